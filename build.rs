@@ -8,6 +8,14 @@ fn main() {
     let dst = PathBuf::from(env::var_os("OUT_DIR").unwrap()).join("mesa");
     let _ = fs::create_dir(&dst);
 
+    // swr is picked at runtime, with GALLIUM_DRIVER=swr or the
+    // OSMESA_GALLIUM_DRIVER context attribute
+    let gallium_drivers = if env::var_os("CARGO_FEATURE_SWR").is_some() {
+        "-Dgallium-drivers=swrast,swr"
+    } else {
+        "-Dgallium-drivers=swrast"
+    };
+
     if !dst.join("build.ninja").exists() {
         let mut cmd = Command::new("meson");
 
@@ -23,7 +31,7 @@ fn main() {
             .arg("-Dplatforms=")
             .arg("-Ddri3=disabled")
             .arg("-Dglx-direct=false")
-            .arg("-Dgallium-drivers=swrast")
+            .arg(gallium_drivers)
             .arg("-Dvulkan-drivers=")
             .arg("-Ddri-drivers=")
             .arg("-Dgles1=disabled")
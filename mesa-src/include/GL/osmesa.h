@@ -106,6 +106,17 @@ extern "C" {
 #define OSMESA_COMPAT_PROFILE        0x35
 #define OSMESA_CONTEXT_MAJOR_VERSION 0x36
 #define OSMESA_CONTEXT_MINOR_VERSION 0x37
+#define OSMESA_ZERO_COPY             0x38
+#define OSMESA_THREADED              0x39
+#define OSMESA_COLOR_BUFFERS         0x3A
+#define OSMESA_DEPTH_FLOAT           0x3B
+#define OSMESA_GALLIUM_DRIVER        0x3C
+#define OSMESA_LLVMPIPE              0x3D
+#define OSMESA_SOFTPIPE              0x3E
+#define OSMESA_SWR                   0x3F
+#define OSMESA_TRANSIENT_DEPTH_STENCIL 0x40
+
+#define OSMESA_MAX_COLOR_BUFFERS     4
 
 
 typedef struct osmesa_context *OSMesaContext;
@@ -153,9 +164,54 @@ OSMesaCreateContextExt( GLenum format, GLint depthBits, GLint stencilBits,
  * OSMESA_PROFILE                OSMESA_COMPAT_PROFILE*, OSMESA_CORE_PROFILE
  * OSMESA_CONTEXT_MAJOR_VERSION  1*, 2, 3
  * OSMESA_CONTEXT_MINOR_VERSION  0+
+ * OSMESA_ZERO_COPY              GL_FALSE*, GL_TRUE
+ * OSMESA_THREADED               GL_FALSE*, GL_TRUE
+ * OSMESA_COLOR_BUFFERS          1*, 2, 3, 4
+ * OSMESA_DEPTH_FLOAT            GL_FALSE*, GL_TRUE
+ * OSMESA_GALLIUM_DRIVER         OSMESA_LLVMPIPE*, OSMESA_SOFTPIPE, OSMESA_SWR
+ * OSMESA_TRANSIENT_DEPTH_STENCIL GL_FALSE*, GL_TRUE
  *
  * Note: * = default value
  *
+ * With OSMESA_ZERO_COPY the driver renders directly into the buffer passed
+ * to OSMesaMakeCurrent() when its layout allows it (OSMESA_Y_UP must be
+ * false, the buffer 16-byte aligned and its height a multiple of 4 pixels,
+ * and the row stride must match the driver's, a multiple of 16 bytes for
+ * llvmpipe).  Otherwise, and for drivers that can't wrap client memory,
+ * the image is copied on glFlush/glFinish as usual.
+ *
+ * With OSMESA_COLOR_BUFFERS the default framebuffer has that many color
+ * buffers for OSMesaMakeCurrentBuffers() to attach image buffers to:
+ * GL_FRONT_LEFT, GL_FRONT_RIGHT, GL_BACK_LEFT and GL_BACK_RIGHT, in that
+ * order.  glDrawBuffers() with them writes fragment shader outputs 0 to 3
+ * to the image buffers in a single pass.  The context is stereo, and with
+ * more than two color buffers double-buffered, which makes GL_BACK the
+ * default draw buffer, so call glDrawBuffers() first.  OSMESA_ZERO_COPY
+ * defaults to GL_TRUE for such contexts.
+ *
+ * With OSMESA_GALLIUM_DRIVER the driver is picked, if it was built.  All
+ * contexts render with the driver of the first one created, so null is
+ * returned for another driver than that one.  The GALLIUM_DRIVER
+ * environment variable overrides the attribute.  swr wraps the buffers
+ * for OSMESA_ZERO_COPY when their rows are packed, without stencil.
+ *
+ * With OSMESA_DEPTH_FLOAT the depth buffer holds 32-bit floats, followed
+ * by 32 bits of which the low 8 are stencil if OSMESA_STENCIL_BITS is set,
+ * rather than 24-bit (or 16-bit) unsigned normalized values.
+ *
+ * With OSMESA_TRANSIENT_DEPTH_STENCIL the depth and stencil buffers are
+ * undefined after glFlush, glFinish, a fence or OSMesaGetColorBuffer, and
+ * so is what OSMesaGetDepthBuffer returns.  llvmpipe then keeps them in
+ * its tiles, and only allocates them for frames which read them back or
+ * don't start with a full glClear of depth and stencil.  There is no
+ * effect with OSMesaDepthBuffer().
+ *
+ * With OSMESA_THREADED the GL calls are validated and executed on a thread
+ * of the context's own, glthread, while the application thread queues them.
+ * The OSMesa functions wait for the queued calls, but glFlush doesn't, so
+ * call glFinish (or OSMesaGetColorBuffer) before reading the buffer.  The
+ * OSMESA_THREADED environment variable overrides the attribute.
+ *
  * We return a context version >= what's specified by OSMESA_CONTEXT_MAJOR/
  * MINOR_VERSION for the given profile.  For example, if you request a GL 1.4
  * compat profile, you might get a GL 3.0 compat profile.
@@ -210,6 +266,22 @@ OSMesaMakeCurrent( OSMesaContext ctx, void *buffer, GLenum type,
                    GLsizei width, GLsizei height );
 
 
+/*
+ * Like OSMesaMakeCurrent(), but binding image buffers of the same type and
+ * size to each of the first count color buffers of the context, see
+ * OSMESA_COLOR_BUFFERS.  buffers[0] is the GL_FRONT_LEFT one, which
+ * OSMesaGetColorBuffer() returns; the others may be NULL for color buffers
+ * without an image buffer.  Those not rendered in place are all written on
+ * glFlush/glFinish, once GL_FRONT_LEFT was drawn to.
+ * OSMesaSwapBuffersAsync() isn't supported with
+ * more than one color buffer.
+ * New in Mesa 20.3
+ */
+GLAPI GLboolean GLAPIENTRY
+OSMesaMakeCurrentBuffers(OSMesaContext ctx, GLint count, void *const *buffers,
+                         GLenum type, GLsizei width, GLsizei height);
+
+
 
 
 /*
@@ -324,6 +396,297 @@ OSMesaPostprocess(OSMesaContext osmesa, const char *filter,
                   unsigned enable_value);
 
 
+typedef struct osmesa_frame *OSMesaFrame;
+
+
+/**
+ * Submit the rendering done into the current buffer without waiting for
+ * it to complete, and make next_buffer current in its place.  next_buffer
+ * must have the same type and size as the current buffer, so rendering
+ * into a ring of two or three buffers lets the next frame be rasterized
+ * while the previous one is consumed.
+ * Returns a frame handle which must be passed to OSMesaWaitFrame() before
+ * the previous buffer's contents are valid, or NULL on error.
+ * New in Mesa 20.3
+ */
+GLAPI OSMesaFrame GLAPIENTRY
+OSMesaSwapBuffersAsync(OSMesaContext osmesa, void *next_buffer);
+
+
+/**
+ * Wait up to timeout nanoseconds (zero to poll) for a frame returned by
+ * OSMesaSwapBuffersAsync() to complete.  On success the frame's buffer
+ * holds the rendered image, the handle is released and GL_TRUE is
+ * returned.  On timeout GL_FALSE is returned and the frame stays pending.
+ * New in Mesa 20.3
+ */
+GLAPI GLboolean GLAPIENTRY
+OSMesaWaitFrame(OSMesaContext osmesa, OSMesaFrame frame, GLuint64 timeout);
+
+
+/**
+ * Write the set of shader variants compiled so far to a manifest file.
+ * Returns GL_FALSE on error, or if the driver doesn't support manifests.
+ * New in Mesa 20.3
+ */
+GLAPI GLboolean GLAPIENTRY
+OSMesaSaveShaderManifest(const char *filename);
+
+
+/**
+ * Load a manifest written by OSMesaSaveShaderManifest(), usually by an
+ * earlier process.  The shader variants it lists are then compiled as
+ * soon as their shaders are created, instead of at their first draw.
+ * Call it before creating any shaders.  Returns GL_FALSE on error, or if
+ * the manifest was written by a different build.
+ * New in Mesa 20.3
+ */
+GLAPI GLboolean GLAPIENTRY
+OSMesaLoadShaderManifest(const char *filename);
+
+
+/**
+ * Write the compiled shader code the driver keeps, along with its
+ * manifest, to a file.  Written after rendering a representative frame,
+ * e.g. when the application is packaged, it lets later processes on the
+ * same build and CPU load the code of those shaders, including the
+ * internal ones of clears and blits, instead of compiling it.  llvmpipe
+ * loads it at startup from the LP_SHADER_CACHE_FILE environment variable.
+ * Returns GL_FALSE on error, or if the driver doesn't support it.
+ * New in Mesa 20.3
+ */
+GLAPI GLboolean GLAPIENTRY
+OSMesaSaveShaderCache(const char *filename);
+
+
+/**
+ * Load a file written by OSMesaSaveShaderCache().  Call it before
+ * creating any shaders.  Returns GL_FALSE on error, or if the file was
+ * written by a different build or for a different CPU.
+ * New in Mesa 20.3
+ */
+GLAPI GLboolean GLAPIENTRY
+OSMesaLoadShaderCache(const char *filename);
+
+
+/**
+ * Read the index'th driver statistic, e.g. a performance counter of
+ * llvmpipe's (see LP_PERF=counters).  Either name or value may be NULL.
+ * The value is cumulative since the counter was enabled; indices run from
+ * zero until GL_FALSE is returned.
+ * New in Mesa 20.3
+ */
+GLAPI GLboolean GLAPIENTRY
+OSMesaGetStats(OSMesaContext osmesa, GLuint index,
+               const char **name, GLuint64 *value);
+
+
+typedef void (*OSMESAhudproc)(void *data, const char *name, double value);
+
+/**
+ * Sample the graphs of a GALLIUM_HUD configuration string, e.g.
+ * "fps,cpu,primitives-generated", without drawing them.  Values are taken
+ * at every front buffer flush (glFinish / glFlush), at the rate set by the
+ * configuration's period, and passed to callback if it isn't NULL, and
+ * written to the GALLIUM_HUD_DUMP_DIR files if that is set.  A NULL config
+ * stops recording.  GALLIUM_HUD sets up the same for every new context.
+ * New in Mesa 20.3
+ */
+GLAPI GLboolean GLAPIENTRY
+OSMesaRecordHUD(OSMesaContext osmesa, const char *config,
+                OSMESAhudproc callback, void *data);
+
+
+/**
+ * Free the framebuffers OSMesa keeps for the image buffer, with their
+ * color/depth/accum textures, or those of all image buffers if buffer is
+ * NULL.  Framebuffers still current in a context (unbind with
+ * OSMesaMakeCurrent(NULL, NULL, 0, 0, 0) or bind another buffer), or with
+ * frames in flight, are kept.  Otherwise the least recently bound ones are
+ * freed once they take more than OSMESA_BUFFER_CACHE_MB, 256 by default.
+ * New in Mesa 20.3
+ */
+GLAPI void GLAPIENTRY
+OSMesaDestroyBuffer(void *buffer);
+
+
+/**
+ * Return a context to the state of a newly created one, dropping its GL
+ * state and objects, much faster than destroying it and creating a new
+ * one: the driver's context, with its allocations and compiled shaders,
+ * is kept.  OSMesaPixelStore() settings are reset too.  If the context is
+ * current it stays current with the same image buffer.
+ * Contexts created with a sharelist can't be reset.
+ * Return GL_FALSE on failure, after which the context can only be
+ * destroyed.
+ * New in Mesa 20.3
+ */
+GLAPI GLboolean GLAPIENTRY
+OSMesaResetContext(OSMesaContext osmesa);
+
+
+/**
+ * Have the depth (and stencil) buffers of the context's image buffers
+ * written to buffer, from now on if the context is current, or NULL to
+ * go back to OSMesa's own.  The values are as OSMesaGetDepthBuffer()
+ * returns them, 2, 4 or 8 bytes each (see OSMESA_DEPTH_FLOAT), with the
+ * rows as for the color buffer: OSMESA_ROW_LENGTH values apart, bottom
+ * first if OSMESA_Y_UP.  Like with OSMESA_ZERO_COPY, the driver renders
+ * straight into the buffer if it can, else it is written on
+ * glFlush/glFinish.  The context must have a depth or stencil buffer.
+ * New in Mesa 20.3
+ */
+GLAPI GLboolean GLAPIENTRY
+OSMesaDepthBuffer(OSMesaContext osmesa, void *buffer);
+
+
+/**
+ * Return the region of the current color buffer which the last
+ * glFlush/glFinish wrote to the user's image buffer, or which was rendered
+ * to in place.  The driver tracks it in whole tiles, so it may be larger
+ * than what was drawn.  It is the whole buffer when that isn't tracked, or
+ * when the image buffer isn't the one last written.  y counts rows of the
+ * image buffer, as laid out in memory.  The width and height are 0 if
+ * nothing was drawn.
+ * Returns GL_FALSE if there is no current buffer.
+ * New in Mesa 20.3
+ */
+GLAPI GLboolean GLAPIENTRY
+OSMesaGetDirtyRegion(OSMesaContext osmesa, GLint *x, GLint *y,
+                     GLint *width, GLint *height);
+
+
+/**
+ * The start of the memory of a buffer from OSMesaCreateSharedBuffer(),
+ * which other processes map from its file descriptor.  The image is
+ * offset bytes in, height rows stride bytes apart, in format and type.
+ * sequence is incremented once a glFlush/glFinish (or OSMesaWaitFrame)
+ * has written a frame to the image, and on Linux the waiters of the futex
+ * at its address are woken.  y_up and dirty (x, y, width, height, see
+ * OSMesaGetDirtyRegion()) describe that frame.
+ */
+#define OSMESA_SHARED_MAGIC 0x534d534f  /* "OSMS" */
+
+typedef struct osmesa_shared_header {
+   GLuint magic;
+   GLuint sequence;
+   GLuint offset;
+   GLuint stride;
+   GLint width, height;
+   GLenum format, type;
+   GLint y_up;
+   GLint dirty[4];
+} OSMesaSharedHeader;
+
+
+/**
+ * Create an image buffer for the context's format, of the given type and
+ * size, on an anonymous shared memory file, and return its image, to pass
+ * to OSMesaMakeCurrent().  If fd isn't NULL it gets the file descriptor,
+ * which OSMesa owns, to be sent to the processes which read the frames;
+ * the OSMesaSharedHeader is at its start.  The rows are laid out as the
+ * driver renders them, so with OSMESA_Y_UP false it renders in place
+ * without a copy to the image, whatever OSMESA_ZERO_COPY, and
+ * OSMESA_ROW_LENGTH is ignored.
+ * Returns NULL on error, or where shared memory isn't supported.
+ * New in Mesa 20.3
+ */
+GLAPI void * GLAPIENTRY
+OSMesaCreateSharedBuffer(OSMesaContext osmesa, GLenum type,
+                         GLsizei width, GLsizei height, int *fd);
+
+
+/**
+ * Unmap and close a buffer from OSMesaCreateSharedBuffer(), which must
+ * not be current to any context anymore.
+ * New in Mesa 20.3
+ */
+GLAPI void GLAPIENTRY
+OSMesaDestroySharedBuffer(void *buffer);
+
+
+typedef void (GLAPIENTRYP OSMESAprogressproc)(void *data, GLint rows);
+
+/**
+ * Have func called with data as the rendering to the current image buffer
+ * gets done, from the top down, so that its first rows can be used while
+ * the others are still being drawn.  rows is how many rows at the start of
+ * the buffer all the rendering flushed so far has been written to.  It is
+ * called from the driver's threads, in order, with growing counts, in
+ * steps of the driver's tiles, up to the height for each flush, and it
+ * should return quickly.  This only works for image buffers which are
+ * rendered in place, see OSMESA_ZERO_COPY and OSMesaCreateSharedBuffer(),
+ * and it lasts until another image buffer is made current instead.
+ * A NULL func stops it, and once this returns the old one isn't called
+ * anymore.
+ * Returns GL_FALSE if there is no current buffer, the driver doesn't
+ * support it, or the buffer isn't rendered in place.
+ * New in Mesa 20.3
+ */
+GLAPI GLboolean GLAPIENTRY
+OSMesaProgressCallback(OSMesaContext osmesa, OSMESAprogressproc func,
+                       void *data);
+
+
+typedef void (GLAPIENTRYP OSMESAdrawproc)(void *data);
+typedef void (GLAPIENTRYP OSMESAregionproc)(void *data, GLint x, GLint y,
+                                            GLsizei width, GLsizei height);
+
+/**
+ * Render an image of width x height pixels, which may be bigger than the
+ * maximum framebuffer size, in regions of at most regionWidth x
+ * regionHeight pixels.  Each region is rendered into buffer, which must
+ * hold one of them, made current with OSMesaMakeCurrent() at the region's
+ * size, and region_done is called with its position in the image, in
+ * window coordinates (y up), and size once the buffer holds its pixels.
+ *
+ * draw renders the scene as for a regionWidth x regionHeight window, which
+ * is stretched to the whole image: its viewports and scissors are mapped
+ * to the regions.  So the projection should be set up for the aspect
+ * ratio of the image.  With a compatibility profile context, the calls of
+ * draw are recorded in a display list while rendering the first region,
+ * and the list is replayed for the others, else draw is called for each.
+ * Either way each region should start from the same state.  Window
+ * coordinate operations other than drawing and glClear, like glRasterPos,
+ * glReadPixels or gl_FragCoord, see the region as the whole window.
+ * The context stays current to buffer, at the last region's size.
+ * Returns GL_FALSE on error.
+ * New in Mesa 20.3
+ */
+GLAPI GLboolean GLAPIENTRY
+OSMesaRenderRegions(OSMesaContext osmesa, void *buffer, GLenum type,
+                    GLsizei width, GLsizei height,
+                    GLsizei regionWidth, GLsizei regionHeight,
+                    OSMESAdrawproc draw, OSMESAregionproc region_done,
+                    void *data);
+
+
+/**
+ * Estimate the bytes of memory the driver holds for the context alone,
+ * i.e. its shader variants, scenes and vertex buffers, and for the
+ * screen, which all the contexts share, i.e. textures, buffers and the
+ * shader variants of all the contexts.  Either may be NULL.  Returns
+ * GL_FALSE if the driver can't tell (llvmpipe can).
+ * New in Mesa 20.3
+ */
+GLAPI GLboolean GLAPIENTRY
+OSMesaGetMemoryUsage(OSMesaContext osmesa, GLuint64 *context_bytes,
+                     GLuint64 *screen_bytes);
+
+
+/**
+ * Set how many bytes the context alone should hold, as reported by
+ * OSMesaGetMemoryUsage(), 0 for no limit, the default.  Over it, the
+ * driver frees its cached buffers at flushes, and its least recently
+ * used shaders when compiling new ones, which are compiled again when
+ * needed.  It is a target, not a hard limit.  Returns GL_FALSE if the
+ * driver doesn't support it.
+ * New in Mesa 20.3
+ */
+GLAPI GLboolean GLAPIENTRY
+OSMesaSetMemoryBudget(OSMesaContext osmesa, GLuint64 bytes);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -7637,6 +7637,12 @@ builtin_builder::_helper_invocation()
 
 /* The singleton instance of builtin_builder. */
 static builtin_builder builtins;
+
+/**
+ * Only guards initialize() and release().  The built-in shader isn't changed
+ * in between, and every caller of the lookups below holds a reference, so
+ * compiler threads look built-ins up concurrently without taking it.
+ */
 static mtx_t builtins_lock = _MTX_INITIALIZER_NP;
 static uint32_t builtin_users = 0;
 
@@ -7667,32 +7673,21 @@ ir_function_signature *
 _mesa_glsl_find_builtin_function(_mesa_glsl_parse_state *state,
                                  const char *name, exec_list *actual_parameters)
 {
-   ir_function_signature *s;
-   mtx_lock(&builtins_lock);
-   s = builtins.find(state, name, actual_parameters);
-   mtx_unlock(&builtins_lock);
-
-   return s;
+   return builtins.find(state, name, actual_parameters);
 }
 
 bool
 _mesa_glsl_has_builtin_function(_mesa_glsl_parse_state *state, const char *name)
 {
-   ir_function *f;
-   bool ret = false;
-   mtx_lock(&builtins_lock);
-   f = builtins.shader->symbols->get_function(name);
+   ir_function *f = builtins.shader->symbols->get_function(name);
    if (f != NULL) {
       foreach_in_list(ir_function_signature, sig, &f->signatures) {
-         if (sig->is_builtin_available(state)) {
-            ret = true;
-            break;
-         }
+         if (sig->is_builtin_available(state))
+            return true;
       }
    }
-   mtx_unlock(&builtins_lock);
 
-   return ret;
+   return false;
 }
 
 gl_shader *
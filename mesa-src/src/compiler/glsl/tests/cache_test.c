@@ -474,6 +474,177 @@ test_put_key_and_get_key(void)
 
    disk_cache_destroy(cache);
 }
+
+static void
+test_archive_put_and_get(bool compressed)
+{
+   struct disk_cache *cache;
+   char blob[] = "This is a blob of thirty-seven bytes";
+   uint8_t blob_key[20];
+   uint8_t *one_KB;
+   uint8_t one_KB_key[20], first_KB_key[20];
+   char *result;
+   size_t size;
+   int i;
+
+   setenv("MESA_GLSL_CACHE_ARCHIVE", "true", 1);
+   setenv("MESA_GLSL_CACHE_ARCHIVE_UNCOMPRESSED", compressed ? "false" : "true", 1);
+   setenv("MESA_GLSL_CACHE_MAX_SIZE", "64K", 1);
+   cache = disk_cache_create("test", "make_check", 0);
+
+   disk_cache_compute_key(cache, blob, sizeof(blob), blob_key);
+
+   result = disk_cache_get(cache, blob_key, &size);
+   expect_null(result, "archive get with non-existent item (pointer)");
+   expect_equal(size, 0, "archive get with non-existent item (size)");
+
+   disk_cache_put(cache, blob_key, blob, sizeof(blob), NULL);
+   disk_cache_wait_for_idle(cache);
+
+   result = disk_cache_get(cache, blob_key, &size);
+   expect_equal_str(blob, result, "archive get of existing item (pointer)");
+   expect_equal(size, sizeof(blob), "archive get of existing item (size)");
+   free(result);
+
+   /* A second cache on the same archive sees the item. */
+   disk_cache_destroy(cache);
+   cache = disk_cache_create("test", "make_check", 0);
+   expect_equal(does_cache_contain(cache, blob_key), true,
+                "archive item survives reopening");
+
+   disk_cache_remove(cache, blob_key);
+   expect_equal(does_cache_contain(cache, blob_key), false,
+                "archive item is gone after disk_cache_remove");
+
+   /* Write well past MAX_SIZE so the archive wraps around. */
+   one_KB = calloc(1, 1024);
+   for (i = 0; i < 256; i++) {
+      one_KB[0] = i;
+      one_KB[1] = i >> 8;
+      one_KB[2] = compressed;
+      disk_cache_compute_key(cache, one_KB, 1024, one_KB_key);
+      if (i == 0)
+         memcpy(first_KB_key, one_KB_key, sizeof(one_KB_key));
+      disk_cache_put(cache, one_KB_key, one_KB, 1024, NULL);
+      disk_cache_wait_for_idle(cache);
+   }
+
+   result = disk_cache_get(cache, one_KB_key, &size);
+   expect_non_null(result, "archive get of the last item after wrapping");
+   expect_equal(size, 1024, "archive get of the last item after wrapping (size)");
+   free(result);
+
+   if (!compressed) {
+      expect_equal(does_cache_contain(cache, first_KB_key), false,
+                   "archive wrapping drops the first item");
+   }
+
+   free(one_KB);
+   disk_cache_destroy(cache);
+
+   unsetenv("MESA_GLSL_CACHE_ARCHIVE");
+   unsetenv("MESA_GLSL_CACHE_ARCHIVE_UNCOMPRESSED");
+   unsetenv("MESA_GLSL_CACHE_MAX_SIZE");
+}
+
+static void
+test_xxh64_keys_and_miss_filter(void)
+{
+   struct disk_cache *cache;
+   char blob[] = "This is a blob of thirty-seven bytes";
+   char other_blob[] = "This blob was never put in the cache";
+   uint8_t blob_key[20], sha1_key[20], other_key[20];
+   char *result;
+   size_t size;
+
+   cache = disk_cache_create("test", "make_check", 0);
+   disk_cache_compute_key(cache, blob, sizeof(blob), sha1_key);
+   disk_cache_destroy(cache);
+
+   setenv("MESA_GLSL_CACHE_KEY_HASH", "xxh64", 1);
+   setenv("MESA_GLSL_CACHE_MISS_FILTER", "true", 1);
+   cache = disk_cache_create("test", "make_check", 0);
+
+   disk_cache_compute_key(cache, blob, sizeof(blob), blob_key);
+   expect_true(memcmp(blob_key, sha1_key, sizeof(blob_key)) != 0,
+               "xxh64 keys differ from sha1 keys");
+
+   disk_cache_put(cache, blob_key, blob, sizeof(blob), NULL);
+   disk_cache_wait_for_idle(cache);
+
+   result = disk_cache_get(cache, blob_key, &size);
+   expect_equal_str(blob, result, "get of item put with the filter (pointer)");
+   expect_equal(size, sizeof(blob), "get of item put with the filter (size)");
+   free(result);
+
+   /* A new cache fills its filter from the directory. */
+   disk_cache_destroy(cache);
+   cache = disk_cache_create("test", "make_check", 0);
+   disk_cache_wait_for_idle(cache);
+
+   result = disk_cache_get(cache, blob_key, &size);
+   expect_equal_str(blob, result, "get of item found by the filter scan");
+   free(result);
+
+   disk_cache_compute_key(cache, other_blob, sizeof(other_blob), other_key);
+   result = disk_cache_get(cache, other_key, &size);
+   expect_null(result, "get of item missing from the filter");
+
+   disk_cache_destroy(cache);
+
+   unsetenv("MESA_GLSL_CACHE_KEY_HASH");
+   unsetenv("MESA_GLSL_CACHE_MISS_FILTER");
+}
+
+static void
+test_bundles(void)
+{
+   struct disk_cache *cache;
+   char blob[] = "This is a blob of thirty-seven bytes";
+   uint8_t blob_key[20];
+   char *result;
+   size_t size;
+   int err;
+
+   /* Bake a bundle by filling an archive. */
+   setenv("MESA_GLSL_CACHE_ARCHIVE", "true", 1);
+   setenv("MESA_GLSL_CACHE_MAX_SIZE", "64K", 1);
+   cache = disk_cache_create("test", "make_check", 0);
+   disk_cache_compute_key(cache, blob, sizeof(blob), blob_key);
+   disk_cache_put(cache, blob_key, blob, sizeof(blob), NULL);
+   disk_cache_destroy(cache);
+   unsetenv("MESA_GLSL_CACHE_ARCHIVE");
+   unsetenv("MESA_GLSL_CACHE_MAX_SIZE");
+
+   err = rename(CACHE_TEST_TMP "/mesa-glsl-cache-dir/mesa_shader_cache/archive",
+                CACHE_TEST_TMP "/bundle");
+   expect_equal(err, 0, "Moving the archive to a bundle");
+
+   /* The bundle works without a usable cache directory. */
+   setenv("MESA_GLSL_CACHE_DIR", "/dev/null/no-such-dir", 1);
+   setenv("MESA_GLSL_CACHE_BUNDLES",
+          CACHE_TEST_TMP "/missing:" CACHE_TEST_TMP "/bundle", 1);
+   cache = disk_cache_create("test", "make_check", 0);
+
+   expect_true(disk_cache_has_key(cache, blob_key), "bundle has_key");
+
+   result = disk_cache_get(cache, blob_key, &size);
+   expect_equal_str(blob, result, "bundle get of existing item (pointer)");
+   expect_equal(size, sizeof(blob), "bundle get of existing item (size)");
+   free(result);
+
+   disk_cache_destroy(cache);
+
+   /* Other drivers do not see it. */
+   cache = disk_cache_create("test", "other_driver", 0);
+   disk_cache_compute_key(cache, blob, sizeof(blob), blob_key);
+   result = disk_cache_get(cache, blob_key, &size);
+   expect_null(result, "bundle get from another driver");
+   disk_cache_destroy(cache);
+
+   unsetenv("MESA_GLSL_CACHE_BUNDLES");
+   setenv("MESA_GLSL_CACHE_DIR", CACHE_TEST_TMP "/mesa-glsl-cache-dir", 1);
+}
 #endif /* ENABLE_SHADER_CACHE */
 
 int
@@ -488,6 +659,14 @@ main(void)
 
    test_put_key_and_get_key();
 
+   test_archive_put_and_get(true);
+
+   test_archive_put_and_get(false);
+
+   test_xxh64_keys_and_miss_filter();
+
+   test_bundles();
+
    err = rmrf_local(CACHE_TEST_TMP);
    expect_equal(err, 0, "Removing " CACHE_TEST_TMP " again");
 #endif /* ENABLE_SHADER_CACHE */
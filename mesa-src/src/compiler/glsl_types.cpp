@@ -26,6 +26,7 @@
 #include "compiler/glsl/glsl_parser_extras.h"
 #include "glsl_types.h"
 #include "util/hash_table.h"
+#include "util/u_atomic.h"
 #include "util/u_string.h"
 
 
@@ -43,6 +44,38 @@ hash_table *glsl_type::subroutine_types = NULL;
  */
 static uint32_t glsl_type_users = 0;
 
+#ifdef USE_ELF_TLS
+/**
+ * Per-thread caches in front of explicit_matrix_types and array_types, so
+ * that the lookups compiler threads keep doing don't take hash_mutex.
+ *
+ * Types are only freed once the last user is gone, which bumps
+ * glsl_type_generation: a cache is emptied on its next use after that.
+ */
+#define TYPE_CACHE_SIZE 64
+
+struct glsl_type_cache {
+   uint32_t generation;
+   const glsl_type *types[TYPE_CACHE_SIZE];
+};
+
+static uint32_t glsl_type_generation = 1;
+static __thread struct glsl_type_cache explicit_matrix_type_cache;
+static __thread struct glsl_type_cache array_type_cache;
+
+static inline struct glsl_type_cache *
+get_type_cache(struct glsl_type_cache *cache)
+{
+   const uint32_t generation = p_atomic_read(&glsl_type_generation);
+
+   if (unlikely(cache->generation != generation)) {
+      memset(cache->types, 0, sizeof(cache->types));
+      cache->generation = generation;
+   }
+   return cache;
+}
+#endif
+
 glsl_type::glsl_type(GLenum gl_type,
                      glsl_base_type base_type, unsigned vector_elements,
                      unsigned matrix_columns, const char *name,
@@ -557,6 +590,10 @@ glsl_type_singleton_decref()
       glsl_type::subroutine_types = NULL;
    }
 
+#ifdef USE_ELF_TLS
+   p_atomic_inc(&glsl_type_generation);
+#endif
+
    mtx_unlock(&glsl_type::hash_mutex);
 }
 
@@ -661,6 +698,21 @@ glsl_type::get_instance(unsigned base_type, unsigned rows, unsigned columns,
     * table so they're handled separately.
     */
    if (explicit_stride > 0) {
+#ifdef USE_ELF_TLS
+      struct glsl_type_cache *cache =
+         get_type_cache(&explicit_matrix_type_cache);
+      const unsigned slot = (base_type * 97 + rows * 13 + columns * 5 +
+                             explicit_stride + row_major) % TYPE_CACHE_SIZE;
+      const glsl_type *cached = cache->types[slot];
+
+      if (cached && cached->base_type == base_type &&
+          cached->vector_elements == rows &&
+          cached->matrix_columns == columns &&
+          cached->explicit_stride == explicit_stride &&
+          cached->interface_row_major == row_major)
+         return cached;
+#endif
+
       const glsl_type *bare_type = get_instance(base_type, rows, columns);
 
       assert(columns > 1 || !row_major);
@@ -699,6 +751,10 @@ glsl_type::get_instance(unsigned base_type, unsigned rows, unsigned columns,
 
       mtx_unlock(&glsl_type::hash_mutex);
 
+#ifdef USE_ELF_TLS
+      cache->types[slot] = t;
+#endif
+
       return t;
    }
 
@@ -1030,6 +1086,18 @@ glsl_type::get_array_instance(const glsl_type *base,
                               unsigned array_size,
                               unsigned explicit_stride)
 {
+#ifdef USE_ELF_TLS
+   struct glsl_type_cache *cache = get_type_cache(&array_type_cache);
+   const unsigned slot = (((uintptr_t) base >> 4) ^ (array_size * 31) ^
+                          explicit_stride) % TYPE_CACHE_SIZE;
+   const glsl_type *cached = cache->types[slot];
+
+   if (cached && cached->fields.array == base &&
+       cached->length == array_size &&
+       cached->explicit_stride == explicit_stride)
+      return cached;
+#endif
+
    /* Generate a name using the base type pointer in the key.  This is
     * done because the name of the base type may not be unique across
     * shaders.  For example, two shaders may have different record types
@@ -1064,6 +1132,10 @@ glsl_type::get_array_instance(const glsl_type *base,
 
    mtx_unlock(&glsl_type::hash_mutex);
 
+#ifdef USE_ELF_TLS
+   cache->types[slot] = t;
+#endif
+
    return t;
 }
 
@@ -28,6 +28,7 @@
 #include "nir.h"
 #include "nir_builder.h"
 #include "nir_control_flow_private.h"
+#include "util/debug.h"
 #include "util/half_float.h"
 #include <limits.h>
 #include <assert.h>
@@ -36,6 +37,15 @@
 
 #include "main/menums.h" /* BITFIELD64_MASK */
 
+static bool
+nir_arena_enabled(void)
+{
+   static int enabled = -1;
+   if (enabled < 0)
+      enabled = env_var_as_boolean("NIR_ARENA", false);
+   return enabled;
+}
+
 nir_shader *
 nir_shader_create(void *mem_ctx,
                   gl_shader_stage stage,
@@ -62,6 +72,9 @@ nir_shader_create(void *mem_ctx,
    shader->num_uniforms = 0;
    shader->num_shared = 0;
 
+   if (nir_arena_enabled())
+      shader->arena = linear_alloc_parent(shader, 0);
+
    return shader;
 }
 
@@ -405,9 +418,19 @@ instr_init(nir_instr *instr, nir_instr_type type)
 {
    instr->type = type;
    instr->block = NULL;
+   instr->arena = false;
    exec_node_init(&instr->node);
 }
 
+/* Only for instructions that nothing is ever ralloc'd against */
+static void *
+leaf_instr_zalloc(nir_shader *shader, size_t size)
+{
+   if (shader->arena)
+      return linear_zalloc_child(shader->arena, size);
+   return rzalloc_size(shader, size);
+}
+
 static void
 dest_init(nir_dest *dest)
 {
@@ -490,8 +513,10 @@ nir_load_const_instr_create(nir_shader *shader, unsigned num_components,
                             unsigned bit_size)
 {
    nir_load_const_instr *instr =
-      rzalloc_size(shader, sizeof(*instr) + num_components * sizeof(*instr->value));
+      leaf_instr_zalloc(shader, sizeof(*instr) +
+                                num_components * sizeof(*instr->value));
    instr_init(&instr->instr, nir_instr_type_load_const);
+   instr->instr.arena = shader->arena != NULL;
 
    nir_ssa_def_init(&instr->instr, &instr->def, num_components, bit_size, NULL);
 
@@ -638,8 +663,10 @@ nir_ssa_undef_instr_create(nir_shader *shader,
                            unsigned num_components,
                            unsigned bit_size)
 {
-   nir_ssa_undef_instr *instr = ralloc(shader, nir_ssa_undef_instr);
+   nir_ssa_undef_instr *instr =
+      leaf_instr_zalloc(shader, sizeof(nir_ssa_undef_instr));
    instr_init(&instr->instr, nir_instr_type_ssa_undef);
+   instr->instr.arena = shader->arena != NULL;
 
    nir_ssa_def_init(&instr->instr, &instr->def, num_components, bit_size, NULL);
 
@@ -725,6 +725,9 @@ typedef struct nir_instr {
     */
    uint8_t pass_flags;
 
+   /** Allocated from nir_shader::arena rather than with ralloc */
+   bool arena;
+
    /** generic instruction index. */
    unsigned index;
 } nir_instr;
@@ -3328,6 +3331,13 @@ typedef struct nir_shader {
    void *constant_data;
    /** Size of the constant data associated with the shader, in bytes */
    unsigned constant_data_size;
+
+   /**
+    * Linear allocator for load_const and ssa_undef instructions, see
+    * NIR_ARENA, or NULL.  These can't be ralloc_steal()ed or freed one by
+    * one; nir_sweep() keeps them all and they go away with the shader.
+    */
+   void *arena;
 } nir_shader;
 
 #define nir_foreach_function(func, shader) \
@@ -3908,6 +3918,21 @@ static inline bool should_serialize_deserialize_nir(void) { return false; }
 static inline bool should_print_nir(void) { return false; }
 #endif /* NDEBUG */
 
+/* Per-pass timing, see NIR_PASS_STATS in nir_pass_stats.c. */
+bool nir_pass_stats_enabled(void);
+int64_t nir_pass_stats_time(void);
+void nir_pass_stats_record(const char *name, gl_shader_stage stage,
+                           int64_t start, bool progress);
+void nir_pass_stats_reset(void);
+void nir_pass_stats_dump(FILE *fp);
+
+/** Start time to pass to nir_pass_stats_record(), 0 if stats are off. */
+static inline int64_t
+nir_pass_stats_begin(void)
+{
+   return nir_pass_stats_enabled() ? nir_pass_stats_time() : 0;
+}
+
 #define _PASS(pass, nir, do_pass) do {                               \
    if (should_skip_nir(#pass)) {                                     \
       printf("skipping %s\n", #pass);                                \
@@ -3928,7 +3953,12 @@ static inline bool should_print_nir(void) { return false; }
    nir_metadata_set_validation_flag(nir);                            \
    if (should_print_nir())                                           \
       printf("%s\n", #pass);                                         \
-   if (pass(nir, ##__VA_ARGS__)) {                                   \
+   const int64_t _pass_start = nir_pass_stats_begin();               \
+   const bool _pass_progress = pass(nir, ##__VA_ARGS__);             \
+   if (_pass_start)                                                  \
+      nir_pass_stats_record(#pass, (nir)->info.stage, _pass_start,   \
+                            _pass_progress);                         \
+   if (_pass_progress) {                                             \
       progress = true;                                               \
       if (should_print_nir())                                        \
          nir_print_shader(nir, stdout);                              \
@@ -3939,7 +3969,11 @@ static inline bool should_print_nir(void) { return false; }
 #define NIR_PASS_V(nir, pass, ...) _PASS(pass, nir,                  \
    if (should_print_nir())                                           \
       printf("%s\n", #pass);                                         \
+   const int64_t _pass_start = nir_pass_stats_begin();               \
    pass(nir, ##__VA_ARGS__);                                         \
+   if (_pass_start)                                                  \
+      nir_pass_stats_record(#pass, (nir)->info.stage, _pass_start,   \
+                            false);                                  \
    if (should_print_nir())                                           \
       nir_print_shader(nir, stdout);                                 \
 )
@@ -4299,6 +4333,12 @@ bool nir_lower_fragcoord_wtrans(nir_shader *shader);
 void nir_lower_viewport_transform(nir_shader *shader);
 bool nir_lower_uniforms_to_ubo(nir_shader *shader, int multiplier);
 
+unsigned nir_find_inlinable_uniforms(const nir_shader *shader,
+                                     uint16_t *dw_offsets, unsigned max);
+bool nir_inline_uniforms(nir_shader *shader, unsigned num_uniforms,
+                         const uint32_t *uniform_values,
+                         const uint16_t *uniform_dw_offsets);
+
 typedef struct nir_lower_subgroups_options {
    uint8_t subgroup_size;
    uint8_t ballot_bit_size;
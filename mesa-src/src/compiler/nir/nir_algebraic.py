@@ -1057,8 +1057,8 @@ _algebraic_pass_template = mako.template.Template("""
 
 /* What follows is NIR algebraic transform code for the following ${len(xforms)}
  * transforms:
-% for xform in xforms:
- *    ${xform.search} => ${xform.replace}
+% for i, xform in enumerate(xforms):
+ *    ${i}: ${xform.search} => ${xform.replace}
 % endfor
  */
 
@@ -1072,7 +1072,7 @@ _algebraic_pass_template = mako.template.Template("""
 % if state_xforms: # avoid emitting a 0-length array for MSVC
 static const struct transform ${pass_name}_state${state_id}_xforms[] = {
 % for i in state_xforms:
-  { ${xforms[i].search.c_ptr(cache)}, ${xforms[i].replace.c_value_ptr(cache)}, ${xforms[i].condition_index} },
+  { ${xforms[i].search.c_ptr(cache)}, ${xforms[i].replace.c_value_ptr(cache)}, ${xforms[i].condition_index}, ${i} },
 % endfor
 };
 % endif
@@ -1122,6 +1122,13 @@ const uint16_t ${pass_name}_transform_counts[] = {
 % endfor
 };
 
+/* Per state, the OR of the destination bit sizes its transforms can match */
+const uint8_t ${pass_name}_transform_bit_sizes[] = {
+% for mask in state_bit_sizes:
+   ${hex(mask)},
+% endfor
+};
+
 bool
 ${pass_name}(nir_shader *shader)
 {
@@ -1138,9 +1145,11 @@ ${pass_name}(nir_shader *shader)
 
    nir_foreach_function(function, shader) {
       if (function->impl) {
-         progress |= nir_algebraic_impl(function->impl, condition_flags,
+         progress |= nir_algebraic_impl(function->impl, "${pass_name}",
+                                        condition_flags,
                                         ${pass_name}_transforms,
                                         ${pass_name}_transform_counts,
+                                        ${pass_name}_transform_bit_sizes,
                                         ${pass_name}_table);
       }
    }
@@ -1207,6 +1216,17 @@ class AlgebraicPass(object):
 
       self.automaton = TreeAutomaton(self.xforms)
 
+      # Bit sizes are 1, 8, 16, 32 or 64, so they can be OR'd into a mask.
+      # It lets nir_algebraic_impl() skip instructions whose opcodes match
+      # but which are of a bit size that none of the transforms are for.
+      self.state_bit_sizes = []
+      for state_xforms in self.automaton.state_patterns:
+         mask = 0
+         for i in state_xforms:
+            bit_size = self.xforms[i].search.get_bit_size()
+            mask |= bit_size if isinstance(bit_size, int) else 0xff
+         self.state_bit_sizes.append(mask)
+
       if error:
          sys.exit(1)
 
@@ -1217,5 +1237,6 @@ class AlgebraicPass(object):
                                              opcode_xforms=self.opcode_xforms,
                                              condition_list=condition_list,
                                              automaton=self.automaton,
+                                             state_bit_sizes=self.state_bit_sizes,
                                              get_c_opcode=get_c_opcode,
                                              itertools=itertools)
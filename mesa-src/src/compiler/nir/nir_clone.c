@@ -788,6 +788,7 @@ nir_shader_replace(nir_shader *dst, nir_shader *src)
 
    /* Re-parent all of src's ralloc children to dst */
    ralloc_adopt(dst, src);
+   ralloc_steal_linear_parent(dst, src->arena);
 
    memcpy(dst, src, sizeof(*dst));
 
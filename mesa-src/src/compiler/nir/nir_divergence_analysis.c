@@ -566,7 +566,7 @@ visit_deref(nir_deref_instr *deref, struct divergence_state *state)
       is_divergent |= deref->parent.ssa->divergent;
       break;
    case nir_deref_type_cast:
-      is_divergent = !nir_variable_mode_is_uniform(deref->var->data.mode) ||
+      is_divergent = !nir_variable_mode_is_uniform(deref->mode) ||
                      deref->parent.ssa->divergent;
       break;
    }
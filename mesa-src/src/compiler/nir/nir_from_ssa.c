@@ -503,7 +503,8 @@ rewrite_ssa_def(nir_ssa_def *def, void *void_state)
        */
       nir_instr *parent_instr = def->parent_instr;
       nir_instr_remove(parent_instr);
-      ralloc_steal(state->dead_ctx, parent_instr);
+      if (!parent_instr->arena)
+         ralloc_steal(state->dead_ctx, parent_instr);
       state->progress = true;
       return true;
    }
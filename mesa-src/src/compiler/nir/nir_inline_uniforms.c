@@ -0,0 +1,318 @@
+/*
+ * Copyright © 2026 Mesa contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Replace loads of a few uniforms by their values, for drivers which compile
+ * variants of a shader for uniforms which rarely change.
+ *
+ * nir_find_inlinable_uniforms() picks the uniforms worth it: those which
+ * decide branches.  Their values make whole branches dead, or give loops
+ * constant bounds, once the shader is optimized again.
+ *
+ * Uniforms are 32-bit loads from UBO 0 at a constant offset, as left by
+ * nir_lower_uniforms_to_ubo().  They are identified by their offset there,
+ * in dwords.
+ */
+
+#include "nir.h"
+#include "nir_builder.h"
+
+/* How far back conditions are traced, as the sources may be shared. */
+#define MAX_DEPTH 16
+
+static bool
+is_uniform_load(const nir_intrinsic_instr *intr)
+{
+   return intr->intrinsic == nir_intrinsic_load_ubo &&
+          intr->dest.is_ssa &&
+          intr->dest.ssa.bit_size == 32 &&
+          nir_src_is_const(intr->src[0]) &&
+          nir_src_as_uint(intr->src[0]) == 0 &&
+          nir_src_is_const(intr->src[1]) &&
+          (nir_src_as_uint(intr->src[1]) & 3) == 0;
+}
+
+/**
+ * Whether the component of the source only depends on constants and
+ * uniforms.  The uniforms are added to dw_offsets, up to max of them.
+ */
+static bool
+src_only_uses_uniforms(const nir_src *src, unsigned component,
+                       uint16_t *dw_offsets, unsigned *num, unsigned max,
+                       unsigned depth)
+{
+   nir_instr *instr;
+
+   if (!src->is_ssa || depth > MAX_DEPTH)
+      return false;
+
+   instr = src->ssa->parent_instr;
+
+   switch (instr->type) {
+   case nir_instr_type_load_const:
+      return true;
+
+   case nir_instr_type_alu: {
+      nir_alu_instr *alu = nir_instr_as_alu(instr);
+      unsigned i, j;
+
+      /* Each component of a vec comes from one source only. */
+      if (nir_op_is_vec(alu->op)) {
+         return src_only_uses_uniforms(&alu->src[component].src,
+                                       alu->src[component].swizzle[0],
+                                       dw_offsets, num, max, depth + 1);
+      }
+
+      for (i = 0; i < nir_op_infos[alu->op].num_inputs; i++) {
+         unsigned input_size = nir_op_infos[alu->op].input_sizes[i];
+
+         /* Per-component ops only read the same component. */
+         if (input_size == 0) {
+            if (!src_only_uses_uniforms(&alu->src[i].src,
+                                        alu->src[i].swizzle[component],
+                                        dw_offsets, num, max, depth + 1))
+               return false;
+            continue;
+         }
+
+         for (j = 0; j < input_size; j++) {
+            if (!src_only_uses_uniforms(&alu->src[i].src,
+                                        alu->src[i].swizzle[j],
+                                        dw_offsets, num, max, depth + 1))
+               return false;
+         }
+      }
+      return true;
+   }
+
+   case nir_instr_type_intrinsic: {
+      nir_intrinsic_instr *intr = nir_instr_as_intrinsic(instr);
+      uint64_t offset;
+      unsigned i;
+
+      if (!is_uniform_load(intr))
+         return false;
+
+      offset = nir_src_as_uint(intr->src[1]) / 4 + component;
+      if (offset > UINT16_MAX)
+         return false;
+
+      for (i = 0; i < *num; i++) {
+         if (dw_offsets[i] == offset)
+            return true;
+      }
+
+      if (*num == max)
+         return false;
+
+      dw_offsets[(*num)++] = offset;
+      return true;
+   }
+
+   default:
+      return false;
+   }
+}
+
+/**
+ * Record the uniforms the component of the source depends on, if it only
+ * depends on constants and uniforms, and they all fit.
+ */
+static bool
+record_uniforms(const nir_src *src, unsigned component,
+                uint16_t *dw_offsets, unsigned *num, unsigned max)
+{
+   uint16_t new_offsets[UINT8_MAX];
+   unsigned new_num = *num;
+
+   assert(max <= ARRAY_SIZE(new_offsets));
+   memcpy(new_offsets, dw_offsets, *num * sizeof(*dw_offsets));
+
+   if (!src_only_uses_uniforms(src, component, new_offsets, &new_num, max, 0))
+      return false;
+
+   memcpy(dw_offsets, new_offsets, new_num * sizeof(*dw_offsets));
+   *num = new_num;
+   return true;
+}
+
+static void
+find_in_cf_list(struct exec_list *cf_list, bool in_loop,
+                uint16_t *dw_offsets, unsigned *num, unsigned max)
+{
+   foreach_list_typed(nir_cf_node, node, node, cf_list) {
+      switch (node->type) {
+      case nir_cf_node_block:
+         break;
+
+      case nir_cf_node_if: {
+         nir_if *nif = nir_cf_node_as_if(node);
+
+         /* In loops, a comparison against a uniform is likely the loop's
+          * bound, even if the other side is the counter.
+          */
+         if (!record_uniforms(&nif->condition, 0, dw_offsets, num, max) &&
+             in_loop && nif->condition.is_ssa &&
+             nif->condition.ssa->parent_instr->type == nir_instr_type_alu) {
+            nir_alu_instr *alu =
+               nir_instr_as_alu(nif->condition.ssa->parent_instr);
+            unsigned i;
+
+            if (nir_alu_instr_is_comparison(alu)) {
+               for (i = 0; i < nir_op_infos[alu->op].num_inputs; i++) {
+                  record_uniforms(&alu->src[i].src, alu->src[i].swizzle[0],
+                                  dw_offsets, num, max);
+               }
+            }
+         }
+
+         find_in_cf_list(&nif->then_list, in_loop, dw_offsets, num, max);
+         find_in_cf_list(&nif->else_list, in_loop, dw_offsets, num, max);
+         break;
+      }
+
+      case nir_cf_node_loop:
+         find_in_cf_list(&nir_cf_node_as_loop(node)->body, true,
+                         dw_offsets, num, max);
+         break;
+
+      default:
+         unreachable("unknown cf node type");
+      }
+   }
+}
+
+/**
+ * Find up to max uniforms which decide the branches of the shader, in the
+ * order they appear.
+ *
+ * \return how many were written to dw_offsets
+ */
+unsigned
+nir_find_inlinable_uniforms(const nir_shader *shader, uint16_t *dw_offsets,
+                            unsigned max)
+{
+   unsigned num = 0;
+
+   assert(max <= UINT8_MAX);
+
+   nir_foreach_function(function, shader) {
+      if (function->impl)
+         find_in_cf_list(&function->impl->body, false, dw_offsets, &num, max);
+   }
+
+   return num;
+}
+
+/**
+ * Replace the loads of the uniforms at uniform_dw_offsets by the matching
+ * uniform_values.  Vector loads keep loading the other components.
+ *
+ * The shader should be optimized afterwards, for the values to fold.
+ */
+bool
+nir_inline_uniforms(nir_shader *shader, unsigned num_uniforms,
+                    const uint32_t *uniform_values,
+                    const uint16_t *uniform_dw_offsets)
+{
+   bool progress = false;
+
+   if (!num_uniforms)
+      return false;
+
+   nir_foreach_function(function, shader) {
+      nir_builder b;
+      bool impl_progress = false;
+
+      if (!function->impl)
+         continue;
+
+      nir_builder_init(&b, function->impl);
+
+      nir_foreach_block(block, function->impl) {
+         nir_foreach_instr_safe(instr, block) {
+            nir_ssa_def *components[NIR_MAX_VEC_COMPONENTS];
+            nir_intrinsic_instr *intr;
+            unsigned num_components, offset, i;
+            bool found = false;
+
+            if (instr->type != nir_instr_type_intrinsic)
+               continue;
+
+            intr = nir_instr_as_intrinsic(instr);
+            if (!is_uniform_load(intr))
+               continue;
+
+            num_components = intr->dest.ssa.num_components;
+            offset = nir_src_as_uint(intr->src[1]) / 4;
+
+            memset(components, 0, sizeof components);
+            b.cursor = nir_after_instr(instr);
+
+            for (i = 0; i < num_uniforms; i++) {
+               if (uniform_dw_offsets[i] >= offset &&
+                   uniform_dw_offsets[i] < offset + num_components) {
+                  components[uniform_dw_offsets[i] - offset] =
+                     nir_imm_int(&b, uniform_values[i]);
+                  found = true;
+               }
+            }
+
+            if (!found)
+               continue;
+
+            if (num_components == 1) {
+               nir_ssa_def_rewrite_uses(&intr->dest.ssa,
+                                        nir_src_for_ssa(components[0]));
+               nir_instr_remove(instr);
+            }
+            else {
+               nir_ssa_def *vec;
+
+               for (i = 0; i < num_components; i++) {
+                  if (!components[i])
+                     components[i] = nir_channel(&b, &intr->dest.ssa, i);
+               }
+
+               vec = nir_vec(&b, components, num_components);
+               nir_ssa_def_rewrite_uses_after(&intr->dest.ssa,
+                                              nir_src_for_ssa(vec),
+                                              vec->parent_instr);
+            }
+            impl_progress = true;
+         }
+      }
+
+      if (impl_progress) {
+         nir_metadata_preserve(function->impl, nir_metadata_block_index |
+                                               nir_metadata_dominance);
+         progress = true;
+      }
+      else {
+         nir_metadata_preserve(function->impl, nir_metadata_all);
+      }
+   }
+
+   return progress;
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright © 2026 Mesa contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * \file
+ * Per-pass compile time statistics.
+ *
+ * With NIR_PASS_STATS set to a file name, NIR_PASS and NIR_PASS_V time every
+ * pass they run, and the totals per pass and shader stage are written to the
+ * file as JSON when the process exits.  Backends can record their own
+ * stages with nir_pass_stats_record().
+ */
+
+#include "nir.h"
+#include "util/os_time.h"
+#include "util/simple_mtx.h"
+
+struct nir_pass_stat {
+   char *name;
+
+   /** Indexed by gl_shader_stage + 1, 0 is MESA_SHADER_NONE. */
+   struct {
+      uint64_t calls;
+      uint64_t progress;
+      int64_t time;   /**< nanoseconds */
+   } stages[MESA_ALL_SHADER_STAGES + 1];
+};
+
+static simple_mtx_t stats_mutex = _SIMPLE_MTX_INITIALIZER_NP;
+static struct hash_table *stats;
+static const char *stats_path;
+
+static void
+delete_stat(struct hash_entry *entry)
+{
+   struct nir_pass_stat *stat = entry->data;
+
+   free(stat->name);
+   free(stat);
+}
+
+static void
+dump_stats_at_exit(void)
+{
+   FILE *fp = fopen(stats_path, "w");
+
+   if (!fp) {
+      fprintf(stderr, "NIR_PASS_STATS: can't open %s\n", stats_path);
+      return;
+   }
+
+   nir_pass_stats_dump(fp);
+   fclose(fp);
+}
+
+bool
+nir_pass_stats_enabled(void)
+{
+   static int enabled = -1;
+
+   if (unlikely(enabled < 0)) {
+      simple_mtx_lock(&stats_mutex);
+      if (enabled < 0) {
+         stats_path = getenv("NIR_PASS_STATS");
+         if (stats_path && stats_path[0])
+            atexit(dump_stats_at_exit);
+         enabled = stats_path && stats_path[0];
+      }
+      simple_mtx_unlock(&stats_mutex);
+   }
+
+   return enabled;
+}
+
+int64_t
+nir_pass_stats_time(void)
+{
+   return os_time_get_nano();
+}
+
+void
+nir_pass_stats_record(const char *name, gl_shader_stage stage, int64_t start,
+                      bool progress)
+{
+   const int64_t time = os_time_get_nano() - start;
+
+   assert(stage >= MESA_SHADER_NONE && stage < MESA_ALL_SHADER_STAGES);
+
+   simple_mtx_lock(&stats_mutex);
+
+   if (!stats) {
+      stats = _mesa_hash_table_create(NULL, _mesa_hash_string,
+                                      _mesa_key_string_equal);
+   }
+
+   struct hash_entry *entry = _mesa_hash_table_search(stats, name);
+   struct nir_pass_stat *stat;
+
+   if (entry) {
+      stat = entry->data;
+   } else {
+      stat = calloc(1, sizeof(*stat));
+      if (!stat) {
+         simple_mtx_unlock(&stats_mutex);
+         return;
+      }
+      stat->name = strdup(name);
+      _mesa_hash_table_insert(stats, stat->name, stat);
+   }
+
+   stat->stages[stage + 1].calls++;
+   stat->stages[stage + 1].progress += progress;
+   stat->stages[stage + 1].time += time;
+
+   simple_mtx_unlock(&stats_mutex);
+}
+
+void
+nir_pass_stats_reset(void)
+{
+   simple_mtx_lock(&stats_mutex);
+   _mesa_hash_table_destroy(stats, delete_stat);
+   stats = NULL;
+   simple_mtx_unlock(&stats_mutex);
+}
+
+/**
+ * Write the statistics as a JSON array with an object per pass and stage:
+ * name, stage, calls, progress (the calls which made progress, 0 for
+ * NIR_PASS_V) and time_us.
+ */
+void
+nir_pass_stats_dump(FILE *fp)
+{
+   bool first = true;
+
+   simple_mtx_lock(&stats_mutex);
+
+   fprintf(fp, "[");
+   if (stats) {
+      hash_table_foreach(stats, entry) {
+         const struct nir_pass_stat *stat = entry->data;
+
+         for (int i = 0; i < ARRAY_SIZE(stat->stages); i++) {
+            if (!stat->stages[i].calls)
+               continue;
+
+            fprintf(fp, "%s\n  {\"name\": \"%s\", \"stage\": \"%s\", "
+                    "\"calls\": %" PRIu64 ", \"progress\": %" PRIu64 ", "
+                    "\"time_us\": %.3f}",
+                    first ? "" : ",", stat->name,
+                    i ? _mesa_shader_stage_to_string(i - 1) : "none",
+                    stat->stages[i].calls, stat->stages[i].progress,
+                    stat->stages[i].time / 1000.0);
+            first = false;
+         }
+      }
+   }
+   fprintf(fp, "\n]\n");
+
+   simple_mtx_unlock(&stats_mutex);
+}
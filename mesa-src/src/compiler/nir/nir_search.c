@@ -855,24 +855,42 @@ nir_algebraic_automaton(nir_instr *instr, struct util_dynarray *states,
    }
 }
 
+/* Whether any of the transforms for the instruction's state can apply */
+static bool
+nir_algebraic_may_match(nir_instr *instr, struct util_dynarray *states,
+                        const uint16_t *transform_counts,
+                        const uint8_t *transform_bit_sizes)
+{
+   if (instr->type != nir_instr_type_alu)
+      return false;
+
+   nir_alu_instr *alu = nir_instr_as_alu(instr);
+   if (!alu->dest.dest.is_ssa)
+      return false;
+
+   uint16_t xform_idx = *util_dynarray_element(states, uint16_t,
+                                               alu->dest.dest.ssa.index);
+   return transform_counts[xform_idx] &&
+          (transform_bit_sizes[xform_idx] & alu->dest.dest.ssa.bit_size);
+}
+
 static bool
 nir_algebraic_instr(nir_builder *build, nir_instr *instr,
                     struct hash_table *range_ht,
+                    const char *pass_name,
                     const bool *condition_flags,
                     const struct transform **transforms,
                     const uint16_t *transform_counts,
+                    const uint8_t *transform_bit_sizes,
                     struct util_dynarray *states,
                     const struct per_op_table *pass_op_table,
                     nir_instr_worklist *worklist)
 {
-
-   if (instr->type != nir_instr_type_alu)
+   if (!nir_algebraic_may_match(instr, states, transform_counts,
+                                transform_bit_sizes))
       return false;
 
    nir_alu_instr *alu = nir_instr_as_alu(instr);
-   if (!alu->dest.dest.is_ssa)
-      return false;
-
    unsigned bit_size = alu->dest.dest.ssa.bit_size;
    const unsigned execution_mode =
       build->shader->info.float_controls_execution_mode;
@@ -880,14 +898,30 @@ nir_algebraic_instr(nir_builder *build, nir_instr *instr,
       nir_is_float_control_signed_zero_inf_nan_preserve(execution_mode, bit_size) ||
       nir_is_denorm_flush_to_zero(execution_mode, bit_size);
 
+   const bool record_stats = nir_pass_stats_enabled();
+
    int xform_idx = *util_dynarray_element(states, uint16_t,
                                           alu->dest.dest.ssa.index);
    for (uint16_t i = 0; i < transform_counts[xform_idx]; i++) {
       const struct transform *xform = &transforms[xform_idx][i];
-      if (condition_flags[xform->condition_offset] &&
-          !(xform->search->inexact && ignore_inexact) &&
-          nir_replace_instr(build, alu, range_ht, states, pass_op_table,
-                            xform->search, xform->replace, worklist)) {
+      if (!condition_flags[xform->condition_offset] ||
+          (xform->search->inexact && ignore_inexact))
+         continue;
+
+      const int64_t start = record_stats ? nir_pass_stats_time() : 0;
+      const bool matched =
+         nir_replace_instr(build, alu, range_ht, states, pass_op_table,
+                           xform->search, xform->replace, worklist) != NULL;
+
+      /* Per transform: the match attempts, the hits and the time taken. */
+      if (record_stats) {
+         char name[128];
+         snprintf(name, sizeof(name), "%s:%u", pass_name, xform->index);
+         nir_pass_stats_record(name, build->shader->info.stage, start,
+                               matched);
+      }
+
+      if (matched) {
          _mesa_hash_table_clear(range_ht, NULL);
          return true;
       }
@@ -898,9 +932,11 @@ nir_algebraic_instr(nir_builder *build, nir_instr *instr,
 
 bool
 nir_algebraic_impl(nir_function_impl *impl,
+                   const char *pass_name,
                    const bool *condition_flags,
                    const struct transform **transforms,
                    const uint16_t *transform_counts,
+                   const uint8_t *transform_bit_sizes,
                    const struct per_op_table *pass_op_table)
 {
    bool progress = false;
@@ -932,11 +968,14 @@ nir_algebraic_impl(nir_function_impl *impl,
 
    /* Put our instrs in the worklist such that we're popping the last instr
     * first.  This will encourage us to match the biggest source patterns when
-    * possible.
+    * possible.  Instructions that no transform can apply to are left out;
+    * if their state changes, nir_algebraic_update_automaton() adds them.
     */
    nir_foreach_block_reverse(block, impl) {
       nir_foreach_instr_reverse(instr, block) {
-         nir_instr_worklist_push_tail(worklist, instr);
+         if (nir_algebraic_may_match(instr, &states, transform_counts,
+                                     transform_bit_sizes))
+            nir_instr_worklist_push_tail(worklist, instr);
       }
    }
 
@@ -950,8 +989,9 @@ nir_algebraic_impl(nir_function_impl *impl,
          continue;
 
       progress |= nir_algebraic_instr(&build, instr,
-                                      range_ht, condition_flags,
-                                      transforms, transform_counts, &states,
+                                      range_ht, pass_name, condition_flags,
+                                      transforms, transform_counts,
+                                      transform_bit_sizes, &states,
                                       pass_op_table, worklist);
    }
 
@@ -178,6 +178,9 @@ struct transform {
    const nir_search_expression *search;
    const nir_search_value *replace;
    unsigned condition_offset;
+
+   /** Index of the transform in the pass, for NIR_PASS_STATS */
+   uint16_t index;
 };
 
 /* Note: these must match the start states created in
@@ -207,9 +210,11 @@ nir_replace_instr(struct nir_builder *b, nir_alu_instr *instr,
                   nir_instr_worklist *algebraic_worklist);
 bool
 nir_algebraic_impl(nir_function_impl *impl,
+                   const char *pass_name,
                    const bool *condition_flags,
                    const struct transform **transforms,
                    const uint16_t *transform_counts,
+                   const uint8_t *transform_bit_sizes,
                    const struct per_op_table *pass_op_table);
 
 #endif /* _NIR_SEARCH_ */
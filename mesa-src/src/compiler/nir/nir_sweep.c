@@ -73,7 +73,8 @@ sweep_block(nir_shader *nir, nir_block *block)
    block->live_out = NULL;
 
    nir_foreach_instr(instr, block) {
-      ralloc_steal(nir, instr);
+      if (!instr->arena)
+         ralloc_steal(nir, instr);
 
       nir_foreach_src(instr, sweep_src_indirect, nir);
       nir_foreach_dest(instr, sweep_dest_indirect, nir);
@@ -172,6 +173,9 @@ nir_sweep(nir_shader *nir)
 
    ralloc_steal(nir, nir->constant_data);
 
+   /* The arena isn't swept, dead instructions in it stay until the end. */
+   ralloc_steal_linear_parent(nir, nir->arena);
+
    /* Free everything we didn't steal back. */
    ralloc_free(rubbish);
 }
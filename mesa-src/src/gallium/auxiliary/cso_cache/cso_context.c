@@ -47,6 +47,7 @@
 #include "cso_cache/cso_context.h"
 #include "cso_cache/cso_cache.h"
 #include "cso_cache/cso_hash.h"
+#include "cso_cache/cso_shared.h"
 #include "cso_context.h"
 
 
@@ -65,6 +66,9 @@ struct cso_context {
    struct pipe_context *pipe;
    struct cso_cache *cache;
 
+   /** Screen-wide cache behind this one, if the driver allows sharing */
+   struct cso_shared_cache *shared;
+
    struct u_vbuf *vbuf;
    struct u_vbuf *vbuf_current;
    bool always_use_vbuf;
@@ -76,8 +80,13 @@ struct cso_context {
 
    unsigned saved_state;  /**< bitmask of CSO_BIT_x flags */
 
-   struct pipe_sampler_view *fragment_views[PIPE_MAX_SHADER_SAMPLER_VIEWS];
-   unsigned nr_fragment_views;
+   /** Number of state calls passed on to the driver, see
+    * cso_get_state_changes()
+    */
+   unsigned state_changes;
+
+   struct pipe_sampler_view *views[PIPE_SHADER_TYPES][PIPE_MAX_SHADER_SAMPLER_VIEWS];
+   unsigned nr_views[PIPE_SHADER_TYPES];
 
    struct pipe_sampler_view *fragment_views_saved[PIPE_MAX_SHADER_SAMPLER_VIEWS];
    unsigned nr_fragment_views_saved;
@@ -85,6 +94,10 @@ struct cso_context {
    struct sampler_info fragment_samplers_saved;
    struct sampler_info samplers[PIPE_SHADER_TYPES];
 
+   /** The sampler states last bound in the driver, to skip rebinding them */
+   void *samplers_bound[PIPE_SHADER_TYPES][PIPE_MAX_SAMPLERS];
+   unsigned nr_samplers_bound[PIPE_SHADER_TYPES];
+
    /* Temporary number until cso_single_sampler_done is called.
     * It tracks the highest sampler seen in cso_single_sampler.
     */
@@ -96,6 +109,13 @@ struct cso_context {
    struct pipe_constant_buffer aux_constbuf_current[PIPE_SHADER_TYPES];
    struct pipe_constant_buffer aux_constbuf_saved[PIPE_SHADER_TYPES];
 
+   /** Copy of the user constants bound in slot 0, if they are small enough.
+    * A user buffer is read by the driver when it is bound, so the slot can
+    * only be skipped when the contents are the same as well.
+    */
+   void *constbuf0_copy[PIPE_SHADER_TYPES];
+   unsigned constbuf0_copy_size[PIPE_SHADER_TYPES];
+
    struct pipe_image_view fragment_image0_current;
    struct pipe_image_view fragment_image0_saved;
 
@@ -135,6 +155,17 @@ struct pipe_context *cso_get_pipe_context(struct cso_context *cso)
    return cso->pipe;
 }
 
+/**
+ * Return the number of state calls which have been passed on to the
+ * driver.  Calls which would set the current state again are filtered out
+ * and not counted, so comparing this before and after updating some state
+ * tells whether the update was redundant.
+ */
+unsigned cso_get_state_changes(struct cso_context *cso)
+{
+   return cso->state_changes;
+}
+
 static boolean delete_blend_state(struct cso_context *ctx, void *state)
 {
    struct cso_blend *cso = (struct cso_blend *)state;
@@ -163,9 +194,20 @@ static boolean delete_depth_stencil_state(struct cso_context *ctx, void *state)
    return TRUE;
 }
 
-static boolean delete_sampler_state(UNUSED struct cso_context *ctx, void *state)
+static boolean delete_sampler_state(struct cso_context *ctx, void *state)
 {
    struct cso_sampler *cso = (struct cso_sampler *)state;
+
+   /* A new sampler could get the same handle, so don't skip binding it. */
+   for (unsigned sh = 0; sh < PIPE_SHADER_TYPES; sh++) {
+      for (unsigned i = 0; i < ctx->nr_samplers_bound[sh]; i++) {
+         if (ctx->samplers_bound[sh][i] == cso->data) {
+            ctx->nr_samplers_bound[sh] = ~0;
+            break;
+         }
+      }
+   }
+
    if (cso->delete_state)
       cso->delete_state(cso->context, cso->data);
    FREE(state);
@@ -322,6 +364,10 @@ cso_create_context(struct pipe_context *pipe, unsigned flags)
    ctx->pipe = pipe;
    ctx->sample_mask = ~0;
 
+   if (pipe->screen->get_param(pipe->screen,
+                               PIPE_CAP_SHAREABLE_STATE_OBJECTS))
+      ctx->shared = cso_shared_cache_reference(pipe->screen);
+
    cso_init_vbuf(ctx, flags);
 
    /* Enable for testing: */
@@ -415,8 +461,11 @@ void cso_destroy_context( struct cso_context *ctx )
          ctx->pipe->set_stream_output_targets(ctx->pipe, 0, NULL, NULL);
    }
 
-   for (i = 0; i < ctx->nr_fragment_views; i++) {
-      pipe_sampler_view_reference(&ctx->fragment_views[i], NULL);
+   for (unsigned sh = 0; sh < PIPE_SHADER_TYPES; sh++) {
+      for (i = 0; i < ctx->nr_views[sh]; i++) {
+         pipe_sampler_view_reference(&ctx->views[sh][i], NULL);
+      }
+      FREE(ctx->constbuf0_copy[sh]);
    }
    for (i = 0; i < ctx->nr_fragment_views_saved; i++) {
       pipe_sampler_view_reference(&ctx->fragment_views_saved[i], NULL);
@@ -446,6 +495,8 @@ void cso_destroy_context( struct cso_context *ctx )
       ctx->cache = NULL;
    }
 
+   cso_shared_cache_unreference(ctx->shared);
+
    if (ctx->vbuf)
       u_vbuf_destroy(ctx->vbuf);
    FREE( ctx );
@@ -483,8 +534,17 @@ enum pipe_error cso_set_blend(struct cso_context *ctx,
 
       memset(&cso->state, 0, sizeof cso->state);
       memcpy(&cso->state, templ, key_size);
-      cso->data = ctx->pipe->create_blend_state(ctx->pipe, &cso->state);
-      cso->delete_state = (cso_state_callback)ctx->pipe->delete_blend_state;
+      if (ctx->shared) {
+         /* The driver reads all of it, the zeroed tail included. */
+         cso->data = cso_shared_acquire(ctx->shared, ctx->pipe, hash_key,
+                                        CSO_BLEND, &cso->state,
+                                        sizeof cso->state);
+         cso->delete_state = cso->data ? cso_shared_release : NULL;
+      } else {
+         cso->data = ctx->pipe->create_blend_state(ctx->pipe, &cso->state);
+         cso->delete_state =
+            (cso_state_callback)ctx->pipe->delete_blend_state;
+      }
       cso->context = ctx->pipe;
 
       iter = cso_insert_state(ctx->cache, hash_key, CSO_BLEND, cso);
@@ -502,6 +562,7 @@ enum pipe_error cso_set_blend(struct cso_context *ctx,
    if (ctx->blend != handle) {
       ctx->blend = handle;
       ctx->pipe->bind_blend_state(ctx->pipe, handle);
+      ctx->state_changes++;
    }
    return PIPE_OK;
 }
@@ -544,10 +605,17 @@ cso_set_depth_stencil_alpha(struct cso_context *ctx,
          return PIPE_ERROR_OUT_OF_MEMORY;
 
       memcpy(&cso->state, templ, sizeof(*templ));
-      cso->data = ctx->pipe->create_depth_stencil_alpha_state(ctx->pipe,
-                                                              &cso->state);
-      cso->delete_state =
-         (cso_state_callback)ctx->pipe->delete_depth_stencil_alpha_state;
+      if (ctx->shared) {
+         cso->data = cso_shared_acquire(ctx->shared, ctx->pipe, hash_key,
+                                        CSO_DEPTH_STENCIL_ALPHA, &cso->state,
+                                        key_size);
+         cso->delete_state = cso->data ? cso_shared_release : NULL;
+      } else {
+         cso->data = ctx->pipe->create_depth_stencil_alpha_state(ctx->pipe,
+                                                                 &cso->state);
+         cso->delete_state =
+            (cso_state_callback)ctx->pipe->delete_depth_stencil_alpha_state;
+      }
       cso->context = ctx->pipe;
 
       iter = cso_insert_state(ctx->cache, hash_key,
@@ -567,6 +635,7 @@ cso_set_depth_stencil_alpha(struct cso_context *ctx,
    if (ctx->depth_stencil != handle) {
       ctx->depth_stencil = handle;
       ctx->pipe->bind_depth_stencil_alpha_state(ctx->pipe, handle);
+      ctx->state_changes++;
    }
    return PIPE_OK;
 }
@@ -613,9 +682,17 @@ enum pipe_error cso_set_rasterizer(struct cso_context *ctx,
          return PIPE_ERROR_OUT_OF_MEMORY;
 
       memcpy(&cso->state, templ, sizeof(*templ));
-      cso->data = ctx->pipe->create_rasterizer_state(ctx->pipe, &cso->state);
-      cso->delete_state =
-         (cso_state_callback)ctx->pipe->delete_rasterizer_state;
+      if (ctx->shared) {
+         cso->data = cso_shared_acquire(ctx->shared, ctx->pipe, hash_key,
+                                        CSO_RASTERIZER, &cso->state,
+                                        key_size);
+         cso->delete_state = cso->data ? cso_shared_release : NULL;
+      } else {
+         cso->data = ctx->pipe->create_rasterizer_state(ctx->pipe,
+                                                        &cso->state);
+         cso->delete_state =
+            (cso_state_callback)ctx->pipe->delete_rasterizer_state;
+      }
       cso->context = ctx->pipe;
 
       iter = cso_insert_state(ctx->cache, hash_key, CSO_RASTERIZER, cso);
@@ -633,6 +710,7 @@ enum pipe_error cso_set_rasterizer(struct cso_context *ctx,
    if (ctx->rasterizer != handle) {
       ctx->rasterizer = handle;
       ctx->pipe->bind_rasterizer_state(ctx->pipe, handle);
+      ctx->state_changes++;
    }
    return PIPE_OK;
 }
@@ -660,6 +738,7 @@ void cso_set_fragment_shader_handle(struct cso_context *ctx, void *handle )
    if (ctx->fragment_shader != handle) {
       ctx->fragment_shader = handle;
       ctx->pipe->bind_fs_state(ctx->pipe, handle);
+      ctx->state_changes++;
    }
 }
 
@@ -686,6 +765,7 @@ void cso_set_vertex_shader_handle(struct cso_context *ctx, void *handle)
    if (ctx->vertex_shader != handle) {
       ctx->vertex_shader = handle;
       ctx->pipe->bind_vs_state(ctx->pipe, handle);
+      ctx->state_changes++;
    }
 }
 
@@ -713,6 +793,7 @@ void cso_set_framebuffer(struct cso_context *ctx,
    if (memcmp(&ctx->fb, fb, sizeof(*fb)) != 0) {
       util_copy_framebuffer_state(&ctx->fb, fb);
       ctx->pipe->set_framebuffer_state(ctx->pipe, fb);
+      ctx->state_changes++;
    }
 }
 
@@ -739,6 +820,7 @@ void cso_set_viewport(struct cso_context *ctx,
    if (memcmp(&ctx->vp, vp, sizeof(*vp))) {
       ctx->vp = *vp;
       ctx->pipe->set_viewport_states(ctx->pipe, 0, 1, vp);
+      ctx->state_changes++;
    }
 }
 
@@ -787,6 +869,7 @@ void cso_set_blend_color(struct cso_context *ctx,
    if (memcmp(&ctx->blend_color, bc, sizeof(ctx->blend_color))) {
       ctx->blend_color = *bc;
       ctx->pipe->set_blend_color(ctx->pipe, bc);
+      ctx->state_changes++;
    }
 }
 
@@ -795,6 +878,7 @@ void cso_set_sample_mask(struct cso_context *ctx, unsigned sample_mask)
    if (ctx->sample_mask != sample_mask) {
       ctx->sample_mask = sample_mask;
       ctx->pipe->set_sample_mask(ctx->pipe, sample_mask);
+      ctx->state_changes++;
    }
 }
 
@@ -815,6 +899,7 @@ void cso_set_min_samples(struct cso_context *ctx, unsigned min_samples)
    if (ctx->min_samples != min_samples && ctx->pipe->set_min_samples) {
       ctx->min_samples = min_samples;
       ctx->pipe->set_min_samples(ctx->pipe, min_samples);
+      ctx->state_changes++;
    }
 }
 
@@ -836,6 +921,7 @@ void cso_set_stencil_ref(struct cso_context *ctx,
    if (memcmp(&ctx->stencil_ref, sr, sizeof(ctx->stencil_ref))) {
       ctx->stencil_ref = *sr;
       ctx->pipe->set_stencil_ref(ctx->pipe, sr);
+      ctx->state_changes++;
    }
 }
 
@@ -896,6 +982,7 @@ void cso_set_geometry_shader_handle(struct cso_context *ctx, void *handle)
    if (ctx->has_geometry_shader && ctx->geometry_shader != handle) {
       ctx->geometry_shader = handle;
       ctx->pipe->bind_gs_state(ctx->pipe, handle);
+      ctx->state_changes++;
    }
 }
 
@@ -931,6 +1018,7 @@ void cso_set_tessctrl_shader_handle(struct cso_context *ctx, void *handle)
    if (ctx->has_tessellation && ctx->tessctrl_shader != handle) {
       ctx->tessctrl_shader = handle;
       ctx->pipe->bind_tcs_state(ctx->pipe, handle);
+      ctx->state_changes++;
    }
 }
 
@@ -966,6 +1054,7 @@ void cso_set_tesseval_shader_handle(struct cso_context *ctx, void *handle)
    if (ctx->has_tessellation && ctx->tesseval_shader != handle) {
       ctx->tesseval_shader = handle;
       ctx->pipe->bind_tes_state(ctx->pipe, handle);
+      ctx->state_changes++;
    }
 }
 
@@ -1001,6 +1090,7 @@ void cso_set_compute_shader_handle(struct cso_context *ctx, void *handle)
    if (ctx->has_compute_shader && ctx->compute_shader != handle) {
       ctx->compute_shader = handle;
       ctx->pipe->bind_compute_state(ctx->pipe, handle);
+      ctx->state_changes++;
    }
 }
 
@@ -1029,11 +1119,18 @@ cso_set_vertex_elements_direct(struct cso_context *ctx,
          return;
 
       memcpy(&cso->state, velems, key_size);
-      cso->data = ctx->pipe->create_vertex_elements_state(ctx->pipe,
-                                                          velems->count,
+      if (ctx->shared) {
+         cso->data = cso_shared_acquire(ctx->shared, ctx->pipe, hash_key,
+                                        CSO_VELEMENTS, &cso->state,
+                                        key_size);
+         cso->delete_state = cso->data ? cso_shared_release : NULL;
+      } else {
+         cso->data = ctx->pipe->create_vertex_elements_state(ctx->pipe,
+                                                             velems->count,
                                                       &cso->state.velems[0]);
-      cso->delete_state =
-         (cso_state_callback) ctx->pipe->delete_vertex_elements_state;
+         cso->delete_state =
+            (cso_state_callback) ctx->pipe->delete_vertex_elements_state;
+      }
       cso->context = ctx->pipe;
 
       iter = cso_insert_state(ctx->cache, hash_key, CSO_VELEMENTS, cso);
@@ -1051,6 +1148,7 @@ cso_set_vertex_elements_direct(struct cso_context *ctx,
    if (ctx->velements != handle) {
       ctx->velements = handle;
       ctx->pipe->bind_vertex_elements_state(ctx->pipe, handle);
+      ctx->state_changes++;
    }
 }
 
@@ -1120,6 +1218,7 @@ cso_set_vertex_buffers_direct(struct cso_context *ctx,
    }
 
    ctx->pipe->set_vertex_buffers(ctx->pipe, start_slot, count, buffers);
+   ctx->state_changes++;
 }
 
 
@@ -1134,6 +1233,7 @@ void cso_set_vertex_buffers(struct cso_context *ctx,
 
    if (vbuf) {
       u_vbuf_set_vertex_buffers(vbuf, start_slot, count, buffers);
+      ctx->state_changes++;
       return;
    }
 
@@ -1208,6 +1308,7 @@ cso_set_vertex_buffers_and_elements(struct cso_context *ctx,
       if (vb_count)
          u_vbuf_set_vertex_buffers(vbuf, 0, vb_count, vbuffers);
       u_vbuf_set_vertex_elements(vbuf, velems);
+      ctx->state_changes++;
       return;
    }
 
@@ -1249,9 +1350,17 @@ cso_single_sampler(struct cso_context *ctx, enum pipe_shader_type shader_stage,
             return;
 
          memcpy(&cso->state, templ, sizeof(*templ));
-         cso->data = ctx->pipe->create_sampler_state(ctx->pipe, &cso->state);
-         cso->delete_state =
-            (cso_state_callback) ctx->pipe->delete_sampler_state;
+         if (ctx->shared) {
+            cso->data = cso_shared_acquire(ctx->shared, ctx->pipe, hash_key,
+                                           CSO_SAMPLER, &cso->state,
+                                           key_size);
+            cso->delete_state = cso->data ? cso_shared_release : NULL;
+         } else {
+            cso->data = ctx->pipe->create_sampler_state(ctx->pipe,
+                                                        &cso->state);
+            cso->delete_state =
+               (cso_state_callback) ctx->pipe->delete_sampler_state;
+         }
          cso->context = ctx->pipe;
          cso->hash_key = hash_key;
 
@@ -1280,13 +1389,21 @@ cso_single_sampler_done(struct cso_context *ctx,
                         enum pipe_shader_type shader_stage)
 {
    struct sampler_info *info = &ctx->samplers[shader_stage];
+   unsigned count = ctx->max_sampler_seen + 1;
 
    if (ctx->max_sampler_seen == -1)
       return;
 
-   ctx->pipe->bind_sampler_states(ctx->pipe, shader_stage, 0,
-                                  ctx->max_sampler_seen + 1,
-                                  info->samplers);
+   if (count != ctx->nr_samplers_bound[shader_stage] ||
+       memcmp(ctx->samplers_bound[shader_stage], info->samplers,
+              count * sizeof(info->samplers[0]))) {
+      ctx->pipe->bind_sampler_states(ctx->pipe, shader_stage, 0, count,
+                                     info->samplers);
+      memcpy(ctx->samplers_bound[shader_stage], info->samplers,
+             count * sizeof(info->samplers[0]));
+      ctx->nr_samplers_bound[shader_stage] = count;
+      ctx->state_changes++;
+   }
    ctx->max_sampler_seen = -1;
 }
 
@@ -1347,32 +1464,30 @@ cso_set_sampler_views(struct cso_context *ctx,
                       unsigned count,
                       struct pipe_sampler_view **views)
 {
-   if (shader_stage == PIPE_SHADER_FRAGMENT) {
-      unsigned i;
-      boolean any_change = FALSE;
-
-      /* reference new views */
-      for (i = 0; i < count; i++) {
-         any_change |= ctx->fragment_views[i] != views[i];
-         pipe_sampler_view_reference(&ctx->fragment_views[i], views[i]);
-      }
-      /* unref extra old views, if any */
-      for (; i < ctx->nr_fragment_views; i++) {
-         any_change |= ctx->fragment_views[i] != NULL;
-         pipe_sampler_view_reference(&ctx->fragment_views[i], NULL);
-      }
+   struct pipe_sampler_view **current = ctx->views[shader_stage];
+   unsigned i;
+   boolean any_change = FALSE;
 
-      /* bind the new sampler views */
-      if (any_change) {
-         ctx->pipe->set_sampler_views(ctx->pipe, shader_stage, 0,
-                                      MAX2(ctx->nr_fragment_views, count),
-                                      ctx->fragment_views);
-      }
+   /* reference new views */
+   for (i = 0; i < count; i++) {
+      any_change |= current[i] != views[i];
+      pipe_sampler_view_reference(&current[i], views[i]);
+   }
+   /* unref extra old views, if any */
+   for (; i < ctx->nr_views[shader_stage]; i++) {
+      any_change |= current[i] != NULL;
+      pipe_sampler_view_reference(&current[i], NULL);
+   }
 
-      ctx->nr_fragment_views = count;
+   /* bind the new sampler views */
+   if (any_change) {
+      ctx->pipe->set_sampler_views(ctx->pipe, shader_stage, 0,
+                                   MAX2(ctx->nr_views[shader_stage], count),
+                                   current);
+      ctx->state_changes++;
    }
-   else
-      ctx->pipe->set_sampler_views(ctx->pipe, shader_stage, 0, count, views);
+
+   ctx->nr_views[shader_stage] = count;
 }
 
 
@@ -1381,12 +1496,12 @@ cso_save_fragment_sampler_views(struct cso_context *ctx)
 {
    unsigned i;
 
-   ctx->nr_fragment_views_saved = ctx->nr_fragment_views;
+   ctx->nr_fragment_views_saved = ctx->nr_views[PIPE_SHADER_FRAGMENT];
 
-   for (i = 0; i < ctx->nr_fragment_views; i++) {
+   for (i = 0; i < ctx->nr_views[PIPE_SHADER_FRAGMENT]; i++) {
       assert(!ctx->fragment_views_saved[i]);
       pipe_sampler_view_reference(&ctx->fragment_views_saved[i],
-                                  ctx->fragment_views[i]);
+                                  ctx->views[PIPE_SHADER_FRAGMENT][i]);
    }
 }
 
@@ -1398,22 +1513,22 @@ cso_restore_fragment_sampler_views(struct cso_context *ctx)
    unsigned num;
 
    for (i = 0; i < nr_saved; i++) {
-      pipe_sampler_view_reference(&ctx->fragment_views[i], NULL);
+      pipe_sampler_view_reference(&ctx->views[PIPE_SHADER_FRAGMENT][i], NULL);
       /* move the reference from one pointer to another */
-      ctx->fragment_views[i] = ctx->fragment_views_saved[i];
+      ctx->views[PIPE_SHADER_FRAGMENT][i] = ctx->fragment_views_saved[i];
       ctx->fragment_views_saved[i] = NULL;
    }
-   for (; i < ctx->nr_fragment_views; i++) {
-      pipe_sampler_view_reference(&ctx->fragment_views[i], NULL);
+   for (; i < ctx->nr_views[PIPE_SHADER_FRAGMENT]; i++) {
+      pipe_sampler_view_reference(&ctx->views[PIPE_SHADER_FRAGMENT][i], NULL);
    }
 
-   num = MAX2(ctx->nr_fragment_views, nr_saved);
+   num = MAX2(ctx->nr_views[PIPE_SHADER_FRAGMENT], nr_saved);
 
    /* bind the old/saved sampler views */
    ctx->pipe->set_sampler_views(ctx->pipe, PIPE_SHADER_FRAGMENT, 0, num,
-                                ctx->fragment_views);
+                                ctx->views[PIPE_SHADER_FRAGMENT]);
 
-   ctx->nr_fragment_views = nr_saved;
+   ctx->nr_views[PIPE_SHADER_FRAGMENT] = nr_saved;
    ctx->nr_fragment_views_saved = 0;
 }
 
@@ -1429,6 +1544,7 @@ cso_set_shader_images(struct cso_context *ctx,
    }
 
    ctx->pipe->set_shader_images(ctx->pipe, shader_stage, start, count, images);
+   ctx->state_changes++;
 }
 
 
@@ -1478,6 +1594,7 @@ cso_set_stream_outputs(struct cso_context *ctx,
 
    pipe->set_stream_output_targets(pipe, num_targets, targets,
                                    offsets);
+   ctx->state_changes++;
    ctx->nr_so_targets = num_targets;
 }
 
@@ -1536,6 +1653,50 @@ cso_restore_stream_outputs(struct cso_context *ctx)
 
 /* constant buffers */
 
+/** Largest user constant buffer in slot 0 which is compared, in bytes */
+#define CSO_CONSTBUF0_COPY_SIZE 4096
+
+static bool
+cso_constbuf0_is_current(struct cso_context *cso,
+                         enum pipe_shader_type shader_stage,
+                         const struct pipe_constant_buffer *cb)
+{
+   const struct pipe_constant_buffer *current =
+      &cso->aux_constbuf_current[shader_stage];
+
+   return cb && !cb->buffer && cb->user_buffer &&
+          cb->user_buffer == current->user_buffer &&
+          cb->buffer_offset == current->buffer_offset &&
+          cso->constbuf0_copy_size[shader_stage] &&
+          cb->buffer_size == cso->constbuf0_copy_size[shader_stage] &&
+          !memcmp(cso->constbuf0_copy[shader_stage],
+                  (const uint8_t *)cb->user_buffer + cb->buffer_offset,
+                  cb->buffer_size);
+}
+
+static void
+cso_update_constbuf0_copy(struct cso_context *cso,
+                          enum pipe_shader_type shader_stage,
+                          const struct pipe_constant_buffer *cb)
+{
+   cso->constbuf0_copy_size[shader_stage] = 0;
+
+   if (!cb || cb->buffer || !cb->user_buffer ||
+       !cb->buffer_size || cb->buffer_size > CSO_CONSTBUF0_COPY_SIZE)
+      return;
+
+   if (!cso->constbuf0_copy[shader_stage]) {
+      cso->constbuf0_copy[shader_stage] = MALLOC(CSO_CONSTBUF0_COPY_SIZE);
+      if (!cso->constbuf0_copy[shader_stage])
+         return;
+   }
+
+   memcpy(cso->constbuf0_copy[shader_stage],
+          (const uint8_t *)cb->user_buffer + cb->buffer_offset,
+          cb->buffer_size);
+   cso->constbuf0_copy_size[shader_stage] = cb->buffer_size;
+}
+
 void
 cso_set_constant_buffer(struct cso_context *cso,
                         enum pipe_shader_type shader_stage,
@@ -1543,10 +1704,18 @@ cso_set_constant_buffer(struct cso_context *cso,
 {
    struct pipe_context *pipe = cso->pipe;
 
+   /* Buffer resources are always rebound: the frontend rebinds them to
+    * tell the driver the storage was reallocated.
+    */
+   if (index == 0 && cso_constbuf0_is_current(cso, shader_stage, cb))
+      return;
+
    pipe->set_constant_buffer(pipe, shader_stage, index, cb);
+   cso->state_changes++;
 
    if (index == 0) {
       util_copy_constant_buffer(&cso->aux_constbuf_current[shader_stage], cb);
+      cso_update_constbuf0_copy(cso, shader_stage, cb);
    }
 }
 
@@ -49,6 +49,7 @@ struct cso_context *cso_create_context(struct pipe_context *pipe,
                                        unsigned flags);
 void cso_destroy_context( struct cso_context *cso );
 struct pipe_context *cso_get_pipe_context(struct cso_context *cso);
+unsigned cso_get_state_changes(struct cso_context *cso);
 
 
 enum pipe_error cso_set_blend( struct cso_context *cso,
@@ -0,0 +1,329 @@
+/*
+ * Copyright © 2026 Mesa contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include "pipe/p_screen.h"
+#include "util/hash_table.h"
+#include "util/simple_mtx.h"
+#include "util/u_memory.h"
+
+#include "cso_shared.h"
+#include "cso_hash.h"
+
+
+#define CSO_SHARED_SHARDS 16
+
+struct cso_shared_state {
+   enum cso_cache_type type;
+   unsigned hash_key;
+   unsigned size;
+   unsigned refcount;
+   void *data;
+   uint64_t templ[];
+};
+
+struct cso_shared_shard {
+   simple_mtx_t lock;
+   struct cso_hash hashes[CSO_CACHE_MAX];
+};
+
+struct cso_shared_cache {
+   struct pipe_screen *screen;
+   unsigned refcount;
+   struct cso_shared_cache *next;
+
+   struct cso_shared_shard shards[CSO_SHARED_SHARDS];
+
+   /** Driver handle -> cso_shared_state, for cso_shared_release() */
+   simple_mtx_t handles_lock;
+   struct hash_table *handles;
+};
+
+/* One cache per screen, looked up by the screen pointer. */
+static simple_mtx_t caches_lock = _SIMPLE_MTX_INITIALIZER_NP;
+static struct cso_shared_cache *caches;
+
+
+struct cso_shared_cache *
+cso_shared_cache_reference(struct pipe_screen *screen)
+{
+   struct cso_shared_cache *sc;
+   unsigned i, j;
+
+   simple_mtx_lock(&caches_lock);
+
+   for (sc = caches; sc; sc = sc->next) {
+      if (sc->screen == screen) {
+         sc->refcount++;
+         simple_mtx_unlock(&caches_lock);
+         return sc;
+      }
+   }
+
+   sc = CALLOC_STRUCT(cso_shared_cache);
+   if (sc) {
+      sc->handles = _mesa_pointer_hash_table_create(NULL);
+      if (!sc->handles) {
+         FREE(sc);
+         simple_mtx_unlock(&caches_lock);
+         return NULL;
+      }
+      simple_mtx_init(&sc->handles_lock, mtx_plain);
+
+      for (i = 0; i < CSO_SHARED_SHARDS; i++) {
+         simple_mtx_init(&sc->shards[i].lock, mtx_plain);
+         for (j = 0; j < CSO_CACHE_MAX; j++)
+            cso_hash_init(&sc->shards[i].hashes[j]);
+      }
+
+      sc->screen = screen;
+      sc->refcount = 1;
+      sc->next = caches;
+      caches = sc;
+   }
+
+   simple_mtx_unlock(&caches_lock);
+   return sc;
+}
+
+void
+cso_shared_cache_unreference(struct cso_shared_cache *sc)
+{
+   struct cso_shared_cache **prev;
+   unsigned i, j;
+
+   if (!sc)
+      return;
+
+   simple_mtx_lock(&caches_lock);
+   if (--sc->refcount) {
+      simple_mtx_unlock(&caches_lock);
+      return;
+   }
+
+   for (prev = &caches; *prev != sc; prev = &(*prev)->next)
+      ;
+   *prev = sc->next;
+   simple_mtx_unlock(&caches_lock);
+
+   /* Every state is released by the context cache holding it before that
+    * context drops its reference here.
+    */
+   assert(_mesa_hash_table_num_entries(sc->handles) == 0);
+
+   for (i = 0; i < CSO_SHARED_SHARDS; i++) {
+      for (j = 0; j < CSO_CACHE_MAX; j++)
+         cso_hash_deinit(&sc->shards[i].hashes[j]);
+      simple_mtx_destroy(&sc->shards[i].lock);
+   }
+   simple_mtx_destroy(&sc->handles_lock);
+   _mesa_hash_table_destroy(sc->handles, NULL);
+   FREE(sc);
+}
+
+static struct cso_shared_cache *
+cso_shared_cache_for_screen(struct pipe_screen *screen)
+{
+   struct cso_shared_cache *sc;
+
+   simple_mtx_lock(&caches_lock);
+   for (sc = caches; sc; sc = sc->next) {
+      if (sc->screen == screen)
+         break;
+   }
+   simple_mtx_unlock(&caches_lock);
+
+   return sc;
+}
+
+static inline struct cso_shared_shard *
+shard_for_key(struct cso_shared_cache *sc, unsigned hash_key)
+{
+   /* cso_construct_key() xors the template words, so mix before picking. */
+   return &sc->shards[(hash_key * 0x9e3779b1u) >> 28];
+}
+
+static void *
+create_driver_state(struct pipe_context *pipe, enum cso_cache_type type,
+                    const void *templ)
+{
+   switch (type) {
+   case CSO_BLEND:
+      return pipe->create_blend_state(pipe, templ);
+   case CSO_DEPTH_STENCIL_ALPHA:
+      return pipe->create_depth_stencil_alpha_state(pipe, templ);
+   case CSO_RASTERIZER:
+      return pipe->create_rasterizer_state(pipe, templ);
+   case CSO_SAMPLER:
+      return pipe->create_sampler_state(pipe, templ);
+   case CSO_VELEMENTS: {
+      const struct cso_velems_state *velems = templ;
+      return pipe->create_vertex_elements_state(pipe, velems->count,
+                                                &velems->velems[0]);
+   }
+   default:
+      assert(0);
+      return NULL;
+   }
+}
+
+static void
+delete_driver_state(struct pipe_context *pipe, enum cso_cache_type type,
+                    void *data)
+{
+   switch (type) {
+   case CSO_BLEND:
+      pipe->delete_blend_state(pipe, data);
+      break;
+   case CSO_DEPTH_STENCIL_ALPHA:
+      pipe->delete_depth_stencil_alpha_state(pipe, data);
+      break;
+   case CSO_RASTERIZER:
+      pipe->delete_rasterizer_state(pipe, data);
+      break;
+   case CSO_SAMPLER:
+      pipe->delete_sampler_state(pipe, data);
+      break;
+   case CSO_VELEMENTS:
+      pipe->delete_vertex_elements_state(pipe, data);
+      break;
+   default:
+      assert(0);
+   }
+}
+
+/**
+ * Return the driver object for the given template, creating it with pipe
+ * if no context of the screen has one yet.  The caller owns a reference,
+ * dropped with cso_shared_release(), which has the cso_state_callback
+ * signature so it can be the delete_state of the context's cso.
+ */
+void *
+cso_shared_acquire(struct cso_shared_cache *sc, struct pipe_context *pipe,
+                   unsigned hash_key, enum cso_cache_type type,
+                   const void *templ, unsigned size)
+{
+   struct cso_shared_shard *shard = shard_for_key(sc, hash_key);
+   struct cso_hash *hash = &shard->hashes[type];
+   struct cso_shared_state *state;
+   struct cso_hash_iter iter;
+   void *data;
+
+   simple_mtx_lock(&shard->lock);
+
+   for (iter = cso_hash_find(hash, hash_key);
+        !cso_hash_iter_is_null(iter);
+        iter = cso_hash_iter_next(iter)) {
+      state = cso_hash_iter_data(iter);
+      if (state->size == size && !memcmp(state->templ, templ, size)) {
+         state->refcount++;
+         data = state->data;
+         simple_mtx_unlock(&shard->lock);
+         return data;
+      }
+   }
+
+   /* Create under the shard lock, so that two contexts missing on the same
+    * state at once still end up with a single object.
+    */
+   state = MALLOC(sizeof(*state) + size);
+   if (!state) {
+      simple_mtx_unlock(&shard->lock);
+      return NULL;
+   }
+
+   state->type = type;
+   state->hash_key = hash_key;
+   state->size = size;
+   state->refcount = 1;
+   memcpy(state->templ, templ, size);
+   state->data = create_driver_state(pipe, type, state->templ);
+
+   if (!state->data ||
+       cso_hash_iter_is_null(cso_hash_insert(hash, hash_key, state))) {
+      if (state->data)
+         delete_driver_state(pipe, type, state->data);
+      FREE(state);
+      simple_mtx_unlock(&shard->lock);
+      return NULL;
+   }
+
+   simple_mtx_lock(&sc->handles_lock);
+   _mesa_hash_table_insert(sc->handles, state->data, state);
+   simple_mtx_unlock(&sc->handles_lock);
+
+   data = state->data;
+   simple_mtx_unlock(&shard->lock);
+   return data;
+}
+
+/**
+ * Drop a reference from cso_shared_acquire().  The last one deletes the
+ * driver object through the releasing context, which the driver allows by
+ * setting PIPE_CAP_SHAREABLE_STATE_OBJECTS.
+ */
+void
+cso_shared_release(void *_pipe, void *data)
+{
+   struct pipe_context *pipe = _pipe;
+   struct cso_shared_cache *sc = cso_shared_cache_for_screen(pipe->screen);
+   struct cso_shared_shard *shard;
+   struct cso_shared_state *state;
+   struct hash_entry *entry;
+   struct cso_hash_iter iter;
+
+   assert(sc);
+
+   simple_mtx_lock(&sc->handles_lock);
+   entry = _mesa_hash_table_search(sc->handles, data);
+   state = entry ? entry->data : NULL;
+   simple_mtx_unlock(&sc->handles_lock);
+
+   assert(state);
+   if (!state)
+      return;
+
+   /* Our reference keeps the state alive until the shard lock is held. */
+   shard = shard_for_key(sc, state->hash_key);
+   simple_mtx_lock(&shard->lock);
+
+   if (--state->refcount) {
+      simple_mtx_unlock(&shard->lock);
+      return;
+   }
+
+   for (iter = cso_hash_find(&shard->hashes[state->type], state->hash_key);
+        cso_hash_iter_data(iter) != state;
+        iter = cso_hash_iter_next(iter))
+      assert(!cso_hash_iter_is_null(iter));
+   cso_hash_erase(&shard->hashes[state->type], iter);
+
+   simple_mtx_lock(&sc->handles_lock);
+   _mesa_hash_table_remove_key(sc->handles, data);
+   simple_mtx_unlock(&sc->handles_lock);
+
+   simple_mtx_unlock(&shard->lock);
+
+   delete_driver_state(pipe, state->type, data);
+   FREE(state);
+}
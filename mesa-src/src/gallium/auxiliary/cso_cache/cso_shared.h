@@ -0,0 +1,66 @@
+/*
+ * Copyright © 2026 Mesa contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * @file
+ * Screen-wide cache of driver state objects, shared by the cso_contexts of
+ * a screen whose driver sets PIPE_CAP_SHAREABLE_STATE_OBJECTS.
+ *
+ * Each cso_context keeps its own cso_cache in front of this one, so hits
+ * there stay lock free; only the per-context misses come here, where an
+ * identical state created by another context is handed out with a
+ * reference instead of being created again.
+ */
+
+#ifndef CSO_SHARED_H
+#define CSO_SHARED_H
+
+#include "cso_cache.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+struct pipe_screen;
+struct cso_shared_cache;
+
+struct cso_shared_cache *
+cso_shared_cache_reference(struct pipe_screen *screen);
+
+void
+cso_shared_cache_unreference(struct cso_shared_cache *sc);
+
+void *
+cso_shared_acquire(struct cso_shared_cache *sc, struct pipe_context *pipe,
+                   unsigned hash_key, enum cso_cache_type type,
+                   const void *templ, unsigned size);
+
+void
+cso_shared_release(void *pipe, void *data);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif
@@ -161,6 +161,7 @@ boolean draw_init(struct draw_context *draw)
 
    draw->pt.user.planes = (float (*) [DRAW_TOTAL_CLIP_PLANES][4]) &(draw->plane[0]);
    draw->pt.user.eltMax = ~0;
+   draw->instance_batch = 1;
 
    if (!draw_pipeline_init( draw ))
       return FALSE;
@@ -174,6 +175,9 @@ boolean draw_init(struct draw_context *draw)
    if (!draw_gs_init( draw ))
       return FALSE;
 
+   if (!draw_tess_init( draw ))
+      return FALSE;
+
    draw->quads_always_flatshade_last = !draw->pipe->screen->get_param(
       draw->pipe->screen, PIPE_CAP_QUADS_FOLLOW_PROVOKING_VERTEX_CONVENTION);
 
@@ -231,6 +235,7 @@ void draw_destroy( struct draw_context *draw )
    draw_pt_destroy( draw );
    draw_vs_destroy( draw );
    draw_gs_destroy( draw );
+   draw_tess_destroy( draw );
 #ifdef LLVM_AVAILABLE
    if (draw->llvm)
       draw_llvm_destroy( draw->llvm );
@@ -247,6 +252,36 @@ void draw_flush( struct draw_context *draw )
 }
 
 
+/**
+ * Bytes the draw module holds on to between draws: the code of its
+ * shader variants and the draws recorded for vertex replay.
+ */
+size_t
+draw_get_memory_size(struct draw_context *draw)
+{
+   size_t size = draw_pt_replay_size(draw);
+
+#ifdef LLVM_AVAILABLE
+   if (draw->llvm)
+      size += draw_llvm_code_size(draw->llvm);
+#endif
+
+   return size;
+}
+
+
+/**
+ * Free what the draw module only keeps to speed up later draws, the
+ * draws recorded for vertex replay.  Not while drawing.
+ */
+void
+draw_trim_memory(struct draw_context *draw)
+{
+   draw_do_flush(draw, DRAW_FLUSH_BACKEND);
+   draw_pt_replay_flush(draw);
+}
+
+
 /**
  * Specify the depth stencil format for the draw pipeline. This function
  * determines the Minimum Resolvable Depth factor for polygon offset.
@@ -587,6 +622,21 @@ draw_set_force_passthrough( struct draw_context *draw, boolean enable )
 }
 
 
+/**
+ * Tell the draw module the driver drops all primitives, for reasons of
+ * its own besides the rasterizer state's rasterizer_discard.  Only the
+ * shaders and stream output are run then.
+ */
+void
+draw_set_rasterizer_discard( struct draw_context *draw, boolean discard )
+{
+   if (draw->rasterizer_discard != discard) {
+      draw_do_flush( draw, DRAW_FLUSH_STATE_CHANGE );
+      draw->rasterizer_discard = discard;
+   }
+}
+
+
 
 /**
  * Allocate an extra vertex/geometry shader vertex attribute, if it doesn't
@@ -916,6 +966,20 @@ draw_set_indexes(struct draw_context *draw,
       draw->pt.user.eltMax = elem_buffer_space / elem_size;
    else
       draw->pt.user.eltMax = 0;
+   draw->pt.user.eltSerial = 0;
+}
+
+
+/**
+ * Give a serial for the contents of the elements set with
+ * draw_set_indexes(), which changes whenever they are written.  Lets
+ * draws with primitive restart reuse the runs found between the restart
+ * indexes.  Reset to 0, unknown, by draw_set_indexes().
+ */
+void
+draw_set_index_serial(struct draw_context *draw, uint64_t serial)
+{
+   draw->pt.user.eltSerial = serial;
 }
 
 
@@ -923,6 +987,9 @@ draw_set_indexes(struct draw_context *draw,
  */
 void draw_do_flush( struct draw_context *draw, unsigned flags )
 {
+   if (flags & (DRAW_FLUSH_PARAMETER_CHANGE | DRAW_FLUSH_STATE_CHANGE))
+      draw->pt.replay_state_dirty = TRUE;
+
    if (!draw->suspend_flushing)
    {
       assert(!draw->flushing); /* catch inadvertant recursion */
@@ -294,6 +294,8 @@ void draw_set_indexes(struct draw_context *draw,
                       const void *elements, unsigned elem_size,
                       unsigned available_space);
 
+void draw_set_index_serial(struct draw_context *draw, uint64_t serial);
+
 void draw_set_mapped_vertex_buffer(struct draw_context *draw,
                                    unsigned attr, const void *buffer,
                                    size_t size);
@@ -325,6 +327,11 @@ draw_set_mapped_so_targets(struct draw_context *draw,
 void draw_vbo(struct draw_context *draw,
               const struct pipe_draw_info *info);
 
+void draw_vbo_multi(struct draw_context *draw,
+                    const struct pipe_draw_info *info,
+                    const uint32_t *params, unsigned stride,
+                    unsigned draw_count);
+
 
 /*******************************************************************************
  * Driver backend interface 
@@ -342,6 +349,9 @@ void draw_set_driver_clipping( struct draw_context *draw,
 void draw_set_force_passthrough( struct draw_context *draw, 
                                  boolean enable );
 
+void draw_set_rasterizer_discard( struct draw_context *draw,
+                                  boolean discard );
+
 
 /*******************************************************************************
  * Draw statistics
@@ -352,6 +362,20 @@ void draw_collect_pipeline_statistics(struct draw_context *draw,
 void draw_collect_primitives_generated(struct draw_context *draw,
                                        bool eanble);
 
+/*******************************************************************************
+ * Post-transform vertex replay
+ */
+void draw_enable_replay(struct draw_context *draw, size_t max_bytes);
+
+void draw_set_replay_serial(struct draw_context *draw, uint64_t serial);
+
+/*******************************************************************************
+ * Memory accounting
+ */
+size_t draw_get_memory_size(struct draw_context *draw);
+
+void draw_trim_memory(struct draw_context *draw);
+
 /*******************************************************************************
  * Draw pipeline 
  */
@@ -423,6 +423,58 @@ llvm_gs_run(struct draw_geometry_shader *shader,
 
 #endif
 
+/**
+ * Make room in the output of every stream for what one run of the shader
+ * emits at most.  The buffers grow with what is actually emitted, the
+ * worst case of the whole draw is usually far more: the GS may emit up
+ * to max_output_vertices for each input primitive, but rarely does.
+ * \return FALSE if out of memory
+ */
+static boolean
+gs_reserve_outputs(struct draw_geometry_shader *shader)
+{
+   /* each of the vector's primitives writes from its own boundary */
+   unsigned run_max = shader->vector_length * shader->primitive_boundary;
+   unsigned i;
+
+   for (i = 0; i < shader->num_vertex_streams; i++) {
+      struct draw_vertex_stream *stream = &shader->stream[i];
+      unsigned verts = stream->emitted_vertices + run_max;
+      unsigned prims = stream->emitted_primitives + run_max;
+
+      if (verts > stream->max_vertices) {
+         unsigned new_size = MAX2(verts, stream->max_vertices * 2);
+         struct vertex_header *new_verts =
+            REALLOC(stream->verts, stream->max_vertices * shader->vertex_size,
+                    new_size * shader->vertex_size);
+         if (!new_verts)
+            return FALSE;
+         stream->verts = new_verts;
+         stream->max_vertices = new_size;
+      }
+
+      if (prims > stream->max_primitives) {
+         unsigned new_size = MAX2(prims, stream->max_primitives * 2);
+         unsigned *new_lengths =
+            REALLOC(stream->primitive_lengths,
+                    stream->max_primitives * sizeof(unsigned),
+                    new_size * sizeof(unsigned));
+         if (!new_lengths)
+            return FALSE;
+         stream->primitive_lengths = new_lengths;
+         stream->max_primitives = new_size;
+      }
+
+      stream->tmp_output = ((struct vertex_header *)
+                            ((char *)stream->verts +
+                             stream->emitted_vertices * shader->vertex_size))->data;
+#ifdef LLVM_AVAILABLE
+      shader->gs_output[i] = stream->verts;
+#endif
+   }
+   return TRUE;
+}
+
 static void gs_flush(struct draw_geometry_shader *shader)
 {
    unsigned out_prim_count[TGSI_MAX_VERTEX_STREAMS];
@@ -437,6 +489,8 @@ static void gs_flush(struct draw_geometry_shader *shader)
                 input_primitives <= 4);
 
    for (unsigned invocation = 0; invocation < shader->num_invocations; invocation++) {
+      if (!gs_reserve_outputs(shader))
+         break;
       shader->invocation_id = invocation;
       shader->run(shader, input_primitives, out_prim_count);
       for (i = 0; i < shader->num_vertex_streams; i++) {
@@ -576,41 +630,17 @@ int draw_geometry_shader_run(struct draw_geometry_shader *shader,
    unsigned input_stride = input_verts->vertex_size;
    unsigned num_outputs = draw_total_gs_outputs(shader->draw);
    unsigned vertex_size = sizeof(struct vertex_header) + num_outputs * 4 * sizeof(float);
-   unsigned num_input_verts = input_prim->linear ?
-      input_verts->count :
-      input_prim->count;
-   unsigned num_in_primitives =
-      align(
-         MAX2(u_decomposed_prims_for_vertices(input_prim->prim,
-                                              num_input_verts),
-              u_decomposed_prims_for_vertices(shader->input_primitive,
-                                              num_input_verts)),
-         shader->vector_length);
-   unsigned max_out_prims =
-      u_decomposed_prims_for_vertices(shader->output_primitive,
-                                      shader->max_output_vertices)
-      * num_in_primitives;
-   /* we allocate exactly one extra vertex per primitive to allow the GS to emit
-    * overflown vertices into some area where they won't harm anyone */
-   unsigned total_verts_per_buffer = shader->primitive_boundary *
-      num_in_primitives;
    int i;
-   //Assume at least one primitive
-   max_out_prims = MAX2(max_out_prims, 1);
 
    for (i = 0; i < shader->num_vertex_streams; i++) {
       /* write all the vertex data into all the streams */
       output_verts[i].vertex_size = vertex_size;
       output_verts[i].stride = output_verts[i].vertex_size;
-      output_verts[i].verts =
-         (struct vertex_header *)MALLOC(output_verts[i].vertex_size *
-                                        total_verts_per_buffer * shader->num_invocations);
-      debug_assert(output_verts[i].verts);
    }
 
 #if 0
-   debug_printf("%s count = %d (in prims # = %d, invocs = %d, streams = %d)\n",
-                __FUNCTION__, num_input_verts, num_in_primitives,
+   debug_printf("%s count = %d (invocs = %d, streams = %d)\n",
+                __FUNCTION__, input_prim->count,
                 shader->num_invocations, shader->num_vertex_streams);
    debug_printf("\tlinear = %d, prim_info->count = %d\n",
                 input_prim->linear, input_prim->count);
@@ -618,19 +648,20 @@ int draw_geometry_shader_run(struct draw_geometry_shader *shader,
                 u_prim_name(input_prim->prim),
                 u_prim_name(shader->input_primitive),
                 u_prim_name(shader->output_primitive));
-   debug_printf("\tmaxv  = %d, maxp = %d, primitive_boundary = %d, "
-                "vertex_size = %d, tverts = %d\n",
-                shader->max_output_vertices, max_out_prims,
-                shader->primitive_boundary, output_verts->vertex_size,
-                total_verts_per_buffer);
+   debug_printf("\tmaxv  = %d, primitive_boundary = %d, "
+                "vertex_size = %d\n",
+                shader->max_output_vertices,
+                shader->primitive_boundary, output_verts->vertex_size);
 #endif
 
+   /* The vertices are handed over to the caller, the primitive lengths
+    * are kept for the next draw.
+    */
    for (i = 0; i < shader->num_vertex_streams; i++) {
       shader->stream[i].emitted_vertices = 0;
       shader->stream[i].emitted_primitives = 0;
-      FREE(shader->stream[i].primitive_lengths);
-      shader->stream[i].primitive_lengths = MALLOC(max_out_prims * sizeof(unsigned) * shader->num_invocations);
-      shader->stream[i].tmp_output = (float (*)[4])output_verts[i].verts->data;
+      shader->stream[i].verts = NULL;
+      shader->stream[i].max_vertices = 0;
    }
    shader->vertex_size = vertex_size;
    shader->fetched_prim_count = 0;
@@ -638,29 +669,10 @@ int draw_geometry_shader_run(struct draw_geometry_shader *shader,
    shader->input = input;
    shader->input_info = input_info;
 
+   gs_reserve_outputs(shader);
+
 #ifdef LLVM_AVAILABLE
    if (shader->draw->llvm) {
-      for (i = 0; i < shader->num_vertex_streams; i++) {
-         shader->gs_output[i] = output_verts[i].verts;
-      }
-      if (max_out_prims > shader->max_out_prims) {
-         unsigned i;
-         if (shader->llvm_prim_lengths) {
-            for (i = 0; i < shader->num_vertex_streams * shader->max_out_prims; ++i) {
-               align_free(shader->llvm_prim_lengths[i]);
-            }
-            FREE(shader->llvm_prim_lengths);
-         }
-
-         shader->llvm_prim_lengths = MALLOC(shader->num_vertex_streams * max_out_prims * sizeof(unsigned*));
-         for (i = 0; i < shader->num_vertex_streams * max_out_prims; ++i) {
-            int vector_size = shader->vector_length * sizeof(unsigned);
-            shader->llvm_prim_lengths[i] =
-               align_malloc(vector_size, vector_size);
-         }
-
-         shader->max_out_prims = max_out_prims;
-      }
       shader->jit_context->prim_lengths = shader->llvm_prim_lengths;
       shader->jit_context->emitted_vertices = shader->llvm_emitted_vertices;
       shader->jit_context->emitted_prims = shader->llvm_emitted_primitives;
@@ -696,6 +708,9 @@ int draw_geometry_shader_run(struct draw_geometry_shader *shader,
       output_prims[i].primitive_lengths = shader->stream[i].primitive_lengths;
       output_prims[i].primitive_count = shader->stream[i].emitted_primitives;
       output_verts[i].count = shader->stream[i].emitted_vertices;
+      output_verts[i].verts = shader->stream[i].verts;
+      shader->stream[i].verts = NULL;
+      shader->stream[i].max_vertices = 0;
 
       if (shader->draw->collect_statistics) {
          unsigned j;
@@ -809,9 +824,6 @@ draw_create_geometry_shader(struct draw_context *draw,
    } else
       nir_tgsi_scan_shader(state->ir.nir, &gs->info, true);
 
-   /* setup the defaults */
-   gs->max_out_prims = 0;
-
 #ifdef LLVM_AVAILABLE
    if (use_llvm) {
       /* TODO: change the input array to handle the following
@@ -874,7 +886,17 @@ draw_create_geometry_shader(struct draw_context *draw,
       int vector_size = gs->vector_length * sizeof(float);
       gs->gs_input = align_malloc(sizeof(struct draw_gs_inputs), 16);
       memset(gs->gs_input, 0, sizeof(struct draw_gs_inputs));
-      gs->llvm_prim_lengths = 0;
+
+      /* Every primitive has a vertex, and the vertices past
+       * max_output_vertices are dropped, see primitive_boundary.
+       */
+      gs->max_out_prims = gs->primitive_boundary;
+      gs->llvm_prim_lengths =
+         MALLOC(gs->num_vertex_streams * gs->max_out_prims * sizeof(unsigned*));
+      if (gs->llvm_prim_lengths) {
+         for (i = 0; i < gs->num_vertex_streams * gs->max_out_prims; ++i)
+            gs->llvm_prim_lengths[i] = align_malloc(vector_size, vector_size);
+      }
 
       gs->llvm_emitted_primitives = align_malloc(vector_size * gs->num_vertex_streams, vector_size);
       gs->llvm_emitted_vertices = align_malloc(vector_size * gs->num_vertex_streams, vector_size);
@@ -958,8 +980,10 @@ void draw_delete_geometry_shader(struct draw_context *draw,
    }
 #endif
 
-   for (i = 0; i < TGSI_MAX_VERTEX_STREAMS; i++)
+   for (i = 0; i < TGSI_MAX_VERTEX_STREAMS; i++) {
       FREE(dgs->stream[i].primitive_lengths);
+      FREE(dgs->stream[i].verts);
+   }
 
    if (dgs->state.ir.nir)
       ralloc_free(dgs->state.ir.nir);
@@ -59,9 +59,14 @@ struct draw_gs_inputs {
  */
 struct draw_vertex_stream {
    unsigned *primitive_lengths;
+   unsigned max_primitives;   /**< allocated primitive_lengths */
    unsigned emitted_vertices;
    unsigned emitted_primitives;
    float (*tmp_output)[4];
+
+   /** The output vertices of the draw, grown as they are emitted */
+   struct vertex_header *verts;
+   unsigned max_vertices;
 };
 
 struct draw_geometry_shader {
@@ -92,7 +97,7 @@ struct draw_geometry_shader {
    const float (*input)[4];
    const struct tgsi_shader_info *input_info;
    unsigned vector_length;
-   unsigned max_out_prims;
+   unsigned max_out_prims;   /**< per invocation and stream, see llvm_prim_lengths */
 
    unsigned num_invocations;
    unsigned invocation_id;
@@ -59,6 +59,7 @@
 #include "util/u_pointer.h"
 #include "util/u_string.h"
 #include "util/simple_list.h"
+#include "util/hash_table.h"
 #include "nir_serialize.h"
 #include "util/mesa-sha1.h"
 #define DEBUG_STORE 0
@@ -772,8 +773,8 @@ draw_llvm_create(struct draw_context *draw, LLVMContextRef context)
 {
    struct draw_llvm *llvm;
 
-   if (!lp_build_init())
-      return NULL;
+   /* LLVM is initialized by the first variant's gallivm_create() */
+   lp_build_init_native();
 
    llvm = CALLOC_STRUCT( draw_llvm );
    if (!llvm)
@@ -823,6 +824,31 @@ draw_llvm_destroy(struct draw_llvm *llvm)
    FREE(llvm);
 }
 
+
+/**
+ * Bytes of code of all the shader variants.
+ */
+size_t
+draw_llvm_code_size(struct draw_llvm *llvm)
+{
+   struct draw_llvm_variant_list_item *li;
+   struct draw_gs_llvm_variant_list_item *gs_li;
+   struct draw_tcs_llvm_variant_list_item *tcs_li;
+   struct draw_tes_llvm_variant_list_item *tes_li;
+   size_t size = 0;
+
+   foreach(li, &llvm->vs_variants_list)
+      size += gallivm_code_size(li->base->gallivm);
+   foreach(gs_li, &llvm->gs_variants_list)
+      size += gallivm_code_size(gs_li->base->gallivm);
+   foreach(tcs_li, &llvm->tcs_variants_list)
+      size += gallivm_code_size(tcs_li->base->gallivm);
+   foreach(tes_li, &llvm->tes_variants_list)
+      size += gallivm_code_size(tes_li->base->gallivm);
+
+   return size;
+}
+
 static void
 draw_get_ir_cache_key(struct nir_shader *nir,
                       const void *key, size_t key_size,
@@ -2652,6 +2678,7 @@ draw_llvm_destroy_variant(struct draw_llvm_variant *variant)
    gallivm_destroy(variant->gallivm);
 
    remove_from_list(&variant->list_item_local);
+   _mesa_hash_table_remove_key(variant->shader->variant_table, &variant->key);
    variant->shader->variants_cached--;
    remove_from_list(&variant->list_item_global);
    llvm->nr_variants--;
@@ -3467,7 +3494,7 @@ draw_tcs_llvm_generate(struct draw_llvm *llvm,
 
    {
       LLVMValueRef coro_id = lp_build_coro_id(gallivm);
-      LLVMValueRef coro_hdl = lp_build_coro_begin_alloc_mem(gallivm, coro_id);
+      LLVMValueRef coro_hdl = lp_build_coro_begin_alloc_mem(gallivm, coro_id, NULL);
 
       mask_val = generate_tcs_mask_value(variant, tcs_type, count, LLVMBuildMul(builder, counter, step, ""));
       lp_build_mask_begin(&mask, gallivm, tcs_type, mask_val);
@@ -3506,7 +3533,7 @@ draw_tcs_llvm_generate(struct draw_llvm *llvm,
       lp_build_coro_suspend_switch(gallivm, &coro_info, NULL, true);
       LLVMPositionBuilderAtEnd(builder, clean_block);
 
-      lp_build_coro_free_mem(gallivm, coro_id, coro_hdl);
+      lp_build_coro_free_mem(gallivm, coro_id, coro_hdl, NULL);
 
       LLVMBuildBr(builder, sus_block);
       LLVMPositionBuilderAtEnd(builder, sus_block);
@@ -43,6 +43,7 @@
 
 struct draw_llvm;
 struct llvm_vertex_shader;
+struct hash_table;
 struct llvm_geometry_shader;
 struct llvm_tess_ctrl_shader;
 struct llvm_tess_eval_shader;
@@ -746,6 +747,7 @@ struct llvm_vertex_shader {
 
    unsigned variant_key_size;
    struct draw_llvm_variant_list_item variants;
+   struct hash_table *variant_table;   /**< the same variants, by key */
    unsigned variants_created;
    unsigned variants_cached;
 };
@@ -832,6 +834,9 @@ draw_llvm_create(struct draw_context *draw, LLVMContextRef llvm_context);
 void
 draw_llvm_destroy(struct draw_llvm *llvm);
 
+size_t
+draw_llvm_code_size(struct draw_llvm *llvm);
+
 struct draw_llvm_variant *
 draw_llvm_create_variant(struct draw_llvm *llvm,
                          unsigned num_vertex_header_attribs,
@@ -155,6 +155,7 @@ draw_llvm_sampler_member(const struct lp_sampler_dynamic_state *base,
                          struct gallivm_state *gallivm,
                          LLVMValueRef context_ptr,
                          unsigned sampler_unit,
+                         LLVMValueRef sampler_unit_offset,
                          unsigned member_index,
                          const char *member_name,
                          boolean emit_load)
@@ -172,6 +173,11 @@ draw_llvm_sampler_member(const struct lp_sampler_dynamic_state *base,
    indices[1] = lp_build_const_int32(gallivm, DRAW_JIT_CTX_SAMPLERS);
    /* context[0].samplers[unit] */
    indices[2] = lp_build_const_int32(gallivm, sampler_unit);
+   if (sampler_unit_offset) {
+      indices[2] = LLVMBuildAdd(gallivm->builder, indices[2], sampler_unit_offset, "");
+      LLVMValueRef cond = LLVMBuildICmp(gallivm->builder, LLVMIntULT, indices[2], lp_build_const_int32(gallivm, PIPE_MAX_SAMPLERS), "");
+      indices[2] = LLVMBuildSelect(gallivm->builder, cond, indices[2], lp_build_const_int32(gallivm, sampler_unit), "");
+   }
    /* context[0].samplers[unit].member */
    indices[3] = lp_build_const_int32(gallivm, member_index);
 
@@ -278,10 +284,12 @@ DRAW_LLVM_TEXTURE_MEMBER(sample_stride, DRAW_JIT_TEXTURE_SAMPLE_STRIDE, TRUE)
    draw_llvm_sampler_##_name( const struct lp_sampler_dynamic_state *base, \
                               struct gallivm_state *gallivm,               \
                               LLVMValueRef context_ptr,                    \
-                              unsigned sampler_unit)                       \
+                              unsigned sampler_unit,                       \
+                              LLVMValueRef sampler_unit_offset)            \
    { \
       return draw_llvm_sampler_member(base, gallivm, context_ptr, \
-                                      sampler_unit, _index, #_name, _emit_load ); \
+                                      sampler_unit, sampler_unit_offset, \
+                                      _index, #_name, _emit_load ); \
    }
 
 
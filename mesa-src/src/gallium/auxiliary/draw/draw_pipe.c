@@ -34,8 +34,34 @@
 #include "draw/draw_pipe.h"
 #include "util/u_debug.h"
 #include "util/u_math.h"
+#include "util/u_memory.h"
+#include "util/u_prim.h"
 
 
+/** Triangles which are clip tested and culled together */
+#define DRAW_TRI_BATCH_SIZE 8
+
+/**
+ * Triangles on their way into the clip and cull stages.  These are run
+ * on a batch of triangles at a time, in straight loops over the batch,
+ * so that the compiler can vectorize them: unclipped triangles are
+ * culled right here and handed to the stage after cull, trivially
+ * rejected ones are dropped, and only the ones which need clipping go
+ * through the clip stage.
+ */
+struct draw_tri_batch {
+   boolean enabled;
+   struct draw_stage *clip;   /**< NULL if not in the pipeline */
+   struct draw_stage *cull;   /**< NULL if not in the pipeline */
+   struct draw_stage *next;   /**< the stage after them */
+   unsigned cull_face;
+   unsigned front_ccw;
+   unsigned pos;
+
+   unsigned count;
+   struct prim_header prims[DRAW_TRI_BATCH_SIZE];
+};
+
 
 boolean draw_pipeline_init( struct draw_context *draw )
 {
@@ -52,6 +78,7 @@ boolean draw_pipeline_init( struct draw_context *draw )
    draw->pipeline.user_cull = draw_user_cull_stage( draw );
    draw->pipeline.validate  = draw_validate_stage( draw );
    draw->pipeline.first     = draw->pipeline.validate;
+   draw->pipeline.tri_batch = CALLOC_STRUCT( draw_tri_batch );
 
    if (!draw->pipeline.wide_line ||
        !draw->pipeline.wide_point ||
@@ -63,7 +90,8 @@ boolean draw_pipeline_init( struct draw_context *draw )
        !draw->pipeline.flatshade ||
        !draw->pipeline.cull ||
        !draw->pipeline.user_cull ||
-       !draw->pipeline.validate)
+       !draw->pipeline.validate ||
+       !draw->pipeline.tri_batch)
       return FALSE;
 
    /* these defaults are oriented toward the needs of softpipe */
@@ -109,6 +137,123 @@ void draw_pipeline_destroy( struct draw_context *draw )
       draw->pipeline.pstipple->destroy( draw->pipeline.pstipple );
    if (draw->pipeline.rasterize)
       draw->pipeline.rasterize->destroy( draw->pipeline.rasterize );
+   FREE( draw->pipeline.tri_batch );
+}
+
+
+/**
+ * Set up batching of the triangles of a run of the pipeline, if it
+ * starts with the clip and/or cull stages.
+ */
+static void tri_batch_begin( struct draw_context *draw,
+                             unsigned prim )
+{
+   struct draw_tri_batch *batch = draw->pipeline.tri_batch;
+   struct draw_stage *stage;
+
+   batch->enabled = FALSE;
+   batch->count = 0;
+
+   if (u_reduced_prim(prim) != PIPE_PRIM_TRIANGLES)
+      return;
+
+   stage = draw_validate_pipeline( draw );
+
+   batch->clip = NULL;
+   if (stage == draw->pipeline.clip) {
+      batch->clip = stage;
+      stage = stage->next;
+   }
+
+   batch->cull = NULL;
+   if (stage == draw->pipeline.cull) {
+      batch->cull = stage;
+      stage = stage->next;
+   }
+
+   if (!batch->clip && !batch->cull)
+      return;
+
+   batch->next = stage;
+   batch->cull_face = draw->rasterizer->cull_face;
+   batch->front_ccw = draw->rasterizer->front_ccw;
+   batch->pos = draw_current_shader_position_output(draw);
+   batch->enabled = TRUE;
+}
+
+
+/**
+ * Clip test and cull the batched triangles, see cull_tri() and
+ * clip_tri(), and pass them on in order.
+ */
+static void tri_batch_flush( struct draw_context *draw )
+{
+   struct draw_tri_batch *batch = draw->pipeline.tri_batch;
+   const unsigned n = batch->count;
+   const unsigned pos = batch->pos;
+   unsigned or_mask[DRAW_TRI_BATCH_SIZE];
+   unsigned and_mask[DRAW_TRI_BATCH_SIZE];
+   float ex[DRAW_TRI_BATCH_SIZE], ey[DRAW_TRI_BATCH_SIZE];
+   float fx[DRAW_TRI_BATCH_SIZE], fy[DRAW_TRI_BATCH_SIZE];
+   float det[DRAW_TRI_BATCH_SIZE];
+   unsigned face[DRAW_TRI_BATCH_SIZE];
+   unsigned i;
+
+   if (!n)
+      return;
+   batch->count = 0;
+
+   for (i = 0; i < n; i++) {
+      const struct prim_header *header = &batch->prims[i];
+      or_mask[i] = (header->v[0]->clipmask |
+                    header->v[1]->clipmask |
+                    header->v[2]->clipmask);
+      and_mask[i] = (header->v[0]->clipmask &
+                     header->v[1]->clipmask &
+                     header->v[2]->clipmask);
+   }
+
+   if (batch->cull) {
+      /* edge vectors: e = v0 - v2, f = v1 - v2 */
+      for (i = 0; i < n; i++) {
+         const struct prim_header *header = &batch->prims[i];
+         const float *v0 = header->v[0]->data[pos];
+         const float *v1 = header->v[1]->data[pos];
+         const float *v2 = header->v[2]->data[pos];
+         ex[i] = v0[0] - v2[0];
+         ey[i] = v0[1] - v2[1];
+         fx[i] = v1[0] - v2[0];
+         fy[i] = v1[1] - v2[1];
+      }
+
+      for (i = 0; i < n; i++)
+         det[i] = ex[i] * fy[i] - ey[i] * fx[i];
+
+      /* zero area triangles are back facing */
+      for (i = 0; i < n; i++) {
+         unsigned ccw = det[i] < 0;
+         face[i] = (det[i] != 0 && ccw == batch->front_ccw) ?
+                   PIPE_FACE_FRONT : PIPE_FACE_BACK;
+      }
+   }
+
+   for (i = 0; i < n; i++) {
+      struct prim_header *header = &batch->prims[i];
+
+      if (batch->clip && or_mask[i]) {
+         if (and_mask[i] == 0)
+            batch->clip->tri( batch->clip, header );
+         continue;
+      }
+
+      if (batch->cull) {
+         header->det = det[i];
+         if (face[i] & batch->cull_face)
+            continue;
+      }
+
+      batch->next->tri( batch->next, header );
+   }
 }
 
 
@@ -159,8 +304,23 @@ static void do_triangle( struct draw_context *draw,
 			 char *v1,
 			 char *v2 )
 {
+   struct draw_tri_batch *batch = draw->pipeline.tri_batch;
    struct prim_header prim;
-   
+
+   if (batch->enabled) {
+      struct prim_header *header = &batch->prims[batch->count];
+
+      header->v[0] = (struct vertex_header *)v0;
+      header->v[1] = (struct vertex_header *)v1;
+      header->v[2] = (struct vertex_header *)v2;
+      header->flags = flags;
+      header->pad = 0;
+
+      if (++batch->count == DRAW_TRI_BATCH_SIZE)
+         tri_batch_flush( draw );
+      return;
+   }
+
    prim.v[0] = (struct vertex_header *)v0;
    prim.v[1] = (struct vertex_header *)v1;
    prim.v[2] = (struct vertex_header *)v2;
@@ -233,10 +393,14 @@ void draw_pipeline_run( struct draw_context *draw,
 {
    unsigned i, start;
 
+   draw_pt_replay_abort(draw);
+
    draw->pipeline.verts = (char *)vert_info->verts;
    draw->pipeline.vertex_stride = vert_info->stride;
    draw->pipeline.vertex_count = vert_info->count;
 
+   tri_batch_begin(draw, prim_info->prim);
+
    for (start = i = 0;
         i < prim_info->primitive_count;
         start += prim_info->primitive_lengths[i], i++)
@@ -272,6 +436,9 @@ void draw_pipeline_run( struct draw_context *draw,
                     vert_info->count - 1);
    }
 
+   tri_batch_flush(draw);
+   draw->pipeline.tri_batch->enabled = FALSE;
+
    draw->pipeline.verts = NULL;
    draw->pipeline.vertex_count = 0;
 }
@@ -320,6 +487,10 @@ void draw_pipeline_run_linear( struct draw_context *draw,
 {
    unsigned i, start;
 
+   draw_pt_replay_abort(draw);
+
+   tri_batch_begin(draw, prim_info->prim);
+
    for (start = i = 0;
         i < prim_info->primitive_count;
         start += prim_info->primitive_lengths[i], i++)
@@ -340,8 +511,13 @@ void draw_pipeline_run_linear( struct draw_context *draw,
                       (struct vertex_header*)verts,
                       vert_info->stride,
                       count);
+
+      /* the batch points into this primitive's vertices */
+      tri_batch_flush(draw);
    }
 
+   draw->pipeline.tri_batch->enabled = FALSE;
+
    draw->pipeline.verts = NULL;
    draw->pipeline.vertex_count = 0;
 }
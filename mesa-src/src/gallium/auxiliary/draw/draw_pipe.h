@@ -98,6 +98,8 @@ extern boolean draw_alloc_temp_verts( struct draw_stage *stage, unsigned nr );
 
 extern void draw_reset_vertex_ids( struct draw_context *draw );
 
+extern struct draw_stage *draw_validate_pipeline( struct draw_context *draw );
+
 void draw_pipe_passthrough_tri(struct draw_stage *stage, struct prim_header *header);
 void draw_pipe_passthrough_line(struct draw_stage *stage, struct prim_header *header);
 void draw_pipe_passthrough_point(struct draw_stage *stage, struct prim_header *header);
@@ -285,6 +285,19 @@ static struct draw_stage *validate_pipeline( struct draw_stage *stage )
    return draw->pipeline.first;
 }
 
+
+/**
+ * Build the pipeline before the first primitive reaches it, for
+ * draw_pipeline_run(), which looks at the stages to batch triangles.
+ */
+struct draw_stage *
+draw_validate_pipeline(struct draw_context *draw)
+{
+   if (draw->pipeline.first == draw->pipeline.validate)
+      return validate_pipeline(draw->pipeline.validate);
+   return draw->pipeline.first;
+}
+
 static void validate_tri( struct draw_stage *stage, 
 			  struct prim_header *header )
 {
@@ -59,10 +59,25 @@ struct gallivm_state;
  */
 #define DRAW_MAX_FETCH_IDX 0xffffffff
 
+/**
+ * Vertices of all the instances shaded in one run of the llvm middle end
+ * at most, the vsplit segment size.
+ */
+#define DRAW_MAX_INSTANCE_BATCH_VERTICES 4096
+
+/**
+ * Restart draws whose runs of elements are remembered, and the smallest
+ * index count worth it.
+ */
+#define DRAW_RESTART_CACHE_SIZE 8
+#define DRAW_RESTART_CACHE_MIN_COUNT 256
+
 struct pipe_context;
 struct draw_vertex_shader;
 struct draw_context;
 struct draw_stage;
+struct draw_tri_batch;
+struct draw_tes_queue;
 struct vbuf_render;
 struct tgsi_exec_machine;
 struct tgsi_sampler;
@@ -76,6 +91,24 @@ struct lp_cached_code;
 /**
  * Represents the mapped vertex buffer.
  */
+/**
+ * The runs of elements between the restart indexes of a draw, see
+ * draw_pt_arrays_restart().
+ */
+struct draw_restart_runs {
+   const void *elts;
+   uint64_t serial;
+   unsigned elt_size;
+   unsigned elt_max;
+   unsigned start;
+   unsigned count;
+   unsigned restart_index;
+
+   unsigned num_runs;
+   unsigned max_runs;
+   unsigned *runs;      /**< start, count pairs */
+};
+
 struct draw_vertex_buffer {
    const void *map;
    uint32_t size;
@@ -145,6 +178,8 @@ struct draw_context
       char *verts;
       unsigned vertex_stride;
       unsigned vertex_count;
+
+      struct draw_tri_batch *tri_batch;  /**< see draw_pipe.c */
    } pipeline;
 
 
@@ -194,6 +229,8 @@ struct draw_context
          unsigned eltSizeIB;
          unsigned eltSize;
          unsigned eltMax;
+         /** driver's serial for the contents of elts, 0 if unknown */
+         uint64_t eltSerial;
          int eltBias;         
          unsigned min_index;
          unsigned max_index;
@@ -228,6 +265,16 @@ struct draw_context
 
       boolean test_fse;         /* enable FSE even though its not correct (eg for softpipe) */
       boolean no_fse;           /* disable FSE even when it is correct */
+
+      /** Post-transform vertex replay, see draw_pt_replay.c */
+      struct draw_pt_replay *replay;
+      uint64_t replay_serial;
+      boolean replay_state_dirty;
+
+      /** Restart runs of recent draws, and of the current uncached one */
+      struct draw_restart_runs restart_cache[DRAW_RESTART_CACHE_SIZE];
+      struct draw_restart_runs restart_scratch;
+      unsigned restart_cache_next;
    } pt;
 
    struct {
@@ -252,6 +299,7 @@ struct draw_context
    boolean guard_band_points_xy;
 
    boolean force_passthrough; /**< never clip or shade */
+   boolean rasterizer_discard; /**< the driver drops all primitives */
 
    boolean dump_vs;
 
@@ -330,6 +378,9 @@ struct draw_context
       struct draw_tess_eval_shader *tess_eval_shader;
       uint position_output;
 
+      /** Threads evaluating the patches of a draw, see DRAW_THREADS */
+      struct draw_tes_queue *queue;
+
       /** Fields for TGSI interpreter / execution */
       struct {
          struct tgsi_exec_machine *machine;
@@ -366,6 +417,7 @@ struct draw_context
 
    unsigned instance_id;
    unsigned start_instance;
+   unsigned instance_batch;   /**< instances per pipeline run, see draw_vbo() */
    unsigned start_index;
    unsigned constant_buffer_stride;
    struct draw_llvm *llvm;
@@ -533,6 +585,28 @@ void draw_pipeline_flush( struct draw_context *draw,
 void draw_do_flush( struct draw_context *draw, unsigned flags );
 
 
+/*******************************************************************************
+ * Post-transform vertex replay
+ */
+boolean draw_pt_replay_begin(struct draw_context *draw,
+                             const struct pipe_draw_info *info);
+
+void draw_pt_replay_end(struct draw_context *draw);
+
+void draw_pt_replay_record(struct draw_context *draw,
+                           const struct draw_prim_info *prim_info,
+                           const void *vertices, unsigned stride,
+                           unsigned vertex_size, unsigned nr_vertices);
+
+void draw_pt_replay_abort(struct draw_context *draw);
+
+void draw_pt_replay_flush(struct draw_context *draw);
+
+size_t draw_pt_replay_size(const struct draw_context *draw);
+
+void draw_pt_replay_destroy(struct draw_context *draw);
+
+
 
 void *
 draw_get_rasterizer_no_cull( struct draw_context *draw,
@@ -557,6 +631,17 @@ void draw_update_viewport_flags(struct draw_context *draw);
  * Return index of the given viewport clamping it
  * to be between 0 <= and < PIPE_MAX_VIEWPORTS
  */
+/**
+ * Nothing is rasterized: once stream output is done with the vertices,
+ * there is no point in clipping and emitting them.
+ */
+static inline boolean
+draw_discards_primitives(const struct draw_context *draw)
+{
+   return draw->rasterizer_discard ||
+          (draw->rasterizer && draw->rasterizer->rasterizer_discard);
+}
+
 static inline unsigned
 draw_clamp_viewport_idx(int idx)
 {
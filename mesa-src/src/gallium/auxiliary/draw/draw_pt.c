@@ -32,6 +32,7 @@
 
 #include "draw/draw_context.h"
 #include "draw/draw_gs.h"
+#include "draw/draw_prim_assembler.h"
 #include "draw/draw_tess.h"
 #include "draw/draw_private.h"
 #include "draw/draw_pt.h"
@@ -39,6 +40,7 @@
 #include "draw/draw_vs.h"
 #include "tgsi/tgsi_dump.h"
 #include "util/u_math.h"
+#include "util/u_memory.h"
 #include "util/u_prim.h"
 #include "util/format/u_format.h"
 #include "util/u_draw.h"
@@ -157,6 +159,9 @@ draw_pt_arrays(struct draw_context *draw,
 
    frontend->run( frontend, start, count );
 
+   if (middle->flush)
+      middle->flush( middle );
+
    return TRUE;
 }
 
@@ -211,6 +216,14 @@ boolean draw_pt_init( struct draw_context *draw )
 
 void draw_pt_destroy( struct draw_context *draw )
 {
+   unsigned i;
+
+   draw_pt_replay_destroy( draw );
+
+   for (i = 0; i < DRAW_RESTART_CACHE_SIZE; i++)
+      FREE(draw->pt.restart_cache[i].runs);
+   FREE(draw->pt.restart_scratch.runs);
+
    if (draw->pt.middle.llvm) {
       draw->pt.middle.llvm->destroy( draw->pt.middle.llvm );
       draw->pt.middle.llvm = NULL;
@@ -351,16 +364,38 @@ draw_print_arrays(struct draw_context *draw, uint prim, int start, uint count)
 }
 
 
+static boolean
+draw_restart_runs_add(struct draw_restart_runs *runs,
+                      unsigned start, unsigned count)
+{
+   if (runs->num_runs == runs->max_runs) {
+      unsigned max_runs = MAX2(16, runs->max_runs * 2);
+      unsigned *data = REALLOC(runs->runs,
+                               runs->max_runs * 2 * sizeof(unsigned),
+                               max_runs * 2 * sizeof(unsigned));
+      if (!data)
+         return FALSE;
+      runs->runs = data;
+      runs->max_runs = max_runs;
+   }
+
+   runs->runs[runs->num_runs * 2] = start;
+   runs->runs[runs->num_runs * 2 + 1] = count;
+   runs->num_runs++;
+   return TRUE;
+}
+
+
 /** Helper code for below */
 #define PRIM_RESTART_LOOP(elements) \
    do { \
       for (j = 0; j < count; j++) {               \
          i = draw_overflow_uadd(start, j, MAX_LOOP_IDX);  \
-         if (i < elt_max && elements[i] == info->restart_index) { \
-            if (cur_count > 0) { \
-               /* draw elts up to prev pos */ \
-               draw_pt_arrays(draw, prim, cur_start, cur_count); \
-            } \
+         if (i < elt_max && elements[i] == restart_index) { \
+            /* end the run at the previous element */ \
+            if (cur_count > 0 && \
+                !draw_restart_runs_add(runs, cur_start, cur_count)) \
+               return FALSE; \
             /* begin new prim at next elt */ \
             cur_start = i + 1; \
             cur_count = 0; \
@@ -369,65 +404,133 @@ draw_print_arrays(struct draw_context *draw, uint prim, int start, uint count)
             cur_count++; \
          } \
       } \
-      if (cur_count > 0) { \
-         draw_pt_arrays(draw, prim, cur_start, cur_count); \
-      } \
+      if (cur_count > 0 && \
+          !draw_restart_runs_add(runs, cur_start, cur_count)) \
+         return FALSE; \
    } while (0)
 
 
+/**
+ * Scan for restart indexes, filling runs with the runs of elements
+ * between them.
+ */
+static boolean
+draw_restart_scan(struct draw_restart_runs *runs)
+{
+   const unsigned start = runs->start;
+   const unsigned count = runs->count;
+   const unsigned elt_max = runs->elt_max;
+   const unsigned restart_index = runs->restart_index;
+   unsigned i, j, cur_start = start, cur_count = 0;
+   /* The largest index within a loop using the i variable as the index.
+    * Used for overflow detection */
+   const unsigned MAX_LOOP_IDX = 0xffffffff;
+
+   runs->num_runs = 0;
+
+   switch (runs->elt_size) {
+   case 1:
+      {
+         const ubyte *elt_ub = (const ubyte *) runs->elts;
+         PRIM_RESTART_LOOP(elt_ub);
+      }
+      break;
+   case 2:
+      {
+         const ushort *elt_us = (const ushort *) runs->elts;
+         PRIM_RESTART_LOOP(elt_us);
+      }
+      break;
+   case 4:
+      {
+         const uint *elt_ui = (const uint *) runs->elts;
+         PRIM_RESTART_LOOP(elt_ui);
+      }
+      break;
+   default:
+      assert(0 && "bad eltSize in draw_arrays()");
+   }
+
+   return TRUE;
+}
+
+
+/**
+ * Find the runs of a draw.  Draws of index buffers with a serial from the
+ * driver are looked up among the recent ones, others are scanned into a
+ * scratch list each time.
+ */
+static struct draw_restart_runs *
+draw_restart_lookup(struct draw_context *draw,
+                    const struct pipe_draw_info *info)
+{
+   const uint64_t serial = draw->pt.user.eltSerial;
+   struct draw_restart_runs *runs = &draw->pt.restart_scratch;
+   unsigned i;
+
+   if (serial && info->count >= DRAW_RESTART_CACHE_MIN_COUNT) {
+      for (i = 0; i < DRAW_RESTART_CACHE_SIZE; i++) {
+         runs = &draw->pt.restart_cache[i];
+         if (runs->serial == serial &&
+             runs->elts == draw->pt.user.elts &&
+             runs->elt_size == draw->pt.user.eltSize &&
+             runs->elt_max == draw->pt.user.eltMax &&
+             runs->start == info->start &&
+             runs->count == info->count &&
+             runs->restart_index == info->restart_index)
+            return runs;
+      }
+
+      runs = &draw->pt.restart_cache[draw->pt.restart_cache_next];
+      draw->pt.restart_cache_next =
+         (draw->pt.restart_cache_next + 1) % DRAW_RESTART_CACHE_SIZE;
+   }
+
+   runs->elts = draw->pt.user.elts;
+   runs->elt_size = draw->pt.user.eltSize;
+   runs->elt_max = draw->pt.user.eltMax;
+   runs->start = info->start;
+   runs->count = info->count;
+   runs->restart_index = info->restart_index;
+   runs->serial = 0;
+
+   if (!draw_restart_scan(runs))
+      return NULL;
+
+   if (runs != &draw->pt.restart_scratch)
+      runs->serial = serial;
+   return runs;
+}
+
+
 /**
  * For drawing prims with primitive restart enabled.
- * Scan for restart indexes and draw the runs of elements/vertices between
- * the restarts.
+ * Draw the runs of elements/vertices between the restart indexes.
  */
 static void
 draw_pt_arrays_restart(struct draw_context *draw,
                        const struct pipe_draw_info *info)
 {
    const unsigned prim = info->mode;
-   const unsigned start = info->start;
-   const unsigned count = info->count;
-   const unsigned elt_max = draw->pt.user.eltMax;
-   unsigned i, j, cur_start, cur_count;
-   /* The largest index within a loop using the i variable as the index.
-    * Used for overflow detection */
-   const unsigned MAX_LOOP_IDX = 0xffffffff;
+   struct draw_restart_runs *runs;
+   unsigned i;
 
    assert(info->primitive_restart);
 
    if (draw->pt.user.eltSize) {
       /* indexed prims (draw_elements) */
-      cur_start = start;
-      cur_count = 0;
-
-      switch (draw->pt.user.eltSize) {
-      case 1:
-         {
-            const ubyte *elt_ub = (const ubyte *) draw->pt.user.elts;
-            PRIM_RESTART_LOOP(elt_ub);
-         }
-         break;
-      case 2:
-         {
-            const ushort *elt_us = (const ushort *) draw->pt.user.elts;
-            PRIM_RESTART_LOOP(elt_us);
-         }
-         break;
-      case 4:
-         {
-            const uint *elt_ui = (const uint *) draw->pt.user.elts;
-            PRIM_RESTART_LOOP(elt_ui);
-         }
-         break;
-      default:
-         assert(0 && "bad eltSize in draw_arrays()");
-      }
+      runs = draw_restart_lookup(draw, info);
+      if (!runs)
+         return;
+
+      for (i = 0; i < runs->num_runs; i++)
+         draw_pt_arrays(draw, prim, runs->runs[i * 2], runs->runs[i * 2 + 1]);
    }
    else {
       /* Non-indexed prims (draw_arrays).
        * Primitive restart should have been handled in gallium frontends.
        */
-      draw_pt_arrays(draw, prim, start, count);
+      draw_pt_arrays(draw, prim, info->start, info->count);
    }
 }
 
@@ -459,31 +562,60 @@ resolve_draw_info(const struct pipe_draw_info *raw_info,
 }
 
 /**
- * Draw vertex arrays.
- * This is the main entrypoint into the drawing module.  If drawing an indexed
- * primitive, the draw_set_indexes() function should have already been called
- * to specify the element/index buffer information.
+ * How many instances of the draw can be shaded in one run of the
+ * pipeline.  The llvm middle end then calls the vertex shader once per
+ * instance, into consecutive vertices, and replicates the elements, so
+ * each instance must fit into one vsplit segment and the primitives of
+ * consecutive instances must not connect or be numbered.
  */
-void
-draw_vbo(struct draw_context *draw,
-         const struct pipe_draw_info *info)
+static unsigned
+draw_instance_batch(const struct draw_context *draw,
+                    const struct pipe_draw_info *info,
+                    unsigned count)
 {
-   unsigned instance;
-   unsigned index_limit;
-   unsigned count;
-   unsigned fpstate = util_fpstate_get();
-   struct pipe_draw_info resolved_info;
+   struct draw_prim_info prim_info;
+
+   if (!draw->pt.middle.llvm ||
+       info->instance_count < 2 ||
+       info->primitive_restart ||
+       count == 0 || count > DRAW_MAX_INSTANCE_BATCH_VERTICES / 2 ||
+       info->start_instance + info->instance_count < info->start_instance ||
+       draw->gs.geometry_shader ||
+       draw->tcs.tess_ctrl_shader ||
+       draw->tes.tess_eval_shader)
+      return 1;
+
+   switch (info->mode) {
+   case PIPE_PRIM_POINTS:
+   case PIPE_PRIM_LINES:
+   case PIPE_PRIM_TRIANGLES:
+      break;
+   default:
+      return 1;
+   }
 
-   if (info->instance_count == 0)
-      return;
+   /* primitive ids restart with each instance */
+   memset(&prim_info, 0, sizeof prim_info);
+   prim_info.prim = info->mode;
+   if (draw_prim_assembler_is_required(draw, &prim_info, NULL))
+      return 1;
 
-   /* Make sure that denorms are treated like zeros. This is 
-    * the behavior required by D3D10. OpenGL doesn't care.
-    */
-   util_fpstate_set_denorms_to_zero(fpstate);
+   return MIN2(info->instance_count, DRAW_MAX_INSTANCE_BATCH_VERTICES / count);
+}
 
-   resolve_draw_info(info, &resolved_info, &(draw->pt.vertex_buffer[0]));
-   info = &resolved_info;
+
+/**
+ * Run one draw, with the statistics and rounding mode already set up by
+ * draw_vbo() or draw_vbo_multi().
+ */
+static void
+draw_vbo_run(struct draw_context *draw,
+             const struct pipe_draw_info *info)
+{
+   unsigned instance;
+   unsigned index_limit;
+   unsigned count;
+   unsigned batch;
 
    if (info->index_size)
       assert(draw->pt.user.elts);
@@ -541,28 +673,28 @@ draw_vbo(struct draw_context *draw,
       if (index_limit == 0) {
          /* one of the buffers is too small to do any valid drawing */
          debug_warning("draw: VBO too small to draw anything\n");
-         util_fpstate_set(fpstate);
          return;
       }
    }
 
-   /* If we're collecting stats then make sure we start from scratch */
-   if (draw->collect_statistics) {
-      memset(&draw->statistics, 0, sizeof(draw->statistics));
-   }
-
    draw->pt.max_index = index_limit - 1;
    draw->start_index = info->start;
 
+   if (draw_pt_replay_begin(draw, info))
+      return;
+
    /*
     * TODO: We could use draw->pt.max_index to further narrow
     * the min_index/max_index hints given by gallium frontends.
     */
 
-   for (instance = 0; instance < info->instance_count; instance++) {
+   batch = draw_instance_batch(draw, info, count);
+
+   for (instance = 0; instance < info->instance_count; instance += batch) {
       unsigned instance_idx = instance + info->start_instance;
       draw->start_instance = info->start_instance;
       draw->instance_id = instance;
+      draw->instance_batch = MIN2(batch, info->instance_count - instance);
       /* check for overflow */
       if (instance_idx < instance ||
           instance_idx < draw->start_instance) {
@@ -580,9 +712,103 @@ draw_vbo(struct draw_context *draw,
       }
    }
 
+   draw_pt_replay_end(draw);
+}
+
+
+/**
+ * Draw vertex arrays.
+ * This is the main entrypoint into the drawing module.  If drawing an indexed
+ * primitive, the draw_set_indexes() function should have already been called
+ * to specify the element/index buffer information.
+ */
+void
+draw_vbo(struct draw_context *draw,
+         const struct pipe_draw_info *info)
+{
+   unsigned fpstate = util_fpstate_get();
+   struct pipe_draw_info resolved_info;
+
+   if (info->instance_count == 0)
+      return;
+
+   /* Make sure that denorms are treated like zeros. This is 
+    * the behavior required by D3D10. OpenGL doesn't care.
+    */
+   util_fpstate_set_denorms_to_zero(fpstate);
+
+   resolve_draw_info(info, &resolved_info, &(draw->pt.vertex_buffer[0]));
+
+   /* If we're collecting stats then make sure we start from scratch */
+   if (draw->collect_statistics) {
+      memset(&draw->statistics, 0, sizeof(draw->statistics));
+   }
+
+   draw_vbo_run(draw, &resolved_info);
+
    /* If requested emit the pipeline statistics for this run */
    if (draw->collect_statistics) {
       draw->render->pipeline_statistics(draw->render, &draw->statistics);
    }
    util_fpstate_set(fpstate);
 }
+
+
+/**
+ * Run draw_count draws of info, with the count, instance_count, start,
+ * index_bias (indexed draws only) and start_instance of each read from
+ * params, in the layout of the indirect draw commands of
+ * pipe_draw_indirect_info, stride bytes apart (tightly packed if 0).
+ * The draws are numbered from info->drawid.  The rounding mode is set and
+ * the statistics are emitted once for all the draws, and the vertex and
+ * index buffers must stay mapped for all of them.
+ */
+void
+draw_vbo_multi(struct draw_context *draw,
+               const struct pipe_draw_info *info,
+               const uint32_t *params, unsigned stride,
+               unsigned draw_count)
+{
+   const unsigned num_params = info->index_size ? 5 : 4;
+   unsigned fpstate;
+   struct pipe_draw_info sub_info;
+   unsigned i;
+
+   assert(!info->count_from_stream_output);
+
+   if (!draw_count)
+      return;
+
+   if (!stride)
+      stride = num_params * sizeof(uint32_t);
+
+   fpstate = util_fpstate_get();
+   util_fpstate_set_denorms_to_zero(fpstate);
+
+   if (draw->collect_statistics) {
+      memset(&draw->statistics, 0, sizeof(draw->statistics));
+   }
+
+   memcpy(&sub_info, info, sizeof(sub_info));
+   sub_info.indirect = NULL;
+
+   for (i = 0; i < draw_count; i++) {
+      const uint32_t *p =
+        (const uint32_t *)((const uint8_t *)params + (size_t)i * stride);
+
+      sub_info.count = p[0];
+      sub_info.instance_count = p[1];
+      sub_info.start = p[2];
+      sub_info.index_bias = info->index_size ? (int)p[3] : 0;
+      sub_info.start_instance = p[num_params - 1];
+      sub_info.drawid = info->drawid + i;
+
+      if (sub_info.count && sub_info.instance_count)
+         draw_vbo_run(draw, &sub_info);
+   }
+
+   if (draw->collect_statistics) {
+      draw->render->pipeline_statistics(draw->render, &draw->statistics);
+   }
+   util_fpstate_set(fpstate);
+}
@@ -124,6 +124,11 @@ struct draw_pt_middle_end {
 
    int (*get_max_vertex_count)( struct draw_pt_middle_end * );
 
+   /* Finish the vertices which are still being processed, as the
+    * vertex buffers may go away after the draw.  Optional.
+    */
+   void (*flush)( struct draw_pt_middle_end * );
+
    void (*finish)( struct draw_pt_middle_end * );
    void (*destroy)( struct draw_pt_middle_end * );
 };
@@ -45,6 +45,9 @@ struct pt_emit {
 
    const struct vertex_info *vinfo;
 
+   /** First shader output of the hw vertex if it needs no translate, or -1 */
+   int direct_output;
+
    float zero4[4];
 
 };
@@ -115,6 +118,21 @@ draw_pt_emit_prepare(struct pt_emit *emit,
    hw_key.nr_elements = vinfo->num_attribs;
    hw_key.output_stride = vinfo->size * 4;
 
+   /* Can the renderer read the vertices as they come out of the shader? */
+   emit->direct_output = -1;
+   if (draw->render->set_vertices && vinfo->num_attribs &&
+       vinfo->attrib[0].src_index != DRAW_ATTR_NONEXIST) {
+      for (i = 0; i < vinfo->num_attribs; i++) {
+         if (vinfo->attrib[i].emit != EMIT_4F ||
+             vinfo->attrib[i].src_index != vinfo->attrib[0].src_index + i)
+            break;
+      }
+      if (i == vinfo->num_attribs &&
+          vinfo->attrib[0].src_index + i <=
+          draw_num_shader_outputs(draw) - draw->extra_shader_outputs.num)
+         emit->direct_output = vinfo->attrib[0].src_index;
+   }
+
    if (!emit->translate ||
        translate_key_compare(&emit->translate->key, &hw_key) != 0) {
       translate_key_sanitize(&hw_key);
@@ -159,37 +177,51 @@ draw_pt_emit(struct pt_emit *emit,
    render->set_primitive(draw->render, prim_info->prim);
 
    assert(vertex_count <= 65535);
-   render->allocate_vertices(render,
-                             (ushort)translate->key.output_stride,
-                             (ushort)vertex_count);
-
-   hw_verts = render->map_vertices(render);
-   if (!hw_verts) {
-      debug_warn_once("map of vertex buffer failed (out of memory?)");
-      return;
+   if (emit->direct_output >= 0 &&
+       render->set_vertices(render, vertex_data[emit->direct_output],
+                            (ushort)stride, (ushort)vertex_count)) {
+      draw_pt_replay_record(draw, prim_info, vertex_data[emit->direct_output],
+                            stride, translate->key.output_stride,
+                            vertex_count);
    }
+   else {
+      render->allocate_vertices(render,
+                                (ushort)translate->key.output_stride,
+                                (ushort)vertex_count);
+
+      hw_verts = render->map_vertices(render);
+      if (!hw_verts) {
+         debug_warn_once("map of vertex buffer failed (out of memory?)");
+         draw_pt_replay_abort(draw);
+         return;
+      }
 
-   translate->set_buffer(translate,
-                         0,
-                         vertex_data,
-                         stride,
-                         ~0);
-
-   translate->set_buffer(translate,
-                         1,
-                         &draw->rasterizer->point_size,
-                         0,
-                         ~0);
-
-   /* fetch/translate vertex attribs to fill hw_verts[] */
-   translate->run(translate,
-                  0,
-                  vertex_count,
-                  0,
-                  0,
-                  hw_verts);
-
-   render->unmap_vertices(render, 0, vertex_count - 1);
+      translate->set_buffer(translate,
+                            0,
+                            vertex_data,
+                            stride,
+                            ~0);
+
+      translate->set_buffer(translate,
+                            1,
+                            &draw->rasterizer->point_size,
+                            0,
+                            ~0);
+
+      /* fetch/translate vertex attribs to fill hw_verts[] */
+      translate->run(translate,
+                     0,
+                     vertex_count,
+                     0,
+                     0,
+                     hw_verts);
+
+      draw_pt_replay_record(draw, prim_info, hw_verts,
+                            translate->key.output_stride,
+                            translate->key.output_stride, vertex_count);
+
+      render->unmap_vertices(render, 0, vertex_count - 1);
+   }
 
    for (start = i = 0;
         i < prim_info->primitive_count;
@@ -231,6 +263,14 @@ draw_pt_emit_linear(struct pt_emit *emit,
    render->set_primitive(draw->render, prim_info->prim);
 
    assert(count <= 65535);
+   if (emit->direct_output >= 0 &&
+       render->set_vertices(render, vertex_data[emit->direct_output],
+                            (ushort)stride, (ushort)count)) {
+      draw_pt_replay_record(draw, prim_info, vertex_data[emit->direct_output],
+                            stride, translate->key.output_stride, count);
+      goto draw;
+   }
+
    if (!render->allocate_vertices(render,
                                   (ushort)translate->key.output_stride,
                                   (ushort)count))
@@ -264,8 +304,13 @@ draw_pt_emit_linear(struct pt_emit *emit,
       }
    }
 
+   draw_pt_replay_record(draw, prim_info, hw_verts,
+                         translate->key.output_stride,
+                         translate->key.output_stride, count);
+
    render->unmap_vertices(render, 0, count - 1);
 
+draw:
    for (start = i = 0;
         i < prim_info->primitive_count;
         start += prim_info->primitive_lengths[i], i++)
@@ -281,6 +326,7 @@ draw_pt_emit_linear(struct pt_emit *emit,
 
 fail:
    debug_warn_once("allocate or map of vertex buffer failed (out of memory?)");
+   draw_pt_replay_abort(draw);
    return;
 }
 
@@ -293,6 +339,7 @@ draw_pt_emit_create(struct draw_context *draw)
       return NULL;
 
    emit->draw = draw;
+   emit->direct_output = -1;
    emit->cache = translate_cache_create();
    if (!emit->cache) {
       FREE(emit);
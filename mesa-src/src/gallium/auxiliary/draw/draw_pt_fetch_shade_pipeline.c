@@ -352,8 +352,10 @@ fetch_pipeline_generic(struct draw_pt_middle_end *middle,
    /*
     * if there's no position, need to stop now, or the latter stages
     * will try to access non-existent position output.
+    * Nor is there anything left to do if nothing gets rasterized.
     */
-   if (draw_current_shader_position_output(draw) != -1) {
+   if (draw_current_shader_position_output(draw) != -1 &&
+       !draw_discards_primitives(draw)) {
 
       if (draw_pt_post_vs_run( fpme->post_vs, vert_info, prim_info ))
       {
@@ -28,6 +28,8 @@
 #include "util/u_math.h"
 #include "util/u_memory.h"
 #include "util/u_prim.h"
+#include "util/hash_table.h"
+#include "util/u_queue.h"
 #include "draw/draw_context.h"
 #include "draw/draw_gs.h"
 #include "draw/draw_tess.h"
@@ -41,6 +43,43 @@
 #include "gallivm/lp_bld_debug.h"
 
 
+DEBUG_GET_ONCE_NUM_OPTION(draw_threads, "DRAW_THREADS", 0)
+
+
+/** Segments queued for the worker threads at most */
+#define LLVM_MAX_PENDING_SEGMENTS 32
+
+/** Smaller segments are only queued behind others, to keep the order */
+#define LLVM_MIN_QUEUED_VERTICES 256
+
+/** Triangles whose facing is computed together, see llvm_cull_tris() */
+#define LLVM_CULL_BATCH 8
+
+
+struct llvm_middle_end;
+
+/**
+ * A segment from vsplit whose vertices are fetched and shaded on one of
+ * the worker threads, see DRAW_THREADS.  The elements are copied since
+ * vsplit reuses its buffers for the next segment.
+ */
+struct llvm_segment {
+   struct llvm_middle_end *fpme;
+   struct util_queue_fence fence;
+
+   struct draw_fetch_info fetch_info;
+   struct draw_prim_info prim_info;
+   unsigned draw_count;
+   struct draw_vertex_info vert_info;
+   boolean clipped;
+
+   unsigned *fetch_elts;
+   unsigned fetch_elts_size;   /**< in elements */
+   ushort *draw_elts;
+   unsigned draw_elts_size;
+};
+
+
 struct llvm_middle_end {
    struct draw_pt_middle_end base;
    struct draw_context *draw;
@@ -58,9 +97,38 @@ struct llvm_middle_end {
 
    struct draw_llvm *llvm;
    struct draw_llvm_variant *current_variant;
+
+   /**
+    * Fetch and vertex shading of the segments of a draw run on these
+    * threads, and the rest of the pipeline on the application thread in
+    * segment order, see llvm_queue_segment().
+    */
+   struct util_queue queue;
+   boolean use_queue;
+   struct llvm_segment segments[LLVM_MAX_PENDING_SEGMENTS];
+   unsigned first_segment;   /**< oldest of the queued segments */
+   unsigned num_segments;
+
+   /** Draw elements replicated for each instance of the batch */
+   ushort *instance_elts;
+   unsigned instance_elts_size;
+   unsigned instance_count;
+
+   /** The elements of the triangles which survived llvm_cull_tris() */
+   ushort *cull_elts;
+   unsigned cull_elts_size;
+   unsigned cull_count;
 };
 
 
+static void
+llvm_flush_segments(struct llvm_middle_end *fpme);
+
+static boolean
+llvm_segment_reserve(void **elts, unsigned *size, unsigned count,
+                     unsigned elt_size);
+
+
 /** cast wrapper */
 static inline struct llvm_middle_end *
 llvm_middle_end(struct draw_pt_middle_end *middle)
@@ -303,6 +371,8 @@ llvm_middle_end_prepare( struct draw_pt_middle_end *middle,
                          out_prim == PIPE_PRIM_POINTS;
    unsigned nr;
 
+   llvm_flush_segments(fpme);
+
    fpme->input_prim = in_prim;
    fpme->opt = opt;
 
@@ -348,22 +418,20 @@ llvm_middle_end_prepare( struct draw_pt_middle_end *middle,
    {
       struct draw_llvm_variant_key *key;
       struct draw_llvm_variant *variant = NULL;
-      struct draw_llvm_variant_list_item *li;
       struct llvm_vertex_shader *shader = llvm_vertex_shader(vs);
+      struct hash_entry *entry;
       char store[DRAW_LLVM_MAX_VARIANT_KEY_SIZE];
+      uint32_t hash;
       unsigned i;
 
       key = draw_llvm_make_variant_key(llvm, store);
+      hash = _mesa_hash_data(key, shader->variant_key_size);
 
-      /* Search shader's list of variants for the key */
-      li = first_elem(&shader->variants);
-      while (!at_end(&shader->variants, li)) {
-         if (memcmp(&li->base->key, key, shader->variant_key_size) == 0) {
-            variant = li->base;
-            break;
-         }
-         li = next_elem(li);
-      }
+      /* Search shader's variants for the key */
+      entry = _mesa_hash_table_search_pre_hashed(shader->variant_table,
+                                                 hash, key);
+      if (entry)
+         variant = entry->data;
 
       if (variant) {
          /* found the variant, move to head of global list (for LRU) */
@@ -400,6 +468,8 @@ llvm_middle_end_prepare( struct draw_pt_middle_end *middle,
 
          if (variant) {
             insert_at_head(&shader->variants, &variant->list_item_local);
+            _mesa_hash_table_insert_pre_hashed(shader->variant_table, hash,
+                                               &variant->key, variant);
             insert_at_head(&llvm->vs_variants_list,
                            &variant->list_item_global);
             llvm->nr_variants++;
@@ -447,6 +517,9 @@ llvm_middle_end_bind_parameters(struct draw_pt_middle_end *middle)
    struct draw_llvm *llvm = fpme->llvm;
    unsigned i;
 
+   /* The queued segments read the jit context. */
+   llvm_flush_segments(fpme);
+
    for (i = 0; i < ARRAY_SIZE(llvm->jit_context.vs_constants); ++i) {
       /*
        * There could be a potential issue with rounding this up, as the
@@ -560,45 +633,35 @@ emit(struct pt_emit *emit,
 }
 
 
-static void
-llvm_pipeline_generic(struct draw_pt_middle_end *middle,
-                      const struct draw_fetch_info *fetch_info,
-                      const struct draw_prim_info *in_prim_info)
+/** The vertices of all the instances of the batch */
+static inline unsigned
+llvm_vertex_count(const struct llvm_middle_end *fpme,
+                  const struct draw_fetch_info *fetch_info)
+{
+   return fetch_info->count * fpme->draw->instance_batch;
+}
+
+
+/**
+ * Allocate the vertices the fetch is shaded into, and count the vertex
+ * statistics.
+ */
+static struct vertex_header *
+llvm_get_vertices(struct llvm_middle_end *fpme,
+                  const struct draw_fetch_info *fetch_info,
+                  const struct draw_prim_info *prim_info)
 {
-   struct llvm_middle_end *fpme = llvm_middle_end(middle);
    struct draw_context *draw = fpme->draw;
-   struct draw_geometry_shader *gshader = draw->gs.geometry_shader;
-   struct draw_tess_ctrl_shader *tcs_shader = draw->tcs.tess_ctrl_shader;
-   struct draw_tess_eval_shader *tes_shader = draw->tes.tess_eval_shader;
-   struct draw_prim_info tcs_prim_info;
-   struct draw_prim_info tes_prim_info;
-   struct draw_prim_info gs_prim_info[TGSI_MAX_VERTEX_STREAMS];
-   struct draw_vertex_info llvm_vert_info;
-   struct draw_vertex_info tcs_vert_info;
-   struct draw_vertex_info tes_vert_info;
-   struct draw_vertex_info gs_vert_info[TGSI_MAX_VERTEX_STREAMS];
-   struct draw_vertex_info *vert_info;
-   struct draw_prim_info ia_prim_info;
-   struct draw_vertex_info ia_vert_info;
-   const struct draw_prim_info *prim_info = in_prim_info;
-   boolean free_prim_info = FALSE;
-   unsigned opt = fpme->opt;
-   boolean clipped = 0;
-   unsigned start_or_maxelt, vid_base;
-   const unsigned *elts;
-   ushort *tes_elts_out = NULL;
+   struct vertex_header *verts;
 
-   memset(&gs_vert_info, 0, sizeof(struct draw_vertex_info) * TGSI_MAX_VERTEX_STREAMS);
-   assert(fetch_info->count > 0);
-   llvm_vert_info.count = fetch_info->count;
-   llvm_vert_info.vertex_size = fpme->vertex_size;
-   llvm_vert_info.stride = fpme->vertex_size;
-   llvm_vert_info.verts = (struct vertex_header *)
+   /* the shader stores whole vectors, past the end of each instance */
+   verts = (struct vertex_header *)
       MALLOC(fpme->vertex_size *
-             align(fetch_info->count, lp_native_vector_width / 32));
-   if (!llvm_vert_info.verts) {
+             (llvm_vertex_count(fpme, fetch_info) - fetch_info->count +
+              align(fetch_info->count, lp_native_vector_width / 32)));
+   if (!verts) {
       assert(0);
-      return;
+      return NULL;
    }
 
    if (draw->collect_statistics) {
@@ -608,9 +671,29 @@ llvm_pipeline_generic(struct draw_pt_middle_end *middle,
       else
          draw->statistics.ia_primitives +=
             u_decomposed_prims_for_vertices(prim_info->prim, prim_info->count);
-      draw->statistics.vs_invocations += fetch_info->count;
+      draw->statistics.vs_invocations += llvm_vertex_count(fpme, fetch_info);
    }
 
+   return verts;
+}
+
+
+/**
+ * Fetch and shade the vertices, of each instance of the batch in turn.
+ * This only reads the draw state, so it can run on the worker threads.
+ * \return whether any vertex was clipped
+ */
+static boolean
+llvm_fetch_shade(struct llvm_middle_end *fpme,
+                 const struct draw_fetch_info *fetch_info,
+                 struct vertex_header *verts)
+{
+   struct draw_context *draw = fpme->draw;
+   unsigned start_or_maxelt, vid_base;
+   const unsigned *elts;
+   boolean clipped = FALSE;
+   unsigned i;
+
    if (fetch_info->linear) {
       start_or_maxelt = fetch_info->start;
       vid_base = draw->start_index;
@@ -621,22 +704,160 @@ llvm_pipeline_generic(struct draw_pt_middle_end *middle,
       vid_base = draw->pt.user.eltBias;
       elts = fetch_info->elts;
    }
-   clipped = fpme->current_variant->jit_func(&fpme->llvm->jit_context,
-                                             llvm_vert_info.verts,
-                                             draw->pt.user.vbuffer,
-                                             fetch_info->count,
-                                             start_or_maxelt,
-                                             fpme->vertex_size,
-                                             draw->pt.vertex_buffer,
-                                             draw->instance_id,
-                                             vid_base,
-                                             draw->start_instance,
-                                             elts, draw->pt.user.drawid);
-
-   /* Finished with fetch and vs:
-    */
-   fetch_info = NULL;
-   vert_info = &llvm_vert_info;
+   for (i = 0; i < draw->instance_batch; i++) {
+      struct vertex_header *instance_verts = (struct vertex_header *)
+         ((char *)verts + i * fetch_info->count * fpme->vertex_size);
+
+      clipped |= fpme->current_variant->jit_func(&fpme->llvm->jit_context,
+                                                 instance_verts,
+                                                 draw->pt.user.vbuffer,
+                                                 fetch_info->count,
+                                                 start_or_maxelt,
+                                                 fpme->vertex_size,
+                                                 draw->pt.vertex_buffer,
+                                                 draw->instance_id + i,
+                                                 vid_base,
+                                                 draw->start_instance,
+                                                 elts, draw->pt.user.drawid);
+   }
+   return clipped;
+}
+
+
+/**
+ * Cull back or front facing triangles of a list before they are emitted,
+ * the way draw_pipe_cull.c would, so the driver doesn't copy and set them
+ * up only to throw them away.  The facing of LLVM_CULL_BATCH triangles is
+ * computed at a time, in loops the compiler can vectorize.  The elements
+ * of the surviving triangles are compacted, or for linear lists their
+ * vertices.
+ * \return FALSE if nothing was culled
+ */
+static boolean
+llvm_cull_tris(struct llvm_middle_end *fpme,
+               const struct draw_vertex_info *vert_info,
+               const struct draw_prim_info *prim_info,
+               struct draw_vertex_info *cull_vert_info,
+               struct draw_prim_info *cull_prim_info)
+{
+   struct draw_context *draw = fpme->draw;
+   const struct pipe_rasterizer_state *rast = draw->rasterizer;
+   const unsigned pos = draw_current_shader_position_output(draw);
+   const unsigned stride = vert_info->stride;
+   const unsigned num_tris = prim_info->count / 3;
+   char *verts = (char *)vert_info->verts;
+   unsigned kept = 0;
+   unsigned i, j;
+
+   if (rast->cull_face == PIPE_FACE_NONE ||
+       rast->fill_front != PIPE_POLYGON_MODE_FILL ||
+       rast->fill_back != PIPE_POLYGON_MODE_FILL ||
+       prim_info->prim != PIPE_PRIM_TRIANGLES ||
+       prim_info->primitive_count != 1 ||
+       num_tris == 0 ||
+       draw->collect_statistics)
+      return FALSE;
+
+   if (!prim_info->linear &&
+       !llvm_segment_reserve((void **)&fpme->cull_elts, &fpme->cull_elts_size,
+                             num_tris * 3, sizeof *fpme->cull_elts))
+      return FALSE;
+
+   for (i = 0; i < num_tris; i += LLVM_CULL_BATCH) {
+      const unsigned n = MIN2(LLVM_CULL_BATCH, num_tris - i);
+      const float *v[3][LLVM_CULL_BATCH];
+      float det[LLVM_CULL_BATCH];
+      unsigned face[LLVM_CULL_BATCH];
+
+      for (j = 0; j < n; j++) {
+         unsigned k;
+         for (k = 0; k < 3; k++) {
+            unsigned idx = prim_info->linear ? (i + j) * 3 + k :
+                                               prim_info->elts[(i + j) * 3 + k];
+            v[k][j] = ((const struct vertex_header *)
+                       (verts + idx * stride))->data[pos];
+         }
+      }
+
+      /* det = cross(v0 - v2, v1 - v2).z */
+      for (j = 0; j < n; j++)
+         det[j] = (v[0][j][0] - v[2][j][0]) * (v[1][j][1] - v[2][j][1]) -
+                  (v[0][j][1] - v[2][j][1]) * (v[1][j][0] - v[2][j][0]);
+
+      /* zero area triangles are back facing */
+      for (j = 0; j < n; j++)
+         face[j] = (det[j] != 0 && (det[j] < 0) == rast->front_ccw) ?
+                   PIPE_FACE_FRONT : PIPE_FACE_BACK;
+
+      for (j = 0; j < n; j++) {
+         const unsigned tri = i + j;
+
+         if (face[j] & rast->cull_face)
+            continue;
+
+         if (prim_info->linear) {
+            if (kept != tri)
+               memcpy(verts + kept * 3 * stride, verts + tri * 3 * stride,
+                      3 * stride);
+         }
+         else {
+            memcpy(fpme->cull_elts + kept * 3, prim_info->elts + tri * 3,
+                   3 * sizeof *fpme->cull_elts);
+         }
+         kept++;
+      }
+   }
+
+   if (kept == num_tris)
+      return FALSE;
+
+   *cull_vert_info = *vert_info;
+   *cull_prim_info = *prim_info;
+   fpme->cull_count = kept * 3;
+   cull_prim_info->count = fpme->cull_count;
+   cull_prim_info->primitive_lengths = &fpme->cull_count;
+   if (prim_info->linear)
+      cull_vert_info->count = fpme->cull_count;
+   else
+      cull_prim_info->elts = fpme->cull_elts;
+
+   return TRUE;
+}
+
+
+/**
+ * Run the shaded vertices through the rest of the pipeline, and free
+ * them.
+ */
+static void
+llvm_pipeline_shaded(struct llvm_middle_end *fpme,
+                     struct draw_vertex_info *llvm_vert_info,
+                     const struct draw_prim_info *in_prim_info,
+                     boolean clipped)
+{
+   struct draw_context *draw = fpme->draw;
+   struct draw_geometry_shader *gshader = draw->gs.geometry_shader;
+   struct draw_tess_ctrl_shader *tcs_shader = draw->tcs.tess_ctrl_shader;
+   struct draw_tess_eval_shader *tes_shader = draw->tes.tess_eval_shader;
+   struct draw_prim_info tcs_prim_info;
+   struct draw_prim_info tes_prim_info;
+   struct draw_prim_info gs_prim_info[TGSI_MAX_VERTEX_STREAMS];
+   struct draw_vertex_info tcs_vert_info;
+   struct draw_vertex_info tes_vert_info;
+   struct draw_vertex_info gs_vert_info[TGSI_MAX_VERTEX_STREAMS];
+   struct draw_vertex_info *vert_info;
+   struct draw_prim_info ia_prim_info;
+   struct draw_vertex_info ia_vert_info;
+   struct draw_prim_info cull_prim_info;
+   struct draw_vertex_info cull_vert_info;
+   const struct draw_prim_info *prim_info = in_prim_info;
+   boolean free_prim_info = FALSE;
+   unsigned opt = fpme->opt;
+   ushort *tes_elts_out = NULL;
+
+   memset(&gs_vert_info, 0, sizeof(struct draw_vertex_info) * TGSI_MAX_VERTEX_STREAMS);
+
+   vert_info = llvm_vert_info;
 
    if (opt & PT_SHADE) {
       struct draw_vertex_shader *vshader = draw->vs.vertex_shader;
@@ -743,8 +964,10 @@ llvm_pipeline_generic(struct draw_pt_middle_end *middle,
    /*
     * if there's no position, need to stop now, or the latter stages
     * will try to access non-existent position output.
+    * Nor is there anything left to do if nothing gets rasterized.
     */
-   if (draw_current_shader_position_output(draw) != -1) {
+   if (draw_current_shader_position_output(draw) != -1 &&
+       !draw_discards_primitives(draw)) {
       if ((opt & PT_SHADE) && (gshader || tes_shader ||
                                draw->vs.vertex_shader->info.writes_viewport_index)) {
          clipped = draw_pt_post_vs_run( fpme->post_vs, vert_info, prim_info );
@@ -759,6 +982,11 @@ llvm_pipeline_generic(struct draw_pt_middle_end *middle,
       if (opt & PT_PIPELINE) {
          pipeline( fpme, vert_info, prim_info );
       }
+      else if (llvm_cull_tris(fpme, vert_info, prim_info,
+                              &cull_vert_info, &cull_prim_info)) {
+         if (cull_prim_info.count)
+            emit( fpme->emit, &cull_vert_info, &cull_prim_info );
+      }
       else {
          emit( fpme->emit, vert_info, prim_info );
       }
@@ -776,6 +1004,211 @@ out:
 }
 
 
+
+/**
+ * Run the oldest queued segment through the rest of the pipeline, once
+ * its vertices are shaded.
+ */
+static void
+llvm_finish_segment(struct llvm_middle_end *fpme)
+{
+   struct llvm_segment *seg = &fpme->segments[fpme->first_segment];
+
+   assert(fpme->num_segments);
+
+   util_queue_fence_wait(&seg->fence);
+   fpme->first_segment = (fpme->first_segment + 1) % LLVM_MAX_PENDING_SEGMENTS;
+   fpme->num_segments--;
+
+   llvm_pipeline_shaded(fpme, &seg->vert_info, &seg->prim_info, seg->clipped);
+}
+
+
+static void
+llvm_flush_segments(struct llvm_middle_end *fpme)
+{
+   while (fpme->num_segments)
+      llvm_finish_segment(fpme);
+}
+
+
+static void
+llvm_segment_execute(void *data, int thread_index)
+{
+   struct llvm_segment *seg = (struct llvm_segment *)data;
+
+   seg->clipped = llvm_fetch_shade(seg->fpme, &seg->fetch_info,
+                                   seg->vert_info.verts);
+}
+
+
+/**
+ * Make room for count elements in the segment's copy.
+ */
+static boolean
+llvm_segment_reserve(void **elts, unsigned *size, unsigned count,
+                     unsigned elt_size)
+{
+   if (count > *size) {
+      void *new_elts = REALLOC(*elts, *size * elt_size, count * elt_size);
+      if (!new_elts)
+         return FALSE;
+      *elts = new_elts;
+      *size = count;
+   }
+   return TRUE;
+}
+
+
+/**
+ * Queue fetch and shading of the segment on the worker threads.  The
+ * segments are finished in order, when the queue is full, and at the
+ * latest by llvm_middle_end_flush() once vsplit is done with the draw.
+ * \return FALSE if the segment must be run right now
+ */
+static boolean
+llvm_queue_segment(struct llvm_middle_end *fpme,
+                   const struct draw_fetch_info *fetch_info,
+                   const struct draw_prim_info *prim_info)
+{
+   struct llvm_segment *seg;
+   struct vertex_header *verts;
+
+   assert(prim_info->primitive_count == 1);
+
+   if (fpme->num_segments == LLVM_MAX_PENDING_SEGMENTS)
+      llvm_finish_segment(fpme);
+
+   seg = &fpme->segments[(fpme->first_segment + fpme->num_segments) %
+                         LLVM_MAX_PENDING_SEGMENTS];
+
+   if ((fetch_info->elts &&
+        !llvm_segment_reserve((void **)&seg->fetch_elts, &seg->fetch_elts_size,
+                              fetch_info->count, sizeof *seg->fetch_elts)) ||
+       (prim_info->elts &&
+        !llvm_segment_reserve((void **)&seg->draw_elts, &seg->draw_elts_size,
+                              prim_info->count, sizeof *seg->draw_elts))) {
+      llvm_flush_segments(fpme);
+      return FALSE;
+   }
+
+   verts = llvm_get_vertices(fpme, fetch_info, prim_info);
+   if (!verts)
+      return TRUE;
+
+   seg->fpme = fpme;
+   seg->fetch_info = *fetch_info;
+   if (fetch_info->elts) {
+      memcpy(seg->fetch_elts, fetch_info->elts,
+             fetch_info->count * sizeof *seg->fetch_elts);
+      seg->fetch_info.elts = seg->fetch_elts;
+   }
+
+   seg->prim_info = *prim_info;
+   if (prim_info->elts) {
+      memcpy(seg->draw_elts, prim_info->elts,
+             prim_info->count * sizeof *seg->draw_elts);
+      seg->prim_info.elts = seg->draw_elts;
+   }
+   seg->draw_count = prim_info->primitive_lengths[0];
+   seg->prim_info.primitive_lengths = &seg->draw_count;
+
+   seg->vert_info.count = llvm_vertex_count(fpme, fetch_info);
+   seg->vert_info.vertex_size = fpme->vertex_size;
+   seg->vert_info.stride = fpme->vertex_size;
+   seg->vert_info.verts = verts;
+
+   fpme->num_segments++;
+   util_queue_add_job(&fpme->queue, seg, &seg->fence,
+                      llvm_segment_execute, NULL, 0);
+   return TRUE;
+}
+
+
+/**
+ * The primitives of all the instances of the batch: the vertices of
+ * instance i follow those of instance i - 1, see llvm_fetch_shade().
+ * \return NULL if out of memory
+ */
+static const struct draw_prim_info *
+llvm_instance_prim_info(struct llvm_middle_end *fpme,
+                        const struct draw_fetch_info *fetch_info,
+                        const struct draw_prim_info *prim_info,
+                        struct draw_prim_info *instance_prim_info)
+{
+   unsigned instances = fpme->draw->instance_batch;
+   unsigned i, j;
+
+   assert(prim_info->primitive_count == 1);
+   assert(llvm_vertex_count(fpme, fetch_info) <=
+          DRAW_MAX_INSTANCE_BATCH_VERTICES);
+
+   *instance_prim_info = *prim_info;
+   fpme->instance_count = prim_info->count * instances;
+   instance_prim_info->count = fpme->instance_count;
+   instance_prim_info->primitive_lengths = &fpme->instance_count;
+
+   if (prim_info->elts) {
+      if (!llvm_segment_reserve((void **)&fpme->instance_elts,
+                                &fpme->instance_elts_size,
+                                fpme->instance_count,
+                                sizeof *fpme->instance_elts))
+         return NULL;
+
+      for (i = 0; i < instances; i++) {
+         ushort *elts = fpme->instance_elts + i * prim_info->count;
+         ushort base = i * fetch_info->count;
+
+         for (j = 0; j < prim_info->count; j++)
+            elts[j] = prim_info->elts[j] + base;
+      }
+      instance_prim_info->elts = fpme->instance_elts;
+   }
+
+   return instance_prim_info;
+}
+
+
+static void
+llvm_pipeline_generic(struct draw_pt_middle_end *middle,
+                      const struct draw_fetch_info *fetch_info,
+                      const struct draw_prim_info *prim_info)
+{
+   struct llvm_middle_end *fpme = llvm_middle_end(middle);
+   struct draw_vertex_info llvm_vert_info;
+   struct draw_prim_info instance_prim_info;
+   boolean clipped;
+
+   assert(fetch_info->count > 0);
+
+   if (fpme->draw->instance_batch > 1) {
+      prim_info = llvm_instance_prim_info(fpme, fetch_info, prim_info,
+                                          &instance_prim_info);
+      if (!prim_info) {
+         assert(0);
+         return;
+      }
+   }
+
+   if (fpme->use_queue &&
+       (fpme->num_segments ||
+        llvm_vertex_count(fpme, fetch_info) >= LLVM_MIN_QUEUED_VERTICES) &&
+       llvm_queue_segment(fpme, fetch_info, prim_info))
+      return;
+
+   llvm_vert_info.count = llvm_vertex_count(fpme, fetch_info);
+   llvm_vert_info.vertex_size = fpme->vertex_size;
+   llvm_vert_info.stride = fpme->vertex_size;
+   llvm_vert_info.verts = llvm_get_vertices(fpme, fetch_info, prim_info);
+   if (!llvm_vert_info.verts)
+      return;
+
+   clipped = llvm_fetch_shade(fpme, fetch_info, llvm_vert_info.verts);
+
+   llvm_pipeline_shaded(fpme, &llvm_vert_info, prim_info, clipped);
+}
+
+
 static inline unsigned
 prim_type(unsigned prim, unsigned flags)
 {
@@ -876,10 +1309,17 @@ llvm_middle_end_linear_run_elts(struct draw_pt_middle_end *middle,
 }
 
 
+static void
+llvm_middle_end_flush(struct draw_pt_middle_end *middle)
+{
+   llvm_flush_segments(llvm_middle_end(middle));
+}
+
+
 static void
 llvm_middle_end_finish(struct draw_pt_middle_end *middle)
 {
-   /* nothing to do */
+   llvm_flush_segments(llvm_middle_end(middle));
 }
 
 
@@ -887,6 +1327,20 @@ static void
 llvm_middle_end_destroy(struct draw_pt_middle_end *middle)
 {
    struct llvm_middle_end *fpme = llvm_middle_end(middle);
+   unsigned i;
+
+   if (fpme->use_queue) {
+      llvm_flush_segments(fpme);
+      util_queue_destroy(&fpme->queue);
+      for (i = 0; i < LLVM_MAX_PENDING_SEGMENTS; i++) {
+         util_queue_fence_destroy(&fpme->segments[i].fence);
+         FREE(fpme->segments[i].fetch_elts);
+         FREE(fpme->segments[i].draw_elts);
+      }
+   }
+
+   FREE(fpme->instance_elts);
+   FREE(fpme->cull_elts);
 
    if (fpme->fetch)
       draw_pt_fetch_destroy( fpme->fetch );
@@ -908,6 +1362,8 @@ struct draw_pt_middle_end *
 draw_pt_fetch_pipeline_or_emit_llvm(struct draw_context *draw)
 {
    struct llvm_middle_end *fpme = 0;
+   unsigned num_threads;
+   unsigned i;
 
    if (!draw->llvm)
       return NULL;
@@ -921,6 +1377,7 @@ draw_pt_fetch_pipeline_or_emit_llvm(struct draw_context *draw)
    fpme->base.run             = llvm_middle_end_run;
    fpme->base.run_linear      = llvm_middle_end_linear_run;
    fpme->base.run_linear_elts = llvm_middle_end_linear_run_elts;
+   fpme->base.flush           = llvm_middle_end_flush;
    fpme->base.finish          = llvm_middle_end_finish;
    fpme->base.destroy         = llvm_middle_end_destroy;
 
@@ -948,6 +1405,15 @@ draw_pt_fetch_pipeline_or_emit_llvm(struct draw_context *draw)
 
    fpme->current_variant = NULL;
 
+   num_threads = debug_get_option_draw_threads();
+   if (num_threads &&
+       util_queue_init(&fpme->queue, "draw", LLVM_MAX_PENDING_SEGMENTS,
+                       MIN2(num_threads, LLVM_MAX_PENDING_SEGMENTS), 0)) {
+      for (i = 0; i < LLVM_MAX_PENDING_SEGMENTS; i++)
+         util_queue_fence_init(&fpme->segments[i].fence);
+      fpme->use_queue = TRUE;
+   }
+
    return &fpme->base;
 
  fail:
@@ -0,0 +1,745 @@
+/*
+ * Copyright © 2026 Mesa contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * \file
+ * Replay of post-transform vertices.
+ *
+ * Applications which draw the same geometry every frame, like display
+ * lists replayed unchanged, have it fetched, shaded, clipped and emitted
+ * again each time.  Once the driver enabled the replay, see
+ * draw_enable_replay(), what the middle end emits to the render for a
+ * draw is recorded, and a later draw with the same parameters, state and
+ * buffer contents sends the recorded vertices and primitives to the
+ * render again without running any of it.
+ *
+ * Draws are keyed on their parameters, the mapped vertex and index
+ * buffers and the driver's serial for their contents, see
+ * draw_set_replay_serial(), and on the draw state.  The state is interned
+ * separately, as it changes a lot less often than the draws.  Draws which
+ * go through the pipeline stages, or whose shaders read or write anything
+ * but their constants and vertices, are never recorded.
+ */
+
+#include "util/format/u_format.h"
+#include "util/hash_table.h"
+#include "util/list.h"
+#include "util/u_dynarray.h"
+#include "util/u_math.h"
+#include "util/u_memory.h"
+#include "draw/draw_context.h"
+#include "draw/draw_private.h"
+#include "draw/draw_pt.h"
+#include "draw/draw_vbuf.h"
+#include "draw/draw_vertex.h"
+#include "draw/draw_vs.h"
+
+
+/** Draws of fewer vertices aren't worth looking up */
+#define REPLAY_MIN_VERTICES 32
+
+/** Draws are not recorded while the vertex shader has more constants */
+#define REPLAY_MAX_CONSTANTS (64 * 1024)
+
+/** Everything recorded is dropped once there are this many states */
+#define REPLAY_MAX_STATES 256
+
+
+/** Hash table key, followed by size bytes of data */
+struct replay_blob {
+   uint32_t hash;
+   uint32_t size;
+   uint8_t data[];
+};
+
+
+/**
+ * What was emitted to the render in one go.  The offsets are into the
+ * recorded data of the draw.
+ */
+struct replay_batch {
+   enum pipe_prim_type prim;
+   unsigned vertex_size;  /**< in bytes */
+   unsigned nr_vertices;
+   unsigned nr_prims;
+   unsigned lengths;      /**< the primitive lengths */
+   unsigned elts;         /**< the ushort elements, 0 for draw_arrays() */
+   unsigned vertices;
+   unsigned end;          /**< the next batch */
+};
+
+
+struct replay_draw {
+   struct replay_blob *key;
+   struct list_head lru;
+
+   /** The draw couldn't be recorded, so it is drawn as is from now on */
+   boolean failed;
+
+   /** The replay_batch records of the draw */
+   struct util_dynarray data;
+};
+
+
+struct draw_pt_replay {
+   size_t max_bytes;
+   size_t bytes;                /**< total recorded data */
+
+   struct hash_table *states;   /**< interned states, replay_blob */
+   struct hash_table *draws;    /**< replay_draw, by key */
+   struct list_head lru;        /**< the draws, most recently used first */
+
+   /** Current state, NULL while draws can't be recorded */
+   const struct replay_blob *state;
+
+   /** The draw being recorded, between begin and end */
+   struct replay_draw *recording;
+
+   struct util_dynarray scratch;
+};
+
+
+static uint32_t
+replay_blob_hash(const void *key)
+{
+   return ((const struct replay_blob *)key)->hash;
+}
+
+
+static bool
+replay_blob_equal(const void *a, const void *b)
+{
+   const struct replay_blob *blob_a = a;
+   const struct replay_blob *blob_b = b;
+
+   return blob_a->size == blob_b->size &&
+          memcmp(blob_a->data, blob_b->data, blob_a->size) == 0;
+}
+
+
+static void
+replay_blob_begin(struct util_dynarray *buf)
+{
+   util_dynarray_clear(buf);
+   (void)util_dynarray_grow_bytes(buf, 1, sizeof(struct replay_blob));
+}
+
+
+static void
+replay_blob_add(struct util_dynarray *buf, const void *data, size_t size)
+{
+   void *dst = util_dynarray_grow_bytes(buf, 1, size);
+   if (dst && size)
+      memcpy(dst, data, size);
+}
+
+
+/** The blob built in buf, or NULL if it ran out of memory */
+static const struct replay_blob *
+replay_blob_end(struct util_dynarray *buf)
+{
+   struct replay_blob *blob = buf->data;
+
+   if (!blob || buf->size < sizeof(*blob))
+      return NULL;
+
+   blob->size = buf->size - sizeof(*blob);
+   blob->hash = _mesa_hash_data(blob->data, blob->size);
+   return blob;
+}
+
+
+static struct replay_blob *
+replay_blob_copy(const struct replay_blob *blob)
+{
+   struct replay_blob *copy = MALLOC(sizeof(*blob) + blob->size);
+   if (copy)
+      memcpy(copy, blob, sizeof(*blob) + blob->size);
+   return copy;
+}
+
+
+static void
+replay_destroy_draw(struct draw_pt_replay *replay, struct replay_draw *recorded)
+{
+   replay->bytes -= recorded->data.size;
+   util_dynarray_fini(&recorded->data);
+   list_del(&recorded->lru);
+   FREE(recorded->key);
+   FREE(recorded);
+}
+
+
+/**
+ * Drop everything recorded, and the states.
+ */
+static void
+replay_clear(struct draw_pt_replay *replay)
+{
+   list_for_each_entry_safe(struct replay_draw, recorded, &replay->lru, lru)
+      replay_destroy_draw(replay, recorded);
+   _mesa_hash_table_clear(replay->draws, NULL);
+
+   hash_table_foreach(replay->states, entry)
+      FREE((void *)entry->key);
+   _mesa_hash_table_clear(replay->states, NULL);
+
+   replay->state = NULL;
+   assert(replay->bytes == 0);
+}
+
+
+/**
+ * Everything besides the draw's parameters and vertex buffers that the
+ * emitted vertices depend on, interned.  NULL if they depend on things
+ * the replay can't see changing: textures, images and buffers the
+ * shaders access, stream output, or the other shader stages.
+ */
+static const struct replay_blob *
+replay_get_state(struct draw_context *draw)
+{
+   struct draw_pt_replay *replay = draw->pt.replay;
+   struct util_dynarray *buf = &replay->scratch;
+   const struct draw_vertex_shader *vs = draw->vs.vertex_shader;
+   const struct vertex_info *vinfo;
+   const struct replay_blob *state;
+   struct replay_blob *copy;
+   struct hash_entry *entry;
+   unsigned constants = 0;
+   unsigned i;
+
+   if (!vs || !draw->rasterizer ||
+       draw->gs.geometry_shader ||
+       draw->tes.tess_eval_shader ||
+       draw->so.num_targets ||
+       vs->info.file_count[TGSI_FILE_SAMPLER] ||
+       vs->info.file_count[TGSI_FILE_SAMPLER_VIEW] ||
+       vs->info.file_count[TGSI_FILE_IMAGE] ||
+       vs->info.file_count[TGSI_FILE_BUFFER] ||
+       vs->info.file_count[TGSI_FILE_HW_ATOMIC] ||
+       vs->info.writes_viewport_index)
+      return NULL;
+
+   for (i = 0; i < PIPE_MAX_CONSTANT_BUFFERS; i++) {
+      if (draw->pt.user.vs_constants[i])
+         constants += draw->pt.user.vs_constants_size[i];
+   }
+   if (constants > REPLAY_MAX_CONSTANTS)
+      return NULL;
+
+   {
+      /* the CSOs are copied, but the shader can only be told apart by its
+       * address, see draw_pt_replay_flush()
+       */
+      struct {
+         const struct draw_vertex_shader *vs;
+         unsigned nr_vertex_elements;
+         boolean clip_xy;
+         boolean clip_z;
+         boolean clip_user;
+         boolean guard_band_xy;
+         boolean guard_band_points_xy;
+         boolean bypass_viewport;
+         boolean force_passthrough;
+         boolean rasterizer_discard;
+      } header;
+
+      memset(&header, 0, sizeof header);
+      header.vs = vs;
+      header.nr_vertex_elements = draw->pt.nr_vertex_elements;
+      header.clip_xy = draw->clip_xy;
+      header.clip_z = draw->clip_z;
+      header.clip_user = draw->clip_user;
+      header.guard_band_xy = draw->guard_band_xy;
+      header.guard_band_points_xy = draw->guard_band_points_xy;
+      header.bypass_viewport = draw->bypass_viewport;
+      header.force_passthrough = draw->force_passthrough;
+      header.rasterizer_discard = draw->rasterizer_discard;
+
+      replay_blob_begin(buf);
+      replay_blob_add(buf, &header, sizeof header);
+   }
+
+   vinfo = draw->render->get_vertex_info(draw->render);
+   replay_blob_add(buf, vinfo, draw_vinfo_size(vinfo));
+   replay_blob_add(buf, draw->rasterizer, sizeof *draw->rasterizer);
+   replay_blob_add(buf, draw->pt.vertex_element,
+                   draw->pt.nr_vertex_elements *
+                   sizeof draw->pt.vertex_element[0]);
+   replay_blob_add(buf, &draw->viewports[0], sizeof draw->viewports[0]);
+   replay_blob_add(buf, draw->plane, sizeof draw->plane);
+
+   for (i = 0; i < PIPE_MAX_CONSTANT_BUFFERS; i++) {
+      unsigned size = draw->pt.user.vs_constants[i] ?
+                         draw->pt.user.vs_constants_size[i] : 0;
+
+      replay_blob_add(buf, &size, sizeof size);
+      replay_blob_add(buf, draw->pt.user.vs_constants[i], size);
+   }
+
+   state = replay_blob_end(buf);
+   if (!state)
+      return NULL;
+
+   entry = _mesa_hash_table_search_pre_hashed(replay->states, state->hash,
+                                              state);
+   if (entry)
+      return entry->key;
+
+   if (replay->states->entries >= REPLAY_MAX_STATES)
+      replay_clear(replay);
+
+   copy = replay_blob_copy(state);
+   if (!copy)
+      return NULL;
+
+   _mesa_hash_table_insert_pre_hashed(replay->states, copy->hash, copy, copy);
+   return copy;
+}
+
+
+/**
+ * The key of the draw, or NULL if it can't be recorded.  Vertex buffers
+ * with a zero stride, like the current attribute values a display list
+ * doesn't set, are usually uploaded anew for each draw, so what the
+ * vertex elements read from them is compared instead of where it is.
+ */
+static const struct replay_blob *
+replay_get_key(struct draw_context *draw, const struct pipe_draw_info *info)
+{
+   struct draw_pt_replay *replay = draw->pt.replay;
+   struct util_dynarray *buf = &replay->scratch;
+   struct {
+      const struct replay_blob *state;
+      uint64_t serial;
+      const void *elts;
+      unsigned elt_size;
+      unsigned elt_max;
+      unsigned mode;
+      unsigned start;
+      unsigned count;
+      int index_bias;
+      unsigned min_index;
+      unsigned max_index;
+      unsigned start_instance;
+      unsigned instance_count;
+      unsigned drawid;
+      unsigned primitive_restart;
+      unsigned restart_index;
+      unsigned nr_vertex_buffers;
+   } header;
+   unsigned i;
+
+   memset(&header, 0, sizeof header);
+   header.state = replay->state;
+   header.serial = draw->pt.replay_serial;
+   if (info->index_size) {
+      header.elts = draw->pt.user.elts;
+      header.elt_size = draw->pt.user.eltSize;
+      header.elt_max = draw->pt.user.eltMax;
+   }
+   header.mode = info->mode;
+   header.start = info->start;
+   header.count = info->count;
+   header.index_bias = info->index_bias;
+   header.min_index = info->min_index;
+   header.max_index = info->max_index;
+   header.start_instance = info->start_instance;
+   header.instance_count = info->instance_count;
+   header.drawid = info->drawid;
+   header.primitive_restart = info->primitive_restart;
+   header.restart_index = info->primitive_restart ? info->restart_index : 0;
+   header.nr_vertex_buffers = draw->pt.nr_vertex_buffers;
+
+   replay_blob_begin(buf);
+   replay_blob_add(buf, &header, sizeof header);
+
+   for (i = 0; i < draw->pt.nr_vertex_buffers; i++) {
+      const struct pipe_vertex_buffer *vb = &draw->pt.vertex_buffer[i];
+      struct {
+         const void *map;
+         size_t size;
+         unsigned stride;
+         unsigned offset;
+      } buffer;
+
+      memset(&buffer, 0, sizeof buffer);
+      if (vb->stride) {
+         buffer.map = draw->pt.user.vbuffer[i].map;
+         buffer.size = draw->pt.user.vbuffer[i].size;
+         buffer.stride = vb->stride;
+         buffer.offset = vb->buffer_offset;
+      }
+      replay_blob_add(buf, &buffer, sizeof buffer);
+   }
+
+   for (i = 0; i < draw->pt.nr_vertex_elements; i++) {
+      const struct pipe_vertex_element *ve = &draw->pt.vertex_element[i];
+      const unsigned index = ve->vertex_buffer_index;
+      const struct draw_vertex_buffer *vbuffer = &draw->pt.user.vbuffer[index];
+      const unsigned offset = draw->pt.vertex_buffer[index].buffer_offset +
+                              ve->src_offset;
+      const unsigned size = util_format_get_blocksize(ve->src_format);
+
+      if (draw->pt.vertex_buffer[index].stride)
+         continue;
+
+      if (!vbuffer->map || offset + size > vbuffer->size)
+         return NULL;
+
+      replay_blob_add(buf, (const uint8_t *)vbuffer->map + offset, size);
+   }
+
+   return replay_blob_end(buf);
+}
+
+
+static void
+replay_fail(struct replay_draw *recorded)
+{
+   recorded->failed = TRUE;
+   util_dynarray_fini(&recorded->data);
+}
+
+
+/**
+ * Send the recorded batches to the render, the way draw_pt_emit() and
+ * draw_pt_emit_linear() did.
+ */
+static void
+replay_run(struct draw_context *draw, const struct replay_draw *recorded)
+{
+   struct vbuf_render *render = draw->render;
+   const uint8_t *data = recorded->data.data;
+   unsigned offset = 0;
+
+   draw_do_flush(draw, DRAW_FLUSH_BACKEND);
+
+   while (offset < recorded->data.size) {
+      const struct replay_batch *batch =
+         (const struct replay_batch *)(data + offset);
+      const unsigned *lengths = (const unsigned *)(data + batch->lengths);
+      const ushort *elts = (const ushort *)(data + batch->elts);
+      const uint8_t *vertices = data + batch->vertices;
+      unsigned start, i;
+
+      render->set_primitive(render, batch->prim);
+
+      if (!render->set_vertices ||
+          !render->set_vertices(render, vertices, (ushort)batch->vertex_size,
+                                (ushort)batch->nr_vertices)) {
+         void *hw_verts;
+
+         if (!render->allocate_vertices(render, (ushort)batch->vertex_size,
+                                        (ushort)batch->nr_vertices) ||
+             !(hw_verts = render->map_vertices(render))) {
+            debug_warn_once("allocate or map of vertex buffer failed (out of memory?)");
+            return;
+         }
+
+         memcpy(hw_verts, vertices, batch->vertex_size * batch->nr_vertices);
+         render->unmap_vertices(render, 0, batch->nr_vertices - 1);
+      }
+
+      for (start = i = 0; i < batch->nr_prims; start += lengths[i], i++) {
+         if (batch->elts)
+            render->draw_elements(render, elts + start, lengths[i]);
+         else
+            render->draw_arrays(render, start, lengths[i]);
+      }
+
+      render->release_vertices(render);
+
+      offset = batch->end;
+   }
+}
+
+
+/**
+ * Called by draw_vbo() before it runs the draw.  Returns TRUE if the
+ * draw was replayed, and otherwise starts recording it if it can be.
+ */
+boolean
+draw_pt_replay_begin(struct draw_context *draw,
+                     const struct pipe_draw_info *info)
+{
+   struct draw_pt_replay *replay = draw->pt.replay;
+   const struct replay_blob *key;
+   struct replay_draw *recorded;
+   struct hash_entry *entry;
+
+   if (!replay || !draw->pt.replay_serial || !draw->render ||
+       draw->collect_statistics || draw->collect_primgen ||
+       (uint64_t)info->count * info->instance_count < REPLAY_MIN_VERTICES)
+      return FALSE;
+
+   if (draw->pt.replay_state_dirty) {
+      replay->state = replay_get_state(draw);
+      draw->pt.replay_state_dirty = FALSE;
+   }
+
+   if (!replay->state)
+      return FALSE;
+
+   key = replay_get_key(draw, info);
+   if (!key)
+      return FALSE;
+
+   entry = _mesa_hash_table_search_pre_hashed(replay->draws, key->hash, key);
+   if (entry) {
+      recorded = entry->data;
+      list_del(&recorded->lru);
+      list_add(&recorded->lru, &replay->lru);
+
+      if (recorded->failed)
+         return FALSE;
+
+      replay_run(draw, recorded);
+      return TRUE;
+   }
+
+   recorded = CALLOC_STRUCT(replay_draw);
+   if (!recorded)
+      return FALSE;
+
+   recorded->key = replay_blob_copy(key);
+   if (!recorded->key) {
+      FREE(recorded);
+      return FALSE;
+   }
+
+   util_dynarray_init(&recorded->data, NULL);
+   replay->recording = recorded;
+   return FALSE;
+}
+
+
+/**
+ * Called by draw_vbo() once the draw ran, to keep what was recorded and
+ * evict the least recently used draws beyond the budget.
+ */
+void
+draw_pt_replay_end(struct draw_context *draw)
+{
+   struct draw_pt_replay *replay = draw->pt.replay;
+   struct replay_draw *recorded = replay ? replay->recording : NULL;
+
+   if (!recorded)
+      return;
+
+   replay->recording = NULL;
+
+   util_dynarray_trim(&recorded->data);
+   replay->bytes += recorded->data.size;
+
+   _mesa_hash_table_insert_pre_hashed(replay->draws, recorded->key->hash,
+                                      recorded->key, recorded);
+   list_add(&recorded->lru, &replay->lru);
+
+   while (replay->bytes > replay->max_bytes) {
+      struct replay_draw *oldest =
+         list_last_entry(&replay->lru, struct replay_draw, lru);
+
+      _mesa_hash_table_remove_key(replay->draws, oldest->key);
+      replay_destroy_draw(replay, oldest);
+   }
+}
+
+
+/**
+ * Record an emitted batch of vertices in the render's vertex layout,
+ * vertex_size bytes each, stride bytes apart, and the primitives drawn
+ * from them.
+ */
+void
+draw_pt_replay_record(struct draw_context *draw,
+                      const struct draw_prim_info *prim_info,
+                      const void *vertices, unsigned stride,
+                      unsigned vertex_size, unsigned nr_vertices)
+{
+   struct draw_pt_replay *replay = draw->pt.replay;
+   struct replay_draw *recorded = replay ? replay->recording : NULL;
+   struct replay_batch batch;
+   unsigned nr_elts = 0;
+   unsigned base, i;
+   uint8_t *data;
+
+   if (!recorded || recorded->failed)
+      return;
+
+   if (!prim_info->linear) {
+      for (i = 0; i < prim_info->primitive_count; i++)
+         nr_elts += prim_info->primitive_lengths[i];
+   }
+
+   base = recorded->data.size;
+   batch.prim = prim_info->prim;
+   batch.vertex_size = vertex_size;
+   batch.nr_vertices = nr_vertices;
+   batch.nr_prims = prim_info->primitive_count;
+   batch.lengths = base + sizeof batch;
+   batch.elts = prim_info->linear ? 0 :
+                   batch.lengths + batch.nr_prims * sizeof(unsigned);
+   batch.vertices = base + align(batch.lengths - base +
+                                 batch.nr_prims * sizeof(unsigned) +
+                                 nr_elts * sizeof(ushort), 16);
+   batch.end = batch.vertices + vertex_size * nr_vertices;
+
+   if (batch.end > replay->max_bytes ||
+       !util_dynarray_grow_bytes(&recorded->data, 1, batch.end - base)) {
+      replay_fail(recorded);
+      return;
+   }
+
+   data = recorded->data.data;
+   memcpy(data + base, &batch, sizeof batch);
+   memcpy(data + batch.lengths, prim_info->primitive_lengths,
+          batch.nr_prims * sizeof(unsigned));
+   if (batch.elts)
+      memcpy(data + batch.elts, prim_info->elts, nr_elts * sizeof(ushort));
+
+   if (stride == vertex_size) {
+      memcpy(data + batch.vertices, vertices, vertex_size * nr_vertices);
+   }
+   else {
+      for (i = 0; i < nr_vertices; i++)
+         memcpy(data + batch.vertices + i * vertex_size,
+                (const uint8_t *)vertices + i * stride, vertex_size);
+   }
+}
+
+
+/**
+ * The draw being recorded went where the replay can't follow, so it
+ * is drawn as is from now on.
+ */
+void
+draw_pt_replay_abort(struct draw_context *draw)
+{
+   struct draw_pt_replay *replay = draw->pt.replay;
+
+   if (replay && replay->recording)
+      replay_fail(replay->recording);
+}
+
+
+/**
+ * Drop everything recorded.  Needed when a vertex shader is deleted, as
+ * the states only know it by its address.
+ */
+void
+draw_pt_replay_flush(struct draw_context *draw)
+{
+   struct draw_pt_replay *replay = draw->pt.replay;
+
+   if (replay) {
+      assert(!replay->recording);
+      replay_clear(replay);
+      draw->pt.replay_state_dirty = TRUE;
+   }
+}
+
+
+/** Bytes of the recorded draws and the states they were drawn with */
+size_t
+draw_pt_replay_size(const struct draw_context *draw)
+{
+   const struct draw_pt_replay *replay = draw->pt.replay;
+
+   return replay ? replay->bytes + replay->scratch.capacity : 0;
+}
+
+
+void
+draw_pt_replay_destroy(struct draw_context *draw)
+{
+   struct draw_pt_replay *replay = draw->pt.replay;
+
+   if (!replay)
+      return;
+
+   replay_clear(replay);
+   _mesa_hash_table_destroy(replay->states, NULL);
+   _mesa_hash_table_destroy(replay->draws, NULL);
+   util_dynarray_fini(&replay->scratch);
+   FREE(replay);
+   draw->pt.replay = NULL;
+}
+
+
+/**
+ * Record what draws emit to the render, and replay it for later draws
+ * with the same parameters, state and buffer contents, keeping up to
+ * max_bytes of vertices.  The driver has to give a serial for the
+ * buffers of every draw, see draw_set_replay_serial().  Only supported
+ * with the llvm middle end; 0 disables it.
+ */
+void
+draw_enable_replay(struct draw_context *draw, size_t max_bytes)
+{
+   struct draw_pt_replay *replay;
+
+   draw_pt_replay_destroy(draw);
+
+   if (!max_bytes || !draw->pt.middle.llvm)
+      return;
+
+   replay = CALLOC_STRUCT(draw_pt_replay);
+   if (!replay)
+      return;
+
+   replay->max_bytes = max_bytes;
+   replay->states = _mesa_hash_table_create(NULL, replay_blob_hash,
+                                            replay_blob_equal);
+   replay->draws = _mesa_hash_table_create(NULL, replay_blob_hash,
+                                           replay_blob_equal);
+   if (!replay->states || !replay->draws) {
+      if (replay->states)
+         _mesa_hash_table_destroy(replay->states, NULL);
+      if (replay->draws)
+         _mesa_hash_table_destroy(replay->draws, NULL);
+      FREE(replay);
+      return;
+   }
+
+   list_inithead(&replay->lru);
+   util_dynarray_init(&replay->scratch, NULL);
+
+   draw->pt.replay = replay;
+   draw->pt.replay_state_dirty = TRUE;
+}
+
+
+/**
+ * Set the serial of the buffers the next draws read: their vertex and
+ * index buffers, and the vertex shader's constant buffers.  It has to
+ * change whenever their contents may have, or the storage behind their
+ * mapped pointers was replaced.  0 means the draws must not be replayed,
+ * for example as they read client memory.
+ */
+void
+draw_set_replay_serial(struct draw_context *draw, uint64_t serial)
+{
+   draw->pt.replay_serial = serial;
+}
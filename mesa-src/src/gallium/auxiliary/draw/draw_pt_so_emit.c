@@ -40,6 +40,15 @@
 #include "util/u_prim.h"
 #include "util/u_memory.h"
 
+/** An output of the stream being emitted, see so_setup_stream() */
+struct pt_so_slot {
+   unsigned src_offset;   /**< bytes into the vertex data */
+   unsigned num_comps;
+   unsigned ob;
+   unsigned dst_offset;   /**< in floats */
+   boolean pre_clip_pos;
+};
+
 struct pt_so_emit {
    struct draw_context *draw;
 
@@ -52,6 +61,13 @@ struct pt_so_emit {
    unsigned emitted_primitives;
    unsigned generated_primitives;
    unsigned stream;
+
+   /** The stream's outputs, and what they need of each buffer */
+   struct pt_so_slot slots[PIPE_MAX_SO_OUTPUTS];
+   unsigned num_slots;
+   unsigned buffer_end[PIPE_MAX_SO_BUFFERS];   /**< bytes, 0 if unwritten */
+   unsigned buffer_stride[PIPE_MAX_SO_BUFFERS];   /**< bytes */
+   boolean missing_target;
 };
 
 static const struct pipe_stream_output_info *
@@ -112,115 +128,110 @@ void draw_pt_so_emit_prepare(struct pt_so_emit *emit, boolean use_pre_clip_pos)
    draw_do_flush( draw, DRAW_FLUSH_BACKEND );
 }
 
+/**
+ * Look up the outputs of the stream once, rather than for every vertex.
+ */
+static void so_setup_stream(struct pt_so_emit *so)
+{
+   struct draw_context *draw = so->draw;
+   const struct pipe_stream_output_info *state = draw_so_info(draw);
+   unsigned slot, ob;
+
+   so->num_slots = 0;
+   so->missing_target = FALSE;
+   for (ob = 0; ob < PIPE_MAX_SO_BUFFERS; ob++) {
+      so->buffer_end[ob] = 0;
+      so->buffer_stride[ob] = state->stride[ob] * sizeof(float);
+   }
+
+   for (slot = 0; slot < state->num_outputs; ++slot) {
+      const struct pipe_stream_output *output = &state->output[slot];
+      struct pt_so_slot *so_slot;
+      unsigned end;
+
+      if (output->stream != so->stream)
+         continue;
+
+      ob = output->output_buffer;
+      /* If a buffer is missing then that's equivalent to
+       * an overflow */
+      if (ob >= draw->so.num_targets || !draw->so.targets[ob])
+         so->missing_target = TRUE;
+
+      so_slot = &so->slots[so->num_slots++];
+      so_slot->src_offset = (output->register_index * 4 +
+                             output->start_component) * sizeof(float);
+      so_slot->num_comps = output->num_components;
+      so_slot->ob = ob;
+      so_slot->dst_offset = output->dst_offset;
+      so_slot->pre_clip_pos = so->use_pre_clip_pos && so->stream == 0 &&
+                              output->register_index == so->pos_idx;
+      if (so_slot->pre_clip_pos)
+         so_slot->src_offset = output->start_component * sizeof(float);
+
+      end = (output->dst_offset + output->num_components) * sizeof(float);
+      so->buffer_end[ob] = MAX2(so->buffer_end[ob], end);
+   }
+}
+
 static void so_emit_prim(struct pt_so_emit *so,
                          unsigned *indices,
                          unsigned num_vertices)
 {
-   unsigned slot, i;
+   unsigned slot, i, ob;
    unsigned input_vertex_stride = so->input_vertex_stride;
    struct draw_context *draw = so->draw;
-   const float (*input_ptr)[4];
-   const float *pcp_ptr = NULL;
-   const struct pipe_stream_output_info *state = draw_so_info(draw);
-   float *buffer;
-   int buffer_total_bytes[PIPE_MAX_SO_BUFFERS];
-   boolean buffer_written[PIPE_MAX_SO_BUFFERS] = {0};
-
-   input_ptr = so->inputs;
-   if (so->use_pre_clip_pos)
-      pcp_ptr = so->pre_clip_pos;
+   const char *input_ptr = (const char *)so->inputs;
+   const char *pcp_ptr = (const char *)so->pre_clip_pos;
 
    ++so->generated_primitives;
 
-   for (i = 0; i < draw->so.num_targets; i++) {
-      struct draw_so_target *target = draw->so.targets[i];
-      if (target) {
-         buffer_total_bytes[i] = target->internal_offset;
-      } else {
-         buffer_total_bytes[i] = 0;
-      }
-   }
+   if (so->missing_target)
+      return;
 
-   /* check have we space to emit prim first - if not don't do anything */
-   for (i = 0; i < num_vertices; ++i) {
-      unsigned ob;
-      for (slot = 0; slot < state->num_outputs; ++slot) {
-         unsigned num_comps = state->output[slot].num_components;
-         int ob = state->output[slot].output_buffer;
-         unsigned dst_offset = state->output[slot].dst_offset * sizeof(float);
-         unsigned write_size = num_comps * sizeof(float);
-
-         if (state->output[slot].stream != so->stream)
-            continue;
-         /* If a buffer is missing then that's equivalent to
-          * an overflow */
-         if (!draw->so.targets[ob]) {
-            return;
-         }
-         if ((buffer_total_bytes[ob] + write_size + dst_offset) >
-             draw->so.targets[ob]->target.buffer_size) {
-            return;
-         }
-      }
-      for (ob = 0; ob < draw->so.num_targets; ++ob) {
-         buffer_total_bytes[ob] += state->stride[ob] * sizeof(float);
-      }
+   /* check have we space to emit prim first - if not don't do anything,
+    * the last vertex is the one which reaches furthest into each buffer */
+   for (ob = 0; ob < draw->so.num_targets; ob++) {
+      struct draw_so_target *target = draw->so.targets[ob];
+
+      if (so->buffer_end[ob] &&
+          target->internal_offset + (num_vertices - 1) * so->buffer_stride[ob] +
+          so->buffer_end[ob] > target->target.buffer_size)
+         return;
    }
 
    for (i = 0; i < num_vertices; ++i) {
-      const float (*input)[4];
-      const float *pre_clip_pos = NULL;
-      unsigned  ob;
-
-      input = (const float (*)[4])(
-         (const char *)input_ptr + (indices[i] * input_vertex_stride));
-
-      if (pcp_ptr)
-         pre_clip_pos = (const float *)(
-         (const char *)pcp_ptr + (indices[i] * input_vertex_stride));
-
-      for (slot = 0; slot < state->num_outputs; ++slot) {
-         unsigned idx = state->output[slot].register_index;
-         unsigned start_comp = state->output[slot].start_component;
-         unsigned num_comps = state->output[slot].num_components;
-         unsigned stream = state->output[slot].stream;
-
-         if (stream != so->stream)
-            continue;
-         ob = state->output[slot].output_buffer;
-         buffer_written[ob] = TRUE;
-
-         buffer = (float *)((char *)draw->so.targets[ob]->mapping +
-                            draw->so.targets[ob]->target.buffer_offset +
-                            draw->so.targets[ob]->internal_offset) +
-            state->output[slot].dst_offset;
-         
-         if (idx == so->pos_idx && pcp_ptr && so->stream == 0)
-            memcpy(buffer, &pre_clip_pos[start_comp],
-                   num_comps * sizeof(float));
-         else
-            memcpy(buffer, &input[idx][start_comp],
-                   num_comps * sizeof(float));
-#if 0
-         {
-            int j;
-            debug_printf("VERT[%d], stream = %d, offset = %d, slot[%d] sc = %d, num_c = %d, idx = %d = [",
-                         i, stream,
-                         draw->so.targets[ob]->internal_offset,
-                         slot, start_comp, num_comps, idx);
-            for (j = 0; j < num_comps; ++j) {
-               unsigned *ubuffer = (unsigned*)buffer;
-               debug_printf("%d (0x%x), ", ubuffer[j], ubuffer[j]);
-            }
-            debug_printf("]\n");
+      const char *input = input_ptr + indices[i] * input_vertex_stride;
+      const char *pre_clip_pos = pcp_ptr ?
+         pcp_ptr + indices[i] * input_vertex_stride : NULL;
+
+      for (slot = 0; slot < so->num_slots; ++slot) {
+         const struct pt_so_slot *so_slot = &so->slots[slot];
+         struct draw_so_target *target = draw->so.targets[so_slot->ob];
+         const float *src = (const float *)
+            ((so_slot->pre_clip_pos ? pre_clip_pos : input) + so_slot->src_offset);
+         float *buffer = (float *)((char *)target->mapping +
+                                   target->target.buffer_offset +
+                                   target->internal_offset) +
+            so_slot->dst_offset;
+
+         switch (so_slot->num_comps) {
+         case 4:
+            buffer[3] = src[3];
+            /* fallthrough */
+         case 3:
+            buffer[2] = src[2];
+            /* fallthrough */
+         case 2:
+            buffer[1] = src[1];
+            /* fallthrough */
+         default:
+            buffer[0] = src[0];
          }
-#endif
       }
       for (ob = 0; ob < draw->so.num_targets; ++ob) {
-         struct draw_so_target *target = draw->so.targets[ob];
-         if (target && buffer_written[ob]) {
-            target->internal_offset += state->stride[ob] * sizeof(float);
-         }
+         if (so->buffer_end[ob])
+            draw->so.targets[ob]->internal_offset += so->buffer_stride[ob];
       }
    }
    ++so->emitted_primitives;
@@ -307,6 +318,7 @@ void draw_pt_so_emit( struct pt_so_emit *emit,
       emit->input_vertex_stride = input_verts[stream].stride;
       emit->inputs = (const float (*)[4])input_verts[stream].verts->data;
       emit->stream = stream;
+      so_setup_stream(emit);
       for (start = i = 0; i < input_prims[stream].primitive_count;
            start += input_prims[stream].primitive_lengths[i], i++)
       {
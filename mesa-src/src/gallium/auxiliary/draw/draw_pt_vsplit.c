@@ -23,6 +23,9 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <inttypes.h>
+
+#include "util/u_debug.h"
 #include "util/u_math.h"
 #include "util/u_memory.h"
 
@@ -30,12 +33,21 @@
 #include "draw/draw_private.h"
 #include "draw/draw_pt.h"
 
-#define SEGMENT_SIZE 1024
-#define MAP_SIZE     256
+#define SEGMENT_SIZE 4096
+
+/**
+ * The vertex cache is set associative, with MAP_SETS sets of
+ * DRAW_VCACHE_WAYS ways, at most MAP_MAX_WAYS.
+ */
+#define MAP_SETS     256
+#define MAP_MAX_WAYS 8
 
 /* The largest possible index within an index buffer */
 #define MAX_ELT_IDX 0xffffffff
 
+DEBUG_GET_ONCE_NUM_OPTION(draw_vcache_ways, "DRAW_VCACHE_WAYS", 4)
+DEBUG_GET_ONCE_BOOL_OPTION(draw_vcache_stats, "DRAW_VCACHE_STATS", FALSE)
+
 struct vsplit_frontend {
    struct draw_pt_front_end base;
    struct draw_context *draw;
@@ -54,12 +66,18 @@ struct vsplit_frontend {
 
    struct {
       /* map a fetch element to a draw element */
-      unsigned fetches[MAP_SIZE];
-      ushort draws[MAP_SIZE];
-      boolean has_max_fetch;
+      unsigned fetches[MAP_SETS][MAP_MAX_WAYS];
+      ushort draws[MAP_SETS][MAP_MAX_WAYS];
+      ubyte used[MAP_SETS];     /**< valid ways of each set */
+      ubyte victim[MAP_SETS];   /**< way replaced next once the set is full */
+      unsigned ways;
 
       ushort num_fetch_elts;
       ushort num_draw_elts;
+
+      /** Draw elements found in the cache, and fetched, see DRAW_VCACHE_STATS */
+      uint64_t hits;
+      uint64_t misses;
    } cache;
 };
 
@@ -67,8 +85,8 @@ struct vsplit_frontend {
 static void
 vsplit_clear_cache(struct vsplit_frontend *vsplit)
 {
-   memset(vsplit->cache.fetches, 0xff, sizeof(vsplit->cache.fetches));
-   vsplit->cache.has_max_fetch = FALSE;
+   memset(vsplit->cache.used, 0, sizeof(vsplit->cache.used));
+   memset(vsplit->cache.victim, 0, sizeof(vsplit->cache.victim));
    vsplit->cache.num_fetch_elts = 0;
    vsplit->cache.num_draw_elts = 0;
 }
@@ -76,6 +94,9 @@ vsplit_clear_cache(struct vsplit_frontend *vsplit)
 static void
 vsplit_flush_cache(struct vsplit_frontend *vsplit, unsigned flags)
 {
+   vsplit->cache.hits += vsplit->cache.num_draw_elts - vsplit->cache.num_fetch_elts;
+   vsplit->cache.misses += vsplit->cache.num_fetch_elts;
+
    vsplit->middle->run(vsplit->middle,
          vsplit->fetch_elts, vsplit->cache.num_fetch_elts,
          vsplit->draw_elts, vsplit->cache.num_draw_elts, flags);
@@ -87,23 +108,38 @@ vsplit_flush_cache(struct vsplit_frontend *vsplit, unsigned flags)
 static inline void
 vsplit_add_cache(struct vsplit_frontend *vsplit, unsigned fetch)
 {
-   unsigned hash;
-
-   hash = fetch % MAP_SIZE;
-
-   /* If the value isn't in the cache or it's an overflow due to the
-    * element bias */
-   if (vsplit->cache.fetches[hash] != fetch) {
-      /* update cache */
-      vsplit->cache.fetches[hash] = fetch;
-      vsplit->cache.draws[hash] = vsplit->cache.num_fetch_elts;
+   /* Fibonacci hashing, so that strided indices spread over the sets */
+   const unsigned set = (fetch * 2654435761u) >> 24;
+   unsigned *fetches = vsplit->cache.fetches[set];
+   ushort *draws = vsplit->cache.draws[set];
+   const unsigned used = vsplit->cache.used[set];
+   unsigned way;
+
+   STATIC_ASSERT(MAP_SETS == 1 << 8);
+
+   for (way = 0; way < used; way++) {
+      if (fetches[way] == fetch) {
+         vsplit->draw_elts[vsplit->cache.num_draw_elts++] = draws[way];
+         return;
+      }
+   }
 
-      /* add fetch */
-      assert(vsplit->cache.num_fetch_elts < vsplit->segment_size);
-      vsplit->fetch_elts[vsplit->cache.num_fetch_elts++] = fetch;
+   /* not in the cache: replace the oldest way once the set is full */
+   if (used < vsplit->cache.ways) {
+      vsplit->cache.used[set] = used + 1;
    }
+   else {
+      way = vsplit->cache.victim[set];
+      vsplit->cache.victim[set] = (way + 1) % vsplit->cache.ways;
+   }
+   fetches[way] = fetch;
+   draws[way] = vsplit->cache.num_fetch_elts;
+
+   /* add fetch */
+   assert(vsplit->cache.num_fetch_elts < vsplit->segment_size);
+   vsplit->fetch_elts[vsplit->cache.num_fetch_elts++] = fetch;
 
-   vsplit->draw_elts[vsplit->cache.num_draw_elts++] = vsplit->cache.draws[hash];
+   vsplit->draw_elts[vsplit->cache.num_draw_elts++] = draws[way];
 }
 
 /**
@@ -125,12 +161,6 @@ vsplit_add_cache_ubyte(struct vsplit_frontend *vsplit, const ubyte *elts,
    unsigned elt_idx;
    elt_idx = vsplit_get_base_idx(start, fetch);
    elt_idx = (unsigned)((int)(DRAW_GET_IDX(elts, elt_idx)) + elt_bias);
-   /* unlike the uint case this can only happen with elt_bias */
-   if (elt_bias && elt_idx == DRAW_MAX_FETCH_IDX && !vsplit->cache.has_max_fetch) {
-      unsigned hash = elt_idx % MAP_SIZE;
-      vsplit->cache.fetches[hash] = 0;
-      vsplit->cache.has_max_fetch = TRUE;
-   }
    vsplit_add_cache(vsplit, elt_idx);
 }
 
@@ -142,12 +172,6 @@ vsplit_add_cache_ushort(struct vsplit_frontend *vsplit, const ushort *elts,
    unsigned elt_idx;
    elt_idx = vsplit_get_base_idx(start, fetch);
    elt_idx = (unsigned)((int)(DRAW_GET_IDX(elts, elt_idx)) + elt_bias);
-   /* unlike the uint case this can only happen with elt_bias */
-   if (elt_bias && elt_idx == DRAW_MAX_FETCH_IDX && !vsplit->cache.has_max_fetch) {
-      unsigned hash = elt_idx % MAP_SIZE;
-      vsplit->cache.fetches[hash] = 0;
-      vsplit->cache.has_max_fetch = TRUE;
-   }
    vsplit_add_cache(vsplit, elt_idx);
 }
 
@@ -167,13 +191,6 @@ vsplit_add_cache_uint(struct vsplit_frontend *vsplit, const uint *elts,
     */
    elt_idx = vsplit_get_base_idx(start, fetch);
    elt_idx = (unsigned)((int)(DRAW_GET_IDX(elts, elt_idx)) + elt_bias);
-   /* Take care for DRAW_MAX_FETCH_IDX (since cache is initialized to -1). */
-   if (elt_idx == DRAW_MAX_FETCH_IDX && !vsplit->cache.has_max_fetch) {
-      unsigned hash = elt_idx % MAP_SIZE;
-      /* force update - any value will do except DRAW_MAX_FETCH_IDX */
-      vsplit->cache.fetches[hash] = 0;
-      vsplit->cache.has_max_fetch = TRUE;
-   }
    vsplit_add_cache(vsplit, elt_idx);
 }
 
@@ -245,6 +262,17 @@ static void vsplit_flush(struct draw_pt_front_end *frontend, unsigned flags)
 
 static void vsplit_destroy(struct draw_pt_front_end *frontend)
 {
+   struct vsplit_frontend *vsplit = (struct vsplit_frontend *) frontend;
+
+   if (debug_get_option_draw_vcache_stats() &&
+       vsplit->cache.hits + vsplit->cache.misses) {
+      debug_printf("draw: vertex cache: %" PRIu64 " hits, %" PRIu64
+                   " misses, %.1f%% hit rate\n",
+                   vsplit->cache.hits, vsplit->cache.misses,
+                   100.0 * vsplit->cache.hits /
+                   (vsplit->cache.hits + vsplit->cache.misses));
+   }
+
    FREE(frontend);
 }
 
@@ -262,6 +290,8 @@ struct draw_pt_front_end *draw_pt_vsplit(struct draw_context *draw)
    vsplit->base.flush   = vsplit_flush;
    vsplit->base.destroy = vsplit_destroy;
    vsplit->draw = draw;
+   vsplit->cache.ways = CLAMP(debug_get_option_draw_vcache_ways(), 1,
+                              MAP_MAX_WAYS);
 
    for (i = 0; i < SEGMENT_SIZE; i++)
       vsplit->identity_draw_elts[i] = i;
@@ -27,12 +27,25 @@
 #include "draw_llvm.h"
 #endif
 
-#include "tessellator/p_tessellator.h"
 #include "nir/nir_to_tgsi_info.h"
+#include "util/u_debug.h"
 #include "util/u_prim.h"
 #include "util/u_math.h"
 #include "util/u_memory.h"
+#include "util/u_queue.h"
+#include "util/hash_table.h"
 #include "util/ralloc.h"
+
+
+DEBUG_GET_ONCE_NUM_OPTION(draw_threads, "DRAW_THREADS", 0)
+
+
+/** Jobs the patches of a draw are split into at most */
+#define DRAW_TES_MAX_JOBS 16
+
+/** Fewer patches aren't worth a job of their own */
+#define DRAW_TES_MIN_JOB_PATCHES 32
+
 static inline int
 draw_tes_get_input_index(int semantic, int index,
                          const struct tgsi_shader_info *input_info)
@@ -216,12 +229,13 @@ int draw_tess_ctrl_shader_run(struct draw_tess_ctrl_shader *shader,
 #define DEBUG_INPUTS 0
 static void
 llvm_fetch_tes_input(struct draw_tess_eval_shader *shader,
+                     struct draw_tes_inputs *tes_input,
                      const struct draw_prim_info *input_prim_info,
                      unsigned prim_id,
                      unsigned num_vertices)
 {
    const float (*input_ptr)[4];
-   float (*input_data)[32][PIPE_MAX_SHADER_INPUTS][TGSI_NUM_CHANNELS] = &shader->tes_input->data;
+   float (*input_data)[32][PIPE_MAX_SHADER_INPUTS][TGSI_NUM_CHANNELS] = &tes_input->data;
    unsigned slot, i;
    int vs_slot;
    unsigned input_vertex_stride = shader->input_vertex_stride;
@@ -301,15 +315,156 @@ llvm_fetch_tess_factors(struct draw_tess_eval_shader *shader,
 
 static void
 llvm_tes_run(struct draw_tess_eval_shader *shader,
+             struct draw_tes_inputs *tes_input,
              uint32_t prim_id,
              uint32_t patch_vertices_in,
-             struct pipe_tessellator_data *tess_data,
-             struct pipe_tessellation_factors *tess_factors,
+             uint32_t num_domain_points,
+             const float *domain_points_u,
+             const float *domain_points_v,
+             const struct pipe_tessellation_factors *tess_factors,
              struct vertex_header *output)
 {
-   shader->current_variant->jit_func(shader->jit_context, shader->tes_input->data, output, prim_id,
-                                     tess_data->num_domain_points, tess_data->domain_points_u, tess_data->domain_points_v,
-                                     tess_factors->outer_tf, tess_factors->inner_tf, patch_vertices_in);
+   shader->current_variant->jit_func(shader->jit_context, tes_input->data, output, prim_id,
+                                     num_domain_points, (float *)domain_points_u, (float *)domain_points_v,
+                                     (float *)tess_factors->outer_tf, (float *)tess_factors->inner_tf, patch_vertices_in);
+}
+
+
+/**
+ * Tessellate a patch, or find the domain points and indices of the same
+ * tess levels in the shader's pattern cache.  The result is valid until
+ * the next call.
+ */
+static const struct pipe_tessellator_data *
+llvm_tes_get_pattern(struct draw_tess_eval_shader *shader,
+                     const struct pipe_tessellation_factors *factors)
+{
+   struct pipe_tessellator_data data;
+   struct draw_tess_pattern *pattern;
+   unsigned num_points, num_indices;
+   uint32_t hash;
+
+   hash = _mesa_hash_data(factors->outer_tf, sizeof factors->outer_tf);
+   hash ^= _mesa_hash_data(factors->inner_tf, sizeof factors->inner_tf);
+   pattern = &shader->patterns[hash & (DRAW_TESS_PATTERN_CACHE_SIZE - 1)];
+
+   if (pattern->valid &&
+       memcmp(pattern->outer_tf, factors->outer_tf, sizeof pattern->outer_tf) == 0 &&
+       memcmp(pattern->inner_tf, factors->inner_tf, sizeof pattern->inner_tf) == 0)
+      return &pattern->data;
+
+   p_tessellate(shader->tessellator, factors, &data);
+
+   FREE(pattern->data.indices);
+   memset(pattern, 0, sizeof *pattern);
+
+   num_points = data.num_domain_points;
+   num_indices = data.num_indices;
+   pattern->data.indices = MALLOC((num_indices + 2 * num_points) * sizeof(uint32_t));
+   if (!pattern->data.indices) {
+      shader->tess_data = data;
+      return &shader->tess_data;
+   }
+   pattern->data.domain_points_u = (float *)(pattern->data.indices + num_indices);
+   pattern->data.domain_points_v = pattern->data.domain_points_u + num_points;
+   memcpy(pattern->data.indices, data.indices, num_indices * sizeof(uint32_t));
+   memcpy(pattern->data.domain_points_u, data.domain_points_u, num_points * sizeof(float));
+   memcpy(pattern->data.domain_points_v, data.domain_points_v, num_points * sizeof(float));
+   pattern->data.num_indices = num_indices;
+   pattern->data.num_domain_points = num_points;
+
+   memcpy(pattern->outer_tf, factors->outer_tf, sizeof pattern->outer_tf);
+   memcpy(pattern->inner_tf, factors->inner_tf, sizeof pattern->inner_tf);
+   pattern->valid = TRUE;
+   return &pattern->data;
+}
+
+
+/** Where the domain points of a patch go, see draw_tess_eval_shader_run() */
+struct draw_tes_patch {
+   uint32_t vert_start;
+   uint32_t num_domain_points;
+   struct pipe_tessellation_factors factors;
+};
+
+/** The patches of a draw, shared by its jobs */
+struct draw_tes_run {
+   struct draw_tess_eval_shader *shader;
+   const struct draw_prim_info *input_prim;
+   unsigned num_input_vertices_per_patch;
+   const struct draw_tes_patch *patches;
+   const float *domain_points_u;
+   const float *domain_points_v;
+   char *verts;
+   unsigned vertex_size;
+};
+
+/** A run of consecutive patches, evaluated on one thread */
+struct draw_tes_job {
+   struct util_queue_fence fence;
+   const struct draw_tes_run *run;
+   unsigned first_patch;
+   unsigned num_patches;
+   struct draw_tes_inputs *tes_input;
+};
+
+struct draw_tes_queue {
+   struct util_queue queue;
+   unsigned num_threads;
+   struct draw_tes_job jobs[DRAW_TES_MAX_JOBS];
+};
+
+
+static void
+llvm_tes_run_patches(const struct draw_tes_run *run,
+                     struct draw_tes_inputs *tes_input,
+                     unsigned first_patch, unsigned num_patches)
+{
+   for (unsigned i = first_patch; i < first_patch + num_patches; i++) {
+      const struct draw_tes_patch *patch = &run->patches[i];
+
+      if (patch->num_domain_points == 0)
+         continue;
+
+      llvm_fetch_tes_input(run->shader, tes_input, run->input_prim, i,
+                           run->num_input_vertices_per_patch);
+      llvm_tes_run(run->shader, tes_input, i, run->num_input_vertices_per_patch,
+                   patch->num_domain_points,
+                   run->domain_points_u + patch->vert_start,
+                   run->domain_points_v + patch->vert_start,
+                   &patch->factors,
+                   (struct vertex_header *)(run->verts +
+                                            patch->vert_start * run->vertex_size));
+   }
+}
+
+
+static void
+llvm_tes_job_execute(void *data, int thread_index)
+{
+   struct draw_tes_job *job = (struct draw_tes_job *)data;
+
+   llvm_tes_run_patches(job->run, job->tes_input,
+                        job->first_patch, job->num_patches);
+}
+
+
+/**
+ * Grow an array of elt_size elements to hold at least count, doubling.
+ */
+static boolean
+llvm_tes_reserve(void **array, unsigned *size, unsigned count,
+                 unsigned elt_size)
+{
+   if (count > *size) {
+      unsigned new_size = MAX2(count, *size * 2);
+      void *new_array = REALLOC(*array, *size * elt_size, new_size * elt_size);
+      if (!new_array)
+         return FALSE;
+      *array = new_array;
+      *size = new_size;
+   }
+   return TRUE;
 }
 #endif
 
@@ -354,55 +509,120 @@ int draw_tess_eval_shader_run(struct draw_tess_eval_shader *shader,
       shader->draw->statistics.ds_invocations += input_prim->primitive_count;
    }
 #ifdef LLVM_AVAILABLE
-   struct pipe_tessellation_factors factors;
-   struct pipe_tessellator_data data = { 0 };
-   struct pipe_tessellator *ptess = p_tess_init(shader->prim_mode,
-                                                shader->spacing,
-                                                !shader->vertex_order_cw,
-                                                shader->point_mode);
-   for (unsigned i = 0; i < input_prim->primitive_count; i++) {
-      uint32_t vert_start = output_verts->count;
+   struct draw_tes_queue *queue = shader->draw->tes.queue;
+   unsigned num_patches = input_prim->primitive_count;
+   uint32_t prim_len = u_prim_vertex_count(output_prims->prim)->min;
+   struct draw_tes_patch *patches;
+   struct draw_tes_run run;
+   float *domain_u = NULL, *domain_v = NULL;
+   unsigned domain_size = 0, domain_v_size = 0;
+   unsigned num_jobs = 1, job_patches;
+   uint32_t verts_end = 0;
+
+   patches = MALLOC(MAX2(num_patches, 1) * sizeof *patches);
+   if (!patches)
+      goto out;
+
+   if (queue)
+      num_jobs = CLAMP(num_patches / DRAW_TES_MIN_JOB_PATCHES, 1,
+                       queue->num_threads + 1);
+   job_patches = DIV_ROUND_UP(num_patches, num_jobs);
+
+   /*
+    * Tessellate all the patches first, in order, as that is what the
+    * elements and the primitive lengths come out in.  The shader writes
+    * its vertices four at a time, so the last ones of a patch may spill
+    * over into the next; the patches of different jobs are kept that far
+    * apart.  The vertices in between aren't referenced.
+    */
+   for (unsigned i = 0; i < num_patches; i++) {
+      struct draw_tes_patch *patch = &patches[i];
+      const struct pipe_tessellator_data *data;
       uint32_t prim_start = output_prims->primitive_count;
       uint32_t elt_start = output_prims->count;
+      uint32_t vert_start;
 
-      llvm_fetch_tess_factors(shader, i, num_input_vertices_per_patch, &factors);
+      if (i % job_patches == 0)
+         output_verts->count = verts_end;
+      vert_start = output_verts->count;
+
+      llvm_fetch_tess_factors(shader, i, num_input_vertices_per_patch, &patch->factors);
 
       /* tessellate with the factors for this primitive */
-      p_tessellate(ptess, &factors, &data);
+      data = llvm_tes_get_pattern(shader, &patch->factors);
 
-      if (data.num_domain_points == 0)
+      patch->vert_start = vert_start;
+      patch->num_domain_points = data->num_domain_points;
+      if (data->num_domain_points == 0)
          continue;
 
-      uint32_t old_verts = vert_start;
-      uint32_t new_verts = vert_start + util_align_npot(data.num_domain_points, 4);
-      uint32_t old_size = output_verts->vertex_size * old_verts;
-      uint32_t new_size = output_verts->vertex_size * new_verts;
-      output_verts->verts = REALLOC(output_verts->verts, old_size, new_size);
+      verts_end = vert_start + util_align_npot(data->num_domain_points, 4);
+      if (!llvm_tes_reserve((void **)&domain_u, &domain_size, verts_end, sizeof(float)) ||
+          !llvm_tes_reserve((void **)&domain_v, &domain_v_size, verts_end, sizeof(float))) {
+         patch->num_domain_points = 0;
+         continue;
+      }
+      memcpy(domain_u + vert_start, data->domain_points_u,
+             data->num_domain_points * sizeof(float));
+      memcpy(domain_v + vert_start, data->domain_points_v,
+             data->num_domain_points * sizeof(float));
 
-      output_verts->count += data.num_domain_points;
+      output_verts->count += data->num_domain_points;
 
-      output_prims->count += data.num_indices;
+      output_prims->count += data->num_indices;
       elts = REALLOC(elts, elt_start * sizeof(uint16_t),
                      output_prims->count * sizeof(uint16_t));
 
-      for (unsigned i = 0; i < data.num_indices; i++)
-         elts[elt_start + i] = vert_start + data.indices[i];
+      for (unsigned j = 0; j < data->num_indices; j++)
+         elts[elt_start + j] = vert_start + data->indices[j];
 
-      llvm_fetch_tes_input(shader, input_prim, i, num_input_vertices_per_patch);
-      /* run once per primitive? */
-      char *output = (char *)output_verts->verts;
-      output += vert_start * vertex_size;
-      llvm_tes_run(shader, i, num_input_vertices_per_patch, &data, &factors, (struct vertex_header *)output);
-
-      uint32_t prim_len = u_prim_vertex_count(output_prims->prim)->min;
-      output_prims->primitive_count += data.num_indices / prim_len;
+      output_prims->primitive_count += data->num_indices / prim_len;
       output_prims->primitive_lengths = REALLOC(output_prims->primitive_lengths, prim_start * sizeof(uint32_t),
                                                 output_prims->primitive_count * sizeof(uint32_t));
-      for (unsigned i = prim_start; i < output_prims->primitive_count; i++) {
-         output_prims->primitive_lengths[i] = prim_len;
+      for (unsigned j = prim_start; j < output_prims->primitive_count; j++) {
+         output_prims->primitive_lengths[j] = prim_len;
+      }
+   }
+   if (verts_end) {
+      output_verts->verts = MALLOC(verts_end * vertex_size);
+      if (!output_verts->verts) {
+         output_verts->count = 0;
+         output_prims->count = 0;
+         output_prims->primitive_count = 0;
+         goto out;
       }
    }
-   p_tess_destroy(ptess);
+
+   run.shader = shader;
+   run.input_prim = input_prim;
+   run.num_input_vertices_per_patch = num_input_vertices_per_patch;
+   run.patches = patches;
+   run.domain_points_u = domain_u;
+   run.domain_points_v = domain_v;
+   run.verts = (char *)output_verts->verts;
+   run.vertex_size = vertex_size;
+
+   /* The last job runs here, while the threads do the others. */
+   for (unsigned j = 0; j + 1 < num_jobs; j++) {
+      struct draw_tes_job *job = &queue->jobs[j];
+
+      job->run = &run;
+      job->first_patch = j * job_patches;
+      job->num_patches = job_patches;
+      util_queue_add_job(&queue->queue, job, &job->fence,
+                         llvm_tes_job_execute, NULL, 0);
+   }
+
+   llvm_tes_run_patches(&run, shader->tes_input, (num_jobs - 1) * job_patches,
+                        num_patches - (num_jobs - 1) * job_patches);
+
+   for (unsigned j = 0; j + 1 < num_jobs; j++)
+      util_queue_fence_wait(&queue->jobs[j].fence);
+
+out:
+   FREE(patches);
+   FREE(domain_u);
+   FREE(domain_v);
 #endif
 
    *elts_out = elts;
@@ -575,6 +795,9 @@ draw_create_tess_eval_shader(struct draw_context *draw,
       tes->tes_input = align_malloc(sizeof(struct draw_tes_inputs), 16);
       memset(tes->tes_input, 0, sizeof(struct draw_tes_inputs));
 
+      tes->tessellator = p_tess_init(tes->prim_mode, tes->spacing,
+                                     !tes->vertex_order_cw, tes->point_mode);
+
       tes->jit_context = &draw->llvm->tes_jit_context;
       llvm_tes->variant_key_size =
          draw_tes_llvm_variant_key_size(
@@ -618,6 +841,11 @@ void draw_delete_tess_eval_shader(struct draw_context *draw,
 
       assert(shader->variants_cached == 0);
       align_free(dtes->tes_input);
+
+      for (unsigned i = 0; i < DRAW_TESS_PATTERN_CACHE_SIZE; i++)
+         FREE(dtes->patterns[i].data.indices);
+      if (dtes->tessellator)
+         p_tess_destroy(dtes->tessellator);
    }
 #endif
    if (dtes->state.ir.nir)
@@ -633,6 +861,67 @@ void draw_tes_set_current_variant(struct draw_tess_eval_shader *shader,
 }
 #endif
 
+/**
+ * Start the threads the patches of large draws are evaluated on, see
+ * DRAW_THREADS.  Without them, or if they can't be started, it is all
+ * done on the application thread.
+ */
+boolean draw_tess_init(struct draw_context *draw)
+{
+#ifdef LLVM_AVAILABLE
+   struct draw_tes_queue *queue;
+   unsigned num_threads = MIN2(debug_get_option_draw_threads(),
+                               DRAW_TES_MAX_JOBS - 1);
+
+   if (!draw->llvm || !num_threads)
+      return TRUE;
+
+   queue = CALLOC_STRUCT(draw_tes_queue);
+   if (!queue)
+      return TRUE;
+
+   if (!util_queue_init(&queue->queue, "draw_tes", DRAW_TES_MAX_JOBS,
+                        num_threads, 0)) {
+      FREE(queue);
+      return TRUE;
+   }
+
+   for (unsigned i = 0; i < DRAW_TES_MAX_JOBS - 1; i++)
+      util_queue_fence_init(&queue->jobs[i].fence);
+
+   queue->num_threads = num_threads;
+   for (unsigned i = 0; i < num_threads; i++) {
+      queue->jobs[i].tes_input = align_malloc(sizeof(struct draw_tes_inputs), 16);
+      if (!queue->jobs[i].tes_input) {
+         queue->num_threads = i;
+         break;
+      }
+      memset(queue->jobs[i].tes_input, 0, sizeof(struct draw_tes_inputs));
+   }
+
+   draw->tes.queue = queue;
+#endif
+   return TRUE;
+}
+
+void draw_tess_destroy(struct draw_context *draw)
+{
+#ifdef LLVM_AVAILABLE
+   struct draw_tes_queue *queue = draw->tes.queue;
+
+   if (!queue)
+      return;
+
+   util_queue_destroy(&queue->queue);
+   for (unsigned i = 0; i < DRAW_TES_MAX_JOBS - 1; i++) {
+      util_queue_fence_destroy(&queue->jobs[i].fence);
+      align_free(queue->jobs[i].tes_input);
+   }
+   FREE(queue);
+   draw->tes.queue = NULL;
+#endif
+}
+
 enum pipe_prim_type get_tes_output_prim(struct draw_tess_eval_shader *shader)
 {
    if (shader->point_mode)
@@ -28,6 +28,7 @@
 
 #include "draw_context.h"
 #include "draw_private.h"
+#include "tessellator/p_tessellator.h"
 
 struct draw_context;
 #ifdef LLVM_AVAILABLE
@@ -50,6 +51,21 @@ struct draw_tes_inputs {
   float data[32][PIPE_MAX_SHADER_INPUTS][4];
 };
 
+/** Entries of the tessellation pattern cache of a TES, a power of two */
+#define DRAW_TESS_PATTERN_CACHE_SIZE 64
+
+/**
+ * The domain points and indices p_tessellate() generated for a set of
+ * tess levels.  The other inputs of the tessellator, the primitive mode,
+ * spacing and vertex order, are properties of the shader.
+ */
+struct draw_tess_pattern {
+   boolean valid;
+   float outer_tf[4];
+   float inner_tf[2];
+   struct pipe_tessellator_data data;   /**< indices owns the allocation */
+};
+
 #endif
 
 struct draw_tess_ctrl_shader {
@@ -95,11 +111,18 @@ struct draw_tess_eval_shader {
    struct draw_tes_inputs *tes_input;
    struct draw_tes_jit_context *jit_context;
    struct draw_tes_llvm_variant *current_variant;
+
+   struct pipe_tessellator *tessellator;
+   struct pipe_tessellator_data tess_data;   /**< uncached, out of memory */
+   struct draw_tess_pattern patterns[DRAW_TESS_PATTERN_CACHE_SIZE];
 #endif
 };
 
 enum pipe_prim_type get_tes_output_prim(struct draw_tess_eval_shader *shader);
 
+boolean draw_tess_init(struct draw_context *draw);
+void draw_tess_destroy(struct draw_context *draw);
+
 int draw_tess_ctrl_shader_run(struct draw_tess_ctrl_shader *shader,
                               const void *constants[PIPE_MAX_CONSTANT_BUFFERS],
                               const unsigned constants_size[PIPE_MAX_CONSTANT_BUFFERS],
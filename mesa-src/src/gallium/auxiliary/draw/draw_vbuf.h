@@ -91,6 +91,20 @@ struct vbuf_render {
                            ushort min_index,
                            ushort max_index );
 
+   /**
+    * Draw straight from the draw module's vertices instead of a copy, when
+    * the hardware format is a run of consecutive float[4] shader outputs.
+    * The vertices start at the first of them, are stride bytes apart and
+    * not necessarily 16 byte aligned, and stay valid until
+    * release_vertices().  Return FALSE to get a copy after all.
+    *
+    * Optional.
+    */
+   boolean (*set_vertices)( struct vbuf_render *,
+                            const void *vertices,
+                            ushort stride,
+                            ushort nr_vertices );
+
    /**
     * Notify the renderer of the current primitive when it changes.
     * Must succeed for TRIANGLES, LINES and POINTS.  Other prims at
@@ -134,6 +134,9 @@ draw_delete_vertex_shader(struct draw_context *draw,
 {
    unsigned i;
 
+   /* the replayed states know the shader by its address */
+   draw_pt_replay_flush(draw);
+
    for (i = 0; i < dvs->nr_variants; i++) 
       dvs->variant[i]->destroy( dvs->variant[i] );
 
@@ -27,6 +27,7 @@
 
 #include "util/u_math.h"
 #include "util/u_memory.h"
+#include "util/hash_table.h"
 #include "pipe/p_shader_tokens.h"
 #include "pipe/p_screen.h"
 
@@ -64,6 +65,36 @@ vs_llvm_run_linear( struct draw_vertex_shader *shader,
 }
 
 
+/**
+ * All the keys of a shader have the same size, but the hash table
+ * callbacks only get to see the key, so work it out from there the same
+ * way draw_create_vs_llvm() does.
+ */
+static size_t
+vs_llvm_variant_key_size(const struct draw_llvm_variant_key *key)
+{
+   return draw_llvm_variant_key_size(key->nr_vertex_elements,
+                                     MAX2(key->nr_samplers,
+                                          key->nr_sampler_views),
+                                     key->nr_images);
+}
+
+
+static uint32_t
+vs_llvm_variant_key_hash(const void *key)
+{
+   return _mesa_hash_data(key, vs_llvm_variant_key_size(key));
+}
+
+
+static bool
+vs_llvm_variant_key_equal(const void *a, const void *b)
+{
+   size_t size = vs_llvm_variant_key_size(a);
+   return size == vs_llvm_variant_key_size(b) && memcmp(a, b, size) == 0;
+}
+
+
 static void
 vs_llvm_delete( struct draw_vertex_shader *dvs )
 {
@@ -78,6 +109,7 @@ vs_llvm_delete( struct draw_vertex_shader *dvs )
    }
 
    assert(shader->variants_cached == 0);
+   _mesa_hash_table_destroy(shader->variant_table, NULL);
    if (dvs->state.ir.nir)
       ralloc_free(dvs->state.ir.nir);
    FREE((void*) dvs->state.tokens);
@@ -94,6 +126,13 @@ draw_create_vs_llvm(struct draw_context *draw,
    if (!vs)
       return NULL;
 
+   vs->variant_table = _mesa_hash_table_create(NULL, vs_llvm_variant_key_hash,
+                                               vs_llvm_variant_key_equal);
+   if (!vs->variant_table) {
+      FREE(vs);
+      return NULL;
+   }
+
    /* due to some bugs in the feedback state tracker we have to check
       for ir.nir & PIPE_SHADER_IR_NIR here. */
    if (state->ir.nir && state->type == PIPE_SHADER_IR_NIR) {
@@ -105,6 +144,7 @@ draw_create_vs_llvm(struct draw_context *draw,
       /* we make a private copy of the tokens */
       vs->base.state.tokens = tgsi_dup_tokens(state->tokens);
       if (!vs->base.state.tokens) {
+         _mesa_hash_table_destroy(vs->variant_table, NULL);
          FREE(vs);
          return NULL;
       }
@@ -97,6 +97,7 @@ lp_build_min_simple(struct lp_build_context *bld,
    const struct lp_type type = bld->type;
    const char *intrinsic = NULL;
    unsigned intr_size = 0;
+   char intrin[32];
    LLVMValueRef cond;
 
    assert(lp_check_value(type, a));
@@ -114,10 +115,11 @@ lp_build_min_simple(struct lp_build_context *bld,
             intrinsic = "llvm.x86.sse.min.ps";
             intr_size = 128;
          }
-         else {
+         else if (type.length <= 8 || !lp_has_avx512()) {
             intrinsic = "llvm.x86.avx.min.ps.256";
             intr_size = 256;
          }
+         /* else cmp/select below, which llvm turns into a 512-bit vminps */
       }
       if (type.width == 64 && util_cpu_caps.has_sse2) {
          if (type.length == 1) {
@@ -128,12 +130,28 @@ lp_build_min_simple(struct lp_build_context *bld,
             intrinsic = "llvm.x86.sse2.min.pd";
             intr_size = 128;
          }
-         else {
+         else if (type.length <= 4 || !lp_has_avx512()) {
             intrinsic = "llvm.x86.avx.min.pd.256";
             intr_size = 256;
          }
       }
    }
+#if LLVM_VERSION_MAJOR >= 8
+   else if (type.floating && lp_has_neon64()) {
+      /*
+       * These become fmin, which returns nan if either input is, and
+       * fminnm, which returns the other input, for both NEON and SVE.
+       */
+      if (nan_behavior == GALLIVM_NAN_RETURN_NAN ||
+          nan_behavior == GALLIVM_NAN_RETURN_NAN_FIRST_NONNAN) {
+         lp_format_intrinsic(intrin, sizeof intrin, "llvm.minimum", bld->vec_type);
+      } else {
+         lp_format_intrinsic(intrin, sizeof intrin, "llvm.minnum", bld->vec_type);
+      }
+      intrinsic = intrin;
+      intr_size = type.width * type.length;
+   }
+#endif
    else if (type.floating && util_cpu_caps.has_altivec) {
       if (nan_behavior == GALLIVM_NAN_RETURN_NAN ||
           nan_behavior == GALLIVM_NAN_RETURN_NAN_FIRST_NONNAN) {
@@ -267,6 +285,7 @@ lp_build_max_simple(struct lp_build_context *bld,
    const struct lp_type type = bld->type;
    const char *intrinsic = NULL;
    unsigned intr_size = 0;
+   char intrin[32];
    LLVMValueRef cond;
 
    assert(lp_check_value(type, a));
@@ -284,10 +303,11 @@ lp_build_max_simple(struct lp_build_context *bld,
             intrinsic = "llvm.x86.sse.max.ps";
             intr_size = 128;
          }
-         else {
+         else if (type.length <= 8 || !lp_has_avx512()) {
             intrinsic = "llvm.x86.avx.max.ps.256";
             intr_size = 256;
          }
+         /* else cmp/select below, which llvm turns into a 512-bit vmaxps */
       }
       if (type.width == 64 && util_cpu_caps.has_sse2) {
          if (type.length == 1) {
@@ -298,12 +318,25 @@ lp_build_max_simple(struct lp_build_context *bld,
             intrinsic = "llvm.x86.sse2.max.pd";
             intr_size = 128;
          }
-         else {
+         else if (type.length <= 4 || !lp_has_avx512()) {
             intrinsic = "llvm.x86.avx.max.pd.256";
             intr_size = 256;
          }
       }
    }
+#if LLVM_VERSION_MAJOR >= 8
+   else if (type.floating && lp_has_neon64()) {
+      /* See lp_build_min_simple() */
+      if (nan_behavior == GALLIVM_NAN_RETURN_NAN ||
+          nan_behavior == GALLIVM_NAN_RETURN_NAN_FIRST_NONNAN) {
+         lp_format_intrinsic(intrin, sizeof intrin, "llvm.maximum", bld->vec_type);
+      } else {
+         lp_format_intrinsic(intrin, sizeof intrin, "llvm.maxnum", bld->vec_type);
+      }
+      intrinsic = intrin;
+      intr_size = type.width * type.length;
+   }
+#endif
    else if (type.floating && util_cpu_caps.has_altivec) {
       if (nan_behavior == GALLIVM_NAN_RETURN_NAN ||
           nan_behavior == GALLIVM_NAN_RETURN_NAN_FIRST_NONNAN) {
@@ -903,7 +936,13 @@ lp_build_sub(struct lp_build_context *bld,
  *
  *       t/255 ~= (t + (t >> 8) + 0x80) >> 8
  *
- *     achieving the exact results.
+ *     which is off by one for a few products, unless the roundoff is added
+ *     first, achieving the exact results
+ *
+ *       t/255 = ((t + 0x80) + ((t + 0x80) >> 8)) >> 8
+ *             = ((t + 0x80) * 0x101) >> 16
+ *
+ *     the latter being a single PMULHUW for 8-bit values in 16-bit lanes.
  *
  *
  *
@@ -920,7 +959,7 @@ lp_build_mul_norm(struct gallivm_state *gallivm,
    LLVMBuilderRef builder = gallivm->builder;
    struct lp_build_context bld;
    unsigned n;
-   LLVMValueRef half;
+   LLVMValueRef half, minus_half, sign;
    LLVMValueRef ab;
 
    assert(!wide_type.floating);
@@ -934,16 +973,37 @@ lp_build_mul_norm(struct gallivm_state *gallivm,
       --n;
    }
 
-   /*
-    * TODO: for 16bits normalized SSE2 vectors we could consider using PMULHUW
-    * http://ssp.impulsetrain.com/2011/07/03/multiplying-normalized-16-bit-numbers-with-sse2/
-    */
+   ab = LLVMBuildMul(builder, a, b, "");
+
+   if (!wide_type.sign) {
+      /*
+       * a*b / (2**n - 1) = (t + (t >> n)) >> n, with t = a*b + half
+       */
+      half = lp_build_const_int_vec(gallivm, wide_type, 1LL << (n - 1));
+      ab = LLVMBuildAdd(builder, ab, half, "");
+
+      if (wide_type.width == 16) {
+         /* (t * 0x101) >> 16, which LLVM matches to PMULHUW */
+         struct lp_type type32 = lp_type_uint_vec(32, 32 * wide_type.length);
+         LLVMTypeRef vec32 = lp_build_vec_type(gallivm, type32);
+         LLVMValueRef t;
+
+         t = LLVMBuildZExt(builder, ab, vec32, "");
+         t = LLVMBuildMul(builder, t,
+                          lp_build_const_int_vec(gallivm, type32, 0x101), "");
+         t = LLVMBuildLShr(builder, t,
+                           lp_build_const_int_vec(gallivm, type32, 16), "");
+         return LLVMBuildTrunc(builder, t, bld.vec_type, "");
+      }
+
+      ab = LLVMBuildAdd(builder, ab, lp_build_shr_imm(&bld, ab, n), "");
+      return lp_build_shr_imm(&bld, ab, n);
+   }
 
    /*
-    * a*b / (2**n - 1) ~= (a*b + (a*b >> n) + half) >> n
+    * The signed a*b / (2**n - 1) ~= (a*b + (a*b >> n) + half) >> n
     */
 
-   ab = LLVMBuildMul(builder, a, b, "");
    ab = LLVMBuildAdd(builder, ab, lp_build_shr_imm(&bld, ab, n), "");
 
    /*
@@ -951,11 +1011,9 @@ lp_build_mul_norm(struct gallivm_state *gallivm,
     */
 
    half = lp_build_const_int_vec(gallivm, wide_type, 1LL << (n - 1));
-   if (wide_type.sign) {
-      LLVMValueRef minus_half = LLVMBuildNeg(builder, half, "");
-      LLVMValueRef sign = lp_build_shr_imm(&bld, ab, wide_type.width - 1);
-      half = lp_build_select(&bld, sign, minus_half, half);
-   }
+   minus_half = LLVMBuildNeg(builder, half, "");
+   sign = lp_build_shr_imm(&bld, ab, wide_type.width - 1);
+   half = lp_build_select(&bld, sign, minus_half, half);
    ab = LLVMBuildAdd(builder, ab, half, "");
 
    /* Final division */
@@ -2043,6 +2101,71 @@ lp_build_round_arch(struct lp_build_context *bld,
      return lp_build_round_altivec(bld, a, mode);
 }
 
+static inline boolean
+lp_build_iround_neon_available(const struct lp_type type)
+{
+   return lp_has_neon64() && type.width == 32 && type.length % 4 == 0;
+}
+
+/**
+ * Round and convert to int at once, which the AArch64 fcvt[nmp]s
+ * instructions do, 4 floats at a time.
+ */
+static LLVMValueRef
+lp_build_iround_neon(struct lp_build_context *bld,
+                     LLVMValueRef a,
+                     enum lp_build_round_mode mode)
+{
+   LLVMBuilderRef builder = bld->gallivm->builder;
+   const struct lp_type type = bld->type;
+   struct lp_type type4 = type, int_type4;
+   LLVMValueRef res[LP_MAX_VECTOR_LENGTH / 4];
+   const char *intrinsic_root;
+   char intrinsic[48], tmp[48];
+   unsigned num_split = type.length / 4;
+   unsigned i;
+
+   assert(lp_build_iround_neon_available(type));
+   assert(lp_check_value(type, a));
+
+   switch (mode) {
+   case LP_BUILD_ROUND_NEAREST:
+      intrinsic_root = "llvm.aarch64.neon.fcvtns";
+      break;
+   case LP_BUILD_ROUND_FLOOR:
+      intrinsic_root = "llvm.aarch64.neon.fcvtms";
+      break;
+   case LP_BUILD_ROUND_CEIL:
+      intrinsic_root = "llvm.aarch64.neon.fcvtps";
+      break;
+   case LP_BUILD_ROUND_TRUNCATE:
+   default:
+      intrinsic_root = "llvm.aarch64.neon.fcvtzs";
+      break;
+   }
+
+   type4.length = 4;
+   int_type4 = lp_int_type(type4);
+   lp_format_intrinsic(tmp, sizeof tmp, intrinsic_root,
+                       lp_build_vec_type(bld->gallivm, int_type4));
+   lp_format_intrinsic(intrinsic, sizeof intrinsic, tmp,
+                       lp_build_vec_type(bld->gallivm, type4));
+
+   if (num_split == 1) {
+      return lp_build_intrinsic_unary(builder, intrinsic,
+                                      bld->int_vec_type, a);
+   }
+
+   for (i = 0; i < num_split; i++) {
+      LLVMValueRef a4 = lp_build_extract_range(bld->gallivm, a, i * 4, 4);
+      res[i] = lp_build_intrinsic_unary(builder, intrinsic,
+                                        lp_build_vec_type(bld->gallivm,
+                                                          int_type4),
+                                        a4);
+   }
+   return lp_build_concat(bld->gallivm, res, int_type4, num_split);
+}
+
 /**
  * Return the integer part of a float (vector) value (== round toward zero).
  * The returned value is a float (vector).
@@ -2383,6 +2506,9 @@ lp_build_iround(struct lp_build_context *bld,
        (util_cpu_caps.has_avx && type.width == 32 && type.length == 8)) {
       return lp_build_iround_nearest_sse2(bld, a);
    }
+   if (lp_build_iround_neon_available(type)) {
+      return lp_build_iround_neon(bld, a, LP_BUILD_ROUND_NEAREST);
+   }
    if (arch_rounding_available(type)) {
       res = lp_build_round_arch(bld, a, LP_BUILD_ROUND_NEAREST);
    }
@@ -2435,7 +2561,10 @@ lp_build_ifloor(struct lp_build_context *bld,
 
    res = a;
    if (type.sign) {
-      if (arch_rounding_available(type)) {
+      if (lp_build_iround_neon_available(type)) {
+         return lp_build_iround_neon(bld, a, LP_BUILD_ROUND_FLOOR);
+      }
+      else if (arch_rounding_available(type)) {
          res = lp_build_round_arch(bld, a, LP_BUILD_ROUND_FLOOR);
       }
       else {
@@ -2490,7 +2619,10 @@ lp_build_iceil(struct lp_build_context *bld,
    assert(type.floating);
    assert(lp_check_value(type, a));
 
-   if (arch_rounding_available(type)) {
+   if (lp_build_iround_neon_available(type)) {
+      return lp_build_iround_neon(bld, a, LP_BUILD_ROUND_CEIL);
+   }
+   else if (arch_rounding_available(type)) {
       res = lp_build_round_arch(bld, a, LP_BUILD_ROUND_CEIL);
    }
    else {
@@ -2786,9 +2918,15 @@ lp_build_fast_rsqrt_available(struct lp_type type)
    assert(type.floating);
 
    if ((util_cpu_caps.has_sse && type.width == 32 && type.length == 4) ||
-       (util_cpu_caps.has_avx && type.width == 32 && type.length == 8)) {
+       (util_cpu_caps.has_avx && type.width == 32 && type.length == 8) ||
+       (lp_has_avx512() && type.width == 32 && type.length == 16)) {
+      return true;
+   }
+#if defined(PIPE_ARCH_ARM) || defined(PIPE_ARCH_AARCH64)
+   if (util_cpu_caps.has_neon && type.width == 32 && type.length == 4) {
       return true;
    }
+#endif
    return false;
 }
 
@@ -2811,12 +2949,37 @@ lp_build_fast_rsqrt(struct lp_build_context *bld,
    if (lp_build_fast_rsqrt_available(type)) {
       const char *intrinsic = NULL;
 
+#if defined(PIPE_ARCH_ARM) || defined(PIPE_ARCH_AARCH64)
+      /*
+       * The NEON estimate only has ~8 bits, one Newton-Raphson step
+       * still beats the sqrt and division by far.
+       */
+#if defined(PIPE_ARCH_AARCH64)
+      intrinsic = "llvm.aarch64.neon.frsqrte.v4f32";
+#else
+      intrinsic = "llvm.arm.neon.vrsqrte.v4f32";
+#endif
+      return lp_build_rsqrt_refine(bld, a,
+                                   lp_build_intrinsic_unary(builder, intrinsic,
+                                                            bld->vec_type, a));
+#endif
+
       if (type.length == 4) {
          intrinsic = "llvm.x86.sse.rsqrt.ps";
       }
-      else {
+      else if (type.length == 8) {
          intrinsic = "llvm.x86.avx.rsqrt.ps.256";
       }
+      else {
+         /* a, passthru, mask */
+         LLVMValueRef args[3];
+         args[0] = a;
+         args[1] = bld->undef;
+         args[2] = LLVMConstInt(LLVMInt16TypeInContext(bld->gallivm->context),
+                                0xffff, 0);
+         return lp_build_intrinsic(builder, "llvm.x86.avx512.rsqrt14.ps.512",
+                                   bld->vec_type, args, 3, 0);
+      }
       return lp_build_intrinsic_unary(builder, intrinsic, bld->vec_type, a);
    }
    else {
@@ -102,7 +102,8 @@ lp_build_half_to_float(struct gallivm_state *gallivm,
    LLVMValueRef h;
 
    if (util_cpu_caps.has_f16c &&
-       (src_length == 4 || src_length == 8)) {
+       (src_length == 4 || src_length == 8 ||
+        (src_length == 16 && lp_has_avx512() && LLVM_VERSION_MAJOR >= 11))) {
       if (LLVM_VERSION_MAJOR < 11) {
          const char *intrinsic = NULL;
          if (src_length == 4) {
@@ -167,7 +168,17 @@ lp_build_float_to_half(struct gallivm_state *gallivm,
     * useless.
     */
 
-   if (util_cpu_caps.has_f16c &&
+   if (util_cpu_caps.has_f16c && length == 16 && lp_has_avx512()) {
+      /* src, rounding, passthru, mask */
+      LLVMValueRef args[4];
+      args[0] = src;
+      args[1] = LLVMConstInt(LLVMInt32TypeInContext(gallivm->context), 3, 0);
+      args[2] = LLVMGetUndef(lp_build_vec_type(gallivm, i16_type));
+      args[3] = LLVMConstInt(LLVMInt16TypeInContext(gallivm->context), 0xffff, 0);
+      result = lp_build_intrinsic(builder, "llvm.x86.avx512.mask.vcvtps2ph.512",
+                                  lp_build_vec_type(gallivm, i16_type), args, 4, 0);
+   }
+   else if (util_cpu_caps.has_f16c &&
        (length == 4 || length == 8)) {
       struct lp_type i168_type = lp_type_int_vec(16, 16 * 8);
       unsigned mode = 3; /* same as LP_BUILD_ROUND_TRUNCATE */
@@ -489,7 +500,8 @@ int lp_build_conv_auto(struct gallivm_state *gallivm,
 
       /* Special case 4x4x32 --> 1x16x8 */
       if (src_type.length == 4 &&
-            (util_cpu_caps.has_sse2 || util_cpu_caps.has_altivec))
+            (util_cpu_caps.has_sse2 || util_cpu_caps.has_altivec ||
+             lp_has_neon64()))
       {
          num_dsts = (num_srcs + 3) / 4;
          dst_type->length = num_srcs * 4 >= 16 ? 16 : num_srcs * 4;
@@ -597,7 +609,8 @@ lp_build_conv(struct gallivm_state *gallivm,
        ((dst_type.length == 16 && 4 * num_dsts == num_srcs) ||
         (num_dsts == 1 && dst_type.length * num_srcs == 16 && num_srcs != 3)) &&
 
-       (util_cpu_caps.has_sse2 || util_cpu_caps.has_altivec))
+       (util_cpu_caps.has_sse2 || util_cpu_caps.has_altivec ||
+        lp_has_neon64()))
    {
       struct lp_build_context bld;
       struct lp_type int16_type, int32_type;
@@ -674,7 +687,7 @@ lp_build_conv(struct gallivm_state *gallivm,
             tmp[1] = tmp[0];
          }
 
-         /* relying on clamping behavior of sse2 intrinsics here */
+         /* relying on clamping behavior of sse2 (or neon) intrinsics here */
          lo = lp_build_pack2(gallivm, int32_type, int16_type, tmp[0], tmp[1]);
 
          if (num_srcs < 4) {
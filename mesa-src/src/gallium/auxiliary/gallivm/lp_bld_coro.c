@@ -24,8 +24,10 @@
  **************************************************************************/
 
 #include <stdint.h>
+#include <string.h>
 #include "lp_bld_coro.h"
 #include "util/os_memory.h"
+#include "util/u_math.h"
 #include "lp_bld_init.h"
 #include "lp_bld_const.h"
 #include "lp_bld_intr.h"
@@ -142,18 +144,57 @@ LLVMValueRef lp_build_coro_alloc(struct gallivm_state *gallivm, LLVMValueRef id)
                              &id, 1, 0);
 }
 
+#define LP_CORO_FRAME_ALIGN 64
+
 static char *
-coro_malloc(int size)
+coro_malloc(int size, struct lp_coro_frame_pool *pool)
 {
+   if (pool) {
+      unsigned offset = pool->used;
+
+      pool->used += align(size, LP_CORO_FRAME_ALIGN);
+      pool->peak = MAX2(pool->peak, pool->used);
+      if (pool->used <= pool->size) {
+         pool->last = offset;
+         return pool->mem + offset;
+      }
+      pool->used = offset;
+   }
    return os_malloc_aligned(size, 4096);
 }
 
 static void
-coro_free(char *ptr)
+coro_free(char *ptr, struct lp_coro_frame_pool *pool)
 {
+   if (pool && ptr >= pool->mem && ptr < pool->mem + pool->size) {
+      /* Frames which don't suspend are freed right after they're made */
+      if (ptr == pool->mem + pool->last)
+         pool->used = pool->last;
+      return;
+   }
    os_free_aligned(ptr);
 }
 
+void
+lp_coro_frame_pool_reset(struct lp_coro_frame_pool *pool)
+{
+   if (pool->peak > pool->size) {
+      os_free_aligned(pool->mem);
+      pool->mem = os_malloc_aligned(pool->peak, LP_CORO_FRAME_ALIGN);
+      pool->size = pool->mem ? pool->peak : 0;
+   }
+   pool->used = 0;
+   pool->last = 0;
+   pool->peak = 0;
+}
+
+void
+lp_coro_frame_pool_fini(struct lp_coro_frame_pool *pool)
+{
+   os_free_aligned(pool->mem);
+   memset(pool, 0, sizeof(*pool));
+}
+
 void lp_build_coro_add_malloc_hooks(struct gallivm_state *gallivm)
 {
    assert(gallivm->engine);
@@ -168,24 +209,40 @@ void lp_build_coro_declare_malloc_hooks(struct gallivm_state *gallivm)
 {
    LLVMTypeRef int32_type = LLVMInt32TypeInContext(gallivm->context);
    LLVMTypeRef mem_ptr_type = LLVMPointerType(LLVMInt8TypeInContext(gallivm->context), 0);
-   LLVMTypeRef malloc_type = LLVMFunctionType(mem_ptr_type, &int32_type, 1, 0);
+   LLVMTypeRef malloc_args[2] = { int32_type, mem_ptr_type };
+   LLVMTypeRef malloc_type = LLVMFunctionType(mem_ptr_type, malloc_args, 2, 0);
    gallivm->coro_malloc_hook = LLVMAddFunction(gallivm->module, "coro_malloc", malloc_type);
-   LLVMTypeRef free_type = LLVMFunctionType(LLVMVoidTypeInContext(gallivm->context), &mem_ptr_type, 1, 0);
+   LLVMTypeRef free_args[2] = { mem_ptr_type, mem_ptr_type };
+   LLVMTypeRef free_type = LLVMFunctionType(LLVMVoidTypeInContext(gallivm->context), free_args, 2, 0);
    gallivm->coro_free_hook = LLVMAddFunction(gallivm->module, "coro_free", free_type);
 }
 
-LLVMValueRef lp_build_coro_begin_alloc_mem(struct gallivm_state *gallivm, LLVMValueRef coro_id)
+static LLVMValueRef
+coro_pool_arg(struct gallivm_state *gallivm, LLVMValueRef pool)
+{
+   LLVMTypeRef mem_ptr_type = LLVMPointerType(LLVMInt8TypeInContext(gallivm->context), 0);
+
+   if (!pool)
+      return LLVMConstPointerNull(mem_ptr_type);
+   return LLVMBuildBitCast(gallivm->builder, pool, mem_ptr_type, "");
+}
+
+LLVMValueRef lp_build_coro_begin_alloc_mem(struct gallivm_state *gallivm, LLVMValueRef coro_id,
+                                           LLVMValueRef pool)
 {
    LLVMValueRef do_alloc = lp_build_coro_alloc(gallivm, coro_id);
    LLVMTypeRef mem_ptr_type = LLVMPointerType(LLVMInt8TypeInContext(gallivm->context), 0);
    LLVMValueRef alloc_mem_store = lp_build_alloca(gallivm, mem_ptr_type, "coro mem");
    struct lp_build_if_state if_state_coro;
    lp_build_if(&if_state_coro, gallivm, do_alloc);
-   LLVMValueRef coro_size = lp_build_coro_size(gallivm);
+   LLVMValueRef malloc_args[2];
    LLVMValueRef alloc_mem;
 
+   malloc_args[0] = lp_build_coro_size(gallivm);
+   malloc_args[1] = coro_pool_arg(gallivm, pool);
+
    assert(gallivm->coro_malloc_hook);
-   alloc_mem = LLVMBuildCall(gallivm->builder, gallivm->coro_malloc_hook, &coro_size, 1, "");
+   alloc_mem = LLVMBuildCall(gallivm->builder, gallivm->coro_malloc_hook, malloc_args, 2, "");
 
    LLVMBuildStore(gallivm->builder, alloc_mem, alloc_mem_store);
    lp_build_endif(&if_state_coro);
@@ -194,12 +251,16 @@ LLVMValueRef lp_build_coro_begin_alloc_mem(struct gallivm_state *gallivm, LLVMVa
    return coro_hdl;
 }
 
-void lp_build_coro_free_mem(struct gallivm_state *gallivm, LLVMValueRef coro_id, LLVMValueRef coro_hdl)
+void lp_build_coro_free_mem(struct gallivm_state *gallivm, LLVMValueRef coro_id, LLVMValueRef coro_hdl,
+                            LLVMValueRef pool)
 {
-   LLVMValueRef alloc_mem = lp_build_coro_free(gallivm, coro_id, coro_hdl);
+   LLVMValueRef free_args[2];
+
+   free_args[0] = lp_build_coro_free(gallivm, coro_id, coro_hdl);
+   free_args[1] = coro_pool_arg(gallivm, pool);
 
    assert(gallivm->coro_malloc_hook);
-   alloc_mem = LLVMBuildCall(gallivm->builder, gallivm->coro_free_hook, &alloc_mem, 1, "");
+   LLVMBuildCall(gallivm->builder, gallivm->coro_free_hook, free_args, 2, "");
 }
 
 void lp_build_coro_suspend_switch(struct gallivm_state *gallivm, const struct lp_build_coro_suspend_info *sus_info,
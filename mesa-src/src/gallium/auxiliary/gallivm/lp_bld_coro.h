@@ -54,8 +54,29 @@ LLVMValueRef lp_build_coro_suspend(struct gallivm_state *gallivm, bool last);
 
 LLVMValueRef lp_build_coro_alloc(struct gallivm_state *gallivm, LLVMValueRef id);
 
-LLVMValueRef lp_build_coro_begin_alloc_mem(struct gallivm_state *gallivm, LLVMValueRef coro_id);
-void lp_build_coro_free_mem(struct gallivm_state *gallivm, LLVMValueRef coro_id, LLVMValueRef coro_hdl);
+/**
+ * Coroutine frames are allocated from this when it is passed to
+ * lp_build_coro_begin_alloc_mem(), as one bump allocation per run of the
+ * function which resumes them, falling back to the heap once it is full.
+ * lp_coro_frame_pool_reset() is called between runs, and grows the pool
+ * to what the last one needed.  A pool must only be used by one thread.
+ */
+struct lp_coro_frame_pool {
+   char *mem;
+   unsigned size;
+   unsigned used;
+   unsigned last;   /**< offset of the last frame, freed LIFO */
+   unsigned peak;
+};
+
+void lp_coro_frame_pool_reset(struct lp_coro_frame_pool *pool);
+void lp_coro_frame_pool_fini(struct lp_coro_frame_pool *pool);
+
+/* pool is a struct lp_coro_frame_pool pointer or NULL, for the heap */
+LLVMValueRef lp_build_coro_begin_alloc_mem(struct gallivm_state *gallivm, LLVMValueRef coro_id,
+                                           LLVMValueRef pool);
+void lp_build_coro_free_mem(struct gallivm_state *gallivm, LLVMValueRef coro_id, LLVMValueRef coro_hdl,
+                            LLVMValueRef pool);
 
 struct lp_build_coro_suspend_info {
    LLVMBasicBlockRef suspend;
@@ -26,6 +26,17 @@
  **************************************************************************/
 
 
+#include "util/format/u_format.h"
+#include "util/u_math.h"
+#include "util/u_memory.h"
+#include "util/u_pointer.h"
+#include "lp_bld_const.h"
+#include "lp_bld_flow.h"
+#include "lp_bld_init.h"
+#include "lp_bld_misc.h"
+#include "lp_bld_struct.h"
+#include "lp_bld_swizzle.h"
+#include "lp_bld_type.h"
 #include "lp_bld_format.h"
 
 
@@ -37,20 +48,404 @@ lp_build_format_cache_type(struct gallivm_state *gallivm)
    LLVMTypeRef s;
 
    elem_types[LP_BUILD_FORMAT_CACHE_MEMBER_DATA] =
-         LLVMArrayType(LLVMInt32TypeInContext(gallivm->context),
-                       LP_BUILD_FORMAT_CACHE_SIZE * 16);
+         LLVMPointerType(LLVMInt32TypeInContext(gallivm->context), 0);
    elem_types[LP_BUILD_FORMAT_CACHE_MEMBER_TAGS] =
-         LLVMArrayType(LLVMInt64TypeInContext(gallivm->context),
-                       LP_BUILD_FORMAT_CACHE_SIZE);
-#if LP_BUILD_FORMAT_CACHE_DEBUG
+         LLVMPointerType(LLVMInt64TypeInContext(gallivm->context), 0);
+   elem_types[LP_BUILD_FORMAT_CACHE_MEMBER_MASK] =
+         LLVMInt32TypeInContext(gallivm->context);
    elem_types[LP_BUILD_FORMAT_CACHE_MEMBER_ACCESS_TOTAL] =
          LLVMInt64TypeInContext(gallivm->context);
    elem_types[LP_BUILD_FORMAT_CACHE_MEMBER_ACCESS_MISS] =
          LLVMInt64TypeInContext(gallivm->context);
-#endif
 
    s = LLVMStructTypeInContext(gallivm->context, elem_types,
                                LP_BUILD_FORMAT_CACHE_MEMBER_COUNT, 0);
 
    return s;
 }
+
+
+/**
+ * Create a block cache of (at least) size entries, with all tags cleared.
+ */
+struct lp_build_format_cache *
+lp_build_format_cache_create(unsigned size)
+{
+   struct lp_build_format_cache *cache;
+
+   size = util_next_power_of_two(MAX2(size, 1));
+
+   cache = CALLOC_STRUCT(lp_build_format_cache);
+   if (!cache)
+      return NULL;
+
+   cache->cache_data = align_malloc(size * sizeof(cache->cache_data[0]), 16);
+   cache->cache_tags = CALLOC(size, sizeof(cache->cache_tags[0]));
+   if (!cache->cache_data || !cache->cache_tags) {
+      lp_build_format_cache_destroy(cache);
+      return NULL;
+   }
+   cache->cache_mask = size - 1;
+
+   return cache;
+}
+
+
+/**
+ * Invalidate all entries, e.g. when the textures may have changed.
+ * The access counters are left alone.
+ */
+void
+lp_build_format_cache_reset(struct lp_build_format_cache *cache)
+{
+   memset(cache->cache_tags, 0,
+          (cache->cache_mask + 1) * sizeof(cache->cache_tags[0]));
+}
+
+
+void
+lp_build_format_cache_destroy(struct lp_build_format_cache *cache)
+{
+   if (!cache)
+      return;
+
+   align_free(cache->cache_data);
+   FREE(cache->cache_tags);
+   FREE(cache);
+}
+
+
+/**
+ * Whether fetches from the format go through the block cache when one is
+ * given: S3TC, which has its own decoder, and the other 4x4 compressed
+ * formats whose texels fit in RGBA8 (once linear, for sRGB ones), which
+ * are decoded with the util_format unpack function.  RGTC is decoded fast
+ * enough in place.
+ */
+boolean
+lp_build_format_cache_supported(const struct util_format_description *format_desc)
+{
+   const struct util_format_description *linear_desc;
+
+   switch (format_desc->layout) {
+   case UTIL_FORMAT_LAYOUT_S3TC:
+      return TRUE;
+   case UTIL_FORMAT_LAYOUT_PLAIN:
+   case UTIL_FORMAT_LAYOUT_SUBSAMPLED:
+   case UTIL_FORMAT_LAYOUT_RGTC:
+   case UTIL_FORMAT_LAYOUT_OTHER:
+      return FALSE;
+   default:
+      break;
+   }
+
+   if (format_desc->block.width != 4 || format_desc->block.height != 4 ||
+       (format_desc->block.bits != 64 && format_desc->block.bits != 128))
+      return FALSE;
+
+   if (!util_format_unpack_description(format_desc->format)->unpack_rgba_8unorm)
+      return FALSE;
+
+   linear_desc = util_format_description(util_format_linear(format_desc->format));
+   return util_format_fits_8unorm(linear_desc);
+}
+
+
+/**
+ * Store the 4 columns of a decoded block, and its tag.
+ */
+void
+lp_build_format_cache_store_block(struct gallivm_state *gallivm,
+                                  LLVMValueRef *col,
+                                  LLVMValueRef tag_value,
+                                  LLVMValueRef hash_index,
+                                  LLVMValueRef cache)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef data, tags, ptr;
+   LLVMTypeRef type_ptr4x32;
+   unsigned count;
+
+   type_ptr4x32 = LLVMPointerType(LLVMVectorType(LLVMInt32TypeInContext(gallivm->context), 4), 0);
+   tags = lp_build_struct_get(gallivm, cache,
+                              LP_BUILD_FORMAT_CACHE_MEMBER_TAGS, "cache_tags");
+   ptr = LLVMBuildGEP(builder, tags, &hash_index, 1, "");
+   LLVMBuildStore(builder, tag_value, ptr);
+
+   data = lp_build_struct_get(gallivm, cache,
+                              LP_BUILD_FORMAT_CACHE_MEMBER_DATA, "cache_data");
+   hash_index = LLVMBuildMul(builder, hash_index,
+                             lp_build_const_int32(gallivm, 16), "");
+   for (count = 0; count < 4; count++) {
+      ptr = LLVMBuildGEP(builder, data, &hash_index, 1, "");
+      ptr = LLVMBuildBitCast(builder, ptr, type_ptr4x32, "");
+      LLVMBuildStore(builder, col[count], ptr);
+      hash_index = LLVMBuildAdd(builder, hash_index,
+                                lp_build_const_int32(gallivm, 4), "");
+   }
+}
+
+
+static LLVMValueRef
+lp_build_format_cache_lookup_pixel(struct gallivm_state *gallivm,
+                                   LLVMValueRef cache,
+                                   LLVMValueRef index)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef data, member_ptr;
+
+   data = lp_build_struct_get(gallivm, cache,
+                              LP_BUILD_FORMAT_CACHE_MEMBER_DATA, "cache_data");
+   member_ptr = LLVMBuildGEP(builder, data, &index, 1, "");
+   return LLVMBuildLoad(builder, member_ptr, "cache_data");
+}
+
+
+static LLVMValueRef
+lp_build_format_cache_lookup_tag(struct gallivm_state *gallivm,
+                                 LLVMValueRef cache,
+                                 LLVMValueRef index)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef tags, member_ptr;
+
+   tags = lp_build_struct_get(gallivm, cache,
+                              LP_BUILD_FORMAT_CACHE_MEMBER_TAGS, "cache_tags");
+   member_ptr = LLVMBuildGEP(builder, tags, &index, 1, "");
+   return LLVMBuildLoad(builder, member_ptr, "tag_data");
+}
+
+
+static void
+lp_build_format_cache_count_access(struct gallivm_state *gallivm,
+                                   LLVMValueRef cache,
+                                   unsigned count,
+                                   unsigned index)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef member_ptr, cache_access;
+
+   assert(index == LP_BUILD_FORMAT_CACHE_MEMBER_ACCESS_TOTAL ||
+          index == LP_BUILD_FORMAT_CACHE_MEMBER_ACCESS_MISS);
+
+   member_ptr = lp_build_struct_get_ptr(gallivm, cache, index, "");
+   cache_access = LLVMBuildLoad(builder, member_ptr, "cache_access");
+   cache_access = LLVMBuildAdd(builder, cache_access,
+                               LLVMConstInt(LLVMInt64TypeInContext(gallivm->context),
+                                                                   count, 0), "");
+   LLVMBuildStore(builder, cache_access, member_ptr);
+}
+
+
+/**
+ * Decode a block with util_format_unpack_description::unpack_rgba_8unorm(),
+ * for the formats without a decoder of their own.
+ */
+static void
+lp_build_format_cache_update_unpack(struct gallivm_state *gallivm,
+                                    const struct util_format_description *format_desc,
+                                    LLVMValueRef ptr_addr,
+                                    LLVMValueRef hash_index,
+                                    LLVMValueRef cache)
+{
+   const struct util_format_unpack_description *unpack =
+      util_format_unpack_description(format_desc->format);
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMTypeRef i8t = LLVMInt8TypeInContext(gallivm->context);
+   LLVMTypeRef pi8t = LLVMPointerType(i8t, 0);
+   LLVMTypeRef i32t = LLVMInt32TypeInContext(gallivm->context);
+   LLVMTypeRef i32x4t = LLVMVectorType(i32t, 4);
+   LLVMTypeRef ret_type, arg_types[6], function_type;
+   LLVMValueRef function, tmp_ptr, rows_ptr, args[6];
+   LLVMValueRef rows[4], col[4], tag_value;
+   unsigned k;
+
+   /*
+    * Function to call looks like:
+    *   unpack(uint8_t *dst, unsigned dst_stride,
+    *          const uint8_t *src, unsigned src_stride,
+    *          unsigned width, unsigned height)
+    */
+   ret_type = LLVMVoidTypeInContext(gallivm->context);
+   arg_types[0] = pi8t;
+   arg_types[1] = i32t;
+   arg_types[2] = pi8t;
+   arg_types[3] = i32t;
+   arg_types[4] = i32t;
+   arg_types[5] = i32t;
+   function_type = LLVMFunctionType(ret_type, arg_types,
+                                    ARRAY_SIZE(arg_types), 0);
+
+   function = lp_build_const_int_pointer(gallivm,
+      func_to_pointer((func_pointer) unpack->unpack_rgba_8unorm));
+   function = LLVMBuildBitCast(builder, function,
+                               LLVMPointerType(function_type, 0),
+                               "cast callee");
+
+   /* The block is unpacked by rows, but cached by columns */
+   tmp_ptr = lp_build_alloca(gallivm, LLVMVectorType(i32t, 16), "");
+
+   args[0] = LLVMBuildBitCast(builder, tmp_ptr, pi8t, "");
+   args[1] = lp_build_const_int32(gallivm, 16);
+   args[2] = ptr_addr;
+   args[3] = lp_build_const_int32(gallivm, 0);
+   args[4] = lp_build_const_int32(gallivm, 4);
+   args[5] = lp_build_const_int32(gallivm, 4);
+   LLVMBuildCall(builder, function, args, ARRAY_SIZE(args), "");
+
+   rows_ptr = LLVMBuildBitCast(builder, tmp_ptr,
+                               LLVMPointerType(i32x4t, 0), "");
+   for (k = 0; k < 4; k++) {
+      LLVMValueRef index = lp_build_const_int32(gallivm, k);
+      LLVMValueRef row_ptr = LLVMBuildGEP(builder, rows_ptr, &index, 1, "");
+      rows[k] = LLVMBuildLoad(builder, row_ptr, "");
+   }
+   lp_build_transpose_aos(gallivm, lp_type_int_vec(32, 128), rows, col);
+
+   tag_value = LLVMBuildPtrToInt(builder, ptr_addr,
+                                 LLVMInt64TypeInContext(gallivm->context), "");
+   lp_build_format_cache_store_block(gallivm, col, tag_value, hash_index, cache);
+}
+
+
+/**
+ * Fetch n texels as RGBA8 through the block cache, decoding the blocks
+ * which miss with update (or the util_format unpack function if NULL).
+ *
+ * \param offset  <n x i32> vector with the relative offsets of the blocks
+ * \param i, j  <n x i32> vectors with the x and y subpixel coordinates
+ * \return  a <4*n x i8> vector with the texels
+ */
+LLVMValueRef
+lp_build_format_cache_fetch(struct gallivm_state *gallivm,
+                            const struct util_format_description *format_desc,
+                            unsigned n,
+                            LLVMValueRef base_ptr,
+                            LLVMValueRef offset,
+                            LLVMValueRef i,
+                            LLVMValueRef j,
+                            LLVMValueRef cache,
+                            lp_build_format_cache_update_func update)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   unsigned count, low_bit, log2size;
+   LLVMValueRef color, offset_stored, addr, ptr_addrtrunc, tmp;
+   LLVMValueRef ij_index, hash_index, hash_mask, block_index;
+   LLVMTypeRef i8t = LLVMInt8TypeInContext(gallivm->context);
+   LLVMTypeRef i32t = LLVMInt32TypeInContext(gallivm->context);
+   LLVMTypeRef i64t = LLVMInt64TypeInContext(gallivm->context);
+   struct lp_type type;
+   struct lp_build_context bld32;
+   memset(&type, 0, sizeof type);
+   type.width = 32;
+   type.length = n;
+
+   lp_build_context_init(&bld32, gallivm, type);
+
+   if (!update)
+      update = lp_build_format_cache_update_unpack;
+
+   /*
+    * Whether there is a cache is up to the driver's settings of the time,
+    * and the unpack functions are called by address, so don't let the
+    * code outlive the process.
+    */
+   if (gallivm->cache)
+      gallivm->cache->dont_cache = true;
+
+   /*
+    * compute hash - we use direct mapped cache, the hash function could
+    *                be better but it needs to be simple
+    * per-element:
+    *    compare offset with offset stored at tag (hash)
+    *    if not equal extract block, store block, update tag
+    *    extract color from cache
+    *    assemble colors
+    */
+
+   low_bit = util_logbase2(format_desc->block.bits / 8);
+   log2size = util_logbase2(LP_BUILD_FORMAT_CACHE_SIZE);
+   addr = LLVMBuildPtrToInt(builder, base_ptr, i64t, "");
+   ptr_addrtrunc = LLVMBuildPtrToInt(builder, base_ptr, i32t, "");
+   ptr_addrtrunc = lp_build_broadcast_scalar(&bld32, ptr_addrtrunc);
+   /* For the hash function, first mask off the unused lowest bits. Then just
+      do some xor with address bits - only use lower 32bits */
+   ptr_addrtrunc = LLVMBuildAdd(builder, offset, ptr_addrtrunc, "");
+   ptr_addrtrunc = LLVMBuildLShr(builder, ptr_addrtrunc,
+                                 lp_build_const_int_vec(gallivm, type, low_bit), "");
+   /* This only really makes sense for size 64,128,256 */
+   hash_index = ptr_addrtrunc;
+   ptr_addrtrunc = LLVMBuildLShr(builder, ptr_addrtrunc,
+                                 lp_build_const_int_vec(gallivm, type, 2*log2size), "");
+   hash_index = LLVMBuildXor(builder, ptr_addrtrunc, hash_index, "");
+   tmp = LLVMBuildLShr(builder, hash_index,
+                       lp_build_const_int_vec(gallivm, type, log2size), "");
+   hash_index = LLVMBuildXor(builder, hash_index, tmp, "");
+
+   hash_mask = lp_build_struct_get(gallivm, cache,
+                                   LP_BUILD_FORMAT_CACHE_MEMBER_MASK, "cache_mask");
+   hash_mask = lp_build_broadcast_scalar(&bld32, hash_mask);
+   hash_index = LLVMBuildAnd(builder, hash_index, hash_mask, "");
+   ij_index = LLVMBuildShl(builder, i, lp_build_const_int_vec(gallivm, type, 2), "");
+   ij_index = LLVMBuildAdd(builder, ij_index, j, "");
+   block_index = LLVMBuildShl(builder, hash_index,
+                              lp_build_const_int_vec(gallivm, type, 4), "");
+   block_index = LLVMBuildAdd(builder, ij_index, block_index, "");
+
+   if (n > 1) {
+      color = bld32.undef;
+      for (count = 0; count < n; count++) {
+         LLVMValueRef index, cond, colorx;
+         LLVMValueRef block_indexx, hash_indexx, addrx, offsetx, ptr_addrx;
+         struct lp_build_if_state if_ctx;
+
+         index = lp_build_const_int32(gallivm, count);
+         offsetx = LLVMBuildExtractElement(builder, offset, index, "");
+         addrx = LLVMBuildZExt(builder, offsetx, i64t, "");
+         addrx = LLVMBuildAdd(builder, addrx, addr, "");
+         block_indexx = LLVMBuildExtractElement(builder, block_index, index, "");
+         hash_indexx = LLVMBuildLShr(builder, block_indexx,
+                                     lp_build_const_int32(gallivm, 4), "");
+         offset_stored = lp_build_format_cache_lookup_tag(gallivm, cache, hash_indexx);
+         cond = LLVMBuildICmp(builder, LLVMIntNE, offset_stored, addrx, "");
+
+         lp_build_if(&if_ctx, gallivm, cond);
+         {
+            ptr_addrx = LLVMBuildIntToPtr(builder, addrx,
+                                          LLVMPointerType(i8t, 0), "");
+            update(gallivm, format_desc, ptr_addrx, hash_indexx, cache);
+            lp_build_format_cache_count_access(gallivm, cache, 1,
+                                               LP_BUILD_FORMAT_CACHE_MEMBER_ACCESS_MISS);
+         }
+         lp_build_endif(&if_ctx);
+
+         colorx = lp_build_format_cache_lookup_pixel(gallivm, cache, block_indexx);
+
+         color = LLVMBuildInsertElement(builder, color, colorx,
+                                        lp_build_const_int32(gallivm, count), "");
+      }
+   }
+   else {
+      LLVMValueRef cond;
+      struct lp_build_if_state if_ctx;
+
+      tmp = LLVMBuildZExt(builder, offset, i64t, "");
+      addr = LLVMBuildAdd(builder, tmp, addr, "");
+      offset_stored = lp_build_format_cache_lookup_tag(gallivm, cache, hash_index);
+      cond = LLVMBuildICmp(builder, LLVMIntNE, offset_stored, addr, "");
+
+      lp_build_if(&if_ctx, gallivm, cond);
+      {
+         tmp = LLVMBuildIntToPtr(builder, addr, LLVMPointerType(i8t, 0), "");
+         update(gallivm, format_desc, tmp, hash_index, cache);
+         lp_build_format_cache_count_access(gallivm, cache, 1,
+                                            LP_BUILD_FORMAT_CACHE_MEMBER_ACCESS_MISS);
+      }
+      lp_build_endif(&if_ctx);
+
+      color = lp_build_format_cache_lookup_pixel(gallivm, cache, block_index);
+   }
+   lp_build_format_cache_count_access(gallivm, cache, n,
+                                      LP_BUILD_FORMAT_CACHE_MEMBER_ACCESS_TOTAL);
+   return LLVMBuildBitCast(builder, color, LLVMVectorType(i8t, n * 4), "");
+}
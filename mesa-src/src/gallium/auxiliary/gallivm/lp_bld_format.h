@@ -44,12 +44,12 @@ struct lp_type;
 struct lp_build_context;
 
 
-#define LP_BUILD_FORMAT_CACHE_DEBUG 0
 /*
  * Block cache
  *
- * Optional block cache to be used when unpacking big pixel blocks.
- * Must be a power of 2
+ * Optional direct mapped cache of decoded 4x4 blocks, as RGBA8, to be used
+ * when unpacking big pixel blocks (see lp_build_format_cache_supported()).
+ * The number of entries is chosen at creation, and is a power of 2.
  */
 
 #define LP_BUILD_FORMAT_CACHE_SIZE 128
@@ -59,22 +59,20 @@ struct lp_build_context;
  */
 struct lp_build_format_cache
 {
-   PIPE_ALIGN_VAR(16) uint32_t cache_data[LP_BUILD_FORMAT_CACHE_SIZE][4][4];
-   uint64_t cache_tags[LP_BUILD_FORMAT_CACHE_SIZE];
-#if LP_BUILD_FORMAT_CACHE_DEBUG
-   uint64_t cache_access_total;
-   uint64_t cache_access_miss;
-#endif
+   uint32_t (*cache_data)[4][4];
+   uint64_t *cache_tags;
+   uint32_t cache_mask;          /**< number of entries - 1 */
+   uint64_t cache_access_total;  /**< texels fetched */
+   uint64_t cache_access_miss;   /**< blocks decoded */
 };
 
 
 enum {
    LP_BUILD_FORMAT_CACHE_MEMBER_DATA = 0,
    LP_BUILD_FORMAT_CACHE_MEMBER_TAGS,
-#if LP_BUILD_FORMAT_CACHE_DEBUG
+   LP_BUILD_FORMAT_CACHE_MEMBER_MASK,
    LP_BUILD_FORMAT_CACHE_MEMBER_ACCESS_TOTAL,
    LP_BUILD_FORMAT_CACHE_MEMBER_ACCESS_MISS,
-#endif
    LP_BUILD_FORMAT_CACHE_MEMBER_COUNT
 };
 
@@ -82,6 +80,46 @@ enum {
 LLVMTypeRef
 lp_build_format_cache_type(struct gallivm_state *gallivm);
 
+struct lp_build_format_cache *
+lp_build_format_cache_create(unsigned size);
+
+void
+lp_build_format_cache_reset(struct lp_build_format_cache *cache);
+
+void
+lp_build_format_cache_destroy(struct lp_build_format_cache *cache);
+
+boolean
+lp_build_format_cache_supported(const struct util_format_description *format_desc);
+
+/**
+ * Decode the block at ptr_addr into the cache entry hash_index, and tag it.
+ */
+typedef void
+(*lp_build_format_cache_update_func)(struct gallivm_state *gallivm,
+                                     const struct util_format_description *format_desc,
+                                     LLVMValueRef ptr_addr,
+                                     LLVMValueRef hash_index,
+                                     LLVMValueRef cache);
+
+void
+lp_build_format_cache_store_block(struct gallivm_state *gallivm,
+                                  LLVMValueRef *col,
+                                  LLVMValueRef tag_value,
+                                  LLVMValueRef hash_index,
+                                  LLVMValueRef cache);
+
+LLVMValueRef
+lp_build_format_cache_fetch(struct gallivm_state *gallivm,
+                            const struct util_format_description *format_desc,
+                            unsigned n,
+                            LLVMValueRef base_ptr,
+                            LLVMValueRef offset,
+                            LLVMValueRef i,
+                            LLVMValueRef j,
+                            LLVMValueRef cache,
+                            lp_build_format_cache_update_func update);
+
 
 /*
  * AoS
@@ -133,6 +171,12 @@ lp_build_unpack_rgba_soa(struct gallivm_state *gallivm,
                          LLVMValueRef packed,
                          LLVMValueRef rgba_out[4]);
 
+LLVMValueRef
+lp_build_pack_swizzled_rgba_soa(struct gallivm_state *gallivm,
+                                const struct util_format_description *format_desc,
+                                struct lp_type type,
+                                const LLVMValueRef rgba[4]);
+
 void
 lp_build_rgba8_to_fi32_soa(struct gallivm_state *gallivm,
                           struct lp_type dst_type,
@@ -787,6 +787,20 @@ lp_build_fetch_rgba_aos(struct gallivm_state *gallivm,
        return tmp;
    }
 
+   /*
+    * Other compressed formats, through the block cache.
+    */
+
+   if (cache && lp_build_format_cache_supported(format_desc) &&
+       !type.floating && type.width == 8 && !type.sign && type.norm) {
+      LLVMValueRef res;
+
+      res = lp_build_format_cache_fetch(gallivm, format_desc, num_pixels,
+                                        base_ptr, offset, i, j, cache, NULL);
+
+      return LLVMBuildBitCast(builder, res, bld.vec_type, "");
+   }
+
    /*
     * Fallback to util_format_description::fetch_rgba_8unorm().
     */
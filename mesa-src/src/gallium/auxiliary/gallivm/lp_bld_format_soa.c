@@ -741,7 +741,7 @@ lp_build_fetch_rgba_soa(struct gallivm_state *gallivm,
    /*
     * Try calling lp_build_fetch_rgba_aos for all pixels.
     * Should only really hit subsampled, compressed
-    * (for s3tc srgb and rgtc too).
+    * (for s3tc srgb and rgtc too, and any format the block cache decodes).
     * (This is invalid for plain 8unorm formats because we're lazy with
     * the swizzle since some results would arrive swizzled, some not.)
     */
@@ -749,7 +749,8 @@ lp_build_fetch_rgba_soa(struct gallivm_state *gallivm,
    if ((format_desc->layout != UTIL_FORMAT_LAYOUT_PLAIN) &&
        (util_format_fits_8unorm(format_desc) ||
         format_desc->layout == UTIL_FORMAT_LAYOUT_RGTC ||
-        format_desc->layout == UTIL_FORMAT_LAYOUT_S3TC) &&
+        format_desc->layout == UTIL_FORMAT_LAYOUT_S3TC ||
+        (cache && lp_build_format_cache_supported(format_desc))) &&
        type.floating && type.width == 32 &&
        (type.length == 1 || (type.length % 4 == 0))) {
       struct lp_type tmp_type;
@@ -786,7 +787,8 @@ lp_build_fetch_rgba_soa(struct gallivm_state *gallivm,
        */
       frgba8_desc = util_format_description(is_signed ? PIPE_FORMAT_R8G8B8A8_SNORM : PIPE_FORMAT_R8G8B8A8_UNORM);
       if (format_desc->colorspace == UTIL_FORMAT_COLORSPACE_SRGB) {
-         assert(format_desc->layout == UTIL_FORMAT_LAYOUT_S3TC);
+         assert(format_desc->layout == UTIL_FORMAT_LAYOUT_S3TC ||
+                (cache && lp_build_format_cache_supported(format_desc)));
          frgba8_desc = util_format_description(PIPE_FORMAT_R8G8B8A8_SRGB);
       }
       lp_build_unpack_rgba_soa(gallivm,
@@ -995,6 +997,39 @@ lp_build_pack_rgba_soa(struct gallivm_state *gallivm,
    }
 }
 
+
+/**
+ * Pack SoA rgba values, in rgba rather than channel order, into one packed
+ * pixel per element, e.g. four 32-bit floats to R10G10B10A2_UNORM.
+ * Channels the format doesn't store are dropped.
+ */
+LLVMValueRef
+lp_build_pack_swizzled_rgba_soa(struct gallivm_state *gallivm,
+                                const struct util_format_description *format_desc,
+                                struct lp_type type,
+                                const LLVMValueRef rgba[4])
+{
+   struct lp_build_context bld;
+   LLVMValueRef packed = NULL;
+   unsigned chan;
+
+   assert(format_desc->layout == UTIL_FORMAT_LAYOUT_PLAIN);
+   assert(format_desc->block.bits <= type.width);
+   assert(type.width == 32);
+
+   lp_build_context_init(&bld, gallivm, type);
+   for (chan = 0; chan < 4; ++chan) {
+      unsigned swz = format_desc->swizzle[chan];
+
+      if (swz <= PIPE_SWIZZLE_W)
+         lp_build_insert_soa_chan(&bld, format_desc->block.bits,
+                                  format_desc->channel[swz],
+                                  &packed, rgba[chan]);
+   }
+
+   return packed ? packed : lp_build_zero(gallivm, lp_int_type(type));
+}
+
 void
 lp_build_store_rgba_soa(struct gallivm_state *gallivm,
                         const struct util_format_description *format_desc,
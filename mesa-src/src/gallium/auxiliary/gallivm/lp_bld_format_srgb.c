@@ -100,10 +100,12 @@ lp_build_srgb_to_linear(struct gallivm_state *gallivm,
    struct lp_type f32_type = lp_type_float_vec(32, src_type.length * 32);
    struct lp_build_context f32_bld;
    LLVMValueRef srcf, part_lin, part_pow, is_linear, lin_const, lin_thresh;
+   /* scale of the channel's values to 8 bits, folded into the constants */
+   const double scale = 255.0 / ((1 << chan_bits) - 1);
    double coeffs[4] = {0.0023f,
-                       0.0030f / 255.0f,
-                       0.6935f / (255.0f * 255.0f),
-                       0.3012f / (255.0f * 255.0f * 255.0f)
+                       0.0030f / 255.0f * scale,
+                       0.6935f / (255.0f * 255.0f) * scale * scale,
+                       0.3012f / (255.0f * 255.0f * 255.0f) * scale * scale * scale
    };
 
    assert(src_type.width == 32);
@@ -128,18 +130,13 @@ lp_build_srgb_to_linear(struct gallivm_state *gallivm,
     */
    /* doing the 1/255 mul as part of the approximation */
    srcf = lp_build_int_to_float(&f32_bld, src);
-   if (chan_bits != 8) {
-      /* could adjust all the constants instead */
-      LLVMValueRef rescale_const = lp_build_const_vec(gallivm, f32_type,
-                                                      255.0f / ((1 << chan_bits) - 1));
-      srcf = lp_build_mul(&f32_bld, srcf, rescale_const);
-   }
-   lin_const = lp_build_const_vec(gallivm, f32_type, 1.0f / (12.6f * 255.0f));
+   lin_const = lp_build_const_vec(gallivm, f32_type,
+                                  scale / (12.6f * 255.0f));
    part_lin = lp_build_mul(&f32_bld, srcf, lin_const);
 
    part_pow = lp_build_polynomial(&f32_bld, srcf, coeffs, 4);
 
-   lin_thresh = lp_build_const_vec(gallivm, f32_type, 15.0f);
+   lin_thresh = lp_build_const_vec(gallivm, f32_type, 15.0f / scale);
    is_linear = lp_build_compare(gallivm, f32_type, PIPE_FUNC_LEQUAL, srcf, lin_thresh);
    return lp_build_select(&f32_bld, is_linear, part_lin, part_pow);
 }
@@ -166,6 +163,8 @@ lp_build_linear_to_srgb(struct gallivm_state *gallivm,
    LLVMBuilderRef builder = gallivm->builder;
    struct lp_build_context f32_bld;
    LLVMValueRef lin_thresh, lin, lin_const, is_linear, tmp, pow_final;
+   /* scale from 8 bits to the channel's values, folded into the constants */
+   const float scale = ((1 << chan_bits) - 1) / 255.0f;
 
    lp_build_context_init(&f32_bld, gallivm, src_type);
 
@@ -240,6 +239,10 @@ lp_build_linear_to_srgb(struct gallivm_state *gallivm,
       }
       pow_final = lp_build_add(&f32_bld, pow_final,
                                lp_build_const_vec(gallivm, src_type, -0.055f * 255.0f));
+      if (chan_bits != 8) {
+         pow_final = lp_build_mul(&f32_bld, pow_final,
+                                  lp_build_const_vec(gallivm, src_type, scale));
+      }
    }
 
    else {
@@ -285,9 +288,9 @@ lp_build_linear_to_srgb(struct gallivm_state *gallivm,
          x0375 = lp_build_sqrt(&f32_bld, lp_build_sqrt(&f32_bld, tmp));
       }
 
-      a_const = lp_build_const_vec(gallivm, src_type, 0.675f * 1.0622 * 255.0f);
-      b_const = lp_build_const_vec(gallivm, src_type, 0.325f * 1.0622 * 255.0f);
-      c_const = lp_build_const_vec(gallivm, src_type, -0.0620f * 255.0f);
+      a_const = lp_build_const_vec(gallivm, src_type, 0.675f * 1.0622 * 255.0f * scale);
+      b_const = lp_build_const_vec(gallivm, src_type, 0.325f * 1.0622 * 255.0f * scale);
+      c_const = lp_build_const_vec(gallivm, src_type, -0.0620f * 255.0f * scale);
 
       tmp = lp_build_mul(&f32_bld, a_const, x0375);
       tmp2 = lp_build_mad(&f32_bld, b_const, x05, c_const);
@@ -295,20 +298,13 @@ lp_build_linear_to_srgb(struct gallivm_state *gallivm,
    }
 
    /* linear part is easy */
-   lin_const = lp_build_const_vec(gallivm, src_type, 12.92f * 255.0f);
+   lin_const = lp_build_const_vec(gallivm, src_type, 12.92f * 255.0f * scale);
    lin = lp_build_mul(&f32_bld, src, lin_const);
 
    lin_thresh = lp_build_const_vec(gallivm, src_type, 0.0031308f);
    is_linear = lp_build_compare(gallivm, src_type, PIPE_FUNC_LEQUAL, src, lin_thresh);
    tmp = lp_build_select(&f32_bld, is_linear, lin, pow_final);
 
-   if (chan_bits != 8) {
-      /* could adjust all the constants instead */
-      LLVMValueRef rescale_const = lp_build_const_vec(gallivm, src_type,
-                                                      ((1 << chan_bits) - 1) / 255.0f);
-      tmp = lp_build_mul(&f32_bld, tmp, rescale_const);
-   }
-
    f32_bld.type.sign = 0;
    return lp_build_iround(&f32_bld, tmp);
 }
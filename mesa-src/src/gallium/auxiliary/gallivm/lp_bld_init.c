@@ -28,15 +28,19 @@
 
 #include "pipe/p_config.h"
 #include "pipe/p_compiler.h"
+#include "c11/threads.h"
+#include "util/u_atomic.h"
 #include "util/u_cpu_detect.h"
 #include "util/u_debug.h"
 #include "util/u_memory.h"
 #include "util/simple_list.h"
 #include "util/os_time.h"
+#include "nir.h"
 #include "lp_bld.h"
 #include "lp_bld_debug.h"
 #include "lp_bld_misc.h"
 #include "lp_bld_init.h"
+#include "lp_bld_type.h"
 
 #include <llvm/Config/llvm-config.h>
 #include <llvm-c/Analysis.h>
@@ -45,6 +49,7 @@
 #include <llvm-c/Transforms/Utils.h>
 #endif
 #include <llvm-c/BitWriter.h>
+#include <llvm-c/Support.h>
 #if GALLIVM_HAVE_CORO
 #if LLVM_VERSION_MAJOR <= 8 && (defined(PIPE_ARCH_AARCH64) || defined (PIPE_ARCH_ARM) || defined(PIPE_ARCH_S390))
 #include <llvm-c/Transforms/IPO.h>
@@ -82,10 +87,11 @@ DEBUG_GET_ONCE_FLAGS_OPTION(gallivm_debug, "GALLIVM_DEBUG", lp_bld_debug_flags,
 #endif
 
 
-static boolean gallivm_initialized = FALSE;
-
 unsigned lp_native_vector_width;
 
+uint64_t gallivm_init_time;
+uint64_t gallivm_compile_time;
+
 
 /*
  * Optimization values are:
@@ -105,8 +111,8 @@ enum LLVM_CodeGenOpt_Level {
 
 
 /**
- * Create the LLVM (optimization) pass manager and install
- * relevant optimization passes.
+ * Create the LLVM (optimization) pass manager.  The optimization passes are
+ * installed by add_optimization_passes().
  * \return  TRUE for success, FALSE for failure
  */
 static boolean
@@ -146,7 +152,29 @@ create_pass_manager(struct gallivm_state *gallivm)
    LLVMAddCoroElidePass(gallivm->cgpassmgr);
 #endif
 
-   if ((gallivm_perf & GALLIVM_PERF_NO_OPT) == 0) {
+   return TRUE;
+}
+
+
+/**
+ * Whether to skip the optimization passes and compile at -O0.
+ */
+static inline boolean
+gallivm_no_opt(const struct gallivm_state *gallivm)
+{
+   return (gallivm_perf & GALLIVM_PERF_NO_OPT) || gallivm->no_opt;
+}
+
+
+/**
+ * Install the optimization passes.  This is deferred to
+ * gallivm_compile_module() so that callers can set gallivm->no_opt after
+ * creating the gallivm state.
+ */
+static void
+add_optimization_passes(struct gallivm_state *gallivm)
+{
+   if (!gallivm_no_opt(gallivm)) {
       /*
        * TODO: Evaluate passes some more - keeping in mind
        * both quality of generated code and compile times.
@@ -186,8 +214,6 @@ create_pass_manager(struct gallivm_state *gallivm)
 #if GALLIVM_HAVE_CORO
    LLVMAddCoroCleanupPass(gallivm->passmgr);
 #endif
-
-   return TRUE;
 }
 
 
@@ -265,7 +291,7 @@ init_gallivm_engine(struct gallivm_state *gallivm)
       char *error = NULL;
       int ret;
 
-      if (gallivm_perf & GALLIVM_PERF_NO_OPT) {
+      if (gallivm_no_opt(gallivm)) {
          optlevel = None;
       }
       else {
@@ -407,27 +433,19 @@ fail:
 }
 
 
-boolean
-lp_build_init(void)
+/**
+ * Detect the CPU and pick lp_native_vector_width, which drivers report
+ * caps from, without initializing LLVM.
+ */
+static void
+init_native(void)
 {
-   if (gallivm_initialized)
-      return TRUE;
-
-
-   /* LLVMLinkIn* are no-ops at runtime.  They just ensure the respective
-    * component is linked at buildtime, which is sufficient for its static
-    * constructors to be called at load time.
-    */
-   LLVMLinkInMCJIT();
-
 #ifdef DEBUG
    gallivm_debug = debug_get_option_gallivm_debug();
 #endif
 
    gallivm_perf = debug_get_flags_option("GALLIVM_PERF", lp_bld_perf_flags, 0 );
 
-   lp_set_target_options();
-
    util_cpu_detect();
 
    /* For simulating less capable machines */
@@ -454,6 +472,10 @@ lp_build_init(void)
       lp_native_vector_width = 128;
    }
 
+   /*
+    * 512-bit vectors are opt-in, as zmm registers lower the clock of many
+    * CPUs, see lp_has_avx512().
+    */
    lp_native_vector_width = debug_get_num_option("LP_NATIVE_VECTOR_WIDTH",
                                                  lp_native_vector_width);
 
@@ -472,6 +494,40 @@ lp_build_init(void)
       util_cpu_caps.has_fma = 0;
    }
 #endif
+}
+
+
+/**
+ * Initialize the LLVM targets and options.  This is most of the cost of
+ * starting up, so it is left to the first gallivm_create().
+ */
+static void
+init_llvm(void)
+{
+   int64_t time_begin = os_time_get();
+   int64_t stats_start = nir_pass_stats_begin();
+
+   /* LLVMLinkIn* are no-ops at runtime.  They just ensure the respective
+    * component is linked at buildtime, which is sufficient for its static
+    * constructors to be called at load time.
+    */
+   LLVMLinkInMCJIT();
+
+   lp_set_target_options();
+
+#if defined(PIPE_ARCH_AARCH64) && LLVM_VERSION_MAJOR >= 11
+   if (lp_has_sve256()) {
+      /*
+       * Have LLVM lower the 256-bit vectors to SVE instead of splitting
+       * them into NEON registers.
+       */
+      static const char *const sve_options[] = {
+         "mesa",
+         "-aarch64-sve-vector-bits-min=256",
+      };
+      LLVMParseCommandLineOptions(ARRAY_SIZE(sve_options), sve_options, NULL);
+   }
+#endif
 
 #ifdef PIPE_ARCH_PPC_64
    /* Set the NJ bit in VSCR to 0 so denormalized values are handled as
@@ -495,7 +551,33 @@ lp_build_init(void)
    }
 #endif
 
-   gallivm_initialized = TRUE;
+   if (stats_start)
+      nir_pass_stats_record("gallivm_init", MESA_SHADER_NONE,
+                            stats_start, false);
+
+   gallivm_init_time = os_time_get() - time_begin;
+}
+
+
+/**
+ * Everything but LLVM, see lp_build_init().
+ */
+void
+lp_build_init_native(void)
+{
+   static once_flag native_once_flag = ONCE_FLAG_INIT;
+
+   call_once(&native_once_flag, init_native);
+}
+
+
+boolean
+lp_build_init(void)
+{
+   static once_flag llvm_once_flag = ONCE_FLAG_INIT;
+
+   lp_build_init_native();
+   call_once(&llvm_once_flag, init_llvm);
 
    return TRUE;
 }
@@ -536,6 +618,23 @@ gallivm_destroy(struct gallivm_state *gallivm)
 }
 
 
+/**
+ * Emit the module's code into a shared code arena, see
+ * lp_code_arena_create(), instead of pages of its own.  Must be called
+ * before gallivm_compile_module().  A NULL arena changes nothing.
+ */
+void
+gallivm_use_code_arena(struct gallivm_state *gallivm,
+                       struct lp_code_arena *arena)
+{
+   assert(!gallivm->compiled);
+   if (!arena)
+      return;
+   lp_free_memory_manager(gallivm->memorymgr);
+   gallivm->memorymgr = lp_get_arena_memory_manager(arena);
+}
+
+
 /**
  * Validate a function.
  * Verification is only done with debug builds.
@@ -570,6 +669,8 @@ gallivm_compile_module(struct gallivm_state *gallivm)
 {
    LLVMValueRef func;
    int64_t time_begin = 0;
+   int64_t compile_begin = os_time_get();
+   int64_t stats_start;
 
    assert(!gallivm->compiled);
 
@@ -601,10 +702,13 @@ gallivm_compile_module(struct gallivm_state *gallivm)
    if (gallivm_debug & GALLIVM_DEBUG_PERF)
       time_begin = os_time_get();
 
+   stats_start = nir_pass_stats_begin();
+
 #if GALLIVM_HAVE_CORO
    LLVMRunPassManager(gallivm->cgpassmgr, gallivm->module);
 #endif
    /* Run optimization passes */
+   add_optimization_passes(gallivm);
    LLVMInitializeFunctionPassManager(gallivm->passmgr);
    func = LLVMGetFirstFunction(gallivm->module);
    while (func) {
@@ -624,6 +728,10 @@ gallivm_compile_module(struct gallivm_state *gallivm)
    }
    LLVMFinalizeFunctionPassManager(gallivm->passmgr);
 
+   if (stats_start)
+      nir_pass_stats_record("gallivm_optimize", MESA_SHADER_NONE,
+                            stats_start, false);
+
    if (gallivm_debug & GALLIVM_DEBUG_PERF) {
       int64_t time_end = os_time_get();
       int time_msec = (int)((time_end - time_begin) / 1000);
@@ -659,6 +767,8 @@ gallivm_compile_module(struct gallivm_state *gallivm)
 
    ++gallivm->compiled;
 
+   p_atomic_add(&gallivm_compile_time, os_time_get() - compile_begin);
+
    if (gallivm->debug_printf_hook)
       LLVMAddGlobalMapping(gallivm->engine, gallivm->debug_printf_hook, debug_printf);
 
@@ -703,6 +813,8 @@ gallivm_jit_function(struct gallivm_state *gallivm,
    void *code;
    func_pointer jit_func;
    int64_t time_begin = 0;
+   int64_t codegen_begin;
+   int64_t stats_start;
 
    assert(gallivm->compiled);
    assert(gallivm->engine);
@@ -710,10 +822,20 @@ gallivm_jit_function(struct gallivm_state *gallivm,
    if (gallivm_debug & GALLIVM_DEBUG_PERF)
       time_begin = os_time_get();
 
+   /* MCJIT generates the code of the whole module on the first lookup. */
+   stats_start = nir_pass_stats_begin();
+   codegen_begin = os_time_get();
+
    code = LLVMGetPointerToGlobal(gallivm->engine, func);
    assert(code);
    jit_func = pointer_to_func(code);
 
+   p_atomic_add(&gallivm_compile_time, os_time_get() - codegen_begin);
+
+   if (stats_start)
+      nir_pass_stats_record("gallivm_codegen", MESA_SHADER_NONE,
+                            stats_start, false);
+
    if (gallivm_debug & GALLIVM_DEBUG_PERF) {
       int64_t time_end = os_time_get();
       int time_msec = (int)(time_end - time_begin) / 1000;
@@ -723,3 +845,14 @@ gallivm_jit_function(struct gallivm_state *gallivm,
 
    return jit_func;
 }
+
+
+/**
+ * Bytes of code and data the module was compiled to, 0 before
+ * gallivm_compile_module().
+ */
+size_t
+gallivm_code_size(const struct gallivm_state *gallivm)
+{
+   return lp_generated_code_size(gallivm->code);
+}
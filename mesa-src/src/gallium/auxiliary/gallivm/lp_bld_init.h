@@ -40,6 +40,7 @@ extern "C" {
 #endif
 
 struct lp_cached_code;
+struct lp_code_arena;
 struct gallivm_state
 {
    char *module_name;
@@ -54,15 +55,26 @@ struct gallivm_state
    struct lp_generated_code *code;
    struct lp_cached_code *cache;
    unsigned compiled;
+   /** Compile quickly rather than well, like GALLIVM_PERF=nopt does */
+   boolean no_opt;
    LLVMValueRef coro_malloc_hook;
    LLVMValueRef coro_free_hook;
    LLVMValueRef debug_printf_hook;
 };
 
 
+void
+lp_build_init_native(void);
+
 boolean
 lp_build_init(void);
 
+/** Microseconds lp_build_init() spent initializing LLVM, 0 until then */
+extern uint64_t gallivm_init_time;
+
+/** Microseconds spent compiling and loading modules, summed over threads */
+extern uint64_t gallivm_compile_time;
+
 
 struct gallivm_state *
 gallivm_create(const char *name, LLVMContextRef context,
@@ -71,6 +83,16 @@ gallivm_create(const char *name, LLVMContextRef context,
 void
 gallivm_destroy(struct gallivm_state *gallivm);
 
+struct lp_code_arena *
+lp_code_arena_create(void);
+
+void
+lp_code_arena_destroy(struct lp_code_arena *arena);
+
+void
+gallivm_use_code_arena(struct gallivm_state *gallivm,
+                       struct lp_code_arena *arena);
+
 void
 gallivm_free_ir(struct gallivm_state *gallivm);
 
@@ -85,6 +107,9 @@ func_pointer
 gallivm_jit_function(struct gallivm_state *gallivm,
                      LLVMValueRef func);
 
+size_t
+gallivm_code_size(const struct gallivm_state *gallivm);
+
 #ifdef __cplusplus
 }
 #endif
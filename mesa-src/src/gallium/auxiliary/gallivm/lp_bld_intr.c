@@ -47,6 +47,7 @@
 
 #include "util/u_debug.h"
 #include "util/u_string.h"
+#include "util/u_cpu_detect.h"
 #include "util/bitscan.h"
 
 #include "lp_bld_const.h"
@@ -439,3 +440,96 @@ lp_build_intrinsic_map_binary(struct gallivm_state *gallivm,
 }
 
 
+/**
+ * Whether lp_build_masked_gather() should be used for a vector of
+ * bit_size elements.  Without hardware gathers LLVM expands the intrinsic
+ * into one branch per lane, which is what the callers' own loops do anyway.
+ */
+boolean
+lp_has_masked_gather(unsigned bit_size)
+{
+   if (LLVM_VERSION_MAJOR < 6)
+      return FALSE;
+   return util_cpu_caps.has_avx2 && (bit_size == 32 || bit_size == 64);
+}
+
+
+/**
+ * Whether lp_build_masked_scatter() should be used for a vector of
+ * bit_size elements.  Scatters only exist from AVX-512 on.
+ */
+boolean
+lp_has_masked_scatter(unsigned bit_size)
+{
+   if (LLVM_VERSION_MAJOR < 6)
+      return FALSE;
+   return util_cpu_caps.has_avx512f && (bit_size == 32 || bit_size == 64);
+}
+
+
+/**
+ * Load one bit_size element through each pointer in ptrs whose exec_mask
+ * lane is set, with llvm.masked.gather.  Inactive lanes read as zero and
+ * their pointers are never dereferenced.
+ *
+ * @param ptrs vector of length pointers to bit_size integers
+ * @param exec_mask integer vector of length, non-zero for active lanes
+ */
+LLVMValueRef
+lp_build_masked_gather(struct gallivm_state *gallivm,
+                       unsigned length,
+                       unsigned bit_size,
+                       LLVMValueRef ptrs,
+                       LLVMValueRef exec_mask)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMTypeRef vec_type =
+      LLVMVectorType(LLVMIntTypeInContext(gallivm->context, bit_size), length);
+   LLVMValueRef args[4];
+   char intrinsic[64];
+
+   snprintf(intrinsic, sizeof intrinsic, "llvm.masked.gather.v%ui%u.v%up0i%u",
+            length, bit_size, length, bit_size);
+
+   args[0] = ptrs;
+   args[1] = lp_build_const_int32(gallivm, bit_size / 8);
+   args[2] = LLVMBuildICmp(builder, LLVMIntNE, exec_mask,
+                           LLVMConstNull(LLVMTypeOf(exec_mask)), "");
+   args[3] = LLVMConstNull(vec_type);
+
+   return lp_build_intrinsic(builder, intrinsic, vec_type, args, 4, 0);
+}
+
+
+/**
+ * Store each bit_size element of values through the matching pointer in
+ * ptrs whose exec_mask lane is set, with llvm.masked.scatter.
+ *
+ * @param ptrs vector of length pointers to bit_size integers
+ * @param values integer vector of length bit_size elements
+ * @param exec_mask integer vector of length, non-zero for active lanes
+ */
+void
+lp_build_masked_scatter(struct gallivm_state *gallivm,
+                        unsigned length,
+                        unsigned bit_size,
+                        LLVMValueRef ptrs,
+                        LLVMValueRef values,
+                        LLVMValueRef exec_mask)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef args[4];
+   char intrinsic[64];
+
+   snprintf(intrinsic, sizeof intrinsic, "llvm.masked.scatter.v%ui%u.v%up0i%u",
+            length, bit_size, length, bit_size);
+
+   args[0] = values;
+   args[1] = ptrs;
+   args[2] = lp_build_const_int32(gallivm, bit_size / 8);
+   args[3] = LLVMBuildICmp(builder, LLVMIntNE, exec_mask,
+                           LLVMConstNull(LLVMTypeOf(exec_mask)), "");
+
+   lp_build_intrinsic(builder, intrinsic,
+                      LLVMVoidTypeInContext(gallivm->context), args, 4, 0);
+}
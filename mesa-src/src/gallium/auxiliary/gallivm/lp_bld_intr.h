@@ -137,5 +137,26 @@ lp_build_intrinsic_map_binary(struct gallivm_state *gallivm,
                               LLVMValueRef a,
                               LLVMValueRef b);
 
+boolean
+lp_has_masked_gather(unsigned bit_size);
+
+boolean
+lp_has_masked_scatter(unsigned bit_size);
+
+LLVMValueRef
+lp_build_masked_gather(struct gallivm_state *gallivm,
+                       unsigned length,
+                       unsigned bit_size,
+                       LLVMValueRef ptrs,
+                       LLVMValueRef exec_mask);
+
+void
+lp_build_masked_scatter(struct gallivm_state *gallivm,
+                        unsigned length,
+                        unsigned bit_size,
+                        LLVMValueRef ptrs,
+                        LLVMValueRef values,
+                        LLVMValueRef exec_mask);
+
 
 #endif /* !LP_BLD_INTR_H */
@@ -41,6 +41,7 @@
 
 
 #include <stddef.h>
+#include <algorithm>
 
 #include <llvm/Config/llvm-config.h>
 
@@ -59,6 +60,7 @@
 #include <llvm/ADT/Triple.h>
 #include <llvm/Analysis/TargetLibraryInfo.h>
 #include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/Support/Memory.h>
 #include <llvm/Support/CommandLine.h>
 #include <llvm/Support/Host.h>
 #include <llvm/Support/PrettyStackTrace.h>
@@ -90,6 +92,7 @@
 
 #include "lp_bld_misc.h"
 #include "lp_bld_debug.h"
+#include "lp_bld_type.h"
 
 namespace {
 
@@ -246,9 +249,11 @@ class ShaderMemoryManager : public DelegatingJITMemoryManager {
       typedef std::vector<void *> Vec;
       Vec FunctionBody, ExceptionTable;
       BaseMemoryManager *TheMM;
+      size_t Size;   /* of all the sections */
 
       GeneratedCode(BaseMemoryManager *MM) {
          TheMM = MM;
+         Size = 0;
       }
 
       ~GeneratedCode() {
@@ -283,12 +288,239 @@ class ShaderMemoryManager : public DelegatingJITMemoryManager {
          delete (GeneratedCode *) code;
       }
 
+      static size_t getGeneratedCodeSize(const struct lp_generated_code *code) {
+         return ((const GeneratedCode *) code)->Size;
+      }
+
+      virtual uint8_t *allocateCodeSection(uintptr_t Size,
+                                           unsigned Alignment,
+                                           unsigned SectionID,
+                                           llvm::StringRef SectionName) {
+         code->Size += Size;
+         return DelegatingJITMemoryManager::allocateCodeSection(
+            Size, Alignment, SectionID, SectionName);
+      }
+
+      virtual uint8_t *allocateDataSection(uintptr_t Size,
+                                           unsigned Alignment,
+                                           unsigned SectionID,
+                                           llvm::StringRef SectionName,
+                                           bool IsReadOnly) {
+         code->Size += Size;
+         return DelegatingJITMemoryManager::allocateDataSection(
+            Size, Alignment, SectionID, SectionName, IsReadOnly);
+      }
+
       virtual void deallocateFunctionBody(void *Body) {
          // remember for later deallocation
          code->FunctionBody.push_back(Body);
       }
 };
 
+/*
+ * Code memory shared by all the modules of a screen.
+ *
+ * SectionMemoryManager maps at least one page per section kind for every
+ * module, which for the many small shader variants is mostly padding.
+ * The arena instead hands out sections from large slabs which are
+ * mapped read/write/execute, so a module never has to be flipped between
+ * writable and executable while other modules are still being emitted
+ * into the same slab.  A slab is unmapped once no module uses it.
+ *
+ * The arena may be used from several compiler threads at once.
+ */
+class CodeArena {
+
+   struct Slab {
+      llvm::sys::MemoryBlock Block;
+      uintptr_t Used;
+      unsigned Refs;
+   };
+
+   static const uintptr_t SlabSize = 256 * 1024;
+
+   mtx_t Mutex;
+   std::vector<Slab *> Slabs;
+   Slab *Current;
+   unsigned Refs;
+
+   static uintptr_t slabSize(const Slab *S) {
+#if LLVM_VERSION_MAJOR >= 10
+      return S->Block.allocatedSize();
+#else
+      return S->Block.size();
+#endif
+   }
+
+   Slab *newSlab(uintptr_t MinSize) {
+      std::error_code EC;
+      Slab *S = new Slab;
+      S->Block = llvm::sys::Memory::allocateMappedMemory(
+         std::max(MinSize, SlabSize), nullptr,
+         llvm::sys::Memory::MF_READ |
+         llvm::sys::Memory::MF_WRITE |
+         llvm::sys::Memory::MF_EXEC, EC);
+      if (EC) {
+         delete S;
+         return NULL;
+      }
+      S->Used = 0;
+      S->Refs = 0;
+      Slabs.push_back(S);
+      return S;
+   }
+
+   void freeSlab(Slab *S) {
+      Slabs.erase(std::find(Slabs.begin(), Slabs.end(), S));
+      llvm::sys::Memory::releaseMappedMemory(S->Block);
+      delete S;
+   }
+
+   ~CodeArena() {
+      assert(Slabs.size() <= 1);
+      while (!Slabs.empty())
+         freeSlab(Slabs.back());
+      mtx_destroy(&Mutex);
+   }
+
+   public:
+
+      typedef void *SlabRef;
+
+      CodeArena() : Current(NULL), Refs(1) {
+         mtx_init(&Mutex, mtx_plain);
+      }
+
+      /* Fails when the system does not allow writable code memory. */
+      bool init() {
+         Current = newSlab(SlabSize);
+         return Current != NULL;
+      }
+
+      void reference() {
+         mtx_lock(&Mutex);
+         Refs++;
+         mtx_unlock(&Mutex);
+      }
+
+      void unreference() {
+         mtx_lock(&Mutex);
+         bool last = --Refs == 0;
+         mtx_unlock(&Mutex);
+         if (last)
+            delete this;
+      }
+
+      /*
+       * Returns Size bytes aligned to Alignment, and in OutSlab the slab
+       * they came from, which the caller must release() when done.
+       */
+      uint8_t *allocate(uintptr_t Size, unsigned Alignment,
+                        SlabRef *OutSlab) {
+         uintptr_t Align = Alignment ? Alignment : 16;
+         mtx_lock(&Mutex);
+         Slab *S = Current;
+         uintptr_t Offset = (S->Used + Align - 1) & ~(Align - 1);
+         if (Offset + Size > slabSize(S)) {
+            /* Slabs are page aligned, so offset 0 suits any alignment. */
+            S = newSlab(Size);
+            if (!S) {
+               mtx_unlock(&Mutex);
+               return NULL;
+            }
+            /*
+             * Sections bigger than a slab get one of their own, anything
+             * else starts a new slab to fill.
+             */
+            if (Size < SlabSize) {
+               if (Current->Refs == 0)
+                  freeSlab(Current);
+               Current = S;
+            }
+            Offset = 0;
+         }
+         S->Used = Offset + Size;
+         S->Refs++;
+         *OutSlab = S;
+         mtx_unlock(&Mutex);
+
+         return (uint8_t *) S->Block.base() + Offset;
+      }
+
+      void release(SlabRef Ref) {
+         Slab *S = (Slab *) Ref;
+         mtx_lock(&Mutex);
+         if (--S->Refs == 0) {
+            if (S == Current)
+               S->Used = 0;
+            else
+               freeSlab(S);
+         }
+         mtx_unlock(&Mutex);
+      }
+};
+
+
+/*
+ * Memory manager of one module, allocating from a CodeArena.  It is
+ * deleted with the module's generated code, see gallivm_free_code(),
+ * and gives its share of the arena back then.
+ */
+class ArenaMemoryManager : public BaseMemoryManager {
+
+   CodeArena *Arena;
+   std::vector<CodeArena::SlabRef> Slabs;
+   std::vector<std::pair<uint8_t *, uintptr_t> > CodeBlocks;
+
+   uint8_t *allocate(uintptr_t Size, unsigned Alignment) {
+      CodeArena::SlabRef Slab;
+      uint8_t *Ptr = Arena->allocate(Size, Alignment, &Slab);
+      if (Ptr && std::find(Slabs.begin(), Slabs.end(), Slab) != Slabs.end())
+         Arena->release(Slab);
+      else if (Ptr)
+         Slabs.push_back(Slab);
+      return Ptr;
+   }
+
+   public:
+
+      ArenaMemoryManager(CodeArena *A) : Arena(A) {
+         Arena->reference();
+      }
+
+      virtual ~ArenaMemoryManager() {
+         for (CodeArena::SlabRef Slab : Slabs)
+            Arena->release(Slab);
+         Arena->unreference();
+      }
+
+      virtual uint8_t *allocateCodeSection(uintptr_t Size,
+                                           unsigned Alignment,
+                                           unsigned SectionID,
+                                           llvm::StringRef SectionName) {
+         uint8_t *Ptr = allocate(Size, Alignment);
+         if (Ptr)
+            CodeBlocks.push_back(std::make_pair(Ptr, Size));
+         return Ptr;
+      }
+
+      virtual uint8_t *allocateDataSection(uintptr_t Size,
+                                           unsigned Alignment,
+                                           unsigned SectionID,
+                                           llvm::StringRef SectionName,
+                                           bool IsReadOnly) {
+         return allocate(Size, Alignment);
+      }
+
+      virtual bool finalizeMemory(std::string *ErrMsg = 0) {
+         for (const auto &Block : CodeBlocks)
+            llvm::sys::Memory::InvalidateInstructionCache(Block.first,
+                                                          Block.second);
+         CodeBlocks.clear();
+         return false;
+      }
+};
+
 class LPObjectCache : public llvm::ObjectCache {
 private:
    bool has_object;
@@ -416,14 +648,17 @@ lp_build_create_jit_compiler_for_module(LLVMExecutionEngineRef *OutJIT,
    MAttrs.push_back(util_cpu_caps.has_f16c ? "+f16c" : "-f16c");
    MAttrs.push_back(util_cpu_caps.has_fma  ? "+fma"  : "-fma");
    MAttrs.push_back(util_cpu_caps.has_avx2 ? "+avx2" : "-avx2");
-   /* disable avx512 and all subvariants */
-   MAttrs.push_back("-avx512cd");
-   MAttrs.push_back("-avx512er");
-   MAttrs.push_back("-avx512f");
-   MAttrs.push_back("-avx512pf");
-   MAttrs.push_back("-avx512bw");
-   MAttrs.push_back("-avx512dq");
-   MAttrs.push_back("-avx512vl");
+   /* avx512 and all subvariants only with 512-bit native vectors */
+   {
+      const bool avx512 = lp_has_avx512();
+      MAttrs.push_back(avx512 && util_cpu_caps.has_avx512cd ? "+avx512cd" : "-avx512cd");
+      MAttrs.push_back(avx512 && util_cpu_caps.has_avx512er ? "+avx512er" : "-avx512er");
+      MAttrs.push_back(avx512 ? "+avx512f" : "-avx512f");
+      MAttrs.push_back(avx512 && util_cpu_caps.has_avx512pf ? "+avx512pf" : "-avx512pf");
+      MAttrs.push_back(avx512 ? "+avx512bw" : "-avx512bw");
+      MAttrs.push_back(avx512 ? "+avx512dq" : "-avx512dq");
+      MAttrs.push_back(avx512 ? "+avx512vl" : "-avx512vl");
+   }
 #endif
 #if defined(PIPE_ARCH_ARM)
    if (!util_cpu_caps.has_neon) {
@@ -432,6 +667,11 @@ lp_build_create_jit_compiler_for_module(LLVMExecutionEngineRef *OutJIT,
       MAttrs.push_back("-vfp2");
    }
 #endif
+#if defined(PIPE_ARCH_AARCH64)
+   /* The host cpu name may not imply it, see lp_has_sve256() */
+   if (lp_has_sve256())
+      MAttrs.push_back("+sve");
+#endif
 
 #if defined(PIPE_ARCH_PPC)
    MAttrs.push_back(util_cpu_caps.has_altivec ? "+altivec" : "-altivec");
@@ -562,6 +802,13 @@ lp_free_generated_code(struct lp_generated_code *code)
    ShaderMemoryManager::freeGeneratedCode(code);
 }
 
+extern "C"
+size_t
+lp_generated_code_size(const struct lp_generated_code *code)
+{
+   return code ? ShaderMemoryManager::getGeneratedCodeSize(code) : 0;
+}
+
 extern "C"
 LLVMMCJITMemoryManagerRef
 lp_get_default_memory_manager()
@@ -578,6 +825,40 @@ lp_free_memory_manager(LLVMMCJITMemoryManagerRef memorymgr)
    delete reinterpret_cast<BaseMemoryManager*>(memorymgr);
 }
 
+/**
+ * Create code memory to share between modules, see CodeArena.  Returns
+ * NULL if the system refuses writable and executable mappings, in which
+ * case modules keep using a memory manager of their own.
+ */
+extern "C"
+struct lp_code_arena *
+lp_code_arena_create(void)
+{
+   CodeArena *arena = new CodeArena();
+   if (!arena->init()) {
+      arena->unreference();
+      return NULL;
+   }
+   return (struct lp_code_arena *) arena;
+}
+
+extern "C"
+void
+lp_code_arena_destroy(struct lp_code_arena *arena)
+{
+   if (arena)
+      ((CodeArena *) arena)->unreference();
+}
+
+extern "C"
+LLVMMCJITMemoryManagerRef
+lp_get_arena_memory_manager(struct lp_code_arena *arena)
+{
+   BaseMemoryManager *mm;
+   mm = new ArenaMemoryManager((CodeArena *) arena);
+   return reinterpret_cast<LLVMMCJITMemoryManagerRef>(mm);
+}
+
 extern "C" void
 lp_free_objcache(void *objcache_ptr)
 {
@@ -54,6 +54,7 @@ struct lp_cached_code {
 };
 
 struct lp_generated_code;
+struct lp_code_arena;
 
 extern LLVMTargetLibraryInfoRef
 gallivm_create_target_library_info(const char *triple);
@@ -77,12 +78,18 @@ lp_build_create_jit_compiler_for_module(LLVMExecutionEngineRef *OutJIT,
 extern void
 lp_free_generated_code(struct lp_generated_code *code);
 
+extern size_t
+lp_generated_code_size(const struct lp_generated_code *code);
+
 extern LLVMMCJITMemoryManagerRef
 lp_get_default_memory_manager();
 
 extern void
 lp_free_memory_manager(LLVMMCJITMemoryManagerRef memorymgr);
 
+extern LLVMMCJITMemoryManagerRef
+lp_get_arena_memory_manager(struct lp_code_arena *arena);
+
 extern LLVMValueRef
 lp_get_called_value(LLVMValueRef call);
 
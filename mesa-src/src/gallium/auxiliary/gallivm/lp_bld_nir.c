@@ -94,15 +94,6 @@ static LLVMValueRef cast_type(struct lp_build_nir_context *bld_base, LLVMValueRe
 }
 
 
-static struct lp_build_context *get_flt_bld(struct lp_build_nir_context *bld_base,
-                                            unsigned op_bit_size)
-{
-   if (op_bit_size == 64)
-      return &bld_base->dbl_bld;
-   else
-      return &bld_base->base;
-}
-
 static unsigned glsl_sampler_to_pipe(int sampler_dim, bool is_array)
 {
    unsigned pipe_target = PIPE_BUFFER;
@@ -1014,7 +1005,7 @@ static void visit_load_ubo(struct lp_build_nir_context *bld_base,
    LLVMValueRef idx = get_src(bld_base, instr->src[0]);
    LLVMValueRef offset = get_src(bld_base, instr->src[1]);
 
-   bool offset_is_uniform = nir_src_is_dynamically_uniform(instr->src[1]);
+   bool offset_is_uniform = lp_nir_src_is_uniform(instr->src[1]);
    idx = LLVMBuildExtractElement(builder, idx, lp_build_const_int32(gallivm, 0), "");
    bld_base->load_ubo(bld_base, nir_dest_num_components(instr->dest), nir_dest_bit_size(instr->dest),
                       offset_is_uniform, idx, offset, result);
@@ -1027,7 +1018,7 @@ static void visit_load_push_constant(struct lp_build_nir_context *bld_base,
    struct gallivm_state *gallivm = bld_base->base.gallivm;
    LLVMValueRef offset = get_src(bld_base, instr->src[0]);
    LLVMValueRef idx = lp_build_const_int32(gallivm, 0);
-   bool offset_is_uniform = nir_src_is_dynamically_uniform(instr->src[0]);
+   bool offset_is_uniform = lp_nir_src_is_uniform(instr->src[0]);
 
    bld_base->load_ubo(bld_base, nir_dest_num_components(instr->dest), nir_dest_bit_size(instr->dest),
                       offset_is_uniform, idx, offset, result);
@@ -1040,8 +1031,9 @@ static void visit_load_ssbo(struct lp_build_nir_context *bld_base,
 {
    LLVMValueRef idx = get_src(bld_base, instr->src[0]);
    LLVMValueRef offset = get_src(bld_base, instr->src[1]);
+   bool offset_is_uniform = lp_nir_src_is_uniform(instr->src[1]);
    bld_base->load_mem(bld_base, nir_dest_num_components(instr->dest), nir_dest_bit_size(instr->dest),
-                       idx, offset, result);
+                      offset_is_uniform, idx, offset, result);
 }
 
 static void visit_store_ssbo(struct lp_build_nir_context *bld_base,
@@ -1276,8 +1268,9 @@ static void visit_shared_load(struct lp_build_nir_context *bld_base,
                                 LLVMValueRef result[NIR_MAX_VEC_COMPONENTS])
 {
    LLVMValueRef offset = get_src(bld_base, instr->src[0]);
+   bool offset_is_uniform = lp_nir_src_is_uniform(instr->src[0]);
    bld_base->load_mem(bld_base, nir_dest_num_components(instr->dest), nir_dest_bit_size(instr->dest),
-                      NULL, offset, result);
+                      offset_is_uniform, NULL, offset, result);
 }
 
 static void visit_shared_store(struct lp_build_nir_context *bld_base,
@@ -1442,6 +1435,9 @@ static void visit_intrinsic(struct lp_build_nir_context *bld_base,
    case nir_intrinsic_load_sample_id:
    case nir_intrinsic_load_sample_pos:
    case nir_intrinsic_load_sample_mask_in:
+   case nir_intrinsic_load_subgroup_size:
+   case nir_intrinsic_load_subgroup_invocation:
+   case nir_intrinsic_first_invocation:
       bld_base->sysval_intrin(bld_base, instr, result);
       break;
    case nir_intrinsic_load_helper_invocation:
@@ -1547,6 +1543,29 @@ static void visit_intrinsic(struct lp_build_nir_context *bld_base,
    case nir_intrinsic_vote_ieq:
       bld_base->vote(bld_base, cast_type(bld_base, get_src(bld_base, instr->src[0]), nir_type_int, 32), instr, result);
       break;
+   case nir_intrinsic_ballot:
+      bld_base->ballot(bld_base, cast_type(bld_base, get_src(bld_base, instr->src[0]), nir_type_int, 32), result);
+      break;
+   case nir_intrinsic_read_invocation:
+   case nir_intrinsic_read_first_invocation: {
+      LLVMValueRef invoc = NULL;
+      if (instr->intrinsic == nir_intrinsic_read_invocation)
+         invoc = cast_type(bld_base, get_src(bld_base, instr->src[1]), nir_type_uint, 32);
+      bld_base->read_invocation(bld_base, get_src(bld_base, instr->src[0]), invoc, result);
+      break;
+   }
+   case nir_intrinsic_shuffle:
+      bld_base->shuffle(bld_base, get_src(bld_base, instr->src[0]),
+                        cast_type(bld_base, get_src(bld_base, instr->src[1]), nir_type_uint, 32),
+                        result);
+      break;
+   case nir_intrinsic_reduce:
+   case nir_intrinsic_inclusive_scan:
+   case nir_intrinsic_exclusive_scan: {
+      nir_alu_type type = nir_alu_type_get_base_type(nir_op_infos[nir_intrinsic_reduction_op(instr)].input_types[0]);
+      bld_base->reduce(bld_base, cast_type(bld_base, get_src(bld_base, instr->src[0]), type, nir_src_bit_size(instr->src[0])), instr, result);
+      break;
+   }
    case nir_intrinsic_interp_deref_at_offset:
    case nir_intrinsic_interp_deref_at_centroid:
    case nir_intrinsic_interp_deref_at_sample:
@@ -1899,15 +1918,66 @@ static void visit_block(struct lp_build_nir_context *bld_base, nir_block *block)
    }
 }
 
+/*
+ * Whether a cf node can be branched around: the backend puts its masks
+ * back afterwards, so nothing inside may change them for good, nor expect
+ * all invocations to get there.  A loop's own breaks and continues are
+ * undone by its end.
+ */
+static bool cf_node_can_branch(nir_cf_node *node, bool allow_jumps)
+{
+   nir_foreach_block_in_cf_node(block, node) {
+      nir_foreach_instr(instr, block) {
+         if (instr->type == nir_instr_type_jump && !allow_jumps)
+            return false;
+         if (instr->type != nir_instr_type_intrinsic)
+            continue;
+         switch (nir_instr_as_intrinsic(instr)->intrinsic) {
+         case nir_intrinsic_emit_vertex:
+         case nir_intrinsic_end_primitive:
+         case nir_intrinsic_control_barrier:
+            return false;
+         default:
+            break;
+         }
+      }
+   }
+   return true;
+}
+
+/*
+ * Bodies of fewer instructions than this are cheaper to run masked than
+ * to test for active invocations first.
+ */
+#define LP_NIR_SKIP_MIN_INSTRS 16
+
+static bool cf_list_worth_skipping(struct exec_list *list)
+{
+   unsigned count = 0;
+
+   foreach_list_typed(nir_cf_node, node, node, list) {
+      nir_foreach_block_in_cf_node(block, node) {
+         count += exec_list_length(&block->instr_list);
+         if (count >= LP_NIR_SKIP_MIN_INSTRS)
+            return true;
+      }
+   }
+   return false;
+}
+
 static void visit_if(struct lp_build_nir_context *bld_base, nir_if *if_stmt)
 {
    LLVMValueRef cond = get_src(bld_base, if_stmt->condition);
+   bool can_branch = cf_node_can_branch(&if_stmt->cf_node, false);
+   bool uniform = lp_nir_src_is_uniform(if_stmt->condition) && can_branch;
 
-   bld_base->if_cond(bld_base, cond);
+   bld_base->if_cond(bld_base, cond, uniform,
+                     can_branch && cf_list_worth_skipping(&if_stmt->then_list));
    visit_cf_list(bld_base, &if_stmt->then_list);
 
    if (!exec_list_is_empty(&if_stmt->else_list)) {
-      bld_base->else_stmt(bld_base);
+      bld_base->else_stmt(bld_base,
+                          can_branch && cf_list_worth_skipping(&if_stmt->else_list));
       visit_cf_list(bld_base, &if_stmt->else_list);
    }
    bld_base->endif_stmt(bld_base);
@@ -1915,7 +1985,8 @@ static void visit_if(struct lp_build_nir_context *bld_base, nir_if *if_stmt)
 
 static void visit_loop(struct lp_build_nir_context *bld_base, nir_loop *loop)
 {
-   bld_base->bgnloop(bld_base);
+   bld_base->bgnloop(bld_base, cf_node_can_branch(&loop->cf_node, true) &&
+                               cf_list_worth_skipping(&loop->body));
    visit_cf_list(bld_base, &loop->body);
    bld_base->endloop(bld_base);
 }
@@ -1981,6 +2052,8 @@ bool lp_build_nir_llvm(
 {
    struct nir_function *func;
 
+   /* Before leaving SSA, as it only looks at SSA values. */
+   nir_divergence_analysis(nir, 0);
    nir_convert_from_ssa(nir, true);
    nir_lower_locals_to_regs(nir);
    nir_remove_dead_derefs(nir);
@@ -2016,6 +2089,20 @@ bool lp_build_nir_llvm(
 void lp_build_opt_nir(struct nir_shader *nir)
 {
    bool progress;
+
+   /* Subgroups are the SIMD lanes of one shader invocation of the jit code.
+    * The lane count differs between stages, so load_subgroup_size is left
+    * for the backend to answer.
+    */
+   const nir_lower_subgroups_options subgroups_options = {
+      .ballot_bit_size = 32,
+      .lower_to_scalar = true,
+      .lower_subgroup_masks = true,
+      .lower_shuffle = true,
+      .lower_quad = true,
+   };
+   NIR_PASS_V(nir, nir_lower_subgroups, &subgroups_options);
+
    do {
       progress = false;
       NIR_PASS_V(nir, nir_opt_constant_folding);
@@ -27,6 +27,7 @@
 #define LP_BLD_NIR_H
 
 #include "gallivm/lp_bld.h"
+#include "gallivm/lp_bld_flow.h"
 #include "gallivm/lp_bld_limits.h"
 #include "lp_bld_type.h"
 
@@ -93,6 +94,7 @@ struct lp_build_nir_context
    /* for SSBO and shared memory */
    void (*load_mem)(struct lp_build_nir_context *bld_base,
                     unsigned nc, unsigned bit_size,
+                    bool offset_is_uniform,
                     LLVMValueRef index, LLVMValueRef offset, LLVMValueRef result[NIR_MAX_VEC_COMPONENTS]);
    void (*store_mem)(struct lp_build_nir_context *bld_base,
                      unsigned writemask, unsigned nc, unsigned bit_size,
@@ -162,10 +164,13 @@ struct lp_build_nir_context
    void (*discard)(struct lp_build_nir_context *bld_base,
                    LLVMValueRef cond);
 
-   void (*bgnloop)(struct lp_build_nir_context *bld_base);
+   /* with skip, a body may be branched around when no invocation runs it */
+   void (*bgnloop)(struct lp_build_nir_context *bld_base, bool skip);
    void (*endloop)(struct lp_build_nir_context *bld_base);
-   void (*if_cond)(struct lp_build_nir_context *bld_base, LLVMValueRef cond);
-   void (*else_stmt)(struct lp_build_nir_context *bld_base);
+   /* uniform ifs may be emitted as branches, leaving the masks alone */
+   void (*if_cond)(struct lp_build_nir_context *bld_base, LLVMValueRef cond,
+                   bool uniform, bool skip);
+   void (*else_stmt)(struct lp_build_nir_context *bld_base, bool skip);
    void (*endif_stmt)(struct lp_build_nir_context *bld_base);
    void (*break_stmt)(struct lp_build_nir_context *bld_base);
    void (*continue_stmt)(struct lp_build_nir_context *bld_base);
@@ -174,6 +179,10 @@ struct lp_build_nir_context
    void (*end_primitive)(struct lp_build_nir_context *bld_base, uint32_t stream_id);
 
    void (*vote)(struct lp_build_nir_context *bld_base, LLVMValueRef src, nir_intrinsic_instr *instr, LLVMValueRef dst[4]);
+   void (*ballot)(struct lp_build_nir_context *bld_base, LLVMValueRef src, LLVMValueRef dst[4]);
+   void (*read_invocation)(struct lp_build_nir_context *bld_base, LLVMValueRef src, LLVMValueRef invoc, LLVMValueRef dst[4]);
+   void (*shuffle)(struct lp_build_nir_context *bld_base, LLVMValueRef src, LLVMValueRef index, LLVMValueRef dst[4]);
+   void (*reduce)(struct lp_build_nir_context *bld_base, LLVMValueRef src, nir_intrinsic_instr *instr, LLVMValueRef dst[4]);
    void (*helper_invocation)(struct lp_build_nir_context *bld_base, LLVMValueRef *dst);
 
    void (*interp_at)(struct lp_build_nir_context *bld_base,
@@ -229,6 +238,29 @@ struct lp_build_nir_soa_context
    struct lp_build_mask_context *mask;
    struct lp_exec_mask exec_mask;
 
+   /* The open ifs.  Uniform ones are emitted as branches, which leave the
+    * exec mask as it was on entry.  Skipped ones are masked as usual, but
+    * each side is also branched around when no invocation takes it.
+    */
+   struct {
+      bool uniform;
+      bool skip;
+      struct lp_build_if_state branch;
+      struct lp_exec_mask exec_mask;
+   } if_stack[LP_MAX_TGSI_NESTING];
+   unsigned if_stack_size;
+
+   /* The open loops, only to branch around skipped ones */
+   struct {
+      bool skip;
+      struct lp_build_if_state branch;
+      struct lp_exec_mask exec_mask;
+   } loop_stack[LP_MAX_TGSI_NESTING];
+   unsigned loop_stack_size;
+
+   /* Counts the bodies skipped, may be NULL */
+   uint64_t *skipped_bodies;
+
    /* We allocate/use this array of inputs if (indirects & nir_var_shader_in) is
     * set. The inputs[] array above is unused then.
     */
@@ -244,6 +276,19 @@ lp_build_nir_llvm(struct lp_build_nir_context *bld_base,
 
 void lp_build_opt_nir(struct nir_shader *nir);
 
+/**
+ * Whether \p src has the same value in all active invocations, going by
+ * the nir_divergence_analysis() lp_build_nir_llvm() runs.  The inactive
+ * invocations may hold anything, unless the source is also dynamically
+ * uniform.
+ */
+static inline bool
+lp_nir_src_is_uniform(nir_src src)
+{
+   return nir_src_is_dynamically_uniform(src) ||
+          (src.is_ssa && !src.ssa->divergent);
+}
+
 static inline LLVMValueRef
 lp_nir_array_build_gather_values(LLVMBuilderRef builder,
                                  LLVMValueRef * values,
@@ -260,6 +305,15 @@ lp_nir_array_build_gather_values(LLVMBuilderRef builder,
 }
 
 
+static inline struct lp_build_context *get_flt_bld(struct lp_build_nir_context *bld_base,
+                                                   unsigned op_bit_size)
+{
+   if (op_bit_size == 64)
+      return &bld_base->dbl_bld;
+   else
+      return &bld_base->base;
+}
+
 static inline struct lp_build_context *get_int_bld(struct lp_build_nir_context *bld_base,
                                                    bool is_unsigned,
                                                    unsigned op_bit_size)
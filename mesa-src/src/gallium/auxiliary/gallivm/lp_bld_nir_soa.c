@@ -33,6 +33,8 @@
 #include "lp_bld_arit.h"
 #include "lp_bld_bitarit.h"
 #include "lp_bld_coro.h"
+#include "lp_bld_intr.h"
+#include "lp_bld_misc.h"
 #include "lp_bld_printf.h"
 #include "util/u_math.h"
 /*
@@ -54,6 +56,56 @@ mask_vec(struct lp_build_nir_context *bld_base)
                        exec_mask->exec_mask, "");
 }
 
+/*
+ * One bit per active invocation, as an i32, or NULL if all are active.
+ */
+static LLVMValueRef
+active_invocation_bits(struct lp_build_nir_context *bld_base)
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef exec_mask = mask_vec(bld_base);
+   LLVMValueRef bits;
+
+   if (!exec_mask)
+      return NULL;
+
+   bits = LLVMBuildICmp(builder, LLVMIntNE, exec_mask,
+                        bld_base->uint_bld.zero, "");
+   bits = LLVMBuildBitCast(builder, bits,
+                           LLVMIntTypeInContext(gallivm->context,
+                                                bld_base->uint_bld.type.length),
+                           "");
+   return LLVMBuildZExt(builder, bits,
+                        LLVMInt32TypeInContext(gallivm->context), "");
+}
+
+/*
+ * The index of the first active invocation, or 0 if none is.  Values the
+ * divergence analysis found uniform are read from there, since inactive
+ * invocations may hold anything.
+ */
+static LLVMValueRef
+first_active_invocation(struct lp_build_nir_context *bld_base)
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef bits = active_invocation_bits(bld_base);
+   LLVMValueRef zero = lp_build_const_int32(gallivm, 0);
+   LLVMValueRef first, none;
+
+   if (!bits)
+      return zero;
+
+   first = lp_build_intrinsic_binary(builder, "llvm.cttz.i32",
+                                     LLVMInt32TypeInContext(gallivm->context),
+                                     bits,
+                                     LLVMConstInt(LLVMInt1TypeInContext(gallivm->context),
+                                                  0, 0));
+   none = LLVMBuildICmp(builder, LLVMIntEQ, bits, zero, "");
+   return LLVMBuildSelect(builder, none, zero, first, "");
+}
+
 static LLVMValueRef
 emit_fetch_64bit(
    struct lp_build_nir_context * bld_base,
@@ -293,6 +345,16 @@ emit_mask_scatter(struct lp_build_nir_soa_context *bld,
    }
 }
 
+static LLVMValueRef
+get_input(struct lp_build_nir_soa_context *bld,
+          unsigned attrib, unsigned chan)
+{
+   if (bld->fs_iface && bld->fs_iface->load_input)
+      return bld->fs_iface->load_input(bld->fs_iface, &bld->bld_base.base,
+                                       attrib, chan);
+   return bld->inputs[attrib][chan];
+}
+
 static void emit_load_var(struct lp_build_nir_context *bld_base,
                            nir_variable_mode deref_mode,
                            unsigned num_components,
@@ -413,11 +475,11 @@ static void emit_load_var(struct lp_build_nir_context *bld_base,
                } else {
                   if (bit_size == 64) {
                      LLVMValueRef tmp[2];
-                     tmp[0] = bld->inputs[var->data.driver_location + const_index][idx];
-                     tmp[1] = bld->inputs[var->data.driver_location + const_index][idx + 1];
+                     tmp[0] = get_input(bld, var->data.driver_location + const_index, idx);
+                     tmp[1] = get_input(bld, var->data.driver_location + const_index, idx + 1);
                      result[i] = emit_fetch_64bit(bld_base, tmp[0], tmp[1]);
                   } else {
-                     result[i] = bld->inputs[var->data.driver_location + const_index][idx];
+                     result[i] = get_input(bld, var->data.driver_location + const_index, idx);
                   }
                }
             }
@@ -598,6 +660,53 @@ static void emit_store_var(struct lp_build_nir_context *bld_base,
    }
 }
 
+/*
+ * For a register array accessed at the same element by all invocations:
+ * the element index, read from the first active invocation and clamped like
+ * the gathers' indices are.
+ */
+static LLVMValueRef
+get_uniform_reg_index(struct lp_build_nir_context *bld_base,
+                      nir_register *reg, unsigned base_offset,
+                      LLVMValueRef indir_src)
+{
+   struct lp_build_nir_soa_context *bld = (struct lp_build_nir_soa_context *)bld_base;
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef index = lp_build_const_int32(gallivm, base_offset);
+
+   if (indir_src) {
+      LLVMValueRef max_index = lp_build_const_int32(gallivm, reg->num_array_elems - 1);
+      index = LLVMBuildAdd(builder, index,
+                           LLVMBuildExtractElement(builder, indir_src,
+                                                   first_active_invocation(bld_base), ""), "");
+      index = lp_build_min(&bld->uint_elem_bld, index, max_index);
+   }
+   return index;
+}
+
+/*
+ * The vector of one channel of a register array element, as laid out by
+ * get_soa_array_offsets().
+ */
+static LLVMValueRef
+get_uniform_reg_chan_ptr(struct lp_build_nir_context *bld_base,
+                         struct lp_build_context *reg_bld,
+                         LLVMValueRef reg_storage, LLVMValueRef index,
+                         unsigned num_components, unsigned chan)
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef offset;
+
+   offset = LLVMBuildMul(builder, index, lp_build_const_int32(gallivm, num_components), "");
+   offset = LLVMBuildAdd(builder, offset, lp_build_const_int32(gallivm, chan), "");
+   offset = LLVMBuildMul(builder, offset, lp_build_const_int32(gallivm, reg_bld->type.length), "");
+   return LLVMBuildBitCast(builder,
+                           LLVMBuildGEP(builder, reg_storage, &offset, 1, ""),
+                           LLVMPointerType(reg_bld->vec_type, 0), "");
+}
+
 static LLVMValueRef emit_load_reg(struct lp_build_nir_context *bld_base,
                                   struct lp_build_context *reg_bld,
                                   const nir_reg_src *reg,
@@ -609,7 +718,17 @@ static LLVMValueRef emit_load_reg(struct lp_build_nir_context *bld_base,
    int nc = reg->reg->num_components;
    LLVMValueRef vals[NIR_MAX_VEC_COMPONENTS] = { NULL };
    struct lp_build_context *uint_bld = &bld_base->uint_bld;
-   if (reg->reg->num_array_elems) {
+   if (reg->reg->num_array_elems &&
+       (!reg->indirect || lp_nir_src_is_uniform(*reg->indirect))) {
+      LLVMValueRef index = get_uniform_reg_index(bld_base, reg->reg, reg->base_offset,
+                                                 reg->indirect ? indir_src : NULL);
+      reg_storage = LLVMBuildBitCast(builder, reg_storage, LLVMPointerType(reg_bld->elem_type, 0), "");
+      for (unsigned i = 0; i < nc; i++) {
+         vals[i] = LLVMBuildLoad(builder,
+                                 get_uniform_reg_chan_ptr(bld_base, reg_bld, reg_storage,
+                                                          index, nc, i), "");
+      }
+   } else if (reg->reg->num_array_elems) {
       LLVMValueRef indirect_val = lp_build_const_int_vec(gallivm, uint_bld->type, reg->base_offset);
       if (reg->indirect) {
          LLVMValueRef max_index = lp_build_const_int_vec(gallivm, uint_bld->type, reg->reg->num_array_elems - 1);
@@ -644,6 +763,22 @@ static void emit_store_reg(struct lp_build_nir_context *bld_base,
    LLVMBuilderRef builder = gallivm->builder;
    struct lp_build_context *uint_bld = &bld_base->uint_bld;
    int nc = reg->reg->num_components;
+   if (reg->reg->num_array_elems > 0 &&
+       (!reg->indirect || lp_nir_src_is_uniform(*reg->indirect))) {
+      LLVMValueRef index = get_uniform_reg_index(bld_base, reg->reg, reg->base_offset,
+                                                 reg->indirect ? indir_src : NULL);
+      reg_storage = LLVMBuildBitCast(builder, reg_storage, LLVMPointerType(reg_bld->elem_type, 0), "");
+      for (unsigned i = 0; i < nc; i++) {
+         if (!(writemask & (1 << i)))
+            continue;
+         dst[i] = LLVMBuildBitCast(builder, dst[i], reg_bld->vec_type, "");
+         lp_exec_mask_store(&bld->exec_mask, reg_bld, dst[i],
+                            get_uniform_reg_chan_ptr(bld_base, reg_bld, reg_storage,
+                                                     index, nc, i));
+      }
+      return;
+   }
+
    if (reg->reg->num_array_elems > 0) {
       LLVMValueRef indirect_val = lp_build_const_int_vec(gallivm, uint_bld->type, reg->base_offset);
       if (reg->indirect) {
@@ -730,6 +865,13 @@ static LLVMValueRef global_addr_to_ptr(struct gallivm_state *gallivm, LLVMValueR
    return addr_ptr;
 }
 
+static LLVMValueRef global_addr_to_ptr_vec(struct gallivm_state *gallivm, LLVMValueRef addr_ptrs,
+                                           unsigned bit_size, unsigned length)
+{
+   LLVMTypeRef ptr_type = LLVMPointerType(LLVMIntTypeInContext(gallivm->context, bit_size), 0);
+   return LLVMBuildIntToPtr(gallivm->builder, addr_ptrs, LLVMVectorType(ptr_type, length), "");
+}
+
 static void emit_load_global(struct lp_build_nir_context *bld_base,
                              unsigned nc,
                              unsigned bit_size,
@@ -744,6 +886,19 @@ static void emit_load_global(struct lp_build_nir_context *bld_base,
 
    res_bld = get_int_bld(bld_base, true, bit_size);
 
+   if (lp_has_masked_gather(bit_size)) {
+      LLVMValueRef ptrs = global_addr_to_ptr_vec(gallivm, addr, bit_size, uint_bld->type.length);
+      LLVMValueRef exec_mask = mask_vec(bld_base);
+
+      for (unsigned c = 0; c < nc; c++) {
+         LLVMValueRef chan = lp_build_const_int32(gallivm, c);
+         LLVMValueRef chan_ptrs = LLVMBuildGEP(builder, ptrs, &chan, 1, "");
+         outval[c] = lp_build_masked_gather(gallivm, uint_bld->type.length, bit_size,
+                                            chan_ptrs, exec_mask);
+      }
+      return;
+   }
+
    for (unsigned c = 0; c < nc; c++) {
       LLVMValueRef result = lp_build_alloca(gallivm, res_bld->vec_type, "");
 
@@ -783,6 +938,15 @@ static void emit_store_global(struct lp_build_nir_context *bld_base,
       LLVMValueRef val = (nc == 1) ? dst : LLVMBuildExtractValue(builder, dst, c, "");
 
       LLVMValueRef exec_mask = mask_vec(bld_base);
+      if (lp_has_masked_scatter(bit_size)) {
+         LLVMValueRef chan = lp_build_const_int32(gallivm, c);
+         LLVMValueRef ptrs = global_addr_to_ptr_vec(gallivm, addr, bit_size, uint_bld->type.length);
+         ptrs = LLVMBuildGEP(builder, ptrs, &chan, 1, "");
+         val = LLVMBuildBitCast(builder, val, get_int_bld(bld_base, true, bit_size)->vec_type, "");
+         lp_build_masked_scatter(gallivm, uint_bld->type.length, bit_size, ptrs, val, exec_mask);
+         continue;
+      }
+
       struct lp_build_loop_state loop_state;
       lp_build_loop_begin(&loop_state, gallivm, lp_build_const_int32(gallivm, 0));
       LLVMValueRef value_ptr = LLVMBuildExtractElement(gallivm->builder, val,
@@ -932,12 +1096,19 @@ static void emit_load_ubo(struct lp_build_nir_context *bld_base,
    }
 
    if (offset_is_uniform) {
-      offset = LLVMBuildExtractElement(builder, offset, lp_build_const_int32(gallivm, 0), "");
+      LLVMValueRef num_consts = lp_build_array_get(gallivm, bld->const_sizes_ptr, index);
+      LLVMValueRef zero = lp_build_const_int32(gallivm, 0);
+
+      offset = LLVMBuildExtractElement(builder, offset, first_active_invocation(bld_base), "");
 
       for (unsigned c = 0; c < nc; c++) {
          LLVMValueRef this_offset = LLVMBuildAdd(builder, offset, lp_build_const_int32(gallivm, c), "");
+         LLVMValueRef overflow = LLVMBuildICmp(builder, LLVMIntUGE, this_offset, num_consts, "");
 
+         /* Out of bounds reads return 0, like build_gather() does. */
+         this_offset = LLVMBuildSelect(builder, overflow, zero, this_offset, "");
          LLVMValueRef scalar = lp_build_pointer_get(builder, consts_ptr, this_offset);
+         scalar = LLVMBuildSelect(builder, overflow, LLVMConstNull(LLVMTypeOf(scalar)), scalar, "");
          result[c] = lp_build_broadcast_scalar(bld_broad, scalar);
       }
    } else {
@@ -958,6 +1129,7 @@ static void emit_load_ubo(struct lp_build_nir_context *bld_base,
 static void emit_load_mem(struct lp_build_nir_context *bld_base,
                           unsigned nc,
                           unsigned bit_size,
+                          bool offset_is_uniform,
                           LLVMValueRef index,
                           LLVMValueRef offset,
                           LLVMValueRef outval[NIR_MAX_VEC_COMPONENTS])
@@ -969,17 +1141,50 @@ static void emit_load_mem(struct lp_build_nir_context *bld_base,
    struct lp_build_context *uint_bld = &bld_base->uint_bld;
    struct lp_build_context *uint64_bld = &bld_base->uint64_bld;
    LLVMValueRef ssbo_limit = NULL;
+   LLVMValueRef ssbo_limit_scalar = NULL;
 
    if (index) {
       LLVMValueRef ssbo_size_ptr = lp_build_array_get(gallivm, bld->ssbo_sizes_ptr, LLVMBuildExtractElement(builder, index, lp_build_const_int32(gallivm, 0), ""));
-      ssbo_limit = LLVMBuildAShr(gallivm->builder, ssbo_size_ptr, lp_build_const_int32(gallivm, bit_size == 64 ? 3 : 2), "");
-      ssbo_limit = lp_build_broadcast_scalar(uint_bld, ssbo_limit);
+      ssbo_limit_scalar = LLVMBuildAShr(gallivm->builder, ssbo_size_ptr, lp_build_const_int32(gallivm, bit_size == 64 ? 3 : 2), "");
+      ssbo_limit = lp_build_broadcast_scalar(uint_bld, ssbo_limit_scalar);
 
       ssbo_ptr = lp_build_array_get(gallivm, bld->ssbo_ptr, LLVMBuildExtractElement(builder, index, lp_build_const_int32(gallivm, 0), ""));
    } else
       ssbo_ptr = bld->shared_ptr;
 
    offset = LLVMBuildAShr(gallivm->builder, offset, lp_build_const_int_vec(gallivm, uint_bld->type, bit_size == 64 ? 3 : 2), "");
+
+   /* One load for all invocations, if any is active and in bounds. */
+   if (offset_is_uniform) {
+      struct lp_build_context *load_bld = bit_size == 64 ? uint64_bld : uint_bld;
+      LLVMValueRef bits = active_invocation_bits(bld_base);
+      LLVMValueRef any_active = bits ?
+         LLVMBuildICmp(builder, LLVMIntNE, bits, lp_build_const_int32(gallivm, 0), "") :
+         LLVMConstInt(LLVMInt1TypeInContext(gallivm->context), 1, 0);
+
+      if (bit_size == 64)
+         ssbo_ptr = LLVMBuildBitCast(builder, ssbo_ptr, LLVMPointerType(uint64_bld->elem_type, 0), "");
+      offset = LLVMBuildExtractElement(builder, offset, first_active_invocation(bld_base), "");
+
+      for (unsigned c = 0; c < nc; c++) {
+         LLVMValueRef chan_offset = LLVMBuildAdd(builder, offset, lp_build_const_int32(gallivm, c), "");
+         LLVMValueRef cond = any_active;
+         LLVMValueRef result = lp_build_alloca(gallivm, load_bld->elem_type, "");
+         struct lp_build_if_state ifthen;
+
+         if (ssbo_limit_scalar)
+            cond = LLVMBuildAnd(builder, cond,
+                                LLVMBuildICmp(builder, LLVMIntULT, chan_offset, ssbo_limit_scalar, ""), "");
+
+         LLVMBuildStore(builder, LLVMConstNull(load_bld->elem_type), result);
+         lp_build_if(&ifthen, gallivm, cond);
+         LLVMBuildStore(builder, lp_build_pointer_get(builder, ssbo_ptr, chan_offset), result);
+         lp_build_endif(&ifthen);
+         outval[c] = lp_build_broadcast_scalar(load_bld, LLVMBuildLoad(builder, result, ""));
+      }
+      return;
+   }
+
    for (unsigned c = 0; c < nc; c++) {
       LLVMValueRef loop_index = lp_build_add(uint_bld, offset, lp_build_const_int_vec(gallivm, uint_bld->type, c));
       LLVMValueRef exec_mask = mask_vec(bld_base);
@@ -989,6 +1194,16 @@ static void emit_load_mem(struct lp_build_nir_context *bld_base,
          exec_mask = LLVMBuildAnd(builder, exec_mask, ssbo_oob_cmp, "");
       }
 
+      if (lp_has_masked_gather(bit_size)) {
+         LLVMValueRef base_ptr = ssbo_ptr;
+         if (bit_size == 64)
+            base_ptr = LLVMBuildBitCast(builder, ssbo_ptr, LLVMPointerType(uint64_bld->elem_type, 0), "");
+         LLVMValueRef ptrs = LLVMBuildGEP(builder, base_ptr, &loop_index, 1, "");
+         outval[c] = lp_build_masked_gather(gallivm, uint_bld->type.length, bit_size,
+                                            ptrs, exec_mask);
+         continue;
+      }
+
       LLVMValueRef result = lp_build_alloca(gallivm, bit_size == 64 ? uint64_bld->vec_type : uint_bld->vec_type, "");
       struct lp_build_loop_state loop_state;
       lp_build_loop_begin(&loop_state, gallivm, lp_build_const_int32(gallivm, 0));
@@ -1065,6 +1280,17 @@ static void emit_store_mem(struct lp_build_nir_context *bld_base,
          exec_mask = LLVMBuildAnd(builder, exec_mask, ssbo_oob_cmp, "");
       }
 
+      if (lp_has_masked_scatter(bit_size)) {
+         struct lp_build_context *store_bld = bit_size == 64 ? &bld_base->uint64_bld : uint_bld;
+         LLVMValueRef base_ptr = ssbo_ptr;
+         if (bit_size == 64)
+            base_ptr = LLVMBuildBitCast(builder, ssbo_ptr, LLVMPointerType(store_bld->elem_type, 0), "");
+         LLVMValueRef ptrs = LLVMBuildGEP(builder, base_ptr, &loop_index, 1, "");
+         val = LLVMBuildBitCast(builder, val, store_bld->vec_type, "");
+         lp_build_masked_scatter(gallivm, uint_bld->type.length, bit_size, ptrs, val, exec_mask);
+         continue;
+      }
+
       struct lp_build_loop_state loop_state;
       lp_build_loop_begin(&loop_state, gallivm, lp_build_const_int32(gallivm, 0));
       LLVMValueRef value_ptr = LLVMBuildExtractElement(gallivm->builder, val,
@@ -1484,6 +1710,21 @@ static void emit_sysval_intrin(struct lp_build_nir_context *bld_base,
    case nir_intrinsic_load_sample_mask_in:
       result[0] = bld->system_values.sample_mask_in;
       break;
+   case nir_intrinsic_load_subgroup_size:
+      result[0] = lp_build_const_int_vec(gallivm, bld_base->uint_bld.type,
+                                         bld_base->uint_bld.type.length);
+      break;
+   case nir_intrinsic_load_subgroup_invocation: {
+      LLVMValueRef elems[LP_MAX_VECTOR_LENGTH];
+      for (unsigned i = 0; i < bld_base->uint_bld.type.length; i++)
+         elems[i] = lp_build_const_int32(gallivm, i);
+      result[0] = LLVMConstVector(elems, bld_base->uint_bld.type.length);
+      break;
+   }
+   case nir_intrinsic_first_invocation:
+      result[0] = lp_build_broadcast_scalar(&bld_base->uint_bld,
+                                            first_active_invocation(bld_base));
+      break;
    }
 }
 
@@ -1495,35 +1736,163 @@ static void emit_helper_invocation(struct lp_build_nir_context *bld_base,
    *dst = lp_build_cmp(uint_bld, PIPE_FUNC_NOTEQUAL, mask_vec(bld_base), lp_build_const_int_vec(gallivm, uint_bld->type, -1));
 }
 
-static void bgnloop(struct lp_build_nir_context *bld_base)
+/*
+ * Branch around a masked body when no invocation is active at its start,
+ * saving the exec mask to put back at skip_end().  Returns false if there
+ * is no mask to test.
+ */
+static bool skip_begin(struct lp_build_nir_context *bld_base,
+                       struct lp_build_if_state *branch,
+                       struct lp_exec_mask *saved)
+{
+   struct lp_build_nir_soa_context *bld = (struct lp_build_nir_soa_context *)bld_base;
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMValueRef bits = active_invocation_bits(bld_base);
+
+   if (!bits)
+      return false;
+
+   *saved = bld->exec_mask;
+   lp_build_if(branch, gallivm,
+               LLVMBuildICmp(gallivm->builder, LLVMIntNE, bits,
+                             lp_build_const_int32(gallivm, 0), ""));
+   return true;
+}
+
+static void skip_end(struct lp_build_nir_context *bld_base,
+                     struct lp_build_if_state *branch,
+                     struct lp_exec_mask *saved)
+{
+   struct lp_build_nir_soa_context *bld = (struct lp_build_nir_soa_context *)bld_base;
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+
+   if (bld->skipped_bodies) {
+      LLVMValueRef ptr = lp_build_const_int_pointer(gallivm, bld->skipped_bodies);
+
+      lp_build_else(branch);
+      ptr = LLVMBuildBitCast(gallivm->builder, ptr,
+                             LLVMPointerType(LLVMInt64TypeInContext(gallivm->context), 0),
+                             "");
+      LLVMBuildAtomicRMW(gallivm->builder, LLVMAtomicRMWBinOpAdd, ptr,
+                         LLVMConstInt(LLVMInt64TypeInContext(gallivm->context), 1, 0),
+                         LLVMAtomicOrderingMonotonic, false);
+      if (gallivm->cache)
+         gallivm->cache->dont_cache = true;
+   }
+   lp_build_endif(branch);
+   bld->exec_mask = *saved;
+}
+
+static void bgnloop(struct lp_build_nir_context *bld_base, bool skip)
 {
    struct lp_build_nir_soa_context *bld = (struct lp_build_nir_soa_context *)bld_base;
+   unsigned depth = bld->loop_stack_size++;
+
+   if (depth < LP_MAX_TGSI_NESTING)
+      bld->loop_stack[depth].skip = skip &&
+         skip_begin(bld_base, &bld->loop_stack[depth].branch,
+                    &bld->loop_stack[depth].exec_mask);
    lp_exec_bgnloop(&bld->exec_mask, true);
 }
 
 static void endloop(struct lp_build_nir_context *bld_base)
 {
    struct lp_build_nir_soa_context *bld = (struct lp_build_nir_soa_context *)bld_base;
+   unsigned depth = --bld->loop_stack_size;
+
    lp_exec_endloop(bld_base->base.gallivm, &bld->exec_mask);
+   if (depth < LP_MAX_TGSI_NESTING && bld->loop_stack[depth].skip)
+      skip_end(bld_base, &bld->loop_stack[depth].branch,
+               &bld->loop_stack[depth].exec_mask);
 }
 
-static void if_cond(struct lp_build_nir_context *bld_base, LLVMValueRef cond)
+/*
+ * A uniform if branches on the first active invocation's condition instead
+ * of narrowing the exec mask, so the side not taken is skipped.  Anything
+ * inside may still rebuild the mask values, so they are put back at the
+ * else and the endif.  A divergent if may still skip a side no invocation
+ * takes, if lp_bld_nir.c found it big enough to be worth the test.
+ */
+static void if_cond(struct lp_build_nir_context *bld_base, LLVMValueRef cond,
+                    bool uniform, bool skip)
 {
-   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
    struct lp_build_nir_soa_context *bld = (struct lp_build_nir_soa_context *)bld_base;
+   unsigned depth = bld->if_stack_size++;
+
+   if (depth >= LP_MAX_TGSI_NESTING)
+      uniform = false;
+   else
+      bld->if_stack[depth].uniform = uniform;
+
+   if (uniform) {
+      LLVMValueRef scalar = LLVMBuildExtractElement(builder, cond,
+                                                    first_active_invocation(bld_base), "");
+      scalar = LLVMBuildICmp(builder, LLVMIntNE, scalar,
+                             LLVMConstNull(LLVMTypeOf(scalar)), "");
+      bld->if_stack[depth].exec_mask = bld->exec_mask;
+      lp_build_if(&bld->if_stack[depth].branch, gallivm, scalar);
+      return;
+   }
+
    lp_exec_mask_cond_push(&bld->exec_mask, LLVMBuildBitCast(builder, cond, bld_base->base.int_vec_type, ""));
+   if (depth < LP_MAX_TGSI_NESTING)
+      bld->if_stack[depth].skip = skip &&
+         skip_begin(bld_base, &bld->if_stack[depth].branch,
+                    &bld->if_stack[depth].exec_mask);
 }
 
-static void else_stmt(struct lp_build_nir_context *bld_base)
+static bool if_is_uniform(struct lp_build_nir_soa_context *bld)
+{
+   unsigned depth = bld->if_stack_size - 1;
+
+   return depth < LP_MAX_TGSI_NESTING && bld->if_stack[depth].uniform;
+}
+
+static bool if_is_skipped(struct lp_build_nir_soa_context *bld)
+{
+   unsigned depth = bld->if_stack_size - 1;
+
+   return depth < LP_MAX_TGSI_NESTING && bld->if_stack[depth].skip;
+}
+
+static void else_stmt(struct lp_build_nir_context *bld_base, bool skip)
 {
    struct lp_build_nir_soa_context *bld = (struct lp_build_nir_soa_context *)bld_base;
+   unsigned depth = bld->if_stack_size - 1;
+
+   if (if_is_uniform(bld)) {
+      bld->exec_mask = bld->if_stack[depth].exec_mask;
+      lp_build_else(&bld->if_stack[depth].branch);
+      return;
+   }
+
+   if (if_is_skipped(bld))
+      skip_end(bld_base, &bld->if_stack[depth].branch,
+               &bld->if_stack[depth].exec_mask);
    lp_exec_mask_cond_invert(&bld->exec_mask);
+   if (depth < LP_MAX_TGSI_NESTING)
+      bld->if_stack[depth].skip = skip &&
+         skip_begin(bld_base, &bld->if_stack[depth].branch,
+                    &bld->if_stack[depth].exec_mask);
 }
 
 static void endif_stmt(struct lp_build_nir_context *bld_base)
 {
    struct lp_build_nir_soa_context *bld = (struct lp_build_nir_soa_context *)bld_base;
-   lp_exec_mask_cond_pop(&bld->exec_mask);
+   unsigned depth = bld->if_stack_size - 1;
+
+   if (if_is_uniform(bld)) {
+      bld->exec_mask = bld->if_stack[depth].exec_mask;
+      lp_build_endif(&bld->if_stack[depth].branch);
+   } else {
+      if (if_is_skipped(bld))
+         skip_end(bld_base, &bld->if_stack[depth].branch,
+                  &bld->if_stack[depth].exec_mask);
+      lp_exec_mask_cond_pop(&bld->exec_mask);
+   }
+   bld->if_stack_size--;
 }
 
 static void break_stmt(struct lp_build_nir_context *bld_base)
@@ -1691,7 +2060,7 @@ emit_prologue(struct lp_build_nir_soa_context *bld)
             LLVMValueRef input_ptr =
                LLVMBuildGEP(gallivm->builder, bld->inputs_array,
                             &lindex, 1, "");
-            LLVMValueRef value = bld->inputs[index][chan];
+            LLVMValueRef value = get_input(bld, index, chan);
             if (value)
                LLVMBuildStore(gallivm->builder, value, input_ptr);
          }
@@ -1755,6 +2124,201 @@ static void emit_vote(struct lp_build_nir_context *bld_base, LLVMValueRef src, n
    result[0] = lp_build_broadcast_scalar(&bld_base->uint_bld, LLVMBuildLoad(builder, res_store, ""));
 }
 
+/*
+ * Subgroups are the lanes of the SIMD vector, so the cross-invocation
+ * operations below are all shuffles and selects within one register.
+ */
+static void emit_ballot(struct lp_build_nir_context *bld_base, LLVMValueRef src, LLVMValueRef result[4])
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef exec_mask = mask_vec(bld_base);
+   LLVMValueRef bits;
+
+   if (exec_mask)
+      src = LLVMBuildAnd(builder, src, exec_mask, "");
+   bits = LLVMBuildICmp(builder, LLVMIntNE, src, bld_base->int_bld.zero, "");
+   bits = LLVMBuildBitCast(builder, bits,
+                           LLVMIntTypeInContext(gallivm->context,
+                                                bld_base->uint_bld.type.length),
+                           "");
+   bits = LLVMBuildZExt(builder, bits, bld_base->uint_bld.elem_type, "");
+   result[0] = lp_build_broadcast_scalar(&bld_base->uint_bld, bits);
+}
+
+static void emit_read_invocation(struct lp_build_nir_context *bld_base,
+                                 LLVMValueRef src,
+                                 LLVMValueRef invoc,
+                                 LLVMValueRef result[4])
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef idx = first_active_invocation(bld_base);
+
+   /* The index is dynamically uniform, so any active lane holds it. */
+   if (invoc) {
+      idx = LLVMBuildExtractElement(builder, invoc, idx, "");
+      idx = LLVMBuildAnd(builder, idx,
+                         lp_build_const_int32(gallivm, bld_base->uint_bld.type.length - 1), "");
+   }
+   result[0] = lp_build_broadcast(gallivm, LLVMTypeOf(src),
+                                  LLVMBuildExtractElement(builder, src, idx, ""));
+}
+
+static void emit_shuffle(struct lp_build_nir_context *bld_base,
+                         LLVMValueRef src,
+                         LLVMValueRef index,
+                         LLVMValueRef result[4])
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   unsigned length = bld_base->uint_bld.type.length;
+   LLVMValueRef lane_mask = lp_build_const_int32(gallivm, length - 1);
+   LLVMValueRef res = LLVMGetUndef(LLVMTypeOf(src));
+
+   for (unsigned i = 0; i < length; i++) {
+      LLVMValueRef lane = lp_build_const_int32(gallivm, i);
+      LLVMValueRef idx = LLVMBuildExtractElement(builder, index, lane, "");
+      idx = LLVMBuildAnd(builder, idx, lane_mask, "");
+      res = LLVMBuildInsertElement(builder, res,
+                                   LLVMBuildExtractElement(builder, src, idx, ""),
+                                   lane, "");
+   }
+   result[0] = res;
+}
+
+static struct lp_build_context *
+reduce_bld(struct lp_build_nir_context *bld_base, nir_op op, unsigned bit_size)
+{
+   switch (op) {
+   case nir_op_fadd:
+   case nir_op_fmul:
+   case nir_op_fmin:
+   case nir_op_fmax:
+      return get_flt_bld(bld_base, bit_size);
+   case nir_op_imin:
+   case nir_op_imax:
+      return get_int_bld(bld_base, false, bit_size);
+   default:
+      return get_int_bld(bld_base, true, bit_size);
+   }
+}
+
+static LLVMValueRef
+reduce_identity(struct lp_build_context *bld, nir_op op, unsigned bit_size)
+{
+   struct gallivm_state *gallivm = bld->gallivm;
+
+   switch (op) {
+   case nir_op_fmul:
+      return lp_build_const_vec(gallivm, bld->type, 1.0);
+   case nir_op_fmin:
+      return lp_build_const_vec(gallivm, bld->type, INFINITY);
+   case nir_op_fmax:
+      return lp_build_const_vec(gallivm, bld->type, -INFINITY);
+   case nir_op_imul:
+      return lp_build_const_int_vec(gallivm, bld->type, 1);
+   case nir_op_imin:
+      return lp_build_const_int_vec(gallivm, bld->type, (long long)(~0ull >> (65 - bit_size)));
+   case nir_op_imax:
+      return lp_build_const_int_vec(gallivm, bld->type, (long long)(~0ull << (bit_size - 1)));
+   case nir_op_umin:
+   case nir_op_iand:
+      return lp_build_const_int_vec(gallivm, bld->type, -1);
+   default:
+      return bld->zero;
+   }
+}
+
+static LLVMValueRef
+reduce_op(struct lp_build_context *bld, nir_op op, LLVMValueRef a, LLVMValueRef b)
+{
+   LLVMBuilderRef builder = bld->gallivm->builder;
+
+   switch (op) {
+   case nir_op_fadd:
+   case nir_op_iadd:
+      return lp_build_add(bld, a, b);
+   case nir_op_fmul:
+   case nir_op_imul:
+      return lp_build_mul(bld, a, b);
+   case nir_op_fmin:
+   case nir_op_imin:
+   case nir_op_umin:
+      return lp_build_min(bld, a, b);
+   case nir_op_fmax:
+   case nir_op_imax:
+   case nir_op_umax:
+      return lp_build_max(bld, a, b);
+   case nir_op_iand:
+      return LLVMBuildAnd(builder, a, b, "");
+   case nir_op_ior:
+      return LLVMBuildOr(builder, a, b, "");
+   case nir_op_ixor:
+      return LLVMBuildXor(builder, a, b, "");
+   default:
+      unreachable("unhandled subgroup reduction op");
+   }
+}
+
+static void emit_reduce(struct lp_build_nir_context *bld_base, LLVMValueRef src,
+                        nir_intrinsic_instr *instr, LLVMValueRef result[4])
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   unsigned length = bld_base->uint_bld.type.length;
+   unsigned bit_size = nir_src_bit_size(instr->src[0]);
+   nir_op op = nir_intrinsic_reduction_op(instr);
+   struct lp_build_context *bld = reduce_bld(bld_base, op, bit_size);
+   LLVMValueRef identity = reduce_identity(bld, op, bit_size);
+   LLVMValueRef exec_mask = mask_vec(bld_base);
+   LLVMValueRef shuffles[LP_MAX_VECTOR_LENGTH];
+   LLVMValueRef res = src;
+
+   /* Inactive lanes contribute the identity. */
+   if (exec_mask) {
+      LLVMValueRef cond = LLVMBuildICmp(builder, LLVMIntNE, exec_mask,
+                                        bld_base->uint_bld.zero, "");
+      res = LLVMBuildSelect(builder, cond, res, identity, "");
+   }
+
+   if (instr->intrinsic == nir_intrinsic_reduce) {
+      unsigned cluster_size = nir_intrinsic_cluster_size(instr);
+      if (cluster_size == 0 || cluster_size > length)
+         cluster_size = length;
+
+      /* Butterfly: every lane ends up with the reduction of its cluster. */
+      for (unsigned step = 1; step < cluster_size; step <<= 1) {
+         for (unsigned i = 0; i < length; i++)
+            shuffles[i] = lp_build_const_int32(gallivm, i ^ step);
+         res = reduce_op(bld, op, res,
+                         LLVMBuildShuffleVector(builder, res, res,
+                                                LLVMConstVector(shuffles, length), ""));
+      }
+   } else {
+      /* The exclusive scan is the inclusive scan of the input shifted up by
+       * one lane, with the identity shifted into lane 0.  Indices past the
+       * vector length select from the identity.
+       */
+      if (instr->intrinsic == nir_intrinsic_exclusive_scan) {
+         for (unsigned i = 0; i < length; i++)
+            shuffles[i] = lp_build_const_int32(gallivm, i == 0 ? length : i - 1);
+         res = LLVMBuildShuffleVector(builder, res, identity,
+                                      LLVMConstVector(shuffles, length), "");
+      }
+
+      /* Hillis-Steele: log2(length) shifted adds. */
+      for (unsigned step = 1; step < length; step <<= 1) {
+         for (unsigned i = 0; i < length; i++)
+            shuffles[i] = lp_build_const_int32(gallivm, i >= step ? i - step : length + i);
+         res = reduce_op(bld, op, res,
+                         LLVMBuildShuffleVector(builder, res, identity,
+                                                LLVMConstVector(shuffles, length), ""));
+      }
+   }
+   result[0] = res;
+}
+
 static void
 emit_interp_at(struct lp_build_nir_context *bld_base,
                unsigned num_components,
@@ -1784,6 +2348,8 @@ void lp_build_nir_soa(struct gallivm_state *gallivm,
    struct lp_type type = params->type;
    struct lp_type res_type;
 
+   const int64_t stats_start = nir_pass_stats_begin();
+
    assert(type.length <= LP_MAX_VECTOR_LENGTH);
    memset(&res_type, 0, sizeof res_type);
    res_type.width = type.width;
@@ -1870,6 +2436,10 @@ void lp_build_nir_soa(struct gallivm_state *gallivm,
    bld.bld_base.image_op = emit_image_op;
    bld.bld_base.image_size = emit_image_size;
    bld.bld_base.vote = emit_vote;
+   bld.bld_base.ballot = emit_ballot;
+   bld.bld_base.read_invocation = emit_read_invocation;
+   bld.bld_base.shuffle = emit_shuffle;
+   bld.bld_base.reduce = emit_reduce;
    bld.bld_base.helper_invocation = emit_helper_invocation;
    bld.bld_base.interp_at = emit_interp_at;
 
@@ -1889,6 +2459,7 @@ void lp_build_nir_soa(struct gallivm_state *gallivm,
    bld.shared_ptr = params->shared_ptr;
    bld.coro = params->coro;
    bld.kernel_args_ptr = params->kernel_args;
+   bld.skipped_bodies = params->skipped_bodies;
    bld.indirects = 0;
    if (params->info->indirect_files & (1 << TGSI_FILE_INPUT))
       bld.indirects |= nir_var_shader_in;
@@ -1940,4 +2511,8 @@ void lp_build_nir_soa(struct gallivm_state *gallivm,
       }
    }
    lp_exec_mask_fini(&bld.exec_mask);
+
+   if (stats_start)
+      nir_pass_stats_record("lp_build_nir_soa", shader->info.stage,
+                            stats_start, false);
 }
@@ -484,7 +484,8 @@ lp_build_unpack2_native(struct gallivm_state *gallivm,
 
    /* Interleave bits */
 #if UTIL_ARCH_LITTLE_ENDIAN
-   if (src_type.length * src_type.width == 256 && util_cpu_caps.has_avx2) {
+   if ((src_type.length * src_type.width == 256 && util_cpu_caps.has_avx2) ||
+       (src_type.length * src_type.width == 512 && lp_has_avx512())) {
       *dst_lo = lp_build_interleave2_half(gallivm, src_type, src, msb, 0);
       *dst_hi = lp_build_interleave2_half(gallivm, src_type, src, msb, 1);
    } else {
@@ -550,6 +551,65 @@ lp_build_unpack(struct gallivm_state *gallivm,
 }
 
 
+/**
+ * Non-interleaved pack with the AArch64 NEON saturating narrows, half a
+ * register at a time.  They saturate like the SSE2 packs do, signed
+ * inputs to the signed or unsigned destination range, and also have a
+ * variant for unsigned inputs.
+ */
+static LLVMValueRef
+lp_build_pack2_neon(struct gallivm_state *gallivm,
+                    struct lp_type src_type,
+                    struct lp_type dst_type,
+                    LLVMValueRef lo,
+                    LLVMValueRef hi)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_type part_type = dst_type;
+   LLVMTypeRef part_vec_type;
+   LLVMValueRef parts[LP_MAX_VECTOR_WIDTH / 64];
+   const unsigned part_length = 128 / src_type.width;
+   const unsigned num_split = src_type.length / part_length;
+   const char *intrinsic_root;
+   char intrinsic[48];
+   unsigned i;
+
+   assert(src_type.width * src_type.length >= 128);
+   assert(src_type.length % part_length == 0);
+
+   if (!src_type.sign)
+      intrinsic_root = "llvm.aarch64.neon.uqxtn";
+   else if (dst_type.sign)
+      intrinsic_root = "llvm.aarch64.neon.sqxtn";
+   else
+      intrinsic_root = "llvm.aarch64.neon.sqxtun";
+
+   lo = LLVMBuildBitCast(builder, lo, lp_build_vec_type(gallivm, src_type), "");
+   hi = LLVMBuildBitCast(builder, hi, lp_build_vec_type(gallivm, src_type), "");
+
+   part_type.length = part_length;
+   part_vec_type = lp_build_vec_type(gallivm, part_type);
+   lp_format_intrinsic(intrinsic, sizeof intrinsic, intrinsic_root,
+                       part_vec_type);
+
+   for (i = 0; i < num_split; i++) {
+      LLVMValueRef lo_part = lo, hi_part = hi;
+      if (num_split > 1) {
+         lo_part = lp_build_extract_range(gallivm, lo, i * part_length,
+                                          part_length);
+         hi_part = lp_build_extract_range(gallivm, hi, i * part_length,
+                                          part_length);
+      }
+      parts[i] = lp_build_intrinsic_unary(builder, intrinsic,
+                                          part_vec_type, lo_part);
+      parts[num_split + i] = lp_build_intrinsic_unary(builder, intrinsic,
+                                                      part_vec_type, hi_part);
+   }
+
+   return lp_build_concat(gallivm, parts, part_type, 2 * num_split);
+}
+
+
 /**
  * Non-interleaved pack.
  *
@@ -585,6 +645,12 @@ lp_build_pack2(struct gallivm_state *gallivm,
    assert(src_type.length * 2 == dst_type.length);
 
    /* Check for special cases first */
+   if (lp_has_neon64() &&
+       src_type.width * src_type.length >= 128 &&
+       src_type.width >= 16 && src_type.width <= 64) {
+      return lp_build_pack2_neon(gallivm, src_type, dst_type, lo, hi);
+   }
+
    if ((util_cpu_caps.has_sse2 || util_cpu_caps.has_altivec) &&
         src_type.width * src_type.length >= 128) {
       const char *intrinsic = NULL;
@@ -738,9 +804,29 @@ lp_build_pack2_native(struct gallivm_state *gallivm,
    assert(src_type.width == dst_type.width * 2);
    assert(src_type.length * 2 == dst_type.length);
 
-   /* At this point only have special case for avx2 */
-   if (src_type.length * src_type.width == 256 &&
-       util_cpu_caps.has_avx2) {
+   /* At this point only have special case for avx2 and avx512 */
+   if (LLVM_VERSION_MAJOR >= 6 &&
+       src_type.length * src_type.width == 512 &&
+       lp_has_avx512()) {
+      switch(src_type.width) {
+      case 32:
+         if (dst_type.sign) {
+            intrinsic = "llvm.x86.avx512.packssdw.512";
+         } else {
+            intrinsic = "llvm.x86.avx512.packusdw.512";
+         }
+         break;
+      case 16:
+         if (dst_type.sign) {
+            intrinsic = "llvm.x86.avx512.packsswb.512";
+         } else {
+            intrinsic = "llvm.x86.avx512.packuswb.512";
+         }
+         break;
+      }
+   }
+   else if (src_type.length * src_type.width == 256 &&
+            util_cpu_caps.has_avx2) {
       switch(src_type.width) {
       case 32:
          if (dst_type.sign) {
@@ -799,6 +885,12 @@ lp_build_packs2(struct gallivm_state *gallivm,
       (src_type.width == 32 || src_type.width == 16))
       clamp = FALSE;
 
+   /* Neither for the NEON ones, which also saturate unsigned inputs. */
+   if (lp_has_neon64() &&
+       src_type.width * src_type.length >= 128 &&
+       src_type.width >= 16 && src_type.width <= 64)
+      clamp = FALSE;
+
    if(clamp) {
       struct lp_build_context bld;
       unsigned dst_bits = dst_type.sign ? dst_type.width - 1 : dst_type.width;
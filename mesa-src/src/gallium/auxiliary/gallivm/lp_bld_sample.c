@@ -231,6 +231,12 @@ lp_sampler_static_sampler_state(struct lp_static_sampler_state *state,
    }
 
    state->normalized_coords = sampler->normalized_coords;
+
+   if (sampler->max_anisotropy > 1 &&
+       sampler->min_mip_filter != PIPE_TEX_MIPFILTER_NONE &&
+       sampler->min_img_filter == PIPE_TEX_FILTER_LINEAR) {
+      state->aniso = MIN2(sampler->max_anisotropy, 16);
+   }
 }
 
 
@@ -281,8 +287,7 @@ lp_build_rho(struct lp_build_sample_context *bld,
     * the messy cube maps for now) when requested.
     */
 
-   first_level = bld->dynamic_state->first_level(bld->dynamic_state, bld->gallivm,
-                                                 bld->context_ptr, texture_unit, NULL);
+   first_level = lp_build_sample_first_level(bld, texture_unit);
    first_level_vec = lp_build_broadcast_scalar(int_size_bld, first_level);
    int_size = lp_build_minify(int_size_bld, bld->int_size, first_level_vec, TRUE);
    float_size = lp_build_int_to_float(float_size_bld, int_size);
@@ -715,6 +720,110 @@ lp_build_ilog2_sqrt(struct lp_build_context *bld,
 }
 
 
+/**
+ * Compute the footprint of an anisotropic 2D lookup.
+ *
+ * The pixel footprint is approximated by the parallelogram spanned by the
+ * texel space derivatives.  Its longer side is covered by N isotropic
+ * lookups, N = min(ceil(Pmax / Pmin), aniso), each taken from the mip level
+ * matching Pmax / N rather than Pmax.
+ *
+ * \param out_lod  per element lod, without any lod bias
+ * \param out_num_samples  per element N, as float vector
+ * \param out_max_samples  the largest N as scalar int32
+ * \param out_axis  the major axis in normalized coords (s and t)
+ */
+void
+lp_build_aniso_footprint(struct lp_build_sample_context *bld,
+                         unsigned texture_unit,
+                         LLVMValueRef s,
+                         LLVMValueRef t,
+                         const struct lp_derivatives *derivs,
+                         LLVMValueRef *out_lod,
+                         LLVMValueRef *out_num_samples,
+                         LLVMValueRef *out_max_samples,
+                         LLVMValueRef out_axis[2])
+{
+   struct gallivm_state *gallivm = bld->gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_build_context *coord_bld = &bld->coord_bld;
+   struct lp_build_context *float_bld = &bld->float_bld;
+   LLVMValueRef index0 = lp_build_const_int32(gallivm, 0);
+   LLVMValueRef index1 = lp_build_const_int32(gallivm, 1);
+   LLVMValueRef first_level, int_size, float_size, width, height;
+   LLVMValueRef dsdx, dtdx, dsdy, dtdy, dudx, dvdx, dudy, dvdy;
+   LLVMValueRef px2, py2, x_major, pmax, pmin, ratio, num, lod, max_num;
+   LLVMValueRef tiny = lp_build_const_vec(gallivm, coord_bld->type,
+                                          1.0f / (1 << 20));
+   unsigned i;
+
+   assert(bld->dims == 2);
+   assert(bld->num_lods == coord_bld->type.length);
+
+   first_level = lp_build_sample_first_level(bld, texture_unit);
+   first_level = lp_build_broadcast_scalar(&bld->int_size_in_bld, first_level);
+   int_size = lp_build_minify(&bld->int_size_in_bld, bld->int_size, first_level, TRUE);
+   float_size = lp_build_int_to_float(&bld->float_size_in_bld, int_size);
+   width = lp_build_extract_broadcast(gallivm, bld->float_size_in_type,
+                                      coord_bld->type, float_size, index0);
+   height = lp_build_extract_broadcast(gallivm, bld->float_size_in_type,
+                                       coord_bld->type, float_size, index1);
+
+   if (derivs) {
+      dsdx = derivs->ddx[0];
+      dtdx = derivs->ddx[1];
+      dsdy = derivs->ddy[0];
+      dtdy = derivs->ddy[1];
+   }
+   else {
+      dsdx = lp_build_ddx(coord_bld, s);
+      dtdx = lp_build_ddx(coord_bld, t);
+      dsdy = lp_build_ddy(coord_bld, s);
+      dtdy = lp_build_ddy(coord_bld, t);
+   }
+
+   dudx = lp_build_mul(coord_bld, dsdx, width);
+   dvdx = lp_build_mul(coord_bld, dtdx, height);
+   dudy = lp_build_mul(coord_bld, dsdy, width);
+   dvdy = lp_build_mul(coord_bld, dtdy, height);
+
+   px2 = lp_build_mad(coord_bld, dudx, dudx, lp_build_mul(coord_bld, dvdx, dvdx));
+   py2 = lp_build_mad(coord_bld, dudy, dudy, lp_build_mul(coord_bld, dvdy, dvdy));
+
+   x_major = lp_build_cmp(coord_bld, PIPE_FUNC_GEQUAL, px2, py2);
+   pmax = lp_build_sqrt(coord_bld, lp_build_select(coord_bld, x_major, px2, py2));
+   pmin = lp_build_sqrt(coord_bld, lp_build_select(coord_bld, x_major, py2, px2));
+
+   /*
+    * No more lookups than the ratio of the axes, the sampler allows, or
+    * texels are covered along the major axis (so magnification stays at 1).
+    */
+   ratio = lp_build_div(coord_bld, pmax, lp_build_max(coord_bld, pmin, tiny));
+   ratio = lp_build_min(coord_bld, ratio,
+                        lp_build_const_vec(gallivm, coord_bld->type,
+                                           bld->static_sampler_state->aniso));
+   ratio = lp_build_min(coord_bld, ratio, pmax);
+   num = lp_build_max(coord_bld, lp_build_ceil(coord_bld, ratio), coord_bld->one);
+
+   lod = lp_build_div(coord_bld, pmax, num);
+   lod = lp_build_fast_log2(coord_bld, lp_build_max(coord_bld, lod, tiny));
+
+   max_num = LLVMBuildExtractElement(builder, num, index0, "");
+   for (i = 1; i < coord_bld->type.length; i++) {
+      LLVMValueRef elem = LLVMBuildExtractElement(builder, num,
+                                                  lp_build_const_int32(gallivm, i), "");
+      max_num = lp_build_max(float_bld, max_num, elem);
+   }
+
+   *out_lod = lod;
+   *out_num_samples = num;
+   *out_max_samples = LLVMBuildFPToSI(builder, max_num,
+                                      LLVMInt32TypeInContext(gallivm->context), "");
+   out_axis[0] = lp_build_select(coord_bld, x_major, dsdx, dsdy);
+   out_axis[1] = lp_build_select(coord_bld, x_major, dtdx, dtdy);
+}
+
+
 /**
  * Generate code to compute texture level of detail (lambda).
  * \param derivs  partial derivatives of (s, t, r, q) with respect to X and Y
@@ -779,7 +888,8 @@ lp_build_lod_selector(struct lp_build_sample_context *bld,
        */
       LLVMValueRef min_lod =
          dynamic_state->min_lod(dynamic_state, bld->gallivm,
-                                bld->context_ptr, sampler_unit);
+                                bld->context_ptr, sampler_unit,
+                                bld->sampler_unit_offset);
 
       lod = lp_build_broadcast_scalar(lodf_bld, min_lod);
    }
@@ -871,7 +981,8 @@ lp_build_lod_selector(struct lp_build_sample_context *bld,
       if (bld->static_sampler_state->lod_bias_non_zero) {
          LLVMValueRef sampler_lod_bias =
             dynamic_state->lod_bias(dynamic_state, bld->gallivm,
-                                    bld->context_ptr, sampler_unit);
+                                    bld->context_ptr, sampler_unit,
+                                    bld->sampler_unit_offset);
          sampler_lod_bias = lp_build_broadcast_scalar(lodf_bld,
                                                       sampler_lod_bias);
          lod = LLVMBuildFAdd(builder, lod, sampler_lod_bias, "sampler_lod_bias");
@@ -885,7 +996,8 @@ lp_build_lod_selector(struct lp_build_sample_context *bld,
       if (bld->static_sampler_state->apply_max_lod) {
          LLVMValueRef max_lod =
             dynamic_state->max_lod(dynamic_state, bld->gallivm,
-                                   bld->context_ptr, sampler_unit);
+                                   bld->context_ptr, sampler_unit,
+                                   bld->sampler_unit_offset);
          max_lod = lp_build_broadcast_scalar(lodf_bld, max_lod);
 
          lod = lp_build_min(lodf_bld, lod, max_lod);
@@ -893,7 +1005,8 @@ lp_build_lod_selector(struct lp_build_sample_context *bld,
       if (bld->static_sampler_state->apply_min_lod) {
          LLVMValueRef min_lod =
             dynamic_state->min_lod(dynamic_state, bld->gallivm,
-                                   bld->context_ptr, sampler_unit);
+                                   bld->context_ptr, sampler_unit,
+                                   bld->sampler_unit_offset);
          min_lod = lp_build_broadcast_scalar(lodf_bld, min_lod);
 
          lod = lp_build_max(lodf_bld, lod, min_lod);
@@ -948,10 +1061,10 @@ lp_build_nearest_mip_level(struct lp_build_sample_context *bld,
    struct lp_sampler_dynamic_state *dynamic_state = bld->dynamic_state;
    LLVMValueRef first_level, last_level, level;
 
-   first_level = dynamic_state->first_level(dynamic_state, bld->gallivm,
-                                            bld->context_ptr, texture_unit, NULL);
+   first_level = lp_build_sample_first_level(bld, texture_unit);
    last_level = dynamic_state->last_level(dynamic_state, bld->gallivm,
-                                          bld->context_ptr, texture_unit, NULL);
+                                          bld->context_ptr, texture_unit,
+                                          bld->texture_unit_offset);
    first_level = lp_build_broadcast_scalar(leveli_bld, first_level);
    last_level = lp_build_broadcast_scalar(leveli_bld, last_level);
 
@@ -1010,10 +1123,10 @@ lp_build_linear_mip_levels(struct lp_build_sample_context *bld,
 
    assert(bld->num_lods == bld->num_mips);
 
-   first_level = dynamic_state->first_level(dynamic_state, bld->gallivm,
-                                            bld->context_ptr, texture_unit, NULL);
+   first_level = lp_build_sample_first_level(bld, texture_unit);
    last_level = dynamic_state->last_level(dynamic_state, bld->gallivm,
-                                          bld->context_ptr, texture_unit, NULL);
+                                          bld->context_ptr, texture_unit,
+                                          bld->texture_unit_offset);
    first_level = lp_build_broadcast_scalar(leveli_bld, first_level);
    last_level = lp_build_broadcast_scalar(leveli_bld, last_level);
 
@@ -1129,6 +1242,23 @@ lp_build_get_mip_offsets(struct lp_build_sample_context *bld,
 }
 
 
+/**
+ * The texture's first level, which is 0 when its size is constant, see
+ * lp_static_texture_state::const_size.
+ */
+LLVMValueRef
+lp_build_sample_first_level(struct lp_build_sample_context *bld,
+                            unsigned texture_unit)
+{
+   if (bld->static_texture_state->const_size)
+      return lp_build_const_int32(bld->gallivm, 0);
+
+   return bld->dynamic_state->first_level(bld->dynamic_state, bld->gallivm,
+                                          bld->context_ptr, texture_unit,
+                                          bld->texture_unit_offset);
+}
+
+
 /**
  * Codegen equivalent for u_minify().
  * @param lod_scalar  if lod is a (broadcasted) scalar
@@ -1358,9 +1488,20 @@ lp_build_mipmap_level_sizes(struct lp_build_sample_context *bld,
    }
 
    if (dims >= 2) {
-      *row_stride_vec = lp_build_get_level_stride_vec(bld,
-                                                      bld->row_stride_array,
-                                                      ilevel);
+      const struct lp_static_texture_state *state = bld->static_texture_state;
+
+      if (state->const_size) {
+         unsigned row_stride =
+            (bld->format_desc->block.bits / 8) << state->width_log2;
+         *row_stride_vec = lp_build_const_int_vec(bld->gallivm,
+                                                  bld->int_coord_bld.type,
+                                                  row_stride);
+      }
+      else {
+         *row_stride_vec = lp_build_get_level_stride_vec(bld,
+                                                         bld->row_stride_array,
+                                                         ilevel);
+      }
    }
    if (dims == 3 || has_layer_coord(bld->static_texture_state->target)) {
       *img_stride_vec = lp_build_get_level_stride_vec(bld,
@@ -2114,3 +2255,70 @@ lp_build_sample_offset(struct lp_build_context *bld,
 
    *out_offset = offset;
 }
+
+
+/**
+ * As lp_build_sample_offset(), for textures stored in 4x4 tiles, each in
+ * Morton order (see lp_static_texture_state::tiled), so that the texels
+ * of a bilinear footprint mostly share a cache line.  y_stride is the
+ * stride between rows of tiles.  Only for formats with 1x1 blocks.
+ */
+void
+lp_build_sample_tiled_offset(struct lp_build_context *bld,
+                             const struct util_format_description *format_desc,
+                             LLVMValueRef x,
+                             LLVMValueRef y,
+                             LLVMValueRef z,
+                             LLVMValueRef y_stride,
+                             LLVMValueRef z_stride,
+                             LLVMValueRef *out_offset,
+                             LLVMValueRef *out_i,
+                             LLVMValueRef *out_j)
+{
+   struct gallivm_state *gallivm = bld->gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef one = lp_build_const_int_vec(gallivm, bld->type, 1);
+   LLVMValueRef two = lp_build_const_int_vec(gallivm, bld->type, 2);
+   LLVMValueRef tile_shift = two;
+   LLVMValueRef texel, bits, offset;
+
+   assert(format_desc->block.width == 1 && format_desc->block.height == 1);
+
+   /* texel index in the row of tiles: tile x, then y1 x1 y0 x0 */
+   texel = LLVMBuildShl(builder,
+                        LLVMBuildLShr(builder, x, tile_shift, ""),
+                        lp_build_const_int_vec(gallivm, bld->type, 4), "");
+   bits = LLVMBuildAnd(builder, x, one, "");
+   texel = LLVMBuildOr(builder, texel, bits, "");
+   bits = LLVMBuildShl(builder, LLVMBuildAnd(builder, x, two, ""), one, "");
+   texel = LLVMBuildOr(builder, texel, bits, "");
+
+   if (y && y_stride) {
+      LLVMValueRef y_offset;
+
+      bits = LLVMBuildShl(builder, LLVMBuildAnd(builder, y, one, ""), one, "");
+      texel = LLVMBuildOr(builder, texel, bits, "");
+      bits = LLVMBuildShl(builder, LLVMBuildAnd(builder, y, two, ""), two, "");
+      texel = LLVMBuildOr(builder, texel, bits, "");
+
+      y_offset = lp_build_mul(bld, LLVMBuildLShr(builder, y, tile_shift, ""),
+                              y_stride);
+      offset = lp_build_mul(bld, texel,
+                            lp_build_const_int_vec(gallivm, bld->type,
+                                                   format_desc->block.bits/8));
+      offset = lp_build_add(bld, offset, y_offset);
+   }
+   else {
+      offset = lp_build_mul(bld, texel,
+                            lp_build_const_int_vec(gallivm, bld->type,
+                                                   format_desc->block.bits/8));
+   }
+
+   if (z && z_stride) {
+      offset = lp_build_add(bld, offset, lp_build_mul(bld, z, z_stride));
+   }
+
+   *out_offset = offset;
+   *out_i = bld->zero;
+   *out_j = bld->zero;
+}
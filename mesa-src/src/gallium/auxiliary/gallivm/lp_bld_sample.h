@@ -174,6 +174,20 @@ struct lp_static_texture_state
    unsigned pot_height:1;
    unsigned pot_depth:1;
    unsigned level_zero_only:1;
+   /**
+    * Texels are stored in 4x4 tiles, each in Morton (Z) order, and the
+    * row stride is that of rows of tiles.  Left to the driver to set.
+    */
+   unsigned tiled:1;
+   /**
+    * Level 0, the only level, is 1 << width_log2 by 1 << height_log2 texels
+    * with rows packed tight, so that the size, row stride and first level
+    * are constants in the code.  Only for 1D, 2D and RECT textures.  Left
+    * to the driver to set.
+    */
+   unsigned const_size:1;
+   unsigned width_log2:4;
+   unsigned height_log2:4;
 };
 
 
@@ -201,6 +215,12 @@ struct lp_static_sampler_state
    unsigned apply_min_lod:1;  /**< min_lod > 0 ? */
    unsigned apply_max_lod:1;  /**< max_lod < last_level ? */
    unsigned seamless_cube_map:1;
+   /**
+    * max_anisotropy, clamped to 16, or 0 if anisotropic filtering is off.
+    * Only honoured for mipmapped 2D minification, see
+    * lp_build_aniso_footprint().
+    */
+   unsigned aniso:5;
 
    /* Hacks */
    unsigned force_nearest_s:1;
@@ -306,28 +326,28 @@ struct lp_sampler_dynamic_state
    (*min_lod)(const struct lp_sampler_dynamic_state *state,
               struct gallivm_state *gallivm,
               LLVMValueRef context_ptr,
-              unsigned sampler_unit);
+              unsigned sampler_unit, LLVMValueRef sampler_unit_offset);
 
    /** Obtain texture max lod (returns float) */
    LLVMValueRef
    (*max_lod)(const struct lp_sampler_dynamic_state *state,
               struct gallivm_state *gallivm,
               LLVMValueRef context_ptr,
-              unsigned sampler_unit);
+              unsigned sampler_unit, LLVMValueRef sampler_unit_offset);
 
    /** Obtain texture lod bias (returns float) */
    LLVMValueRef
    (*lod_bias)(const struct lp_sampler_dynamic_state *state,
                struct gallivm_state *gallivm,
                LLVMValueRef context_ptr,
-               unsigned sampler_unit);
+               unsigned sampler_unit, LLVMValueRef sampler_unit_offset);
 
    /** Obtain texture border color (returns ptr to float[4]) */
    LLVMValueRef
    (*border_color)(const struct lp_sampler_dynamic_state *state,
                    struct gallivm_state *gallivm,
                    LLVMValueRef context_ptr,
-                   unsigned sampler_unit);
+                   unsigned sampler_unit, LLVMValueRef sampler_unit_offset);
 
    /** 
     * Obtain texture cache (returns ptr to lp_build_format_cache).
@@ -443,6 +463,14 @@ struct lp_build_sample_context
    LLVMValueRef border_color_clamped;
 
    LLVMValueRef context_ptr;
+
+   /**
+    * Runtime offsets (int32) added to the texture and sampler units, or
+    * NULL.  Set in sampling functions shared by the units with the same
+    * static state, see lp_build_sample_soa_func().
+    */
+   LLVMValueRef texture_unit_offset;
+   LLVMValueRef sampler_unit_offset;
 };
 
 /*
@@ -479,6 +507,7 @@ lp_is_simple_wrap_mode(unsigned mode)
    switch (mode) {
    case PIPE_TEX_WRAP_REPEAT:
    case PIPE_TEX_WRAP_CLAMP_TO_EDGE:
+   case PIPE_TEX_WRAP_MIRROR_REPEAT:
       return TRUE;
    default:
       return FALSE;
@@ -581,6 +610,17 @@ lp_build_lod_selector(struct lp_build_sample_context *bld,
                       LLVMValueRef *out_lod_fpart,
                       LLVMValueRef *out_lod_positive);
 
+void
+lp_build_aniso_footprint(struct lp_build_sample_context *bld,
+                         unsigned texture_unit,
+                         LLVMValueRef s,
+                         LLVMValueRef t,
+                         const struct lp_derivatives *derivs, /* optional */
+                         LLVMValueRef *out_lod,
+                         LLVMValueRef *out_num_samples,
+                         LLVMValueRef *out_max_samples,
+                         LLVMValueRef out_axis[2]);
+
 void
 lp_build_nearest_mip_level(struct lp_build_sample_context *bld,
                            unsigned texture_unit,
@@ -676,6 +716,19 @@ lp_build_sample_offset(struct lp_build_context *bld,
                        LLVMValueRef *out_j);
 
 
+void
+lp_build_sample_tiled_offset(struct lp_build_context *bld,
+                             const struct util_format_description *format_desc,
+                             LLVMValueRef x,
+                             LLVMValueRef y,
+                             LLVMValueRef z,
+                             LLVMValueRef y_stride,
+                             LLVMValueRef z_stride,
+                             LLVMValueRef *out_offset,
+                             LLVMValueRef *out_i,
+                             LLVMValueRef *out_j);
+
+
 void
 lp_build_sample_soa(const struct lp_static_texture_state *static_texture_state,
                     const struct lp_static_sampler_state *static_sampler_state,
@@ -692,6 +745,10 @@ lp_build_coord_repeat_npot_linear(struct lp_build_sample_context *bld,
                                   LLVMValueRef *coord0_i,
                                   LLVMValueRef *weight_f);
 
+LLVMValueRef
+lp_build_coord_mirror(struct lp_build_sample_context *bld,
+                      LLVMValueRef coord, boolean posOnly);
+
 
 void
 lp_build_size_query_soa(struct gallivm_state *gallivm,
@@ -706,6 +763,10 @@ lp_build_sample_nop(struct gallivm_state *gallivm,
                     LLVMValueRef texel_out[4]);
 
 
+LLVMValueRef
+lp_build_sample_first_level(struct lp_build_sample_context *bld,
+                            unsigned texture_unit);
+
 LLVMValueRef
 lp_build_minify(struct lp_build_context *bld,
                 LLVMValueRef base_size,
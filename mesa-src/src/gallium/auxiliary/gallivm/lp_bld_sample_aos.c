@@ -116,9 +116,27 @@ lp_build_sample_wrap_nearest_int(struct lp_build_sample_context *bld,
       coord = lp_build_min(int_coord_bld, coord, length_minus_one);
       break;
 
+   case PIPE_TEX_WRAP_MIRROR_REPEAT:
+      {
+         struct lp_build_context *coord_bld = &bld->coord_bld;
+         LLVMValueRef length_f = lp_build_int_to_float(coord_bld, length);
+         if (offset) {
+            offset = lp_build_int_to_float(coord_bld, offset);
+            offset = lp_build_div(coord_bld, offset, length_f);
+            coord_f = lp_build_add(coord_bld, coord_f, offset);
+         }
+         /* mirror with normalized floats, then scale to length */
+         assert(bld->static_sampler_state->normalized_coords);
+         coord = lp_build_coord_mirror(bld, coord_f, TRUE);
+         coord = lp_build_mul(coord_bld, coord, length_f);
+         /* itrunc == ifloor here */
+         coord = lp_build_itrunc(coord_bld, coord);
+         coord = lp_build_min(int_coord_bld, coord, length_minus_one);
+      }
+      break;
+
    case PIPE_TEX_WRAP_CLAMP:
    case PIPE_TEX_WRAP_CLAMP_TO_BORDER:
-   case PIPE_TEX_WRAP_MIRROR_REPEAT:
    case PIPE_TEX_WRAP_MIRROR_CLAMP:
    case PIPE_TEX_WRAP_MIRROR_CLAMP_TO_EDGE:
    case PIPE_TEX_WRAP_MIRROR_CLAMP_TO_BORDER:
@@ -193,6 +211,64 @@ lp_build_coord_repeat_npot_linear_int(struct lp_build_sample_context *bld,
 }
 
 
+/**
+ * Helper to compute the two coords and the weight for
+ * linear wrap mirror repeat textures
+ */
+static void
+lp_build_coord_mirror_linear_int(struct lp_build_sample_context *bld,
+                                 LLVMValueRef coord_f,
+                                 LLVMValueRef length_i,
+                                 LLVMValueRef length_f,
+                                 LLVMValueRef *coord0_i,
+                                 LLVMValueRef *coord1_i,
+                                 LLVMValueRef *weight_i)
+{
+   struct lp_build_context *coord_bld = &bld->coord_bld;
+   struct lp_build_context *int_coord_bld = &bld->int_coord_bld;
+   struct lp_build_context abs_coord_bld;
+   struct lp_type abs_type;
+   LLVMValueRef length_minus_one = lp_build_sub(int_coord_bld, length_i,
+                                                int_coord_bld->one);
+   LLVMValueRef i32_c8, i32_c128, i32_c255;
+
+   /* compute mirror function with normalized floats */
+   assert(bld->static_sampler_state->normalized_coords);
+   coord_f = lp_build_coord_mirror(bld, coord_f, TRUE);
+   /* mul by size */
+   coord_f = lp_build_mul(coord_bld, coord_f, length_f);
+   /* convert to int, compute lerp weight */
+   coord_f = lp_build_mul_imm(&bld->coord_bld, coord_f, 256);
+
+   /* The mirrored coord is never negative. */
+   abs_type = coord_bld->type;
+   abs_type.sign = 0;
+   lp_build_context_init(&abs_coord_bld, bld->gallivm, abs_type);
+   *coord0_i = lp_build_iround(&abs_coord_bld, coord_f);
+
+   /* subtract 0.5 (add -128) */
+   i32_c128 = lp_build_const_int_vec(bld->gallivm, bld->int_coord_type, -128);
+   *coord0_i = LLVMBuildAdd(bld->gallivm->builder, *coord0_i, i32_c128, "");
+
+   /* compute fractional part (AND with 0xff) */
+   i32_c255 = lp_build_const_int_vec(bld->gallivm, bld->int_coord_type, 255);
+   *weight_i = LLVMBuildAnd(bld->gallivm->builder, *coord0_i, i32_c255, "");
+
+   /* compute floor (shift right 8) */
+   i32_c8 = lp_build_const_int_vec(bld->gallivm, bld->int_coord_type, 8);
+   *coord0_i = LLVMBuildAShr(bld->gallivm->builder, *coord0_i, i32_c8, "");
+   *coord1_i = lp_build_add(int_coord_bld, *coord0_i, int_coord_bld->one);
+
+   /*
+    * Past the edges the neighbour mirrors back onto the edge texel
+    * (the min also takes care of nan and inf coords).
+    */
+   *coord0_i = lp_build_max(int_coord_bld, *coord0_i, int_coord_bld->zero);
+   *coord0_i = lp_build_min(int_coord_bld, *coord0_i, length_minus_one);
+   *coord1_i = lp_build_min(int_coord_bld, *coord1_i, length_minus_one);
+}
+
+
 /**
  * Build LLVM code for texture coord wrapping, for linear filtering,
  * for scaled integer texcoords.
@@ -277,9 +353,22 @@ lp_build_sample_wrap_linear_int(struct lp_build_sample_context *bld,
                                 length_minus_one);
          break;
 
+      case PIPE_TEX_WRAP_MIRROR_REPEAT:
+         {
+            LLVMValueRef length_f = lp_build_int_to_float(&bld->coord_bld, length);
+            if (offset) {
+               offset = lp_build_int_to_float(&bld->coord_bld, offset);
+               offset = lp_build_div(&bld->coord_bld, offset, length_f);
+               coord_f = lp_build_add(&bld->coord_bld, coord_f, offset);
+            }
+            lp_build_coord_mirror_linear_int(bld, coord_f,
+                                             length, length_f,
+                                             &coord0, &coord1, weight_i);
+         }
+         break;
+
       case PIPE_TEX_WRAP_CLAMP:
       case PIPE_TEX_WRAP_CLAMP_TO_BORDER:
-      case PIPE_TEX_WRAP_MIRROR_REPEAT:
       case PIPE_TEX_WRAP_MIRROR_CLAMP:
       case PIPE_TEX_WRAP_MIRROR_CLAMP_TO_EDGE:
       case PIPE_TEX_WRAP_MIRROR_CLAMP_TO_BORDER:
@@ -347,9 +436,27 @@ lp_build_sample_wrap_linear_int(struct lp_build_sample_context *bld,
                               LLVMBuildAnd(builder, stride, mask, ""));
       break;
 
+   case PIPE_TEX_WRAP_MIRROR_REPEAT:
+      {
+         LLVMValueRef length_f = lp_build_int_to_float(&bld->coord_bld, length);
+         LLVMValueRef coord1;
+         if (offset) {
+            offset = lp_build_int_to_float(&bld->coord_bld, offset);
+            offset = lp_build_div(&bld->coord_bld, offset, length_f);
+            coord_f = lp_build_add(&bld->coord_bld, coord_f, offset);
+         }
+         lp_build_coord_mirror_linear_int(bld, coord_f,
+                                          length, length_f,
+                                          &coord0, &coord1, weight_i);
+
+         /* coord1 is coord0 + 1 except at the edges */
+         *offset0 = lp_build_mul(int_coord_bld, coord0, stride);
+         *offset1 = lp_build_mul(int_coord_bld, coord1, stride);
+      }
+      break;
+
    case PIPE_TEX_WRAP_CLAMP:
    case PIPE_TEX_WRAP_CLAMP_TO_BORDER:
-   case PIPE_TEX_WRAP_MIRROR_REPEAT:
    case PIPE_TEX_WRAP_MIRROR_CLAMP:
    case PIPE_TEX_WRAP_MIRROR_CLAMP_TO_EDGE:
    case PIPE_TEX_WRAP_MIRROR_CLAMP_TO_BORDER:
@@ -1156,21 +1263,63 @@ lp_build_sample_aos(struct lp_build_sample_context *bld,
                              ilevel0, ilevel1, lod_fpart,
                              packed_var);
    }
+   else if (bld->num_lods > 1) {
+      /*
+       * Per-pixel lods: run the filters the pixels need, and if they
+       * disagree, pick each pixel's result.
+       */
+      struct lp_build_context *lodi_bld = &bld->lodi_bld;
+      struct lp_build_if_state if_ctx;
+      LLVMValueRef any_min, any_mag, mag_var, mask;
+
+      any_min = lp_build_any_true_range(lodi_bld, bld->num_lods, lod_positive);
+      any_mag = lp_build_any_true_range(lodi_bld, bld->num_lods,
+                                        lp_build_not(lodi_bld, lod_positive));
+      mag_var = lp_build_alloca(bld->gallivm, u8n_bld.vec_type, "mag_var");
+
+      lp_build_if(&if_ctx, bld->gallivm, any_min);
+      {
+         /* Use the minification filter */
+         lp_build_sample_mipmap(bld,
+                                min_filter, mip_filter,
+                                s, t, r, offsets,
+                                ilevel0, ilevel1, lod_fpart,
+                                packed_var);
+      }
+      lp_build_endif(&if_ctx);
+
+      lp_build_if(&if_ctx, bld->gallivm, any_mag);
+      {
+         /* Use the magnification filter */
+         lp_build_sample_mipmap(bld,
+                                mag_filter, PIPE_TEX_MIPFILTER_NONE,
+                                s, t, r, offsets,
+                                ilevel0, NULL, NULL,
+                                mag_var);
+
+         /* Widen the lod masks to the bytes of their pixels */
+         mask = lod_positive;
+         if (bld->num_lods != bld->coord_type.length) {
+            mask = lp_build_unpack_broadcast_aos_scalars(bld->gallivm,
+                                                         lodi_bld->type,
+                                                         bld->int_coord_type,
+                                                         mask);
+         }
+         mask = LLVMBuildBitCast(builder, mask, u8n_bld.vec_type, "");
+
+         packed = lp_build_select(&u8n_bld, mask,
+                                  LLVMBuildLoad(builder, packed_var, ""),
+                                  LLVMBuildLoad(builder, mag_var, ""));
+         LLVMBuildStore(builder, packed, packed_var);
+      }
+      lp_build_endif(&if_ctx);
+   }
    else {
       /* Emit conditional to choose min image filter or mag image filter
        * depending on the lod being > 0 or <= 0, respectively.
        */
       struct lp_build_if_state if_ctx;
 
-      /*
-       * FIXME this should take all lods into account, if some are min
-       * some max probably could hack up the weights in the linear
-       * path with selects to work for nearest.
-       */
-      if (bld->num_lods > 1)
-         lod_positive = LLVMBuildExtractElement(builder, lod_positive,
-                                                lp_build_const_int32(bld->gallivm, 0), "");
-
       lod_positive = LLVMBuildTrunc(builder, lod_positive,
                                     LLVMInt1TypeInContext(bld->gallivm->context), "");
 
@@ -1200,9 +1349,36 @@ lp_build_sample_aos(struct lp_build_sample_context *bld,
    /*
     * Convert to SoA and swizzle.
     */
-   lp_build_rgba8_to_fi32_soa(bld->gallivm,
-                             bld->texel_type,
-                             packed, unswizzled);
+   if (bld->format_desc->colorspace == UTIL_FORMAT_COLORSPACE_SRGB) {
+      /*
+       * Only nearest filtering gets here, so the fetched texels can be
+       * decoded, just like the SoA path does.
+       */
+      struct lp_type int_type = lp_int_type(bld->texel_type);
+      unsigned chan;
+
+      assert(util_format_is_rgba8_variant(bld->format_desc));
+
+      lp_build_rgba8_to_fi32_soa(bld->gallivm, int_type,
+                                 packed, unswizzled);
+
+      for (chan = 0; chan < 4; chan++) {
+         if (bld->format_desc->swizzle[3] == chan) {
+            unswizzled[chan] = lp_build_unsigned_norm_to_float(bld->gallivm, 8,
+                                                               bld->texel_type,
+                                                               unswizzled[chan]);
+         }
+         else {
+            unswizzled[chan] = lp_build_srgb_to_linear(bld->gallivm, int_type,
+                                                       8, unswizzled[chan]);
+         }
+      }
+   }
+   else {
+      lp_build_rgba8_to_fi32_soa(bld->gallivm,
+                                bld->texel_type,
+                                packed, unswizzled);
+   }
 
    if (util_format_is_rgba8_variant(bld->format_desc)) {
       lp_build_format_swizzle_soa(bld->format_desc,
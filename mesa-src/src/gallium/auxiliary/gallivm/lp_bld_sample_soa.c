@@ -40,6 +40,7 @@
 #include "util/u_dump.h"
 #include "util/u_memory.h"
 #include "util/u_math.h"
+#include "util/u_endian.h"
 #include "util/format/u_format.h"
 #include "util/u_cpu_detect.h"
 #include "util/format_rgb9e5.h"
@@ -65,34 +66,23 @@
 
 
 /**
- * Generate code to fetch a texel from a texture at int coords (x, y, z).
- * The computation depends on whether the texture is 1D, 2D or 3D.
- * The result, texel, will be float vectors:
- *   texel[0] = red values
- *   texel[1] = green values
- *   texel[2] = blue values
- *   texel[3] = alpha values
+ * Return the mask of the elements whose int coords (x, y, z) lie outside
+ * the texture and get the border color, or NULL if the wrap modes never
+ * use it.
  */
-static void
-lp_build_sample_texel_soa(struct lp_build_sample_context *bld,
-                          LLVMValueRef width,
-                          LLVMValueRef height,
-                          LLVMValueRef depth,
-                          LLVMValueRef x,
-                          LLVMValueRef y,
-                          LLVMValueRef z,
-                          LLVMValueRef y_stride,
-                          LLVMValueRef z_stride,
-                          LLVMValueRef data_ptr,
-                          LLVMValueRef mipoffsets,
-                          LLVMValueRef texel_out[4])
+static LLVMValueRef
+lp_build_sample_texel_use_border(struct lp_build_sample_context *bld,
+                                 LLVMValueRef width,
+                                 LLVMValueRef height,
+                                 LLVMValueRef depth,
+                                 LLVMValueRef x,
+                                 LLVMValueRef y,
+                                 LLVMValueRef z)
 {
    const struct lp_static_sampler_state *static_state = bld->static_sampler_state;
    const unsigned dims = bld->dims;
    struct lp_build_context *int_coord_bld = &bld->int_coord_bld;
    LLVMBuilderRef builder = bld->gallivm->builder;
-   LLVMValueRef offset;
-   LLVMValueRef i, j;
    LLVMValueRef use_border = NULL;
 
    /* use_border = x < 0 || x >= width || y < 0 || y >= height */
@@ -136,12 +126,102 @@ lp_build_sample_texel_soa(struct lp_build_sample_context *bld,
          use_border = LLVMBuildOr(builder, b1, b2, "b1_or_b2");
       }
    }
+   return use_border;
+}
+
+
+/**
+ * Replace the texels of the elements in use_border with the border color.
+ */
+static void
+lp_build_sample_texel_border(struct lp_build_sample_context *bld,
+                             LLVMValueRef use_border,
+                             LLVMValueRef texel_out[4])
+{
+   /* select texel color or border color depending on use_border. */
+   const struct util_format_description *format_desc = bld->format_desc;
+   int chan;
+   struct lp_type border_type = bld->texel_type;
+   border_type.length = 4;
+   /*
+    * Only replace channels which are actually present. The others should
+    * get optimized away eventually by sampler_view swizzle anyway but it's
+    * easier too.
+    */
+   for (chan = 0; chan < 4; chan++) {
+      unsigned chan_s;
+      /* reverse-map channel... */
+      if (util_format_has_stencil(format_desc)) {
+         if (chan == 0)
+            chan_s = 0;
+         else
+            break;
+      }
+      else {
+         for (chan_s = 0; chan_s < 4; chan_s++) {
+            if (chan_s == format_desc->swizzle[chan]) {
+               break;
+            }
+         }
+      }
+      if (chan_s <= 3) {
+         /* use the already clamped color */
+         LLVMValueRef idx = lp_build_const_int32(bld->gallivm, chan);
+         LLVMValueRef border_chan;
+
+         border_chan = lp_build_extract_broadcast(bld->gallivm,
+                                                  border_type,
+                                                  bld->texel_type,
+                                                  bld->border_color_clamped,
+                                                  idx);
+         texel_out[chan] = lp_build_select(&bld->texel_bld, use_border,
+                                           border_chan, texel_out[chan]);
+      }
+   }
+}
+
+
+/**
+ * Generate code to fetch a texel from a texture at int coords (x, y, z).
+ * The computation depends on whether the texture is 1D, 2D or 3D.
+ * The result, texel, will be float vectors:
+ *   texel[0] = red values
+ *   texel[1] = green values
+ *   texel[2] = blue values
+ *   texel[3] = alpha values
+ */
+static void
+lp_build_sample_texel_soa(struct lp_build_sample_context *bld,
+                          LLVMValueRef width,
+                          LLVMValueRef height,
+                          LLVMValueRef depth,
+                          LLVMValueRef x,
+                          LLVMValueRef y,
+                          LLVMValueRef z,
+                          LLVMValueRef y_stride,
+                          LLVMValueRef z_stride,
+                          LLVMValueRef data_ptr,
+                          LLVMValueRef mipoffsets,
+                          LLVMValueRef texel_out[4])
+{
+   LLVMValueRef offset;
+   LLVMValueRef i, j;
+   LLVMValueRef use_border;
+
+   use_border = lp_build_sample_texel_use_border(bld, width, height, depth,
+                                                 x, y, z);
 
    /* convert x,y,z coords to linear offset from start of texture, in bytes */
-   lp_build_sample_offset(&bld->int_coord_bld,
-                          bld->format_desc,
-                          x, y, z, y_stride, z_stride,
-                          &offset, &i, &j);
+   if (bld->static_texture_state->tiled)
+      lp_build_sample_tiled_offset(&bld->int_coord_bld,
+                                   bld->format_desc,
+                                   x, y, z, y_stride, z_stride,
+                                   &offset, &i, &j);
+   else
+      lp_build_sample_offset(&bld->int_coord_bld,
+                             bld->format_desc,
+                             x, y, z, y_stride, z_stride,
+                             &offset, &i, &j);
    if (mipoffsets) {
       offset = lp_build_add(&bld->int_coord_bld, offset, mipoffsets);
    }
@@ -182,47 +262,169 @@ lp_build_sample_texel_soa(struct lp_build_sample_context *bld,
     */
 
    if (use_border) {
-      /* select texel color or border color depending on use_border. */
-      const struct util_format_description *format_desc = bld->format_desc;
-      int chan;
-      struct lp_type border_type = bld->texel_type;
-      border_type.length = 4;
+      lp_build_sample_texel_border(bld, use_border, texel_out);
+   }
+}
+
+
+/**
+ * Whether lp_build_sample_texel_pair_soa() can fetch the texels of the
+ * linear filter footprint: 16 or 32 bit depth formats, linearly laid out,
+ * sampled with comparison (shadow lookups and their gathers).
+ */
+static boolean
+lp_build_sample_can_fetch_pairs(const struct lp_build_sample_context *bld)
+{
+   const struct util_format_description *format_desc = bld->format_desc;
+
+   return UTIL_ARCH_LITTLE_ENDIAN &&
+          bld->static_sampler_state->compare_mode != PIPE_TEX_COMPARE_NONE &&
+          !bld->static_texture_state->tiled &&
+          util_format_has_depth(format_desc) &&
+          format_desc->layout == UTIL_FORMAT_LAYOUT_PLAIN &&
+          format_desc->block.width == 1 &&
+          format_desc->block.height == 1 &&
+          (format_desc->block.bits == 16 || format_desc->block.bits == 32) &&
+          bld->texel_type.width == 32;
+}
+
+
+/**
+ * Fetch the two texels at int coords (x0, y, z) and (x1, y, z), like two
+ * lp_build_sample_texel_soa() calls would.
+ * When x1 is x0 + 1 and both are inside the row for all elements (no wrap
+ * happened in between) this is one load of twice the texel size per
+ * element instead of two loads, which then gets split and unpacked.
+ * Otherwise falls back to fetching the texels separately.
+ */
+static void
+lp_build_sample_texel_pair_soa(struct lp_build_sample_context *bld,
+                               LLVMValueRef width,
+                               LLVMValueRef height,
+                               LLVMValueRef depth,
+                               LLVMValueRef x0,
+                               LLVMValueRef x1,
+                               LLVMValueRef y,
+                               LLVMValueRef z,
+                               LLVMValueRef y_stride,
+                               LLVMValueRef z_stride,
+                               LLVMValueRef data_ptr,
+                               LLVMValueRef mipoffsets,
+                               LLVMValueRef texel0_out[4],
+                               LLVMValueRef texel1_out[4])
+{
+   struct gallivm_state *gallivm = bld->gallivm;
+   const struct util_format_description *format_desc = bld->format_desc;
+   struct lp_build_context *int_coord_bld = &bld->int_coord_bld;
+   LLVMBuilderRef builder = gallivm->builder;
+   const unsigned length = bld->texel_type.length;
+   const unsigned bits = format_desc->block.bits;
+   struct lp_type packed_type = lp_type_uint_vec(32, 32 * length);
+   struct lp_type pair_type = lp_type_uint_vec(2 * bits, 2 * bits * length);
+   struct lp_build_if_state if_ctx;
+   LLVMValueRef texels0[4], texels1[4];
+   LLVMValueRef split, tmp;
+   LLVMValueRef offset, i, j, use_border;
+   LLVMValueRef pair, packed0, packed1;
+   unsigned chan;
+
+   assert(lp_build_sample_can_fetch_pairs(bld));
+
+   for (chan = 0; chan < 4; chan++) {
+      texels0[chan] = lp_build_alloca(gallivm, bld->texel_bld.vec_type, "texel0");
+      texels1[chan] = lp_build_alloca(gallivm, bld->texel_bld.vec_type, "texel1");
+   }
+
+   /* split = x1 != x0 + 1 || x0 < 0 || x1 >= width */
+   tmp = lp_build_add(int_coord_bld, x0, int_coord_bld->one);
+   split = lp_build_cmp(int_coord_bld, PIPE_FUNC_NOTEQUAL, x1, tmp);
+   tmp = lp_build_cmp(int_coord_bld, PIPE_FUNC_LESS, x0, int_coord_bld->zero);
+   split = lp_build_or(int_coord_bld, split, tmp);
+   tmp = lp_build_cmp(int_coord_bld, PIPE_FUNC_GEQUAL, x1, width);
+   split = lp_build_or(int_coord_bld, split, tmp);
+   split = lp_build_any_true_range(int_coord_bld, length, split);
+
+   lp_build_if(&if_ctx, gallivm, split);
+   {
+      lp_build_sample_texel_soa(bld, width, height, depth,
+                                x0, y, z, y_stride, z_stride,
+                                data_ptr, mipoffsets, texel0_out);
+      lp_build_sample_texel_soa(bld, width, height, depth,
+                                x1, y, z, y_stride, z_stride,
+                                data_ptr, mipoffsets, texel1_out);
+
+      for (chan = 0; chan < 4; chan++) {
+         LLVMBuildStore(builder, texel0_out[chan], texels0[chan]);
+         LLVMBuildStore(builder, texel1_out[chan], texels1[chan]);
+      }
+   }
+   lp_build_else(&if_ctx);
+   {
       /*
-       * Only replace channels which are actually present. The others should
-       * get optimized away eventually by sampler_view swizzle anyway but it's
-       * easier too.
+       * Both texels are inside the row, so only y and z can still be
+       * outside the texture, and they are the same for both texels.
        */
+      use_border = lp_build_sample_texel_use_border(bld, width, height, depth,
+                                                    x0, y, z);
+
+      lp_build_sample_offset(int_coord_bld, format_desc,
+                             x0, y, z, y_stride, z_stride,
+                             &offset, &i, &j);
+      if (mipoffsets) {
+         offset = lp_build_add(int_coord_bld, offset, mipoffsets);
+      }
+      if (use_border) {
+         /*
+          * Offset zero is the first two texels of the image, which exist
+          * as x1 < width means the row has at least two texels.
+          */
+         offset = lp_build_andnot(int_coord_bld, offset, use_border);
+      }
+
+      /* x0 is in the low bits, as the texture is little endian */
+      pair = lp_build_gather(gallivm, length, 2 * bits,
+                             lp_type_uint(2 * bits), FALSE,
+                             data_ptr, offset, FALSE);
+
+      if (bits == 32) {
+         LLVMTypeRef packed_vec_type = lp_build_vec_type(gallivm, packed_type);
+
+         packed0 = LLVMBuildTrunc(builder, pair, packed_vec_type, "");
+         packed1 = LLVMBuildLShr(builder, pair,
+                                 lp_build_const_int_vec(gallivm, pair_type, 32),
+                                 "");
+         packed1 = LLVMBuildTrunc(builder, packed1, packed_vec_type, "");
+      }
+      else {
+         packed0 = LLVMBuildAnd(builder, pair,
+                                lp_build_const_int_vec(gallivm, packed_type,
+                                                       0xffff), "");
+         packed1 = LLVMBuildLShr(builder, pair,
+                                 lp_build_const_int_vec(gallivm, packed_type, 16),
+                                 "");
+      }
+
+      lp_build_unpack_rgba_soa(gallivm, format_desc, bld->texel_type,
+                               packed0, texel0_out);
+      lp_build_unpack_rgba_soa(gallivm, format_desc, bld->texel_type,
+                               packed1, texel1_out);
+
+      if (use_border) {
+         lp_build_sample_texel_border(bld, use_border, texel0_out);
+         lp_build_sample_texel_border(bld, use_border, texel1_out);
+      }
+
       for (chan = 0; chan < 4; chan++) {
-         unsigned chan_s;
-         /* reverse-map channel... */
-         if (util_format_has_stencil(format_desc)) {
-            if (chan == 0)
-               chan_s = 0;
-            else
-               break;
-         }
-         else {
-            for (chan_s = 0; chan_s < 4; chan_s++) {
-               if (chan_s == format_desc->swizzle[chan]) {
-                  break;
-               }
-            }
-         }
-         if (chan_s <= 3) {
-            /* use the already clamped color */
-            LLVMValueRef idx = lp_build_const_int32(bld->gallivm, chan);
-            LLVMValueRef border_chan;
-
-            border_chan = lp_build_extract_broadcast(bld->gallivm,
-                                                     border_type,
-                                                     bld->texel_type,
-                                                     bld->border_color_clamped,
-                                                     idx);
-            texel_out[chan] = lp_build_select(&bld->texel_bld, use_border,
-                                              border_chan, texel_out[chan]);
-         }
+         LLVMBuildStore(builder, texel0_out[chan], texels0[chan]);
+         LLVMBuildStore(builder, texel1_out[chan], texels1[chan]);
       }
    }
+   lp_build_endif(&if_ctx);
+
+   for (chan = 0; chan < 4; chan++) {
+      texel0_out[chan] = LLVMBuildLoad(builder, texels0[chan], "");
+      texel1_out[chan] = LLVMBuildLoad(builder, texels1[chan], "");
+   }
 }
 
 
@@ -231,7 +433,7 @@ lp_build_sample_texel_soa(struct lp_build_sample_context *bld,
  * (Note that with pot sizes could do this much more easily post-scale
  * with some bit arithmetic.)
  */
-static LLVMValueRef
+LLVMValueRef
 lp_build_coord_mirror(struct lp_build_sample_context *bld,
                       LLVMValueRef coord, boolean posOnly)
 {
@@ -1039,6 +1241,7 @@ lp_build_sample_image_linear(struct lp_build_sample_context *bld,
    LLVMValueRef neighbors[2][2][4];
    int chan, texel_index;
    boolean seamless_cube_filter, accurate_cube_corners;
+   boolean fetch_pairs;
    unsigned chan_swiz = bld->static_texture_state->swizzle_r;
 
    if (is_gather) {
@@ -1063,6 +1266,13 @@ lp_build_sample_image_linear(struct lp_build_sample_context *bld,
    accurate_cube_corners = ACCURATE_CUBE_CORNERS && seamless_cube_filter &&
      !util_format_is_pure_integer(bld->static_texture_state->format);
 
+   /*
+    * Without seamless cube filtering the texels of a row are always on the
+    * same row of the same image, which is what the pair fetch relies on.
+    */
+   fetch_pairs = dims == 2 && !seamless_cube_filter &&
+                 lp_build_sample_can_fetch_pairs(bld);
+
    lp_build_extract_image_sizes(bld,
                                 &bld->int_size_bld,
                                 bld->int_coord_type,
@@ -1345,16 +1555,26 @@ lp_build_sample_image_linear(struct lp_build_sample_context *bld,
     * Get texture colors.
     */
    /* get x0/x1 texels */
-   lp_build_sample_texel_soa(bld,
-                             width_vec, height_vec, depth_vec,
-                             x00, y00, z00,
-                             row_stride_vec, img_stride_vec,
-                             data_ptr, mipoffsets, neighbors[0][0]);
-   lp_build_sample_texel_soa(bld,
-                             width_vec, height_vec, depth_vec,
-                             x01, y01, z01,
-                             row_stride_vec, img_stride_vec,
-                             data_ptr, mipoffsets, neighbors[0][1]);
+   if (fetch_pairs) {
+      lp_build_sample_texel_pair_soa(bld,
+                                     width_vec, height_vec, depth_vec,
+                                     x00, x01, y00, z00,
+                                     row_stride_vec, img_stride_vec,
+                                     data_ptr, mipoffsets,
+                                     neighbors[0][0], neighbors[0][1]);
+   }
+   else {
+      lp_build_sample_texel_soa(bld,
+                                width_vec, height_vec, depth_vec,
+                                x00, y00, z00,
+                                row_stride_vec, img_stride_vec,
+                                data_ptr, mipoffsets, neighbors[0][0]);
+      lp_build_sample_texel_soa(bld,
+                                width_vec, height_vec, depth_vec,
+                                x01, y01, z01,
+                                row_stride_vec, img_stride_vec,
+                                data_ptr, mipoffsets, neighbors[0][1]);
+   }
 
    if (dims == 1) {
       assert(!is_gather);
@@ -1383,16 +1603,26 @@ lp_build_sample_image_linear(struct lp_build_sample_context *bld,
       LLVMValueRef colors0[4], colorss[4];
 
       /* get x0/x1 texels at y1 */
-      lp_build_sample_texel_soa(bld,
-                                width_vec, height_vec, depth_vec,
-                                x10, y10, z10,
-                                row_stride_vec, img_stride_vec,
-                                data_ptr, mipoffsets, neighbors[1][0]);
-      lp_build_sample_texel_soa(bld,
-                                width_vec, height_vec, depth_vec,
-                                x11, y11, z11,
-                                row_stride_vec, img_stride_vec,
-                                data_ptr, mipoffsets, neighbors[1][1]);
+      if (fetch_pairs) {
+         lp_build_sample_texel_pair_soa(bld,
+                                        width_vec, height_vec, depth_vec,
+                                        x10, x11, y10, z10,
+                                        row_stride_vec, img_stride_vec,
+                                        data_ptr, mipoffsets,
+                                        neighbors[1][0], neighbors[1][1]);
+      }
+      else {
+         lp_build_sample_texel_soa(bld,
+                                   width_vec, height_vec, depth_vec,
+                                   x10, y10, z10,
+                                   row_stride_vec, img_stride_vec,
+                                   data_ptr, mipoffsets, neighbors[1][0]);
+         lp_build_sample_texel_soa(bld,
+                                   width_vec, height_vec, depth_vec,
+                                   x11, y11, z11,
+                                   row_stride_vec, img_stride_vec,
+                                   data_ptr, mipoffsets, neighbors[1][1]);
+      }
 
       /*
        * To avoid having to duplicate linear_mask / fetch code use
@@ -2035,7 +2265,8 @@ lp_build_layer_coord(struct lp_build_sample_context *bld,
    struct lp_build_context *int_coord_bld = &bld->int_coord_bld;
 
    num_layers = bld->dynamic_state->depth(bld->dynamic_state, bld->gallivm,
-                                          bld->context_ptr, texture_unit, NULL);
+                                          bld->context_ptr, texture_unit,
+                                          bld->texture_unit_offset);
 
    if (out_of_bounds) {
       LLVMValueRef out1, out;
@@ -2157,11 +2388,9 @@ lp_build_sample_common(struct lp_build_sample_context *bld,
          last_level = bld->dynamic_state->last_level(bld->dynamic_state,
                                                      bld->gallivm,
                                                      bld->context_ptr,
-                                                     texture_index, NULL);
-         first_level = bld->dynamic_state->first_level(bld->dynamic_state,
-                                                       bld->gallivm,
-                                                       bld->context_ptr,
-                                                       texture_index, NULL);
+                                                     texture_index,
+                                                     bld->texture_unit_offset);
+         first_level = lp_build_sample_first_level(bld, texture_index);
          last_level = lp_build_sub(&bld->int_bld, last_level, first_level);
          last_level = lp_build_int_to_float(&bld->float_bld, last_level);
          last_level = lp_build_broadcast_scalar(&bld->lodf_bld, last_level);
@@ -2201,9 +2430,7 @@ lp_build_sample_common(struct lp_build_sample_context *bld,
       /* fall-through */
    case PIPE_TEX_MIPFILTER_NONE:
       /* always use mip level 0 */
-      first_level = bld->dynamic_state->first_level(bld->dynamic_state,
-                                                    bld->gallivm, bld->context_ptr,
-                                                    texture_index, NULL);
+      first_level = lp_build_sample_first_level(bld, texture_index);
       first_level = lp_build_broadcast_scalar(&bld->leveli_bld, first_level);
       *ilevel0 = first_level;
       break;
@@ -2229,7 +2456,8 @@ lp_build_clamp_border_color(struct lp_build_sample_context *bld,
    LLVMBuilderRef builder = gallivm->builder;
    LLVMValueRef border_color_ptr =
       bld->dynamic_state->border_color(bld->dynamic_state, gallivm,
-                                       bld->context_ptr, sampler_unit);
+                                       bld->context_ptr, sampler_unit,
+                                       bld->sampler_unit_offset);
    LLVMValueRef border_color;
    const struct util_format_description *format_desc = bld->format_desc;
    struct lp_type vec4_type = bld->texel_type;
@@ -2605,6 +2833,90 @@ lp_build_sample_general(struct lp_build_sample_context *bld,
 }
 
 
+/**
+ * Anisotropic sampling: average num_samples ordinary (trilinear) lookups
+ * spread evenly along the major axis of the footprint, centered on the
+ * original coords.  See lp_build_aniso_footprint().
+ * Loops to the largest per element sample count, elements which need
+ * fewer samples just don't accumulate the extra ones.
+ */
+static void
+lp_build_sample_aniso(struct lp_build_sample_context *bld,
+                      unsigned sampler_unit,
+                      const LLVMValueRef *coords,
+                      const LLVMValueRef *offsets,
+                      LLVMValueRef lod_positive,
+                      LLVMValueRef lod_fpart,
+                      LLVMValueRef ilevel0,
+                      LLVMValueRef ilevel1,
+                      LLVMValueRef num_samples,
+                      LLVMValueRef max_samples,
+                      const LLVMValueRef *axis,
+                      LLVMValueRef *colors_out)
+{
+   struct gallivm_state *gallivm = bld->gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_build_context *coord_bld = &bld->coord_bld;
+   struct lp_build_context *int_coord_bld = &bld->int_coord_bld;
+   struct lp_build_context *texel_bld = &bld->texel_bld;
+   struct lp_build_loop_state loop_state;
+   LLVMValueRef num_samples_int, half, accum[4];
+   unsigned chan, i;
+
+   half = lp_build_const_vec(gallivm, coord_bld->type, 0.5f);
+   num_samples_int = lp_build_itrunc(coord_bld, num_samples);
+
+   for (chan = 0; chan < 4; ++chan) {
+      accum[chan] = lp_build_alloca(gallivm, texel_bld->vec_type, "aniso_accum");
+      /* the alloca is only zeroed once at function entry */
+      LLVMBuildStore(builder, texel_bld->zero, accum[chan]);
+   }
+
+   lp_build_loop_begin(&loop_state, gallivm, lp_build_const_int32(gallivm, 0));
+   {
+      LLVMValueRef k, kf, offset, active, texels[4], sample_coords[5];
+
+      k = lp_build_broadcast_scalar(int_coord_bld, loop_state.counter);
+      kf = lp_build_int_to_float(coord_bld, k);
+
+      /* (k + 0.5) / n - 0.5, in [-0.5, 0.5] along the axis */
+      offset = lp_build_div(coord_bld, lp_build_add(coord_bld, kf, half),
+                            num_samples);
+      offset = lp_build_sub(coord_bld, offset, half);
+
+      for (i = 0; i < 5; i++) {
+         sample_coords[i] = coords[i];
+      }
+      sample_coords[0] = lp_build_mad(coord_bld, offset, axis[0], coords[0]);
+      sample_coords[1] = lp_build_mad(coord_bld, offset, axis[1], coords[1]);
+
+      lp_build_sample_general(bld, sampler_unit, FALSE,
+                              sample_coords, offsets,
+                              lod_positive, lod_fpart,
+                              ilevel0, ilevel1,
+                              texels);
+
+      active = lp_build_cmp(int_coord_bld, PIPE_FUNC_LESS, k, num_samples_int);
+      for (chan = 0; chan < 4; ++chan) {
+         LLVMValueRef sum = LLVMBuildLoad(builder, accum[chan], "");
+         LLVMValueRef texel = lp_build_select(texel_bld, active,
+                                              texels[chan], texel_bld->zero);
+         sum = lp_build_add(texel_bld, sum, texel);
+         LLVMBuildStore(builder, sum, accum[chan]);
+      }
+   }
+   lp_build_loop_end_cond(&loop_state, max_samples, NULL, LLVMIntUGE);
+
+   for (chan = 0; chan < 4; ++chan) {
+      colors_out[chan] = lp_build_div(texel_bld,
+                                      LLVMBuildLoad(builder, accum[chan], ""),
+                                      num_samples);
+      lp_build_name(colors_out[chan], "sampler%u_aniso_texel_%c",
+                    sampler_unit, "xyzw"[chan]);
+   }
+}
+
+
 /**
  * Texel fetch function.
  * In contrast to general sampling there is no filtering, no coord minification,
@@ -2649,8 +2961,7 @@ lp_build_fetch_texel(struct lp_build_sample_context *bld,
    else {
       assert(bld->num_mips == 1);
       if (bld->static_texture_state->target != PIPE_BUFFER) {
-         ilevel = bld->dynamic_state->first_level(bld->dynamic_state, bld->gallivm,
-                                                  bld->context_ptr, texture_unit, NULL);
+         ilevel = lp_build_sample_first_level(bld, texture_unit);
       }
       else {
          ilevel = lp_build_const_int32(bld->gallivm, 0);
@@ -2706,10 +3017,16 @@ lp_build_fetch_texel(struct lp_build_sample_context *bld,
       }
    }
 
-   lp_build_sample_offset(int_coord_bld,
-                          bld->format_desc,
-                          x, y, z, row_stride_vec, img_stride_vec,
-                          &offset, &i, &j);
+   if (bld->static_texture_state->tiled)
+      lp_build_sample_tiled_offset(int_coord_bld,
+                                   bld->format_desc,
+                                   x, y, z, row_stride_vec, img_stride_vec,
+                                   &offset, &i, &j);
+   else
+      lp_build_sample_offset(int_coord_bld,
+                             bld->format_desc,
+                             x, y, z, row_stride_vec, img_stride_vec,
+                             &offset, &i, &j);
 
    if (bld->static_texture_state->target != PIPE_BUFFER) {
       offset = lp_build_add(int_coord_bld, offset,
@@ -2719,7 +3036,8 @@ lp_build_fetch_texel(struct lp_build_sample_context *bld,
    if (bld->fetch_ms) {
       LLVMValueRef num_samples;
       num_samples = bld->dynamic_state->num_samples(bld->dynamic_state, bld->gallivm,
-                                                    bld->context_ptr, texture_unit, NULL);
+                                                    bld->context_ptr, texture_unit,
+                                                    bld->texture_unit_offset);
       out1 = lp_build_cmp(int_coord_bld, PIPE_FUNC_LESS, ms_index, int_coord_bld->zero);
       out_of_bounds = lp_build_or(int_coord_bld, out_of_bounds, out1);
       out1 = lp_build_cmp(int_coord_bld, PIPE_FUNC_GEQUAL, ms_index, lp_build_broadcast_scalar(int_coord_bld, num_samples));
@@ -2788,6 +3106,8 @@ lp_build_sample_soa_code(struct gallivm_state *gallivm,
                          unsigned sample_key,
                          unsigned texture_index,
                          unsigned sampler_index,
+                         LLVMValueRef texture_unit_offset,
+                         LLVMValueRef sampler_unit_offset,
                          LLVMValueRef context_ptr,
                          LLVMValueRef thread_data_ptr,
                          const LLVMValueRef *coords,
@@ -2811,7 +3131,7 @@ lp_build_sample_soa_code(struct gallivm_state *gallivm,
    enum lp_sampler_op_type op_type;
    LLVMValueRef lod_bias = NULL;
    LLVMValueRef explicit_lod = NULL;
-   boolean op_is_tex, op_is_lodq, op_is_gather, fetch_ms;
+   boolean op_is_tex, op_is_lodq, op_is_gather, fetch_ms, use_aniso;
 
    if (0) {
       enum pipe_format fmt = static_texture_state->format;
@@ -2868,6 +3188,8 @@ lp_build_sample_soa_code(struct gallivm_state *gallivm,
    memset(&bld, 0, sizeof bld);
    bld.gallivm = gallivm;
    bld.context_ptr = context_ptr;
+   bld.texture_unit_offset = texture_unit_offset;
+   bld.sampler_unit_offset = sampler_unit_offset;
    bld.static_sampler_state = &derived_sampler_state;
    bld.static_texture_state = static_texture_state;
    bld.dynamic_state = dynamic_state;
@@ -2959,6 +3281,19 @@ lp_build_sample_soa_code(struct gallivm_state *gallivm,
    min_img_filter = derived_sampler_state.min_img_filter;
    mag_img_filter = derived_sampler_state.mag_img_filter;
 
+   /*
+    * Anisotropic filtering, only for implicit lod (or derivatives) 2D
+    * minification with mipmaps, everything else stays isotropic.
+    */
+   use_aniso = derived_sampler_state.aniso > 1 && op_is_tex &&
+               !explicit_lod &&
+               (target == PIPE_TEXTURE_2D || target == PIPE_TEXTURE_2D_ARRAY) &&
+               mip_filter != PIPE_TEX_MIPFILTER_NONE &&
+               min_img_filter == PIPE_TEX_FILTER_LINEAR &&
+               !derived_sampler_state.min_max_lod_equal &&
+               derived_sampler_state.normalized_coords &&
+               bld.texel_type.floating;
+
 
    /*
     * This is all a bit complicated different paths are chosen for performance
@@ -2980,7 +3315,12 @@ lp_build_sample_soa_code(struct gallivm_state *gallivm,
     */
    bld.num_mips = bld.num_lods = 1;
 
-   if (bld.no_quad_lod && bld.no_rho_approx &&
+   if (use_aniso) {
+      /* the footprint, hence the lod, is per element */
+      bld.num_mips = type.length;
+      bld.num_lods = type.length;
+   }
+   else if (bld.no_quad_lod && bld.no_rho_approx &&
        ((mip_filter != PIPE_TEX_MIPFILTER_NONE && op_is_tex &&
          (static_texture_state->target == PIPE_TEXTURE_CUBE ||
           static_texture_state->target == PIPE_TEXTURE_CUBE_ARRAY)) ||
@@ -3062,20 +3402,30 @@ lp_build_sample_soa_code(struct gallivm_state *gallivm,
    lp_build_context_init(&bld.lodi_bld, gallivm, bld.lodi_type);
 
    /* Get the dynamic state */
-   tex_width = dynamic_state->width(dynamic_state, gallivm,
-                                    context_ptr, texture_index, NULL);
+   if (static_texture_state->const_size)
+      tex_width = lp_build_const_int32(gallivm,
+                                       1 << static_texture_state->width_log2);
+   else
+      tex_width = dynamic_state->width(dynamic_state, gallivm,
+                                       context_ptr, texture_index,
+                                       texture_unit_offset);
    bld.row_stride_array = dynamic_state->row_stride(dynamic_state, gallivm,
-                                                    context_ptr, texture_index, NULL);
+                                                    context_ptr, texture_index,
+                                                    texture_unit_offset);
    bld.img_stride_array = dynamic_state->img_stride(dynamic_state, gallivm,
-                                                    context_ptr, texture_index, NULL);
+                                                    context_ptr, texture_index,
+                                                    texture_unit_offset);
    bld.base_ptr = dynamic_state->base_ptr(dynamic_state, gallivm,
-                                          context_ptr, texture_index, NULL);
+                                          context_ptr, texture_index,
+                                          texture_unit_offset);
    bld.mip_offsets = dynamic_state->mip_offsets(dynamic_state, gallivm,
-                                                context_ptr, texture_index, NULL);
+                                                context_ptr, texture_index,
+                                                texture_unit_offset);
 
    if (fetch_ms)
       bld.sample_stride = lp_build_broadcast_scalar(&bld.int_coord_bld, dynamic_state->sample_stride(dynamic_state, gallivm,
-                                                                                                     context_ptr, texture_index, NULL));
+                                                                                                     context_ptr, texture_index,
+                                                                                                     texture_unit_offset));
    /* Note that mip_offsets is an array[level] of offsets to texture images */
 
    if (dynamic_state->cache_ptr && thread_data_ptr) {
@@ -3092,16 +3442,19 @@ lp_build_sample_soa_code(struct gallivm_state *gallivm,
                                             tex_width,
                                             LLVMConstInt(i32t, 0, 0), "");
       if (dims >= 2) {
-         LLVMValueRef tex_height =
+         LLVMValueRef tex_height = static_texture_state->const_size ?
+            lp_build_const_int32(gallivm,
+                                 1 << static_texture_state->height_log2) :
             dynamic_state->height(dynamic_state, gallivm,
-                                  context_ptr, texture_index, NULL);
+                                  context_ptr, texture_index,
+                                  texture_unit_offset);
          bld.int_size = LLVMBuildInsertElement(builder, bld.int_size,
                                                tex_height,
                                                LLVMConstInt(i32t, 1, 0), "");
          if (dims >= 3) {
             LLVMValueRef tex_depth =
                dynamic_state->depth(dynamic_state, gallivm, context_ptr,
-                                    texture_index, NULL);
+                                    texture_index, texture_unit_offset);
             bld.int_size = LLVMBuildInsertElement(builder, bld.int_size,
                                                   tex_depth,
                                                   LLVMConstInt(i32t, 2, 0), "");
@@ -3156,22 +3509,36 @@ lp_build_sample_soa_code(struct gallivm_state *gallivm,
    else {
       LLVMValueRef lod_fpart = NULL, lod_positive = NULL;
       LLVMValueRef ilevel0 = NULL, ilevel1 = NULL, lod = NULL;
-      boolean use_aos;
+      LLVMValueRef aniso_num = NULL, aniso_max = NULL, aniso_axis[2];
+      boolean use_aos, fits_8unorm;
 
-      use_aos = util_format_fits_8unorm(bld.format_desc) &&
+      /*
+       * Decoded sRGB values need more than 8 bits, so they can't be
+       * filtered in AoS, but nearest sampling of the rgba8 variants only
+       * has to decode the fetched texels.
+       */
+      fits_8unorm = util_format_fits_8unorm(bld.format_desc) ||
+                    (bld.format_desc->colorspace == UTIL_FORMAT_COLORSPACE_SRGB &&
+                     util_format_is_rgba8_variant(bld.format_desc) &&
+                     derived_sampler_state.min_img_filter == PIPE_TEX_FILTER_NEAREST &&
+                     derived_sampler_state.mag_img_filter == PIPE_TEX_FILTER_NEAREST &&
+                     derived_sampler_state.min_mip_filter != PIPE_TEX_MIPFILTER_LINEAR);
+
+      use_aos = fits_8unorm &&
                 op_is_tex &&
                 /* not sure this is strictly needed or simply impossible */
                 derived_sampler_state.compare_mode == PIPE_TEX_COMPARE_NONE &&
                 lp_is_simple_wrap_mode(derived_sampler_state.wrap_s);
 
-      use_aos &= bld.num_lods <= num_quads ||
-                 derived_sampler_state.min_img_filter ==
-                    derived_sampler_state.mag_img_filter;
-
       if(gallivm_perf & GALLIVM_PERF_NO_AOS_SAMPLING) {
          use_aos = 0;
       }
 
+      /* The AoS code computes linear offsets itself */
+      if (static_texture_state->tiled) {
+         use_aos = 0;
+      }
+
       if (dims > 1) {
          use_aos &= lp_is_simple_wrap_mode(derived_sampler_state.wrap_t);
          if (dims > 2) {
@@ -3187,12 +3554,28 @@ lp_build_sample_soa_code(struct gallivm_state *gallivm,
          use_aos = 0;
       }
 
-      if ((gallivm_debug & GALLIVM_DEBUG_PERF) &&
-          !use_aos && util_format_fits_8unorm(bld.format_desc)) {
-         debug_printf("%s: using floating point linear filtering for %s\n",
-                      __FUNCTION__, bld.format_desc->short_name);
+      if (use_aniso) {
+         /* The AoS code has no notion of the footprint */
+         use_aos = 0;
+
+         lp_build_aniso_footprint(&bld, texture_index,
+                                  newcoords[0], newcoords[1], derivs,
+                                  &explicit_lod, &aniso_num, &aniso_max,
+                                  aniso_axis);
+         if (lod_bias) {
+            explicit_lod = lp_build_add(&bld.coord_bld, explicit_lod, lod_bias);
+            lod_bias = NULL;
+         }
+         derivs = NULL;
+      }
+
+      if ((gallivm_debug & GALLIVM_DEBUG_PERF) && fits_8unorm) {
+         debug_printf("%s: using %s filtering for %s\n",
+                      __FUNCTION__,
+                      use_aos ? "8-bit AoS" : "floating point linear",
+                      bld.format_desc->short_name);
          debug_printf("  min_img %d  mag_img %d  mip %d  target %d  seamless %d"
-                      "  wraps %d  wrapt %d  wrapr %d\n",
+                      "  wraps %d  wrapt %d  wrapr %d  lods %u\n",
                       derived_sampler_state.min_img_filter,
                       derived_sampler_state.mag_img_filter,
                       derived_sampler_state.min_mip_filter,
@@ -3200,7 +3583,8 @@ lp_build_sample_soa_code(struct gallivm_state *gallivm,
                       derived_sampler_state.seamless_cube_map,
                       derived_sampler_state.wrap_s,
                       derived_sampler_state.wrap_t,
-                      derived_sampler_state.wrap_r);
+                      derived_sampler_state.wrap_r,
+                      bld.num_lods);
       }
 
       lp_build_sample_common(&bld, op_is_lodq, texture_index, sampler_index,
@@ -3241,6 +3625,14 @@ lp_build_sample_soa_code(struct gallivm_state *gallivm,
                                 texel_out);
          }
 
+         else if (use_aniso) {
+            lp_build_sample_aniso(&bld, sampler_index,
+                                  newcoords, offsets,
+                                  lod_positive, lod_fpart,
+                                  ilevel0, ilevel1,
+                                  aniso_num, aniso_max, aniso_axis,
+                                  texel_out);
+         }
          else {
             lp_build_sample_general(&bld, sampler_index,
                                     op_type == LP_SAMPLER_OP_GATHER,
@@ -3267,6 +3659,8 @@ lp_build_sample_soa_code(struct gallivm_state *gallivm,
          bld4.no_brilinear = bld.no_brilinear;
          bld4.gallivm = bld.gallivm;
          bld4.context_ptr = bld.context_ptr;
+         bld4.texture_unit_offset = bld.texture_unit_offset;
+         bld4.sampler_unit_offset = bld.sampler_unit_offset;
          bld4.static_texture_state = bld.static_texture_state;
          bld4.static_sampler_state = bld.static_sampler_state;
          bld4.dynamic_state = bld.dynamic_state;
@@ -3456,6 +3850,8 @@ get_target_info(enum pipe_texture_target target,
 
 /**
  * Generate the function body for a texture sampling function.
+ * If shared, the texture and sampler units are the function's second and
+ * third arguments instead of texture_index and sampler_index.
  */
 static void
 lp_build_sample_gen_func(struct gallivm_state *gallivm,
@@ -3465,6 +3861,7 @@ lp_build_sample_gen_func(struct gallivm_state *gallivm,
                          struct lp_type type,
                          unsigned texture_index,
                          unsigned sampler_index,
+                         boolean shared,
                          LLVMValueRef function,
                          unsigned num_args,
                          unsigned sample_key)
@@ -3477,6 +3874,8 @@ lp_build_sample_gen_func(struct gallivm_state *gallivm,
    LLVMValueRef ms_index = NULL;
    LLVMValueRef context_ptr;
    LLVMValueRef thread_data_ptr = NULL;
+   LLVMValueRef texture_unit_offset = NULL;
+   LLVMValueRef sampler_unit_offset = NULL;
    LLVMValueRef texel_out[4];
    struct lp_derivatives derivs;
    struct lp_derivatives *deriv_ptr = NULL;
@@ -3509,6 +3908,12 @@ lp_build_sample_gen_func(struct gallivm_state *gallivm,
 
    /* "unpack" arguments */
    context_ptr = LLVMGetParam(function, num_param++);
+   if (shared) {
+      texture_unit_offset = LLVMGetParam(function, num_param++);
+      sampler_unit_offset = LLVMGetParam(function, num_param++);
+      texture_index = 0;
+      sampler_index = 0;
+   }
    if (need_cache) {
       thread_data_ptr = LLVMGetParam(function, num_param++);
    }
@@ -3564,6 +3969,8 @@ lp_build_sample_gen_func(struct gallivm_state *gallivm,
                             sample_key,
                             texture_index,
                             sampler_index,
+                            texture_unit_offset,
+                            sampler_unit_offset,
                             context_ptr,
                             thread_data_ptr,
                             coords,
@@ -3582,9 +3989,41 @@ lp_build_sample_gen_func(struct gallivm_state *gallivm,
 }
 
 
+/**
+ * Name the sampling function of the static state, sample key and vector
+ * length for all the units, by the bytes of the static state (which are
+ * memset before being filled in, see lp_sampler_static_texture_state()).
+ */
+static void
+lp_build_sample_func_name(char *name, size_t size,
+                          const struct lp_static_texture_state *static_texture_state,
+                          const struct lp_static_sampler_state *static_sampler_state,
+                          unsigned sample_key,
+                          struct lp_type type)
+{
+   const uint8_t *texture_bytes = (const uint8_t *)static_texture_state;
+   const uint8_t *sampler_bytes = (const uint8_t *)static_sampler_state;
+   unsigned i, len;
+
+   len = snprintf(name, size, "texfunc_%x_%u_", sample_key, type.length);
+   for (i = 0; i < sizeof *static_texture_state; i++)
+      len += snprintf(name + len, size - len, "%02x", texture_bytes[i]);
+   len += snprintf(name + len, size - len, "_");
+   for (i = 0; i < sizeof *static_sampler_state; i++)
+      len += snprintf(name + len, size - len, "%02x", sampler_bytes[i]);
+
+   assert(len < size);
+}
+
+
 /**
  * Call the matching function for texture sampling.
  * If there's no match, generate a new one.
+ *
+ * Functions are shared by all the texture and sampler units with the same
+ * static state, which get passed as arguments, so that a shader sampling
+ * several textures the same way has one copy of the sampling code.  Except
+ * with a texture cache, whose pointer is per texture unit.
  */
 static void
 lp_build_sample_soa_func(struct gallivm_state *gallivm,
@@ -3602,7 +4041,7 @@ lp_build_sample_soa_func(struct gallivm_state *gallivm,
    LLVMValueRef args[LP_MAX_TEX_FUNC_ARGS];
    LLVMBasicBlockRef bb;
    unsigned num_args = 0;
-   char func_name[64];
+   char func_name[128];
    unsigned i, num_coords, num_derivs, num_offsets, layer;
    unsigned sample_key = params->sample_key;
    const LLVMValueRef *coords = params->coords;
@@ -3611,6 +4050,7 @@ lp_build_sample_soa_func(struct gallivm_state *gallivm,
    enum lp_sampler_lod_control lod_control;
    enum lp_sampler_op_type op_type;
    boolean need_cache = FALSE;
+   boolean shared;
 
    lod_control = (sample_key & LP_SAMPLER_LOD_CONTROL_MASK) >>
                     LP_SAMPLER_LOD_CONTROL_SHIFT;
@@ -3632,6 +4072,8 @@ lp_build_sample_soa_func(struct gallivm_state *gallivm,
          need_cache = TRUE;
       }
    }
+   shared = !need_cache;
+
    /*
     * texture function matches are found by name.
     * Thus the name has to include both the texture and sampler unit
@@ -3640,8 +4082,13 @@ lp_build_sample_soa_func(struct gallivm_state *gallivm,
     * Additionally lod_property has to be included too.
     */
 
-   snprintf(func_name, sizeof(func_name), "texfunc_res_%d_sam_%d_%x",
-            texture_index, sampler_index, sample_key);
+   if (shared)
+      lp_build_sample_func_name(func_name, sizeof(func_name),
+                                static_texture_state, static_sampler_state,
+                                sample_key, params->type);
+   else
+      snprintf(func_name, sizeof(func_name), "texfunc_res_%d_sam_%d_%x",
+               texture_index, sampler_index, sample_key);
 
    function = LLVMGetNamedFunction(module, func_name);
 
@@ -3657,6 +4104,10 @@ lp_build_sample_soa_func(struct gallivm_state *gallivm,
        */
 
       arg_types[num_param++] = LLVMTypeOf(params->context_ptr);
+      if (shared) {
+         arg_types[num_param++] = LLVMInt32TypeInContext(gallivm->context);
+         arg_types[num_param++] = LLVMInt32TypeInContext(gallivm->context);
+      }
       if (need_cache) {
          arg_types[num_param++] = LLVMTypeOf(params->thread_data_ptr);
       }
@@ -3716,6 +4167,7 @@ lp_build_sample_soa_func(struct gallivm_state *gallivm,
                                params->type,
                                texture_index,
                                sampler_index,
+                               shared,
                                function,
                                num_param,
                                sample_key);
@@ -3723,6 +4175,10 @@ lp_build_sample_soa_func(struct gallivm_state *gallivm,
 
    num_args = 0;
    args[num_args++] = params->context_ptr;
+   if (shared) {
+      args[num_args++] = lp_build_const_int32(gallivm, texture_index);
+      args[num_args++] = lp_build_const_int32(gallivm, sampler_index);
+   }
    if (need_cache) {
       args[num_args++] = params->thread_data_ptr;
    }
@@ -3834,6 +4290,7 @@ lp_build_sample_soa(const struct lp_static_texture_state *static_texture_state,
                                params->sample_key,
                                params->texture_index,
                                params->sampler_index,
+                               NULL, NULL,
                                params->context_ptr,
                                params->thread_data_ptr,
                                params->coords,
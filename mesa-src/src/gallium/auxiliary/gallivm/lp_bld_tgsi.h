@@ -256,6 +256,11 @@ struct lp_build_fs_iface {
                     struct lp_build_context *bld,
                     unsigned cbuf,
                     LLVMValueRef result[4]);
+
+   /** Fetch an input where it's read instead of from inputs (optional) */
+   LLVMValueRef (*load_input)(const struct lp_build_fs_iface *iface,
+                              struct lp_build_context *bld,
+                              unsigned attrib, unsigned chan);
 };
 
 void
@@ -285,6 +290,7 @@ struct lp_build_tgsi_params {
    LLVMValueRef kernel_args;
    const struct lp_build_fs_iface *fs_iface;
    unsigned gs_vertex_streams;
+   uint64_t *skipped_bodies;  /**< NIR only, counts branched around bodies */
 };
 
 void
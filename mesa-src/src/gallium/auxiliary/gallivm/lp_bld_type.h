@@ -38,6 +38,7 @@
 
 
 #include "util/format/u_format.h"
+#include "util/u_cpu_detect.h"
 #include "pipe/p_compiler.h"
 #include "gallivm/lp_bld.h"
 
@@ -53,6 +54,47 @@ extern "C" {
  */
 extern unsigned lp_native_vector_width;
 
+/**
+ * Whether AVX-512 code may be generated.  This is only the case with
+ * 512-bit native vectors (LP_NATIVE_VECTOR_WIDTH=512), as zmm registers
+ * lower the clock of many CPUs, and LLVM is told not to use them
+ * otherwise.
+ */
+static inline boolean
+lp_has_avx512(void)
+{
+   return lp_native_vector_width >= 512 &&
+          util_cpu_caps.has_avx512f && util_cpu_caps.has_avx512bw &&
+          util_cpu_caps.has_avx512dq && util_cpu_caps.has_avx512vl;
+}
+
+/**
+ * Whether the AArch64 NEON intrinsics may be used.  32-bit Arm NEON lacks
+ * most of them (saturating narrows to unsigned, rounding conversions,
+ * minNum/maxNum).
+ */
+static inline boolean
+lp_has_neon64(void)
+{
+#if defined(PIPE_ARCH_AARCH64)
+   return util_cpu_caps.has_neon;
+#else
+   return FALSE;
+#endif
+}
+
+/**
+ * Whether 256-bit vectors are lowered to SVE.  Like AVX-512 this is opt-in
+ * with LP_NATIVE_VECTOR_WIDTH=256, and needs SVE registers of at least
+ * 256 bits, NEON having 128-bit registers only.
+ */
+static inline boolean
+lp_has_sve256(void)
+{
+   return lp_native_vector_width >= 256 &&
+          util_cpu_caps.has_sve && util_cpu_caps.sve_vector_bits >= 256;
+}
+
 /**
  * Maximum supported vector width (not necessarily supported at run-time).
  *
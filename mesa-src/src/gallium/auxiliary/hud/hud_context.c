@@ -638,6 +638,18 @@ hud_stop_queries(struct hud_context *hud, struct pipe_context *pipe)
    struct hud_pane *pane;
    struct hud_graph *gr, *next;
 
+   /* Nothing is drawn, only the values are needed */
+   if (hud->headless) {
+      hud_batch_query_update(hud->batch_query, pipe);
+
+      LIST_FOR_EACH_ENTRY(pane, &hud->pane_list, head) {
+         LIST_FOR_EACH_ENTRY(gr, &pane->graph_list, head) {
+            gr->query_new_value(gr, pipe);
+         }
+      }
+      return;
+   }
+
    /* prepare vertex buffers */
    hud_prepare_vertices(hud, &hud->bg, 16 * 256, 2 * sizeof(float));
    hud_prepare_vertices(hud, &hud->whitelines, 4 * 256, 2 * sizeof(float));
@@ -945,7 +957,13 @@ hud_pane_add_graph(struct hud_pane *pane, struct hud_graph *gr)
 void
 hud_graph_add_value(struct hud_graph *gr, double value)
 {
+   struct hud_context *hud = gr->pane->hud;
+
    gr->current_value = value;
+
+   if (hud->value_callback)
+      hud->value_callback(hud->value_callback_data, gr->name, value);
+
    value = value > gr->pane->ceiling ? gr->pane->ceiling : value;
 
    if (gr->fd) {
@@ -1907,6 +1925,52 @@ hud_create(struct cso_context *cso, struct hud_context *share)
    return hud;
 }
 
+/**
+ * Create a HUD which is never drawn, for contexts without a window.
+ *
+ * "config" has the syntax of GALLIUM_HUD.  The queries are executed in
+ * "pipe" and their values are sampled by hud_record_only(), typically
+ * once per frame.  They go to the GALLIUM_HUD_DUMP_DIR files and to the
+ * callback set with hud_set_value_callback().
+ */
+struct hud_context *
+hud_create_headless(struct pipe_context *pipe, const char *config)
+{
+   struct hud_context *hud;
+
+   if (!config || !*config)
+      return NULL;
+
+   if (strcmp(config, "help") == 0) {
+      print_help(pipe->screen);
+      return NULL;
+   }
+
+   hud = CALLOC_STRUCT(hud_context);
+   if (!hud)
+      return NULL;
+
+   hud->refcount = 1;
+   hud->headless = true;
+   list_inithead(&hud->pane_list);
+
+   hud_set_record_context(hud, pipe);
+   hud_parse_env_var(hud, pipe->screen, config);
+   return hud;
+}
+
+/**
+ * Pass every new value of every graph to "callback", with the graph's name.
+ * The values aren't limited by the pane's ceiling.
+ */
+void
+hud_set_value_callback(struct hud_context *hud, hud_value_callback callback,
+                       void *data)
+{
+   hud->value_callback = callback;
+   hud->value_callback_data = data;
+}
+
 /**
  * Destroy a HUD. If the HUD has several users, decrease the reference counter
  * and detach the context from the HUD.
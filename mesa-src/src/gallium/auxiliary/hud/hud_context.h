@@ -34,9 +34,19 @@ struct pipe_context;
 struct pipe_resource;
 struct util_queue_monitoring;
 
+typedef void (*hud_value_callback)(void *data, const char *name,
+                                   double value);
+
 struct hud_context *
 hud_create(struct cso_context *cso, struct hud_context *share);
 
+struct hud_context *
+hud_create_headless(struct pipe_context *pipe, const char *config);
+
+void
+hud_set_value_callback(struct hud_context *hud, hud_value_callback callback,
+                       void *data);
+
 void
 hud_destroy(struct hud_context *hud, struct cso_context *cso);
 
@@ -32,6 +32,7 @@
 #include "pipe/p_state.h"
 #include "util/list.h"
 #include "hud/font.h"
+#include "hud/hud_context.h"
 #include "cso_cache/cso_context.h"
 
 enum hud_counter {
@@ -43,6 +44,10 @@ enum hud_counter {
 struct hud_context {
    int refcount;
    bool simple;
+   bool headless;   /* see hud_create_headless() */
+
+   hud_value_callback value_callback;
+   void *value_callback_data;
 
    /* Context where queries are executed. */
    struct pipe_context *record_pipe;
@@ -43,6 +43,10 @@ struct pp_program;
 typedef void (*pp_func) (struct pp_queue_t *, struct pipe_resource *,
                          struct pipe_resource *, unsigned int);
 
+/* A CPU run function, returns false to fall back to the pp_func */
+typedef bool (*pp_cpu_func) (struct pp_queue_t *, struct pipe_resource *,
+                             struct pipe_resource *, unsigned int);
+
 /* Main functions */
 
 /**
@@ -71,6 +75,22 @@ void pp_jimenezmlaa(struct pp_queue_t *, struct pipe_resource *,
 void pp_jimenezmlaa_color(struct pp_queue_t *, struct pipe_resource *,
                           struct pipe_resource *, unsigned int);
 
+/* The CPU versions of the filters, used on software rasterizers */
+
+bool pp_nored_cpu(struct pp_queue_t *, struct pipe_resource *,
+                  struct pipe_resource *, unsigned int);
+bool pp_nogreen_cpu(struct pp_queue_t *, struct pipe_resource *,
+                    struct pipe_resource *, unsigned int);
+bool pp_noblue_cpu(struct pp_queue_t *, struct pipe_resource *,
+                   struct pipe_resource *, unsigned int);
+bool pp_celshade_cpu(struct pp_queue_t *, struct pipe_resource *,
+                     struct pipe_resource *, unsigned int);
+
+bool pp_jimenezmlaa_cpu(struct pp_queue_t *, struct pipe_resource *,
+                        struct pipe_resource *, unsigned int);
+bool pp_jimenezmlaa_color_cpu(struct pp_queue_t *, struct pipe_resource *,
+                              struct pipe_resource *, unsigned int);
+
 /* The filter init functions */
 
 bool pp_celshade_init(struct pp_queue_t *, unsigned int, unsigned int);
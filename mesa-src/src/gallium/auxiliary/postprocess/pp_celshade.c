@@ -30,6 +30,70 @@
 #include "postprocess/pp_filters.h"
 #include "postprocess/pp_private.h"
 
+#include "util/u_math.h"
+
+/**
+ * The celshade shader's maths: the luma is quantized to quarters, with the
+ * last 0.025 before each step smoothed, and the color scaled by it.
+ */
+static float
+pp_celshade_factor(float luma)
+{
+   float q = roundf(luma * 4.0f) * 0.25f;
+   float d = luma - q;
+
+   if (d > 0.1f) {
+      float t = (d - 0.1f) / 0.025f;
+      q += t * t * (3.0f - 2.0f * t) * 0.125f;
+   } else if (d < -0.1f) {
+      float t = (d + 0.125f) / 0.025f;
+      q -= (1.0f - t * t * (3.0f - 2.0f * t)) * 0.125f;
+   }
+
+   return q * 2.0f + 0.1f;
+}
+
+static void
+pp_celshade_cpu_rows(const void *data, unsigned int y0, unsigned int y1)
+{
+   const struct pp_cpu_color_pass *pass = data;
+   unsigned int x, y, i;
+
+   for (y = y0; y < y1; y++) {
+      const uint8_t *src = pass->in.data + y * pass->in.stride;
+      uint8_t *dst = pass->out.data + y * pass->out.stride;
+
+      for (x = 0; x < pass->width; x++) {
+         uint8_t c[4];
+         float f;
+
+         pp_cpu_load(src + x * 4, pass->in_rgba, c);
+         f = pp_celshade_factor((0.2126f * c[0] + 0.7152f * c[1] +
+                                 0.0722f * c[2]) * (1.0f / 255.0f));
+         for (i = 0; i < 4; i++)
+            c[i] = (uint8_t) CLAMP(c[i] * f + 0.5f, 0.0f, 255.0f);
+         pp_cpu_store(dst + x * 4, pass->out_rgba, c);
+      }
+   }
+}
+
+/** The CPU version of the celshade filter */
+bool
+pp_celshade_cpu(struct pp_queue_t *ppq, struct pipe_resource *in,
+                struct pipe_resource *out, unsigned int n)
+{
+   struct pp_cpu_color_pass pass;
+
+   if (!pp_cpu_begin_color(ppq, in, out, &pass))
+      return false;
+
+   pp_cpu_run_rows(ppq, pp_celshade_cpu_rows, &pass, pass.height);
+
+   pp_cpu_end_color(ppq, &pass);
+
+   return true;
+}
+
 /** Init function */
 bool
 pp_celshade_init(struct pp_queue_t *ppq, unsigned int n, unsigned int val)
@@ -55,6 +55,65 @@ pp_nocolor(struct pp_queue_t *ppq, struct pipe_resource *in,
    pp_filter_end_pass(p);
 }
 
+static void
+pp_nocolor_cpu_rows(const void *data, unsigned int y0, unsigned int y1)
+{
+   const struct pp_cpu_color_pass *pass = data;
+   unsigned int x, y;
+
+   for (y = y0; y < y1; y++) {
+      const uint8_t *src = pass->in.data + y * pass->in.stride;
+      uint8_t *dst = pass->out.data + y * pass->out.stride;
+
+      for (x = 0; x < pass->width; x++) {
+         uint8_t c[4];
+
+         pp_cpu_load(src + x * 4, pass->in_rgba, c);
+         c[pass->param] = 0;
+         pp_cpu_store(dst + x * 4, pass->out_rgba, c);
+      }
+   }
+}
+
+/** The CPU version of pp_nocolor, zeroing one channel. */
+static bool
+pp_nocolor_cpu(struct pp_queue_t *ppq, struct pipe_resource *in,
+               struct pipe_resource *out, unsigned int channel)
+{
+   struct pp_cpu_color_pass pass;
+
+   if (!pp_cpu_begin_color(ppq, in, out, &pass))
+      return false;
+
+   pass.param = channel;
+   pp_cpu_run_rows(ppq, pp_nocolor_cpu_rows, &pass, pass.height);
+
+   pp_cpu_end_color(ppq, &pass);
+
+   return true;
+}
+
+bool
+pp_nored_cpu(struct pp_queue_t *ppq, struct pipe_resource *in,
+             struct pipe_resource *out, unsigned int n)
+{
+   return pp_nocolor_cpu(ppq, in, out, 0);
+}
+
+bool
+pp_nogreen_cpu(struct pp_queue_t *ppq, struct pipe_resource *in,
+               struct pipe_resource *out, unsigned int n)
+{
+   return pp_nocolor_cpu(ppq, in, out, 1);
+}
+
+bool
+pp_noblue_cpu(struct pp_queue_t *ppq, struct pipe_resource *in,
+              struct pipe_resource *out, unsigned int n)
+{
+   return pp_nocolor_cpu(ppq, in, out, 2);
+}
+
 
 /* Init functions */
 
@@ -0,0 +1,287 @@
+/*
+ * Copyright © 2026 Mesa contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * CPU versions of the filters.
+ *
+ * On a software rasterizer, drawing a screen quad per pass means running
+ * the TGSI shaders through the whole pipeline, with a texture fetch per
+ * neighbour.  The filters' CPU versions do the same maths on the mapped
+ * resources instead, splitting each pass into bands of rows which run on
+ * a small pool of threads.  The filters themselves live next to their
+ * shaders; this file has the parts they share.
+ */
+
+#include "postprocess/postprocess.h"
+#include "postprocess/pp_private.h"
+
+#include "pipe/p_screen.h"
+#include "util/format/u_format.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_inlines.h"
+#include "util/u_math.h"
+#include "util/u_memory.h"
+
+/** Bands queued per thread, so that uneven bands even out */
+#define PP_CPU_BANDS_PER_THREAD 4
+/** Rows below which a band isn't worth queueing */
+#define PP_CPU_MIN_BAND_ROWS 16
+#define PP_CPU_MAX_THREADS 16
+
+
+/** Allocate the CPU queue, when the screen is a software rasterizer. */
+bool
+pp_cpu_init(struct pp_queue_t *ppq, unsigned int num_filters)
+{
+   struct pipe_screen *screen = ppq->p->screen;
+
+   if (screen->get_param(screen, PIPE_CAP_ACCELERATED))
+      return true;
+
+   ppq->cpu_queue = CALLOC(num_filters, sizeof(pp_cpu_func));
+   ppq->cpu_params = CALLOC(num_filters, sizeof(unsigned int));
+   if (!ppq->cpu_queue || !ppq->cpu_params) {
+      pp_debug("Unable to allocate memory for cpu_queue.\n");
+      return false;
+   }
+
+   pp_debug("Using the CPU filters.\n");
+
+   return true;
+}
+
+/** Free the CPU threads and scratch buffers. */
+void
+pp_cpu_free(struct pp_queue_t *ppq)
+{
+   if (ppq->cpu_num_threads > 1)
+      util_queue_destroy(&ppq->cpu_threads);
+   ppq->cpu_num_threads = 0;
+
+   FREE(ppq->cpu_bands);
+   FREE(ppq->cpu_values);
+   FREE(ppq->cpu_edges);
+   FREE(ppq->cpu_weights);
+   FREE(ppq->cpu_queue);
+   FREE(ppq->cpu_params);
+   ppq->cpu_bands = NULL;
+   ppq->cpu_values = NULL;
+   ppq->cpu_edges = ppq->cpu_weights = NULL;
+   ppq->cpu_queue = NULL;
+   ppq->cpu_params = NULL;
+}
+
+/**
+ * Whether the CPU filters can read or write this resource, and if so the
+ * byte of each of R, G, B and A, or PIPE_SWIZZLE_0/1 for a missing one.
+ */
+bool
+pp_cpu_color_format(const struct pipe_resource *res, unsigned int *rgba)
+{
+   const struct util_format_description *desc =
+      util_format_description(res->format);
+   unsigned int i;
+
+   if (!desc || !util_format_is_rgba8_variant(desc) ||
+       desc->colorspace != UTIL_FORMAT_COLORSPACE_RGB ||
+       res->nr_samples > 1)
+      return false;
+
+   for (i = 0; i < 4; i++)
+      rgba[i] = desc->swizzle[i];
+
+   return rgba[0] < 4 && rgba[1] < 4 && rgba[2] < 4;
+}
+
+/** Map the whole of level 0 of a resource. */
+bool
+pp_cpu_map(struct pp_queue_t *ppq, struct pipe_resource *res,
+           unsigned int usage, struct pp_cpu_map *map)
+{
+   map->data = pipe_transfer_map(ppq->p->pipe, res, 0, 0, usage, 0, 0,
+                                 res->width0, res->height0, &map->transfer);
+   if (!map->data)
+      return false;
+
+   map->stride = map->transfer->stride;
+
+   return true;
+}
+
+void
+pp_cpu_unmap(struct pp_queue_t *ppq, struct pp_cpu_map *map)
+{
+   if (map->data)
+      pipe_transfer_unmap(ppq->p->pipe, map->transfer);
+   map->data = NULL;
+}
+
+/**
+ * Check the formats of and map a filter's input and output, sized like
+ * the GPU passes' framebuffer.  Returns false to fall back to the GPU
+ * version.
+ */
+bool
+pp_cpu_begin_color(struct pp_queue_t *ppq, struct pipe_resource *in,
+                   struct pipe_resource *out, struct pp_cpu_color_pass *pass)
+{
+   memset(pass, 0, sizeof(*pass));
+
+   if (in == out ||
+       !pp_cpu_color_format(in, pass->in_rgba) ||
+       !pp_cpu_color_format(out, pass->out_rgba))
+      return false;
+
+   pass->width = MIN3(ppq->p->framebuffer.width, in->width0, out->width0);
+   pass->height = MIN3(ppq->p->framebuffer.height, in->height0, out->height0);
+
+   if (!pp_cpu_map(ppq, in, PIPE_TRANSFER_READ, &pass->in) ||
+       !pp_cpu_map(ppq, out, PIPE_TRANSFER_WRITE, &pass->out)) {
+      pp_cpu_end_color(ppq, pass);
+      return false;
+   }
+
+   return true;
+}
+
+void
+pp_cpu_end_color(struct pp_queue_t *ppq, struct pp_cpu_color_pass *pass)
+{
+   pp_cpu_unmap(ppq, &pass->out);
+   pp_cpu_unmap(ppq, &pass->in);
+}
+
+/** Size the MLAA scratch buffers. */
+bool
+pp_cpu_scratch(struct pp_queue_t *ppq, unsigned int w, unsigned int h)
+{
+   size_t pixels = (size_t) w * h;
+
+   if (ppq->cpu_values && ppq->cpu_width == w && ppq->cpu_height == h)
+      return true;
+
+   FREE(ppq->cpu_values);
+   FREE(ppq->cpu_edges);
+   FREE(ppq->cpu_weights);
+
+   pp_debug("Allocating the CPU scratch, size %ux%u\n", w, h);
+
+   ppq->cpu_values = MALLOC(pixels * sizeof(float));
+   ppq->cpu_edges = MALLOC(pixels * 4);
+   ppq->cpu_weights = MALLOC(pixels * 4);
+
+   if (!ppq->cpu_values || !ppq->cpu_edges || !ppq->cpu_weights) {
+      FREE(ppq->cpu_values);
+      FREE(ppq->cpu_edges);
+      FREE(ppq->cpu_weights);
+      ppq->cpu_values = NULL;
+      ppq->cpu_edges = ppq->cpu_weights = NULL;
+      return false;
+   }
+
+   ppq->cpu_width = w;
+   ppq->cpu_height = h;
+
+   return true;
+}
+
+static void
+pp_cpu_band_execute(void *job, int thread_index)
+{
+   struct pp_cpu_band *band = job;
+
+   band->func(band->data, band->y0, band->y1);
+}
+
+/** Start the thread pool, on the first run. */
+static void
+pp_cpu_start_threads(struct pp_queue_t *ppq)
+{
+   unsigned int threads;
+
+   util_cpu_detect();
+   threads = CLAMP(util_cpu_caps.nr_cpus, 1, PP_CPU_MAX_THREADS);
+
+   if (threads > 1) {
+      ppq->cpu_bands = CALLOC(threads * PP_CPU_BANDS_PER_THREAD,
+                              sizeof(struct pp_cpu_band));
+
+      /* The calling thread runs a band too. */
+      if (!ppq->cpu_bands ||
+          !util_queue_init(&ppq->cpu_threads, "pp",
+                           threads * PP_CPU_BANDS_PER_THREAD, threads - 1, 0)) {
+         pp_debug("Failed to start the CPU filter threads\n");
+         FREE(ppq->cpu_bands);
+         ppq->cpu_bands = NULL;
+         threads = 1;
+      } else {
+         ppq->cpu_max_bands = threads * PP_CPU_BANDS_PER_THREAD;
+      }
+   }
+
+   ppq->cpu_num_threads = threads;
+}
+
+/**
+ * Run func over rows [0, height), in bands on the CPU threads.  Returns
+ * once all of them are done, so passes can read the previous one's output
+ * in any row.
+ */
+void
+pp_cpu_run_rows(struct pp_queue_t *ppq, pp_cpu_rows_func func,
+                const void *data, unsigned int height)
+{
+   unsigned int n, i;
+
+   if (!ppq->cpu_num_threads)
+      pp_cpu_start_threads(ppq);
+
+   n = MIN2(ppq->cpu_max_bands, DIV_ROUND_UP(height, PP_CPU_MIN_BAND_ROWS));
+   if (ppq->cpu_num_threads < 2 || n < 2) {
+      func(data, 0, height);
+      return;
+   }
+
+   for (i = 0; i < n; i++) {
+      struct pp_cpu_band *band = &ppq->cpu_bands[i];
+
+      band->func = func;
+      band->data = data;
+      band->y0 = height * i / n;
+      band->y1 = height * (i + 1) / n;
+
+      if (i) {
+         util_queue_fence_init(&band->fence);
+         util_queue_add_job(&ppq->cpu_threads, band, &band->fence,
+                            pp_cpu_band_execute, NULL, 0);
+      }
+   }
+
+   func(data, ppq->cpu_bands[0].y0, ppq->cpu_bands[0].y1);
+
+   for (i = 1; i < n; i++) {
+      util_queue_fence_wait(&ppq->cpu_bands[i].fence);
+      util_queue_fence_destroy(&ppq->cpu_bands[i].fence);
+   }
+}
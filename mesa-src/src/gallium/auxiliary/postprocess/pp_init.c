@@ -84,6 +84,9 @@ pp_init(struct pipe_context *pipe, const unsigned int *enabled,
       goto error;
    }
 
+   if (!pp_cpu_init(ppq, num_filters))
+      goto error;
+
    /* Add the enabled filters to the queue, in order */
    curpos = 0;
    for (i = 0; i < PP_FILTERS; i++) {
@@ -92,6 +95,11 @@ pp_init(struct pipe_context *pipe, const unsigned int *enabled,
          tmp_req = MAX2(tmp_req, pp_filters[i].inner_tmps);
          ppq->filters[curpos] = i;
 
+         if (ppq->cpu_queue) {
+            ppq->cpu_queue[curpos] = pp_filters[i].cpu;
+            ppq->cpu_params[curpos] = enabled[i];
+         }
+
          if (pp_filters[i].shaders) {
             ppq->shaders[curpos] =
                CALLOC(pp_filters[i].shaders + 1, sizeof(void *));
@@ -223,6 +231,8 @@ pp_free(struct pp_queue_t *ppq)
       FREE(ppq->p);
    }
 
+   pp_cpu_free(ppq);
+
    /*
     * Handle partial initialization for common resource destruction
     * in the create path.
@@ -45,7 +45,9 @@
 #include "postprocess/pp_filters.h"
 #include "postprocess/pp_private.h"
 
+#include "util/format/u_format.h"
 #include "util/u_box.h"
+#include "util/u_math.h"
 #include "util/u_sampler.h"
 #include "util/u_inlines.h"
 #include "util/u_memory.h"
@@ -324,6 +326,323 @@ pp_jimenezmlaa_color(struct pp_queue_t *ppq, struct pipe_resource *in,
 }
 
 
+/*
+ * The CPU version of MLAA.  It does the three passes of the shaders above,
+ * with the bilinear fetches they make worked out on the 0/1 edges: the
+ * searches step over two pixels at a time, and the crossing edges are
+ * counted 1 for the row or column outside and 3 for the one inside.  The
+ * results match the GPU passes' 8 bit intermediates, and the stencil is
+ * the edges map being non-zero.
+ */
+
+struct pp_mlaa_cpu_pass
+{
+   struct pp_cpu_color_pass color;
+   struct pp_cpu_map depth;
+   enum pipe_format depth_format;
+
+   float *values;
+   uint8_t *edges, *weights;
+
+   float threshold;
+   int max_steps;
+};
+
+static inline const uint8_t *
+pp_mlaa_cpu_edge(const struct pp_mlaa_cpu_pass *pass, int x, int y)
+{
+   x = CLAMP(x, 0, (int) pass->color.width - 1);
+   y = CLAMP(y, 0, (int) pass->color.height - 1);
+
+   return &pass->edges[((size_t) y * pass->color.width + x) * 4];
+}
+
+static inline const uint8_t *
+pp_mlaa_cpu_weight(const struct pp_mlaa_cpu_pass *pass, int x, int y)
+{
+   x = MIN2(x, (int) pass->color.width - 1);
+   y = MIN2(y, (int) pass->color.height - 1);
+
+   return &pass->weights[((size_t) y * pass->color.width + x) * 4];
+}
+
+/** The luma or the depth, which the edges are found in */
+static void
+pp_mlaa_cpu_values(const void *data, unsigned int y0, unsigned int y1)
+{
+   const struct pp_mlaa_cpu_pass *pass = data;
+   unsigned int w = pass->color.width, x, y;
+
+   for (y = y0; y < y1; y++) {
+      float *dst = &pass->values[(size_t) y * w];
+
+      if (pass->depth.data) {
+         util_format_unpack_z_float(pass->depth_format, dst,
+                                    pass->depth.data + y * pass->depth.stride,
+                                    w);
+         continue;
+      }
+
+      for (x = 0; x < w; x++) {
+         const uint8_t *src = pass->color.in.data + y * pass->color.in.stride +
+                              x * 4;
+         uint8_t c[4];
+
+         pp_cpu_load(src, pass->color.in_rgba, c);
+         dst[x] = (0.2126f * c[0] + 0.7152f * c[1] + 0.0722f * c[2]) *
+                  (1.0f / 255.0f);
+      }
+   }
+}
+
+/** First pass: edge detection, see color1fs and depth1fs */
+static void
+pp_mlaa_cpu_edges(const void *data, unsigned int y0, unsigned int y1)
+{
+   const struct pp_mlaa_cpu_pass *pass = data;
+   unsigned int w = pass->color.width, h = pass->color.height, x, y;
+
+   for (y = y0; y < y1; y++) {
+      const float *row = &pass->values[(size_t) y * w];
+      const float *up = y > 0 ? row - w : row;
+      const float *down = y + 1 < h ? row + w : row;
+      uint8_t *e = &pass->edges[(size_t) y * w * 4];
+
+      for (x = 0; x < w; x++, e += 4) {
+         float v = row[x];
+
+         e[0] = fabsf(v - row[x > 0 ? x - 1 : x]) >= pass->threshold ? 255 : 0;
+         e[1] = fabsf(v - up[x]) >= pass->threshold ? 255 : 0;
+         e[2] = fabsf(v - row[x + 1 < w ? x + 1 : x]) >= pass->threshold ?
+                255 : 0;
+         e[3] = fabsf(v - down[x]) >= pass->threshold ? 255 : 0;
+      }
+   }
+}
+
+/**
+ * Search for the end of an edge along (dx, dy), in channel c.  Returns the
+ * distance, as the shader's loop computes it.
+ */
+static inline int
+pp_mlaa_cpu_search(const struct pp_mlaa_cpu_pass *pass, int x, int y,
+                   int dx, int dy, unsigned int c)
+{
+   int k, found = 2;
+
+   for (k = 0; k < pass->max_steps; k++) {
+      int s = 1 + 2 * k;
+
+      found = (pp_mlaa_cpu_edge(pass, x + dx * s, y + dy * s)[c] != 0) +
+              (pp_mlaa_cpu_edge(pass, x + dx * (s + 1),
+                                y + dy * (s + 1))[c] != 0);
+      if (found < 2)
+         break;
+   }
+
+   return MIN2(2 * k + found, 2 * pass->max_steps);
+}
+
+/** Look up the area map, point sampled as in blend2fs */
+static inline const uint8_t *
+pp_mlaa_cpu_area(unsigned int cross1, int d1, unsigned int cross2, int d2)
+{
+   /* The shader's 1/164 scale lands on texel c for c < 165 */
+   unsigned int u = MIN2(33 * cross1 + d1, 164);
+   unsigned int v = MIN2(33 * cross2 + d2, 164);
+
+   return &areamap[(v * 165 + u) * 2];
+}
+
+/** Second pass: blending weights, see blend2fs */
+static void
+pp_mlaa_cpu_weights(const void *data, unsigned int y0, unsigned int y1)
+{
+   const struct pp_mlaa_cpu_pass *pass = data;
+   unsigned int w = pass->color.width;
+   int x, y;
+
+   for (y = y0; y < (int) y1; y++) {
+      const uint8_t *e = &pass->edges[(size_t) y * w * 4];
+      uint8_t *out = &pass->weights[(size_t) y * w * 4];
+
+      for (x = 0; x < (int) w; x++, e += 4, out += 4) {
+         memset(out, 0, 4);
+
+         if (e[1]) {
+            int left = pp_mlaa_cpu_search(pass, x, y, -1, 0, 1);
+            int right = pp_mlaa_cpu_search(pass, x, y, 1, 0, 1);
+            unsigned int c1 =
+               (pp_mlaa_cpu_edge(pass, x - left, y - 1)[0] ? 1 : 0) +
+               (pp_mlaa_cpu_edge(pass, x - left, y)[0] ? 3 : 0);
+            unsigned int c2 =
+               (pp_mlaa_cpu_edge(pass, x + right + 1, y - 1)[0] ? 1 : 0) +
+               (pp_mlaa_cpu_edge(pass, x + right + 1, y)[0] ? 3 : 0);
+            const uint8_t *area = pp_mlaa_cpu_area(c1, left, c2, right);
+
+            out[0] = area[0];
+            out[1] = area[1];
+         }
+
+         if (e[0]) {
+            int top = pp_mlaa_cpu_search(pass, x, y, 0, -1, 0);
+            int bottom = pp_mlaa_cpu_search(pass, x, y, 0, 1, 0);
+            unsigned int c1 =
+               (pp_mlaa_cpu_edge(pass, x - 1, y - top)[1] ? 1 : 0) +
+               (pp_mlaa_cpu_edge(pass, x, y - top)[1] ? 3 : 0);
+            unsigned int c2 =
+               (pp_mlaa_cpu_edge(pass, x - 1, y + bottom + 1)[1] ? 1 : 0) +
+               (pp_mlaa_cpu_edge(pass, x, y + bottom + 1)[1] ? 3 : 0);
+            const uint8_t *area = pp_mlaa_cpu_area(c1, top, c2, bottom);
+
+            out[2] = area[0];
+            out[3] = area[1];
+         }
+      }
+   }
+}
+
+/** Third pass: neighborhood blending, see neigh3fs */
+static void
+pp_mlaa_cpu_blend(const void *data, unsigned int y0, unsigned int y1)
+{
+   const struct pp_mlaa_cpu_pass *pass = data;
+   const struct pp_cpu_color_pass *color = &pass->color;
+   unsigned int w = color->width, h = color->height;
+   unsigned int x, y, i, j;
+
+   for (y = y0; y < y1; y++) {
+      const uint8_t *src = color->in.data + y * color->in.stride;
+      uint8_t *dst = color->out.data + y * color->out.stride;
+      const uint8_t *e = &pass->edges[(size_t) y * w * 4];
+
+      for (x = 0; x < w; x++, e += 4) {
+         const uint8_t *center = pp_mlaa_cpu_weight(pass, x, y);
+         static const int offsets[4][2] = {
+            { 0, -1 }, { 0, 1 }, { -1, 0 }, { 1, 0 }
+         };
+         float a[4], weight[4], sum = 0.0f, res[4] = { 0 };
+         uint8_t c[4], n[4];
+
+         pp_cpu_load(src + x * 4, color->in_rgba, c);
+
+         if (!(e[0] | e[1] | e[2] | e[3])) {
+            pp_cpu_store(dst + x * 4, color->out_rgba, c);
+            continue;
+         }
+
+         /* Top, bottom, left and right */
+         a[0] = center[0] * (1.0f / 255.0f);
+         a[1] = pp_mlaa_cpu_weight(pass, x, y + 1)[1] * (1.0f / 255.0f);
+         a[2] = center[2] * (1.0f / 255.0f);
+         a[3] = pp_mlaa_cpu_weight(pass, x + 1, y)[3] * (1.0f / 255.0f);
+
+         for (i = 0; i < 4; i++) {
+            weight[i] = a[i] * a[i] * a[i];
+            sum += weight[i];
+         }
+
+         if (sum < 0.00001f) {
+            pp_cpu_store(dst + x * 4, color->out_rgba, c);
+            continue;
+         }
+
+         for (i = 0; i < 4; i++) {
+            int nx = CLAMP((int) x + offsets[i][0], 0, (int) w - 1);
+            int ny = CLAMP((int) y + offsets[i][1], 0, (int) h - 1);
+
+            pp_cpu_load(color->in.data + ny * color->in.stride + nx * 4,
+                        color->in_rgba, n);
+            for (j = 0; j < 4; j++)
+               res[j] += (c[j] + (n[j] - c[j]) * a[i]) * weight[i];
+         }
+
+         /* Blended over the input with the result's alpha */
+         for (j = 0; j < 4; j++)
+            res[j] *= 1.0f / (sum * 255.0f);
+         for (j = 0; j < 4; j++) {
+            float v = res[j] * res[3] + c[j] * (1.0f / 255.0f) * (1.0f - res[3]);
+            n[j] = (uint8_t) CLAMP(v * 255.0f + 0.5f, 0.0f, 255.0f);
+         }
+         pp_cpu_store(dst + x * 4, color->out_rgba, n);
+      }
+   }
+}
+
+static bool
+pp_jimenezmlaa_cpu_run(struct pp_queue_t *ppq, struct pipe_resource *in,
+                       struct pipe_resource *out, unsigned int n,
+                       bool iscolor)
+{
+   struct pp_mlaa_cpu_pass pass;
+   unsigned int h;
+
+   memset(&pass, 0, sizeof(pass));
+
+   if (!iscolor) {
+      const struct util_format_unpack_description *unpack;
+
+      if (!ppq->depth ||
+          ppq->depth->nr_samples > 1 ||
+          ppq->depth->width0 < ppq->p->framebuffer.width ||
+          ppq->depth->height0 < ppq->p->framebuffer.height)
+         return false;
+
+      unpack = util_format_unpack_description(ppq->depth->format);
+      if (!util_format_has_depth(util_format_description(ppq->depth->format)) ||
+          !unpack || !unpack->unpack_z_float)
+         return false;
+
+      pass.depth_format = ppq->depth->format;
+   }
+
+   if (!pp_cpu_begin_color(ppq, in, out, &pass.color))
+      return false;
+
+   h = pass.color.height;
+
+   if (!pp_cpu_scratch(ppq, pass.color.width, h) ||
+       (!iscolor && !pp_cpu_map(ppq, ppq->depth, PIPE_TRANSFER_READ,
+                                &pass.depth))) {
+      pp_cpu_end_color(ppq, &pass.color);
+      return false;
+   }
+
+   pass.values = ppq->cpu_values;
+   pass.edges = ppq->cpu_edges;
+   pass.weights = ppq->cpu_weights;
+   pass.threshold = iscolor ? 0.1f : 0.003f;
+   pass.max_steps = ppq->cpu_params[n];
+
+   pp_cpu_run_rows(ppq, pp_mlaa_cpu_values, &pass, h);
+   pp_cpu_unmap(ppq, &pass.depth);
+
+   pp_cpu_run_rows(ppq, pp_mlaa_cpu_edges, &pass, h);
+   pp_cpu_run_rows(ppq, pp_mlaa_cpu_weights, &pass, h);
+   pp_cpu_run_rows(ppq, pp_mlaa_cpu_blend, &pass, h);
+
+   pp_cpu_end_color(ppq, &pass.color);
+
+   return true;
+}
+
+/** The CPU version of the depth MLAA */
+bool
+pp_jimenezmlaa_cpu(struct pp_queue_t *ppq, struct pipe_resource *in,
+                   struct pipe_resource *out, unsigned int n)
+{
+   return pp_jimenezmlaa_cpu_run(ppq, in, out, n, false);
+}
+
+/** The CPU version of the color MLAA */
+bool
+pp_jimenezmlaa_color_cpu(struct pp_queue_t *ppq, struct pipe_resource *in,
+                         struct pipe_resource *out, unsigned int n)
+{
+   return pp_jimenezmlaa_cpu_run(ppq, in, out, n, true);
+}
+
+
 /**
  * Short wrapper to free the mlaa filter resources. Shaders are freed in
  * the common code in pp_free.
@@ -31,6 +31,7 @@
 
 #include "postprocess.h"
 #include "cso_cache/cso_context.h"
+#include "util/u_queue.h"
 
 
 /**
@@ -86,11 +87,93 @@ struct pp_queue_t
    struct pp_program *p;
 
    bool fbos_init;
+
+   /*
+    * CPU versions of the filters, used instead of pp_queue when the screen
+    * isn't accelerated.  See pp_cpu.c.
+    */
+   pp_cpu_func *cpu_queue;      /* NULL entries fall back to pp_queue */
+   unsigned int *cpu_params;    /* The enabled value of each filter */
+   struct util_queue cpu_threads;
+   unsigned int cpu_num_threads;        /* 0 until the first run */
+   struct pp_cpu_band *cpu_bands;
+   unsigned int cpu_max_bands;
+
+   /* MLAA scratch, sized to cpu_width x cpu_height */
+   float *cpu_values;           /* luma or depth */
+   uint8_t *cpu_edges;          /* left, top, right, bottom */
+   uint8_t *cpu_weights;        /* the blend weights */
+   unsigned int cpu_width, cpu_height;
+};
+
+
+/** Processes the rows [y0, y1) of a CPU filter pass. */
+typedef void (*pp_cpu_rows_func) (const void *, unsigned int, unsigned int);
+
+/** One band of rows of a CPU filter pass, run on cpu_threads. */
+struct pp_cpu_band
+{
+   pp_cpu_rows_func func;
+   const void *data;
+   unsigned int y0, y1;
+   struct util_queue_fence fence;
 };
 
+/** A mapped 4x8 unorm color or a depth resource. */
+struct pp_cpu_map
+{
+   struct pipe_transfer *transfer;
+   uint8_t *data;
+   unsigned int stride;
+};
+
+/** The mapped input and output of a CPU filter. */
+struct pp_cpu_color_pass
+{
+   struct pp_cpu_map in, out;
+   unsigned int in_rgba[4], out_rgba[4];
+   unsigned int width, height;
+   unsigned int param;          /* filter specific */
+};
+
+/** Read a pixel as R, G, B, A, given pp_cpu_color_format()'s bytes. */
+static inline void
+pp_cpu_load(const uint8_t *src, const unsigned int *rgba, uint8_t *c)
+{
+   unsigned int i;
+
+   for (i = 0; i < 4; i++)
+      c[i] = rgba[i] < 4 ? src[rgba[i]] :
+             rgba[i] == PIPE_SWIZZLE_0 ? 0 : 255;
+}
+
+static inline void
+pp_cpu_store(uint8_t *dst, const unsigned int *rgba, const uint8_t *c)
+{
+   unsigned int i;
+
+   for (i = 0; i < 4; i++) {
+      if (rgba[i] < 4)
+         dst[rgba[i]] = c[i];
+   }
+}
+
 
 void pp_free_fbos(struct pp_queue_t *);
 
+bool pp_cpu_init(struct pp_queue_t *, unsigned int);
+void pp_cpu_free(struct pp_queue_t *);
+bool pp_cpu_color_format(const struct pipe_resource *, unsigned int *rgba);
+bool pp_cpu_map(struct pp_queue_t *, struct pipe_resource *, unsigned int,
+                struct pp_cpu_map *);
+void pp_cpu_unmap(struct pp_queue_t *, struct pp_cpu_map *);
+bool pp_cpu_begin_color(struct pp_queue_t *, struct pipe_resource *,
+                        struct pipe_resource *, struct pp_cpu_color_pass *);
+void pp_cpu_end_color(struct pp_queue_t *, struct pp_cpu_color_pass *);
+bool pp_cpu_scratch(struct pp_queue_t *, unsigned int, unsigned int);
+void pp_cpu_run_rows(struct pp_queue_t *, pp_cpu_rows_func, const void *,
+                     unsigned int);
+
 void pp_debug(const char *, ...);
 
 struct pp_program *pp_init_prog(struct pp_queue_t *, struct pipe_context *pipe,
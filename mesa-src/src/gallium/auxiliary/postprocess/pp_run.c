@@ -74,6 +74,18 @@ pp_blit(struct pipe_context *pipe,
    pipe->blit(pipe, &blit);
 }
 
+/** Run filter n, on the CPU if it has a CPU version which takes it. */
+static void
+pp_run_filter(struct pp_queue_t *ppq, struct pipe_resource *in,
+              struct pipe_resource *out, unsigned int n)
+{
+   if (ppq->cpu_queue && ppq->cpu_queue[n] &&
+       ppq->cpu_queue[n] (ppq, in, out, n))
+      return;
+
+   ppq->pp_queue[n] (ppq, in, out, n);
+}
+
 /**
 *	Main run function of the PP queue. Called on swapbuffers/flush.
 *
@@ -157,31 +169,31 @@ pp_run(struct pp_queue_t *ppq, struct pipe_resource *in,
       /* Failsafe, but never reached. */
       break;
    case 1:                     /* No temp buf */
-      ppq->pp_queue[0] (ppq, in, out, 0);
+      pp_run_filter(ppq, in, out, 0);
       break;
    case 2:                     /* One temp buf */
 
-      ppq->pp_queue[0] (ppq, in, ppq->tmp[0], 0);
-      ppq->pp_queue[1] (ppq, ppq->tmp[0], out, 1);
+      pp_run_filter(ppq, in, ppq->tmp[0], 0);
+      pp_run_filter(ppq, ppq->tmp[0], out, 1);
 
       break;
    default:                    /* Two temp bufs */
       assert(ppq->tmp[1]);
-      ppq->pp_queue[0] (ppq, in, ppq->tmp[0], 0);
+      pp_run_filter(ppq, in, ppq->tmp[0], 0);
 
       for (i = 1; i < (ppq->n_filters - 1); i++) {
          if (i % 2 == 0)
-            ppq->pp_queue[i] (ppq, ppq->tmp[1], ppq->tmp[0], i);
+            pp_run_filter(ppq, ppq->tmp[1], ppq->tmp[0], i);
 
          else
-            ppq->pp_queue[i] (ppq, ppq->tmp[0], ppq->tmp[1], i);
+            pp_run_filter(ppq, ppq->tmp[0], ppq->tmp[1], i);
       }
 
       if (i % 2 == 0)
-         ppq->pp_queue[i] (ppq, ppq->tmp[1], out, i);
+         pp_run_filter(ppq, ppq->tmp[1], out, i);
 
       else
-         ppq->pp_queue[i] (ppq, ppq->tmp[0], out, i);
+         pp_run_filter(ppq, ppq->tmp[0], out, i);
 
       break;
    }
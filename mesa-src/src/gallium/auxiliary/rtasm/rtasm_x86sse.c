@@ -1508,6 +1508,254 @@ void sse2_rcpss( struct x86_function *p,
    emit_modrm( p, dst, src );
 }
 
+/***********************************************************************
+ * AVX, AVX2 and F16C instructions
+ */
+
+enum vex_map {
+   VEX_0F = 1,
+   VEX_0F38 = 2,
+   VEX_0F3A = 3
+};
+
+enum vex_pp {
+   VEX_NP,
+   VEX_66,
+   VEX_F3,
+   VEX_F2
+};
+
+/* Three byte VEX prefix and opcode, for registers 0-7 only.  vvvv is the
+ * extra source register, 0 if unused; all 256-bit.
+ */
+static void emit_vex256( struct x86_function *p,
+                         enum vex_map map,
+                         enum vex_pp pp,
+                         unsigned w,
+                         unsigned vvvv,
+                         unsigned char op )
+{
+   assert(vvvv < 8);
+   emit_3ub(p, 0xc4, 0xe0 | map,
+            (w << 7) | ((~vvvv & 0xf) << 3) | (1 << 2) | pp);
+   emit_1ub(p, op);
+}
+
+static void emit_vex256_rrr( struct x86_function *p,
+                             enum vex_map map,
+                             enum vex_pp pp,
+                             unsigned char op,
+                             struct x86_reg dst,
+                             struct x86_reg src0,
+                             struct x86_reg src1 )
+{
+   assert(src0.mod == mod_REG);
+   emit_vex256(p, map, pp, 0, src0.idx, op);
+   emit_modrm(p, dst, src1);
+}
+
+void avx_vmovups( struct x86_function *p,
+                  struct x86_reg dst,
+                  struct x86_reg src )
+{
+   DUMP_RR( dst, src );
+   if (dst.mod == mod_REG) {
+      emit_vex256(p, VEX_0F, VEX_NP, 0, 0, 0x10);
+      emit_modrm(p, dst, src);
+   }
+   else {
+      emit_vex256(p, VEX_0F, VEX_NP, 0, 0, 0x11);
+      emit_modrm(p, src, dst);
+   }
+}
+
+void avx_vbroadcastss( struct x86_function *p,
+                       struct x86_reg dst,
+                       struct x86_reg src )
+{
+   DUMP_RR( dst, src );
+   assert(src.mod != mod_REG);
+   emit_vex256(p, VEX_0F38, VEX_66, 0, 0, 0x18);
+   emit_modrm(p, dst, src);
+}
+
+/* Store, or move to an XMM register, the low (0) or high (1) half of src.
+ */
+void avx_vextractf128( struct x86_function *p,
+                       struct x86_reg dst,
+                       struct x86_reg src,
+                       uint8_t imm )
+{
+   DUMP_RRI( dst, src, imm );
+   emit_vex256(p, VEX_0F3A, VEX_66, 0, 0, 0x19);
+   emit_modrm(p, src, dst);
+   emit_1ub(p, imm);
+}
+
+void avx_vcvtdq2ps( struct x86_function *p,
+                    struct x86_reg dst,
+                    struct x86_reg src )
+{
+   DUMP_RR( dst, src );
+   emit_vex256(p, VEX_0F, VEX_NP, 0, 0, 0x5b);
+   emit_modrm(p, dst, src);
+}
+
+void avx_vmulps( struct x86_function *p,
+                 struct x86_reg dst,
+                 struct x86_reg src0,
+                 struct x86_reg src1 )
+{
+   DUMP_RR( dst, src1 );
+   emit_vex256_rrr(p, VEX_0F, VEX_NP, 0x59, dst, src0, src1);
+}
+
+void avx_vunpcklps( struct x86_function *p,
+                    struct x86_reg dst,
+                    struct x86_reg src0,
+                    struct x86_reg src1 )
+{
+   DUMP_RR( dst, src1 );
+   emit_vex256_rrr(p, VEX_0F, VEX_NP, 0x14, dst, src0, src1);
+}
+
+void avx_vunpckhps( struct x86_function *p,
+                    struct x86_reg dst,
+                    struct x86_reg src0,
+                    struct x86_reg src1 )
+{
+   DUMP_RR( dst, src1 );
+   emit_vex256_rrr(p, VEX_0F, VEX_NP, 0x15, dst, src0, src1);
+}
+
+void avx_vunpcklpd( struct x86_function *p,
+                    struct x86_reg dst,
+                    struct x86_reg src0,
+                    struct x86_reg src1 )
+{
+   DUMP_RR( dst, src1 );
+   emit_vex256_rrr(p, VEX_0F, VEX_66, 0x14, dst, src0, src1);
+}
+
+void avx_vunpckhpd( struct x86_function *p,
+                    struct x86_reg dst,
+                    struct x86_reg src0,
+                    struct x86_reg src1 )
+{
+   DUMP_RR( dst, src1 );
+   emit_vex256_rrr(p, VEX_0F, VEX_66, 0x15, dst, src0, src1);
+}
+
+void avx_vzeroupper( struct x86_function *p )
+{
+   DUMP();
+   emit_3ub(p, 0xc5, 0xf8, 0x77);
+}
+
+void avx2_vpand( struct x86_function *p,
+                 struct x86_reg dst,
+                 struct x86_reg src0,
+                 struct x86_reg src1 )
+{
+   DUMP_RR( dst, src1 );
+   emit_vex256_rrr(p, VEX_0F, VEX_66, 0xdb, dst, src0, src1);
+}
+
+void avx2_vpcmpeqd( struct x86_function *p,
+                    struct x86_reg dst,
+                    struct x86_reg src0,
+                    struct x86_reg src1 )
+{
+   DUMP_RR( dst, src1 );
+   emit_vex256_rrr(p, VEX_0F, VEX_66, 0x76, dst, src0, src1);
+}
+
+void avx2_vpmulld( struct x86_function *p,
+                   struct x86_reg dst,
+                   struct x86_reg src0,
+                   struct x86_reg src1 )
+{
+   DUMP_RR( dst, src1 );
+   emit_vex256_rrr(p, VEX_0F38, VEX_66, 0x40, dst, src0, src1);
+}
+
+void avx2_vpackusdw( struct x86_function *p,
+                     struct x86_reg dst,
+                     struct x86_reg src0,
+                     struct x86_reg src1 )
+{
+   DUMP_RR( dst, src1 );
+   emit_vex256_rrr(p, VEX_0F38, VEX_66, 0x2b, dst, src0, src1);
+}
+
+void avx2_vpsrld_imm( struct x86_function *p,
+                      struct x86_reg dst,
+                      struct x86_reg src,
+                      unsigned imm )
+{
+   DUMP_RRI( dst, src, imm );
+   assert(src.mod == mod_REG);
+   emit_vex256(p, VEX_0F, VEX_66, 0, dst.idx, 0x72);
+   emit_modrm_noreg(p, 2, src);
+   emit_1ub(p, imm);
+}
+
+void avx2_vpermq( struct x86_function *p,
+                  struct x86_reg dst,
+                  struct x86_reg src,
+                  uint8_t imm )
+{
+   DUMP_RRI( dst, src, imm );
+   emit_vex256(p, VEX_0F3A, VEX_66, 1, 0, 0x00);
+   emit_modrm(p, dst, src);
+   emit_1ub(p, imm);
+}
+
+/* dst[i] = *(base + index[i]) for the lanes whose mask sign bit is set.
+ * base is a register plus displacement; dst, index and mask must all
+ * differ.  The mask is cleared as lanes complete.
+ */
+void avx2_vpgatherdd( struct x86_function *p,
+                      struct x86_reg dst,
+                      struct x86_reg base,
+                      struct x86_reg index,
+                      struct x86_reg mask )
+{
+   DUMP_RR( dst, base );
+   assert(base.file == file_REG32 && base.mod != mod_REG);
+   assert(dst.idx != index.idx && dst.idx != mask.idx &&
+          index.idx != mask.idx);
+
+   emit_vex256(p, VEX_0F38, VEX_66, 0, mask.idx, 0x90);
+   emit_1ub(p, (base.mod << 6) | (dst.idx << 3) | 4);
+   emit_1ub(p, (index.idx << 3) | base.idx);
+
+   switch (base.mod) {
+   case mod_INDIRECT:
+      break;
+   case mod_DISP8:
+      emit_1b(p, (char) base.disp);
+      break;
+   case mod_DISP32:
+      emit_1i(p, base.disp);
+      break;
+   default:
+      assert(0);
+      break;
+   }
+}
+
+/* Eight half floats from src, an XMM register or memory, to floats.
+ */
+void f16c_vcvtph2ps( struct x86_function *p,
+                     struct x86_reg dst,
+                     struct x86_reg src )
+{
+   DUMP_RR( dst, src );
+   emit_vex256(p, VEX_0F38, VEX_66, 0, 0, 0x13);
+   emit_modrm(p, dst, src);
+}
+
 /***********************************************************************
  * x87 instructions
  */
@@ -2164,6 +2412,10 @@ static void x86_init_func_common( struct x86_function *p )
       p->caps |= X86_SSE3;
    if(util_cpu_caps.has_sse4_1)
       p->caps |= X86_SSE4_1;
+   if(util_cpu_caps.has_avx2)
+      p->caps |= X86_AVX2;
+   if(util_cpu_caps.has_f16c)
+      p->caps |= X86_F16C;
    p->csr = p->store;
 #if defined(PIPE_ARCH_X86)
    emit_1i(p, 0xfb1e0ff3);
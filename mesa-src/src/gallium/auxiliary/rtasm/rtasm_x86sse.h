@@ -47,6 +47,8 @@ struct x86_reg {
 #define X86_SSE2 8
 #define X86_SSE3 0x10
 #define X86_SSE4_1 0x20
+#define X86_AVX2 0x40
+#define X86_F16C 0x80
 
 struct x86_function {
    unsigned caps;
@@ -270,6 +272,43 @@ void sse2_pshuflw( struct x86_function *p, struct x86_reg dst, struct x86_reg sr
 void sse2_pshufhw( struct x86_function *p, struct x86_reg dst, struct x86_reg src, uint8_t imm );
 void sse2_pshufd( struct x86_function *p, struct x86_reg dst, struct x86_reg src, uint8_t imm );
 
+/* AVX, AVX2 and F16C.  The XMM registers double as the 256-bit YMM
+ * registers, only the first eight can be used.
+ */
+void avx_vmovups( struct x86_function *p, struct x86_reg dst, struct x86_reg src );
+void avx_vbroadcastss( struct x86_function *p, struct x86_reg dst, struct x86_reg src );
+void avx_vextractf128( struct x86_function *p, struct x86_reg dst, struct x86_reg src,
+                       uint8_t imm );
+void avx_vcvtdq2ps( struct x86_function *p, struct x86_reg dst, struct x86_reg src );
+void avx_vmulps( struct x86_function *p, struct x86_reg dst, struct x86_reg src0,
+                 struct x86_reg src1 );
+void avx_vunpcklps( struct x86_function *p, struct x86_reg dst, struct x86_reg src0,
+                    struct x86_reg src1 );
+void avx_vunpckhps( struct x86_function *p, struct x86_reg dst, struct x86_reg src0,
+                    struct x86_reg src1 );
+void avx_vunpcklpd( struct x86_function *p, struct x86_reg dst, struct x86_reg src0,
+                    struct x86_reg src1 );
+void avx_vunpckhpd( struct x86_function *p, struct x86_reg dst, struct x86_reg src0,
+                    struct x86_reg src1 );
+void avx_vzeroupper( struct x86_function *p );
+
+void avx2_vpand( struct x86_function *p, struct x86_reg dst, struct x86_reg src0,
+                 struct x86_reg src1 );
+void avx2_vpcmpeqd( struct x86_function *p, struct x86_reg dst, struct x86_reg src0,
+                    struct x86_reg src1 );
+void avx2_vpmulld( struct x86_function *p, struct x86_reg dst, struct x86_reg src0,
+                   struct x86_reg src1 );
+void avx2_vpackusdw( struct x86_function *p, struct x86_reg dst, struct x86_reg src0,
+                     struct x86_reg src1 );
+void avx2_vpsrld_imm( struct x86_function *p, struct x86_reg dst, struct x86_reg src,
+                      unsigned imm );
+void avx2_vpermq( struct x86_function *p, struct x86_reg dst, struct x86_reg src,
+                  uint8_t imm );
+void avx2_vpgatherdd( struct x86_function *p, struct x86_reg dst, struct x86_reg base,
+                      struct x86_reg index, struct x86_reg mask );
+
+void f16c_vcvtph2ps( struct x86_function *p, struct x86_reg dst, struct x86_reg src );
+
 void sse_prefetchnta( struct x86_function *p, struct x86_reg ptr);
 void sse_prefetch0( struct x86_function *p, struct x86_reg ptr);
 void sse_prefetch1( struct x86_function *p, struct x86_reg ptr);
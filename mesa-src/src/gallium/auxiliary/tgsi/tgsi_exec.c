@@ -61,6 +61,7 @@
 #include "util/u_half.h"
 #include "util/u_memory.h"
 #include "util/u_math.h"
+#include "util/u_sse.h"
 #include "util/rounding.h"
 
 
@@ -1066,6 +1067,9 @@ tgsi_exec_set_constant_buffers(struct tgsi_exec_machine *mach,
    }
 }
 
+static void
+predecode_instructions(struct tgsi_exec_machine *mach);
+
 /**
  * Initialize machine state by expanding tokens to full instructions,
  * allocating temporary storage, setting up constants, etc.
@@ -1108,6 +1112,9 @@ tgsi_exec_machine_bind_shader(
       mach->Instructions = NULL;
       mach->NumInstructions = 0;
 
+      FREE(mach->Predecoded);
+      mach->Predecoded = NULL;
+
       return;
    }
 
@@ -1264,6 +1271,8 @@ tgsi_exec_machine_bind_shader(
    FREE(mach->Instructions);
    mach->Instructions = instructions;
    mach->NumInstructions = numInstructions;
+
+   predecode_instructions(mach);
 }
 
 
@@ -1319,6 +1328,7 @@ tgsi_exec_machine_destroy(struct tgsi_exec_machine *mach)
 {
    if (mach) {
       FREE(mach->Instructions);
+      FREE(mach->Predecoded);
       FREE(mach->Declarations);
       FREE(mach->Imms);
 
@@ -1975,6 +1985,442 @@ store_dest(struct tgsi_exec_machine *mach,
    }
 }
 
+/*
+ * Pre-decoded instructions.
+ *
+ * When a shader is bound, the common float ALU instructions which only
+ * use direct registers are decoded once to the registers they read and
+ * write and the function running them.  tgsi_exec_machine_run() calls
+ * that function directly, skipping exec_instruction()'s switch and the
+ * index register and swizzle handling of fetch_source() and store_dest().
+ *
+ * The arithmetic is done in the same order on the same values, so the
+ * results are bit-identical to the generic path.
+ */
+
+struct tgsi_exec_predecoded_src {
+   uint File;
+   uint Index;
+   uint Dimension;            /**< constant buffer */
+   ubyte Swizzle[TGSI_NUM_CHANNELS];
+   boolean Absolute;
+   boolean Negate;
+};
+
+typedef void (* tgsi_exec_predecoded_func)(struct tgsi_exec_machine *mach,
+                                           const struct tgsi_exec_predecoded *pre);
+
+struct tgsi_exec_predecoded {
+   tgsi_exec_predecoded_func exec;  /**< NULL for exec_instruction() */
+   struct tgsi_exec_predecoded_src Src[3];
+   uint DstFile;
+   uint DstIndex;
+   uint WriteMask;
+   boolean Saturate;
+};
+
+#if defined(PIPE_ARCH_SSE)
+
+static inline void
+pre_mul(union tgsi_exec_channel *dst,
+        const union tgsi_exec_channel *src0,
+        const union tgsi_exec_channel *src1)
+{
+   _mm_storeu_ps(dst->f, _mm_mul_ps(_mm_loadu_ps(src0->f),
+                                    _mm_loadu_ps(src1->f)));
+}
+
+static inline void
+pre_add(union tgsi_exec_channel *dst,
+        const union tgsi_exec_channel *src0,
+        const union tgsi_exec_channel *src1)
+{
+   _mm_storeu_ps(dst->f, _mm_add_ps(_mm_loadu_ps(src0->f),
+                                    _mm_loadu_ps(src1->f)));
+}
+
+/* a * b + c, not fused, like micro_mad() without compiler contraction */
+static inline void
+pre_mad(union tgsi_exec_channel *dst,
+        const union tgsi_exec_channel *src0,
+        const union tgsi_exec_channel *src1,
+        const union tgsi_exec_channel *src2)
+{
+   _mm_storeu_ps(dst->f, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(src0->f),
+                                               _mm_loadu_ps(src1->f)),
+                                    _mm_loadu_ps(src2->f)));
+}
+
+/* minps/maxps return the second source when either is NaN, as the
+ * conditionals of micro_min()/micro_max() do.
+ */
+static inline void
+pre_min(union tgsi_exec_channel *dst,
+        const union tgsi_exec_channel *src0,
+        const union tgsi_exec_channel *src1)
+{
+   _mm_storeu_ps(dst->f, _mm_min_ps(_mm_loadu_ps(src0->f),
+                                    _mm_loadu_ps(src1->f)));
+}
+
+static inline void
+pre_max(union tgsi_exec_channel *dst,
+        const union tgsi_exec_channel *src0,
+        const union tgsi_exec_channel *src1)
+{
+   _mm_storeu_ps(dst->f, _mm_max_ps(_mm_loadu_ps(src0->f),
+                                    _mm_loadu_ps(src1->f)));
+}
+
+#else
+
+/* Plain loops, which compilers turn into NEON/AltiVec code where they
+ * can, and contract the same way as micro_mad().
+ */
+#define pre_mul micro_mul
+#define pre_add micro_add
+#define pre_mad micro_mad
+#define pre_min micro_min
+#define pre_max micro_max
+
+#endif
+
+static inline void
+fetch_predecoded(const struct tgsi_exec_machine *mach,
+                 const struct tgsi_exec_predecoded_src *src,
+                 uint chan,
+                 union tgsi_exec_channel *dst)
+{
+   const uint swizzle = src->Swizzle[chan];
+
+   switch (src->File) {
+   case TGSI_FILE_TEMPORARY:
+      *dst = mach->Temps[src->Index].xyzw[swizzle];
+      break;
+
+   case TGSI_FILE_INPUT:
+      *dst = mach->Inputs[src->Index].xyzw[swizzle];
+      break;
+
+   case TGSI_FILE_IMMEDIATE:
+      dst->f[0] =
+      dst->f[1] =
+      dst->f[2] =
+      dst->f[3] = mach->Imms[src->Index][swizzle];
+      break;
+
+   default: {
+      /* constants, with the bounds check of fetch_src_file_channel() */
+      const uint *buf = (const uint *) mach->Consts[src->Dimension];
+      const int pos = src->Index * 4 + swizzle;
+
+      if (pos >= (int) mach->ConstsSize[src->Dimension]) {
+         dst->u[0] = dst->u[1] = dst->u[2] = dst->u[3] = 0;
+      } else {
+         dst->u[0] =
+         dst->u[1] =
+         dst->u[2] =
+         dst->u[3] = buf[pos];
+      }
+      break;
+   }
+   }
+
+   if (src->Absolute)
+      micro_abs(dst, dst);
+
+   if (src->Negate)
+      micro_neg(dst, dst);
+}
+
+/**
+ * Store the write-masked channels of result, like store_dest().
+ */
+static inline void
+store_predecoded(struct tgsi_exec_machine *mach,
+                 const struct tgsi_exec_predecoded *pre,
+                 const struct tgsi_exec_vector *result)
+{
+   const uint execmask = mach->ExecMask;
+   union tgsi_exec_channel *dst;
+   uint chan;
+   int i;
+
+   if (pre->DstFile == TGSI_FILE_TEMPORARY) {
+      dst = mach->Temps[pre->DstIndex].xyzw;
+   } else {
+      const uint index = mach->Temps[TEMP_OUTPUT_I].xyzw[TEMP_OUTPUT_C].u[0]
+         + pre->DstIndex;
+      dst = mach->Outputs[index].xyzw;
+   }
+
+   for (chan = 0; chan < TGSI_NUM_CHANNELS; chan++) {
+      const union tgsi_exec_channel *src = &result->xyzw[chan];
+
+      if (!(pre->WriteMask & (1 << chan)))
+         continue;
+
+      if (pre->Saturate) {
+         for (i = 0; i < TGSI_QUAD_SIZE; i++)
+            if (execmask & (1 << i)) {
+               if (src->f[i] < 0.0f)
+                  dst[chan].f[i] = 0.0f;
+               else if (src->f[i] > 1.0f)
+                  dst[chan].f[i] = 1.0f;
+               else
+                  dst[chan].i[i] = src->i[i];
+            }
+      }
+      else if (execmask == 0xf) {
+         dst[chan] = *src;
+      }
+      else {
+         for (i = 0; i < TGSI_QUAD_SIZE; i++)
+            if (execmask & (1 << i))
+               dst[chan].i[i] = src->i[i];
+      }
+   }
+}
+
+static void
+exec_predecoded_mov(struct tgsi_exec_machine *mach,
+                    const struct tgsi_exec_predecoded *pre)
+{
+   struct tgsi_exec_vector dst;
+   uint chan;
+
+   for (chan = 0; chan < TGSI_NUM_CHANNELS; chan++) {
+      if (pre->WriteMask & (1 << chan))
+         fetch_predecoded(mach, &pre->Src[0], chan, &dst.xyzw[chan]);
+   }
+   store_predecoded(mach, pre, &dst);
+}
+
+#define PREDECODED_BINARY(NAME, OP)                                       \
+static void                                                               \
+exec_predecoded_##NAME(struct tgsi_exec_machine *mach,                    \
+                       const struct tgsi_exec_predecoded *pre)            \
+{                                                                         \
+   struct tgsi_exec_vector dst;                                           \
+   uint chan;                                                             \
+                                                                          \
+   for (chan = 0; chan < TGSI_NUM_CHANNELS; chan++) {                     \
+      if (pre->WriteMask & (1 << chan)) {                                 \
+         union tgsi_exec_channel src[2];                                  \
+                                                                          \
+         fetch_predecoded(mach, &pre->Src[0], chan, &src[0]);             \
+         fetch_predecoded(mach, &pre->Src[1], chan, &src[1]);             \
+         OP(&dst.xyzw[chan], &src[0], &src[1]);                           \
+      }                                                                   \
+   }                                                                      \
+   store_predecoded(mach, pre, &dst);                                     \
+}
+
+PREDECODED_BINARY(add, pre_add)
+PREDECODED_BINARY(mul, pre_mul)
+PREDECODED_BINARY(min, pre_min)
+PREDECODED_BINARY(max, pre_max)
+
+static void
+exec_predecoded_mad(struct tgsi_exec_machine *mach,
+                    const struct tgsi_exec_predecoded *pre)
+{
+   struct tgsi_exec_vector dst;
+   uint chan;
+
+   for (chan = 0; chan < TGSI_NUM_CHANNELS; chan++) {
+      if (pre->WriteMask & (1 << chan)) {
+         union tgsi_exec_channel src[3];
+
+         fetch_predecoded(mach, &pre->Src[0], chan, &src[0]);
+         fetch_predecoded(mach, &pre->Src[1], chan, &src[1]);
+         fetch_predecoded(mach, &pre->Src[2], chan, &src[2]);
+         pre_mad(&dst.xyzw[chan], &src[0], &src[1], &src[2]);
+      }
+   }
+   store_predecoded(mach, pre, &dst);
+}
+
+/**
+ * DP3/DP4, summed in the order of exec_dp3()/exec_dp4().
+ */
+static inline void
+exec_predecoded_dp(struct tgsi_exec_machine *mach,
+                   const struct tgsi_exec_predecoded *pre,
+                   uint num_chans)
+{
+   struct tgsi_exec_vector dst;
+   union tgsi_exec_channel arg[3];
+   uint chan;
+
+   fetch_predecoded(mach, &pre->Src[0], TGSI_CHAN_X, &arg[0]);
+   fetch_predecoded(mach, &pre->Src[1], TGSI_CHAN_X, &arg[1]);
+   pre_mul(&arg[2], &arg[0], &arg[1]);
+
+   for (chan = TGSI_CHAN_Y; chan < num_chans; chan++) {
+      fetch_predecoded(mach, &pre->Src[0], chan, &arg[0]);
+      fetch_predecoded(mach, &pre->Src[1], chan, &arg[1]);
+      pre_mad(&arg[2], &arg[0], &arg[1], &arg[2]);
+   }
+
+   for (chan = 0; chan < TGSI_NUM_CHANNELS; chan++)
+      dst.xyzw[chan] = arg[2];
+   store_predecoded(mach, pre, &dst);
+}
+
+static void
+exec_predecoded_dp3(struct tgsi_exec_machine *mach,
+                    const struct tgsi_exec_predecoded *pre)
+{
+   exec_predecoded_dp(mach, pre, 3);
+}
+
+static void
+exec_predecoded_dp4(struct tgsi_exec_machine *mach,
+                    const struct tgsi_exec_predecoded *pre)
+{
+   exec_predecoded_dp(mach, pre, 4);
+}
+
+static boolean
+predecode_src(const struct tgsi_exec_machine *mach,
+              const struct tgsi_full_src_register *reg,
+              struct tgsi_exec_predecoded_src *src)
+{
+   if (reg->Register.Indirect)
+      return FALSE;
+
+   switch (reg->Register.File) {
+   case TGSI_FILE_TEMPORARY:
+      if (reg->Register.Dimension || reg->Register.Index >= TGSI_EXEC_NUM_TEMPS)
+         return FALSE;
+      src->Dimension = 0;
+      break;
+
+   case TGSI_FILE_INPUT:
+      /* 2D inputs, of geometry shaders, take the generic path */
+      if (reg->Register.Dimension || !mach->Inputs)
+         return FALSE;
+      src->Dimension = 0;
+      break;
+
+   case TGSI_FILE_IMMEDIATE:
+      if (reg->Register.Dimension || reg->Register.Index >= mach->ImmLimit)
+         return FALSE;
+      src->Dimension = 0;
+      break;
+
+   case TGSI_FILE_CONSTANT:
+      if (reg->Register.Dimension) {
+         if (reg->Dimension.Indirect ||
+             reg->Dimension.Index >= PIPE_MAX_CONSTANT_BUFFERS)
+            return FALSE;
+         src->Dimension = reg->Dimension.Index;
+      } else {
+         src->Dimension = 0;
+      }
+      break;
+
+   default:
+      return FALSE;
+   }
+
+   src->File = reg->Register.File;
+   src->Index = reg->Register.Index;
+   src->Swizzle[0] = reg->Register.SwizzleX;
+   src->Swizzle[1] = reg->Register.SwizzleY;
+   src->Swizzle[2] = reg->Register.SwizzleZ;
+   src->Swizzle[3] = reg->Register.SwizzleW;
+   src->Absolute = reg->Register.Absolute;
+   src->Negate = reg->Register.Negate;
+   return TRUE;
+}
+
+static void
+predecode_instruction(const struct tgsi_exec_machine *mach,
+                      const struct tgsi_full_instruction *inst,
+                      struct tgsi_exec_predecoded *pre)
+{
+   const struct tgsi_full_dst_register *dst = &inst->Dst[0];
+   tgsi_exec_predecoded_func exec;
+   uint i;
+
+   switch (inst->Instruction.Opcode) {
+   case TGSI_OPCODE_MOV:
+      exec = exec_predecoded_mov;
+      break;
+   case TGSI_OPCODE_ADD:
+      exec = exec_predecoded_add;
+      break;
+   case TGSI_OPCODE_MUL:
+      exec = exec_predecoded_mul;
+      break;
+   case TGSI_OPCODE_MIN:
+      exec = exec_predecoded_min;
+      break;
+   case TGSI_OPCODE_MAX:
+      exec = exec_predecoded_max;
+      break;
+   case TGSI_OPCODE_MAD:
+      exec = exec_predecoded_mad;
+      break;
+   case TGSI_OPCODE_DP3:
+      exec = exec_predecoded_dp3;
+      break;
+   case TGSI_OPCODE_DP4:
+      exec = exec_predecoded_dp4;
+      break;
+   default:
+      return;
+   }
+
+   if (inst->Instruction.NumDstRegs != 1 ||
+       inst->Instruction.NumSrcRegs > ARRAY_SIZE(pre->Src) ||
+       dst->Register.Indirect || dst->Register.Dimension)
+      return;
+
+   if (dst->Register.File == TGSI_FILE_TEMPORARY) {
+      if (dst->Register.Index >= TGSI_EXEC_NUM_TEMPS)
+         return;
+   }
+   else if (dst->Register.File != TGSI_FILE_OUTPUT || !mach->Outputs) {
+      return;
+   }
+
+   for (i = 0; i < inst->Instruction.NumSrcRegs; i++) {
+      if (!predecode_src(mach, &inst->Src[i], &pre->Src[i]))
+         return;
+   }
+
+   pre->DstFile = dst->Register.File;
+   pre->DstIndex = dst->Register.Index;
+   pre->WriteMask = dst->Register.WriteMask;
+   pre->Saturate = inst->Instruction.Saturate;
+   pre->exec = exec;
+}
+
+static void
+predecode_instructions(struct tgsi_exec_machine *mach)
+{
+   uint i;
+
+   FREE(mach->Predecoded);
+   mach->Predecoded = NULL;
+
+   if (!mach->NumInstructions)
+      return;
+
+   /* without it, everything takes the generic path */
+   mach->Predecoded = CALLOC(mach->NumInstructions,
+                             sizeof(struct tgsi_exec_predecoded));
+   if (!mach->Predecoded)
+      return;
+
+   for (i = 0; i < mach->NumInstructions; i++)
+      predecode_instruction(mach, &mach->Instructions[i],
+                            &mach->Predecoded[i]);
+}
+
 #define FETCH(VAL,INDEX,CHAN)\
     fetch_source(mach, VAL, &inst->Src[INDEX], CHAN, TGSI_EXEC_DATA_FLOAT)
 
@@ -6369,7 +6815,16 @@ tgsi_exec_machine_run( struct tgsi_exec_machine *mach, int start_pc )
 #endif
 
          assert(mach->pc < (int) mach->NumInstructions);
-         barrier_hit = exec_instruction(mach, mach->Instructions + mach->pc, &mach->pc);
+         if (mach->Predecoded && mach->Predecoded[mach->pc].exec) {
+            const struct tgsi_exec_predecoded *pre = &mach->Predecoded[mach->pc];
+
+            mach->pc++;
+            pre->exec(mach, pre);
+            barrier_hit = FALSE;
+         }
+         else {
+            barrier_hit = exec_instruction(mach, mach->Instructions + mach->pc, &mach->pc);
+         }
 
          /* for compute shaders if we hit a barrier return now for later rescheduling */
          if (barrier_hit && mach->ShaderType == PIPE_SHADER_COMPUTE)
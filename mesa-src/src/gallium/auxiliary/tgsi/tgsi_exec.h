@@ -322,6 +322,7 @@ enum tgsi_break_type {
 typedef float float4[4];
 
 struct tgsi_exec_machine;
+struct tgsi_exec_predecoded;
 
 typedef void (* apply_sample_offset_func)(
    const struct tgsi_exec_machine *mach,
@@ -431,6 +432,7 @@ struct tgsi_exec_machine
 
    struct tgsi_full_instruction *Instructions;
    uint NumInstructions;
+   struct tgsi_exec_predecoded *Predecoded;  /**< NumInstructions of them */
 
    struct tgsi_full_declaration *Declarations;
    uint NumDeclarations;
@@ -64,7 +64,8 @@ struct translate_buffer_variant
 
 #define ELEMENT_BUFFER_INSTANCE_ID  1001
 
-#define NUM_CONSTS 7
+#define NUM_FLOAT_CONSTS 15
+#define NUM_CONSTS (NUM_FLOAT_CONSTS + 7)
 
 enum
 {
@@ -74,18 +75,60 @@ enum
    CONST_INV_32767,
    CONST_INV_65535,
    CONST_INV_2147483647,
-   CONST_255
+   CONST_255,
+   CONST_2_POW_112,
+   CONST_65536,
+   CONST_MINUS_1,
+   CONST_512,
+   CONST_SIGN_FIX_10_10_10,
+   CONST_UNORM_10_10_10_2,
+   CONST_SCALED_10_10_10_2,
+   CONST_SNORM_10_10_10_2,
+
+   /* bit patterns, see int_consts[] */
+   CONST_HALF_SIGN,
+   CONST_HALF_EXP_MANT,
+   CONST_FLOAT_ABS,
+   CONST_FLOAT_EXP,
+   CONST_MASK_10_10_10,
+   CONST_MASK_8,
+   CONST_MASK_16
 };
 
 #define C(v) {(float)(v), (float)(v), (float)(v), (float)(v)}
-static float consts[NUM_CONSTS][4] = {
+static float consts[NUM_FLOAT_CONSTS][4] = {
    {0, 0, 0, 1},
    C(1.0 / 127.0),
    C(1.0 / 255.0),
    C(1.0 / 32767.0),
    C(1.0 / 65535.0),
    C(1.0 / 2147483647.0),
-   C(255.0)
+   C(255.0),
+   C(5192296858534827628530496329220096.0),   /* 2^112 */
+   C(65536.0),
+   C(-1.0),
+   C(512.0),
+   {1024.0, 1024.0, 1024.0, 0.0},
+   /* scale the 10_10_10_2 channels, which are still shifted by 0, 10,
+    * 20 and 0 bits
+    */
+   {1.0 / 1023.0, 1.0 / (1023.0 * 1024.0), 1.0 / (1023.0 * 1048576.0),
+    1.0 / 3.0},
+   {1.0, 1.0 / 1024.0, 1.0 / 1048576.0, 1.0},
+   {1.0 / 511.0, 1.0 / 511.0, 1.0 / 511.0, 1.0}
+};
+
+#undef C
+
+#define C(v) {(v), (v), (v), (v)}
+static uint32_t int_consts[NUM_CONSTS - NUM_FLOAT_CONSTS][4] = {
+   C(0x8000),
+   C(0x7fff),
+   C(0x7fffffff),
+   C(0x7f800000),
+   {0x3ff, 0x3ff << 10, 0x3ff << 20, 0},
+   C(0xff),
+   C(0xffff)
 };
 
 #undef C
@@ -114,6 +157,12 @@ struct translate_sse
    /* Multiple elements can map to a single buffer variant. */
    unsigned element_to_buffer_variant[TRANSLATE_MAX_ATTRIBS];
 
+   /* For the AVX2 run: the vertex numbers of a batch, and the byte
+    * offsets of its vertices within each buffer variant.
+    */
+   int32_t avx2_lanes[8];
+   int32_t avx2_offsets[TRANSLATE_MAX_ATTRIBS][8];
+
    boolean use_instancing;
    unsigned instance_id;
    unsigned start_instance;
@@ -222,6 +271,119 @@ emit_load_sse2(struct translate_sse *p,
 }
 
 
+/**
+ * Convert the half floats in the low words of data to floats, the way
+ * util_half_to_float() does, except that denormals are flushed to zero.
+ */
+static void
+emit_half_to_float(struct translate_sse *p, struct x86_reg data)
+{
+   struct x86_reg tmpXMM = x86_make_reg(file_XMM, 1);
+
+   sse2_punpcklwd(p->func, data, get_const(p, CONST_IDENTITY));
+
+   /* sign */
+   sse_movaps(p->func, tmpXMM, data);
+   sse_andps(p->func, tmpXMM, get_const(p, CONST_HALF_SIGN));
+   sse2_pslld_imm(p->func, tmpXMM, 16);
+
+   /* move exponent and mantissa into place, and rebias the exponent */
+   sse_andps(p->func, data, get_const(p, CONST_HALF_EXP_MANT));
+   sse2_pslld_imm(p->func, data, 13);
+   sse_mulps(p->func, data, get_const(p, CONST_2_POW_112));
+   sse_orps(p->func, data, tmpXMM);
+
+   /* infinities and NaNs come out as >= 65536; give them the max exponent */
+   sse_movaps(p->func, tmpXMM, data);
+   sse_andps(p->func, tmpXMM, get_const(p, CONST_FLOAT_ABS));
+   sse_cmpps(p->func, tmpXMM, get_const(p, CONST_65536), cc_NotLessThan);
+   sse_andps(p->func, tmpXMM, get_const(p, CONST_FLOAT_EXP));
+   sse_orps(p->func, data, tmpXMM);
+}
+
+
+/**
+ * Compare two channel descriptions, ignoring their bit position.
+ */
+static boolean
+channels_match(const struct util_format_channel_description *a,
+               const struct util_format_channel_description *b)
+{
+   return a->type == b->type &&
+          a->normalized == b->normalized &&
+          a->pure_integer == b->pure_integer &&
+          a->size == b->size;
+}
+
+
+static boolean
+is_format_10_10_10_2(enum pipe_format format)
+{
+   switch (format) {
+   case PIPE_FORMAT_R10G10B10A2_UNORM:
+   case PIPE_FORMAT_R10G10B10A2_SNORM:
+   case PIPE_FORMAT_R10G10B10A2_USCALED:
+   case PIPE_FORMAT_R10G10B10A2_SSCALED:
+   case PIPE_FORMAT_B10G10R10A2_UNORM:
+   case PIPE_FORMAT_B10G10R10A2_SNORM:
+   case PIPE_FORMAT_B10G10R10A2_USCALED:
+   case PIPE_FORMAT_B10G10R10A2_SSCALED:
+      return TRUE;
+   default:
+      return FALSE;
+   }
+}
+
+
+/**
+ * Load a 10_10_10_2 vertex into the four channels of data, as floats.
+ * The 10 bit channels are masked in place and scaled down as floats, the
+ * 2 bit one is shifted down.
+ */
+static void
+emit_load_10_10_10_2(struct translate_sse *p, struct x86_reg data,
+                     struct x86_reg src,
+                     const struct util_format_description *desc)
+{
+   struct x86_reg tmpXMM = x86_make_reg(file_XMM, 1);
+   const boolean sign = desc->channel[0].type == UTIL_FORMAT_TYPE_SIGNED;
+   const boolean norm = desc->channel[0].normalized;
+
+   sse2_movd(p->func, data, src);
+   sse_movaps(p->func, tmpXMM, data);
+   if (sign)
+      sse2_psrad_imm(p->func, tmpXMM, 30);
+   else
+      sse2_psrld_imm(p->func, tmpXMM, 30);
+   sse2_pshufd(p->func, tmpXMM, tmpXMM, SHUF(Y, Y, Y, X));
+
+   sse2_pshufd(p->func, data, data, SHUF(X, X, X, X));
+   sse_andps(p->func, data, get_const(p, CONST_MASK_10_10_10));
+   sse_orps(p->func, data, tmpXMM);
+   sse2_cvtdq2ps(p->func, data, data);
+
+   if (norm && !sign) {
+      sse_mulps(p->func, data, get_const(p, CONST_UNORM_10_10_10_2));
+      return;
+   }
+
+   sse_mulps(p->func, data, get_const(p, CONST_SCALED_10_10_10_2));
+
+   if (sign) {
+      /* sign extend the 10 bit channels */
+      sse_movaps(p->func, tmpXMM, data);
+      sse_cmpps(p->func, tmpXMM, get_const(p, CONST_512), cc_NotLessThan);
+      sse_andps(p->func, tmpXMM, get_const(p, CONST_SIGN_FIX_10_10_10));
+      sse_subps(p->func, data, tmpXMM);
+
+      if (norm) {
+         sse_mulps(p->func, data, get_const(p, CONST_SNORM_10_10_10_2));
+         sse_maxps(p->func, data, get_const(p, CONST_MINUS_1));
+      }
+   }
+}
+
+
 /* this value can be passed for the out_chans argument */
 #define CHANNELS_0001 5
 
@@ -471,28 +633,37 @@ translate_attr_convert(struct translate_sse *p,
         PIPE_SWIZZLE_NONE, PIPE_SWIZZLE_NONE };
    unsigned needed_chans = 0;
    unsigned imms[2] = { 0, 0x3f800000 };
+   boolean float_output, packed_10_10_10_2;
 
    if (a->output_format == PIPE_FORMAT_NONE
        || a->input_format == PIPE_FORMAT_NONE)
       return FALSE;
 
-   if (input_desc->channel[0].size & 7)
+   float_output = (a->output_format == PIPE_FORMAT_R32_FLOAT
+                   || a->output_format == PIPE_FORMAT_R32G32_FLOAT
+                   || a->output_format == PIPE_FORMAT_R32G32B32_FLOAT
+                   || a->output_format == PIPE_FORMAT_R32G32B32A32_FLOAT);
+
+   /* only converted to float, as its channels differ */
+   packed_10_10_10_2 = is_format_10_10_10_2(a->input_format);
+   if (packed_10_10_10_2 &&
+       (!float_output || !(x86_target_caps(p->func) & X86_SSE2)))
+      return FALSE;
+
+   if ((input_desc->channel[0].size & 7) && !packed_10_10_10_2)
       return FALSE;
 
    if (input_desc->colorspace != output_desc->colorspace)
       return FALSE;
 
-   for (i = 1; i < input_desc->nr_channels; ++i) {
-      if (memcmp
-          (&input_desc->channel[i], &input_desc->channel[0],
-           sizeof(input_desc->channel[0])))
+   for (i = 1; i < input_desc->nr_channels && !packed_10_10_10_2; ++i) {
+      if (!channels_match(&input_desc->channel[i], &input_desc->channel[0]))
          return FALSE;
    }
 
    for (i = 1; i < output_desc->nr_channels; ++i) {
-      if (memcmp
-          (&output_desc->channel[i], &output_desc->channel[0],
-           sizeof(output_desc->channel[0]))) {
+      if (!channels_match(&output_desc->channel[i],
+                          &output_desc->channel[0])) {
          return FALSE;
       }
    }
@@ -502,11 +673,7 @@ translate_attr_convert(struct translate_sse *p,
          swizzle[output_desc->swizzle[i]] = input_desc->swizzle[i];
    }
 
-   if ((x86_target_caps(p->func) & X86_SSE) &&
-       (0 || a->output_format == PIPE_FORMAT_R32_FLOAT
-        || a->output_format == PIPE_FORMAT_R32G32_FLOAT
-        || a->output_format == PIPE_FORMAT_R32G32B32_FLOAT
-        || a->output_format == PIPE_FORMAT_R32G32B32A32_FLOAT)) {
+   if ((x86_target_caps(p->func) & X86_SSE) && float_output) {
       struct x86_reg dataXMM = x86_make_reg(file_XMM, 0);
 
       for (i = 0; i < output_desc->nr_channels; ++i) {
@@ -522,7 +689,15 @@ translate_attr_convert(struct translate_sse *p,
             id_swizzle = FALSE;
       }
 
-      if (needed_chans > 0) {
+      if (needed_chans > 0 && packed_10_10_10_2) {
+         emit_load_10_10_10_2(p, dataXMM, src, input_desc);
+
+         if (!id_swizzle) {
+            sse_shufps(p->func, dataXMM, dataXMM,
+                       SHUF(swizzle[0], swizzle[1], swizzle[2], swizzle[3]));
+         }
+      }
+      else if (needed_chans > 0) {
          switch (input_desc->channel[0].type) {
          case UTIL_FORMAT_TYPE_UNSIGNED:
             if (!(x86_target_caps(p->func) & X86_SSE2))
@@ -626,6 +801,14 @@ translate_attr_convert(struct translate_sse *p,
 
             break;
          case UTIL_FORMAT_TYPE_FLOAT:
+            if (input_desc->channel[0].size == 16) {
+               if (!(x86_target_caps(p->func) & X86_SSE2))
+                  return FALSE;
+               emit_load_sse2(p, dataXMM, src,
+                              2 * input_desc->nr_channels);
+               emit_half_to_float(p, dataXMM);
+               break;
+            }
             if (input_desc->channel[0].size != 32
                 && input_desc->channel[0].size != 64) {
                return FALSE;
@@ -883,8 +1066,8 @@ translate_attr_convert(struct translate_sse *p,
       }
       return TRUE;
    }
-   else if (!memcmp(&output_desc->channel[0], &input_desc->channel[0],
-                    sizeof(output_desc->channel[0]))) {
+   else if (channels_match(&output_desc->channel[0],
+                           &input_desc->channel[0])) {
       struct x86_reg tmp = p->tmp_EAX;
       unsigned i;
 
@@ -1272,6 +1455,297 @@ incr_inputs(struct translate_sse *p, unsigned index_size)
 }
 
 
+/*
+ * AVX2 run of linear draws: 8 vertices per iteration, gathered channel by
+ * channel from each buffer, converted, and transposed back to vertices.
+ * YMM0 holds the vertex offsets, YMM1 the gather mask or a constant,
+ * YMM2-5 the x, y, z and w channels and YMM6-7 are scratch.
+ */
+
+static boolean
+avx2_element_supported(const struct translate_element *a)
+{
+   if (a->type != TRANSLATE_ELEMENT_NORMAL || a->instance_divisor ||
+       a->output_format != PIPE_FORMAT_R32G32B32A32_FLOAT)
+      return FALSE;
+
+   /* Only formats whose gathers read no further than the element. */
+   switch (a->input_format) {
+   case PIPE_FORMAT_R32_FLOAT:
+   case PIPE_FORMAT_R32G32_FLOAT:
+   case PIPE_FORMAT_R32G32B32_FLOAT:
+   case PIPE_FORMAT_R32G32B32A32_FLOAT:
+   case PIPE_FORMAT_R8G8B8A8_UNORM:
+   case PIPE_FORMAT_B8G8R8A8_UNORM:
+   case PIPE_FORMAT_R16G16_FLOAT:
+   case PIPE_FORMAT_R16G16B16A16_FLOAT:
+      return TRUE;
+   default:
+      return FALSE;
+   }
+}
+
+
+/**
+ * The gathers only pay for themselves where the SSE path has a long
+ * per-vertex conversion, which in practice means half floats.  Other
+ * formats are still taken along when they share a vertex with one.
+ */
+static boolean
+avx2_element_profitable(const struct translate_element *a)
+{
+   switch (a->input_format) {
+   case PIPE_FORMAT_R16G16_FLOAT:
+   case PIPE_FORMAT_R16G16B16A16_FLOAT:
+      return TRUE;
+   default:
+      return FALSE;
+   }
+}
+
+
+static boolean
+avx2_supported(struct translate_sse *p)
+{
+   boolean profitable = FALSE;
+   unsigned i;
+
+   if ((x86_target_caps(p->func) & (X86_AVX2 | X86_F16C)) !=
+       (X86_AVX2 | X86_F16C))
+      return FALSE;
+
+   for (i = 0; i < p->translate.key.nr_elements; i++) {
+      const struct translate_element *a = &p->translate.key.element[i];
+
+      if (!avx2_element_supported(a))
+         return FALSE;
+
+      profitable |= avx2_element_profitable(a);
+   }
+
+   return profitable;
+}
+
+
+static struct x86_reg
+avx2_reg(unsigned idx)
+{
+   return x86_make_reg(file_XMM, idx);
+}
+
+
+static void
+avx2_broadcast_const(struct translate_sse *p, struct x86_reg dst,
+                     unsigned id, unsigned chan)
+{
+   avx_vbroadcastss(p->func, dst,
+                    x86_make_disp(p->machine_EDI,
+                                  get_offset(p, &p->consts[id][chan])));
+}
+
+
+static void
+avx2_gather(struct translate_sse *p, struct x86_reg dst, struct x86_reg src)
+{
+   struct x86_reg mask = avx2_reg(1);
+
+   avx2_vpcmpeqd(p->func, mask, mask, mask);
+   avx2_vpgatherdd(p->func, dst, src, avx2_reg(0), mask);
+}
+
+
+/* Two half floats per lane of src to floats in lo and hi, YMM1 holding
+ * the 16-bit mask.
+ */
+static void
+avx2_half2_to_float(struct translate_sse *p, struct x86_reg src,
+                    struct x86_reg lo, struct x86_reg hi)
+{
+   avx2_vpand(p->func, lo, src, avx2_reg(1));
+   avx2_vpsrld_imm(p->func, hi, src, 16);
+   /* x0-3 y0-3 | x4-7 y4-7, then x0-7 | y0-7 */
+   avx2_vpackusdw(p->func, lo, lo, hi);
+   avx2_vpermq(p->func, lo, lo, 0xd8);
+   avx_vextractf128(p->func, hi, lo, 1);
+   f16c_vcvtph2ps(p->func, lo, lo);
+   f16c_vcvtph2ps(p->func, hi, hi);
+}
+
+
+static void
+avx2_translate_attr(struct translate_sse *p,
+                    const struct translate_element *a,
+                    struct x86_reg src, struct x86_reg dst)
+{
+   const struct util_format_description *desc =
+      util_format_description(a->input_format);
+   const unsigned stride = p->translate.key.output_stride;
+   struct x86_reg chan[4] = {
+      avx2_reg(2), avx2_reg(3), avx2_reg(4), avx2_reg(5)
+   };
+   struct x86_reg tmp0 = avx2_reg(6);
+   struct x86_reg tmp1 = avx2_reg(7);
+   struct x86_reg vertex[4];
+   unsigned i;
+
+   switch (a->input_format) {
+   case PIPE_FORMAT_R8G8B8A8_UNORM:
+   case PIPE_FORMAT_B8G8R8A8_UNORM:
+      avx2_gather(p, tmp0, src);
+      avx2_broadcast_const(p, avx2_reg(1), CONST_MASK_8, 0);
+      /* unpack the bytes in memory order */
+      for (i = 0; i < 4; i++) {
+         if (i)
+            avx2_vpsrld_imm(p->func, chan[i], tmp0, i * 8);
+         if (i < 3)
+            avx2_vpand(p->func, chan[i], i ? chan[i] : tmp0, avx2_reg(1));
+      }
+      avx2_broadcast_const(p, avx2_reg(1), CONST_INV_255, 0);
+      for (i = 0; i < 4; i++) {
+         avx_vcvtdq2ps(p->func, chan[i], chan[i]);
+         avx_vmulps(p->func, chan[i], chan[i], avx2_reg(1));
+      }
+      /* and put them in channel order */
+      for (i = 0; i < 4; i++)
+         vertex[i] = chan[desc->swizzle[i]];
+      memcpy(chan, vertex, sizeof(chan));
+      break;
+   case PIPE_FORMAT_R16G16_FLOAT:
+   case PIPE_FORMAT_R16G16B16A16_FLOAT:
+      avx2_gather(p, tmp0, src);
+      if (desc->nr_channels == 4)
+         avx2_gather(p, tmp1, x86_make_disp(src, 4));
+      avx2_broadcast_const(p, avx2_reg(1), CONST_MASK_16, 0);
+      avx2_half2_to_float(p, tmp0, chan[0], chan[1]);
+      if (desc->nr_channels == 4)
+         avx2_half2_to_float(p, tmp1, chan[2], chan[3]);
+      break;
+   default:
+      for (i = 0; i < desc->nr_channels; i++)
+         avx2_gather(p, chan[i], x86_make_disp(src, i * 4));
+      break;
+   }
+
+   /* missing channels read as (0, 0, 0, 1) */
+   for (i = desc->nr_channels; i < 4; i++)
+      avx2_broadcast_const(p, chan[i], CONST_IDENTITY, i);
+
+   /* Transpose to v0|v4, v1|v5, v2|v6 and v3|v7. */
+   avx_vunpcklps(p->func, tmp0, chan[0], chan[1]);
+   avx_vunpckhps(p->func, tmp1, chan[0], chan[1]);
+   avx_vunpcklps(p->func, chan[0], chan[2], chan[3]);
+   avx_vunpckhps(p->func, chan[1], chan[2], chan[3]);
+   avx_vunpcklpd(p->func, chan[2], tmp0, chan[0]);
+   avx_vunpckhpd(p->func, chan[3], tmp0, chan[0]);
+   avx_vunpcklpd(p->func, tmp0, tmp1, chan[1]);
+   avx_vunpckhpd(p->func, tmp1, tmp1, chan[1]);
+
+   vertex[0] = chan[2];
+   vertex[1] = chan[3];
+   vertex[2] = tmp0;
+   vertex[3] = tmp1;
+   for (i = 0; i < 4; i++) {
+      avx_vextractf128(p->func, x86_make_disp(dst, i * stride),
+                       vertex[i], 0);
+      avx_vextractf128(p->func, x86_make_disp(dst, (i + 4) * stride),
+                       vertex[i], 1);
+   }
+}
+
+
+/* Emit the loop converting batches of 8 vertices, ahead of the one
+ * converting the rest one at a time.  Returns the jump to take when no
+ * vertices are left.
+ */
+static int
+avx2_build_linear_loop(struct translate_sse *p)
+{
+   struct x86_reg offsets = avx2_reg(0);
+   struct x86_reg stride = avx2_reg(1);
+   int skip, label, done;
+   int last_variant = -1;
+   struct x86_reg vb;
+   unsigned i;
+
+   x86_cmp_imm(p->func, p->count_EBP, 8);
+   skip = x86_jcc_forward(p->func, cc_NAE);
+
+   for (i = 0; i < p->nr_buffer_variants; i++) {
+      const unsigned buffer_index = p->buffer_variant[i].buffer_index;
+
+      avx_vbroadcastss(p->func, stride,
+                       x86_make_disp(p->machine_EDI,
+                          get_offset(p, &p->buffer[buffer_index].stride)));
+      avx_vmovups(p->func, offsets,
+                  x86_make_disp(p->machine_EDI,
+                                get_offset(p, &p->avx2_lanes[0])));
+      avx2_vpmulld(p->func, offsets, offsets, stride);
+      avx_vmovups(p->func,
+                  x86_make_disp(p->machine_EDI,
+                                get_offset(p, &p->avx2_offsets[i][0])),
+                  offsets);
+   }
+
+   label = x86_get_label(p->func);
+
+   for (i = 0; i < p->translate.key.nr_elements; i++) {
+      const struct translate_element *a = &p->translate.key.element[i];
+      unsigned variant = p->element_to_buffer_variant[i];
+
+      if (variant != last_variant) {
+         last_variant = variant;
+         vb = get_buffer_ptr(p, 0, variant, p->idx_ESI);
+         avx_vmovups(p->func, offsets,
+                     x86_make_disp(p->machine_EDI,
+                                   get_offset(p, &p->avx2_offsets[variant][0])));
+      }
+
+      avx2_translate_attr(p, a, x86_make_disp(vb, a->input_offset),
+                          x86_make_disp(p->outbuf_EBX, a->output_offset));
+   }
+
+   x64_rexw(p->func);
+   x86_lea(p->func, p->outbuf_EBX,
+           x86_make_disp(p->outbuf_EBX, 8 * p->translate.key.output_stride));
+
+   for (i = 0; i < p->nr_buffer_variants; i++) {
+      const unsigned buffer_index = p->buffer_variant[i].buffer_index;
+      struct x86_reg buf_stride =
+         x86_make_disp(p->machine_EDI,
+                       get_offset(p, &p->buffer[buffer_index].stride));
+      struct x86_reg buf_ptr =
+         x86_make_disp(p->machine_EDI,
+                       get_offset(p, &p->buffer_variant[i].ptr));
+
+      x86_mov(p->func, p->tmp_EAX, buf_stride);
+      x86_shl_imm(p->func, p->tmp_EAX, 3);
+      if (p->nr_buffer_variants == 1) {
+         x64_rexw(p->func);
+         x86_add(p->func, p->idx_ESI, p->tmp_EAX);
+      }
+      else {
+         x64_rexw(p->func);
+         x86_add(p->func, p->tmp_EAX, buf_ptr);
+         x64_rexw(p->func);
+         x86_mov(p->func, buf_ptr, p->tmp_EAX);
+      }
+   }
+
+   x86_sub_imm(p->func, p->count_EBP, 8);
+   x86_cmp_imm(p->func, p->count_EBP, 8);
+   x86_jcc(p->func, cc_AE, label);
+
+   avx_vzeroupper(p->func);
+
+   x86_cmp_imm(p->func, p->count_EBP, 0);
+   done = x86_jcc_forward(p->func, cc_E);
+
+   x86_fixup_fwd_jump(p->func, skip);
+
+   return done;
+}
+
+
 /* Build run( struct translate *machine,
  *            unsigned start,
  *            unsigned count,
@@ -1292,7 +1766,7 @@ static boolean
 build_vertex_emit(struct translate_sse *p,
                   struct x86_function *func, unsigned index_size)
 {
-   int fixup, label;
+   int fixup, label, avx2_fixup = -1;
    unsigned j;
 
    memset(p->reg_to_const, 0xff, sizeof(p->reg_to_const));
@@ -1370,6 +1844,9 @@ build_vertex_emit(struct translate_sse *p,
     */
    init_inputs(p, index_size);
 
+   if (!index_size && avx2_supported(p))
+      avx2_fixup = avx2_build_linear_loop(p);
+
    /* Note address for loop jump
     */
    label = x86_get_label(p->func);
@@ -1416,9 +1893,11 @@ build_vertex_emit(struct translate_sse *p,
    if (p->func->need_emms)
       mmx_emms(p->func);
 
-   /* Land forward jump here:
+   /* Land forward jumps here:
     */
    x86_fixup_fwd_jump(p->func, fixup);
+   if (avx2_fixup >= 0)
+      x86_fixup_fwd_jump(p->func, avx2_fixup);
 
    /* Pop regs and return
     */
@@ -1491,6 +1970,9 @@ translate_sse2_create(const struct translate_key *key)
 
    memset(p, 0, sizeof(*p));
    memcpy(p->consts, consts, sizeof(consts));
+   memcpy(p->consts[NUM_FLOAT_CONSTS], int_consts, sizeof(int_consts));
+   for (i = 0; i < ARRAY_SIZE(p->avx2_lanes); i++)
+      p->avx2_lanes[i] = i;
 
    p->translate.key = *key;
    p->translate.release = translate_sse_release;
@@ -2,6 +2,7 @@
 #include "util/u_surface.h"
 #include "util/u_inlines.h"
 #include "util/u_transfer.h"
+#include "util/u_memcpy.h"
 #include "util/u_memory.h"
 
 void u_default_buffer_subdata(struct pipe_context *pipe,
@@ -35,7 +36,7 @@ void u_default_buffer_subdata(struct pipe_context *pipe,
    if (!map)
       return;
 
-   memcpy(map, data, size);
+   util_upload_memcpy(map, data, size);
    pipe_transfer_unmap(pipe, transfer);
 }
 
@@ -32,6 +32,7 @@
 #include "pipe/p_defines.h"
 #include "util/u_inlines.h"
 #include "pipe/p_context.h"
+#include "util/u_memcpy.h"
 #include "util/u_memory.h"
 #include "util/u_math.h"
 
@@ -308,5 +309,5 @@ u_upload_data(struct u_upload_mgr *upload,
                   out_offset, outbuf,
                   (void**)&ptr);
    if (ptr)
-      memcpy(ptr, data, size);
+      util_upload_memcpy(ptr, data, size);
 }
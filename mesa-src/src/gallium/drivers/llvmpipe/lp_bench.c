@@ -0,0 +1,675 @@
+/*
+ * Copyright © 2026 Mesa contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * @file
+ * End-to-end throughput benchmark: drives an llvmpipe pipe_context
+ * directly, without a GL frontend, and reports Mpix/s, Mtri/s or
+ * Minvocations/s for fill rate, triangle rate, texture filtering,
+ * blending, MSAA and compute dispatch.  Run it as
+ *
+ *    lp_bench [-s WxH] [-t seconds] [-j threads,...] [workload...]
+ *
+ * where -j lists the LP_NUM_THREADS values to measure, for scaling.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipe/p_context.h"
+#include "pipe/p_defines.h"
+#include "pipe/p_screen.h"
+#include "pipe/p_shader_tokens.h"
+#include "pipe/p_state.h"
+#include "cso_cache/cso_context.h"
+#include "tgsi/tgsi_text.h"
+#include "util/os_time.h"
+#include "util/u_box.h"
+#include "util/u_draw_quad.h"
+#include "util/u_inlines.h"
+#include "util/u_memory.h"
+#include "util/u_sampler.h"
+#include "util/u_simple_shaders.h"
+#include "sw/null/null_sw_winsys.h"
+
+#include "lp_public.h"
+#include "lp_screen.h"
+
+
+struct bench
+{
+   struct pipe_screen *screen;
+   struct pipe_context *pipe;
+   struct cso_context *cso;
+   unsigned width, height;
+   double min_time;           /**< seconds per workload */
+
+   void *vs, *fs, *cs;
+   struct pipe_vertex_buffer vbuf;
+   unsigned num_verts;
+   unsigned draws;            /**< of the vertex buffer, per frame */
+   struct pipe_resource *target;
+   struct pipe_surface *surf;
+};
+
+
+/** What one frame of a workload does, for the rates */
+struct bench_frame
+{
+   uint64_t pixels;
+   uint64_t tris;
+   uint64_t invocations;
+};
+
+
+struct bench_workload
+{
+   const char *name;
+   void (*setup)(struct bench *b, const struct bench_workload *w,
+                 struct bench_frame *frame);
+   void (*frame)(struct bench *b);
+   unsigned param;
+};
+
+
+/** Vertices of float4 position and float4 generic[0], as u_draw_quad wants */
+static void
+bench_set_vertices(struct bench *b, const float (*verts)[2][4],
+                   unsigned num_verts)
+{
+   pipe_resource_reference(&b->vbuf.buffer.resource, NULL);
+   b->vbuf.buffer.resource =
+      pipe_buffer_create(b->screen, PIPE_BIND_VERTEX_BUFFER,
+                         PIPE_USAGE_IMMUTABLE, num_verts * sizeof(*verts));
+   pipe_buffer_write(b->pipe, b->vbuf.buffer.resource, 0,
+                     num_verts * sizeof(*verts), verts);
+   b->vbuf.stride = sizeof(*verts);
+   b->num_verts = num_verts;
+}
+
+
+/** Bind a new fragment shader, deleting the last one */
+static void
+bench_set_fs(struct bench *b, void *fs)
+{
+   cso_set_fragment_shader_handle(b->cso, fs);
+   if (b->fs)
+      b->pipe->delete_fs_state(b->pipe, b->fs);
+   b->fs = fs;
+}
+
+
+/**
+ * Two triangles covering the framebuffer; the generic attribute is
+ * (s, t, 0, alpha), with s and t going from 0 to texscale.
+ */
+static void
+bench_set_quad(struct bench *b, float texscale, float alpha)
+{
+   const float verts[6][2][4] = {
+      { { -1, -1, 0, 1 }, { 0,        0,        0, alpha } },
+      { {  1, -1, 0, 1 }, { texscale, 0,        0, alpha } },
+      { { -1,  1, 0, 1 }, { 0,        texscale, 0, alpha } },
+      { {  1, -1, 0, 1 }, { texscale, 0,        0, alpha } },
+      { {  1,  1, 0, 1 }, { texscale, texscale, 0, alpha } },
+      { { -1,  1, 0, 1 }, { 0,        texscale, 0, alpha } },
+   };
+
+   bench_set_vertices(b, verts, 6);
+}
+
+
+static void
+bench_set_target(struct bench *b, unsigned samples)
+{
+   struct pipe_resource templ;
+   struct pipe_surface surf_templ;
+   struct pipe_framebuffer_state fb;
+
+   pipe_surface_reference(&b->surf, NULL);
+   pipe_resource_reference(&b->target, NULL);
+
+   memset(&templ, 0, sizeof(templ));
+   templ.target = PIPE_TEXTURE_2D;
+   templ.format = PIPE_FORMAT_B8G8R8A8_UNORM;
+   templ.width0 = b->width;
+   templ.height0 = b->height;
+   templ.depth0 = 1;
+   templ.array_size = 1;
+   templ.nr_samples = templ.nr_storage_samples = samples > 1 ? samples : 0;
+   templ.bind = PIPE_BIND_RENDER_TARGET;
+   b->target = b->screen->resource_create(b->screen, &templ);
+
+   memset(&surf_templ, 0, sizeof(surf_templ));
+   surf_templ.format = templ.format;
+   b->surf = b->pipe->create_surface(b->pipe, b->target, &surf_templ);
+
+   memset(&fb, 0, sizeof(fb));
+   fb.width = b->width;
+   fb.height = b->height;
+   fb.samples = samples > 1 ? samples : 0;
+   fb.nr_cbufs = 1;
+   fb.cbufs[0] = b->surf;
+   cso_set_framebuffer(b->cso, &fb);
+}
+
+
+/** Common state of the draw workloads: no blending, depth or culling */
+static void
+bench_setup_draw(struct bench *b, unsigned samples)
+{
+   struct pipe_blend_state blend;
+   struct pipe_depth_stencil_alpha_state dsa;
+   struct pipe_rasterizer_state rast;
+   struct pipe_viewport_state viewport;
+   struct cso_velems_state velem;
+   unsigned i;
+
+   bench_set_target(b, samples);
+
+   memset(&blend, 0, sizeof(blend));
+   blend.rt[0].colormask = PIPE_MASK_RGBA;
+   cso_set_blend(b->cso, &blend);
+
+   memset(&dsa, 0, sizeof(dsa));
+   cso_set_depth_stencil_alpha(b->cso, &dsa);
+
+   memset(&rast, 0, sizeof(rast));
+   rast.cull_face = PIPE_FACE_NONE;
+   rast.half_pixel_center = 1;
+   rast.bottom_edge_rule = 1;
+   rast.depth_clip_near = 1;
+   rast.depth_clip_far = 1;
+   rast.multisample = samples > 1;
+   cso_set_rasterizer(b->cso, &rast);
+
+   viewport.scale[0] = b->width / 2.0f;
+   viewport.scale[1] = b->height / 2.0f;
+   viewport.scale[2] = 0.5f;
+   viewport.translate[0] = b->width / 2.0f;
+   viewport.translate[1] = b->height / 2.0f;
+   viewport.translate[2] = 0.5f;
+   viewport.swizzle_x = PIPE_VIEWPORT_SWIZZLE_POSITIVE_X;
+   viewport.swizzle_y = PIPE_VIEWPORT_SWIZZLE_POSITIVE_Y;
+   viewport.swizzle_z = PIPE_VIEWPORT_SWIZZLE_POSITIVE_Z;
+   viewport.swizzle_w = PIPE_VIEWPORT_SWIZZLE_POSITIVE_W;
+   cso_set_viewport(b->cso, &viewport);
+
+   memset(&velem, 0, sizeof(velem));
+   velem.count = 2;
+   for (i = 0; i < 2; i++) {
+      velem.velems[i].src_offset = i * 4 * sizeof(float);
+      velem.velems[i].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+   }
+   cso_set_vertex_elements(b->cso, &velem);
+
+   cso_set_vertex_shader_handle(b->cso, b->vs);
+   bench_set_fs(b,
+      util_make_fragment_passthrough_shader(b->pipe, TGSI_SEMANTIC_GENERIC,
+                                            TGSI_INTERPOLATE_PERSPECTIVE,
+                                            TRUE));
+   b->draws = 1;
+}
+
+
+static void
+bench_draw_frame(struct bench *b)
+{
+   const union pipe_color_union color = { .f = { 0.2f, 0.4f, 0.6f, 1.0f } };
+   unsigned i;
+
+   b->pipe->clear(b->pipe, PIPE_CLEAR_COLOR, NULL, &color, 0, 0);
+   for (i = 0; i < b->draws; i++) {
+      cso_set_vertex_buffers(b->cso, 0, 1, &b->vbuf);
+      cso_draw_arrays(b->cso, PIPE_PRIM_TRIANGLES, 0, b->num_verts);
+   }
+   b->pipe->flush(b->pipe, NULL, 0);
+}
+
+
+/** Full screen quads, param of them per frame */
+static void
+bench_setup_fill(struct bench *b, const struct bench_workload *w,
+                 struct bench_frame *frame)
+{
+   bench_setup_draw(b, 1);
+   bench_set_quad(b, 1.0f, 1.0f);
+   b->draws = w->param;
+   frame->pixels = (uint64_t)b->width * b->height * b->draws;
+   frame->tris = 2 * b->draws;
+}
+
+
+/** A grid of right triangles with legs of param pixels */
+static void
+bench_setup_tris(struct bench *b, const struct bench_workload *w,
+                 struct bench_frame *frame)
+{
+   unsigned size = w->param;
+   unsigned cols = b->width / size, rows = b->height / size;
+   float (*verts)[2][4] = MALLOC(cols * rows * 6 * sizeof(*verts));
+   float dx = 2.0f * size / b->width, dy = 2.0f * size / b->height;
+   unsigned n = 0, x, y;
+
+   bench_setup_draw(b, 1);
+
+   if (!verts)
+      return;
+
+   for (y = 0; y < rows; y++) {
+      for (x = 0; x < cols; x++) {
+         const float x0 = -1 + x * dx, y0 = -1 + y * dy;
+         const float corners[6][2] = {
+            { x0, y0 }, { x0 + dx, y0 }, { x0, y0 + dy },
+            { x0 + dx, y0 }, { x0 + dx, y0 + dy }, { x0, y0 + dy },
+         };
+         unsigned i;
+
+         for (i = 0; i < 6; i++, n++) {
+            verts[n][0][0] = corners[i][0];
+            verts[n][0][1] = corners[i][1];
+            verts[n][0][2] = 0.0f;
+            verts[n][0][3] = 1.0f;
+            verts[n][1][0] = (float)x / cols;
+            verts[n][1][1] = (float)y / rows;
+            verts[n][1][2] = 0.5f;
+            verts[n][1][3] = 1.0f;
+         }
+      }
+   }
+
+   bench_set_vertices(b, (const float (*)[2][4])verts, n);
+   FREE(verts);
+
+   frame->pixels = (uint64_t)cols * rows * size * size;
+   frame->tris = n / 3;
+}
+
+
+/** Full screen quads sampling a mipmapped 1024x1024 texture */
+static void
+bench_setup_tex(struct bench *b, const struct bench_workload *w,
+                struct bench_frame *frame)
+{
+   const unsigned size = 1024, levels = 11;
+   struct pipe_resource templ, *tex;
+   struct pipe_sampler_view view_templ, *view;
+   struct pipe_sampler_state sampler;
+   const struct pipe_sampler_state *samplers[1] = { &sampler };
+   uint32_t *texels = MALLOC(size * size * 4);
+   unsigned level, i;
+
+   bench_setup_draw(b, 1);
+   /* Minify by two, so that mipmapping matters */
+   bench_set_quad(b, 2.0f * b->width / size, 1.0f);
+   b->draws = 4;
+
+   memset(&templ, 0, sizeof(templ));
+   templ.target = PIPE_TEXTURE_2D;
+   templ.format = PIPE_FORMAT_B8G8R8A8_UNORM;
+   templ.width0 = templ.height0 = size;
+   templ.depth0 = 1;
+   templ.array_size = 1;
+   templ.last_level = levels - 1;
+   templ.bind = PIPE_BIND_SAMPLER_VIEW;
+   tex = b->screen->resource_create(b->screen, &templ);
+
+   if (texels) {
+      for (i = 0; i < size * size; i++)
+         texels[i] = 0xff000000 | (i * 2654435761u >> 8);
+      for (level = 0; level < levels; level++) {
+         unsigned dim = u_minify(size, level);
+         struct pipe_box box;
+
+         u_box_2d(0, 0, dim, dim, &box);
+         b->pipe->texture_subdata(b->pipe, tex, level, 0, &box, texels,
+                                  dim * 4, 0);
+      }
+      FREE(texels);
+   }
+
+   u_sampler_view_default_template(&view_templ, tex, tex->format);
+   view = b->pipe->create_sampler_view(b->pipe, tex, &view_templ);
+   pipe_resource_reference(&tex, NULL);
+   cso_set_sampler_views(b->cso, PIPE_SHADER_FRAGMENT, 1, &view);
+   pipe_sampler_view_reference(&view, NULL);
+
+   memset(&sampler, 0, sizeof(sampler));
+   sampler.wrap_s = sampler.wrap_t = sampler.wrap_r = PIPE_TEX_WRAP_REPEAT;
+   sampler.min_img_filter = sampler.mag_img_filter = w->param & 1 ?
+      PIPE_TEX_FILTER_LINEAR : PIPE_TEX_FILTER_NEAREST;
+   sampler.min_mip_filter = w->param & 2 ?
+      PIPE_TEX_MIPFILTER_LINEAR : PIPE_TEX_MIPFILTER_NONE;
+   sampler.max_lod = levels - 1;
+   sampler.normalized_coords = 1;
+   cso_set_samplers(b->cso, PIPE_SHADER_FRAGMENT, 1, samplers);
+
+   bench_set_fs(b,
+      util_make_fragment_tex_shader(b->pipe, TGSI_TEXTURE_2D,
+                                    TGSI_INTERPOLATE_LINEAR,
+                                    TGSI_RETURN_TYPE_FLOAT,
+                                    TGSI_RETURN_TYPE_FLOAT, false, false));
+
+   frame->pixels = (uint64_t)b->width * b->height * b->draws;
+   frame->tris = 2 * b->draws;
+}
+
+
+/** Full screen quads blended with PIPE_BLENDFACTOR_* param */
+static void
+bench_setup_blend(struct bench *b, const struct bench_workload *w,
+                  struct bench_frame *frame)
+{
+   struct pipe_blend_state blend;
+
+   bench_setup_draw(b, 1);
+   bench_set_quad(b, 1.0f, 0.5f);
+   b->draws = 8;
+
+   memset(&blend, 0, sizeof(blend));
+   blend.rt[0].colormask = PIPE_MASK_RGBA;
+   blend.rt[0].blend_enable = 1;
+   blend.rt[0].rgb_func = blend.rt[0].alpha_func = PIPE_BLEND_ADD;
+   blend.rt[0].rgb_src_factor = blend.rt[0].alpha_src_factor =
+      w->param == PIPE_BLENDFACTOR_ONE ? PIPE_BLENDFACTOR_ONE :
+                                         PIPE_BLENDFACTOR_SRC_ALPHA;
+   blend.rt[0].rgb_dst_factor = blend.rt[0].alpha_dst_factor = w->param;
+   cso_set_blend(b->cso, &blend);
+
+   frame->pixels = (uint64_t)b->width * b->height * b->draws;
+   frame->tris = 2 * b->draws;
+}
+
+
+/** Full screen quads into a render target of param samples */
+static void
+bench_setup_msaa(struct bench *b, const struct bench_workload *w,
+                 struct bench_frame *frame)
+{
+   bench_setup_draw(b, w->param);
+   bench_set_quad(b, 1.0f, 1.0f);
+   b->draws = 8;
+
+   frame->pixels = (uint64_t)b->width * b->height * b->draws;
+   frame->tris = 2 * b->draws;
+}
+
+
+static const char bench_cs_text[] =
+   "COMP\n"
+   "DCL SV[0], THREAD_ID\n"
+   "DCL SV[1], BLOCK_ID\n"
+   "DCL BUFFER[0]\n"
+   "DCL TEMP[0..1], LOCAL\n"
+   "IMM[0] UINT32 {64, 4, 0, 0}\n"
+   "  0: UMAD TEMP[0].x, SV[1].xxxx, IMM[0].xxxx, SV[0].xxxx\n"
+   "  1: UMUL TEMP[1].x, TEMP[0].xxxx, IMM[0].yyyy\n"
+   "  2: STORE BUFFER[0].x, TEMP[1].xxxx, TEMP[0].xxxx\n"
+   "  3: END\n";
+
+static struct pipe_grid_info bench_grid;
+
+/** param blocks of 64 invocations, each storing its index */
+static void
+bench_setup_compute(struct bench *b, const struct bench_workload *w,
+                    struct bench_frame *frame)
+{
+   struct tgsi_token tokens[256];
+   struct pipe_compute_state cs;
+   struct pipe_shader_buffer buffer;
+
+   if (!tgsi_text_translate(bench_cs_text, tokens, ARRAY_SIZE(tokens))) {
+      fprintf(stderr, "lp_bench: couldn't translate the compute shader\n");
+      return;
+   }
+
+   memset(&cs, 0, sizeof(cs));
+   cs.ir_type = PIPE_SHADER_IR_TGSI;
+   cs.prog = tokens;
+   if (b->cs)
+      b->pipe->delete_compute_state(b->pipe, b->cs);
+   b->cs = b->pipe->create_compute_state(b->pipe, &cs);
+   cso_set_compute_shader_handle(b->cso, b->cs);
+
+   memset(&buffer, 0, sizeof(buffer));
+   buffer.buffer = pipe_buffer_create(b->screen, PIPE_BIND_SHADER_BUFFER,
+                                      PIPE_USAGE_DEFAULT, w->param * 64 * 4);
+   buffer.buffer_size = w->param * 64 * 4;
+   b->pipe->set_shader_buffers(b->pipe, PIPE_SHADER_COMPUTE, 0, 1, &buffer, 1);
+   pipe_resource_reference(&buffer.buffer, NULL);
+
+   memset(&bench_grid, 0, sizeof(bench_grid));
+   bench_grid.work_dim = 1;
+   bench_grid.block[0] = 64;
+   bench_grid.block[1] = bench_grid.block[2] = 1;
+   bench_grid.grid[0] = w->param;
+   bench_grid.grid[1] = bench_grid.grid[2] = 1;
+
+   frame->invocations = (uint64_t)w->param * 64;
+}
+
+
+static void
+bench_compute_frame(struct bench *b)
+{
+   b->pipe->launch_grid(b->pipe, &bench_grid);
+   b->pipe->flush(b->pipe, NULL, 0);
+}
+
+
+static const struct bench_workload bench_workloads[] = {
+   { "fill",           bench_setup_fill,    bench_draw_frame, 8 },
+   { "tri-4",          bench_setup_tris,    bench_draw_frame, 4 },
+   { "tri-16",         bench_setup_tris,    bench_draw_frame, 16 },
+   { "tri-64",         bench_setup_tris,    bench_draw_frame, 64 },
+   { "tex-nearest",    bench_setup_tex,     bench_draw_frame, 0 },
+   { "tex-linear",     bench_setup_tex,     bench_draw_frame, 1 },
+   { "tex-trilinear",  bench_setup_tex,     bench_draw_frame, 3 },
+   { "blend-add",      bench_setup_blend,   bench_draw_frame, PIPE_BLENDFACTOR_ONE },
+   { "blend-alpha",    bench_setup_blend,   bench_draw_frame, PIPE_BLENDFACTOR_INV_SRC_ALPHA },
+   { "msaa-4x",        bench_setup_msaa,    bench_draw_frame, 4 },
+   { "compute",        bench_setup_compute, bench_compute_frame, 4096 },
+};
+
+
+static void
+bench_finish(struct bench *b)
+{
+   struct pipe_fence_handle *fence = NULL;
+
+   b->pipe->flush(b->pipe, &fence, 0);
+   if (fence) {
+      b->screen->fence_finish(b->screen, NULL, fence, PIPE_TIMEOUT_INFINITE);
+      b->screen->fence_reference(b->screen, &fence, NULL);
+   }
+}
+
+
+static bool
+bench_init(struct bench *b)
+{
+   const enum tgsi_semantic names[] = {
+      TGSI_SEMANTIC_POSITION, TGSI_SEMANTIC_GENERIC
+   };
+   const uint indexes[] = { 0, 0 };
+
+   b->screen = llvmpipe_create_screen(null_sw_create());
+   if (!b->screen)
+      return false;
+
+   b->pipe = b->screen->context_create(b->screen, NULL, 0);
+   if (!b->pipe) {
+      b->screen->destroy(b->screen);
+      return false;
+   }
+   b->cso = cso_create_context(b->pipe, 0);
+   b->vs = util_make_vertex_passthrough_shader(b->pipe, 2, names, indexes,
+                                               FALSE);
+   return true;
+}
+
+
+static void
+bench_fini(struct bench *b)
+{
+   cso_destroy_context(b->cso);
+   if (b->fs)
+      b->pipe->delete_fs_state(b->pipe, b->fs);
+   if (b->cs)
+      b->pipe->delete_compute_state(b->pipe, b->cs);
+   b->fs = b->cs = NULL;
+   pipe_surface_reference(&b->surf, NULL);
+   pipe_resource_reference(&b->target, NULL);
+   pipe_resource_reference(&b->vbuf.buffer.resource, NULL);
+   b->pipe->delete_vs_state(b->pipe, b->vs);
+   b->pipe->destroy(b->pipe);
+   b->screen->destroy(b->screen);
+}
+
+
+static void
+bench_run(struct bench *b, const struct bench_workload *w, unsigned threads)
+{
+   struct bench_frame frame;
+   unsigned frames = 0;
+   int64_t start, end;
+   double secs;
+
+   memset(&frame, 0, sizeof(frame));
+   w->setup(b, w, &frame);
+
+   /* Warm up: compiles the shader variants */
+   w->frame(b);
+   bench_finish(b);
+
+   start = os_time_get_nano();
+   do {
+      w->frame(b);
+      frames++;
+   } while (frames < 4 || os_time_get_nano() - start < b->min_time * 1e9);
+   bench_finish(b);
+   end = os_time_get_nano();
+
+   secs = (end - start) / 1e9;
+   printf("%-16s %7u %7u %10.2f %10.2f %10.2f %10.2f\n",
+          w->name, threads, frames, frames / secs,
+          frame.pixels * frames / secs / 1e6,
+          frame.tris * frames / secs / 1e6,
+          frame.invocations * frames / secs / 1e6);
+   fflush(stdout);
+}
+
+
+static void
+usage(void)
+{
+   unsigned i;
+
+   fprintf(stderr,
+           "usage: lp_bench [-s WxH] [-t seconds] [-j threads,...] "
+           "[workload...]\n"
+           "workloads:");
+   for (i = 0; i < ARRAY_SIZE(bench_workloads); i++)
+      fprintf(stderr, " %s", bench_workloads[i].name);
+   fprintf(stderr, "\n");
+}
+
+
+int
+main(int argc, char **argv)
+{
+   struct bench b;
+   const char *thread_list = NULL;
+   bool selected[ARRAY_SIZE(bench_workloads)] = { false };
+   bool any_selected = false;
+   int i;
+
+   memset(&b, 0, sizeof(b));
+   b.width = 1024;
+   b.height = 768;
+   b.min_time = 1.0;
+
+   for (i = 1; i < argc; i++) {
+      if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+         if (sscanf(argv[++i], "%ux%u", &b.width, &b.height) != 2 ||
+             !b.width || !b.height) {
+            usage();
+            return 1;
+         }
+      } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+         b.min_time = atof(argv[++i]);
+      } else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+         thread_list = argv[++i];
+      } else {
+         unsigned j;
+
+         for (j = 0; j < ARRAY_SIZE(bench_workloads); j++) {
+            if (!strcmp(argv[i], bench_workloads[j].name))
+               break;
+         }
+         if (j == ARRAY_SIZE(bench_workloads)) {
+            usage();
+            return 1;
+         }
+         selected[j] = any_selected = true;
+      }
+   }
+
+   printf("%-16s %7s %7s %10s %10s %10s %10s\n", "workload", "threads",
+          "frames", "fps", "Mpix/s", "Mtri/s", "Minvoc/s");
+
+   /* The screen reads LP_NUM_THREADS when it's created, so there's one
+    * screen per thread count.
+    */
+   do {
+      unsigned threads;
+      char value[16];
+
+      if (thread_list) {
+         threads = strtoul(thread_list, (char **)&thread_list, 10);
+         if (*thread_list == ',')
+            thread_list++;
+         else
+            thread_list = NULL;
+         snprintf(value, sizeof(value), "%u", threads);
+         setenv("LP_NUM_THREADS", value, 1);
+      }
+
+      if (!bench_init(&b)) {
+         fprintf(stderr, "lp_bench: couldn't create a llvmpipe context\n");
+         return 1;
+      }
+      threads = llvmpipe_screen(b.screen)->num_threads;
+
+      for (i = 0; i < (int)ARRAY_SIZE(bench_workloads); i++) {
+         if (!any_selected || selected[i])
+            bench_run(&b, &bench_workloads[i], threads);
+      }
+
+      bench_fini(&b);
+   } while (thread_list);
+
+   return 0;
+}
@@ -77,10 +77,66 @@ enum stencil_op {
 
 
 
+/**
+ * Broadcast a scalar i32 value fetched at runtime into a vector of the
+ * given build context's type.
+ */
+static LLVMValueRef
+lp_build_runtime_vec(struct lp_build_context *bld,
+                     LLVMValueRef scalar)
+{
+   if (bld->type.width < 32)
+      scalar = LLVMBuildTrunc(bld->gallivm->builder, scalar,
+                              bld->elem_type, "");
+   return lp_build_broadcast_scalar(bld, scalar);
+}
+
+
+/**
+ * Like lp_build_cmp(), but the PIPE_FUNC_x comparison function is a scalar
+ * only known at runtime.  This relies on LESS, EQUAL and GREATER being
+ * single bits which combine to form the other functions.
+ */
+static LLVMValueRef
+lp_build_cmp_runtime(struct lp_build_context *bld,
+                     LLVMValueRef func,
+                     LLVMValueRef a,
+                     LLVMValueRef b)
+{
+   static const enum pipe_compare_func bits[] = {
+      PIPE_FUNC_LESS, PIPE_FUNC_EQUAL, PIPE_FUNC_GREATER
+   };
+   struct gallivm_state *gallivm = bld->gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef zero = lp_build_const_int_vec(gallivm, bld->type, 0);
+   LLVMValueRef ones = lp_build_const_int_vec(gallivm, bld->type, ~0);
+   LLVMValueRef res = zero;
+   LLVMValueRef cond;
+   unsigned i;
+
+   for (i = 0; i < ARRAY_SIZE(bits); i++) {
+      LLVMValueRef cmp = lp_build_cmp(bld, bits[i], a, b);
+
+      cond = LLVMBuildAnd(builder, func,
+                          lp_build_const_int32(gallivm, bits[i]), "");
+      cond = LLVMBuildICmp(builder, LLVMIntNE, cond,
+                           lp_build_const_int32(gallivm, 0), "");
+      cmp = LLVMBuildSelect(builder, cond, cmp, zero, "");
+      res = LLVMBuildOr(builder, res, cmp, "");
+   }
+
+   /* ALWAYS must pass unordered (NaN) depth values too */
+   cond = LLVMBuildICmp(builder, LLVMIntEQ, func,
+                        lp_build_const_int32(gallivm, PIPE_FUNC_ALWAYS), "");
+   return LLVMBuildSelect(builder, cond, ones, res, "");
+}
+
+
 /**
  * Do the stencil test comparison (compare FB stencil values against ref value).
  * This will be used twice when generating two-sided stencil code.
  * \param stencil  the front/back stencil state
+ * \param runtime  the same state fetched at runtime, or NULL
  * \param stencilRef  the stencil reference value, replicated as a vector
  * \param stencilVals  vector of stencil values from framebuffer
  * \return vector mask of pass/fail values (~0 or 0)
@@ -88,6 +144,7 @@ enum stencil_op {
 static LLVMValueRef
 lp_build_stencil_test_single(struct lp_build_context *bld,
                              const struct pipe_stencil_state *stencil,
+                             const struct lp_build_stencil_runtime *runtime,
                              LLVMValueRef stencilRef,
                              LLVMValueRef stencilVals)
 {
@@ -109,6 +166,13 @@ lp_build_stencil_test_single(struct lp_build_context *bld,
 
    assert(stencil->enabled);
 
+   if (runtime) {
+      LLVMValueRef valuemask = lp_build_runtime_vec(bld, runtime->valuemask);
+      stencilRef = LLVMBuildAnd(builder, stencilRef, valuemask, "");
+      stencilVals = LLVMBuildAnd(builder, stencilVals, valuemask, "");
+      return lp_build_cmp_runtime(bld, runtime->func, stencilRef, stencilVals);
+   }
+
    if (stencil->valuemask != stencilMax) {
       /* compute stencilRef = stencilRef & valuemask */
       LLVMValueRef valuemask = lp_build_const_int_vec(bld->gallivm, type, stencil->valuemask);
@@ -132,6 +196,7 @@ lp_build_stencil_test_single(struct lp_build_context *bld,
 static LLVMValueRef
 lp_build_stencil_test(struct lp_build_context *bld,
                       const struct pipe_stencil_state stencil[2],
+                      const struct lp_build_ds_runtime *runtime,
                       LLVMValueRef stencilRefs[2],
                       LLVMValueRef stencilVals,
                       LLVMValueRef front_facing)
@@ -142,6 +207,7 @@ lp_build_stencil_test(struct lp_build_context *bld,
 
    /* do front face test */
    res = lp_build_stencil_test_single(bld, &stencil[0],
+                                      runtime ? &runtime->stencil[0] : NULL,
                                       stencilRefs[0], stencilVals);
 
    if (stencil[1].enabled && front_facing != NULL) {
@@ -149,6 +215,7 @@ lp_build_stencil_test(struct lp_build_context *bld,
       LLVMValueRef back_res;
 
       back_res = lp_build_stencil_test_single(bld, &stencil[1],
+                                              runtime ? &runtime->stencil[1] : NULL,
                                               stencilRefs[1], stencilVals);
 
       res = lp_build_select(bld, front_facing, res, back_res);
@@ -159,46 +226,25 @@ lp_build_stencil_test(struct lp_build_context *bld,
 
 
 /**
- * Apply the stencil operator (add/sub/keep/etc) to the given vector
- * of stencil values.
- * \return  new stencil values vector
+ * Compute the result of the given PIPE_STENCIL_OP_x operator.
  */
 static LLVMValueRef
-lp_build_stencil_op_single(struct lp_build_context *bld,
-                           const struct pipe_stencil_state *stencil,
-                           enum stencil_op op,
-                           LLVMValueRef stencilRef,
-                           LLVMValueRef stencilVals)
-
+lp_build_stencil_op_value(struct lp_build_context *bld,
+                          unsigned stencil_op,
+                          LLVMValueRef stencilRef,
+                          LLVMValueRef stencilVals)
 {
    LLVMBuilderRef builder = bld->gallivm->builder;
    struct lp_type type = bld->type;
    LLVMValueRef res;
    LLVMValueRef max = lp_build_const_int_vec(bld->gallivm, type, 0xff);
-   unsigned stencil_op;
 
    assert(type.sign);
 
-   switch (op) {
-   case S_FAIL_OP:
-      stencil_op = stencil->fail_op;
-      break;
-   case Z_FAIL_OP:
-      stencil_op = stencil->zfail_op;
-      break;
-   case Z_PASS_OP:
-      stencil_op = stencil->zpass_op;
-      break;
-   default:
-      assert(0 && "Invalid stencil_op mode");
-      stencil_op = PIPE_STENCIL_OP_KEEP;
-   }
-
    switch (stencil_op) {
    case PIPE_STENCIL_OP_KEEP:
       res = stencilVals;
-      /* we can return early for this case */
-      return res;
+      break;
    case PIPE_STENCIL_OP_ZERO:
       res = bld->zero;
       break;
@@ -234,12 +280,87 @@ lp_build_stencil_op_single(struct lp_build_context *bld,
 }
 
 
+/**
+ * Apply the stencil operator (add/sub/keep/etc) to the given vector
+ * of stencil values.
+ * \param runtime  the stencil state fetched at runtime, or NULL
+ * \return  new stencil values vector
+ */
+static LLVMValueRef
+lp_build_stencil_op_single(struct lp_build_context *bld,
+                           const struct pipe_stencil_state *stencil,
+                           const struct lp_build_stencil_runtime *runtime,
+                           enum stencil_op op,
+                           LLVMValueRef stencilRef,
+                           LLVMValueRef stencilVals)
+
+{
+   LLVMBuilderRef builder = bld->gallivm->builder;
+   unsigned stencil_op;
+
+   if (runtime) {
+      /*
+       * Evaluate every operator and pick the one selected at runtime.
+       * These are cheap compared to the blend and shading code around them.
+       */
+      LLVMValueRef op_val, res = stencilVals;
+
+      switch (op) {
+      case S_FAIL_OP:
+         op_val = runtime->fail_op;
+         break;
+      case Z_FAIL_OP:
+         op_val = runtime->zfail_op;
+         break;
+      case Z_PASS_OP:
+         op_val = runtime->zpass_op;
+         break;
+      default:
+         assert(0 && "Invalid stencil_op mode");
+         return stencilVals;
+      }
+
+      for (stencil_op = PIPE_STENCIL_OP_ZERO;
+           stencil_op <= PIPE_STENCIL_OP_INVERT; stencil_op++) {
+         LLVMValueRef cond =
+            LLVMBuildICmp(builder, LLVMIntEQ, op_val,
+                          lp_build_const_int32(bld->gallivm, stencil_op), "");
+         res = LLVMBuildSelect(builder, cond,
+                               lp_build_stencil_op_value(bld, stencil_op,
+                                                         stencilRef,
+                                                         stencilVals),
+                               res, "");
+      }
+
+      return res;
+   }
+
+   switch (op) {
+   case S_FAIL_OP:
+      stencil_op = stencil->fail_op;
+      break;
+   case Z_FAIL_OP:
+      stencil_op = stencil->zfail_op;
+      break;
+   case Z_PASS_OP:
+      stencil_op = stencil->zpass_op;
+      break;
+   default:
+      assert(0 && "Invalid stencil_op mode");
+      stencil_op = PIPE_STENCIL_OP_KEEP;
+   }
+
+   return lp_build_stencil_op_value(bld, stencil_op, stencilRef, stencilVals);
+}
+
+
 /**
  * Do the one or two-sided stencil test op/update.
  */
 static LLVMValueRef
 lp_build_stencil_op(struct lp_build_context *bld,
                     const struct pipe_stencil_state stencil[2],
+                    const struct lp_build_ds_runtime *runtime,
                     enum stencil_op op,
                     LLVMValueRef stencilRefs[2],
                     LLVMValueRef stencilVals,
@@ -253,20 +374,34 @@ lp_build_stencil_op(struct lp_build_context *bld,
    assert(stencil[0].enabled);
 
    /* do front face op */
-   res = lp_build_stencil_op_single(bld, &stencil[0], op,
-                                     stencilRefs[0], stencilVals);
+   res = lp_build_stencil_op_single(bld, &stencil[0],
+                                    runtime ? &runtime->stencil[0] : NULL, op,
+                                    stencilRefs[0], stencilVals);
 
    if (stencil[1].enabled && front_facing != NULL) {
       /* do back face op */
       LLVMValueRef back_res;
 
-      back_res = lp_build_stencil_op_single(bld, &stencil[1], op,
-                                            stencilRefs[1], stencilVals);
+      back_res = lp_build_stencil_op_single(bld, &stencil[1],
+                                            runtime ? &runtime->stencil[1] : NULL,
+                                            op, stencilRefs[1], stencilVals);
 
       res = lp_build_select(bld, front_facing, res, back_res);
    }
 
-   if (stencil[0].writemask != 0xff ||
+   if (runtime) {
+      LLVMValueRef writemask =
+         lp_build_runtime_vec(bld, runtime->stencil[0].writemask);
+      if (stencil[1].enabled && front_facing != NULL) {
+         LLVMValueRef back_writemask =
+            lp_build_runtime_vec(bld, runtime->stencil[1].writemask);
+         writemask = lp_build_select(bld, front_facing, writemask, back_writemask);
+      }
+
+      mask = LLVMBuildAnd(builder, mask, writemask, "");
+      res = lp_build_select_bitwise(bld, mask, res, stencilVals);
+   }
+   else if (stencil[0].writemask != 0xff ||
        (stencil[1].enabled && front_facing != NULL && stencil[1].writemask != 0xff)) {
       /* mask &= stencil[0].writemask */
       LLVMValueRef writemask = lp_build_const_int_vec(bld->gallivm, bld->type,
@@ -816,6 +951,8 @@ lp_build_depth_stencil_write_swizzled(struct gallivm_state *gallivm,
  * \param mask  the alive/dead pixel mask for the quad (vector)
  * \param cov_mask coverage mask
  * \param stencil_refs  the front/back stencil ref values (scalar)
+ * \param runtime  if non-NULL, the depth func and stencil funcs/ops/masks
+ *                 to use instead of the ones in depth/stencil
  * \param z_src  the incoming depth/stencil values (n 2x2 quad values, float32)
  * \param zs_dst  the depth/stencil values in framebuffer
  * \param face  contains boolean value indicating front/back facing polygon
@@ -829,6 +966,7 @@ lp_build_depth_stencil_test(struct gallivm_state *gallivm,
                             struct lp_build_mask_context *mask,
                             LLVMValueRef *cov_mask,
                             LLVMValueRef stencil_refs[2],
+                            const struct lp_build_ds_runtime *runtime,
                             LLVMValueRef z_src,
                             LLVMValueRef z_fb,
                             LLVMValueRef s_fb,
@@ -1017,14 +1155,14 @@ lp_build_depth_stencil_test(struct gallivm_state *gallivm,
          }
       }
 
-      s_pass_mask = lp_build_stencil_test(&s_bld, stencil,
+      s_pass_mask = lp_build_stencil_test(&s_bld, stencil, runtime,
                                           stencil_refs, stencil_vals,
                                           front_facing);
 
       /* apply stencil-fail operator */
       {
          LLVMValueRef s_fail_mask = lp_build_andnot(&s_bld, current_mask, s_pass_mask);
-         stencil_vals = lp_build_stencil_op(&s_bld, stencil, S_FAIL_OP,
+         stencil_vals = lp_build_stencil_op(&s_bld, stencil, runtime, S_FAIL_OP,
                                             stencil_refs, stencil_vals,
                                             s_fail_mask, front_facing);
       }
@@ -1069,7 +1207,11 @@ lp_build_depth_stencil_test(struct gallivm_state *gallivm,
       lp_build_name(z_src, "z_src");
 
       /* compare src Z to dst Z, returning 'pass' mask */
-      z_pass = lp_build_cmp(&z_bld, depth->func, z_src, z_dst);
+      if (runtime)
+         z_pass = lp_build_cmp_runtime(&z_bld, runtime->depth_func,
+                                       z_src, z_dst);
+      else
+         z_pass = lp_build_cmp(&z_bld, depth->func, z_src, z_dst);
 
       /* mask off bits that failed stencil test */
       if (s_pass_mask) {
@@ -1106,13 +1248,13 @@ lp_build_depth_stencil_test(struct gallivm_state *gallivm,
 
          /* apply Z-fail operator */
          z_fail_mask = lp_build_andnot(&s_bld, current_mask, z_pass);
-         stencil_vals = lp_build_stencil_op(&s_bld, stencil, Z_FAIL_OP,
+         stencil_vals = lp_build_stencil_op(&s_bld, stencil, runtime, Z_FAIL_OP,
                                             stencil_refs, stencil_vals,
                                             z_fail_mask, front_facing);
 
          /* apply Z-pass operator */
          z_pass_mask = LLVMBuildAnd(builder, current_mask, z_pass, "");
-         stencil_vals = lp_build_stencil_op(&s_bld, stencil, Z_PASS_OP,
+         stencil_vals = lp_build_stencil_op(&s_bld, stencil, runtime, Z_PASS_OP,
                                             stencil_refs, stencil_vals,
                                             z_pass_mask, front_facing);
       }
@@ -1122,7 +1264,7 @@ lp_build_depth_stencil_test(struct gallivm_state *gallivm,
        * passed the stencil test.
        */
       s_pass_mask = LLVMBuildAnd(builder, current_mask, s_pass_mask, "");
-      stencil_vals = lp_build_stencil_op(&s_bld, stencil, Z_PASS_OP,
+      stencil_vals = lp_build_stencil_op(&s_bld, stencil, runtime, Z_PASS_OP,
                                          stencil_refs, stencil_vals,
                                          s_pass_mask, front_facing);
    }
@@ -49,6 +49,29 @@ struct lp_type;
 struct lp_build_mask_context;
 
 
+/**
+ * Depth/stencil state fetched at runtime as scalar i32 values, used by the
+ * generic fragment shader variant in place of the corresponding
+ * pipe_depth_state/pipe_stencil_state fields.  Which tests are enabled,
+ * and whether depth/stencil is written at all, is still static.
+ */
+struct lp_build_stencil_runtime
+{
+   LLVMValueRef func;
+   LLVMValueRef fail_op;
+   LLVMValueRef zfail_op;
+   LLVMValueRef zpass_op;
+   LLVMValueRef valuemask;
+   LLVMValueRef writemask;
+};
+
+struct lp_build_ds_runtime
+{
+   LLVMValueRef depth_func;
+   struct lp_build_stencil_runtime stencil[2];
+};
+
+
 struct lp_type
 lp_depth_type(const struct util_format_description *format_desc,
               unsigned length);
@@ -63,6 +86,7 @@ lp_build_depth_stencil_test(struct gallivm_state *gallivm,
                             struct lp_build_mask_context *mask,
                             LLVMValueRef *cov_mask,
                             LLVMValueRef stencil_refs[2],
+                            const struct lp_build_ds_runtime *runtime,
                             LLVMValueRef z_src,
                             LLVMValueRef z_fb,
                             LLVMValueRef s_fb,
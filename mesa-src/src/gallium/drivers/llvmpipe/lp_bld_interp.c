@@ -232,6 +232,7 @@ coeffs_init_simple(struct lp_build_interp_soa_context *bld,
       case LP_INTERP_PERSPECTIVE:
          /* fall-through */
 
+      case LP_INTERP_AA_LINE:
       case LP_INTERP_LINEAR:
          ptr = LLVMBuildGEP(builder, dadx_ptr, &index, 1, "");
          ptr = LLVMBuildBitCast(builder, ptr,
@@ -281,7 +282,8 @@ attribs_update_simple(struct lp_build_interp_soa_context *bld,
                       LLVMValueRef mask_store,
                       LLVMValueRef sample_id,
                       int start,
-                      int end)
+                      int end,
+                      unsigned chan_mask)
 {
    LLVMBuilderRef builder = gallivm->builder;
    struct lp_build_context *coeff_bld = &bld->coeff_bld;
@@ -313,7 +315,7 @@ attribs_update_simple(struct lp_build_interp_soa_context *bld,
       unsigned chan;
 
       for (chan = 0; chan < TGSI_NUM_CHANNELS; chan++) {
-         if (mask & (1 << chan)) {
+         if (mask & chan_mask & (1 << chan)) {
             LLVMValueRef index;
             LLVMValueRef dadx = coeff_bld->zero;
             LLVMValueRef dady = coeff_bld->zero;
@@ -325,6 +327,7 @@ attribs_update_simple(struct lp_build_interp_soa_context *bld,
             case LP_INTERP_PERSPECTIVE:
                /* fall-through */
 
+            case LP_INTERP_AA_LINE:
             case LP_INTERP_LINEAR:
                if (attrib == 0 && chan == 0) {
                   dadx = coeff_bld->one;
@@ -462,6 +465,7 @@ lp_build_interp_soa_indirect(struct lp_build_interp_soa_context *bld,
    switch (interp) {
    case LP_INTERP_PERSPECTIVE:
       /* fall-through */
+   case LP_INTERP_AA_LINE:
    case LP_INTERP_LINEAR:
 
       dadx = lp_build_gather(gallivm, coeff_bld->type.length,
@@ -605,6 +609,7 @@ lp_build_interp_soa(struct lp_build_interp_soa_context *bld,
    switch (interp) {
    case LP_INTERP_PERSPECTIVE:
       /* fall-through */
+   case LP_INTERP_AA_LINE:
    case LP_INTERP_LINEAR:
       dadx = lp_build_extract_broadcast(gallivm, setup_bld->type,
                                         coeff_bld->type, bld->dadxaos[attrib],
@@ -796,7 +801,35 @@ lp_build_interp_soa_update_inputs_dyn(struct lp_build_interp_soa_context *bld,
                                       LLVMValueRef mask_store,
                                       LLVMValueRef sample_id)
 {
-   attribs_update_simple(bld, gallivm, quad_start_index, mask_store, sample_id, 1, bld->num_attribs);
+   bld->quad_start_index = quad_start_index;
+   bld->mask_store = mask_store;
+   bld->sample_id = sample_id;
+
+   if (!bld->lazy_inputs)
+      attribs_update_simple(bld, gallivm, quad_start_index, mask_store,
+                            sample_id, 1, bld->num_attribs,
+                            TGSI_WRITEMASK_XYZW);
+}
+
+
+/**
+ * Get a channel of an input (not counting the position) for the current
+ * quad.  Lazily interpolated inputs are computed right here, so an input
+ * only read in some branch of the shader costs nothing outside of it.
+ */
+LLVMValueRef
+lp_build_interp_soa_input(struct lp_build_interp_soa_context *bld,
+                          struct gallivm_state *gallivm,
+                          unsigned attrib, unsigned chan)
+{
+   attrib++;
+
+   if (bld->lazy_inputs && (bld->mask[attrib] & (1 << chan)))
+      attribs_update_simple(bld, gallivm, bld->quad_start_index,
+                            bld->mask_store, bld->sample_id,
+                            attrib, attrib + 1, 1 << chan);
+
+   return bld->attribs[attrib][chan];
 }
 
 void
@@ -805,6 +838,7 @@ lp_build_interp_soa_update_pos_dyn(struct lp_build_interp_soa_context *bld,
                                    LLVMValueRef quad_start_index,
                                    LLVMValueRef sample_id)
 {
-   attribs_update_simple(bld, gallivm, quad_start_index, NULL, sample_id, 0, 1);
+   attribs_update_simple(bld, gallivm, quad_start_index, NULL, sample_id, 0, 1,
+                         TGSI_WRITEMASK_XYZW);
 }
 
@@ -56,6 +56,10 @@
  *
  * LP_INTERP_COLOR is translated to either LP_INTERP_CONSTANT or
  * PERSPECTIVE depending on flatshade state.
+ *
+ * LP_INTERP_AA_LINE is not a shader input: it is appended for smooth
+ * lines, and setup writes the pixel's distances to the line's edges in
+ * it, which are interpolated linearly.  See lp_setup_line.c.
  */
 enum lp_interp {
    LP_INTERP_CONSTANT,
@@ -63,7 +67,8 @@ enum lp_interp {
    LP_INTERP_LINEAR,
    LP_INTERP_PERSPECTIVE,
    LP_INTERP_POSITION,
-   LP_INTERP_FACING
+   LP_INTERP_FACING,
+   LP_INTERP_AA_LINE
 };
 
 struct lp_shader_input {
@@ -109,6 +114,16 @@ struct lp_build_interp_soa_context
    LLVMValueRef xoffset_store;
    LLVMValueRef yoffset_store;
 
+   /*
+    * With lazy_inputs set (by the caller, after init) the inputs are only
+    * interpolated where lp_build_interp_soa_input() reads them, for the
+    * quad of the last lp_build_interp_soa_update_inputs_dyn() call.
+    */
+   boolean lazy_inputs;
+   LLVMValueRef quad_start_index;
+   LLVMValueRef mask_store;
+   LLVMValueRef sample_id;
+
    /*
     * Convenience pointers. Callers may access this one.
     */
@@ -142,6 +157,11 @@ lp_build_interp_soa_update_inputs_dyn(struct lp_build_interp_soa_context *bld,
                                       LLVMValueRef mask_store,
                                       LLVMValueRef sample_id);
 
+LLVMValueRef
+lp_build_interp_soa_input(struct lp_build_interp_soa_context *bld,
+                          struct gallivm_state *gallivm,
+                          unsigned attrib, unsigned chan);
+
 void
 lp_build_interp_soa_update_pos_dyn(struct lp_build_interp_soa_context *bld,
                                    struct gallivm_state *gallivm,
@@ -36,17 +36,21 @@
 #include "util/u_inlines.h"
 #include "util/u_math.h"
 #include "util/u_memory.h"
+#include "util/os_time.h"
 #include "util/simple_list.h"
+#include "util/hash_table.h"
 #include "util/u_upload_mgr.h"
 #include "lp_clear.h"
 #include "lp_context.h"
 #include "lp_flush.h"
+#include "lp_memory.h"
 #include "lp_perf.h"
 #include "lp_state.h"
 #include "lp_surface.h"
 #include "lp_query.h"
 #include "lp_setup.h"
 #include "lp_screen.h"
+#include "lp_texture.h"
 
 /* This is only safe if there's just one concurrent context */
 #ifdef EMBEDDED_DEVICE
@@ -59,6 +63,7 @@ static void llvmpipe_destroy( struct pipe_context *pipe )
    uint i;
 
    lp_print_counters();
+   lp_fs_print_profile(llvmpipe);
 
    if (llvmpipe->csctx) {
       lp_csctx_destroy(llvmpipe->csctx);
@@ -101,12 +106,15 @@ static void llvmpipe_destroy( struct pipe_context *pipe )
    }
 
    lp_delete_setup_variants(llvmpipe);
+   if (llvmpipe->setup_variants_table)
+      _mesa_hash_table_destroy(llvmpipe->setup_variants_table, NULL);
 
 #ifndef USE_GLOBAL_LLVM_CONTEXT
    LLVMContextDispose(llvmpipe->context);
 #endif
    llvmpipe->context = NULL;
 
+   util_dynarray_fini(&llvmpipe->fs_profile_retired);
    align_free( llvmpipe );
 }
 
@@ -115,7 +123,20 @@ do_flush( struct pipe_context *pipe,
           struct pipe_fence_handle **fence,
           unsigned flags)
 {
-   llvmpipe_flush(pipe, fence, __FUNCTION__);
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+   struct pipe_surface *zsbuf = llvmpipe->framebuffer.zsbuf;
+
+   /* A transient depth/stencil buffer doesn't outlive the flush */
+   if (zsbuf && llvmpipe_resource(zsbuf->texture)->transient)
+      lp_setup_invalidate_resource(llvmpipe->setup, zsbuf->texture);
+
+   if ((flags & PIPE_FLUSH_DEFERRED) && fence)
+      llvmpipe_flush_deferred(pipe, fence, __FUNCTION__);
+   else
+      llvmpipe_flush(pipe, fence, __FUNCTION__);
+
+   if (llvmpipe->memory_budget)
+      llvmpipe_check_memory_budget(llvmpipe);
 }
 
 
@@ -130,6 +151,9 @@ llvmpipe_render_condition(struct pipe_context *pipe,
    llvmpipe->render_cond_query = query;
    llvmpipe->render_cond_mode = mode;
    llvmpipe->render_cond_cond = condition;
+
+   /* The next draw bins the new condition's predicate, if it has one */
+   lp_setup_set_predicate(llvmpipe->setup, NULL, FALSE);
 }
 
 static void
@@ -165,6 +189,7 @@ llvmpipe_create_context(struct pipe_screen *screen, void *priv,
                         unsigned flags)
 {
    struct llvmpipe_context *llvmpipe;
+   int64_t create_begin = os_time_get();
 
    llvmpipe = align_malloc(sizeof(struct llvmpipe_context), 16);
    if (!llvmpipe)
@@ -175,8 +200,14 @@ llvmpipe_create_context(struct pipe_screen *screen, void *priv,
    memset(llvmpipe, 0, sizeof *llvmpipe);
 
    make_empty_list(&llvmpipe->fs_variants_list);
+   util_dynarray_init(&llvmpipe->fs_profile_retired, NULL);
 
    make_empty_list(&llvmpipe->setup_variants_list);
+   llvmpipe->setup_variants_table = lp_setup_variants_table_create();
+   if (!llvmpipe->setup_variants_table) {
+      align_free(llvmpipe);
+      return NULL;
+   }
 
    make_empty_list(&llvmpipe->cs_variants_list);
 
@@ -189,6 +220,7 @@ llvmpipe_create_context(struct pipe_screen *screen, void *priv,
    llvmpipe->pipe.clear = llvmpipe_clear;
    llvmpipe->pipe.flush = do_flush;
    llvmpipe->pipe.texture_barrier = llvmpipe_texture_barrier;
+   llvmpipe->pipe.set_memory_budget = llvmpipe_set_memory_budget;
 
    llvmpipe->pipe.render_condition = llvmpipe_render_condition;
 
@@ -233,6 +265,9 @@ llvmpipe_create_context(struct pipe_screen *screen, void *priv,
 
    draw_set_constant_buffer_stride(llvmpipe->draw, lp_get_constant_buffer_stride(screen));
 
+   draw_enable_replay(llvmpipe->draw,
+                      llvmpipe_screen(screen)->vertex_replay_size);
+
    /* FIXME: devise alternative to draw_texture_samplers */
 
    llvmpipe->setup = lp_setup_create( &llvmpipe->pipe,
@@ -256,8 +291,9 @@ llvmpipe_create_context(struct pipe_screen *screen, void *priv,
    /* must be done before installing Draw stages */
    util_blitter_cache_all_shaders(llvmpipe->blitter);
 
-   /* plug in AA line/point stages */
-   draw_install_aaline_stage(llvmpipe->draw, &llvmpipe->pipe);
+   /* plug in AA point stage, smooth lines are done in setup, see
+    * llvmpipe_aa_lines()
+    */
    draw_install_aapoint_stage(llvmpipe->draw, &llvmpipe->pipe);
    draw_install_pstipple_stage(llvmpipe->draw, &llvmpipe->pipe);
 
@@ -277,7 +313,23 @@ llvmpipe_create_context(struct pipe_screen *screen, void *priv,
     */
    llvmpipe->dirty |= LP_NEW_SCISSOR;
 
-   return &llvmpipe->pipe;
+   /* The first context is part of the startup time */
+   if (!llvmpipe_screen(screen)->startup.context)
+      llvmpipe_screen(screen)->startup.context = os_time_get() - create_begin;
+
+   if (!(flags & PIPE_CONTEXT_PREFER_THREADED) ||
+       !llvmpipe_screen(screen)->threaded_context)
+      return &llvmpipe->pipe;
+
+   /*
+    * Without create_fence, flushes with a fence wait for the driver thread.
+    * GALLIUM_THREAD=0 still leaves the context unwrapped.
+    */
+   return threaded_context_create(&llvmpipe->pipe,
+                                  &llvmpipe_screen(screen)->pool_transfers,
+                                  llvmpipe_replace_buffer_storage,
+                                  NULL,
+                                  &llvmpipe->tc);
 
  fail:
    llvmpipe_destroy(&llvmpipe->pipe);
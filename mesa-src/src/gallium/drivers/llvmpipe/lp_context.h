@@ -35,6 +35,7 @@
 
 #include "draw/draw_vertex.h"
 #include "util/u_blitter.h"
+#include "util/u_dynarray.h"
 
 #include "lp_tex_sample.h"
 #include "lp_jit.h"
@@ -150,13 +151,50 @@ struct llvmpipe_context {
    struct blitter_context *blitter;
 
    unsigned tex_timestamp;
+   unsigned cs_tex_timestamp;
+
+   /**
+    * Bytes llvmpipe_context_memory() should stay under, 0 for no limit,
+    * see pipe_context::set_memory_budget.
+    */
+   uint64_t memory_budget;
 
    /** List of all fragment shader variants */
    struct lp_fs_variant_list_item fs_variants_list;
    unsigned nr_fs_variants;
    unsigned nr_fs_instrs;
 
+   /** lp_fs_profile_records of destroyed variants, with LP_PERF=profile */
+   struct util_dynarray fs_profile_retired;
+
+   /**
+    * A generic fs variant stands in while the specialized one compiles,
+    * or the z prepass variants are still compiling.
+    */
+   boolean fs_variant_pending;
+
+   /** The bound fs variant, while it waits to be recompiled optimized */
+   struct lp_fragment_shader_variant *fs_variant_unoptimized;
+
+   /**
+    * Shader and key the bound fs variants were looked up for, so that
+    * rebinding textures which don't change the key skips the lookups.
+    * NULL while fs_variant_pending, or once a variant was removed.
+    */
+   struct lp_fragment_shader *fs_key_shader;
+   char fs_key[LP_FS_MAX_VARIANT_KEY_SIZE];
+
+   /**
+    * Values of the bound fs's inlinable uniforms, see LP_INLINE_UNIFORMS,
+    * and for how many draws they haven't changed.  fs_inline_shader is
+    * NULL while they aren't known.
+    */
+   struct lp_fragment_shader *fs_inline_shader;
+   uint32_t fs_inline_values[LP_MAX_INLINABLE_UNIFORMS];
+   unsigned fs_inline_draws;
+
    struct lp_setup_variant_list_item setup_variants_list;
+   struct hash_table *setup_variants_table;   /**< the same, by key */
    unsigned nr_setup_variants;
 
    /** List of all compute shader variants */
@@ -176,6 +214,8 @@ struct llvmpipe_context {
    int max_global_buffers;
    struct pipe_resource **global_buffers;
 
+   /** The threaded context wrapping this one, see LP_THREADED_CONTEXT */
+   struct threaded_context *tc;
 };
 
 
@@ -196,5 +236,20 @@ llvmpipe_context( struct pipe_context *pipe )
    return (struct llvmpipe_context *)pipe;
 }
 
+
+/**
+ * Whether smooth lines are antialiased by setup and the fragment shader.
+ * Both variants then carry one input more than the shader has, so a
+ * shader using every input slot draws them aliased.  GL ignores line
+ * smoothing when multisampling.
+ */
+static inline boolean
+llvmpipe_aa_lines(const struct llvmpipe_context *lp)
+{
+   return lp->rasterizer->line_smooth &&
+          !lp->rasterizer->multisample &&
+          lp->fs->info.base.num_inputs < PIPE_MAX_SHADER_INPUTS;
+}
+
 #endif /* LP_CONTEXT_H */
 
@@ -28,9 +28,67 @@
  * based on threadpool.c but modified heavily to be compute shader tuned.
  */
 
+#include <limits.h>
+
+#include "util/futex.h"
+#include "util/u_atomic.h"
 #include "util/u_thread.h"
 #include "util/u_memory.h"
 #include "lp_cs_tpool.h"
+#include "lp_screen.h"
+
+/**
+ * Claim the next chunk of iterations of the task, returning the number
+ * claimed, or 0 once all of them are.  Chunks shrink as the task drains
+ * (guided scheduling), so large grids cost few atomics while the last
+ * iterations still spread over all threads.
+ */
+static unsigned
+lp_cs_tpool_claim(struct lp_cs_tpool *pool, struct lp_cs_tpool_task *task,
+                  unsigned *first)
+{
+   unsigned start = p_atomic_read(&task->iter_start);
+
+   while (start < task->iter_total) {
+      unsigned remaining = task->iter_total - start;
+      unsigned count = MAX2(remaining / (4 * (pool->num_threads + 1)), 1);
+      unsigned old = p_atomic_cmpxchg(&task->iter_start, start, start + count);
+
+      if (old == start) {
+         *first = start;
+         return count;
+      }
+      start = old;
+   }
+   return 0;
+}
+
+/** Run claimed chunks until the task is exhausted */
+static void
+lp_cs_tpool_run(struct lp_cs_tpool *pool, struct lp_cs_tpool_task *task,
+                struct lp_cs_local_mem *lmem)
+{
+   unsigned first, count;
+
+   while ((count = lp_cs_tpool_claim(pool, task, &first))) {
+      for (unsigned i = 0; i < count; i++)
+         task->work(task->data, first + i, lmem);
+
+      if (p_atomic_add_return(&task->iter_finished, count) ==
+          task->iter_total) {
+#if UTIL_FUTEX_SUPPORTED
+         futex_wake(&task->iter_finished, INT_MAX);
+#endif
+      }
+   }
+}
+
+static void
+lp_cs_local_mem_fini(struct lp_cs_local_mem *lmem)
+{
+   FREE(lmem->local_mem_ptr);
+   lp_coro_frame_pool_fini(&lmem->coro_pool);
+}
 
 static int
 lp_cs_tpool_worker(void *data)
@@ -52,25 +110,25 @@ lp_cs_tpool_worker(void *data)
 
       task = list_first_entry(&pool->workqueue, struct lp_cs_tpool_task,
                               list);
-      unsigned this_iter = task->iter_start++;
+      task->busy++;
+      mtx_unlock(&pool->m);
 
-      if (task->iter_start == task->iter_total)
-         list_del(&task->list);
+      lp_cs_tpool_run(pool, task, &lmem);
 
-      mtx_unlock(&pool->m);
-      task->work(task->data, this_iter, &lmem);
       mtx_lock(&pool->m);
-      task->iter_finished++;
-      if (task->iter_finished == task->iter_total)
+      /* Nothing is left to claim, so stop handing the task out. */
+      if (task->list.next)
+         list_del(&task->list);
+      if (--task->busy == 0)
          cnd_broadcast(&task->finish);
    }
    mtx_unlock(&pool->m);
-   FREE(lmem.local_mem_ptr);
+   lp_cs_local_mem_fini(&lmem);
    return 0;
 }
 
 struct lp_cs_tpool *
-lp_cs_tpool_create(unsigned num_threads)
+lp_cs_tpool_create(unsigned num_threads, enum lp_thread_affinity affinity)
 {
    struct lp_cs_tpool *pool = CALLOC_STRUCT(lp_cs_tpool);
 
@@ -82,9 +140,21 @@ lp_cs_tpool_create(unsigned num_threads)
 
    list_inithead(&pool->workqueue);
    assert (num_threads <= LP_MAX_THREADS);
+   if (num_threads) {
+      pool->threads = CALLOC(num_threads, sizeof(*pool->threads));
+      if (!pool->threads) {
+         cnd_destroy(&pool->new_work);
+         mtx_destroy(&pool->m);
+         FREE(pool);
+         return NULL;
+      }
+   }
    pool->num_threads = num_threads;
-   for (unsigned i = 0; i < num_threads; i++)
+   for (unsigned i = 0; i < num_threads; i++) {
       pool->threads[i] = u_thread_create(lp_cs_tpool_worker, pool);
+      if (pool->threads[i])
+         lp_pin_thread(pool->threads[i], affinity, i, num_threads);
+   }
    return pool;
 }
 
@@ -105,6 +175,7 @@ lp_cs_tpool_destroy(struct lp_cs_tpool *pool)
 
    cnd_destroy(&pool->new_work);
    mtx_destroy(&pool->m);
+   FREE(pool->threads);
    FREE(pool);
 }
 
@@ -121,6 +192,7 @@ lp_cs_tpool_queue_task(struct lp_cs_tpool *pool,
       for (unsigned t = 0; t < num_iters; t++) {
          work(data, t, &lmem);
       }
+      lp_cs_local_mem_fini(&lmem);
       return NULL;
    }
    task = CALLOC_STRUCT(lp_cs_tpool_task);
@@ -147,13 +219,34 @@ lp_cs_tpool_wait_for_task(struct lp_cs_tpool *pool,
                           struct lp_cs_tpool_task **task_handle)
 {
    struct lp_cs_tpool_task *task = *task_handle;
+   struct lp_cs_local_mem lmem;
 
    if (!pool || !task)
       return;
 
+   /* Rather than sleeping straight away, help with what is left. */
+   memset(&lmem, 0, sizeof(lmem));
+   lp_cs_tpool_run(pool, task, &lmem);
+   lp_cs_local_mem_fini(&lmem);
+
+#if UTIL_FUTEX_SUPPORTED
+   uint32_t finished;
+   while ((finished = p_atomic_read(&task->iter_finished)) <
+          task->iter_total)
+      futex_wait(&task->iter_finished, finished, NULL);
+#endif
+
+   /*
+    * Workers may still be about to drop the task, wait for them before
+    * freeing it.  This is also where the task is unlinked if no worker
+    * got to it, e.g. for zero iterations.
+    */
    mtx_lock(&pool->m);
-   while (task->iter_finished < task->iter_total)
+   while (task->busy ||
+          p_atomic_read(&task->iter_finished) < task->iter_total)
       cnd_wait(&task->finish, &pool->m);
+   if (task->list.next)
+      list_del(&task->list);
    mtx_unlock(&pool->m);
 
    cnd_destroy(&task->finish);
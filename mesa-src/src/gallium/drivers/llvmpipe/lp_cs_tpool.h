@@ -38,6 +38,7 @@
 
 #include "util/u_thread.h"
 #include "util/list.h"
+#include "gallivm/lp_bld_coro.h"
 
 #include "lp_limits.h"
 
@@ -45,7 +46,7 @@ struct lp_cs_tpool {
    mtx_t m;
    cnd_t new_work;
 
-   thrd_t threads[LP_MAX_THREADS];
+   thrd_t *threads;
    unsigned num_threads;
    struct list_head workqueue;
    bool shutdown;
@@ -54,21 +55,29 @@ struct lp_cs_tpool {
 struct lp_cs_local_mem {
    unsigned local_size;
    void *local_mem_ptr;
+   struct lp_coro_frame_pool coro_pool;
 };
 
 typedef void (*lp_cs_tpool_task_func)(void *data, int iter_idx, struct lp_cs_local_mem *lmem);
 
+/**
+ * Iterations are claimed in chunks by atomically advancing iter_start, so
+ * the pool mutex is only taken when a thread starts or stops working on a
+ * task.  iter_finished is waited on with a futex where supported.
+ */
 struct lp_cs_tpool_task {
    lp_cs_tpool_task_func work;
    void *data;
    struct list_head list;
    cnd_t finish;
    unsigned iter_total;
-   unsigned iter_start;
-   unsigned iter_finished;
+   unsigned iter_start;     /**< next unclaimed iteration, atomic */
+   uint32_t iter_finished;  /**< atomic */
+   unsigned busy;           /**< workers holding the task, under pool->m */
 };
 
-struct lp_cs_tpool *lp_cs_tpool_create(unsigned num_threads);
+struct lp_cs_tpool *lp_cs_tpool_create(unsigned num_threads,
+                                       enum lp_thread_affinity affinity);
 void lp_cs_tpool_destroy(struct lp_cs_tpool *);
 
 struct lp_cs_tpool_task *lp_cs_tpool_queue_task(struct lp_cs_tpool *,
@@ -59,6 +59,14 @@
 #define PERF_NO_BLEND       0x20  	/* disable blending */
 #define PERF_NO_DEPTH       0x40  	/* disable depth buffering entirely */
 #define PERF_NO_ALPHATEST   0x80  	/* disable alpha testing */
+#define PERF_SORT_BINS      0x100 	/* rasterize the busiest bins first */
+#define PERF_NO_HIZ         0x200 	/* no hierarchical Z rejection */
+#define PERF_COUNTERS       0x400 	/* keep lp_counters, see lp_perf.h */
+#define PERF_PROFILE_FS     0x800 	/* count fs variant cycles */
+#define PERF_NO_MSAA_COMPRESS 0x1000	/* always shade every sample */
+#define PERF_PIPELINE       0x2000	/* hand scenes to idle rasterizer threads */
+#define PERF_TILE_LOCAL     0x4000	/* render tiles in per-thread buffers */
+#define PERF_STARTUP        0x8000	/* print where startup time went */
 
 
 extern int LP_PERF;
@@ -37,13 +37,128 @@
 #include "util/u_prim.h"
 
 #include "lp_context.h"
+#include "lp_flush.h"
+#include "lp_screen.h"
 #include "lp_state.h"
 #include "lp_query.h"
+#include "lp_texture.h"
 
 #include "draw/draw_context.h"
 
 
 
+/**
+ * Bind flags of buffers which are only ever written through transfers,
+ * so their timestamps say when their contents changed.
+ */
+#define LP_REPLAY_BIND_FLAGS (PIPE_BIND_VERTEX_BUFFER |             \
+                              PIPE_BIND_INDEX_BUFFER |              \
+                              PIPE_BIND_CONSTANT_BUFFER |           \
+                              PIPE_BIND_SAMPLER_VIEW |              \
+                              PIPE_BIND_COMMAND_ARGS_BUFFER)
+
+
+static boolean
+llvmpipe_replay_stamp(const struct pipe_resource *res, uint64_t *serial)
+{
+   const struct llvmpipe_resource *lpr = llvmpipe_resource_const(res);
+
+   if (lpr->userBuffer ||
+       (res->bind & ~LP_REPLAY_BIND_FLAGS) ||
+       (res->flags & PIPE_RESOURCE_FLAG_MAP_PERSISTENT))
+      return FALSE;
+
+   *serial = MAX2(*serial, lpr->timestamp);
+   return TRUE;
+}
+
+
+/**
+ * Serial of the buffers the draw reads, for the draw module to replay
+ * the vertices of draws it saw before, see LP_VERTEX_REPLAY: the newest
+ * of their timestamps.  As every buffer is stamped with a new timestamp
+ * when it is created, any write raises it above every serial given out
+ * before.  0 if one of them is client memory, or may be written without
+ * a transfer.  Buffers with a zero stride are left out, the draw module
+ * compares what is read from them.
+ */
+static uint64_t
+llvmpipe_replay_serial(const struct llvmpipe_context *lp,
+                       const struct pipe_draw_info *info)
+{
+   uint64_t serial = 1;
+   unsigned i;
+
+   for (i = 0; i < lp->num_vertex_buffers; i++) {
+      const struct pipe_vertex_buffer *vb = &lp->vertex_buffer[i];
+
+      if (!vb->stride)
+         continue;
+      if (vb->is_user_buffer)
+         return 0;
+      if (vb->buffer.resource &&
+          !llvmpipe_replay_stamp(vb->buffer.resource, &serial))
+         return 0;
+   }
+
+   if (info->index_size) {
+      if (info->has_user_indices ||
+          !llvmpipe_replay_stamp(info->index.resource, &serial))
+         return 0;
+   }
+
+   for (i = 0; i < ARRAY_SIZE(lp->constants[PIPE_SHADER_VERTEX]); i++) {
+      const struct pipe_resource *res =
+         lp->constants[PIPE_SHADER_VERTEX][i].buffer;
+
+      if (res && !llvmpipe_replay_stamp(res, &serial))
+         return 0;
+   }
+
+   return serial;
+}
+
+
+/**
+ * Point at the draw parameters of an indirect draw in its buffer, and read
+ * how many draws there are, once the rendering which writes the buffers is
+ * done.  Returns FALSE if there is nothing to draw.
+ */
+static boolean
+llvmpipe_map_draw_indirect(struct pipe_context *pipe,
+                           const struct pipe_draw_indirect_info *indirect,
+                           const uint32_t **params,
+                           unsigned *draw_count)
+{
+   const uint8_t *data;
+
+   *draw_count = indirect->draw_count;
+
+   if (indirect->indirect_draw_count) {
+      llvmpipe_flush_resource(pipe, indirect->indirect_draw_count, 0,
+                              TRUE, TRUE, FALSE, "draw_indirect");
+      data = llvmpipe_resource_data(indirect->indirect_draw_count);
+      if (!data)
+         return FALSE;
+      *draw_count = MIN2(*draw_count,
+                         *(const uint32_t *)
+                            (data + indirect->indirect_draw_count_offset));
+   }
+
+   if (!*draw_count)
+      return FALSE;
+
+   llvmpipe_flush_resource(pipe, indirect->buffer, 0,
+                           TRUE, TRUE, FALSE, "draw_indirect");
+   data = llvmpipe_resource_data(indirect->buffer);
+   if (!data)
+      return FALSE;
+
+   *params = (const uint32_t *)(data + indirect->offset);
+   return TRUE;
+}
+
+
 /**
  * Draw vertex arrays, with optional indexing, optional instancing.
  * All the other drawing functions are implemented in terms of this function.
@@ -56,19 +171,27 @@ llvmpipe_draw_vbo(struct pipe_context *pipe, const struct pipe_draw_info *info)
    struct llvmpipe_context *lp = llvmpipe_context(pipe);
    struct draw_context *draw = lp->draw;
    const void *mapped_indices = NULL;
+   const uint32_t *indirect_params = NULL;
+   unsigned indirect_draw_count = 0;
    unsigned i;
 
-   if (!llvmpipe_check_render_cond(lp))
+   if (!llvmpipe_check_render_cond_draw(lp))
       return;
 
-   if (info->indirect) {
-      util_draw_indirect(pipe, info);
+   /* The draws of an indirect draw are run by the draw module in one go,
+    * rather than each going through here.
+    */
+   if (info->indirect &&
+       !llvmpipe_map_draw_indirect(pipe, info->indirect,
+                                   &indirect_params, &indirect_draw_count))
       return;
-   }
 
    if (lp->dirty)
       llvmpipe_update_derived( lp );
 
+   if (lp->fs_variant_unoptimized)
+      llvmpipe_tier_up_fs(lp);
+
    /*
     * Map vertex buffers
     */
@@ -97,6 +220,13 @@ llvmpipe_draw_vbo(struct pipe_context *pipe, const struct pipe_draw_info *info)
       draw_set_indexes(draw,
                        (ubyte *) mapped_indices,
                        info->index_size, available_space);
+
+      /* Lets the draw module keep the runs between restart indexes. */
+      if (info->primitive_restart && !info->has_user_indices) {
+         uint64_t serial = 0;
+         if (llvmpipe_replay_stamp(info->index.resource, &serial))
+            draw_set_index_serial(draw, serial);
+      }
    }
 
    llvmpipe_prepare_vertex_sampling(lp,
@@ -138,8 +268,15 @@ llvmpipe_draw_vbo(struct pipe_context *pipe, const struct pipe_draw_info *info)
                                      lp->active_primgen_queries &&
                                      !lp->queries_disabled);
 
+   if (llvmpipe_screen(pipe->screen)->vertex_replay_size)
+      draw_set_replay_serial(draw, llvmpipe_replay_serial(lp, info));
+
    /* draw! */
-   draw_vbo(draw, info);
+   if (info->indirect)
+      draw_vbo_multi(draw, info, indirect_params, info->indirect->stride,
+                     indirect_draw_count);
+   else
+      draw_vbo(draw, info);
 
    /*
     * unmap vertex/index buffers
@@ -165,6 +302,9 @@ llvmpipe_draw_vbo(struct pipe_context *pipe, const struct pipe_draw_info *info)
     * internally when this condition is seen?)
     */
    draw_flush(draw);
+
+   /* Bin the triangles still batched while the state is the draw's. */
+   lp_setup_flush_triangles(lp->setup);
 }
 
 
@@ -30,6 +30,8 @@
 #include "util/u_memory.h"
 #include "lp_debug.h"
 #include "lp_fence.h"
+#include "lp_perf.h"
+#include "lp_screen.h"
 
 
 /**
@@ -42,14 +44,17 @@
  * \param rank  the expected finished value of the fence counter.
  */
 struct lp_fence *
-lp_fence_create(unsigned rank)
+lp_fence_create(struct llvmpipe_screen *screen, unsigned rank)
 {
    static int fence_id;
-   struct lp_fence *fence = CALLOC_STRUCT(lp_fence);
+   struct lp_fence *fence = slab_mt_alloc(&screen->fence_pool);
 
    if (!fence)
       return NULL;
 
+   memset(fence, 0, sizeof(*fence));
+   fence->screen = screen;
+
    pipe_reference_init(&fence->reference, 1);
 
    (void) mtx_init(&fence->mutex, mtx_plain);
@@ -74,7 +79,7 @@ lp_fence_destroy(struct lp_fence *fence)
 
    mtx_destroy(&fence->mutex);
    cnd_destroy(&fence->signalled);
-   FREE(fence);
+   slab_mt_free(&fence->screen->fence_pool, fence);
 }
 
 
@@ -90,6 +95,9 @@ lp_fence_signal(struct lp_fence *fence)
 
    mtx_lock(&fence->mutex);
 
+   if (unlikely(lp_counters_enabled) && fence->count + 1 == fence->rank)
+      fence->signal_time = os_time_get_nano();
+
    fence->count++;
    assert(fence->count <= fence->rank);
 
@@ -116,12 +124,26 @@ lp_fence_wait(struct lp_fence *f)
    if (LP_DEBUG & DEBUG_FENCE)
       debug_printf("%s %d\n", __FUNCTION__, f->id);
 
-   mtx_lock(&f->mutex);
    assert(f->issued);
-   while (f->count < f->rank) {
-      cnd_wait(&f->signalled, &f->mutex);
+
+   if (lp_fence_signalled(f))
+      return;
+
+   if (lp_spin_wait((const int *) &f->count, f->rank,
+                    f->screen->spin_wait_ns)) {
+      LP_COUNT(nr_fence_spin_wakeups);
    }
-   mtx_unlock(&f->mutex);
+   else {
+      mtx_lock(&f->mutex);
+      while (f->count < f->rank) {
+         cnd_wait(&f->signalled, &f->mutex);
+      }
+      mtx_unlock(&f->mutex);
+   }
+
+   LP_COUNT(nr_fence_waits);
+   if (unlikely(lp_counters_enabled) && f->signal_time)
+      LP_COUNT_ADD(fence_wakeup_time, os_time_get_nano() - f->signal_time);
 }
 
 
@@ -32,16 +32,20 @@
 
 #include "os/os_thread.h"
 #include "pipe/p_state.h"
+#include "util/os_time.h"
+#include "util/u_atomic.h"
 #include "util/u_inlines.h"
 
 
 struct pipe_screen;
+struct llvmpipe_screen;
 
 
 struct lp_fence
 {
    struct pipe_reference reference;
    unsigned id;
+   struct llvmpipe_screen *screen;   /**< owns the memory */
 
    mtx_t mutex;
    cnd_t signalled;
@@ -49,11 +53,14 @@ struct lp_fence
    boolean issued;
    unsigned rank;
    unsigned count;
+
+   /** os_time_get_nano() when count reached rank, if counting */
+   int64_t signal_time;
 };
 
 
 struct lp_fence *
-lp_fence_create(unsigned rank);
+lp_fence_create(struct llvmpipe_screen *screen, unsigned rank);
 
 
 void
@@ -95,4 +102,29 @@ lp_fence_issued(const struct lp_fence *fence)
 }
 
 
+/**
+ * Busy wait up to ns nanoseconds for *counter to reach target, so that
+ * work which is about to come doesn't cost a sleep and wakeup, see
+ * LP_SPIN_WAIT.  Returns whether it did.
+ */
+static inline boolean
+lp_spin_wait(const int *counter, int target, unsigned ns)
+{
+   int64_t end;
+
+   if (!ns)
+      return FALSE;
+
+   end = os_time_get_nano() + ns;
+   while (p_atomic_read(counter) < target) {
+      if (os_time_get_nano() >= end)
+         return FALSE;
+#if defined(__GNUC__) && (defined(PIPE_ARCH_X86) || defined(PIPE_ARCH_X86_64))
+      __builtin_ia32_pause();
+#endif
+   }
+   return TRUE;
+}
+
+
 #endif /* LP_FENCE_H */
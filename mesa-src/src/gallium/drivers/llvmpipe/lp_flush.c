@@ -50,6 +50,9 @@ llvmpipe_flush( struct pipe_context *pipe,
 {
    struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
 
+   /* Fences, and so memory barriers, cover compute dispatches too */
+   lp_csctx_wait(llvmpipe->csctx);
+
    draw_flush(llvmpipe->draw);
 
    /* ask the setup module to flush */
@@ -75,6 +78,28 @@ llvmpipe_flush( struct pipe_context *pipe,
    }
 }
 
+/**
+ * Get a fence for everything done so far, without ending the scene being
+ * binned if there is one: the fence is the scene's then.  So fences don't
+ * cut frames in several scenes.  Waiting on the fence flushes the scene,
+ * see llvmpipe_fence_finish().
+ */
+void
+llvmpipe_flush_deferred(struct pipe_context *pipe,
+                        struct pipe_fence_handle **fence,
+                        const char *reason)
+{
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+
+   lp_csctx_wait(llvmpipe->csctx);
+
+   /* Bin what the draw module still holds */
+   draw_flush(llvmpipe->draw);
+
+   if (!lp_setup_get_scene_fence(llvmpipe->setup, fence))
+      llvmpipe_flush(pipe, fence, reason);
+}
+
 void
 llvmpipe_finish( struct pipe_context *pipe,
                  const char *reason )
@@ -39,6 +39,11 @@ llvmpipe_flush(struct pipe_context *pipe,
                struct pipe_fence_handle **fence,
                const char *reason);
 
+void
+llvmpipe_flush_deferred(struct pipe_context *pipe,
+                        struct pipe_fence_handle **fence,
+                        const char *reason);
+
 void
 llvmpipe_finish( struct pipe_context *pipe,
                  const char *reason );
@@ -236,6 +236,10 @@ lp_jit_create_types(struct lp_fragment_shader_variant *lp)
          LLVMArrayType(LLVMPointerType(LLVMInt32TypeInContext(lc), 0), LP_MAX_TGSI_SHADER_BUFFERS);
       elem_types[LP_JIT_CTX_NUM_SSBOS] =
             LLVMArrayType(LLVMInt32TypeInContext(lc), LP_MAX_TGSI_SHADER_BUFFERS);
+      elem_types[LP_JIT_CTX_DEPTH_FUNC] = LLVMInt32TypeInContext(lc);
+      elem_types[LP_JIT_CTX_STENCIL_STATE] =
+         LLVMArrayType(LLVMArrayType(LLVMInt32TypeInContext(lc),
+                                     LP_JIT_STENCIL_NUM_FIELDS), 2);
       context_type = LLVMStructTypeInContext(lc, elem_types,
                                              ARRAY_SIZE(elem_types), 0);
 
@@ -281,6 +285,12 @@ lp_jit_create_types(struct lp_fragment_shader_variant *lp)
       LP_CHECK_MEMBER_OFFSET(struct lp_jit_context, sample_mask,
                              gallivm->target, context_type,
                              LP_JIT_CTX_SAMPLE_MASK);
+      LP_CHECK_MEMBER_OFFSET(struct lp_jit_context, depth_func,
+                             gallivm->target, context_type,
+                             LP_JIT_CTX_DEPTH_FUNC);
+      LP_CHECK_MEMBER_OFFSET(struct lp_jit_context, stencil_state,
+                             gallivm->target, context_type,
+                             LP_JIT_CTX_STENCIL_STATE);
       LP_CHECK_STRUCT_SIZE(struct lp_jit_context,
                            gallivm->target, context_type);
 
@@ -298,6 +308,8 @@ lp_jit_create_types(struct lp_fragment_shader_variant *lp)
       elem_types[LP_JIT_THREAD_DATA_INVOCATIONS] = LLVMInt64TypeInContext(lc);
       elem_types[LP_JIT_THREAD_DATA_RASTER_STATE_VIEWPORT_INDEX] =
             LLVMInt32TypeInContext(lc);
+      elem_types[LP_JIT_THREAD_DATA_RASTER_STATE_INNER_COVERAGE] =
+            LLVMInt32TypeInContext(lc);
 
       thread_data_type = LLVMStructTypeInContext(lc, elem_types,
                                                  ARRAY_SIZE(elem_types), 0);
@@ -320,10 +332,14 @@ lp_jit_screen_cleanup(struct llvmpipe_screen *screen)
 }
 
 
+/**
+ * LLVM itself is only initialized when the first variant is compiled.
+ */
 boolean
 lp_jit_screen_init(struct llvmpipe_screen *screen)
 {
-   return lp_build_init();
+   lp_build_init_native();
+   return TRUE;
 }
 
 
@@ -354,6 +370,7 @@ lp_jit_create_cs_types(struct lp_compute_shader_variant *lp)
             LLVMPointerType(lp_build_format_cache_type(gallivm), 0);
 
       elem_types[LP_JIT_CS_THREAD_DATA_SHARED] = LLVMPointerType(LLVMInt32TypeInContext(lc), 0);
+      elem_types[LP_JIT_CS_THREAD_DATA_CORO_POOL] = LLVMPointerType(LLVMInt8TypeInContext(lc), 0);
       thread_data_type = LLVMStructTypeInContext(lc, elem_types,
                                                  ARRAY_SIZE(elem_types), 0);
 
@@ -44,6 +44,7 @@
 
 
 struct lp_build_format_cache;
+struct lp_coro_frame_pool;
 struct lp_fragment_shader_variant;
 struct lp_compute_shader_variant;
 struct llvmpipe_screen;
@@ -146,6 +147,21 @@ enum {
  * Only use types with a clear size and padding here, in particular prefer the
  * stdint.h types to the basic integer types.
  */
+/**
+ * Per-face stencil state, as consumed by the generic fragment shader
+ * variant (see lp_fragment_shader_variant_key::runtime_ds).
+ */
+enum {
+   LP_JIT_STENCIL_FUNC = 0,
+   LP_JIT_STENCIL_FAIL_OP,
+   LP_JIT_STENCIL_ZFAIL_OP,
+   LP_JIT_STENCIL_ZPASS_OP,
+   LP_JIT_STENCIL_VALUEMASK,
+   LP_JIT_STENCIL_WRITEMASK,
+   LP_JIT_STENCIL_NUM_FIELDS
+};
+
+
 struct lp_jit_context
 {
    const float *constants[LP_MAX_TGSI_CONST_BUFFERS];
@@ -168,6 +184,10 @@ struct lp_jit_context
    int num_ssbos[LP_MAX_TGSI_SHADER_BUFFERS];
 
    uint32_t sample_mask;
+
+   /* Depth/stencil state for variants built with runtime_ds */
+   uint32_t depth_func;
+   uint32_t stencil_state[2][LP_JIT_STENCIL_NUM_FIELDS];
 };
 
 
@@ -190,6 +210,8 @@ enum {
    LP_JIT_CTX_SSBOS,
    LP_JIT_CTX_NUM_SSBOS,
    LP_JIT_CTX_SAMPLE_MASK,
+   LP_JIT_CTX_DEPTH_FUNC,
+   LP_JIT_CTX_STENCIL_STATE,
    LP_JIT_CTX_COUNT
 };
 
@@ -236,6 +258,12 @@ enum {
 #define lp_jit_context_sample_mask(_gallivm, _ptr) \
    lp_build_struct_get_ptr(_gallivm, _ptr, LP_JIT_CTX_SAMPLE_MASK, "sample_mask")
 
+#define lp_jit_context_depth_func(_gallivm, _ptr) \
+   lp_build_struct_get(_gallivm, _ptr, LP_JIT_CTX_DEPTH_FUNC, "depth_func")
+
+#define lp_jit_context_stencil_state(_gallivm, _ptr) \
+   lp_build_struct_get_ptr(_gallivm, _ptr, LP_JIT_CTX_STENCIL_STATE, "stencil_state")
+
 struct lp_jit_thread_data
 {
    struct lp_build_format_cache *cache;
@@ -247,6 +275,8 @@ struct lp_jit_thread_data
     */
    struct {
       uint32_t viewport_index;
+      /** Pixels of the 4x4 block fully covered, see lp_rast_inner_coverage() */
+      uint32_t inner_coverage;
    } raster_state;
 };
 
@@ -256,6 +286,7 @@ enum {
    LP_JIT_THREAD_DATA_COUNTER,
    LP_JIT_THREAD_DATA_INVOCATIONS,
    LP_JIT_THREAD_DATA_RASTER_STATE_VIEWPORT_INDEX,
+   LP_JIT_THREAD_DATA_RASTER_STATE_INNER_COVERAGE,
    LP_JIT_THREAD_DATA_COUNT
 };
 
@@ -273,6 +304,11 @@ enum {
    lp_build_struct_get(_gallivm, _ptr, \
                        LP_JIT_THREAD_DATA_RASTER_STATE_VIEWPORT_INDEX, \
                        "raster_state.viewport_index")
+
+#define lp_jit_thread_data_raster_state_inner_coverage(_gallivm, _ptr) \
+   lp_build_struct_get(_gallivm, _ptr, \
+                       LP_JIT_THREAD_DATA_RASTER_STATE_INNER_COVERAGE, \
+                       "raster_state.inner_coverage")
  
 /**
  * typedef for fragment shader function
@@ -286,7 +322,8 @@ enum {
  * @param dady          shader input dady
  * @param color         color buffer
  * @param depth         depth buffer
- * @param mask          mask of visible pixels in block (16-bits per sample)
+ * @param mask          mask of visible pixels in block (16-bits per sample),
+ *                      LP_RAST_MASK_WORDS words
  * @param thread_data   task thread data
  * @param stride        color buffer row stride in bytes
  * @param depth_stride  depth buffer row stride in bytes
@@ -301,7 +338,7 @@ typedef void
                     const void *dady,
                     uint8_t **color,
                     uint8_t *depth,
-                    uint64_t mask,
+                    const uint64_t *mask,
                     struct lp_jit_thread_data *thread_data,
                     unsigned *stride,
                     unsigned depth_stride,
@@ -313,11 +350,13 @@ struct lp_jit_cs_thread_data
 {
    struct lp_build_format_cache *cache;
    void *shared;
+   struct lp_coro_frame_pool *coro_pool;
 };
 
 enum {
    LP_JIT_CS_THREAD_DATA_CACHE = 0,
    LP_JIT_CS_THREAD_DATA_SHARED = 1,
+   LP_JIT_CS_THREAD_DATA_CORO_POOL = 2,
    LP_JIT_CS_THREAD_DATA_COUNT
 };
 
@@ -328,6 +367,9 @@ enum {
 #define lp_jit_cs_thread_data_shared(_gallivm, _ptr) \
    lp_build_struct_get(_gallivm, _ptr, LP_JIT_CS_THREAD_DATA_SHARED, "shared")
 
+#define lp_jit_cs_thread_data_coro_pool(_gallivm, _ptr) \
+   lp_build_struct_get(_gallivm, _ptr, LP_JIT_CS_THREAD_DATA_CORO_POOL, "coro_pool")
+
 struct lp_jit_cs_context
 {
    const float *constants[LP_MAX_TGSI_CONST_BUFFERS];
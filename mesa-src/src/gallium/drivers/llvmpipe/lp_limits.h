@@ -39,6 +39,13 @@
 #define TILE_ORDER 6
 #define TILE_SIZE (1 << TILE_ORDER)
 
+/**
+ * Scenes may bin with smaller tiles, see lp_scene::tile_order.  Tiles
+ * are rasterized in 16x16 blocks, so they can't be smaller than that,
+ * and TILE_SIZE above remains the maximum.
+ */
+#define LP_MIN_TILE_ORDER 5
+
 
 /**
  * Max texture sizes
@@ -64,9 +71,24 @@
 #define LP_MAX_HEIGHT (1 << (LP_MAX_TEXTURE_LEVELS - 1))
 #define LP_MAX_WIDTH  (1 << (LP_MAX_TEXTURE_LEVELS - 1))
 
-#define LP_MAX_SAMPLES 4
+/** Samples per pixel of multisampled buffers: 4, 8 or 16 */
+#define LP_MAX_SAMPLES 16
+
+#define LP_MAX_THREADS 128
 
-#define LP_MAX_THREADS 16
+/** Max number of threads binning one batch of triangles (LP_BIN_THREADS) */
+#define LP_MAX_BIN_THREADS 8
+
+/**
+ * How rasterizer and compute threads are placed on CPU cores
+ * (LP_THREAD_AFFINITY).
+ */
+enum lp_thread_affinity
+{
+   LP_THREAD_AFFINITY_NONE,  /**< leave it to the OS */
+   LP_THREAD_AFFINITY_CPU,   /**< one core per thread */
+   LP_THREAD_AFFINITY_L3,    /**< spread over the L3 caches (or nodes) */
+};
 
 
 /**
@@ -86,6 +108,20 @@
  */
 #define LP_MAX_SHADER_INSTRUCTIONS (2048 * LP_MAX_SHADER_VARIANTS)
 
+/**
+ * Max number of fragment shader variants per shader specialized for the
+ * depth/stencil funcs and ops.  Past this, further depth/stencil states
+ * share the shader's generic variant, which reads them at runtime.
+ */
+#define LP_MAX_FS_SPECIALIZED_VARIANTS 16
+
+/**
+ * Max number of uniforms inlined into fragment shader variants, and of
+ * variants per shader with inlined uniforms, see LP_INLINE_UNIFORMS.
+ */
+#define LP_MAX_INLINABLE_UNIFORMS 4
+#define LP_MAX_FS_INLINED_VARIANTS 8
+
 /**
  * Max number of setup variants that will be kept around.
  *
@@ -25,12 +25,139 @@
  **************************************************************************/
 
 
+#include "util/u_atomic.h"
 #include "util/u_debug.h"
+#include "util/simple_list.h"
+#include "draw/draw_context.h"
+#include "lp_context.h"
 #include "lp_limits.h"
 #include "lp_memory.h"
+#include "lp_scene.h"
+#include "lp_screen.h"
+#include "lp_setup.h"
+#include "lp_state_cs.h"
+#include "lp_state_fs.h"
+#include "lp_texture.h"
 
 /* A single dummy tile used in a couple of out-of-memory situations. 
  */
 PIPE_ALIGN_VAR(LP_MIN_VECTOR_ALIGN)
 uint8_t lp_dummy_tile[TILE_SIZE * TILE_SIZE * 4];
 
+
+
+/*
+ * Memory accounting, see PIPE_QUERY_DRIVER_SPECIFIC + LP_QUERY_*_MEMORY
+ * and pipe_context::set_memory_budget.  The figures are estimates: they
+ * leave out malloc overhead, and LLVM IR, which only lives while
+ * compiling.
+ */
+
+
+/** Bytes of the fragment and compute shader variants of the context */
+uint64_t
+llvmpipe_context_shader_memory(struct llvmpipe_context *lp)
+{
+   struct lp_fs_variant_list_item *fs_item;
+   struct lp_cs_variant_list_item *cs_item;
+   uint64_t size = 0;
+
+   foreach(fs_item, &lp->fs_variants_list)
+      size += p_atomic_read(&fs_item->base->memory);
+
+   foreach(cs_item, &lp->cs_variants_list)
+      size += p_atomic_read(&cs_item->base->memory);
+
+   return size;
+}
+
+
+/** Bytes of the scenes of the context, see lp_scene_memory() */
+uint64_t
+llvmpipe_context_scene_memory(struct llvmpipe_context *lp)
+{
+   return lp_setup_scene_memory(lp->setup);
+}
+
+
+/** Bytes of the draw module's code and buffers, and the setup vertices */
+uint64_t
+llvmpipe_context_draw_memory(struct llvmpipe_context *lp)
+{
+   return draw_get_memory_size(lp->draw) + lp_setup_vertex_memory(lp->setup);
+}
+
+
+/**
+ * Bytes the context alone holds.  Resources belong to the screen, which
+ * the contexts share.
+ */
+uint64_t
+llvmpipe_context_memory(struct llvmpipe_context *lp)
+{
+   return llvmpipe_context_shader_memory(lp) +
+          llvmpipe_context_scene_memory(lp) +
+          llvmpipe_context_draw_memory(lp);
+}
+
+
+/**
+ * Bytes of the screen: resource storage, shader variants of all the
+ * contexts, the scene block pool and the code cache.
+ */
+uint64_t
+llvmpipe_screen_memory(struct pipe_screen *_screen)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(_screen);
+
+   return llvmpipe_resource_memory(_screen) +
+          p_atomic_read(&screen->shader_memory) +
+          lp_scene_block_pool_memory(screen->block_pool) +
+          screen->code_cache_size;
+}
+
+
+boolean
+llvmpipe_context_over_budget(struct llvmpipe_context *lp)
+{
+   return lp->memory_budget &&
+          llvmpipe_context_memory(lp) > lp->memory_budget;
+}
+
+
+/**
+ * Free the buffers kept around for the next draws and scenes.  They are
+ * allocated again when needed.  Only after a flush.
+ */
+void
+llvmpipe_trim_memory(struct llvmpipe_context *lp)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+
+   draw_trim_memory(lp->draw);
+   lp_setup_trim(lp->setup);
+   lp_scene_block_pool_trim(screen->block_pool);
+}
+
+
+/**
+ * Called after flushes: trim the context's memory if it is over budget.
+ * Shader variants are only evicted when a new one is created, as the
+ * bound ones may still be referenced by the setup state.
+ */
+void
+llvmpipe_check_memory_budget(struct llvmpipe_context *lp)
+{
+   if (llvmpipe_context_over_budget(lp))
+      llvmpipe_trim_memory(lp);
+}
+
+
+void
+llvmpipe_set_memory_budget(struct pipe_context *pipe, uint64_t bytes)
+{
+   struct llvmpipe_context *lp = llvmpipe_context(pipe);
+
+   lp->memory_budget = bytes;
+   llvmpipe_check_memory_budget(lp);
+}
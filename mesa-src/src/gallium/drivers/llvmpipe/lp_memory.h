@@ -37,4 +37,36 @@
 extern PIPE_ALIGN_VAR(LP_MIN_VECTOR_ALIGN)
 uint8_t lp_dummy_tile[TILE_SIZE * TILE_SIZE * 4];
 
+
+struct llvmpipe_context;
+struct pipe_screen;
+
+
+uint64_t
+llvmpipe_context_shader_memory(struct llvmpipe_context *lp);
+
+uint64_t
+llvmpipe_context_scene_memory(struct llvmpipe_context *lp);
+
+uint64_t
+llvmpipe_context_draw_memory(struct llvmpipe_context *lp);
+
+uint64_t
+llvmpipe_context_memory(struct llvmpipe_context *lp);
+
+uint64_t
+llvmpipe_screen_memory(struct pipe_screen *screen);
+
+boolean
+llvmpipe_context_over_budget(struct llvmpipe_context *lp);
+
+void
+llvmpipe_trim_memory(struct llvmpipe_context *lp);
+
+void
+llvmpipe_check_memory_budget(struct llvmpipe_context *lp);
+
+void
+llvmpipe_set_memory_budget(struct pipe_context *pipe, uint64_t bytes);
+
 #endif /* LP_MEMORY_H */
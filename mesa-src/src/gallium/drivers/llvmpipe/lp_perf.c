@@ -25,86 +25,310 @@
  *
  **************************************************************************/
 
+#include <inttypes.h>
+#include "util/simple_mtx.h"
 #include "util/u_debug.h"
+#include "util/u_memory.h"
+#include "util/u_math.h"
 #include "lp_debug.h"
 #include "lp_perf.h"
 
 
+#define COUNTER(_name) { #_name, offsetof(struct lp_counters, _name), false }
+#define TIME(_name) { #_name, offsetof(struct lp_counters, _name), true }
 
+const struct lp_counter_info lp_counter_info[LP_NUM_COUNTERS] = {
+   COUNTER(nr_tris),
+   COUNTER(nr_culled_tris),
+   COUNTER(nr_rectangles),
+   COUNTER(nr_empty_64),
+   COUNTER(nr_fully_covered_64),
+   COUNTER(nr_partially_covered_64),
+   COUNTER(nr_pure_shade_opaque_64),
+   COUNTER(nr_pure_shade_64),
+   COUNTER(nr_shade_64),
+   COUNTER(nr_shade_opaque_64),
+   COUNTER(nr_blit_64),
+   COUNTER(nr_span_64),
+   COUNTER(nr_empty_16),
+   COUNTER(nr_fully_covered_16),
+   COUNTER(nr_partially_covered_16),
+   COUNTER(nr_empty_4),
+   COUNTER(nr_fully_covered_4),
+   COUNTER(nr_partially_covered_4),
+   COUNTER(nr_non_empty_4),
+   COUNTER(nr_hiz_rejected_64),
+   COUNTER(nr_hiz_rejected_16),
+   COUNTER(nr_hiz_rejected_4),
+   COUNTER(nr_hiz_rejected_pixels),
+   COUNTER(nr_zprepass_bins),
+   COUNTER(nr_msaa_compressed_blocks),
+   COUNTER(nr_msaa_expanded_blocks),
+   COUNTER(nr_msaa_resolved_pixels),
+   COUNTER(nr_predicated_bins),
+   COUNTER(nr_render_cond_waits),
+   COUNTER(nr_fs_variant_lookups),
+   COUNTER(nr_fs_variant_misses),
+   COUNTER(nr_fs_variant_tier_ups),
+   COUNTER(nr_fs_precompiles),
+   COUNTER(nr_cs_variant_lookups),
+   COUNTER(nr_cs_variant_misses),
+   COUNTER(nr_setup_variant_lookups),
+   COUNTER(nr_setup_variant_misses),
+   COUNTER(nr_llvm_compiles),
+   TIME(llvm_compile_time),
+   COUNTER(nr_color_tile_clear),
+   COUNTER(nr_color_tile_clear_elided),
+   COUNTER(nr_color_tile_load),
+   COUNTER(nr_color_tile_store),
+   COUNTER(nr_tile_local),
+   COUNTER(nr_tile_local_load),
+   COUNTER(nr_tile_local_store),
+   COUNTER(nr_constant_buffer_renames),
+   COUNTER(nr_texture_renames),
+   COUNTER(nr_renames_over_budget),
+   COUNTER(nr_data_block_mallocs),
+   COUNTER(nr_data_block_reuses),
+   COUNTER(nr_scenes),
+   COUNTER(nr_scene_stalls),
+   COUNTER(nr_scene_splits),
+   COUNTER(nr_scene_handoffs),
+   TIME(scene_stall_time),
+   TIME(scene_rast_time),
+   COUNTER(nr_rast_bins),
+   /* nanoseconds, reported as a plain count */
+   COUNTER(rast_bin_time),
+   COUNTER(nr_rast_wakeups),
+   COUNTER(rast_scene_threads),
+   COUNTER(nr_rast_spin_wakeups),
+   COUNTER(rast_wakeup_time),
+   COUNTER(nr_fence_waits),
+   COUNTER(nr_fence_spin_wakeups),
+   COUNTER(fence_wakeup_time),
+};
+
+#undef COUNTER
+#undef TIME
+
+
+bool lp_counters_enabled;
+
+/** The counters of a thread, padded to whole cache lines */
+struct lp_thread_counters_block
+{
+   struct lp_counters counters;
+   struct lp_thread_counters_block *next;
+};
+
+#define LP_COUNTERS_ALIGN 64
+
+static simple_mtx_t lp_counters_mutex = _SIMPLE_MTX_INITIALIZER_NP;
+static struct lp_thread_counters_block *lp_counters_blocks;
+
+#ifdef USE_ELF_TLS
+__thread struct lp_counters *lp_thread_counters_tls;
+#else
 struct lp_counters lp_count;
+#endif
+
+
+/**
+ * Make the calling thread's copy of the counters.  Copies are kept when
+ * their thread exits, so that lp_get_counters() still sees its counts.
+ */
+struct lp_counters *
+lp_thread_counters_create(void)
+{
+   static struct lp_counters fallback;
+   unsigned size = align(sizeof(struct lp_thread_counters_block),
+                         LP_COUNTERS_ALIGN);
+   struct lp_thread_counters_block *block =
+      os_malloc_aligned(size, LP_COUNTERS_ALIGN);
+
+   if (!block)
+      return &fallback;
+
+   memset(block, 0, size);
+
+   simple_mtx_lock(&lp_counters_mutex);
+   block->next = lp_counters_blocks;
+   lp_counters_blocks = block;
+   simple_mtx_unlock(&lp_counters_mutex);
+
+   return &block->counters;
+}
+
+
+static void
+lp_add_counters(struct lp_counters *sum, const struct lp_counters *counters)
+{
+   uint64_t *dst = (uint64_t *)sum;
+   const uint64_t *src = (const uint64_t *)counters;
+
+   for (unsigned i = 0; i < LP_NUM_COUNTERS; i++)
+      dst[i] += src[i];
+}
+
+
+/**
+ * Sum the counters of all threads.  Threads may be counting meanwhile,
+ * so the result is only exact once they are idle.
+ */
+void
+lp_get_counters(struct lp_counters *counters)
+{
+   memset(counters, 0, sizeof(*counters));
+
+   simple_mtx_lock(&lp_counters_mutex);
+   for (struct lp_thread_counters_block *block = lp_counters_blocks;
+        block; block = block->next)
+      lp_add_counters(counters, &block->counters);
+   simple_mtx_unlock(&lp_counters_mutex);
+
+#ifndef USE_ELF_TLS
+   lp_add_counters(counters, &lp_count);
+#endif
+}
 
 
 void
 lp_reset_counters(void)
 {
+   simple_mtx_lock(&lp_counters_mutex);
+   for (struct lp_thread_counters_block *block = lp_counters_blocks;
+        block; block = block->next)
+      memset(&block->counters, 0, sizeof(block->counters));
+   simple_mtx_unlock(&lp_counters_mutex);
+
+#ifndef USE_ELF_TLS
    memset(&lp_count, 0, sizeof(lp_count));
+#endif
 }
 
 
 void
 lp_print_counters(void)
 {
-   if (LP_DEBUG & DEBUG_COUNTERS) {
-      unsigned total_64, total_16, total_4;
+   if ((LP_DEBUG & DEBUG_COUNTERS) || (LP_PERF & PERF_COUNTERS)) {
+      struct lp_counters c;
+      uint64_t total_64, total_16, total_4;
       float p1, p2, p3, p4, p5, p6;
 
-      debug_printf("llvmpipe: nr_triangles:                 %9u\n", lp_count.nr_tris);
-      debug_printf("llvmpipe: nr_culled_triangles:          %9u\n", lp_count.nr_culled_tris);
-
-      total_64 = (lp_count.nr_empty_64 + 
-                  lp_count.nr_fully_covered_64 +
-                  lp_count.nr_partially_covered_64);
-
-      p1 = 100.0 * (float) lp_count.nr_empty_64 / (float) total_64;
-      p2 = 100.0 * (float) lp_count.nr_fully_covered_64 / (float) total_64;
-      p3 = 100.0 * (float) lp_count.nr_partially_covered_64 / (float) total_64;
-      p5 = 100.0 * (float) lp_count.nr_shade_opaque_64 / (float) total_64;
-      p6 = 100.0 * (float) lp_count.nr_shade_64 / (float) total_64;
-
-      debug_printf("llvmpipe: nr_64x64:                     %9u\n", total_64);
-      debug_printf("llvmpipe:   nr_fully_covered_64x64:     %9u (%3.0f%% of %u)\n", lp_count.nr_fully_covered_64, p2, total_64);
-      debug_printf("llvmpipe:     nr_shade_opaque_64x64:    %9u (%3.0f%% of %u)\n", lp_count.nr_shade_opaque_64, p5, total_64);
-      debug_printf("llvmpipe:        nr_pure_shade_opaque:  %9u (%3.0f%% of %u)\n", lp_count.nr_pure_shade_opaque_64, 0.0, lp_count.nr_shade_opaque_64);
-      debug_printf("llvmpipe:     nr_shade_64x64:           %9u (%3.0f%% of %u)\n", lp_count.nr_shade_64, p6, total_64);
-      debug_printf("llvmpipe:        nr_pure_shade:         %9u (%3.0f%% of %u)\n", lp_count.nr_pure_shade_64, 0.0, lp_count.nr_shade_64);
-      debug_printf("llvmpipe:   nr_partially_covered_64x64: %9u (%3.0f%% of %u)\n", lp_count.nr_partially_covered_64, p3, total_64);
-      debug_printf("llvmpipe:   nr_empty_64x64:             %9u (%3.0f%% of %u)\n", lp_count.nr_empty_64, p1, total_64);
-
-      total_16 = (lp_count.nr_empty_16 + 
-                  lp_count.nr_fully_covered_16 +
-                  lp_count.nr_partially_covered_16);
-
-      p1 = 100.0 * (float) lp_count.nr_empty_16 / (float) total_16;
-      p2 = 100.0 * (float) lp_count.nr_fully_covered_16 / (float) total_16;
-      p3 = 100.0 * (float) lp_count.nr_partially_covered_16 / (float) total_16;
-
-      debug_printf("llvmpipe: nr_16x16:                     %9u\n", total_16);
-      debug_printf("llvmpipe:   nr_fully_covered_16x16:     %9u (%3.0f%% of %u)\n", lp_count.nr_fully_covered_16, p2, total_16);
-      debug_printf("llvmpipe:   nr_partially_covered_16x16: %9u (%3.0f%% of %u)\n", lp_count.nr_partially_covered_16, p3, total_16);
-      debug_printf("llvmpipe:   nr_empty_16x16:             %9u (%3.0f%% of %u)\n", lp_count.nr_empty_16, p1, total_16);
-
-      total_4 = (lp_count.nr_empty_4 +
-                 lp_count.nr_fully_covered_4 +
-                 lp_count.nr_partially_covered_4);
-
-      p1 = 100.0 * (float) lp_count.nr_empty_4 / (float) total_4;
-      p2 = 100.0 * (float) lp_count.nr_fully_covered_4 / (float) total_4;
-      p3 = 100.0 * (float) lp_count.nr_partially_covered_4 / (float) total_4;
-      p4 = 100.0 * (float) lp_count.nr_non_empty_4 / (float) total_4;
-
-      debug_printf("llvmpipe: nr_tri_4x4:                   %9u\n", total_4);
-      debug_printf("llvmpipe:   nr_fully_covered_4x4:       %9u (%3.0f%% of %u)\n", lp_count.nr_fully_covered_4, p2, total_4);
-      debug_printf("llvmpipe:   nr_partially_covered_4x4:   %9u (%3.0f%% of %u)\n", lp_count.nr_partially_covered_4, p3, total_4);
-      debug_printf("llvmpipe:   nr_empty_4x4:               %9u (%3.0f%% of %u)\n", lp_count.nr_empty_4, p1, total_4);
-      debug_printf("llvmpipe:   nr_non_empty_4x4:           %9u (%3.0f%% of %u)\n", lp_count.nr_non_empty_4, p4, total_4);
-
-      debug_printf("llvmpipe: nr_color_tile_clear:          %9u\n", lp_count.nr_color_tile_clear);
-      debug_printf("llvmpipe: nr_color_tile_load:           %9u\n", lp_count.nr_color_tile_load);
-      debug_printf("llvmpipe: nr_color_tile_store:          %9u\n", lp_count.nr_color_tile_store);
-
-      debug_printf("llvmpipe: nr_llvm_compiles:             %u\n", lp_count.nr_llvm_compiles);
-      debug_printf("llvmpipe: total LLVM compile time:      %.2f sec\n", lp_count.llvm_compile_time / 1000000.0);
-      debug_printf("llvmpipe: average LLVM compile time:    %.2f sec\n", lp_count.llvm_compile_time / 1000000.0 / lp_count.nr_llvm_compiles);
+      lp_get_counters(&c);
+
+      debug_printf("llvmpipe: nr_triangles:                 %9" PRIu64 "\n", c.nr_tris);
+      debug_printf("llvmpipe: nr_culled_triangles:          %9" PRIu64 "\n", c.nr_culled_tris);
+      debug_printf("llvmpipe: nr_rectangles:                %9" PRIu64 "\n", c.nr_rectangles);
+
+      total_64 = (c.nr_empty_64 + 
+                  c.nr_fully_covered_64 +
+                  c.nr_partially_covered_64);
+
+      p1 = 100.0 * (float) c.nr_empty_64 / (float) total_64;
+      p2 = 100.0 * (float) c.nr_fully_covered_64 / (float) total_64;
+      p3 = 100.0 * (float) c.nr_partially_covered_64 / (float) total_64;
+      p5 = 100.0 * (float) c.nr_shade_opaque_64 / (float) total_64;
+      p6 = 100.0 * (float) c.nr_shade_64 / (float) total_64;
+
+      debug_printf("llvmpipe: nr_64x64:                     %9" PRIu64 "\n", total_64);
+      debug_printf("llvmpipe:   nr_fully_covered_64x64:     %9" PRIu64 " (%3.0f%% of %" PRIu64 ")\n", c.nr_fully_covered_64, p2, total_64);
+      debug_printf("llvmpipe:     nr_shade_opaque_64x64:    %9" PRIu64 " (%3.0f%% of %" PRIu64 ")\n", c.nr_shade_opaque_64, p5, total_64);
+      debug_printf("llvmpipe:        nr_pure_shade_opaque:  %9" PRIu64 " (%3.0f%% of %" PRIu64 ")\n", c.nr_pure_shade_opaque_64, 0.0, c.nr_shade_opaque_64);
+      debug_printf("llvmpipe:        nr_blit_64x64:         %9" PRIu64 " (%3.0f%% of %" PRIu64 ")\n", c.nr_blit_64, 0.0, c.nr_shade_opaque_64);
+      debug_printf("llvmpipe:     nr_shade_64x64:           %9" PRIu64 " (%3.0f%% of %" PRIu64 ")\n", c.nr_shade_64, p6, total_64);
+      debug_printf("llvmpipe:        nr_pure_shade:         %9" PRIu64 " (%3.0f%% of %" PRIu64 ")\n", c.nr_pure_shade_64, 0.0, c.nr_shade_64);
+      debug_printf("llvmpipe:   nr_partially_covered_64x64: %9" PRIu64 " (%3.0f%% of %" PRIu64 ")\n", c.nr_partially_covered_64, p3, total_64);
+      debug_printf("llvmpipe:   nr_empty_64x64:             %9" PRIu64 " (%3.0f%% of %" PRIu64 ")\n", c.nr_empty_64, p1, total_64);
+      debug_printf("llvmpipe:   nr_span_64x64:              %9" PRIu64 " (%3.0f%% of %" PRIu64 ")\n", c.nr_span_64, 0.0, total_64);
+
+      total_16 = (c.nr_empty_16 + 
+                  c.nr_fully_covered_16 +
+                  c.nr_partially_covered_16);
+
+      p1 = 100.0 * (float) c.nr_empty_16 / (float) total_16;
+      p2 = 100.0 * (float) c.nr_fully_covered_16 / (float) total_16;
+      p3 = 100.0 * (float) c.nr_partially_covered_16 / (float) total_16;
+
+      debug_printf("llvmpipe: nr_16x16:                     %9" PRIu64 "\n", total_16);
+      debug_printf("llvmpipe:   nr_fully_covered_16x16:     %9" PRIu64 " (%3.0f%% of %" PRIu64 ")\n", c.nr_fully_covered_16, p2, total_16);
+      debug_printf("llvmpipe:   nr_partially_covered_16x16: %9" PRIu64 " (%3.0f%% of %" PRIu64 ")\n", c.nr_partially_covered_16, p3, total_16);
+      debug_printf("llvmpipe:   nr_empty_16x16:             %9" PRIu64 " (%3.0f%% of %" PRIu64 ")\n", c.nr_empty_16, p1, total_16);
+
+      total_4 = (c.nr_empty_4 +
+                 c.nr_fully_covered_4 +
+                 c.nr_partially_covered_4);
+
+      p1 = 100.0 * (float) c.nr_empty_4 / (float) total_4;
+      p2 = 100.0 * (float) c.nr_fully_covered_4 / (float) total_4;
+      p3 = 100.0 * (float) c.nr_partially_covered_4 / (float) total_4;
+      p4 = 100.0 * (float) c.nr_non_empty_4 / (float) total_4;
+
+      debug_printf("llvmpipe: nr_tri_4x4:                   %9" PRIu64 "\n", total_4);
+      debug_printf("llvmpipe:   nr_fully_covered_4x4:       %9" PRIu64 " (%3.0f%% of %" PRIu64 ")\n", c.nr_fully_covered_4, p2, total_4);
+      debug_printf("llvmpipe:   nr_partially_covered_4x4:   %9" PRIu64 " (%3.0f%% of %" PRIu64 ")\n", c.nr_partially_covered_4, p3, total_4);
+      debug_printf("llvmpipe:   nr_empty_4x4:               %9" PRIu64 " (%3.0f%% of %" PRIu64 ")\n", c.nr_empty_4, p1, total_4);
+      debug_printf("llvmpipe:   nr_non_empty_4x4:           %9" PRIu64 " (%3.0f%% of %" PRIu64 ")\n", c.nr_non_empty_4, p4, total_4);
+
+      debug_printf("llvmpipe: nr_hiz_rejected_64x64:        %9" PRIu64 "\n", c.nr_hiz_rejected_64);
+      debug_printf("llvmpipe: nr_hiz_rejected_16x16:        %9" PRIu64 "\n", c.nr_hiz_rejected_16);
+      debug_printf("llvmpipe: nr_hiz_rejected_4x4:          %9" PRIu64 "\n", c.nr_hiz_rejected_4);
+      debug_printf("llvmpipe:   nr_hiz_rejected_pixels:     %9" PRIu64 "\n", c.nr_hiz_rejected_pixels);
+      debug_printf("llvmpipe: nr_zprepass_bins:             %9" PRIu64 "\n", c.nr_zprepass_bins);
+      debug_printf("llvmpipe: nr_msaa_compressed_4x4:       %9" PRIu64 "\n", c.nr_msaa_compressed_blocks);
+      debug_printf("llvmpipe: nr_msaa_expanded_4x4:         %9" PRIu64 "\n", c.nr_msaa_expanded_blocks);
+      debug_printf("llvmpipe: nr_msaa_resolved_pixels:      %9" PRIu64 "\n", c.nr_msaa_resolved_pixels);
+      debug_printf("llvmpipe: nr_predicated_bins:           %9" PRIu64 "\n", c.nr_predicated_bins);
+      debug_printf("llvmpipe: nr_render_cond_waits:         %9" PRIu64 "\n", c.nr_render_cond_waits);
+
+      debug_printf("llvmpipe: nr_color_tile_clear:          %9" PRIu64 "\n", c.nr_color_tile_clear);
+      debug_printf("llvmpipe: nr_color_tile_clear_elided:   %9" PRIu64 "\n", c.nr_color_tile_clear_elided);
+      debug_printf("llvmpipe: nr_color_tile_load:           %9" PRIu64 "\n", c.nr_color_tile_load);
+      debug_printf("llvmpipe: nr_color_tile_store:          %9" PRIu64 "\n", c.nr_color_tile_store);
+      debug_printf("llvmpipe: nr_tile_local:                %9" PRIu64 "\n", c.nr_tile_local);
+      debug_printf("llvmpipe: nr_tile_local_load:           %9" PRIu64 "\n", c.nr_tile_local_load);
+      debug_printf("llvmpipe: nr_tile_local_store:          %9" PRIu64 "\n", c.nr_tile_local_store);
+
+      debug_printf("llvmpipe: nr_constant_buffer_renames:   %9" PRIu64 "\n", c.nr_constant_buffer_renames);
+      debug_printf("llvmpipe: nr_texture_renames:           %9" PRIu64 "\n", c.nr_texture_renames);
+      debug_printf("llvmpipe: nr_renames_over_budget:       %9" PRIu64 "\n", c.nr_renames_over_budget);
+
+      debug_printf("llvmpipe: nr_data_block_mallocs:        %9" PRIu64 "\n", c.nr_data_block_mallocs);
+      debug_printf("llvmpipe: nr_data_block_reuses:         %9" PRIu64 "\n", c.nr_data_block_reuses);
+
+      debug_printf("llvmpipe: nr_scenes:                    %9" PRIu64 "\n", c.nr_scenes);
+      debug_printf("llvmpipe:   nr_scene_stalls:            %9" PRIu64 "\n", c.nr_scene_stalls);
+      debug_printf("llvmpipe:   nr_scene_splits:            %9" PRIu64 "\n", c.nr_scene_splits);
+      debug_printf("llvmpipe:   nr_scene_handoffs:          %9" PRIu64 "\n", c.nr_scene_handoffs);
+      debug_printf("llvmpipe:   total scene stall time:     %.2f sec\n", c.scene_stall_time / 1000000.0);
+      debug_printf("llvmpipe:   total scene rast time:      %.2f sec\n", c.scene_rast_time / 1000000.0);
+      debug_printf("llvmpipe: nr_rast_bins:                 %9" PRIu64 "\n", c.nr_rast_bins);
+      debug_printf("llvmpipe:   total bin rast time:        %.2f sec\n", c.rast_bin_time / 1000000000.0);
+      debug_printf("llvmpipe: nr_rast_wakeups:              %9" PRIu64 "\n", c.nr_rast_wakeups);
+      debug_printf("llvmpipe:   nr_rast_spin_wakeups:       %9" PRIu64 "\n", c.nr_rast_spin_wakeups);
+      if (c.nr_rast_wakeups)
+         debug_printf("llvmpipe:   mean threads per scene:     %.2f\n",
+                      (double) c.rast_scene_threads / c.nr_rast_wakeups);
+      if (c.nr_rast_wakeups)
+         debug_printf("llvmpipe:   mean wakeup latency:        %.2f usec\n",
+                      c.rast_wakeup_time / 1000.0 / c.nr_rast_wakeups);
+      debug_printf("llvmpipe: nr_fence_waits:               %9" PRIu64 "\n", c.nr_fence_waits);
+      debug_printf("llvmpipe:   nr_fence_spin_wakeups:      %9" PRIu64 "\n", c.nr_fence_spin_wakeups);
+      if (c.nr_fence_waits)
+         debug_printf("llvmpipe:   mean wakeup latency:        %.2f usec\n",
+                      c.fence_wakeup_time / 1000.0 / c.nr_fence_waits);
+
+      debug_printf("llvmpipe: nr_fs_variant_lookups:        %9" PRIu64 "\n", c.nr_fs_variant_lookups);
+      debug_printf("llvmpipe:   nr_fs_variant_misses:       %9" PRIu64 "\n", c.nr_fs_variant_misses);
+      debug_printf("llvmpipe:   nr_fs_variant_tier_ups:     %9" PRIu64 "\n", c.nr_fs_variant_tier_ups);
+      debug_printf("llvmpipe:   nr_fs_precompiles:          %9" PRIu64 "\n", c.nr_fs_precompiles);
+      debug_printf("llvmpipe: nr_cs_variant_lookups:        %9" PRIu64 "\n", c.nr_cs_variant_lookups);
+      debug_printf("llvmpipe:   nr_cs_variant_misses:       %9" PRIu64 "\n", c.nr_cs_variant_misses);
+      debug_printf("llvmpipe: nr_setup_variant_lookups:     %9" PRIu64 "\n", c.nr_setup_variant_lookups);
+      debug_printf("llvmpipe:   nr_setup_variant_misses:    %9" PRIu64 "\n", c.nr_setup_variant_misses);
+
+      debug_printf("llvmpipe: nr_llvm_compiles:             %" PRIu64 "\n", c.nr_llvm_compiles);
+      debug_printf("llvmpipe: total LLVM compile time:      %.2f sec\n", c.llvm_compile_time / 1000000.0);
+      debug_printf("llvmpipe: average LLVM compile time:    %.2f sec\n", c.llvm_compile_time / 1000000.0 / c.nr_llvm_compiles);
 
    }
 }
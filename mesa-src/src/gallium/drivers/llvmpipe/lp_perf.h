@@ -34,52 +34,147 @@
 #define LP_PERF_H
 
 #include "pipe/p_compiler.h"
+#include "util/macros.h"
 
 /**
- * Various counters
+ * Various counters.  They are all uint64_t, so that lp_get_counters() can
+ * sum the copies of the threads, and queries can report any of them.
  */
 struct lp_counters
 {
-   unsigned nr_tris;
-   unsigned nr_culled_tris;
-   unsigned nr_empty_64;
-   unsigned nr_fully_covered_64;
-   unsigned nr_partially_covered_64;
-   unsigned nr_pure_shade_opaque_64;
-   unsigned nr_pure_shade_64;
-   unsigned nr_shade_64;
-   unsigned nr_shade_opaque_64;
-   unsigned nr_empty_16;
-   unsigned nr_fully_covered_16;
-   unsigned nr_partially_covered_16;
-   unsigned nr_empty_4;
-   unsigned nr_fully_covered_4;
-   unsigned nr_partially_covered_4;
-   unsigned nr_non_empty_4;
-   unsigned nr_llvm_compiles;
-   int64_t llvm_compile_time;  /**< total, in microseconds */
-
-   unsigned nr_color_tile_clear;
-   unsigned nr_color_tile_load;
-   unsigned nr_color_tile_store;
+   uint64_t nr_tris;
+   uint64_t nr_culled_tris;
+   uint64_t nr_rectangles;
+   uint64_t nr_empty_64;
+   uint64_t nr_fully_covered_64;
+   uint64_t nr_partially_covered_64;
+   uint64_t nr_pure_shade_opaque_64;
+   uint64_t nr_pure_shade_64;
+   uint64_t nr_shade_64;
+   uint64_t nr_shade_opaque_64;
+   uint64_t nr_blit_64;
+   uint64_t nr_span_64;
+   uint64_t nr_empty_16;
+   uint64_t nr_fully_covered_16;
+   uint64_t nr_partially_covered_16;
+   uint64_t nr_empty_4;
+   uint64_t nr_fully_covered_4;
+   uint64_t nr_partially_covered_4;
+   uint64_t nr_non_empty_4;
+   uint64_t nr_hiz_rejected_64;   /**< tiles, see lp_rast_hiz_reject() */
+   uint64_t nr_hiz_rejected_16;
+   uint64_t nr_hiz_rejected_4;
+   uint64_t nr_hiz_rejected_pixels;
+   uint64_t nr_zprepass_bins;     /**< bins rasterized in two passes */
+   uint64_t nr_msaa_compressed_blocks; /**< 4x4, see lp_rast_msaa_shade() */
+   uint64_t nr_msaa_expanded_blocks;
+   uint64_t nr_msaa_resolved_pixels;   /**< resolved from sample 0 only */
+   uint64_t nr_predicated_bins;  /**< draws skipped by LP_RAST_OP_PREDICATE */
+   uint64_t nr_render_cond_waits; /**< render conditions checked by waiting */
+   uint64_t nr_fs_variant_lookups;
+   uint64_t nr_fs_variant_misses;
+   uint64_t nr_fs_variant_tier_ups;
+   uint64_t nr_fs_precompiles;
+   uint64_t nr_cs_variant_lookups;
+   uint64_t nr_cs_variant_misses;
+   uint64_t nr_setup_variant_lookups;
+   uint64_t nr_setup_variant_misses;
+   uint64_t nr_llvm_compiles;
+   uint64_t llvm_compile_time;  /**< total, in microseconds */
+
+   uint64_t nr_color_tile_clear;
+   uint64_t nr_color_tile_clear_elided;  /**< overwritten before written */
+   uint64_t nr_color_tile_load;
+   uint64_t nr_color_tile_store;
+   uint64_t nr_tile_local;  /**< buffer tiles in task storage, all kinds */
+   uint64_t nr_tile_local_load;
+   uint64_t nr_tile_local_store;
+
+   uint64_t nr_constant_buffer_renames;  /**< see llvmpipe_rename_buffer() */
+   uint64_t nr_texture_renames;  /**< see llvmpipe_rename_texture() */
+   uint64_t nr_renames_over_budget;  /**< see LP_SCENE_MAX_RETIRED_SIZE */
+
+   uint64_t nr_data_block_mallocs;
+   uint64_t nr_data_block_reuses;
+
+   uint64_t nr_scenes;
+   uint64_t nr_scene_stalls;   /**< setup waited for a free scene */
+   uint64_t nr_scene_splits;   /**< scenes handed over mid-frame */
+   uint64_t nr_scene_handoffs; /**< to idle threads, see LP_PERF=pipeline */
+   uint64_t scene_stall_time;  /**< total, in microseconds */
+   uint64_t scene_rast_time;   /**< summed over threads, in microseconds */
+   uint64_t nr_rast_bins;      /**< non-empty bins rasterized */
+   uint64_t rast_bin_time;     /**< summed over threads, in nanoseconds */
+   uint64_t nr_rast_wakeups;   /**< scenes dequeued by the threads */
+   uint64_t rast_scene_threads;  /**< summed, see lp_rast_scene_threads() */
+   uint64_t nr_rast_spin_wakeups;  /**< per thread, see LP_SPIN_WAIT */
+   uint64_t rast_wakeup_time;  /**< queued to dequeued, in nanoseconds */
+   uint64_t nr_fence_waits;    /**< for fences not signalled yet */
+   uint64_t nr_fence_spin_wakeups;  /**< see LP_SPIN_WAIT */
+   uint64_t fence_wakeup_time; /**< signalled to woken, in nanoseconds */
 };
 
+#define LP_NUM_COUNTERS (sizeof(struct lp_counters) / sizeof(uint64_t))
 
-extern struct lp_counters lp_count;
+struct lp_counter_info
+{
+   const char *name;
+   unsigned offset;            /**< in struct lp_counters */
+   bool time;                  /**< in microseconds */
+};
+
+extern const struct lp_counter_info lp_counter_info[LP_NUM_COUNTERS];
+
+
+/**
+ * Counting is off unless LP_PERF=counters or LP_DEBUG=counters is set,
+ * or a counter query was created.  Each thread counts into its own cache
+ * line aligned copy of the counters, see lp_thread_counters().
+ */
+extern bool lp_counters_enabled;
+
+struct lp_counters *
+lp_thread_counters_create(void);
 
+#ifdef USE_ELF_TLS
+extern __thread struct lp_counters *lp_thread_counters_tls;
 
-/** Increment the named counter (only for debug builds) */
-#ifdef DEBUG
-#define LP_COUNT(counter) lp_count.counter++
-#define LP_COUNT_ADD(counter, incr)  lp_count.counter += (incr)
-#define LP_COUNT_GET(counter) (lp_count.counter)
+static inline struct lp_counters *
+lp_thread_counters(void)
+{
+   if (unlikely(!lp_thread_counters_tls))
+      lp_thread_counters_tls = lp_thread_counters_create();
+   return lp_thread_counters_tls;
+}
 #else
-#define LP_COUNT(counter) do {} while (0)
-#define LP_COUNT_ADD(counter, incr) (void)(incr)
-#define LP_COUNT_GET(counter) 0
+/* All threads share one copy, which may lose counts */
+extern struct lp_counters lp_count;
+
+static inline struct lp_counters *
+lp_thread_counters(void)
+{
+   return &lp_count;
+}
 #endif
 
 
+/** Increment the named counter, if counting is enabled */
+#define LP_COUNT(counter) \
+   do { \
+      if (unlikely(lp_counters_enabled)) \
+         lp_thread_counters()->counter++; \
+   } while (0)
+#define LP_COUNT_ADD(counter, incr) \
+   do { \
+      if (unlikely(lp_counters_enabled)) \
+         lp_thread_counters()->counter += (incr); \
+   } while (0)
+
+
+void
+lp_get_counters(struct lp_counters *counters);
+
+
 extern void
 lp_reset_counters(void);
 
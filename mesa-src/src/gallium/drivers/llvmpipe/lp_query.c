@@ -30,17 +30,22 @@
  *    Keith Whitwell, Qicheng Christopher Li, Brian Paul
  */
 
+#include <stdio.h>
 #include "draw/draw_context.h"
 #include "pipe/p_defines.h"
 #include "util/u_memory.h"
 #include "util/os_time.h"
+#include "util/u_atomic.h"
 #include "lp_context.h"
 #include "lp_flush.h"
 #include "lp_fence.h"
+#include "lp_memory.h"
 #include "lp_query.h"
 #include "lp_screen.h"
 #include "lp_state.h"
 #include "lp_rast.h"
+#include "lp_perf.h"
+#include "lp_texture.h"
 
 
 static struct llvmpipe_query *llvmpipe_query( struct pipe_query *p )
@@ -55,7 +60,17 @@ llvmpipe_create_query(struct pipe_context *pipe,
 {
    struct llvmpipe_query *pq;
 
-   assert(type < PIPE_QUERY_TYPES);
+   assert(type < PIPE_QUERY_TYPES || LP_QUERY_IS_MEMORY(type) ||
+          LP_QUERY_IS_STARTUP(type) ||
+          type == LP_QUERY_RAST_BUSY ||
+          (type >= LP_QUERY_COUNTER_FIRST &&
+           type < LP_QUERY_COUNTER_FIRST + LP_NUM_COUNTERS));
+
+   /* Counting stays on from here, it is far too cheap to bother
+    * refcounting the counter queries.
+    */
+   if (type >= LP_QUERY_COUNTER_FIRST)
+      lp_counters_enabled = true;
 
    pq = CALLOC_STRUCT( llvmpipe_query );
 
@@ -68,11 +83,49 @@ llvmpipe_create_query(struct pipe_context *pipe,
 }
 
 
+/** Current value of the lp_counters field a counter query reports */
+static uint64_t
+lp_query_counter_value(unsigned type)
+{
+   struct lp_counters counters;
+
+   lp_get_counters(&counters);
+   return *(const uint64_t *)
+      ((const char *)&counters +
+       lp_counter_info[type - LP_QUERY_COUNTER_FIRST].offset);
+}
+
+
+/**
+ * Wall time between the first and the last bin the threads timed for a
+ * timed query, in nanoseconds.
+ */
+static uint64_t
+lp_query_time_elapsed(const struct llvmpipe_query *pq, unsigned num_threads)
+{
+   uint64_t first = UINT64_MAX, last = 0;
+   unsigned i;
+
+   for (i = 0; i < num_threads; i++) {
+      if (!pq->first[i])
+         continue;
+      first = MIN2(first, pq->first[i]);
+      last = MAX2(last, pq->last[i]);
+   }
+
+   return last > first ? last - first : 0;
+}
+
+
 static void
 llvmpipe_destroy_query(struct pipe_context *pipe, struct pipe_query *q)
 {
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
    struct llvmpipe_query *pq = llvmpipe_query(q);
 
+   if (llvmpipe->render_cond_query == q)
+      lp_setup_set_predicate(llvmpipe->setup, NULL, FALSE);
+
    /* Ideally we would refcount queries & not get destroyed until the
     * last scene had finished with us.
     */
@@ -86,6 +139,18 @@ llvmpipe_destroy_query(struct pipe_context *pipe, struct pipe_query *q)
       lp_fence_reference(&pq->fence, NULL);
    }
 
+   /* Scenes predicated on the query still read its tile results */
+   if (pq->predicate_fence) {
+      if (!lp_fence_issued(pq->predicate_fence))
+         llvmpipe_flush(pipe, NULL, __FUNCTION__);
+
+      if (!lp_fence_signalled(pq->predicate_fence))
+         lp_fence_wait(pq->predicate_fence);
+
+      lp_fence_reference(&pq->predicate_fence, NULL);
+   }
+
+   FREE(pq->tile_visible);
    FREE(pq);
 }
 
@@ -100,8 +165,19 @@ llvmpipe_get_query_result(struct pipe_context *pipe,
    unsigned num_threads = MAX2(1, screen->num_threads);
    struct llvmpipe_query *pq = llvmpipe_query(q);
    uint64_t *result = (uint64_t *)vresult;
+   const bool predicate =
+      pq->type == PIPE_QUERY_OCCLUSION_PREDICATE ||
+      pq->type == PIPE_QUERY_OCCLUSION_PREDICATE_CONSERVATIVE;
    int i;
 
+   /* The first tile which saw a sample pass decides a predicate, the
+    * rest of the scene needn't finish.
+    */
+   if (predicate && p_atomic_read(&pq->passed)) {
+      vresult->b = true;
+      return true;
+   }
+
    if (pq->fence) {
       /* only have a fence if there was a scene */
       if (!lp_fence_signalled(pq->fence)) {
@@ -111,7 +187,16 @@ llvmpipe_get_query_result(struct pipe_context *pipe,
          if (!wait)
             return false;
 
-         lp_fence_wait(pq->fence);
+         if (predicate) {
+            while (!lp_fence_timedwait(pq->fence, 100000)) {
+               if (p_atomic_read(&pq->passed)) {
+                  vresult->b = true;
+                  return true;
+               }
+            }
+         }
+         else
+            lp_fence_wait(pq->fence);
       }
    }
 
@@ -139,6 +224,9 @@ llvmpipe_get_query_result(struct pipe_context *pipe,
          }
       }
       break;
+   case PIPE_QUERY_TIME_ELAPSED:
+      *result = lp_query_time_elapsed(pq, num_threads);
+      break;
    case PIPE_QUERY_TIMESTAMP_DISJOINT: {
       struct pipe_query_data_timestamp_disjoint *td =
          (struct pipe_query_data_timestamp_disjoint *)vresult;
@@ -182,7 +270,34 @@ llvmpipe_get_query_result(struct pipe_context *pipe,
       *stats = pq->stats;
    }
       break;
+   case LP_QUERY_SHADER_MEMORY:
+   case LP_QUERY_RESOURCE_MEMORY:
+   case LP_QUERY_SCREEN_MEMORY:
+   case LP_QUERY_SCENE_MEMORY:
+   case LP_QUERY_DRAW_MEMORY:
+   case LP_QUERY_CONTEXT_MEMORY:
+   case LP_QUERY_STARTUP_SCREEN:
+   case LP_QUERY_STARTUP_CONTEXT:
+   case LP_QUERY_STARTUP_LLVM_INIT:
+   case LP_QUERY_STARTUP_JIT:
+   case LP_QUERY_STARTUP_FIRST_FLUSH:
+      *result = pq->end[0];
+      break;
+   case LP_QUERY_RAST_BUSY:
+      for (i = 0; i < num_threads; i++) {
+         *result += pq->end[i];
+      }
+      *result /= 1000;
+      break;
    default:
+      /* The rasterizer counts when the bins run, so the counters are only
+       * read once the fence of the last scene has signalled.  Anything
+       * counted after end_query but before that lands in the result too.
+       */
+      if (pq->type >= LP_QUERY_COUNTER_FIRST) {
+         *result = lp_query_counter_value(pq->type) - pq->start[0];
+         break;
+      }
       assert(0);
       break;
    }
@@ -259,6 +374,9 @@ llvmpipe_get_query_result_resource(struct pipe_context *pipe,
             }
          }
          break;
+      case PIPE_QUERY_TIME_ELAPSED:
+         value = lp_query_time_elapsed(pq, num_threads);
+         break;
       case PIPE_QUERY_SO_OVERFLOW_ANY_PREDICATE:
          value = 0;
          for (unsigned s = 0; s < PIPE_MAX_VERTEX_STREAMS; s++)
@@ -362,8 +480,15 @@ llvmpipe_begin_query(struct pipe_context *pipe, struct pipe_query *q)
 
    memset(pq->start, 0, sizeof(pq->start));
    memset(pq->end, 0, sizeof(pq->end));
+   memset(pq->first, 0, sizeof(pq->first));
+   memset(pq->last, 0, sizeof(pq->last));
+   pq->passed = 0;
    lp_setup_begin_query(llvmpipe->setup, pq);
 
+   /* A counter query which is never begun counts from zero */
+   if (pq->type >= LP_QUERY_COUNTER_FIRST)
+      pq->start[0] = lp_query_counter_value(pq->type);
+
    switch (pq->type) {
    case PIPE_QUERY_PRIMITIVES_EMITTED:
       pq->num_primitives_written[0] = llvmpipe->so_stats[pq->index].num_primitives_written;
@@ -411,6 +536,7 @@ llvmpipe_begin_query(struct pipe_context *pipe, struct pipe_query *q)
 static bool
 llvmpipe_end_query(struct pipe_context *pipe, struct pipe_query *q)
 {
+   struct llvmpipe_screen *screen = llvmpipe_screen(pipe->screen);
    struct llvmpipe_context *llvmpipe = llvmpipe_context( pipe );
    struct llvmpipe_query *pq = llvmpipe_query(q);
 
@@ -480,6 +606,39 @@ llvmpipe_end_query(struct pipe_context *pipe, struct pipe_query *q)
       llvmpipe->active_occlusion_queries--;
       llvmpipe->dirty |= LP_NEW_OCCLUSION_QUERY;
       break;
+   case LP_QUERY_SHADER_MEMORY:
+      pq->end[0] = p_atomic_read(&screen->shader_memory);
+      break;
+   case LP_QUERY_RESOURCE_MEMORY:
+      pq->end[0] = llvmpipe_resource_memory(&screen->base);
+      break;
+   case LP_QUERY_SCREEN_MEMORY:
+      pq->end[0] = llvmpipe_screen_memory(&screen->base);
+      break;
+   case LP_QUERY_SCENE_MEMORY:
+      pq->end[0] = llvmpipe_context_scene_memory(llvmpipe);
+      break;
+   case LP_QUERY_DRAW_MEMORY:
+      pq->end[0] = llvmpipe_context_draw_memory(llvmpipe);
+      break;
+   case LP_QUERY_CONTEXT_MEMORY:
+      pq->end[0] = llvmpipe_context_memory(llvmpipe);
+      break;
+   case LP_QUERY_STARTUP_SCREEN:
+      pq->end[0] = screen->startup.screen;
+      break;
+   case LP_QUERY_STARTUP_CONTEXT:
+      pq->end[0] = screen->startup.context;
+      break;
+   case LP_QUERY_STARTUP_LLVM_INIT:
+      pq->end[0] = screen->startup.llvm_init;
+      break;
+   case LP_QUERY_STARTUP_JIT:
+      pq->end[0] = screen->startup.jit;
+      break;
+   case LP_QUERY_STARTUP_FIRST_FLUSH:
+      pq->end[0] = screen->startup.first_flush;
+      break;
    default:
       break;
    }
@@ -491,6 +650,7 @@ boolean
 llvmpipe_check_render_cond(struct llvmpipe_context *lp)
 {
    struct pipe_context *pipe = &lp->pipe;
+   struct llvmpipe_query *pq;
    boolean b, wait;
    uint64_t result;
 
@@ -500,6 +660,17 @@ llvmpipe_check_render_cond(struct llvmpipe_context *lp)
    wait = (lp->render_cond_mode == PIPE_RENDER_COND_WAIT ||
            lp->render_cond_mode == PIPE_RENDER_COND_BY_REGION_WAIT);
 
+   /* Without waiting a query still in the unflushed scene just draws,
+    * flushing for it would gain nothing.
+    */
+   pq = llvmpipe_query(lp->render_cond_query);
+   if (!wait && pq->fence && !lp_fence_issued(pq->fence))
+      return TRUE;
+
+   if (wait && pq->fence && !lp_fence_signalled(pq->fence))
+      LP_COUNT(nr_render_cond_waits);
+
+   result = 0;
    b = pipe->get_query_result(pipe, lp->render_cond_query, wait, (void*)&result);
    if (b)
       return ((!result) == lp->render_cond_cond);
@@ -507,6 +678,32 @@ llvmpipe_check_render_cond(struct llvmpipe_context *lp)
       return TRUE;
 }
 
+
+/**
+ * Like llvmpipe_check_render_cond(), for a draw: a by-region condition on
+ * an occlusion query with per-tile results is left to the rasterizer,
+ * which skips the draw's commands in the tiles that fail it.
+ */
+boolean
+llvmpipe_check_render_cond_draw(struct llvmpipe_context *lp)
+{
+   struct llvmpipe_query *pq = NULL;
+
+   if (lp->render_cond_query &&
+       (lp->render_cond_mode == PIPE_RENDER_COND_BY_REGION_WAIT ||
+        lp->render_cond_mode == PIPE_RENDER_COND_BY_REGION_NO_WAIT))
+      pq = llvmpipe_query(lp->render_cond_query);
+
+   if (pq && (pq->type == PIPE_QUERY_OCCLUSION_COUNTER ||
+              pq->type == PIPE_QUERY_OCCLUSION_PREDICATE ||
+              pq->type == PIPE_QUERY_OCCLUSION_PREDICATE_CONSERVATIVE) &&
+       lp_setup_set_predicate(lp->setup, pq, lp->render_cond_cond))
+      return TRUE;
+
+   lp_setup_set_predicate(lp->setup, NULL, FALSE);
+   return llvmpipe_check_render_cond(lp);
+}
+
 static void
 llvmpipe_set_active_query_state(struct pipe_context *pipe, bool enable)
 {
@@ -517,6 +714,85 @@ llvmpipe_set_active_query_state(struct pipe_context *pipe, bool enable)
    llvmpipe->dirty |= LP_NEW_OCCLUSION_QUERY;
 }
 
+/**
+ * The driver-specific queries, which report the state of the screen
+ * or context rather than anything drawn, e.g. for GALLIUM_HUD=shader-memory
+ * or context-memory, or the time the rasterizer threads spent on what was
+ * drawn, summed, for rasterizer-busy, followed by one query per lp_counters
+ * field, e.g. nr-scene-stalls.
+ */
+int
+llvmpipe_get_driver_query_info(struct pipe_screen *screen,
+                               unsigned index,
+                               struct pipe_driver_query_info *info)
+{
+   static const struct pipe_driver_query_info queries[] = {
+      { "shader-memory", LP_QUERY_SHADER_MEMORY, { 0 },
+        PIPE_DRIVER_QUERY_TYPE_BYTES, PIPE_DRIVER_QUERY_RESULT_TYPE_AVERAGE },
+      { "rasterizer-busy", LP_QUERY_RAST_BUSY, { 0 },
+        PIPE_DRIVER_QUERY_TYPE_MICROSECONDS,
+        PIPE_DRIVER_QUERY_RESULT_TYPE_AVERAGE },
+      { "resource-memory", LP_QUERY_RESOURCE_MEMORY, { 0 },
+        PIPE_DRIVER_QUERY_TYPE_BYTES, PIPE_DRIVER_QUERY_RESULT_TYPE_AVERAGE },
+      { "screen-memory", LP_QUERY_SCREEN_MEMORY, { 0 },
+        PIPE_DRIVER_QUERY_TYPE_BYTES, PIPE_DRIVER_QUERY_RESULT_TYPE_AVERAGE },
+      { "scene-memory", LP_QUERY_SCENE_MEMORY, { 0 },
+        PIPE_DRIVER_QUERY_TYPE_BYTES, PIPE_DRIVER_QUERY_RESULT_TYPE_AVERAGE },
+      { "draw-memory", LP_QUERY_DRAW_MEMORY, { 0 },
+        PIPE_DRIVER_QUERY_TYPE_BYTES, PIPE_DRIVER_QUERY_RESULT_TYPE_AVERAGE },
+      { "context-memory", LP_QUERY_CONTEXT_MEMORY, { 0 },
+        PIPE_DRIVER_QUERY_TYPE_BYTES, PIPE_DRIVER_QUERY_RESULT_TYPE_AVERAGE },
+      { "startup-screen", LP_QUERY_STARTUP_SCREEN, { 0 },
+        PIPE_DRIVER_QUERY_TYPE_MICROSECONDS,
+        PIPE_DRIVER_QUERY_RESULT_TYPE_AVERAGE },
+      { "startup-context", LP_QUERY_STARTUP_CONTEXT, { 0 },
+        PIPE_DRIVER_QUERY_TYPE_MICROSECONDS,
+        PIPE_DRIVER_QUERY_RESULT_TYPE_AVERAGE },
+      { "startup-llvm-init", LP_QUERY_STARTUP_LLVM_INIT, { 0 },
+        PIPE_DRIVER_QUERY_TYPE_MICROSECONDS,
+        PIPE_DRIVER_QUERY_RESULT_TYPE_AVERAGE },
+      { "startup-jit", LP_QUERY_STARTUP_JIT, { 0 },
+        PIPE_DRIVER_QUERY_TYPE_MICROSECONDS,
+        PIPE_DRIVER_QUERY_RESULT_TYPE_AVERAGE },
+      { "startup-first-flush", LP_QUERY_STARTUP_FIRST_FLUSH, { 0 },
+        PIPE_DRIVER_QUERY_TYPE_MICROSECONDS,
+        PIPE_DRIVER_QUERY_RESULT_TYPE_AVERAGE },
+   };
+
+   static char names[LP_NUM_COUNTERS][64];
+   const struct lp_counter_info *counter;
+
+   if (!info)
+      return ARRAY_SIZE(queries) + LP_NUM_COUNTERS;
+   if (index < ARRAY_SIZE(queries)) {
+      *info = queries[index];
+      return 1;
+   }
+
+   index -= ARRAY_SIZE(queries);
+   if (index >= LP_NUM_COUNTERS)
+      return 0;
+
+   /* The HUD spells query names with dashes */
+   counter = &lp_counter_info[index];
+   if (!names[index][0]) {
+      char *p;
+      snprintf(names[index], sizeof(names[index]), "%s", counter->name);
+      for (p = names[index]; *p; p++) {
+         if (*p == '_')
+            *p = '-';
+      }
+   }
+
+   memset(info, 0, sizeof(*info));
+   info->name = names[index];
+   info->query_type = LP_QUERY_COUNTER_FIRST + index;
+   info->type = counter->time ? PIPE_DRIVER_QUERY_TYPE_MICROSECONDS :
+                                PIPE_DRIVER_QUERY_TYPE_UINT64;
+   info->result_type = PIPE_DRIVER_QUERY_RESULT_TYPE_CUMULATIVE;
+   return 1;
+}
+
 void llvmpipe_init_query_funcs(struct llvmpipe_context *llvmpipe )
 {
    llvmpipe->pipe.create_query = llvmpipe_create_query;
@@ -35,15 +35,54 @@
 
 #include <limits.h>
 #include "os/os_thread.h"
+#include "util/u_threaded_context.h"
 #include "lp_limits.h"
 
 
 struct llvmpipe_context;
+struct pipe_screen;
+struct pipe_driver_query_info;
+
+
+/** Driver-specific queries, see llvmpipe_get_driver_query_info() */
+#define LP_QUERY_SHADER_MEMORY  (PIPE_QUERY_DRIVER_SPECIFIC + 0)
+/** Time the rasterizer threads spent in the query's bins, summed */
+#define LP_QUERY_RAST_BUSY      (PIPE_QUERY_DRIVER_SPECIFIC + 1)
+/** Bytes of memory, see llvmpipe_context_memory() and co */
+#define LP_QUERY_RESOURCE_MEMORY (PIPE_QUERY_DRIVER_SPECIFIC + 2)
+#define LP_QUERY_SCREEN_MEMORY  (PIPE_QUERY_DRIVER_SPECIFIC + 3)
+#define LP_QUERY_SCENE_MEMORY   (PIPE_QUERY_DRIVER_SPECIFIC + 4)
+#define LP_QUERY_DRAW_MEMORY    (PIPE_QUERY_DRIVER_SPECIFIC + 5)
+#define LP_QUERY_CONTEXT_MEMORY (PIPE_QUERY_DRIVER_SPECIFIC + 6)
+/** Microseconds of startup, see llvmpipe_screen::startup */
+#define LP_QUERY_STARTUP_SCREEN (PIPE_QUERY_DRIVER_SPECIFIC + 7)
+#define LP_QUERY_STARTUP_CONTEXT (PIPE_QUERY_DRIVER_SPECIFIC + 8)
+#define LP_QUERY_STARTUP_LLVM_INIT (PIPE_QUERY_DRIVER_SPECIFIC + 9)
+#define LP_QUERY_STARTUP_JIT    (PIPE_QUERY_DRIVER_SPECIFIC + 10)
+#define LP_QUERY_STARTUP_FIRST_FLUSH (PIPE_QUERY_DRIVER_SPECIFIC + 11)
+/** One query per struct lp_counters field, in lp_counter_info[] order */
+#define LP_QUERY_COUNTER_FIRST  (PIPE_QUERY_DRIVER_SPECIFIC + 12)
+
+/** Queries which snapshot a number of bytes at END */
+#define LP_QUERY_IS_MEMORY(type) \
+   ((type) == LP_QUERY_SHADER_MEMORY || \
+    ((type) >= LP_QUERY_RESOURCE_MEMORY && (type) <= LP_QUERY_CONTEXT_MEMORY))
+
+/** Queries which snapshot a startup time at END */
+#define LP_QUERY_IS_STARTUP(type) \
+   ((type) >= LP_QUERY_STARTUP_SCREEN && (type) <= LP_QUERY_STARTUP_FIRST_FLUSH)
+
+/** Queries timed by the rasterizer, in each bin between BEGIN and END */
+#define LP_QUERY_IS_RAST_TIMED(type) \
+   ((type) == PIPE_QUERY_TIME_ELAPSED || (type) == LP_QUERY_RAST_BUSY)
 
 
 struct llvmpipe_query {
+   struct threaded_query base;      /* see LP_THREADED_CONTEXT */
    uint64_t start[LP_MAX_THREADS];  /* start count value for each thread */
    uint64_t end[LP_MAX_THREADS];    /* end count value for each thread */
+   uint64_t first[LP_MAX_THREADS];  /* rast timed: earliest bin start time */
+   uint64_t last[LP_MAX_THREADS];   /* rast timed: latest bin end time */
    struct lp_fence *fence;          /* fence from last scene this was binned in */
    unsigned type;                   /* PIPE_QUERY_* */
    unsigned index;
@@ -51,6 +90,21 @@ struct llvmpipe_query {
    unsigned num_primitives_written[PIPE_MAX_VERTEX_STREAMS];
 
    struct pipe_query_data_pipeline_statistics stats;
+
+   /**
+    * For occlusion queries which began and ended in one scene: whether a
+    * sample passed in each of its tiles, set by the tiles' END_QUERY, so
+    * by-region conditional rendering needs no wait, see
+    * lp_setup_set_predicate().  tiles_x is 0 otherwise.
+    */
+   uint8_t *tile_visible;
+   unsigned tile_visible_size;
+   unsigned tile_order, tiles_x, tiles_y;
+   unsigned begin_fence_id;        /**< of the scene begin_query went in */
+   struct lp_fence *predicate_fence; /**< last scene predicated on this */
+
+   /** Occlusion predicates: a tile saw a sample pass, the result is TRUE */
+   int passed;
 };
 
 
@@ -58,4 +112,10 @@ extern void llvmpipe_init_query_funcs(struct llvmpipe_context * );
 
 extern boolean llvmpipe_check_render_cond(struct llvmpipe_context *);
 
+extern boolean llvmpipe_check_render_cond_draw(struct llvmpipe_context *);
+
+extern int llvmpipe_get_driver_query_info(struct pipe_screen *screen,
+                                          unsigned index,
+                                          struct pipe_driver_query_info *info);
+
 #endif /* LP_QUERY_H */
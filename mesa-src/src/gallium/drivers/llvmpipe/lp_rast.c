@@ -25,6 +25,7 @@
  *
  **************************************************************************/
 
+#include <inttypes.h>
 #include <limits.h>
 #include "util/u_memory.h"
 #include "util/u_math.h"
@@ -34,6 +35,7 @@
 #include "util/u_string.h"
 #include "util/u_thread.h"
 #include "util/u_memset.h"
+#include "util/u_atomic.h"
 #include "util/os_time.h"
 
 #include "lp_scene_queue.h"
@@ -44,6 +46,8 @@
 #include "lp_query.h"
 #include "lp_rast.h"
 #include "lp_rast_priv.h"
+#include "lp_screen.h"
+#include "lp_trace.h"
 #include "gallivm/lp_bld_format.h"
 #include "gallivm/lp_bld_debug.h"
 #include "lp_scene.h"
@@ -61,6 +65,53 @@ const float lp_sample_pos_4x[4][2] = { { 0.375, 0.125 },
                                        { 0.125, 0.625 },
                                        { 0.625, 0.875 } };
 
+/* The standard D3D patterns, as the 4x one */
+const float lp_sample_pos_8x[8][2] = { { 0.5625, 0.3125 },
+                                       { 0.4375, 0.6875 },
+                                       { 0.8125, 0.5625 },
+                                       { 0.3125, 0.1875 },
+                                       { 0.1875, 0.8125 },
+                                       { 0.0625, 0.4375 },
+                                       { 0.6875, 0.9375 },
+                                       { 0.9375, 0.0625 } };
+
+const float lp_sample_pos_16x[16][2] = { { 0.5625, 0.5625 },
+                                         { 0.4375, 0.3125 },
+                                         { 0.3125, 0.625 },
+                                         { 0.75, 0.4375 },
+                                         { 0.1875, 0.375 },
+                                         { 0.625, 0.8125 },
+                                         { 0.8125, 0.6875 },
+                                         { 0.6875, 0.1875 },
+                                         { 0.375, 0.875 },
+                                         { 0.5, 0.0625 },
+                                         { 0.25, 0.125 },
+                                         { 0.125, 0.75 },
+                                         { 0.0, 0.5 },
+                                         { 0.9375, 0.25 },
+                                         { 0.875, 0.9375 },
+                                         { 0.0625, 0.0 } };
+
+
+/**
+ * The x, y pairs of the sample positions within a pixel for nr_samples
+ * samples, or NULL for single-sampled rendering, which is at the center.
+ */
+const float *
+lp_sample_pos(unsigned nr_samples)
+{
+   switch (nr_samples) {
+   case 4:
+      return &lp_sample_pos_4x[0][0];
+   case 8:
+      return &lp_sample_pos_8x[0][0];
+   case 16:
+      return &lp_sample_pos_16x[0][0];
+   default:
+      return NULL;
+   }
+}
+
 /**
  * Begin rasterizing a scene.
  * Called once per scene by one thread.
@@ -78,12 +129,318 @@ lp_rast_begin( struct lp_rasterizer *rast,
 }
 
 
+/**
+ * End rasterizing a scene and signal its fence.
+ * Called once per scene by one thread, after all threads are done with
+ * the bins.  The setup code may recycle the scene as soon as the fence
+ * is signalled, so the scene must not be touched after that.
+ */
 static void
 lp_rast_end( struct lp_rasterizer *rast )
 {
-   lp_scene_end_rasterization( rast->curr_scene );
+   struct lp_scene *scene = rast->curr_scene;
+
+   lp_scene_progress_end( scene );
+
+   lp_scene_end_rasterization( scene );
 
    rast->curr_scene = NULL;
+
+   if (scene->fence) {
+      lp_fence_signal(scene->fence);
+   }
+}
+
+
+/**
+ * Load what is known of the samples of the tile's blocks, see
+ * lp_rasterizer_task::msaa_blocks.
+ */
+static void
+lp_rast_msaa_begin_tile(struct lp_rasterizer_task *task)
+{
+   const struct lp_scene *scene = task->scene;
+   const unsigned bw = DIV_ROUND_UP(task->width, 4);
+   const unsigned bh = DIV_ROUND_UP(task->height, 4);
+   unsigned i, bx, by;
+
+   task->msaa_cbufs = 0;
+   for (i = 0; i < scene->fb.nr_cbufs; i++) {
+      const uint8_t *equal = scene->cbufs[i].msaa_equal;
+
+      if (!equal)
+         continue;
+
+      equal += (task->y / 4) * scene->cbufs[i].msaa_equal_stride + task->x / 4;
+      for (by = 0; by < bh; by++) {
+         for (bx = 0; bx < bw; bx++) {
+            task->msaa_blocks[i][by * LP_MSAA_BLOCKS_X + bx] =
+               equal[bx] ? LP_RAST_MSAA_EQUAL : 0;
+         }
+         equal += scene->cbufs[i].msaa_equal_stride;
+      }
+      task->msaa_cbufs |= 1 << i;
+   }
+}
+
+
+/**
+ * Copy sample 0 of count 4x4 blocks of a row of the tile to the other
+ * samples.
+ */
+static void
+lp_rast_msaa_expand(struct lp_rasterizer_task *task, unsigned cbuf,
+                    unsigned bx, unsigned by, unsigned count)
+{
+   const struct lp_scene *scene = task->scene;
+   const unsigned stride = task->cbufs[cbuf].stride;
+   const unsigned bytes = scene->cbufs[cbuf].format_bytes * 4;
+   const uint8_t *src = task->color_tiles[cbuf] + by * 4 * stride + bx * bytes;
+   unsigned s, row;
+
+   for (s = 1; s < scene->cbufs[cbuf].nr_samples; s++) {
+      uint8_t *dst = (uint8_t *)src + s * task->cbufs[cbuf].sample_stride;
+
+      for (row = 0; row < 4; row++)
+         memcpy(dst + row * stride, src + row * stride, count * bytes);
+   }
+   LP_COUNT_ADD(nr_msaa_expanded_blocks, count);
+}
+
+
+/**
+ * Give the tile's blocks whose samples were left stale all of them, and
+ * store which blocks have equal samples in the resources, which resolves
+ * can make use of.
+ */
+static void
+lp_rast_msaa_end_tile(struct lp_rasterizer_task *task)
+{
+   const struct lp_scene *scene = task->scene;
+   const unsigned bw = DIV_ROUND_UP(task->width, 4);
+   const unsigned bh = DIV_ROUND_UP(task->height, 4);
+   unsigned cbufs = task->msaa_cbufs;
+
+   while (cbufs) {
+      const unsigned i = u_bit_scan(&cbufs);
+      uint8_t *equal = scene->cbufs[i].msaa_equal +
+                       (task->y / 4) * scene->cbufs[i].msaa_equal_stride +
+                       task->x / 4;
+      unsigned bx, by;
+
+      for (by = 0; by < bh; by++) {
+         const uint8_t *blocks = &task->msaa_blocks[i][by * LP_MSAA_BLOCKS_X];
+
+         for (bx = 0; bx < bw; ) {
+            unsigned n = 0;
+
+            while (bx + n < bw && (blocks[bx + n] & LP_RAST_MSAA_STALE))
+               n++;
+            if (n) {
+               lp_rast_msaa_expand(task, i, bx, by, n);
+               bx += n;
+            }
+            else {
+               bx++;
+            }
+         }
+         for (bx = 0; bx < bw; bx++)
+            equal[bx] = blocks[bx] & LP_RAST_MSAA_EQUAL;
+         equal += scene->cbufs[i].msaa_equal_stride;
+      }
+   }
+   task->msaa_cbufs = 0;
+}
+
+
+/**
+ * Decide for lp_rast_msaa_shade() whether only sample 0 of the 4x4 block
+ * at x, y is to be shaded: when its samples are equal, or are all going
+ * to be overwritten, and the state shades the samples of each pixel
+ * alike, with the same coverage.  The block's samples are expanded
+ * otherwise.
+ */
+boolean
+lp_rast_msaa_shade_block(struct lp_rasterizer_task *task,
+                         unsigned x, unsigned y, uint64_t *mask)
+{
+   const struct lp_scene *scene = task->scene;
+   const unsigned flags = task->state->msaa_flags;
+   const unsigned lane = lp_rast_mask_sample(mask, 0);
+   const unsigned bx = (x - task->x) / 4, by = (y - task->y) / 4;
+   const unsigned block = by * LP_MSAA_BLOCKS_X + bx;
+   boolean one = (flags & LP_RAST_MSAA_PIXEL_RATE) != 0;
+   unsigned cbufs, s;
+
+   for (s = 1; one && s < scene->fb_max_samples; s++) {
+      if (lp_rast_mask_sample(mask, s) != lane)
+         one = FALSE;
+   }
+
+   cbufs = task->msaa_cbufs;
+   while (one && cbufs) {
+      const unsigned i = u_bit_scan(&cbufs);
+
+      if (!(task->msaa_blocks[i][block] & LP_RAST_MSAA_EQUAL) &&
+          !(lane == 0xffff && (flags & LP_RAST_MSAA_OVERWRITE(i))))
+         one = FALSE;
+   }
+
+   cbufs = task->msaa_cbufs;
+   while (cbufs) {
+      const unsigned i = u_bit_scan(&cbufs);
+      uint8_t *state = &task->msaa_blocks[i][block];
+
+      if (one) {
+         *state = LP_RAST_MSAA_EQUAL | LP_RAST_MSAA_STALE;
+         continue;
+      }
+      if (*state & LP_RAST_MSAA_STALE)
+         lp_rast_msaa_expand(task, i, bx, by, 1);
+      *state = 0;
+   }
+
+   if (one) {
+      lp_rast_mask_all_samples(mask, 1, lane);
+      LP_COUNT(nr_msaa_compressed_blocks);
+   }
+   return one;
+}
+
+
+/**
+ * Find what the bin clears before any command touching the tile's pixels.
+ * Returns the mask of color buffers cleared, and sets zs if all the depth
+ * and stencil bits are.
+ */
+static unsigned
+lp_rast_bin_clears(const struct lp_scene *scene,
+                   const struct cmd_bin *bin,
+                   boolean *zs)
+{
+   const uint64_t full_mask = scene->fb.zsbuf ?
+      util_pack64_mask_z_stencil(scene->fb.zsbuf->format, ~0, ~0) : 0;
+   const struct cmd_block *block;
+   unsigned cbufs = 0;
+   unsigned k;
+
+   *zs = FALSE;
+
+   for (block = bin->head; block; block = block->next) {
+      for (k = 0; k < block->count; k++) {
+         switch (block->cmd[k]) {
+         case LP_RAST_OP_CLEAR_ZSTENCIL:
+            if ((block->arg[k].clear_zstencil.mask & full_mask) == full_mask)
+               *zs = TRUE;
+            break;
+         case LP_RAST_OP_CLEAR_COLOR:
+            cbufs |= 1 << block->arg[k].clear_rb->cbuf;
+            break;
+         case LP_RAST_OP_BEGIN_QUERY:
+         case LP_RAST_OP_END_QUERY:
+         case LP_RAST_OP_SET_STATE:
+         case LP_RAST_OP_PREDICATE:
+            break;
+         default:
+            return cbufs;
+         }
+      }
+   }
+
+   return cbufs;
+}
+
+
+/**
+ * Copy the current tile, all the layers of the bin and samples, between a
+ * buffer of the scene and the task's local storage for it.
+ */
+static void
+lp_rast_copy_local_tile(const struct lp_rasterizer_task *task,
+                        const struct lp_scene_buffer *buf,
+                        const struct lp_rast_tile_buffer *tile,
+                        boolean store)
+{
+   const unsigned row_bytes = task->width * buf->format_bytes;
+   unsigned s, layer, row;
+
+   for (s = 0; s < buf->nr_samples; s++) {
+      for (layer = task->first_layer; layer <= task->last_layer; layer++) {
+         uint8_t *mem = buf->map +
+                        s * buf->sample_stride +
+                        layer * buf->layer_stride +
+                        task->y * buf->stride +
+                        task->x * buf->format_bytes;
+         uint8_t *local = tile->storage +
+                          s * tile->sample_stride +
+                          layer * tile->layer_stride;
+
+         for (row = 0; row < task->height; row++) {
+            if (store)
+               memcpy(mem, local, row_bytes);
+            else
+               memcpy(local, mem, row_bytes);
+            mem += buf->stride;
+            local += tile->stride;
+         }
+      }
+   }
+}
+
+
+/**
+ * Point the tile of a buffer of the scene at the resource, or at the
+ * task's local storage if local, loading it unless cleared is set.
+ * Returns the tile's pointer.  A local tile falls back to the resource
+ * if the storage can't be allocated, or returns NULL if the buffer has
+ * no memory, see lp_scene_begin_rasterization().
+ */
+static uint8_t *
+lp_rast_begin_tile_buffer(struct lp_rasterizer_task *task,
+                          const struct lp_scene_buffer *buf,
+                          struct lp_rast_tile_buffer *tile,
+                          boolean local, boolean cleared)
+{
+   const struct lp_scene *scene = task->scene;
+
+   tile->local = FALSE;
+
+   if (local) {
+      const unsigned stride = scene->tile_size * buf->format_bytes;
+      const unsigned layer_stride = stride * scene->tile_size;
+      const unsigned sample_stride =
+         layer_stride * (scene->fb_max_layer + 1);
+      const size_t size = (size_t) sample_stride * buf->nr_samples;
+
+      if (size > tile->storage_size) {
+         align_free(tile->storage);
+         tile->storage = align_malloc(size, 64);
+         tile->storage_size = tile->storage ? size : 0;
+      }
+
+      if (tile->storage) {
+         tile->stride = stride;
+         tile->layer_stride = layer_stride;
+         tile->sample_stride = sample_stride;
+         tile->local = TRUE;
+         LP_COUNT(nr_tile_local);
+
+         if (!cleared && buf->map) {
+            lp_rast_copy_local_tile(task, buf, tile, FALSE);
+            LP_COUNT(nr_tile_local_load);
+         }
+         return tile->storage;
+      }
+   }
+
+   tile->stride = buf->stride;
+   tile->layer_stride = buf->layer_stride;
+   tile->sample_stride = buf->sample_stride;
+
+   if (!buf->map)
+      return NULL;
+
+   return buf->map + buf->stride * task->y + buf->format_bytes * task->x;
 }
 
 
@@ -91,63 +448,102 @@ lp_rast_end( struct lp_rasterizer *rast )
  * Beginning rasterization of a tile.
  * \param x  window X position of the tile, in pixels
  * \param y  window Y position of the tile, in pixels
+ * \param layer  layer of the bin, with per-layer bins
+ * Returns FALSE if the tile can't be rendered, out of memory.
  */
-static void
+static boolean
 lp_rast_tile_begin(struct lp_rasterizer_task *task,
                    const struct cmd_bin *bin,
-                   int x, int y)
+                   int x, int y, unsigned layer)
 {
    unsigned i;
    struct lp_scene *scene = task->scene;
+   unsigned cleared_cbufs;
+   boolean cleared_zs;
+   boolean local;
 
    LP_DBG(DEBUG_RAST, "%s %d,%d\n", __FUNCTION__, x, y);
 
    task->bin = bin;
-   task->x = x * TILE_SIZE;
-   task->y = y * TILE_SIZE;
-   task->width = TILE_SIZE + x * TILE_SIZE > task->scene->fb.width ?
-                    task->scene->fb.width - x * TILE_SIZE : TILE_SIZE;
-   task->height = TILE_SIZE + y * TILE_SIZE > task->scene->fb.height ?
-                    task->scene->fb.height - y * TILE_SIZE : TILE_SIZE;
+   task->x = x << scene->tile_order;
+   task->y = y << scene->tile_order;
+   task->width = scene->tile_size + task->x > scene->fb.width ?
+                    scene->fb.width - task->x : scene->tile_size;
+   task->height = scene->tile_size + task->y > scene->fb.height ?
+                    scene->fb.height - task->y : scene->tile_size;
+
+   if (scene->num_layer_bins > 1) {
+      task->first_layer = task->last_layer = layer;
+   }
+   else {
+      task->first_layer = 0;
+      task->last_layer = scene->fb_max_layer;
+   }
 
    task->thread_data.vis_counter = 0;
    task->thread_data.ps_invocations = 0;
+   if (scene->had_queries)
+      task->tile_begin_time = os_time_get_nano();
+
+   task->pending_clear_cbufs = 0;
+   task->pending_clear_zsmask = 0;
+   task->pending_clear_zsvalue = 0;
+   task->predicate_skip = FALSE;
+
+   /* Nothing is known about the depth left by earlier scenes */
+   for (i = 0; i < ARRAY_SIZE(task->hiz_zmax); i++)
+      task->hiz_zmax[i] = FLT_MAX;
+
+   lp_rast_msaa_begin_tile(task);
+
+   /* LP_PERF=tile_local leaves layered framebuffers in memory, rather
+    * than move all their layers around.
+    */
+   local = (LP_PERF & PERF_TILE_LOCAL) && scene->fb_max_layer == 0;
+   cleared_cbufs = lp_rast_bin_clears(scene, bin, &cleared_zs);
 
    for (i = 0; i < task->scene->fb.nr_cbufs; i++) {
       if (task->scene->fb.cbufs[i]) {
-         task->color_tiles[i] = scene->cbufs[i].map +
-                                scene->cbufs[i].stride * task->y +
-                                scene->cbufs[i].format_bytes * task->x;
+         task->color_tiles[i] =
+            lp_rast_begin_tile_buffer(task, &scene->cbufs[i], &task->cbufs[i],
+                                      local, (cleared_cbufs >> i) & 1);
+      }
+      else {
+         task->cbufs[i].local = FALSE;
       }
    }
+   task->zsbuf.local = FALSE;
    if (task->scene->fb.zsbuf) {
-      task->depth_tile = scene->zsbuf.map +
-                         scene->zsbuf.stride * task->y +
-                         scene->zsbuf.format_bytes * task->x;
+      /* A zsbuf without memory only lives in the tile */
+      task->depth_tile =
+         lp_rast_begin_tile_buffer(task, &scene->zsbuf, &task->zsbuf,
+                                   local || scene->zsbuf_discard ||
+                                   !scene->zsbuf.map,
+                                   cleared_zs);
+      if (!task->depth_tile)
+         return FALSE;
    }
+
+   return TRUE;
 }
 
 
 /**
- * Clear the rasterizer's current color tile.
- * This is a bin command called during bin processing.
- * Clear commands always clear all bound layers.
+ * Fill the rasterizer's current color tile with a clear value.
+ * Clears always fill all the layers of the bin.
  */
 static void
-lp_rast_clear_color(struct lp_rasterizer_task *task,
-                    const union lp_rast_cmd_arg arg)
+lp_rast_fill_clear_color(struct lp_rasterizer_task *task,
+                         const struct lp_rast_clear_rb *clear_rb)
 {
    const struct lp_scene *scene = task->scene;
-   unsigned cbuf = arg.clear_rb->cbuf;
+   unsigned cbuf = clear_rb->cbuf;
+   unsigned nr_samples = scene->cbufs[cbuf].nr_samples;
    union util_color uc;
    enum pipe_format format;
 
-   /* we never bin clear commands for non-existing buffers */
-   assert(cbuf < scene->fb.nr_cbufs);
-   assert(scene->fb.cbufs[cbuf]);
-
    format = scene->fb.cbufs[cbuf]->format;
-   uc = arg.clear_rb->color_val;
+   uc = clear_rb->color_val;
 
    /*
     * this is pretty rough since we have target format (bunch of bytes...) here.
@@ -156,18 +552,29 @@ lp_rast_clear_color(struct lp_rasterizer_task *task,
    LP_DBG(DEBUG_RAST, "%s clear value (target format %d) raw 0x%x,0x%x,0x%x,0x%x\n",
           __FUNCTION__, format, uc.ui[0], uc.ui[1], uc.ui[2], uc.ui[3]);
 
-   for (unsigned s = 0; s < scene->cbufs[cbuf].nr_samples; s++) {
-      void *map = (char *)scene->cbufs[cbuf].map + scene->cbufs[cbuf].sample_stride * s;
+   /* The other samples are copied from sample 0 at the end of the tile,
+    * unless they were drawn to by then.
+    */
+   if (task->msaa_cbufs & (1 << cbuf)) {
+      memset(task->msaa_blocks[cbuf], LP_RAST_MSAA_EQUAL | LP_RAST_MSAA_STALE,
+             sizeof(task->msaa_blocks[cbuf]));
+      nr_samples = 1;
+   }
+
+   for (unsigned s = 0; s < nr_samples; s++) {
+      void *map = task->color_tiles[cbuf] +
+                  task->cbufs[cbuf].sample_stride * s +
+                  task->cbufs[cbuf].layer_stride * task->first_layer;
       util_fill_box(map,
                     format,
-                    scene->cbufs[cbuf].stride,
-                    scene->cbufs[cbuf].layer_stride,
-                    task->x,
-                    task->y,
+                    task->cbufs[cbuf].stride,
+                    task->cbufs[cbuf].layer_stride,
+                    0,
+                    0,
                     0,
                     task->width,
                     task->height,
-                    scene->fb_max_layer + 1,
+                    task->last_layer - task->first_layer + 1,
                     &uc);
    }
 
@@ -177,22 +584,20 @@ lp_rast_clear_color(struct lp_rasterizer_task *task,
 
 
 /**
- * Clear the rasterizer's current z/stencil tile.
- * This is a bin command called during bin processing.
- * Clear commands always clear all bound layers.
+ * Fill the rasterizer's current z/stencil tile with a clear value.
+ * Clears always fill all the layers of the bin.
  */
 static void
-lp_rast_clear_zstencil(struct lp_rasterizer_task *task,
-                       const union lp_rast_cmd_arg arg)
+lp_rast_fill_clear_zstencil(struct lp_rasterizer_task *task,
+                            uint64_t clear_value64,
+                            uint64_t clear_mask64)
 {
    const struct lp_scene *scene = task->scene;
-   uint64_t clear_value64 = arg.clear_zstencil.value;
-   uint64_t clear_mask64 = arg.clear_zstencil.mask;
    uint32_t clear_value = (uint32_t) clear_value64;
    uint32_t clear_mask = (uint32_t) clear_mask64;
    const unsigned height = task->height;
    const unsigned width = task->width;
-   const unsigned dst_stride = scene->zsbuf.stride;
+   const unsigned dst_stride = task->zsbuf.stride;
    uint8_t *dst;
    unsigned i, j;
    unsigned block_size;
@@ -208,12 +613,14 @@ lp_rast_clear_zstencil(struct lp_rasterizer_task *task,
       unsigned layer;
 
       for (unsigned s = 0; s < scene->zsbuf.nr_samples; s++) {
-         uint8_t *dst_layer = task->depth_tile + (s * scene->zsbuf.sample_stride);
+         uint8_t *dst_layer = task->depth_tile +
+                              s * task->zsbuf.sample_stride +
+                              task->first_layer * task->zsbuf.layer_stride;
          block_size = util_format_get_blocksize(scene->fb.zsbuf->format);
 
          clear_value &= clear_mask;
 
-         for (layer = 0; layer <= scene->fb_max_layer; layer++) {
+         for (layer = task->first_layer; layer <= task->last_layer; layer++) {
             dst = dst_layer;
 
             switch (block_size) {
@@ -227,12 +634,12 @@ lp_rast_clear_zstencil(struct lp_rasterizer_task *task,
                break;
             case 2:
                if (clear_mask == 0xffff) {
-                  for (i = 0; i < height; i++) {
-                     uint16_t *row = (uint16_t *)dst;
-                     for (j = 0; j < width; j++)
-                        *row++ = (uint16_t) clear_value;
-                     dst += dst_stride;
-                  }
+                  /* Fill one row, and copy it to the others. */
+                  uint16_t *row = (uint16_t *)dst;
+                  for (j = 0; j < width; j++)
+                     row[j] = (uint16_t) clear_value;
+                  for (i = 1; i < height; i++)
+                     memcpy(dst + i * dst_stride, row, width * 2);
                }
                else {
                   for (i = 0; i < height; i++) {
@@ -266,12 +673,11 @@ lp_rast_clear_zstencil(struct lp_rasterizer_task *task,
             case 8:
                clear_value64 &= clear_mask64;
                if (clear_mask64 == 0xffffffffffULL) {
-                  for (i = 0; i < height; i++) {
-                     uint64_t *row = (uint64_t *)dst;
-                     for (j = 0; j < width; j++)
-                        *row++ = clear_value64;
-                     dst += dst_stride;
-                  }
+                  uint64_t *row = (uint64_t *)dst;
+                  for (j = 0; j < width; j++)
+                     row[j] = clear_value64;
+                  for (i = 1; i < height; i++)
+                     memcpy(dst + i * dst_stride, row, width * 8);
                }
                else {
                   for (i = 0; i < height; i++) {
@@ -289,13 +695,113 @@ lp_rast_clear_zstencil(struct lp_rasterizer_task *task,
                assert(0);
                break;
             }
-            dst_layer += scene->zsbuf.layer_stride;
+            dst_layer += task->zsbuf.layer_stride;
          }
       }
    }
 }
 
 
+/**
+ * Write out the clears still pending on the current tile.
+ */
+static void
+lp_rast_resolve_clears(struct lp_rasterizer_task *task)
+{
+   while (task->pending_clear_cbufs) {
+      unsigned cbuf = u_bit_scan(&task->pending_clear_cbufs);
+      lp_rast_fill_clear_color(task, task->pending_clear_rb[cbuf]);
+   }
+
+   if (task->pending_clear_zsmask) {
+      lp_rast_fill_clear_zstencil(task, task->pending_clear_zsvalue,
+                                  task->pending_clear_zsmask);
+      task->pending_clear_zsmask = 0;
+      task->pending_clear_zsvalue = 0;
+   }
+}
+
+
+/**
+ * Clear the rasterizer's current color tile.
+ * This is a bin command called during bin processing.
+ *
+ * The clear is only recorded here, and written out by
+ * lp_rast_resolve_clears() before anything else reads or writes the tile,
+ * unless a later opaque full-tile shade overwrites it first.
+ */
+static void
+lp_rast_clear_color(struct lp_rasterizer_task *task,
+                    const union lp_rast_cmd_arg arg)
+{
+   unsigned cbuf = arg.clear_rb->cbuf;
+
+   /* we never bin clear commands for non-existing buffers */
+   assert(cbuf < task->scene->fb.nr_cbufs);
+   assert(task->scene->fb.cbufs[cbuf]);
+
+   task->pending_clear_rb[cbuf] = arg.clear_rb;
+   task->pending_clear_cbufs |= 1 << cbuf;
+}
+
+
+/**
+ * Reset the hierarchical Z bounds of the tile for a depth clear.
+ */
+static void
+lp_rast_hiz_clear(struct lp_rasterizer_task *task,
+                  uint64_t value, uint64_t mask)
+{
+   enum pipe_format format = task->scene->fb.zsbuf->format;
+   uint64_t zmask;
+   float z;
+   unsigned i;
+
+   if (!util_format_has_depth(util_format_description(format)))
+      return;
+
+   zmask = util_pack64_mask_z(format, 0xffffffff);
+   if (!(mask & zmask))
+      return;
+
+   if ((mask & zmask) == zmask) {
+      /* little endian, as the depth buffer */
+      util_format_unpack_z_float(format, &z, &value, 1);
+      z += LP_HIZ_EPSILON;
+   }
+   else {
+      z = FLT_MAX;
+   }
+
+   for (i = 0; i < ARRAY_SIZE(task->hiz_zmax); i++)
+      task->hiz_zmax[i] = z;
+}
+
+
+/**
+ * Clear the rasterizer's current z/stencil tile.
+ * This is a bin command called during bin processing.
+ * As with color, the clear is only recorded, merged with any clear
+ * already pending on the tile.
+ */
+static void
+lp_rast_clear_zstencil(struct lp_rasterizer_task *task,
+                       const union lp_rast_cmd_arg arg)
+{
+   uint64_t value = arg.clear_zstencil.value;
+   uint64_t mask = arg.clear_zstencil.mask;
+
+   if (!task->scene->fb.zsbuf)
+      return;
+
+   task->pending_clear_zsvalue =
+      (task->pending_clear_zsvalue & ~mask) | (value & mask);
+   task->pending_clear_zsmask |= mask;
+
+   lp_rast_hiz_clear(task, value, mask);
+}
+
+
 
 /**
  * Run the shader on all blocks in a tile.  This is used when a tile is
@@ -312,6 +818,7 @@ lp_rast_shade_tile(struct lp_rasterizer_task *task,
    struct lp_fragment_shader_variant *variant;
    const unsigned tile_x = task->x, tile_y = task->y;
    unsigned x, y;
+   unsigned width_8x8 = 0, height_8x8 = 0;
 
    if (inputs->disable) {
       /* This command was partially binned and has been disabled */
@@ -325,11 +832,27 @@ lp_rast_shade_tile(struct lp_rasterizer_task *task,
    if (!state) {
       return;
    }
-   variant = state->variant;
+   variant = lp_rast_task_variant(task);
+
+   if (lp_rast_hiz_reject(task, inputs, tile_x, tile_y, scene->tile_size))
+      return;
+   lp_rast_hiz_shaded(task, inputs, tile_x, tile_y, scene->tile_size, TRUE);
+
+   /* The variant may shade the 8x8 blocks in one call each.  The 4x4
+    * blocks past them at the right and bottom edges are done one by one.
+    * Multisampled tiles choose the function per 4x4 block, and so do
+    * conservative primitives for their inner coverage.
+    */
+   if (variant->jit_function[RAST_WHOLE_8X8] && !task->msaa_cbufs &&
+       !(variant->inner_coverage && inputs->conservative_planes)) {
+      width_8x8 = task->width & ~7;
+      height_8x8 = task->height & ~7;
+   }
 
-   /* render the whole 64x64 tile in 4x4 chunks */
+   /* render the whole tile in 4x4 chunks */
    for (y = 0; y < task->height; y += 4){
       for (x = 0; x < task->width; x += 4) {
+         const boolean in_8x8 = x < width_8x8 && y < height_8x8;
          uint8_t *color[PIPE_MAX_COLOR_BUFS];
          unsigned stride[PIPE_MAX_COLOR_BUFS];
          unsigned sample_stride[PIPE_MAX_COLOR_BUFS];
@@ -338,11 +861,15 @@ lp_rast_shade_tile(struct lp_rasterizer_task *task,
          unsigned depth_sample_stride = 0;
          unsigned i;
 
+         /* The 8x8 block's other 4x4 blocks were done with its first */
+         if (in_8x8 && ((x | y) & 4))
+            continue;
+
          /* color buffer */
          for (i = 0; i < scene->fb.nr_cbufs; i++){
             if (scene->fb.cbufs[i]) {
-               stride[i] = scene->cbufs[i].stride;
-               sample_stride[i] = scene->cbufs[i].sample_stride;
+               stride[i] = task->cbufs[i].stride;
+               sample_stride[i] = task->cbufs[i].sample_stride;
                color[i] = lp_rast_get_color_block_pointer(task, i, tile_x + x,
                                                           tile_y + y, inputs->layer);
             }
@@ -354,36 +881,47 @@ lp_rast_shade_tile(struct lp_rasterizer_task *task,
          }
 
          /* depth buffer */
-         if (scene->zsbuf.map) {
+         if (task->depth_tile) {
             depth = lp_rast_get_depth_block_pointer(task, tile_x + x,
                                                     tile_y + y, inputs->layer);
-            depth_stride = scene->zsbuf.stride;
-            depth_sample_stride = scene->zsbuf.sample_stride;
+            depth_stride = task->zsbuf.stride;
+            depth_sample_stride = task->zsbuf.sample_stride;
          }
 
-         uint64_t mask = 0;
-         for (unsigned i = 0; i < scene->fb_max_samples; i++)
-            mask |= (uint64_t)(0xffff) << (16 * i);
+         uint64_t mask[LP_RAST_MASK_WORDS];
+         unsigned func = RAST_WHOLE;
+         lp_rast_mask_all_samples(mask, scene->fb_max_samples, 0xffff);
+
+         if (in_8x8) {
+            func = RAST_WHOLE_8X8;
+         }
+         else if (lp_rast_msaa_shade(task, tile_x + x, tile_y + y, mask)) {
+            for (i = 0; i < scene->fb.nr_cbufs; i++)
+               sample_stride[i] = 0;
+            func = RAST_EDGE_TEST;
+         }
 
          /* Propagate non-interpolated raster state. */
          task->thread_data.raster_state.viewport_index = inputs->viewport_index;
+         task->thread_data.raster_state.inner_coverage =
+            lp_rast_inner_coverage(variant, inputs, tile_x + x, tile_y + y);
 
          /* run shader on 4x4 block */
          BEGIN_JIT_CALL(state, task);
-         variant->jit_function[RAST_WHOLE]( &state->jit_context,
-                                            tile_x + x, tile_y + y,
-                                            inputs->frontfacing,
-                                            GET_A0(inputs),
-                                            GET_DADX(inputs),
-                                            GET_DADY(inputs),
-                                            color,
-                                            depth,
-                                            mask,
-                                            &task->thread_data,
-                                            stride,
-                                            depth_stride,
-                                            sample_stride,
-                                            depth_sample_stride);
+         variant->jit_function[func]( &state->jit_context,
+                                      tile_x + x, tile_y + y,
+                                      inputs->frontfacing,
+                                      GET_A0(inputs),
+                                      GET_DADX(inputs),
+                                      GET_DADY(inputs),
+                                      color,
+                                      depth,
+                                      mask,
+                                      &task->thread_data,
+                                      stride,
+                                      depth_stride,
+                                      sample_stride,
+                                      depth_sample_stride);
          END_JIT_CALL();
       }
    }
@@ -410,6 +948,60 @@ lp_rast_shade_tile_opaque(struct lp_rasterizer_task *task,
 }
 
 
+/**
+ * Copy the texels of a blit to the whole tile, rather than run the
+ * shader, which would give the same bytes.  The texture formats and
+ * the mapping were checked by fs_variant_is_blit() and lp_setup_blit().
+ * This is a bin command called during bin processing.
+ */
+static void
+lp_rast_blit_tile(struct lp_rasterizer_task *task,
+                  const union lp_rast_cmd_arg arg)
+{
+   const struct lp_scene *scene = task->scene;
+   const struct lp_rast_blit *blit = arg.blit;
+   const struct lp_rast_shader_inputs *inputs = blit->inputs;
+   const struct lp_jit_texture *texture;
+   const unsigned format_bytes = scene->cbufs[0].format_bytes;
+   const unsigned row_bytes = task->width * format_bytes;
+   const uint8_t *src;
+   uint8_t *dst;
+   int row;
+   unsigned y;
+
+   if (inputs->disable) {
+      /* This command was partially binned and has been disabled */
+      return;
+   }
+
+   LP_DBG(DEBUG_RAST, "%s\n", __FUNCTION__);
+
+   assert(task->state);
+   if (!task->state) {
+      return;
+   }
+
+   texture = &task->state->jit_context.textures[0];
+   src = (const uint8_t *)texture->base +
+         texture->mip_offsets[texture->first_level] +
+         (task->x + blit->dx) * format_bytes;
+   dst = lp_rast_get_color_block_pointer(task, 0, task->x, task->y,
+                                         inputs->layer);
+   row = (int)task->y * blit->ystep + blit->dy;
+
+   for (y = 0; y < task->height; y++) {
+      memcpy(dst, src + (ptrdiff_t)row * texture->row_stride[texture->first_level],
+             row_bytes);
+      dst += task->cbufs[0].stride;
+      row += blit->ystep;
+   }
+
+   /* As if the shader ran on each 4x4 block */
+   task->thread_data.ps_invocations +=
+      DIV_ROUND_UP(task->width, 4) * DIV_ROUND_UP(task->height, 4);
+}
+
+
 /**
  * Compute shading for a 4x4 block of pixels inside a triangle.
  * This is a bin command called during bin processing.
@@ -420,10 +1012,10 @@ void
 lp_rast_shade_quads_mask_sample(struct lp_rasterizer_task *task,
                                 const struct lp_rast_shader_inputs *inputs,
                                 unsigned x, unsigned y,
-                                uint64_t mask)
+                                uint64_t *mask)
 {
    const struct lp_rast_state *state = task->state;
-   struct lp_fragment_shader_variant *variant = state->variant;
+   struct lp_fragment_shader_variant *variant = lp_rast_task_variant(task);
    const struct lp_scene *scene = task->scene;
    uint8_t *color[PIPE_MAX_COLOR_BUFS];
    unsigned stride[PIPE_MAX_COLOR_BUFS];
@@ -436,8 +1028,8 @@ lp_rast_shade_quads_mask_sample(struct lp_rasterizer_task *task,
    assert(state);
 
    /* Sanity checks */
-   assert(x < scene->tiles_x * TILE_SIZE);
-   assert(y < scene->tiles_y * TILE_SIZE);
+   assert(x < scene->tiles_x << scene->tile_order);
+   assert(y < scene->tiles_y << scene->tile_order);
    assert(x % TILE_VECTOR_WIDTH == 0);
    assert(y % TILE_VECTOR_HEIGHT == 0);
 
@@ -447,8 +1039,8 @@ lp_rast_shade_quads_mask_sample(struct lp_rasterizer_task *task,
    /* color buffer */
    for (i = 0; i < scene->fb.nr_cbufs; i++) {
       if (scene->fb.cbufs[i]) {
-         stride[i] = scene->cbufs[i].stride;
-         sample_stride[i] = scene->cbufs[i].sample_stride;
+         stride[i] = task->cbufs[i].stride;
+         sample_stride[i] = task->cbufs[i].sample_stride;
          color[i] = lp_rast_get_color_block_pointer(task, i, x, y,
                                                     inputs->layer);
       }
@@ -460,9 +1052,9 @@ lp_rast_shade_quads_mask_sample(struct lp_rasterizer_task *task,
    }
 
    /* depth buffer */
-   if (scene->zsbuf.map) {
-      depth_stride = scene->zsbuf.stride;
-      depth_sample_stride = scene->zsbuf.sample_stride;
+   if (task->depth_tile) {
+      depth_stride = task->zsbuf.stride;
+      depth_sample_stride = task->zsbuf.sample_stride;
       depth = lp_rast_get_depth_block_pointer(task, x, y, inputs->layer);
    }
 
@@ -472,9 +1064,20 @@ lp_rast_shade_quads_mask_sample(struct lp_rasterizer_task *task,
     * The rasterizer may produce fragments outside our
     * allocated 4x4 blocks hence need to filter them out here.
     */
-   if ((x % TILE_SIZE) < task->width && (y % TILE_SIZE) < task->height) {
+   if ((x - task->x) < task->width && (y - task->y) < task->height) {
+      if (lp_rast_hiz_reject(task, inputs, x, y, 4))
+         return;
+      lp_rast_hiz_shaded(task, inputs, x, y, 4, FALSE);
+
+      if (lp_rast_msaa_shade(task, x, y, mask)) {
+         for (i = 0; i < scene->fb.nr_cbufs; i++)
+            sample_stride[i] = 0;
+      }
+
       /* Propagate non-interpolated raster state. */
       task->thread_data.raster_state.viewport_index = inputs->viewport_index;
+      task->thread_data.raster_state.inner_coverage =
+         lp_rast_inner_coverage(variant, inputs, x, y);
 
       /* run shader on 4x4 block */
       BEGIN_JIT_CALL(state, task);
@@ -502,14 +1105,13 @@ lp_rast_shade_quads_mask(struct lp_rasterizer_task *task,
                          unsigned x, unsigned y,
                          unsigned mask)
 {
-   uint64_t new_mask = 0;
-   for (unsigned i = 0; i < task->scene->fb_max_samples; i++)
-      new_mask |= ((uint64_t)mask) << (16 * i);
+   uint64_t new_mask[LP_RAST_MASK_WORDS];
+   lp_rast_mask_all_samples(new_mask, task->scene->fb_max_samples, mask);
    lp_rast_shade_quads_mask_sample(task, inputs, x, y, new_mask);
 }
 
 /**
- * Begin a new occlusion query.
+ * Begin a new occlusion, statistics or timed query.
  * This is a bin command put in all bins.
  * Called per thread.
  */
@@ -528,6 +1130,10 @@ lp_rast_begin_query(struct lp_rasterizer_task *task,
    case PIPE_QUERY_PIPELINE_STATISTICS:
       pq->start[task->thread_index] = task->thread_data.ps_invocations;
       break;
+   case PIPE_QUERY_TIME_ELAPSED:
+   case LP_QUERY_RAST_BUSY:
+      pq->start[task->thread_index] = os_time_get_nano();
+      break;
    default:
       assert(0);
       break;
@@ -545,18 +1151,53 @@ lp_rast_end_query(struct lp_rasterizer_task *task,
                   const union lp_rast_cmd_arg arg)
 {
    struct llvmpipe_query *pq = arg.query_obj;
+   const struct lp_scene *scene = task->scene;
+   uint64_t passed;
 
    switch (pq->type) {
    case PIPE_QUERY_OCCLUSION_COUNTER:
    case PIPE_QUERY_OCCLUSION_PREDICATE:
    case PIPE_QUERY_OCCLUSION_PREDICATE_CONSERVATIVE:
-      pq->end[task->thread_index] +=
-         task->thread_data.vis_counter - pq->start[task->thread_index];
+      passed = task->thread_data.vis_counter - pq->start[task->thread_index];
+      pq->end[task->thread_index] += passed;
       pq->start[task->thread_index] = 0;
+
+      /* The query began and ended in this scene, so this is its result
+       * for the tile, see lp_setup_set_predicate().
+       */
+      if (pq->tiles_x == scene->tiles_x &&
+          pq->tiles_y == scene->tiles_y &&
+          pq->tile_order == scene->tile_order) {
+         pq->tile_visible[(task->y >> scene->tile_order) * pq->tiles_x +
+                          (task->x >> scene->tile_order)] = passed != 0;
+      }
+
+      /* A predicate's result is known once any tile saw a sample pass,
+       * see llvmpipe_get_query_result().
+       */
+      if (passed && pq->type != PIPE_QUERY_OCCLUSION_COUNTER)
+         p_atomic_set(&pq->passed, 1);
       break;
    case PIPE_QUERY_TIMESTAMP:
       pq->end[task->thread_index] = os_time_get_nano();
       break;
+   case PIPE_QUERY_TIME_ELAPSED:
+   case LP_QUERY_RAST_BUSY: {
+      /* Bins of later scenes have no BEGIN_QUERY, they are timed from
+       * the start of the tile.
+       */
+      const unsigned thread = task->thread_index;
+      const uint64_t begin = pq->start[thread] ? pq->start[thread] :
+                                                 task->tile_begin_time;
+      const uint64_t now = os_time_get_nano();
+
+      pq->end[thread] += now - begin;
+      pq->start[thread] = 0;
+      if (!pq->first[thread])
+         pq->first[thread] = begin;
+      pq->last[thread] = now;
+      break;
+   }
    case PIPE_QUERY_PIPELINE_STATISTICS:
       pq->end[task->thread_index] +=
          task->thread_data.ps_invocations - pq->start[task->thread_index];
@@ -569,23 +1210,243 @@ lp_rast_end_query(struct lp_rasterizer_task *task,
 }
 
 
+/**
+ * Shade the 4x4 blocks of the tile which a rectangle covers, with masks
+ * straight from its box rather than from planes.
+ * This is a bin command called during bin processing.
+ */
+static void
+lp_rast_rectangle(struct lp_rasterizer_task *task,
+                  const union lp_rast_cmd_arg arg)
+{
+   const struct lp_rast_rectangle *rect = arg.rectangle;
+   const struct lp_rast_shader_inputs *inputs = &rect->inputs;
+   const int x0 = MAX2(rect->box.x0, (int)task->x);
+   const int y0 = MAX2(rect->box.y0, (int)task->y);
+   const int x1 = MIN2(rect->box.x1, (int)(task->x + task->width) - 1);
+   const int y1 = MIN2(rect->box.y1, (int)(task->y + task->height) - 1);
+   int x, y;
+
+   if (inputs->disable) {
+      /* This command was partially binned and has been disabled */
+      return;
+   }
+
+   for (y = y0 & ~3; y <= y1; y += 4) {
+      /* Bit r*4+c of the masks is row r, column c of the block */
+      const unsigned rows = (0xffff << (4 * MAX2(y0 - y, 0))) &
+                            (0xffff >> (4 * MAX2(y + 3 - y1, 0)));
+
+      for (x = x0 & ~3; x <= x1; x += 4) {
+         const unsigned cols = (0xf << MAX2(x0 - x, 0)) &
+                               (0xf >> MAX2(x + 3 - x1, 0)) & 0xf;
+         const unsigned mask = rows & (cols * 0x1111);
+
+         if (mask == 0xffff) {
+            LP_COUNT(nr_fully_covered_4);
+            lp_rast_shade_quads_all(task, inputs, x, y);
+         }
+         else {
+            LP_COUNT(nr_partially_covered_4);
+            lp_rast_shade_quads_mask(task, inputs, x, y, mask);
+         }
+      }
+   }
+}
+
+
+/**
+ * Average the samples of count pixels of a row of a multisampled color
+ * buffer into the readback buffer.
+ */
+static void
+lp_rast_readback_resolve(struct lp_rasterizer_task *task,
+                         const struct lp_rast_readback *readback,
+                         const uint8_t *src, uint8_t *dst, unsigned count)
+{
+   const struct lp_scene *scene = task->scene;
+   const unsigned nr_samples = scene->cbufs[readback->cbuf].nr_samples;
+   const unsigned sample_stride = task->cbufs[readback->cbuf].sample_stride;
+   const float scale = 1.0f / nr_samples;
+   float sum[TILE_SIZE * 4], row[TILE_SIZE * 4];
+   unsigned s, i;
+
+   assert(count <= TILE_SIZE);
+
+   util_format_unpack_rgba(readback->src_format, sum, src, count);
+   for (s = 1; s < nr_samples; s++) {
+      util_format_unpack_rgba(readback->src_format, row,
+                              src + s * sample_stride, count);
+      for (i = 0; i < count * 4; i++)
+         sum[i] += row[i];
+   }
+   for (i = 0; i < count * 4; i++)
+      sum[i] *= scale;
+   util_format_pack_rgba(readback->dst_format, dst, sum, count);
+}
+
+
+/**
+ * Copy the pixels of the tile inside the readback box to the buffer.
+ * This is a bin command put in the bins the box covers, after the
+ * rendering which it reads back.  Multisampled color buffers are
+ * resolved while their tile is still in cache, with the 4x4 blocks the
+ * rasterizer kept equal copied from sample 0, see
+ * lp_rasterizer_task::msaa_blocks.  Integer formats read sample 0.
+ * Called per thread.
+ */
+static void
+lp_rast_readback(struct lp_rasterizer_task *task,
+                 const union lp_rast_cmd_arg arg)
+{
+   const struct lp_rast_readback *readback = arg.readback;
+   const struct lp_scene *scene = task->scene;
+   const unsigned stride = task->cbufs[readback->cbuf].stride;
+   const unsigned bytes = scene->cbufs[readback->cbuf].format_bytes;
+   const boolean resolve =
+      scene->cbufs[readback->cbuf].nr_samples > 1 &&
+      !util_format_is_pure_integer(readback->src_format) &&
+      !util_format_is_pure_integer(readback->dst_format);
+   const boolean tracked = (task->msaa_cbufs >> readback->cbuf) & 1;
+   const unsigned x0 = MAX2(readback->x, task->x);
+   const unsigned y0 = MAX2(readback->y, task->y);
+   const unsigned x1 = MIN2(readback->x + readback->width,
+                            task->x + task->width);
+   const unsigned y1 = MIN2(readback->y + readback->height,
+                            task->y + task->height);
+   unsigned y;
+
+   /* The colors are only final once the shading pass is done. */
+   if (task->zprepass == LP_RAST_ZPREPASS_DEPTH || x0 >= x1)
+      return;
+
+   for (y = y0; y < y1; y++) {
+      const uint8_t *src = task->color_tiles[readback->cbuf] +
+                           (y - task->y) * stride + (x0 - task->x) * bytes;
+      uint8_t *dst = readback->dst +
+                     (ptrdiff_t)(y - readback->y) * readback->dst_stride +
+                     (x0 - readback->x) * readback->dst_bytes;
+
+      const uint8_t *blocks = &task->msaa_blocks[readback->cbuf]
+                                 [((y - task->y) / 4) * LP_MSAA_BLOCKS_X];
+      unsigned x, n;
+
+      if (!resolve) {
+         util_format_translate(readback->dst_format, dst, 0, 0, 0,
+                               readback->src_format, src, 0, 0, 0,
+                               x1 - x0, 1);
+         continue;
+      }
+
+      /* Runs of pixels in blocks alike */
+      for (x = x0; x < x1; x += n) {
+         const boolean equal = tracked &&
+            (blocks[(x - task->x) / 4] & LP_RAST_MSAA_EQUAL);
+
+         n = MIN2(4 - (x - task->x) % 4, x1 - x);
+         while (x + n < x1 &&
+                (tracked &&
+                 (blocks[(x + n - task->x) / 4] & LP_RAST_MSAA_EQUAL)) == equal)
+            n += MIN2(4, x1 - x - n);
+
+         if (equal) {
+            util_format_translate(readback->dst_format, dst, 0, 0, 0,
+                                  readback->src_format, src, 0, 0, 0,
+                                  n, 1);
+            LP_COUNT_ADD(nr_msaa_resolved_pixels, n);
+         }
+         else {
+            lp_rast_readback_resolve(task, readback, src, dst, n);
+         }
+         src += n * bytes;
+         dst += n * readback->dst_bytes;
+      }
+   }
+}
+
+
 void
 lp_rast_set_state(struct lp_rasterizer_task *task,
                   const union lp_rast_cmd_arg arg)
 {
+   struct lp_fragment_shader_variant *variant;
+
    task->state = arg.state;
+
+   /* The z prepass variants were only binned once compiled. */
+   variant = lp_rast_task_variant(task);
+   if (variant != arg.state->variant)
+      return;
+
+   /* The variant may still be compiling on one of the JIT threads. */
+   if (arg.state->variant) {
+      util_queue_fence_wait(&arg.state->variant->fence);
+
+      if (arg.state->variant->unoptimized)
+         p_atomic_inc(&arg.state->variant->executions);
+   }
 }
 
 
 
+/**
+ * Skip the draws that follow in this tile if the occlusion query's result
+ * for it, which the tile's END_QUERY set, fails the condition.  The draws
+ * are rendered where (result == 0) == condition, as with
+ * llvmpipe_check_render_cond().
+ */
+static void
+lp_rast_predicate(struct lp_rasterizer_task *task,
+                  const union lp_rast_cmd_arg arg)
+{
+   const struct llvmpipe_query *pq = arg.predicate.query;
+   const struct lp_scene *scene = task->scene;
+
+   task->predicate_skip = FALSE;
+
+   if (pq) {
+      const boolean visible =
+         pq->tile_visible[(task->y >> scene->tile_order) * pq->tiles_x +
+                          (task->x >> scene->tile_order)];
+
+      task->predicate_skip = visible == arg.predicate.condition;
+      if (task->predicate_skip)
+         LP_COUNT(nr_predicated_bins);
+   }
+}
+
+
 /**
  * Called when we're done writing to a color tile.
  */
 static void
 lp_rast_tile_end(struct lp_rasterizer_task *task)
 {
+   const struct lp_scene *scene = task->scene;
+   const boolean zs_discard = task->zsbuf.local && scene->zsbuf_discard;
    unsigned i;
 
+   /* Nobody will see the discarded depth/stencil */
+   if (zs_discard) {
+      task->pending_clear_zsmask = 0;
+      task->pending_clear_zsvalue = 0;
+   }
+
+   lp_rast_resolve_clears(task);
+   lp_rast_msaa_end_tile(task);
+
+   for (i = 0; i < scene->fb.nr_cbufs; i++) {
+      if (task->cbufs[i].local) {
+         lp_rast_copy_local_tile(task, &scene->cbufs[i], &task->cbufs[i],
+                                 TRUE);
+         LP_COUNT(nr_tile_local_store);
+      }
+   }
+   if (task->zsbuf.local && !zs_discard) {
+      lp_rast_copy_local_tile(task, &scene->zsbuf, &task->zsbuf, TRUE);
+      LP_COUNT(nr_tile_local_store);
+   }
+
    for (i = 0; i < task->scene->num_active_queries; ++i) {
       lp_rast_end_query(task, lp_rast_arg_query(task->scene->active_queries[i]));
    }
@@ -639,9 +1500,62 @@ static lp_rast_cmd_func dispatch[LP_RAST_OP_MAX] =
    lp_rast_triangle_ms_3_4,
    lp_rast_triangle_ms_3_16,
    lp_rast_triangle_ms_4_16,
+   lp_rast_readback,
+   lp_rast_rectangle,
+   lp_rast_predicate,
+   lp_rast_blit_tile,
+   lp_rast_span,
 };
 
 
+/**
+ * Write out, or drop, the clears pending on the tile before a command
+ * which touches its pixels.
+ */
+static void
+lp_rast_resolve_clears_for_cmd(struct lp_rasterizer_task *task,
+                               unsigned cmd,
+                               const union lp_rast_cmd_arg arg)
+{
+   const struct lp_scene *scene = task->scene;
+
+   switch (cmd) {
+   case LP_RAST_OP_CLEAR_COLOR:
+   case LP_RAST_OP_CLEAR_ZSTENCIL:
+   case LP_RAST_OP_BEGIN_QUERY:
+   case LP_RAST_OP_END_QUERY:
+   case LP_RAST_OP_SET_STATE:
+   case LP_RAST_OP_PREDICATE:
+      /* These don't touch the tile's pixels. */
+      return;
+   case LP_RAST_OP_SHADE_TILE_OPAQUE:
+   case LP_RAST_OP_BLIT_TILE:
+      if ((cmd == LP_RAST_OP_BLIT_TILE ? arg.blit->inputs
+                                       : arg.shade_tile)->disable ||
+          !task->state)
+         return;
+      /* Opaque variants have a single color buffer, write all of its
+       * channels and don't touch depth/stencil, so a pending color clear
+       * would be overwritten.  As with lp_setup_whole_tile(), bins of
+       * several layers and multisampled buffers are left alone.
+       */
+      if (task->first_layer == task->last_layer &&
+          scene->cbufs[0].nr_samples == 1 &&
+          (task->pending_clear_cbufs & 1)) {
+         task->pending_clear_cbufs &= ~1;
+         LP_COUNT(nr_color_tile_clear_elided);
+      }
+      if (!task->pending_clear_cbufs)
+         return;
+      break;
+   default:
+      break;
+   }
+
+   lp_rast_resolve_clears(task);
+}
+
+
 static void
 do_rasterize_bin(struct lp_rasterizer_task *task,
                  const struct cmd_bin *bin,
@@ -655,6 +1569,18 @@ do_rasterize_bin(struct lp_rasterizer_task *task,
 
    for (block = bin->head; block; block = block->next) {
       for (k = 0; k < block->count; k++) {
+         /* Clears only ever start a z prepass bin, and went in the
+          * first pass.
+          */
+         if (task->zprepass == LP_RAST_ZPREPASS_SHADE &&
+             (block->cmd[k] == LP_RAST_OP_CLEAR_COLOR ||
+              block->cmd[k] == LP_RAST_OP_CLEAR_ZSTENCIL))
+            continue;
+         if (task->predicate_skip && lp_rast_op_is_draw(block->cmd[k]))
+            continue;
+         if (task->pending_clear_cbufs || task->pending_clear_zsmask)
+            lp_rast_resolve_clears_for_cmd(task, block->cmd[k],
+                                           block->arg[k]);
          dispatch[block->cmd[k]]( task, block->arg[k] );
       }
    }
@@ -665,29 +1591,57 @@ do_rasterize_bin(struct lp_rasterizer_task *task,
 /**
  * Rasterize commands for a single bin.
  * \param x, y  position of the bin's tile in the framebuffer
+ * \param layer  layer of the bin, see lp_scene::num_layer_bins
  * Must be called between lp_rast_begin() and lp_rast_end().
  * Called per thread.
  */
 static void
 rasterize_bin(struct lp_rasterizer_task *task,
-              const struct cmd_bin *bin, int x, int y )
+              const struct cmd_bin *bin, int x, int y, unsigned layer )
 {
-   lp_rast_tile_begin( task, bin, x, y );
+   int64_t trace_start = lp_trace_begin();
 
-   do_rasterize_bin(task, bin, x, y);
+   if (!lp_rast_tile_begin( task, bin, x, y, layer )) {
+      /* Out of memory: the bin is dropped, but the tile still ends its
+       * queries.
+       */
+      debug_warn_once("llvmpipe: out of memory for a depth/stencil tile");
+   }
+   else if (task->scene->z_prepass) {
+      /* Lay down the depth first, so that only the visible fragments
+       * get shaded.
+       */
+      task->zprepass = LP_RAST_ZPREPASS_DEPTH;
+      do_rasterize_bin(task, bin, x, y);
+      task->zprepass = LP_RAST_ZPREPASS_SHADE;
+      do_rasterize_bin(task, bin, x, y);
+      task->zprepass = 0;
+      LP_COUNT(nr_zprepass_bins);
+   }
+   else {
+      do_rasterize_bin(task, bin, x, y);
+   }
 
    lp_rast_tile_end(task);
 
-#ifdef DEBUG
    /* Debug/Perf flags:
     */
-   if (bin->head->count == 1) {
+   if (unlikely(lp_counters_enabled) && bin->head->count == 1) {
       if (bin->head->cmd[0] == LP_RAST_OP_SHADE_TILE_OPAQUE)
          LP_COUNT(nr_pure_shade_opaque_64);
       else if (bin->head->cmd[0] == LP_RAST_OP_SHADE_TILE)
          LP_COUNT(nr_pure_shade_64);
    }
-#endif
+
+   if (unlikely(trace_start)) {
+      const struct cmd_block *block;
+      unsigned num_cmds = 0;
+
+      for (block = bin->head; block; block = block->next)
+         num_cmds += block->count;
+      lp_trace_span("rasterize_bin", trace_start, "x,y,cmds",
+                    x, y, num_cmds);
+   }
 }
 
 
@@ -717,47 +1671,42 @@ rasterize_scene(struct lp_rasterizer_task *task,
 
    /* Clear the cache tags. This should not always be necessary but
       simpler for now. */
-#if LP_USE_TEXTURE_CACHE
-   memset(task->thread_data.cache->cache_tags, 0,
-          sizeof(task->thread_data.cache->cache_tags));
-#if LP_BUILD_FORMAT_CACHE_DEBUG
-   task->thread_data.cache->cache_access_total = 0;
-   task->thread_data.cache->cache_access_miss = 0;
-#endif
-#endif
+   if (task->thread_data.cache)
+      lp_build_format_cache_reset(task->thread_data.cache);
 
    if (!task->rast->no_rast) {
       /* loop over scene bins, rasterize each */
       {
          struct cmd_bin *bin;
          int i, j;
+         unsigned layer;
 
          assert(scene);
-         while ((bin = lp_scene_bin_iter_next(scene, &i, &j))) {
-            if (!is_empty_bin( bin ))
-               rasterize_bin(task, bin, i, j);
-         }
-      }
-   }
+         if (unlikely(lp_counters_enabled)) {
+            int64_t scene_t0 = os_time_get();
 
+            while ((bin = lp_scene_bin_iter_next(scene, &i, &j, &layer))) {
+               if (!is_empty_bin( bin )) {
+                  int64_t bin_t0 = os_time_get_nano();
 
-#if LP_BUILD_FORMAT_CACHE_DEBUG
-   {
-      uint64_t total, miss;
-      total = task->thread_data.cache->cache_access_total;
-      miss = task->thread_data.cache->cache_access_miss;
-      if (total) {
-         debug_printf("thread %d cache access %llu miss %llu hit rate %f\n",
-                 task->thread_index, (long long unsigned)total,
-                 (long long unsigned)miss,
-                 (float)(total - miss)/(float)total);
+                  rasterize_bin(task, bin, i, j, layer);
+                  LP_COUNT(nr_rast_bins);
+                  LP_COUNT_ADD(rast_bin_time, os_time_get_nano() - bin_t0);
+               }
+               lp_scene_bin_done(scene, j);
+            }
+            LP_COUNT_ADD(scene_rast_time, os_time_get() - scene_t0);
+         }
+         else {
+            while ((bin = lp_scene_bin_iter_next(scene, &i, &j, &layer))) {
+               if (!is_empty_bin( bin ))
+                  rasterize_bin(task, bin, i, j, layer);
+               lp_scene_bin_done(scene, j);
+            }
+         }
       }
    }
-#endif
 
-   if (scene->fence) {
-      lp_fence_signal(scene->fence);
-   }
 
    task->scene = NULL;
 }
@@ -788,48 +1737,51 @@ lp_rast_queue_scene( struct lp_rasterizer *rast,
       lp_rast_end( rast );
 
       util_fpstate_set(fpstate);
-
-      rast->curr_scene = NULL;
    }
    else {
       /* threaded rendering! */
-      unsigned i;
+      scene->queue_time = unlikely(lp_counters_enabled) ?
+                          os_time_get_nano() : 0;
 
       lp_scene_enqueue( rast->full_scenes, scene );
 
-      /* signal the threads that there's work to do */
-      for (i = 0; i < rast->num_threads; i++) {
-         pipe_semaphore_signal(&rast->tasks[i].work_ready);
-      }
+      /* thread 0 wakes the others the scene needs */
+      pipe_semaphore_signal(&rast->tasks[0].work_ready);
    }
 
    LP_DBG(DEBUG_SETUP, "%s done \n", __FUNCTION__);
 }
 
 
-void
-lp_rast_finish( struct lp_rasterizer *rast )
+/**
+ * How many threads rasterize the scene: no more than it has bins, nor
+ * than one per LP_RAST_CMDS_PER_THREAD commands, so that small scenes
+ * don't wake threads just for them to find no bins left.
+ */
+static unsigned
+lp_rast_scene_threads(const struct lp_rasterizer *rast,
+                      const struct lp_scene *scene)
 {
-   if (rast->num_threads == 0) {
-      /* nothing to do */
-   }
-   else {
-      int i;
+   unsigned num_threads = MIN2(rast->num_threads, scene->num_active_bins);
 
-      /* wait for work to complete */
-      for (i = 0; i < rast->num_threads; i++) {
-         pipe_semaphore_wait(&rast->tasks[i].work_done);
-      }
-   }
+   /* num_cmds may be ~0, so rounding up can't add to it */
+   num_threads = MIN2(num_threads,
+                      scene->num_cmds / LP_RAST_CMDS_PER_THREAD +
+                      (scene->num_cmds % LP_RAST_CMDS_PER_THREAD != 0));
+   num_threads = MAX2(num_threads, 1);
+
+   LP_COUNT_ADD(rast_scene_threads, num_threads);
+
+   return num_threads;
 }
 
 
 /**
  * This is the thread's main entrypoint.
  * It's a simple loop:
- *   1. wait for work
+ *   1. wait for work (thread 0 wakes the others the scene needs)
  *   2. do work
- *   3. signal that we're done
+ *   3. signal the scene's fence (thread 0 only)
  */
 static int
 thread_function(void *init_data)
@@ -839,6 +1791,7 @@ thread_function(void *init_data)
    boolean debug = false;
    char thread_name[16];
    unsigned fpstate;
+   unsigned i;
 
    snprintf(thread_name, sizeof thread_name, "llvmpipe-%u", task->thread_index);
    u_thread_setname(thread_name);
@@ -853,6 +1806,8 @@ thread_function(void *init_data)
       /* wait for work */
       if (debug)
          debug_printf("thread %d waiting for work\n", task->thread_index);
+      if (lp_spin_wait(&task->work_ready.counter, 1, rast->spin_wait_ns))
+         LP_COUNT(nr_rast_spin_wakeups);
       pipe_semaphore_wait(&task->work_ready);
 
       if (rast->exit_flag)
@@ -863,14 +1818,23 @@ thread_function(void *init_data)
           *  - get next scene to rasterize
           *  - map the framebuffer surfaces
           */
-         lp_rast_begin( rast, 
-                        lp_scene_dequeue( rast->full_scenes, TRUE ) );
-      }
+         struct lp_scene *scene = lp_scene_dequeue( rast->full_scenes, TRUE );
 
-      /* Wait for all threads to get here so that threads[1+] don't
-       * get a null rast->curr_scene pointer.
-       */
-      util_barrier_wait( &rast->barrier );
+         /* From queueing to this thread dequeueing, once per scene */
+         LP_COUNT(nr_rast_wakeups);
+         if (unlikely(lp_counters_enabled) && scene->queue_time)
+            LP_COUNT_ADD(rast_wakeup_time,
+                         os_time_get_nano() - scene->queue_time);
+
+         lp_rast_begin( rast, scene );
+
+         /* Only now, so that threads[1+] don't get a null
+          * rast->curr_scene pointer.
+          */
+         rast->curr_threads = lp_rast_scene_threads(rast, scene);
+         for (i = 1; i < rast->curr_threads; i++)
+            pipe_semaphore_signal(&rast->tasks[i].work_ready);
+      }
 
       /* do work */
       if (debug)
@@ -878,21 +1842,25 @@ thread_function(void *init_data)
 
       rasterize_scene(task,
                       rast->curr_scene);
-      
-      /* wait for all threads to finish with this scene */
-      util_barrier_wait( &rast->barrier );
 
-      /* XXX: shouldn't be necessary:
+      /* thread[0]:
+       *  - wait for the other threads to finish with this scene
+       *  - unmap the framebuffer surfaces
+       *  - signal the scene's fence
        */
       if (task->thread_index == 0) {
+         lp_spin_wait(&rast->scene_done.counter, rast->curr_threads - 1,
+                      rast->spin_wait_ns);
+         for (i = 1; i < rast->curr_threads; i++)
+            pipe_semaphore_wait(&rast->scene_done);
          lp_rast_end( rast );
       }
+      else {
+         pipe_semaphore_signal(&rast->scene_done);
+      }
 
-      /* signal done with work */
       if (debug)
          debug_printf("thread %d done working\n", task->thread_index);
-
-      pipe_semaphore_signal(&task->work_done);
    }
 
 #ifdef _WIN32
@@ -907,7 +1875,8 @@ thread_function(void *init_data)
  * Initialize semaphores and spawn the threads.
  */
 static void
-create_rast_threads(struct lp_rasterizer *rast)
+create_rast_threads(struct lp_rasterizer *rast,
+                    enum lp_thread_affinity affinity)
 {
    unsigned i;
 
@@ -922,6 +1891,9 @@ create_rast_threads(struct lp_rasterizer *rast)
          break;
       }
    }
+
+   for (i = 0; i < rast->num_threads; i++)
+      lp_pin_thread(rast->threads[i], affinity, i, rast->num_threads);
 }
 
 
@@ -930,9 +1902,14 @@ create_rast_threads(struct lp_rasterizer *rast)
  * Create new lp_rasterizer.  If num_threads is zero, don't create any
  * new threads, do rendering synchronously.
  * \param num_threads  number of rasterizer threads to create
+ * \param affinity  how to place the threads on the CPU cores
+ * \param spin_wait_ns  how long idle threads spin before sleeping
  */
 struct lp_rasterizer *
-lp_rast_create( unsigned num_threads )
+lp_rast_create( unsigned num_threads,
+                enum lp_thread_affinity affinity,
+                unsigned spin_wait_ns,
+                unsigned tex_cache_size )
 {
    struct lp_rasterizer *rast;
    unsigned i;
@@ -942,6 +1919,18 @@ lp_rast_create( unsigned num_threads )
       goto no_rast;
    }
 
+   rast->tasks = CALLOC(MAX2(1, num_threads), sizeof(*rast->tasks));
+   if (!rast->tasks) {
+      goto no_tasks;
+   }
+
+   if (num_threads) {
+      rast->threads = CALLOC(num_threads, sizeof(*rast->threads));
+      if (!rast->threads) {
+         goto no_threads;
+      }
+   }
+
    rast->full_scenes = lp_scene_queue_create();
    if (!rast->full_scenes) {
       goto no_full_scenes;
@@ -951,37 +1940,38 @@ lp_rast_create( unsigned num_threads )
       struct lp_rasterizer_task *task = &rast->tasks[i];
       task->rast = rast;
       task->thread_index = i;
-      task->thread_data.cache = align_malloc(sizeof(struct lp_build_format_cache),
-                                             16);
-      if (!task->thread_data.cache) {
-         goto no_thread_data_cache;
+      if (tex_cache_size) {
+         task->thread_data.cache = lp_build_format_cache_create(tex_cache_size);
+         if (!task->thread_data.cache) {
+            goto no_thread_data_cache;
+         }
       }
    }
 
    rast->num_threads = num_threads;
+   rast->spin_wait_ns = spin_wait_ns;
 
    rast->no_rast = debug_get_bool_option("LP_NO_RAST", FALSE);
 
-   create_rast_threads(rast);
+   pipe_semaphore_init(&rast->scene_done, 0);
 
-   /* for synchronizing rasterization threads */
-   if (rast->num_threads > 0) {
-      util_barrier_init( &rast->barrier, rast->num_threads );
-   }
+   create_rast_threads(rast, affinity);
 
    memset(lp_dummy_tile, 0, sizeof lp_dummy_tile);
 
    return rast;
 
 no_thread_data_cache:
-   for (i = 0; i < MAX2(1, rast->num_threads); i++) {
-      if (rast->tasks[i].thread_data.cache) {
-         align_free(rast->tasks[i].thread_data.cache);
-      }
+   for (i = 0; i < MAX2(1, num_threads); i++) {
+      lp_build_format_cache_destroy(rast->tasks[i].thread_data.cache);
    }
 
    lp_scene_queue_destroy(rast->full_scenes);
 no_full_scenes:
+   FREE(rast->threads);
+no_threads:
+   FREE(rast->tasks);
+no_tasks:
    FREE(rast);
 no_rast:
    return NULL;
@@ -992,7 +1982,7 @@ no_rast:
  */
 void lp_rast_destroy( struct lp_rasterizer *rast )
 {
-   unsigned i;
+   unsigned i, j;
 
    /* Set exit_flag and signal each thread's work_ready semaphore.
     * Each thread will be woken up, notice that the exit_flag is set and
@@ -1020,16 +2010,27 @@ void lp_rast_destroy( struct lp_rasterizer *rast )
       pipe_semaphore_destroy(&rast->tasks[i].work_done);
    }
    for (i = 0; i < MAX2(1, rast->num_threads); i++) {
-      align_free(rast->tasks[i].thread_data.cache);
+      struct lp_build_format_cache *cache = rast->tasks[i].thread_data.cache;
+
+      if (cache && (LP_DEBUG & DEBUG_CACHE_STATS)) {
+         uint64_t total = cache->cache_access_total;
+         uint64_t miss = cache->cache_access_miss;
+         printf("texture block cache: thread %u: texels = %" PRIu64
+                ", block misses = %" PRIu64 ", hit rate = %.1f%%\n", i,
+                total, miss, total ? 100.0 * (total - miss) / total : 0.0);
+      }
+      lp_build_format_cache_destroy(cache);
+      for (j = 0; j < PIPE_MAX_COLOR_BUFS; j++)
+         align_free(rast->tasks[i].cbufs[j].storage);
+      align_free(rast->tasks[i].zsbuf.storage);
    }
 
-   /* for synchronizing rasterization threads */
-   if (rast->num_threads > 0) {
-      util_barrier_destroy( &rast->barrier );
-   }
+   pipe_semaphore_destroy(&rast->scene_done);
 
    lp_scene_queue_destroy(rast->full_scenes);
 
+   FREE(rast->threads);
+   FREE(rast->tasks);
    FREE(rast);
 }
 
@@ -39,7 +39,9 @@
 
 #include "pipe/p_compiler.h"
 #include "util/u_pack_color.h"
+#include "util/u_rect.h"
 #include "lp_jit.h"
+#include "lp_limits.h"
 
 
 struct lp_rasterizer;
@@ -72,7 +74,18 @@ struct cmd_bin;
 
 struct lp_rasterizer_task;
 
+/**
+ * Words of the coverage of a 4x4 block given to the fragment shaders, a
+ * 16 bit mask per sample, sample s in bits 16 * (s % 4) of word s / 4.
+ */
+#define LP_RAST_MASK_WORDS (LP_MAX_SAMPLES / 4)
+
 extern const float lp_sample_pos_4x[4][2];
+extern const float lp_sample_pos_8x[8][2];
+extern const float lp_sample_pos_16x[16][2];
+
+const float *
+lp_sample_pos(unsigned nr_samples);
 
 /**
  * Rasterization state.
@@ -89,9 +102,44 @@ struct lp_rast_state {
     * the tile color/z/stencil data somehow
      */
    struct lp_fragment_shader_variant *variant;
+
+   /** LP_RAST_HIZ_x, what the state allows hierarchical Z to do */
+   unsigned hiz_flags;
+
+   /** LP_RAST_MSAA_x, how the shaded samples of a pixel compare */
+   unsigned msaa_flags;
+
+   /**
+    * Z prepass, see LP_Z_PREPASS: the depth-only variant and the variant
+    * with an equal depth test which replace the variant in the first and
+    * second pass over the bin.  NULL if the state doesn't allow it.
+    */
+   struct lp_fragment_shader_variant *zprepass_variant[2];
 };
 
 
+/** Pass over the bin of a scene with z_prepass set, or 0 */
+#define LP_RAST_ZPREPASS_DEPTH  1
+#define LP_RAST_ZPREPASS_SHADE  2
+
+
+/** Skip blocks whose depth bound the triangle is entirely behind */
+#define LP_RAST_HIZ_TEST        (1 << 0)
+/** Fully covered blocks end up no farther than the triangle */
+#define LP_RAST_HIZ_UPDATE      (1 << 1)
+/** Shaded blocks may end up farther, so their bound is lost */
+#define LP_RAST_HIZ_INVALIDATE  (1 << 2)
+
+
+/**
+ * The covered samples of a pixel all end up with the same colors, when
+ * they were equal before, so only one of them needs to be shaded
+ */
+#define LP_RAST_MSAA_PIXEL_RATE     (1 << 0)
+/** ... and fully covered pixels of color buffer i whatever they were */
+#define LP_RAST_MSAA_OVERWRITE(i)   (1 << (1 + (i)))
+
+
 /**
  * Coefficients necessary to run the shader at a given location.
  * First coefficient is position.
@@ -101,7 +149,8 @@ struct lp_rast_shader_inputs {
    unsigned frontfacing:1;      /** True for front-facing */
    unsigned disable:1;          /** Partially binned, disable this command */
    unsigned opaque:1;           /** Is opaque */
-   unsigned pad0:29;            /* wasted space */
+   unsigned conservative_planes:3; /** Leading planes moved out, see lp_setup_conservative_planes() */
+   unsigned pad0:26;            /* wasted space */
    unsigned stride;             /* how much to advance data between a0, dadx, dady */
    unsigned layer;              /* the layer to render to (from gs, already clamped) */
    unsigned viewport_index;     /* the active viewport index (from gs, already clamped) */
@@ -144,21 +193,86 @@ struct lp_rast_triangle {
 };
 
 
+/**
+ * An axis-aligned rectangle of pixels, as points and axis-aligned lines
+ * cover, with the inputs to run the shader.  Rasterizing it needs no
+ * planes, see lp_setup_bin_rectangle().
+ */
+struct lp_rast_rectangle {
+   /** Pixels covered, inclusive, within the draw region */
+   struct u_rect box;
+
+   /* inputs for the shader, followed by a0, dadx and dady */
+   struct lp_rast_shader_inputs inputs;
+};
+
+
+/**
+ * A primitive covering whole tiles whose texels the blit shader maps 1:1
+ * to pixels, see lp_setup_blit(): tile pixel (x, y) gets texel
+ * (x + dx, y * ystep + dy) of texture 0.
+ */
+struct lp_rast_blit {
+   const struct lp_rast_shader_inputs *inputs;
+   int dx;
+   int dy;
+   int ystep;   /**< 1, or -1 for textures upside down */
+};
+
+
+/**
+ * A primitive whose pixels within the box lp_rast_span() shades, as set
+ * up by lp_setup_span().  Colors are 255 times the value at the box's
+ * first pixel, and steps, in 16.16 fixed point, in r, g, b, a order.
+ * Texels are mapped like those of blits.
+ */
+struct lp_rast_span {
+   const struct lp_rast_shader_inputs *inputs;
+   struct u_rect box;
+   int32_t color[4];
+   int32_t dcdx[4];
+   int32_t dcdy[4];
+   int dx;
+   int dy;
+   int ystep;
+};
+
+
 struct lp_rast_clear_rb {
    union util_color color_val;
    unsigned cbuf;
 };
 
 
+/**
+ * Copy of a box of a color buffer into a buffer or texture, resolving
+ * multisampled ones, see lp_setup_readback().
+ */
+struct lp_rast_readback {
+   unsigned cbuf;
+   enum pipe_format src_format;
+   unsigned x, y, width, height;   /**< in the framebuffer */
+
+   enum pipe_format dst_format;
+   unsigned dst_bytes;             /**< per pixel */
+   uint8_t *dst;                   /**< where pixel (x, y) goes */
+   int dst_stride;                 /**< negative to flip the rows */
+};
+
+
 #define GET_A0(inputs) ((float (*)[4])((inputs)+1))
 #define GET_DADX(inputs) ((float (*)[4])((char *)((inputs) + 1) + (inputs)->stride))
 #define GET_DADY(inputs) ((float (*)[4])((char *)((inputs) + 1) + 2 * (inputs)->stride))
 #define GET_PLANES(tri) ((struct lp_rast_plane *)((char *)(&(tri)->inputs + 1) + 3 * (tri)->inputs.stride))
+#define GET_INPUTS_PLANES(inputs) ((const struct lp_rast_plane *)((const char *)((inputs) + 1) + 3 * (inputs)->stride))
 
 
 
 struct lp_rasterizer *
-lp_rast_create( unsigned num_threads );
+lp_rast_create( unsigned num_threads,
+                enum lp_thread_affinity affinity,
+                unsigned spin_wait_ns,
+                unsigned tex_cache_size );
 
 void
 lp_rast_destroy( struct lp_rasterizer * );
@@ -167,9 +281,6 @@ void
 lp_rast_queue_scene( struct lp_rasterizer *rast,
                      struct lp_scene *scene );
 
-void
-lp_rast_finish( struct lp_rasterizer *rast );
-
 
 union lp_rast_cmd_arg {
    const struct lp_rast_shader_inputs *shade_tile;
@@ -177,8 +288,12 @@ union lp_rast_cmd_arg {
       const struct lp_rast_triangle *tri;
       unsigned plane_mask;
    } triangle;
+   const struct lp_rast_rectangle *rectangle;
+   const struct lp_rast_blit *blit;
+   const struct lp_rast_span *span;
    const struct lp_rast_state *set_state;
    const struct lp_rast_clear_rb *clear_rb;
+   const struct lp_rast_readback *readback;
    struct {
       uint64_t value;
       uint64_t mask;
@@ -186,6 +301,10 @@ union lp_rast_cmd_arg {
    const struct lp_rast_state *state;
    struct lp_fence *fence;
    struct llvmpipe_query *query_obj;
+   struct {
+      const struct llvmpipe_query *query;  /**< NULL: not predicated */
+      boolean condition;
+   } predicate;
 };
 
 
@@ -225,6 +344,40 @@ lp_rast_arg_triangle_contained( const struct lp_rast_triangle *triangle,
    return arg;
 }
 
+static inline union lp_rast_cmd_arg
+lp_rast_arg_rectangle( const struct lp_rast_rectangle *rectangle )
+{
+   union lp_rast_cmd_arg arg;
+   arg.rectangle = rectangle;
+   return arg;
+}
+
+static inline union lp_rast_cmd_arg
+lp_rast_arg_blit( const struct lp_rast_blit *blit )
+{
+   union lp_rast_cmd_arg arg;
+   arg.blit = blit;
+   return arg;
+}
+
+static inline union lp_rast_cmd_arg
+lp_rast_arg_span( const struct lp_rast_span *span )
+{
+   union lp_rast_cmd_arg arg;
+   arg.span = span;
+   return arg;
+}
+
+static inline union lp_rast_cmd_arg
+lp_rast_arg_predicate( const struct llvmpipe_query *query,
+                       boolean condition )
+{
+   union lp_rast_cmd_arg arg;
+   arg.predicate.query = query;
+   arg.predicate.condition = condition;
+   return arg;
+}
+
 static inline union lp_rast_cmd_arg
 lp_rast_arg_state( const struct lp_rast_state *state )
 {
@@ -315,9 +468,53 @@ lp_rast_arg_null( void )
 #define LP_RAST_OP_MS_TRIANGLE_3_4   0x25
 #define LP_RAST_OP_MS_TRIANGLE_3_16  0x26
 #define LP_RAST_OP_MS_TRIANGLE_4_16  0x27
-#define LP_RAST_OP_MAX               0x28
+#define LP_RAST_OP_READBACK          0x28
+#define LP_RAST_OP_RECTANGLE         0x29
+#define LP_RAST_OP_PREDICATE         0x2a
+#define LP_RAST_OP_BLIT_TILE         0x2b
+#define LP_RAST_OP_SPAN              0x2c
+#define LP_RAST_OP_MAX               0x2d
 #define LP_RAST_OP_MASK              0xff
 
+/** Whether a command may write the color buffers */
+static inline boolean
+lp_rast_op_writes_color(unsigned cmd)
+{
+   switch (cmd & LP_RAST_OP_MASK) {
+   case LP_RAST_OP_CLEAR_ZSTENCIL:
+   case LP_RAST_OP_BEGIN_QUERY:
+   case LP_RAST_OP_END_QUERY:
+   case LP_RAST_OP_SET_STATE:
+   case LP_RAST_OP_READBACK:
+   case LP_RAST_OP_PREDICATE:
+      return FALSE;
+   default:
+      return TRUE;
+   }
+}
+
+/**
+ * Whether a command belongs to a draw, and so is skipped in the tiles
+ * where the predicate set by LP_RAST_OP_PREDICATE fails.  Clears and
+ * readbacks check the render condition when they're binned.
+ */
+static inline boolean
+lp_rast_op_is_draw(unsigned cmd)
+{
+   switch (cmd & LP_RAST_OP_MASK) {
+   case LP_RAST_OP_CLEAR_COLOR:
+   case LP_RAST_OP_CLEAR_ZSTENCIL:
+   case LP_RAST_OP_BEGIN_QUERY:
+   case LP_RAST_OP_END_QUERY:
+   case LP_RAST_OP_SET_STATE:
+   case LP_RAST_OP_READBACK:
+   case LP_RAST_OP_PREDICATE:
+      return FALSE;
+   default:
+      return TRUE;
+   }
+}
+
 void
 lp_debug_bins( struct lp_scene *scene );
 void
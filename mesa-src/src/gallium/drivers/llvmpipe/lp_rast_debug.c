@@ -54,6 +54,22 @@ static const char *cmd_names[LP_RAST_OP_MAX] =
    "triangle_32_3_4",
    "triangle_32_3_16",
    "triangle_32_4_16",
+   "triangle_ms_1",
+   "triangle_ms_2",
+   "triangle_ms_3",
+   "triangle_ms_4",
+   "triangle_ms_5",
+   "triangle_ms_6",
+   "triangle_ms_7",
+   "triangle_ms_8",
+   "triangle_ms_3_4",
+   "triangle_ms_3_16",
+   "triangle_ms_4_16",
+   "readback",
+   "rectangle",
+   "predicate",
+   "blit_tile",
+   "span",
 };
 
 static const char *cmd_name(unsigned cmd)
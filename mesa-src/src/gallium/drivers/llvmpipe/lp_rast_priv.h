@@ -28,7 +28,9 @@
 #ifndef LP_RAST_PRIV_H
 #define LP_RAST_PRIV_H
 
+#include <float.h>
 #include "util/format/u_format.h"
+#include "util/u_math.h"
 #include "util/u_thread.h"
 #include "gallivm/lp_bld_debug.h"
 #include "lp_memory.h"
@@ -37,11 +39,30 @@
 #include "lp_state.h"
 #include "lp_texture.h"
 #include "lp_limits.h"
+#include "lp_perf.h"
 
 
 #define TILE_VECTOR_HEIGHT 4
 #define TILE_VECTOR_WIDTH 4
 
+/** Hierarchical Z keeps one depth bound per 16x16 block of a tile */
+#define LP_HIZ_BLOCK_ORDER 4
+#define LP_HIZ_BLOCKS_X (TILE_SIZE >> LP_HIZ_BLOCK_ORDER)
+
+/**
+ * Slack for comparing triangle depths with the bounds, more than half a
+ * Z16 step, which also covers the rounding of the shader's depth.
+ */
+#define LP_HIZ_EPSILON (1.0f / (1 << 15))
+
+/** Commands of a scene worth waking one more rasterizer thread for */
+#define LP_RAST_CMDS_PER_THREAD 4
+
+/** What is known of the samples of each 4x4 block of a tile */
+#define LP_MSAA_BLOCKS_X (TILE_SIZE / 4)
+#define LP_RAST_MSAA_EQUAL  (1 << 0)  /**< all samples are equal */
+#define LP_RAST_MSAA_STALE  (1 << 1)  /**< only sample 0 is written */
+
 /* If we crash in a jitted function, we can examine jit_line and jit_state
  * to get some info.  This is not thread-safe, however.
  */
@@ -76,6 +97,26 @@ extern const struct lp_rasterizer_task *jit_task;
 struct lp_rasterizer;
 struct cmd_bin;
 
+/**
+ * Where a task's tile of a framebuffer buffer is: in the resource, or in
+ * the task's own storage.  The tile is local with LP_PERF=tile_local, for
+ * a smaller stride than the resource's, and for a depth/stencil buffer the
+ * scene discards, see lp_scene::zsbuf_discard.  A local tile is loaded at
+ * tile begin, unless the bin clears it first, and stored back at tile end
+ * unless discarded.
+ */
+struct lp_rast_tile_buffer
+{
+   unsigned stride;
+   unsigned layer_stride;
+   unsigned sample_stride;
+   boolean local;
+
+   uint8_t *storage;
+   size_t storage_size;
+};
+
+
 /**
  * Per-thread rasterization state
  */
@@ -88,9 +129,28 @@ struct lp_rasterizer_task
    unsigned x, y;          /**< Pos of this tile in framebuffer, in pixels */
    unsigned width, height; /**< width, height of current tile, in pixels */
 
+   /**
+    * Layers of the framebuffer the current bin covers: its own with
+    * per-layer bins, see lp_scene::num_layer_bins, otherwise all of them.
+    */
+   unsigned first_layer, last_layer;
+
    uint8_t *color_tiles[PIPE_MAX_COLOR_BUFS];
    uint8_t *depth_tile;
 
+   /** Layout and tile-local storage of color_tiles[] and depth_tile */
+   struct lp_rast_tile_buffer cbufs[PIPE_MAX_COLOR_BUFS];
+   struct lp_rast_tile_buffer zsbuf;
+
+   /**
+    * Clears binned for the current tile and not yet written out, see
+    * lp_rast_resolve_clears().
+    */
+   unsigned pending_clear_cbufs;
+   const struct lp_rast_clear_rb *pending_clear_rb[PIPE_MAX_COLOR_BUFS];
+   uint64_t pending_clear_zsvalue;
+   uint64_t pending_clear_zsmask;
+
    /** "back" pointer */
    struct lp_rasterizer *rast;
 
@@ -100,15 +160,42 @@ struct lp_rasterizer_task
    /** Non-interpolated passthru state and occlude counter for visible pixels */
    struct lp_jit_thread_data thread_data;
 
+   /** When the tile began, if the scene has queries, for timed queries */
+   uint64_t tile_begin_time;
+
+   /**
+    * Hierarchical Z: per 16x16 block of the tile, an upper bound of the
+    * depth values of layer 0, or FLT_MAX if unknown.  Only set by depth
+    * clears, and tightened by triangles fully covering blocks, while the
+    * depth func is LESS or LEQUAL.
+    */
+   float hiz_zmax[LP_HIZ_BLOCKS_X * LP_HIZ_BLOCKS_X];
+
+   /** LP_RAST_ZPREPASS_x of the current pass over the bin, or 0 */
+   unsigned zprepass;
+
+   /** The predicate last set in the bin fails: skip its draws */
+   boolean predicate_skip;
+
+   /**
+    * Multisampled color buffers with lp_scene::cbufs[].msaa_equal, and
+    * LP_RAST_MSAA_x per 4x4 block of the tile for them.  Blocks whose
+    * samples are equal, and stay so, only get sample 0 shaded; the other
+    * samples are copied from it once they may differ, or at the end of
+    * the tile, see lp_rast_msaa_shade().
+    */
+   unsigned msaa_cbufs;
+   uint8_t msaa_blocks[PIPE_MAX_COLOR_BUFS][LP_MSAA_BLOCKS_X * LP_MSAA_BLOCKS_X];
+
    pipe_semaphore work_ready;
-   pipe_semaphore work_done;
+   pipe_semaphore work_done;  /**< only used for thread exit on Windows */
 };
 
 
 /**
  * This is the state required while rasterizing tiles.
  * Note that this contains per-thread information too.
- * The tile size is TILE_SIZE x TILE_SIZE pixels.
+ * The tile size is (1 << lp_scene::tile_order) pixels square.
  */
 struct lp_rasterizer
 {
@@ -121,30 +208,93 @@ struct lp_rasterizer
    /** The scene currently being rasterized by the threads */
    struct lp_scene *curr_scene;
 
-   /** A task object for each rasterization thread */
-   struct lp_rasterizer_task tasks[LP_MAX_THREADS];
+   /** A task object for each rasterization thread, MAX2(1, num_threads) */
+   struct lp_rasterizer_task *tasks;
 
    unsigned num_threads;
-   thrd_t threads[LP_MAX_THREADS];
+   thrd_t *threads;
+
+   /** How long idle threads spin before sleeping, see LP_SPIN_WAIT */
+   unsigned spin_wait_ns;
 
-   /** For synchronizing the rasterization threads */
-   util_barrier barrier;
+   /**
+    * Threads rasterizing the current scene, 0 to curr_threads - 1, see
+    * lp_rast_scene_threads().  The others signal scene_done to thread 0
+    * once they are done with the bins.
+    */
+   unsigned curr_threads;
+   pipe_semaphore scene_done;
 };
 
+/** The coverage of sample s in mask, see LP_RAST_MASK_WORDS */
+static inline unsigned
+lp_rast_mask_sample(const uint64_t *mask, unsigned s)
+{
+   return (mask[s / 4] >> (16 * (s % 4))) & 0xffff;
+}
+
+/** Give all nr_samples samples in mask the coverage lane */
+static inline void
+lp_rast_mask_all_samples(uint64_t *mask, unsigned nr_samples, unsigned lane)
+{
+   unsigned s;
+
+   memset(mask, 0, LP_RAST_MASK_WORDS * sizeof *mask);
+   for (s = 0; s < nr_samples; s++)
+      mask[s / 4] |= (uint64_t)lane << (16 * (s % 4));
+}
+
+unsigned
+lp_rast_inner_mask(const struct lp_rast_shader_inputs *inputs, int x, int y);
+
+/**
+ * The pixels of the 4x4 block at x, y the primitive of inputs fully
+ * covers, for the sample mask input of variants with inner coverage.  Only
+ * conservatively rasterized primitives are told apart from their coverage.
+ */
+static inline unsigned
+lp_rast_inner_coverage(const struct lp_fragment_shader_variant *variant,
+                       const struct lp_rast_shader_inputs *inputs,
+                       int x, int y)
+{
+   if (!variant->inner_coverage || !inputs->conservative_planes)
+      return 0xffff;
+   return lp_rast_inner_mask(inputs, x, y);
+}
+
 void
 lp_rast_shade_quads_mask_sample(struct lp_rasterizer_task *task,
                                 const struct lp_rast_shader_inputs *inputs,
                                 unsigned x, unsigned y,
-                                uint64_t mask);
+                                uint64_t *mask);
 void
 lp_rast_shade_quads_mask(struct lp_rasterizer_task *task,
                          const struct lp_rast_shader_inputs *inputs,
                          unsigned x, unsigned y,
                          unsigned mask);
 
+boolean
+lp_rast_msaa_shade_block(struct lp_rasterizer_task *task,
+                         unsigned x, unsigned y, uint64_t *mask);
+
+
+/**
+ * Whether only sample 0 of the 4x4 block at x, y is to be shaded, with
+ * the edge test variant, the sample strides set to 0 and mask reduced to
+ * sample 0's coverage.  Otherwise all its samples are up to date.
+ */
+static inline boolean
+lp_rast_msaa_shade(struct lp_rasterizer_task *task,
+                   unsigned x, unsigned y, uint64_t *mask)
+{
+   if (!task->msaa_cbufs)
+      return FALSE;
+   return lp_rast_msaa_shade_block(task, x, y, mask);
+}
+
 
 /**
- * Get the pointer to a 4x4 color block (within a 64x64 tile).
+ * Get the pointer to a 4x4 color block (within a tile).
  * \param x, y location of 4x4 block in window coords
  */
 static inline uint8_t *
@@ -155,8 +305,8 @@ lp_rast_get_color_block_pointer(struct lp_rasterizer_task *task,
    unsigned px, py, pixel_offset;
    uint8_t *color;
 
-   assert(x < task->scene->tiles_x * TILE_SIZE);
-   assert(y < task->scene->tiles_y * TILE_SIZE);
+   assert(x < task->scene->tiles_x << task->scene->tile_order);
+   assert(y < task->scene->tiles_y << task->scene->tile_order);
    assert((x % TILE_VECTOR_WIDTH) == 0);
    assert((y % TILE_VECTOR_HEIGHT) == 0);
    assert(buf < task->scene->fb.nr_cbufs);
@@ -166,17 +316,17 @@ lp_rast_get_color_block_pointer(struct lp_rasterizer_task *task,
    /*
     * We don't actually benefit from having per tile cbuf/zsbuf pointers,
     * it's just extra work - the mul/add would be exactly the same anyway.
-    * Fortunately the extra work (modulo) here is very cheap at least...
+    * Fortunately the extra work (subtraction) here is very cheap at least...
     */
-   px = x % TILE_SIZE;
-   py = y % TILE_SIZE;
+   px = x - task->x;
+   py = y - task->y;
 
    pixel_offset = px * task->scene->cbufs[buf].format_bytes +
-                  py * task->scene->cbufs[buf].stride;
+                  py * task->cbufs[buf].stride;
    color = task->color_tiles[buf] + pixel_offset;
 
    if (layer) {
-      color += layer * task->scene->cbufs[buf].layer_stride;
+      color += layer * task->cbufs[buf].layer_stride;
    }
 
    assert(lp_check_alignment(color, llvmpipe_get_format_alignment(task->scene->fb.cbufs[buf]->format)));
@@ -185,7 +335,7 @@ lp_rast_get_color_block_pointer(struct lp_rasterizer_task *task,
 
 
 /**
- * Get the pointer to a 4x4 depth block (within a 64x64 tile).
+ * Get the pointer to a 4x4 depth block (within a tile).
  * \param x, y location of 4x4 block in window coords
  */
 static inline uint8_t *
@@ -195,22 +345,22 @@ lp_rast_get_depth_block_pointer(struct lp_rasterizer_task *task,
    unsigned px, py, pixel_offset;
    uint8_t *depth;
 
-   assert(x < task->scene->tiles_x * TILE_SIZE);
-   assert(y < task->scene->tiles_y * TILE_SIZE);
+   assert(x < task->scene->tiles_x << task->scene->tile_order);
+   assert(y < task->scene->tiles_y << task->scene->tile_order);
    assert((x % TILE_VECTOR_WIDTH) == 0);
    assert((y % TILE_VECTOR_HEIGHT) == 0);
 
    assert(task->depth_tile);
 
-   px = x % TILE_SIZE;
-   py = y % TILE_SIZE;
+   px = x - task->x;
+   py = y - task->y;
 
    pixel_offset = px * task->scene->zsbuf.format_bytes +
-                  py * task->scene->zsbuf.stride;
+                  py * task->zsbuf.stride;
    depth = task->depth_tile + pixel_offset;
 
    if (layer) {
-      depth += layer * task->scene->zsbuf.layer_stride;
+      depth += layer * task->zsbuf.layer_stride;
    }
 
    assert(lp_check_alignment(depth, llvmpipe_get_format_alignment(task->scene->fb.zsbuf->format)));
@@ -218,6 +368,141 @@ lp_rast_get_depth_block_pointer(struct lp_rasterizer_task *task,
 }
 
 
+/**
+ * The fs variant to run for the current state in the current pass.
+ */
+static inline struct lp_fragment_shader_variant *
+lp_rast_task_variant(const struct lp_rasterizer_task *task)
+{
+   if (task->zprepass)
+      return task->state->zprepass_variant[task->zprepass - 1];
+   return task->state->variant;
+}
+
+
+
+/**
+ * Range of the triangle's depth plane over a size x size square at x, y,
+ * with a pixel of slack around it for pixel centers and sample positions,
+ * plus the error of evaluating the plane.
+ */
+static inline void
+lp_rast_hiz_tri_range(const struct lp_rast_shader_inputs *inputs,
+                      int x, int y, unsigned size,
+                      float *zmin, float *zmax)
+{
+   const float a0 = GET_A0(inputs)[0][2];
+   const float dzdx = GET_DADX(inputs)[0][2];
+   const float dzdy = GET_DADY(inputs)[0][2];
+   const float x0 = dzdx * (float)(x - 1);
+   const float y0 = dzdy * (float)(y - 1);
+   const float ex = dzdx * (float)(size + 2);
+   const float ey = dzdy * (float)(size + 2);
+   const float z = a0 + x0 + y0;
+   const float err = (fabsf(a0) + fabsf(x0) + fabsf(y0) +
+                      fabsf(ex) + fabsf(ey)) * (1.0f / (1 << 20)) +
+                     LP_HIZ_EPSILON;
+
+   *zmin = z + MIN2(ex, 0.0f) + MIN2(ey, 0.0f) - err;
+   *zmax = z + MAX2(ex, 0.0f) + MAX2(ey, 0.0f) + err;
+}
+
+
+/**
+ * The 16x16 blocks of the tile a size x size square at x, y touches.
+ */
+static inline void
+lp_rast_hiz_blocks(const struct lp_rasterizer_task *task,
+                   int x, int y, unsigned size,
+                   unsigned *bx0, unsigned *by0,
+                   unsigned *bx1, unsigned *by1)
+{
+   const int tile_size = task->scene->tile_size;
+   const int rx = x - (int)task->x, ry = y - (int)task->y;
+
+   *bx0 = MAX2(rx, 0) >> LP_HIZ_BLOCK_ORDER;
+   *by0 = MAX2(ry, 0) >> LP_HIZ_BLOCK_ORDER;
+   *bx1 = MIN2(rx + (int)size - 1, tile_size - 1) >> LP_HIZ_BLOCK_ORDER;
+   *by1 = MIN2(ry + (int)size - 1, tile_size - 1) >> LP_HIZ_BLOCK_ORDER;
+}
+
+
+/**
+ * Whether the triangle is entirely behind the depth bounds of the blocks
+ * a size x size square at x, y touches (so every fragment there would
+ * fail the depth test), and its shading can be skipped.
+ */
+static inline boolean
+lp_rast_hiz_reject(struct lp_rasterizer_task *task,
+                   const struct lp_rast_shader_inputs *inputs,
+                   int x, int y, unsigned size)
+{
+   unsigned bx0, by0, bx1, by1, bx, by;
+   float zmin, zmax, bound = 0.0f;
+
+   if (!(task->state->hiz_flags & LP_RAST_HIZ_TEST) || inputs->layer != 0)
+      return FALSE;
+
+   lp_rast_hiz_blocks(task, x, y, size, &bx0, &by0, &bx1, &by1);
+   for (by = by0; by <= by1; by++)
+      for (bx = bx0; bx <= bx1; bx++)
+         bound = MAX2(bound, task->hiz_zmax[by * LP_HIZ_BLOCKS_X + bx]);
+
+   lp_rast_hiz_tri_range(inputs, x, y, size, &zmin, &zmax);
+   if (zmin <= bound)
+      return FALSE;
+
+   if (size >= TILE_SIZE / 2)
+      LP_COUNT(nr_hiz_rejected_64);
+   else if (size == 16)
+      LP_COUNT(nr_hiz_rejected_16);
+   else
+      LP_COUNT(nr_hiz_rejected_4);
+   LP_COUNT_ADD(nr_hiz_rejected_pixels, size * size);
+   return TRUE;
+}
+
+
+/**
+ * Account for shading a size x size square at x, y.  If it is fully
+ * covered, its blocks end up no farther than the triangle.
+ */
+static inline void
+lp_rast_hiz_shaded(struct lp_rasterizer_task *task,
+                   const struct lp_rast_shader_inputs *inputs,
+                   int x, int y, unsigned size,
+                   boolean covered)
+{
+   const unsigned flags = task->state->hiz_flags;
+   unsigned bx0, by0, bx1, by1, bx, by;
+   float zmin, zmax;
+
+   if (inputs->layer != 0 ||
+       !(flags & (LP_RAST_HIZ_INVALIDATE | LP_RAST_HIZ_UPDATE)))
+      return;
+
+   if (flags & LP_RAST_HIZ_INVALIDATE) {
+      lp_rast_hiz_blocks(task, x, y, size, &bx0, &by0, &bx1, &by1);
+      for (by = by0; by <= by1; by++)
+         for (bx = bx0; bx <= bx1; bx++)
+            task->hiz_zmax[by * LP_HIZ_BLOCKS_X + bx] = FLT_MAX;
+      return;
+   }
+
+   /* Only blocks entirely inside the square */
+   if (!covered || (x - task->x) % 16 || (y - task->y) % 16 || size < 16)
+      return;
+
+   lp_rast_hiz_tri_range(inputs, x, y, size, &zmin, &zmax);
+   lp_rast_hiz_blocks(task, x, y, size, &bx0, &by0, &bx1, &by1);
+   for (by = by0; by <= by1; by++) {
+      for (bx = bx0; bx <= bx1; bx++) {
+         float *bound = &task->hiz_zmax[by * LP_HIZ_BLOCKS_X + bx];
+         *bound = MIN2(*bound, zmax);
+      }
+   }
+}
+
 
 /**
  * Shade all pixels in a 4x4 block.  The fragment code omits the
@@ -231,7 +516,7 @@ lp_rast_shade_quads_all( struct lp_rasterizer_task *task,
 {
    const struct lp_scene *scene = task->scene;
    const struct lp_rast_state *state = task->state;
-   struct lp_fragment_shader_variant *variant = state->variant;
+   struct lp_fragment_shader_variant *variant = lp_rast_task_variant(task);
    uint8_t *color[PIPE_MAX_COLOR_BUFS];
    unsigned stride[PIPE_MAX_COLOR_BUFS];
    unsigned sample_stride[PIPE_MAX_COLOR_BUFS];
@@ -243,8 +528,8 @@ lp_rast_shade_quads_all( struct lp_rasterizer_task *task,
    /* color buffer */
    for (i = 0; i < scene->fb.nr_cbufs; i++) {
       if (scene->fb.cbufs[i]) {
-         stride[i] = scene->cbufs[i].stride;
-         sample_stride[i] = scene->cbufs[i].sample_stride;
+         stride[i] = task->cbufs[i].stride;
+         sample_stride[i] = task->cbufs[i].sample_stride;
          color[i] = lp_rast_get_color_block_pointer(task, i, x, y,
                                                     inputs->layer);
       }
@@ -255,44 +540,58 @@ lp_rast_shade_quads_all( struct lp_rasterizer_task *task,
       }
    }
 
-   if (scene->zsbuf.map) {
+   if (task->depth_tile) {
       depth = lp_rast_get_depth_block_pointer(task, x, y, inputs->layer);
-      depth_sample_stride = scene->zsbuf.sample_stride;
-      depth_stride = scene->zsbuf.stride;
+      depth_sample_stride = task->zsbuf.sample_stride;
+      depth_stride = task->zsbuf.stride;
    }
 
-   uint64_t mask = 0;
-   for (unsigned i = 0; i < scene->fb_max_samples; i++)
-      mask |= (uint64_t)0xffff << (16 * i);
+   uint64_t mask[LP_RAST_MASK_WORDS];
+   lp_rast_mask_all_samples(mask, scene->fb_max_samples, 0xffff);
 
    /*
     * The rasterizer may produce fragments outside our
     * allocated 4x4 blocks hence need to filter them out here.
     */
-   if ((x % TILE_SIZE) < task->width && (y % TILE_SIZE) < task->height) {
+   if ((x - task->x) < task->width && (y - task->y) < task->height) {
+      unsigned func = RAST_WHOLE;
+
+      lp_rast_hiz_shaded(task, inputs, x, y, 4, TRUE);
+
+      if (lp_rast_msaa_shade(task, x, y, mask)) {
+         for (i = 0; i < scene->fb.nr_cbufs; i++)
+            sample_stride[i] = 0;
+         func = RAST_EDGE_TEST;
+      }
+
       /* Propagate non-interpolated raster state. */
       task->thread_data.raster_state.viewport_index = inputs->viewport_index;
+      task->thread_data.raster_state.inner_coverage =
+         lp_rast_inner_coverage(variant, inputs, x, y);
 
       /* run shader on 4x4 block */
       BEGIN_JIT_CALL(state, task);
-      variant->jit_function[RAST_WHOLE]( &state->jit_context,
-                                         x, y,
-                                         inputs->frontfacing,
-                                         GET_A0(inputs),
-                                         GET_DADX(inputs),
-                                         GET_DADY(inputs),
-                                         color,
-                                         depth,
-                                         mask,
-                                         &task->thread_data,
-                                         stride,
-                                         depth_stride,
-                                         sample_stride,
-                                         depth_sample_stride);
+      variant->jit_function[func]( &state->jit_context,
+                                   x, y,
+                                   inputs->frontfacing,
+                                   GET_A0(inputs),
+                                   GET_DADX(inputs),
+                                   GET_DADY(inputs),
+                                   color,
+                                   depth,
+                                   mask,
+                                   &task->thread_data,
+                                   stride,
+                                   depth_stride,
+                                   sample_stride,
+                                   depth_sample_stride);
       END_JIT_CALL();
    }
 }
 
+void lp_rast_span(struct lp_rasterizer_task *,
+                  const union lp_rast_cmd_arg);
+
 void lp_rast_triangle_1( struct lp_rasterizer_task *, 
                          const union lp_rast_cmd_arg );
 void lp_rast_triangle_2( struct lp_rasterizer_task *, 
@@ -0,0 +1,196 @@
+/*
+ * Copyright © 2026 Mesa contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+/*
+ * Shading of simple 2D draws in spans of 8-bit pixels, see LP_SPANS.
+ *
+ * Solid fills, gradients and textures mapped 1:1 to pixels need none of
+ * the fragment shader's float math: the colors are interpolated in 16.16
+ * fixed point along each row, or the texels are read directly, and
+ * blended with 8-bit multiplies.
+ */
+
+#include "util/u_math.h"
+#include "lp_debug.h"
+#include "lp_perf.h"
+#include "lp_rast_priv.h"
+#include "lp_state_fs.h"
+
+
+/** a * b / 255, rounded, as the fragment shader's blending does */
+static inline unsigned
+mul8(unsigned a, unsigned b)
+{
+   const unsigned t = a * b + 0x80;
+   return (t + (t >> 8)) >> 8;
+}
+
+
+static inline unsigned
+span_factor(enum lp_fs_span_factor factor, unsigned src_alpha)
+{
+   switch (factor) {
+   case LP_FS_SPAN_ZERO:
+      return 0;
+   case LP_FS_SPAN_ONE:
+      return 255;
+   case LP_FS_SPAN_SRC_ALPHA:
+      return src_alpha;
+   default:
+      return 255 - src_alpha;
+   }
+}
+
+
+/** A 16.16 fixed point color channel as 8 bits, clamped */
+static inline unsigned
+span_channel(int32_t value)
+{
+   return value < 0 ? 0 : MIN2(value >> 16, 255);
+}
+
+
+/**
+ * Blend the row's source colors, in r, g, b, a order, into the pixels,
+ * or just write them if no blending is needed.
+ */
+static void
+span_write(const struct lp_fs_span_state *state,
+           uint8_t (*src)[4], uint8_t *dst, unsigned count)
+{
+   const uint8_t *chan = state->dst_chan;
+   const boolean copy = state->factor[0] == LP_FS_SPAN_ONE &&
+                        state->factor[1] == LP_FS_SPAN_ZERO &&
+                        state->factor[2] == LP_FS_SPAN_ONE &&
+                        state->factor[3] == LP_FS_SPAN_ZERO;
+   unsigned i, c;
+
+   if (copy) {
+      for (i = 0; i < count; i++, dst += 4) {
+         for (c = 0; c < 4; c++)
+            dst[chan[c]] = src[i][c];
+      }
+      return;
+   }
+
+   for (i = 0; i < count; i++, dst += 4) {
+      const unsigned sa = src[i][3];
+
+      for (c = 0; c < 4; c++) {
+         const unsigned f = c < 3 ? 0 : 2;
+         const unsigned value =
+            mul8(src[i][c], span_factor(state->factor[f], sa)) +
+            mul8(dst[chan[c]], span_factor(state->factor[f + 1], sa));
+
+         dst[chan[c]] = MIN2(value, 255);
+      }
+   }
+}
+
+
+/**
+ * Shade the pixels of the tile within the span's box.
+ * This is a bin command called during bin processing.
+ */
+void
+lp_rast_span(struct lp_rasterizer_task *task,
+             const union lp_rast_cmd_arg arg)
+{
+   const struct lp_rast_span *span = arg.span;
+   const struct lp_rast_shader_inputs *inputs = span->inputs;
+   const struct lp_fs_span_state *state;
+   const int x0 = MAX2(span->box.x0, (int)task->x);
+   const int y0 = MAX2(span->box.y0, (int)task->y);
+   const int x1 = MIN2(span->box.x1, (int)(task->x + task->width) - 1);
+   const int y1 = MIN2(span->box.y1, (int)(task->y + task->height) - 1);
+   const unsigned count = x1 - x0 + 1;
+   uint8_t src[TILE_SIZE][4];
+   uint8_t *dst;
+   int x, y;
+   unsigned c;
+
+   if (inputs->disable) {
+      /* This command was partially binned and has been disabled */
+      return;
+   }
+
+   LP_DBG(DEBUG_RAST, "%s\n", __FUNCTION__);
+
+   assert(task->state);
+   if (!task->state || x0 > x1 || y0 > y1) {
+      return;
+   }
+
+   state = &task->state->variant->span;
+   assert(state->kind != LP_FS_SPAN_NONE);
+   assert(count <= TILE_SIZE);
+
+   dst = task->color_tiles[0] +
+         (x0 - (int)task->x) * 4 +
+         (y0 - (int)task->y) * task->cbufs[0].stride +
+         inputs->layer * task->cbufs[0].layer_stride;
+
+   for (y = y0; y <= y1; y++, dst += task->cbufs[0].stride) {
+      if (state->kind == LP_FS_SPAN_TEXTURE) {
+         const struct lp_jit_texture *texture =
+            &task->state->jit_context.textures[0];
+         const unsigned level = texture->first_level;
+         const uint8_t *texel = (const uint8_t *)texture->base +
+            texture->mip_offsets[level] +
+            (ptrdiff_t)(y * span->ystep + span->dy) *
+            texture->row_stride[level] +
+            (x0 + span->dx) * 4;
+
+         for (x = 0; x < (int)count; x++, texel += 4) {
+            for (c = 0; c < 4; c++) {
+               src[x][c] = state->src_chan[c] < 4 ?
+                           texel[state->src_chan[c]] : 255;
+            }
+         }
+      }
+      else {
+         int32_t value[4];
+
+         for (c = 0; c < 4; c++) {
+            value[c] = (int32_t)(span->color[c] +
+                                 (int64_t)span->dcdx[c] * (x0 - span->box.x0) +
+                                 (int64_t)span->dcdy[c] * (y - span->box.y0));
+         }
+
+         for (x = 0; x < (int)count; x++) {
+            for (c = 0; c < 4; c++) {
+               src[x][c] = span_channel(value[c]);
+               value[c] += span->dcdx[c];
+            }
+         }
+      }
+
+      span_write(state, src, dst, count);
+   }
+
+   /* As if the shader ran on each 4x4 block */
+   task->thread_data.ps_invocations +=
+      ((x1 >> 2) - (x0 >> 2) + 1) * ((y1 >> 2) - (y0 >> 2) + 1);
+}
@@ -58,9 +58,43 @@ block_full_16(struct lp_rasterizer_task *task,
    unsigned ix, iy;
    assert(x % 16 == 0);
    assert(y % 16 == 0);
+   if (lp_rast_hiz_reject(task, &tri->inputs, x, y, 16))
+      return;
    for (iy = 0; iy < 16; iy += 4)
       for (ix = 0; ix < 16; ix += 4)
 	 block_full_4(task, tri, x + ix, y + iy);
+   lp_rast_hiz_shaded(task, &tri->inputs, x, y, 16, TRUE);
+}
+
+
+/**
+ * The pixels of the 4x4 block at x, y which the conservatively rasterized
+ * primitive of inputs fully covers.  Its edge planes were moved out by half
+ * a pixel diagonal plus the dilation, see lp_setup_conservative_planes():
+ * moved back in by a whole diagonal, the pixel centers inside them are
+ * those of the pixels inside the dilated primitive.
+ */
+unsigned
+lp_rast_inner_mask(const struct lp_rast_shader_inputs *inputs, int x, int y)
+{
+   const struct lp_rast_plane *plane = GET_INPUTS_PLANES(inputs);
+   unsigned mask = 0xffff;
+   unsigned i, ix, iy;
+
+   for (i = 0; i < inputs->conservative_planes; i++) {
+      const int64_t dcdx = plane[i].dcdx, dcdy = plane[i].dcdy;
+      const int64_t d = (dcdx < 0 ? -dcdx : dcdx) + (dcdy < 0 ? -dcdy : dcdy);
+      const int64_t c = plane[i].c + dcdy * y - dcdx * x - d;
+
+      for (iy = 0; iy < 4; iy++) {
+         for (ix = 0; ix < 4; ix++) {
+            if (c + dcdy * iy - dcdx * ix <= 0)
+               mask &= ~(1 << (iy * 4 + ix));
+         }
+      }
+   }
+
+   return mask;
 }
 
 static inline unsigned
@@ -164,6 +198,11 @@ lp_rast_triangle_ms_4_16(struct lp_rasterizer_task *task,
 
 #include <emmintrin.h>
 #include "util/u_sse.h"
+#if defined(PIPE_ARCH_X86_64) && defined(PIPE_CC_GCC)
+#include <immintrin.h>
+#include "util/u_cpu_detect.h"
+#define LP_RAST_HAVE_AVX2
+#endif
 
 
 static inline void
@@ -262,6 +301,143 @@ sign_bits4(const __m128i *cstep, int cdiff)
 }
 
 
+#if defined(LP_RAST_HAVE_AVX2)
+
+/**
+ * Per-plane state for evaluating the three edges of a 32-bit triangle
+ * over 4x4 blocks with 8-wide vectors: span holds the offsets of rows 0
+ * and 1 of a block, dcdy2 the step from those to rows 2 and 3.
+ */
+struct tri_32_3_avx2 {
+   __m256i span[3];
+   __m256i dcdy2[3];
+   int32_t c[3];
+   int32_t dcdx[3];
+   int32_t dcdy[3];
+   int32_t rej[3];
+};
+
+__attribute__((target("avx2")))
+static inline void
+tri_32_3_avx2_init(struct tri_32_3_avx2 *t,
+                   const struct lp_rast_plane *plane,
+                   int x, int y)
+{
+   unsigned p;
+
+   for (p = 0; p < 3; p++) {
+      const int32_t dcdx = -plane[p].dcdx;
+      const int32_t dcdy = plane[p].dcdy;
+
+      t->span[p] = _mm256_setr_epi32(0, dcdx, dcdx * 2, dcdx * 3,
+                                     dcdy, dcdy + dcdx,
+                                     dcdy + dcdx * 2, dcdy + dcdx * 3);
+      t->dcdy2[p] = _mm256_set1_epi32(dcdy * 2);
+      t->dcdx[p] = dcdx * 4;
+      t->dcdy[p] = dcdy * 4;
+
+      /* As the SSE path, the position terms may wrap, only the value
+       * within the tile has to fit in 32 bits. Subtract one so the sign
+       * bit gives the < 0 test.
+       */
+      t->c[p] = (int32_t)((uint32_t)plane[p].c +
+                          (uint32_t)dcdx * x +
+                          (uint32_t)dcdy * y - 1);
+      t->rej[p] = (int32_t)(plane[p].eo << 2) + 1;
+   }
+}
+
+/**
+ * Mask of the pixels of the 4x4 block at c that are outside any of the
+ * three planes, in the same layout as the SSE pack / movemask version.
+ */
+__attribute__((target("avx2")))
+static inline unsigned
+tri_32_3_avx2_block(const struct tri_32_3_avx2 *t, const int32_t *c)
+{
+   __m256i c_01 = _mm256_setzero_si256();
+   __m256i c_23 = _mm256_setzero_si256();
+   unsigned p;
+
+   for (p = 0; p < 3; p++) {
+      __m256i cp_01 = _mm256_add_epi32(_mm256_set1_epi32(c[p]), t->span[p]);
+      __m256i cp_23 = _mm256_add_epi32(cp_01, t->dcdy2[p]);
+
+      c_01 = _mm256_or_si256(c_01, cp_01);
+      c_23 = _mm256_or_si256(c_23, cp_23);
+   }
+
+   return _mm256_movemask_ps(_mm256_castsi256_ps(c_01)) |
+          (_mm256_movemask_ps(_mm256_castsi256_ps(c_23)) << 8);
+}
+
+__attribute__((target("avx2")))
+static void
+triangle_32_3_16_avx2(struct lp_rasterizer_task *task,
+                      const struct lp_rast_triangle *tri,
+                      int x, int y)
+{
+   struct tri_32_3_avx2 t;
+   struct { unsigned mask:16; unsigned i:8; unsigned j:8; } out[16];
+   unsigned nr = 0;
+   unsigned i, j, p;
+
+   tri_32_3_avx2_init(&t, GET_PLANES(tri), x, y);
+
+   for (i = 0; i < 4; i++) {
+      int32_t cx[3];
+
+      for (p = 0; p < 3; p++)
+         cx[p] = t.c[p];
+
+      for (j = 0; j < 4; j++) {
+         if (((cx[0] + t.rej[0]) |
+              (cx[1] + t.rej[1]) |
+              (cx[2] + t.rej[2])) >= 0) {
+            unsigned mask = tri_32_3_avx2_block(&t, cx);
+
+            out[nr].i = i;
+            out[nr].j = j;
+            out[nr].mask = mask;
+            if (mask != 0xffff)
+               nr++;
+         }
+
+         for (p = 0; p < 3; p++)
+            cx[p] += t.dcdx[p];
+      }
+
+      for (p = 0; p < 3; p++)
+         t.c[p] += t.dcdy[p];
+   }
+
+   for (i = 0; i < nr; i++)
+      lp_rast_shade_quads_mask(task,
+                               &tri->inputs,
+                               x + 4 * out[i].j,
+                               y + 4 * out[i].i,
+                               0xffff & ~out[i].mask);
+}
+
+__attribute__((target("avx2")))
+static void
+triangle_32_3_4_avx2(struct lp_rasterizer_task *task,
+                     const struct lp_rast_triangle *tri,
+                     int x, int y)
+{
+   struct tri_32_3_avx2 t;
+   unsigned mask;
+
+   tri_32_3_avx2_init(&t, GET_PLANES(tri), x, y);
+
+   mask = tri_32_3_avx2_block(&t, t.c);
+   if (mask != 0xffff)
+      lp_rast_shade_quads_mask(task, &tri->inputs, x, y, 0xffff & ~mask);
+}
+
+#endif /* LP_RAST_HAVE_AVX2 */
+
+
 #define NR_PLANES 3
 
 void
@@ -277,6 +453,16 @@ lp_rast_triangle_32_3_16(struct lp_rasterizer_task *task,
    struct { unsigned mask:16; unsigned i:8; unsigned j:8; } out[16];
    unsigned nr = 0;
 
+   if (lp_rast_hiz_reject(task, &tri->inputs, x, y, 16))
+      return;
+
+#if defined(LP_RAST_HAVE_AVX2)
+   if (util_cpu_caps.has_avx2) {
+      triangle_32_3_16_avx2(task, tri, x, y);
+      return;
+   }
+#endif
+
    /* p0 and p2 are aligned, p1 is not (plane size 24 bytes). */
    __m128i p0 = _mm_load_si128((__m128i *)&plane[0]); /* clo, chi, dcdx, dcdy */
    __m128i p1 = _mm_loadu_si128((__m128i *)&plane[1]);
@@ -386,6 +572,13 @@ lp_rast_triangle_32_3_4(struct lp_rasterizer_task *task,
    unsigned x = (arg.triangle.plane_mask & 0xff) + task->x;
    unsigned y = (arg.triangle.plane_mask >> 8) + task->y;
 
+#if defined(LP_RAST_HAVE_AVX2)
+   if (util_cpu_caps.has_avx2) {
+      triangle_32_3_4_avx2(task, tri, x, y);
+      return;
+   }
+#endif
+
    /* p0 and p2 are aligned, p1 is not (plane size 24 bytes). */
    __m128i p0 = _mm_load_si128((__m128i *)&plane[0]); /* clo, chi, dcdx, dcdy */
    __m128i p1 = _mm_loadu_si128((__m128i *)&plane[1]);
@@ -561,6 +754,9 @@ lp_rast_triangle_32_3_16(struct lp_rasterizer_task *task,
    struct { unsigned mask:16; unsigned i:8; unsigned j:8; } out[16];
    unsigned nr = 0;
 
+   if (lp_rast_hiz_reject(task, &tri->inputs, x, y, 16))
+      return;
+
    __m128i p0 = lp_plane_to_m128i(&plane[0]); /* c, dcdx, dcdy, eo */
    __m128i p1 = lp_plane_to_m128i(&plane[1]); /* c, dcdx, dcdy, eo */
    __m128i p2 = lp_plane_to_m128i(&plane[2]); /* c, dcdx, dcdy, eo */
@@ -50,7 +50,11 @@ TAG(do_block_4)(struct lp_rasterizer_task *task,
 #ifndef MULTISAMPLE
    unsigned mask = 0xffff;
 #else
-   uint64_t mask = UINT64_MAX;
+   const unsigned nr_samples = task->scene->fb_max_samples;
+   uint64_t mask[LP_RAST_MASK_WORDS];
+   unsigned covered = 0;
+
+   lp_rast_mask_all_samples(mask, nr_samples, 0xffff);
 #endif
 
    for (j = 0; j < NR_PLANES; j++) {
@@ -65,7 +69,25 @@ TAG(do_block_4)(struct lp_rasterizer_task *task,
                                  plane[j].dcdy);
 #endif
 #else
-      for (unsigned s = 0; s < 4; s++) {
+      if (tri->inputs.conservative_planes) {
+         /* Conservative rasterization covers all samples of the pixels
+          * touched alike, the planes being set up for the pixel centers.
+          */
+         uint32_t build_mask;
+#ifdef RASTER_64
+         build_mask = BUILD_MASK_LINEAR((int32_t)((c[j] - 1) >> (int64_t)FIXED_ORDER),
+                                        -plane[j].dcdx >> FIXED_ORDER,
+                                        plane[j].dcdy >> FIXED_ORDER);
+#else
+         build_mask = BUILD_MASK_LINEAR((c[j] - 1),
+                                        -plane[j].dcdx,
+                                        plane[j].dcdy);
+#endif
+         for (unsigned s = 0; s < nr_samples; s++)
+            mask[s / 4] &= ~((uint64_t)build_mask << (16 * (s % 4)));
+         continue;
+      }
+      for (unsigned s = 0; s < nr_samples; s++) {
          int64_t new_c = (c[j]) + ((IMUL64(task->scene->fixed_sample_pos[s][1], plane[j].dcdy) + IMUL64(task->scene->fixed_sample_pos[s][0], -plane[j].dcdx)) >> FIXED_ORDER);
          uint32_t build_mask;
 #ifdef RASTER_64
@@ -77,15 +99,22 @@ TAG(do_block_4)(struct lp_rasterizer_task *task,
                                         -plane[j].dcdx,
                                         plane[j].dcdy);
 #endif
-         mask &= ~((uint64_t)build_mask << (s * 16));
+         mask[s / 4] &= ~((uint64_t)build_mask << (16 * (s % 4)));
       }
 #endif
    }
 
    /* Now pass to the shader:
     */
+#ifndef MULTISAMPLE
    if (mask)
+      lp_rast_shade_quads_mask(task, &tri->inputs, x, y, mask);
+#else
+   for (j = 0; j < DIV_ROUND_UP(nr_samples, 4); j++)
+      covered |= mask[j] != 0;
+   if (covered)
       lp_rast_shade_quads_mask_sample(task, &tri->inputs, x, y, mask);
+#endif
 }
 
 /**
@@ -102,6 +131,9 @@ TAG(do_block_16)(struct lp_rasterizer_task *task,
    unsigned outmask, inmask, partmask, partial_mask;
    unsigned j;
 
+   if (lp_rast_hiz_reject(task, &tri->inputs, x, y, 16))
+      return;
+
    outmask = 0;                 /* outside one or more trivial reject planes */
    partmask = 0;                /* outside one or more trivial accept planes */
 
@@ -135,12 +167,16 @@ TAG(do_block_16)(struct lp_rasterizer_task *task,
                   &partmask); /* sign bits from c[i][0..15] + cio */
    }
 
+   /* Leave out the 16x16 blocks beyond the edges of smaller tiles:
+    */
+   outmask |= task->scene->block16_outmask;
+
    if (outmask == 0xffff)
       return;
 
    /* Mask of sub-blocks which are inside all trivial accept planes:
     */
-   inmask = ~partmask & 0xffff;
+   inmask = ~(partmask | outmask) & 0xffff;
 
    /* Mask of sub-blocks which are inside all trivial reject planes,
     * but outside at least one trivial accept plane:
@@ -212,6 +248,9 @@ TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
       return;
    }
 
+   if (lp_rast_hiz_reject(task, &tri->inputs, x, y, task->scene->tile_size))
+      return;
+
    outmask = 0;                 /* outside one or more trivial reject planes */
    partmask = 0;                /* outside one or more trivial accept planes */
 
@@ -25,26 +25,176 @@
  *
  **************************************************************************/
 
+#include <limits.h>
+#include <stdlib.h>
+
+#include "util/hash_table.h"
 #include "util/u_framebuffer.h"
 #include "util/u_math.h"
 #include "util/u_memory.h"
+#include "util/u_atomic.h"
 #include "util/u_inlines.h"
 #include "util/simple_list.h"
 #include "util/format/u_format.h"
 #include "lp_scene.h"
 #include "lp_fence.h"
 #include "lp_debug.h"
+#include "lp_perf.h"
+#include "lp_screen.h"
+#include "lp_trace.h"
 
 
 #define RESOURCE_REF_SZ 32
 
-/** List of resource references */
+/** List of resource references, which resource_table indexes */
 struct resource_ref {
    struct pipe_resource *resource[RESOURCE_REF_SZ];
    int count;
    struct resource_ref *next;
 };
 
+/** Storage the scene frees once rasterized, see lp_scene_retire_data() */
+struct retired_data {
+   void *data;
+   struct retired_data *next;
+};
+
+
+/**
+ * Data blocks no longer used by any scene, for reuse by the scenes of
+ * all the contexts of a screen.  The pool never holds more blocks than
+ * the scenes ever used at the same time (max_used).
+ */
+struct lp_scene_block_pool {
+   mtx_t mutex;
+   struct data_block *free;
+   unsigned num_free;
+   unsigned num_used;   /**< blocks currently held by scenes */
+   unsigned max_used;   /**< high-water mark of num_used */
+};
+
+
+struct lp_scene_block_pool *
+lp_scene_block_pool_create(void)
+{
+   struct lp_scene_block_pool *pool = CALLOC_STRUCT(lp_scene_block_pool);
+   if (!pool)
+      return NULL;
+
+   (void) mtx_init(&pool->mutex, mtx_plain);
+
+   return pool;
+}
+
+
+void
+lp_scene_block_pool_destroy(struct lp_scene_block_pool *pool)
+{
+   struct data_block *block, *tmp;
+
+   if (!pool)
+      return;
+
+   assert(pool->num_used == 0);
+
+   if (LP_DEBUG & DEBUG_SCENE)
+      debug_printf("scene block pool: %u blocks, high-water mark %u\n",
+                   pool->num_free, pool->max_used);
+
+   for (block = pool->free; block; block = tmp) {
+      tmp = block->next;
+      align_free(block);
+   }
+
+   mtx_destroy(&pool->mutex);
+   FREE(pool);
+}
+
+
+/** Bytes of the blocks of the pool, held by scenes or free */
+uint64_t
+lp_scene_block_pool_memory(struct lp_scene_block_pool *pool)
+{
+   uint64_t size;
+
+   mtx_lock(&pool->mutex);
+   size = (uint64_t)(pool->num_used + pool->num_free) *
+          sizeof(struct data_block);
+   mtx_unlock(&pool->mutex);
+
+   return size;
+}
+
+
+/** Free the blocks no scene uses */
+void
+lp_scene_block_pool_trim(struct lp_scene_block_pool *pool)
+{
+   struct data_block *block, *tmp;
+
+   mtx_lock(&pool->mutex);
+   block = pool->free;
+   pool->free = NULL;
+   pool->num_free = 0;
+   mtx_unlock(&pool->mutex);
+
+   for (; block; block = tmp) {
+      tmp = block->next;
+      align_free(block);
+   }
+}
+
+
+static struct data_block *
+block_pool_get(struct lp_scene_block_pool *pool)
+{
+   struct data_block *block;
+
+   mtx_lock(&pool->mutex);
+   block = pool->free;
+   if (block) {
+      pool->free = block->next;
+      pool->num_free--;
+      LP_COUNT(nr_data_block_reuses);
+   }
+   else {
+      block = align_malloc(sizeof(*block), DATA_BLOCK_ALIGN);
+      LP_COUNT(nr_data_block_mallocs);
+   }
+   if (block) {
+      pool->num_used++;
+      pool->max_used = MAX2(pool->max_used, pool->num_used);
+   }
+   mtx_unlock(&pool->mutex);
+
+   return block;
+}
+
+
+/** Give a NULL-terminated chain of blocks back to the pool. */
+static void
+block_pool_put(struct lp_scene_block_pool *pool, struct data_block *blocks)
+{
+   struct data_block *last = blocks;
+   unsigned count = 1;
+
+   if (!blocks)
+      return;
+
+   while (last->next) {
+      last = last->next;
+      count++;
+   }
+
+   mtx_lock(&pool->mutex);
+   last->next = pool->free;
+   pool->free = blocks;
+   pool->num_free += count;
+   assert(pool->num_used >= count);
+   pool->num_used -= count;
+   mtx_unlock(&pool->mutex);
+}
+
 
 /**
  * Create a new scene object.
@@ -58,11 +208,24 @@ lp_scene_create( struct pipe_context *pipe )
       return NULL;
 
    scene->pipe = pipe;
+   scene->block_pool = llvmpipe_screen(pipe->screen)->block_pool;
 
-   scene->data.head =
-      CALLOC_STRUCT(data_block);
+   scene->data.head = block_pool_get(scene->block_pool);
+   if (!scene->data.head) {
+      FREE(scene);
+      return NULL;
+   }
+   scene->data.head->used = 0;
+   scene->data.head->next = NULL;
 
-   (void) mtx_init(&scene->mutex, mtx_plain);
+   scene->resource_table = _mesa_pointer_hash_table_create(NULL);
+   if (!scene->resource_table) {
+      block_pool_put(scene->block_pool, scene->data.head);
+      FREE(scene);
+      return NULL;
+   }
+
+   (void) mtx_init(&scene->progress_mutex, mtx_plain);
 
 #ifdef DEBUG
    /* Do some scene limit sanity checks here */
@@ -90,9 +253,13 @@ void
 lp_scene_destroy(struct lp_scene *scene)
 {
    lp_fence_reference(&scene->fence, NULL);
-   mtx_destroy(&scene->mutex);
+   FREE(scene->bin_order);
+   FREE(scene->row_bins);
+   FREE(scene->tiles);
+   mtx_destroy(&scene->progress_mutex);
    assert(scene->data.head->next == NULL);
-   FREE(scene->data.head);
+   block_pool_put(scene->block_pool, scene->data.head);
+   _mesa_hash_table_destroy(scene->resource_table, NULL);
    FREE(scene);
 }
 
@@ -104,14 +271,12 @@ lp_scene_destroy(struct lp_scene *scene)
 boolean
 lp_scene_is_empty(struct lp_scene *scene )
 {
-   unsigned x, y;
+   unsigned num_bins = lp_scene_get_num_bins(scene);
+   unsigned i;
 
-   for (y = 0; y < scene->tiles_y; y++) {
-      for (x = 0; x < scene->tiles_x; x++) {
-         const struct cmd_bin *bin = lp_scene_get_bin(scene, x, y);
-         if (bin->head) {
-            return FALSE;
-         }
+   for (i = 0; i < num_bins; i++) {
+      if (scene->tiles[i].head) {
+         return FALSE;
       }
    }
    return TRUE;
@@ -132,10 +297,12 @@ lp_scene_is_oom(struct lp_scene *scene)
 /* Remove all commands from a bin.  Tries to reuse some of the memory
  * allocated to the bin, however.
  */
-void
-lp_scene_bin_reset(struct lp_scene *scene, unsigned x, unsigned y)
+static void
+bin_reset(struct lp_scene *scene, struct cmd_bin *bin)
 {
-   struct cmd_bin *bin = lp_scene_get_bin(scene, x, y);
+   /* The scene's own commands are dropped when the fork is joined. */
+   if (scene->is_fork)
+      bin->reset = TRUE;
 
    bin->last_state = NULL;
    bin->head = bin->tail;
@@ -146,6 +313,13 @@ lp_scene_bin_reset(struct lp_scene *scene, unsigned x, unsigned y)
 }
 
 
+void
+lp_scene_bin_reset(struct lp_scene *scene, unsigned x, unsigned y)
+{
+   bin_reset(scene, lp_scene_get_bin(scene, x, y));
+}
+
+
 void
 lp_scene_begin_rasterization(struct lp_scene *scene)
 {
@@ -163,10 +337,15 @@ lp_scene_begin_rasterization(struct lp_scene *scene)
          scene->cbufs[i].sample_stride = 0;
          scene->cbufs[i].nr_samples = 0;
          scene->cbufs[i].map = NULL;
+         scene->cbufs[i].msaa_equal = NULL;
          continue;
       }
 
+      scene->cbufs[i].msaa_equal = NULL;
+
       if (llvmpipe_resource_is_texture(cbuf->texture)) {
+         struct llvmpipe_resource *lpr = llvmpipe_resource(cbuf->texture);
+
          scene->cbufs[i].stride = llvmpipe_resource_stride(cbuf->texture,
                                                            cbuf->u.tex.level);
          scene->cbufs[i].layer_stride = llvmpipe_layer_stride(cbuf->texture,
@@ -179,6 +358,23 @@ lp_scene_begin_rasterization(struct lp_scene *scene)
                                                      LP_TEX_USAGE_READ_WRITE);
          scene->cbufs[i].format_bytes = util_format_get_blocksize(cbuf->format);
          scene->cbufs[i].nr_samples = util_res_sample_count(cbuf->texture);
+
+         /* The rasterizer only tracks which blocks' samples are equal on
+          * unlayered framebuffers, anything else loses what is known.
+          */
+         if (lpr->msaa_equal && cbuf->u.tex.first_layer == 0) {
+            const unsigned stride = llvmpipe_msaa_equal_stride(lpr);
+
+            if (lpr->msaa_equal_writes != lpr->writes || scene->fb_max_layer) {
+               memset(lpr->msaa_equal, 0,
+                      stride * DIV_ROUND_UP(cbuf->texture->height0, 4));
+               lpr->msaa_equal_writes = lpr->writes;
+            }
+            if (scene->fb_max_layer == 0) {
+               scene->cbufs[i].msaa_equal = lpr->msaa_equal;
+               scene->cbufs[i].msaa_equal_stride = stride;
+            }
+         }
       }
       else {
          struct llvmpipe_resource *lpr = llvmpipe_resource(cbuf->texture);
@@ -193,17 +389,49 @@ lp_scene_begin_rasterization(struct lp_scene *scene)
       }
    }
 
+   /* Sample 0 alone is shaded for all color buffers at once, so they are
+    * all tracked, or none.
+    */
+   for (i = 0; i < scene->fb.nr_cbufs; i++) {
+      if (scene->fb.cbufs[i] &&
+          (!scene->cbufs[i].msaa_equal ||
+           scene->cbufs[i].nr_samples != scene->fb_max_samples))
+         break;
+   }
+   if (i < scene->fb.nr_cbufs) {
+      for (i = 0; i < scene->fb.nr_cbufs; i++) {
+         if (scene->cbufs[i].msaa_equal) {
+            const struct pipe_resource *res = scene->fb.cbufs[i]->texture;
+
+            memset(scene->cbufs[i].msaa_equal, 0,
+                   scene->cbufs[i].msaa_equal_stride *
+                   DIV_ROUND_UP(res->height0, 4));
+            scene->cbufs[i].msaa_equal = NULL;
+         }
+      }
+   }
+
    if (fb->zsbuf) {
       struct pipe_surface *zsbuf = scene->fb.zsbuf;
+      struct llvmpipe_resource *lpr = llvmpipe_resource(zsbuf->texture);
       scene->zsbuf.stride = llvmpipe_resource_stride(zsbuf->texture, zsbuf->u.tex.level);
       scene->zsbuf.layer_stride = llvmpipe_layer_stride(zsbuf->texture, zsbuf->u.tex.level);
       scene->zsbuf.sample_stride = llvmpipe_sample_stride(zsbuf->texture);
       scene->zsbuf.nr_samples = util_res_sample_count(zsbuf->texture);
-      scene->zsbuf.map = llvmpipe_resource_map(zsbuf->texture,
-                                               zsbuf->u.tex.level,
-                                               zsbuf->u.tex.first_layer,
-                                               LP_TEX_USAGE_READ_WRITE);
       scene->zsbuf.format_bytes = util_format_get_blocksize(zsbuf->format);
+
+      /* A transient zsbuf which is cleared first and discarded at the end
+       * only ever lives in the tiles, so it still needs no memory.
+       * Mapping allocates it.
+       */
+      if (lpr->transient && !lpr->tex_data &&
+          scene->zsbuf_cleared && scene->zsbuf_discard)
+         scene->zsbuf.map = NULL;
+      else
+         scene->zsbuf.map = llvmpipe_resource_map(zsbuf->texture,
+                                                  zsbuf->u.tex.level,
+                                                  zsbuf->u.tex.first_layer,
+                                                  LP_TEX_USAGE_READ_WRITE);
    }
 }
 
@@ -211,12 +439,14 @@ lp_scene_begin_rasterization(struct lp_scene *scene)
 
 
 /**
- * Free all the temporary data in a scene.
+ * Unmap the framebuffer.  Called by the rasterizer once all the bins
+ * have been executed; the scene data is left alone until the setup
+ * code recycles the scene.
  */
 void
 lp_scene_end_rasterization(struct lp_scene *scene )
 {
-   int i, j;
+   int i;
 
    /* Unmap color buffers */
    for (i = 0; i < scene->fb.nr_cbufs; i++) {
@@ -239,16 +469,27 @@ lp_scene_end_rasterization(struct lp_scene *scene )
                               zsbuf->u.tex.first_layer);
       scene->zsbuf.map = NULL;
    }
+}
+
+
+/**
+ * Free all the temporary data in a scene.
+ * Only called by the setup code, once the scene's fence has signalled
+ * (or if the scene never made it to the rasterizer).
+ */
+void
+lp_scene_recycle(struct lp_scene *scene)
+{
+   unsigned num_bins = lp_scene_get_num_bins(scene);
+   unsigned i;
 
    /* Reset all command lists:
     */
-   for (i = 0; i < scene->tiles_x; i++) {
-      for (j = 0; j < scene->tiles_y; j++) {
-         struct cmd_bin *bin = lp_scene_get_bin(scene, i, j);
-         bin->head = NULL;
-         bin->tail = NULL;
-         bin->last_state = NULL;
-      }
+   for (i = 0; i < num_bins; i++) {
+      struct cmd_bin *bin = &scene->tiles[i];
+      bin->head = NULL;
+      bin->tail = NULL;
+      bin->last_state = NULL;
    }
 
    /* If there are any bins which weren't cleared by the loop above,
@@ -256,6 +497,9 @@ lp_scene_end_rasterization(struct lp_scene *scene )
     */
    assert(lp_scene_is_empty(scene));
 
+   scene->zsbuf_discard = FALSE;
+   scene->zsbuf_cleared = FALSE;
+
    /* Decrement texture ref counts
     */
    {
@@ -281,16 +525,24 @@ lp_scene_end_rasterization(struct lp_scene *scene )
                       j, scene->resource_reference_size);
    }
 
-   /* Free all scene data blocks:
+   /* Free the storage given to the scene.  The list lives in the data
+    * blocks, so walk it before they go.
+    */
+   {
+      struct retired_data *retired;
+
+      for (retired = scene->retired; retired; retired = retired->next)
+         align_free(retired->data);
+      scene->retired = NULL;
+      scene->retired_size = 0;
+   }
+
+   /* Give all scene data blocks but one back to the pool:
     */
    {
       struct data_block_list *list = &scene->data;
-      struct data_block *block, *tmp;
 
-      for (block = list->head->next; block; block = tmp) {
-         tmp = block->next;
-	 FREE(block);
-      }
+      block_pool_put(scene->block_pool, list->head->next);
 
       list->head->next = NULL;
       list->head->used = 0;
@@ -299,6 +551,7 @@ lp_scene_end_rasterization(struct lp_scene *scene )
    lp_fence_reference(&scene->fence, NULL);
 
    scene->resources = NULL;
+   _mesa_hash_table_clear(scene->resource_table, NULL);
    scene->scene_size = 0;
    scene->resource_reference_size = 0;
 
@@ -312,6 +565,122 @@ lp_scene_end_rasterization(struct lp_scene *scene )
 
 
 
+/**
+ * Make fork a copy of scene to bin into, with empty bins and its own data
+ * blocks, so that a setup thread can bin without touching the scene.
+ * The fork may allocate up to max_size bytes.  Nothing in the fork is
+ * rasterized until lp_scene_join() hands it over to the scene.
+ */
+boolean
+lp_scene_fork(struct lp_scene *scene, struct lp_scene *fork,
+              unsigned max_size)
+{
+   unsigned num_tiles = lp_scene_get_num_bins(scene);
+   struct cmd_bin *tiles = fork->tiles;
+   unsigned num_tiles_alloc = fork->num_tiles_alloc;
+   struct data_block *block;
+
+   if (num_tiles > num_tiles_alloc) {
+      FREE(tiles);
+      tiles = CALLOC(num_tiles, sizeof *tiles);
+      num_tiles_alloc = tiles ? num_tiles : 0;
+   }
+   else {
+      memset(tiles, 0, num_tiles * sizeof *tiles);
+   }
+
+   block = tiles ? block_pool_get(scene->block_pool) : NULL;
+
+   memcpy(fork, scene, sizeof *fork);
+   fork->tiles = tiles;
+   fork->num_tiles_alloc = num_tiles_alloc;
+   fork->bin_order = NULL;
+   fork->bin_order_size = 0;
+   fork->num_active_bins = 0;
+   fork->row_bins = NULL;
+   fork->row_bins_size = 0;
+   fork->bin_layer = 0;
+   fork->data.head = block;
+   fork->fence = NULL;
+   fork->alloc_failed = FALSE;
+   fork->is_fork = TRUE;
+
+   if (!block)
+      return FALSE;
+
+   block->used = 0;
+   block->next = NULL;
+
+   max_size = MIN2(max_size, LP_SCENE_MAX_SIZE);
+   fork->scene_size = LP_SCENE_MAX_SIZE - max_size + sizeof *block;
+
+   return TRUE;
+}
+
+
+/**
+ * Give the fork's data blocks to the scene, and unless keep_bins is
+ * false, append each of the fork's bins to the scene's.  Forks must be
+ * joined in the order their commands are to run in.
+ */
+void
+lp_scene_join(struct lp_scene *scene, struct lp_scene *fork,
+              boolean keep_bins)
+{
+   struct data_block *last;
+   unsigned num_bins = lp_scene_get_num_bins(scene);
+   unsigned i, count;
+
+   assert(fork->is_fork);
+   assert(fork->num_layer_bins == scene->num_layer_bins);
+
+   if (keep_bins) {
+      for (i = 0; i < num_bins; i++) {
+         struct cmd_bin *src = &fork->tiles[i];
+         struct cmd_bin *dst = &scene->tiles[i];
+
+         if (src->reset)
+            bin_reset(scene, dst);
+
+         if (!src->head)
+            continue;
+
+         if (dst->tail)
+            dst->tail->next = src->head;
+         else
+            dst->head = src->head;
+         dst->tail = src->tail;
+         dst->last_state = src->last_state;
+      }
+   }
+
+   if (!fork->data.head)
+      return;
+
+   /* Keep allocating from the scene's current block. */
+   count = 1;
+   for (last = fork->data.head; last->next; last = last->next)
+      count++;
+
+   last->next = scene->data.head->next;
+   scene->data.head->next = fork->data.head;
+   scene->scene_size += count * sizeof(struct data_block);
+   fork->data.head = NULL;
+}
+
+
+void
+lp_scene_fork_destroy(struct lp_scene *fork)
+{
+   if (!fork)
+      return;
+
+   assert(!fork->data.head);
+   FREE(fork->tiles);
+   FREE(fork);
+}
+
+
 struct cmd_block *
 lp_scene_new_cmd_block( struct lp_scene *scene,
                         struct cmd_bin *bin )
@@ -343,7 +712,7 @@ lp_scene_new_data_block( struct lp_scene *scene )
       return NULL;
    }
    else {
-      struct data_block *block = MALLOC_STRUCT(data_block);
+      struct data_block *block = block_pool_get(scene->block_pool);
       if (!block)
          return NULL;
       
@@ -358,6 +727,22 @@ lp_scene_new_data_block( struct lp_scene *scene )
 }
 
 
+/**
+ * Bytes of memory the scene holds: its data blocks, of which it always
+ * keeps one, its bins and the storage retired to it.  Scenes being
+ * rasterized change it meanwhile, so it is only a snapshot.
+ */
+uint64_t
+lp_scene_memory(const struct lp_scene *scene)
+{
+   return (uint64_t)scene->scene_size + sizeof(struct data_block) +
+          scene->retired_size +
+          (uint64_t)scene->num_tiles_alloc * sizeof(struct cmd_bin) +
+          (uint64_t)scene->bin_order_size * sizeof(struct lp_scene_bin_ref) +
+          (uint64_t)scene->row_bins_size * sizeof(unsigned);
+}
+
+
 /**
  * Return number of bytes used for all bin data within a scene.
  * This does not include resources (textures) referenced by the scene.
@@ -377,45 +762,45 @@ lp_scene_data_size( const struct lp_scene *scene )
 
 /**
  * Add a reference to a resource by the scene.
+ * \param writeable  the scene commands write to the resource
  */
 boolean
 lp_scene_add_resource_reference(struct lp_scene *scene,
                                 struct pipe_resource *resource,
-                                boolean initializing_scene)
+                                boolean initializing_scene,
+                                boolean writeable)
 {
-   struct resource_ref *ref, **last = &scene->resources;
-   int i;
+   const uintptr_t usage = writeable ?
+      LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE :
+      LP_REFERENCED_FOR_READ;
+   struct resource_ref *ref = scene->resources;
+   struct hash_entry *entry;
 
-   /* Look at existing resource blocks:
+   /* The table maps each resource to how the scene uses it:
     */
-   for (ref = scene->resources; ref; ref = ref->next) {
-      last = &ref->next;
-
-      /* Search for this resource:
-       */
-      for (i = 0; i < ref->count; i++)
-         if (ref->resource[i] == resource)
-            return TRUE;
-
-      if (ref->count < RESOURCE_REF_SZ) {
-         /* If the block is half-empty, then append the reference here.
-          */
-         break;
-      }
+   entry = _mesa_hash_table_search(scene->resource_table, resource);
+   if (entry) {
+      entry->data = (void *) ((uintptr_t) entry->data | usage);
+      return TRUE;
    }
 
-   /* Create a new block if no half-empty block was found.
+   /* Create a new block if the first one is full.  The blocks are
+    * pushed on the front, as the table does the searching.
     */
-   if (!ref) {
-      assert(*last == NULL);
-      *last = lp_scene_alloc(scene, sizeof *ref);
-      if (*last == NULL)
+   if (!ref || ref->count == RESOURCE_REF_SZ) {
+      ref = lp_scene_alloc(scene, sizeof *ref);
+      if (!ref)
           return FALSE;
 
-      ref = *last;
       memset(ref, 0, sizeof *ref);
+      ref->next = scene->resources;
+      scene->resources = ref;
    }
 
+   if (!_mesa_hash_table_insert(scene->resource_table, resource,
+                                (void *) usage))
+      return FALSE;
+
    /* Append the reference to the reference block.
     */
    pipe_resource_reference(&ref->resource[ref->count++], resource);
@@ -435,97 +820,308 @@ lp_scene_add_resource_reference(struct lp_scene *scene,
 
 
 /**
- * Does this scene have a reference to the given resource?
+ * Have the scene align_free() data once it is rasterized.  This is for
+ * resource storage replaced while this and earlier scenes read it; as
+ * scenes are rasterized in order, those are done by then.  Returns FALSE
+ * past LP_SCENE_MAX_RETIRED_SIZE bytes, so that renames can't pile up
+ * unbounded copies of a resource.
  */
 boolean
-lp_scene_is_resource_referenced(const struct lp_scene *scene,
-                                const struct pipe_resource *resource)
+lp_scene_retire_data(struct lp_scene *scene, void *data, size_t size)
 {
-   const struct resource_ref *ref;
-   int i;
+   struct retired_data *retired;
 
-   for (ref = scene->resources; ref; ref = ref->next) {
-      for (i = 0; i < ref->count; i++)
-         if (ref->resource[i] == resource)
-            return TRUE;
+   if (scene->retired_size + size > LP_SCENE_MAX_RETIRED_SIZE) {
+      LP_COUNT(nr_renames_over_budget);
+      return FALSE;
    }
 
-   return FALSE;
-}
+   retired = lp_scene_alloc(scene, sizeof *retired);
+   if (!retired)
+      return FALSE;
 
+   scene->retired_size += size;
 
+   retired->data = data;
+   retired->next = scene->retired;
+   scene->retired = retired;
+   return TRUE;
+}
 
 
-/** advance curr_x,y to the next bin */
-static boolean
-next_bin(struct lp_scene *scene)
+/**
+ * Does this scene have a reference to the given resource?
+ * \return  LP_REFERENCED_FOR_READ, with LP_REFERENCED_FOR_WRITE if the
+ *          scene writes to it, or 0
+ */
+unsigned
+lp_scene_is_resource_referenced(const struct lp_scene *scene,
+                                const struct pipe_resource *resource)
 {
-   scene->curr_x++;
-   if (scene->curr_x >= scene->tiles_x) {
-      scene->curr_x = 0;
-      scene->curr_y++;
-   }
-   if (scene->curr_y >= scene->tiles_y) {
-      /* no more bins */
-      return FALSE;
-   }
-   return TRUE;
+   const struct hash_entry *entry =
+      _mesa_hash_table_search(scene->resource_table, resource);
+
+   return entry ? (unsigned) (uintptr_t) entry->data : 0;
 }
 
 
+
+
 void
 lp_scene_bin_iter_begin( struct lp_scene *scene )
 {
-   scene->curr_x = scene->curr_y = -1;
+   scene->curr_bin = 0;
 }
 
 
 /**
  * Return pointer to next bin to be rendered.
- * The lp_scene::curr_x and ::curr_y fields will be advanced.
  * Multiple rendering threads will call this function to get a chunk
- * of work (a bin) to work on.
+ * of work (a bin) to work on; each call just claims the next entry of
+ * lp_scene::bin_order, so no lock is needed.
  */
 struct cmd_bin *
-lp_scene_bin_iter_next( struct lp_scene *scene , int *x, int *y)
+lp_scene_bin_iter_next( struct lp_scene *scene , int *x, int *y,
+                        unsigned *layer)
+{
+   unsigned i = p_atomic_inc_return(&scene->curr_bin) - 1;
+
+   if (i >= scene->num_active_bins)
+      return NULL;
+
+   if (scene->bin_order) {
+      *x = scene->bin_order[i].x;
+      *y = scene->bin_order[i].y;
+      *layer = scene->bin_order[i].layer;
+   }
+   else {
+      /* no bin list, hand out all the bins in raster order */
+      *x = i % scene->tiles_x;
+      *y = (i / scene->tiles_x) % scene->tiles_y;
+      *layer = i / (scene->tiles_x * scene->tiles_y);
+   }
+
+   return lp_scene_get_layer_bin(scene, *x, *y, *layer);
+}
+
+
+/**
+ * Called by the rasterizer threads once done with a bin from
+ * lp_scene_bin_iter_next(), in tile row y.  Once that completes the tile
+ * rows at the top of the color buffer, the progress callback gets their
+ * height.  The mutex keeps the calls in order.
+ */
+void
+lp_scene_bin_done(struct lp_scene *scene, int y)
+{
+   unsigned rows_done;
+
+   if (!scene->progress_func || !scene->row_bins ||
+       !p_atomic_dec_zero(&scene->row_bins[y]))
+      return;
+
+   mtx_lock(&scene->progress_mutex);
+   rows_done = scene->rows_done;
+   while (rows_done < scene->tiles_y &&
+          p_atomic_read(&scene->row_bins[rows_done]) == 0)
+      rows_done++;
+   if (rows_done > scene->rows_done) {
+      scene->rows_done = rows_done;
+      scene->progress_func(scene->progress_data,
+                           MIN2(rows_done << scene->tile_order,
+                                scene->fb.height));
+   }
+   mtx_unlock(&scene->progress_mutex);
+}
+
+
+/**
+ * Report the whole color buffer done, unless lp_scene_bin_done() did,
+ * once all the bins are.  Called by one thread, before the fence is
+ * signalled.
+ */
+void
+lp_scene_progress_end(struct lp_scene *scene)
+{
+   if (scene->progress_func && scene->rows_done < scene->tiles_y) {
+      scene->rows_done = scene->tiles_y;
+      scene->progress_func(scene->progress_data, scene->fb.height);
+   }
+}
+
+
+/** Sort bins by decreasing cost, keeping raster order for equal costs. */
+static int
+compare_bin_cost(const void *a, const void *b)
+{
+   const struct lp_scene_bin_ref *bin_a = a, *bin_b = b;
+
+   if (bin_a->cost != bin_b->cost)
+      return bin_a->cost < bin_b->cost ? 1 : -1;
+   if (bin_a->layer != bin_b->layer)
+      return bin_a->layer < bin_b->layer ? -1 : 1;
+   if (bin_a->y != bin_b->y)
+      return bin_a->y < bin_b->y ? -1 : 1;
+   return bin_a->x < bin_b->x ? -1 : (bin_a->x > bin_b->x);
+}
+
+
+/**
+ * Build the list of bins the rasterizer threads will pick from, and count
+ * their commands.  Empty bins are left out, and with LP_PERF=sort_bins,
+ * the bins with the most commands go first so that the threads don't end
+ * up waiting on a single busy bin at the end of the scene.
+ */
+static void
+build_bin_order(struct lp_scene *scene)
 {
-   struct cmd_bin *bin = NULL;
+   unsigned num_bins = lp_scene_get_num_bins(scene);
+   unsigned x, y, layer, n = 0;
+
+   if (num_bins > scene->bin_order_size) {
+      FREE(scene->bin_order);
+      scene->bin_order = MALLOC(num_bins * sizeof(*scene->bin_order));
+      scene->bin_order_size = scene->bin_order ? num_bins : 0;
+   }
+
+   scene->num_cmds = 0;
+   scene->rows_done = 0;
 
-   mtx_lock(&scene->mutex);
+   if (scene->progress_func) {
+      if (scene->tiles_y > scene->row_bins_size) {
+         FREE(scene->row_bins);
+         scene->row_bins = MALLOC(scene->tiles_y * sizeof(*scene->row_bins));
+         scene->row_bins_size = scene->row_bins ? scene->tiles_y : 0;
+      }
+      if (scene->row_bins)
+         memset(scene->row_bins, 0,
+                scene->tiles_y * sizeof(*scene->row_bins));
+   }
 
-   if (scene->curr_x < 0) {
-      /* first bin */
-      scene->curr_x = 0;
-      scene->curr_y = 0;
+   if (!scene->bin_order) {
+      /* all the threads get to look at all the bins */
+      scene->num_active_bins = num_bins;
+      scene->num_cmds = ~0u;
+      if (scene->progress_func && scene->row_bins) {
+         for (y = 0; y < scene->tiles_y; y++)
+            scene->row_bins[y] = scene->tiles_x * scene->num_layer_bins;
+      }
+      return;
    }
-   else if (!next_bin(scene)) {
-      /* no more bins left */
-      goto end;
+
+   for (layer = 0; layer < scene->num_layer_bins; layer++) {
+      for (y = 0; y < scene->tiles_y; y++) {
+         for (x = 0; x < scene->tiles_x; x++) {
+            const struct cmd_bin *bin =
+               lp_scene_get_layer_bin(scene, x, y, layer);
+            const struct cmd_block *block;
+            unsigned cost = 0;
+
+            if (!bin->head)
+               continue;
+
+            for (block = bin->head; block; block = block->next)
+               cost += block->count;
+            scene->num_cmds += cost;
+
+            scene->bin_order[n].x = x;
+            scene->bin_order[n].y = y;
+            scene->bin_order[n].layer = layer;
+            scene->bin_order[n].cost = cost;
+            n++;
+
+            if (scene->progress_func && scene->row_bins)
+               scene->row_bins[y]++;
+         }
+      }
    }
 
-   bin = lp_scene_get_bin(scene, scene->curr_x, scene->curr_y);
-   *x = scene->curr_x;
-   *y = scene->curr_y;
+   if (LP_PERF & PERF_SORT_BINS)
+      qsort(scene->bin_order, n, sizeof(*scene->bin_order), compare_bin_cost);
 
-end:
-   /*printf("return bin %p at %d, %d\n", (void *) bin, *bin_x, *bin_y);*/
-   mtx_unlock(&scene->mutex);
-   return bin;
+   scene->num_active_bins = n;
 }
 
 
-void lp_scene_begin_binning(struct lp_scene *scene,
-                            struct pipe_framebuffer_state *fb)
+/**
+ * Pick the tile size for a framebuffer: the largest one which still
+ * gives each rasterizer thread a couple of bins to work on.
+ */
+static unsigned
+choose_tile_order(const struct pipe_framebuffer_state *fb,
+                  unsigned num_threads)
+{
+   unsigned order = TILE_ORDER;
+
+   while (order > LP_MIN_TILE_ORDER) {
+      unsigned tiles_x = DIV_ROUND_UP(fb->width, 1 << order);
+      unsigned tiles_y = DIV_ROUND_UP(fb->height, 1 << order);
+
+      if (tiles_x * tiles_y >= 2 * num_threads)
+         break;
+      order--;
+   }
+
+   return order;
+}
+
+
+/**
+ * \param num_threads  number of rasterizer threads, for picking the tile
+ *                     size
+ * \param tile_order  tile size to use, or 0 to pick one
+ * \return FALSE if the bins couldn't be allocated
+ */
+boolean lp_scene_begin_binning(struct lp_scene *scene,
+                            struct pipe_framebuffer_state *fb,
+                            unsigned num_threads,
+                            unsigned tile_order)
 {
    int i;
    unsigned max_layer = ~0;
 
    assert(lp_scene_is_empty(scene));
 
+   scene->trace_binning_start = lp_trace_begin();
+
    util_copy_framebuffer_state(&scene->fb, fb);
 
-   scene->tiles_x = align(fb->width, TILE_SIZE) / TILE_SIZE;
-   scene->tiles_y = align(fb->height, TILE_SIZE) / TILE_SIZE;
+   scene->progress_func = NULL;
+   scene->progress_data = NULL;
+   if (fb->nr_cbufs && fb->cbufs[0] &&
+       llvmpipe_resource_is_texture(fb->cbufs[0]->texture) &&
+       fb->cbufs[0]->u.tex.level == 0) {
+      const struct llvmpipe_resource *lpr =
+         llvmpipe_resource(fb->cbufs[0]->texture);
+
+      scene->progress_func = lpr->progress_func;
+      scene->progress_data = lpr->progress_data;
+   }
+
+   if (!tile_order)
+      tile_order = choose_tile_order(fb, num_threads);
+
+   /* The bins are sized for TILE_SIZE tiles, don't go below that for
+    * framebuffers which would need more.
+    */
+   while (tile_order < TILE_ORDER &&
+          (DIV_ROUND_UP(fb->width, 1 << tile_order) > TILES_X ||
+           DIV_ROUND_UP(fb->height, 1 << tile_order) > TILES_Y))
+      tile_order++;
+
+   scene->tile_order = tile_order;
+   scene->tile_size = 1 << tile_order;
+   scene->block16_outmask = 0;
+   for (i = 0; i < 16; i++) {
+      if ((i & 3) * 16 >= scene->tile_size ||
+          (i >> 2) * 16 >= scene->tile_size)
+         scene->block16_outmask |= 1 << i;
+   }
+
+   scene->tiles_x = align(fb->width, scene->tile_size) >> tile_order;
+   scene->tiles_y = align(fb->height, scene->tile_size) >> tile_order;
+   scene->color_x0 = scene->color_y0 = INT_MAX;
+   scene->color_x1 = scene->color_y1 = -1;
    assert(scene->tiles_x <= TILES_X);
    assert(scene->tiles_y <= TILES_Y);
 
@@ -552,18 +1148,53 @@ void lp_scene_begin_binning(struct lp_scene *scene,
       max_layer = MIN2(max_layer, zsbuf->u.tex.last_layer - zsbuf->u.tex.first_layer);
    }
    scene->fb_max_layer = max_layer;
+
+   /*
+    * Layered framebuffers get a set of bins per layer, as long as they fit
+    * in the bins of a single layered framebuffer of the maximum size, so that
+    * the threads can rasterize the layers in parallel and each bin only
+    * touches its own layer.  Otherwise all layers share the bins.
+    */
+   scene->num_layer_bins = 1;
+   scene->bin_layer = 0;
+   if (max_layer > 0 && max_layer != ~0u &&
+       scene->tiles_x * scene->tiles_y * (max_layer + 1) <= TILES_X * TILES_Y)
+      scene->num_layer_bins = max_layer + 1;
+
+   if (lp_scene_get_num_bins(scene) > scene->num_tiles_alloc) {
+      unsigned num_tiles = lp_scene_get_num_bins(scene);
+
+      FREE(scene->tiles);
+      scene->tiles = CALLOC(num_tiles, sizeof(*scene->tiles));
+      if (!scene->tiles) {
+         scene->num_tiles_alloc = 0;
+         scene->tiles_x = scene->tiles_y = 0;
+         scene->num_layer_bins = 1;
+         return FALSE;
+      }
+      scene->num_tiles_alloc = num_tiles;
+   }
    scene->fb_max_samples = util_framebuffer_get_num_samples(fb);
-   if (scene->fb_max_samples == 4) {
-      for (unsigned i = 0; i < 4; i++) {
-         scene->fixed_sample_pos[i][0] = util_iround(lp_sample_pos_4x[i][0] * FIXED_ONE);
-         scene->fixed_sample_pos[i][1] = util_iround(lp_sample_pos_4x[i][1] * FIXED_ONE);
+   if (lp_sample_pos(scene->fb_max_samples)) {
+      const float *pos = lp_sample_pos(scene->fb_max_samples);
+      for (unsigned i = 0; i < scene->fb_max_samples; i++) {
+         scene->fixed_sample_pos[i][0] = util_iround(pos[i * 2] * FIXED_ONE);
+         scene->fixed_sample_pos[i][1] = util_iround(pos[i * 2 + 1] * FIXED_ONE);
       }
    }
+
+   return TRUE;
 }
 
 
 void lp_scene_end_binning( struct lp_scene *scene )
 {
+   build_bin_order(scene);
+
+   LP_TRACE_END_ARGS("binning", scene->trace_binning_start,
+                     "tiles_x,tiles_y,bins", scene->tiles_x, scene->tiles_y,
+                     scene->num_active_bins);
+
    if (LP_DEBUG & DEBUG_SCENE) {
       debug_printf("rasterize scene:\n");
       debug_printf("  scene_size: %u\n",
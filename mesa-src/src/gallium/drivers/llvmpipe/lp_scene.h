@@ -36,14 +36,15 @@
 #define LP_SCENE_H
 
 #include "os/os_thread.h"
+#include "util/u_math.h"
 #include "lp_rast.h"
 #include "lp_debug.h"
 
 struct lp_scene_queue;
 struct lp_rast_state;
 
-/* We're limited to 2K by 2K for 32bit fixed point rasterization.
- * Will need a 64-bit version for larger framebuffers.
+/* Max number of bins in each dimension.  The bins themselves are
+ * allocated for the bound framebuffer, see lp_scene::tiles.
  */
 #define TILES_X (LP_MAX_WIDTH / TILE_SIZE)
 #define TILES_Y (LP_MAX_HEIGHT / TILE_SIZE)
@@ -58,6 +59,11 @@ struct lp_rast_state;
  */
 #define DATA_BLOCK_SIZE (64 * 1024)
 
+/* Data blocks start on a cache line, the most lp_scene_alloc_aligned()
+ * aligns data to.
+ */
+#define DATA_BLOCK_ALIGN 64
+
 /* Scene temporary storage is clamped to this size:
  */
 #define LP_SCENE_MAX_SIZE (36*1024*1024)
@@ -67,6 +73,23 @@ struct lp_rast_state;
  */
 #define LP_SCENE_MAX_RESOURCE_SIZE (64*1024*1024)
 
+/* Max storage replaced by renames a scene holds on to, see
+ * lp_scene_retire_data().
+ */
+#define LP_SCENE_MAX_RETIRED_SIZE (64*1024*1024)
+
+/* Once a frame has outgrown a scene, the setup code hands scenes over
+ * to the rasterizer as soon as they hold this much data, so that
+ * rasterization overlaps with binning the rest of the frame:
+ */
+#define LP_SCENE_STREAM_SIZE (4*1024*1024)
+
+/* With LP_PERF=pipeline, scenes holding this much data are handed over
+ * as soon as the rasterizer threads are idle, so that they rasterize the
+ * bins of the draws binned so far while setup bins the next ones:
+ */
+#define LP_SCENE_PIPELINE_SIZE (512*1024)
+
 
 /* switch to a non-pointer value for this:
  */
@@ -97,6 +120,7 @@ struct cmd_bin {
    const struct lp_rast_state *last_state;       /* most recent state set in bin */
    struct cmd_block *head;
    struct cmd_block *tail;
+   boolean reset;   /**< forks only: the commands before the fork are dropped */
 };
    
 
@@ -107,15 +131,27 @@ struct cmd_bin {
  * Examples include triangle data and state data.  The commands in
  * the per-tile bins will point to chunks of data in this structure.
  *
- * Include the first block of data statically to ensure we can always
- * initiate a scene without relying on malloc succeeding.
+ * Each binning thread allocates from the blocks of its own fork of the
+ * scene, see lp_scene_fork(), and all of them go back to the screen's
+ * pool at once when the scene is rasterized.
  */
 struct data_block_list {
-   struct data_block first;
    struct data_block *head;
 };
 
 struct resource_ref;
+struct hash_table;
+struct retired_data;
+struct lp_scene_block_pool;
+
+/**
+ * Position of a bin, and an estimate of the work it holds.
+ */
+struct lp_scene_bin_ref {
+   uint16_t x, y;
+   uint16_t layer;  /**< bin layer, see lp_scene::num_layer_bins */
+   unsigned cost;  /**< number of commands */
+};
 
 /**
  * All bins and bin data are contained here.
@@ -129,22 +165,40 @@ struct lp_scene {
    struct pipe_context *pipe;
    struct lp_fence *fence;
 
+   /** Where data blocks come from and go back to, shared by the screen */
+   struct lp_scene_block_pool *block_pool;
+
    /* The queries still active at end of scene */
    struct llvmpipe_query *active_queries[LP_MAX_ACTIVE_BINNED_QUERIES];
    unsigned num_active_queries;
    /* If queries were either active or there were begin/end query commands */
    boolean had_queries;
 
+   /** Rasterize the bins in two passes, see LP_RAST_ZPREPASS_x */
+   boolean z_prepass;
+
+   /**
+    * The zsbuf contents are undefined once the scene is done, so its
+    * tiles are kept in tile-local storage and never written back.
+    */
+   boolean zsbuf_discard;
+
+   /** All the depth/stencil bits are cleared before the first draw */
+   boolean zsbuf_cleared;
+
    /* Framebuffer mappings - valid only between begin_rasterization()
     * and end_rasterization().
     */
-   struct {
+   struct lp_scene_buffer {
       uint8_t *map;
       unsigned stride;
       unsigned layer_stride;
       unsigned format_bytes;
       unsigned sample_stride;
       unsigned nr_samples;
+      /** llvmpipe_resource::msaa_equal, if the scene keeps it up to date */
+      uint8_t *msaa_equal;
+      unsigned msaa_equal_stride;
    } zsbuf, cbufs[PIPE_MAX_COLOR_BUFS];
 
    /* The amount of layers in the fb (minimum of all attachments) */
@@ -162,6 +216,13 @@ struct lp_scene {
    /** list of resources referenced by the scene commands */
    struct resource_ref *resources;
 
+   /** Maps the resources to LP_REFERENCED_FOR_x, for O(1) lookups */
+   struct hash_table *resource_table;
+
+   /** storage to free with the scene, see lp_scene_retire_data() */
+   struct retired_data *retired;
+   size_t retired_size;
+
    /** Total memory used by the scene (in bytes).  This sums all the
     * data blocks and counts all bins, state, resource references and
     * other random allocations within the scene.
@@ -174,21 +235,90 @@ struct lp_scene {
    unsigned resource_reference_size;
 
    boolean alloc_failed;
+   /**
+    * Tile size used for this scene, picked by lp_scene_begin_binning():
+    * TILE_ORDER, or down to LP_MIN_TILE_ORDER when the framebuffer is too
+    * small to give all the rasterizer threads some bins to work on.
+    */
+   unsigned tile_order;
+   unsigned tile_size;
+   /** 16x16 blocks of a TILE_SIZE tile which are outside smaller tiles */
+   unsigned block16_outmask;
+
    /**
     * Number of active tiles in each dimension.
     * This basically the framebuffer size divided by tile size
     */
    unsigned tiles_x, tiles_y;
 
-   int curr_x, curr_y;  /**< for iterating over bins */
-   mtx_t mutex;
+   /**
+    * Layered framebuffers get a bin per tile and layer, so that the
+    * threads can work on the layers of a tile at once, and each bin only
+    * clears its own layer.  Else 1, and each bin has the commands for all
+    * the layers of its tile.  bin_layer is the one lp_scene_get_bin() and
+    * the binning functions below address.
+    */
+   unsigned num_layer_bins;
+   unsigned bin_layer;
+
+   /**
+    * Bounds of the bins with commands writing color, inclusive, empty
+    * while color_x1 < color_x0.  Added to the color buffers' dirty region
+    * when the scene is queued, see llvmpipe_resource_add_dirty().
+    */
+   int color_x0, color_y0, color_x1, color_y1;
+
+   /** Bins to rasterize, in the order they're handed out to the
+    * rasterizer threads.  Built by lp_scene_end_binning(), skipping the
+    * empty bins.
+    */
+   struct lp_scene_bin_ref *bin_order;
+   unsigned bin_order_size;    /**< allocated entries */
+   unsigned num_active_bins;   /**< used entries */
+   unsigned curr_bin;          /**< next entry, atomically incremented */
+   unsigned num_cmds;          /**< in all the bins, ~0 if unknown */
 
-   struct cmd_bin tile[TILES_X][TILES_Y];
+   /**
+    * tiles_x * tiles_y * num_layer_bins bins, grown as needed by
+    * lp_scene_begin_binning()
+    */
+   struct cmd_bin *tiles;
+   unsigned num_tiles_alloc;
    struct data_block_list data;
+
+   /** Made by lp_scene_fork(), binning for another scene */
+   boolean is_fork;
+
+   /** See lp_trace_begin(), set by lp_scene_begin_binning() */
+   int64_t trace_binning_start;
+
+   /** os_time_get_nano() when queued to the threads, if counting */
+   int64_t queue_time;
+
+   /**
+    * pipe_context::set_progress_callback() of cbufs[0], picked up by
+    * lp_scene_begin_binning().  row_bins counts the bins of each tile row
+    * still to rasterize, NULL if it couldn't be allocated, and rows_done
+    * the tile rows at the top with none left.
+    */
+   void (*progress_func)(void *data, unsigned rows);
+   void *progress_data;
+   unsigned *row_bins;
+   unsigned row_bins_size;
+   unsigned rows_done;
+   mtx_t progress_mutex;
 };
 
 
 
+struct lp_scene_block_pool *lp_scene_block_pool_create(void);
+
+void lp_scene_block_pool_destroy(struct lp_scene_block_pool *pool);
+
+uint64_t lp_scene_block_pool_memory(struct lp_scene_block_pool *pool);
+
+void lp_scene_block_pool_trim(struct lp_scene_block_pool *pool);
+
 struct lp_scene *lp_scene_create(struct pipe_context *pipe);
 
 void lp_scene_destroy(struct lp_scene *scene);
@@ -196,6 +326,8 @@ void lp_scene_destroy(struct lp_scene *scene);
 boolean lp_scene_is_empty(struct lp_scene *scene );
 boolean lp_scene_is_oom(struct lp_scene *scene );
 
+uint64_t lp_scene_memory(const struct lp_scene *scene);
+
 
 struct data_block *lp_scene_new_data_block( struct lp_scene *scene );
 
@@ -204,10 +336,14 @@ struct cmd_block *lp_scene_new_cmd_block( struct lp_scene *scene,
 
 boolean lp_scene_add_resource_reference(struct lp_scene *scene,
                                         struct pipe_resource *resource,
-                                        boolean initializing_scene);
+                                        boolean initializing_scene,
+                                        boolean writeable);
 
-boolean lp_scene_is_resource_referenced(const struct lp_scene *scene,
-                                        const struct pipe_resource *resource );
+unsigned lp_scene_is_resource_referenced(const struct lp_scene *scene,
+                                         const struct pipe_resource *resource );
+
+boolean lp_scene_retire_data(struct lp_scene *scene, void *data,
+                             size_t size);
 
 
 /**
@@ -253,27 +389,30 @@ lp_scene_alloc_aligned( struct lp_scene *scene, unsigned size,
 {
    struct data_block_list *list = &scene->data;
    struct data_block *block = list->head;
+   unsigned offset;
 
    assert(block != NULL);
+   assert(util_is_power_of_two_nonzero(alignment) &&
+          alignment <= DATA_BLOCK_ALIGN);
+
+   /* The block data is aligned, so aligning the offset is enough */
+   offset = align(block->used, alignment);
 
    if (LP_DEBUG & DEBUG_MEM)
       debug_printf("alloc %u block %u/%u tot %u/%u\n",
-		   size + alignment - 1,
+		   size + offset - block->used,
 		   block->used, DATA_BLOCK_SIZE,
 		   scene->scene_size, LP_SCENE_MAX_SIZE);
-       
-   if (block->used + size + alignment - 1 > DATA_BLOCK_SIZE) {
+
+   if (offset + size > DATA_BLOCK_SIZE) {
       block = lp_scene_new_data_block( scene );
       if (!block)
          return NULL;
+      offset = 0;
    }
 
-   {
-      ubyte *data = block->data + block->used;
-      unsigned offset = (((uintptr_t)data + alignment - 1) & ~(alignment - 1)) - (uintptr_t)data;
-      block->used += offset + size;
-      return data + offset;
-   }
+   block->used = offset + size;
+   return block->data + offset;
 }
 
 
@@ -288,11 +427,32 @@ lp_scene_putback_data( struct lp_scene *scene, unsigned size)
 }
 
 
-/** Return pointer to a particular tile's bin. */
+/** Return pointer to the bin of a particular tile and bin layer. */
+static inline struct cmd_bin *
+lp_scene_get_layer_bin(struct lp_scene *scene,
+                       unsigned x, unsigned y, unsigned layer)
+{
+   assert(layer < scene->num_layer_bins);
+   return &scene->tiles[(layer * scene->tiles_y + y) * scene->tiles_x + x];
+}
+
+
+/** Return pointer to a particular tile's bin, in lp_scene::bin_layer. */
 static inline struct cmd_bin *
 lp_scene_get_bin(struct lp_scene *scene, unsigned x, unsigned y)
 {
-   return &scene->tile[x][y];
+   return lp_scene_get_layer_bin(scene, x, y, scene->bin_layer);
+}
+
+
+/**
+ * Have the next commands binned for layer, which primitives are clamped
+ * to lp_scene::fb_max_layer.
+ */
+static inline void
+lp_scene_set_bin_layer(struct lp_scene *scene, unsigned layer)
+{
+   scene->bin_layer = scene->num_layer_bins > 1 ? layer : 0;
 }
 
 
@@ -330,6 +490,13 @@ lp_scene_bin_command( struct lp_scene *scene,
       tail->arg[i] = arg;
       tail->count++;
    }
+
+   if (lp_rast_op_writes_color(cmd)) {
+      scene->color_x0 = MIN2(scene->color_x0, (int) x);
+      scene->color_y0 = MIN2(scene->color_y0, (int) y);
+      scene->color_x1 = MAX2(scene->color_x1, (int) x);
+      scene->color_y1 = MAX2(scene->color_y1, (int) y);
+   }
    
    return TRUE;
 }
@@ -359,21 +526,29 @@ lp_scene_bin_cmd_with_state( struct lp_scene *scene,
 }
 
 
-/* Add a command to all active bins.
+/* Add a command to all active bins, of all the layers.
  */
 static inline boolean
 lp_scene_bin_everywhere( struct lp_scene *scene,
 			 unsigned cmd,
 			 const union lp_rast_cmd_arg arg )
 {
+   const unsigned bin_layer = scene->bin_layer;
    unsigned i, j;
-   for (i = 0; i < scene->tiles_x; i++) {
-      for (j = 0; j < scene->tiles_y; j++) {
-         if (!lp_scene_bin_command( scene, i, j, cmd, arg ))
-            return FALSE;
+
+   for (scene->bin_layer = 0; scene->bin_layer < scene->num_layer_bins;
+        scene->bin_layer++) {
+      for (i = 0; i < scene->tiles_x; i++) {
+         for (j = 0; j < scene->tiles_y; j++) {
+            if (!lp_scene_bin_command( scene, i, j, cmd, arg )) {
+               scene->bin_layer = bin_layer;
+               return FALSE;
+            }
+         }
       }
    }
 
+   scene->bin_layer = bin_layer;
    return TRUE;
 }
 
@@ -381,7 +556,7 @@ lp_scene_bin_everywhere( struct lp_scene *scene,
 static inline unsigned
 lp_scene_get_num_bins( const struct lp_scene *scene )
 {
-   return scene->tiles_x * scene->tiles_y;
+   return scene->tiles_x * scene->tiles_y * scene->num_layer_bins;
 }
 
 
@@ -389,15 +564,24 @@ void
 lp_scene_bin_iter_begin( struct lp_scene *scene );
 
 struct cmd_bin *
-lp_scene_bin_iter_next( struct lp_scene *scene, int *x, int *y );
+lp_scene_bin_iter_next( struct lp_scene *scene, int *x, int *y,
+                        unsigned *layer );
+
+void
+lp_scene_bin_done(struct lp_scene *scene, int y);
+
+void
+lp_scene_progress_end(struct lp_scene *scene);
 
 
 
 /* Begin/end binning of a scene
  */
-void
+boolean
 lp_scene_begin_binning(struct lp_scene *scene,
-                       struct pipe_framebuffer_state *fb);
+                       struct pipe_framebuffer_state *fb,
+                       unsigned num_threads,
+                       unsigned tile_order);
 
 void
 lp_scene_end_binning(struct lp_scene *scene);
@@ -412,6 +596,27 @@ void
 lp_scene_end_rasterization(struct lp_scene *scene);
 
 
+/* Make a scene whose rasterization is complete ready for binning again
+ */
+void
+lp_scene_recycle(struct lp_scene *scene);
+
+
+/* Bin into private copies of a scene's bins, from another thread, and
+ * append them to the scene's bins afterwards.
+ */
+boolean
+lp_scene_fork(struct lp_scene *scene, struct lp_scene *fork,
+              unsigned max_size);
+
+void
+lp_scene_join(struct lp_scene *scene, struct lp_scene *fork,
+              boolean keep_bins);
+
+void
+lp_scene_fork_destroy(struct lp_scene *fork);
+
+
 
 
 
@@ -36,21 +36,33 @@
 #include "pipe/p_defines.h"
 #include "pipe/p_screen.h"
 #include "draw/draw_context.h"
+#include "gallivm/lp_bld_init.h"
 #include "gallivm/lp_bld_type.h"
 #include "gallivm/lp_bld_nir.h"
+#include "util/blob.h"
 #include "util/disk_cache.h"
+#include "util/hash_table.h"
+#include "util/list.h"
+#include "util/os_file.h"
 #include "util/os_misc.h"
+#include "util/u_dynarray.h"
 #include "util/os_time.h"
+#include "util/detect_os.h"
 #include "lp_texture.h"
 #include "lp_fence.h"
 #include "lp_jit.h"
 #include "lp_screen.h"
+#include "lp_scene.h"
+#include "lp_state_fs.h"
 #include "lp_context.h"
 #include "lp_debug.h"
 #include "lp_public.h"
+#include "lp_query.h"
 #include "lp_limits.h"
 #include "lp_rast.h"
 #include "lp_cs_tpool.h"
+#include "lp_perf.h"
+#include "lp_trace.h"
 
 #include "frontend/sw_winsys.h"
 
@@ -90,10 +102,57 @@ static const struct debug_named_value lp_perf_flags[] = {
    { "no_blend",       PERF_NO_BLEND, NULL },
    { "no_depth",       PERF_NO_DEPTH, NULL },
    { "no_alphatest",   PERF_NO_ALPHATEST, NULL },
+   { "sort_bins",      PERF_SORT_BINS, NULL },
+   { "no_hiz",         PERF_NO_HIZ, NULL },
+   { "counters",       PERF_COUNTERS, NULL },
+   { "profile",        PERF_PROFILE_FS, NULL },
+   { "no_msaa_compress", PERF_NO_MSAA_COMPRESS, NULL },
+   { "pipeline",       PERF_PIPELINE, NULL },
+   { "tile_local",     PERF_TILE_LOCAL, NULL },
+   { "startup",        PERF_STARTUP, NULL },
    DEBUG_NAMED_VALUE_END
 };
 
 
+static const struct debug_named_value lp_thread_affinity_values[] = {
+   { "none",  LP_THREAD_AFFINITY_NONE, "let the OS place the threads" },
+   { "cpu",   LP_THREAD_AFFINITY_CPU, "pin each thread to one CPU core" },
+   { "l3",    LP_THREAD_AFFINITY_L3, "pin threads to groups of cores sharing an L3 cache" },
+   DEBUG_NAMED_VALUE_END
+};
+
+
+/**
+ * Apply the LP_THREAD_AFFINITY policy to rasterizer/compute thread
+ * number \p index out of \p num_threads.
+ *
+ * With "l3", consecutive threads share an L3 cache, so threads working on
+ * neighbouring bins share cache, and on multi-socket machines (where each
+ * socket has its own L3) each socket gets a contiguous range of threads.
+ */
+void
+lp_pin_thread(thrd_t thread, enum lp_thread_affinity affinity,
+              unsigned index, unsigned num_threads)
+{
+   unsigned nr_cpus = MAX2(util_cpu_caps.nr_cpus, 1);
+   unsigned cores_per_L3 = MAX2(util_cpu_caps.cores_per_L3, 1);
+   unsigned num_L3 = MAX2(nr_cpus / cores_per_L3, 1);
+
+   switch (affinity) {
+   case LP_THREAD_AFFINITY_CPU:
+      util_pin_thread_to_cpu(thread, index % nr_cpus);
+      break;
+   case LP_THREAD_AFFINITY_L3:
+      util_pin_thread_to_L3(thread, (index * num_L3) / MAX2(num_threads, 1),
+                            cores_per_L3);
+      break;
+   case LP_THREAD_AFFINITY_NONE:
+   default:
+      break;
+   }
+}
+
+
 static const char *
 llvmpipe_get_vendor(struct pipe_screen *screen)
 {
@@ -111,6 +170,26 @@ llvmpipe_get_name(struct pipe_screen *screen)
 }
 
 
+/**
+ * UUIDs for EXT_memory_object: memory objects can only be shared with
+ * other llvmpipe instances, which all see the same CPU memory.
+ */
+static void
+llvmpipe_get_driver_uuid(struct pipe_screen *screen, char *uuid)
+{
+   memset(uuid, 0, PIPE_UUID_SIZE);
+   snprintf(uuid, PIPE_UUID_SIZE, "llvmpipeUUID");
+}
+
+
+static void
+llvmpipe_get_device_uuid(struct pipe_screen *screen, char *uuid)
+{
+   memset(uuid, 0, PIPE_UUID_SIZE);
+   snprintf(uuid, PIPE_UUID_SIZE, "llvmpipeCPU");
+}
+
+
 static int
 llvmpipe_get_param(struct pipe_screen *screen, enum pipe_cap param)
 {
@@ -133,6 +212,7 @@ llvmpipe_get_param(struct pipe_screen *screen, enum pipe_cap param)
       return PIPE_MAX_COLOR_BUFS;
    case PIPE_CAP_OCCLUSION_QUERY:
    case PIPE_CAP_QUERY_TIMESTAMP:
+   case PIPE_CAP_QUERY_TIME_ELAPSED:
       return 1;
    case PIPE_CAP_QUERY_PIPELINE_STATISTICS:
       return 1;
@@ -156,6 +236,13 @@ llvmpipe_get_param(struct pipe_screen *screen, enum pipe_cap param)
       return 1;
    case PIPE_CAP_INDEP_BLEND_FUNC:
       return 1;
+   case PIPE_CAP_SHAREABLE_STATE_OBJECTS:
+      return 1;
+   /* The draw module fetches user vertex and index buffers during
+    * draw_vbo and only uses the index bounds as a hint.
+    */
+   case PIPE_CAP_USER_VERTEX_BUFFERS_DIRECT:
+      return 1;
    case PIPE_CAP_TGSI_FS_COORD_ORIGIN_UPPER_LEFT:
    case PIPE_CAP_TGSI_FS_COORD_PIXEL_CENTER_INTEGER:
    case PIPE_CAP_TGSI_FS_COORD_PIXEL_CENTER_HALF_INTEGER:
@@ -230,6 +317,11 @@ llvmpipe_get_param(struct pipe_screen *screen, enum pipe_cap param)
       return 16;
    case PIPE_CAP_PREFER_BLIT_BASED_TEXTURE_TRANSFER:
       return 0;
+   case PIPE_CAP_GL_BEGIN_END_BUFFER_SIZE:
+      /* Buffers are user memory, larger ones make larger glBegin draws */
+      return 2 * 1024 * 1024;
+   case PIPE_CAP_GENERATE_MIPMAP:
+      return 1;
    case PIPE_CAP_MAX_VIEWPORTS:
       return PIPE_MAX_VIEWPORTS;
    case PIPE_CAP_ENDIANNESS:
@@ -314,17 +406,35 @@ llvmpipe_get_param(struct pipe_screen *screen, enum pipe_cap param)
    case PIPE_CAP_DEVICE_RESET_STATUS_QUERY:
    case PIPE_CAP_ROBUST_BUFFER_ACCESS_BEHAVIOR:
       return 1;
+   case PIPE_CAP_RESOURCE_FROM_USER_MEMORY:
+      return 1;
+   case PIPE_CAP_MEMOBJ:
+      return DETECT_OS_UNIX;
+   case PIPE_CAP_SPARSE_BUFFER_PAGE_SIZE:
+      return DETECT_OS_UNIX ? LP_SPARSE_PAGE_SIZE : 0;
    case PIPE_CAP_MAX_SHADER_PATCH_VARYINGS:
       return 32;
    case PIPE_CAP_RASTERIZER_SUBPIXEL_BITS:
       return 8;
+   case PIPE_CAP_CONSERVATIVE_RASTER_POST_SNAP_TRIANGLES:
+   case PIPE_CAP_CONSERVATIVE_RASTER_POST_SNAP_POINTS_LINES:
+      return 1;
+   case PIPE_CAP_MAX_CONSERVATIVE_RASTER_SUBPIXEL_PRECISION_BIAS:
+      /* Accepted, but the snapping grid stays RASTERIZER_SUBPIXEL_BITS */
+      return 2;
    case PIPE_CAP_PCI_GROUP:
    case PIPE_CAP_PCI_BUS:
    case PIPE_CAP_PCI_DEVICE:
    case PIPE_CAP_PCI_FUNCTION:
-   case PIPE_CAP_GLSL_OPTIMIZE_CONSERVATIVELY:
    case PIPE_CAP_ALLOW_MAPPED_BUFFERS_DURING_EXECUTION:
       return 0;
+   case PIPE_CAP_GLSL_OPTIMIZE_CONSERVATIVELY: {
+      /* NIR redoes the GLSL IR optimizations, only glsl_to_tgsi needs
+       * them run to a fixed point.
+       */
+      struct llvmpipe_screen *lscreen = llvmpipe_screen(screen);
+      return !lscreen->use_tgsi;
+   }
    case PIPE_CAP_MAX_GS_INVOCATIONS:
       return 32;
    case PIPE_CAP_MAX_SHADER_BUFFER_SIZE:
@@ -335,10 +445,13 @@ llvmpipe_get_param(struct pipe_screen *screen, enum pipe_cap param)
       return 1;
    case PIPE_CAP_TGSI_TXQS:
    case PIPE_CAP_TGSI_VOTE:
+   case PIPE_CAP_TGSI_BALLOT:
    case PIPE_CAP_LOAD_CONSTBUF:
    case PIPE_CAP_TEXTURE_MULTISAMPLE:
    case PIPE_CAP_SAMPLE_SHADING:
    case PIPE_CAP_POST_DEPTH_COVERAGE:
+   case PIPE_CAP_CONSERVATIVE_RASTER_POST_DEPTH_COVERAGE:
+   case PIPE_CAP_CONSERVATIVE_RASTER_INNER_COVERAGE:
    case PIPE_CAP_PACKED_UNIFORMS: {
       struct llvmpipe_screen *lscreen = llvmpipe_screen(screen);
       return !lscreen->use_tgsi;
@@ -423,15 +536,15 @@ llvmpipe_get_paramf(struct pipe_screen *screen, enum pipe_capf param)
    case PIPE_CAPF_MAX_POINT_WIDTH_AA:
       return LP_MAX_POINT_WIDTH; /* arbitrary */
    case PIPE_CAPF_MAX_TEXTURE_ANISOTROPY:
-      return 16.0; /* not actually signficant at this time */
+      return 16.0;
    case PIPE_CAPF_MAX_TEXTURE_LOD_BIAS:
       return 16.0; /* arbitrary */
    case PIPE_CAPF_MIN_CONSERVATIVE_RASTER_DILATE:
       return 0.0;
    case PIPE_CAPF_MAX_CONSERVATIVE_RASTER_DILATE:
-      return 0.0;
+      return 0.75;
    case PIPE_CAPF_CONSERVATIVE_RASTER_DILATE_GRANULARITY:
-      return 0.0;
+      return 0.25;
    }
    /* should only get here on unhandled cases */
    debug_printf("Unexpected PIPE_CAP %d query\n", param);
@@ -516,7 +629,8 @@ llvmpipe_get_compute_param(struct pipe_screen *_screen,
    case PIPE_COMPUTE_CAP_SUBGROUP_SIZE:
       if (ret) {
          uint32_t *subgroup_size = ret;
-         *subgroup_size = 32;
+         /* One lane of the compute shader vector per invocation. */
+         *subgroup_size = MIN2(lp_native_vector_width / 32, 16);
       }
       return sizeof(uint32_t);
    case PIPE_COMPUTE_CAP_MAX_COMPUTE_UNITS:
@@ -626,7 +740,7 @@ llvmpipe_is_format_supported( struct pipe_screen *_screen,
           target == PIPE_TEXTURE_CUBE ||
           target == PIPE_TEXTURE_CUBE_ARRAY);
 
-   if (sample_count != 0 && sample_count != 1 && sample_count != 4)
+   if (sample_count > 1 && !lp_sample_pos(sample_count))
       return false;
 
    if (MAX2(1, sample_count) != MAX2(1, storage_sample_count))
@@ -717,34 +831,78 @@ llvmpipe_flush_frontbuffer(struct pipe_screen *_screen,
    struct sw_winsys *winsys = screen->winsys;
    struct llvmpipe_resource *texture = llvmpipe_resource(resource);
 
+   struct lp_fence *fence = NULL;
+   int64_t trace_start = lp_trace_begin();
+
+   /* Contexts don't wait for their scenes to be rasterized when
+    * flushing, so make sure whatever was rendered is there before it's
+    * handed over to the winsys.
+    */
+   mtx_lock(&screen->rast_mutex);
+   lp_fence_reference(&fence, texture->dt_fence);
+   mtx_unlock(&screen->rast_mutex);
+   if (fence) {
+      lp_fence_wait(fence);
+      lp_fence_reference(&fence, NULL);
+   }
+
    assert(texture->dt);
    if (texture->dt)
       winsys->displaytarget_display(winsys, texture->dt, context_private, sub_box);
+
+   LP_TRACE_END_ARGS("flush_frontbuffer", trace_start, "width,height",
+                     resource->width0, resource->height0, 0);
 }
 
+static void
+lp_code_cache_destroy(struct llvmpipe_screen *screen);
+
+static void
+lp_manifest_destroy(struct llvmpipe_screen *screen);
+
 static void
 llvmpipe_destroy_screen( struct pipe_screen *_screen )
 {
    struct llvmpipe_screen *screen = llvmpipe_screen(_screen);
    struct sw_winsys *winsys = screen->winsys;
 
+   if (util_queue_is_initialized(&screen->jit_queue))
+      util_queue_destroy(&screen->jit_queue);
+
+   if (util_queue_is_initialized(&screen->bin_queue))
+      util_queue_destroy(&screen->bin_queue);
+
    if (screen->cs_tpool)
       lp_cs_tpool_destroy(screen->cs_tpool);
 
    if (screen->rast)
       lp_rast_destroy(screen->rast);
 
+   lp_trace_write();
+
+   lp_scene_block_pool_destroy(screen->block_pool);
+
    lp_jit_screen_cleanup(screen);
 
-   if (LP_DEBUG & DEBUG_CACHE_STATS)
+   lp_code_arena_destroy(screen->code_arena);
+
+   if (LP_DEBUG & DEBUG_CACHE_STATS) {
       printf("disk shader cache:   hits = %u, misses = %u\n", screen->num_disk_shader_cache_hits,
              screen->num_disk_shader_cache_misses);
+      printf("memory code cache:   hits = %u, size = %zu\n", screen->num_code_cache_hits,
+             screen->code_cache_size);
+   }
    disk_cache_destroy(screen->disk_shader_cache);
+   lp_code_cache_destroy(screen);
+   lp_manifest_destroy(screen);
    if(winsys->destroy)
       winsys->destroy(winsys);
 
    glsl_type_singleton_decref();
 
+   slab_destroy_parent(&screen->pool_transfers);
+   slab_mt_destroy(&screen->transfer_pool);
+   slab_mt_destroy(&screen->fence_pool);
    mtx_destroy(&screen->rast_mutex);
    mtx_destroy(&screen->cs_mutex);
    FREE(screen);
@@ -779,6 +937,10 @@ llvmpipe_fence_finish(struct pipe_screen *screen,
 {
    struct lp_fence *f = (struct lp_fence *) fence_handle;
 
+   /* A deferred fence is the one of a scene still being binned */
+   if (!lp_fence_issued(f) && ctx)
+      ctx->flush(ctx, NULL, 0);
+
    if (!timeout)
       return lp_fence_signalled(f);
 
@@ -797,6 +959,35 @@ llvmpipe_get_timestamp(struct pipe_screen *_screen)
    return os_time_get_nano();
 }
 
+/**
+ * Lower (or restore) the number of JIT threads, for
+ * KHR_parallel_shader_compile.  LP_JIT_THREADS stays the upper limit.
+ */
+static void
+llvmpipe_set_max_shader_compiler_threads(struct pipe_screen *_screen,
+                                         unsigned max_threads)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(_screen);
+
+   if (util_queue_is_initialized(&screen->jit_queue))
+      util_queue_adjust_num_threads(&screen->jit_queue, max_threads);
+}
+
+/**
+ * pipe_screen::is_parallel_shader_compilation_finished.  Only fragment
+ * shader variants are compiled on jit_queue.
+ */
+static bool
+llvmpipe_is_parallel_shader_compilation_finished(struct pipe_screen *_screen,
+                                                 void *shader,
+                                                 unsigned shader_type)
+{
+   if (shader_type != PIPE_SHADER_FRAGMENT)
+      return true;
+
+   return llvmpipe_fs_variants_compiled((struct lp_fragment_shader *) shader);
+}
+
 static void lp_disk_cache_create(struct llvmpipe_screen *screen)
 {
    struct mesa_sha1 ctx;
@@ -821,12 +1012,143 @@ static struct disk_cache *lp_get_disk_shader_cache(struct pipe_screen *_screen)
    return screen->disk_shader_cache;
 }
 
+static uint32_t
+lp_sha1_key_hash(const void *key)
+{
+   return _mesa_hash_data(key, 20);
+}
+
+static bool
+lp_sha1_key_equal(const void *a, const void *b)
+{
+   return memcmp(a, b, 20) == 0;
+}
+
+/*
+ * In-memory code cache.
+ *
+ * The object code of every variant compiled, or loaded from the disk
+ * cache, by IR cache key, so that the other contexts of the screen don't
+ * have to go to the disk cache or compile the very same variant again.
+ * The least recently used code is dropped to stay within
+ * LP_CODE_CACHE_SIZE.  Lookups get a copy, which the caller frees with
+ * the variant's IR as it would a disk cache buffer.
+ */
+struct lp_code_cache_entry
+{
+   unsigned char ir_sha1[20];
+   struct list_head link;   /**< in screen->code_cache_lru, newest first */
+   size_t size;
+   uint8_t data[];
+};
+
+static void
+lp_code_cache_create(struct llvmpipe_screen *screen)
+{
+   (void) mtx_init(&screen->code_cache_mutex, mtx_plain);
+   list_inithead(&screen->code_cache_lru);
+
+   screen->code_cache_max_size =
+      (size_t)debug_get_num_option("LP_CODE_CACHE_SIZE", 16 * 1024) * 1024;
+   if (screen->code_cache_max_size)
+      screen->code_cache = _mesa_hash_table_create(NULL, lp_sha1_key_hash,
+                                                   lp_sha1_key_equal);
+}
+
+static void
+lp_code_cache_destroy(struct llvmpipe_screen *screen)
+{
+   if (screen->code_cache) {
+      list_for_each_entry_safe(struct lp_code_cache_entry, entry,
+                               &screen->code_cache_lru, link)
+         FREE(entry);
+      _mesa_hash_table_destroy(screen->code_cache, NULL);
+   }
+   mtx_destroy(&screen->code_cache_mutex);
+}
+
+static bool
+lp_code_cache_find(struct llvmpipe_screen *screen,
+                   struct lp_cached_code *cache,
+                   const unsigned char ir_sha1_cache_key[20])
+{
+   struct hash_entry *he;
+   bool found = false;
+
+   if (!screen->code_cache)
+      return false;
+
+   mtx_lock(&screen->code_cache_mutex);
+   he = _mesa_hash_table_search(screen->code_cache, ir_sha1_cache_key);
+   if (he) {
+      struct lp_code_cache_entry *entry = he->data;
+
+      cache->data = malloc(entry->size);
+      if (cache->data) {
+         memcpy(cache->data, entry->data, entry->size);
+         cache->data_size = entry->size;
+         list_del(&entry->link);
+         list_add(&entry->link, &screen->code_cache_lru);
+         found = true;
+      }
+   }
+   mtx_unlock(&screen->code_cache_mutex);
+
+   return found;
+}
+
+static void
+lp_code_cache_insert(struct llvmpipe_screen *screen,
+                     const struct lp_cached_code *cache,
+                     const unsigned char ir_sha1_cache_key[20])
+{
+   struct lp_code_cache_entry *entry;
+
+   if (!screen->code_cache || cache->data_size > screen->code_cache_max_size)
+      return;
+
+   entry = MALLOC(sizeof(*entry) + cache->data_size);
+   if (!entry)
+      return;
+   memcpy(entry->ir_sha1, ir_sha1_cache_key, 20);
+   entry->size = cache->data_size;
+   memcpy(entry->data, cache->data, cache->data_size);
+
+   mtx_lock(&screen->code_cache_mutex);
+   /* Another context may have been compiling the same variant. */
+   if (_mesa_hash_table_search(screen->code_cache, entry->ir_sha1)) {
+      mtx_unlock(&screen->code_cache_mutex);
+      FREE(entry);
+      return;
+   }
+
+   while (screen->code_cache_size + entry->size > screen->code_cache_max_size) {
+      struct lp_code_cache_entry *oldest =
+         list_last_entry(&screen->code_cache_lru,
+                         struct lp_code_cache_entry, link);
+      _mesa_hash_table_remove_key(screen->code_cache, oldest->ir_sha1);
+      list_del(&oldest->link);
+      screen->code_cache_size -= oldest->size;
+      FREE(oldest);
+   }
+
+   _mesa_hash_table_insert(screen->code_cache, entry->ir_sha1, entry);
+   list_add(&entry->link, &screen->code_cache_lru);
+   screen->code_cache_size += entry->size;
+   mtx_unlock(&screen->code_cache_mutex);
+}
+
 void lp_disk_cache_find_shader(struct llvmpipe_screen *screen,
                                struct lp_cached_code *cache,
                                unsigned char ir_sha1_cache_key[20])
 {
    unsigned char sha1[CACHE_KEY_SIZE];
 
+   if (lp_code_cache_find(screen, cache, ir_sha1_cache_key)) {
+      p_atomic_inc(&screen->num_code_cache_hits);
+      return;
+   }
+
    if (!screen->disk_shader_cache)
       return;
    disk_cache_compute_key(screen->disk_shader_cache, ir_sha1_cache_key, 20, sha1);
@@ -841,6 +1163,8 @@ void lp_disk_cache_find_shader(struct llvmpipe_screen *screen,
    cache->data_size = binary_size;
    cache->data = buffer;
    p_atomic_inc(&screen->num_disk_shader_cache_hits);
+
+   lp_code_cache_insert(screen, cache, ir_sha1_cache_key);
 }
 
 void lp_disk_cache_insert_shader(struct llvmpipe_screen *screen,
@@ -849,11 +1173,485 @@ void lp_disk_cache_insert_shader(struct llvmpipe_screen *screen,
 {
    unsigned char sha1[CACHE_KEY_SIZE];
 
-   if (!screen->disk_shader_cache || !cache->data_size || cache->dont_cache)
+   if (!cache->data_size || cache->dont_cache)
+      return;
+
+   lp_code_cache_insert(screen, cache, ir_sha1_cache_key);
+
+   if (!screen->disk_shader_cache)
       return;
    disk_cache_compute_key(screen->disk_shader_cache, ir_sha1_cache_key, 20, sha1);
    disk_cache_put(screen->disk_shader_cache, sha1, cache->data, cache->data_size, NULL);
 }
+
+
+/*
+ * Shader variant manifest.
+ *
+ * For each fragment shader seen, by the sha1 of its IR, the variant keys
+ * it was compiled for.  Saved to a file, another process can load it to
+ * compile those variants as soon as the shaders are created:
+ *
+ *    uint32  LP_MANIFEST_MAGIC, LP_MANIFEST_VERSION
+ *    uint8   build id[20]
+ *    then for each shader:
+ *    uint8   ir sha1[20]
+ *    uint32  key size, number of keys
+ *    uint8   keys[number of keys][key size]
+ */
+#define LP_MANIFEST_MAGIC 0x4d53504c /* "LPSM" */
+#define LP_MANIFEST_VERSION 1
+
+struct lp_manifest_shader
+{
+   unsigned char ir_sha1[20];
+   unsigned key_size;
+   struct util_dynarray keys;
+};
+
+static void
+lp_manifest_create(struct llvmpipe_screen *screen)
+{
+   struct mesa_sha1 ctx;
+
+   (void) mtx_init(&screen->manifest_mutex, mtx_plain);
+
+   /* Keys are only meaningful to the build which wrote them. */
+   _mesa_sha1_init(&ctx);
+   if (!disk_cache_get_function_identifier(lp_manifest_create, &ctx) ||
+       !disk_cache_get_function_identifier(LLVMLinkInMCJIT, &ctx))
+      return;
+   _mesa_sha1_final(&ctx, screen->manifest_build_id);
+
+   screen->manifest = _mesa_hash_table_create(NULL, lp_sha1_key_hash,
+                                              lp_sha1_key_equal);
+}
+
+static void
+lp_manifest_destroy(struct llvmpipe_screen *screen)
+{
+   if (screen->manifest) {
+      hash_table_foreach(screen->manifest, entry) {
+         struct lp_manifest_shader *shader = entry->data;
+         util_dynarray_fini(&shader->keys);
+         FREE(shader);
+      }
+      _mesa_hash_table_destroy(screen->manifest, NULL);
+   }
+   mtx_destroy(&screen->manifest_mutex);
+}
+
+static void
+lp_manifest_add_locked(struct llvmpipe_screen *screen,
+                       const unsigned char ir_sha1[20],
+                       const void *key, unsigned key_size)
+{
+   struct lp_manifest_shader *shader;
+   struct hash_entry *entry;
+   unsigned i, num_keys;
+   void *dst;
+
+   entry = _mesa_hash_table_search(screen->manifest, ir_sha1);
+   if (entry) {
+      shader = entry->data;
+      if (shader->key_size != key_size)
+         return;
+
+      num_keys = shader->keys.size / key_size;
+      for (i = 0; i < num_keys; i++) {
+         if (memcmp((const char *)shader->keys.data + i * key_size,
+                    key, key_size) == 0)
+            return;
+      }
+   }
+   else {
+      shader = CALLOC_STRUCT(lp_manifest_shader);
+      if (!shader)
+         return;
+      memcpy(shader->ir_sha1, ir_sha1, 20);
+      shader->key_size = key_size;
+      util_dynarray_init(&shader->keys, NULL);
+      if (!_mesa_hash_table_insert(screen->manifest, shader->ir_sha1, shader)) {
+         FREE(shader);
+         return;
+      }
+   }
+
+   dst = util_dynarray_grow_bytes(&shader->keys, 1, key_size);
+   if (!dst)
+      return;
+   memcpy(dst, key, key_size);
+}
+
+/**
+ * Note that a fragment shader variant with the given key was compiled.
+ */
+void lp_manifest_record(struct llvmpipe_screen *screen,
+                        const unsigned char ir_sha1[20],
+                        const void *key, unsigned key_size)
+{
+   if (!screen->manifest)
+      return;
+
+   mtx_lock(&screen->manifest_mutex);
+   lp_manifest_add_locked(screen, ir_sha1, key, key_size);
+   mtx_unlock(&screen->manifest_mutex);
+}
+
+/**
+ * Return a copy of the manifest's variant keys for the given shader, to
+ * be freed with FREE(), or NULL if there are none.
+ */
+void *lp_manifest_get_keys(struct llvmpipe_screen *screen,
+                           const unsigned char ir_sha1[20],
+                           unsigned key_size, unsigned *num_keys)
+{
+   struct hash_entry *entry;
+   void *keys = NULL;
+
+   *num_keys = 0;
+   if (!screen->manifest)
+      return NULL;
+
+   mtx_lock(&screen->manifest_mutex);
+   entry = _mesa_hash_table_search(screen->manifest, ir_sha1);
+   if (entry) {
+      struct lp_manifest_shader *shader = entry->data;
+      if (shader->key_size == key_size && shader->keys.size) {
+         keys = MALLOC(shader->keys.size);
+         if (keys) {
+            memcpy(keys, shader->keys.data, shader->keys.size);
+            *num_keys = shader->keys.size / key_size;
+         }
+      }
+   }
+   mtx_unlock(&screen->manifest_mutex);
+
+   return keys;
+}
+
+static bool
+lp_save_shader_manifest(struct pipe_screen *_screen, const char *path)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(_screen);
+   struct blob blob;
+   bool ok;
+   FILE *f;
+
+   if (!screen->manifest)
+      return false;
+
+   blob_init(&blob);
+   blob_write_uint32(&blob, LP_MANIFEST_MAGIC);
+   blob_write_uint32(&blob, LP_MANIFEST_VERSION);
+   blob_write_bytes(&blob, screen->manifest_build_id, 20);
+
+   mtx_lock(&screen->manifest_mutex);
+   hash_table_foreach(screen->manifest, entry) {
+      struct lp_manifest_shader *shader = entry->data;
+      blob_write_bytes(&blob, shader->ir_sha1, 20);
+      blob_write_uint32(&blob, shader->key_size);
+      blob_write_uint32(&blob, shader->keys.size / shader->key_size);
+      blob_write_bytes(&blob, shader->keys.data, shader->keys.size);
+   }
+   mtx_unlock(&screen->manifest_mutex);
+
+   ok = !blob.out_of_memory;
+   if (ok) {
+      f = fopen(path, "wb");
+      ok = f && fwrite(blob.data, 1, blob.size, f) == blob.size;
+      if (f && fclose(f) != 0)
+         ok = false;
+   }
+
+   blob_finish(&blob);
+   return ok;
+}
+
+static bool
+lp_load_shader_manifest(struct pipe_screen *_screen, const char *path)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(_screen);
+   struct blob_reader blob;
+   const void *build_id;
+   size_t size;
+   char *data;
+   bool ok;
+
+   if (!screen->manifest)
+      return false;
+
+   data = os_read_file(path, &size);
+   if (!data)
+      return false;
+
+   blob_reader_init(&blob, data, size);
+   ok = blob_read_uint32(&blob) == LP_MANIFEST_MAGIC &&
+        blob_read_uint32(&blob) == LP_MANIFEST_VERSION;
+   build_id = blob_read_bytes(&blob, 20);
+   ok = ok && build_id &&
+        memcmp(build_id, screen->manifest_build_id, 20) == 0;
+
+   mtx_lock(&screen->manifest_mutex);
+   while (ok && blob.current < blob.end) {
+      const unsigned char *ir_sha1 = blob_read_bytes(&blob, 20);
+      unsigned key_size = blob_read_uint32(&blob);
+      unsigned num_keys = blob_read_uint32(&blob);
+      const char *keys;
+      unsigned i;
+
+      if (blob.overrun || !key_size ||
+          key_size > LP_FS_MAX_VARIANT_KEY_SIZE ||
+          num_keys > (blob.end - blob.current) / key_size) {
+         ok = false;
+         break;
+      }
+
+      keys = blob_read_bytes(&blob, num_keys * key_size);
+      for (i = 0; i < num_keys; i++)
+         lp_manifest_add_locked(screen, ir_sha1, keys + i * key_size, key_size);
+   }
+   mtx_unlock(&screen->manifest_mutex);
+
+   free(data);
+   return ok;
+}
+
+/*
+ * Shader cache data, for API level caches such as Vulkan pipeline caches:
+ * the manifest and the in-memory code cache, as records which can be cut
+ * short after any of them:
+ *
+ *    uint32  LP_CACHE_DATA_MAGIC, LP_CACHE_DATA_VERSION
+ *    uint8   build and CPU id[20]
+ *    then for each record:
+ *    uint32  LP_CACHE_DATA_KEYS or LP_CACHE_DATA_CODE, size of the rest
+ *    for keys: uint8 ir sha1[20], uint32 key size, uint8 keys[][key size]
+ *    for code: uint8 ir cache key[20], uint8 object code[]
+ *
+ * The code is newest first, so what is cut off is the oldest.
+ */
+#define LP_CACHE_DATA_MAGIC 0x4443504c /* "LPCD" */
+#define LP_CACHE_DATA_VERSION 1
+#define LP_CACHE_DATA_HEADER_SIZE (2 * 4 + 20)
+#define LP_CACHE_DATA_KEYS 0
+#define LP_CACHE_DATA_CODE 1
+
+/* The object code is for the very CPU features LLVM was told about. */
+static void
+lp_cache_data_id(const struct llvmpipe_screen *screen, unsigned char id[20])
+{
+   struct util_cpu_caps caps = util_cpu_caps;
+   struct mesa_sha1 ctx;
+
+   caps.nr_cpus = 0;
+   caps.cores_per_L3 = 0;
+
+   _mesa_sha1_init(&ctx);
+   _mesa_sha1_update(&ctx, screen->manifest_build_id, 20);
+   _mesa_sha1_update(&ctx, &caps, sizeof(caps));
+   _mesa_sha1_final(&ctx, id);
+}
+
+static size_t
+lp_get_shader_cache_data(struct pipe_screen *_screen, void *data, size_t size)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(_screen);
+   struct blob_reader reader;
+   unsigned char id[20];
+   struct blob blob;
+   size_t written;
+
+   if (!screen->manifest)
+      return 0;
+
+   lp_cache_data_id(screen, id);
+
+   blob_init(&blob);
+   blob_write_uint32(&blob, LP_CACHE_DATA_MAGIC);
+   blob_write_uint32(&blob, LP_CACHE_DATA_VERSION);
+   blob_write_bytes(&blob, id, 20);
+
+   mtx_lock(&screen->manifest_mutex);
+   hash_table_foreach(screen->manifest, entry) {
+      struct lp_manifest_shader *shader = entry->data;
+      blob_write_uint32(&blob, LP_CACHE_DATA_KEYS);
+      blob_write_uint32(&blob, 20 + 4 + shader->keys.size);
+      blob_write_bytes(&blob, shader->ir_sha1, 20);
+      blob_write_uint32(&blob, shader->key_size);
+      blob_write_bytes(&blob, shader->keys.data, shader->keys.size);
+   }
+   mtx_unlock(&screen->manifest_mutex);
+
+   if (screen->code_cache) {
+      mtx_lock(&screen->code_cache_mutex);
+      list_for_each_entry(struct lp_code_cache_entry, entry,
+                          &screen->code_cache_lru, link) {
+         blob_write_uint32(&blob, LP_CACHE_DATA_CODE);
+         blob_write_uint32(&blob, 20 + entry->size);
+         blob_write_bytes(&blob, entry->ir_sha1, 20);
+         blob_write_bytes(&blob, entry->data, entry->size);
+      }
+      mtx_unlock(&screen->code_cache_mutex);
+   }
+
+   if (blob.out_of_memory) {
+      blob_finish(&blob);
+      return 0;
+   }
+
+   if (!data) {
+      written = blob.size;
+   }
+   else if (size < LP_CACHE_DATA_HEADER_SIZE) {
+      written = 0;
+   }
+   else {
+      /* Whole records only */
+      blob_reader_init(&reader, blob.data, blob.size);
+      blob_skip_bytes(&reader, LP_CACHE_DATA_HEADER_SIZE);
+      written = LP_CACHE_DATA_HEADER_SIZE;
+      while (reader.current < reader.end) {
+         size_t record_size;
+
+         blob_read_uint32(&reader);
+         record_size = 8 + blob_read_uint32(&reader);
+         if (written + record_size > size)
+            break;
+         blob_skip_bytes(&reader, record_size - 8);
+         written += record_size;
+      }
+      memcpy(data, blob.data, written);
+   }
+
+   blob_finish(&blob);
+   return written;
+}
+
+static bool
+lp_add_shader_cache_data(struct pipe_screen *_screen,
+                         const void *data, size_t size)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(_screen);
+   struct blob_reader blob;
+   unsigned char id[20];
+   const void *data_id;
+   bool ok;
+
+   if (!screen->manifest)
+      return false;
+
+   lp_cache_data_id(screen, id);
+
+   blob_reader_init(&blob, data, size);
+   ok = blob_read_uint32(&blob) == LP_CACHE_DATA_MAGIC &&
+        blob_read_uint32(&blob) == LP_CACHE_DATA_VERSION;
+   data_id = blob_read_bytes(&blob, 20);
+   ok = ok && data_id && memcmp(data_id, id, 20) == 0;
+
+   while (ok && blob.current < blob.end) {
+      unsigned type = blob_read_uint32(&blob);
+      unsigned record_size = blob_read_uint32(&blob);
+      const unsigned char *sha1;
+
+      if (blob.overrun || record_size < 20 ||
+          record_size > blob.end - blob.current) {
+         ok = false;
+         break;
+      }
+
+      sha1 = blob_read_bytes(&blob, 20);
+      record_size -= 20;
+
+      if (type == LP_CACHE_DATA_KEYS) {
+         unsigned key_size = blob_read_uint32(&blob);
+         const char *keys;
+         unsigned i, num_keys;
+
+         if (blob.overrun || record_size < 4 || !key_size ||
+             key_size > LP_FS_MAX_VARIANT_KEY_SIZE ||
+             (record_size - 4) % key_size) {
+            ok = false;
+            break;
+         }
+
+         num_keys = (record_size - 4) / key_size;
+         keys = blob_read_bytes(&blob, record_size - 4);
+
+         mtx_lock(&screen->manifest_mutex);
+         for (i = 0; i < num_keys; i++)
+            lp_manifest_add_locked(screen, sha1, keys + i * key_size, key_size);
+         mtx_unlock(&screen->manifest_mutex);
+      }
+      else if (type == LP_CACHE_DATA_CODE) {
+         struct lp_cached_code cached;
+
+         memset(&cached, 0, sizeof(cached));
+         cached.data = (void *)blob_read_bytes(&blob, record_size);
+         cached.data_size = record_size;
+         lp_code_cache_insert(screen, &cached, sha1);
+      }
+      else {
+         /* from a later version, which would have bumped it */
+         ok = false;
+      }
+   }
+
+   return ok;
+}
+
+/**
+ * Add a file written from get_shader_cache_data(), e.g. when the
+ * application was packaged, see LP_SHADER_CACHE_FILE, so that the
+ * variants it holds, such as those of the blitter and the state
+ * tracker's internal shaders, are loaded rather than compiled.
+ */
+static void
+lp_load_shader_cache_file(struct llvmpipe_screen *screen, const char *path)
+{
+   size_t size;
+   char *data;
+
+   data = os_read_file(path, &size);
+   if (!data) {
+      debug_printf("llvmpipe: can't read %s\n", path);
+      return;
+   }
+
+   if (!lp_add_shader_cache_data(&screen->base, data, size))
+      debug_printf("llvmpipe: %s is from another build or CPU\n", path);
+
+   free(data);
+}
+
+
+/**
+ * Called once a scene has been flushed, to account for the time it took
+ * the first one to get there.
+ */
+void
+llvmpipe_startup_done(struct llvmpipe_screen *screen)
+{
+   if (p_atomic_cmpxchg(&screen->startup.done, 0, 1) != 0)
+      return;
+
+   screen->startup.first_flush = os_time_get() - screen->startup.created;
+   screen->startup.llvm_init = gallivm_init_time;
+   screen->startup.jit = p_atomic_read(&gallivm_compile_time);
+
+   if (LP_PERF & PERF_STARTUP) {
+      debug_printf("llvmpipe: startup: screen %.3f ms, context %.3f ms, "
+                   "LLVM init %.3f ms, JIT %.3f ms, "
+                   "first scene flushed after %.3f ms\n",
+                   screen->startup.screen / 1000.0,
+                   screen->startup.context / 1000.0,
+                   screen->startup.llvm_init / 1000.0,
+                   screen->startup.jit / 1000.0,
+                   screen->startup.first_flush / 1000.0);
+   }
+}
+
+
 /**
  * Create a new pipe_screen object
  * Note: we're not presently subclassing pipe_screen (no llvmpipe_screen).
@@ -862,6 +1660,8 @@ struct pipe_screen *
 llvmpipe_create_screen(struct sw_winsys *winsys)
 {
    struct llvmpipe_screen *screen;
+   int64_t created = os_time_get();
+   const char *cache_file;
 
    util_cpu_detect();
 
@@ -872,6 +1672,9 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
 #endif
 
    LP_PERF = debug_get_flags_option("LP_PERF", lp_perf_flags, 0 );
+   if ((LP_DEBUG & DEBUG_COUNTERS) || (LP_PERF & PERF_COUNTERS))
+      lp_counters_enabled = true;
+   lp_trace_init();
 
    screen = CALLOC_STRUCT(llvmpipe_screen);
    if (!screen)
@@ -889,6 +1692,8 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
    screen->base.get_name = llvmpipe_get_name;
    screen->base.get_vendor = llvmpipe_get_vendor;
    screen->base.get_device_vendor = llvmpipe_get_vendor; // TODO should be the CPU vendor
+   screen->base.get_driver_uuid = llvmpipe_get_driver_uuid;
+   screen->base.get_device_uuid = llvmpipe_get_device_uuid;
    screen->base.get_param = llvmpipe_get_param;
    screen->base.get_shader_param = llvmpipe_get_shader_param;
    screen->base.get_compute_param = llvmpipe_get_compute_param;
@@ -904,8 +1709,17 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
    screen->base.get_timestamp = llvmpipe_get_timestamp;
 
    screen->base.finalize_nir = llvmpipe_finalize_nir;
+   screen->base.set_max_shader_compiler_threads =
+      llvmpipe_set_max_shader_compiler_threads;
+   screen->base.is_parallel_shader_compilation_finished =
+      llvmpipe_is_parallel_shader_compilation_finished;
 
    screen->base.get_disk_shader_cache = lp_get_disk_shader_cache;
+   screen->base.get_driver_query_info = llvmpipe_get_driver_query_info;
+   screen->base.save_shader_manifest = lp_save_shader_manifest;
+   screen->base.load_shader_manifest = lp_load_shader_manifest;
+   screen->base.get_shader_cache_data = lp_get_shader_cache_data;
+   screen->base.add_shader_cache_data = lp_add_shader_cache_data;
    llvmpipe_init_screen_resource_funcs(&screen->base);
 
    screen->use_tgsi = (LP_DEBUG & DEBUG_TGSI_IR);
@@ -915,24 +1729,123 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
 #endif
    screen->num_threads = debug_get_num_option("LP_NUM_THREADS", screen->num_threads);
    screen->num_threads = MIN2(screen->num_threads, LP_MAX_THREADS);
+   screen->spin_wait_ns = debug_get_num_option("LP_SPIN_WAIT", 0) * 1000;
+   screen->thread_affinity = LP_THREAD_AFFINITY_NONE;
+   {
+      const char *affinity = debug_get_option("LP_THREAD_AFFINITY", NULL);
+      const struct debug_named_value *v;
+      for (v = lp_thread_affinity_values; affinity && v->name; v++) {
+         if (!strcmp(affinity, v->name))
+            screen->thread_affinity = v->value;
+      }
+   }
+
+   /* With LP_RAST_PER_CONTEXT, each context gets its own rasterizer
+    * threads (see lp_setup_create()), so that independent contexts don't
+    * queue their scenes behind each other.
+    */
+   screen->rast_per_context = debug_get_bool_option("LP_RAST_PER_CONTEXT",
+                                                    FALSE);
 
-   screen->rast = lp_rast_create(screen->num_threads);
-   if (!screen->rast) {
+   screen->block_pool = lp_scene_block_pool_create();
+   if (!screen->block_pool) {
       lp_jit_screen_cleanup(screen);
       FREE(screen);
       return NULL;
    }
+
+   if (!screen->rast_per_context) {
+      screen->rast = lp_rast_create(screen->num_threads,
+                                    screen->thread_affinity,
+                                    screen->spin_wait_ns,
+                                    screen->texture_cache_size);
+      if (!screen->rast) {
+         lp_scene_block_pool_destroy(screen->block_pool);
+         lp_jit_screen_cleanup(screen);
+         FREE(screen);
+         return NULL;
+      }
+   }
    (void) mtx_init(&screen->rast_mutex, mtx_plain);
 
-   screen->cs_tpool = lp_cs_tpool_create(screen->num_threads);
+   screen->cs_tpool = lp_cs_tpool_create(screen->num_threads,
+                                         screen->thread_affinity);
    if (!screen->cs_tpool) {
-      lp_rast_destroy(screen->rast);
+      if (screen->rast)
+         lp_rast_destroy(screen->rast);
+      lp_scene_block_pool_destroy(screen->block_pool);
       lp_jit_screen_cleanup(screen);
       FREE(screen);
       return NULL;
    }
    (void) mtx_init(&screen->cs_mutex, mtx_plain);
 
+   /* Background compilation needs an LLVM context per variant, which
+    * the global LLVM context rules out.  If the queue can't be created,
+    * variants are simply compiled on the spot.
+    */
+#ifndef USE_GLOBAL_LLVM_CONTEXT
+   {
+      unsigned num_jit_threads = debug_get_num_option("LP_JIT_THREADS", 0);
+      if (num_jit_threads &&
+          util_queue_init(&screen->jit_queue, "lpjit", 64,
+                          MIN2(num_jit_threads, LP_MAX_THREADS),
+                          UTIL_QUEUE_INIT_RESIZE_IF_FULL))
+         screen->jit_tier_up = debug_get_num_option("LP_JIT_TIER_UP", 0);
+   }
+#endif
+
+   /* The application thread bins too, so the queue has one thread less. */
+   screen->num_bin_threads =
+      debug_get_num_option("LP_BIN_THREADS", MIN2(screen->num_threads, 4));
+   screen->num_bin_threads = MIN2(screen->num_bin_threads, LP_MAX_BIN_THREADS);
+   if (screen->num_bin_threads > 1 &&
+       !util_queue_init(&screen->bin_queue, "lpbin", LP_MAX_BIN_THREADS,
+                        screen->num_bin_threads - 1,
+                        UTIL_QUEUE_INIT_LOCKLESS))
+      screen->num_bin_threads = 0;
+
+   screen->threaded_context =
+      debug_get_bool_option("LP_THREADED_CONTEXT", FALSE);
+   slab_create_parent(&screen->pool_transfers,
+                      sizeof(struct llvmpipe_transfer), 16);
+   slab_mt_create(&screen->transfer_pool, sizeof(struct llvmpipe_transfer), 16);
+   slab_mt_create(&screen->fence_pool, sizeof(struct lp_fence), 64);
+
+   /*
+    * Texture views and surfaces may untile textures, which needs the
+    * context, but the threaded context creates them from the application
+    * thread.
+    */
+   screen->tiled_textures = !screen->threaded_context &&
+      debug_get_bool_option("LP_TILED_TEXTURES", FALSE);
+   screen->texture_cache_size = debug_get_num_option("LP_TEXTURE_CACHE_SIZE", 0);
+   screen->const_texture_size = debug_get_num_option("LP_CONST_TEXTURE_SIZE", 0);
+   screen->decompressed_memory_budget =
+      (uint64_t)debug_get_num_option("LP_DECOMPRESS_TEXTURES", 0) * 1024 * 1024;
+   screen->huge_page_threshold =
+      (uint64_t)debug_get_num_option("LP_HUGE_PAGES", 0) * 1024 * 1024;
+   screen->prefault_textures = debug_get_bool_option("LP_PREFAULT", FALSE);
+   screen->z_prepass = debug_get_bool_option("LP_Z_PREPASS", FALSE);
+   screen->fs_8x8 = debug_get_bool_option("LP_FS_8X8", FALSE);
+   screen->spans = debug_get_bool_option("LP_SPANS", FALSE);
+   screen->inline_uniforms = debug_get_num_option("LP_INLINE_UNIFORMS", 0);
+   screen->vertex_replay_size =
+      (size_t)debug_get_num_option("LP_VERTEX_REPLAY", 0) * 1024 * 1024;
+
+   screen->code_arena = lp_code_arena_create();
+   screen->shader_memory_budget =
+      (uint64_t)debug_get_num_option("LP_SHADER_MEMORY_BUDGET", 0) * 1024;
+
    lp_disk_cache_create(screen);
+   lp_code_cache_create(screen);
+   lp_manifest_create(screen);
+
+   cache_file = debug_get_option("LP_SHADER_CACHE_FILE", NULL);
+   if (cache_file)
+      lp_load_shader_cache_file(screen, cache_file);
+
+   screen->startup.created = created;
+   screen->startup.screen = os_time_get() - created;
    return &screen->base;
 }
@@ -37,11 +37,17 @@
 #include "pipe/p_screen.h"
 #include "pipe/p_defines.h"
 #include "os/os_thread.h"
+#include "util/list.h"
+#include "util/slab.h"
+#include "util/u_queue.h"
 #include "gallivm/lp_bld.h"
 #include "gallivm/lp_bld_misc.h"
+#include "lp_limits.h"
 
 struct sw_winsys;
 struct lp_cs_tpool;
+struct lp_scene_block_pool;
+struct hash_table;
 
 struct llvmpipe_screen
 {
@@ -50,24 +56,136 @@ struct llvmpipe_screen
    struct sw_winsys *winsys;
 
    unsigned num_threads;
+   enum lp_thread_affinity thread_affinity;
+   unsigned spin_wait_ns;   /**< see LP_SPIN_WAIT */
 
    /* Increments whenever textures are modified.  Contexts can track this.
     */
    unsigned timestamp;
 
+   /** Shared rasterizer, NULL with LP_RAST_PER_CONTEXT */
    struct lp_rasterizer *rast;
    mtx_t rast_mutex;
+   boolean rast_per_context;
+
+   /** Scene data blocks, recycled across scenes and contexts */
+   struct lp_scene_block_pool *block_pool;
 
    struct lp_cs_tpool *cs_tpool;
    mtx_t cs_mutex;
 
+   /** Compiles FS variants in the background, with LP_JIT_THREADS only */
+   struct util_queue jit_queue;
+
+   /** Bins an unoptimized FS variant runs before it is optimized, or 0 */
+   unsigned jit_tier_up;
+
+   /** Lay sampled-only textures out in tiles, see LP_TILED_TEXTURES */
+   boolean tiled_textures;
+
+   /** Entries of each thread's decoded block cache, see LP_TEXTURE_CACHE_SIZE */
+   unsigned texture_cache_size;
+
+   /** Largest texture size compiled into shaders, see LP_CONST_TEXTURE_SIZE */
+   unsigned const_texture_size;
+
+   /** Bytes of decompressed texture copies, see LP_DECOMPRESS_TEXTURES */
+   uint64_t decompressed_memory;
+   uint64_t decompressed_memory_budget;   /**< in bytes, 0 to disable */
+
+   /** Textures of at least this many bytes are on huge pages, or 0 */
+   uint64_t huge_page_threshold;   /**< LP_HUGE_PAGES, in bytes */
+   /** Fault their pages in on the compute threads, see LP_PREFAULT */
+   boolean prefault_textures;
+
+   /** Rasterize scenes with a depth-only pass first, see LP_Z_PREPASS */
+   boolean z_prepass;
+
+   /** Give fs variants a function shading 8x8 blocks, see LP_FS_8X8 */
+   boolean fs_8x8;
+
+   /** Shade the tiles of simple 2D draws in 8-bit spans, see LP_SPANS */
+   boolean spans;
+
+   /**
+    * Draws the fs uniforms deciding branches must stay unchanged before a
+    * variant is compiled with their values, see LP_INLINE_UNIFORMS, or 0
+    */
+   unsigned inline_uniforms;
+
+   /** Bytes of replayed vertices per context, see LP_VERTEX_REPLAY */
+   size_t vertex_replay_size;
+
+   /** Wrap contexts in a threaded context, see LP_THREADED_CONTEXT */
+   boolean threaded_context;
+   struct slab_parent_pool pool_transfers;   /**< for the threaded contexts */
+
+   /** Freed by whichever thread drops the last use, so not in a child pool */
+   struct slab_mt_pool transfer_pool;
+   struct slab_mt_pool fence_pool;
+
+   /** Bins triangles alongside the application thread, see LP_BIN_THREADS */
+   struct util_queue bin_queue;
+   unsigned num_bin_threads;   /**< including the application thread */
+
+   /** Bytes of FS and CS variants of all contexts, see LP_QUERY_SHADER_MEMORY */
+   uint64_t shader_memory;
+   uint64_t shader_memory_budget;   /**< LP_SHADER_MEMORY_BUDGET, in bytes */
+
+   /** Code memory of all variants, NULL if writable code isn't allowed */
+   struct lp_code_arena *code_arena;
+
    bool use_tgsi;
 
    struct disk_cache *disk_shader_cache;
    unsigned num_disk_shader_cache_hits;
    unsigned num_disk_shader_cache_misses;
+
+   /** Object code by IR cache key, shared by all contexts */
+   struct hash_table *code_cache;
+   struct list_head code_cache_lru;
+   size_t code_cache_size;
+   size_t code_cache_max_size;   /**< LP_CODE_CACHE_SIZE, in bytes */
+   mtx_t code_cache_mutex;
+   unsigned num_code_cache_hits;
+
+   /** FS variant keys compiled or to pre-compile, by shader IR sha1 */
+   struct hash_table *manifest;
+   unsigned char manifest_build_id[20];
+   mtx_t manifest_mutex;
+
+   /**
+    * Where the time until the first scene was flushed went, in
+    * microseconds, see LP_QUERY_STARTUP_* and LP_PERF=startup
+    */
+   struct {
+      int64_t created;        /**< os_time_get() when the screen was */
+      uint64_t screen;        /**< llvmpipe_create_screen() */
+      uint64_t context;       /**< the first llvmpipe_create_context() */
+      uint64_t llvm_init;     /**< lp_build_init(), by the first compile */
+      uint64_t jit;           /**< compiling and loading variants */
+      uint64_t first_flush;   /**< until a scene with draws was flushed */
+      unsigned done;
+   } startup;
 };
 
+/**
+ * Whether the variants have outgrown LP_SHADER_MEMORY_BUDGET.  Without a
+ * budget, contexts limit the number of variants instead.
+ */
+static inline boolean
+lp_shader_memory_over_budget(struct llvmpipe_screen *screen)
+{
+   return screen->shader_memory_budget &&
+          p_atomic_read(&screen->shader_memory) > screen->shader_memory_budget;
+}
+
+void
+llvmpipe_startup_done(struct llvmpipe_screen *screen);
+
+void lp_pin_thread(thrd_t thread, enum lp_thread_affinity affinity,
+                   unsigned index, unsigned num_threads);
+
 void lp_disk_cache_find_shader(struct llvmpipe_screen *screen,
                                struct lp_cached_code *cache,
                                unsigned char ir_sha1_cache_key[20]);
@@ -75,6 +193,13 @@ void lp_disk_cache_insert_shader(struct llvmpipe_screen *screen,
                                  struct lp_cached_code *cache,
                                  unsigned char ir_sha1_cache_key[20]);
 
+void lp_manifest_record(struct llvmpipe_screen *screen,
+                        const unsigned char ir_sha1[20],
+                        const void *key, unsigned key_size);
+void *lp_manifest_get_keys(struct llvmpipe_screen *screen,
+                           const unsigned char ir_sha1[20],
+                           unsigned key_size, unsigned *num_keys);
+
 
 static inline struct llvmpipe_screen *
 llvmpipe_screen( struct pipe_screen *pipe )
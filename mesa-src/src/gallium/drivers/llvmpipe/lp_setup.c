@@ -47,12 +47,14 @@
 #include "lp_scene.h"
 #include "lp_texture.h"
 #include "lp_debug.h"
+#include "lp_perf.h"
 #include "lp_fence.h"
 #include "lp_query.h"
 #include "lp_rast.h"
 #include "lp_setup_context.h"
 #include "lp_screen.h"
 #include "lp_state.h"
+#include "lp_trace.h"
 #include "frontend/sw_winsys.h"
 
 #include "draw/draw_context.h"
@@ -64,26 +66,69 @@ static boolean set_scene_state( struct lp_setup_context *, enum setup_state,
 static boolean try_update_scene_state( struct lp_setup_context *setup );
 
 
+/**
+ * Wait for a scene to come back from the rasterizer and make it
+ * ready for binning again.
+ */
 static void
-lp_setup_get_empty_scene(struct lp_setup_context *setup)
+lp_setup_recycle_scene(struct lp_scene *scene)
 {
-   assert(setup->scene == NULL);
+   if (scene->fence) {
+      if (!lp_fence_signalled(scene->fence)) {
+         int64_t t0 = os_time_get();
 
-   setup->scene_idx++;
-   setup->scene_idx %= ARRAY_SIZE(setup->scenes);
+         if (LP_DEBUG & DEBUG_SETUP)
+            debug_printf("%s: wait for scene %d\n",
+                         __FUNCTION__, scene->fence->id);
 
-   setup->scene = setup->scenes[setup->scene_idx];
+         lp_fence_wait(scene->fence);
 
-   if (setup->scene->fence) {
-      if (LP_DEBUG & DEBUG_SETUP)
-         debug_printf("%s: wait for scene %d\n",
-                      __FUNCTION__, setup->scene->fence->id);
+         LP_COUNT(nr_scene_stalls);
+         LP_COUNT_ADD(scene_stall_time, os_time_get() - t0);
+      }
 
-      lp_fence_wait(setup->scene->fence);
+      lp_scene_recycle(scene);
    }
+}
+
+
+static boolean
+lp_setup_get_empty_scene(struct lp_setup_context *setup)
+{
+   unsigned next;
+   struct lp_scene *scene;
+
+   assert(setup->scene == NULL);
+
+   /* Scenes are rasterized in order, so the one after scene_idx is the
+    * oldest.  If it is still in flight and the pool isn't full yet,
+    * grow the pool rather than waiting for it.
+    */
+   next = (setup->scene_idx + 1) % setup->num_scenes;
+   scene = setup->scenes[next];
+
+   if (scene->fence && !lp_fence_signalled(scene->fence) &&
+       setup->num_scenes < setup->max_scenes) {
+      struct lp_scene *new_scene = lp_scene_create(setup->pipe);
+      if (new_scene) {
+         next = setup->scene_idx + 1;
+         memmove(&setup->scenes[next + 1], &setup->scenes[next],
+                 (setup->num_scenes - next) * sizeof setup->scenes[0]);
+         setup->scenes[next] = new_scene;
+         setup->num_scenes++;
+         scene = new_scene;
+      }
+   }
+
+   setup->scene_idx = next;
+   setup->scene = scene;
 
-   lp_scene_begin_binning(setup->scene, &setup->fb);
+   lp_setup_recycle_scene(scene);
 
+   LP_COUNT(nr_scenes);
+
+   return lp_scene_begin_binning(setup->scene, &setup->fb,
+                                 setup->num_threads, setup->tile_order);
 }
 
 
@@ -153,6 +198,7 @@ lp_setup_rasterize_scene( struct lp_setup_context *setup )
 {
    struct lp_scene *scene = setup->scene;
    struct llvmpipe_screen *screen = llvmpipe_screen(scene->pipe->screen);
+   unsigned i;
 
    scene->num_active_queries = setup->active_binned_queries;
    memcpy(scene->active_queries, setup->active_queries,
@@ -165,23 +211,39 @@ lp_setup_rasterize_scene( struct lp_setup_context *setup )
    if (setup->last_fence)
       setup->last_fence->issued = TRUE;
 
-   mtx_lock(&screen->rast_mutex);
-
-   /* FIXME: We enqueue the scene then wait on the rasterizer to finish.
-    * This means we never actually run any vertex stuff in parallel to
-    * rasterization (not in the same context at least) which is what the
-    * multiple scenes per setup is about - when we get a new empty scene
-    * any old one is already empty again because we waited here for
-    * raster tasks to be finished. Ideally, we shouldn't need to wait here
-    * and rely on fences elsewhere when waiting is necessary.
-    * Certainly, lp_scene_end_rasterization() would need to be deferred too
-    * and there's probably other bits why this doesn't actually work.
+   /* Don't wait for the rasterizer here: the scene's fence gets
+    * signalled once it's done, and lp_setup_get_empty_scene() waits on
+    * it before reusing the scene.  Meanwhile, binning of the next scene
+    * can proceed in another scene of the pool.
     */
-   lp_rast_queue_scene(screen->rast, scene);
-   lp_rast_finish(screen->rast);
+   /* The color buffers' dirty regions, in whole tiles */
+   for (i = 0; i < scene->fb.nr_cbufs; i++) {
+      struct pipe_surface *cbuf = scene->fb.cbufs[i];
+      if (cbuf && llvmpipe_resource_is_texture(cbuf->texture) &&
+          cbuf->u.tex.level == 0)
+         llvmpipe_resource_add_dirty(llvmpipe_resource(cbuf->texture),
+                                     scene->color_x0 * scene->tile_size,
+                                     scene->color_y0 * scene->tile_size,
+                                     MIN2((scene->color_x1 + 1) *
+                                          scene->tile_size, cbuf->width),
+                                     MIN2((scene->color_y1 + 1) *
+                                          scene->tile_size, cbuf->height));
+   }
+
+   mtx_lock(&screen->rast_mutex);
+   for (i = 0; i < scene->fb.nr_cbufs; i++) {
+      struct pipe_surface *cbuf = scene->fb.cbufs[i];
+      if (cbuf && llvmpipe_resource(cbuf->texture)->dt)
+         lp_fence_reference(&llvmpipe_resource(cbuf->texture)->dt_fence,
+                            scene->fence);
+   }
+   if (!setup->own_rast)
+      lp_rast_queue_scene(setup->rast, scene);
    mtx_unlock(&screen->rast_mutex);
 
-   lp_scene_end_rasterization(setup->scene);
+   if (setup->own_rast)
+      lp_rast_queue_scene(setup->rast, scene);
+
    lp_setup_reset( setup );
 
    LP_DBG(DEBUG_SETUP, "%s done \n", __FUNCTION__);
@@ -199,12 +261,21 @@ begin_binning( struct lp_setup_context *setup )
    assert(scene);
    assert(scene->fence == NULL);
 
-   /* Always create a fence:
+   /* Always create a fence.  It is signalled once by the rasterizer,
+    * when it's done with the whole scene:
     */
-   scene->fence = lp_fence_create(MAX2(1, setup->num_threads));
+   scene->fence = lp_fence_create(llvmpipe_screen(setup->pipe->screen), 1);
    if (!scene->fence)
       return FALSE;
 
+   /* Draws whose state doesn't allow it turn this off again. */
+   scene->z_prepass = llvmpipe_screen(setup->pipe->screen)->z_prepass &&
+                      !setup->active_binned_queries;
+
+   /* A predicate carries over into the new scene's bins */
+   if (setup->predicate.query)
+      setup->dirty |= LP_SETUP_NEW_PREDICATE;
+
    ok = try_update_scene_state(setup);
    if (!ok)
       return FALSE;
@@ -246,6 +317,11 @@ begin_binning( struct lp_setup_context *setup )
 
    if (setup->fb.zsbuf) {
       if (setup->clear.flags & PIPE_CLEAR_DEPTHSTENCIL) {
+         const uint64_t full_mask =
+            util_pack64_mask_z_stencil(setup->fb.zsbuf->format, ~0, ~0);
+         scene->zsbuf_cleared =
+            (setup->clear.zsmask & full_mask) == full_mask;
+
          ok = lp_scene_bin_everywhere( scene,
                                        LP_RAST_OP_CLEAR_ZSTENCIL,
                                        lp_rast_arg_clearzs(
@@ -260,7 +336,8 @@ begin_binning( struct lp_setup_context *setup )
    setup->clear.zsmask = 0;
    setup->clear.zsvalue = 0;
 
-   scene->had_queries = !!setup->active_binned_queries;
+   scene->had_queries = setup->active_binned_queries ||
+                        setup->predicate.query;
 
    LP_DBG(DEBUG_SETUP, "%s done\n", __FUNCTION__);
    return TRUE;
@@ -311,8 +388,9 @@ set_scene_state( struct lp_setup_context *setup,
 
    /* wait for a free/empty scene
     */
-   if (old_state == SETUP_FLUSHED) 
-      lp_setup_get_empty_scene(setup);
+   if (old_state == SETUP_FLUSHED &&
+       !lp_setup_get_empty_scene(setup))
+      goto fail;
 
    switch (new_state) {
    case SETUP_CLEARED:
@@ -342,7 +420,15 @@ set_scene_state( struct lp_setup_context *setup,
 
 fail:
    if (setup->scene) {
-      lp_scene_end_rasterization(setup->scene);
+      struct lp_fence *fence = setup->scene->fence;
+
+      /* Don't leave whoever got the fence early waiting for it */
+      if (fence && !lp_fence_issued(fence)) {
+         fence->issued = TRUE;
+         lp_fence_signal(fence);
+      }
+
+      lp_scene_recycle(setup->scene);
       setup->scene = NULL;
    }
 
@@ -352,18 +438,116 @@ fail:
 }
 
 
+/**
+ * The contents of texture are undefined from here on.  If it's the
+ * depth/stencil buffer, the scene being binned keeps its tiles in
+ * tile-local storage rather than writing them back, unless more draws or
+ * clears get binned into it.
+ */
+void
+lp_setup_invalidate_resource(struct lp_setup_context *setup,
+                             const struct pipe_resource *texture)
+{
+   if (setup->state == SETUP_FLUSHED || !setup->scene)
+      return;
+
+   if (setup->fb.zsbuf && setup->fb.zsbuf->texture == texture)
+      setup->scene->zsbuf_discard = TRUE;
+}
+
+
+/**
+ * Release the resources and data blocks held by the scenes the
+ * rasterizer is done with, rather than waiting for the scenes to be
+ * reused.
+ */
+static void
+lp_setup_recycle_signalled_scenes(struct lp_setup_context *setup)
+{
+   unsigned i;
+
+   for (i = 0; i < setup->num_scenes; i++) {
+      struct lp_scene *scene = setup->scenes[i];
+      if (scene->fence && lp_fence_signalled(scene->fence))
+         lp_scene_recycle(scene);
+   }
+}
+
+
+/**
+ * Hand the current scene over to the rasterizer mid-frame and start
+ * binning into a new one.
+ */
+static boolean
+lp_setup_split_scene(struct lp_setup_context *setup, const char *reason)
+{
+   LP_COUNT(nr_scene_splits);
+
+   setup->streaming = TRUE;
+   setup->scene_split = TRUE;
+
+   /* More of the rendering to its color buffer is coming in the next
+    * scene, so its rows aren't done with the split one.
+    */
+   if (setup->scene)
+      setup->scene->progress_func = NULL;
+
+   if (!set_scene_state(setup, SETUP_FLUSHED, reason))
+      return FALSE;
+
+   lp_setup_recycle_signalled_scenes(setup);
+
+   return TRUE;
+}
+
+
 void
 lp_setup_flush( struct lp_setup_context *setup,
                 struct pipe_fence_handle **fence,
                 const char *reason)
 {
+   int64_t trace_start = lp_trace_begin();
+   struct llvmpipe_screen *screen = llvmpipe_screen(setup->pipe->screen);
+   boolean had_draws = setup->state == SETUP_ACTIVE;
+
    set_scene_state( setup, SETUP_FLUSHED, reason );
 
+   if (unlikely(had_draws && !screen->startup.done))
+      llvmpipe_startup_done(screen);
+
+   lp_setup_recycle_signalled_scenes(setup);
+
+   /* Keep streaming as long as frames don't fit in a single scene.
+    */
+   setup->streaming = setup->scene_split;
+   setup->scene_split = FALSE;
+
    if (fence) {
       lp_fence_reference((struct lp_fence **)fence, setup->last_fence);
       if (!*fence)
-         *fence = (struct pipe_fence_handle *)lp_fence_create(0);
+         *fence = (struct pipe_fence_handle *)
+                  lp_fence_create(llvmpipe_screen(setup->pipe->screen), 0);
    }
+
+   LP_TRACE_END("setup_flush", trace_start);
+}
+
+
+/**
+ * Return a reference to the fence of the scene being binned, if there is
+ * one, without ending the scene.  The rasterizer signals it once it is done
+ * with the whole scene, so with everything binned so far too.
+ */
+boolean
+lp_setup_get_scene_fence(struct lp_setup_context *setup,
+                         struct pipe_fence_handle **fence)
+{
+   if (setup->state != SETUP_ACTIVE || !setup->scene ||
+       !setup->scene->fence)
+      return FALSE;
+
+   lp_fence_reference((struct lp_fence **)fence, setup->scene->fence);
+   return TRUE;
 }
 
 
@@ -386,6 +570,7 @@ lp_setup_bind_framebuffer( struct lp_setup_context *setup,
     * scene.
     */
    util_copy_framebuffer_state(&setup->fb, fb);
+   setup->predicate.query = NULL;
    setup->framebuffer.x0 = 0;
    setup->framebuffer.y0 = 0;
    setup->framebuffer.x1 = fb->width-1;
@@ -436,6 +621,9 @@ lp_setup_try_clear_color_buffer(struct lp_setup_context *setup,
                                    LP_RAST_OP_CLEAR_COLOR,
                                    clearrb_arg))
          return FALSE;
+
+      /* The z prepass only runs the clears starting the bins. */
+      scene->z_prepass = FALSE;
    }
    else {
       /* Put ourselves into the 'pre-clear' state, specifically to try
@@ -500,6 +688,8 @@ lp_setup_try_clear_zs(struct lp_setup_context *setup,
                                    LP_RAST_OP_CLEAR_ZSTENCIL,
                                    lp_rast_arg_clearzs(zsvalue, zsmask)))
          return FALSE;
+
+      scene->z_prepass = FALSE;
    }
    else {
       /* Put ourselves into the 'pre-clear' state, specifically to try
@@ -516,6 +706,10 @@ lp_setup_try_clear_zs(struct lp_setup_context *setup,
          (setup->clear.zsvalue & ~zsmask) | (zsvalue & zsmask);
    }
 
+   /* The clear has to land in memory */
+   if (setup->scene)
+      setup->scene->zsbuf_discard = FALSE;
+
    return TRUE;
 }
 
@@ -560,6 +754,102 @@ lp_setup_clear( struct lp_setup_context *setup,
 }
 
 
+static boolean
+lp_setup_try_readback(struct lp_setup_context *setup,
+                      const struct lp_rast_readback *tmpl,
+                      struct pipe_resource *dst)
+{
+   struct lp_scene *scene = setup->scene;
+   struct lp_rast_readback *readback;
+   union lp_rast_cmd_arg arg;
+   unsigned ix0, iy0, ix1, iy1, i, j;
+
+   readback = lp_scene_alloc(scene, sizeof *readback);
+   if (!readback)
+      return FALSE;
+
+   *readback = *tmpl;
+   arg.readback = readback;
+
+   /* Readbacks copy from the first layer. */
+   lp_scene_set_bin_layer(scene, 0);
+
+   /* Mapping dst now waits for the scene. */
+   if (!lp_scene_add_resource_reference(scene, dst, FALSE, TRUE))
+      return FALSE;
+
+   ix0 = tmpl->x >> scene->tile_order;
+   iy0 = tmpl->y >> scene->tile_order;
+   ix1 = MIN2((tmpl->x + tmpl->width - 1) >> scene->tile_order,
+              scene->tiles_x - 1);
+   iy1 = MIN2((tmpl->y + tmpl->height - 1) >> scene->tile_order,
+              scene->tiles_y - 1);
+
+   for (j = iy0; j <= iy1; j++) {
+      for (i = ix0; i <= ix1; i++) {
+         if (!lp_scene_bin_command(scene, i, j, LP_RAST_OP_READBACK, arg))
+            return FALSE;
+      }
+   }
+
+   return TRUE;
+}
+
+
+/**
+ * Copy a box of color buffer cbuf into dst once what has been binned so
+ * far is rasterized, tile by tile on the rasterizer threads, rather than
+ * waiting for the rendering to map the color buffer.  The scene holds dst
+ * as written, so mapping dst waits for the scene fence.  Multisampled
+ * color buffers are resolved.
+ * \param dst  a buffer, or a linear texture which isn't a display target
+ * \param dst_offset  where pixel (box->x, box->y) goes
+ * \param dst_stride  bytes from a row to the next one, may be negative
+ */
+boolean
+lp_setup_readback(struct lp_setup_context *setup,
+                  unsigned cbuf,
+                  const struct pipe_box *box,
+                  struct pipe_resource *dst,
+                  enum pipe_format dst_format,
+                  unsigned dst_offset,
+                  int dst_stride)
+{
+   struct llvmpipe_resource *lpr = llvmpipe_resource(dst);
+   struct lp_rast_readback tmpl;
+
+   assert(cbuf < setup->fb.nr_cbufs && setup->fb.cbufs[cbuf]);
+   assert(box->x >= 0 && box->y >= 0 && box->width > 0 && box->height > 0);
+   assert(box->x + box->width <= setup->fb.width &&
+          box->y + box->height <= setup->fb.height);
+
+   tmpl.cbuf = cbuf;
+   tmpl.src_format = util_format_linear(setup->fb.cbufs[cbuf]->format);
+   tmpl.x = box->x;
+   tmpl.y = box->y;
+   tmpl.width = box->width;
+   tmpl.height = box->height;
+   tmpl.dst_format = dst_format;
+   tmpl.dst_bytes = util_format_get_blocksize(dst_format);
+   tmpl.dst = (uint8_t *) (llvmpipe_resource_is_texture(dst) ?
+                           lpr->tex_data : lpr->data) + dst_offset;
+   tmpl.dst_stride = dst_stride;
+
+   if (!set_scene_state(setup, SETUP_ACTIVE, __FUNCTION__))
+      return FALSE;
+
+   if (!lp_setup_try_readback(setup, &tmpl, dst)) {
+      if (!lp_setup_flush_and_restart(setup))
+         return FALSE;
+
+      if (!lp_setup_try_readback(setup, &tmpl, dst))
+         return FALSE;
+   }
+
+   return TRUE;
+}
+
+
 
 void 
 lp_setup_set_triangle_state( struct lp_setup_context *setup,
@@ -585,6 +875,21 @@ lp_setup_set_triangle_state( struct lp_setup_context *setup,
    }
 }
 
+/**
+ * Conservative rasterization: primitives cover every pixel they touch,
+ * dilated by dilate pixels.  The subpixel precision bias is ignored.
+ */
+void
+lp_setup_set_conservative_state( struct lp_setup_context *setup,
+                                 boolean conservative,
+                                 float dilate)
+{
+   LP_DBG(DEBUG_SETUP, "%s\n", __FUNCTION__);
+
+   setup->conservative = conservative;
+   setup->conservative_ext = FIXED_ONE / 2 + util_iround(dilate * FIXED_ONE);
+}
+
 void 
 lp_setup_set_line_state( struct lp_setup_context *setup,
 			 float line_width)
@@ -611,7 +916,7 @@ lp_setup_set_point_state( struct lp_setup_context *setup,
 
 void
 lp_setup_set_setup_variant( struct lp_setup_context *setup,
-			    const struct lp_setup_variant *variant)
+			    struct lp_setup_variant *variant)
 {
    LP_DBG(DEBUG_SETUP, "%s\n", __FUNCTION__);
    
@@ -630,6 +935,26 @@ lp_setup_set_fs_variant( struct lp_setup_context *setup,
    setup->dirty |= LP_SETUP_NEW_FS;
 }
 
+/**
+ * Set the fs variants of the z prepass, see lp_rast_state::zprepass_variant.
+ * Both must be compiled already, or NULL.
+ */
+void
+lp_setup_set_fs_zprepass(struct lp_setup_context *setup,
+                         struct lp_fragment_shader_variant *depth_variant,
+                         struct lp_fragment_shader_variant *shade_variant)
+{
+   if (!depth_variant || !shade_variant)
+      depth_variant = shade_variant = NULL;
+
+   if (setup->fs.current.zprepass_variant[0] != depth_variant ||
+       setup->fs.current.zprepass_variant[1] != shade_variant) {
+      setup->fs.current.zprepass_variant[0] = depth_variant;
+      setup->fs.current.zprepass_variant[1] = shade_variant;
+      setup->dirty |= LP_SETUP_NEW_FS;
+   }
+}
+
 void
 lp_setup_set_fs_constants(struct lp_setup_context *setup,
                           unsigned num,
@@ -704,6 +1029,10 @@ lp_setup_set_fs_images(struct lp_setup_context *setup,
          jit_image->depth = res->depth0;
          jit_image->num_samples = res->nr_samples;
 
+         /* The shader's stores may make the samples differ */
+         if (res->nr_samples > 1 && (image->access & PIPE_IMAGE_ACCESS_WRITE))
+            lp_res->writes++;
+
          if (llvmpipe_resource_is_texture(res)) {
             uint32_t mip_offset = lp_res->mip_offsets[image->u.tex.level];
 
@@ -770,6 +1099,38 @@ lp_setup_set_stencil_ref_values( struct lp_setup_context *setup,
    }
 }
 
+/**
+ * Pass the depth/stencil funcs and ops through to the fragment shader,
+ * for the generic variants which don't have them compiled in.
+ */
+void
+lp_setup_set_depth_stencil_state( struct lp_setup_context *setup,
+                                  const struct pipe_depth_stencil_alpha_state *dsa )
+{
+   struct lp_jit_context *jit_context = &setup->fs.current.jit_context;
+   uint32_t stencil_state[2][LP_JIT_STENCIL_NUM_FIELDS];
+   unsigned i;
+
+   LP_DBG(DEBUG_SETUP, "%s\n", __FUNCTION__);
+
+   for (i = 0; i < 2; i++) {
+      stencil_state[i][LP_JIT_STENCIL_FUNC] = dsa->stencil[i].func;
+      stencil_state[i][LP_JIT_STENCIL_FAIL_OP] = dsa->stencil[i].fail_op;
+      stencil_state[i][LP_JIT_STENCIL_ZFAIL_OP] = dsa->stencil[i].zfail_op;
+      stencil_state[i][LP_JIT_STENCIL_ZPASS_OP] = dsa->stencil[i].zpass_op;
+      stencil_state[i][LP_JIT_STENCIL_VALUEMASK] = dsa->stencil[i].valuemask;
+      stencil_state[i][LP_JIT_STENCIL_WRITEMASK] = dsa->stencil[i].writemask;
+   }
+
+   if (jit_context->depth_func != dsa->depth.func ||
+       memcmp(jit_context->stencil_state, stencil_state,
+              sizeof stencil_state) != 0) {
+      jit_context->depth_func = dsa->depth.func;
+      memcpy(jit_context->stencil_state, stencil_state, sizeof stencil_state);
+      setup->dirty |= LP_SETUP_NEW_FS;
+   }
+}
+
 void
 lp_setup_set_blend_color( struct lp_setup_context *setup,
                           const struct pipe_blend_color *blend_color )
@@ -897,7 +1258,7 @@ lp_setup_set_fragment_sampler_views(struct lp_setup_context *setup,
       struct pipe_sampler_view *view = i < num ? views[i] : NULL;
 
       if (view) {
-         struct pipe_resource *res = view->texture;
+         struct pipe_resource *res = llvmpipe_sampler_view_texture(view);
          struct llvmpipe_resource *lp_tex = llvmpipe_resource(res);
          struct lp_jit_texture *jit_tex;
          jit_tex = &setup->fs.current.jit_context.textures[i];
@@ -1061,6 +1422,63 @@ lp_setup_set_fragment_sampler_state(struct lp_setup_context *setup,
 }
 
 
+/**
+ * Have the scene being binned free data, see lp_scene_retire_data().
+ * Returns FALSE if there is no such scene, or it holds too much already.
+ */
+boolean
+lp_setup_retire_data(struct lp_setup_context *setup, void *data,
+                     size_t size)
+{
+   if (!setup->scene || !setup->scene->fence)
+      return FALSE;
+
+   return lp_scene_retire_data(setup->scene, data, size);
+}
+
+
+/** Bytes of memory the scenes hold, see lp_scene_memory() */
+uint64_t
+lp_setup_scene_memory(const struct lp_setup_context *setup)
+{
+   uint64_t size = 0;
+   unsigned i;
+
+   for (i = 0; i < setup->num_scenes; i++)
+      size += lp_scene_memory(setup->scenes[i]);
+
+   return size;
+}
+
+
+/** Bytes of the vertices kept for the next draws */
+uint64_t
+lp_setup_vertex_memory(const struct lp_setup_context *setup)
+{
+   return setup->vertex_buffer_size +
+          (uint64_t)setup->tri_batch.max * 3 * setup->tri_batch.vertex_size;
+}
+
+
+/**
+ * Free the vertex storage kept for the next draws, which allocate it
+ * again.  Not while drawing.
+ */
+void
+lp_setup_trim(struct lp_setup_context *setup)
+{
+   lp_setup_flush_triangles(setup);
+
+   align_free(setup->vertex_buffer);
+   setup->vertex_buffer = NULL;
+   setup->vertex_buffer_size = 0;
+
+   align_free(setup->tri_batch.verts);
+   setup->tri_batch.verts = NULL;
+   setup->tri_batch.max = 0;
+}
+
+
 /**
  * Is the given texture referenced by any scene?
  * Note: we have to check all scenes including any scenes currently
@@ -1081,11 +1499,25 @@ lp_setup_is_resource_referenced( const struct lp_setup_context *setup,
       return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
    }
 
-   /* check textures referenced by the scene */
-   for (i = 0; i < ARRAY_SIZE(setup->scenes); i++) {
-      if (lp_scene_is_resource_referenced(setup->scenes[i], texture)) {
-         return LP_REFERENCED_FOR_READ;
+   /* check the scenes which are being binned or rasterized */
+   for (i = 0; i < setup->num_scenes; i++) {
+      const struct lp_scene *scene = setup->scenes[i];
+      unsigned referenced;
+      unsigned j;
+
+      if (!scene->fence || lp_fence_signalled(scene->fence))
+         continue;
+
+      for (j = 0; j < scene->fb.nr_cbufs; j++) {
+         if (scene->fb.cbufs[j] && scene->fb.cbufs[j]->texture == texture)
+            return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
       }
+      if (scene->fb.zsbuf && scene->fb.zsbuf->texture == texture)
+         return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
+
+      referenced = lp_scene_is_resource_referenced(scene, texture);
+      if (referenced)
+         return referenced;
    }
 
    for (i = 0; i < ARRAY_SIZE(setup->ssbos); i++) {
@@ -1102,6 +1534,141 @@ lp_setup_is_resource_referenced( const struct lp_setup_context *setup,
 }
 
 
+/**
+ * Work out what hierarchical Z may do with the current fragment state,
+ * see LP_RAST_HIZ_x.  Only less/lequal depth tests are tracked: blocks
+ * reject against a per-block upper bound of the stored depth, which
+ * only ever decreases while such tests pass.
+ */
+static unsigned
+lp_setup_hiz_flags(const struct lp_setup_context *setup)
+{
+   const struct lp_fragment_shader_variant *variant = setup->fs.current.variant;
+   const struct lp_fragment_shader_variant_key *key;
+   const struct tgsi_shader_info *info;
+   unsigned func;
+   boolean less;
+   unsigned flags = 0;
+
+   if (!variant || !variant->key.depth.enabled ||
+       (LP_PERF & (PERF_NO_HIZ | PERF_NO_DEPTH)))
+      return 0;
+
+   key = &variant->key;
+   info = &variant->shader->info.base;
+   func = key->runtime_ds ? setup->fs.current.jit_context.depth_func
+                          : key->depth.func;
+   less = func == PIPE_FUNC_LESS || func == PIPE_FUNC_LEQUAL;
+
+   if (!less) {
+      /* Any other func may raise the stored depth. */
+      if (key->depth.writemask &&
+          func != PIPE_FUNC_EQUAL && func != PIPE_FUNC_NEVER)
+         flags |= LP_RAST_HIZ_INVALIDATE;
+      return flags;
+   }
+
+   if (info->writes_z)
+      return LP_RAST_HIZ_INVALIDATE;
+
+   /* Rejected fragments must have no other visible effect. */
+   if (!key->stencil[0].enabled && !key->stencil[1].enabled &&
+       (!info->writes_memory ||
+        info->properties[TGSI_PROPERTY_FS_EARLY_DEPTH_STENCIL]))
+      flags |= LP_RAST_HIZ_TEST;
+
+   /* Lowering the bound needs every covered pixel to write its depth. */
+   if (key->depth.writemask &&
+       !info->uses_kill &&
+       !info->writes_samplemask &&
+       !key->alpha.enabled &&
+       !key->blend.alpha_to_coverage &&
+       (!key->multisample ||
+        (setup->fs.current.jit_context.sample_mask &
+         ((1u << key->coverage_samples) - 1)) ==
+        ((1u << key->coverage_samples) - 1)))
+      flags |= LP_RAST_HIZ_UPDATE;
+
+   return flags;
+}
+
+
+/**
+ * Work out whether the current fragment state shades the samples of a
+ * pixel alike, see LP_RAST_MSAA_x: no per-sample shading or inputs, no
+ * depth/stencil test to pass or fail per sample, and nothing counting
+ * the samples.
+ */
+static unsigned
+lp_setup_msaa_flags(const struct lp_setup_context *setup)
+{
+   const struct lp_fragment_shader_variant *variant = setup->fs.current.variant;
+   const struct lp_fragment_shader_variant_key *key;
+   const struct tgsi_shader_info *info;
+   unsigned flags = LP_RAST_MSAA_PIXEL_RATE;
+   unsigned all, i;
+
+   if (!variant || !variant->key.multisample ||
+       (LP_PERF & PERF_NO_MSAA_COMPRESS))
+      return 0;
+
+   key = &variant->key;
+   info = &variant->shader->info.base;
+   all = (1u << key->coverage_samples) - 1;
+
+   if (key->min_samples > 1 ||
+       key->depth.enabled ||
+       key->stencil[0].enabled ||
+       key->occlusion_count ||
+       key->blend.alpha_to_coverage ||
+       info->writes_samplemask ||
+       info->reads_samplemask ||
+       info->uses_persp_sample ||
+       info->uses_linear_sample ||
+       info->uses_persp_opcode_interp_sample ||
+       info->uses_linear_opcode_interp_sample ||
+       (setup->fs.current.jit_context.sample_mask & all) != all)
+      return 0;
+
+   for (i = 0; i < info->num_system_values; i++) {
+      switch (info->system_value_semantic_name[i]) {
+      case TGSI_SEMANTIC_SAMPLEID:
+      case TGSI_SEMANTIC_SAMPLEPOS:
+      case TGSI_SEMANTIC_SAMPLEMASK:
+         return 0;
+      default:
+         break;
+      }
+   }
+
+   /* Whether fully covered pixels are overwritten, so their samples
+    * become equal
+    */
+   for (i = 0; i < key->nr_cbufs; i++) {
+      const struct pipe_rt_blend_state *rt = &key->blend.rt[i];
+      const enum pipe_format format = key->cbuf_format[i];
+      const struct util_format_description *desc;
+      unsigned chans = 0, c;
+
+      if (format == PIPE_FORMAT_NONE)
+         continue;
+
+      desc = util_format_description(format);
+      for (c = 0; c < 4; c++) {
+         if (desc->swizzle[c] <= PIPE_SWIZZLE_W)
+            chans |= 1 << c;
+      }
+
+      if (!rt->blend_enable && !key->blend.logicop_enable &&
+          !info->uses_kill && !key->alpha.enabled &&
+          (rt->colormask & chans) == chans)
+         flags |= LP_RAST_MSAA_OVERWRITE(i);
+   }
+
+   return flags;
+}
+
+
 /**
  * Called by vbuf code when we're about to draw something.
  *
@@ -1206,7 +1773,20 @@ try_update_scene_state( struct lp_setup_context *setup )
 
             /* TODO: copy only the actually used constants? */
 
-            if (setup->constants[i].stored_size != current_size ||
+            if (buffer && llvmpipe_resource(buffer)->constants_only) {
+               /* Read in place.  Writes give the buffer new storage
+                * rather than touching this, see llvmpipe_rename_buffer().
+                */
+               if (setup->constants[i].stored_data != current_data &&
+                   !lp_scene_add_resource_reference(scene, buffer,
+                                                    new_scene, FALSE)) {
+                  assert(!new_scene);
+                  return FALSE;
+               }
+               setup->constants[i].stored_size = current_size;
+               setup->constants[i].stored_data = current_data;
+            }
+            else if (setup->constants[i].stored_size != current_size ||
                !setup->constants[i].stored_data ||
                memcmp(setup->constants[i].stored_data,
                       current_data,
@@ -1263,6 +1843,9 @@ try_update_scene_state( struct lp_setup_context *setup )
       }
    }
    if (setup->dirty & LP_SETUP_NEW_FS) {
+      setup->fs.current.hiz_flags = lp_setup_hiz_flags(setup);
+      setup->fs.current.msaa_flags = lp_setup_msaa_flags(setup);
+
       if (!setup->fs.stored ||
           memcmp(setup->fs.stored,
                  &setup->fs.current,
@@ -1284,6 +1867,9 @@ try_update_scene_state( struct lp_setup_context *setup )
                 &setup->fs.current,
                 sizeof setup->fs.current);
          setup->fs.stored = stored;
+
+         if (!stored->zprepass_variant[0])
+            scene->z_prepass = FALSE;
          
          /* The scene now references the textures in the rasterization
           * state record.  Note that now.
@@ -1292,7 +1878,7 @@ try_update_scene_state( struct lp_setup_context *setup )
             if (setup->fs.current_tex[i]) {
                if (!lp_scene_add_resource_reference(scene,
                                                     setup->fs.current_tex[i],
-                                                    new_scene)) {
+                                                    new_scene, FALSE)) {
                   assert(!new_scene);
                   return FALSE;
                }
@@ -1312,6 +1898,26 @@ try_update_scene_state( struct lp_setup_context *setup )
       }
    }
 
+   if (setup->dirty & LP_SETUP_NEW_PREDICATE) {
+      struct llvmpipe_query *pq = setup->predicate.query;
+
+      if (!lp_scene_bin_everywhere(scene,
+                                   LP_RAST_OP_PREDICATE,
+                                   lp_rast_arg_predicate(pq,
+                                      setup->predicate.condition))) {
+         assert(!new_scene);
+         return FALSE;
+      }
+
+      if (pq) {
+         /* Opaque draws must not drop the predicate from a bin and the
+          * query's tile results must outlive this scene.
+          */
+         scene->had_queries = TRUE;
+         lp_fence_reference(&pq->predicate_fence, scene->fence);
+      }
+   }
+
    setup->dirty = 0;
 
    assert(setup->fs.stored);
@@ -1340,6 +1946,9 @@ lp_setup_update_state( struct lp_setup_context *setup,
 
       assert(setup->setup.variant);
 
+      /* The setup function may still be compiling on the JIT queue. */
+      util_queue_fence_wait(&setup->setup.variant->fence);
+
       /* Will probably need to move this somewhere else, just need  
        * to know about vertex shader point size attribute.
        */
@@ -1358,11 +1967,37 @@ lp_setup_update_state( struct lp_setup_context *setup,
 		    setup->setup.variant->key.size) == 0);
    }
 
+   /* When streaming, don't let the scene grow big before the rasterizer
+    * gets to see it.  This is done here, between primitive batches,
+    * as restarting the scene is cheap at this point.
+    */
+   if (update_scene && setup->streaming && setup->scene &&
+       setup->scene->scene_size >= LP_SCENE_STREAM_SIZE) {
+      if (!lp_setup_split_scene(setup, __FUNCTION__))
+         return FALSE;
+   }
+   else if (update_scene && setup->pipeline && setup->scene &&
+            setup->scene->scene_size >= LP_SCENE_PIPELINE_SIZE &&
+            (!setup->last_fence || lp_fence_signalled(setup->last_fence))) {
+      /* The rasterizer threads are done with the earlier scenes, give
+       * them this one rather than leave them idle until the flush.  This
+       * doesn't make the next frames stream.
+       */
+      LP_COUNT(nr_scene_handoffs);
+      if (!set_scene_state(setup, SETUP_FLUSHED, __FUNCTION__))
+         return FALSE;
+      lp_setup_recycle_signalled_scenes(setup);
+   }
+
    if (update_scene && setup->state != SETUP_ACTIVE) {
       if (!set_scene_state( setup, SETUP_ACTIVE, __FUNCTION__ ))
          return FALSE;
    }
 
+   /* What is drawn after an invalidate has to land in memory */
+   if (update_scene && setup->scene)
+      setup->scene->zsbuf_discard = FALSE;
+
    /* Only call into update_scene_state() if we already have a
     * scene:
     */
@@ -1417,18 +2052,25 @@ lp_setup_destroy( struct lp_setup_context *setup )
       pipe_resource_reference(&setup->ssbos[i].current.buffer, NULL);
    }
 
-   /* free the scenes in the 'empty' queue */
-   for (i = 0; i < ARRAY_SIZE(setup->scenes); i++) {
+   /* wait for the scenes in flight and free them all */
+   for (i = 0; i < setup->num_scenes; i++) {
       struct lp_scene *scene = setup->scenes[i];
 
-      if (scene->fence)
+      if (scene->fence) {
          lp_fence_wait(scene->fence);
+         lp_scene_recycle(scene);
+      }
 
       lp_scene_destroy(scene);
    }
 
    lp_fence_reference(&setup->last_fence, NULL);
 
+   lp_setup_destroy_bin_threads(setup);
+
+   if (setup->own_rast)
+      lp_rast_destroy(setup->rast);
+
    FREE( setup );
 }
 
@@ -1444,7 +2086,6 @@ lp_setup_create( struct pipe_context *pipe,
 {
    struct llvmpipe_screen *screen = llvmpipe_screen(pipe->screen);
    struct lp_setup_context *setup;
-   unsigned i;
 
    setup = CALLOC_STRUCT(lp_setup_context);
    if (!setup) {
@@ -1459,6 +2100,31 @@ lp_setup_create( struct pipe_context *pipe,
 
 
    setup->num_threads = screen->num_threads;
+   setup->pipeline = (LP_PERF & PERF_PIPELINE) && screen->num_threads > 0;
+   if (util_queue_is_initialized(&screen->bin_queue)) {
+      setup->bin_queue = &screen->bin_queue;
+      setup->num_bin_threads = screen->num_bin_threads;
+   }
+   {
+      unsigned tile_size = debug_get_num_option("LP_TILE_SIZE", 0);
+      if (tile_size && util_is_power_of_two_nonzero(tile_size))
+         setup->tile_order = CLAMP(util_logbase2(tile_size),
+                                   LP_MIN_TILE_ORDER, TILE_ORDER);
+   }
+   if (screen->rast_per_context) {
+      setup->rast = lp_rast_create(screen->num_threads,
+                                   screen->thread_affinity,
+                                   screen->spin_wait_ns,
+                                   screen->texture_cache_size);
+      if (!setup->rast) {
+         goto no_rast;
+      }
+      setup->own_rast = TRUE;
+   }
+   else {
+      setup->rast = screen->rast;
+   }
+
    setup->vbuf = draw_vbuf_stage(draw, &setup->base);
    if (!setup->vbuf) {
       goto no_vbuf;
@@ -1467,13 +2133,17 @@ lp_setup_create( struct pipe_context *pipe,
    draw_set_rasterize_stage(draw, setup->vbuf);
    draw_set_render(draw, &setup->base);
 
-   /* create some empty scenes */
-   for (i = 0; i < MAX_SCENES; i++) {
-      setup->scenes[i] = lp_scene_create( pipe );
-      if (!setup->scenes[i]) {
-         goto no_scenes;
-      }
+   /* Create the first scene.  More are created on demand, up to
+    * max_scenes, when binning gets ahead of rasterization.
+    */
+   setup->max_scenes = debug_get_num_option("LP_MAX_SCENES", MAX_SCENES);
+   setup->max_scenes = CLAMP(setup->max_scenes, 1, MAX_SCENES);
+
+   setup->scenes[0] = lp_scene_create( pipe );
+   if (!setup->scenes[0]) {
+      goto no_scenes;
    }
+   setup->num_scenes = 1;
 
    setup->triangle = first_triangle;
    setup->line     = first_line;
@@ -1488,14 +2158,11 @@ lp_setup_create( struct pipe_context *pipe,
    return setup;
 
 no_scenes:
-   for (i = 0; i < MAX_SCENES; i++) {
-      if (setup->scenes[i]) {
-         lp_scene_destroy(setup->scenes[i]);
-      }
-   }
-
    setup->vbuf->destroy(setup->vbuf);
 no_vbuf:
+   if (setup->own_rast)
+      lp_rast_destroy(setup->rast);
+no_rast:
    FREE(setup);
 no_setup:
    return NULL;
@@ -1515,7 +2182,8 @@ lp_setup_begin_query(struct lp_setup_context *setup,
    if (!(pq->type == PIPE_QUERY_OCCLUSION_COUNTER ||
          pq->type == PIPE_QUERY_OCCLUSION_PREDICATE ||
          pq->type == PIPE_QUERY_OCCLUSION_PREDICATE_CONSERVATIVE ||
-         pq->type == PIPE_QUERY_PIPELINE_STATISTICS))
+         pq->type == PIPE_QUERY_PIPELINE_STATISTICS ||
+         LP_QUERY_IS_RAST_TIMED(pq->type)))
       return;
 
    /* init the query to its beginning state */
@@ -1528,6 +2196,10 @@ lp_setup_begin_query(struct lp_setup_context *setup,
    setup->active_queries[setup->active_binned_queries] = pq;
    setup->active_binned_queries++;
 
+   /* No per-tile results until the query ends in this same scene */
+   pq->tiles_x = 0;
+   pq->begin_fence_id = 0;
+
    assert(setup->scene);
    if (setup->scene) {
       if (!lp_scene_bin_everywhere(setup->scene,
@@ -1544,7 +2216,44 @@ lp_setup_begin_query(struct lp_setup_context *setup,
          }
       }
       setup->scene->had_queries |= TRUE;
+      pq->begin_fence_id = setup->scene->fence->id;
+   }
+}
+
+
+/**
+ * Give an occlusion query one byte per tile, written when its END_QUERY
+ * is rasterized, if the whole query lives in the current scene.
+ */
+static void
+lp_setup_alloc_tile_visible(struct lp_setup_context *setup,
+                            struct llvmpipe_query *pq)
+{
+   struct lp_scene *scene = setup->scene;
+   unsigned size = scene->tiles_x * scene->tiles_y;
+
+   /* The bins of each layer would race to write the tile's byte. */
+   if (pq->begin_fence_id != scene->fence->id || !size ||
+       scene->num_layer_bins > 1)
+      return;
+
+   if (size > pq->tile_visible_size) {
+      /* An older scene may still be writing or reading the old array */
+      if (pq->fence && !lp_fence_signalled(pq->fence))
+         lp_fence_wait(pq->fence);
+      if (pq->predicate_fence && !lp_fence_signalled(pq->predicate_fence))
+         lp_fence_wait(pq->predicate_fence);
+
+      FREE(pq->tile_visible);
+      pq->tile_visible = MALLOC(size);
+      pq->tile_visible_size = pq->tile_visible ? size : 0;
+      if (!pq->tile_visible)
+         return;
    }
+
+   pq->tile_order = scene->tile_order;
+   pq->tiles_x = scene->tiles_x;
+   pq->tiles_y = scene->tiles_y;
 }
 
 
@@ -1558,6 +2267,12 @@ lp_setup_end_query(struct lp_setup_context *setup, struct llvmpipe_query *pq)
 
    assert(setup->scene);
    if (setup->scene) {
+      pq->tiles_x = 0;
+      if (pq->type == PIPE_QUERY_OCCLUSION_COUNTER ||
+          pq->type == PIPE_QUERY_OCCLUSION_PREDICATE ||
+          pq->type == PIPE_QUERY_OCCLUSION_PREDICATE_CONSERVATIVE)
+         lp_setup_alloc_tile_visible(setup, pq);
+
       /* pq->fence should be the fence of the *last* scene which
        * contributed to the query result.
        */
@@ -1567,7 +2282,8 @@ lp_setup_end_query(struct lp_setup_context *setup, struct llvmpipe_query *pq)
           pq->type == PIPE_QUERY_OCCLUSION_PREDICATE ||
           pq->type == PIPE_QUERY_OCCLUSION_PREDICATE_CONSERVATIVE ||
           pq->type == PIPE_QUERY_PIPELINE_STATISTICS ||
-          pq->type == PIPE_QUERY_TIMESTAMP) {
+          pq->type == PIPE_QUERY_TIMESTAMP ||
+          LP_QUERY_IS_RAST_TIMED(pq->type)) {
          if (pq->type == PIPE_QUERY_TIMESTAMP &&
                !(setup->scene->tiles_x | setup->scene->tiles_y)) {
             /*
@@ -1580,6 +2296,9 @@ lp_setup_end_query(struct lp_setup_context *setup, struct llvmpipe_query *pq)
          if (!lp_scene_bin_everywhere(setup->scene,
                                       LP_RAST_OP_END_QUERY,
                                       lp_rast_arg_query(pq))) {
+            /* The query's begin is in the flushed scene now */
+            pq->tiles_x = 0;
+
             if (!lp_setup_flush_and_restart(setup))
                goto fail;
 
@@ -1603,7 +2322,8 @@ fail:
    if (pq->type == PIPE_QUERY_OCCLUSION_COUNTER ||
       pq->type == PIPE_QUERY_OCCLUSION_PREDICATE ||
       pq->type == PIPE_QUERY_OCCLUSION_PREDICATE_CONSERVATIVE ||
-      pq->type == PIPE_QUERY_PIPELINE_STATISTICS) {
+      pq->type == PIPE_QUERY_PIPELINE_STATISTICS ||
+      LP_QUERY_IS_RAST_TIMED(pq->type)) {
       unsigned i;
 
       /* remove from active binned query list */
@@ -1621,6 +2341,41 @@ fail:
 }
 
 
+/**
+ * Predicate the following draws, per tile, on an occlusion query's
+ * result, or stop predicating them if pq is NULL.  Returns FALSE if the
+ * query has no per-tile results for the current framebuffer.
+ */
+boolean
+lp_setup_set_predicate(struct lp_setup_context *setup,
+                       struct llvmpipe_query *pq,
+                       boolean condition)
+{
+   boolean ok = TRUE;
+
+   if (pq) {
+      set_scene_state(setup, SETUP_ACTIVE, "set_predicate");
+
+      if (!setup->scene || !pq->tile_visible ||
+          pq->tiles_x != setup->scene->tiles_x ||
+          pq->tiles_y != setup->scene->tiles_y ||
+          pq->tile_order != setup->scene->tile_order) {
+         pq = NULL;
+         ok = FALSE;
+      }
+   }
+
+   if (pq != setup->predicate.query ||
+       (pq && condition != setup->predicate.condition)) {
+      setup->predicate.query = pq;
+      setup->predicate.condition = condition;
+      setup->dirty |= LP_SETUP_NEW_PREDICATE;
+   }
+
+   return ok;
+}
+
+
 boolean
 lp_setup_flush_and_restart(struct lp_setup_context *setup)
 {
@@ -1628,7 +2383,7 @@ lp_setup_flush_and_restart(struct lp_setup_context *setup)
 
    assert(setup->state == SETUP_ACTIVE);
 
-   if (!set_scene_state(setup, SETUP_FLUSHED, __FUNCTION__))
+   if (!lp_setup_split_scene(setup, __FUNCTION__))
       return FALSE;
    
    if (!lp_setup_update_state(setup, TRUE))
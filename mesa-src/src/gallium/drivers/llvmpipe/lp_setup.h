@@ -35,9 +35,11 @@ struct vertex_info;
 
 
 struct pipe_resource;
+struct pipe_box;
 struct pipe_query;
 struct pipe_surface;
 struct pipe_blend_color;
+struct pipe_depth_stencil_alpha_state;
 struct pipe_screen;
 struct pipe_framebuffer_state;
 struct lp_fragment_shader_variant;
@@ -60,6 +62,15 @@ lp_setup_clear(struct lp_setup_context *setup,
                unsigned clear_stencil,
                unsigned flags);
 
+boolean
+lp_setup_readback(struct lp_setup_context *setup,
+                  unsigned cbuf,
+                  const struct pipe_box *box,
+                  struct pipe_resource *dst,
+                  enum pipe_format dst_format,
+                  unsigned dst_offset,
+                  int dst_stride);
+
 
 
 void
@@ -67,6 +78,13 @@ lp_setup_flush( struct lp_setup_context *setup,
                 struct pipe_fence_handle **fence,
                 const char *reason);
 
+boolean
+lp_setup_get_scene_fence(struct lp_setup_context *setup,
+                         struct pipe_fence_handle **fence);
+
+void
+lp_setup_flush_triangles(struct lp_setup_context *setup);
+
 
 void
 lp_setup_bind_framebuffer( struct lp_setup_context *setup,
@@ -81,6 +99,11 @@ lp_setup_set_triangle_state( struct lp_setup_context *setup,
                              boolean bottom_edge_rule,
                              boolean multisample);
 
+void
+lp_setup_set_conservative_state( struct lp_setup_context *setup,
+                                 boolean conservative,
+                                 float dilate);
+
 void 
 lp_setup_set_line_state( struct lp_setup_context *setup,
                          float line_width);
@@ -94,12 +117,17 @@ lp_setup_set_point_state( struct lp_setup_context *setup,
 
 void
 lp_setup_set_setup_variant( struct lp_setup_context *setup,
-			    const struct lp_setup_variant *variant );
+			    struct lp_setup_variant *variant );
 
 void
 lp_setup_set_fs_variant( struct lp_setup_context *setup,
                          struct lp_fragment_shader_variant *variant );
 
+void
+lp_setup_set_fs_zprepass(struct lp_setup_context *setup,
+                         struct lp_fragment_shader_variant *depth_variant,
+                         struct lp_fragment_shader_variant *shade_variant);
+
 void
 lp_setup_set_fs_constants(struct lp_setup_context *setup,
                           unsigned num,
@@ -123,6 +151,10 @@ void
 lp_setup_set_stencil_ref_values( struct lp_setup_context *setup,
                                  const ubyte refs[2] );
 
+void
+lp_setup_set_depth_stencil_state( struct lp_setup_context *setup,
+                                  const struct pipe_depth_stencil_alpha_state *dsa );
+
 void
 lp_setup_set_blend_color( struct lp_setup_context *setup,
                           const struct pipe_blend_color *blend_color );
@@ -150,6 +182,14 @@ unsigned
 lp_setup_is_resource_referenced( const struct lp_setup_context *setup,
                                 const struct pipe_resource *texture );
 
+void
+lp_setup_invalidate_resource(struct lp_setup_context *setup,
+                             const struct pipe_resource *texture);
+
+boolean
+lp_setup_retire_data(struct lp_setup_context *setup, void *data,
+                     size_t size);
+
 void
 lp_setup_set_sample_mask(struct lp_setup_context *setup,
                          uint32_t sample_mask);
@@ -174,6 +214,20 @@ void
 lp_setup_end_query(struct lp_setup_context *setup,
                    struct llvmpipe_query *pq);
 
+boolean
+lp_setup_set_predicate(struct lp_setup_context *setup,
+                       struct llvmpipe_query *pq,
+                       boolean condition);
+
+uint64_t
+lp_setup_scene_memory(const struct lp_setup_context *setup);
+
+uint64_t
+lp_setup_vertex_memory(const struct lp_setup_context *setup);
+
+void
+lp_setup_trim(struct lp_setup_context *setup);
+
 static inline unsigned
 lp_clamp_viewport_idx(int idx)
 {
@@ -43,6 +43,7 @@
 #include "draw/draw_vbuf.h"
 #include "util/u_rect.h"
 #include "util/u_pack_color.h"
+#include "util/u_queue.h"
 
 #define LP_SETUP_NEW_FS          0x01
 #define LP_SETUP_NEW_CONSTANTS   0x02
@@ -50,13 +51,37 @@
 #define LP_SETUP_NEW_SCISSOR     0x08
 #define LP_SETUP_NEW_VIEWPORTS   0x10
 #define LP_SETUP_NEW_SSBOS       0x20
+#define LP_SETUP_NEW_PREDICATE   0x40
 
 struct lp_setup_variant;
 
 
-/** Max number of scenes */
-/* XXX: make multiple scenes per context work, see lp_setup_rasterize_scene */
-#define MAX_SCENES 1
+/** Max number of scenes per context (see also LP_MAX_SCENES) */
+#define MAX_SCENES 4
+
+/** Fewest triangles worth giving a bin thread */
+#define LP_BIN_THREAD_MIN_TRIANGLES 1024
+
+/** Most triangles batched before they are binned */
+#define LP_BIN_BATCH_MAX_TRIANGLES (LP_MAX_BIN_THREADS * 2048)
+
+
+/**
+ * A range of the triangle batch, binned by one thread into a fork of the
+ * scene (see lp_scene_fork()) through a copy of the setup context.
+ */
+struct lp_setup_bin_thread
+{
+   struct util_queue_fence fence;
+
+   struct lp_setup_context *setup;   /**< the copy, bin_thread points back */
+   struct lp_scene *fork;
+
+   unsigned start, end;              /**< triangles, [start, end) */
+
+   boolean failed;                   /**< the fork ran out of memory */
+   unsigned failed_at;               /**< the triangle which didn't fit */
+};
 
 
 
@@ -81,26 +106,45 @@ struct lp_setup_context
    uint sprite_coord_enable, sprite_coord_origin;
    uint vertex_buffer_size;
    void *vertex_buffer;
+   /** vertex_buffer, or the draw module's, see lp_setup_set_vertices() */
+   const void *vertices;
 
    /* Final pipeline stage for draw module.  Draw module should
     * create/install this itself now.
     */
    struct draw_stage *vbuf;
+   struct lp_rasterizer *rast;  /**< the screen's, or our own one */
+   boolean own_rast;
    unsigned num_threads;
+   unsigned tile_order;                  /**< LP_TILE_SIZE, 0 for adaptive */
    unsigned scene_idx;
-   struct lp_scene *scenes[MAX_SCENES];  /**< all the scenes */
+   unsigned num_scenes;                  /**< scenes allocated so far */
+   unsigned max_scenes;                  /**< LP_MAX_SCENES, <= MAX_SCENES */
+   struct lp_scene *scenes[MAX_SCENES];  /**< all the scenes, oldest first
+                                          *   after scene_idx */
    struct lp_scene *scene;               /**< current scene being built */
+   boolean streaming;        /**< split scenes at LP_SCENE_STREAM_SIZE */
+   boolean scene_split;      /**< a scene was split since the last flush */
+   boolean pipeline;         /**< LP_PERF=pipeline, with rasterizer threads */
 
    struct lp_fence *last_fence;
    struct llvmpipe_query *active_queries[LP_MAX_ACTIVE_BINNED_QUERIES];
    unsigned active_binned_queries;
 
+   /** Occlusion query whose per-tile result predicates the draws */
+   struct {
+      struct llvmpipe_query *query;
+      boolean condition;
+   } predicate;
+
    boolean flatshade_first;
    boolean ccw_is_frontface;
    boolean scissor_test;
    boolean point_size_per_vertex;
    boolean rasterizer_discard;
    boolean multisample;
+   boolean conservative;   /**< see lp_setup_conservative_planes() */
+   int conservative_ext;   /**< half a pixel plus the dilation, fixed point */
    unsigned cullmode;
    unsigned bottom_edge_rule;
    float pixel_offset;
@@ -160,11 +204,29 @@ struct lp_setup_context
 
 
    struct {
-      const struct lp_setup_variant *variant;
+      struct lp_setup_variant *variant;
    } setup;
 
    unsigned dirty;   /**< bitmask of LP_SETUP_NEW_x bits */
 
+   /**
+    * Threaded binning (LP_BIN_THREADS): the triangles of a draw are
+    * queued with their vertices, and binned by lp_setup_flush_triangles()
+    * once the draw is done or the batch is full.
+    */
+   struct util_queue *bin_queue;
+   unsigned num_bin_threads;
+   struct lp_setup_bin_thread bin_threads[LP_MAX_BIN_THREADS];
+   struct {
+      uint8_t *verts;           /**< 3 vertices per triangle */
+      unsigned vertex_size;     /**< in bytes */
+      unsigned count;
+      unsigned max;
+   } tri_batch;
+
+   /** Set in the copies of the context used by the bin threads */
+   struct lp_setup_bin_thread *bin_thread;
+
    void (*point)( struct lp_setup_context *,
                   const float (*v0)[4]);
 
@@ -192,12 +254,48 @@ scissor_planes_needed(boolean scis_planes[4], const struct u_rect *bbox,
    scis_planes[3] = (bbox->y1 > scissor->y1);
 }
 
+/**
+ * Move the edge planes of a conservatively rasterized primitive out by
+ * setup->conservative_ext along both axes, so that every pixel whose
+ * square, grown by the dilation, the primitive touches has its center
+ * inside.  The trivial reject and accept tests of the 64x64, 16x16 and
+ * 4x4 blocks follow, as they only add offsets derived from dcdx and dcdy.
+ */
+static inline void
+lp_setup_conservative_planes(const struct lp_setup_context *setup,
+                             struct lp_rast_plane *plane,
+                             unsigned nr_planes)
+{
+   unsigned i;
+
+   for (i = 0; i < nr_planes; i++) {
+      const int64_t dcdx = plane[i].dcdx, dcdy = plane[i].dcdy;
+      const int64_t d = (dcdx < 0 ? -dcdx : dcdx) + (dcdy < 0 ? -dcdy : dcdy);
+
+      plane[i].c += (d >> FIXED_ORDER) * setup->conservative_ext;
+   }
+}
+
+/**
+ * The inclusive range of pixels a conservatively rasterized primitive
+ * spanning [min, max] in fixed point touches, see
+ * lp_setup_conservative_planes().
+ */
+static inline void
+lp_setup_conservative_range(const struct lp_setup_context *setup,
+                            int min, int max, int *p0, int *p1)
+{
+   *p0 = ((min - setup->conservative_ext) >> FIXED_ORDER) + 1;
+   *p1 = (max + setup->conservative_ext - 1) >> FIXED_ORDER;
+}
+
 
 void lp_setup_choose_triangle( struct lp_setup_context *setup );
 void lp_setup_choose_line( struct lp_setup_context *setup );
 void lp_setup_choose_point( struct lp_setup_context *setup );
 
 void lp_setup_init_vbuf(struct lp_setup_context *setup);
+void lp_setup_destroy_bin_threads(struct lp_setup_context *setup);
 
 boolean lp_setup_update_state( struct lp_setup_context *setup,
                             boolean update_scene);
@@ -224,6 +322,12 @@ lp_setup_alloc_triangle(struct lp_scene *scene,
                         unsigned nr_planes,
                         unsigned *tri_size);
 
+unsigned
+lp_setup_triangles(struct lp_setup_context *setup,
+                   const uint8_t *verts,
+                   unsigned vertex_size,
+                   unsigned count);
+
 boolean
 lp_setup_bin_triangle(struct lp_setup_context *setup,
                       struct lp_rast_triangle *tri,
@@ -232,4 +336,12 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
                       int nr_planes,
                       unsigned scissor_index);
 
+struct lp_rast_rectangle *
+lp_setup_alloc_rectangle(struct lp_scene *scene,
+                         unsigned num_inputs);
+
+boolean
+lp_setup_bin_rectangle(struct lp_setup_context *setup,
+                       struct lp_rast_rectangle *rect);
+
 #endif
@@ -129,6 +129,40 @@ static void perspective_coef( struct lp_setup_context *setup,
                          dady * (info->v1[0][1] - setup->pixel_offset)));
 }
 
+/**
+ * Setup the edge distances of a smooth line.  x and y are the distances
+ * across and along the line from its middle, z and w those at which a
+ * pixel's coverage reaches zero: the fragment shader takes the coverage
+ * as clamp(z - |x|) * clamp(w - |y|), and triangles and points set
+ * z = w = 1 with x = y = 0.
+ */
+static void aa_line_coef( struct lp_setup_context *setup,
+                          struct lp_line_info *info,
+                          unsigned slot)
+{
+   const float len = sqrtf(info->dx * info->dx + info->dy * info->dy);
+   const float ux = -info->dx / len;
+   const float uy = -info->dy / len;
+   const float mx = 0.5f * (info->v1[0][0] + info->v2[0][0]) - setup->pixel_offset;
+   const float my = 0.5f * (info->v1[0][1] + info->v2[0][1]) - setup->pixel_offset;
+
+   /* Across the line, along its normal (-uy, ux):
+    */
+   info->dadx[slot][0] = -uy;
+   info->dady[slot][0] = ux;
+   info->a0[slot][0] = uy * mx - ux * my;
+
+   /* Along the line:
+    */
+   info->dadx[slot][1] = ux;
+   info->dady[slot][1] = uy;
+   info->a0[slot][1] = -(ux * mx + uy * my);
+
+   constant_coef(setup, info, slot,
+                 0.5f * MAX2(1.0f, setup->line_width) + 0.5f, 2);
+   constant_coef(setup, info, slot, 0.5f * len + 0.5f, 3);
+}
+
 static void
 setup_fragcoord_coef( struct lp_setup_context *setup,
                       struct lp_line_info *info,
@@ -220,6 +254,10 @@ static void setup_line_coefficients( struct lp_setup_context *setup,
                              info->frontfacing ? 1.0f : -1.0f, i);
          break;
 
+      case LP_INTERP_AA_LINE:
+         aa_line_coef(setup, info, slot+1);
+         break;
+
       default:
          assert(0);
       }
@@ -275,6 +313,58 @@ static inline float fracf(float f)
 }
 
 
+/* Floor of a / b, for b > 0:
+ */
+static inline int64_t floor_div64(int64_t a, int64_t b)
+{
+   int64_t q = a / b;
+   return (a % b < 0) ? q - 1 : q;
+}
+
+
+/**
+ * A line whose edges are all horizontal or vertical covers exactly the
+ * pixels of a box.  Find that box from the edge planes with the C > 0
+ * test the rasterizer applies per pixel, so the fill convention holds.
+ * \return FALSE if the edges are not screen-aligned
+ */
+static boolean
+line_rect_box(const struct lp_rast_plane *plane,
+              struct u_rect *box)
+{
+   unsigned bounds = 0;
+   int i;
+
+   for (i = 0; i < 4; i++) {
+      const int64_t c = plane[i].c;
+      const int64_t dcdx = plane[i].dcdx;
+      const int64_t dcdy = plane[i].dcdy;
+
+      if (dcdy == 0 && dcdx < 0) {
+         box->x0 = (int)(floor_div64(-c, -dcdx) + 1);
+         bounds |= 1 << 0;
+      }
+      else if (dcdy == 0 && dcdx > 0) {
+         box->x1 = (int)floor_div64(c - 1, dcdx);
+         bounds |= 1 << 1;
+      }
+      else if (dcdx == 0 && dcdy > 0) {
+         box->y0 = (int)(floor_div64(-c, dcdy) + 1);
+         bounds |= 1 << 2;
+      }
+      else if (dcdx == 0 && dcdy < 0) {
+         box->y1 = (int)floor_div64(c - 1, -dcdy);
+         bounds |= 1 << 3;
+      }
+      else {
+         return FALSE;
+      }
+   }
+
+   return bounds == 0xf;
+}
+
+
 
 static boolean
 try_setup_line( struct lp_setup_context *setup,
@@ -284,7 +374,10 @@ try_setup_line( struct lp_setup_context *setup,
    struct llvmpipe_context *lp_context = (struct llvmpipe_context *)setup->pipe;
    struct lp_scene *scene = setup->scene;
    const struct lp_setup_variant_key *key = &setup->setup.variant->key;
-   struct lp_rast_triangle *line;
+   struct lp_rast_triangle *line = NULL;
+   struct lp_rast_rectangle *rect = NULL;
+   struct lp_rast_shader_inputs *inputs;
+   struct lp_rast_plane edge[4];
    struct lp_rast_plane *plane;
    struct lp_line_info info;
    float width = MAX2(1.0, setup->line_width);
@@ -357,8 +450,44 @@ try_setup_line( struct lp_setup_context *setup,
    info.v2 = v2;
 
   
+   if (key->aa_line) {
+      /* Smooth lines cover the rectangle around the segment, grown by
+       * half a pixel on every side so that partially covered pixels are
+       * shaded too; aa_line_coef() gives them their coverage.  There is
+       * no diamond exit rule to follow.
+       */
+      const float len = sqrtf(area);
+      const float hw = 0.5f * MAX2(1.0f, setup->line_width) + 0.5f;
+      const float ex = -dx / len * 0.5f;
+      const float ey = -dy / len * 0.5f;
+      const float nx = dy / len * hw;
+      const float ny = -dx / len * hw;
+      const float x1 = v1[0][0] - setup->pixel_offset;
+      const float y1 = v1[0][1] - setup->pixel_offset;
+      const float x2 = v2[0][0] - setup->pixel_offset;
+      const float y2 = v2[0][1] - setup->pixel_offset;
+
+      x[0] = subpixel_snap(x1 - ex - nx);
+      y[0] = subpixel_snap(y1 - ey - ny);
+      x[1] = subpixel_snap(x2 + ex - nx);
+      y[1] = subpixel_snap(y2 + ey - ny);
+      x[2] = subpixel_snap(x2 + ex + nx);
+      y[2] = subpixel_snap(y2 + ey + ny);
+      x[3] = subpixel_snap(x1 - ex + nx);
+      y[3] = subpixel_snap(y1 - ey + ny);
+
+      /* The edge planes below want the corners in the same order as
+       * the aliased quads.
+       */
+      if (IMUL64(x[1] - x[0], y[3] - y[0]) >
+          IMUL64(y[1] - y[0], x[3] - x[0])) {
+         int tmp;
+         tmp = x[1]; x[1] = x[3]; x[3] = tmp;
+         tmp = y[1]; y[1] = y[3]; y[3] = tmp;
+      }
+   }
    /* X-MAJOR LINE */
-   if (fabsf(dx) >= fabsf(dy)) {
+   else if (fabsf(dx) >= fabsf(dy)) {
       float dydx = dy / dx;
 
       x1diff = v1[0][0] - floorf(v1[0][0]) - 0.5f;
@@ -553,7 +682,17 @@ try_setup_line( struct lp_setup_context *setup,
    }
 
    /* Bounding rectangle (in pixels) */
-   {
+   if (setup->conservative) {
+      lp_setup_conservative_range(setup,
+                                  MIN4(x[0], x[1], x[2], x[3]),
+                                  MAX4(x[0], x[1], x[2], x[3]),
+                                  &bbox.x0, &bbox.x1);
+      lp_setup_conservative_range(setup,
+                                  MIN4(y[0], y[1], y[2], y[3]),
+                                  MAX4(y[0], y[1], y[2], y[3]),
+                                  &bbox.y0, &bbox.y1);
+   }
+   else {
       /* Yes this is necessary to accurately calculate bounding boxes
        * with the two fill-conventions we support.  GL (normally) ends
        * up needing a bottom-left fill convention, which requires
@@ -585,47 +724,8 @@ try_setup_line( struct lp_setup_context *setup,
       return TRUE;
    }
 
-   bboxpos = bbox;
-
-   /* Can safely discard negative regions:
-    */
-   bboxpos.x0 = MAX2(bboxpos.x0, 0);
-   bboxpos.y0 = MAX2(bboxpos.y0, 0);
-
-   nr_planes = 4;
-   /*
-    * Determine how many scissor planes we need, that is drop scissor
-    * edges if the bounding box of the tri is fully inside that edge.
-    */
-   if (setup->scissor_test) {
-      /* why not just use draw_regions */
-      scissor = &setup->scissors[viewport_index];
-      scissor_planes_needed(s_planes, &bboxpos, scissor);
-      nr_planes += s_planes[0] + s_planes[1] + s_planes[2] + s_planes[3];
-   } else {
-      scissor = &setup->draw_regions[viewport_index];
-      scissor_planes_needed(s_planes, &bboxpos, scissor);
-      nr_planes += s_planes[0] + s_planes[1] + s_planes[2] + s_planes[3];
-   }
-
-   line = lp_setup_alloc_triangle(scene,
-                                  key->num_inputs,
-                                  nr_planes,
-                                  &tri_bytes);
-   if (!line)
-      return FALSE;
-
-#ifdef DEBUG
-   line->v[0][0] = v1[0][0];
-   line->v[1][0] = v2[0][0];   
-   line->v[0][1] = v1[0][1];
-   line->v[1][1] = v2[0][1];
-#endif
-
-   LP_COUNT(nr_tris);
-
    /* calculate the deltas */
-   plane = GET_PLANES(line);
+   plane = edge;
    plane[0].dcdy = x[0] - x[1];
    plane[1].dcdy = x[1] - x[2];
    plane[2].dcdy = x[2] - x[3];
@@ -636,26 +736,6 @@ try_setup_line( struct lp_setup_context *setup,
    plane[2].dcdx = y[2] - y[3];
    plane[3].dcdx = y[3] - y[0];
 
-   if (draw_will_inject_frontface(lp_context->draw) &&
-       setup->face_slot > 0) {
-      line->inputs.frontfacing = v1[setup->face_slot][0];
-   } else {
-      line->inputs.frontfacing = TRUE;
-   }
-
-   /* Setup parameter interpolants:
-    */
-   info.a0 = GET_A0(&line->inputs);
-   info.dadx = GET_DADX(&line->inputs);
-   info.dady = GET_DADY(&line->inputs);
-   info.frontfacing = line->inputs.frontfacing;
-   setup_line_coefficients(setup, &info); 
-
-   line->inputs.disable = FALSE;
-   line->inputs.opaque = FALSE;
-   line->inputs.layer = layer;
-   line->inputs.viewport_index = viewport_index;
-
    /*
     * XXX: this code is mostly identical to the one in lp_setup_tri, except it
     * uses 4 planes instead of 3. Could share the code (including the sse
@@ -702,6 +782,100 @@ try_setup_line( struct lp_setup_context *setup,
       if (plane[i].dcdy > 0) plane[i].eo += plane[i].dcdy;
    }
 
+   if (setup->conservative)
+      lp_setup_conservative_planes(setup, plane, 4);
+
+   /* Single-sampled lines with screen-aligned edges are rectangles,
+    * which need neither edge nor scissor planes.  Conservative ones keep
+    * the planes, for the inner coverage.
+    */
+   if (!setup->multisample && !setup->conservative &&
+       line_rect_box(edge, &bbox)) {
+      if (bbox.x1 < bbox.x0 ||
+          bbox.y1 < bbox.y0 ||
+          !u_rect_test_intersection(&setup->draw_regions[viewport_index],
+                                    &bbox)) {
+         LP_COUNT(nr_culled_tris);
+         return TRUE;
+      }
+      u_rect_find_intersection(&setup->draw_regions[viewport_index], &bbox);
+
+      rect = lp_setup_alloc_rectangle(scene, key->num_inputs);
+      if (!rect)
+         return FALSE;
+
+      rect->box = bbox;
+      inputs = &rect->inputs;
+   }
+   else {
+      bboxpos = bbox;
+
+      /* Can safely discard negative regions:
+       */
+      bboxpos.x0 = MAX2(bboxpos.x0, 0);
+      bboxpos.y0 = MAX2(bboxpos.y0, 0);
+
+      nr_planes = 4;
+      /*
+       * Determine how many scissor planes we need, that is drop scissor
+       * edges if the bounding box of the tri is fully inside that edge.
+       */
+      if (setup->scissor_test) {
+         /* why not just use draw_regions */
+         scissor = &setup->scissors[viewport_index];
+         scissor_planes_needed(s_planes, &bboxpos, scissor);
+         nr_planes += s_planes[0] + s_planes[1] + s_planes[2] + s_planes[3];
+      } else {
+         scissor = &setup->draw_regions[viewport_index];
+         scissor_planes_needed(s_planes, &bboxpos, scissor);
+         nr_planes += s_planes[0] + s_planes[1] + s_planes[2] + s_planes[3];
+      }
+
+      line = lp_setup_alloc_triangle(scene,
+                                     key->num_inputs,
+                                     nr_planes,
+                                     &tri_bytes);
+      if (!line)
+         return FALSE;
+
+#ifdef DEBUG
+      line->v[0][0] = v1[0][0];
+      line->v[1][0] = v2[0][0];   
+      line->v[0][1] = v1[0][1];
+      line->v[1][1] = v2[0][1];
+#endif
+
+      inputs = &line->inputs;
+   }
+
+   LP_COUNT(nr_tris);
+
+   if (draw_will_inject_frontface(lp_context->draw) &&
+       setup->face_slot > 0) {
+      inputs->frontfacing = v1[setup->face_slot][0];
+   } else {
+      inputs->frontfacing = TRUE;
+   }
+
+   /* Setup parameter interpolants:
+    */
+   info.a0 = GET_A0(inputs);
+   info.dadx = GET_DADX(inputs);
+   info.dady = GET_DADY(inputs);
+   info.frontfacing = inputs->frontfacing;
+   setup_line_coefficients(setup, &info); 
+
+   inputs->disable = FALSE;
+   inputs->opaque = FALSE;
+   inputs->conservative_planes = setup->conservative ? 4 : 0;
+   inputs->layer = layer;
+   inputs->viewport_index = viewport_index;
+
+   if (rect)
+      return lp_setup_bin_rectangle(setup, rect);
+
+   plane = GET_PLANES(line);
+   memcpy(plane, edge, sizeof edge);
 
    /* 
     * When rasterizing scissored tris, use the intersection of the
@@ -291,6 +291,12 @@ setup_point_coefficients( struct lp_setup_context *setup,
                              info->frontfacing ? 1.0f : -1.0f, i);
          break;
 
+      case LP_INTERP_AA_LINE:
+         /* Points are fully covered, see lp_setup_line.c */
+         for (i = 0; i < NUM_CHANNELS; i++)
+            constant_coef(setup, info, slot+1, i < 2 ? 0.0f : 1.0f, i);
+         break;
+
       default:
          assert(0);
          break;
@@ -352,7 +358,9 @@ try_setup_point( struct lp_setup_context *setup,
    int adj = (setup->bottom_edge_rule != 0) ? 1 : 0;
 
    struct lp_scene *scene = setup->scene;
-   struct lp_rast_triangle *point;
+   struct lp_rast_triangle *point = NULL;
+   struct lp_rast_rectangle *rect = NULL;
+   struct lp_rast_shader_inputs *inputs;
    unsigned bytes;
    struct u_rect bbox;
    unsigned nr_planes = 4;
@@ -388,15 +396,23 @@ try_setup_point( struct lp_setup_context *setup,
       x0 = subpixel_snap(v0[0][0] - setup->pixel_offset) - fixed_width/2;
       y0 = subpixel_snap(v0[0][1] - setup->pixel_offset) - fixed_width/2;
 
-      bbox.x0 = (x0 + (FIXED_ONE-1)) >> FIXED_ORDER;
-      bbox.x1 = (x0 + fixed_width + (FIXED_ONE-1)) >> FIXED_ORDER;
-      bbox.y0 = (y0 + (FIXED_ONE-1) + adj) >> FIXED_ORDER;
-      bbox.y1 = (y0 + fixed_width + (FIXED_ONE-1) + adj) >> FIXED_ORDER;
+      if (setup->conservative) {
+         lp_setup_conservative_range(setup, x0, x0 + fixed_width,
+                                     &bbox.x0, &bbox.x1);
+         lp_setup_conservative_range(setup, y0, y0 + fixed_width,
+                                     &bbox.y0, &bbox.y1);
+      }
+      else {
+         bbox.x0 = (x0 + (FIXED_ONE-1)) >> FIXED_ORDER;
+         bbox.x1 = (x0 + fixed_width + (FIXED_ONE-1)) >> FIXED_ORDER;
+         bbox.y0 = (y0 + (FIXED_ONE-1) + adj) >> FIXED_ORDER;
+         bbox.y1 = (y0 + fixed_width + (FIXED_ONE-1) + adj) >> FIXED_ORDER;
 
-      /* Inclusive coordinates:
-       */
-      bbox.x1--;
-      bbox.y1--;
+         /* Inclusive coordinates:
+          */
+         bbox.x1--;
+         bbox.y1--;
+      }
    } else {
       /*
        * OpenGL legacy rasterization rules for non-sprite points.
@@ -455,17 +471,29 @@ try_setup_point( struct lp_setup_context *setup,
 
    u_rect_find_intersection(&setup->draw_regions[viewport_index], &bbox);
 
-   point = lp_setup_alloc_triangle(scene,
-                                   key->num_inputs,
-                                   nr_planes,
-                                   &bytes);
-   if (!point)
-      return FALSE;
+   /* Single-sampled points cover their box, and are binned as such.
+    * Multisampled ones need the planes to test the samples.
+    */
+   if (!setup->multisample) {
+      rect = lp_setup_alloc_rectangle(scene, key->num_inputs);
+      if (!rect)
+         return FALSE;
+      inputs = &rect->inputs;
+   }
+   else {
+      point = lp_setup_alloc_triangle(scene,
+                                      key->num_inputs,
+                                      nr_planes,
+                                      &bytes);
+      if (!point)
+         return FALSE;
+      inputs = &point->inputs;
 
 #ifdef DEBUG
-   point->v[0][0] = v0[0][0];
-   point->v[0][1] = v0[0][1];
+      point->v[0][0] = v0[0][0];
+      point->v[0][1] = v0[0][1];
 #endif
+   }
 
    LP_COUNT(nr_tris);
 
@@ -475,9 +503,9 @@ try_setup_point( struct lp_setup_context *setup,
 
    if (draw_will_inject_frontface(lp_context->draw) &&
        setup->face_slot > 0) {
-      point->inputs.frontfacing = v0[setup->face_slot][0];
+      inputs->frontfacing = v0[setup->face_slot][0];
    } else {
-      point->inputs.frontfacing = TRUE;
+      inputs->frontfacing = TRUE;
    }
 
    info.v0 = v0;
@@ -485,19 +513,25 @@ try_setup_point( struct lp_setup_context *setup,
    info.dx12 = fixed_width;
    info.dy01 = fixed_width;
    info.dy12 = 0;
-   info.a0 = GET_A0(&point->inputs);
-   info.dadx = GET_DADX(&point->inputs);
-   info.dady = GET_DADY(&point->inputs);
-   info.frontfacing = point->inputs.frontfacing;
+   info.a0 = GET_A0(inputs);
+   info.dadx = GET_DADX(inputs);
+   info.dady = GET_DADY(inputs);
+   info.frontfacing = inputs->frontfacing;
    
    /* Setup parameter interpolants:
     */
    setup_point_coefficients(setup, &info);
 
-   point->inputs.disable = FALSE;
-   point->inputs.opaque = FALSE;
-   point->inputs.layer = layer;
-   point->inputs.viewport_index = viewport_index;
+   inputs->disable = FALSE;
+   inputs->opaque = FALSE;
+   inputs->conservative_planes = 0;
+   inputs->layer = layer;
+   inputs->viewport_index = viewport_index;
+
+   if (rect) {
+      rect->box = bbox;
+      return lp_setup_bin_rectangle(setup, rect);
+   }
 
    {
       struct lp_rast_plane *plane = GET_PLANES(point);
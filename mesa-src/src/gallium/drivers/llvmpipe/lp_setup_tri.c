@@ -33,6 +33,7 @@
 #include "util/u_memory.h"
 #include "util/u_rect.h"
 #include "util/u_sse.h"
+#include "util/u_cpu_detect.h"
 #include "lp_perf.h"
 #include "lp_setup_context.h"
 #include "lp_rast.h"
@@ -41,14 +42,21 @@
 #include "lp_context.h"
 
 #include <inttypes.h>
+#include <limits.h>
 
 #define NUM_CHANNELS 4
 
 #if defined(PIPE_ARCH_SSE)
 #include <emmintrin.h>
+#if defined(PIPE_ARCH_X86_64) && defined(PIPE_CC_GCC)
+#include <immintrin.h>
+#define LP_SETUP_HAVE_AVX2
+#endif
 #elif defined(_ARCH_PWR8) && UTIL_ARCH_LITTLE_ENDIAN
 #include <altivec.h>
 #include "util/u_pwr8.h"
+#elif defined(PIPE_ARCH_AARCH64)
+#include <arm_neon.h>
 #endif
 
 #if !defined(PIPE_ARCH_SSE)
@@ -97,7 +105,10 @@ lp_setup_alloc_triangle(struct lp_scene *scene,
                 3 * input_array_sz +
                 plane_sz);
 
-   tri = lp_scene_alloc_aligned( scene, *tri_size, 16 );
+   /* On a cache line of their own, the rasterizer threads read the
+    * header, coefficients and planes in the fewest lines.
+    */
+   tri = lp_scene_alloc_aligned( scene, *tri_size, DATA_BLOCK_ALIGN );
    if (!tri)
       return NULL;
 
@@ -218,13 +229,238 @@ lp_rast_ms_tri_tab[MAX_PLANES+1] = {
 };
 
 /**
- * The primitive covers the whole tile- shade whole tile.
+ * Check whether the input a blit shader samples at maps the pixels of the
+ * box 1:1 to texels of the texture, left to right, without the rounding
+ * of the shader's math getting near another texel.  With linear
+ * filtering, the texel centers must be hit exactly, for the weights of
+ * the neighbours to be zero.  Pixel (x, y) then gets texel
+ * (x + offset[0], y * step[1] + offset[1]).
+ *
+ * \param box  pixels of the primitive to check, inclusive
+ */
+static boolean
+lp_setup_texel_mapping(struct lp_setup_context *setup,
+                       const struct lp_rast_shader_inputs *inputs,
+                       const struct u_rect *box,
+                       int offset[2], int step[2])
+{
+   const struct lp_fragment_shader_variant *variant =
+      setup->fs.current.variant;
+   const struct lp_fragment_shader *shader = variant->shader;
+   const struct lp_static_sampler_state *sampler =
+      &variant->key.samplers[0].sampler_state;
+   const struct lp_jit_texture *texture =
+      &setup->fs.current.jit_context.textures[0];
+   const float (*a0)[4] = (const float (*)[4])GET_A0(inputs);
+   const float (*dadx)[4] = (const float (*)[4])GET_DADX(inputs);
+   const float (*dady)[4] = (const float (*)[4])GET_DADY(inputs);
+   const int size[2] = { texture->width, texture->height };
+   const unsigned slot = shader->blit_input + 1;
+   const boolean linear =
+      sampler->min_img_filter == PIPE_TEX_FILTER_LINEAR ||
+      sampler->mag_img_filter == PIPE_TEX_FILTER_LINEAR;
+   double oow = 1.0;
+   unsigned i, j;
+
+   assert(shader->blit_input >= 0);
+
+   if (!texture->base || texture->first_level != 0 ||
+       texture->num_samples > 1)
+      return FALSE;
+
+   /* The input is divided by the interpolated 1/w, which must be constant */
+   if (shader->inputs[shader->blit_input].interp == LP_INTERP_PERSPECTIVE) {
+      if (dadx[0][3] != 0.0f || dady[0][3] != 0.0f || a0[0][3] <= 0.0f ||
+          (linear && a0[0][3] != 1.0f))
+         return FALSE;
+      oow = a0[0][3];
+   }
+
+   for (i = 0; i < 2; i++) {
+      const unsigned chan = shader->blit_chan[i];
+      const double scale = (sampler->normalized_coords ? size[i] : 1) / oow;
+      const double a = a0[slot][chan] * scale;
+      const double dx = dadx[slot][chan] * scale;
+      const double dy = dady[slot][chan] * scale;
+      const int p0 = i == 0 ? box->x0 : box->y0;
+      const int p1 = i == 0 ? box->x1 : box->y1;
+
+      /* Exact results with linear filtering need exact math in floats */
+      if (linear && sampler->normalized_coords &&
+          !util_is_power_of_two_or_zero(size[i]))
+         return FALSE;
+
+      /* Rows may be flipped, columns are copied in order */
+      step[i] = i == 1 && dy < 0.0 ? -1 : 1;
+      offset[i] = (int)floor(a + dx * box->x0 + dy * box->y0) - step[i] * p0;
+
+      if (step[i] * p0 + offset[i] < 0 || step[i] * p0 + offset[i] >= size[i] ||
+          step[i] * p1 + offset[i] < 0 || step[i] * p1 + offset[i] >= size[i])
+         return FALSE;
+
+      /* The distance to the texel center is affine, so the largest one is
+       * at a corner of the box.
+       */
+      for (j = 0; j < 4; j++) {
+         const int x = j & 1 ? box->x1 : box->x0;
+         const int y = j & 2 ? box->y1 : box->y0;
+         const double err = a + dx * x + dy * y -
+                            (step[i] * (i == 0 ? x : y) + offset[i] + 0.5);
+
+         if (linear ? err != 0.0 : fabs(err) > 0.375)
+            return FALSE;
+      }
+   }
+
+   return TRUE;
+}
+
+
+/**
+ * Check whether the whole tiles of a primitive drawn with a blit shader
+ * may copy texels rather than run it, see lp_rast_blit_tile().
+ *
+ * \param box  pixels of the primitive the tiles may cover, inclusive
+ * \return what to bin for the tiles, or NULL to shade them
+ */
+static const struct lp_rast_blit *
+lp_setup_blit(struct lp_setup_context *setup,
+              const struct lp_rast_shader_inputs *inputs,
+              const struct u_rect *box)
+{
+   const struct lp_fragment_shader_variant *variant =
+      setup->fs.current.variant;
+   struct lp_rast_blit *blit;
+   int offset[2], step[2];
+
+   if (!variant || !variant->blit ||
+       !lp_setup_texel_mapping(setup, inputs, box, offset, step))
+      return NULL;
+
+   blit = lp_scene_alloc(setup->scene, sizeof *blit);
+   if (!blit)
+      return NULL;
+
+   blit->inputs = inputs;
+   blit->dx = offset[0];
+   blit->dy = offset[1];
+   blit->ystep = step[1];
+   return blit;
+}
+
+
+/**
+ * Check whether the pixels of a primitive within the box may be shaded
+ * in spans, see lp_rast_span(), and set up their colors or texels.
+ * Colors are clamped to [0, 1] per pixel, like the shader's are when
+ * written, but must stay small enough for the fixed point math.
+ *
+ * \param box  pixels of the primitive to shade, inclusive
+ * \return what to bin for the box, or NULL to shade it
+ */
+static const struct lp_rast_span *
+lp_setup_span(struct lp_setup_context *setup,
+              const struct lp_rast_shader_inputs *inputs,
+              const struct u_rect *box)
+{
+   const struct lp_fragment_shader_variant *variant =
+      setup->fs.current.variant;
+   const struct lp_fragment_shader *shader;
+   const float (*a0)[4] = (const float (*)[4])GET_A0(inputs);
+   const float (*dadx)[4] = (const float (*)[4])GET_DADX(inputs);
+   const float (*dady)[4] = (const float (*)[4])GET_DADY(inputs);
+   struct lp_rast_span *span;
+   int offset[2] = { 0, 0 }, step[2] = { 1, 1 };
+   unsigned c, j;
+
+   if (!variant || variant->span.kind == LP_FS_SPAN_NONE)
+      return NULL;
+
+   shader = variant->shader;
+   span = lp_scene_alloc(setup->scene, sizeof *span);
+   if (!span)
+      return NULL;
+
+   switch (variant->span.kind) {
+   case LP_FS_SPAN_INPUT: {
+      const unsigned slot = shader->color_input + 1;
+      double oow = 1.0;
+
+      if (shader->inputs[shader->color_input].interp ==
+          LP_INTERP_PERSPECTIVE) {
+         if (dadx[0][3] != 0.0f || dady[0][3] != 0.0f || a0[0][3] <= 0.0f)
+            return NULL;
+         oow = a0[0][3];
+      }
+
+      for (c = 0; c < 4; c++) {
+         const double scale = 255.0 * 65536.0 / oow;
+         const double a = a0[slot][c] * scale;
+         const double dx = dadx[slot][c] * scale;
+         const double dy = dady[slot][c] * scale;
+
+         for (j = 0; j < 4; j++) {
+            const int x = j & 1 ? box->x1 : box->x0;
+            const int y = j & 2 ? box->y1 : box->y0;
+
+            if (fabs(a + dx * x + dy * y) > (double)(1 << 30))
+               return NULL;
+         }
+
+         span->color[c] = (int32_t)(a + dx * box->x0 + dy * box->y0 + 32768.0);
+         span->dcdx[c] = (int32_t)(dx < 0.0 ? dx - 0.5 : dx + 0.5);
+         span->dcdy[c] = (int32_t)(dy < 0.0 ? dy - 0.5 : dy + 0.5);
+      }
+      break;
+   }
+
+   case LP_FS_SPAN_UNIFORM: {
+      const float *constants = setup->fs.current.jit_context.constants[0];
+      const unsigned dw = shader->color_uniform;
+
+      if (!constants ||
+          dw + 4 > setup->fs.current.jit_context.num_constants[0])
+         return NULL;
+
+      for (c = 0; c < 4; c++) {
+         const float value = constants[dw + c];
+
+         /* NaN as 0 */
+         span->color[c] = value > 0.0f ?
+            (int32_t)(MIN2(value, 1.0f) * 255.0f + 0.5f) << 16 : 0;
+      }
+      break;
+   }
+
+   case LP_FS_SPAN_TEXTURE:
+      if (!lp_setup_texel_mapping(setup, inputs, box, offset, step))
+         return NULL;
+      break;
+
+   default:
+      return NULL;
+   }
+
+   span->inputs = inputs;
+   span->box = *box;
+   span->dx = offset[0];
+   span->dy = offset[1];
+   span->ystep = step[1];
+   return span;
+}
+
+
+/**
+ * The primitive covers the whole tile- shade whole tile, copy the
+ * texels of the blit, or shade it in spans.
  *
  * \param tx, ty  the tile position in tiles, not pixels
  */
 static boolean
 lp_setup_whole_tile(struct lp_setup_context *setup,
                     const struct lp_rast_shader_inputs *inputs,
+                    const struct lp_rast_blit *blit,
+                    const struct lp_rast_span *span,
                     int tx, int ty)
 {
    struct lp_scene *scene = setup->scene;
@@ -236,16 +472,19 @@ lp_setup_whole_tile(struct lp_setup_context *setup,
       /* Several things prevent this optimization from working:
        * - For layered rendering we can't determine if this covers the same layer
        * as previous rendering (or in case of clears those actually always cover
-       * all layers so optimization is impossible). Need to use fb_max_layer and
-       * not setup->layer_slot to determine this since even if there's currently
-       * no slot assigned previous rendering could have used one.
+       * all layers so optimization is impossible), unless the layers have bins
+       * of their own. Need to use fb_max_layer and not setup->layer_slot to
+       * determine this since even if there's currently no slot assigned
+       * previous rendering could have used one.
        * - If there were any Begin/End query commands in the scene then those
        * would get removed which would be very wrong. Furthermore, if queries
        * were just active we also can't do the optimization since to get
        * accurate query results we unfortunately need to execute the rendering
        * commands.
        */
-      if (!scene->fb.zsbuf && scene->fb_max_layer == 0 && !scene->had_queries) {
+      if (!scene->fb.zsbuf &&
+          (scene->fb_max_layer == 0 || scene->num_layer_bins > 1) &&
+          !scene->had_queries) {
          /*
           * All previous rendering will be overwritten so reset the bin.
           */
@@ -253,12 +492,33 @@ lp_setup_whole_tile(struct lp_setup_context *setup,
       }
 
       LP_COUNT(nr_shade_opaque_64);
+      if (blit) {
+         LP_COUNT(nr_blit_64);
+         return lp_scene_bin_cmd_with_state( scene, tx, ty,
+                                             setup->fs.stored,
+                                             LP_RAST_OP_BLIT_TILE,
+                                             lp_rast_arg_blit(blit) );
+      }
+      if (span) {
+         LP_COUNT(nr_span_64);
+         return lp_scene_bin_cmd_with_state( scene, tx, ty,
+                                             setup->fs.stored,
+                                             LP_RAST_OP_SPAN,
+                                             lp_rast_arg_span(span) );
+      }
       return lp_scene_bin_cmd_with_state( scene, tx, ty,
                                           setup->fs.stored,
                                           LP_RAST_OP_SHADE_TILE_OPAQUE,
                                           lp_rast_arg_inputs(inputs) );
    } else {
       LP_COUNT(nr_shade_64);
+      if (span) {
+         LP_COUNT(nr_span_64);
+         return lp_scene_bin_cmd_with_state( scene, tx, ty,
+                                             setup->fs.stored,
+                                             LP_RAST_OP_SPAN,
+                                             lp_rast_arg_span(span) );
+      }
       return lp_scene_bin_cmd_with_state( scene, tx, ty,
                                           setup->fs.stored,
                                           LP_RAST_OP_SHADE_TILE,
@@ -315,7 +575,17 @@ do_triangle_ccw(struct lp_setup_context *setup,
    }
 
    /* Bounding rectangle (in pixels) */
-   {
+   if (setup->conservative) {
+      lp_setup_conservative_range(setup,
+                                  MIN3(position->x[0], position->x[1], position->x[2]),
+                                  MAX3(position->x[0], position->x[1], position->x[2]),
+                                  &bbox.x0, &bbox.x1);
+      lp_setup_conservative_range(setup,
+                                  MIN3(position->y[0], position->y[1], position->y[2]),
+                                  MAX3(position->y[0], position->y[1], position->y[2]),
+                                  &bbox.y0, &bbox.y1);
+   }
+   else {
       /* Yes this is necessary to accurately calculate bounding boxes
        * with the two fill-conventions we support.  GL (normally) ends
        * up needing a bottom-left fill convention, which requires
@@ -399,6 +669,7 @@ do_triangle_ccw(struct lp_setup_context *setup,
    tri->inputs.frontfacing = frontfacing;
    tri->inputs.disable = FALSE;
    tri->inputs.opaque = setup->fs.current.variant->opaque;
+   tri->inputs.conservative_planes = setup->conservative ? 3 : 0;
    tri->inputs.layer = layer;
    tri->inputs.viewport_index = viewport_index;
 
@@ -655,6 +926,9 @@ do_triangle_ccw(struct lp_setup_context *setup,
       }
    }
 
+   if (setup->conservative)
+      lp_setup_conservative_planes(setup, plane, 3);
+
    if (0) {
       debug_printf("p0: %"PRIx64"/%08x/%08x/%08x\n",
                    plane[0].c,
@@ -806,25 +1080,27 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
    u_rect_find_intersection(&setup->draw_regions[viewport_index],
                             &trimmed_box);
 
+   lp_scene_set_bin_layer(scene, tri->inputs.layer);
+
    /* Determine which tile(s) intersect the triangle's bounding box
     */
-   if (dx < TILE_SIZE)
+   if (dx < (int) scene->tile_size)
    {
-      int ix0 = bbox->x0 / TILE_SIZE;
-      int iy0 = bbox->y0 / TILE_SIZE;
-      unsigned px = bbox->x0 & 63 & ~3;
-      unsigned py = bbox->y0 & 63 & ~3;
+      int ix0 = bbox->x0 >> scene->tile_order;
+      int iy0 = bbox->y0 >> scene->tile_order;
+      unsigned px = bbox->x0 & (scene->tile_size - 1) & ~3;
+      unsigned py = bbox->y0 & (scene->tile_size - 1) & ~3;
 
-      assert(iy0 == bbox->y1 / TILE_SIZE &&
-	     ix0 == bbox->x1 / TILE_SIZE);
+      assert(iy0 == bbox->y1 >> scene->tile_order &&
+	     ix0 == bbox->x1 >> scene->tile_order);
 
       if (nr_planes == 3) {
          if (sz < 4)
          {
             /* Triangle is contained in a single 4x4 stamp:
              */
-            assert(px + 4 <= TILE_SIZE);
-            assert(py + 4 <= TILE_SIZE);
+            assert(px + 4 <= scene->tile_size);
+            assert(py + 4 <= scene->tile_size);
             if (setup->multisample)
                cmd = LP_RAST_OP_MS_TRIANGLE_3_4;
             else
@@ -844,11 +1120,11 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
              * dimensions if the triangle is 16 pixels in one dimension but 4
              * in the other. So budge the 16x16 back inside the tile.
              */
-            px = MIN2(px, TILE_SIZE - 16);
-            py = MIN2(py, TILE_SIZE - 16);
+            px = MIN2(px, scene->tile_size - 16);
+            py = MIN2(py, scene->tile_size - 16);
 
-            assert(px + 16 <= TILE_SIZE);
-            assert(py + 16 <= TILE_SIZE);
+            assert(px + 16 <= scene->tile_size);
+            assert(py + 16 <= scene->tile_size);
 
             if (setup->multisample)
                cmd = LP_RAST_OP_MS_TRIANGLE_3_16;
@@ -861,11 +1137,11 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
       }
       else if (nr_planes == 4 && sz < 16) 
       {
-         px = MIN2(px, TILE_SIZE - 16);
-         py = MIN2(py, TILE_SIZE - 16);
+         px = MIN2(px, scene->tile_size - 16);
+         py = MIN2(py, scene->tile_size - 16);
 
-         assert(px + 16 <= TILE_SIZE);
-         assert(py + 16 <= TILE_SIZE);
+         assert(px + 16 <= scene->tile_size);
+         assert(py + 16 <= scene->tile_size);
 
          if (setup->multisample)
             cmd = LP_RAST_OP_MS_TRIANGLE_4_16;
@@ -890,6 +1166,8 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
    else
    {
       struct lp_rast_plane *plane = GET_PLANES(tri);
+      const struct lp_rast_blit *blit;
+      const struct lp_rast_span *span;
       int64_t c[MAX_PLANES];
       int64_t ei[MAX_PLANES];
 
@@ -898,23 +1176,26 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
       int64_t ystep[MAX_PLANES];
       int x, y;
 
-      int ix0 = trimmed_box.x0 / TILE_SIZE;
-      int iy0 = trimmed_box.y0 / TILE_SIZE;
-      int ix1 = trimmed_box.x1 / TILE_SIZE;
-      int iy1 = trimmed_box.y1 / TILE_SIZE;
+      int ix0 = trimmed_box.x0 >> scene->tile_order;
+      int iy0 = trimmed_box.y0 >> scene->tile_order;
+      int ix1 = trimmed_box.x1 >> scene->tile_order;
+      int iy1 = trimmed_box.y1 >> scene->tile_order;
+
+      blit = lp_setup_blit(setup, &tri->inputs, &trimmed_box);
+      span = blit ? NULL : lp_setup_span(setup, &tri->inputs, &trimmed_box);
       
       for (i = 0; i < nr_planes; i++) {
          c[i] = (plane[i].c + 
-                 IMUL64(plane[i].dcdy, iy0) * TILE_SIZE -
-                 IMUL64(plane[i].dcdx, ix0) * TILE_SIZE);
+                 IMUL64(plane[i].dcdy, iy0) * scene->tile_size -
+                 IMUL64(plane[i].dcdx, ix0) * scene->tile_size);
 
          ei[i] = (plane[i].dcdy - 
                   plane[i].dcdx - 
-                  (int64_t)plane[i].eo) << TILE_ORDER;
+                  (int64_t)plane[i].eo) << scene->tile_order;
 
-         eo[i] = (int64_t)plane[i].eo << TILE_ORDER;
-         xstep[i] = -(((int64_t)plane[i].dcdx) << TILE_ORDER);
-         ystep[i] = ((int64_t)plane[i].dcdy) << TILE_ORDER;
+         eo[i] = (int64_t)plane[i].eo << scene->tile_order;
+         xstep[i] = -(((int64_t)plane[i].dcdx) << scene->tile_order);
+         ystep[i] = ((int64_t)plane[i].dcdy) << scene->tile_order;
       }
 
 
@@ -972,7 +1253,7 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
                /* triangle covers the whole tile- shade whole tile */
                LP_COUNT(nr_fully_covered_64);
                in = TRUE;
-               if (!lp_setup_whole_tile(setup, &tri->inputs, x, y))
+               if (!lp_setup_whole_tile(setup, &tri->inputs, blit, span, x, y))
                   goto fail;
             }
 
@@ -999,6 +1280,100 @@ fail:
 }
 
 
+/**
+ * Alloc space for a new rectangle plus the input.a0/dadx/dady arrays
+ * immediately after it, from the per-scene pool.
+ * \param num_inputs  number of fragment shader inputs
+ * \return pointer to rectangle space
+ */
+struct lp_rast_rectangle *
+lp_setup_alloc_rectangle(struct lp_scene *scene,
+                         unsigned nr_inputs)
+{
+   unsigned input_array_sz = NUM_CHANNELS * (nr_inputs + 1) * sizeof(float);
+   struct lp_rast_rectangle *rect;
+
+   STATIC_ASSERT(sizeof(struct lp_rast_rectangle) % 16 == 0);
+
+   rect = lp_scene_alloc_aligned(scene,
+                                 sizeof(struct lp_rast_rectangle) +
+                                 3 * input_array_sz,
+                                 16);
+   if (!rect)
+      return NULL;
+
+   rect->inputs.stride = input_array_sz;
+   rect->inputs.conservative_planes = 0;
+
+   return rect;
+}
+
+
+/**
+ * Bin a screen-aligned rectangle, already intersected with the draw
+ * region, into each tile its box touches.  Tiles it covers entirely
+ * are shaded like any fully covered tile; the others get a rectangle
+ * command which needs no edge planes.
+ */
+boolean
+lp_setup_bin_rectangle(struct lp_setup_context *setup,
+                       struct lp_rast_rectangle *rect)
+{
+   struct lp_scene *scene = setup->scene;
+   const struct u_rect *box = &rect->box;
+   const int ix0 = box->x0 >> scene->tile_order;
+   const int iy0 = box->y0 >> scene->tile_order;
+   const int ix1 = box->x1 >> scene->tile_order;
+   const int iy1 = box->y1 >> scene->tile_order;
+   const struct lp_rast_blit *blit;
+   const struct lp_rast_span *span;
+   int x, y;
+
+   LP_COUNT(nr_rectangles);
+
+   blit = lp_setup_blit(setup, &rect->inputs, box);
+   span = blit ? NULL : lp_setup_span(setup, &rect->inputs, box);
+
+   lp_scene_set_bin_layer(scene, rect->inputs.layer);
+
+   for (y = iy0; y <= iy1; y++) {
+      for (x = ix0; x <= ix1; x++) {
+         const int tx0 = x << scene->tile_order;
+         const int ty0 = y << scene->tile_order;
+         boolean ok;
+
+         if (box->x0 <= tx0 && box->x1 >= tx0 + (int)scene->tile_size - 1 &&
+             box->y0 <= ty0 && box->y1 >= ty0 + (int)scene->tile_size - 1) {
+            ok = lp_setup_whole_tile(setup, &rect->inputs, blit, span, x, y);
+         }
+         else if (span) {
+            LP_COUNT(nr_partially_covered_64);
+            LP_COUNT(nr_span_64);
+            ok = lp_scene_bin_cmd_with_state(scene, x, y,
+                                             setup->fs.stored,
+                                             LP_RAST_OP_SPAN,
+                                             lp_rast_arg_span(span));
+         }
+         else {
+            LP_COUNT(nr_partially_covered_64);
+            ok = lp_scene_bin_cmd_with_state(scene, x, y,
+                                             setup->fs.stored,
+                                             LP_RAST_OP_RECTANGLE,
+                                             lp_rast_arg_rectangle(rect));
+         }
+
+         if (!ok) {
+            /* As for triangles, disable whatever was already binned. */
+            rect->inputs.disable = TRUE;
+            return FALSE;
+         }
+      }
+   }
+
+   return TRUE;
+}
+
+
 /**
  * Try to draw the triangle, restart the scene on failure.
  */
@@ -1011,6 +1386,12 @@ static void retry_triangle_ccw( struct lp_setup_context *setup,
 {
    if (!do_triangle_ccw( setup, position, v0, v1, v2, front ))
    {
+      /* Bin threads can't flush, the triangle is binned again later. */
+      if (setup->bin_thread) {
+         setup->bin_thread->failed = TRUE;
+         return;
+      }
+
       if (!lp_setup_flush_and_restart(setup))
          return;
 
@@ -1019,6 +1400,20 @@ static void retry_triangle_ccw( struct lp_setup_context *setup,
    }
 }
 
+/**
+ * What to subtract from the vertex positions for the planes.  Multisampled
+ * planes are evaluated at the pixel corners, from which the rasterizer
+ * offsets them to the sample positions, unless conservative: all samples
+ * of a pixel are then covered alike, and its center is tested.
+ */
+static inline float
+setup_pixel_offset(const struct lp_setup_context *setup)
+{
+   if (!setup->multisample)
+      return setup->pixel_offset;
+   return setup->conservative ? 0.5f : 0.0f;
+}
+
 /**
  * Calculate fixed position data for a triangle
  * It is unfortunate we need to do that here (as we need area
@@ -1032,7 +1427,7 @@ calc_fixed_position(struct lp_setup_context *setup,
                     const float (*v1)[4],
                     const float (*v2)[4])
 {
-   float pixel_offset = setup->multisample ? 0.0 : setup->pixel_offset;
+   float pixel_offset = setup_pixel_offset(setup);
    /*
     * The rounding may not be quite the same with PIPE_ARCH_SSE
     * (util_iround right now only does nearest/even on x87,
@@ -1239,6 +1634,402 @@ static void triangle_noop(struct lp_setup_context *setup,
 }
 
 
+/*
+ * Batched setup of the triangles queued for LP_BIN_THREADS: the fixed
+ * point positions and bounding boxes of several triangles are computed
+ * at once, and those outside the draw region are rejected before they
+ * get to do_triangle_ccw().  The triangles left are set up one by one,
+ * exactly as triangle_cw/ccw/both() would.
+ */
+
+#define LP_SETUP_MAX_LANES 8
+
+struct lp_setup_lane_params {
+   float pixel_offset;
+   int adj;
+   struct u_rect region;
+};
+
+/**
+ * Compute the fixed point positions of triangles [0, n) of verts into
+ * x/y, and return the mask of those whose bounding box misses
+ * params->region.  Lanes past n repeat the last triangle.
+ */
+typedef unsigned (*lp_setup_lanes_func)(const struct lp_setup_lane_params *params,
+                                        const uint8_t *verts,
+                                        unsigned vertex_size,
+                                        unsigned n,
+                                        int32_t x[3][LP_SETUP_MAX_LANES],
+                                        int32_t y[3][LP_SETUP_MAX_LANES]);
+
+static inline const float *
+lane_vertex(const uint8_t *verts, unsigned vertex_size,
+            unsigned n, unsigned lane, unsigned k)
+{
+   return (const float *)(verts + (3 * MIN2(lane, n - 1) + k) * vertex_size);
+}
+
+#if defined(PIPE_ARCH_SSE)
+
+static inline __m128i
+lanes_min_epi32(__m128i a, __m128i b)
+{
+   __m128i gt = _mm_cmpgt_epi32(a, b);
+   return _mm_or_si128(_mm_and_si128(gt, b), _mm_andnot_si128(gt, a));
+}
+
+static inline __m128i
+lanes_max_epi32(__m128i a, __m128i b)
+{
+   __m128i gt = _mm_cmpgt_epi32(a, b);
+   return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+}
+
+/* As calc_fixed_position(), for 4 triangles. */
+static unsigned
+setup_lanes_sse2(const struct lp_setup_lane_params *params,
+                 const uint8_t *verts, unsigned vertex_size, unsigned n,
+                 int32_t x[3][LP_SETUP_MAX_LANES],
+                 int32_t y[3][LP_SETUP_MAX_LANES])
+{
+   const __m128 pix_offset = _mm_set1_ps(params->pixel_offset);
+   const __m128 fixed_one = _mm_set1_ps((float)FIXED_ONE);
+   const __m128i one = _mm_set1_epi32(1);
+   const __m128i adj = _mm_set1_epi32(params->adj);
+   __m128i xi[3], yi[3];
+   __m128i minx, maxx, miny, maxy, bx0, bx1, by0, by1, reject;
+   unsigned k, l;
+
+   for (k = 0; k < 3; k++) {
+      float fx[4], fy[4];
+      for (l = 0; l < 4; l++) {
+         const float *v = lane_vertex(verts, vertex_size, n, l, k);
+         fx[l] = v[0];
+         fy[l] = v[1];
+      }
+      xi[k] = _mm_cvtps_epi32(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(fx),
+                                                    pix_offset), fixed_one));
+      yi[k] = _mm_cvtps_epi32(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(fy),
+                                                    pix_offset), fixed_one));
+      _mm_storeu_si128((__m128i *)x[k], xi[k]);
+      _mm_storeu_si128((__m128i *)y[k], yi[k]);
+   }
+
+   minx = lanes_min_epi32(lanes_min_epi32(xi[0], xi[1]), xi[2]);
+   maxx = lanes_max_epi32(lanes_max_epi32(xi[0], xi[1]), xi[2]);
+   miny = lanes_min_epi32(lanes_min_epi32(yi[0], yi[1]), yi[2]);
+   maxy = lanes_max_epi32(lanes_max_epi32(yi[0], yi[1]), yi[2]);
+
+   bx0 = _mm_srai_epi32(minx, FIXED_ORDER);
+   bx1 = _mm_srai_epi32(_mm_sub_epi32(maxx, one), FIXED_ORDER);
+   by0 = _mm_srai_epi32(_mm_add_epi32(miny, adj), FIXED_ORDER);
+   by1 = _mm_srai_epi32(_mm_sub_epi32(_mm_add_epi32(maxy, adj), one),
+                        FIXED_ORDER);
+
+   reject = _mm_or_si128(_mm_cmpgt_epi32(bx0, bx1),
+                         _mm_cmpgt_epi32(by0, by1));
+   reject = _mm_or_si128(reject,
+                         _mm_cmpgt_epi32(_mm_set1_epi32(params->region.x0), bx1));
+   reject = _mm_or_si128(reject,
+                         _mm_cmpgt_epi32(bx0, _mm_set1_epi32(params->region.x1)));
+   reject = _mm_or_si128(reject,
+                         _mm_cmpgt_epi32(_mm_set1_epi32(params->region.y0), by1));
+   reject = _mm_or_si128(reject,
+                         _mm_cmpgt_epi32(by0, _mm_set1_epi32(params->region.y1)));
+
+   return _mm_movemask_ps(_mm_castsi128_ps(reject)) & ((1 << n) - 1);
+}
+
+#if defined(LP_SETUP_HAVE_AVX2)
+
+/* As setup_lanes_sse2(), for 8 triangles, picked when util_cpu_caps has
+ * AVX2.
+ */
+__attribute__((target("avx2")))
+static unsigned
+setup_lanes_avx2(const struct lp_setup_lane_params *params,
+                 const uint8_t *verts, unsigned vertex_size, unsigned n,
+                 int32_t x[3][LP_SETUP_MAX_LANES],
+                 int32_t y[3][LP_SETUP_MAX_LANES])
+{
+   const __m256 pix_offset = _mm256_set1_ps(params->pixel_offset);
+   const __m256 fixed_one = _mm256_set1_ps((float)FIXED_ONE);
+   const __m256i one = _mm256_set1_epi32(1);
+   const __m256i adj = _mm256_set1_epi32(params->adj);
+   const int stride = vertex_size / sizeof(float);
+   __m256i lane, xi[3], yi[3];
+   __m256i minx, maxx, miny, maxy, bx0, bx1, by0, by1, reject;
+   unsigned k;
+
+   /* Float index of each lane's first vertex */
+   lane = _mm256_min_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                           _mm256_set1_epi32(n - 1));
+   lane = _mm256_mullo_epi32(lane, _mm256_set1_epi32(3 * stride));
+
+   for (k = 0; k < 3; k++) {
+      const float *base = (const float *)(verts + k * vertex_size);
+      __m256 fx = _mm256_i32gather_ps(base, lane, 4);
+      __m256 fy = _mm256_i32gather_ps(base + 1, lane, 4);
+      xi[k] = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_sub_ps(fx, pix_offset),
+                                               fixed_one));
+      yi[k] = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_sub_ps(fy, pix_offset),
+                                               fixed_one));
+      _mm256_storeu_si256((__m256i *)x[k], xi[k]);
+      _mm256_storeu_si256((__m256i *)y[k], yi[k]);
+   }
+
+   minx = _mm256_min_epi32(_mm256_min_epi32(xi[0], xi[1]), xi[2]);
+   maxx = _mm256_max_epi32(_mm256_max_epi32(xi[0], xi[1]), xi[2]);
+   miny = _mm256_min_epi32(_mm256_min_epi32(yi[0], yi[1]), yi[2]);
+   maxy = _mm256_max_epi32(_mm256_max_epi32(yi[0], yi[1]), yi[2]);
+
+   bx0 = _mm256_srai_epi32(minx, FIXED_ORDER);
+   bx1 = _mm256_srai_epi32(_mm256_sub_epi32(maxx, one), FIXED_ORDER);
+   by0 = _mm256_srai_epi32(_mm256_add_epi32(miny, adj), FIXED_ORDER);
+   by1 = _mm256_srai_epi32(_mm256_sub_epi32(_mm256_add_epi32(maxy, adj), one),
+                           FIXED_ORDER);
+
+   reject = _mm256_or_si256(_mm256_cmpgt_epi32(bx0, bx1),
+                            _mm256_cmpgt_epi32(by0, by1));
+   reject = _mm256_or_si256(reject,
+                            _mm256_cmpgt_epi32(_mm256_set1_epi32(params->region.x0), bx1));
+   reject = _mm256_or_si256(reject,
+                            _mm256_cmpgt_epi32(bx0, _mm256_set1_epi32(params->region.x1)));
+   reject = _mm256_or_si256(reject,
+                            _mm256_cmpgt_epi32(_mm256_set1_epi32(params->region.y0), by1));
+   reject = _mm256_or_si256(reject,
+                            _mm256_cmpgt_epi32(by0, _mm256_set1_epi32(params->region.y1)));
+
+   return _mm256_movemask_ps(_mm256_castsi256_ps(reject)) & ((1 << n) - 1);
+}
+
+#endif /* LP_SETUP_HAVE_AVX2 */
+
+#elif defined(PIPE_ARCH_AARCH64)
+
+/* As calc_fixed_position(), for 4 triangles.  Rounds like util_iround(). */
+static unsigned
+setup_lanes_neon(const struct lp_setup_lane_params *params,
+                 const uint8_t *verts, unsigned vertex_size, unsigned n,
+                 int32_t x[3][LP_SETUP_MAX_LANES],
+                 int32_t y[3][LP_SETUP_MAX_LANES])
+{
+   const float32x4_t pix_offset = vdupq_n_f32(params->pixel_offset);
+   const float32x4_t fixed_one = vdupq_n_f32((float)FIXED_ONE);
+   const float32x4_t zero = vdupq_n_f32(0.0f);
+   const float32x4_t half = vdupq_n_f32(0.5f);
+   const float32x4_t neg_half = vdupq_n_f32(-0.5f);
+   const int32x4_t one = vdupq_n_s32(1);
+   const int32x4_t adj = vdupq_n_s32(params->adj);
+   int32x4_t xi[3], yi[3];
+   int32x4_t minx, maxx, miny, maxy, bx0, bx1, by0, by1;
+   uint32x4_t reject;
+   uint32_t mask[4];
+   unsigned k, l, bits = 0;
+
+   for (k = 0; k < 3; k++) {
+      float fx[4], fy[4];
+      float32x4_t tx, ty;
+      for (l = 0; l < 4; l++) {
+         const float *v = lane_vertex(verts, vertex_size, n, l, k);
+         fx[l] = v[0];
+         fy[l] = v[1];
+      }
+      tx = vmulq_f32(fixed_one, vsubq_f32(vld1q_f32(fx), pix_offset));
+      ty = vmulq_f32(fixed_one, vsubq_f32(vld1q_f32(fy), pix_offset));
+      tx = vaddq_f32(tx, vbslq_f32(vcgeq_f32(tx, zero), half, neg_half));
+      ty = vaddq_f32(ty, vbslq_f32(vcgeq_f32(ty, zero), half, neg_half));
+      xi[k] = vcvtq_s32_f32(tx);
+      yi[k] = vcvtq_s32_f32(ty);
+      vst1q_s32(x[k], xi[k]);
+      vst1q_s32(y[k], yi[k]);
+   }
+
+   minx = vminq_s32(vminq_s32(xi[0], xi[1]), xi[2]);
+   maxx = vmaxq_s32(vmaxq_s32(xi[0], xi[1]), xi[2]);
+   miny = vminq_s32(vminq_s32(yi[0], yi[1]), yi[2]);
+   maxy = vmaxq_s32(vmaxq_s32(yi[0], yi[1]), yi[2]);
+
+   bx0 = vshrq_n_s32(minx, FIXED_ORDER);
+   bx1 = vshrq_n_s32(vsubq_s32(maxx, one), FIXED_ORDER);
+   by0 = vshrq_n_s32(vaddq_s32(miny, adj), FIXED_ORDER);
+   by1 = vshrq_n_s32(vsubq_s32(vaddq_s32(maxy, adj), one), FIXED_ORDER);
+
+   reject = vorrq_u32(vcgtq_s32(bx0, bx1), vcgtq_s32(by0, by1));
+   reject = vorrq_u32(reject, vcgtq_s32(vdupq_n_s32(params->region.x0), bx1));
+   reject = vorrq_u32(reject, vcgtq_s32(bx0, vdupq_n_s32(params->region.x1)));
+   reject = vorrq_u32(reject, vcgtq_s32(vdupq_n_s32(params->region.y0), by1));
+   reject = vorrq_u32(reject, vcgtq_s32(by0, vdupq_n_s32(params->region.y1)));
+
+   vst1q_u32(mask, reject);
+   for (l = 0; l < n; l++)
+      bits |= (mask[l] & 1) << l;
+   return bits;
+}
+
+#else
+
+static unsigned
+setup_lanes_scalar(const struct lp_setup_lane_params *params,
+                   const uint8_t *verts, unsigned vertex_size, unsigned n,
+                   int32_t x[3][LP_SETUP_MAX_LANES],
+                   int32_t y[3][LP_SETUP_MAX_LANES])
+{
+   unsigned k, l, bits = 0;
+
+   for (l = 0; l < n; l++) {
+      struct u_rect bbox;
+
+      for (k = 0; k < 3; k++) {
+         const float *v = lane_vertex(verts, vertex_size, n, l, k);
+         x[k][l] = subpixel_snap(v[0] - params->pixel_offset);
+         y[k][l] = subpixel_snap(v[1] - params->pixel_offset);
+      }
+
+      bbox.x0 = MIN3(x[0][l], x[1][l], x[2][l]) >> FIXED_ORDER;
+      bbox.x1 = (MAX3(x[0][l], x[1][l], x[2][l]) - 1) >> FIXED_ORDER;
+      bbox.y0 = (MIN3(y[0][l], y[1][l], y[2][l]) + params->adj) >> FIXED_ORDER;
+      bbox.y1 = (MAX3(y[0][l], y[1][l], y[2][l]) - 1 + params->adj) >> FIXED_ORDER;
+
+      if (!u_rect_test_intersection(&params->region, &bbox))
+         bits |= 1 << l;
+   }
+
+   return bits;
+}
+
+#endif
+
+
+/**
+ * Set up and bin count triangles, given as 3 consecutive vertices each
+ * of vertex_size bytes.  Returns the number of triangles done, which is
+ * less than count only if a bin thread ran out of scene memory.
+ */
+unsigned
+lp_setup_triangles(struct lp_setup_context *setup,
+                   const uint8_t *verts,
+                   unsigned vertex_size,
+                   unsigned count)
+{
+   struct llvmpipe_context *lp_context = (struct llvmpipe_context *)setup->pipe;
+   const boolean ccw = setup->triangle == triangle_ccw ||
+                       setup->triangle == triangle_both;
+   const boolean cw = setup->triangle == triangle_cw ||
+                      setup->triangle == triangle_both;
+   struct lp_setup_lane_params params;
+   lp_setup_lanes_func setup_lanes;
+   unsigned lanes, t, l, k;
+
+   if (!ccw && !cw)
+      return count;
+
+   if (lp_context->active_statistics_queries)
+      lp_context->pipeline_statistics.c_primitives += count;
+
+#if defined(PIPE_ARCH_SSE)
+   setup_lanes = setup_lanes_sse2;
+   lanes = 4;
+#if defined(LP_SETUP_HAVE_AVX2)
+   if (util_cpu_caps.has_avx2) {
+      setup_lanes = setup_lanes_avx2;
+      lanes = 8;
+   }
+#endif
+#elif defined(PIPE_ARCH_AARCH64)
+   setup_lanes = setup_lanes_neon;
+   lanes = 4;
+#else
+   setup_lanes = setup_lanes_scalar;
+   lanes = LP_SETUP_MAX_LANES;
+#endif
+
+   params.pixel_offset = setup_pixel_offset(setup);
+   params.adj = (setup->bottom_edge_rule != 0) ? 1 : 0;
+   if (setup->viewport_index_slot > 0 || setup->conservative) {
+      /* Rejected later, once the viewport of each triangle is known, or
+       * its bounding box grown to the pixels it touches.
+       */
+      params.region.x0 = INT_MIN;
+      params.region.x1 = INT_MAX;
+      params.region.y0 = INT_MIN;
+      params.region.y1 = INT_MAX;
+   }
+   else if (setup->draw_regions[0].x1 < setup->draw_regions[0].x0 ||
+            setup->draw_regions[0].y1 < setup->draw_regions[0].y0) {
+      /* Nothing can intersect an empty region. */
+      params.region.x0 = INT_MAX;
+      params.region.x1 = INT_MIN;
+      params.region.y0 = INT_MAX;
+      params.region.y1 = INT_MIN;
+   }
+   else {
+      params.region = setup->draw_regions[0];
+   }
+
+   for (t = 0; t < count; t += lanes) {
+      const uint8_t *group = verts + t * 3 * vertex_size;
+      const unsigned n = MIN2(lanes, count - t);
+      int32_t x[3][LP_SETUP_MAX_LANES], y[3][LP_SETUP_MAX_LANES];
+      unsigned reject = setup_lanes(&params, group, vertex_size, n, x, y);
+
+      for (l = 0; l < n; l++) {
+         const uint8_t *tri = group + l * 3 * vertex_size;
+         const float (*v0)[4] = (const float (*)[4]) tri;
+         const float (*v1)[4] = (const float (*)[4]) (tri + vertex_size);
+         const float (*v2)[4] = (const float (*)[4]) (tri + 2 * vertex_size);
+         PIPE_ALIGN_VAR(16) struct fixed_position position;
+
+         for (k = 0; k < 3; k++) {
+            position.x[k] = x[k][l];
+            position.y[k] = y[k][l];
+         }
+#if defined(PIPE_ARCH_SSE)
+         position.x[3] = position.x[0];
+         position.y[3] = position.y[0];
+#else
+         position.x[3] = 0;
+         position.y[3] = 0;
+#endif
+         position.dx01 = position.x[0] - position.x[1];
+         position.dy01 = position.y[0] - position.y[1];
+         position.dx20 = position.x[2] - position.x[0];
+         position.dy20 = position.y[2] - position.y[0];
+         position.area = IMUL64(position.dx01, position.dy20) -
+                         IMUL64(position.dx20, position.dy01);
+
+         if (!(position.area > 0 && ccw) && !(position.area < 0 && cw))
+            continue;
+
+         if (reject & (1 << l)) {
+            LP_COUNT(nr_culled_tris);
+            continue;
+         }
+
+         if (position.area > 0) {
+            retry_triangle_ccw(setup, &position, v0, v1, v2,
+                               setup->ccw_is_frontface);
+         }
+         else if (setup->flatshade_first) {
+            rotate_fixed_position_12(&position);
+            retry_triangle_ccw(setup, &position, v0, v2, v1,
+                               !setup->ccw_is_frontface);
+         }
+         else {
+            rotate_fixed_position_01(&position);
+            retry_triangle_ccw(setup, &position, v1, v0, v2,
+                               !setup->ccw_is_frontface);
+         }
+
+         if (setup->bin_thread && setup->bin_thread->failed)
+            return t + l;
+      }
+   }
+
+   return count;
+}
+
+
 void 
 lp_setup_choose_triangle(struct lp_setup_context *setup)
 {
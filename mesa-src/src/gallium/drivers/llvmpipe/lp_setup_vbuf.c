@@ -41,6 +41,7 @@
 #include "draw/draw_vbuf.h"
 #include "draw/draw_vertex.h"
 #include "util/u_memory.h"
+#include "util/u_prim.h"
 
 
 #define LP_MAX_VBUF_INDEXES 1024
@@ -86,10 +87,29 @@ lp_setup_allocate_vertices(struct vbuf_render *vbr,
 
    setup->vertex_size = vertex_size;
    setup->nr_vertices = nr_vertices;
+   setup->vertices = setup->vertex_buffer;
    
    return setup->vertex_buffer != NULL;
 }
 
+
+/**
+ * Set up straight from the draw module's vertices.  The setup variants
+ * load the attributes unaligned, so they don't need to be copied.
+ */
+static boolean
+lp_setup_set_vertices(struct vbuf_render *vbr, const void *vertices,
+                      ushort stride, ushort nr_vertices)
+{
+   struct lp_setup_context *setup = lp_setup_context(vbr);
+
+   setup->vertices = vertices;
+   setup->vertex_size = stride;
+   setup->nr_vertices = nr_vertices;
+
+   return TRUE;
+}
+
 static void
 lp_setup_release_vertices(struct vbuf_render *vbr)
 {
@@ -129,6 +149,84 @@ static inline const_float4_ptr get_vert( const void *vertex_buffer,
    return (const_float4_ptr)((char *)vertex_buffer + index * stride);
 }
 
+typedef void (*lp_setup_triangle_func)(struct lp_setup_context *,
+                                       const float (*v0)[4],
+                                       const float (*v1)[4],
+                                       const float (*v2)[4]);
+
+
+/**
+ * Queue a triangle, with copies of its vertices, for
+ * lp_setup_flush_triangles().
+ */
+static void
+lp_setup_batch_triangle(struct lp_setup_context *setup,
+                        const float (*v0)[4],
+                        const float (*v1)[4],
+                        const float (*v2)[4])
+{
+   const unsigned size = setup->tri_batch.vertex_size;
+   uint8_t *dst;
+
+   if (setup->tri_batch.count == setup->tri_batch.max) {
+      unsigned max = MAX2(setup->tri_batch.max * 2, 1024);
+      uint8_t *verts = NULL;
+
+      if (setup->tri_batch.max < LP_BIN_BATCH_MAX_TRIANGLES)
+         verts = align_realloc(setup->tri_batch.verts,
+                               setup->tri_batch.max * 3 * size,
+                               max * 3 * size, 16);
+
+      if (!verts) {
+         lp_setup_flush_triangles(setup);
+         if (!setup->tri_batch.max) {
+            setup->triangle(setup, v0, v1, v2);
+            return;
+         }
+      }
+      else {
+         setup->tri_batch.verts = verts;
+         setup->tri_batch.max = max;
+      }
+   }
+
+   dst = setup->tri_batch.verts + setup->tri_batch.count * 3 * size;
+   memcpy(dst, v0, size);
+   memcpy(dst + size, v1, size);
+   memcpy(dst + 2 * size, v2, size);
+   setup->tri_batch.count++;
+}
+
+
+/**
+ * Pick how the draw's primitives are binned: triangles are batched when
+ * there are bin threads, anything else first bins the batched ones.
+ */
+static lp_setup_triangle_func
+lp_setup_begin_prims(struct lp_setup_context *setup)
+{
+   const struct llvmpipe_context *lp =
+      (const struct llvmpipe_context *)setup->pipe;
+   /* the draw module's vertices may have more than setup reads */
+   const unsigned stride = setup->vertex_info->size * sizeof(float);
+
+   if (setup->num_bin_threads > 1 &&
+       !lp->active_statistics_queries &&
+       u_reduced_prim(setup->prim) == PIPE_PRIM_TRIANGLES) {
+      if (setup->tri_batch.vertex_size != stride) {
+         lp_setup_flush_triangles(setup);
+         align_free(setup->tri_batch.verts);
+         setup->tri_batch.verts = NULL;
+         setup->tri_batch.max = 0;
+         setup->tri_batch.vertex_size = stride;
+      }
+      return lp_setup_batch_triangle;
+   }
+
+   lp_setup_flush_triangles(setup);
+   return setup->triangle;
+}
+
 /**
  * draw elements / indexed primitives
  */
@@ -136,9 +234,10 @@ static void
 lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
 {
    struct lp_setup_context *setup = lp_setup_context(vbr);
-   const unsigned stride = setup->vertex_info->size * sizeof(float);
-   const void *vertex_buffer = setup->vertex_buffer;
+   const unsigned stride = setup->vertex_size;
+   const void *vertex_buffer = setup->vertices;
    const boolean flatshade_first = setup->flatshade_first;
+   lp_setup_triangle_func triangle;
    unsigned i;
 
    assert(setup->setup.variant);
@@ -146,6 +245,8 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
    if (!lp_setup_update_state(setup, TRUE))
       return;
 
+   triangle = lp_setup_begin_prims(setup);
+
    switch (setup->prim) {
    case PIPE_PRIM_POINTS:
       for (i = 0; i < nr; i++) {
@@ -185,7 +286,7 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
 
    case PIPE_PRIM_TRIANGLES:
       for (i = 2; i < nr; i += 3) {
-         setup->triangle( setup,
+         triangle( setup,
                           get_vert(vertex_buffer, indices[i-2], stride),
                           get_vert(vertex_buffer, indices[i-1], stride),
                           get_vert(vertex_buffer, indices[i-0], stride) );
@@ -196,7 +297,7 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
       if (flatshade_first) {
          for (i = 2; i < nr; i += 1) {
             /* emit first triangle vertex as first triangle vertex */
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, indices[i-2], stride),
                              get_vert(vertex_buffer, indices[i+(i&1)-1], stride),
                              get_vert(vertex_buffer, indices[i-(i&1)], stride) );
@@ -206,7 +307,7 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
       else {
          for (i = 2; i < nr; i += 1) {
             /* emit last triangle vertex as last triangle vertex */
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, indices[i+(i&1)-2], stride),
                              get_vert(vertex_buffer, indices[i-(i&1)-1], stride),
                              get_vert(vertex_buffer, indices[i-0], stride) );
@@ -218,7 +319,7 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
       if (flatshade_first) {
          for (i = 2; i < nr; i += 1) {
             /* emit first non-spoke vertex as first vertex */
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, indices[i-1], stride),
                              get_vert(vertex_buffer, indices[i-0], stride),
                              get_vert(vertex_buffer, indices[0], stride) );
@@ -227,7 +328,7 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
       else {
          for (i = 2; i < nr; i += 1) {
             /* emit last non-spoke vertex as last vertex */
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, indices[0], stride),
                              get_vert(vertex_buffer, indices[i-1], stride),
                              get_vert(vertex_buffer, indices[i-0], stride) );
@@ -240,12 +341,12 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
       if (flatshade_first) { 
          /* emit last quad vertex as first triangle vertex */
          for (i = 3; i < nr; i += 4) {
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, indices[i-0], stride),
                              get_vert(vertex_buffer, indices[i-3], stride),
                              get_vert(vertex_buffer, indices[i-2], stride) );
 
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, indices[i-0], stride),
                              get_vert(vertex_buffer, indices[i-2], stride),
                              get_vert(vertex_buffer, indices[i-1], stride) );
@@ -254,12 +355,12 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
       else {
          /* emit last quad vertex as last triangle vertex */
          for (i = 3; i < nr; i += 4) {
-            setup->triangle( setup,
+            triangle( setup,
                           get_vert(vertex_buffer, indices[i-3], stride),
                           get_vert(vertex_buffer, indices[i-2], stride),
                           get_vert(vertex_buffer, indices[i-0], stride) );
 
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, indices[i-2], stride),
                              get_vert(vertex_buffer, indices[i-1], stride),
                              get_vert(vertex_buffer, indices[i-0], stride) );
@@ -272,11 +373,11 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
       if (flatshade_first) { 
          /* emit last quad vertex as first triangle vertex */
          for (i = 3; i < nr; i += 2) {
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, indices[i-0], stride),
                              get_vert(vertex_buffer, indices[i-3], stride),
                              get_vert(vertex_buffer, indices[i-2], stride) );
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, indices[i-0], stride),
                              get_vert(vertex_buffer, indices[i-1], stride),
                              get_vert(vertex_buffer, indices[i-3], stride) );
@@ -285,11 +386,11 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
       else {
          /* emit last quad vertex as last triangle vertex */
          for (i = 3; i < nr; i += 2) {
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, indices[i-3], stride),
                              get_vert(vertex_buffer, indices[i-2], stride),
                              get_vert(vertex_buffer, indices[i-0], stride) );
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, indices[i-1], stride),
                              get_vert(vertex_buffer, indices[i-3], stride),
                              get_vert(vertex_buffer, indices[i-0], stride) );
@@ -304,7 +405,7 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
       if (flatshade_first) { 
          /* emit first polygon  vertex as first triangle vertex */
          for (i = 2; i < nr; i += 1) {
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, indices[0], stride),
                              get_vert(vertex_buffer, indices[i-1], stride),
                              get_vert(vertex_buffer, indices[i-0], stride) );
@@ -313,7 +414,7 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
       else {
          /* emit first polygon  vertex as last triangle vertex */
          for (i = 2; i < nr; i += 1) {
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, indices[i-1], stride),
                              get_vert(vertex_buffer, indices[i-0], stride),
                              get_vert(vertex_buffer, indices[0], stride) );
@@ -335,15 +436,18 @@ static void
 lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
 {
    struct lp_setup_context *setup = lp_setup_context(vbr);
-   const unsigned stride = setup->vertex_info->size * sizeof(float);
+   const unsigned stride = setup->vertex_size;
    const void *vertex_buffer =
-      (void *) get_vert(setup->vertex_buffer, start, stride);
+      (void *) get_vert(setup->vertices, start, stride);
    const boolean flatshade_first = setup->flatshade_first;
+   lp_setup_triangle_func triangle;
    unsigned i;
 
    if (!lp_setup_update_state(setup, TRUE))
       return;
 
+   triangle = lp_setup_begin_prims(setup);
+
    switch (setup->prim) {
    case PIPE_PRIM_POINTS:
       for (i = 0; i < nr; i++) {
@@ -383,7 +487,7 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
 
    case PIPE_PRIM_TRIANGLES:
       for (i = 2; i < nr; i += 3) {
-         setup->triangle( setup,
+         triangle( setup,
                           get_vert(vertex_buffer, i-2, stride),
                           get_vert(vertex_buffer, i-1, stride),
                           get_vert(vertex_buffer, i-0, stride) );
@@ -394,7 +498,7 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
       if (flatshade_first) {
          for (i = 2; i < nr; i++) {
             /* emit first triangle vertex as first triangle vertex */
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, i-2, stride),
                              get_vert(vertex_buffer, i+(i&1)-1, stride),
                              get_vert(vertex_buffer, i-(i&1), stride) );
@@ -403,7 +507,7 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
       else {
          for (i = 2; i < nr; i++) {
             /* emit last triangle vertex as last triangle vertex */
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, i+(i&1)-2, stride),
                              get_vert(vertex_buffer, i-(i&1)-1, stride),
                              get_vert(vertex_buffer, i-0, stride) );
@@ -415,7 +519,7 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
       if (flatshade_first) {
          for (i = 2; i < nr; i += 1) {
             /* emit first non-spoke vertex as first vertex */
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, i-1, stride),
                              get_vert(vertex_buffer, i-0, stride),
                              get_vert(vertex_buffer, 0, stride)  );
@@ -424,7 +528,7 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
       else {
          for (i = 2; i < nr; i += 1) {
             /* emit last non-spoke vertex as last vertex */
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, 0, stride),
                              get_vert(vertex_buffer, i-1, stride),
                              get_vert(vertex_buffer, i-0, stride) );
@@ -437,11 +541,11 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
       if (flatshade_first) { 
          /* emit last quad vertex as first triangle vertex */
          for (i = 3; i < nr; i += 4) {
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, i-0, stride),
                              get_vert(vertex_buffer, i-3, stride),
                              get_vert(vertex_buffer, i-2, stride) );
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, i-0, stride),
                              get_vert(vertex_buffer, i-2, stride),
                              get_vert(vertex_buffer, i-1, stride) );
@@ -450,11 +554,11 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
       else {
          /* emit last quad vertex as last triangle vertex */
          for (i = 3; i < nr; i += 4) {
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, i-3, stride),
                              get_vert(vertex_buffer, i-2, stride),
                              get_vert(vertex_buffer, i-0, stride) );
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, i-2, stride),
                              get_vert(vertex_buffer, i-1, stride),
                              get_vert(vertex_buffer, i-0, stride) );
@@ -467,11 +571,11 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
       if (flatshade_first) { 
          /* emit last quad vertex as first triangle vertex */
          for (i = 3; i < nr; i += 2) {
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, i-0, stride),
                              get_vert(vertex_buffer, i-3, stride),
                              get_vert(vertex_buffer, i-2, stride) );
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, i-0, stride),
                              get_vert(vertex_buffer, i-1, stride),
                              get_vert(vertex_buffer, i-3, stride) );
@@ -480,11 +584,11 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
       else {
          /* emit last quad vertex as last triangle vertex */
          for (i = 3; i < nr; i += 2) {
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, i-3, stride),
                              get_vert(vertex_buffer, i-2, stride),
                              get_vert(vertex_buffer, i-0, stride) );
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, i-1, stride),
                              get_vert(vertex_buffer, i-3, stride),
                              get_vert(vertex_buffer, i-0, stride) );
@@ -499,7 +603,7 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
       if (flatshade_first) { 
          /* emit first polygon  vertex as first triangle vertex */
          for (i = 2; i < nr; i += 1) {
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, 0, stride),
                              get_vert(vertex_buffer, i-1, stride),
                              get_vert(vertex_buffer, i-0, stride) );
@@ -508,7 +612,7 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
       else {
          /* emit first polygon  vertex as last triangle vertex */
          for (i = 2; i < nr; i += 1) {
-            setup->triangle( setup,
+            triangle( setup,
                              get_vert(vertex_buffer, i-1, stride),
                              get_vert(vertex_buffer, i-0, stride),
                              get_vert(vertex_buffer, 0, stride) );
@@ -523,6 +627,147 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
 
 
 
+/**
+ * Bin triangles [bt->start, bt->end) of the batch, on a bin thread or
+ * the application thread.
+ */
+static void
+lp_setup_bin_triangle_range(void *data, int thread_index)
+{
+   struct lp_setup_bin_thread *bt = (struct lp_setup_bin_thread *) data;
+   struct lp_setup_context *setup = bt->setup;
+   const unsigned size = setup->tri_batch.vertex_size;
+   unsigned done;
+
+   done = lp_setup_triangles(setup,
+                             setup->tri_batch.verts + bt->start * 3 * size,
+                             size, bt->end - bt->start);
+   if (bt->failed)
+      bt->failed_at = bt->start + done;
+}
+
+
+/**
+ * Split the batch into ranges binned at the same time, each into its own
+ * fork of the scene, and join the forks in order so each bin gets its
+ * commands in submission order.  A range which runs out of scene memory
+ * stops there, the ranges after it are thrown away, and the rest of the
+ * batch is binned here, where the scene can be flushed.
+ */
+static boolean
+lp_setup_bin_triangles_threaded(struct lp_setup_context *setup,
+                                unsigned count, unsigned parts)
+{
+   struct lp_scene *scene = setup->scene;
+   const unsigned size = setup->tri_batch.vertex_size;
+   unsigned per_part = DIV_ROUND_UP(count, parts);
+   unsigned max_size = (LP_SCENE_MAX_SIZE - MIN2(scene->scene_size,
+                                                 LP_SCENE_MAX_SIZE)) / parts;
+   unsigned resume = count;
+   boolean failed = FALSE;
+   unsigned i, j;
+
+   for (i = 0; i < parts; i++) {
+      struct lp_setup_bin_thread *bt = &setup->bin_threads[i];
+
+      if (!bt->setup) {
+         bt->setup = MALLOC_STRUCT(lp_setup_context);
+         bt->fork = CALLOC_STRUCT(lp_scene);
+         util_queue_fence_init(&bt->fence);
+      }
+
+      if (!bt->setup || !bt->fork ||
+          !lp_scene_fork(scene, bt->fork, max_size)) {
+         for (j = 0; j <= i; j++) {
+            if (setup->bin_threads[j].fork)
+               lp_scene_join(scene, setup->bin_threads[j].fork, FALSE);
+         }
+         return FALSE;
+      }
+
+      memcpy(bt->setup, setup, sizeof *setup);
+      bt->setup->scene = bt->fork;
+      bt->setup->bin_thread = bt;
+      bt->start = MIN2(i * per_part, count);
+      bt->end = MIN2(bt->start + per_part, count);
+      bt->failed = FALSE;
+   }
+
+   for (i = 1; i < parts; i++) {
+      struct lp_setup_bin_thread *bt = &setup->bin_threads[i];
+      util_queue_add_job(setup->bin_queue, bt, &bt->fence,
+                         lp_setup_bin_triangle_range, NULL, 0);
+   }
+
+   lp_setup_bin_triangle_range(&setup->bin_threads[0], 0);
+
+   for (i = 1; i < parts; i++)
+      util_queue_fence_wait(&setup->bin_threads[i].fence);
+
+   for (i = 0; i < parts; i++) {
+      struct lp_setup_bin_thread *bt = &setup->bin_threads[i];
+
+      lp_scene_join(scene, bt->fork, !failed);
+      if (!failed && bt->failed) {
+         failed = TRUE;
+         resume = bt->failed_at;
+      }
+   }
+
+   if (resume < count)
+      lp_setup_triangles(setup, setup->tri_batch.verts + resume * 3 * size,
+                         size, count - resume);
+
+   return TRUE;
+}
+
+
+/**
+ * Bin the triangles batched by lp_setup_batch_triangle(), on the bin
+ * threads when there are enough of them.
+ */
+void
+lp_setup_flush_triangles(struct lp_setup_context *setup)
+{
+   const unsigned count = setup->tri_batch.count;
+   const unsigned size = setup->tri_batch.vertex_size;
+   unsigned parts;
+
+   if (!count)
+      return;
+
+   setup->tri_batch.count = 0;
+
+   if (!lp_setup_update_state(setup, TRUE))
+      return;
+
+   parts = MIN2(setup->num_bin_threads, count / LP_BIN_THREAD_MIN_TRIANGLES);
+   if (parts > 1 && lp_setup_bin_triangles_threaded(setup, count, parts))
+      return;
+
+   lp_setup_triangles(setup, setup->tri_batch.verts, size, count);
+}
+
+
+void
+lp_setup_destroy_bin_threads(struct lp_setup_context *setup)
+{
+   unsigned i;
+
+   for (i = 0; i < ARRAY_SIZE(setup->bin_threads); i++) {
+      struct lp_setup_bin_thread *bt = &setup->bin_threads[i];
+
+      if (bt->setup) {
+         util_queue_fence_destroy(&bt->fence);
+         FREE(bt->setup);
+      }
+      lp_scene_fork_destroy(bt->fork);
+   }
+
+   align_free(setup->tri_batch.verts);
+}
+
+
 static void
 lp_setup_vbuf_destroy(struct vbuf_render *vbr)
 {
@@ -596,6 +841,7 @@ lp_setup_init_vbuf(struct lp_setup_context *setup)
    setup->base.allocate_vertices = lp_setup_allocate_vertices;
    setup->base.map_vertices = lp_setup_map_vertices;
    setup->base.unmap_vertices = lp_setup_unmap_vertices;
+   setup->base.set_vertices = lp_setup_set_vertices;
    setup->base.set_primitive = lp_setup_set_primitive;
    setup->base.draw_elements = lp_setup_draw_elements;
    setup->base.draw_arrays = lp_setup_draw_arrays;
@@ -61,6 +61,7 @@
 #define LP_NEW_TCS          0x200000
 #define LP_NEW_TES          0x400000
 #define LP_NEW_SAMPLE_MASK  0x800000
+#define LP_NEW_FS_VARIANT   0x1000000  /**< a specialized fs variant may be ready */
 
 #define LP_CSNEW_CS 0x1
 #define LP_CSNEW_CONSTANTS 0x2
@@ -110,9 +111,15 @@ void
 llvmpipe_set_framebuffer_state(struct pipe_context *,
                                const struct pipe_framebuffer_state *);
 
+void
+llvmpipe_check_fs_uniforms(struct llvmpipe_context *lp);
+
 void
 llvmpipe_update_fs(struct llvmpipe_context *lp);
 
+void
+llvmpipe_tier_up_fs(struct llvmpipe_context *lp);
+
 void 
 llvmpipe_update_setup(struct llvmpipe_context *lp);
 
@@ -155,6 +162,14 @@ llvmpipe_init_rasterizer_funcs(struct llvmpipe_context *llvmpipe);
 void
 llvmpipe_init_so_funcs(struct llvmpipe_context *llvmpipe);
 
+void
+llvmpipe_sampler_static_texture_state(struct lp_static_texture_state *state,
+                                      const struct pipe_sampler_view *view);
+
+void
+llvmpipe_decompress_sampler_views(struct llvmpipe_context *llvmpipe,
+                                  enum pipe_shader_type shader);
+
 void
 llvmpipe_prepare_vertex_sampling(struct llvmpipe_context *ctx,
                                  unsigned num,
@@ -39,6 +39,7 @@
 #include "lp_context.h"
 #include "lp_state.h"
 #include "lp_debug.h"
+#include "lp_rast.h"
 
 
 static void *
@@ -186,6 +187,24 @@ llvmpipe_set_sample_mask(struct pipe_context *pipe,
    }
 }
 
+static void
+llvmpipe_get_sample_position(struct pipe_context *pipe,
+                             unsigned sample_count,
+                             unsigned sample_index,
+                             float *out_value)
+{
+   const float *pos = lp_sample_pos(sample_count);
+
+   if (pos && sample_index < sample_count) {
+      out_value[0] = pos[sample_index * 2];
+      out_value[1] = pos[sample_index * 2 + 1];
+   }
+   else {
+      out_value[0] = 0.5f;
+      out_value[1] = 0.5f;
+   }
+}
+
 static void
 llvmpipe_set_min_samples(struct pipe_context *pipe,
                          unsigned min_samples)
@@ -215,6 +234,7 @@ llvmpipe_init_blend_funcs(struct llvmpipe_context *llvmpipe)
    llvmpipe->pipe.set_stencil_ref = llvmpipe_set_stencil_ref;
    llvmpipe->pipe.set_sample_mask = llvmpipe_set_sample_mask;
    llvmpipe->pipe.set_min_samples = llvmpipe_set_min_samples;
+   llvmpipe->pipe.get_sample_position = llvmpipe_get_sample_position;
 
    llvmpipe->dirty |= LP_NEW_SAMPLE_MASK;
    llvmpipe->sample_mask = ~0;
@@ -24,6 +24,7 @@
  **************************************************************************/
 #include "util/u_memory.h"
 #include "util/simple_list.h"
+#include "util/hash_table.h"
 #include "util/os_time.h"
 #include "util/u_dump.h"
 #include "util/u_string.h"
@@ -41,6 +42,7 @@
 #include "lp_debug.h"
 #include "lp_state.h"
 #include "lp_perf.h"
+#include "lp_trace.h"
 #include "lp_screen.h"
 #include "lp_memory.h"
 #include "lp_query.h"
@@ -53,12 +55,28 @@
 /** Fragment shader number (for debugging) */
 static unsigned cs_no = 0;
 
+#define LP_CS_JOB_MAX_RESOURCES (LP_MAX_TGSI_CONST_BUFFERS +            \
+                                 LP_MAX_TGSI_SHADER_BUFFERS +           \
+                                 LP_MAX_TGSI_SHADER_IMAGES +            \
+                                 PIPE_MAX_SHADER_SAMPLER_VIEWS)
+
+/**
+ * A dispatch.  Grids normally run while the context goes on with other
+ * work, so the job has its own copy of the jit context, and of any user
+ * constants, and holds references on the resources the grid uses.
+ */
 struct lp_cs_job_info {
    unsigned grid_size[3];
    unsigned block_size[3];
    unsigned req_local_mem;
    unsigned work_dim;
    struct lp_cs_exec *current;
+
+   struct lp_cs_exec exec;
+   struct lp_cs_tpool_task *task;   /**< NULL once the grid finished */
+   struct pipe_resource *resources[LP_CS_JOB_MAX_RESOURCES];
+   unsigned num_resources;
+   void *user_constants[LP_MAX_TGSI_CONST_BUFFERS];
 };
 
 static void
@@ -175,7 +193,8 @@ generate_compute(struct llvmpipe_context *lp,
    builder = gallivm->builder;
    assert(builder);
    LLVMPositionBuilderAtEnd(builder, block);
-   sampler = lp_llvm_sampler_soa_create(key->samplers, key->nr_samplers);
+   /* Compute threads have no block cache */
+   sampler = lp_llvm_sampler_soa_create(key->samplers, key->nr_samplers, FALSE);
    image = lp_llvm_image_soa_create(lp_cs_variant_key_images(key), key->nr_images);
 
    struct lp_build_loop_state loop_state[4];
@@ -186,11 +205,14 @@ generate_compute(struct llvmpipe_context *lp,
    num_x_loop = LLVMBuildUDiv(gallivm->builder, num_x_loop, vec_length, "");
    LLVMValueRef partials = LLVMBuildURem(gallivm->builder, x_size_arg, vec_length, "");
 
-   LLVMValueRef coro_num_hdls = LLVMBuildMul(gallivm->builder, num_x_loop, y_size_arg, "");
-   coro_num_hdls = LLVMBuildMul(gallivm->builder, coro_num_hdls, z_size_arg, "");
+   LLVMValueRef coro_hdls = NULL;
+   if (shader->has_barrier) {
+      LLVMValueRef coro_num_hdls = LLVMBuildMul(gallivm->builder, num_x_loop, y_size_arg, "");
+      coro_num_hdls = LLVMBuildMul(gallivm->builder, coro_num_hdls, z_size_arg, "");
 
-   LLVMTypeRef hdl_ptr_type = LLVMPointerType(LLVMInt8TypeInContext(gallivm->context), 0);
-   LLVMValueRef coro_hdls = LLVMBuildArrayAlloca(gallivm->builder, hdl_ptr_type, coro_num_hdls, "coro_hdls");
+      LLVMTypeRef hdl_ptr_type = LLVMPointerType(LLVMInt8TypeInContext(gallivm->context), 0);
+      coro_hdls = LLVMBuildArrayAlloca(gallivm->builder, hdl_ptr_type, coro_num_hdls, "coro_hdls");
+   }
 
    unsigned end_coroutine = INT_MAX;
 
@@ -198,10 +220,15 @@ generate_compute(struct llvmpipe_context *lp,
     * This is the main coroutine execution loop. It iterates over the dimensions
     * and calls the coroutine main entrypoint on the first pass, but in subsequent
     * passes it checks if the coroutine has completed and resumes it if not.
+    *
+    * Without barriers a coroutine runs to its final suspend on the first
+    * call, so there is no reentry loop nor handle array then, and each
+    * frame goes back to the pool before the next is made.
     */
    /* take x_width - round up to type.length width */
-   lp_build_loop_begin(&loop_state[3], gallivm,
-                       lp_build_const_int32(gallivm, 0)); /* coroutine reentry loop */
+   if (shader->has_barrier)
+      lp_build_loop_begin(&loop_state[3], gallivm,
+                          lp_build_const_int32(gallivm, 0)); /* coroutine reentry loop */
    lp_build_loop_begin(&loop_state[2], gallivm,
                        lp_build_const_int32(gallivm, 0)); /* z loop */
    lp_build_loop_begin(&loop_state[1], gallivm,
@@ -228,40 +255,45 @@ generate_compute(struct llvmpipe_context *lp,
       args[15] = y_size_arg;
       args[16] = z_size_arg;
 
-      /* idx = (z * (size_x * size_y) + y * size_x + x */
-      LLVMValueRef coro_hdl_idx = LLVMBuildMul(gallivm->builder, loop_state[2].counter,
-                                               LLVMBuildMul(gallivm->builder, num_x_loop, y_size_arg, ""), "");
-      coro_hdl_idx = LLVMBuildAdd(gallivm->builder, coro_hdl_idx,
-                                  LLVMBuildMul(gallivm->builder, loop_state[1].counter,
-                                               num_x_loop, ""), "");
-      coro_hdl_idx = LLVMBuildAdd(gallivm->builder, coro_hdl_idx,
-                                  loop_state[0].counter, "");
-
-      LLVMValueRef coro_entry = LLVMBuildGEP(gallivm->builder, coro_hdls, &coro_hdl_idx, 1, "");
-
-      LLVMValueRef coro_hdl = LLVMBuildLoad(gallivm->builder, coro_entry, "coro_hdl");
-
-      struct lp_build_if_state ifstate;
-      LLVMValueRef cmp = LLVMBuildICmp(gallivm->builder, LLVMIntEQ, loop_state[3].counter,
-                                       lp_build_const_int32(gallivm, 0), "");
-      /* first time here - call the coroutine function entry point */
-      lp_build_if(&ifstate, gallivm, cmp);
-      LLVMValueRef coro_ret = LLVMBuildCall(gallivm->builder, coro, args, 17, "");
-      LLVMBuildStore(gallivm->builder, coro_ret, coro_entry);
-      lp_build_else(&ifstate);
-      /* subsequent calls for this invocation - check if done. */
-      LLVMValueRef coro_done = lp_build_coro_done(gallivm, coro_hdl);
-      struct lp_build_if_state ifstate2;
-      lp_build_if(&ifstate2, gallivm, coro_done);
-      /* if done destroy and force loop exit */
-      lp_build_coro_destroy(gallivm, coro_hdl);
-      lp_build_loop_force_set_counter(&loop_state[3], lp_build_const_int32(gallivm, end_coroutine - 1));
-      lp_build_else(&ifstate2);
-      /* otherwise resume the coroutine */
-      lp_build_coro_resume(gallivm, coro_hdl);
-      lp_build_endif(&ifstate2);
-      lp_build_endif(&ifstate);
-      lp_build_loop_force_reload_counter(&loop_state[3]);
+      if (!shader->has_barrier) {
+         LLVMValueRef coro_hdl = LLVMBuildCall(gallivm->builder, coro, args, 17, "");
+         lp_build_coro_destroy(gallivm, coro_hdl);
+      } else {
+         /* idx = (z * (size_x * size_y) + y * size_x + x */
+         LLVMValueRef coro_hdl_idx = LLVMBuildMul(gallivm->builder, loop_state[2].counter,
+                                                  LLVMBuildMul(gallivm->builder, num_x_loop, y_size_arg, ""), "");
+         coro_hdl_idx = LLVMBuildAdd(gallivm->builder, coro_hdl_idx,
+                                     LLVMBuildMul(gallivm->builder, loop_state[1].counter,
+                                                  num_x_loop, ""), "");
+         coro_hdl_idx = LLVMBuildAdd(gallivm->builder, coro_hdl_idx,
+                                     loop_state[0].counter, "");
+
+         LLVMValueRef coro_entry = LLVMBuildGEP(gallivm->builder, coro_hdls, &coro_hdl_idx, 1, "");
+
+         LLVMValueRef coro_hdl = LLVMBuildLoad(gallivm->builder, coro_entry, "coro_hdl");
+
+         struct lp_build_if_state ifstate;
+         LLVMValueRef cmp = LLVMBuildICmp(gallivm->builder, LLVMIntEQ, loop_state[3].counter,
+                                          lp_build_const_int32(gallivm, 0), "");
+         /* first time here - call the coroutine function entry point */
+         lp_build_if(&ifstate, gallivm, cmp);
+         LLVMValueRef coro_ret = LLVMBuildCall(gallivm->builder, coro, args, 17, "");
+         LLVMBuildStore(gallivm->builder, coro_ret, coro_entry);
+         lp_build_else(&ifstate);
+         /* subsequent calls for this invocation - check if done. */
+         LLVMValueRef coro_done = lp_build_coro_done(gallivm, coro_hdl);
+         struct lp_build_if_state ifstate2;
+         lp_build_if(&ifstate2, gallivm, coro_done);
+         /* if done destroy and force loop exit */
+         lp_build_coro_destroy(gallivm, coro_hdl);
+         lp_build_loop_force_set_counter(&loop_state[3], lp_build_const_int32(gallivm, end_coroutine - 1));
+         lp_build_else(&ifstate2);
+         /* otherwise resume the coroutine */
+         lp_build_coro_resume(gallivm, coro_hdl);
+         lp_build_endif(&ifstate2);
+         lp_build_endif(&ifstate);
+         lp_build_loop_force_reload_counter(&loop_state[3]);
+      }
    }
    lp_build_loop_end_cond(&loop_state[0],
                           num_x_loop,
@@ -272,9 +304,10 @@ generate_compute(struct llvmpipe_context *lp,
    lp_build_loop_end_cond(&loop_state[2],
                           z_size_arg,
                           NULL,  LLVMIntUGE);
-   lp_build_loop_end_cond(&loop_state[3],
-                          lp_build_const_int32(gallivm, end_coroutine),
-                          NULL, LLVMIntEQ);
+   if (shader->has_barrier)
+      lp_build_loop_end_cond(&loop_state[3],
+                             lp_build_const_int32(gallivm, end_coroutine),
+                             NULL, LLVMIntEQ);
    LLVMBuildRetVoid(builder);
 
    /* This is stage (b) - generate the compute shader code inside the coroutine. */
@@ -316,8 +349,9 @@ generate_compute(struct llvmpipe_context *lp,
       shared_ptr = lp_jit_cs_thread_data_shared(gallivm, thread_data_ptr);
 
       /* these are coroutine entrypoint necessities */
+      LLVMValueRef coro_pool = lp_jit_cs_thread_data_coro_pool(gallivm, thread_data_ptr);
       LLVMValueRef coro_id = lp_build_coro_id(gallivm);
-      LLVMValueRef coro_hdl = lp_build_coro_begin_alloc_mem(gallivm, coro_id);
+      LLVMValueRef coro_hdl = lp_build_coro_begin_alloc_mem(gallivm, coro_id, coro_pool);
 
       LLVMValueRef has_partials = LLVMBuildICmp(gallivm->builder, LLVMIntNE, partials, lp_build_const_int32(gallivm, 0), "");
       LLVMValueRef tid_vals[3];
@@ -408,7 +442,7 @@ generate_compute(struct llvmpipe_context *lp,
       lp_build_coro_suspend_switch(gallivm, &coro_info, NULL, true);
       LLVMPositionBuilderAtEnd(builder, clean_block);
 
-      lp_build_coro_free_mem(gallivm, coro_id, coro_hdl);
+      lp_build_coro_free_mem(gallivm, coro_id, coro_hdl, coro_pool);
 
       LLVMBuildBr(builder, sus_block);
       LLVMPositionBuilderAtEnd(builder, sus_block);
@@ -424,6 +458,47 @@ generate_compute(struct llvmpipe_context *lp,
    gallivm_verify_function(gallivm, function);
 }
 
+/**
+ * See fs_variant_key_size().
+ */
+static size_t
+cs_variant_key_size(const struct lp_compute_shader_variant_key *key)
+{
+   return lp_cs_variant_key_size(MAX2(key->nr_samplers, key->nr_sampler_views),
+                                 key->nr_images);
+}
+
+static uint32_t
+cs_variant_key_hash(const void *key)
+{
+   return _mesa_hash_data(key, cs_variant_key_size(key));
+}
+
+static bool
+cs_variant_key_equal(const void *a, const void *b)
+{
+   size_t size = cs_variant_key_size(a);
+   return size == cs_variant_key_size(b) && memcmp(a, b, size) == 0;
+}
+
+static bool
+nir_has_control_barrier(const struct nir_shader *nir)
+{
+   nir_foreach_function(function, nir) {
+      if (!function->impl)
+         continue;
+      nir_foreach_block(block, function->impl) {
+         nir_foreach_instr(instr, block) {
+            if (instr->type == nir_instr_type_intrinsic &&
+                nir_instr_as_intrinsic(instr)->intrinsic ==
+                nir_intrinsic_control_barrier)
+               return true;
+         }
+      }
+   }
+   return false;
+}
+
 static void *
 llvmpipe_create_compute_state(struct pipe_context *pipe,
                                      const struct pipe_compute_state *templ)
@@ -435,6 +510,13 @@ llvmpipe_create_compute_state(struct pipe_context *pipe,
    if (!shader)
       return NULL;
 
+   shader->variant_table = _mesa_hash_table_create(NULL, cs_variant_key_hash,
+                                                   cs_variant_key_equal);
+   if (!shader->variant_table) {
+      FREE(shader);
+      return NULL;
+   }
+
    shader->no = cs_no++;
 
    shader->base.type = templ->ir_type;
@@ -456,8 +538,18 @@ llvmpipe_create_compute_state(struct pipe_context *pipe,
 
       /* we need to keep a local copy of the tokens */
       shader->base.tokens = tgsi_dup_tokens(templ->prog);
+      shader->has_barrier =
+         shader->info.base.opcode_count[TGSI_OPCODE_BARRIER] > 0;
    } else {
+      struct blob blob;
+
       nir_tgsi_scan_shader(shader->base.ir.nir, &shader->info.base, false);
+      shader->has_barrier = nir_has_control_barrier(shader->base.ir.nir);
+
+      blob_init(&blob);
+      nir_serialize(&blob, shader->base.ir.nir, true);
+      _mesa_sha1_compute(blob.data, blob.size, shader->ir_sha1);
+      blob_finish(&blob);
    }
 
    shader->req_local_mem = templ->req_local_mem;
@@ -492,6 +584,8 @@ static void
 llvmpipe_remove_cs_shader_variant(struct llvmpipe_context *lp,
                                   struct lp_compute_shader_variant *variant)
 {
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+
    if ((LP_DEBUG & DEBUG_CS) || (gallivm_debug & GALLIVM_DEBUG_IR)) {
       debug_printf("llvmpipe: del cs #%u var %u v created %u v cached %u "
                    "v total cached %u inst %u total inst %u\n",
@@ -502,9 +596,11 @@ llvmpipe_remove_cs_shader_variant(struct llvmpipe_context *lp,
    }
 
    gallivm_destroy(variant->gallivm);
+   p_atomic_add(&screen->shader_memory, -(int64_t)variant->memory);
 
    /* remove from shader's list */
    remove_from_list(&variant->list_item_local);
+   _mesa_hash_table_remove_key(variant->shader->variant_table, &variant->key);
    variant->shader->variants_cached--;
 
    /* remove from context's list */
@@ -523,6 +619,9 @@ llvmpipe_delete_compute_state(struct pipe_context *pipe,
    struct lp_compute_shader *shader = cs;
    struct lp_cs_variant_list_item *li;
 
+   /* The last dispatch may still be running one of the variants. */
+   lp_csctx_wait(llvmpipe->csctx);
+
    if (llvmpipe->cs == cs)
       llvmpipe->cs = NULL;
    for (unsigned i = 0; i < shader->max_global_buffers; i++)
@@ -536,6 +635,7 @@ llvmpipe_delete_compute_state(struct pipe_context *pipe,
       llvmpipe_remove_cs_shader_variant(llvmpipe, li->base);
       li = next;
    }
+   _mesa_hash_table_destroy(shader->variant_table, NULL);
    if (shader->base.ir.nir)
       ralloc_free(shader->base.ir.nir);
    tgsi_free_tokens(shader->base.tokens);
@@ -580,8 +680,8 @@ make_variant_key(struct llvmpipe_context *lp,
           * used views may be included in the shader key.
           */
          if(shader->info.base.file_mask[TGSI_FILE_SAMPLER_VIEW] & (1u << (i & 31))) {
-            lp_sampler_static_texture_state(&cs_sampler[i].texture_state,
-                                            lp->sampler_views[PIPE_SHADER_COMPUTE][i]);
+            llvmpipe_sampler_static_texture_state(&cs_sampler[i].texture_state,
+                                                  lp->sampler_views[PIPE_SHADER_COMPUTE][i]);
          }
       }
    }
@@ -589,8 +689,8 @@ make_variant_key(struct llvmpipe_context *lp,
       key->nr_sampler_views = key->nr_samplers;
       for(i = 0; i < key->nr_sampler_views; ++i) {
          if(shader->info.base.file_mask[TGSI_FILE_SAMPLER] & (1 << i)) {
-            lp_sampler_static_texture_state(&cs_sampler[i].texture_state,
-                                            lp->sampler_views[PIPE_SHADER_COMPUTE][i]);
+            llvmpipe_sampler_static_texture_state(&cs_sampler[i].texture_state,
+                                                  lp->sampler_views[PIPE_SHADER_COMPUTE][i]);
          }
       }
    }
@@ -647,6 +747,9 @@ dump_cs_variant_key(const struct lp_compute_shader_variant_key *key)
                    texture->pot_width,
                    texture->pot_height,
                    texture->pot_depth);
+      if (texture->const_size)
+         debug_printf("  .const_size = %ux%u\n",
+                      1 << texture->width_log2, 1 << texture->height_log2);
    }
    struct lp_image_static_state *images = lp_cs_variant_key_images(key);
    for (i = 0; i < key->nr_images; ++i) {
@@ -678,26 +781,20 @@ lp_debug_cs_variant(const struct lp_compute_shader_variant *variant)
    debug_printf("\n");
 }
 
+/**
+ * The disk cache key of a variant: its key and the sha1 of the shader's NIR,
+ * computed once when the shader was created.
+ */
 static void
 lp_cs_get_ir_cache_key(struct lp_compute_shader_variant *variant,
                        unsigned char ir_sha1_cache_key[20])
 {
-   struct blob blob = { 0 };
-   unsigned ir_size;
-   void *ir_binary;
-
-   blob_init(&blob);
-   nir_serialize(&blob, variant->shader->base.ir.nir, true);
-   ir_binary = blob.data;
-   ir_size = blob.size;
-
    struct mesa_sha1 ctx;
    _mesa_sha1_init(&ctx);
    _mesa_sha1_update(&ctx, &variant->key, variant->shader->variant_key_size);
-   _mesa_sha1_update(&ctx, ir_binary, ir_size);
+   _mesa_sha1_update(&ctx, variant->shader->ir_sha1,
+                     sizeof(variant->shader->ir_sha1));
    _mesa_sha1_final(&ctx, ir_sha1_cache_key);
-
-   blob_finish(&blob);
 }
 
 static struct lp_compute_shader_variant *
@@ -711,6 +808,7 @@ generate_variant(struct llvmpipe_context *lp,
    unsigned char ir_sha1_cache_key[20];
    struct lp_cached_code cached = { 0 };
    bool needs_caching = false;
+   int64_t trace_start = lp_trace_begin();
    variant = MALLOC(sizeof *variant + shader->variant_key_size - sizeof variant->key);
    if (!variant)
       return NULL;
@@ -734,6 +832,7 @@ generate_variant(struct llvmpipe_context *lp,
       FREE(variant);
       return NULL;
    }
+   gallivm_use_code_arena(variant->gallivm, screen->code_arena);
 
    variant->list_item_global.base = variant;
    variant->list_item_local.base = variant;
@@ -756,10 +855,17 @@ generate_variant(struct llvmpipe_context *lp,
 
    variant->jit_function = (lp_jit_cs_func)gallivm_jit_function(variant->gallivm, variant->function);
 
+   variant->memory = sizeof *variant + shader->variant_key_size - sizeof variant->key +
+                     gallivm_code_size(variant->gallivm);
+   p_atomic_add(&screen->shader_memory, variant->memory);
+
    if (needs_caching) {
       lp_disk_cache_insert_shader(screen, &cached, ir_sha1_cache_key);
    }
    gallivm_free_ir(variant->gallivm);
+
+   LP_TRACE_END_ARGS("cs_generate_variant", trace_start, "shader,variant",
+                     shader->no, variant->no, 0);
    return variant;
 }
 
@@ -770,27 +876,39 @@ lp_cs_ctx_set_cs_variant( struct lp_cs_context *csctx,
    csctx->cs.current.variant = variant;
 }
 
+/**
+ * Whether variants need to be evicted before another one is created.
+ */
+static boolean
+cs_variants_over_budget(struct llvmpipe_context *lp)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+
+   if (screen->shader_memory_budget)
+      return lp_shader_memory_over_budget(screen);
+   return lp->nr_cs_instrs >= LP_MAX_SHADER_INSTRUCTIONS;
+}
+
 static void
 llvmpipe_update_cs(struct llvmpipe_context *lp)
 {
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
    struct lp_compute_shader *shader = lp->cs;
 
    struct lp_compute_shader_variant_key *key;
    struct lp_compute_shader_variant *variant = NULL;
-   struct lp_cs_variant_list_item *li;
+   struct hash_entry *entry;
    char store[LP_CS_MAX_VARIANT_KEY_SIZE];
+   uint32_t hash;
 
    key = make_variant_key(lp, shader, store);
+   hash = _mesa_hash_data(key, shader->variant_key_size);
 
    /* Search the variants for one which matches the key */
-   li = first_elem(&shader->variants);
-   while(!at_end(&shader->variants, li)) {
-      if(memcmp(&li->base->key, key, shader->variant_key_size) == 0) {
-         variant = li->base;
-         break;
-      }
-      li = next_elem(li);
-   }
+   LP_COUNT(nr_cs_variant_lookups);
+   entry = _mesa_hash_table_search_pre_hashed(shader->variant_table, hash, key);
+   if (entry)
+      variant = entry->data;
 
    if (variant) {
       /* Move this variant to the head of the list to implement LRU
@@ -804,6 +922,8 @@ llvmpipe_update_cs(struct llvmpipe_context *lp)
       unsigned i;
       unsigned variants_to_cull;
 
+      LP_COUNT(nr_cs_variant_misses);
+
       if (LP_DEBUG & DEBUG_CS) {
          debug_printf("%u variants,\t%u instrs,\t%u instrs/variant\n",
                       lp->nr_cs_variants,
@@ -814,10 +934,10 @@ llvmpipe_update_cs(struct llvmpipe_context *lp)
       /* First, check if we've exceeded the max number of shader variants.
        * If so, free 6.25% of them (the least recently used ones).
        */
-      variants_to_cull = lp->nr_cs_variants >= LP_MAX_SHADER_VARIANTS ? LP_MAX_SHADER_VARIANTS / 16 : 0;
+      variants_to_cull = !screen->shader_memory_budget &&
+         lp->nr_cs_variants >= LP_MAX_SHADER_VARIANTS ? LP_MAX_SHADER_VARIANTS / 16 : 0;
 
-      if (variants_to_cull ||
-          lp->nr_cs_instrs >= LP_MAX_SHADER_INSTRUCTIONS) {
+      if (variants_to_cull || cs_variants_over_budget(lp)) {
          if (gallivm_debug & GALLIVM_DEBUG_PERF) {
             debug_printf("Evicting CS: %u cs variants,\t%u total variants,"
                          "\t%u instrs,\t%u instrs/variant\n",
@@ -832,7 +952,7 @@ llvmpipe_update_cs(struct llvmpipe_context *lp)
           * pending for destruction on flush.
           */
 
-         for (i = 0; i < variants_to_cull || lp->nr_cs_instrs >= LP_MAX_SHADER_INSTRUCTIONS; i++) {
+         for (i = 0; i < variants_to_cull || cs_variants_over_budget(lp); i++) {
             struct lp_cs_variant_list_item *item;
             if (is_empty_list(&lp->cs_variants_list)) {
                break;
@@ -856,6 +976,8 @@ llvmpipe_update_cs(struct llvmpipe_context *lp)
       /* Put the new variant into the list */
       if (variant) {
          insert_at_head(&shader->variants, &variant->list_item_local);
+         _mesa_hash_table_insert_pre_hashed(shader->variant_table, hash,
+                                            &variant->key, variant);
          insert_at_head(&lp->cs_variants_list, &variant->list_item_global);
          lp->nr_cs_variants++;
          lp->nr_cs_instrs += variant->nr_instrs;
@@ -886,7 +1008,7 @@ lp_csctx_set_sampler_views(struct lp_cs_context *csctx,
       struct pipe_sampler_view *view = i < num ? views[i] : NULL;
 
       if (view) {
-         struct pipe_resource *res = view->texture;
+         struct pipe_resource *res = llvmpipe_sampler_view_texture(view);
          struct llvmpipe_resource *lp_tex = llvmpipe_resource(res);
          struct lp_jit_texture *jit_tex;
          jit_tex = &csctx->cs.current.jit_context.textures[i];
@@ -1114,6 +1236,10 @@ lp_csctx_set_cs_images(struct lp_cs_context *csctx,
          jit_image->depth = res->depth0;
          jit_image->num_samples = res->nr_samples;
 
+         /* The shader's stores may make the samples differ */
+         if (res->nr_samples > 1 && (image->access & PIPE_IMAGE_ACCESS_WRITE))
+            lp_res->writes++;
+
          if (llvmpipe_resource_is_texture(res)) {
             uint32_t mip_offset = lp_res->mip_offsets[image->u.tex.level];
 
@@ -1213,6 +1339,19 @@ update_csctx_ssbo(struct llvmpipe_context *llvmpipe)
 static void
 llvmpipe_cs_update_derived(struct llvmpipe_context *llvmpipe, void *input)
 {
+   struct llvmpipe_screen *lp_screen = llvmpipe_screen(llvmpipe->pipe.screen);
+
+   /* Check for updated textures, e.g. untiled ones. */
+   if (llvmpipe->cs_tex_timestamp != lp_screen->timestamp) {
+      llvmpipe->cs_tex_timestamp = lp_screen->timestamp;
+      llvmpipe->cs_dirty |= LP_CSNEW_SAMPLER_VIEW;
+   }
+
+   if (llvmpipe->cs_dirty & LP_CSNEW_SAMPLER_VIEW) {
+      llvmpipe_decompress_sampler_views(llvmpipe, PIPE_SHADER_COMPUTE);
+      llvmpipe->cs_tex_timestamp = lp_screen->timestamp;
+   }
+
    if (llvmpipe->cs_dirty & LP_CSNEW_CONSTANTS) {
       lp_csctx_set_cs_constants(llvmpipe->csctx,
                                 ARRAY_SIZE(llvmpipe->constants[PIPE_SHADER_COMPUTE]),
@@ -1272,6 +1411,7 @@ cs_exec_fn(void *init_data, int iter_idx, struct lp_cs_local_mem *lmem)
       lmem->local_size = job_info->req_local_mem;
    }
    thread_data.shared = lmem->local_mem_ptr;
+   thread_data.coro_pool = &lmem->coro_pool;
 
    unsigned grid_z = iter_idx / (job_info->grid_size[0] * job_info->grid_size[1]);
    unsigned grid_y = (iter_idx - (grid_z * (job_info->grid_size[0] * job_info->grid_size[1]))) / job_info->grid_size[0];
@@ -1282,6 +1422,7 @@ cs_exec_fn(void *init_data, int iter_idx, struct lp_cs_local_mem *lmem)
                          grid_x, grid_y, grid_z,
                          job_info->grid_size[0], job_info->grid_size[1], job_info->grid_size[2], job_info->work_dim,
                          &thread_data);
+   lp_coro_frame_pool_reset(&lmem->coro_pool);
 }
 
 static void
@@ -1312,37 +1453,157 @@ fill_grid_size(struct pipe_context *pipe,
    pipe_buffer_unmap(pipe, transfer);
 }
 
+static void
+lp_cs_job_add_resource(struct lp_cs_job_info *job,
+                       struct pipe_resource *resource)
+{
+   if (!resource)
+      return;
+
+   assert(job->num_resources < ARRAY_SIZE(job->resources));
+   pipe_resource_reference(&job->resources[job->num_resources++], resource);
+}
+
+/**
+ * Make the job independent of later state changes: snapshot the jit
+ * context, copy user constants, which only live until the call returns,
+ * and reference everything the grid reads or writes.
+ */
+static boolean
+lp_cs_job_capture(struct lp_cs_context *csctx, struct lp_cs_job_info *job)
+{
+   unsigned i;
+
+   job->exec = csctx->cs.current;
+   job->current = &job->exec;
+
+   for (i = 0; i < ARRAY_SIZE(csctx->constants); i++) {
+      const struct pipe_constant_buffer *cb = &csctx->constants[i].current;
+
+      if (cb->buffer) {
+         lp_cs_job_add_resource(job, cb->buffer);
+      } else if (cb->user_buffer && job->exec.jit_context.num_constants[i]) {
+         job->user_constants[i] = MALLOC(cb->buffer_size);
+         if (!job->user_constants[i])
+            return FALSE;
+         memcpy(job->user_constants[i], job->exec.jit_context.constants[i],
+                cb->buffer_size);
+         job->exec.jit_context.constants[i] = job->user_constants[i];
+      }
+   }
+   for (i = 0; i < ARRAY_SIZE(csctx->ssbos); i++)
+      lp_cs_job_add_resource(job, csctx->ssbos[i].current.buffer);
+   for (i = 0; i < ARRAY_SIZE(csctx->images); i++)
+      lp_cs_job_add_resource(job, csctx->images[i].current.resource);
+   for (i = 0; i < csctx->cs.current_tex_num; i++)
+      lp_cs_job_add_resource(job, csctx->cs.current_tex[i]);
+
+   return TRUE;
+}
+
+static void
+lp_cs_job_release(struct lp_cs_job_info *job)
+{
+   for (unsigned i = 0; i < job->num_resources; i++)
+      pipe_resource_reference(&job->resources[i], NULL);
+   job->num_resources = 0;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(job->user_constants); i++) {
+      FREE(job->user_constants[i]);
+      job->user_constants[i] = NULL;
+   }
+}
+
+/**
+ * Wait for the last dispatch to finish.  Anything which may read what
+ * the grid writes, write what it reads, or change what it runs must come
+ * after this: flushes (and so memory barriers), transfers and copies of
+ * the resources it uses, see lp_csctx_is_resource_referenced(), and the
+ * next dispatch.
+ */
+void
+lp_csctx_wait(struct lp_cs_context *csctx)
+{
+   struct lp_cs_job_info *job = csctx ? csctx->job : NULL;
+
+   if (!job || !job->task)
+      return;
+
+   lp_cs_tpool_wait_for_task(llvmpipe_screen(csctx->pipe->screen)->cs_tpool,
+                             &job->task);
+   lp_cs_job_release(job);
+}
+
+boolean
+lp_csctx_is_resource_referenced(const struct lp_cs_context *csctx,
+                                const struct pipe_resource *resource)
+{
+   const struct lp_cs_job_info *job = csctx ? csctx->job : NULL;
+
+   if (!job || !job->task)
+      return FALSE;
+
+   for (unsigned i = 0; i < job->num_resources; i++) {
+      if (job->resources[i] == resource)
+         return TRUE;
+   }
+   return FALSE;
+}
+
 static void llvmpipe_launch_grid(struct pipe_context *pipe,
                                  const struct pipe_grid_info *info)
 {
    struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
    struct llvmpipe_screen *screen = llvmpipe_screen(pipe->screen);
-   struct lp_cs_job_info job_info;
+   struct lp_cs_context *csctx = llvmpipe->csctx;
+   struct lp_cs_job_info *job_info;
 
    if (!llvmpipe_check_render_cond(llvmpipe))
       return;
 
-   memset(&job_info, 0, sizeof(job_info));
+   /* One dispatch in flight per context keeps the state it uses alive. */
+   lp_csctx_wait(csctx);
+
+   if (!csctx->job) {
+      csctx->job = CALLOC_STRUCT(lp_cs_job_info);
+      if (!csctx->job)
+         return;
+   }
+   job_info = csctx->job;
 
    llvmpipe_cs_update_derived(llvmpipe, info->input);
 
-   fill_grid_size(pipe, info, job_info.grid_size);
+   fill_grid_size(pipe, info, job_info->grid_size);
 
-   job_info.block_size[0] = info->block[0];
-   job_info.block_size[1] = info->block[1];
-   job_info.block_size[2] = info->block[2];
-   job_info.work_dim = info->work_dim;
-   job_info.req_local_mem = llvmpipe->cs->req_local_mem;
-   job_info.current = &llvmpipe->csctx->cs.current;
+   job_info->block_size[0] = info->block[0];
+   job_info->block_size[1] = info->block[1];
+   job_info->block_size[2] = info->block[2];
+   job_info->work_dim = info->work_dim;
+   job_info->req_local_mem = llvmpipe->cs->req_local_mem;
 
-   int num_tasks = job_info.grid_size[2] * job_info.grid_size[1] * job_info.grid_size[0];
+   int num_tasks = job_info->grid_size[2] * job_info->grid_size[1] * job_info->grid_size[0];
    if (num_tasks) {
-      struct lp_cs_tpool_task *task;
-      mtx_lock(&screen->cs_mutex);
-      task = lp_cs_tpool_queue_task(screen->cs_tpool, cs_exec_fn, &job_info, num_tasks);
+      /*
+       * Kernel arguments belong to the caller, and may point at global
+       * buffers the job doesn't track, so such grids still run to
+       * completion here.
+       */
+      boolean async = !info->input && lp_cs_job_capture(csctx, job_info);
 
-      lp_cs_tpool_wait_for_task(screen->cs_tpool, &task);
+      if (!async) {
+         lp_cs_job_release(job_info);
+         job_info->current = &csctx->cs.current;
+      }
+
+      mtx_lock(&screen->cs_mutex);
+      job_info->task = lp_cs_tpool_queue_task(screen->cs_tpool, cs_exec_fn,
+                                              job_info, num_tasks);
       mtx_unlock(&screen->cs_mutex);
+
+      if (!async)
+         lp_cs_tpool_wait_for_task(screen->cs_tpool, &job_info->task);
+      else if (!job_info->task)
+         lp_cs_job_release(job_info);
    }
    llvmpipe->pipeline_statistics.cs_invocations += num_tasks * info->block[0] * info->block[1] * info->block[2];
 }
@@ -1410,6 +1671,10 @@ void
 lp_csctx_destroy(struct lp_cs_context *csctx)
 {
    unsigned i;
+
+   lp_csctx_wait(csctx);
+   FREE(csctx->job);
+
    for (i = 0; i < ARRAY_SIZE(csctx->cs.current_tex); i++) {
       pipe_resource_reference(&csctx->cs.current_tex[i], NULL);
    }
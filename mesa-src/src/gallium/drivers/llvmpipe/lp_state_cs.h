@@ -35,6 +35,7 @@
 #include "lp_jit.h"
 #include "lp_state_fs.h"
 
+struct hash_table;
 struct lp_compute_shader_variant;
 
 struct lp_compute_shader_variant_key
@@ -86,6 +87,9 @@ struct lp_compute_shader_variant
    /* Total number of LLVM instructions generated */
    unsigned nr_instrs;
 
+   /** Bytes of the variant and its code, counted in screen->shader_memory */
+   uint64_t memory;
+
    struct lp_cs_variant_list_item list_item_global, list_item_local;
 
    struct lp_compute_shader *shader;
@@ -101,11 +105,18 @@ struct lp_compute_shader {
    struct pipe_shader_state base;
 
    struct lp_cs_variant_list_item variants;
+   struct hash_table *variant_table;   /**< the same variants, by key */
 
    struct lp_tgsi_info info;
 
    uint32_t req_local_mem;
 
+   /** Invocations may suspend, see generate_compute() */
+   boolean has_barrier;
+
+   /** sha1 of the NIR, for the disk cache keys of the variants */
+   unsigned char ir_sha1[20];
+
    /* For debugging/profiling purposes */
    unsigned variant_key_size;
    unsigned no;
@@ -147,9 +158,17 @@ struct lp_cs_context {
    } images[LP_MAX_TGSI_SHADER_IMAGES];
 
    void *input;
+
+   /** The last dispatch, which may still be running, see lp_csctx_wait() */
+   struct lp_cs_job_info *job;
 };
 
 struct lp_cs_context *lp_csctx_create(struct pipe_context *pipe);
 void lp_csctx_destroy(struct lp_cs_context *csctx);
 
+void lp_csctx_wait(struct lp_cs_context *csctx);
+
+boolean lp_csctx_is_resource_referenced(const struct lp_cs_context *csctx,
+                                        const struct pipe_resource *resource);
+
 #endif
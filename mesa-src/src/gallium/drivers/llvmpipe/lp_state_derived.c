@@ -191,6 +191,11 @@ void llvmpipe_update_derived( struct llvmpipe_context *llvmpipe )
       llvmpipe->dirty |= LP_NEW_SAMPLER_VIEW;
    }
 
+   if (llvmpipe->dirty & LP_NEW_SAMPLER_VIEW) {
+      llvmpipe_decompress_sampler_views(llvmpipe, PIPE_SHADER_FRAGMENT);
+      llvmpipe->tex_timestamp = lp_screen->timestamp;
+   }
+
    /* This needs LP_NEW_RASTERIZER because of draw_prepare_shader_outputs(). */
    if (llvmpipe->dirty & (LP_NEW_RASTERIZER |
                           LP_NEW_FS |
@@ -200,6 +205,10 @@ void llvmpipe_update_derived( struct llvmpipe_context *llvmpipe )
                           LP_NEW_VS))
       compute_vertex_info(llvmpipe);
 
+   if (lp_screen->inline_uniforms && llvmpipe->fs &&
+       llvmpipe->fs->num_inlinable_uniforms)
+      llvmpipe_check_fs_uniforms(llvmpipe);
+
    if (llvmpipe->dirty & (LP_NEW_FS |
                           LP_NEW_FRAMEBUFFER |
                           LP_NEW_BLEND |
@@ -208,7 +217,8 @@ void llvmpipe_update_derived( struct llvmpipe_context *llvmpipe )
                           LP_NEW_RASTERIZER |
                           LP_NEW_SAMPLER |
                           LP_NEW_SAMPLER_VIEW |
-                          LP_NEW_OCCLUSION_QUERY))
+                          LP_NEW_OCCLUSION_QUERY |
+                          LP_NEW_FS_VARIANT))
       llvmpipe_update_fs(llvmpipe);
 
    if (llvmpipe->dirty & (LP_NEW_FS |
@@ -231,6 +241,7 @@ void llvmpipe_update_derived( struct llvmpipe_context *llvmpipe )
          (null_fs &&
           !llvmpipe->depth_stencil->depth.enabled &&
           !llvmpipe->depth_stencil->stencil[0].enabled);
+      draw_set_rasterizer_discard(llvmpipe->draw, discard);
       lp_setup_set_rasterizer_discard(llvmpipe->setup, discard);
    }
 
@@ -254,6 +265,8 @@ void llvmpipe_update_derived( struct llvmpipe_context *llvmpipe )
                                    llvmpipe->depth_stencil->alpha.ref_value);
       lp_setup_set_stencil_ref_values(llvmpipe->setup,
                                       llvmpipe->stencil_ref.ref_value);
+      lp_setup_set_depth_stencil_state(llvmpipe->setup,
+                                       llvmpipe->depth_stencil);
    }
 
    if (llvmpipe->dirty & LP_NEW_FS_CONSTANTS)
@@ -294,5 +307,9 @@ void llvmpipe_update_derived( struct llvmpipe_context *llvmpipe )
    }
 
    llvmpipe->dirty = 0;
+
+   /* Keep checking whether the specialized fs variant is ready. */
+   if (llvmpipe->fs_variant_pending)
+      llvmpipe->dirty |= LP_NEW_FS_VARIANT;
 }
 
@@ -66,6 +66,7 @@
 #include "util/u_dump.h"
 #include "util/u_string.h"
 #include "util/simple_list.h"
+#include "util/hash_table.h"
 #include "util/u_dual_blend.h"
 #include "util/os_time.h"
 #include "pipe/p_shader_tokens.h"
@@ -102,13 +103,23 @@
 #include "lp_state.h"
 #include "lp_tex_sample.h"
 #include "lp_flush.h"
+#include "lp_memory.h"
 #include "lp_state_fs.h"
 #include "lp_rast.h"
+#include "lp_trace.h"
 #include "nir/nir_to_tgsi_info.h"
 
 #include "lp_screen.h"
 #include "compiler/nir/nir_serialize.h"
 #include "util/mesa-sha1.h"
+
+/**
+ * The depth/stencil and blend code handles up to two rows of a 4x4 stamp
+ * per loop iteration, so fragment shaders stay at 8 floats wide even with
+ * 512-bit native vectors.
+ */
+#define LP_FS_MAX_VECTOR_WIDTH 256
+
 /** Fragment shader number (for debugging) */
 static unsigned fs_no = 0;
 
@@ -159,6 +170,34 @@ format_expands_to_float_soa(const struct util_format_description *format_desc)
    return false;
 }
 
+/**
+ * Checks if this is a 32-bit packed unorm format with uneven channels, such
+ * as R10G10B10A2_UNORM.  The generic path blends these as 16-bit channels
+ * in 64-bit pixels, which needs 64-bit lane shifts and multiplies to unpack
+ * and repack them, so unless a logic op needs their integer values they
+ * are unpacked to floats in SoA like the formats above instead.
+ */
+static inline boolean
+format_is_packed_unorm(const struct util_format_description *format_desc)
+{
+   unsigned i;
+
+   if (format_desc->layout != UTIL_FORMAT_LAYOUT_PLAIN ||
+       format_desc->colorspace != UTIL_FORMAT_COLORSPACE_RGB ||
+       format_desc->block.bits != 32 ||
+       !is_arithmetic_format(format_desc))
+      return false;
+
+   for (i = 0; i < format_desc->nr_channels; ++i) {
+      if (format_desc->channel[i].type == UTIL_FORMAT_TYPE_VOID)
+         continue;
+      if (format_desc->channel[i].type != UTIL_FORMAT_TYPE_UNSIGNED ||
+          !format_desc->channel[i].normalized)
+         return false;
+   }
+   return true;
+}
+
 
 /**
  * Retrieves the type representing the memory layout for a format
@@ -215,14 +254,15 @@ lp_mem_type_from_format_desc(const struct util_format_description *format_desc,
  * quad arguments with fs length 8.
  *
  * \param first_quad  which quad(s) of the quad group to test, in [0,3]
- * \param mask_input  bitwise mask for the whole 4x4 stamp
+ * \param mask_input  bitwise masks for the whole 4x4 stamp, 16 bits per
+ *                    sample, see LP_RAST_MASK_WORDS
  */
 static LLVMValueRef
 generate_quad_mask(struct gallivm_state *gallivm,
                    struct lp_type fs_type,
                    unsigned first_quad,
                    unsigned sample,
-                   LLVMValueRef mask_input) /* int64 */
+                   LLVMValueRef mask_input) /* int64 * */
 {
    LLVMBuilderRef builder = gallivm->builder;
    struct lp_type mask_type;
@@ -261,7 +301,9 @@ generate_quad_mask(struct gallivm_state *gallivm,
       shift = 0;
    }
 
-   mask_input = LLVMBuildLShr(builder, mask_input, lp_build_const_int64(gallivm, 16 * sample), "");
+   mask_input = lp_build_pointer_get(builder, mask_input,
+                                     lp_build_const_int32(gallivm, sample / 4));
+   mask_input = LLVMBuildLShr(builder, mask_input, lp_build_const_int64(gallivm, 16 * (sample % 4)), "");
    mask_input = LLVMBuildTrunc(builder, mask_input,
                                i32t, "");
    mask_input = LLVMBuildAnd(builder, mask_input, lp_build_const_int32(gallivm, 0xffff), "");
@@ -299,6 +341,65 @@ generate_quad_mask(struct gallivm_state *gallivm,
 }
 
 
+/**
+ * Expand the inner coverage of the 4x4 stamp, in the thread data, to a
+ * mask of the pixels of loop iteration loop_counter, as
+ * generate_quad_mask() does for the coverage.
+ */
+static LLVMValueRef
+generate_inner_coverage(struct gallivm_state *gallivm,
+                        struct lp_type fs_type,
+                        LLVMValueRef loop_counter,
+                        LLVMValueRef thread_data_ptr)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_type mask_type = lp_int_type(fs_type);
+   LLVMTypeRef i32t = LLVMInt32TypeInContext(gallivm->context);
+   LLVMValueRef bits[16];
+   LLVMValueRef inner, quad, shift, mask, bits_vec;
+   unsigned i;
+
+   assert(fs_type.length <= ARRAY_SIZE(bits));
+
+   /*
+    * inner >>= 2 * (quad % 2) + 8 * (quad / 2), of the first quad
+    */
+   inner = lp_jit_thread_data_raster_state_inner_coverage(gallivm,
+                                                           thread_data_ptr);
+   quad = LLVMBuildMul(builder, loop_counter,
+                       lp_build_const_int32(gallivm, fs_type.length / 4), "");
+   shift = LLVMBuildOr(builder,
+                       LLVMBuildShl(builder,
+                                    LLVMBuildAnd(builder, quad,
+                                                 lp_build_const_int32(gallivm, 1), ""),
+                                    lp_build_const_int32(gallivm, 1), ""),
+                       LLVMBuildShl(builder,
+                                    LLVMBuildLShr(builder, quad,
+                                                  lp_build_const_int32(gallivm, 1), ""),
+                                    lp_build_const_int32(gallivm, 3), ""),
+                       "");
+   inner = LLVMBuildLShr(builder, inner, shift, "");
+
+   mask = lp_build_broadcast(gallivm,
+                             lp_build_vec_type(gallivm, mask_type),
+                             inner);
+
+   for (i = 0; i < fs_type.length / 4; i++) {
+      unsigned j = 2 * (i % 2) + (i / 2) * 8;
+      bits[4*i + 0] = LLVMConstInt(i32t, 1ULL << (j + 0), 0);
+      bits[4*i + 1] = LLVMConstInt(i32t, 1ULL << (j + 1), 0);
+      bits[4*i + 2] = LLVMConstInt(i32t, 1ULL << (j + 4), 0);
+      bits[4*i + 3] = LLVMConstInt(i32t, 1ULL << (j + 5), 0);
+   }
+   bits_vec = LLVMConstVector(bits, fs_type.length);
+   mask = LLVMBuildAnd(builder, mask, bits_vec, "");
+
+   return lp_build_compare(gallivm,
+                           mask_type, PIPE_FUNC_EQUAL,
+                           mask, bits_vec);
+}
+
+
 #define EARLY_DEPTH_TEST  0x1
 #define LATE_DEPTH_TEST   0x2
 #define EARLY_DEPTH_WRITE 0x4
@@ -450,6 +551,16 @@ static LLVMValueRef fs_interp(const struct lp_build_fs_iface *iface,
                               attrib, chan, loc, attrib_indir, offsets);
 }
 
+static LLVMValueRef fs_load_input(const struct lp_build_fs_iface *iface,
+                                  struct lp_build_context *bld,
+                                  unsigned attrib, unsigned chan)
+{
+   struct lp_build_fs_llvm_iface *fs_iface = (struct lp_build_fs_llvm_iface *)iface;
+
+   return lp_build_interp_soa_input(fs_iface->interp, bld->gallivm,
+                                    attrib, chan);
+}
+
 static void fs_fb_fetch(const struct lp_build_fs_iface *iface,
                                 struct lp_build_context *bld,
                                 unsigned cbuf,
@@ -552,9 +663,48 @@ static void fs_fb_fetch(const struct lp_build_fs_iface *iface,
 /**
  * Generate the fragment shader, depth/stencil test, and alpha tests.
  */
+/**
+ * Fetch the depth/stencil state of a generic (runtime_ds) variant from the
+ * jit context.
+ */
+static void
+lp_build_ds_runtime_state(struct gallivm_state *gallivm,
+                          LLVMValueRef context_ptr,
+                          struct lp_build_ds_runtime *runtime)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef stencil_ptr = lp_jit_context_stencil_state(gallivm, context_ptr);
+   LLVMValueRef *fields[LP_JIT_STENCIL_NUM_FIELDS];
+   unsigned face, i;
+
+   runtime->depth_func = lp_jit_context_depth_func(gallivm, context_ptr);
+
+   for (face = 0; face < 2; face++) {
+      fields[LP_JIT_STENCIL_FUNC] = &runtime->stencil[face].func;
+      fields[LP_JIT_STENCIL_FAIL_OP] = &runtime->stencil[face].fail_op;
+      fields[LP_JIT_STENCIL_ZFAIL_OP] = &runtime->stencil[face].zfail_op;
+      fields[LP_JIT_STENCIL_ZPASS_OP] = &runtime->stencil[face].zpass_op;
+      fields[LP_JIT_STENCIL_VALUEMASK] = &runtime->stencil[face].valuemask;
+      fields[LP_JIT_STENCIL_WRITEMASK] = &runtime->stencil[face].writemask;
+
+      for (i = 0; i < LP_JIT_STENCIL_NUM_FIELDS; i++) {
+         LLVMValueRef indices[3];
+         LLVMValueRef ptr;
+
+         indices[0] = lp_build_const_int32(gallivm, 0);
+         indices[1] = lp_build_const_int32(gallivm, face);
+         indices[2] = lp_build_const_int32(gallivm, i);
+         ptr = LLVMBuildGEP(builder, stencil_ptr, indices, 3, "");
+         *fields[i] = LLVMBuildLoad(builder, ptr, "");
+      }
+   }
+}
+
+
 static void
 generate_fs_loop(struct gallivm_state *gallivm,
                  struct lp_fragment_shader *shader,
+                 struct nir_shader *nir,
                  const struct lp_fragment_shader_variant_key *key,
                  LLVMBuilderRef builder,
                  struct lp_type type,
@@ -573,7 +723,8 @@ generate_fs_loop(struct gallivm_state *gallivm,
                  LLVMValueRef color_stride_ptr,
                  LLVMValueRef color_sample_stride_ptr,
                  LLVMValueRef facing,
-                 LLVMValueRef thread_data_ptr)
+                 LLVMValueRef thread_data_ptr,
+                 uint64_t *skipped_bodies)
 {
    const struct util_format_description *zs_format_desc = NULL;
    const struct tgsi_token *tokens = shader->base.tokens;
@@ -587,6 +738,7 @@ generate_fs_loop(struct gallivm_state *gallivm,
    LLVMValueRef z_fb, s_fb;
    LLVMValueRef depth_ptr;
    LLVMValueRef stencil_refs[2];
+   struct lp_build_ds_runtime ds_runtime;
    LLVMValueRef outputs[PIPE_MAX_SHADER_OUTPUTS][TGSI_NUM_CHANNELS];
    LLVMValueRef zs_samples = lp_build_const_int32(gallivm, key->zsbuf_nr_samples);
    struct lp_build_for_loop_state loop_state, sample_loop_state;
@@ -669,6 +821,9 @@ generate_fs_loop(struct gallivm_state *gallivm,
    stencil_refs[0] = lp_build_broadcast(gallivm, int_vec_type, stencil_refs[0]);
    stencil_refs[1] = lp_build_broadcast(gallivm, int_vec_type, stencil_refs[1]);
 
+   if (key->runtime_ds)
+      lp_build_ds_runtime_state(gallivm, context_ptr, &ds_runtime);
+
    consts_ptr = lp_jit_context_constants(gallivm, context_ptr);
    num_consts_ptr = lp_jit_context_num_constants(gallivm, context_ptr);
 
@@ -822,6 +977,7 @@ generate_fs_loop(struct gallivm_state *gallivm,
                                   key->multisample ? NULL : &mask,
                                   &s_mask,
                                   stencil_refs,
+                                  key->runtime_ds ? &ds_runtime : NULL,
                                   z, z_fb, s_fb,
                                   facing,
                                   &z_value, &s_value,
@@ -902,6 +1058,15 @@ generate_fs_loop(struct gallivm_state *gallivm,
    }
    else
       system_values.sample_mask_in = sample_mask_in;
+   if (nir && nir->info.fs.inner_coverage) {
+      /* Only the samples of the pixels fully covered, see
+       * lp_rast_inner_coverage().
+       */
+      system_values.sample_mask_in =
+         LLVMBuildAnd(builder, system_values.sample_mask_in,
+                      generate_inner_coverage(gallivm, type, loop_state.counter,
+                                              thread_data_ptr), "");
+   }
    if (key->multisample && key->min_samples > 1) {
       lp_build_for_loop_begin(&sample_loop_state, gallivm,
                               lp_build_const_int32(gallivm, 0),
@@ -930,6 +1095,7 @@ generate_fs_loop(struct gallivm_state *gallivm,
    struct lp_build_fs_llvm_iface fs_iface = {
      .base.interp_fn = fs_interp,
      .base.fb_fetch = fs_fb_fetch,
+     .base.load_input = fs_load_input,
      .interp = interp,
      .loop_state = &loop_state,
      .sample_id = system_values.sample_id,
@@ -957,14 +1123,49 @@ generate_fs_loop(struct gallivm_state *gallivm,
    params.ssbo_ptr = ssbo_ptr;
    params.ssbo_sizes_ptr = num_ssbo_ptr;
    params.image = image;
+   params.skipped_bodies = skipped_bodies;
 
-   /* Build the actual shader */
-   if (shader->base.type == PIPE_SHADER_IR_TGSI)
-      lp_build_tgsi_soa(gallivm, tokens, &params,
-                        outputs);
-   else
-      lp_build_nir_soa(gallivm, shader->base.ir.nir, &params,
-                       outputs);
+   /* Build the actual shader.  Depth-only variants leave the outputs
+    * unset, so there's no color written below either.
+    */
+   if (!key->depth_only) {
+      if (shader->base.type == PIPE_SHADER_IR_TGSI)
+         lp_build_tgsi_soa(gallivm, tokens, &params,
+                           outputs);
+      else
+         lp_build_nir_soa(gallivm, nir, &params,
+                          outputs);
+   }
+
+   /* Smooth lines: scale the alpha of color 0 by the pixel's coverage,
+    * from its distances to the line's edges which setup put in the
+    * input after the shader's.  Other primitives get a coverage of 1.
+    */
+   if (key->aa_line) {
+      int color0 = find_output_by_semantic(&shader->info.base,
+                                           TGSI_SEMANTIC_COLOR,
+                                           0);
+
+      if (color0 != -1 && outputs[color0][3]) {
+         const unsigned aa = shader->info.base.num_inputs;
+         LLVMValueRef dist[4];
+         struct lp_build_context bld;
+         LLVMValueRef cov_x, cov_y, alpha;
+
+         for (unsigned chan = 0; chan < 4; chan++)
+            dist[chan] = lp_build_interp_soa_input(interp, gallivm, aa, chan);
+
+         lp_build_context_init(&bld, gallivm, type);
+         cov_x = lp_build_sub(&bld, dist[2], lp_build_abs(&bld, dist[0]));
+         cov_y = lp_build_sub(&bld, dist[3], lp_build_abs(&bld, dist[1]));
+         cov_x = lp_build_clamp_zero_one_nanzero(&bld, cov_x);
+         cov_y = lp_build_clamp_zero_one_nanzero(&bld, cov_y);
+
+         alpha = LLVMBuildLoad(builder, outputs[color0][3], "alpha");
+         alpha = lp_build_mul(&bld, alpha, lp_build_mul(&bld, cov_x, cov_y));
+         LLVMBuildStore(builder, alpha, outputs[color0][3]);
+      }
+   }
 
    /* Alpha test */
    if (key->alpha.enabled) {
@@ -1150,6 +1351,7 @@ generate_fs_loop(struct gallivm_state *gallivm,
                                   key->multisample ? NULL : &mask,
                                   &s_mask,
                                   stencil_refs,
+                                  key->runtime_ds ? &ds_runtime : NULL,
                                   z, z_fb, s_fb,
                                   facing,
                                   &z_value, &s_value,
@@ -1561,12 +1763,13 @@ store_unswizzled_block(struct gallivm_state *gallivm,
  */
 static inline void
 lp_blend_type_from_format_desc(const struct util_format_description *format_desc,
+                               bool float_soa,
                                struct lp_type* type)
 {
    unsigned i;
    unsigned chan;
 
-   if (format_expands_to_float_soa(format_desc)) {
+   if (float_soa) {
       /* always use ordinary floats for blending */
       type->floating = true;
       type->fixed = false;
@@ -1763,6 +1966,7 @@ static void
 convert_to_blend_type(struct gallivm_state *gallivm,
                       unsigned block_size,
                       const struct util_format_description *src_fmt,
+                      bool float_soa,
                       struct lp_type src_type,
                       struct lp_type dst_type,
                       LLVMValueRef* src, // and dst
@@ -1782,7 +1986,7 @@ convert_to_blend_type(struct gallivm_state *gallivm,
     * can't be fixed. Should really have some SoA blend path for these kind of
     * formats rather than hacking them in here.
     */
-   if (format_expands_to_float_soa(src_fmt)) {
+   if (float_soa) {
       LLVMValueRef tmpsrc[4];
       /*
        * This is pretty suboptimal for this case blending in SoA would be much
@@ -1840,7 +2044,7 @@ convert_to_blend_type(struct gallivm_state *gallivm,
    }
 
    lp_mem_type_from_format_desc(src_fmt, &mem_type);
-   lp_blend_type_from_format_desc(src_fmt, &blend_type);
+   lp_blend_type_from_format_desc(src_fmt, float_soa, &blend_type);
 
    /* Is the format arithmetic */
    is_arith = blend_type.length * blend_type.width != mem_type.width * mem_type.length;
@@ -1931,6 +2135,7 @@ static void
 convert_from_blend_type(struct gallivm_state *gallivm,
                         unsigned block_size,
                         const struct util_format_description *src_fmt,
+                        bool float_soa,
                         struct lp_type src_type,
                         struct lp_type dst_type,
                         LLVMValueRef* src, // and dst
@@ -1950,7 +2155,7 @@ convert_from_blend_type(struct gallivm_state *gallivm,
     * can't be fixed. Should really have some SoA blend path for these kind of
     * formats rather than hacking them in here.
     */
-   if (format_expands_to_float_soa(src_fmt)) {
+   if (float_soa) {
       /*
        * This is pretty suboptimal for this case blending in SoA would be much
        * better - we need to transpose the AoS values back to SoA values for
@@ -1969,10 +2174,14 @@ convert_from_blend_type(struct gallivm_state *gallivm,
          if (src_fmt->format == PIPE_FORMAT_R11G11B10_FLOAT) {
             tmpdst = lp_build_float_to_r11g11b10(gallivm, tmpsoa);
          }
-         else {
+         else if (src_fmt->colorspace == UTIL_FORMAT_COLORSPACE_SRGB) {
             tmpdst = lp_build_float_to_srgb_packed(gallivm, src_fmt,
                                                    src_type, tmpsoa);
          }
+         else {
+            tmpdst = lp_build_pack_swizzled_rgba_soa(gallivm, src_fmt,
+                                                     src_type, tmpsoa);
+         }
 
          if (src_type.length == 8) {
             LLVMValueRef tmpaos, shuffles[8];
@@ -2017,7 +2226,7 @@ convert_from_blend_type(struct gallivm_state *gallivm,
    }
 
    lp_mem_type_from_format_desc(src_fmt, &mem_type);
-   lp_blend_type_from_format_desc(src_fmt, &blend_type);
+   lp_blend_type_from_format_desc(src_fmt, float_soa, &blend_type);
 
    is_arith = (blend_type.length * blend_type.width != mem_type.width * mem_type.length);
 
@@ -2272,6 +2481,9 @@ generate_unswizzled_blend(struct gallivm_state *gallivm,
    unsigned dst_alignment;
 
    bool pad_inline = is_arithmetic_format(out_format_desc);
+   const bool float_soa = format_expands_to_float_soa(out_format_desc) ||
+                          (format_is_packed_unorm(out_format_desc) &&
+                           !variant->key.blend.logicop_enable);
    bool has_alpha = false;
    const boolean dual_source_blend = variant->key.blend.rt[0].blend_enable &&
                                      util_blend_state_is_dual(&variant->key.blend, 0);
@@ -2282,7 +2494,7 @@ generate_unswizzled_blend(struct gallivm_state *gallivm,
    LLVMValueRef fpstate = 0;
 
    /* Get type from output format */
-   lp_blend_type_from_format_desc(out_format_desc, &row_type);
+   lp_blend_type_from_format_desc(out_format_desc, float_soa, &row_type);
    lp_mem_type_from_format_desc(out_format_desc, &dst_type);
 
    /*
@@ -2327,7 +2539,7 @@ generate_unswizzled_blend(struct gallivm_state *gallivm,
    undef_src_val = lp_build_undef(gallivm, fs_type);
 
    row_type.length = fs_type.length;
-   vector_width    = dst_type.floating ? lp_native_vector_width : lp_integer_vector_width;
+   vector_width    = dst_type.floating ? MIN2(lp_native_vector_width, LP_FS_MAX_VECTOR_WIDTH) : lp_integer_vector_width;
 
    /* Compute correct swizzle and count channels */
    memset(swizzle, LP_BLD_SWIZZLE_DONTCARE, TGSI_NUM_CHANNELS);
@@ -2357,7 +2569,7 @@ generate_unswizzled_blend(struct gallivm_state *gallivm,
       }
    }
 
-   if (format_expands_to_float_soa(out_format_desc)) {
+   if (float_soa) {
       /*
        * the code above can't work for layout_other
        * for srgb it would sort of work but we short-circuit swizzles, etc.
@@ -2595,7 +2807,7 @@ generate_unswizzled_blend(struct gallivm_state *gallivm,
    /* Convert */
    lp_build_conv(gallivm, fs_type, blend_type, &blend_color, 1, &blend_color, 1);
 
-   if (out_format_desc->colorspace == UTIL_FORMAT_COLORSPACE_SRGB) {
+   if (float_soa && out_format != PIPE_FORMAT_R11G11B10_FLOAT) {
       /*
        * since blending is done with floats, there was no conversion.
        * However, the rules according to fixed point renderbuffers still
@@ -2713,7 +2925,7 @@ generate_unswizzled_blend(struct gallivm_state *gallivm,
 
    dst_type.length *= block_size / dst_count;
 
-   if (format_expands_to_float_soa(out_format_desc)) {
+   if (float_soa) {
       /*
        * we need multiple values at once for the conversion, so can as well
        * load them vectorized here too instead of concatenating later.
@@ -2825,8 +3037,8 @@ generate_unswizzled_blend(struct gallivm_state *gallivm,
     * It seems some cleanup could be done here (like skipping conversion/blend
     * when not needed).
     */
-   convert_to_blend_type(gallivm, block_size, out_format_desc, dst_type,
-                         row_type, dst, src_count);
+   convert_to_blend_type(gallivm, block_size, out_format_desc, float_soa,
+                         dst_type, row_type, dst, src_count);
 
    /*
     * FIXME: Really should get logic ops / masks out of generic blend / row
@@ -2852,7 +3064,7 @@ generate_unswizzled_blend(struct gallivm_state *gallivm,
                                   pad_inline ? 4 : dst_channels);
    }
 
-   convert_from_blend_type(gallivm, block_size, out_format_desc,
+   convert_from_blend_type(gallivm, block_size, out_format_desc, float_soa,
                            row_type, dst_type, dst, src_count);
 
    /* Split the blend rows back to memory rows */
@@ -2898,181 +3110,91 @@ generate_unswizzled_blend(struct gallivm_state *gallivm,
 }
 
 
+/** Read the CPU's cycle counter, e.g. rdtsc on x86 */
+static LLVMValueRef
+lp_fs_profile_cycles(struct gallivm_state *gallivm)
+{
+   return lp_build_intrinsic(gallivm->builder, "llvm.readcyclecounter",
+                             LLVMInt64TypeInContext(gallivm->context),
+                             NULL, 0, 0);
+}
+
+
 /**
- * Generate the runtime callable function for the whole fragment pipeline.
- * Note that the function which we generate operates on a block of 16
- * pixels at at time.  The block contains 2x2 quads.  Each quad contains
- * 2x2 pixels.
+ * Atomically add an int64 value to one of variant->profile's counters.
+ * The counter's address is baked into the code, which therefore can't
+ * be cached.
  */
 static void
-generate_fragment(struct llvmpipe_context *lp,
-                  struct lp_fragment_shader *shader,
-                  struct lp_fragment_shader_variant *variant,
-                  unsigned partial_mask)
+lp_fs_profile_add(struct gallivm_state *gallivm, uint64_t *counter,
+                  LLVMValueRef value)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef ptr = lp_build_const_int_pointer(gallivm, counter);
+
+   ptr = LLVMBuildBitCast(builder, ptr,
+                          LLVMPointerType(LLVMInt64TypeInContext(gallivm->context), 0),
+                          "");
+   LLVMBuildAtomicRMW(builder, LLVMAtomicRMWBinOpAdd, ptr, value,
+                      LLVMAtomicOrderingMonotonic, false);
+   if (gallivm->cache)
+      gallivm->cache->dont_cache = true;
+}
+
+
+/**
+ * Generate the shading of one 4x4 block, from the interpolation to the
+ * blending, at x, y with the given color and depth block pointers.
+ * partial_mask selects the edge test, reading the coverage from
+ * mask_input, rather than assuming it full.
+ */
+static void
+generate_fragment_block(struct llvmpipe_context *lp,
+                        struct lp_fragment_shader *shader,
+                        struct lp_fragment_shader_variant *variant,
+                        unsigned partial_mask,
+                        const struct lp_shader_input *inputs,
+                        struct lp_type fs_type,
+                        LLVMTypeRef blend_vec_type,
+                        LLVMValueRef context_ptr,
+                        LLVMValueRef x,
+                        LLVMValueRef y,
+                        LLVMValueRef facing,
+                        LLVMValueRef a0_ptr,
+                        LLVMValueRef dadx_ptr,
+                        LLVMValueRef dady_ptr,
+                        LLVMValueRef color_ptr_ptr,
+                        LLVMValueRef depth_ptr,
+                        LLVMValueRef mask_input,
+                        LLVMValueRef thread_data_ptr,
+                        LLVMValueRef stride_ptr,
+                        LLVMValueRef depth_stride,
+                        LLVMValueRef color_sample_stride_ptr,
+                        LLVMValueRef depth_sample_stride)
 {
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
    struct gallivm_state *gallivm = variant->gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
    struct lp_fragment_shader_variant_key *key = &variant->key;
-   struct lp_shader_input inputs[PIPE_MAX_SHADER_INPUTS];
-   char func_name[64];
-   struct lp_type fs_type;
-   struct lp_type blend_type;
-   LLVMTypeRef fs_elem_type;
-   LLVMTypeRef blend_vec_type;
-   LLVMTypeRef arg_types[15];
-   LLVMTypeRef func_type;
    LLVMTypeRef int32_type = LLVMInt32TypeInContext(gallivm->context);
-   LLVMTypeRef int8_type = LLVMInt8TypeInContext(gallivm->context);
-   LLVMValueRef context_ptr;
-   LLVMValueRef x;
-   LLVMValueRef y;
-   LLVMValueRef a0_ptr;
-   LLVMValueRef dadx_ptr;
-   LLVMValueRef dady_ptr;
-   LLVMValueRef color_ptr_ptr;
-   LLVMValueRef stride_ptr;
-   LLVMValueRef color_sample_stride_ptr;
-   LLVMValueRef depth_ptr;
-   LLVMValueRef depth_stride;
-   LLVMValueRef depth_sample_stride;
-   LLVMValueRef mask_input;
-   LLVMValueRef thread_data_ptr;
-   LLVMBasicBlockRef block;
-   LLVMBuilderRef builder;
    struct lp_build_sampler_soa *sampler;
+   LLVMValueRef profile_start = NULL, profile_blend = NULL;
    struct lp_build_image_soa *image;
    struct lp_build_interp_soa_context interp;
    LLVMValueRef fs_mask[(16 / 4) * LP_MAX_SAMPLES];
    LLVMValueRef fs_out_color[LP_MAX_SAMPLES][PIPE_MAX_COLOR_BUFS][TGSI_NUM_CHANNELS][16 / 4];
-   LLVMValueRef function;
-   LLVMValueRef facing;
    unsigned num_fs;
    unsigned i;
    unsigned chan;
    unsigned cbuf;
-   boolean cbuf0_write_all;
-   const boolean dual_source_blend = key->blend.rt[0].blend_enable &&
-                                     util_blend_state_is_dual(&key->blend, 0);
-
-   assert(lp_native_vector_width / 32 >= 4);
-
-   /* Adjust color input interpolation according to flatshade state:
-    */
-   memcpy(inputs, shader->inputs, shader->info.base.num_inputs * sizeof inputs[0]);
-   for (i = 0; i < shader->info.base.num_inputs; i++) {
-      if (inputs[i].interp == LP_INTERP_COLOR) {
-	 if (key->flatshade)
-	    inputs[i].interp = LP_INTERP_CONSTANT;
-	 else
-	    inputs[i].interp = LP_INTERP_PERSPECTIVE;
-      }
-   }
-
    /* check if writes to cbuf[0] are to be copied to all cbufs */
-   cbuf0_write_all =
+   const boolean cbuf0_write_all =
      shader->info.base.properties[TGSI_PROPERTY_FS_COLOR0_WRITES_ALL_CBUFS];
+   const boolean dual_source_blend = key->blend.rt[0].blend_enable &&
+                                     util_blend_state_is_dual(&key->blend, 0);
 
-   /* TODO: actually pick these based on the fs and color buffer
-    * characteristics. */
-
-   memset(&fs_type, 0, sizeof fs_type);
-   fs_type.floating = TRUE;      /* floating point values */
-   fs_type.sign = TRUE;          /* values are signed */
-   fs_type.norm = FALSE;         /* values are not limited to [0,1] or [-1,1] */
-   fs_type.width = 32;           /* 32-bit float */
-   fs_type.length = MIN2(lp_native_vector_width / 32, 16); /* n*4 elements per vector */
-
-   memset(&blend_type, 0, sizeof blend_type);
-   blend_type.floating = FALSE; /* values are integers */
-   blend_type.sign = FALSE;     /* values are unsigned */
-   blend_type.norm = TRUE;      /* values are in [0,1] or [-1,1] */
-   blend_type.width = 8;        /* 8-bit ubyte values */
-   blend_type.length = 16;      /* 16 elements per vector */
-
-   /* 
-    * Generate the function prototype. Any change here must be reflected in
-    * lp_jit.h's lp_jit_frag_func function pointer type, and vice-versa.
-    */
-
-   fs_elem_type = lp_build_elem_type(gallivm, fs_type);
-
-   blend_vec_type = lp_build_vec_type(gallivm, blend_type);
-
-   snprintf(func_name, sizeof(func_name), "fs_variant_%s",
-            partial_mask ? "partial" : "whole");
-
-   arg_types[0] = variant->jit_context_ptr_type;       /* context */
-   arg_types[1] = int32_type;                          /* x */
-   arg_types[2] = int32_type;                          /* y */
-   arg_types[3] = int32_type;                          /* facing */
-   arg_types[4] = LLVMPointerType(fs_elem_type, 0);    /* a0 */
-   arg_types[5] = LLVMPointerType(fs_elem_type, 0);    /* dadx */
-   arg_types[6] = LLVMPointerType(fs_elem_type, 0);    /* dady */
-   arg_types[7] = LLVMPointerType(LLVMPointerType(int8_type, 0), 0);  /* color */
-   arg_types[8] = LLVMPointerType(int8_type, 0);       /* depth */
-   arg_types[9] = LLVMInt64TypeInContext(gallivm->context);  /* mask_input */
-   arg_types[10] = variant->jit_thread_data_ptr_type;  /* per thread data */
-   arg_types[11] = LLVMPointerType(int32_type, 0);     /* stride */
-   arg_types[12] = int32_type;                         /* depth_stride */
-   arg_types[13] = LLVMPointerType(int32_type, 0);     /* color sample strides */
-   arg_types[14] = int32_type;                         /* depth sample stride */
-
-   func_type = LLVMFunctionType(LLVMVoidTypeInContext(gallivm->context),
-                                arg_types, ARRAY_SIZE(arg_types), 0);
-
-   function = LLVMAddFunction(gallivm->module, func_name, func_type);
-   LLVMSetFunctionCallConv(function, LLVMCCallConv);
-
-   variant->function[partial_mask] = function;
-
-   /* XXX: need to propagate noalias down into color param now we are
-    * passing a pointer-to-pointer?
-    */
-   for(i = 0; i < ARRAY_SIZE(arg_types); ++i)
-      if(LLVMGetTypeKind(arg_types[i]) == LLVMPointerTypeKind)
-         lp_add_function_attr(function, i + 1, LP_FUNC_ATTR_NOALIAS);
-
-   if (variant->gallivm->cache->data_size)
-      return;
-
-   context_ptr  = LLVMGetParam(function, 0);
-   x            = LLVMGetParam(function, 1);
-   y            = LLVMGetParam(function, 2);
-   facing       = LLVMGetParam(function, 3);
-   a0_ptr       = LLVMGetParam(function, 4);
-   dadx_ptr     = LLVMGetParam(function, 5);
-   dady_ptr     = LLVMGetParam(function, 6);
-   color_ptr_ptr = LLVMGetParam(function, 7);
-   depth_ptr    = LLVMGetParam(function, 8);
-   mask_input   = LLVMGetParam(function, 9);
-   thread_data_ptr  = LLVMGetParam(function, 10);
-   stride_ptr   = LLVMGetParam(function, 11);
-   depth_stride = LLVMGetParam(function, 12);
-   color_sample_stride_ptr = LLVMGetParam(function, 13);
-   depth_sample_stride = LLVMGetParam(function, 14);
-
-   lp_build_name(context_ptr, "context");
-   lp_build_name(x, "x");
-   lp_build_name(y, "y");
-   lp_build_name(a0_ptr, "a0");
-   lp_build_name(dadx_ptr, "dadx");
-   lp_build_name(dady_ptr, "dady");
-   lp_build_name(color_ptr_ptr, "color_ptr_ptr");
-   lp_build_name(depth_ptr, "depth");
-   lp_build_name(mask_input, "mask_input");
-   lp_build_name(thread_data_ptr, "thread_data");
-   lp_build_name(stride_ptr, "stride_ptr");
-   lp_build_name(depth_stride, "depth_stride");
-   lp_build_name(color_sample_stride_ptr, "color_sample_stride_ptr");
-   lp_build_name(depth_sample_stride, "depth_sample_stride");
-
-   /*
-    * Function body
-    */
-
-   block = LLVMAppendBasicBlockInContext(gallivm->context, function, "entry");
-   builder = gallivm->builder;
-   assert(builder);
-   LLVMPositionBuilderAtEnd(builder, block);
+   if (LP_PERF & PERF_PROFILE_FS)
+      profile_start = lp_fs_profile_cycles(gallivm);
 
    /*
     * Must not count ps invocations if there's a null shader.
@@ -3083,7 +3205,7 @@ generate_fragment(struct llvmpipe_context *lp,
     * Could use popcount on mask, but pixel accuracy is not required.
     * Could disable if there's no stats query, but maybe not worth it.
     */
-   if (shader->info.base.num_instructions > 1) {
+   if (shader->info.base.num_instructions > 1 && !key->depth_only) {
       LLVMValueRef invocs, val;
       invocs = lp_jit_thread_data_invocations(gallivm, thread_data_ptr);
       val = LLVMBuildLoad(builder, invocs, "");
@@ -3094,7 +3216,8 @@ generate_fragment(struct llvmpipe_context *lp,
    }
 
    /* code generated texture sampling */
-   sampler = lp_llvm_sampler_soa_create(key->samplers, key->nr_samplers);
+   sampler = lp_llvm_sampler_soa_create(key->samplers, key->nr_samplers,
+                                        screen->texture_cache_size != 0);
    image = lp_llvm_image_soa_create(lp_fs_variant_key_images(key), key->nr_images);
 
    num_fs = 16 / fs_type.length; /* number of loops per 4x4 stamp */
@@ -3113,13 +3236,13 @@ generate_fragment(struct llvmpipe_context *lp,
       LLVMValueRef glob_sample_pos = LLVMAddGlobal(gallivm->module, LLVMArrayType(flt_type, key->coverage_samples * 2), "");
       LLVMValueRef sample_pos_array;
 
-      if (key->multisample && key->coverage_samples == 4) {
-         LLVMValueRef sample_pos_arr[8];
-         for (unsigned i = 0; i < 4; i++) {
-            sample_pos_arr[i * 2] = LLVMConstReal(flt_type, lp_sample_pos_4x[i][0]);
-            sample_pos_arr[i * 2 + 1] = LLVMConstReal(flt_type, lp_sample_pos_4x[i][1]);
-         }
-         sample_pos_array = LLVMConstArray(LLVMFloatTypeInContext(gallivm->context), sample_pos_arr, 8);
+      if (key->multisample && lp_sample_pos(key->coverage_samples)) {
+         const float *pos = lp_sample_pos(key->coverage_samples);
+         LLVMValueRef sample_pos_arr[LP_MAX_SAMPLES * 2];
+         for (unsigned i = 0; i < key->coverage_samples * 2; i++)
+            sample_pos_arr[i] = LLVMConstReal(flt_type, pos[i]);
+         sample_pos_array = LLVMConstArray(LLVMFloatTypeInContext(gallivm->context), sample_pos_arr,
+                                           key->coverage_samples * 2);
       } else {
          LLVMValueRef sample_pos_arr[2];
          sample_pos_arr[0] = LLVMConstReal(flt_type, 0.5);
@@ -3139,7 +3262,7 @@ generate_fragment(struct llvmpipe_context *lp,
        */
       lp_build_interp_soa_init(&interp,
                                gallivm,
-                               shader->info.base.num_inputs,
+                               shader->info.base.num_inputs + key->aa_line,
                                inputs,
                                pixel_center_integer,
                                key->coverage_samples, glob_sample_pos,
@@ -3149,6 +3272,9 @@ generate_fragment(struct llvmpipe_context *lp,
                                a0_ptr, dadx_ptr, dady_ptr,
                                x, y);
 
+      /* The NIR path fetches inputs through fs_load_input() */
+      interp.lazy_inputs = shader->base.type != PIPE_SHADER_IR_TGSI;
+
       for (i = 0; i < num_fs; i++) {
          if (key->multisample) {
             LLVMValueRef smask_val = LLVMBuildLoad(builder, lp_jit_context_sample_mask(gallivm, context_ptr), "");
@@ -3192,7 +3318,9 @@ generate_fragment(struct llvmpipe_context *lp,
       }
 
       generate_fs_loop(gallivm,
-                       shader, key,
+                       shader,
+                       variant->nir ? variant->nir : shader->base.ir.nir,
+                       key,
                        builder,
                        fs_type,
                        context_ptr,
@@ -3210,7 +3338,8 @@ generate_fragment(struct llvmpipe_context *lp,
                        stride_ptr,
                        color_sample_stride_ptr,
                        facing,
-                       thread_data_ptr);
+                       thread_data_ptr,
+                       profile_start ? &variant->profile.skipped_bodies : NULL);
 
       for (i = 0; i < num_fs; i++) {
          LLVMValueRef ptr;
@@ -3249,6 +3378,13 @@ generate_fragment(struct llvmpipe_context *lp,
 
    sampler->destroy(sampler);
    image->destroy(image);
+
+   if (profile_start) {
+      profile_blend = lp_fs_profile_cycles(gallivm);
+      lp_fs_profile_add(gallivm, &variant->profile.shader_cycles,
+                        LLVMBuildSub(builder, profile_blend, profile_start, ""));
+   }
+
    /* Loop over color outputs / color buffers to do blending.
     */
    for(cbuf = 0; cbuf < key->nr_cbufs; cbuf++) {
@@ -3299,6 +3435,312 @@ generate_fragment(struct llvmpipe_context *lp,
       }
    }
 
+   if (profile_start) {
+      LLVMTypeRef int64_type = LLVMInt64TypeInContext(gallivm->context);
+      LLVMValueRef fragments;
+
+      lp_fs_profile_add(gallivm, &variant->profile.blend_cycles,
+                        LLVMBuildSub(builder, lp_fs_profile_cycles(gallivm),
+                                     profile_blend, ""));
+      lp_fs_profile_add(gallivm, &variant->profile.blocks,
+                        LLVMConstInt(int64_type, 1, 0));
+
+      if (partial_mask || key->multisample) {
+         fragments = lp_build_intrinsic_unary(builder, "llvm.ctpop.i64",
+                                              int64_type, mask_input);
+      }
+      else {
+         fragments = LLVMConstInt(int64_type, num_fs * fs_type.length, 0);
+      }
+      lp_fs_profile_add(gallivm, &variant->profile.fragments, fragments);
+   }
+
+}
+
+
+/**
+ * Generate the RAST_WHOLE_8X8 function's body: the four fully covered 4x4
+ * blocks of the 8x8 block at x, y, one after the other.  The color and
+ * depth pointers passed in are those of the top left block.  Sharing one
+ * call and one function, the blocks also share the loads of the context
+ * and of the shader inputs' coefficients.
+ */
+static void
+generate_fragment_8x8(struct llvmpipe_context *lp,
+                      struct lp_fragment_shader *shader,
+                      struct lp_fragment_shader_variant *variant,
+                      const struct lp_shader_input *inputs,
+                      struct lp_type fs_type,
+                      LLVMTypeRef blend_vec_type,
+                      LLVMValueRef context_ptr,
+                      LLVMValueRef x,
+                      LLVMValueRef y,
+                      LLVMValueRef facing,
+                      LLVMValueRef a0_ptr,
+                      LLVMValueRef dadx_ptr,
+                      LLVMValueRef dady_ptr,
+                      LLVMValueRef color_ptr_ptr,
+                      LLVMValueRef depth_ptr,
+                      LLVMValueRef mask_input,
+                      LLVMValueRef thread_data_ptr,
+                      LLVMValueRef stride_ptr,
+                      LLVMValueRef depth_stride,
+                      LLVMValueRef color_sample_stride_ptr,
+                      LLVMValueRef depth_sample_stride)
+{
+   struct gallivm_state *gallivm = variant->gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   const struct lp_fragment_shader_variant_key *key = &variant->key;
+   LLVMTypeRef int8_ptr_type = LLVMPointerType(LLVMInt8TypeInContext(gallivm->context), 0);
+   LLVMValueRef block_color_ptr_ptr =
+      lp_build_array_alloca(gallivm, int8_ptr_type,
+                            lp_build_const_int32(gallivm, MAX2(key->nr_cbufs, 1)),
+                            "block_color_ptr_ptr");
+   LLVMValueRef color_ptr[PIPE_MAX_COLOR_BUFS];
+   LLVMValueRef stride[PIPE_MAX_COLOR_BUFS];
+   unsigned cbuf;
+
+   for (cbuf = 0; cbuf < key->nr_cbufs; cbuf++) {
+      LLVMValueRef index = lp_build_const_int32(gallivm, cbuf);
+
+      color_ptr[cbuf] = LLVMBuildLoad(builder,
+                                      LLVMBuildGEP(builder, color_ptr_ptr,
+                                                   &index, 1, ""), "");
+      stride[cbuf] = LLVMBuildLoad(builder,
+                                   LLVMBuildGEP(builder, stride_ptr,
+                                                &index, 1, ""), "");
+   }
+
+   for (unsigned blk = 0; blk < 4; blk++) {
+      unsigned bx = (blk & 1) * 4, by = (blk >> 1) * 4;
+      LLVMValueRef block_depth_ptr = depth_ptr;
+      LLVMValueRef offset;
+
+      for (cbuf = 0; cbuf < key->nr_cbufs; cbuf++) {
+         LLVMValueRef index = lp_build_const_int32(gallivm, cbuf);
+         LLVMValueRef ptr = color_ptr[cbuf];
+
+         if (key->cbuf_format[cbuf] != PIPE_FORMAT_NONE) {
+            offset = LLVMBuildMul(builder, stride[cbuf],
+                                  lp_build_const_int32(gallivm, by), "");
+            offset = LLVMBuildAdd(builder, offset,
+                                  lp_build_const_int32(gallivm, bx *
+                                     util_format_get_blocksize(key->cbuf_format[cbuf])), "");
+            ptr = LLVMBuildGEP(builder, ptr, &offset, 1, "");
+         }
+         LLVMBuildStore(builder, ptr,
+                        LLVMBuildGEP(builder, block_color_ptr_ptr, &index, 1, ""));
+      }
+
+      if (key->zsbuf_format != PIPE_FORMAT_NONE) {
+         offset = LLVMBuildMul(builder, depth_stride,
+                               lp_build_const_int32(gallivm, by), "");
+         offset = LLVMBuildAdd(builder, offset,
+                               lp_build_const_int32(gallivm, bx *
+                                  util_format_get_blocksize(key->zsbuf_format)), "");
+         block_depth_ptr = LLVMBuildGEP(builder, depth_ptr, &offset, 1, "");
+      }
+
+      generate_fragment_block(lp, shader, variant, RAST_WHOLE, inputs,
+                              fs_type, blend_vec_type, context_ptr,
+                              LLVMBuildAdd(builder, x,
+                                           lp_build_const_int32(gallivm, bx), ""),
+                              LLVMBuildAdd(builder, y,
+                                           lp_build_const_int32(gallivm, by), ""),
+                              facing, a0_ptr, dadx_ptr, dady_ptr,
+                              block_color_ptr_ptr, block_depth_ptr, mask_input,
+                              thread_data_ptr, stride_ptr, depth_stride,
+                              color_sample_stride_ptr, depth_sample_stride);
+   }
+}
+
+
+/**
+ * Generate the runtime callable function for the whole fragment pipeline.
+ * Note that the function which we generate operates on a block of 16
+ * pixels at at time.  The block contains 2x2 quads.  Each quad contains
+ * 2x2 pixels.  The RAST_WHOLE_8X8 function does four such blocks.
+ */
+static void
+generate_fragment(struct llvmpipe_context *lp,
+                  struct lp_fragment_shader *shader,
+                  struct lp_fragment_shader_variant *variant,
+                  unsigned partial_mask)
+{
+   struct gallivm_state *gallivm = variant->gallivm;
+   struct lp_fragment_shader_variant_key *key = &variant->key;
+   struct lp_shader_input inputs[PIPE_MAX_SHADER_INPUTS];
+   char func_name[64];
+   struct lp_type fs_type;
+   struct lp_type blend_type;
+   LLVMTypeRef fs_elem_type;
+   LLVMTypeRef blend_vec_type;
+   LLVMTypeRef arg_types[15];
+   LLVMTypeRef func_type;
+   LLVMTypeRef int32_type = LLVMInt32TypeInContext(gallivm->context);
+   LLVMTypeRef int8_type = LLVMInt8TypeInContext(gallivm->context);
+   LLVMValueRef context_ptr;
+   LLVMValueRef x;
+   LLVMValueRef y;
+   LLVMValueRef a0_ptr;
+   LLVMValueRef dadx_ptr;
+   LLVMValueRef dady_ptr;
+   LLVMValueRef color_ptr_ptr;
+   LLVMValueRef stride_ptr;
+   LLVMValueRef color_sample_stride_ptr;
+   LLVMValueRef depth_ptr;
+   LLVMValueRef depth_stride;
+   LLVMValueRef depth_sample_stride;
+   LLVMValueRef mask_input;
+   LLVMValueRef thread_data_ptr;
+   LLVMBasicBlockRef block;
+   LLVMBuilderRef builder;
+   LLVMValueRef function;
+   LLVMValueRef facing;
+   unsigned i;
+
+   assert(lp_native_vector_width / 32 >= 4);
+
+   /* Adjust color input interpolation according to flatshade state:
+    */
+   memcpy(inputs, shader->inputs, shader->info.base.num_inputs * sizeof inputs[0]);
+   for (i = 0; i < shader->info.base.num_inputs; i++) {
+      if (inputs[i].interp == LP_INTERP_COLOR) {
+	 if (key->flatshade)
+	    inputs[i].interp = LP_INTERP_CONSTANT;
+	 else
+	    inputs[i].interp = LP_INTERP_PERSPECTIVE;
+      }
+   }
+
+   /* The smooth line edge distances follow the shader's inputs, as in
+    * the setup variant key.
+    */
+   if (key->aa_line) {
+      memset(&inputs[i], 0, sizeof inputs[i]);
+      inputs[i].interp = LP_INTERP_AA_LINE;
+      inputs[i].usage_mask = TGSI_WRITEMASK_XYZW;
+   }
+
+   /* TODO: actually pick these based on the fs and color buffer
+    * characteristics. */
+
+   memset(&fs_type, 0, sizeof fs_type);
+   fs_type.floating = TRUE;      /* floating point values */
+   fs_type.sign = TRUE;          /* values are signed */
+   fs_type.norm = FALSE;         /* values are not limited to [0,1] or [-1,1] */
+   fs_type.width = 32;           /* 32-bit float */
+   fs_type.length = MIN2(lp_native_vector_width, LP_FS_MAX_VECTOR_WIDTH) / 32; /* n*4 elements per vector */
+
+   memset(&blend_type, 0, sizeof blend_type);
+   blend_type.floating = FALSE; /* values are integers */
+   blend_type.sign = FALSE;     /* values are unsigned */
+   blend_type.norm = TRUE;      /* values are in [0,1] or [-1,1] */
+   blend_type.width = 8;        /* 8-bit ubyte values */
+   blend_type.length = 16;      /* 16 elements per vector */
+
+   /* 
+    * Generate the function prototype. Any change here must be reflected in
+    * lp_jit.h's lp_jit_frag_func function pointer type, and vice-versa.
+    */
+
+   fs_elem_type = lp_build_elem_type(gallivm, fs_type);
+
+   blend_vec_type = lp_build_vec_type(gallivm, blend_type);
+
+   snprintf(func_name, sizeof(func_name), "fs_variant_%s",
+            partial_mask == RAST_WHOLE_8X8 ? "whole8x8" :
+            partial_mask ? "partial" : "whole");
+
+   arg_types[0] = variant->jit_context_ptr_type;       /* context */
+   arg_types[1] = int32_type;                          /* x */
+   arg_types[2] = int32_type;                          /* y */
+   arg_types[3] = int32_type;                          /* facing */
+   arg_types[4] = LLVMPointerType(fs_elem_type, 0);    /* a0 */
+   arg_types[5] = LLVMPointerType(fs_elem_type, 0);    /* dadx */
+   arg_types[6] = LLVMPointerType(fs_elem_type, 0);    /* dady */
+   arg_types[7] = LLVMPointerType(LLVMPointerType(int8_type, 0), 0);  /* color */
+   arg_types[8] = LLVMPointerType(int8_type, 0);       /* depth */
+   arg_types[9] = LLVMPointerType(LLVMInt64TypeInContext(gallivm->context), 0);  /* mask_input */
+   arg_types[10] = variant->jit_thread_data_ptr_type;  /* per thread data */
+   arg_types[11] = LLVMPointerType(int32_type, 0);     /* stride */
+   arg_types[12] = int32_type;                         /* depth_stride */
+   arg_types[13] = LLVMPointerType(int32_type, 0);     /* color sample strides */
+   arg_types[14] = int32_type;                         /* depth sample stride */
+
+   func_type = LLVMFunctionType(LLVMVoidTypeInContext(gallivm->context),
+                                arg_types, ARRAY_SIZE(arg_types), 0);
+
+   function = LLVMAddFunction(gallivm->module, func_name, func_type);
+   LLVMSetFunctionCallConv(function, LLVMCCallConv);
+
+   variant->function[partial_mask] = function;
+
+   /* XXX: need to propagate noalias down into color param now we are
+    * passing a pointer-to-pointer?
+    */
+   for(i = 0; i < ARRAY_SIZE(arg_types); ++i)
+      if(LLVMGetTypeKind(arg_types[i]) == LLVMPointerTypeKind)
+         lp_add_function_attr(function, i + 1, LP_FUNC_ATTR_NOALIAS);
+
+   if (variant->gallivm->cache->data_size)
+      return;
+
+   context_ptr  = LLVMGetParam(function, 0);
+   x            = LLVMGetParam(function, 1);
+   y            = LLVMGetParam(function, 2);
+   facing       = LLVMGetParam(function, 3);
+   a0_ptr       = LLVMGetParam(function, 4);
+   dadx_ptr     = LLVMGetParam(function, 5);
+   dady_ptr     = LLVMGetParam(function, 6);
+   color_ptr_ptr = LLVMGetParam(function, 7);
+   depth_ptr    = LLVMGetParam(function, 8);
+   mask_input   = LLVMGetParam(function, 9);
+   thread_data_ptr  = LLVMGetParam(function, 10);
+   stride_ptr   = LLVMGetParam(function, 11);
+   depth_stride = LLVMGetParam(function, 12);
+   color_sample_stride_ptr = LLVMGetParam(function, 13);
+   depth_sample_stride = LLVMGetParam(function, 14);
+
+   lp_build_name(context_ptr, "context");
+   lp_build_name(x, "x");
+   lp_build_name(y, "y");
+   lp_build_name(a0_ptr, "a0");
+   lp_build_name(dadx_ptr, "dadx");
+   lp_build_name(dady_ptr, "dady");
+   lp_build_name(color_ptr_ptr, "color_ptr_ptr");
+   lp_build_name(depth_ptr, "depth");
+   lp_build_name(mask_input, "mask_input");
+   lp_build_name(thread_data_ptr, "thread_data");
+   lp_build_name(stride_ptr, "stride_ptr");
+   lp_build_name(depth_stride, "depth_stride");
+   lp_build_name(color_sample_stride_ptr, "color_sample_stride_ptr");
+   lp_build_name(depth_sample_stride, "depth_sample_stride");
+
+   /*
+    * Function body
+    */
+
+   block = LLVMAppendBasicBlockInContext(gallivm->context, function, "entry");
+   builder = gallivm->builder;
+   assert(builder);
+   LLVMPositionBuilderAtEnd(builder, block);
+
+   if (partial_mask == RAST_WHOLE_8X8)
+      generate_fragment_8x8(lp, shader, variant, inputs, fs_type,
+                            blend_vec_type, context_ptr, x, y, facing,
+                            a0_ptr, dadx_ptr, dady_ptr, color_ptr_ptr,
+                            depth_ptr, mask_input, thread_data_ptr,
+                            stride_ptr, depth_stride,
+                            color_sample_stride_ptr, depth_sample_stride);
+   else
+      generate_fragment_block(lp, shader, variant, partial_mask, inputs,
+                              fs_type, blend_vec_type, context_ptr, x, y,
+                              facing, a0_ptr, dadx_ptr, dady_ptr,
+                              color_ptr_ptr, depth_ptr, mask_input,
+                              thread_data_ptr, stride_ptr, depth_stride,
+                              color_sample_stride_ptr, depth_sample_stride);
+
    LLVMBuildRetVoid(builder);
 
    gallivm_verify_function(gallivm, function);
@@ -3328,6 +3770,19 @@ dump_fs_variant_key(struct lp_fragment_shader_variant_key *key)
       debug_printf("depth.format = %s\n", util_format_name(key->zsbuf_format));
       debug_printf("depth nr_samples = %d\n", key->zsbuf_nr_samples);
    }
+   if (key->runtime_ds) {
+      debug_printf("runtime_ds = 1\n");
+   }
+   if (key->depth_only) {
+      debug_printf("depth_only = 1\n");
+   }
+   if (key->aa_line) {
+      debug_printf("aa_line = 1\n");
+   }
+   if (key->inline_uniforms) {
+      for (i = 0; i < LP_MAX_INLINABLE_UNIFORMS; ++i)
+         debug_printf("inline_values[%u] = 0x%08x\n", i, key->inline_values[i]);
+   }
    if (key->depth.enabled) {
       debug_printf("depth.func = %s\n", util_str_func(key->depth.func, TRUE));
       debug_printf("depth.writemask = %u\n", key->depth.writemask);
@@ -3401,6 +3856,9 @@ dump_fs_variant_key(struct lp_fragment_shader_variant_key *key)
                    texture->pot_width,
                    texture->pot_height,
                    texture->pot_depth);
+      if (texture->const_size)
+         debug_printf("  .const_size = %ux%u\n",
+                      1 << texture->width_log2, 1 << texture->height_log2);
    }
    struct lp_image_static_state *images = lp_fs_variant_key_images(key);
    for (i = 0; i < key->nr_images; ++i) {
@@ -3431,34 +3889,337 @@ lp_debug_fs_variant(struct lp_fragment_shader_variant *variant)
       nir_print_shader(variant->shader->base.ir.nir, stderr);
    dump_fs_variant_key(&variant->key);
    debug_printf("variant->opaque = %u\n", variant->opaque);
+   debug_printf("variant->blit = %u\n", variant->blit);
+   debug_printf("variant->span.kind = %u\n", variant->span.kind);
    debug_printf("\n");
 }
 
+/**
+ * The disk cache key of a variant: its key and the shader's ir_sha1, which
+ * lp_fs_get_ir_sha1() computed once when the shader was created.
+ */
 static void
 lp_fs_get_ir_cache_key(struct lp_fragment_shader_variant *variant,
                             unsigned char ir_sha1_cache_key[20])
 {
-   struct blob blob = { 0 };
-   unsigned ir_size;
-   void *ir_binary;
-
-   blob_init(&blob);
-   nir_serialize(&blob, variant->shader->base.ir.nir, true);
-   ir_binary = blob.data;
-   ir_size = blob.size;
-
    struct mesa_sha1 ctx;
    _mesa_sha1_init(&ctx);
    _mesa_sha1_update(&ctx, &variant->key, variant->shader->variant_key_size);
-   _mesa_sha1_update(&ctx, ir_binary, ir_size);
+   _mesa_sha1_update(&ctx, variant->shader->ir_sha1,
+                     sizeof(variant->shader->ir_sha1));
+   /* The code has one more function then */
+   if (variant->whole_8x8)
+      _mesa_sha1_update(&ctx, "8x8", 3);
    _mesa_sha1_final(&ctx, ir_sha1_cache_key);
+}
+
+/**
+ * What it takes to turn a variant's IR into code, possibly on one of the
+ * screen's JIT threads.
+ */
+struct lp_fs_compile_job
+{
+   struct llvmpipe_screen *screen;
+   struct lp_fragment_shader_variant *variant;
+   LLVMContextRef context;   /**< the variant's own, if compiled async */
+   struct lp_cached_code cached;
+   unsigned char ir_sha1_cache_key[20];
+   bool needs_caching;
+};
+
+
+/**
+ * Compile the variant's module and look up its functions.
+ *
+ * When an unoptimized variant is recompiled, the rasterizer may be running
+ * the old functions meanwhile, so each new one is swapped in atomically.
+ */
+static void
+compile_variant(void *data, int thread_index)
+{
+   struct lp_fs_compile_job *job = data;
+   struct lp_fragment_shader_variant *variant = job->variant;
+   lp_jit_frag_func edge_test, whole;
+   uint64_t code_size;
+   int64_t trace_start = lp_trace_begin();
+
+   gallivm_compile_module(variant->gallivm);
+
+   code_size = gallivm_code_size(variant->gallivm);
+   p_atomic_add(&variant->memory, code_size);
+   p_atomic_add(&job->screen->shader_memory, code_size);
+
+   edge_test = (lp_jit_frag_func)
+         gallivm_jit_function(variant->gallivm,
+                              variant->function[RAST_EDGE_TEST]);
+
+   if (variant->function[RAST_WHOLE]) {
+      whole = (lp_jit_frag_func)
+            gallivm_jit_function(variant->gallivm,
+                                 variant->function[RAST_WHOLE]);
+   } else {
+      whole = edge_test;
+   }
+
+   p_atomic_set(&variant->jit_function[RAST_EDGE_TEST], edge_test);
+   p_atomic_set(&variant->jit_function[RAST_WHOLE], whole);
+   if (variant->function[RAST_WHOLE_8X8]) {
+      p_atomic_set(&variant->jit_function[RAST_WHOLE_8X8],
+                   (lp_jit_frag_func)
+                   gallivm_jit_function(variant->gallivm,
+                                        variant->function[RAST_WHOLE_8X8]));
+   }
+
+   if (job->needs_caching) {
+      lp_disk_cache_insert_shader(job->screen, &job->cached,
+                                  job->ir_sha1_cache_key);
+   }
+
+   gallivm_free_ir(variant->gallivm);
+
+   /* The generated code doesn't need the LLVM context anymore. */
+   if (job->context)
+      LLVMContextDispose(job->context);
+
+   LP_TRACE_END_ARGS("fs_compile_variant", trace_start,
+                     "shader,variant,unoptimized", variant->shader->no,
+                     variant->no, variant->gallivm->no_opt);
+}
+
+
+static void
+free_compile_job(void *data, int thread_index)
+{
+   FREE(data);
+}
+
+
+/**
+ * Clone the shader's NIR with the key's values of its inlinable uniforms,
+ * and fold them, see LP_INLINE_UNIFORMS.  The NIR was finalized, so its
+ * booleans are 32-bit already, which nir_opt_algebraic doesn't expect.
+ */
+static struct nir_shader *
+inline_fs_uniforms(struct lp_fragment_shader *shader,
+                   const struct lp_fragment_shader_variant_key *key)
+{
+   struct nir_shader *nir = nir_shader_clone(NULL, shader->inline_nir);
+   bool progress;
+
+   NIR_PASS_V(nir, nir_inline_uniforms, shader->num_inlinable_uniforms,
+              key->inline_values, shader->inlinable_uniforms);
+
+   do {
+      progress = false;
+      NIR_PASS(progress, nir, nir_copy_prop);
+      NIR_PASS(progress, nir, nir_opt_constant_folding);
+      NIR_PASS(progress, nir, nir_opt_dead_cf);
+      NIR_PASS(progress, nir, nir_opt_dce);
+   } while (progress);
+
+   return nir;
+}
+
+
+/**
+ * Whether draws with the variant of a blit shader may copy texels rather
+ * than run it.  This takes an opaque variant, and texels which get back
+ * to the same bytes when written to the color buffer.  Snorm doesn't, as
+ * -128 and -127 are both -1.0, nor does sRGB.
+ */
+static boolean
+fs_variant_is_blit(const struct lp_fragment_shader *shader,
+                   const struct lp_fragment_shader_variant *variant)
+{
+   const struct lp_fragment_shader_variant_key *key = &variant->key;
+   const struct lp_static_texture_state *texture;
+   const struct lp_static_sampler_state *sampler;
+   const struct util_format_description *desc;
+
+   if (shader->blit_input < 0 || !variant->opaque ||
+       key->nr_cbufs != 1 || key->cbuf_nr_samples[0] > 1 ||
+       key->nr_samplers < 1 || key->nr_sampler_views < 1 ||
+       key->occlusion_count || key->aa_line || key->depth_only)
+      return FALSE;
+
+   if (shader->inputs[shader->blit_input].interp != LP_INTERP_LINEAR &&
+       shader->inputs[shader->blit_input].interp != LP_INTERP_PERSPECTIVE)
+      return FALSE;
+
+   texture = &key->samplers[0].texture_state;
+   sampler = &key->samplers[0].sampler_state;
+
+   if ((texture->target != PIPE_TEXTURE_2D &&
+        texture->target != PIPE_TEXTURE_RECT) ||
+       !texture->level_zero_only || texture->tiled ||
+       texture->swizzle_r != PIPE_SWIZZLE_X ||
+       texture->swizzle_g != PIPE_SWIZZLE_Y ||
+       texture->swizzle_b != PIPE_SWIZZLE_Z ||
+       texture->swizzle_a != PIPE_SWIZZLE_W ||
+       sampler->compare_mode != PIPE_TEX_COMPARE_NONE)
+      return FALSE;
+
+   if (texture->format != key->cbuf_format[0])
+      return FALSE;
+
+   desc = util_format_description(texture->format);
+   return desc->layout == UTIL_FORMAT_LAYOUT_PLAIN &&
+          desc->block.width == 1 && desc->block.height == 1 &&
+          desc->colorspace == UTIL_FORMAT_COLORSPACE_RGB &&
+          !desc->is_snorm && !desc->is_mixed;
+}
+
+
+/**
+ * The bytes of r, g, b and a in the pixels of the formats the span path
+ * handles, with 4 for X.
+ */
+static boolean
+span_format_chans(enum pipe_format format, uint8_t chan[4])
+{
+   static const uint8_t rgba[4] = { 0, 1, 2, 3 }, rgbx[4] = { 0, 1, 2, 4 };
+   static const uint8_t bgra[4] = { 2, 1, 0, 3 }, bgrx[4] = { 2, 1, 0, 4 };
+   const uint8_t *chans;
 
-   blob_finish(&blob);
+   switch (format) {
+   case PIPE_FORMAT_R8G8B8A8_UNORM:
+      chans = rgba;
+      break;
+   case PIPE_FORMAT_R8G8B8X8_UNORM:
+      chans = rgbx;
+      break;
+   case PIPE_FORMAT_B8G8R8A8_UNORM:
+      chans = bgra;
+      break;
+   case PIPE_FORMAT_B8G8R8X8_UNORM:
+      chans = bgrx;
+      break;
+   default:
+      return FALSE;
+   }
+
+   memcpy(chan, chans, 4);
+   return TRUE;
+}
+
+
+static boolean
+span_factor(unsigned pipe_factor, enum lp_fs_span_factor *factor)
+{
+   switch (pipe_factor) {
+   case PIPE_BLENDFACTOR_ZERO:
+      *factor = LP_FS_SPAN_ZERO;
+      return TRUE;
+   case PIPE_BLENDFACTOR_ONE:
+      *factor = LP_FS_SPAN_ONE;
+      return TRUE;
+   case PIPE_BLENDFACTOR_SRC_ALPHA:
+      *factor = LP_FS_SPAN_SRC_ALPHA;
+      return TRUE;
+   case PIPE_BLENDFACTOR_INV_SRC_ALPHA:
+      *factor = LP_FS_SPAN_INV_SRC_ALPHA;
+      return TRUE;
+   default:
+      return FALSE;
+   }
 }
 
+
+/**
+ * Whether the draws of the variant may be shaded in spans of 8-bit
+ * pixels, see LP_SPANS, and how.  This takes a shader computing only
+ * color 0 from an input, a uniform or a texture, a single RGBA8-like
+ * color buffer, and no tests or blending beyond adds of scaled colors.
+ */
+static void
+fs_variant_span(const struct lp_fragment_shader *shader,
+                struct lp_fragment_shader_variant *variant)
+{
+   const struct lp_fragment_shader_variant_key *key = &variant->key;
+   const struct pipe_rt_blend_state *blend = &key->blend.rt[0];
+   struct lp_fs_span_state *span = &variant->span;
+   enum lp_fs_span_kind kind = LP_FS_SPAN_NONE;
+
+   memset(span, 0, sizeof *span);
+
+   if (key->nr_cbufs != 1 || key->cbuf_nr_samples[0] > 1 ||
+       key->multisample || key->depth.enabled || key->stencil[0].enabled ||
+       key->alpha.enabled || key->blend.logicop_enable ||
+       key->blend.alpha_to_coverage || key->occlusion_count ||
+       key->aa_line || key->depth_only ||
+       shader->info.base.uses_kill || shader->info.base.writes_samplemask ||
+       !util_format_colormask_full(util_format_description(key->cbuf_format[0]),
+                                   blend->colormask) ||
+       !span_format_chans(key->cbuf_format[0], span->dst_chan))
+      return;
+
+   /* X is written as alpha */
+   span->dst_chan[3] = MIN2(span->dst_chan[3], 3);
+
+   if (blend->blend_enable) {
+      if (blend->rgb_func != PIPE_BLEND_ADD ||
+          blend->alpha_func != PIPE_BLEND_ADD ||
+          !span_factor(blend->rgb_src_factor, &span->factor[0]) ||
+          !span_factor(blend->rgb_dst_factor, &span->factor[1]) ||
+          !span_factor(blend->alpha_src_factor, &span->factor[2]) ||
+          !span_factor(blend->alpha_dst_factor, &span->factor[3]))
+         return;
+   }
+   else {
+      span->factor[0] = span->factor[2] = LP_FS_SPAN_ONE;
+      span->factor[1] = span->factor[3] = LP_FS_SPAN_ZERO;
+   }
+
+   if (shader->color_input >= 0) {
+      switch (shader->inputs[shader->color_input].interp) {
+      case LP_INTERP_CONSTANT:
+      case LP_INTERP_LINEAR:
+      case LP_INTERP_PERSPECTIVE:
+      case LP_INTERP_COLOR:
+         kind = LP_FS_SPAN_INPUT;
+         break;
+      default:
+         break;
+      }
+   }
+   else if (shader->color_uniform >= 0) {
+      kind = LP_FS_SPAN_UNIFORM;
+   }
+   else if (shader->blit_input >= 0 &&
+            key->nr_samplers >= 1 && key->nr_sampler_views >= 1 &&
+            (shader->inputs[shader->blit_input].interp == LP_INTERP_LINEAR ||
+             shader->inputs[shader->blit_input].interp ==
+             LP_INTERP_PERSPECTIVE)) {
+      const struct lp_static_texture_state *texture =
+         &key->samplers[0].texture_state;
+      const struct lp_static_sampler_state *sampler =
+         &key->samplers[0].sampler_state;
+
+      if ((texture->target == PIPE_TEXTURE_2D ||
+           texture->target == PIPE_TEXTURE_RECT) &&
+          texture->level_zero_only && !texture->tiled &&
+          texture->swizzle_r == PIPE_SWIZZLE_X &&
+          texture->swizzle_g == PIPE_SWIZZLE_Y &&
+          texture->swizzle_b == PIPE_SWIZZLE_Z &&
+          texture->swizzle_a == PIPE_SWIZZLE_W &&
+          sampler->compare_mode == PIPE_TEX_COMPARE_NONE &&
+          span_format_chans(texture->format, span->src_chan))
+         kind = LP_FS_SPAN_TEXTURE;
+   }
+
+   span->kind = kind;
+}
+
+
 /**
  * Generate a new fragment shader variant from the shader code and
  * other state indicated by the key.
+ *
+ * With LP_JIT_THREADS, only the IR is built here, and the variant is
+ * compiled in the background.  The rasterizer waits for variant->fence
+ * before it uses the variant, so only the bins which need it stall.
+ * With LP_JIT_TIER_UP too, variants which aren't in the disk cache are
+ * compiled unoptimized, see llvmpipe_tier_up_fs().
  */
 static struct lp_fragment_shader_variant *
 generate_variant(struct llvmpipe_context *lp,
@@ -3467,35 +4228,80 @@ generate_variant(struct llvmpipe_context *lp,
 {
    struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
    struct lp_fragment_shader_variant *variant;
+   struct lp_fs_compile_job *job;
    const struct util_format_description *cbuf0_format_desc = NULL;
    boolean fullcolormask;
    char module_name[64];
-   unsigned char ir_sha1_cache_key[20];
-   struct lp_cached_code cached = { 0 };
-   bool needs_caching = false;
+   int64_t trace_start = lp_trace_begin();
    variant = MALLOC(sizeof *variant + shader->variant_key_size - sizeof variant->key);
    if (!variant)
       return NULL;
 
+   job = CALLOC_STRUCT(lp_fs_compile_job);
+   if (!job) {
+      FREE(variant);
+      return NULL;
+   }
+
    memset(variant, 0, sizeof(*variant));
    snprintf(module_name, sizeof(module_name), "fs%u_variant%u",
             shader->no, shader->variants_created);
 
    variant->shader = shader;
    memcpy(&variant->key, key, shader->variant_key_size);
+   util_queue_fence_init(&variant->fence);
+   util_queue_fence_init(&variant->tier_up_fence);
+   variant->whole_8x8 = screen->fs_8x8 && !key->multisample &&
+                        !key->resource_1d;
+   variant->inner_coverage = shader->base.ir.nir &&
+      ((nir_shader *)shader->base.ir.nir)->info.fs.inner_coverage;
 
-   if (shader->base.ir.nir) {
-      lp_fs_get_ir_cache_key(variant, ir_sha1_cache_key);
+   job->screen = screen;
+   job->variant = variant;
 
-      lp_disk_cache_find_shader(screen, &cached, ir_sha1_cache_key);
-      if (!cached.data_size)
-         needs_caching = true;
+   /* Cached code doesn't count into variant->profile */
+   if (shader->base.ir.nir && !(LP_PERF & PERF_PROFILE_FS)) {
+      lp_fs_get_ir_cache_key(variant, job->ir_sha1_cache_key);
+
+      lp_disk_cache_find_shader(screen, &job->cached, job->ir_sha1_cache_key);
+      if (!job->cached.data_size)
+         job->needs_caching = true;
+   }
+
+   /* LLVM contexts aren't thread safe, so a variant compiled in the
+    * background gets a context of its own.
+    */
+   if (util_queue_is_initialized(&screen->jit_queue)) {
+      job->context = LLVMContextCreate();
+      if (!job->context) {
+         util_queue_fence_destroy(&variant->fence);
+         util_queue_fence_destroy(&variant->tier_up_fence);
+         FREE(job);
+         FREE(variant);
+         return NULL;
+      }
+
+      /* The unoptimized code isn't worth caching. */
+      if (screen->jit_tier_up && !job->cached.data_size) {
+         variant->unoptimized = TRUE;
+         job->needs_caching = false;
+      }
    }
-   variant->gallivm = gallivm_create(module_name, lp->context, &cached);
+
+   variant->gallivm = gallivm_create(module_name,
+                                     job->context ? job->context : lp->context,
+                                     variant->unoptimized ? NULL : &job->cached);
    if (!variant->gallivm) {
+      if (job->context)
+         LLVMContextDispose(job->context);
+      util_queue_fence_destroy(&variant->fence);
+      util_queue_fence_destroy(&variant->tier_up_fence);
+      FREE(job);
       FREE(variant);
       return NULL;
    }
+   gallivm_use_code_arena(variant->gallivm, screen->code_arena);
+   variant->gallivm->no_opt = variant->unoptimized;
 
    variant->list_item_global.base = variant;
    variant->list_item_local.base = variant;
@@ -3525,6 +4331,17 @@ generate_variant(struct llvmpipe_context *lp,
          !shader->info.base.writes_samplemask
       ? TRUE : FALSE;
 
+   variant->blit = fs_variant_is_blit(shader, variant);
+   if (screen->spans)
+      fs_variant_span(shader, variant);
+   else
+      memset(&variant->span, 0, sizeof variant->span);
+
+   if (key->inline_uniforms) {
+      variant->nir = inline_fs_uniforms(shader, key);
+      shader->inlined_variants++;
+   }
+
    if ((LP_DEBUG & DEBUG_FS) || (gallivm_debug & GALLIVM_DEBUG_IR)) {
       lp_debug_fs_variant(variant);
    }
@@ -3541,35 +4358,306 @@ generate_variant(struct llvmpipe_context *lp,
       }
    }
 
+   if (variant->whole_8x8)
+      generate_fragment(lp, shader, variant, RAST_WHOLE_8X8);
+
    /*
-    * Compile everything
+    * Compile everything.  The instructions are counted before
+    * optimization, as the module may be gone by the time the
+    * variant is inserted.
     */
 
-   gallivm_compile_module(variant->gallivm);
-
    variant->nr_instrs += lp_build_count_ir_module(variant->gallivm->module);
 
-   if (variant->function[RAST_EDGE_TEST]) {
-      variant->jit_function[RAST_EDGE_TEST] = (lp_jit_frag_func)
-            gallivm_jit_function(variant->gallivm,
-                                 variant->function[RAST_EDGE_TEST]);
+   variant->memory = sizeof *variant + shader->variant_key_size - sizeof variant->key;
+   p_atomic_add(&screen->shader_memory, variant->memory);
+
+   /* Compiles in the background are traced by their JIT thread */
+   LP_TRACE_END_ARGS("fs_generate_variant", trace_start, "shader,variant",
+                     shader->no, variant->no, 0);
+
+   if (job->context) {
+      util_queue_add_job(&screen->jit_queue, job, &variant->fence,
+                         compile_variant, free_compile_job, 0);
+   }
+   else {
+      compile_variant(job, 0);
+      free_compile_job(job, 0);
    }
 
-   if (variant->function[RAST_WHOLE]) {
-         variant->jit_function[RAST_WHOLE] = (lp_jit_frag_func)
-               gallivm_jit_function(variant->gallivm,
-                                    variant->function[RAST_WHOLE]);
-   } else if (!variant->jit_function[RAST_WHOLE]) {
-      variant->jit_function[RAST_WHOLE] = variant->jit_function[RAST_EDGE_TEST];
+   return variant;
+}
+
+
+/**
+ * All the keys of a shader have the same size, but the hash table
+ * callbacks only get to see the key, so work it out from there the same
+ * way llvmpipe_create_fs_state() does.
+ */
+static size_t
+fs_variant_key_size(const struct lp_fragment_shader_variant_key *key)
+{
+   return lp_fs_variant_key_size(MAX2(key->nr_samplers, key->nr_sampler_views),
+                                 key->nr_images);
+}
+
+
+static uint32_t
+fs_variant_key_hash(const void *key)
+{
+   return _mesa_hash_data(key, fs_variant_key_size(key));
+}
+
+
+static bool
+fs_variant_key_equal(const void *a, const void *b)
+{
+   size_t size = fs_variant_key_size(a);
+   return size == fs_variant_key_size(b) && memcmp(a, b, size) == 0;
+}
+
+
+static struct lp_fragment_shader_variant *
+get_variant(struct llvmpipe_context *lp,
+            struct lp_fragment_shader *shader,
+            const struct lp_fragment_shader_variant_key *key);
+
+
+/**
+ * Compute the sha1 identifying the shader in the variant manifest and in the
+ * disk cache keys of its variants.
+ */
+static void
+lp_fs_get_ir_sha1(struct lp_fragment_shader *shader)
+{
+   if (shader->base.ir.nir) {
+      struct blob blob;
+
+      blob_init(&blob);
+      nir_serialize(&blob, shader->base.ir.nir, true);
+      _mesa_sha1_compute(blob.data, blob.size, shader->ir_sha1);
+      blob_finish(&blob);
+   }
+   else {
+      _mesa_sha1_compute(shader->base.tokens,
+                         tgsi_num_tokens(shader->base.tokens) *
+                         sizeof(struct tgsi_token),
+                         shader->ir_sha1);
    }
+}
+
 
-   if (needs_caching) {
-      lp_disk_cache_insert_shader(screen, &cached, ir_sha1_cache_key);
+/**
+ * Follow movs and vecs back to the value a component of a source comes
+ * from.  Source and destination modifiers change it, so they stop there.
+ */
+static boolean
+chase_fs_src(nir_src src, unsigned comp,
+             nir_ssa_def **def, unsigned *def_comp)
+{
+   while (src.is_ssa) {
+      nir_alu_instr *alu;
+      const nir_alu_src *alu_src;
+
+      if (src.ssa->parent_instr->type != nir_instr_type_alu) {
+         *def = src.ssa;
+         *def_comp = comp;
+         return TRUE;
+      }
+
+      alu = nir_instr_as_alu(src.ssa->parent_instr);
+      if (alu->op == nir_op_mov)
+         alu_src = &alu->src[0];
+      else if (nir_op_is_vec(alu->op))
+         alu_src = &alu->src[comp];
+      else
+         return FALSE;
+
+      if (alu->dest.saturate || alu_src->negate || alu_src->abs)
+         return FALSE;
+
+      comp = alu_src->swizzle[alu->op == nir_op_mov ? comp : 0];
+      src = alu_src->src;
    }
 
-   gallivm_free_ir(variant->gallivm);
+   return FALSE;
+}
 
-   return variant;
+
+/**
+ * Find the input, and its channels, which a texture lookup is at, for
+ * blits: a plain 2D or RECT lookup of texture 0 with sampler 0.
+ */
+static void
+analyse_blit_tex(struct lp_fragment_shader *shader, const nir_tex_instr *tex)
+{
+   nir_variable *input = NULL;
+   nir_ssa_def *def;
+   unsigned chan[2], comp, i;
+
+   /* Only the coordinates, no bias, lod, offsets, projector or shadow */
+   if (tex->op != nir_texop_tex ||
+       (tex->sampler_dim != GLSL_SAMPLER_DIM_2D &&
+        tex->sampler_dim != GLSL_SAMPLER_DIM_RECT) ||
+       tex->is_array || tex->is_shadow ||
+       tex->texture_index != 0 || tex->sampler_index != 0 ||
+       tex->num_srcs != 1 || tex->src[0].src_type != nir_tex_src_coord ||
+       tex->coord_components != 2)
+      return;
+
+   for (i = 0; i < 2; i++) {
+      nir_intrinsic_instr *load;
+      nir_variable *load_var;
+
+      if (!chase_fs_src(tex->src[0].src, i, &def, &comp) ||
+          def->parent_instr->type != nir_instr_type_intrinsic)
+         return;
+
+      load = nir_instr_as_intrinsic(def->parent_instr);
+      if (load->intrinsic != nir_intrinsic_load_deref ||
+          nir_src_as_deref(load->src[0])->deref_type != nir_deref_type_var)
+         return;
+
+      load_var = nir_src_as_deref(load->src[0])->var;
+      if ((input && load_var != input) ||
+          load_var->data.location_frac + comp >= 4)
+         return;
+
+      input = load_var;
+      chan[i] = load_var->data.location_frac + comp;
+   }
+
+   shader->blit_input = input->data.driver_location;
+   shader->blit_chan[0] = chan[0];
+   shader->blit_chan[1] = chan[1];
+}
+
+
+/**
+ * Find out whether color 0 is all the shader computes, and whether it
+ * is a texture lookup, for blits, or all of an input or a uniform, for
+ * solid fills and gradients.  Compositors and 2D canvases draw with
+ * such shaders.  Whether blits map pixels to texels 1:1 is up to
+ * lp_setup_blit().
+ */
+static void
+analyse_fs_nir(struct lp_fragment_shader *shader, nir_shader *nir)
+{
+   nir_function_impl *impl = nir_shader_get_entrypoint(nir);
+   nir_intrinsic_instr *store = NULL;
+   nir_variable *var;
+   nir_ssa_def *color, *def;
+   unsigned comp, i;
+
+   if (!impl || !exec_list_is_singular(&impl->body))
+      return;
+
+   nir_foreach_block(block, impl) {
+      nir_foreach_instr(instr, block) {
+         switch (instr->type) {
+         case nir_instr_type_deref:
+         case nir_instr_type_load_const:
+         case nir_instr_type_tex:
+            break;
+         case nir_instr_type_alu: {
+            nir_op op = nir_instr_as_alu(instr)->op;
+            if (op != nir_op_mov && !nir_op_is_vec(op))
+               return;
+            break;
+         }
+         case nir_instr_type_intrinsic: {
+            nir_intrinsic_instr *intr = nir_instr_as_intrinsic(instr);
+            if (intr->intrinsic == nir_intrinsic_load_ubo ||
+                (intr->intrinsic == nir_intrinsic_load_deref &&
+                 nir_src_as_deref(intr->src[0])->mode == nir_var_shader_in))
+               break;
+            if (intr->intrinsic != nir_intrinsic_store_deref || store)
+               return;
+            store = intr;
+            break;
+         }
+         default:
+            return;
+         }
+      }
+   }
+
+   if (!store)
+      return;
+
+   /* All of color 0 is the same vec4 */
+   var = nir_deref_instr_get_variable(nir_src_as_deref(store->src[0]));
+   if (!var || var->data.mode != nir_var_shader_out ||
+       (var->data.location != FRAG_RESULT_COLOR &&
+        var->data.location != FRAG_RESULT_DATA0) ||
+       var->data.index != 0 ||
+       !glsl_type_is_vector(var->type) ||
+       glsl_get_vector_elements(var->type) != 4 ||
+       nir_intrinsic_write_mask(store) != 0xf ||
+       !chase_fs_src(store->src[1], 0, &color, &comp) || comp != 0 ||
+       color->num_components != 4)
+      return;
+
+   for (i = 1; i < 4; i++) {
+      if (!chase_fs_src(store->src[1], i, &def, &comp) ||
+          def != color || comp != i)
+         return;
+   }
+
+   if (color->parent_instr->type == nir_instr_type_tex) {
+      analyse_blit_tex(shader, nir_instr_as_tex(color->parent_instr));
+   }
+   else if (color->parent_instr->type == nir_instr_type_intrinsic) {
+      nir_intrinsic_instr *load = nir_instr_as_intrinsic(color->parent_instr);
+
+      if (load->intrinsic == nir_intrinsic_load_deref) {
+         nir_deref_instr *deref = nir_src_as_deref(load->src[0]);
+
+         if (deref->deref_type == nir_deref_type_var &&
+             deref->var->data.location_frac == 0)
+            shader->color_input = deref->var->data.driver_location;
+      }
+      else if (load->intrinsic == nir_intrinsic_load_ubo &&
+               color->bit_size == 32 &&
+               nir_src_is_const(load->src[0]) &&
+               nir_src_as_uint(load->src[0]) == 0 &&
+               nir_src_is_const(load->src[1]) &&
+               (nir_src_as_uint(load->src[1]) & 3) == 0 &&
+               nir_src_as_uint(load->src[1]) / 4 < INT_MAX) {
+         shader->color_uniform = nir_src_as_uint(load->src[1]) / 4;
+      }
+   }
+}
+
+
+/**
+ * Compile the variants the manifest lists for this shader now, rather than
+ * at their first draw.  With LP_JIT_THREADS they are compiled in parallel.
+ */
+static void
+prewarm_variants(struct llvmpipe_context *lp,
+                 struct lp_fragment_shader *shader)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+   char store[LP_FS_MAX_VARIANT_KEY_SIZE];
+   const struct lp_fragment_shader_variant_key *key =
+      (const struct lp_fragment_shader_variant_key *)store;
+   unsigned num_keys, i;
+   char *keys;
+
+   keys = lp_manifest_get_keys(screen, shader->ir_sha1,
+                               shader->variant_key_size, &num_keys);
+   if (!keys)
+      return;
+
+   for (i = 0; i < num_keys; i++) {
+      memcpy(store, keys + i * shader->variant_key_size,
+             shader->variant_key_size);
+      if (fs_variant_key_size(key) == shader->variant_key_size)
+         get_variant(lp, shader, key);
+   }
+
+   FREE(keys);
 }
 
 
@@ -3578,6 +4666,7 @@ llvmpipe_create_fs_state(struct pipe_context *pipe,
                          const struct pipe_shader_state *templ)
 {
    struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+   struct llvmpipe_screen *screen = llvmpipe_screen(pipe->screen);
    struct lp_fragment_shader *shader;
    int nr_samplers;
    int nr_sampler_views;
@@ -3591,7 +4680,17 @@ llvmpipe_create_fs_state(struct pipe_context *pipe,
    shader->no = fs_no++;
    make_empty_list(&shader->variants);
 
+   shader->variant_table = _mesa_hash_table_create(NULL, fs_variant_key_hash,
+                                                   fs_variant_key_equal);
+   if (!shader->variant_table) {
+      FREE(shader);
+      return NULL;
+   }
+
    shader->base.type = templ->type;
+   shader->blit_input = -1;
+   shader->color_input = -1;
+   shader->color_uniform = -1;
    if (templ->type == PIPE_SHADER_IR_TGSI) {
       /* get/save the summary info for this shader */
       lp_build_tgsi_info(templ->tokens, &shader->info);
@@ -3601,10 +4700,22 @@ llvmpipe_create_fs_state(struct pipe_context *pipe,
    } else {
       shader->base.ir.nir = templ->ir.nir;
       nir_tgsi_scan_shader(templ->ir.nir, &shader->info.base, true);
+      analyse_fs_nir(shader, templ->ir.nir);
+
+      if (screen->inline_uniforms) {
+         shader->num_inlinable_uniforms =
+            nir_find_inlinable_uniforms(templ->ir.nir,
+                                        shader->inlinable_uniforms,
+                                        LP_MAX_INLINABLE_UNIFORMS);
+         if (shader->num_inlinable_uniforms)
+            shader->inline_nir = nir_shader_clone(NULL, templ->ir.nir);
+      }
    }
 
    shader->draw_data = draw_create_fragment_shader(llvmpipe->draw, templ);
    if (shader->draw_data == NULL) {
+      ralloc_free(shader->inline_nir);
+      _mesa_hash_table_destroy(shader->variant_table, NULL);
       FREE((void *) shader->base.tokens);
       FREE(shader);
       return NULL;
@@ -3614,6 +4725,7 @@ llvmpipe_create_fs_state(struct pipe_context *pipe,
    nr_sampler_views = shader->info.base.file_max[TGSI_FILE_SAMPLER_VIEW] + 1;
    nr_images = shader->info.base.file_max[TGSI_FILE_IMAGE] + 1;
    shader->variant_key_size = lp_fs_variant_key_size(MAX2(nr_samplers, nr_sampler_views), nr_images);
+   lp_fs_get_ir_sha1(shader);
 
    for (i = 0; i < shader->info.base.num_inputs; i++) {
       shader->inputs[i].usage_mask = shader->info.base.input_usage_mask[i];
@@ -3672,6 +4784,8 @@ llvmpipe_create_fs_state(struct pipe_context *pipe,
       debug_printf("\n");
    }
 
+   prewarm_variants(llvmpipe, shader);
+
    return shader;
 }
 
@@ -3687,41 +4801,156 @@ llvmpipe_bind_fs_state(struct pipe_context *pipe, void *fs)
    draw_bind_fragment_shader(llvmpipe->draw,
                              (lp_fs ? lp_fs->draw_data : NULL));
 
-   llvmpipe->fs = lp_fs;
+   llvmpipe->fs = lp_fs;
+
+   llvmpipe->dirty |= LP_NEW_FS;
+}
+
+
+/**
+ * Remove shader variant from two lists: the shader's variant list
+ * and the context's variant list.
+ */
+static void
+llvmpipe_remove_shader_variant(struct llvmpipe_context *lp,
+                               struct lp_fragment_shader_variant *variant)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+
+   lp->fs_key_shader = NULL;
+
+   if ((LP_DEBUG & DEBUG_FS) || (gallivm_debug & GALLIVM_DEBUG_IR)) {
+      debug_printf("llvmpipe: del fs #%u var %u v created %u v cached %u "
+                   "v total cached %u inst %u total inst %u\n",
+                   variant->shader->no, variant->no,
+                   variant->shader->variants_created,
+                   variant->shader->variants_cached,
+                   lp->nr_fs_variants, variant->nr_instrs, lp->nr_fs_instrs);
+   }
+
+   /* it may still be compiling */
+   util_queue_fence_wait(&variant->fence);
+   util_queue_fence_destroy(&variant->fence);
+   util_queue_fence_wait(&variant->tier_up_fence);
+   util_queue_fence_destroy(&variant->tier_up_fence);
+
+   p_atomic_add(&screen->shader_memory, -(int64_t)variant->memory);
+
+   if ((LP_PERF & PERF_PROFILE_FS) && variant->profile.blocks) {
+      struct lp_fs_profile_record record;
+
+      record.shader_no = variant->shader->no;
+      record.variant_no = variant->no;
+      record.profile = variant->profile;
+      util_dynarray_append(&lp->fs_profile_retired,
+                           struct lp_fs_profile_record, record);
+   }
+
+   if (lp->fs_variant_unoptimized == variant)
+      lp->fs_variant_unoptimized = NULL;
+
+   gallivm_destroy(variant->gallivm);
+   if (variant->unoptimized_gallivm)
+      gallivm_destroy(variant->unoptimized_gallivm);
+   ralloc_free(variant->nir);
+
+   /* remove from shader's list */
+   remove_from_list(&variant->list_item_local);
+   _mesa_hash_table_remove_key(variant->shader->variant_table, &variant->key);
+   variant->shader->variants_cached--;
+
+   /* remove from context's list */
+   remove_from_list(&variant->list_item_global);
+   lp->nr_fs_variants--;
+   lp->nr_fs_instrs -= variant->nr_instrs;
+
+   FREE(variant);
+}
+
+
+/**
+ * Whether the JIT of all the variants of the shader is done, see
+ * LP_JIT_THREADS.
+ */
+boolean
+llvmpipe_fs_variants_compiled(struct lp_fragment_shader *shader)
+{
+   struct lp_fs_variant_list_item *li;
+
+   for (li = first_elem(&shader->variants);
+        !at_end(&shader->variants, li);
+        li = next_elem(li)) {
+      if (!util_queue_fence_is_signalled(&li->base->fence))
+         return FALSE;
+   }
+   return TRUE;
+}
+
+
+static int
+lp_fs_profile_record_compare(const void *a, const void *b)
+{
+   const struct lp_fs_profile_record *ra = a, *rb = b;
+   uint64_t ca = ra->profile.shader_cycles + ra->profile.blend_cycles;
+   uint64_t cb = rb->profile.shader_cycles + rb->profile.blend_cycles;
+
+   return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+
+/**
+ * With LP_PERF=profile, print the fs variants of the context ranked by
+ * the cycles they took, and their average cost per 4x4 block.
+ */
+void
+lp_fs_print_profile(struct llvmpipe_context *lp)
+{
+   struct util_dynarray records;
+   struct lp_fs_variant_list_item *li;
+   uint64_t total = 0;
+
+   if (!(LP_PERF & PERF_PROFILE_FS))
+      return;
+
+   util_dynarray_clone(&records, NULL, &lp->fs_profile_retired);
 
-   llvmpipe->dirty |= LP_NEW_FS;
-}
+   foreach(li, &lp->fs_variants_list) {
+      struct lp_fragment_shader_variant *variant = li->base;
+      struct lp_fs_profile_record r;
 
+      if (!variant->profile.blocks)
+         continue;
 
-/**
- * Remove shader variant from two lists: the shader's variant list
- * and the context's variant list.
- */
-static void
-llvmpipe_remove_shader_variant(struct llvmpipe_context *lp,
-                               struct lp_fragment_shader_variant *variant)
-{
-   if ((LP_DEBUG & DEBUG_FS) || (gallivm_debug & GALLIVM_DEBUG_IR)) {
-      debug_printf("llvmpipe: del fs #%u var %u v created %u v cached %u "
-                   "v total cached %u inst %u total inst %u\n",
-                   variant->shader->no, variant->no,
-                   variant->shader->variants_created,
-                   variant->shader->variants_cached,
-                   lp->nr_fs_variants, variant->nr_instrs, lp->nr_fs_instrs);
+      r.shader_no = variant->shader->no;
+      r.variant_no = variant->no;
+      r.profile = variant->profile;
+      util_dynarray_append(&records, struct lp_fs_profile_record, r);
    }
 
-   gallivm_destroy(variant->gallivm);
+   qsort(records.data,
+         util_dynarray_num_elements(&records, struct lp_fs_profile_record),
+         sizeof(struct lp_fs_profile_record), lp_fs_profile_record_compare);
 
-   /* remove from shader's list */
-   remove_from_list(&variant->list_item_local);
-   variant->shader->variants_cached--;
+   util_dynarray_foreach(&records, struct lp_fs_profile_record, record)
+      total += record->profile.shader_cycles + record->profile.blend_cycles;
 
-   /* remove from context's list */
-   remove_from_list(&variant->list_item_global);
-   lp->nr_fs_variants--;
-   lp->nr_fs_instrs -= variant->nr_instrs;
+   debug_printf("llvmpipe: fs variant profile, cycles per 4x4 block:\n");
+   debug_printf("llvmpipe:     fs variant   %%total       blocks    fragments"
+                "   shader    blend      skipped\n");
+   util_dynarray_foreach(&records, struct lp_fs_profile_record, record) {
+      const struct lp_fs_variant_profile *p = &record->profile;
 
-   FREE(variant);
+      debug_printf("llvmpipe: %6u %7u  %6.2f%% %12" PRIu64 " %12" PRIu64
+                   " %8.1f %8.1f %12" PRIu64 "\n",
+                   record->shader_no, record->variant_no,
+                   total ? 100.0 * (p->shader_cycles + p->blend_cycles) / total : 0.0,
+                   p->blocks, p->fragments,
+                   (double)p->shader_cycles / p->blocks,
+                   (double)p->blend_cycles / p->blocks,
+                   p->skipped_bodies);
+   }
+
+   util_dynarray_fini(&records);
 }
 
 
@@ -3754,7 +4983,11 @@ llvmpipe_delete_fs_state(struct pipe_context *pipe, void *fs)
 
    if (shader->base.ir.nir)
       ralloc_free(shader->base.ir.nir);
+   ralloc_free(shader->inline_nir);
+   if (llvmpipe->fs_inline_shader == shader)
+      llvmpipe->fs_inline_shader = NULL;
    assert(shader->variants_cached == 0);
+   _mesa_hash_table_destroy(shader->variant_table, NULL);
    FREE((void *) shader->base.tokens);
    FREE(shader);
 }
@@ -3776,10 +5009,20 @@ llvmpipe_set_constant_buffer(struct pipe_context *pipe,
    util_copy_constant_buffer(&llvmpipe->constants[shader][index], cb);
 
    if (constants) {
+      struct llvmpipe_resource *lpr = llvmpipe_resource(constants);
+
        if (!(constants->bind & PIPE_BIND_CONSTANT_BUFFER)) {
          debug_printf("Illegal set constant without bind flag\n");
          constants->bind |= PIPE_BIND_CONSTANT_BUFFER;
       }
+
+      /* Only the one context's scenes may read the storage in place */
+      if (lpr->constants_only) {
+         if (!lpr->constants_context)
+            lpr->constants_context = llvmpipe;
+         else if (lpr->constants_context != llvmpipe)
+            lpr->constants_only = FALSE;
+      }
    }
 
    if (shader == PIPE_SHADER_VERTEX ||
@@ -3861,6 +5104,11 @@ llvmpipe_set_shader_images(struct pipe_context *pipe,
    for (i = start_slot, idx = 0; i < start_slot + count; i++, idx++) {
       const struct pipe_image_view *image = images ? &images[idx] : NULL;
 
+      if (image && image->resource) {
+         llvmpipe_resource_untile(pipe, image->resource);
+         /* Images may be written, and their storage is cached */
+         llvmpipe_resource(image->resource)->renamable = FALSE;
+      }
       util_copy_image_view(&llvmpipe->images[shader][i], image);
    }
 
@@ -3901,6 +5149,72 @@ force_dst_alpha_one(unsigned factor, boolean clamped_zero)
 }
 
 
+/**
+ * The state fs variant keys are made of, but for the fs samplers, sampler
+ * views and images: the bound state, or the one given to precompile_fs().
+ */
+struct lp_fs_key_state
+{
+   const struct pipe_blend_state *blend;
+   const struct pipe_depth_stencil_alpha_state *depth_stencil;
+   const struct pipe_rasterizer_state *rasterizer;
+   unsigned min_samples;
+   boolean occlusion_count;
+
+   /** PIPE_FORMAT_NONE for unbound buffers */
+   unsigned nr_cbufs;
+   enum pipe_format cbuf_format[PIPE_MAX_COLOR_BUFS];
+   unsigned cbuf_nr_samples[PIPE_MAX_COLOR_BUFS];
+   enum pipe_format zsbuf_format;
+   unsigned zsbuf_nr_samples;
+   unsigned nr_samples;
+   boolean resource_1d;
+};
+
+
+static void
+get_bound_key_state(const struct llvmpipe_context *lp,
+                    struct lp_fs_key_state *state)
+{
+   const struct pipe_framebuffer_state *fb = &lp->framebuffer;
+   unsigned i;
+
+   memset(state, 0, sizeof *state);
+
+   state->blend = lp->blend;
+   state->depth_stencil = lp->depth_stencil;
+   state->rasterizer = lp->rasterizer;
+   state->min_samples = lp->min_samples;
+   state->occlusion_count = lp->active_occlusion_queries &&
+                            !lp->queries_disabled;
+
+   state->nr_cbufs = fb->nr_cbufs;
+   for (i = 0; i < fb->nr_cbufs; i++) {
+      if (fb->cbufs[i]) {
+         state->cbuf_format[i] = fb->cbufs[i]->format;
+         state->cbuf_nr_samples[i] = util_res_sample_count(fb->cbufs[i]->texture);
+
+         /*
+          * Note that OpenGL allows crazy mixing of 2d textures with height 1
+          * and 1d textures, so make sure we pick 1d if any cbuf or zsbuf is
+          * 1d.
+          */
+         if (llvmpipe_resource_is_1d(fb->cbufs[i]->texture))
+            state->resource_1d = TRUE;
+      }
+   }
+
+   if (fb->zsbuf) {
+      state->zsbuf_format = fb->zsbuf->format;
+      state->zsbuf_nr_samples = util_res_sample_count(fb->zsbuf->texture);
+      if (llvmpipe_resource_is_1d(fb->zsbuf->texture))
+         state->resource_1d = TRUE;
+   }
+
+   state->nr_samples = util_framebuffer_get_num_samples(fb);
+}
+
+
 /**
  * We need to generate several variants of the fragment pipeline to match
  * all the combinations of the contributing state atoms.
@@ -3911,6 +5225,7 @@ force_dst_alpha_one(unsigned factor, boolean clamped_zero)
 static struct lp_fragment_shader_variant_key *
 make_variant_key(struct llvmpipe_context *lp,
                  struct lp_fragment_shader *shader,
+                 const struct lp_fs_key_state *state,
                  char *store)
 {
    unsigned i;
@@ -3920,26 +5235,24 @@ make_variant_key(struct llvmpipe_context *lp,
 
    memset(key, 0, offsetof(struct lp_fragment_shader_variant_key, samplers[1]));
 
-   if (lp->framebuffer.zsbuf) {
-      enum pipe_format zsbuf_format = lp->framebuffer.zsbuf->format;
+   if (state->zsbuf_format != PIPE_FORMAT_NONE) {
+      enum pipe_format zsbuf_format = state->zsbuf_format;
       const struct util_format_description *zsbuf_desc =
          util_format_description(zsbuf_format);
 
-      if (lp->depth_stencil->depth.enabled &&
+      if (state->depth_stencil->depth.enabled &&
           util_format_has_depth(zsbuf_desc)) {
          key->zsbuf_format = zsbuf_format;
-         memcpy(&key->depth, &lp->depth_stencil->depth, sizeof key->depth);
+         memcpy(&key->depth, &state->depth_stencil->depth, sizeof key->depth);
       }
-      if (lp->depth_stencil->stencil[0].enabled &&
+      if (state->depth_stencil->stencil[0].enabled &&
           util_format_has_stencil(zsbuf_desc)) {
          key->zsbuf_format = zsbuf_format;
-         memcpy(&key->stencil, &lp->depth_stencil->stencil, sizeof key->stencil);
+         memcpy(&key->stencil, &state->depth_stencil->stencil, sizeof key->stencil);
       }
-      if (llvmpipe_resource_is_1d(lp->framebuffer.zsbuf->texture)) {
-         key->resource_1d = TRUE;
-      }
-      key->zsbuf_nr_samples = util_res_sample_count(lp->framebuffer.zsbuf->texture);
+      key->zsbuf_nr_samples = state->zsbuf_nr_samples;
    }
+   key->resource_1d = state->resource_1d;
 
    /*
     * Propagate the depth clamp setting from the rasterizer state.
@@ -3954,39 +5267,41 @@ make_variant_key(struct llvmpipe_context *lp,
     * to ensure the depth values stay in range. Doesn't look like
     * we do that, though...)
     */
-   if (lp->rasterizer->clip_halfz) {
+   if (state->rasterizer->clip_halfz) {
       key->depth_clamp = 1;
    } else {
-      key->depth_clamp = (lp->rasterizer->depth_clip_near == 0) ? 1 : 0;
+      key->depth_clamp = (state->rasterizer->depth_clip_near == 0) ? 1 : 0;
    }
 
    /* alpha test only applies if render buffer 0 is non-integer (or does not exist) */
-   if (!lp->framebuffer.nr_cbufs ||
-       !lp->framebuffer.cbufs[0] ||
-       !util_format_is_pure_integer(lp->framebuffer.cbufs[0]->format)) {
-      key->alpha.enabled = lp->depth_stencil->alpha.enabled;
+   if (!state->nr_cbufs ||
+       state->cbuf_format[0] == PIPE_FORMAT_NONE ||
+       !util_format_is_pure_integer(state->cbuf_format[0])) {
+      key->alpha.enabled = state->depth_stencil->alpha.enabled;
    }
    if(key->alpha.enabled)
-      key->alpha.func = lp->depth_stencil->alpha.func;
+      key->alpha.func = state->depth_stencil->alpha.func;
    /* alpha.ref_value is passed in jit_context */
 
-   key->flatshade = lp->rasterizer->flatshade;
-   key->multisample = lp->rasterizer->multisample;
-   if (lp->active_occlusion_queries && !lp->queries_disabled) {
-      key->occlusion_count = TRUE;
-   }
+   key->flatshade = state->rasterizer->flatshade;
+   key->multisample = state->rasterizer->multisample;
+   /* see llvmpipe_aa_lines() */
+   key->aa_line = state->rasterizer->line_smooth &&
+                  !state->rasterizer->multisample &&
+                  shader->info.base.num_inputs < PIPE_MAX_SHADER_INPUTS;
+   key->occlusion_count = state->occlusion_count;
 
-   if (lp->framebuffer.nr_cbufs) {
-      memcpy(&key->blend, lp->blend, sizeof key->blend);
+   if (state->nr_cbufs) {
+      memcpy(&key->blend, state->blend, sizeof key->blend);
    }
 
    key->coverage_samples = 1;
    key->min_samples = 1;
    if (key->multisample) {
-      key->coverage_samples = util_framebuffer_get_num_samples(&lp->framebuffer);
-      key->min_samples = lp->min_samples == 1 ? 1 : key->coverage_samples;
+      key->coverage_samples = state->nr_samples;
+      key->min_samples = state->min_samples == 1 ? 1 : key->coverage_samples;
    }
-   key->nr_cbufs = lp->framebuffer.nr_cbufs;
+   key->nr_cbufs = state->nr_cbufs;
 
    if (!key->blend.independent_blend_enable) {
       /* we always need independent blend otherwise the fixups below won't work */
@@ -3996,24 +5311,15 @@ make_variant_key(struct llvmpipe_context *lp,
       key->blend.independent_blend_enable = 1;
    }
 
-   for (i = 0; i < lp->framebuffer.nr_cbufs; i++) {
+   for (i = 0; i < state->nr_cbufs; i++) {
       struct pipe_rt_blend_state *blend_rt = &key->blend.rt[i];
 
-      if (lp->framebuffer.cbufs[i]) {
-         enum pipe_format format = lp->framebuffer.cbufs[i]->format;
+      if (state->cbuf_format[i] != PIPE_FORMAT_NONE) {
+         enum pipe_format format = state->cbuf_format[i];
          const struct util_format_description *format_desc;
 
          key->cbuf_format[i] = format;
-         key->cbuf_nr_samples[i] = util_res_sample_count(lp->framebuffer.cbufs[i]->texture);
-
-         /*
-          * Figure out if this is a 1d resource. Note that OpenGL allows crazy
-          * mixing of 2d textures with height 1 and 1d textures, so make sure
-          * we pick 1d if any cbuf or zsbuf is 1d.
-          */
-         if (llvmpipe_resource_is_1d(lp->framebuffer.cbufs[i]->texture)) {
-            key->resource_1d = TRUE;
-         }
+         key->cbuf_nr_samples[i] = state->cbuf_nr_samples[i];
 
          format_desc = util_format_description(format);
          assert(format_desc->colorspace == UTIL_FORMAT_COLORSPACE_RGB ||
@@ -4101,8 +5407,8 @@ make_variant_key(struct llvmpipe_context *lp,
           * used views may be included in the shader key.
           */
          if(shader->info.base.file_mask[TGSI_FILE_SAMPLER_VIEW] & (1u << (i & 31))) {
-            lp_sampler_static_texture_state(&fs_sampler[i].texture_state,
-                                            lp->sampler_views[PIPE_SHADER_FRAGMENT][i]);
+            llvmpipe_sampler_static_texture_state(&fs_sampler[i].texture_state,
+                                                  lp->sampler_views[PIPE_SHADER_FRAGMENT][i]);
          }
       }
    }
@@ -4110,8 +5416,8 @@ make_variant_key(struct llvmpipe_context *lp,
       key->nr_sampler_views = key->nr_samplers;
       for(i = 0; i < key->nr_sampler_views; ++i) {
          if(shader->info.base.file_mask[TGSI_FILE_SAMPLER] & (1 << i)) {
-            lp_sampler_static_texture_state(&fs_sampler[i].texture_state,
-                                            lp->sampler_views[PIPE_SHADER_FRAGMENT][i]);
+            llvmpipe_sampler_static_texture_state(&fs_sampler[i].texture_state,
+                                                  lp->sampler_views[PIPE_SHADER_FRAGMENT][i]);
          }
       }
    }
@@ -4131,30 +5437,137 @@ make_variant_key(struct llvmpipe_context *lp,
 
 
 /**
- * Update fragment shader state.  This is called just prior to drawing
- * something when some fragment-related state has changed.
+ * Turn the key into the one of the shader's generic variant, which reads
+ * the depth func and the stencil funcs, ops and masks from the jit context.
+ * \return FALSE if there's no depth/stencil test, i.e. nothing to share.
  */
-void 
-llvmpipe_update_fs(struct llvmpipe_context *lp)
+static boolean
+make_generic_variant_key(struct lp_fragment_shader_variant_key *key)
 {
-   struct lp_fragment_shader *shader = lp->fs;
-   struct lp_fragment_shader_variant_key *key;
-   struct lp_fragment_shader_variant *variant = NULL;
-   struct lp_fs_variant_list_item *li;
-   char store[LP_FS_MAX_VARIANT_KEY_SIZE];
+   unsigned i;
 
-   key = make_variant_key(lp, shader, store);
+   if (!key->depth.enabled && !key->stencil[0].enabled)
+      return FALSE;
 
-   /* Search the variants for one which matches the key */
-   li = first_elem(&shader->variants);
-   while(!at_end(&shader->variants, li)) {
-      if(memcmp(&li->base->key, key, shader->variant_key_size) == 0) {
-         variant = li->base;
-         break;
-      }
-      li = next_elem(li);
+   key->runtime_ds = 1;
+   key->depth.func = 0;
+   for (i = 0; i < 2; i++) {
+      key->stencil[i].func = 0;
+      key->stencil[i].fail_op = 0;
+      key->stencil[i].zfail_op = 0;
+      key->stencil[i].zpass_op = 0;
+      key->stencil[i].valuemask = 0;
+      /* whether stencil is written at all still decides the depth mode */
+      key->stencil[i].writemask = key->stencil[i].writemask ? 0xff : 0;
    }
 
+   return TRUE;
+}
+
+
+/**
+ * Make the keys of the z prepass variants, see LP_Z_PREPASS: a depth-only
+ * one, and one with an equal depth test and no depth write to shade the
+ * fragments left visible.
+ * \return FALSE if the state must be rasterized in a single pass.
+ */
+static boolean
+make_zprepass_keys(const struct lp_fragment_shader *shader,
+                   const struct lp_fragment_shader_variant_key *key,
+                   struct lp_fragment_shader_variant_key *depth_key,
+                   struct lp_fragment_shader_variant_key *shade_key)
+{
+   const struct tgsi_shader_info *info = &shader->info.base;
+   unsigned i;
+
+   /* With an equal test all coplanar fragments are shaded, the last one
+    * wins, which only matches the single pass with LEQUAL or GEQUAL.
+    */
+   if (!key->depth.enabled || !key->depth.writemask ||
+       (key->depth.func != PIPE_FUNC_LEQUAL &&
+        key->depth.func != PIPE_FUNC_GEQUAL))
+      return FALSE;
+
+   /* Nothing but the visible fragments may leave a trace. */
+   if (key->stencil[0].enabled ||
+       key->alpha.enabled ||
+       key->blend.alpha_to_coverage ||
+       key->blend.logicop_enable ||
+       key->multisample ||
+       key->occlusion_count ||
+       info->writes_z ||
+       info->writes_stencil ||
+       info->writes_samplemask ||
+       info->writes_memory ||
+       info->uses_kill ||
+       info->uses_fbfetch)
+      return FALSE;
+
+   for (i = 0; i < key->nr_cbufs; i++) {
+      if (key->blend.rt[key->blend.independent_blend_enable ? i : 0].blend_enable)
+         return FALSE;
+   }
+
+   memcpy(depth_key, key, shader->variant_key_size);
+   depth_key->depth_only = 1;
+   depth_key->nr_cbufs = 0;
+   memset(depth_key->cbuf_format, 0, sizeof depth_key->cbuf_format);
+   memset(depth_key->cbuf_nr_samples, 0, sizeof depth_key->cbuf_nr_samples);
+   memset(&depth_key->blend, 0, sizeof depth_key->blend);
+
+   memcpy(shade_key, key, shader->variant_key_size);
+   shade_key->depth.func = PIPE_FUNC_EQUAL;
+   shade_key->depth.writemask = 0;
+
+   return TRUE;
+}
+
+
+/**
+ * Look up the shader's variant for the given key.
+ */
+static struct lp_fragment_shader_variant *
+lookup_variant(struct lp_fragment_shader *shader,
+               const struct lp_fragment_shader_variant_key *key)
+{
+   struct hash_entry *entry;
+
+   LP_COUNT(nr_fs_variant_lookups);
+   entry = _mesa_hash_table_search_pre_hashed(shader->variant_table,
+                                              _mesa_hash_data(key, shader->variant_key_size),
+                                              key);
+   return entry ? entry->data : NULL;
+}
+
+
+/**
+ * Whether variants need to be evicted before another one is created.
+ */
+static boolean
+fs_variants_over_budget(struct llvmpipe_context *lp)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+
+   if (screen->shader_memory_budget)
+      return lp_shader_memory_over_budget(screen);
+   return lp->nr_fs_instrs >= LP_MAX_SHADER_INSTRUCTIONS;
+}
+
+
+/**
+ * Find the shader's variant for the given key, creating it if necessary.
+ */
+static struct lp_fragment_shader_variant *
+get_variant(struct llvmpipe_context *lp,
+            struct lp_fragment_shader *shader,
+            const struct lp_fragment_shader_variant_key *key)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+   struct lp_fragment_shader_variant *variant;
+
+   /* Search the variants for one which matches the key */
+   variant = lookup_variant(shader, key);
+
    if (variant) {
       /* Move this variant to the head of the list to implement LRU
        * deletion of shader's when we have too many.
@@ -4167,6 +5580,8 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
       unsigned i;
       unsigned variants_to_cull;
 
+      LP_COUNT(nr_fs_variant_misses);
+
       if (LP_DEBUG & DEBUG_FS) {
          debug_printf("%u variants,\t%u instrs,\t%u instrs/variant\n",
                       lp->nr_fs_variants,
@@ -4175,12 +5590,14 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
       }
 
       /* First, check if we've exceeded the max number of shader variants.
-       * If so, free 6.25% of them (the least recently used ones).
+       * If so, free 6.25% of them (the least recently used ones).  With a
+       * memory budget, free the least recently used ones until it fits.
        */
-      variants_to_cull = lp->nr_fs_variants >= LP_MAX_SHADER_VARIANTS ? LP_MAX_SHADER_VARIANTS / 16 : 0;
+      variants_to_cull = !screen->shader_memory_budget &&
+         lp->nr_fs_variants >= LP_MAX_SHADER_VARIANTS ? LP_MAX_SHADER_VARIANTS / 16 : 0;
 
-      if (variants_to_cull ||
-          lp->nr_fs_instrs >= LP_MAX_SHADER_INSTRUCTIONS) {
+      if (variants_to_cull || fs_variants_over_budget(lp) ||
+          llvmpipe_context_over_budget(lp)) {
          struct pipe_context *pipe = &lp->pipe;
 
          if (gallivm_debug & GALLIVM_DEBUG_PERF) {
@@ -4204,7 +5621,7 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
           * pending for destruction on flush.
           */
 
-         for (i = 0; i < variants_to_cull || lp->nr_fs_instrs >= LP_MAX_SHADER_INSTRUCTIONS; i++) {
+         for (i = 0; i < variants_to_cull || fs_variants_over_budget(lp); i++) {
             struct lp_fs_variant_list_item *item;
             if (is_empty_list(&lp->fs_variants_list)) {
                break;
@@ -4214,6 +5631,25 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
             assert(item->base);
             llvmpipe_remove_shader_variant(lp, item->base);
          }
+
+         /*
+          * Then keep under the context's memory budget, freeing the other
+          * buffers first.
+          */
+         if (lp->memory_budget) {
+            uint64_t memory;
+
+            llvmpipe_trim_memory(lp);
+            memory = llvmpipe_context_memory(lp);
+
+            while (memory > lp->memory_budget &&
+                   !is_empty_list(&lp->fs_variants_list)) {
+               struct lp_fragment_shader_variant *lru =
+                  last_elem(&lp->fs_variants_list)->base;
+               memory -= MIN2(memory, p_atomic_read(&lru->memory));
+               llvmpipe_remove_shader_variant(lp, lru);
+            }
+         }
       }
 
       /*
@@ -4229,20 +5665,424 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
       /* Put the new variant into the list */
       if (variant) {
          insert_at_head(&shader->variants, &variant->list_item_local);
+         _mesa_hash_table_insert(shader->variant_table,
+                                 &variant->key, variant);
          insert_at_head(&lp->fs_variants_list, &variant->list_item_global);
          lp->nr_fs_variants++;
          lp->nr_fs_instrs += variant->nr_instrs;
          shader->variants_cached++;
+
+         /* Inlined uniform values are unlikely to be the next run's. */
+         if (!key->inline_uniforms)
+            lp_manifest_record(llvmpipe_screen(lp->pipe.screen), shader->ir_sha1,
+                               &variant->key, shader->variant_key_size);
+      }
+   }
+
+   return variant;
+}
+
+
+/**
+ * Read the values of the fs's inlinable uniforms from constant buffer 0.
+ * \return FALSE if they aren't all in it
+ */
+static boolean
+get_fs_uniform_values(const struct llvmpipe_context *lp,
+                      const struct lp_fragment_shader *shader,
+                      uint32_t *values)
+{
+   const struct pipe_constant_buffer *cb =
+      &lp->constants[PIPE_SHADER_FRAGMENT][0];
+   const ubyte *data;
+   unsigned i;
+
+   if (cb->buffer)
+      data = (const ubyte *) llvmpipe_resource_data(cb->buffer);
+   else
+      data = (const ubyte *) cb->user_buffer;
+
+   if (!data)
+      return FALSE;
+
+   data += cb->buffer_offset;
+
+   for (i = 0; i < shader->num_inlinable_uniforms; i++) {
+      unsigned offset = shader->inlinable_uniforms[i] * 4;
+
+      if (offset + 4 > cb->buffer_size)
+         return FALSE;
+      memcpy(&values[i], data + offset, 4);
+   }
+
+   return TRUE;
+}
+
+
+/**
+ * Count the draws for which the bound fs's inlinable uniforms keep their
+ * values, see LP_INLINE_UNIFORMS.  Once there were enough, or as soon as
+ * they change, the fs variant is looked up again.
+ */
+void
+llvmpipe_check_fs_uniforms(struct llvmpipe_context *lp)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+   struct lp_fragment_shader *shader = lp->fs;
+   uint32_t values[LP_MAX_INLINABLE_UNIFORMS];
+   size_t size = shader->num_inlinable_uniforms * sizeof values[0];
+
+   if (lp->fs_inline_shader != shader || (lp->dirty & LP_NEW_FS_CONSTANTS)) {
+      if (!get_fs_uniform_values(lp, shader, values)) {
+         if (lp->fs_inline_shader)
+            lp->dirty |= LP_NEW_FS_VARIANT;
+         lp->fs_inline_shader = NULL;
+         return;
+      }
+
+      if (lp->fs_inline_shader != shader ||
+          memcmp(lp->fs_inline_values, values, size) != 0) {
+         lp->fs_inline_shader = shader;
+         memcpy(lp->fs_inline_values, values, size);
+         lp->fs_inline_draws = 0;
+         lp->dirty |= LP_NEW_FS_VARIANT;
+         return;
+      }
+   }
+
+   if (lp->fs_inline_draws < screen->inline_uniforms &&
+       ++lp->fs_inline_draws == screen->inline_uniforms)
+      lp->dirty |= LP_NEW_FS_VARIANT;
+}
+
+
+/**
+ * Put the values of the shader's inlinable uniforms into the key once they
+ * haven't changed for LP_INLINE_UNIFORMS draws.  Until the variant is
+ * compiled, or when the shader has too many already, the key is left
+ * alone, so that the variant reading them is used.
+ * \return TRUE if the inlined variant is still compiling
+ */
+static boolean
+make_inline_uniforms_key(struct llvmpipe_context *lp,
+                         struct lp_fragment_shader *shader,
+                         struct lp_fragment_shader_variant_key *key)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+   struct lp_fragment_shader_variant *variant;
+
+   if (!screen->inline_uniforms ||
+       lp->fs_inline_shader != shader ||
+       lp->fs_inline_draws < screen->inline_uniforms)
+      return FALSE;
+
+   key->inline_uniforms = 1;
+   memcpy(key->inline_values, lp->fs_inline_values,
+          shader->num_inlinable_uniforms * sizeof key->inline_values[0]);
+
+   variant = lookup_variant(shader, key);
+   if (!variant && shader->inlined_variants < LP_MAX_FS_INLINED_VARIANTS)
+      variant = get_variant(lp, shader, key);
+
+   if (variant && util_queue_fence_is_signalled(&variant->fence))
+      return FALSE;
+
+   key->inline_uniforms = 0;
+   memset(key->inline_values, 0, sizeof key->inline_values);
+   return variant != NULL;
+}
+
+
+/**
+ * Update fragment shader state.  This is called just prior to drawing
+ * something when some fragment-related state has changed.
+ *
+ * Depth/stencil states are normally compiled into the variant.  Shaders
+ * which have been specialized too often, or whose specialized variant is
+ * still compiling in the background, use the shader's generic variant
+ * instead, which has depth/stencil state read from the jit context.
+ *
+ * With LP_Z_PREPASS the z prepass variants are bound too, once they are
+ * compiled.  With LP_INLINE_UNIFORMS, the variant with the shader's
+ * uniforms inlined is used once it is compiled.
+ */
+void 
+llvmpipe_update_fs(struct llvmpipe_context *lp)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+   struct lp_fragment_shader *shader = lp->fs;
+   struct lp_fragment_shader_variant_key *key, *generic_key;
+   struct lp_fragment_shader_variant *variant;
+   struct lp_fragment_shader_variant *zprepass[2] = { NULL, NULL };
+   char store[LP_FS_MAX_VARIANT_KEY_SIZE];
+   char generic_store[LP_FS_MAX_VARIANT_KEY_SIZE];
+   char zprepass_store[2][LP_FS_MAX_VARIANT_KEY_SIZE];
+   struct lp_fs_key_state key_state;
+   boolean has_generic;
+   boolean inline_pending;
+
+   get_bound_key_state(lp, &key_state);
+   key = make_variant_key(lp, shader, &key_state, store);
+   inline_pending = make_inline_uniforms_key(lp, shader, key);
+
+   /* Only state outside the key changed, e.g. which textures are bound. */
+   if (lp->fs_key_shader == shader &&
+       memcmp(lp->fs_key, key, shader->variant_key_size) == 0) {
+      lp->fs_variant_pending = inline_pending;
+      return;
+   }
+
+   generic_key = (struct lp_fragment_shader_variant_key *)generic_store;
+   memcpy(generic_key, key, shader->variant_key_size);
+   has_generic = make_generic_variant_key(generic_key);
+
+   lp->fs_variant_pending = inline_pending;
+
+   if (has_generic &&
+       shader->variants_cached >= LP_MAX_FS_SPECIALIZED_VARIANTS &&
+       !lookup_variant(shader, key)) {
+      /* Don't specialize for yet another depth/stencil state. */
+      variant = get_variant(lp, shader, generic_key);
+   }
+   else {
+      variant = get_variant(lp, shader, key);
+
+      if (has_generic && variant &&
+          !util_queue_fence_is_signalled(&variant->fence)) {
+         struct lp_fragment_shader_variant *generic;
+
+         generic = get_variant(lp, shader, generic_key);
+
+         /* Creating the generic variant may have evicted the other one. */
+         variant = lookup_variant(shader, key);
+
+         if (generic &&
+             (!variant || util_queue_fence_is_signalled(&generic->fence))) {
+            lp->fs_variant_pending |= variant != NULL;
+            variant = generic;
+         }
+      }
+   }
+
+   if (variant && screen->z_prepass &&
+       make_zprepass_keys(shader, key,
+                          (struct lp_fragment_shader_variant_key *)zprepass_store[0],
+                          (struct lp_fragment_shader_variant_key *)zprepass_store[1])) {
+      char bound_store[LP_FS_MAX_VARIANT_KEY_SIZE];
+      const struct lp_fragment_shader_variant_key *bound_key =
+         (const struct lp_fragment_shader_variant_key *)bound_store;
+      unsigned i;
+
+      memcpy(bound_store, &variant->key, shader->variant_key_size);
+
+      zprepass[0] = get_variant(lp, shader,
+         (const struct lp_fragment_shader_variant_key *)zprepass_store[0]);
+      zprepass[1] = get_variant(lp, shader,
+         (const struct lp_fragment_shader_variant_key *)zprepass_store[1]);
+
+      /* Creating variants may have evicted the others. */
+      zprepass[0] = lookup_variant(shader,
+         (const struct lp_fragment_shader_variant_key *)zprepass_store[0]);
+      variant = lookup_variant(shader, bound_key);
+      if (!variant) {
+         variant = get_variant(lp, shader, bound_key);
+         zprepass[0] = zprepass[1] = NULL;
+      }
+
+      /* Don't wait for them, check again on the next draw. */
+      for (i = 0; i < 2; i++) {
+         if (zprepass[i] && !util_queue_fence_is_signalled(&zprepass[i]->fence)) {
+            zprepass[0] = zprepass[1] = NULL;
+            lp->fs_variant_pending = TRUE;
+            break;
+         }
       }
    }
 
    /* Bind this variant */
    lp_setup_set_fs_variant(lp->setup, variant);
+   lp_setup_set_fs_zprepass(lp->setup, zprepass[0], zprepass[1]);
+
+   lp->fs_variant_unoptimized =
+      variant && variant->unoptimized ? variant : NULL;
+
+   if (variant && !lp->fs_variant_pending) {
+      lp->fs_key_shader = shader;
+      memcpy(lp->fs_key, key, shader->variant_key_size);
+   }
+   else {
+      lp->fs_key_shader = NULL;
+   }
+}
+
+
+/**
+ * Recompile the bound fs variant with optimizations once it has run for
+ * LP_JIT_TIER_UP bins.  Only the IR is built here, like in
+ * generate_variant(); the JIT queue compiles it and swaps the functions.
+ * If anything fails the variant just stays unoptimized.
+ */
+void
+llvmpipe_tier_up_fs(struct llvmpipe_context *lp)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+   struct lp_fragment_shader_variant *variant = lp->fs_variant_unoptimized;
+   struct lp_fragment_shader *shader = variant->shader;
+   struct gallivm_state *gallivm;
+   struct lp_fs_compile_job *job;
+   char module_name[64];
+
+   if (p_atomic_read(&variant->executions) < screen->jit_tier_up ||
+       !util_queue_fence_is_signalled(&variant->fence))
+      return;
+
+   lp->fs_variant_unoptimized = NULL;
+   variant->unoptimized = FALSE;
+
+   job = CALLOC_STRUCT(lp_fs_compile_job);
+   if (!job)
+      return;
+
+   job->screen = screen;
+   job->variant = variant;
+   job->context = LLVMContextCreate();
+   if (!job->context) {
+      FREE(job);
+      return;
+   }
+
+   if (shader->base.ir.nir && !(LP_PERF & PERF_PROFILE_FS)) {
+      lp_fs_get_ir_cache_key(variant, job->ir_sha1_cache_key);
+      job->needs_caching = true;
+   }
+
+   snprintf(module_name, sizeof(module_name), "fs%u_variant%u_opt",
+            shader->no, variant->no);
+
+   gallivm = gallivm_create(module_name, job->context, &job->cached);
+   if (!gallivm) {
+      LLVMContextDispose(job->context);
+      FREE(job);
+      return;
+   }
+   gallivm_use_code_arena(gallivm, screen->code_arena);
+
+   variant->unoptimized_gallivm = variant->gallivm;
+   variant->gallivm = gallivm;
+
+   /* The types belong to the old LLVM context. */
+   variant->jit_context_ptr_type = NULL;
+   variant->jit_thread_data_ptr_type = NULL;
+   variant->jit_linear_context_ptr_type = NULL;
+   lp_jit_init_types(variant);
+
+   variant->function[RAST_WHOLE] = NULL;
+   variant->function[RAST_WHOLE_8X8] = NULL;
+   generate_fragment(lp, shader, variant, RAST_EDGE_TEST);
+   if (variant->opaque)
+      generate_fragment(lp, shader, variant, RAST_WHOLE);
+   if (variant->whole_8x8)
+      generate_fragment(lp, shader, variant, RAST_WHOLE_8X8);
+
+   LP_COUNT(nr_fs_variant_tier_ups);
+
+   util_queue_add_job(&screen->jit_queue, job, &variant->tier_up_fence,
+                      compile_variant, free_compile_job, 0);
 }
 
 
 
 
+/**
+ * Compile the variants draws with the given state will need, see
+ * pipe_context::precompile_fs().  The keys are made like in
+ * llvmpipe_update_fs(), but for shaders with samplers, sampler views or
+ * images, whose keys depend on state not known yet.  Those are compiled
+ * at their first draw.  With LP_JIT_THREADS the compilation happens in
+ * the background.
+ */
+static void
+llvmpipe_precompile_fs(struct pipe_context *pipe,
+                       const struct pipe_precompile_fs_state *templ)
+{
+   struct llvmpipe_context *lp = llvmpipe_context(pipe);
+   struct llvmpipe_screen *screen = llvmpipe_screen(pipe->screen);
+   struct lp_fragment_shader *shader = templ->fs;
+   struct lp_fragment_shader_variant_key *key;
+   struct lp_fragment_shader_variant *variant;
+   struct lp_fs_key_state state;
+   char store[LP_FS_MAX_VARIANT_KEY_SIZE];
+   char generic_store[LP_FS_MAX_VARIANT_KEY_SIZE];
+   char zprepass_store[2][LP_FS_MAX_VARIANT_KEY_SIZE];
+   void *blend, *depth_stencil;
+   unsigned i;
+
+   if (!shader ||
+       shader->info.base.file_max[TGSI_FILE_SAMPLER] != -1 ||
+       shader->info.base.file_max[TGSI_FILE_SAMPLER_VIEW] != -1 ||
+       shader->info.base.file_max[TGSI_FILE_IMAGE] != -1)
+      return;
+
+   /* These apply the LP_PERF overrides like the bound state's. */
+   blend = pipe->create_blend_state(pipe, templ->blend);
+   depth_stencil = pipe->create_depth_stencil_alpha_state(pipe,
+                                             templ->depth_stencil_alpha);
+   if (!blend || !depth_stencil)
+      goto out;
+
+   memset(&state, 0, sizeof state);
+   state.blend = blend;
+   state.depth_stencil = depth_stencil;
+   state.rasterizer = templ->rasterizer;
+   state.min_samples = templ->min_samples;
+
+   state.nr_cbufs = templ->nr_cbufs;
+   for (i = 0; i < templ->nr_cbufs; i++) {
+      state.cbuf_format[i] = templ->cbuf_formats[i];
+      if (templ->cbuf_formats[i] != PIPE_FORMAT_NONE)
+         state.cbuf_nr_samples[i] = MAX2(templ->samples, 1);
+   }
+   state.zsbuf_format = templ->zsbuf_format;
+   if (templ->zsbuf_format != PIPE_FORMAT_NONE)
+      state.zsbuf_nr_samples = MAX2(templ->samples, 1);
+   state.nr_samples = MAX2(templ->samples, 1);
+
+   key = make_variant_key(lp, shader, &state, store);
+
+   if (lookup_variant(shader, key))
+      goto out;
+
+   /* Past the limit, the first draw would use the generic variant too. */
+   if (shader->variants_cached >= LP_MAX_FS_SPECIALIZED_VARIANTS) {
+      memcpy(generic_store, key, shader->variant_key_size);
+      if (make_generic_variant_key(
+             (struct lp_fragment_shader_variant_key *)generic_store))
+         key = (struct lp_fragment_shader_variant_key *)generic_store;
+   }
+
+   variant = get_variant(lp, shader, key);
+
+   if (variant && screen->z_prepass &&
+       make_zprepass_keys(shader,
+                          (const struct lp_fragment_shader_variant_key *)store,
+                          (struct lp_fragment_shader_variant_key *)zprepass_store[0],
+                          (struct lp_fragment_shader_variant_key *)zprepass_store[1])) {
+      for (i = 0; i < 2; i++)
+         get_variant(lp, shader,
+            (const struct lp_fragment_shader_variant_key *)zprepass_store[i]);
+   }
+
+   LP_COUNT(nr_fs_precompiles);
+
+out:
+   if (blend)
+      pipe->delete_blend_state(pipe, blend);
+   if (depth_stencil)
+      pipe->delete_depth_stencil_alpha_state(pipe, depth_stencil);
+}
+
+
+
 
 void
 llvmpipe_init_fs_funcs(struct llvmpipe_context *llvmpipe)
@@ -4250,6 +6090,7 @@ llvmpipe_init_fs_funcs(struct llvmpipe_context *llvmpipe)
    llvmpipe->pipe.create_fs_state = llvmpipe_create_fs_state;
    llvmpipe->pipe.bind_fs_state   = llvmpipe_bind_fs_state;
    llvmpipe->pipe.delete_fs_state = llvmpipe_delete_fs_state;
+   llvmpipe->pipe.precompile_fs   = llvmpipe_precompile_fs;
 
    llvmpipe->pipe.set_constant_buffer = llvmpipe_set_constant_buffer;
 
@@ -32,19 +32,25 @@
 
 #include "pipe/p_compiler.h"
 #include "pipe/p_state.h"
+#include "util/u_queue.h"
 #include "tgsi/tgsi_scan.h" /* for tgsi_shader_info */
 #include "gallivm/lp_bld_sample.h" /* for struct lp_sampler_static_state */
 #include "gallivm/lp_bld_tgsi.h" /* for lp_tgsi_info */
 #include "lp_bld_interp.h" /* for struct lp_shader_input */
+#include "lp_limits.h"
 
 
 struct tgsi_token;
+struct hash_table;
+struct nir_shader;
 struct lp_fragment_shader;
+struct llvmpipe_context;
 
 
 /** Indexes into jit_function[] array */
 #define RAST_WHOLE 0
 #define RAST_EDGE_TEST 1
+#define RAST_WHOLE_8X8 2   /**< four full 4x4 blocks, see LP_FS_8X8 */
 
 
 struct lp_sampler_static_state
@@ -64,6 +70,37 @@ struct lp_image_static_state
    struct lp_static_texture_state image_state;
 };
 
+
+/** What lp_rast_span() computes color 0 from, see LP_SPANS */
+enum lp_fs_span_kind
+{
+   LP_FS_SPAN_NONE = 0,
+   LP_FS_SPAN_INPUT,
+   LP_FS_SPAN_UNIFORM,
+   LP_FS_SPAN_TEXTURE,
+};
+
+/** Blend factors of the span path */
+enum lp_fs_span_factor
+{
+   LP_FS_SPAN_ZERO = 0,
+   LP_FS_SPAN_ONE,
+   LP_FS_SPAN_SRC_ALPHA,
+   LP_FS_SPAN_INV_SRC_ALPHA,
+};
+
+/** How lp_rast_span() shades the draws of a variant */
+struct lp_fs_span_state
+{
+   enum lp_fs_span_kind kind;
+   /** Source and destination factors of color, then of alpha */
+   enum lp_fs_span_factor factor[4];
+   /** Bytes of r, g, b and a in the color buffer's pixels */
+   uint8_t dst_chan[4];
+   /** Same in the texels, 4 where the channel is X and reads as 1 */
+   uint8_t src_chan[4];
+};
+
 struct lp_fragment_shader_variant_key
 {
    struct pipe_depth_state depth;
@@ -84,6 +121,29 @@ struct lp_fragment_shader_variant_key
    unsigned resource_1d:1;
    unsigned depth_clamp:1;
    unsigned multisample:1;
+   /**
+    * Generic variant: the depth func and the stencil funcs, ops and masks
+    * are zeroed here and read from lp_jit_context instead.  Only the
+    * enabled bits, and whether the stencil writemasks are non-zero, count.
+    */
+   unsigned runtime_ds:1;
+   /**
+    * Z prepass variant, see LP_Z_PREPASS: only the depth test and write
+    * are done, the shader isn't run.
+    */
+   unsigned depth_only:1;
+   /**
+    * Smooth lines are antialiased here, see llvmpipe_aa_lines(): color 0's
+    * alpha is scaled by the coverage setup passes in an extra input.
+    */
+   unsigned aa_line:1;
+   /**
+    * The shader's inlinable uniforms have the values in inline_values[],
+    * see LP_INLINE_UNIFORMS.
+    */
+   unsigned inline_uniforms:1;
+
+   uint32_t inline_values[LP_MAX_INLINABLE_UNIFORMS];
 
    enum pipe_format zsbuf_format;
    enum pipe_format cbuf_format[PIPE_MAX_COLOR_BUFS];
@@ -118,6 +178,27 @@ lp_fs_variant_key_images(struct lp_fragment_shader_variant_key *key)
       &key->samplers[key->nr_samplers];
 }
 
+/**
+ * Counted by the variant's own code with LP_PERF=profile, see
+ * lp_fs_print_profile().  Both of the variant's functions count here.
+ */
+struct lp_fs_variant_profile
+{
+   uint64_t blocks;         /**< 4x4 blocks shaded */
+   uint64_t fragments;      /**< covered in them, samples if multisampled */
+   uint64_t shader_cycles;  /**< interpolation, depth test and the shader */
+   uint64_t blend_cycles;
+   uint64_t skipped_bodies; /**< ifs and loops no fragment ran, NIR only */
+};
+
+/** The profile of a variant which was destroyed before the context */
+struct lp_fs_profile_record
+{
+   unsigned shader_no;
+   unsigned variant_no;
+   struct lp_fs_variant_profile profile;
+};
+
 /** doubly-linked list item */
 struct lp_fs_variant_list_item
 {
@@ -131,24 +212,68 @@ struct lp_fragment_shader_variant
 
    boolean opaque;
 
+   /**
+    * Has a RAST_WHOLE_8X8 function too.  Not for multisampling, where
+    * lp_rast_shade_tile() may pick a different function per 4x4 block.
+    */
+   boolean whole_8x8;
+
+   /**
+    * The shader's sample mask input is the inner coverage of conservatively
+    * rasterized primitives, see lp_rast_inner_coverage().
+    */
+   boolean inner_coverage;
+
+   /**
+    * The shader is a blit and the state lets its 1:1 draws copy texels of
+    * texture 0 straight to color buffer 0, see lp_setup_blit().
+    */
+   boolean blit;
+
+   /** Whether and how its draws may be shaded in spans, see LP_SPANS */
+   struct lp_fs_span_state span;
+
    struct gallivm_state *gallivm;
 
+   /** The shader's NIR with the key's uniforms inlined, or NULL */
+   struct nir_shader *nir;
+
    LLVMTypeRef jit_context_ptr_type;
    LLVMTypeRef jit_thread_data_ptr_type;
    LLVMTypeRef jit_linear_context_ptr_type;
 
-   LLVMValueRef function[2];
+   LLVMValueRef function[3];
 
-   lp_jit_frag_func jit_function[2];
+   lp_jit_frag_func jit_function[3];
 
    /* Total number of LLVM instructions generated */
    unsigned nr_instrs;
 
+   /** Bytes of the variant and its code, counted in screen->shader_memory */
+   uint64_t memory;
+
    struct lp_fs_variant_list_item list_item_global, list_item_local;
    struct lp_fragment_shader *shader;
 
+   /** Signalled once jit_function[] is ready, see LP_JIT_THREADS */
+   struct util_queue_fence fence;
+
+   /**
+    * Tiered compilation, see LP_JIT_TIER_UP: the variant is first compiled
+    * without optimizations, and the bins which ran it are counted.  Once
+    * it is hot it is recompiled in the background into a new gallivm, and
+    * jit_function[] is swapped when that finishes.  The unoptimized code
+    * is kept until the variant is destroyed, as bins may still be
+    * running it.
+    */
+   boolean unoptimized;
+   unsigned executions;
+   struct gallivm_state *unoptimized_gallivm;
+   struct util_queue_fence tier_up_fence;
+
    /* For debugging/profiling purposes */
    unsigned no;
+   struct lp_fs_variant_profile profile;
 
    /* key is variable-sized, must be last */
    struct lp_fragment_shader_variant_key key;
@@ -163,9 +288,38 @@ struct lp_fragment_shader
    struct lp_tgsi_info info;
 
    struct lp_fs_variant_list_item variants;
+   struct hash_table *variant_table;   /**< the same variants, by key */
 
    struct draw_fragment_shader *draw_data;
 
+   /** Identifies the shader in the screen's variant manifest */
+   unsigned char ir_sha1[20];
+
+   /**
+    * With LP_INLINE_UNIFORMS, the uniforms deciding the shader's branches,
+    * as dword offsets into constant buffer 0, and the NIR to inline them
+    * into.  The shader's own NIR leaves SSA when variants are built.
+    */
+   unsigned num_inlinable_uniforms;
+   uint16_t inlinable_uniforms[LP_MAX_INLINABLE_UNIFORMS];
+   struct nir_shader *inline_nir;
+   unsigned inlined_variants;   /**< created, see LP_MAX_FS_INLINED_VARIANTS */
+
+   /**
+    * The input, and its channels, at which the shader samples texture 0
+    * with sampler 0 into color 0 and does nothing else, or -1.  NIR only.
+    */
+   int blit_input;
+   unsigned blit_chan[2];
+
+   /**
+    * The input which color 0 is all of, or the dword offset into constant
+    * buffer 0 of the uniform it is, with nothing else done, or -1.  NIR
+    * only.  Solid fills and gradients, see LP_SPANS.
+    */
+   int color_input;
+   int color_uniform;
+
    /* For debugging/profiling purposes */
    unsigned variant_key_size;
    unsigned no;
@@ -180,4 +334,10 @@ struct lp_fragment_shader
 void
 lp_debug_fs_variant(struct lp_fragment_shader_variant *variant);
 
+boolean
+llvmpipe_fs_variants_compiled(struct lp_fragment_shader *shader);
+
+void
+lp_fs_print_profile(struct llvmpipe_context *lp);
+
 #endif /* LP_STATE_FS_H_ */
@@ -70,8 +70,8 @@ llvmpipe_create_rasterizer_state(struct pipe_context *pipe,
    memcpy(&state->draw_state, rast, sizeof *rast);
    memcpy(&state->lp_state, rast, sizeof *rast);
 
-   /* We rely on draw module to do unfilled polyons, AA lines and
-    * points and stipple.
+   /* We rely on draw module to do unfilled polyons, AA points and
+    * stipple.  AA lines are done in setup.
     * 
     * Over time, reduce this list of conditions, and expand the list
     * of flags which get cleared in clear_flags().
@@ -79,7 +79,6 @@ llvmpipe_create_rasterizer_state(struct pipe_context *pipe,
    need_pipeline = (rast->fill_front != PIPE_POLYGON_MODE_FILL ||
 		    rast->fill_back != PIPE_POLYGON_MODE_FILL ||
 		    rast->point_smooth ||
-		    rast->line_smooth ||
 		    rast->line_stipple_enable ||
 		    rast->poly_stipple_enable);
 
@@ -118,6 +117,10 @@ llvmpipe_bind_rasterizer_state(struct pipe_context *pipe, void *handle)
                                   state->lp_state.half_pixel_center,
                                   state->lp_state.bottom_edge_rule,
                                   state->lp_state.multisample);
+      lp_setup_set_conservative_state( llvmpipe->setup,
+                                      state->lp_state.conservative_raster_mode !=
+                                      PIPE_CONSERVATIVE_RASTER_OFF,
+                                      state->lp_state.conservative_raster_dilate);
       lp_setup_set_flatshade_first( llvmpipe->setup,
 				    state->lp_state.flatshade_first);
       lp_setup_set_line_state( llvmpipe->setup,
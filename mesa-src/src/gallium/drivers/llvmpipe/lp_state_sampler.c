@@ -141,6 +141,10 @@ llvmpipe_set_sampler_views(struct pipe_context *pipe,
 
       if (views[i])
          llvmpipe_flush_resource(pipe, views[i]->texture, 0, true, false, false, "sampler_view");
+      /* The draw module samples linear textures only */
+      if (views[i] && shader != PIPE_SHADER_FRAGMENT &&
+          shader != PIPE_SHADER_COMPUTE)
+         llvmpipe_resource_untile(pipe, views[i]->texture);
       pipe_sampler_view_reference(&llvmpipe->sampler_views[shader][start + i],
                                   views[i]);
    }
@@ -185,6 +189,28 @@ llvmpipe_create_sampler_view(struct pipe_context *pipe,
       texture->bind |= PIPE_BIND_SAMPLER_VIEW;
    }
 
+   /* Tiles are addressed by texel, which compressed views don't have */
+   if (util_format_is_compressed(templ->format))
+      llvmpipe_resource_untile(pipe, texture);
+
+   /* Scenes of other contexts could sample storage renames free */
+   if (llvmpipe_resource_is_texture(texture)) {
+      struct llvmpipe_resource *lpr = llvmpipe_resource(texture);
+
+      if (!lpr->rename_context)
+         lpr->rename_context = llvmpipe_context(pipe);
+      else if (lpr->rename_context != llvmpipe_context(pipe))
+         lpr->renamable = FALSE;
+   }
+
+   /* Sampling reads the texture from memory */
+   if (llvmpipe_resource_is_texture(texture) &&
+       llvmpipe_resource(texture)->transient &&
+       !llvmpipe_resource_alloc_transient(llvmpipe_resource(texture))) {
+      FREE(view);
+      return NULL;
+   }
+
    if (view) {
       *view = *templ;
       view->reference.count = 1;
@@ -227,6 +253,86 @@ llvmpipe_create_sampler_view(struct pipe_context *pipe,
 }
 
 
+/**
+ * Whether the size of the sampled texture can be compiled into the shaders,
+ * see LP_CONST_TEXTURE_SIZE.  1D textures don't use the row stride.
+ */
+static boolean
+texture_size_is_const(const struct lp_static_texture_state *state,
+                      const struct pipe_resource *texture)
+{
+   const struct llvmpipe_screen *screen = llvmpipe_screen(texture->screen);
+   const struct llvmpipe_resource *lpr = llvmpipe_resource_const(texture);
+
+   if (texture->width0 > screen->const_texture_size ||
+       texture->height0 > screen->const_texture_size)
+      return FALSE;
+
+   if (state->target != PIPE_TEXTURE_1D &&
+       state->target != PIPE_TEXTURE_2D &&
+       state->target != PIPE_TEXTURE_RECT)
+      return FALSE;
+
+   if (!state->level_zero_only ||
+       !state->pot_width || !state->pot_height ||
+       state->tiled ||
+       util_format_is_compressed(state->format))
+      return FALSE;
+
+   return state->target == PIPE_TEXTURE_1D ||
+          lpr->row_stride[0] ==
+             texture->width0 * util_format_get_blocksize(state->format);
+}
+
+
+/**
+ * lp_sampler_static_texture_state(), plus the resource's tiling, the
+ * format of its decompressed copy, if sampled, and its size if constant,
+ * see LP_CONST_TEXTURE_SIZE.
+ */
+void
+llvmpipe_sampler_static_texture_state(struct lp_static_texture_state *state,
+                                      const struct pipe_sampler_view *view)
+{
+   lp_sampler_static_texture_state(state, view);
+   if (view && view->texture) {
+      struct pipe_resource *texture = llvmpipe_sampler_view_texture(view);
+
+      state->tiled = llvmpipe_resource_is_tiled(texture);
+      if (texture != view->texture) {
+         state->format = util_format_is_srgb(view->format) ?
+                            util_format_srgb(texture->format) : texture->format;
+      }
+
+      if (texture_size_is_const(state, texture)) {
+         state->const_size = 1;
+         state->width_log2 = util_logbase2(texture->width0);
+         state->height_log2 = util_logbase2(texture->height0);
+      }
+   }
+}
+
+
+/**
+ * Update the decompressed copies of the compressed textures of a shader
+ * stage's sampler views, before their state is derived.
+ */
+void
+llvmpipe_decompress_sampler_views(struct llvmpipe_context *llvmpipe,
+                                  enum pipe_shader_type shader)
+{
+   unsigned i;
+
+   for (i = 0; i < llvmpipe->num_sampler_views[shader]; i++) {
+      struct pipe_sampler_view *view = llvmpipe->sampler_views[shader][i];
+
+      if (view && view->texture &&
+          util_format_is_compressed(view->texture->format))
+         llvmpipe_resource_decompress(view->texture);
+   }
+}
+
+
 static void
 llvmpipe_sampler_view_destroy(struct pipe_context *pipe,
                               struct pipe_sampler_view *view)
@@ -29,6 +29,7 @@
 #include "util/u_math.h"
 #include "util/u_memory.h"
 #include "util/simple_list.h"
+#include "util/hash_table.h"
 #include "util/os_time.h"
 #include "gallivm/lp_bld_arit.h"
 #include "gallivm/lp_bld_bitarit.h"
@@ -155,6 +156,23 @@ emit_facing_coef(struct gallivm_state *gallivm,
 }
 
 
+/**
+ * Load a whole attribute of a vertex.  The vertices may be the draw
+ * module's own, which are only 4 byte aligned, see lp_setup_set_vertices().
+ */
+static LLVMValueRef
+load_vert_attrib(LLVMBuilderRef b,
+                 LLVMValueRef vert,
+                 LLVMValueRef attr,
+                 const char *name)
+{
+   LLVMValueRef load = LLVMBuildLoad(b, LLVMBuildGEP(b, vert, &attr, 1, ""),
+                                     name);
+   LLVMSetAlignment(load, 4);
+   return load;
+}
+
+
 static LLVMValueRef
 vert_attrib(struct gallivm_state *gallivm,
             LLVMValueRef vert,
@@ -185,9 +203,9 @@ lp_twoside(struct gallivm_state *gallivm,
    LLVMValueRef front_facing = LLVMBuildICmp(b, LLVMIntEQ, facing,
                                              lp_build_const_int32(gallivm, 0), ""); /** need i1 for if condition */
 
-   a0_back = LLVMBuildLoad(b, LLVMBuildGEP(b, args->v0, &idx2, 1, ""), "v0a_back");
-   a1_back = LLVMBuildLoad(b, LLVMBuildGEP(b, args->v1, &idx2, 1, ""), "v1a_back");
-   a2_back = LLVMBuildLoad(b, LLVMBuildGEP(b, args->v2, &idx2, 1, ""), "v2a_back");
+   a0_back = load_vert_attrib(b, args->v0, idx2, "v0a_back");
+   a1_back = load_vert_attrib(b, args->v1, idx2, "v1a_back");
+   a2_back = load_vert_attrib(b, args->v2, idx2, "v2a_back");
 
    /* Possibly swap the front and back attrib values,
     *
@@ -364,9 +382,9 @@ load_attribute(struct gallivm_state *gallivm,
 
    /* Load the vertex data
     */
-   attribv[0] = LLVMBuildLoad(b, LLVMBuildGEP(b, args->v0, &idx, 1, ""), "v0a");
-   attribv[1] = LLVMBuildLoad(b, LLVMBuildGEP(b, args->v1, &idx, 1, ""), "v1a");
-   attribv[2] = LLVMBuildLoad(b, LLVMBuildGEP(b, args->v2, &idx, 1, ""), "v2a");
+   attribv[0] = load_vert_attrib(b, args->v0, idx, "v0a");
+   attribv[1] = load_vert_attrib(b, args->v1, idx, "v1a");
+   attribv[2] = load_vert_attrib(b, args->v2, idx, "v2a");
 
 
    /* Potentially modify it according to twoside, etc:
@@ -568,9 +586,13 @@ emit_tri_coef( struct gallivm_state *gallivm,
 
    LLVMValueRef attribs[3];
 
-  /* setup interpolation for all the remaining attributes:
+   /* setup interpolation for all the remaining attributes the fragment
+    * shader reads:
     */
    for (slot = 0; slot < key->num_inputs; slot++) {
+      if (!key->inputs[slot].usage_mask)
+         continue;
+
       switch (key->inputs[slot].interp) {
       case LP_INTERP_CONSTANT:
          load_attribute(gallivm, args, key, key->inputs[slot].src_index, attribs);
@@ -606,6 +628,13 @@ emit_tri_coef( struct gallivm_state *gallivm,
          emit_facing_coef(gallivm, args, slot+1);
          break;
 
+      case LP_INTERP_AA_LINE:
+         /* Triangles are fully covered, see lp_setup_line.c */
+         emit_constant_coef4(gallivm, args, slot+1,
+                             lp_build_const_aos(gallivm, args->bld.type,
+                                                0.0, 0.0, 1.0, 1.0, NULL));
+         break;
+
       default:
          assert(0);
       }
@@ -703,10 +732,39 @@ init_args(struct gallivm_state *gallivm,
  * Generate the runtime callable function for the coefficient calculation.
  *
  */
+static void
+compile_setup_variant(void *data, int thread_index)
+{
+   struct lp_setup_variant *variant = data;
+
+   gallivm_compile_module(variant->gallivm);
+
+   variant->jit_function = (lp_jit_setup_triangle)
+      gallivm_jit_function(variant->gallivm, variant->function);
+
+   gallivm_free_ir(variant->gallivm);
+
+   /* The generated code doesn't need the LLVM context anymore. */
+   if (variant->context) {
+      LLVMContextDispose(variant->context);
+      variant->context = NULL;
+   }
+}
+
+
+/**
+ * Generate the setup function for the key.
+ *
+ * With LP_JIT_THREADS it is compiled in the background, concurrently
+ * with the fragment shader variant and with the vertex shader which the
+ * draw module compiles next.  lp_setup_update_state() waits for it before
+ * any triangle is set up.
+ */
 static struct lp_setup_variant *
 generate_setup_variant(struct lp_setup_variant_key *key,
                        struct llvmpipe_context *lp)
 {
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
    struct lp_setup_variant *variant = NULL;
    struct gallivm_state *gallivm;
    struct lp_setup_args args;
@@ -726,18 +784,30 @@ generate_setup_variant(struct lp_setup_variant_key *key,
       goto fail;
 
    variant->no = setup_no++;
+   util_queue_fence_init(&variant->fence);
 
    snprintf(func_name, sizeof(func_name), "setup_variant_%u",
             variant->no);
 
-   variant->gallivm = gallivm = gallivm_create(func_name, lp->context, NULL);
+   /* LLVM contexts aren't thread safe, see generate_variant(). */
+   if (util_queue_is_initialized(&screen->jit_queue)) {
+      variant->context = LLVMContextCreate();
+      if (!variant->context)
+         goto fail;
+   }
+
+   variant->gallivm = gallivm =
+      gallivm_create(func_name,
+                     variant->context ? variant->context : lp->context,
+                     NULL);
    if (!variant->gallivm) {
       goto fail;
    }
+   gallivm_use_code_arena(gallivm, screen->code_arena);
 
    builder = gallivm->builder;
 
-   if (LP_DEBUG & DEBUG_COUNTERS) {
+   if (lp_counters_enabled) {
       t0 = os_time_get();
    }
 
@@ -798,19 +868,20 @@ generate_setup_variant(struct lp_setup_variant_key *key,
 
    gallivm_verify_function(gallivm, variant->function);
 
-   gallivm_compile_module(gallivm);
-
-   variant->jit_function = (lp_jit_setup_triangle)
-      gallivm_jit_function(gallivm, variant->function);
-   if (!variant->jit_function)
-      goto fail;
-
-   gallivm_free_ir(variant->gallivm);
+   if (variant->context) {
+      util_queue_add_job(&screen->jit_queue, variant, &variant->fence,
+                         compile_setup_variant, NULL, 0);
+   }
+   else {
+      compile_setup_variant(variant, 0);
+      if (!variant->jit_function)
+         goto fail;
+   }
 
    /*
     * Update timing information:
     */
-   if (LP_DEBUG & DEBUG_COUNTERS) {
+   if (lp_counters_enabled) {
       t1 = os_time_get();
       LP_COUNT_ADD(llvm_compile_time, t1 - t0);
       LP_COUNT_ADD(nr_llvm_compiles, 1);
@@ -823,6 +894,10 @@ fail:
       if (variant->gallivm) {
          gallivm_destroy(variant->gallivm);
       }
+      if (variant->context) {
+         LLVMContextDispose(variant->context);
+      }
+      util_queue_fence_destroy(&variant->fence);
       FREE(variant);
    }
 
@@ -845,8 +920,9 @@ lp_make_setup_variant_key(struct llvmpipe_context *lp,
    key->pixel_center_half = lp->rasterizer->half_pixel_center;
    key->multisample = lp->rasterizer->multisample;
    key->twoside = lp->rasterizer->light_twoside;
+   key->aa_line = llvmpipe_aa_lines(lp);
    key->size = Offset(struct lp_setup_variant_key,
-                      inputs[key->num_inputs]);
+                      inputs[key->num_inputs + key->aa_line]);
 
    key->color_slot = lp->color_slot[0];
    key->bcolor_slot = lp->bcolor_slot[0];
@@ -872,6 +948,17 @@ lp_make_setup_variant_key(struct llvmpipe_context *lp,
    key->pad = 0;
    memcpy(key->inputs, fs->inputs, key->num_inputs * sizeof key->inputs[0]);
    for (i = 0; i < key->num_inputs; i++) {
+      /* interpolateAt*() reads aren't in the usage masks, so those
+       * shaders get every input set up in full.
+       */
+      if (fs->info.base.uses_persp_opcode_interp_centroid ||
+          fs->info.base.uses_persp_opcode_interp_offset ||
+          fs->info.base.uses_persp_opcode_interp_sample ||
+          fs->info.base.uses_linear_opcode_interp_centroid ||
+          fs->info.base.uses_linear_opcode_interp_offset ||
+          fs->info.base.uses_linear_opcode_interp_sample)
+         key->inputs[i].usage_mask = TGSI_WRITEMASK_XYZW;
+
       if (key->inputs[i].interp == LP_INTERP_COLOR) {
          if (lp->rasterizer->flatshade)
             key->inputs[i].interp = LP_INTERP_CONSTANT;
@@ -880,6 +967,38 @@ lp_make_setup_variant_key(struct llvmpipe_context *lp,
       }
    }
 
+   if (key->aa_line) {
+      struct lp_shader_input *aa = &key->inputs[key->num_inputs++];
+
+      memset(aa, 0, sizeof *aa);
+      aa->interp = LP_INTERP_AA_LINE;
+      aa->usage_mask = TGSI_WRITEMASK_XYZW;
+   }
+}
+
+
+static uint32_t
+setup_variant_key_hash(const void *key)
+{
+   const struct lp_setup_variant_key *k = key;
+   return _mesa_hash_data(k, k->size);
+}
+
+
+static bool
+setup_variant_key_equal(const void *a, const void *b)
+{
+   const struct lp_setup_variant_key *ka = a;
+   const struct lp_setup_variant_key *kb = b;
+   return ka->size == kb->size && memcmp(ka, kb, ka->size) == 0;
+}
+
+
+struct hash_table *
+lp_setup_variants_table_create(void)
+{
+   return _mesa_hash_table_create(NULL, setup_variant_key_hash,
+                                  setup_variant_key_equal);
 }
 
 
@@ -892,11 +1011,16 @@ remove_setup_variant(struct llvmpipe_context *lp,
                    variant->no, lp->nr_setup_variants);
    }
 
+   /* it may still be compiling */
+   util_queue_fence_wait(&variant->fence);
+   util_queue_fence_destroy(&variant->fence);
+
    if (variant->gallivm) {
       gallivm_destroy(variant->gallivm);
    }
 
    remove_from_list(&variant->list_item_global);
+   _mesa_hash_table_remove_key(lp->setup_variants_table, &variant->key);
    lp->nr_setup_variants--;
    FREE(variant);
 }
@@ -942,22 +1066,24 @@ llvmpipe_update_setup(struct llvmpipe_context *lp)
 {
    struct lp_setup_variant_key *key = &lp->setup_variant.key;
    struct lp_setup_variant *variant = NULL;
-   struct lp_setup_variant_list_item *li;
+   struct hash_entry *entry;
+   uint32_t hash;
 
    lp_make_setup_variant_key(lp, key);
+   hash = setup_variant_key_hash(key);
 
-   foreach(li, &lp->setup_variants_list) {
-      if(li->base->key.size == key->size &&
-         memcmp(&li->base->key, key, key->size) == 0) {
-         variant = li->base;
-         break;
-      }
-   }
+   LP_COUNT(nr_setup_variant_lookups);
+   entry = _mesa_hash_table_search_pre_hashed(lp->setup_variants_table,
+                                              hash, key);
+   if (entry)
+      variant = entry->data;
 
    if (variant) {
       move_to_head(&lp->setup_variants_list, &variant->list_item_global);
    }
    else {
+      LP_COUNT(nr_setup_variant_misses);
+
       if (lp->nr_setup_variants >= LP_MAX_SETUP_VARIANTS) {
          cull_setup_variants(lp);
       }
@@ -965,6 +1091,8 @@ llvmpipe_update_setup(struct llvmpipe_context *lp)
       variant = generate_setup_variant(key, lp);
       if (variant) {
          insert_at_head(&lp->setup_variants_list, &variant->list_item_global);
+         _mesa_hash_table_insert_pre_hashed(lp->setup_variants_table, hash,
+                                            &variant->key, variant);
          lp->nr_setup_variants++;
       }
    }
@@ -1,6 +1,7 @@
 #ifndef LP_STATE_SETUP_H
 #define LP_STATE_SETUP_H
 
+#include "util/u_queue.h"
 #include "lp_bld_interp.h"
 
 
@@ -26,7 +27,8 @@ struct lp_setup_variant_key {
    unsigned twoside:1;
    unsigned floating_point_depth:1;
    unsigned multisample:1;
-   unsigned pad:3;
+   unsigned aa_line:1;     /**< last input is LP_INTERP_AA_LINE */
+   unsigned pad:2;
 
    /* TODO: get those floats out of the key and use a jit_context for setup */
    float pgon_offset_units;
@@ -71,9 +73,17 @@ struct lp_setup_variant {
     */
    lp_jit_setup_triangle jit_function;
 
+   /** Signalled once jit_function is ready, see LP_JIT_THREADS */
+   struct util_queue_fence fence;
+
+   /** Own LLVM context while being compiled in the background */
+   LLVMContextRef context;
+
    unsigned no;
 };
 
+struct hash_table *lp_setup_variants_table_create(void);
+
 void lp_delete_setup_variants(struct llvmpipe_context *lp);
 
 void
@@ -79,6 +79,9 @@ llvmpipe_set_so_targets(struct pipe_context *pipe,
          debug_printf("Illegal setting of so target with target %d created in "
                        "another context\n", i);
       }
+      if (targets[i] &&
+          lp_csctx_is_resource_referenced(llvmpipe->csctx, targets[i]->buffer))
+         lp_csctx_wait(llvmpipe->csctx);
       pipe_so_target_reference((struct pipe_stream_output_target **)&llvmpipe->so_targets[i], targets[i]);
       /* If we're not appending then lets set the internal
          offset to what was requested */
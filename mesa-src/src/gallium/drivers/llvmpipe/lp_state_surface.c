@@ -79,6 +79,16 @@ llvmpipe_set_framebuffer_state(struct pipe_context *pipe,
          }
       }
 
+      /* Scenes rasterize behind the grid, which mustn't see them write */
+      for (i = 0; i < fb->nr_cbufs; i++) {
+         if (fb->cbufs[i] &&
+             lp_csctx_is_resource_referenced(lp->csctx, fb->cbufs[i]->texture))
+            lp_csctx_wait(lp->csctx);
+      }
+      if (fb->zsbuf &&
+          lp_csctx_is_resource_referenced(lp->csctx, fb->zsbuf->texture))
+         lp_csctx_wait(lp->csctx);
+
       util_copy_framebuffer_state(&lp->framebuffer, fb);
 
       if (LP_PERF & PERF_NO_DEPTH) {
@@ -25,15 +25,25 @@
  * 
  **************************************************************************/
 
+#include "util/format/u_format.h"
+#include "util/u_gen_mipmap.h"
 #include "util/u_rect.h"
 #include "util/u_surface.h"
 #include "lp_context.h"
+#include "lp_cs_tpool.h"
 #include "lp_flush.h"
 #include "lp_limits.h"
+#include "lp_perf.h"
 #include "lp_surface.h"
 #include "lp_texture.h"
 #include "lp_query.h"
 #include "lp_rast.h"
+#include "lp_screen.h"
+#include "lp_setup.h"
+
+#if defined(PIPE_ARCH_SSE)
+#include <emmintrin.h>
+#endif
 
 static void
 lp_resource_copy_ms(struct pipe_context *pipe,
@@ -112,6 +122,233 @@ lp_resource_copy(struct pipe_context *pipe,
 }
 
 
+/**
+ * Resolve a bound multisampled color buffer as a readback at the end of
+ * the scene, see lp_setup_readback(), so that each rasterizer thread
+ * averages the samples of its tiles while they are still in cache.  The
+ * scene is flushed after it, as later draws might sample dst.
+ * Only plain resolves of layer 0 into a linear texture, without scaling.
+ */
+static bool
+lp_blit_resolve_binned(struct pipe_context *pipe,
+                       const struct pipe_blit_info *info)
+{
+   struct llvmpipe_context *lp = llvmpipe_context(pipe);
+   struct llvmpipe_screen *screen = llvmpipe_screen(pipe->screen);
+   const struct pipe_framebuffer_state *fb = &lp->framebuffer;
+   struct pipe_resource *src = info->src.resource;
+   struct pipe_resource *dst = info->dst.resource;
+   struct llvmpipe_resource *lpr = llvmpipe_resource(dst);
+   const struct util_format_description *desc =
+      util_format_description(info->src.format);
+   const unsigned level = info->dst.level;
+   const int width = info->dst.box.width;
+   const int height = info->dst.box.height;
+   int cbuf = -1;
+   unsigned chans = 0, c, i;
+
+   if (src->nr_samples <= 1 || dst->nr_samples > 1 ||
+       !llvmpipe_resource_is_texture(dst) || lpr->dt ||
+       info->src.format != src->format ||
+       util_format_linear(info->dst.format) !=
+          util_format_linear(dst->format) ||
+       util_format_is_srgb(info->src.format) !=
+          util_format_is_srgb(info->dst.format) ||
+       desc->layout != UTIL_FORMAT_LAYOUT_PLAIN ||
+       util_format_description(info->dst.format)->layout !=
+          UTIL_FORMAT_LAYOUT_PLAIN ||
+       util_format_is_pure_integer(info->src.format) ||
+       util_format_is_pure_integer(info->dst.format) ||
+       util_format_is_depth_or_stencil(info->src.format) ||
+       util_format_is_depth_or_stencil(info->dst.format) ||
+       info->src.level != 0 || info->src.box.z != 0 ||
+       info->src.box.depth != 1 || info->dst.box.depth != 1 ||
+       info->src.box.width != width || info->src.box.height != height ||
+       width <= 0 || height <= 0 ||
+       info->src.box.x < 0 || info->src.box.y < 0 ||
+       info->src.box.x + width > (int)fb->width ||
+       info->src.box.y + height > (int)fb->height ||
+       info->dst.box.x < 0 || info->dst.box.y < 0 ||
+       info->dst.box.x + width > (int)u_minify(dst->width0, level) ||
+       info->dst.box.y + height > (int)u_minify(dst->height0, level) ||
+       info->scissor_enable || info->num_window_rectangles ||
+       info->alpha_blend)
+      return false;
+
+   for (c = 0; c < 4; c++) {
+      if (desc->swizzle[c] <= PIPE_SWIZZLE_W)
+         chans |= PIPE_MASK_R << c;
+   }
+   if ((info->mask & chans) != chans)
+      return false;
+
+   if (fb->zsbuf && fb->zsbuf->texture == dst)
+      return false;
+
+   for (i = 0; i < fb->nr_cbufs; i++) {
+      const struct pipe_surface *surf = fb->cbufs[i];
+
+      if (!surf)
+         continue;
+      if (surf->texture == dst)
+         return false;
+      if (surf->texture == src && surf->format == info->src.format &&
+          surf->u.tex.level == 0 && surf->u.tex.first_layer == 0 &&
+          surf->u.tex.last_layer == 0)
+         cbuf = i;
+   }
+   if (cbuf < 0)
+      return false;
+
+   /* The rasterizer writes straight into the texture */
+   if (llvmpipe_resource_is_tiled(dst))
+      llvmpipe_resource_untile(pipe, dst);
+
+   screen->timestamp++;
+   lpr->writes++;
+   lpr->timestamp = screen->timestamp;
+   if (level == 0)
+      llvmpipe_resource_add_dirty(lpr, info->dst.box.x, info->dst.box.y,
+                                  info->dst.box.x + width,
+                                  info->dst.box.y + height);
+
+   if (!lp_setup_readback(lp->setup, cbuf, &info->src.box, dst,
+                          util_format_linear(info->dst.format),
+                          lpr->mip_offsets[level] +
+                          info->dst.box.z * lpr->img_stride[level] +
+                          info->dst.box.y * lpr->row_stride[level] +
+                          info->dst.box.x * util_format_get_blocksize(dst->format),
+                          lpr->row_stride[level]))
+      return false;
+
+   llvmpipe_flush(pipe, NULL, __FUNCTION__);
+   return true;
+}
+
+
+/**
+ * Resolve a multisampled color buffer on the CPU: copy sample 0 of the
+ * blocks whose samples the rasterizer left equal, see
+ * llvmpipe_resource::msaa_equal, and average the samples of the others.
+ * Only plain resolves of layer 0, without scaling or conversion.
+ */
+static bool
+lp_blit_resolve(struct pipe_context *pipe, const struct pipe_blit_info *info)
+{
+   struct pipe_resource *src = info->src.resource;
+   struct pipe_resource *dst = info->dst.resource;
+   const struct llvmpipe_resource *lpr = llvmpipe_resource(src);
+   const enum pipe_format format = src->format;
+   const struct util_format_description *desc = util_format_description(format);
+   const unsigned bytes = util_format_get_blocksize(format);
+   const int width = info->dst.box.width;
+   const int height = info->dst.box.height;
+   const float scale = 1.0f / src->nr_samples;
+   struct pipe_transfer *src_trans, *dst_trans;
+   const uint8_t *src_map;
+   uint8_t *dst_map;
+   float *sum, *row;
+   unsigned chans = 0, estride, s, c;
+   int x, y;
+
+   if (src->nr_samples <= 1 || dst->nr_samples > 1 || !lpr->msaa_equal ||
+       info->src.format != format || info->dst.format != format ||
+       dst->format != format ||
+       desc->layout != UTIL_FORMAT_LAYOUT_PLAIN ||
+       util_format_is_pure_integer(format) ||
+       util_format_is_depth_or_stencil(format) ||
+       info->src.level != 0 || info->src.box.z != 0 ||
+       info->src.box.depth != 1 || info->dst.box.depth != 1 ||
+       info->src.box.width != width || info->src.box.height != height ||
+       width <= 0 || height <= 0 ||
+       info->src.box.x < 0 || info->src.box.y < 0 ||
+       info->src.box.x + width > (int)src->width0 ||
+       info->src.box.y + height > (int)src->height0 ||
+       info->scissor_enable || info->num_window_rectangles ||
+       info->alpha_blend)
+      return false;
+
+   for (c = 0; c < 4; c++) {
+      if (desc->swizzle[c] <= PIPE_SWIZZLE_W)
+         chans |= PIPE_MASK_R << c;
+   }
+   if ((info->mask & chans) != chans)
+      return false;
+
+   sum = MALLOC(width * 8 * sizeof(float));
+   if (!sum)
+      return false;
+   row = sum + width * 4;
+
+   src_map = llvmpipe_transfer_map_ms(pipe, src, 0, PIPE_TRANSFER_READ, 0,
+                                      &info->src.box, &src_trans);
+   if (!src_map) {
+      FREE(sum);
+      return false;
+   }
+
+   /* Final once the rendering to it is done */
+   if (lpr->msaa_equal_writes != lpr->writes) {
+      pipe->transfer_unmap(pipe, src_trans);
+      FREE(sum);
+      return false;
+   }
+
+   dst_map = pipe->transfer_map(pipe, dst, info->dst.level,
+                                PIPE_TRANSFER_WRITE |
+                                PIPE_TRANSFER_DISCARD_RANGE,
+                                &info->dst.box, &dst_trans);
+   if (!dst_map) {
+      pipe->transfer_unmap(pipe, src_trans);
+      FREE(sum);
+      return false;
+   }
+
+   estride = llvmpipe_msaa_equal_stride(lpr);
+   for (y = 0; y < height; y++) {
+      const unsigned sy = info->src.box.y + y;
+      const uint8_t *equal = lpr->msaa_equal + (sy / 4) * estride;
+      const uint8_t *src_row = src_map + y * src_trans->stride;
+      uint8_t *dst_row = dst_map + y * dst_trans->stride;
+
+      for (x = 0; x < width; ) {
+         const unsigned sx = info->src.box.x + x;
+         const bool same = equal[sx / 4] != 0;
+         int n = MIN2(4 - (int)(sx % 4), width - x);
+         int i;
+
+         /* The run of blocks alike */
+         while (x + n < width && (equal[(sx + n) / 4] != 0) == same)
+            n += MIN2(4, width - x - n);
+
+         if (same) {
+            memcpy(dst_row + x * bytes, src_row + x * bytes, n * bytes);
+            LP_COUNT_ADD(nr_msaa_resolved_pixels, n);
+         }
+         else {
+            util_format_unpack_rgba(format, sum, src_row + x * bytes, n);
+            for (s = 1; s < src->nr_samples; s++) {
+               util_format_unpack_rgba(format, row,
+                                       src_row + s * lpr->sample_stride +
+                                       x * bytes, n);
+               for (i = 0; i < n * 4; i++)
+                  sum[i] += row[i];
+            }
+            for (i = 0; i < n * 4; i++)
+               sum[i] *= scale;
+            util_format_pack_rgba(format, dst_row + x * bytes, sum, n);
+         }
+         x += n;
+      }
+   }
+
+   pipe->transfer_unmap(pipe, dst_trans);
+   pipe->transfer_unmap(pipe, src_trans);
+   FREE(sum);
+   return true;
+}
+
+
 static void lp_blit(struct pipe_context *pipe,
                     const struct pipe_blit_info *blit_info)
 {
@@ -125,6 +362,10 @@ static void lp_blit(struct pipe_context *pipe,
       return; /* done */
    }
 
+   if (lp_blit_resolve_binned(pipe, &info) ||
+       lp_blit_resolve(pipe, &info))
+      return;
+
    if (!util_blitter_is_blit_supported(lp->blitter, &info)) {
       debug_printf("llvmpipe: blit unsupported %s -> %s\n",
                    util_format_short_name(info.src.resource->format),
@@ -178,6 +419,136 @@ lp_flush_resource(struct pipe_context *ctx, struct pipe_resource *resource)
 }
 
 
+/**
+ * Only the bound depth/stencil buffer is invalidated, see
+ * lp_setup_invalidate_resource().
+ */
+static void
+llvmpipe_invalidate_resource(struct pipe_context *pipe,
+                             struct pipe_resource *resource)
+{
+   struct llvmpipe_context *lp = llvmpipe_context(pipe);
+
+   lp_setup_invalidate_resource(lp->setup, resource);
+}
+
+
+/**
+ * Only readbacks of a bound color buffer are done, as copy commands at the
+ * end of the scene being binned, see lp_setup_readback().
+ */
+static bool
+llvmpipe_readback_to_buffer(struct pipe_context *pipe,
+                            struct pipe_surface *src,
+                            const struct pipe_box *box,
+                            struct pipe_resource *dst,
+                            enum pipe_format dst_format,
+                            unsigned dst_offset,
+                            int dst_stride)
+{
+   struct llvmpipe_context *lp = llvmpipe_context(pipe);
+   const struct pipe_framebuffer_state *fb = &lp->framebuffer;
+   const struct util_format_description *desc =
+      util_format_description(dst_format);
+   const int64_t row_bytes = (int64_t) box->width * (desc->block.bits / 8);
+   const int64_t last_row =
+      dst_offset + (int64_t) (box->height - 1) * dst_stride;
+   const uint8_t zero[16] = { 0 };
+   uint8_t pixel[16];
+   unsigned i;
+
+   if (dst->target != PIPE_BUFFER ||
+       !llvmpipe_resource_is_texture(src->texture) ||
+       box->width <= 0 || box->height <= 0 || box->x < 0 || box->y < 0 ||
+       box->x + box->width > fb->width || box->y + box->height > fb->height)
+      return false;
+
+   if (MIN2(last_row, dst_offset) < 0 ||
+       MAX2(last_row, dst_offset) + row_bytes > dst->width0)
+      return false;
+
+   /* The rasterizer converts with util_format_translate(), see whether it
+    * can on a single pixel.
+    */
+   if (desc->block.width != 1 || desc->block.height != 1 ||
+       desc->block.bits > 8 * sizeof(pixel) ||
+       util_format_get_blocksize(src->format) > sizeof(zero) ||
+       !util_format_translate(dst_format, pixel, 0, 0, 0,
+                              util_format_linear(src->format), zero, 0, 0, 0,
+                              1, 1))
+      return false;
+
+   for (i = 0; i < fb->nr_cbufs; i++) {
+      const struct pipe_surface *cbuf = fb->cbufs[i];
+
+      if (cbuf && cbuf->texture == src->texture &&
+          cbuf->format == src->format &&
+          cbuf->u.tex.level == src->u.tex.level &&
+          cbuf->u.tex.first_layer == src->u.tex.first_layer)
+         return lp_setup_readback(lp->setup, i, box, dst, dst_format,
+                                  dst_offset, dst_stride);
+   }
+
+   return false;
+}
+
+
+/**
+ * The dirty regions grow as scenes are queued, see
+ * lp_setup_rasterize_scene(), so the one binning is flushed first.
+ */
+static bool
+llvmpipe_get_dirty_region(struct pipe_context *pipe,
+                          struct pipe_resource *resource,
+                          bool reset,
+                          struct pipe_box *box)
+{
+   struct llvmpipe_context *lp = llvmpipe_context(pipe);
+   struct llvmpipe_resource *lpr = llvmpipe_resource(resource);
+
+   if (!llvmpipe_resource_is_texture(resource))
+      return false;
+
+   if (lp_setup_is_resource_referenced(lp->setup, resource) &
+       LP_REFERENCED_FOR_WRITE)
+      llvmpipe_flush(pipe, NULL, __FUNCTION__);
+
+   memset(box, 0, sizeof(*box));
+   if (lpr->dirty_x1 > lpr->dirty_x0 && lpr->dirty_y1 > lpr->dirty_y0)
+      u_box_2d(lpr->dirty_x0, lpr->dirty_y0,
+               lpr->dirty_x1 - lpr->dirty_x0,
+               lpr->dirty_y1 - lpr->dirty_y0, box);
+
+   if (reset)
+      lpr->dirty_x0 = lpr->dirty_y0 = lpr->dirty_x1 = lpr->dirty_y1 = 0;
+
+   return true;
+}
+
+
+/**
+ * The scenes binned or in flight keep calling the old callback, so they
+ * are waited for.
+ */
+static void
+llvmpipe_set_progress_callback(struct pipe_context *pipe,
+                               struct pipe_resource *resource,
+                               void (*func)(void *data, unsigned rows),
+                               void *data)
+{
+   struct llvmpipe_resource *lpr = llvmpipe_resource(resource);
+
+   if (!llvmpipe_resource_is_texture(resource))
+      return;
+
+   llvmpipe_flush_resource(pipe, resource, 0, TRUE, TRUE, FALSE,
+                           __FUNCTION__);
+
+   lpr->progress_func = func;
+   lpr->progress_data = func ? data : NULL;
+}
+
+
 static struct pipe_surface *
 llvmpipe_create_surface(struct pipe_context *pipe,
                         struct pipe_resource *pt,
@@ -195,6 +566,10 @@ llvmpipe_create_surface(struct pipe_context *pipe,
       }
    }
 
+   /* Rendering is to linear images only */
+   if (llvmpipe_resource_is_texture(pt))
+      llvmpipe_resource_untile(pipe, pt);
+
    ps = CALLOC_STRUCT(pipe_surface);
    if (ps) {
       pipe_reference_init(&ps->reference, 1);
@@ -434,6 +809,276 @@ llvmpipe_clear_texture(struct pipe_context *pipe,
    }
 }
 
+/**
+ * Levels with at least this many bytes are computed by the compute
+ * threads, a band of rows each.
+ */
+#define LP_MIPMAP_THREAD_SIZE (256 * 1024)
+
+
+/** A mipmap level to compute from the one above it */
+struct lp_mipmap_job
+{
+   struct llvmpipe_resource *lpr;
+   enum pipe_format format;
+   unsigned level;           /**< the level written */
+   unsigned first_layer, num_layers;
+   unsigned rows_per_band;
+   boolean unorm8;           /**< only 8-bit unorm channels, see below */
+};
+
+
+/**
+ * Whether the texels of format are bytes which can be averaged as they
+ * are, without unpacking.
+ */
+static boolean
+lp_mipmap_format_is_unorm8(const struct util_format_description *desc)
+{
+   unsigned i;
+
+   if (desc->layout != UTIL_FORMAT_LAYOUT_PLAIN ||
+       desc->colorspace != UTIL_FORMAT_COLORSPACE_RGB ||
+       desc->block.bits % 8)
+      return FALSE;
+
+   for (i = 0; i < desc->nr_channels; i++) {
+      if (desc->channel[i].size != 8)
+         return FALSE;
+      if (desc->channel[i].type != UTIL_FORMAT_TYPE_VOID &&
+          (desc->channel[i].type != UTIL_FORMAT_TYPE_UNSIGNED ||
+           !desc->channel[i].normalized))
+         return FALSE;
+   }
+
+   return TRUE;
+}
+
+
+/**
+ * Box filter a row of bytes: each output byte is the rounded average of
+ * the 2 bytes of a texel pair in each of the num_src source rows.  Odd
+ * sized levels leave their last texel out, one texel wide ones use it
+ * twice.
+ */
+static void
+lp_mipmap_row_unorm8(uint8_t *dst, const uint8_t **src, unsigned num_src,
+                     unsigned width, unsigned src_width, unsigned bpp)
+{
+   const unsigned taps = 2 * num_src;
+   unsigned x = 0, c, i;
+
+#if defined(PIPE_ARCH_SSE)
+   if (bpp == 4 && num_src == 2) {
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i round = _mm_set1_epi16(2);
+
+      /* Two texels out of four in each row */
+      for (; x + 2 <= width && 2 * x + 4 <= src_width; x += 2) {
+         __m128i r0 = _mm_loadu_si128((const __m128i *)(src[0] + x * 8));
+         __m128i r1 = _mm_loadu_si128((const __m128i *)(src[1] + x * 8));
+         __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(r0, zero),
+                                    _mm_unpacklo_epi8(r1, zero));
+         __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(r0, zero),
+                                    _mm_unpackhi_epi8(r1, zero));
+         __m128i sum;
+
+         lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+         hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+         sum = _mm_unpacklo_epi64(lo, hi);
+         sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+         _mm_storel_epi64((__m128i *)(dst + x * 4),
+                          _mm_packus_epi16(sum, sum));
+      }
+   }
+#endif
+
+   for (; x < width; x++) {
+      const unsigned x0 = MIN2(2 * x, src_width - 1) * bpp;
+      const unsigned x1 = MIN2(2 * x + 1, src_width - 1) * bpp;
+
+      for (c = 0; c < bpp; c++) {
+         unsigned sum = taps / 2;
+
+         for (i = 0; i < num_src; i++)
+            sum += src[i][x0 + c] + src[i][x1 + c];
+         dst[x * bpp + c] = sum / taps;
+      }
+   }
+}
+
+
+static void
+lp_mipmap_band(void *data, int band, struct lp_cs_local_mem *lmem)
+{
+   const struct lp_mipmap_job *job = data;
+   struct llvmpipe_resource *lpr = job->lpr;
+   const struct pipe_resource *pt = &lpr->base;
+   const unsigned src_level = job->level - 1;
+   const unsigned bpp = util_format_get_blocksize(job->format);
+   const unsigned width = u_minify(pt->width0, job->level);
+   const unsigned height = u_minify(pt->height0, job->level);
+   const unsigned src_width = u_minify(pt->width0, src_level);
+   const unsigned src_height = u_minify(pt->height0, src_level);
+   const unsigned src_depth = u_minify(pt->depth0, src_level);
+   const unsigned num_rows = height * job->num_layers;
+   const unsigned first = band * job->rows_per_band;
+   const unsigned last = MIN2(first + job->rows_per_band, num_rows);
+   float *tmp = NULL;
+   unsigned i, j, k;
+
+   if (!job->unorm8) {
+      tmp = MALLOC((4 * src_width + width) * 4 * sizeof *tmp);
+      if (!tmp)
+         return;
+   }
+
+   for (i = first; i < last; i++) {
+      const unsigned layer = job->first_layer + i / height;
+      const unsigned y = i % height;
+      const unsigned sy[2] = { MIN2(2 * y, src_height - 1),
+                               MIN2(2 * y + 1, src_height - 1) };
+      const uint8_t *src[4];
+      unsigned num_src = 0;
+      uint8_t *dst;
+
+      /* 3D textures filter two slices, others one layer */
+      for (j = 0; j < (pt->target == PIPE_TEXTURE_3D ? 2 : 1); j++) {
+         const unsigned src_layer = pt->target == PIPE_TEXTURE_3D ?
+            MIN2(2 * layer + j, src_depth - 1) : layer;
+         const uint8_t *image =
+            llvmpipe_get_texture_image_address(lpr, src_layer, src_level);
+
+         for (k = 0; k < 2; k++)
+            src[num_src++] = image + sy[k] * lpr->row_stride[src_level];
+      }
+
+      dst = (uint8_t *) llvmpipe_get_texture_image_address(lpr, layer,
+                                                           job->level) +
+            y * lpr->row_stride[job->level];
+
+      if (job->unorm8) {
+         lp_mipmap_row_unorm8(dst, src, num_src, width, src_width, bpp);
+      }
+      else {
+         float *out = tmp + 4 * 4 * src_width;
+         unsigned x, c;
+
+         for (j = 0; j < num_src; j++)
+            util_format_unpack_rgba(job->format, tmp + j * 4 * src_width,
+                                    src[j], src_width);
+
+         for (x = 0; x < width; x++) {
+            const unsigned x0 = MIN2(2 * x, src_width - 1) * 4;
+            const unsigned x1 = MIN2(2 * x + 1, src_width - 1) * 4;
+
+            for (c = 0; c < 4; c++) {
+               float sum = 0.0f;
+
+               for (j = 0; j < num_src; j++) {
+                  const float *row = tmp + j * 4 * src_width;
+                  sum += row[x0 + c] + row[x1 + c];
+               }
+               out[x * 4 + c] = sum / (2 * num_src);
+            }
+         }
+
+         util_format_pack_rgba(job->format, dst, out, width);
+      }
+   }
+
+   FREE(tmp);
+}
+
+
+/**
+ * Compute the levels right in the texture memory with a box filter,
+ * rather than blitting them one draw and one scene at a time, splitting
+ * the bigger levels over the compute threads.  Other formats and layouts
+ * are still blitted with util_gen_mipmap(): the threaded context expects
+ * this to succeed for any supported format.
+ */
+static bool
+llvmpipe_generate_mipmap(struct pipe_context *pipe,
+                         struct pipe_resource *pt,
+                         enum pipe_format format,
+                         unsigned base_level,
+                         unsigned last_level,
+                         unsigned first_layer,
+                         unsigned last_layer)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(pipe->screen);
+   struct llvmpipe_resource *lpr = llvmpipe_resource(pt);
+   const struct util_format_description *desc = util_format_description(format);
+   struct lp_mipmap_job job;
+   unsigned level;
+
+   if (!llvmpipe_resource_is_texture(pt) || lpr->dt ||
+       llvmpipe_resource_is_tiled(pt) || pt->nr_samples > 1 ||
+       desc->block.width != 1 || desc->block.height != 1 ||
+       desc->block.bits != util_format_get_blocksizebits(pt->format) ||
+       util_format_is_depth_or_stencil(format) ||
+       util_format_is_pure_integer(format))
+      goto blit;
+
+   job.lpr = lpr;
+   job.format = format;
+   job.unorm8 = lp_mipmap_format_is_unorm8(desc);
+   if (!job.unorm8 &&
+       (!util_format_unpack_description(format)->unpack_rgba ||
+        !util_format_pack_description(format)->pack_rgba_float))
+      goto blit;
+
+   llvmpipe_flush_resource(pipe, pt, 0, FALSE, TRUE, FALSE, __FUNCTION__);
+
+   for (level = base_level + 1; level <= last_level; level++) {
+      const unsigned row_bytes =
+         u_minify(pt->width0, level) * desc->block.bits / 8;
+      unsigned num_rows, num_bands = 1;
+
+      if (pt->target == PIPE_TEXTURE_3D) {
+         job.first_layer = 0;
+         job.num_layers = u_minify(pt->depth0, level);
+      }
+      else {
+         job.first_layer = first_layer;
+         job.num_layers = last_layer + 1 - first_layer;
+      }
+      job.level = level;
+
+      num_rows = u_minify(pt->height0, level) * job.num_layers;
+      if (screen->num_threads > 1 &&
+          (uint64_t) num_rows * row_bytes >= LP_MIPMAP_THREAD_SIZE)
+         num_bands = MIN2(num_rows, screen->num_threads * 4);
+      job.rows_per_band = DIV_ROUND_UP(num_rows, num_bands);
+      num_bands = DIV_ROUND_UP(num_rows, job.rows_per_band);
+
+      if (num_bands > 1) {
+         struct lp_cs_tpool_task *task;
+
+         mtx_lock(&screen->cs_mutex);
+         task = lp_cs_tpool_queue_task(screen->cs_tpool, lp_mipmap_band,
+                                       &job, num_bands);
+         lp_cs_tpool_wait_for_task(screen->cs_tpool, &task);
+         mtx_unlock(&screen->cs_mutex);
+      }
+      else {
+         lp_mipmap_band(&job, 0, NULL);
+      }
+   }
+
+   /* Do something to notify sharing contexts of a texture change. */
+   screen->timestamp++;
+   lpr->writes++;
+   lpr->timestamp = screen->timestamp;
+   return true;
+
+blit:
+   return util_gen_mipmap(pipe, pt, format, base_level, last_level,
+                          first_layer, last_layer, PIPE_TEX_FILTER_LINEAR);
+}
+
+
 void
 llvmpipe_init_surface_functions(struct llvmpipe_context *lp)
 {
@@ -446,5 +1091,10 @@ llvmpipe_init_surface_functions(struct llvmpipe_context *lp)
    lp->pipe.resource_copy_region = lp_resource_copy;
    lp->pipe.blit = lp_blit;
    lp->pipe.flush_resource = lp_flush_resource;
+   lp->pipe.invalidate_resource = llvmpipe_invalidate_resource;
+   lp->pipe.readback_to_buffer = llvmpipe_readback_to_buffer;
+   lp->pipe.get_dirty_region = llvmpipe_get_dirty_region;
+   lp->pipe.set_progress_callback = llvmpipe_set_progress_callback;
+   lp->pipe.generate_mipmap = llvmpipe_generate_mipmap;
    lp->pipe.get_sample_position = llvmpipe_get_sample_position;
 }
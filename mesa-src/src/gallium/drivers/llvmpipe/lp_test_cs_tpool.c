@@ -0,0 +1,187 @@
+/*
+ * Copyright © 2026 Mesa contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * Dispatch micro-benchmark for the compute thread pool: queues tasks of
+ * many tiny iterations, as small compute grids and texture uploads do,
+ * and checks that every iteration runs exactly once.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "util/os_time.h"
+#include "util/u_atomic.h"
+#include "util/u_memory.h"
+
+#include "lp_cs_tpool.h"
+#include "lp_test.h"
+
+
+struct cs_tpool_test_case {
+   unsigned num_threads;
+   unsigned num_iters;
+   unsigned num_tasks;
+};
+
+static const struct cs_tpool_test_case test_cases[] = {
+   { 0,    64,    16 },
+   { 1,     0,    16 },
+   { 1,  1024,    16 },
+   { 4,     1,  1024 },
+   { 4,    16,  1024 },
+   { 4,  4096,    64 },
+   { 8,   256,   256 },
+   { 8, 65536,     8 },
+};
+
+
+struct cs_tpool_test_data {
+   unsigned *counts;
+};
+
+
+static void
+cs_tpool_test_work(void *data, int iter_idx, struct lp_cs_local_mem *lmem)
+{
+   struct cs_tpool_test_data *test = data;
+
+   p_atomic_inc(&test->counts[iter_idx]);
+}
+
+
+void
+write_tsv_header(FILE *fp)
+{
+   fprintf(fp,
+           "result\t"
+           "threads\t"
+           "iterations\t"
+           "tasks\t"
+           "usecs_per_task\n");
+
+   fflush(fp);
+}
+
+
+static boolean
+test_cs_tpool(unsigned verbose, FILE *fp,
+              const struct cs_tpool_test_case *testcase)
+{
+   struct lp_cs_tpool *pool;
+   struct cs_tpool_test_data test;
+   boolean success = TRUE;
+   int64_t start, end;
+
+   pool = lp_cs_tpool_create(testcase->num_threads, LP_THREAD_AFFINITY_NONE);
+   if (!pool)
+      return FALSE;
+
+   test.counts = CALLOC(MAX2(testcase->num_iters, 1), sizeof(unsigned));
+   if (!test.counts) {
+      lp_cs_tpool_destroy(pool);
+      return FALSE;
+   }
+
+   start = os_time_get();
+   for (unsigned t = 0; t < testcase->num_tasks; t++) {
+      struct lp_cs_tpool_task *task;
+
+      task = lp_cs_tpool_queue_task(pool, cs_tpool_test_work, &test,
+                                    testcase->num_iters);
+      lp_cs_tpool_wait_for_task(pool, &task);
+   }
+   end = os_time_get();
+
+   for (unsigned i = 0; i < testcase->num_iters; i++) {
+      if (test.counts[i] != testcase->num_tasks) {
+         if (verbose < 1)
+            fprintf(stderr, "threads %u, iterations %u: ",
+                    testcase->num_threads, testcase->num_iters);
+         fprintf(stderr, "iteration %u ran %u times, expected %u\n",
+                 i, test.counts[i], testcase->num_tasks);
+         success = FALSE;
+         break;
+      }
+   }
+
+   double usecs = (double)(end - start) / testcase->num_tasks;
+
+   if (verbose >= 1)
+      printf("threads %u, iterations %u, tasks %u: %.2f usecs/task\n",
+             testcase->num_threads, testcase->num_iters,
+             testcase->num_tasks, usecs);
+
+   if (fp) {
+      fprintf(fp, "%s\t%u\t%u\t%u\t%f\n", success ? "pass" : "fail",
+              testcase->num_threads, testcase->num_iters,
+              testcase->num_tasks, usecs);
+      fflush(fp);
+   }
+
+   FREE(test.counts);
+   lp_cs_tpool_destroy(pool);
+
+   return success;
+}
+
+
+boolean
+test_all(unsigned verbose, FILE *fp)
+{
+   boolean success = TRUE;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(test_cases); i++) {
+      if (!test_cs_tpool(verbose, fp, &test_cases[i]))
+         success = FALSE;
+   }
+
+   return success;
+}
+
+
+boolean
+test_some(unsigned verbose, FILE *fp,
+          unsigned long n)
+{
+   boolean success = TRUE;
+
+   for (unsigned long i = 0; i < n; i++) {
+      const struct cs_tpool_test_case *testcase =
+         &test_cases[rand() % ARRAY_SIZE(test_cases)];
+
+      if (!test_cs_tpool(verbose, fp, testcase))
+         success = FALSE;
+   }
+
+   return success;
+}
+
+
+boolean
+test_single(unsigned verbose, FILE *fp)
+{
+   printf("no test_single()");
+   return TRUE;
+}
@@ -175,6 +175,9 @@ test_format_float(unsigned verbose, FILE *fp,
 
          /* To ensure it's 16-byte aligned */
          memcpy(packed, test->packed, sizeof packed);
+         /* The block cache is tagged by address only */
+         if (use_cache)
+            lp_build_format_cache_reset(cache_ptr);
 
          for (i = 0; i < desc->block.height; ++i) {
             for (j = 0; j < desc->block.width; ++j) {
@@ -276,6 +279,9 @@ test_format_unorm8(unsigned verbose, FILE *fp,
          /* To ensure it's 16-byte aligned */
          /* Could skip this and use unaligned lp_build_fetch_rgba_aos */
          memcpy(packed, test->packed, sizeof packed);
+         /* The block cache is tagged by address only */
+         if (use_cache)
+            lp_build_format_cache_reset(cache_ptr);
 
          for (i = 0; i < desc->block.height; ++i) {
             for (j = 0; j < desc->block.width; ++j) {
@@ -362,7 +368,7 @@ test_all(unsigned verbose, FILE *fp)
    boolean success = TRUE;
    unsigned use_cache;
 
-   cache_ptr = align_malloc(sizeof(struct lp_build_format_cache), 16);
+   cache_ptr = lp_build_format_cache_create(LP_BUILD_FORMAT_CACHE_SIZE);
 
    for (use_cache = 0; use_cache < 2; use_cache++) {
       for (format = 1; format < PIPE_FORMAT_COUNT; ++format) {
@@ -394,7 +400,7 @@ test_all(unsigned verbose, FILE *fp)
             continue;
 
          /* only test twice with formats which can use cache */
-         if (format_desc->layout != UTIL_FORMAT_LAYOUT_S3TC && use_cache) {
+         if (!lp_build_format_cache_supported(format_desc) && use_cache) {
             continue;
          }
 
@@ -403,7 +409,7 @@ test_all(unsigned verbose, FILE *fp)
          }
       }
    }
-   align_free(cache_ptr);
+   lp_build_format_cache_destroy(cache_ptr);
 
    return success;
 }
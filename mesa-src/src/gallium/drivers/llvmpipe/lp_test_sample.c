@@ -0,0 +1,508 @@
+/*
+ * Copyright © 2026 Mesa contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * Unit and performance test of texture sampling.
+ *
+ * For every format and filter a 2D texture is sampled with the generated
+ * SoA sampler, as a fragment shader would, at the centre of every texel.
+ * Without mipmapping the result must match util_format's unpack.  With -o
+ * the cycles per texel are written too, which covers the format unpacking
+ * and the conversions the sampler does, per format and for the native
+ * vector width (see LP_NATIVE_VECTOR_WIDTH).
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <float.h>
+
+#include "util/u_math.h"
+#include "util/u_memory.h"
+#include "util/format/u_format.h"
+
+#include "gallivm/lp_bld.h"
+#include "gallivm/lp_bld_const.h"
+#include "gallivm/lp_bld_debug.h"
+#include "gallivm/lp_bld_flow.h"
+#include "gallivm/lp_bld_init.h"
+#include "gallivm/lp_bld_sample.h"
+#include "gallivm/lp_bld_tgsi.h"
+
+#include "lp_jit.h"
+#include "lp_state_fs.h"
+#include "lp_tex_sample.h"
+#include "lp_test.h"
+
+
+#define TEX_SIZE 128
+#define TEX_LEVELS 8    /* down to 1x1 */
+#define NUM_TEXELS (TEX_SIZE * TEX_SIZE)
+
+
+typedef void
+(*sample_ptr_t)(const struct lp_jit_context *context,
+                const float *s, const float *t,
+                float *r, float *g, float *b, float *a,
+                uint32_t num_packets);
+
+
+static const struct {
+   const char *name;
+   unsigned img_filter;
+   unsigned mip_filter;
+   float lod_bias;              /**< so that two levels are blended */
+} filters[] = {
+   { "nearest", PIPE_TEX_FILTER_NEAREST, PIPE_TEX_MIPFILTER_NONE, 0.0f },
+   { "linear", PIPE_TEX_FILTER_LINEAR, PIPE_TEX_MIPFILTER_NONE, 0.0f },
+   { "trilinear", PIPE_TEX_FILTER_LINEAR, PIPE_TEX_MIPFILTER_LINEAR, 0.5f },
+};
+
+
+void
+write_tsv_header(FILE *fp)
+{
+   fprintf(fp,
+           "result\t"
+           "cycles_per_texel\t"
+           "texels_per_cycle\t"
+           "vector_width\t"
+           "filter\t"
+           "format\n");
+
+   fflush(fp);
+}
+
+
+static void
+write_tsv_row(FILE *fp,
+              const struct util_format_description *desc,
+              unsigned filter,
+              double cycles,
+              boolean success)
+{
+   fprintf(fp, "%s\t", success ? "pass" : "fail");
+
+   fprintf(fp, "%.2f\t", cycles / NUM_TEXELS);
+
+   fprintf(fp, "%.3f\t", cycles ? NUM_TEXELS / cycles : 0.0);
+
+   fprintf(fp, "%u\t", lp_native_vector_width);
+
+   fprintf(fp, "%s\t", filters[filter].name);
+
+   fprintf(fp, "%s\n", desc->name);
+
+   fflush(fp);
+}
+
+
+/**
+ * Build a function sampling texture 0 at num_packets vectors of coords,
+ * and storing the texels in SoA.
+ */
+static LLVMValueRef
+add_sample_test(struct gallivm_state *gallivm,
+                LLVMTypeRef context_ptr_type,
+                const struct lp_sampler_static_state *static_state,
+                struct lp_type type)
+{
+   LLVMContextRef context = gallivm->context;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMTypeRef float_ptr_type =
+      LLVMPointerType(LLVMFloatTypeInContext(context), 0);
+   LLVMTypeRef vec_ptr_type =
+      LLVMPointerType(lp_build_vec_type(gallivm, type), 0);
+   LLVMTypeRef args[8];
+   LLVMValueRef func;
+   LLVMValueRef coords[5];
+   LLVMValueRef texel[4];
+   LLVMValueRef offset;
+   LLVMBasicBlockRef block;
+   struct lp_build_sampler_soa *sampler;
+   struct lp_build_loop_state loop;
+   struct lp_sampler_params params;
+   unsigned i;
+
+   args[0] = context_ptr_type;
+   for (i = 1; i < 7; i++)
+      args[i] = float_ptr_type;
+   args[7] = LLVMInt32TypeInContext(context);
+
+   func = LLVMAddFunction(gallivm->module, "sample",
+                          LLVMFunctionType(LLVMVoidTypeInContext(context),
+                                           args, ARRAY_SIZE(args), 0));
+   LLVMSetFunctionCallConv(func, LLVMCCallConv);
+
+   block = LLVMAppendBasicBlockInContext(context, func, "entry");
+   LLVMPositionBuilderAtEnd(builder, block);
+
+   sampler = lp_llvm_sampler_soa_create(static_state, 1, FALSE);
+
+   lp_build_loop_begin(&loop, gallivm, lp_build_const_int32(gallivm, 0));
+
+   offset = LLVMBuildMul(builder, loop.counter,
+                         lp_build_const_int32(gallivm, type.length), "");
+
+   for (i = 0; i < 2; i++) {
+      LLVMValueRef ptr = LLVMBuildGEP(builder, LLVMGetParam(func, 1 + i),
+                                      &offset, 1, "");
+      ptr = LLVMBuildBitCast(builder, ptr, vec_ptr_type, "");
+      coords[i] = LLVMBuildLoad(builder, ptr, "");
+   }
+   for (; i < ARRAY_SIZE(coords); i++)
+      coords[i] = lp_build_undef(gallivm, type);
+
+   /* Implicit lod, per quad, as fragment shaders sample */
+   memset(&params, 0, sizeof params);
+   params.type = type;
+   params.sample_key = (LP_SAMPLER_OP_TEXTURE << LP_SAMPLER_OP_TYPE_SHIFT) |
+                       (LP_SAMPLER_LOD_PER_QUAD << LP_SAMPLER_LOD_PROPERTY_SHIFT);
+   params.texture_index = 0;
+   params.sampler_index = 0;
+   params.context_ptr = LLVMGetParam(func, 0);
+   params.coords = coords;
+   params.texel = texel;
+
+   sampler->emit_tex_sample(sampler, gallivm, &params);
+
+   for (i = 0; i < 4; i++) {
+      LLVMValueRef ptr = LLVMBuildGEP(builder, LLVMGetParam(func, 3 + i),
+                                      &offset, 1, "");
+      ptr = LLVMBuildBitCast(builder, ptr, vec_ptr_type, "");
+      LLVMBuildStore(builder, texel[i], ptr);
+   }
+
+   lp_build_loop_end_cond(&loop, LLVMGetParam(func, 7), NULL, LLVMIntUGE);
+
+   LLVMBuildRetVoid(builder);
+
+   sampler->destroy(sampler);
+
+   gallivm_verify_function(gallivm, func);
+
+   return func;
+}
+
+
+/**
+ * Fill all levels of the texture.  Plain formats get random colors in
+ * [0, 1], which can be checked against; the others random bytes.
+ */
+static boolean
+init_texture(const struct util_format_description *desc,
+             struct lp_jit_texture *jit_tex, uint8_t **data)
+{
+   const struct util_format_pack_description *pack =
+      util_format_pack_description(desc->format);
+   boolean plain = desc->layout == UTIL_FORMAT_LAYOUT_PLAIN &&
+                   desc->block.width == 1 && pack && pack->pack_rgba_float;
+   float row[TEX_SIZE][4];
+   unsigned size = 0;
+   unsigned level, x, y, c;
+
+   for (level = 0; level < TEX_LEVELS; level++) {
+      unsigned width = u_minify(TEX_SIZE, level);
+      unsigned stride = util_format_get_stride(desc->format, width);
+      unsigned nblocksy = util_format_get_nblocksy(desc->format, width);
+
+      jit_tex->row_stride[level] = stride;
+      jit_tex->img_stride[level] = stride * nblocksy;
+      jit_tex->mip_offsets[level] = size;
+      size = align(size + stride * nblocksy, 64);
+   }
+
+   *data = align_malloc(size, 64);
+   for (level = 0; level < TEX_LEVELS; level++) {
+      unsigned width = u_minify(TEX_SIZE, level);
+      unsigned nblocksy = util_format_get_nblocksy(desc->format, width);
+      uint8_t *dst = *data + jit_tex->mip_offsets[level];
+
+      for (y = 0; y < nblocksy; y++) {
+         if (plain) {
+            for (x = 0; x < width; x++)
+               for (c = 0; c < 4; c++)
+                  row[x][c] = (float)rand() / RAND_MAX;
+            util_format_pack_rgba(desc->format, dst, row, width);
+         } else {
+            for (x = 0; x < jit_tex->row_stride[level]; x++)
+               dst[x] = rand();
+         }
+         dst += jit_tex->row_stride[level];
+      }
+   }
+
+   jit_tex->width = TEX_SIZE;
+   jit_tex->height = TEX_SIZE;
+   jit_tex->depth = 1;
+   jit_tex->base = *data;
+   jit_tex->first_level = 0;
+
+   return plain;
+}
+
+
+PIPE_ALIGN_STACK
+static boolean
+test_one(unsigned verbose, FILE *fp,
+         const struct util_format_description *desc,
+         unsigned filter)
+{
+   struct lp_type type = lp_type_float_vec(32, lp_native_vector_width);
+   unsigned num_packets = NUM_TEXELS / type.length;
+   const unsigned n = fp ? LP_TEST_NUM_SAMPLES : 1;
+   int64_t cycles[LP_TEST_NUM_SAMPLES];
+   double cycles_avg = 0.0;
+   LLVMContextRef context;
+   struct gallivm_state *gallivm;
+   struct lp_fragment_shader_variant *variant;
+   struct lp_sampler_static_state static_state;
+   struct pipe_resource texture;
+   struct pipe_sampler_view view;
+   struct pipe_sampler_state state;
+   struct lp_jit_context *jit_context;
+   LLVMValueRef func;
+   sample_ptr_t sample_ptr;
+   uint8_t *data;
+   float *s, *t, *out[4];
+   boolean check;
+   boolean success = TRUE;
+   unsigned i, c;
+
+   memset(&texture, 0, sizeof texture);
+   texture.target = PIPE_TEXTURE_2D;
+   texture.format = desc->format;
+   texture.width0 = TEX_SIZE;
+   texture.height0 = TEX_SIZE;
+   texture.depth0 = 1;
+   texture.array_size = 1;
+   texture.last_level = TEX_LEVELS - 1;
+
+   memset(&view, 0, sizeof view);
+   view.format = desc->format;
+   view.texture = &texture;
+   view.target = PIPE_TEXTURE_2D;
+   view.swizzle_r = PIPE_SWIZZLE_X;
+   view.swizzle_g = PIPE_SWIZZLE_Y;
+   view.swizzle_b = PIPE_SWIZZLE_Z;
+   view.swizzle_a = PIPE_SWIZZLE_W;
+   view.u.tex.last_level =
+      filters[filter].mip_filter == PIPE_TEX_MIPFILTER_NONE ? 0 : TEX_LEVELS - 1;
+
+   memset(&state, 0, sizeof state);
+   state.wrap_s = PIPE_TEX_WRAP_REPEAT;
+   state.wrap_t = PIPE_TEX_WRAP_REPEAT;
+   state.wrap_r = PIPE_TEX_WRAP_REPEAT;
+   state.min_img_filter = filters[filter].img_filter;
+   state.mag_img_filter = filters[filter].img_filter;
+   state.min_mip_filter = filters[filter].mip_filter;
+   state.normalized_coords = 1;
+   state.lod_bias = filters[filter].lod_bias;
+   state.max_lod = view.u.tex.last_level;
+
+   lp_sampler_static_texture_state(&static_state.texture_state, &view);
+   lp_sampler_static_sampler_state(&static_state.sampler_state, &state);
+
+   context = LLVMContextCreate();
+   gallivm = gallivm_create("test_module_sample", context, NULL);
+
+   /* Only for the lp_jit_context type */
+   variant = CALLOC_STRUCT(lp_fragment_shader_variant);
+   variant->gallivm = gallivm;
+   lp_jit_init_types(variant);
+
+   func = add_sample_test(gallivm, variant->jit_context_ptr_type,
+                          &static_state, type);
+
+   gallivm_compile_module(gallivm);
+
+   sample_ptr = (sample_ptr_t) gallivm_jit_function(gallivm, func);
+
+   gallivm_free_ir(gallivm);
+
+   jit_context = align_malloc(sizeof *jit_context, 16);
+   memset(jit_context, 0, sizeof *jit_context);
+   check = init_texture(desc, &jit_context->textures[0], &data) &&
+           filters[filter].mip_filter == PIPE_TEX_MIPFILTER_NONE;
+   jit_context->textures[0].last_level = view.u.tex.last_level;
+   jit_context->samplers[0].max_lod = state.max_lod;
+   jit_context->samplers[0].lod_bias = state.lod_bias;
+
+   /* The texel centres, quad by quad */
+   s = align_malloc(NUM_TEXELS * sizeof(float), 64);
+   t = align_malloc(NUM_TEXELS * sizeof(float), 64);
+   for (c = 0; c < 4; c++)
+      out[c] = align_malloc(NUM_TEXELS * sizeof(float), 64);
+   for (i = 0; i < NUM_TEXELS; i++) {
+      unsigned quad = i / 4;
+      unsigned x = 2 * (quad % (TEX_SIZE / 2)) + (i & 1);
+      unsigned y = 2 * (quad / (TEX_SIZE / 2)) + ((i >> 1) & 1);
+
+      s[i] = (x + 0.5f) / TEX_SIZE;
+      t[i] = (y + 0.5f) / TEX_SIZE;
+   }
+
+   for (i = 0; i < n; i++) {
+      int64_t start_counter = rdtsc();
+      sample_ptr(jit_context, s, t, out[0], out[1], out[2], out[3],
+                 num_packets);
+      cycles[i] = rdtsc() - start_counter;
+   }
+
+   for (i = 0; check && i < NUM_TEXELS; i++) {
+      unsigned x = (unsigned)(s[i] * TEX_SIZE);
+      unsigned y = (unsigned)(t[i] * TEX_SIZE);
+      const uint8_t *texel = data + y * jit_context->textures[0].row_stride[0] +
+                             x * (desc->block.bits / 8);
+      float ref[4];
+      boolean match = TRUE;
+
+      util_format_unpack_rgba(desc->format, ref, texel, 1);
+      for (c = 0; c < 4; c++) {
+         if (fabs(out[c][i] - ref[c]) > 0.01 + fabs(ref[c]) * 1e-3)
+            match = FALSE;
+      }
+
+      if (!match || verbose >= 3) {
+         printf("%s: %s (%s) at %u,%u\n", match ? "PASS" : "FAILED",
+                desc->name, filters[filter].name, x, y);
+         printf("  %.9g %.9g %.9g %.9g obtained\n",
+                out[0][i], out[1][i], out[2][i], out[3][i]);
+         printf("  %.9g %.9g %.9g %.9g expected\n",
+                ref[0], ref[1], ref[2], ref[3]);
+         fflush(stdout);
+      }
+      if (!match) {
+         success = FALSE;
+         break;
+      }
+   }
+
+   /*
+    * Unfortunately the output of cycle counter is not very reliable as it comes
+    * -- sometimes we get outliers (due IRQs perhaps?) which are
+    * better removed to avoid random or biased data.
+    */
+   {
+      double sum = 0.0, sum2 = 0.0;
+      double avg, std;
+      unsigned m;
+
+      for (i = 0; i < n; ++i) {
+         sum += cycles[i];
+         sum2 += cycles[i]*cycles[i];
+      }
+
+      avg = sum/n;
+      std = sqrtf((sum2 - n*avg*avg)/n);
+
+      m = 0;
+      sum = 0.0;
+      for (i = 0; i < n; ++i) {
+         if (fabs(cycles[i] - avg) <= 4.0*std) {
+            sum += cycles[i];
+            ++m;
+         }
+      }
+
+      cycles_avg = m ? sum/m : avg;
+   }
+
+   if (verbose >= 1)
+      printf("%s (%s): %.2f cycles/texel\n", desc->name,
+             filters[filter].name, cycles_avg / NUM_TEXELS);
+
+   if (fp)
+      write_tsv_row(fp, desc, filter, cycles_avg, success);
+
+   for (c = 0; c < 4; c++)
+      align_free(out[c]);
+   align_free(t);
+   align_free(s);
+   align_free(data);
+   align_free(jit_context);
+   FREE(variant);
+   gallivm_destroy(gallivm);
+   LLVMContextDispose(context);
+
+   return success;
+}
+
+
+boolean
+test_all(unsigned verbose, FILE *fp)
+{
+   enum pipe_format format;
+   boolean success = TRUE;
+   unsigned filter;
+
+   for (format = 1; format < PIPE_FORMAT_COUNT; ++format) {
+      const struct util_format_description *format_desc;
+
+      format_desc = util_format_description(format);
+      if (!format_desc) {
+         continue;
+      }
+
+      if (format_desc->colorspace == UTIL_FORMAT_COLORSPACE_ZS) {
+         continue;
+      }
+
+      /* Not filterable */
+      if (util_format_is_pure_integer(format))
+         continue;
+
+      /* As in lp_test_format.c, the sampler may call the precompiled fetch
+       * func for formats it has no code for.
+       */
+      if (!util_format_fetch_rgba_func(format))
+         continue;
+
+      if (format_desc->block.depth != 1)
+         continue;
+
+      for (filter = 0; filter < ARRAY_SIZE(filters); filter++) {
+         if (!test_one(verbose, fp, format_desc, filter))
+            success = FALSE;
+      }
+   }
+
+   return success;
+}
+
+
+boolean
+test_some(unsigned verbose, FILE *fp,
+          unsigned long n)
+{
+   return test_all(verbose, fp);
+}
+
+
+boolean
+test_single(unsigned verbose, FILE *fp)
+{
+   return test_one(verbose, fp,
+                   util_format_description(PIPE_FORMAT_B8G8R8A8_UNORM), 1);
+}
@@ -199,6 +199,7 @@ lp_llvm_sampler_member(const struct lp_sampler_dynamic_state *base,
                        struct gallivm_state *gallivm,
                        LLVMValueRef context_ptr,
                        unsigned sampler_unit,
+                       LLVMValueRef sampler_unit_offset,
                        unsigned member_index,
                        const char *member_name,
                        boolean emit_load)
@@ -216,6 +217,11 @@ lp_llvm_sampler_member(const struct lp_sampler_dynamic_state *base,
    indices[1] = lp_build_const_int32(gallivm, LP_JIT_CTX_SAMPLERS);
    /* context[0].samplers[unit] */
    indices[2] = lp_build_const_int32(gallivm, sampler_unit);
+   if (sampler_unit_offset) {
+      indices[2] = LLVMBuildAdd(gallivm->builder, indices[2], sampler_unit_offset, "");
+      LLVMValueRef cond = LLVMBuildICmp(gallivm->builder, LLVMIntULT, indices[2], lp_build_const_int32(gallivm, PIPE_MAX_SAMPLERS), "");
+      indices[2] = LLVMBuildSelect(gallivm->builder, cond, indices[2], lp_build_const_int32(gallivm, sampler_unit), "");
+   }
    /* context[0].samplers[unit].member */
    indices[3] = lp_build_const_int32(gallivm, member_index);
 
@@ -237,10 +243,12 @@ lp_llvm_sampler_member(const struct lp_sampler_dynamic_state *base,
    lp_llvm_sampler_##_name( const struct lp_sampler_dynamic_state *base, \
                             struct gallivm_state *gallivm, \
                             LLVMValueRef context_ptr, \
-                            unsigned sampler_unit) \
+                            unsigned sampler_unit, \
+                            LLVMValueRef sampler_unit_offset) \
    { \
       return lp_llvm_sampler_member(base, gallivm, context_ptr, \
-                                    sampler_unit, _index, #_name, _emit_load ); \
+                                    sampler_unit, sampler_unit_offset, \
+                                    _index, #_name, _emit_load ); \
    }
 
 
@@ -333,7 +341,6 @@ LP_LLVM_IMAGE_MEMBER(img_stride, LP_JIT_IMAGE_IMG_STRIDE, TRUE)
 LP_LLVM_IMAGE_MEMBER(num_samples, LP_JIT_IMAGE_NUM_SAMPLES, TRUE)
 LP_LLVM_IMAGE_MEMBER(sample_stride, LP_JIT_IMAGE_SAMPLE_STRIDE, TRUE)
 
-#if LP_USE_TEXTURE_CACHE
 static LLVMValueRef
 lp_llvm_texture_cache_ptr(const struct lp_sampler_dynamic_state *base,
                           struct gallivm_state *gallivm,
@@ -345,7 +352,6 @@ lp_llvm_texture_cache_ptr(const struct lp_sampler_dynamic_state *base,
 
    return lp_jit_thread_data_cache(gallivm, thread_data_ptr);
 }
-#endif
 
 
 static void
@@ -420,7 +426,8 @@ lp_llvm_sampler_soa_emit_size_query(const struct lp_build_sampler_soa *base,
 
 struct lp_build_sampler_soa *
 lp_llvm_sampler_soa_create(const struct lp_sampler_static_state *static_state,
-                           unsigned nr_samplers)
+                           unsigned nr_samplers,
+                           boolean use_cache)
 {
    struct lp_llvm_sampler_soa *sampler;
 
@@ -447,9 +454,8 @@ lp_llvm_sampler_soa_create(const struct lp_sampler_static_state *static_state,
    sampler->dynamic_state.base.lod_bias = lp_llvm_sampler_lod_bias;
    sampler->dynamic_state.base.border_color = lp_llvm_sampler_border_color;
 
-#if LP_USE_TEXTURE_CACHE
-   sampler->dynamic_state.base.cache_ptr = lp_llvm_texture_cache_ptr;
-#endif
+   if (use_cache)
+      sampler->dynamic_state.base.cache_ptr = lp_llvm_texture_cache_ptr;
 
    sampler->dynamic_state.static_state = static_state;
 
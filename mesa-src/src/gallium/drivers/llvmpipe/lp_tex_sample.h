@@ -35,18 +35,16 @@
 struct lp_sampler_static_state;
 struct lp_image_static_state;
 
-/**
- * Whether texture cache is used for s3tc textures.
- */
-#define LP_USE_TEXTURE_CACHE 0
-
 /**
  * Pure-LLVM texture sampling code generator.
  *
+ * With use_cache, compressed texels are fetched through the thread data's
+ * block cache (lp_jit_thread_data::cache), which must then be non-NULL.
  */
 struct lp_build_sampler_soa *
 lp_llvm_sampler_soa_create(const struct lp_sampler_static_state *key,
-                           unsigned nr_samplers);
+                           unsigned nr_samplers,
+                           boolean use_cache);
 
 struct lp_build_image_soa *
 lp_llvm_image_soa_create(const struct lp_image_static_state *key,
@@ -32,6 +32,13 @@
 
 #include <stdio.h>
 
+#include "util/detect_os.h"
+#if DETECT_OS_UNIX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "pipe/p_context.h"
 #include "pipe/p_defines.h"
 
@@ -39,26 +46,239 @@
 #include "util/u_cpu_detect.h"
 #include "util/format/u_format.h"
 #include "util/u_math.h"
+#include "util/u_memcpy.h"
 #include "util/u_memory.h"
 #include "util/simple_list.h"
 #include "util/u_transfer.h"
+#include "util/u_box.h"
+
+#include "draw/draw_context.h"
 
 #include "lp_context.h"
+#include "lp_cs_tpool.h"
+#include "lp_fence.h"
 #include "lp_flush.h"
+#include "lp_perf.h"
 #include "lp_screen.h"
 #include "lp_texture.h"
 #include "lp_setup.h"
 #include "lp_state.h"
 #include "lp_rast.h"
+#include "lp_trace.h"
 
 #include "frontend/sw_winsys.h"
 
 
-#ifdef DEBUG
+/** All the resources, for llvmpipe_resource_memory() */
 static struct llvmpipe_resource resource_list;
-#endif
+/** The threaded context creates buffers from the application thread */
+static mtx_t resource_list_mutex = _MTX_INITIALIZER_NP;
 static unsigned id_counter = 0;
 
+/** Serializes the allocations of transient textures */
+static mtx_t transient_mutex = _MTX_INITIALIZER_NP;
+
+
+/**
+ * Whether to lay the texture out in tiles, see LP_TILED_TEXTURES.  Only
+ * textures which we expect to be just sampled by fragment or compute
+ * shaders qualify; anything else may still be untiled later.
+ */
+static boolean
+llvmpipe_texture_can_tile(const struct llvmpipe_screen *screen,
+                          const struct llvmpipe_resource *lpr)
+{
+   const struct pipe_resource *pt = &lpr->base;
+
+   if (!screen->tiled_textures || lpr->userBuffer)
+      return FALSE;
+
+   switch (pt->target) {
+   case PIPE_TEXTURE_2D:
+   case PIPE_TEXTURE_RECT:
+   case PIPE_TEXTURE_2D_ARRAY:
+   case PIPE_TEXTURE_CUBE:
+   case PIPE_TEXTURE_CUBE_ARRAY:
+   case PIPE_TEXTURE_3D:
+      break;
+   default:
+      return FALSE;
+   }
+
+   if (util_format_is_compressed(pt->format) ||
+       util_format_is_depth_or_stencil(pt->format))
+      return FALSE;
+
+   if (pt->nr_samples > 1 || pt->usage == PIPE_USAGE_STAGING)
+      return FALSE;
+
+   /* Pages of sparse textures are committed in linear boxes */
+   if (pt->flags & PIPE_RESOURCE_FLAG_SPARSE)
+      return FALSE;
+
+   return (pt->bind & PIPE_BIND_SAMPLER_VIEW) &&
+          !(pt->bind & (PIPE_BIND_DEPTH_STENCIL | PIPE_BIND_LINEAR));
+}
+
+
+/** Huge pages texture data is mapped on, see LP_HUGE_PAGES */
+#define LP_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+
+#if DETECT_OS_LINUX
+static void
+llvmpipe_prefault_page(void *data, int iter_idx,
+                       struct lp_cs_local_mem *lmem)
+{
+   volatile uint8_t *page =
+      (uint8_t *)data + (size_t)iter_idx * LP_HUGE_PAGE_SIZE;
+   unsigned offset;
+
+   /* Anonymous memory reads as zeroes, so this changes nothing */
+   for (offset = 0; offset < LP_HUGE_PAGE_SIZE; offset += 4096)
+      page[offset] = 0;
+}
+#endif
+
+
+/**
+ * Map texture data on huge pages, which cuts the TLB misses and page
+ * faults of rendering to big textures: explicit ones if the system
+ * reserved some, else transparent ones.  The memory is zeroed, and with
+ * LP_PREFAULT faulted in up front, spread over the compute threads.
+ * \return NULL if mapping failed, or isn't supported.
+ */
+static void *
+llvmpipe_map_texture_data(struct llvmpipe_screen *screen,
+                          struct llvmpipe_resource *lpr,
+                          uint64_t size)
+{
+#if DETECT_OS_LINUX
+   const size_t mapped = align64(size, LP_HUGE_PAGE_SIZE);
+   uint8_t *map = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+   map = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+   if (map == MAP_FAILED) {
+      /* Transparent huge pages need an aligned mapping */
+      uint8_t *base = mmap(NULL, mapped + LP_HUGE_PAGE_SIZE,
+                           PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (base == MAP_FAILED)
+         return NULL;
+
+      map = (uint8_t *)align64((uintptr_t)base, LP_HUGE_PAGE_SIZE);
+      if (map != base)
+         munmap(base, map - base);
+      munmap(map + mapped, base + LP_HUGE_PAGE_SIZE - map);
+#ifdef MADV_HUGEPAGE
+      madvise(map, mapped, MADV_HUGEPAGE);
+#endif
+   }
+
+   if (screen->prefault_textures) {
+      const unsigned num_pages = mapped / LP_HUGE_PAGE_SIZE;
+
+      if (screen->num_threads > 1 && num_pages > 1) {
+         struct lp_cs_tpool_task *task;
+
+         mtx_lock(&screen->cs_mutex);
+         task = lp_cs_tpool_queue_task(screen->cs_tpool,
+                                       llvmpipe_prefault_page, map,
+                                       num_pages);
+         lp_cs_tpool_wait_for_task(screen->cs_tpool, &task);
+         mtx_unlock(&screen->cs_mutex);
+      }
+      else {
+         unsigned i;
+         for (i = 0; i < num_pages; i++)
+            llvmpipe_prefault_page(map, i, NULL);
+      }
+   }
+
+   lpr->tex_data_mapped = mapped;
+   return map;
+#else
+   return NULL;
+#endif
+}
+
+
+/**
+ * Map the storage of a sparse resource, see LP_SPARSE_PAGE_SIZE.  The
+ * mapping is anonymous and not reserved, so that the pages which are
+ * never written take no memory, reading as the kernel's zero page.
+ * \return NULL if mapping failed, or isn't supported.
+ */
+static void *
+llvmpipe_map_sparse_data(uint64_t size, size_t *mapped)
+{
+#if DETECT_OS_UNIX
+   const size_t map_size = align64(size, LP_SPARSE_PAGE_SIZE);
+   int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+   void *map;
+
+#ifdef MAP_NORESERVE
+   flags |= MAP_NORESERVE;
+#endif
+   map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+   if (map == MAP_FAILED)
+      return NULL;
+
+   *mapped = map_size;
+   return map;
+#else
+   return NULL;
+#endif
+}
+
+
+static void
+llvmpipe_free_texture_data(struct llvmpipe_resource *lpr)
+{
+#if DETECT_OS_UNIX
+   if (lpr->tex_data_mapped) {
+      munmap(lpr->tex_data, lpr->tex_data_mapped);
+      return;
+   }
+#endif
+   align_free(lpr->tex_data);
+}
+
+
+/**
+ * Allocate the lpr->size_required bytes of a texture, zeroed.
+ */
+static boolean
+llvmpipe_alloc_texture_data(struct llvmpipe_screen *screen,
+                            struct llvmpipe_resource *lpr)
+{
+   const uint64_t total_size = lpr->size_required;
+   void *data = NULL;
+
+   lpr->tex_data_mapped = 0;
+   if (lpr->base.flags & PIPE_RESOURCE_FLAG_SPARSE) {
+      data = llvmpipe_map_sparse_data(total_size, &lpr->tex_data_mapped);
+      if (!data)
+         return FALSE;
+   }
+   else if (screen->huge_page_threshold &&
+            total_size >= screen->huge_page_threshold)
+      data = llvmpipe_map_texture_data(screen, lpr, total_size);
+
+   if (!data) {
+      data = align_malloc(total_size, MAX2(64, util_cpu_caps.cacheline));
+      if (!data)
+         return FALSE;
+      memset(data, 0, total_size);
+   }
+
+   lpr->tex_data = data;
+   return TRUE;
+}
+
 
 /**
  * Conventional allocation path for non-display textures:
@@ -90,6 +310,8 @@ llvmpipe_texture_layout(struct llvmpipe_screen *screen,
    assert(LP_MAX_TEXTURE_2D_LEVELS <= LP_MAX_TEXTURE_LEVELS);
    assert(LP_MAX_TEXTURE_3D_LEVELS <= LP_MAX_TEXTURE_LEVELS);
 
+   lpr->tiled = allocate && llvmpipe_texture_can_tile(screen, lpr);
+
    for (level = 0; level <= pt->last_level; level++) {
       uint64_t mipsize;
       unsigned align_x, align_y, nblocksx, nblocksy, block_size, num_slices;
@@ -120,11 +342,22 @@ llvmpipe_texture_layout(struct llvmpipe_screen *screen,
                                           align(height, align_y));
       block_size = util_format_get_blocksize(pt->format);
 
+      /* Rows of user memory are only padded to the 16 bytes the rasterizer
+       * needs, so that common client layouts can be wrapped as they are.
+       */
       if (util_format_is_compressed(pt->format))
          lpr->row_stride[level] = nblocksx * block_size;
+      else if (lpr->tiled)
+         lpr->row_stride[level] = align(nblocksx * block_size * 4, util_cpu_caps.cacheline);
+      else if (lpr->userBuffer)
+         lpr->row_stride[level] = align(nblocksx * block_size, 16);
       else
          lpr->row_stride[level] = align(nblocksx * block_size, util_cpu_caps.cacheline);
 
+      /* Tiled rows of tiles are 4 texels high */
+      if (lpr->tiled)
+         nblocksy /= 4;
+
       /* if row_stride * height > LP_MAX_TEXTURE_SIZE */
       if ((uint64_t)lpr->row_stride[level] * nblocksy > LP_MAX_TEXTURE_SIZE) {
          /* image too large */
@@ -172,15 +405,8 @@ llvmpipe_texture_layout(struct llvmpipe_screen *screen,
    total_size *= num_samples;
 
    lpr->size_required = total_size;
-   if (allocate) {
-      lpr->tex_data = align_malloc(total_size, mip_align);
-      if (!lpr->tex_data) {
-         return FALSE;
-      }
-      else {
-         memset(lpr->tex_data, 0, total_size);
-      }
-   }
+   if (allocate)
+      return llvmpipe_alloc_texture_data(screen, lpr);
 
    return TRUE;
 
@@ -189,6 +415,28 @@ fail:
 }
 
 
+/**
+ * Give a transient texture its storage, once something needs it in
+ * memory, see llvmpipe_resource::transient.  Returns FALSE if out of
+ * memory.
+ */
+boolean
+llvmpipe_resource_alloc_transient(struct llvmpipe_resource *lpr)
+{
+   boolean ok = TRUE;
+
+   assert(lpr->transient);
+
+   mtx_lock(&transient_mutex);
+   if (!lpr->tex_data)
+      ok = llvmpipe_alloc_texture_data(llvmpipe_screen(lpr->base.screen),
+                                       lpr);
+   mtx_unlock(&transient_mutex);
+
+   return ok;
+}
+
+
 /**
  * Check the size of the texture specified by 'res'.
  * \return TRUE if OK, FALSE if too large.
@@ -255,6 +503,7 @@ llvmpipe_resource_create_all(struct pipe_screen *_screen,
    lpr->base = *templat;
    pipe_reference_init(&lpr->base.reference, 1);
    lpr->base.screen = &screen->base;
+   threaded_resource_init(&lpr->base);
 
    /* assert(lpr->base.bind); */
 
@@ -267,9 +516,26 @@ llvmpipe_resource_create_all(struct pipe_screen *_screen,
             goto fail;
       }
       else {
+         /* Their storage comes once needed, if ever */
+         lpr->transient =
+            (templat->flags & PIPE_RESOURCE_FLAG_TRANSIENT) &&
+            (templat->bind & PIPE_BIND_DEPTH_STENCIL) && alloc_backing;
+
          /* texture map */
-         if (!llvmpipe_texture_layout(screen, lpr, alloc_backing))
+         if (!llvmpipe_texture_layout(screen, lpr,
+                                      alloc_backing && !lpr->transient))
             goto fail;
+
+         lpr->renamable = alloc_backing && !lpr->transient &&
+                          !lpr->tex_data_mapped &&
+                          util_res_sample_count(&lpr->base) <= 1;
+
+         /* Without it, the samples are just never known to be equal */
+         if (lpr->base.nr_samples > 1 &&
+             (lpr->base.bind & PIPE_BIND_RENDER_TARGET))
+            lpr->msaa_equal =
+               CALLOC(llvmpipe_msaa_equal_stride(lpr) *
+                      DIV_ROUND_UP(lpr->base.height0, 4), 1);
       }
    }
    else {
@@ -295,24 +561,34 @@ llvmpipe_resource_create_all(struct pipe_screen *_screen,
       if (!(templat->flags & PIPE_RESOURCE_FLAG_DONT_OVER_ALLOCATE))
          lpr->size_required += (LP_RASTER_BLOCK_SIZE - 1) * 4 * sizeof(float);
 
-      if (alloc_backing) {
+      if (alloc_backing && (templat->flags & PIPE_RESOURCE_FLAG_SPARSE)) {
+         lpr->data = llvmpipe_map_sparse_data(lpr->size_required,
+                                              &lpr->data_mapped);
+         if (!lpr->data)
+            goto fail;
+      }
+      else if (alloc_backing) {
          lpr->data = align_malloc(lpr->size_required, 64);
 
          if (!lpr->data)
             goto fail;
          memset(lpr->data, 0, bytes);
+
+         lpr->constants_only = templat->bind == PIPE_BIND_CONSTANT_BUFFER;
       }
    }
 
    lpr->id = id_counter++;
+   lpr->timestamp = ++screen->timestamp;
 
-#ifdef DEBUG
+   mtx_lock(&resource_list_mutex);
    insert_at_tail(&resource_list, lpr);
-#endif
+   mtx_unlock(&resource_list_mutex);
 
    return &lpr->base;
 
  fail:
+   threaded_resource_deinit(&lpr->base);
    FREE(lpr);
    return NULL;
 }
@@ -344,10 +620,47 @@ llvmpipe_resource_create_unbacked(struct pipe_screen *_screen,
       return pt;
    lpr = llvmpipe_resource(pt);
    lpr->backable = true;
+   /* The memory object may be bound elsewhere, so it can't be replaced */
+   lpr->threaded.is_shared = true;
    *size_required = lpr->size_required;
    return pt;
 }
 
+
+#if DETECT_OS_UNIX
+
+/**
+ * Memory imported from a file descriptor, see EXT_memory_object_fd.  The
+ * file is mapped rather than copied, so the resources created from it
+ * read and write the file's pages in place.  Each of them holds a
+ * reference, so the mapping outlives the GL memory object if need be.
+ */
+struct llvmpipe_memory_object
+{
+   struct pipe_memory_object b;
+   struct pipe_reference reference;
+   void *data;
+   uint64_t size;
+};
+
+
+static void
+llvmpipe_memobj_reference(struct llvmpipe_memory_object **dst,
+                          struct llvmpipe_memory_object *src)
+{
+   struct llvmpipe_memory_object *old = *dst;
+
+   if (pipe_reference(old ? &old->reference : NULL,
+                      src ? &src->reference : NULL)) {
+      munmap(old->data, old->size);
+      FREE(old);
+   }
+   *dst = src;
+}
+
+#endif /* DETECT_OS_UNIX */
+
+
 static void
 llvmpipe_resource_destroy(struct pipe_screen *pscreen,
                           struct pipe_resource *pt)
@@ -363,21 +676,44 @@ llvmpipe_resource_destroy(struct pipe_screen *pscreen,
       }
       else if (llvmpipe_resource_is_texture(pt)) {
          /* free linear image data */
-         if (lpr->tex_data) {
-            align_free(lpr->tex_data);
+         if (lpr->tex_data && !lpr->userBuffer) {
+            llvmpipe_free_texture_data(lpr);
             lpr->tex_data = NULL;
          }
       }
+      else if (lpr->storage) {
+         pipe_resource_reference(&lpr->storage, NULL);
+      }
+#if DETECT_OS_UNIX
+      else if (lpr->data_mapped) {
+         munmap(lpr->data, lpr->data_mapped);
+      }
+#endif
       else if (!lpr->userBuffer) {
          if (lpr->data)
             align_free(lpr->data);
       }
    }
-#ifdef DEBUG
+   mtx_lock(&resource_list_mutex);
    if (lpr->next)
       remove_from_list(lpr);
+   mtx_unlock(&resource_list_mutex);
+
+   lp_fence_reference(&lpr->dt_fence, NULL);
+
+#if DETECT_OS_UNIX
+   llvmpipe_memobj_reference(&lpr->memobj, NULL);
 #endif
 
+   if (lpr->decompressed) {
+      p_atomic_add(&screen->decompressed_memory,
+                   -(int64_t)llvmpipe_resource(lpr->decompressed)->total_alloc_size);
+      pipe_resource_reference(&lpr->decompressed, NULL);
+   }
+
+   FREE(lpr->msaa_equal);
+
+   threaded_resource_deinit(pt);
    FREE(lpr);
 }
 
@@ -489,6 +825,8 @@ llvmpipe_resource_from_handle(struct pipe_screen *screen,
    lpr->base = *template;
    pipe_reference_init(&lpr->base.reference, 1);
    lpr->base.screen = screen;
+   threaded_resource_init(&lpr->base);
+   lpr->threaded.is_shared = true;
 
    /*
     * Looks like unaligned displaytargets work just fine,
@@ -509,19 +847,190 @@ llvmpipe_resource_from_handle(struct pipe_screen *screen,
 
    lpr->id = id_counter++;
 
-#ifdef DEBUG
+   mtx_lock(&resource_list_mutex);
    insert_at_tail(&resource_list, lpr);
-#endif
+   mtx_unlock(&resource_list_mutex);
 
    return &lpr->base;
 
 no_dt:
+   threaded_resource_deinit(&lpr->base);
    FREE(lpr);
 no_lpr:
    return NULL;
 }
 
 
+/**
+ * Create a resource which uses memory it doesn't own as its backing store,
+ * in the layout llvmpipe computes (see llvmpipe_texture_layout()).
+ * Fails if the layout needs more than size bytes, unless size is 0.
+ */
+static struct pipe_resource *
+llvmpipe_resource_from_memory(struct pipe_screen *_screen,
+                              const struct pipe_resource *templat,
+                              void *user_memory, uint64_t size)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(_screen);
+   struct llvmpipe_resource *lpr;
+
+   if (templat->bind & (PIPE_BIND_DISPLAY_TARGET |
+                        PIPE_BIND_SCANOUT |
+                        PIPE_BIND_SHARED))
+      return NULL;
+
+   if (llvmpipe_resource_is_texture(templat)) {
+      /* The fragment shader accesses color/depth buffers with 16 byte
+       * alignment, and the rasterizer always touches whole 4x4 blocks,
+       * so refuse layouts which would make it write outside the rows
+       * the caller gave us.
+       */
+      if ((uintptr_t)user_memory % 16)
+         return NULL;
+      if (templat->nr_samples > 1)
+         return NULL;
+      if ((templat->bind & (PIPE_BIND_RENDER_TARGET |
+                            PIPE_BIND_DEPTH_STENCIL)) &&
+          !llvmpipe_resource_is_1d(templat) &&
+          !(templat->flags & PIPE_RESOURCE_FLAG_USER_MEMORY_PADDED) &&
+          templat->height0 % LP_RASTER_BLOCK_SIZE)
+         return NULL;
+   }
+
+   lpr = CALLOC_STRUCT(llvmpipe_resource);
+   if (!lpr)
+      return NULL;
+
+   lpr->base = *templat;
+   pipe_reference_init(&lpr->base.reference, 1);
+   lpr->base.screen = &screen->base;
+   lpr->userBuffer = TRUE;
+   threaded_resource_init(&lpr->base);
+   lpr->threaded.is_user_ptr = true;
+
+   if (llvmpipe_resource_is_texture(&lpr->base)) {
+      if (!llvmpipe_texture_layout(screen, lpr, FALSE))
+         goto fail;
+      lpr->tex_data = user_memory;
+   }
+   else {
+      lpr->row_stride[0] = templat->width0;
+      lpr->size_required = templat->width0;
+      lpr->data = user_memory;
+   }
+
+   if (size && lpr->size_required > size)
+      goto fail;
+
+   lpr->id = id_counter++;
+   lpr->timestamp = ++screen->timestamp;
+
+   mtx_lock(&resource_list_mutex);
+   insert_at_tail(&resource_list, lpr);
+   mtx_unlock(&resource_list_mutex);
+
+   return &lpr->base;
+
+fail:
+   threaded_resource_deinit(&lpr->base);
+   FREE(lpr);
+   return NULL;
+}
+
+
+/**
+ * Create a resource which uses the caller's memory as its backing store.
+ * The memory must stay valid for the resource's lifetime and be large
+ * enough for the layout llvmpipe computes (see llvmpipe_texture_layout()),
+ * which can be queried back with resource_get_info().
+ */
+static struct pipe_resource *
+llvmpipe_resource_from_user_memory(struct pipe_screen *screen,
+                                   const struct pipe_resource *templat,
+                                   void *user_memory)
+{
+   return llvmpipe_resource_from_memory(screen, templat, user_memory, 0);
+}
+
+
+#if DETECT_OS_UNIX
+
+static struct pipe_memory_object *
+llvmpipe_memobj_create_from_handle(struct pipe_screen *screen,
+                                   struct winsys_handle *handle,
+                                   bool dedicated)
+{
+   struct llvmpipe_memory_object *memobj;
+   struct stat st;
+   void *data;
+
+   if (handle->type != WINSYS_HANDLE_TYPE_FD)
+      return NULL;
+
+   if (fstat(handle->handle, &st) != 0 || st.st_size <= 0)
+      return NULL;
+
+   /* Files opened read-only get private pages, which still come from
+    * the page cache until they are written to.
+    */
+   data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+               handle->handle, 0);
+   if (data == MAP_FAILED)
+      data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                  handle->handle, 0);
+   if (data == MAP_FAILED)
+      return NULL;
+
+   memobj = CALLOC_STRUCT(llvmpipe_memory_object);
+   if (!memobj) {
+      munmap(data, st.st_size);
+      return NULL;
+   }
+
+   memobj->b.dedicated = dedicated;
+   pipe_reference_init(&memobj->reference, 1);
+   memobj->data = data;
+   memobj->size = st.st_size;
+   return &memobj->b;
+}
+
+
+static void
+llvmpipe_memobj_destroy(struct pipe_screen *screen,
+                        struct pipe_memory_object *pmemobj)
+{
+   struct llvmpipe_memory_object *memobj =
+      (struct llvmpipe_memory_object *)pmemobj;
+
+   llvmpipe_memobj_reference(&memobj, NULL);
+}
+
+
+static struct pipe_resource *
+llvmpipe_resource_from_memobj(struct pipe_screen *screen,
+                              const struct pipe_resource *templat,
+                              struct pipe_memory_object *pmemobj,
+                              uint64_t offset)
+{
+   struct llvmpipe_memory_object *memobj =
+      (struct llvmpipe_memory_object *)pmemobj;
+   struct pipe_resource *pt;
+
+   if (offset >= memobj->size)
+      return NULL;
+
+   pt = llvmpipe_resource_from_memory(screen, templat,
+                                      (uint8_t *)memobj->data + offset,
+                                      memobj->size - offset);
+   if (pt)
+      llvmpipe_memobj_reference(&llvmpipe_resource(pt)->memobj, memobj);
+
+   return pt;
+}
+
+#endif /* DETECT_OS_UNIX */
+
+
 static bool
 llvmpipe_resource_get_handle(struct pipe_screen *screen,
                              struct pipe_context *ctx,
@@ -540,6 +1049,244 @@ llvmpipe_resource_get_handle(struct pipe_screen *screen,
 }
 
 
+/**
+ * Byte offset of texel (x, y) within a tiled image: the tiles of a row
+ * are consecutive, and the 16 texels of a tile are in Morton order.
+ */
+static inline unsigned
+llvmpipe_tiled_texel_offset(const struct llvmpipe_resource *lpr,
+                            unsigned level, unsigned x, unsigned y)
+{
+   unsigned texel = ((x >> 2) << 4) |
+                    (x & 1) | ((y & 1) << 1) |
+                    ((x & 2) << 1) | ((y & 2) << 2);
+
+   return (y >> 2) * lpr->row_stride[level] +
+          texel * util_format_get_blocksize(lpr->base.format);
+}
+
+
+/**
+ * Copy a box between a tiled texture and linear memory, in the direction
+ * given by to_tiled.
+ */
+static void
+llvmpipe_tiled_copy_box(struct llvmpipe_resource *lpr,
+                        unsigned level,
+                        const struct pipe_box *box,
+                        void *linear,
+                        unsigned stride,
+                        unsigned layer_stride,
+                        boolean to_tiled)
+{
+   unsigned bpp = util_format_get_blocksize(lpr->base.format);
+   int x, y, z;
+
+   assert(lpr->tiled);
+
+   for (z = 0; z < box->depth; z++) {
+      ubyte *image = llvmpipe_get_texture_image_address(lpr, box->z + z, level);
+      ubyte *row = (ubyte *)linear + z * layer_stride;
+
+      for (y = 0; y < box->height; y++) {
+         for (x = 0; x < box->width; x++) {
+            ubyte *texel = image +
+               llvmpipe_tiled_texel_offset(lpr, level, box->x + x, box->y + y);
+            if (to_tiled)
+               memcpy(texel, row + x * bpp, bpp);
+            else
+               memcpy(row + x * bpp, texel, bpp);
+         }
+         row += stride;
+      }
+   }
+}
+
+
+/**
+ * Writes to a bound fragment shader constant buffer must make the next
+ * draw pick up the constants again.  With the threaded context the buffer
+ * may be the storage which replaced the bound one.
+ */
+static void
+llvmpipe_dirty_constants(struct llvmpipe_context *llvmpipe,
+                         struct pipe_resource *resource)
+{
+   unsigned i;
+
+   for (i = 0; i < ARRAY_SIZE(llvmpipe->constants[PIPE_SHADER_FRAGMENT]); ++i) {
+      struct pipe_resource *buffer =
+         llvmpipe->constants[PIPE_SHADER_FRAGMENT][i].buffer;
+
+      if (buffer &&
+          (buffer == resource ||
+           llvmpipe_resource(buffer)->storage == resource)) {
+         llvmpipe->dirty |= LP_NEW_FS_CONSTANTS;
+         break;
+      }
+   }
+}
+
+
+/**
+ * Set again the state which cached pointers into the storage of a buffer
+ * which just got new storage.
+ */
+static void
+llvmpipe_rebind_buffer(struct llvmpipe_context *llvmpipe,
+                       struct pipe_resource *buffer)
+{
+   struct pipe_context *pipe = &llvmpipe->pipe;
+   unsigned sh, i;
+
+   for (sh = 0; sh < PIPE_SHADER_TYPES; sh++) {
+      for (i = 0; i < ARRAY_SIZE(llvmpipe->constants[sh]); i++) {
+         if (llvmpipe->constants[sh][i].buffer == buffer) {
+            struct pipe_constant_buffer cb = llvmpipe->constants[sh][i];
+            pipe->set_constant_buffer(pipe, sh, i, &cb);
+         }
+      }
+      for (i = 0; i < ARRAY_SIZE(llvmpipe->ssbos[sh]); i++) {
+         if (llvmpipe->ssbos[sh][i].buffer == buffer) {
+            struct pipe_shader_buffer sb = llvmpipe->ssbos[sh][i];
+            pipe->set_shader_buffers(pipe, sh, i, 1, &sb, 0);
+         }
+      }
+   }
+
+   for (i = 0; i < llvmpipe->num_so_targets; i++) {
+      if (llvmpipe->so_targets[i] &&
+          llvmpipe->so_targets[i]->target.buffer == buffer)
+         llvmpipe->so_targets[i]->mapping = llvmpipe_resource(buffer)->data;
+   }
+
+   /* The vertex stages look sampler views and images up at each draw */
+   if (buffer->bind & (PIPE_BIND_SAMPLER_VIEW | PIPE_BIND_SHADER_IMAGE)) {
+      llvmpipe->dirty |= LP_NEW_SAMPLER_VIEW | LP_NEW_FS_IMAGES;
+      llvmpipe->cs_dirty |= LP_CSNEW_SAMPLER_VIEW | LP_CSNEW_IMAGES;
+   }
+}
+
+
+/**
+ * Copy on write for constants only buffers, which scenes read in place:
+ * if any does, give the buffer new storage for the write to go to, and
+ * have the current scene free the old one once it is rasterized.
+ * Returns FALSE if the caller must flush and wait instead.
+ */
+static boolean
+llvmpipe_rename_buffer(struct llvmpipe_context *llvmpipe,
+                       struct pipe_resource *buffer,
+                       boolean discard)
+{
+   struct llvmpipe_resource *lpr = llvmpipe_resource(buffer);
+   unsigned referenced;
+   void *data;
+
+   if (!lpr->constants_only || lpr->constants_context != llvmpipe ||
+       lp_csctx_is_resource_referenced(llvmpipe->csctx, buffer))
+      return FALSE;
+
+   referenced = lp_setup_is_resource_referenced(llvmpipe->setup, buffer);
+   if (!referenced)
+      return TRUE;
+   if (referenced & LP_REFERENCED_FOR_WRITE)
+      return FALSE;
+
+   data = align_malloc(lpr->size_required, 64);
+   if (!data)
+      return FALSE;
+
+   if (!lp_setup_retire_data(llvmpipe->setup, lpr->data,
+                             lpr->size_required)) {
+      align_free(data);
+      return FALSE;
+   }
+
+   if (!discard)
+      memcpy(data, lpr->data, lpr->size_required);
+   lpr->data = data;
+
+   LP_COUNT(nr_constant_buffer_renames);
+
+   llvmpipe_rebind_buffer(llvmpipe, buffer);
+   return TRUE;
+}
+
+
+/**
+ * Copy on write for textures which scenes of this context only sample:
+ * if any does, give a texture overwritten whole new storage, and have the
+ * current scene free the old one once it is rasterized.
+ * Returns FALSE if the caller must flush and wait instead.
+ */
+static boolean
+llvmpipe_rename_texture(struct llvmpipe_context *llvmpipe,
+                        struct pipe_resource *texture,
+                        const struct pipe_box *box,
+                        unsigned usage)
+{
+   struct llvmpipe_resource *lpr = llvmpipe_resource(texture);
+   unsigned referenced;
+   void *data;
+
+   if (!lpr->renamable ||
+       (lpr->rename_context && lpr->rename_context != llvmpipe) ||
+       lp_csctx_is_resource_referenced(llvmpipe->csctx, texture))
+      return FALSE;
+
+   /* Nothing is copied over */
+   if (!(usage & PIPE_TRANSFER_DISCARD_WHOLE_RESOURCE) &&
+       !((usage & PIPE_TRANSFER_DISCARD_RANGE) &&
+         texture->last_level == 0 &&
+         box->x == 0 && box->y == 0 && box->z == 0 &&
+         box->width == texture->width0 &&
+         box->height == texture->height0 &&
+         box->depth == util_num_layers(texture, 0)))
+      return FALSE;
+
+   referenced = lp_setup_is_resource_referenced(llvmpipe->setup, texture);
+   if (!referenced)
+      return TRUE;
+   if (referenced & LP_REFERENCED_FOR_WRITE)
+      return FALSE;
+
+   data = align_malloc(lpr->size_required, MAX2(64, util_cpu_caps.cacheline));
+   if (!data)
+      return FALSE;
+
+   if (!lp_setup_retire_data(llvmpipe->setup, lpr->tex_data,
+                             lpr->size_required)) {
+      align_free(data);
+      return FALSE;
+   }
+
+   lpr->tex_data = data;
+
+   LP_COUNT(nr_texture_renames);
+
+   /* The write bumps the screen timestamp, which has the fragment
+    * sampler views set again, see llvmpipe_update_derived().
+    */
+   llvmpipe->cs_dirty |= LP_CSNEW_SAMPLER_VIEW;
+   return TRUE;
+}
+
+
+static boolean
+llvmpipe_rename_resource(struct llvmpipe_context *llvmpipe,
+                         struct pipe_resource *resource,
+                         const struct pipe_box *box,
+                         unsigned usage)
+{
+   if (resource->target == PIPE_BUFFER)
+      return llvmpipe_rename_buffer(llvmpipe, resource,
+                                    usage & PIPE_TRANSFER_DISCARD_WHOLE_RESOURCE);
+
+   return llvmpipe_rename_texture(llvmpipe, resource, box, usage);
+}
+
+
 void *
 llvmpipe_transfer_map_ms( struct pipe_context *pipe,
                           struct pipe_resource *resource,
@@ -562,19 +1309,34 @@ llvmpipe_transfer_map_ms( struct pipe_context *pipe,
    assert(resource);
    assert(level <= resource->last_level);
 
+   /* A persistent mapping pins the storage */
+   if (usage & PIPE_TRANSFER_PERSISTENT) {
+      lpr->constants_only = FALSE;
+      lpr->renamable = FALSE;
+   }
+
    /*
     * Transfers, like other pipe operations, must happen in order, so flush the
-    * context if necessary.
+    * context if necessary.  Constants only buffers, and sampled textures
+    * overwritten whole, get new storage instead, which the write goes to
+    * while scenes keep reading the old one.
     */
-   if (!(usage & PIPE_TRANSFER_UNSYNCHRONIZED)) {
+   if (!(usage & PIPE_TRANSFER_UNSYNCHRONIZED) &&
+       !((usage & PIPE_TRANSFER_WRITE) &&
+         llvmpipe_rename_resource(llvmpipe, resource, box, usage))) {
       boolean read_only = !(usage & PIPE_TRANSFER_WRITE);
       boolean do_not_block = !!(usage & PIPE_TRANSFER_DONTBLOCK);
-      if (!llvmpipe_flush_resource(pipe, resource,
-                                   level,
-                                   read_only,
-                                   TRUE, /* cpu_access */
-                                   do_not_block,
-                                   __FUNCTION__)) {
+      int64_t trace_start = lp_trace_begin();
+      boolean flushed = llvmpipe_flush_resource(pipe, resource,
+                                                level,
+                                                read_only,
+                                                TRUE, /* cpu_access */
+                                                do_not_block,
+                                                __FUNCTION__);
+
+      LP_TRACE_END_ARGS("transfer_map_wait", trace_start, "width,height,read",
+                        box->width, box->height, read_only);
+      if (!flushed) {
          /*
           * It would have blocked, but gallium frontend requested no to.
           */
@@ -583,22 +1345,29 @@ llvmpipe_transfer_map_ms( struct pipe_context *pipe,
       }
    }
 
-   /* Check if we're mapping a current constant buffer */
+   /*
+    * Check if we're mapping a current constant buffer.  Threaded
+    * unsynchronized maps come from the application thread and must not
+    * touch the context; they are checked at unmap instead.  llvmpipe
+    * never invalidates buffers nor infers unsynchronized maps itself,
+    * so the other threaded context flags need no handling.
+    */
    if ((usage & PIPE_TRANSFER_WRITE) &&
-       (resource->bind & PIPE_BIND_CONSTANT_BUFFER)) {
-      unsigned i;
-      for (i = 0; i < ARRAY_SIZE(llvmpipe->constants[PIPE_SHADER_FRAGMENT]); ++i) {
-         if (resource == llvmpipe->constants[PIPE_SHADER_FRAGMENT][i].buffer) {
-            /* constants may have changed */
-            llvmpipe->dirty |= LP_NEW_FS_CONSTANTS;
-            break;
-         }
-      }
-   }
-
-   lpt = CALLOC_STRUCT(llvmpipe_transfer);
+       !(usage & TC_TRANSFER_MAP_THREADED_UNSYNC) &&
+       (resource->bind & PIPE_BIND_CONSTANT_BUFFER))
+      llvmpipe_dirty_constants(llvmpipe, resource);
+
+   /* Direct maps must see the real layout */
+   if (llvmpipe_resource_is_tiled(resource) &&
+       (usage & (PIPE_TRANSFER_MAP_DIRECTLY |
+                 PIPE_TRANSFER_PERSISTENT |
+                 PIPE_TRANSFER_COHERENT)))
+      llvmpipe_resource_untile(pipe, resource);
+
+   lpt = slab_mt_alloc(&screen->transfer_pool);
    if (!lpt)
       return NULL;
+   memset(lpt, 0, sizeof(*lpt));
    pt = &lpt->base;
    pipe_resource_reference(&pt->resource, resource);
    pt->box = *box;
@@ -646,6 +1415,31 @@ llvmpipe_transfer_map_ms( struct pipe_context *pipe,
       /* Do something to notify sharing contexts of a texture change.
        */
       screen->timestamp++;
+      lpr->writes++;
+      lpr->timestamp = screen->timestamp;
+      if (level == 0)
+         llvmpipe_resource_add_dirty(lpr, box->x, box->y,
+                                     box->x + box->width,
+                                     box->y + box->height);
+   }
+
+   /* Tiled textures are mapped through a linear copy of the box */
+   if (llvmpipe_resource_is_tiled(resource)) {
+      pt->stride = box->width * util_format_get_blocksize(format);
+      pt->layer_stride = pt->stride * box->height;
+      lpt->staging = align_malloc((size_t)pt->layer_stride * box->depth, 64);
+      if (!lpt->staging) {
+         llvmpipe_resource_unmap(resource, level, box->z);
+         pipe_resource_reference(&pt->resource, NULL);
+         slab_mt_free(&screen->transfer_pool, lpt);
+         *transfer = NULL;
+         return NULL;
+      }
+      if ((usage & PIPE_TRANSFER_READ) ||
+          !(usage & PIPE_TRANSFER_DISCARD_RANGE))
+         llvmpipe_tiled_copy_box(lpr, level, box, lpt->staging,
+                                 pt->stride, pt->layer_stride, FALSE);
+      return lpt->staging;
    }
 
    map +=
@@ -671,8 +1465,26 @@ static void
 llvmpipe_transfer_unmap(struct pipe_context *pipe,
                         struct pipe_transfer *transfer)
 {
+   struct llvmpipe_transfer *lpt = llvmpipe_transfer(transfer);
+
    assert(transfer->resource);
 
+   /* PIPE_TRANSFER_THREAD_SAFE unmaps may come from any thread */
+   if ((transfer->usage & PIPE_TRANSFER_WRITE) &&
+       (transfer->usage & TC_TRANSFER_MAP_THREADED_UNSYNC) &&
+       !(transfer->usage & PIPE_TRANSFER_THREAD_SAFE) &&
+       (transfer->resource->bind & PIPE_BIND_CONSTANT_BUFFER))
+      llvmpipe_dirty_constants(llvmpipe_context(pipe), transfer->resource);
+
+   if (lpt->staging) {
+      if (transfer->usage & PIPE_TRANSFER_WRITE)
+         llvmpipe_tiled_copy_box(llvmpipe_resource(transfer->resource),
+                                 transfer->level, &transfer->box,
+                                 lpt->staging, transfer->stride,
+                                 transfer->layer_stride, TRUE);
+      align_free(lpt->staging);
+   }
+
    llvmpipe_resource_unmap(transfer->resource,
                            transfer->level,
                            transfer->box.z);
@@ -683,17 +1495,205 @@ llvmpipe_transfer_unmap(struct pipe_context *pipe,
     */
    assert (transfer->resource);
    pipe_resource_reference(&transfer->resource, NULL);
-   FREE(transfer);
+   slab_mt_free(&llvmpipe_screen(pipe->screen)->transfer_pool, lpt);
+}
+
+/**
+ * Uploads of at least this many bytes are split over the compute threads.
+ */
+#define LP_UPLOAD_THREAD_SIZE (1024 * 1024)
+
+
+/** A box upload by texture_subdata(), in bands of block rows */
+struct lp_upload_job
+{
+   struct llvmpipe_resource *lpr;
+   unsigned level;
+   struct pipe_box box;              /**< in blocks */
+   const uint8_t *data;
+   unsigned stride, layer_stride;
+   unsigned rows_per_band;
+   boolean streaming;                /**< big enough to bypass the cache */
+};
+
+
+static void
+llvmpipe_upload_band(void *data, int band, struct lp_cs_local_mem *lmem)
+{
+   const struct lp_upload_job *job = data;
+   struct llvmpipe_resource *lpr = job->lpr;
+   const unsigned bpp = util_format_get_blocksize(lpr->base.format);
+   const unsigned row_bytes = job->box.width * bpp;
+   const unsigned num_rows = job->box.height * job->box.depth;
+   const unsigned first = band * job->rows_per_band;
+   const unsigned last = MIN2(first + job->rows_per_band, num_rows);
+   unsigned i;
+
+   for (i = first; i < last; i++) {
+      const unsigned z = i / job->box.height;
+      const unsigned y = i % job->box.height;
+      const uint8_t *src = job->data + z * job->layer_stride + y * job->stride;
+      uint8_t *image = llvmpipe_get_texture_image_address(lpr, job->box.z + z,
+                                                          job->level);
+
+      if (lpr->tiled) {
+         unsigned x;
+
+         for (x = 0; x < job->box.width; x++) {
+            memcpy(image + llvmpipe_tiled_texel_offset(lpr, job->level,
+                                                       job->box.x + x,
+                                                       job->box.y + y),
+                   src + x * bpp, bpp);
+         }
+      }
+      else if (job->streaming) {
+         util_streaming_store_memcpy(image + (job->box.y + y) *
+                                     lpr->row_stride[job->level] +
+                                     job->box.x * bpp, src, row_bytes);
+      }
+      else {
+         memcpy(image + (job->box.y + y) * lpr->row_stride[job->level] +
+                job->box.x * bpp, src, row_bytes);
+      }
+   }
+}
+
+
+/**
+ * Copy straight from the caller's memory, rather than through a transfer,
+ * which for tiled textures means a second copy, and split big uploads over
+ * the compute thread pool.
+ */
+static void
+llvmpipe_texture_subdata(struct pipe_context *pipe,
+                         struct pipe_resource *resource,
+                         unsigned level,
+                         unsigned usage,
+                         const struct pipe_box *box,
+                         const void *data,
+                         unsigned stride,
+                         unsigned layer_stride)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(pipe->screen);
+   struct llvmpipe_resource *lpr = llvmpipe_resource(resource);
+   const enum pipe_format format = resource->format;
+   struct lp_upload_job job;
+   unsigned num_rows, num_bands;
+   uint64_t size;
+
+   if (!llvmpipe_resource_is_texture(resource) || lpr->dt ||
+       resource->nr_samples > 1) {
+      u_default_texture_subdata(pipe, resource, level, usage, box, data,
+                                stride, layer_stride);
+      return;
+   }
+
+   if (!(usage & PIPE_TRANSFER_UNSYNCHRONIZED))
+      llvmpipe_flush_resource(pipe, resource, level, FALSE, TRUE, FALSE,
+                              __FUNCTION__);
+
+   job.lpr = lpr;
+   job.level = level;
+   job.box.x = box->x / util_format_get_blockwidth(format);
+   job.box.y = box->y / util_format_get_blockheight(format);
+   job.box.z = box->z;
+   job.box.width = DIV_ROUND_UP(box->width, util_format_get_blockwidth(format));
+   job.box.height = DIV_ROUND_UP(box->height,
+                                 util_format_get_blockheight(format));
+   job.box.depth = box->depth;
+   job.data = data;
+   job.stride = stride;
+   job.layer_stride = layer_stride;
+
+   num_rows = job.box.height * job.box.depth;
+   size = (uint64_t) num_rows * job.box.width *
+          util_format_get_blocksize(format);
+   job.streaming = size >= UTIL_STREAMING_STORE_MIN_SIZE;
+   num_bands = 1;
+   if (screen->num_threads > 1 && size >= LP_UPLOAD_THREAD_SIZE)
+      num_bands = MIN2(num_rows, screen->num_threads * 4);
+   job.rows_per_band = DIV_ROUND_UP(num_rows, num_bands);
+   num_bands = DIV_ROUND_UP(num_rows, job.rows_per_band);
+
+   if (num_bands > 1) {
+      struct lp_cs_tpool_task *task;
+
+      mtx_lock(&screen->cs_mutex);
+      task = lp_cs_tpool_queue_task(screen->cs_tpool, llvmpipe_upload_band,
+                                    &job, num_bands);
+      lp_cs_tpool_wait_for_task(screen->cs_tpool, &task);
+      mtx_unlock(&screen->cs_mutex);
+   }
+   else if (num_rows) {
+      llvmpipe_upload_band(&job, 0, NULL);
+   }
+
+   /* Do something to notify sharing contexts of a texture change. */
+   screen->timestamp++;
+   lpr->writes++;
+   lpr->timestamp = screen->timestamp;
+   if (level == 0)
+      llvmpipe_resource_add_dirty(lpr, box->x, box->y, box->x + box->width,
+                                  box->y + box->height);
+}
+
+
+/**
+ * Give dst the storage of src, a new buffer the threaded context created
+ * to invalidate dst (see tc_invalidate_buffer()), and which it keeps
+ * mapping directly.  src stays the owner of the storage, so dst holds a
+ * reference on it.  The old storage is freed once no scene reads it, and
+ * the state which cached pointers into it is set again.
+ */
+void
+llvmpipe_replace_buffer_storage(struct pipe_context *pipe,
+                                struct pipe_resource *dst,
+                                struct pipe_resource *src)
+{
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+   struct llvmpipe_resource *lpdst = llvmpipe_resource(dst);
+
+   assert(dst->target == PIPE_BUFFER && src->target == PIPE_BUFFER);
+   assert(!lpdst->userBuffer && !lpdst->backable);
+
+   /* Scenes may read constants only buffers in place, see
+    * llvmpipe_rename_buffer().  The storage then goes with the scene.
+    */
+   if (lpdst->storage ||
+       !lpdst->constants_only || lpdst->constants_context != llvmpipe ||
+       lp_csctx_is_resource_referenced(llvmpipe->csctx, dst) ||
+       !lp_setup_retire_data(llvmpipe->setup, lpdst->data,
+                             lpdst->size_required)) {
+      llvmpipe_flush_resource(pipe, dst, 0, FALSE, TRUE, FALSE, __FUNCTION__);
+
+      if (lpdst->storage)
+         pipe_resource_reference(&lpdst->storage, NULL);
+      else
+         align_free(lpdst->data);
+   }
+   lpdst->data = llvmpipe_resource(src)->data;
+   pipe_resource_reference(&lpdst->storage, src);
+   lpdst->constants_only = FALSE;
+   lpdst->timestamp = ++llvmpipe_screen(pipe->screen)->timestamp;
+
+   llvmpipe_rebind_buffer(llvmpipe, dst);
 }
 
+
 unsigned int
 llvmpipe_is_resource_referenced( struct pipe_context *pipe,
                                  struct pipe_resource *presource,
                                  unsigned level)
 {
    struct llvmpipe_context *llvmpipe = llvmpipe_context( pipe );
+
+   /* A grid may still be running, and buffers needn't be bound as SSBOs */
+   if (lp_csctx_is_resource_referenced(llvmpipe->csctx, presource))
+      return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
+
    if (!(presource->bind & (PIPE_BIND_DEPTH_STENCIL |
                             PIPE_BIND_RENDER_TARGET |
+                            PIPE_BIND_CONSTANT_BUFFER |
                             PIPE_BIND_SAMPLER_VIEW |
                             PIPE_BIND_SHADER_BUFFER |
                             PIPE_BIND_SHADER_IMAGE)))
@@ -760,6 +1760,8 @@ llvmpipe_user_buffer_create(struct pipe_screen *screen,
    buffer->base.array_size = 1;
    buffer->userBuffer = TRUE;
    buffer->data = ptr;
+   threaded_resource_init(&buffer->base);
+   buffer->threaded.is_user_ptr = true;
 
    return &buffer->base;
 }
@@ -788,6 +1790,10 @@ llvmpipe_get_texture_image_address(struct llvmpipe_resource *lpr,
 
    assert(llvmpipe_resource_is_texture(&lpr->base));
 
+   if (unlikely(lpr->transient && !lpr->tex_data) &&
+       !llvmpipe_resource_alloc_transient(lpr))
+      return NULL;
+
    offset = lpr->mip_offsets[level];
 
    if (face_slice > 0)
@@ -797,6 +1803,177 @@ llvmpipe_get_texture_image_address(struct llvmpipe_resource *lpr,
 }
 
 
+/**
+ * Convert a tiled texture to the linear layout, for good, when it is used
+ * in a way the tiled layout does not cater for: rendering, shader images,
+ * sampling in the draw module, compressed views and direct maps.
+ */
+void
+llvmpipe_resource_untile(struct pipe_context *pipe,
+                         struct pipe_resource *resource)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(resource->screen);
+   struct llvmpipe_resource *lpr = llvmpipe_resource(resource);
+   struct llvmpipe_resource old;
+   unsigned level;
+
+   if (!llvmpipe_resource_is_tiled(resource))
+      return;
+
+   llvmpipe_flush_resource(pipe, resource, 0, FALSE, TRUE, FALSE,
+                           __FUNCTION__);
+
+   old = *lpr;
+   lpr->base.bind |= PIPE_BIND_LINEAR;
+   if (!llvmpipe_texture_layout(screen, lpr, TRUE)) {
+      debug_printf("llvmpipe: failed to untile texture %u\n", lpr->id);
+      *lpr = old;
+      return;
+   }
+
+   for (level = 0; level <= resource->last_level; level++) {
+      struct pipe_box box;
+
+      u_box_3d(0, 0, 0,
+               u_minify(resource->width0, level),
+               u_minify(resource->height0, level),
+               util_num_layers(resource, level), &box);
+      llvmpipe_tiled_copy_box(&old, level, &box,
+                              llvmpipe_get_texture_image_address(lpr, 0, level),
+                              lpr->row_stride[level], lpr->img_stride[level],
+                              FALSE);
+   }
+   llvmpipe_free_texture_data(&old);
+
+   /* Sampler and image state of all contexts has to be updated */
+   screen->timestamp++;
+}
+
+
+/**
+ * How often a texture may be decompressed again after being written to,
+ * before it is considered streamed and sampled compressed for good.
+ */
+#define LP_MAX_DECOMPRESSIONS 4
+
+
+static enum pipe_format
+llvmpipe_decompressed_format(enum pipe_format format)
+{
+   if (util_format_fits_8unorm(util_format_description(util_format_linear(format))))
+      return PIPE_FORMAT_R8G8B8A8_UNORM;
+   return PIPE_FORMAT_R16G16B16A16_FLOAT;
+}
+
+
+static boolean
+llvmpipe_texture_can_decompress(const struct llvmpipe_screen *screen,
+                                const struct llvmpipe_resource *lpr)
+{
+   const struct pipe_resource *pt = &lpr->base;
+
+   if (!screen->decompressed_memory_budget ||
+       !llvmpipe_resource_is_texture(pt) ||
+       !util_format_is_compressed(pt->format) ||
+       lpr->dt || lpr->backable || lpr->userBuffer ||
+       lpr->decompressions >= LP_MAX_DECOMPRESSIONS)
+      return FALSE;
+
+   /* Per resource opt-out: textures the gallium frontend expects to change */
+   if (pt->usage == PIPE_USAGE_DYNAMIC ||
+       pt->usage == PIPE_USAGE_STREAM ||
+       pt->usage == PIPE_USAGE_STAGING)
+      return FALSE;
+
+   /* There's no sRGB variant of the float format */
+   return !util_format_is_srgb(pt->format) ||
+          llvmpipe_decompressed_format(pt->format) != PIPE_FORMAT_R16G16B16A16_FLOAT;
+}
+
+
+static void
+llvmpipe_resource_drop_decompressed(struct llvmpipe_screen *screen,
+                                    struct llvmpipe_resource *lpr)
+{
+   if (!lpr->decompressed)
+      return;
+
+   p_atomic_add(&screen->decompressed_memory,
+                -(int64_t)llvmpipe_resource(lpr->decompressed)->total_alloc_size);
+   pipe_resource_reference(&lpr->decompressed, NULL);
+   screen->timestamp++;
+}
+
+
+/**
+ * Bring the decompressed copy of a compressed texture up to date, see
+ * LP_DECOMPRESS_TEXTURES.  Compressed textures are normally written once
+ * and then sampled a lot, and decoding blocks on every fetch costs
+ * several times as much as sampling a plain RGBA8 (or half float) copy.
+ * Textures which keep being rewritten, or which would exceed the memory
+ * budget, are left to sample compressed.
+ */
+void
+llvmpipe_resource_decompress(struct pipe_resource *resource)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(resource->screen);
+   struct llvmpipe_resource *lpr = llvmpipe_resource(resource);
+   struct pipe_resource templat = *resource;
+   struct pipe_resource *copy;
+   struct llvmpipe_resource *lpc;
+   enum pipe_format src_format = util_format_linear(resource->format);
+   unsigned level, layer;
+
+   if (lpr->decompressed && lpr->decompressed_writes == lpr->writes)
+      return;
+
+   if (!llvmpipe_texture_can_decompress(screen, lpr)) {
+      llvmpipe_resource_drop_decompressed(screen, lpr);
+      return;
+   }
+
+   templat.format = llvmpipe_decompressed_format(resource->format);
+   templat.bind = PIPE_BIND_SAMPLER_VIEW | PIPE_BIND_LINEAR;
+   templat.usage = PIPE_USAGE_DEFAULT;
+   templat.flags = 0;
+   copy = llvmpipe_resource_create(&screen->base, &templat);
+   if (!copy) {
+      llvmpipe_resource_drop_decompressed(screen, lpr);
+      return;
+   }
+   lpc = llvmpipe_resource(copy);
+
+   if (p_atomic_add_return(&screen->decompressed_memory, lpc->total_alloc_size) >
+       screen->decompressed_memory_budget) {
+      p_atomic_add(&screen->decompressed_memory, -(int64_t)lpc->total_alloc_size);
+      pipe_resource_reference(&copy, NULL);
+      llvmpipe_resource_drop_decompressed(screen, lpr);
+      return;
+   }
+
+   for (level = 0; level <= resource->last_level; level++) {
+      for (layer = 0; layer < util_num_layers(resource, level); layer++) {
+         util_format_translate(templat.format,
+                               llvmpipe_get_texture_image_address(lpc, layer, level),
+                               lpc->row_stride[level], 0, 0,
+                               src_format,
+                               llvmpipe_get_texture_image_address(lpr, layer, level),
+                               lpr->row_stride[level], 0, 0,
+                               u_minify(resource->width0, level),
+                               u_minify(resource->height0, level));
+      }
+   }
+
+   llvmpipe_resource_drop_decompressed(screen, lpr);
+   lpr->decompressed = copy;
+   lpr->decompressed_writes = lpr->writes;
+   lpr->decompressions++;
+
+   /* Sampler state of all contexts has to be updated */
+   screen->timestamp++;
+}
+
+
 /**
  * Return size of resource in bytes
  */
@@ -850,6 +2027,8 @@ static void llvmpipe_resource_bind_backing(struct pipe_screen *screen,
    else
       lpr->data = (char *)pmem + offset;
    lpr->backing_offset = offset;
+   /* The contents are the memory's now */
+   lpr->writes++;
 }
 
 static void *llvmpipe_map_memory(struct pipe_screen *screen,
@@ -863,6 +2042,35 @@ static void llvmpipe_unmap_memory(struct pipe_screen *screen,
 {
 }
 
+/**
+ * Bytes of the storage llvmpipe allocated for the resources of a screen.
+ * Storage owned by the user, the winsys or a memory object isn't.
+ */
+uint64_t
+llvmpipe_resource_memory(struct pipe_screen *screen)
+{
+   struct llvmpipe_resource *lpr;
+   uint64_t total = 0;
+
+   mtx_lock(&resource_list_mutex);
+   foreach(lpr, &resource_list) {
+      if (lpr->base.screen != screen || lpr->userBuffer || lpr->backable ||
+          lpr->memobj || lpr->dt)
+         continue;
+
+      if (llvmpipe_resource_is_texture(&lpr->base)) {
+         if (lpr->tex_data)
+            total += lpr->size_required;
+      }
+      else if (lpr->data && !lpr->storage) {
+         total += lpr->size_required;
+      }
+   }
+   mtx_unlock(&resource_list_mutex);
+
+   return total;
+}
+
 #ifdef DEBUG
 void
 llvmpipe_print_resources(void)
@@ -871,6 +2079,7 @@ llvmpipe_print_resources(void)
    unsigned n = 0, total = 0;
 
    debug_printf("LLVMPIPE: current resources:\n");
+   mtx_lock(&resource_list_mutex);
    foreach(lpr, &resource_list) {
       unsigned size = llvmpipe_resource_size(&lpr->base);
       debug_printf("resource %u at %p, size %ux%ux%u: %u bytes, refcount %u\n",
@@ -880,6 +2089,7 @@ llvmpipe_print_resources(void)
       total += size;
       n++;
    }
+   mtx_unlock(&resource_list_mutex);
    debug_printf("LLVMPIPE: total size of %u resources: %u\n", n, total);
 }
 #endif
@@ -899,7 +2109,6 @@ llvmpipe_get_resource_info(struct pipe_screen *screen,
 void
 llvmpipe_init_screen_resource_funcs(struct pipe_screen *screen)
 {
-#ifdef DEBUG
    /* init linked list for tracking resources */
    {
       static boolean first_call = TRUE;
@@ -909,12 +2118,12 @@ llvmpipe_init_screen_resource_funcs(struct pipe_screen *screen)
          first_call = FALSE;
       }
    }
-#endif
 
    screen->resource_create = llvmpipe_resource_create;
 /*   screen->resource_create_front = llvmpipe_resource_create_front; */
    screen->resource_destroy = llvmpipe_resource_destroy;
    screen->resource_from_handle = llvmpipe_resource_from_handle;
+   screen->resource_from_user_memory = llvmpipe_resource_from_user_memory;
    screen->resource_get_handle = llvmpipe_resource_get_handle;
    screen->can_create_resource = llvmpipe_can_create_resource;
 
@@ -927,8 +2136,102 @@ llvmpipe_init_screen_resource_funcs(struct pipe_screen *screen)
    screen->unmap_memory = llvmpipe_unmap_memory;
 
    screen->resource_bind_backing = llvmpipe_resource_bind_backing;
+
+#if DETECT_OS_UNIX
+   screen->memobj_create_from_handle = llvmpipe_memobj_create_from_handle;
+   screen->memobj_destroy = llvmpipe_memobj_destroy;
+   screen->resource_from_memobj = llvmpipe_resource_from_memobj;
+#endif
+}
+
+
+#if DETECT_OS_UNIX
+
+/**
+ * Hand the whole sparse pages in [begin, end) of the storage back to the
+ * system.  They read as zeroes until written again.
+ */
+static void
+llvmpipe_decommit_range(uint8_t *data, uint64_t begin, uint64_t end)
+{
+   begin = align64(begin, LP_SPARSE_PAGE_SIZE);
+   end &= ~(uint64_t)(LP_SPARSE_PAGE_SIZE - 1);
+
+   if (begin < end)
+      madvise(data + begin, end - begin, MADV_DONTNEED);
+}
+
+
+/**
+ * Commit or un-commit a box of a sparse resource.  All of the storage is
+ * mapped from the start and any page gets memory once written, so
+ * committing has nothing to do.  Un-committing frees the memory of the
+ * sparse pages inside the box, once the rendering which uses them is
+ * done.  The texels of a partially covered page are left as they are.
+ */
+static bool
+llvmpipe_resource_commit(struct pipe_context *pipe,
+                         struct pipe_resource *resource,
+                         unsigned level, struct pipe_box *box, bool commit)
+{
+   struct llvmpipe_resource *lpr = llvmpipe_resource(resource);
+   unsigned bx0, bx1, by0, by1, block_size;
+   unsigned s, z, y;
+
+   assert(resource->flags & PIPE_RESOURCE_FLAG_SPARSE);
+
+   if (commit)
+      return true;
+
+   llvmpipe_flush_resource(pipe, resource, level, FALSE, TRUE, FALSE,
+                           __FUNCTION__);
+
+   if (!llvmpipe_resource_is_texture(resource)) {
+      if (lpr->data_mapped)
+         llvmpipe_decommit_range(lpr->data, box->x, box->x + box->width);
+      return true;
+   }
+
+   if (!lpr->tex_data_mapped)
+      return true;
+
+   bx0 = util_format_get_nblocksx(resource->format, box->x);
+   bx1 = util_format_get_nblocksx(resource->format, box->x + box->width);
+   by0 = util_format_get_nblocksy(resource->format, box->y);
+   by1 = util_format_get_nblocksy(resource->format, box->y + box->height);
+   block_size = util_format_get_blocksize(resource->format);
+
+   for (s = 0; s < util_res_sample_count(resource); s++) {
+      for (z = box->z; z < box->z + box->depth; z++) {
+         const uint64_t stride = lpr->row_stride[level];
+         const uint64_t image = lpr->mip_offsets[level] +
+                                (uint64_t)s * lpr->sample_stride +
+                                (uint64_t)z * lpr->img_stride[level];
+
+         /* Boxes as wide as the level cover a run of whole rows */
+         if (bx0 == 0 &&
+             box->x + box->width >= u_minify(resource->width0, level)) {
+            llvmpipe_decommit_range(lpr->tex_data,
+                                    image + by0 * stride,
+                                    image + by1 * stride);
+            continue;
+         }
+
+         for (y = by0; y < by1; y++) {
+            const uint64_t row = image + y * stride;
+
+            llvmpipe_decommit_range(lpr->tex_data,
+                                    row + bx0 * block_size,
+                                    row + bx1 * block_size);
+         }
+      }
+   }
+
+   return true;
 }
 
+#endif /* DETECT_OS_UNIX */
+
 
 void
 llvmpipe_init_context_resource_funcs(struct pipe_context *pipe)
@@ -938,7 +2241,11 @@ llvmpipe_init_context_resource_funcs(struct pipe_context *pipe)
 
    pipe->transfer_flush_region = u_default_transfer_flush_region;
    pipe->buffer_subdata = u_default_buffer_subdata;
-   pipe->texture_subdata = u_default_texture_subdata;
+   pipe->texture_subdata = llvmpipe_texture_subdata;
 
    pipe->memory_barrier = llvmpipe_memory_barrier;
+
+#if DETECT_OS_UNIX
+   pipe->resource_commit = llvmpipe_resource_commit;
+#endif
 }
@@ -31,6 +31,8 @@
 
 #include "pipe/p_state.h"
 #include "util/u_debug.h"
+#include "util/format/u_format.h"
+#include "util/u_threaded_context.h"
 #include "lp_limits.h"
 
 
@@ -42,11 +44,21 @@ enum lp_texture_usage
 };
 
 
+/**
+ * Granularity of the commitment of sparse resources, in bytes.  Their
+ * storage is reserved in full, and un-committing a page hands its memory
+ * back to the system, see llvmpipe_resource_commit().
+ */
+#define LP_SPARSE_PAGE_SIZE (64 * 1024)
+
+
 struct pipe_context;
 struct pipe_screen;
 struct llvmpipe_context;
 
 struct sw_displaytarget;
+struct lp_fence;
+struct llvmpipe_memory_object;
 
 
 /**
@@ -58,7 +70,11 @@ struct sw_displaytarget;
  */
 struct llvmpipe_resource
 {
-   struct pipe_resource base;
+   /** threaded is what the threaded context sees, see LP_THREADED_CONTEXT */
+   union {
+      struct pipe_resource base;
+      struct threaded_resource threaded;
+   };
 
    /** Row stride in bytes */
    unsigned row_stride[LP_MAX_TEXTURE_LEVELS];
@@ -75,19 +91,112 @@ struct llvmpipe_resource
     */
    struct sw_displaytarget *dt;
 
+   /**
+    * Fence of the last scene rendering to the display target, protected
+    * by the screen's rast_mutex.
+    */
+   struct lp_fence *dt_fence;
+
    /**
     * Malloc'ed data for regular textures, or a mapping to dt above.
     */
    void *tex_data;
+   /**
+    * Bytes mmap'ed for tex_data, or 0 if malloc'ed, see LP_HUGE_PAGES and
+    * LP_SPARSE_PAGE_SIZE.
+    */
+   size_t tex_data_mapped;
 
    /**
     * Data for non-texture resources.
     */
    void *data;
+   /** Bytes mmap'ed for data, or 0 if malloc'ed, for sparse buffers */
+   size_t data_mapped;
+
+   /**
+    * Buffer which owns data above, once the threaded context replaced the
+    * original storage, see llvmpipe_replace_buffer_storage().
+    */
+   struct pipe_resource *storage;
+
+   boolean userBuffer;  /** Is the storage owned by the user (buffer or texture)? */
+
+   /**
+    * A depth/stencil texture created with PIPE_RESOURCE_FLAG_TRANSIENT.
+    * tex_data is only allocated once something needs the contents in
+    * memory: a map, a sampler view or image, or a scene which doesn't
+    * clear it first or doesn't discard it at its end, see
+    * lp_scene_begin_rasterization().
+    */
+   boolean transient;
+
+   /**
+    * A buffer created just for constants.  Scenes read it in place rather
+    * than copying it, and writes while they do give it new storage, see
+    * llvmpipe_rename_buffer().  Cleared for good once something else may
+    * hold on to the storage: a persistent mapping, or the threaded
+    * context replacing it.
+    */
+   boolean constants_only;
+   /** The context which set it as a constant buffer, if constants_only */
+   const struct llvmpipe_context *constants_context;
 
-   boolean userBuffer;  /** Is this a user-space buffer? */
+   /**
+    * A texture whose storage writes may replace while scenes sample the
+    * old one, see llvmpipe_rename_texture().  Cleared for good once
+    * something else may hold on to the storage: a persistent mapping, a
+    * shader image, or sampler views of another context than
+    * rename_context.
+    */
+   boolean renamable;
+   /** The context which created sampler views of it, if renamable */
+   const struct llvmpipe_context *rename_context;
+
+   /**
+    * Texels are in 4x4 tiles, each in Morton order, and row_stride is the
+    * stride of rows of tiles, see LP_TILED_TEXTURES.  Only ever set for
+    * textures which are just sampled; llvmpipe_resource_untile() turns
+    * it off for good once they are used any other way.
+    */
+   boolean tiled;
+
+   /**
+    * Screen timestamp of when the storage was created or last written,
+    * see llvmpipe_replay_serial().
+    */
    unsigned timestamp;
 
+   /**
+    * Decompressed copy of a compressed texture, which fragment and compute
+    * shaders sample instead, see LP_DECOMPRESS_TEXTURES.  Only valid while
+    * decompressed_writes == writes.  It is replaced by a new resource when
+    * the texture changed, as scenes in flight may still sample the old one.
+    */
+   struct pipe_resource *decompressed;
+   unsigned decompressed_writes;
+   unsigned decompressions;
+   unsigned writes;   /**< number of write transfers */
+
+   /**
+    * Bounds of level 0 written by scenes and transfers, exclusive, since
+    * the last reset by pipe_context::get_dirty_region.
+    */
+   int dirty_x0, dirty_y0, dirty_x1, dirty_y1;
+
+   /** See pipe_context::set_progress_callback */
+   void (*progress_func)(void *data, unsigned rows);
+   void *progress_data;
+
+   /**
+    * For multisampled render targets, a byte per 4x4 block of layer 0,
+    * non-zero if the rasterizer left all samples of the block equal, see
+    * lp_rast_msaa_end_tile().  The samples are stored in full either way.
+    * Only valid while msaa_equal_writes == writes.
+    */
+   uint8_t *msaa_equal;
+   unsigned msaa_equal_writes;
+
    unsigned id;  /**< temporary, for debugging */
 
    unsigned sample_stride;
@@ -95,18 +204,26 @@ struct llvmpipe_resource
    uint64_t size_required;
    uint64_t backing_offset;
    bool backable;
-#ifdef DEBUG
+
+   /** Memory object the storage was imported from, if any */
+   struct llvmpipe_memory_object *memobj;
+
    /** for linked list */
    struct llvmpipe_resource *prev, *next;
-#endif
 };
 
 
 struct llvmpipe_transfer
 {
-   struct pipe_transfer base;
+   union {
+      struct pipe_transfer base;
+      struct threaded_transfer threaded;
+   };
 
    unsigned long offset;
+
+   /** Linear copy of the box of a tiled texture */
+   void *staging;
 };
 
 
@@ -135,6 +252,11 @@ llvmpipe_transfer(struct pipe_transfer *pt)
 void llvmpipe_init_screen_resource_funcs(struct pipe_screen *screen);
 void llvmpipe_init_context_resource_funcs(struct pipe_context *pipe);
 
+void
+llvmpipe_replace_buffer_storage(struct pipe_context *pipe,
+                                struct pipe_resource *dst,
+                                struct pipe_resource *src);
+
 
 static inline boolean
 llvmpipe_resource_is_texture(const struct pipe_resource *resource)
@@ -180,6 +302,35 @@ llvmpipe_resource_is_1d(const struct pipe_resource *resource)
 }
 
 
+static inline boolean
+llvmpipe_resource_is_tiled(const struct pipe_resource *resource)
+{
+   return llvmpipe_resource_is_texture(resource) &&
+          llvmpipe_resource_const(resource)->tiled;
+}
+
+
+/**
+ * The resource to sample for a sampler view: the decompressed copy of the
+ * texture if there is an up to date one the view's format can use.
+ */
+static inline struct pipe_resource *
+llvmpipe_sampler_view_texture(const struct pipe_sampler_view *view)
+{
+   const struct llvmpipe_resource *lpr = llvmpipe_resource_const(view->texture);
+
+   if (lpr->decompressed &&
+       lpr->decompressed_writes == lpr->writes &&
+       util_format_linear(view->format) ==
+          util_format_linear(view->texture->format) &&
+       (!util_format_is_srgb(view->format) ||
+        util_format_srgb(lpr->decompressed->format) != PIPE_FORMAT_NONE))
+      return lpr->decompressed;
+
+   return view->texture;
+}
+
+
 static inline unsigned
 llvmpipe_layer_stride(struct pipe_resource *resource,
                       unsigned level)
@@ -199,6 +350,36 @@ llvmpipe_resource_stride(struct pipe_resource *resource,
    return lpr->row_stride[level];
 }
 
+
+/** Grow the dirty region with [x0, x1) x [y0, y1) of level 0 */
+static inline void
+llvmpipe_resource_add_dirty(struct llvmpipe_resource *lpr,
+                            int x0, int y0, int x1, int y1)
+{
+   if (x1 <= x0 || y1 <= y0)
+      return;
+
+   if (lpr->dirty_x1 <= lpr->dirty_x0) {
+      lpr->dirty_x0 = x0;
+      lpr->dirty_y0 = y0;
+      lpr->dirty_x1 = x1;
+      lpr->dirty_y1 = y1;
+      return;
+   }
+
+   lpr->dirty_x0 = MIN2(lpr->dirty_x0, x0);
+   lpr->dirty_y0 = MIN2(lpr->dirty_y0, y0);
+   lpr->dirty_x1 = MAX2(lpr->dirty_x1, x1);
+   lpr->dirty_y1 = MAX2(lpr->dirty_y1, y1);
+}
+
+/** Blocks per row of llvmpipe_resource::msaa_equal */
+static inline unsigned
+llvmpipe_msaa_equal_stride(const struct llvmpipe_resource *lpr)
+{
+   return DIV_ROUND_UP(lpr->base.width0, 4);
+}
+
 static inline unsigned
 llvmpipe_sample_stride(struct pipe_resource *resource)
 {
@@ -231,9 +412,25 @@ llvmpipe_get_texture_image_address(struct llvmpipe_resource *lpr,
                                    unsigned face_slice, unsigned level);
 
 
+boolean
+llvmpipe_resource_alloc_transient(struct llvmpipe_resource *lpr);
+
+
+void
+llvmpipe_resource_untile(struct pipe_context *pipe,
+                         struct pipe_resource *resource);
+
+
+void
+llvmpipe_resource_decompress(struct pipe_resource *resource);
+
+
 extern void
 llvmpipe_print_resources(void);
 
+uint64_t
+llvmpipe_resource_memory(struct pipe_screen *screen);
+
 
 #define LP_UNREFERENCED         0
 #define LP_REFERENCED_FOR_READ  (1 << 0)
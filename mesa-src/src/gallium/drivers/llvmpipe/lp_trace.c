@@ -0,0 +1,250 @@
+/*
+ * Copyright © 2026 Mesa contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "util/simple_mtx.h"
+#include "util/u_debug.h"
+#include "util/u_memory.h"
+#include "lp_trace.h"
+
+
+struct lp_trace_event
+{
+   const char *name;
+   const char *arg_names;
+   int64_t start, end;
+   int args[3];
+};
+
+#define LP_TRACE_CHUNK_EVENTS 4096
+
+/** Stop recording a thread's spans past this, ~200MB of them */
+#define LP_TRACE_MAX_CHUNKS 1024
+
+struct lp_trace_chunk
+{
+   struct lp_trace_chunk *next;
+   unsigned count;
+   struct lp_trace_event events[LP_TRACE_CHUNK_EVENTS];
+};
+
+/** The spans of one thread, in the order they ended */
+struct lp_trace_thread
+{
+   struct lp_trace_thread *next;
+   unsigned tid;
+   unsigned num_chunks;
+   uint64_t dropped;
+   struct lp_trace_chunk *head, *tail;
+};
+
+
+bool lp_trace_enabled = false;
+
+static const char *lp_trace_filename;
+static int64_t lp_trace_epoch;
+
+static simple_mtx_t lp_trace_mutex = _SIMPLE_MTX_INITIALIZER_NP;
+static struct lp_trace_thread *lp_trace_threads;
+static unsigned lp_trace_num_threads;
+
+#ifdef USE_ELF_TLS
+static __thread struct lp_trace_thread *lp_trace_thread_tls;
+#else
+/* All threads share one list of spans, appended to under the mutex */
+static struct lp_trace_thread *lp_trace_shared;
+#endif
+
+
+/**
+ * Turn tracing on if LP_TRACE names a file to write to.
+ */
+void
+lp_trace_init(void)
+{
+   const char *filename = debug_get_option("LP_TRACE", NULL);
+
+   if (!filename || !*filename || lp_trace_enabled)
+      return;
+
+   lp_trace_filename = filename;
+   lp_trace_epoch = os_time_get_nano();
+   lp_trace_enabled = true;
+}
+
+
+/** Called with lp_trace_mutex held */
+static struct lp_trace_thread *
+lp_trace_thread_create(void)
+{
+   struct lp_trace_thread *thread = CALLOC_STRUCT(lp_trace_thread);
+
+   if (!thread)
+      return NULL;
+
+   thread->tid = ++lp_trace_num_threads;
+   thread->next = lp_trace_threads;
+   lp_trace_threads = thread;
+
+   return thread;
+}
+
+
+static void
+lp_trace_append(struct lp_trace_thread *thread,
+                const struct lp_trace_event *event)
+{
+   struct lp_trace_chunk *chunk = thread->tail;
+
+   if (!chunk || chunk->count == LP_TRACE_CHUNK_EVENTS) {
+      if (thread->num_chunks == LP_TRACE_MAX_CHUNKS ||
+          !(chunk = MALLOC_STRUCT(lp_trace_chunk))) {
+         thread->dropped++;
+         return;
+      }
+      chunk->next = NULL;
+      chunk->count = 0;
+      if (thread->tail)
+         thread->tail->next = chunk;
+      else
+         thread->head = chunk;
+      thread->tail = chunk;
+      thread->num_chunks++;
+   }
+
+   chunk->events[chunk->count++] = *event;
+}
+
+
+void
+lp_trace_span(const char *name, int64_t start, const char *arg_names,
+              int arg0, int arg1, int arg2)
+{
+   struct lp_trace_event event;
+   struct lp_trace_thread *thread;
+
+   event.name = name;
+   event.arg_names = arg_names;
+   event.start = start;
+   event.end = os_time_get_nano();
+   event.args[0] = arg0;
+   event.args[1] = arg1;
+   event.args[2] = arg2;
+
+#ifdef USE_ELF_TLS
+   thread = lp_trace_thread_tls;
+   if (unlikely(!thread)) {
+      simple_mtx_lock(&lp_trace_mutex);
+      thread = lp_trace_thread_tls = lp_trace_thread_create();
+      simple_mtx_unlock(&lp_trace_mutex);
+      if (!thread)
+         return;
+   }
+   lp_trace_append(thread, &event);
+#else
+   simple_mtx_lock(&lp_trace_mutex);
+   if (!lp_trace_shared)
+      lp_trace_shared = lp_trace_thread_create();
+   thread = lp_trace_shared;
+   if (thread)
+      lp_trace_append(thread, &event);
+   simple_mtx_unlock(&lp_trace_mutex);
+#endif
+}
+
+
+static void
+lp_trace_write_args(FILE *f, const struct lp_trace_event *event)
+{
+   const char *names = event->arg_names;
+   unsigned i;
+
+   fprintf(f, ",\"args\":{");
+   for (i = 0; i < ARRAY_SIZE(event->args) && *names; i++) {
+      const char *comma = strchr(names, ',');
+      int len = comma ? (int)(comma - names) : (int)strlen(names);
+
+      fprintf(f, "%s\"%.*s\":%d", i ? "," : "", len, names, event->args[i]);
+      names += len;
+      if (*names)
+         names++;
+   }
+   fprintf(f, "}");
+}
+
+
+/**
+ * Write all spans recorded so far to the LP_TRACE file.  Threads may still
+ * be recording meanwhile, so this is only complete once they are idle,
+ * i.e. when the screen is destroyed.
+ */
+void
+lp_trace_write(void)
+{
+   FILE *f;
+   bool first = true;
+
+   if (!lp_trace_enabled)
+      return;
+
+   f = fopen(lp_trace_filename, "w");
+   if (!f) {
+      debug_printf("llvmpipe: couldn't open %s for LP_TRACE\n",
+                   lp_trace_filename);
+      return;
+   }
+
+   fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+   simple_mtx_lock(&lp_trace_mutex);
+   for (struct lp_trace_thread *thread = lp_trace_threads;
+        thread; thread = thread->next) {
+      for (struct lp_trace_chunk *chunk = thread->head;
+           chunk; chunk = chunk->next) {
+         for (unsigned i = 0; i < chunk->count; i++) {
+            const struct lp_trace_event *event = &chunk->events[i];
+
+            fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,"
+                    "\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+                    first ? "" : ",\n", event->name, thread->tid,
+                    (event->start - lp_trace_epoch) / 1000.0,
+                    (event->end - event->start) / 1000.0);
+            if (event->arg_names)
+               lp_trace_write_args(f, event);
+            fprintf(f, "}");
+            first = false;
+         }
+      }
+      if (thread->dropped) {
+         debug_printf("llvmpipe: LP_TRACE dropped %" PRIu64
+                      " spans of thread %u\n", thread->dropped, thread->tid);
+      }
+   }
+   simple_mtx_unlock(&lp_trace_mutex);
+
+   fprintf(f, "\n]}\n");
+   fclose(f);
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright © 2026 Mesa contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * Timeline tracing, see LP_TRACE.
+ *
+ * Spans of setup, binning, rasterization and shader compiles are kept per
+ * thread, and written as Chrome trace JSON (chrome://tracing, Perfetto)
+ * when the screen is destroyed.
+ */
+
+#ifndef LP_TRACE_H
+#define LP_TRACE_H
+
+#include "pipe/p_compiler.h"
+#include "util/macros.h"
+#include "util/os_time.h"
+
+
+extern bool lp_trace_enabled;
+
+
+void
+lp_trace_init(void);
+
+void
+lp_trace_write(void);
+
+
+/**
+ * Start a span: the timestamp to pass to LP_TRACE_END(), or zero when
+ * tracing is off.
+ */
+static inline int64_t
+lp_trace_begin(void)
+{
+   return unlikely(lp_trace_enabled) ? os_time_get_nano() : 0;
+}
+
+
+/**
+ * Record a span of the calling thread.  arg_names is a comma-separated
+ * list naming up to three integer arguments, or NULL.
+ */
+void
+lp_trace_span(const char *name, int64_t start, const char *arg_names,
+              int arg0, int arg1, int arg2);
+
+
+#define LP_TRACE_END(name, start) \
+   LP_TRACE_END_ARGS(name, start, NULL, 0, 0, 0)
+
+#define LP_TRACE_END_ARGS(name, start, arg_names, arg0, arg1, arg2) \
+   do { \
+      if (unlikely(start)) \
+         lp_trace_span(name, start, arg_names, arg0, arg1, arg2); \
+   } while (0)
+
+
+#endif /* LP_TRACE_H */
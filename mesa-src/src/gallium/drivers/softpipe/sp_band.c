@@ -0,0 +1,393 @@
+/**************************************************************************
+ *
+ * Copyright © 2026 Mesa contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#include <stdio.h>
+
+#include "util/u_debug.h"
+#include "util/u_math.h"
+#include "util/u_memory.h"
+#include "util/u_thread.h"
+#include "tgsi/tgsi_exec.h"
+#include "sp_band.h"
+#include "sp_context.h"
+#include "sp_quad_pipe.h"
+#include "sp_setup.h"
+#include "sp_state.h"
+#include "sp_texture.h"
+#include "sp_tex_sample.h"
+#include "sp_tex_tile_cache.h"
+#include "sp_tile_cache.h"
+
+
+DEBUG_GET_ONCE_NUM_OPTION(num_threads, "SOFTPIPE_NUM_THREADS", 0)
+
+
+static int
+band_thread(void *init_data)
+{
+   struct sp_band *band = (struct sp_band *) init_data;
+   char thread_name[16];
+
+   snprintf(thread_name, sizeof thread_name, "softpipe-%u", band->index);
+   u_thread_setname(thread_name);
+
+   /* Round like the application thread, which renders band 0. */
+   util_fpstate_set(band->fpstate);
+
+   while (1) {
+      pipe_semaphore_wait(&band->work_ready);
+
+      if (band->exit_flag)
+         break;
+
+      band->func(band, band->data);
+
+      pipe_semaphore_signal(&band->work_done);
+   }
+
+#ifdef _WIN32
+   pipe_semaphore_signal(&band->work_done);
+#endif
+
+   return 0;
+}
+
+
+static void
+destroy_band(struct sp_band *band)
+{
+   unsigned i;
+
+   if (band->thread) {
+      band->exit_flag = TRUE;
+      pipe_semaphore_signal(&band->work_ready);
+
+      /* See lp_rast_destroy() about not joining on Windows. */
+#ifdef _WIN32
+      pipe_semaphore_wait(&band->work_done);
+#else
+      thrd_join(band->thread, NULL);
+#endif
+
+      pipe_semaphore_destroy(&band->work_ready);
+      pipe_semaphore_destroy(&band->work_done);
+   }
+
+   if (band->setup)
+      sp_setup_destroy_context(band->setup);
+
+   if (band->quad.shade)
+      band->quad.shade->destroy(band->quad.shade);
+
+   if (band->quad.depth_test)
+      band->quad.depth_test->destroy(band->quad.depth_test);
+
+   if (band->quad.blend)
+      band->quad.blend->destroy(band->quad.blend);
+
+   if (band->quad.pstipple)
+      band->quad.pstipple->destroy(band->quad.pstipple);
+
+   if (band->fs_machine)
+      tgsi_exec_machine_destroy(band->fs_machine);
+
+   for (i = 0; i < PIPE_MAX_COLOR_BUFS; i++)
+      sp_destroy_tile_cache(band->cbuf_cache[i]);
+   sp_destroy_tile_cache(band->zsbuf_cache);
+
+   /* band 0 borrows the context's sampler */
+   if (band->index > 0) {
+      for (i = 0; i < PIPE_MAX_SHADER_SAMPLER_VIEWS; i++)
+         sp_destroy_tex_tile_cache(band->tex_cache[i]);
+      FREE(band->fs_sampler);
+   }
+
+   FREE(band);
+}
+
+
+static struct sp_band *
+create_band(struct softpipe_context *sp, unsigned index)
+{
+   struct sp_band *band = CALLOC_STRUCT(sp_band);
+   unsigned i;
+
+   if (!band)
+      return NULL;
+
+   band->softpipe = sp;
+   band->index = index;
+   band->num_bands = 1;
+
+   for (i = 0; i < PIPE_MAX_COLOR_BUFS; i++) {
+      band->cbuf_cache[i] = sp_create_tile_cache(&sp->pipe);
+      if (!band->cbuf_cache[i])
+         goto fail;
+   }
+
+   band->zsbuf_cache = sp_create_tile_cache(&sp->pipe);
+   if (!band->zsbuf_cache)
+      goto fail;
+
+   if (index == 0) {
+      band->fs_sampler = sp->tgsi.sampler[PIPE_SHADER_FRAGMENT];
+      for (i = 0; i < PIPE_MAX_SHADER_SAMPLER_VIEWS; i++)
+         band->tex_cache[i] = sp->tex_cache[PIPE_SHADER_FRAGMENT][i];
+   }
+   else {
+      band->fs_sampler = sp_create_tgsi_sampler();
+      if (!band->fs_sampler)
+         goto fail;
+
+      for (i = 0; i < PIPE_MAX_SHADER_SAMPLER_VIEWS; i++) {
+         band->tex_cache[i] = sp_create_tex_tile_cache(&sp->pipe);
+         if (!band->tex_cache[i])
+            goto fail;
+      }
+   }
+
+   band->fs_machine = tgsi_exec_machine_create(PIPE_SHADER_FRAGMENT);
+   if (!band->fs_machine)
+      goto fail;
+
+   /* setup quad rendering stages */
+   band->quad.shade = sp_quad_shade_stage(sp);
+   band->quad.depth_test = sp_quad_depth_test_stage(sp);
+   band->quad.blend = sp_quad_blend_stage(sp);
+   band->quad.pstipple = sp_quad_polygon_stipple_stage(sp);
+   if (!band->quad.shade || !band->quad.depth_test ||
+       !band->quad.blend || !band->quad.pstipple)
+      goto fail;
+
+   band->quad.shade->band = band;
+   band->quad.depth_test->band = band;
+   band->quad.blend->band = band;
+   band->quad.pstipple->band = band;
+
+   band->setup = sp_setup_create_context(band);
+   if (!band->setup)
+      goto fail;
+
+   if (index > 0) {
+      band->fpstate = util_fpstate_get();
+      pipe_semaphore_init(&band->work_ready, 0);
+      pipe_semaphore_init(&band->work_done, 0);
+      band->thread = u_thread_create(band_thread, band);
+      if (!band->thread) {
+         pipe_semaphore_destroy(&band->work_ready);
+         pipe_semaphore_destroy(&band->work_done);
+         goto fail;
+      }
+   }
+
+   return band;
+
+fail:
+   destroy_band(band);
+   return NULL;
+}
+
+
+/**
+ * Create band 0, which renders on the application thread, and one band
+ * per SOFTPIPE_NUM_THREADS thread.  Must be called after the context's
+ * tgsi samplers and texture caches are created.
+ */
+boolean
+sp_create_bands(struct softpipe_context *sp)
+{
+   const long num_threads = debug_get_option_num_threads();
+   const unsigned num_bands = MIN2(MAX2(num_threads, 0) + 1, SP_MAX_BANDS);
+   unsigned i;
+
+   for (i = 0; i < num_bands; i++) {
+      sp->band[i] = create_band(sp, i);
+      if (!sp->band[i]) {
+         /* make do with the threads we have */
+         if (i == 0)
+            return FALSE;
+         break;
+      }
+      sp->num_bands = i + 1;
+   }
+
+   sp->num_bands_used = 1;
+
+   return TRUE;
+}
+
+
+void
+sp_destroy_bands(struct softpipe_context *sp)
+{
+   unsigned i;
+
+   for (i = 0; i < sp->num_bands; i++) {
+      destroy_band(sp->band[i]);
+      sp->band[i] = NULL;
+   }
+
+   sp->num_bands = 0;
+   sp->num_bands_used = 0;
+}
+
+
+/**
+ * Split the framebuffer in num_bands bands.  Rows change hands, so their
+ * current owners first write back their tiles and pending clears.
+ */
+static void
+set_num_bands(struct softpipe_context *sp, unsigned num_bands)
+{
+   unsigned b, i;
+
+   if (num_bands == sp->num_bands_used)
+      return;
+
+   for (b = 0; b < sp->num_bands; b++) {
+      struct sp_band *band = sp->band[b];
+
+      for (i = 0; i < PIPE_MAX_COLOR_BUFS; i++) {
+         sp_flush_tile_cache(band->cbuf_cache[i]);
+         sp_tile_cache_set_band(band->cbuf_cache[i], b, num_bands);
+      }
+
+      sp_flush_tile_cache(band->zsbuf_cache);
+      sp_tile_cache_set_band(band->zsbuf_cache, b, num_bands);
+
+      band->num_bands = num_bands;
+   }
+
+   sp->num_bands_used = num_bands;
+}
+
+
+/**
+ * Called by vbuf code just before we start buffering primitives.
+ */
+void
+sp_bands_prepare(struct softpipe_context *sp)
+{
+   unsigned i;
+
+   if (sp->dirty)
+      softpipe_update_derived(sp, sp->reduced_api_prim);
+
+   /* Stores and atomics from the fragments of different bands would race
+    * and land in any order.
+    */
+   if (sp->fs_variant && sp->fs_variant->info.writes_memory)
+      set_num_bands(sp, 1);
+   else
+      set_num_bands(sp, sp->num_bands);
+
+   for (i = 0; i < sp->num_bands_used; i++)
+      sp_setup_prepare(sp->band[i]->setup);
+}
+
+
+/**
+ * Run func on all the bands in use, band 0 on this thread, and wait for
+ * them to finish.
+ */
+void
+sp_bands_run(struct softpipe_context *sp, sp_band_func func, void *data)
+{
+   unsigned i;
+
+   for (i = 1; i < sp->num_bands_used; i++) {
+      sp->band[i]->func = func;
+      sp->band[i]->data = data;
+      pipe_semaphore_signal(&sp->band[i]->work_ready);
+   }
+
+   func(sp->band[0], data);
+
+   for (i = 1; i < sp->num_bands_used; i++)
+      pipe_semaphore_wait(&sp->band[i]->work_done);
+
+   for (i = 0; i < sp->num_bands_used; i++) {
+      struct sp_band *band = sp->band[i];
+
+      sp->occlusion_count += band->occlusion_count;
+      sp->pipeline_statistics.ps_invocations += band->ps_invocations;
+      band->occlusion_count = 0;
+      band->ps_invocations = 0;
+   }
+}
+
+
+/**
+ * Copy the context's fragment samplers and sampler views to the other
+ * bands, pointing at their own texture caches.
+ */
+void
+sp_bands_update_samplers(struct softpipe_context *sp)
+{
+   const struct sp_tgsi_sampler *sampler =
+      sp->tgsi.sampler[PIPE_SHADER_FRAGMENT];
+   unsigned b, i;
+
+   for (b = 1; b < sp->num_bands; b++) {
+      struct sp_band *band = sp->band[b];
+
+      memcpy(band->fs_sampler, sampler, sizeof(*sampler));
+
+      for (i = 0; i < PIPE_MAX_SHADER_SAMPLER_VIEWS; i++) {
+         struct softpipe_tex_tile_cache *tc = band->tex_cache[i];
+
+         sp_tex_tile_cache_set_sampler_view(tc,
+            sp->sampler_views[PIPE_SHADER_FRAGMENT][i]);
+
+         if (tc->texture) {
+            struct softpipe_resource *spt = softpipe_resource(tc->texture);
+            if (spt->timestamp != tc->timestamp) {
+               sp_tex_tile_cache_validate_texture(tc);
+               tc->timestamp = spt->timestamp;
+            }
+         }
+
+         if (band->fs_sampler->sp_sview[i].base.texture)
+            band->fs_sampler->sp_sview[i].cache = tc;
+      }
+   }
+}
+
+
+/**
+ * Flush the texture caches of the bands other than 0, whose are the
+ * context's.
+ */
+void
+sp_bands_flush_tex_caches(struct softpipe_context *sp)
+{
+   unsigned b, i;
+
+   for (b = 1; b < sp->num_bands; b++) {
+      for (i = 0; i < sp->num_sampler_views[PIPE_SHADER_FRAGMENT]; i++)
+         sp_flush_tex_tile_cache(sp->band[b]->tex_cache[i]);
+   }
+}
@@ -0,0 +1,135 @@
+/**************************************************************************
+ *
+ * Copyright © 2026 Mesa contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/**
+ * Multi-threaded rasterization.
+ *
+ * The framebuffer is split in bands: tile row y belongs to band
+ * y % num_bands.  Each band has its own setup, quad pipeline, tile caches
+ * and fragment shader machine, and sees all the primitives of a vertex
+ * buffer, in order, but only writes its own pixels.  So the results are
+ * exactly the same whatever the number of bands.
+ *
+ * Band 0 runs on the application thread, the others on their own
+ * thread, SOFTPIPE_NUM_THREADS of them.
+ */
+
+#ifndef SP_BAND_H
+#define SP_BAND_H
+
+#include "pipe/p_state.h"
+#include "os/os_thread.h"
+#include "sp_tile_cache.h"
+
+
+#define SP_MAX_BANDS 16
+
+
+struct softpipe_context;
+struct setup_context;
+struct quad_stage;
+struct softpipe_tex_tile_cache;
+struct sp_tgsi_sampler;
+struct tgsi_exec_machine;
+struct sp_band;
+
+typedef void (*sp_band_func)(struct sp_band *band, void *data);
+
+struct sp_band {
+   struct softpipe_context *softpipe;
+   unsigned index;
+   unsigned num_bands;           /**< bands the framebuffer is split in */
+
+   struct setup_context *setup;
+
+   /** Software quad rendering pipeline */
+   struct {
+      struct quad_stage *shade;
+      struct quad_stage *depth_test;
+      struct quad_stage *blend;
+      struct quad_stage *pstipple;
+      struct quad_stage *first; /**< points to one of the above stages */
+   } quad;
+
+   struct tgsi_exec_machine *fs_machine;
+
+   struct softpipe_tile_cache *cbuf_cache[PIPE_MAX_COLOR_BUFS];
+   struct softpipe_tile_cache *zsbuf_cache;
+
+   /**
+    * Fragment shader sampling.  Band 0 uses the context's, the others
+    * copies of it with their own texture caches.
+    */
+   struct sp_tgsi_sampler *fs_sampler;
+   struct softpipe_tex_tile_cache *tex_cache[PIPE_MAX_SHADER_SAMPLER_VIEWS];
+
+   /** Counted per band, added to the context's after each batch */
+   uint64_t occlusion_count;
+   uint64_t ps_invocations;
+
+   /** Thread of the bands other than 0 */
+   thrd_t thread;
+   pipe_semaphore work_ready;
+   pipe_semaphore work_done;
+   sp_band_func func;
+   void *data;
+   unsigned fpstate;
+   boolean exit_flag;
+};
+
+
+/**
+ * Whether the band rasterizes the pixels of row y.
+ */
+static inline boolean
+sp_band_owns_row(const struct sp_band *band, int y)
+{
+   if (band->num_bands == 1)
+      return band->index == 0;
+
+   return (unsigned) (y / TILE_SIZE) % band->num_bands == band->index;
+}
+
+
+boolean
+sp_create_bands(struct softpipe_context *sp);
+
+void
+sp_destroy_bands(struct softpipe_context *sp);
+
+void
+sp_bands_prepare(struct softpipe_context *sp);
+
+void
+sp_bands_run(struct softpipe_context *sp, sp_band_func func, void *data);
+
+void
+sp_bands_update_samplers(struct softpipe_context *sp);
+
+void
+sp_bands_flush_tex_caches(struct softpipe_context *sp);
+
+#endif /* SP_BAND_H */
@@ -56,7 +56,7 @@ softpipe_clear(struct pipe_context *pipe, unsigned buffers,
    struct pipe_surface *zsbuf = softpipe->framebuffer.zsbuf;
    unsigned zs_buffers = buffers & PIPE_CLEAR_DEPTHSTENCIL;
    uint64_t cv;
-   uint i;
+   uint i, b;
 
    if (unlikely(sp_debug & SP_DBG_NO_RAST))
       return;
@@ -70,8 +70,10 @@ softpipe_clear(struct pipe_context *pipe, unsigned buffers,
 
    if (buffers & PIPE_CLEAR_COLOR) {
       for (i = 0; i < softpipe->framebuffer.nr_cbufs; i++) {
-         if (buffers & (PIPE_CLEAR_COLOR0 << i))
-            sp_tile_cache_clear(softpipe->cbuf_cache[i], color, 0);
+         if (buffers & (PIPE_CLEAR_COLOR0 << i)) {
+            for (b = 0; b < softpipe->num_bands_used; b++)
+               sp_tile_cache_clear(softpipe->band[b]->cbuf_cache[i], color, 0);
+         }
       }
    }
 
@@ -86,7 +88,8 @@ softpipe_clear(struct pipe_context *pipe, unsigned buffers,
       static const union pipe_color_union zero;
 
       cv = util_pack64_z_stencil(zsbuf->format, depth, stencil);
-      sp_tile_cache_clear(softpipe->zsbuf_cache, &zero, cv);
+      for (b = 0; b < softpipe->num_bands_used; b++)
+         sp_tile_cache_clear(softpipe->band[b]->zsbuf_cache, &zero, cv);
    }
 
    softpipe->dirty_render_cache = TRUE;
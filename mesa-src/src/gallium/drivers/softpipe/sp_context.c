@@ -30,6 +30,8 @@
  *    Keith Whitwell <keithw@vmware.com>
  */
 
+#include <inttypes.h>
+
 #include "draw/draw_context.h"
 #include "draw/draw_vbuf.h"
 #include "pipe/p_defines.h"
@@ -54,6 +56,63 @@
 #include "sp_tex_sample.h"
 #include "sp_image.h"
 
+static void
+print_cache_stats(const char *name, uint64_t hits, uint64_t misses)
+{
+   const uint64_t lookups = hits + misses;
+
+   debug_printf("softpipe: %s tile cache: %" PRIu64 " hits, %" PRIu64
+                " misses (%.1f%% hit rate)\n", name, hits, misses,
+                lookups ? 100.0 * hits / lookups : 0.0);
+}
+
+
+/**
+ * Print the hit rates of the render and texture tile caches, for
+ * SOFTPIPE_DEBUG=cache_stats.  Lookups of the last tile used aren't
+ * counted.
+ */
+static void
+softpipe_print_cache_stats( struct softpipe_context *softpipe )
+{
+   uint64_t hits = 0, misses = 0;
+   uint i, sh, b;
+
+   for (b = 0; b < softpipe->num_bands; b++) {
+      for (i = 0; i < PIPE_MAX_COLOR_BUFS; i++) {
+         hits += softpipe->band[b]->cbuf_cache[i]->hits;
+         misses += softpipe->band[b]->cbuf_cache[i]->misses;
+      }
+   }
+   print_cache_stats("color", hits, misses);
+
+   hits = misses = 0;
+   for (b = 0; b < softpipe->num_bands; b++) {
+      hits += softpipe->band[b]->zsbuf_cache->hits;
+      misses += softpipe->band[b]->zsbuf_cache->misses;
+   }
+   print_cache_stats("depth/stencil", hits, misses);
+
+   hits = misses = 0;
+   for (sh = 0; sh < ARRAY_SIZE(softpipe->tex_cache); sh++) {
+      for (i = 0; i < ARRAY_SIZE(softpipe->tex_cache[0]); i++) {
+         if (softpipe->tex_cache[sh][i]) {
+            hits += softpipe->tex_cache[sh][i]->hits;
+            misses += softpipe->tex_cache[sh][i]->misses;
+         }
+      }
+   }
+   /* band 0 uses the context's fragment texture caches */
+   for (b = 1; b < softpipe->num_bands; b++) {
+      for (i = 0; i < PIPE_MAX_SHADER_SAMPLER_VIEWS; i++) {
+         hits += softpipe->band[b]->tex_cache[i]->hits;
+         misses += softpipe->band[b]->tex_cache[i]->misses;
+      }
+   }
+   print_cache_stats("texture", hits, misses);
+}
+
+
 static void
 softpipe_destroy( struct pipe_context *pipe )
 {
@@ -75,27 +134,17 @@ softpipe_destroy( struct pipe_context *pipe )
    if (softpipe->draw)
       draw_destroy( softpipe->draw );
 
-   if (softpipe->quad.shade)
-      softpipe->quad.shade->destroy( softpipe->quad.shade );
-
-   if (softpipe->quad.depth_test)
-      softpipe->quad.depth_test->destroy( softpipe->quad.depth_test );
-
-   if (softpipe->quad.blend)
-      softpipe->quad.blend->destroy( softpipe->quad.blend );
-
-   if (softpipe->quad.pstipple)
-      softpipe->quad.pstipple->destroy( softpipe->quad.pstipple );
-
    if (softpipe->pipe.stream_uploader)
       u_upload_destroy(softpipe->pipe.stream_uploader);
 
-   for (i = 0; i < PIPE_MAX_COLOR_BUFS; i++) {
-      sp_destroy_tile_cache(softpipe->cbuf_cache[i]);
+   if (sp_debug & SP_DBG_CACHE_STATS)
+      softpipe_print_cache_stats(softpipe);
+
+   sp_destroy_bands(softpipe);
+
+   for (i = 0; i < PIPE_MAX_COLOR_BUFS; i++)
       pipe_surface_reference(&softpipe->framebuffer.cbufs[i], NULL);
-   }
 
-   sp_destroy_tile_cache(softpipe->zsbuf_cache);
    pipe_surface_reference(&softpipe->framebuffer.zsbuf, NULL);
 
    for (sh = 0; sh < ARRAY_SIZE(softpipe->tex_cache); sh++) {
@@ -117,8 +166,6 @@ softpipe_destroy( struct pipe_context *pipe )
       pipe_vertex_buffer_unreference(&softpipe->vertex_buffer[i]);
    }
 
-   tgsi_exec_machine_destroy(softpipe->fs_machine);
-
    for (i = 0; i < PIPE_SHADER_TYPES; i++) {
       FREE(softpipe->tgsi.sampler[i]);
       FREE(softpipe->tgsi.image[i]);
@@ -255,14 +302,6 @@ softpipe_create_context(struct pipe_screen *screen,
    softpipe->pipe.memory_barrier = softpipe_memory_barrier;
    softpipe->pipe.render_condition = softpipe_render_condition;
    
-   /*
-    * Alloc caches for accessing drawing surfaces and textures.
-    * Must be before quad stage setup!
-    */
-   for (i = 0; i < PIPE_MAX_COLOR_BUFS; i++)
-      softpipe->cbuf_cache[i] = sp_create_tile_cache( &softpipe->pipe );
-   softpipe->zsbuf_cache = sp_create_tile_cache( &softpipe->pipe );
-
    /* Allocate texture caches */
    for (sh = 0; sh < ARRAY_SIZE(softpipe->tex_cache); sh++) {
       for (i = 0; i < ARRAY_SIZE(softpipe->tex_cache[0]); i++) {
@@ -272,13 +311,9 @@ softpipe_create_context(struct pipe_screen *screen,
       }
    }
 
-   softpipe->fs_machine = tgsi_exec_machine_create(PIPE_SHADER_FRAGMENT);
-
-   /* setup quad rendering stages */
-   softpipe->quad.shade = sp_quad_shade_stage(softpipe);
-   softpipe->quad.depth_test = sp_quad_depth_test_stage(softpipe);
-   softpipe->quad.blend = sp_quad_blend_stage(softpipe);
-   softpipe->quad.pstipple = sp_quad_polygon_stipple_stage(softpipe);
+   /* surface caches, quad rendering stages and setup of each band */
+   if (!sp_create_bands(softpipe))
+      goto fail;
 
    softpipe->pipe.stream_uploader = u_upload_create_default(&softpipe->pipe);
    if (!softpipe->pipe.stream_uploader)
@@ -36,6 +36,7 @@
 
 #include "draw/draw_vertex.h"
 
+#include "sp_band.h"
 #include "sp_quad_pipe.h"
 #include "sp_setup.h"
 
@@ -160,14 +161,10 @@ struct softpipe_context {
       struct pipe_sampler_view *sampler_view;
    } pstipple;
 
-   /** Software quad rendering pipeline */
-   struct {
-      struct quad_stage *shade;
-      struct quad_stage *depth_test;
-      struct quad_stage *blend;
-      struct quad_stage *pstipple;
-      struct quad_stage *first; /**< points to one of the above stages */
-   } quad;
+   /** Rasterizers of the framebuffer bands, see sp_band.h */
+   struct sp_band *band[SP_MAX_BANDS];
+   unsigned num_bands;
+   unsigned num_bands_used;  /**< 1 while shaders store to memory */
 
    /** TGSI exec things */
    struct {
@@ -176,7 +173,6 @@ struct softpipe_context {
       struct sp_tgsi_buffer *buffer[PIPE_SHADER_TYPES];
    } tgsi;
 
-   struct tgsi_exec_machine *fs_machine;
    /** whether early depth testing is enabled */
    bool early_depth;
 
@@ -191,9 +187,6 @@ struct softpipe_context {
 
    boolean dirty_render_cache;
 
-   struct softpipe_tile_cache *cbuf_cache[PIPE_MAX_COLOR_BUFS];
-   struct softpipe_tile_cache *zsbuf_cache;
-
    unsigned tex_timestamp;
 
    /*
@@ -49,7 +49,7 @@ softpipe_flush( struct pipe_context *pipe,
                 struct pipe_fence_handle **fence )
 {
    struct softpipe_context *softpipe = softpipe_context(pipe);
-   uint i;
+   uint i, b;
 
    draw_flush(softpipe->draw);
 
@@ -61,6 +61,7 @@ softpipe_flush( struct pipe_context *pipe,
             sp_flush_tex_tile_cache(softpipe->tex_cache[sh][i]);
          }
       }
+      sp_bands_flush_tex_caches(softpipe);
    }
 
    /* If this is a swapbuffers, just flush color buffers.
@@ -68,12 +69,12 @@ softpipe_flush( struct pipe_context *pipe,
     * The zbuffer changes are not discarded, but held in the cache
     * in the hope that a later clear will wipe them out.
     */
-   for (i = 0; i < softpipe->framebuffer.nr_cbufs; i++)
-      if (softpipe->cbuf_cache[i])
-         sp_flush_tile_cache(softpipe->cbuf_cache[i]);
+   for (b = 0; b < softpipe->num_bands; b++) {
+      for (i = 0; i < softpipe->framebuffer.nr_cbufs; i++)
+         sp_flush_tile_cache(softpipe->band[b]->cbuf_cache[i]);
 
-   if (softpipe->zsbuf_cache)
-      sp_flush_tile_cache(softpipe->zsbuf_cache);
+      sp_flush_tile_cache(softpipe->band[b]->zsbuf_cache);
+   }
 
    softpipe->dirty_render_cache = FALSE;
 
@@ -172,20 +173,21 @@ softpipe_flush_resource(struct pipe_context *pipe,
 void softpipe_texture_barrier(struct pipe_context *pipe, unsigned flags)
 {
    struct softpipe_context *softpipe = softpipe_context(pipe);
-   uint i, sh;
+   uint i, sh, b;
 
    for (sh = 0; sh < ARRAY_SIZE(softpipe->tex_cache); sh++) {
       for (i = 0; i < softpipe->num_sampler_views[sh]; i++) {
          sp_flush_tex_tile_cache(softpipe->tex_cache[sh][i]);
       }
    }
+   sp_bands_flush_tex_caches(softpipe);
 
-   for (i = 0; i < softpipe->framebuffer.nr_cbufs; i++)
-      if (softpipe->cbuf_cache[i])
-         sp_flush_tile_cache(softpipe->cbuf_cache[i]);
+   for (b = 0; b < softpipe->num_bands; b++) {
+      for (i = 0; i < softpipe->framebuffer.nr_cbufs; i++)
+         sp_flush_tile_cache(softpipe->band[b]->cbuf_cache[i]);
 
-   if (softpipe->zsbuf_cache)
-      sp_flush_tile_cache(softpipe->zsbuf_cache);
+      sp_flush_tile_cache(softpipe->band[b]->zsbuf_cache);
+   }
 
    softpipe->dirty_render_cache = FALSE;
 }
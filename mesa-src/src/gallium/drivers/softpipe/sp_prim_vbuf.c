@@ -49,6 +49,13 @@
 #define SP_MAX_VBUF_INDEXES 1024
 #define SP_MAX_VBUF_SIZE    4096
 
+/**
+ * With several bands, all of them wait for the slowest at the end of each
+ * batch, so make the batches larger.
+ */
+#define SP_MAX_VBUF_INDEXES_BANDS (SP_MAX_VBUF_INDEXES * 4)
+#define SP_MAX_VBUF_SIZE_BANDS    (SP_MAX_VBUF_SIZE * 16)
+
 typedef const float (*cptrf4)[4];
 
 /**
@@ -58,7 +65,6 @@ struct softpipe_vbuf_render
 {
    struct vbuf_render base;
    struct softpipe_context *softpipe;
-   struct setup_context *setup;
 
    enum pipe_prim_type prim;
    uint vertex_size;
@@ -68,6 +74,18 @@ struct softpipe_vbuf_render
 };
 
 
+/**
+ * Primitives each band rasterizes.
+ */
+struct sp_vbuf_batch
+{
+   struct softpipe_vbuf_render *cvbr;
+   const ushort *indices;
+   uint start;
+   uint nr;
+};
+
+
 /** cast wrapper */
 static struct softpipe_vbuf_render *
 softpipe_vbuf_render(struct vbuf_render *vbr)
@@ -136,9 +154,8 @@ static void
 sp_vbuf_set_primitive(struct vbuf_render *vbr, enum pipe_prim_type prim)
 {
    struct softpipe_vbuf_render *cvbr = softpipe_vbuf_render(vbr);
-   struct setup_context *setup_ctx = cvbr->setup;
-   
-   sp_setup_prepare( setup_ctx );
+
+   sp_bands_prepare(cvbr->softpipe);
 
    cvbr->softpipe->reduced_prim = u_reduced_prim(prim);
    cvbr->prim = prim;
@@ -154,16 +171,19 @@ static inline cptrf4 get_vert( const void *vertex_buffer,
 
 
 /**
- * draw elements / indexed primitives
+ * draw elements / indexed primitives, on one band
  */
 static void
-sp_vbuf_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
+draw_elements_band(struct sp_band *band, void *data)
 {
-   struct softpipe_vbuf_render *cvbr = softpipe_vbuf_render(vbr);
+   const struct sp_vbuf_batch *batch = (const struct sp_vbuf_batch *) data;
+   struct softpipe_vbuf_render *cvbr = batch->cvbr;
+   const ushort *indices = batch->indices;
+   const uint nr = batch->nr;
    struct softpipe_context *softpipe = cvbr->softpipe;
    const unsigned stride = softpipe->vertex_info.size * sizeof(float);
    const void *vertex_buffer = cvbr->vertex_buffer;
-   struct setup_context *setup = cvbr->setup;
+   struct setup_context *setup = band->setup;
    const boolean flatshade_first = softpipe->rasterizer->flatshade_first;
    unsigned i;
 
@@ -348,19 +368,34 @@ sp_vbuf_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
 }
 
 
+static void
+sp_vbuf_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
+{
+   struct sp_vbuf_batch batch;
+
+   batch.cvbr = softpipe_vbuf_render(vbr);
+   batch.indices = indices;
+   batch.start = 0;
+   batch.nr = nr;
+
+   sp_bands_run(batch.cvbr->softpipe, draw_elements_band, &batch);
+}
+
+
 /**
- * This function is hit when the draw module is working in pass-through mode.
- * It's up to us to convert the vertex array into point/line/tri prims.
+ * Draw vertex arrays, on one band.
  */
 static void
-sp_vbuf_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
+draw_arrays_band(struct sp_band *band, void *data)
 {
-   struct softpipe_vbuf_render *cvbr = softpipe_vbuf_render(vbr);
+   const struct sp_vbuf_batch *batch = (const struct sp_vbuf_batch *) data;
+   struct softpipe_vbuf_render *cvbr = batch->cvbr;
+   const uint nr = batch->nr;
    struct softpipe_context *softpipe = cvbr->softpipe;
-   struct setup_context *setup = cvbr->setup;
+   struct setup_context *setup = band->setup;
    const unsigned stride = softpipe->vertex_info.size * sizeof(float);
    const void *vertex_buffer =
-      (void *) get_vert(cvbr->vertex_buffer, start, stride);
+      (void *) get_vert(cvbr->vertex_buffer, batch->start, stride);
    const boolean flatshade_first = softpipe->rasterizer->flatshade_first;
    unsigned i;
 
@@ -587,6 +622,24 @@ sp_vbuf_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
    }
 }
 
+
+/**
+ * This function is hit when the draw module is working in pass-through mode.
+ * It's up to us to convert the vertex array into point/line/tri prims.
+ */
+static void
+sp_vbuf_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
+{
+   struct sp_vbuf_batch batch;
+
+   batch.cvbr = softpipe_vbuf_render(vbr);
+   batch.indices = NULL;
+   batch.start = start;
+   batch.nr = nr;
+
+   sp_bands_run(batch.cvbr->softpipe, draw_arrays_band, &batch);
+}
+
 /*
  * FIXME: it is unclear if primitives_storage_needed (which is generally
  * the same as pipe query num_primitives_generated) should increase
@@ -635,7 +688,6 @@ sp_vbuf_destroy(struct vbuf_render *vbr)
    struct softpipe_vbuf_render *cvbr = softpipe_vbuf_render(vbr);
    if (cvbr->vertex_buffer)
       align_free(cvbr->vertex_buffer);
-   sp_setup_destroy_context(cvbr->setup);
    FREE(cvbr);
 }
 
@@ -650,8 +702,14 @@ sp_create_vbuf_backend(struct softpipe_context *sp)
 
    assert(sp->draw);
 
-   cvbr->base.max_indices = SP_MAX_VBUF_INDEXES;
-   cvbr->base.max_vertex_buffer_bytes = SP_MAX_VBUF_SIZE;
+   if (sp->num_bands > 1) {
+      cvbr->base.max_indices = SP_MAX_VBUF_INDEXES_BANDS;
+      cvbr->base.max_vertex_buffer_bytes = SP_MAX_VBUF_SIZE_BANDS;
+   }
+   else {
+      cvbr->base.max_indices = SP_MAX_VBUF_INDEXES;
+      cvbr->base.max_vertex_buffer_bytes = SP_MAX_VBUF_SIZE;
+   }
 
    cvbr->base.get_vertex_info = sp_vbuf_get_vertex_info;
    cvbr->base.allocate_vertices = sp_vbuf_allocate_vertices;
@@ -667,7 +725,5 @@ sp_create_vbuf_backend(struct softpipe_context *sp)
 
    cvbr->softpipe = sp;
 
-   cvbr->setup = sp_setup_create_context(cvbr->softpipe);
-
    return &cvbr->base;
 }
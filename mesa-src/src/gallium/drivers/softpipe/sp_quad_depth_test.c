@@ -800,7 +800,7 @@ depth_test_quads_fallback(struct quad_stage *qs,
 
       data.ps = qs->softpipe->framebuffer.zsbuf;
       data.format = data.ps->format;
-      data.tile = sp_get_cached_tile(qs->softpipe->zsbuf_cache, 
+      data.tile = sp_get_cached_tile(qs->band->zsbuf_cache, 
                                      quads[0]->input.x0, 
                                      quads[0]->input.y0, quads[0]->input.layer);
       data.clamp = !qs->softpipe->rasterizer->depth_clip_near;
@@ -843,7 +843,7 @@ depth_test_quads_fallback(struct quad_stage *qs,
 
    if (qs->softpipe->active_query_count) {
       for (i = 0; i < nr; i++) 
-         qs->softpipe->occlusion_count += mask_count[quads[i]->inout.mask];
+         qs->band->occlusion_count += mask_count[quads[i]->inout.mask];
    }
 
    if (nr)
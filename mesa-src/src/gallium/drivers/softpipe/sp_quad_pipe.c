@@ -32,10 +32,10 @@
 
 
 static void
-insert_stage_at_head(struct softpipe_context *sp, struct quad_stage *quad)
+insert_stage_at_head(struct sp_band *band, struct quad_stage *quad)
 {
-   quad->next = sp->quad.first;
-   sp->quad.first = quad;
+   quad->next = band->quad.first;
+   band->quad.first = quad;
 }
 
 
@@ -50,22 +50,28 @@ sp_build_quad_pipeline(struct softpipe_context *sp)
       !sp->fs_variant->info.writes_z &&
        !sp->fs_variant->info.writes_stencil) ||
       sp->fs_variant->info.properties[TGSI_PROPERTY_FS_EARLY_DEPTH_STENCIL];
-
-   sp->quad.first = sp->quad.blend;
+   unsigned i;
 
    sp->early_depth = early_depth_test;
-   if (early_depth_test) {
-      insert_stage_at_head( sp, sp->quad.shade );
-      insert_stage_at_head( sp, sp->quad.depth_test );
-   }
-   else {
-      insert_stage_at_head( sp, sp->quad.depth_test );
-      insert_stage_at_head( sp, sp->quad.shade );
-   }
+
+   for (i = 0; i < sp->num_bands; i++) {
+      struct sp_band *band = sp->band[i];
+
+      band->quad.first = band->quad.blend;
+
+      if (early_depth_test) {
+         insert_stage_at_head( band, band->quad.shade );
+         insert_stage_at_head( band, band->quad.depth_test );
+      }
+      else {
+         insert_stage_at_head( band, band->quad.depth_test );
+         insert_stage_at_head( band, band->quad.shade );
+      }
 
 #if !DO_PSTIPPLE_IN_DRAW_MODULE && !DO_PSTIPPLE_IN_HELPER_MODULE
-   if (sp->rasterizer->poly_stipple_enable)
-      insert_stage_at_head( sp, sp->quad.pstipple );
+      if (sp->rasterizer->poly_stipple_enable)
+         insert_stage_at_head( band, band->quad.pstipple );
 #endif
+   }
 }
 
@@ -33,6 +33,7 @@
 
 
 struct softpipe_context;
+struct sp_band;
 struct quad_header;
 
 
@@ -43,6 +44,7 @@ struct quad_header;
  */
 struct quad_stage {
    struct softpipe_context *softpipe;
+   struct sp_band *band;
 
    struct quad_stage *next;
 
@@ -53,6 +53,7 @@ static const struct debug_named_value sp_debug_options[] = {
    {"cs",        SP_DBG_CS,         "dump compute shader assembly to stderr"},
    {"no_rast",   SP_DBG_NO_RAST,    "no-ops rasterization, for profiling purposes"},
    {"use_llvm",  SP_DBG_USE_LLVM,   "Use LLVM if available for shaders"},
+   {"cache_stats", SP_DBG_CACHE_STATS, "print tile cache hit rates at context destruction"},
 };
 
 int sp_debug;
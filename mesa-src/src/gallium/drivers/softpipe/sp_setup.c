@@ -74,6 +74,7 @@ struct edge {
  */
 struct setup_context {
    struct softpipe_context *softpipe;
+   struct sp_band *band;        /**< only rasterizes the rows of this band */
 
    /* Vertices are just an array of floats making up each attribute in
     * turn.  Currently fixed at 4 floats, but should change in time.
@@ -143,6 +144,11 @@ quad_clip(struct setup_context *setup, struct quad_header *quad)
       quad->inout.mask = 0x0;
       return;
    }
+   if (!sp_band_owns_row(setup->band, quad->input.y0)) {
+      /* another band's */
+      quad->inout.mask = 0x0;
+      return;
+   }
    if (quad->input.x0 < minx)
       quad->inout.mask &= (MASK_BOTTOM_RIGHT | MASK_TOP_RIGHT);
    if (quad->input.y0 < miny)
@@ -163,13 +169,13 @@ clip_emit_quad(struct setup_context *setup, struct quad_header *quad)
    quad_clip(setup, quad);
 
    if (quad->inout.mask) {
-      struct softpipe_context *sp = setup->softpipe;
+      struct quad_stage *pipe = setup->band->quad.first;
 
 #if DEBUG_FRAGS
       setup->numFragsEmitted += util_bitcount(quad->inout.mask);
 #endif
 
-      sp->quad.first->run( sp->quad.first, &quad, 1 );
+      pipe->run( pipe, &quad, 1 );
    }
 }
 
@@ -204,7 +210,7 @@ flush_spans(struct setup_context *setup)
    const int xleft1 = setup->span.left[1];
    const int xright0 = setup->span.right[0];
    const int xright1 = setup->span.right[1];
-   struct quad_stage *pipe = setup->softpipe->quad.first;
+   struct quad_stage *pipe = setup->band->quad.first;
 
    const int minleft = block_x(MIN2(xleft0, xleft1));
    const int maxright = MAX2(xright0, xright1);
@@ -731,6 +737,13 @@ subtriangle(struct setup_context *setup,
    */
 
    for (y = start_y; y < finish_y; y++) {
+      int left, right;
+
+      /* Bands are whole tile rows, so the two rows of a quad always
+       * belong to the same band.
+       */
+      if (!sp_band_owns_row(setup->band, sy + y))
+         continue;
 
       /* avoid accumulating adds as floats don't have the precision to
        * accurately iterate large triangle edges that way.  luckily we
@@ -738,8 +751,8 @@ subtriangle(struct setup_context *setup,
        *
        * this is all drowned out by the attribute interpolation anyway.
        */
-      int left = (int)(eleft->sx + y * eleft->dxdy);
-      int right = (int)(eright->sx + y * eright->dxdy);
+      left = (int)(eleft->sx + y * eleft->dxdy);
+      right = (int)(eright->sx + y * eright->dxdy);
 
       /* clip left/right */
       if (left < minx)
@@ -864,7 +877,8 @@ sp_setup_tri(struct setup_context *setup,
 
    flush_spans( setup );
 
-   if (setup->softpipe->active_statistics_queries) {
+   /* every band sees the triangle, count it once */
+   if (setup->softpipe->active_statistics_queries && setup->band->index == 0) {
       setup->softpipe->pipeline_statistics.c_primitives++;
    }
 
@@ -1481,7 +1495,7 @@ sp_setup_prepare(struct setup_context *setup)
 
    setup->max_layer = max_layer;
 
-   sp->quad.first->begin( sp->quad.first );
+   setup->band->quad.first->begin( setup->band->quad.first );
 
    if (sp->reduced_api_prim == PIPE_PRIM_TRIANGLES &&
        sp->rasterizer->fill_front == PIPE_POLYGON_MODE_FILL &&
@@ -1507,12 +1521,16 @@ sp_setup_destroy_context(struct setup_context *setup)
  * Create a new primitive setup/render stage.
  */
 struct setup_context *
-sp_setup_create_context(struct softpipe_context *softpipe)
+sp_setup_create_context(struct sp_band *band)
 {
    struct setup_context *setup = CALLOC_STRUCT(setup_context);
    unsigned i;
 
-   setup->softpipe = softpipe;
+   if (!setup)
+      return NULL;
+
+   setup->softpipe = band->softpipe;
+   setup->band = band;
 
    for (i = 0; i < MAX_QUADS; i++) {
       setup->quad[i].coef = setup->coef;
@@ -28,6 +28,7 @@
 #define SP_SETUP_H
 
 struct setup_context;
+struct sp_band;
 struct softpipe_context;
 
 /**
@@ -70,7 +71,7 @@ sp_clamp_viewport_idx(int idx)
    return (PIPE_MAX_VIEWPORTS > idx && idx >= 0) ? idx : 0;
 }
 
-struct setup_context *sp_setup_create_context( struct softpipe_context *softpipe );
+struct setup_context *sp_setup_create_context( struct sp_band *band );
 void sp_setup_prepare( struct setup_context *setup );
 void sp_setup_destroy_context( struct setup_context *setup );
 
@@ -328,6 +328,8 @@ update_tgsi_samplers( struct softpipe_context *softpipe )
          }
       }
    }
+
+   sp_bands_update_samplers(softpipe);
 }
 
 
@@ -335,6 +337,7 @@ static void
 update_fragment_shader(struct softpipe_context *softpipe, unsigned prim)
 {
    struct sp_fragment_shader_variant_key key;
+   unsigned i;
 
    memset(&key, 0, sizeof(key));
 
@@ -345,13 +348,16 @@ update_fragment_shader(struct softpipe_context *softpipe, unsigned prim)
       softpipe->fs_variant = softpipe_find_fs_variant(softpipe,
                                                       softpipe->fs, &key);
 
-      /* prepare the TGSI interpreter for FS execution */
-      softpipe->fs_variant->prepare(softpipe->fs_variant, 
-                                    softpipe->fs_machine,
-                                    (struct tgsi_sampler *) softpipe->
-                                    tgsi.sampler[PIPE_SHADER_FRAGMENT],
-                                    (struct tgsi_image *)softpipe->tgsi.image[PIPE_SHADER_FRAGMENT],
-                                    (struct tgsi_buffer *)softpipe->tgsi.buffer[PIPE_SHADER_FRAGMENT]);
+      /* prepare the TGSI interpreters of the bands for FS execution */
+      for (i = 0; i < softpipe->num_bands; i++) {
+         struct sp_band *band = softpipe->band[i];
+
+         softpipe->fs_variant->prepare(softpipe->fs_variant,
+                                       band->fs_machine,
+                                       (struct tgsi_sampler *) band->fs_sampler,
+                                       (struct tgsi_image *)softpipe->tgsi.image[PIPE_SHADER_FRAGMENT],
+                                       (struct tgsi_buffer *)softpipe->tgsi.buffer[PIPE_SHADER_FRAGMENT]);
+      }
    }
    else {
       softpipe->fs_variant = NULL;
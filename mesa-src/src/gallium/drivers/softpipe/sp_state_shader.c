@@ -209,6 +209,7 @@ softpipe_delete_fs_state(struct pipe_context *pipe, void *fs)
    struct softpipe_context *softpipe = softpipe_context(pipe);
    struct sp_fragment_shader *state = fs;
    struct sp_fragment_shader_variant *var, *next_var;
+   unsigned i;
 
    assert(fs != softpipe->fs);
 
@@ -223,7 +224,14 @@ softpipe_delete_fs_state(struct pipe_context *pipe, void *fs)
       draw_delete_fragment_shader(softpipe->draw, var->draw_shader);
 #endif
 
-      var->delete(var, softpipe->fs_machine);
+      /* var->delete() only unbinds the variant from the one machine */
+      for (i = 1; i < softpipe->num_bands; i++) {
+         struct tgsi_exec_machine *machine = softpipe->band[i]->fs_machine;
+         if (machine->Tokens == var->tokens)
+            tgsi_exec_machine_bind_shader(machine, NULL, NULL, NULL, NULL);
+      }
+
+      var->delete(var, softpipe->band[0]->fs_machine);
    }
 
    draw_delete_fragment_shader(softpipe->draw, state->draw_shader);
@@ -49,7 +49,7 @@ softpipe_set_framebuffer_state(struct pipe_context *pipe,
                                const struct pipe_framebuffer_state *fb)
 {
    struct softpipe_context *sp = softpipe_context(pipe);
-   uint i;
+   uint i, b;
 
    draw_flush(sp->draw);
 
@@ -59,13 +59,15 @@ softpipe_set_framebuffer_state(struct pipe_context *pipe,
       /* check if changing cbuf */
       if (sp->framebuffer.cbufs[i] != cb) {
          /* flush old */
-         sp_flush_tile_cache(sp->cbuf_cache[i]);
+         for (b = 0; b < sp->num_bands; b++)
+            sp_flush_tile_cache(sp->band[b]->cbuf_cache[i]);
 
          /* assign new */
          pipe_surface_reference(&sp->framebuffer.cbufs[i], cb);
 
          /* update cache */
-         sp_tile_cache_set_surface(sp->cbuf_cache[i], cb);
+         for (b = 0; b < sp->num_bands; b++)
+            sp_tile_cache_set_surface(sp->band[b]->cbuf_cache[i], cb);
       }
    }
 
@@ -74,13 +76,15 @@ softpipe_set_framebuffer_state(struct pipe_context *pipe,
    /* zbuf changing? */
    if (sp->framebuffer.zsbuf != fb->zsbuf) {
       /* flush old */
-      sp_flush_tile_cache(sp->zsbuf_cache);
+      for (b = 0; b < sp->num_bands; b++)
+         sp_flush_tile_cache(sp->band[b]->zsbuf_cache);
 
       /* assign new */
       pipe_surface_reference(&sp->framebuffer.zsbuf, fb->zsbuf);
 
       /* update cache */
-      sp_tile_cache_set_surface(sp->zsbuf_cache, fb->zsbuf);
+      for (b = 0; b < sp->num_bands; b++)
+         sp_tile_cache_set_surface(sp->band[b]->zsbuf_cache, fb->zsbuf);
 
       /* Tell draw module how deep the Z/depth buffer is
        *
@@ -41,13 +41,49 @@
 #include "sp_texture.h"
 #include "sp_tex_tile_cache.h"
 
-   
+
+/**
+ * Resize the cache to num_sets sets, all empty.  Keep the current size if
+ * the entries can't be allocated.
+ */
+static void
+sp_tex_tile_cache_resize(struct softpipe_tex_tile_cache *tc,
+                         unsigned num_sets)
+{
+   const unsigned num_entries = num_sets * TEX_TILE_CACHE_WAYS;
+   struct softpipe_tex_cached_tile *entries;
+   unsigned *last_used;
+   unsigned pos;
+
+   if (num_sets != tc->num_sets) {
+      entries = MALLOC(num_entries * sizeof(*entries));
+      last_used = CALLOC(num_entries, sizeof(*last_used));
+      if (entries && last_used) {
+         FREE(tc->entries);
+         FREE(tc->last_used);
+         tc->entries = entries;
+         tc->last_used = last_used;
+         tc->num_sets = num_sets;
+         tc->num_entries = num_entries;
+      }
+      else {
+         FREE(entries);
+         FREE(last_used);
+      }
+   }
+
+   for (pos = 0; pos < tc->num_entries; pos++) {
+      tc->entries[pos].addr.value = 0;
+      tc->entries[pos].addr.bits.invalid = 1;
+   }
+   tc->last_tile = &tc->entries[0]; /* any tile */
+}
+
 
 struct softpipe_tex_tile_cache *
 sp_create_tex_tile_cache( struct pipe_context *pipe )
 {
    struct softpipe_tex_tile_cache *tc;
-   uint pos;
 
    /* make sure max texture size works */
    assert((TEX_TILE_SIZE << TEX_Y_BITS) >= (1 << (SP_MAX_TEXTURE_2D_LEVELS-1)));
@@ -55,10 +91,11 @@ sp_create_tex_tile_cache( struct pipe_context *pipe )
    tc = CALLOC_STRUCT( softpipe_tex_tile_cache );
    if (tc) {
       tc->pipe = pipe;
-      for (pos = 0; pos < ARRAY_SIZE(tc->entries); pos++) {
-         tc->entries[pos].addr.bits.invalid = 1;
+      sp_tex_tile_cache_resize(tc, TEX_TILE_CACHE_MIN_SETS);
+      if (!tc->entries) {
+         FREE(tc);
+         return NULL;
       }
-      tc->last_tile = &tc->entries[0]; /* any tile */
    }
    return tc;
 }
@@ -68,11 +105,6 @@ void
 sp_destroy_tex_tile_cache(struct softpipe_tex_tile_cache *tc)
 {
    if (tc) {
-      uint pos;
-
-      for (pos = 0; pos < ARRAY_SIZE(tc->entries); pos++) {
-         /*assert(tc->entries[pos].x < 0);*/
-      }
       if (tc->transfer) {
          tc->pipe->transfer_unmap(tc->pipe, tc->transfer);
       }
@@ -80,6 +112,8 @@ sp_destroy_tex_tile_cache(struct softpipe_tex_tile_cache *tc)
          tc->pipe->transfer_unmap(tc->pipe, tc->tex_trans);
       }
 
+      FREE( tc->entries );
+      FREE( tc->last_used );
       FREE( tc );
    }
 }
@@ -97,7 +131,7 @@ sp_tex_tile_cache_validate_texture(struct softpipe_tex_tile_cache *tc)
    assert(tc);
    assert(tc->texture);
 
-   for (i = 0; i < ARRAY_SIZE(tc->entries); i++) {
+   for (i = 0; i < tc->num_entries; i++) {
       tc->entries[i].addr.bits.invalid = 1;
    }
 }
@@ -124,7 +158,6 @@ sp_tex_tile_cache_set_sampler_view(struct softpipe_tex_tile_cache *tc,
                                    struct pipe_sampler_view *view)
 {
    struct pipe_resource *texture = view ? view->texture : NULL;
-   uint i;
 
    assert(!tc->transfer);
 
@@ -145,10 +178,25 @@ sp_tex_tile_cache_set_sampler_view(struct softpipe_tex_tile_cache *tc,
          tc->format = view->format;
       }
 
-      /* mark as entries as invalid/empty */
+      /* mark as entries as invalid/empty, with enough sets for the tiles
+       * of the texture, if possible; a mipmap tree has a third more tiles
+       * than its base level
+       */
       /* XXX we should try to avoid this when the teximage hasn't changed */
-      for (i = 0; i < ARRAY_SIZE(tc->entries); i++) {
-         tc->entries[i].addr.bits.invalid = 1;
+      if (texture && texture->target != PIPE_BUFFER) {
+         unsigned tiles = DIV_ROUND_UP(texture->width0, TEX_TILE_SIZE) *
+                          DIV_ROUND_UP(texture->height0, TEX_TILE_SIZE);
+         unsigned num_sets;
+
+         if (texture->last_level > 0)
+            tiles += tiles / 3;
+         num_sets = util_next_power_of_two(DIV_ROUND_UP(tiles,
+                                                        TEX_TILE_CACHE_WAYS));
+         sp_tex_tile_cache_resize(tc, CLAMP(num_sets, TEX_TILE_CACHE_MIN_SETS,
+                                            TEX_TILE_CACHE_MAX_SETS));
+      }
+      else {
+         sp_tex_tile_cache_resize(tc, tc->num_sets);
       }
 
       tc->tex_z = -1; /* any invalid value here */
@@ -169,7 +217,7 @@ sp_flush_tex_tile_cache(struct softpipe_tex_tile_cache *tc)
 
    if (tc->texture) {
       /* caching a texture, mark all entries as empty */
-      for (pos = 0; pos < ARRAY_SIZE(tc->entries); pos++) {
+      for (pos = 0; pos < tc->num_entries; pos++) {
          tc->entries[pos].addr.bits.invalid = 1;
       }
       tc->tex_z = -1;
@@ -180,20 +228,19 @@ sp_flush_tex_tile_cache(struct softpipe_tex_tile_cache *tc)
 
 /**
  * Given the texture face, level, zslice, x and y values, compute
- * the cache entry position/index where we'd hope to find the
- * cached texture tile.
- * This is basically a direct-map cache.
- * XXX There's probably lots of ways in which we can improve this.
+ * the first cache entry position/index of the set where we'd hope to
+ * find the cached texture tile.
  */
 static inline uint
-tex_cache_pos( union tex_tile_address addr )
+tex_cache_set_pos(const struct softpipe_tex_tile_cache *tc,
+                  union tex_tile_address addr)
 {
-   uint entry = (addr.bits.x + 
-                 addr.bits.y * 9 + 
-                 addr.bits.z +
-                 addr.bits.level * 7);
+   uint set = (addr.bits.x +
+               addr.bits.y * 9 +
+               addr.bits.z +
+               addr.bits.level * 7);
 
-   return entry % NUM_TEX_TILE_ENTRIES;
+   return (set & (tc->num_sets - 1)) * TEX_TILE_CACHE_WAYS;
 }
 
 /**
@@ -205,8 +252,30 @@ sp_find_cached_tile_tex(struct softpipe_tex_tile_cache *tc,
                         union tex_tile_address addr )
 {
    struct softpipe_tex_cached_tile *tile;
+   const uint set = tex_cache_set_pos(tc, addr);
+   uint pos, victim = set;
+
+   for (pos = set; pos < set + TEX_TILE_CACHE_WAYS; pos++) {
+      if (tc->entries[pos].addr.value == addr.value)
+         break;
+
+      /* replace an empty entry, else the least recently used one */
+      if (!tc->entries[victim].addr.bits.invalid &&
+          (tc->entries[pos].addr.bits.invalid ||
+           tc->clock - tc->last_used[pos] > tc->clock - tc->last_used[victim]))
+         victim = pos;
+   }
+
+   if (pos < set + TEX_TILE_CACHE_WAYS) {
+      tc->hits++;
+   }
+   else {
+      tc->misses++;
+      pos = victim;
+   }
+   tc->last_used[pos] = ++tc->clock;
 
-   tile = tc->entries + tex_cache_pos( addr );
+   tile = tc->entries + pos;
 
    if (addr.value != tile->addr.value) {
 
@@ -71,13 +71,14 @@ struct softpipe_tex_cached_tile
    } data;
 };
 
-/*
- * The number of cache entries.
- * Should not be decreased to lower than 16, and even that
- * seems too low to avoid cache thrashing in some cases (because
- * the cache is direct mapped, see tex_cache_pos() function).
+/**
+ * The cache is set associative, with TEX_TILE_CACHE_WAYS tiles per set,
+ * and enough sets for the tiles of the texture's mipmap tree, a power of
+ * two between TEX_TILE_CACHE_MIN_SETS and TEX_TILE_CACHE_MAX_SETS.
  */
-#define NUM_TEX_TILE_ENTRIES 16
+#define TEX_TILE_CACHE_WAYS 4
+#define TEX_TILE_CACHE_MIN_SETS 4
+#define TEX_TILE_CACHE_MAX_SETS 64
 
 struct softpipe_tex_tile_cache
 {
@@ -88,7 +89,14 @@ struct softpipe_tex_tile_cache
    struct pipe_resource *texture;  /**< if caching a texture */
    unsigned timestamp;
 
-   struct softpipe_tex_cached_tile entries[NUM_TEX_TILE_ENTRIES];
+   unsigned num_sets;
+   unsigned num_entries;           /**< num_sets * TEX_TILE_CACHE_WAYS */
+   struct softpipe_tex_cached_tile *entries;
+   unsigned *last_used;            /**< clock of each entry's last lookup */
+   unsigned clock;
+
+   /** Lookups missing the last tile, see SOFTPIPE_DEBUG=cache_stats */
+   uint64_t hits, misses;
 
    struct pipe_transfer *tex_trans;
    void *tex_trans_map;
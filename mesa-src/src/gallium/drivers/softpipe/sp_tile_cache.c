@@ -34,6 +34,7 @@
 
 #include "util/u_inlines.h"
 #include "util/format/u_format.h"
+#include "util/u_math.h"
 #include "util/u_memory.h"
 #include "util/u_tile.h"
 #include "sp_tile_cache.h"
@@ -43,13 +44,19 @@ sp_alloc_tile(struct softpipe_tile_cache *tc);
 
 
 /**
- * Return the position in the cache for the tile that contains win pos (x,y).
- * We currently use a direct mapped cache so this is like a hack key.
- * At some point we should investige something more sophisticated, like
- * a LRU replacement policy.
+ * Return the first position in the cache of the set of the tile.
+ * The band's tiles are numbered in raster order, layer after layer, so
+ * that the tiles of a band which fits in the cache never evict each other.
  */
-#define CACHE_POS(x, y, l)                        \
-   (((x) + (y) * 5 + (l) * 10) % NUM_ENTRIES)
+static inline unsigned
+cache_set_pos(const struct softpipe_tile_cache *tc, union tile_address addr)
+{
+   const unsigned tile = addr.bits.x +
+      (addr.bits.y / tc->num_bands + addr.bits.layer * tc->tiles_y) *
+      tc->tiles_x;
+
+   return (tile & (tc->num_sets - 1)) * TILE_CACHE_WAYS;
+}
 
 
 static inline int addr_to_clear_pos(union tile_address addr)
@@ -85,13 +92,85 @@ clear_clear_flag(uint *bitvec, union tile_address addr, unsigned max)
    assert(pos / 32 < max);
    bitvec[pos / 32] &= ~(1 << (pos & 31));
 }
-   
+
+
+/**
+ * Resize the cache to num_sets sets, keeping the tiles already allocated
+ * and freeing those which don't fit anymore.  All the entries must have
+ * been flushed.  Keep the current size if the arrays can't be allocated.
+ */
+static void
+sp_tile_cache_resize(struct softpipe_tile_cache *tc, unsigned num_sets)
+{
+   const unsigned num_entries = num_sets * TILE_CACHE_WAYS;
+   union tile_address *tile_addrs;
+   struct softpipe_cached_tile **entries;
+   unsigned *last_used;
+   unsigned pos;
+
+   if (num_sets == tc->num_sets)
+      return;
+
+   tile_addrs = MALLOC(num_entries * sizeof(*tile_addrs));
+   entries = CALLOC(num_entries, sizeof(*entries));
+   last_used = CALLOC(num_entries, sizeof(*last_used));
+   if (!tile_addrs || !entries || !last_used) {
+      FREE(tile_addrs);
+      FREE(entries);
+      FREE(last_used);
+      return;
+   }
+
+   for (pos = 0; pos < num_entries; pos++) {
+      tile_addrs[pos].value = 0;
+      tile_addrs[pos].bits.invalid = 1;
+   }
+
+   for (pos = 0; pos < tc->num_entries; pos++) {
+      assert(tc->tile_addrs[pos].bits.invalid);
+      if (pos < num_entries)
+         entries[pos] = tc->entries[pos];
+      else
+         FREE(tc->entries[pos]);
+   }
+
+   FREE(tc->tile_addrs);
+   FREE(tc->entries);
+   FREE(tc->last_used);
+   tc->tile_addrs = tile_addrs;
+   tc->entries = entries;
+   tc->last_used = last_used;
+   tc->num_sets = num_sets;
+   tc->num_entries = num_entries;
+   tc->last_tile_addr.bits.invalid = 1;
+}
+
+
+/**
+ * Resize the cache for all the tiles of the surface in the band, if
+ * possible.
+ */
+static void
+sp_tile_cache_fit(struct softpipe_tile_cache *tc)
+{
+   const struct pipe_surface *ps = tc->surface;
+   unsigned num_sets;
+
+   tc->tiles_x = DIV_ROUND_UP(ps->width, TILE_SIZE);
+   tc->tiles_y = DIV_ROUND_UP(DIV_ROUND_UP(ps->height, TILE_SIZE),
+                              tc->num_bands);
+   num_sets = DIV_ROUND_UP(tc->tiles_x * tc->tiles_y * tc->num_maps,
+                           TILE_CACHE_WAYS);
+   num_sets = util_next_power_of_two(num_sets);
+   sp_tile_cache_resize(tc, CLAMP(num_sets, TILE_CACHE_MIN_SETS,
+                                  TILE_CACHE_MAX_SETS));
+}
+
 
 struct softpipe_tile_cache *
 sp_create_tile_cache( struct pipe_context *pipe )
 {
    struct softpipe_tile_cache *tc;
-   uint pos;
 
    /* sanity checking: max sure MAX_WIDTH/HEIGHT >= largest texture image */
    assert(MAX_WIDTH >= pipe->screen->get_param(pipe->screen,
@@ -104,17 +183,22 @@ sp_create_tile_cache( struct pipe_context *pipe )
    tc = CALLOC_STRUCT( softpipe_tile_cache );
    if (tc) {
       tc->pipe = pipe;
-      for (pos = 0; pos < ARRAY_SIZE(tc->tile_addrs); pos++) {
-         tc->tile_addrs[pos].bits.invalid = 1;
-      }
+      tc->tiles_x = 1;
+      tc->tiles_y = 1;
+      tc->num_bands = 1;
+      sp_tile_cache_resize(tc, TILE_CACHE_MIN_SETS);
       tc->last_tile_addr.bits.invalid = 1;
 
       /* this allocation allows us to guarantee that allocation
        * failures are never fatal later
        */
       tc->tile = MALLOC_STRUCT( softpipe_cached_tile );
-      if (!tc->tile)
+      if (!tc->tile || !tc->num_sets)
       {
+         FREE(tc->tile);
+         FREE(tc->tile_addrs);
+         FREE(tc->entries);
+         FREE(tc->last_used);
          FREE(tc);
          return NULL;
       }
@@ -139,11 +223,14 @@ sp_destroy_tile_cache(struct softpipe_tile_cache *tc)
    if (tc) {
       uint pos;
 
-      for (pos = 0; pos < ARRAY_SIZE(tc->entries); pos++) {
+      for (pos = 0; pos < tc->num_entries; pos++) {
          /*assert(tc->entries[pos].x < 0);*/
          FREE( tc->entries[pos] );
       }
       FREE( tc->tile );
+      FREE( tc->tile_addrs );
+      FREE( tc->entries );
+      FREE( tc->last_used );
 
       if (tc->num_maps) {
          int i;
@@ -192,6 +279,8 @@ sp_tile_cache_set_surface(struct softpipe_tile_cache *tc,
 
    if (ps) {
       tc->num_maps = ps->u.tex.last_layer - ps->u.tex.first_layer + 1;
+      sp_tile_cache_fit(tc);
+
       tc->transfer = CALLOC(tc->num_maps, sizeof(struct pipe_transfer *));
       tc->transfer_map = CALLOC(tc->num_maps, sizeof(void *));
 
@@ -218,6 +307,22 @@ sp_tile_cache_set_surface(struct softpipe_tile_cache *tc,
 }
 
 
+/**
+ * Only cache the tile rows of the band, see sp_band.h.  The cache must
+ * have been flushed.
+ */
+void
+sp_tile_cache_set_band(struct softpipe_tile_cache *tc,
+                       unsigned band, unsigned num_bands)
+{
+   tc->band = band;
+   tc->num_bands = num_bands;
+
+   if (tc->surface)
+      sp_tile_cache_fit(tc);
+}
+
+
 /**
  * Return the transfer being cached.
  */
@@ -347,6 +452,10 @@ sp_tile_cache_flush_clear(struct softpipe_tile_cache *tc, int layer)
 
    assert(pt->resource);
 
+   /* bands past num_bands have no rows */
+   if (tc->band >= tc->num_bands)
+      return;
+
    /* clear the scratch tile to the clear value */
    if (tc->depth_stencil) {
       clear_tile(tc->tile, pt->resource->format, tc->clear_val);
@@ -354,8 +463,8 @@ sp_tile_cache_flush_clear(struct softpipe_tile_cache *tc, int layer)
       clear_tile_rgba(tc->tile, pt->resource->format, &tc->clear_color);
    }
 
-   /* push the tile to all positions marked as clear */
-   for (y = 0; y < h; y += TILE_SIZE) {
+   /* push the tile to all positions of the band marked as clear */
+   for (y = tc->band * TILE_SIZE; y < h; y += tc->num_bands * TILE_SIZE) {
       for (x = 0; x < w; x += TILE_SIZE) {
          union tile_address addr = tile_address(x, y, layer);
 
@@ -418,7 +527,7 @@ sp_flush_tile_cache(struct softpipe_tile_cache *tc)
    int i;
    if (tc->num_maps) {
       /* caching a drawing transfer */
-      for (pos = 0; pos < ARRAY_SIZE(tc->entries); pos++) {
+      for (pos = 0; pos < tc->num_entries; pos++) {
          struct softpipe_cached_tile *tile = tc->entries[pos];
          if (!tile)
          {
@@ -455,7 +564,7 @@ sp_alloc_tile(struct softpipe_tile_cache *tc)
       if (!tc->tile)
       {
          unsigned pos;
-         for (pos = 0; pos < ARRAY_SIZE(tc->entries); ++pos) {
+         for (pos = 0; pos < tc->num_entries; ++pos) {
             if (!tc->entries[pos])
                continue;
 
@@ -487,11 +596,33 @@ sp_find_cached_tile(struct softpipe_tile_cache *tc,
                     union tile_address addr )
 {
    struct pipe_transfer *pt;
-   /* cache pos/entry: */
-   const int pos = CACHE_POS(addr.bits.x,
-                             addr.bits.y, addr.bits.layer);
-   struct softpipe_cached_tile *tile = tc->entries[pos];
+   /* cache set/entry: */
+   const unsigned set = cache_set_pos(tc, addr);
+   struct softpipe_cached_tile *tile;
+   unsigned pos, victim = set;
    int layer;
+
+   for (pos = set; pos < set + TILE_CACHE_WAYS; pos++) {
+      if (tc->tile_addrs[pos].value == addr.value)
+         break;
+
+      /* replace an empty entry, else the least recently used one */
+      if (!tc->tile_addrs[victim].bits.invalid &&
+          (tc->tile_addrs[pos].bits.invalid ||
+           tc->clock - tc->last_used[pos] > tc->clock - tc->last_used[victim]))
+         victim = pos;
+   }
+
+   if (pos < set + TILE_CACHE_WAYS) {
+      tc->hits++;
+   }
+   else {
+      tc->misses++;
+      pos = victim;
+   }
+   tc->last_used[pos] = ++tc->clock;
+
+   tile = tc->entries[pos];
    if (!tile) {
       tile = sp_alloc_tile(tc);
       tc->entries[pos] = tile;
@@ -583,7 +714,7 @@ sp_tile_cache_clear(struct softpipe_tile_cache *tc,
    /* set flags to indicate all the tiles are cleared */
    memset(tc->clear_flags, 255, tc->clear_flags_size);
 
-   for (pos = 0; pos < ARRAY_SIZE(tc->tile_addrs); pos++) {
+   for (pos = 0; pos < tc->num_entries; pos++) {
       tc->tile_addrs[pos].bits.invalid = 1;
    }
    tc->last_tile_addr.bits.invalid = 1;
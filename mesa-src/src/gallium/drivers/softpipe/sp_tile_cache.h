@@ -76,7 +76,15 @@ struct softpipe_cached_tile
    } data;
 };
 
-#define NUM_ENTRIES 50
+/**
+ * The cache is set associative, with TILE_CACHE_WAYS tiles per set, and
+ * enough sets for all the tiles of the surface, a power of two between
+ * TILE_CACHE_MIN_SETS and TILE_CACHE_MAX_SETS.  Tiles are only allocated
+ * once used.
+ */
+#define TILE_CACHE_WAYS 4
+#define TILE_CACHE_MIN_SETS 16
+#define TILE_CACHE_MAX_SETS 256
 
 
 struct softpipe_tile_cache
@@ -87,8 +95,17 @@ struct softpipe_tile_cache
    void **transfer_map;
    int num_maps;
 
-   union tile_address tile_addrs[NUM_ENTRIES];
-   struct softpipe_cached_tile *entries[NUM_ENTRIES];
+   unsigned num_sets;
+   unsigned num_entries;          /**< num_sets * TILE_CACHE_WAYS */
+   unsigned tiles_x, tiles_y;     /**< of the band, to pick sets */
+   unsigned band, num_bands;      /**< the tile rows cached, see sp_band.h */
+   union tile_address *tile_addrs;
+   struct softpipe_cached_tile **entries;
+   unsigned *last_used;           /**< clock of each entry's last lookup */
+   unsigned clock;
+
+   /** Lookups missing the last tile, see SOFTPIPE_DEBUG=cache_stats */
+   uint64_t hits, misses;
    uint *clear_flags;
    uint clear_flags_size;
    union pipe_color_union clear_color; /**< for color bufs */
@@ -118,6 +135,10 @@ sp_tile_cache_get_surface(struct softpipe_tile_cache *tc);
 extern void
 sp_flush_tile_cache(struct softpipe_tile_cache *tc);
 
+extern void
+sp_tile_cache_set_band(struct softpipe_tile_cache *tc,
+                       unsigned band, unsigned num_bands);
+
 extern void
 sp_tile_cache_clear(struct softpipe_tile_cache *tc,
                     const union pipe_color_union *color,
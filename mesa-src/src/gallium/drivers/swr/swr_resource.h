@@ -47,6 +47,9 @@ struct swr_resource {
 
    struct sw_displaytarget *display_target;
 
+   /* Storage is the caller's, see swr_resource_from_user_memory() */
+   bool user_memory;
+
    /* If resource is multisample, then this points to a alternate resource
     * containing the resolved multisample surface, otherwise null */
    struct pipe_resource *resolve_target;
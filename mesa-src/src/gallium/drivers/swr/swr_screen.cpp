@@ -701,7 +701,11 @@ swr_texture_layout(struct swr_screen *screen,
    res->swr.format = mesa_to_swr_format(fmt);
    res->swr.numSamples = std::max(1u, pt->nr_samples);
 
-   if (pt->bind & (PIPE_BIND_RENDER_TARGET | PIPE_BIND_DEPTH_STENCIL)) {
+   /* The caller's memory has its rows packed.  Tiles are clipped to the
+    * surface size when loaded and stored, so it needs no padding.
+    */
+   if ((pt->bind & (PIPE_BIND_RENDER_TARGET | PIPE_BIND_DEPTH_STENCIL)) &&
+       !res->user_memory) {
       res->swr.halign = KNOB_MACROTILE_X_DIM;
       res->swr.valign = KNOB_MACROTILE_Y_DIM;
 
@@ -938,6 +942,63 @@ fail:
    return NULL;
 }
 
+/* Wrap memory of the caller's, which stays theirs, as a single level,
+ * single sample resource.  Rows are packed, see swr_resource_get_info().
+ */
+static struct pipe_resource *
+swr_resource_from_user_memory(struct pipe_screen *_screen,
+                              const struct pipe_resource *templat,
+                              void *user_memory)
+{
+   struct swr_screen *screen = swr_screen(_screen);
+   struct swr_resource *res;
+
+   if (templat->last_level > 0 || templat->nr_samples > 1 ||
+       screen->msaa_force_enable ||
+       util_format_has_stencil(util_format_description(templat->format)))
+      return NULL;
+
+   switch (templat->target) {
+   case PIPE_BUFFER:
+   case PIPE_TEXTURE_2D:
+   case PIPE_TEXTURE_RECT:
+      break;
+   default:
+      return NULL;
+   }
+
+   res = CALLOC_STRUCT(swr_resource);
+   if (!res)
+      return NULL;
+
+   res->base = *templat;
+   pipe_reference_init(&res->base.reference, 1);
+   res->base.screen = &screen->base;
+   res->user_memory = true;
+
+   if (!swr_texture_layout(screen, res, false)) {
+      FREE(res);
+      return NULL;
+   }
+   res->swr.xpBaseAddress = (gfxptr_t)user_memory;
+
+   return &res->base;
+}
+
+static void
+swr_resource_get_info(struct pipe_screen *screen,
+                      struct pipe_resource *resource,
+                      unsigned *stride,
+                      unsigned *offset)
+{
+   struct swr_resource *res = swr_resource(resource);
+
+   if (stride)
+      *stride = res->swr.pitch;
+   if (offset)
+      *offset = 0;
+}
+
 static void
 swr_resource_destroy(struct pipe_screen *p_screen, struct pipe_resource *pt)
 {
@@ -960,6 +1021,9 @@ swr_resource_destroy(struct pipe_screen *p_screen, struct pipe_resource *pt)
          /* Free multisample buffer */
          swr_fence_work_free(screen->flush_fence, (void*)(spr->swr.xpBaseAddress), true);
       }
+   } else if (spr->user_memory) {
+      /* The memory is the caller's, who waits for the rendering to it */
+      swr_resource_unused(pt);
    } else {
       /* For regular resources, defer deletion */
       swr_resource_unused(pt);
@@ -1126,6 +1190,8 @@ swr_create_screen_internal(struct sw_winsys *winsys)
 
    screen->base.resource_create = swr_resource_create;
    screen->base.resource_destroy = swr_resource_destroy;
+   screen->base.resource_from_user_memory = swr_resource_from_user_memory;
+   screen->base.resource_get_info = swr_resource_get_info;
 
    screen->base.flush_frontbuffer = swr_flush_frontbuffer;
 
@@ -102,6 +102,7 @@ swr_texture_member(const struct lp_sampler_dynamic_state *base,
                    struct gallivm_state *gallivm,
                    LLVMValueRef context_ptr,
                    unsigned texture_unit,
+                   LLVMValueRef texture_unit_offset,
                    unsigned member_index,
                    const char *member_name,
                    boolean emit_load)
@@ -139,6 +140,14 @@ swr_texture_member(const struct lp_sampler_dynamic_state *base,
    }
    /* context[0].textures[unit] */
    indices[2] = lp_build_const_int32(gallivm, texture_unit);
+   if (texture_unit_offset) {
+      indices[2] = LLVMBuildAdd(builder, indices[2], texture_unit_offset, "");
+      LLVMValueRef cond =
+         LLVMBuildICmp(builder, LLVMIntULT, indices[2],
+                       lp_build_const_int32(gallivm, PIPE_MAX_SHADER_SAMPLER_VIEWS), "");
+      indices[2] = LLVMBuildSelect(builder, cond, indices[2],
+                                   lp_build_const_int32(gallivm, texture_unit), "");
+   }
    /* context[0].textures[unit].member */
    indices[3] = lp_build_const_int32(gallivm, member_index);
 
@@ -176,6 +185,7 @@ swr_texture_member(const struct lp_sampler_dynamic_state *base,
                                 gallivm,                                     \
                                 context_ptr,                                 \
                                 texture_unit,                                \
+                                texture_unit_offset,                         \
                                 swr_jit_texture_##_name,                     \
                                 #_name,                                      \
                                 _emit_load);                                 \
@@ -208,6 +218,7 @@ swr_sampler_member(const struct lp_sampler_dynamic_state *base,
                    struct gallivm_state *gallivm,
                    LLVMValueRef context_ptr,
                    unsigned sampler_unit,
+                   LLVMValueRef sampler_unit_offset,
                    unsigned member_index,
                    const char *member_name,
                    boolean emit_load)
@@ -245,6 +256,14 @@ swr_sampler_member(const struct lp_sampler_dynamic_state *base,
    }
    /* context[0].samplers[unit] */
    indices[2] = lp_build_const_int32(gallivm, sampler_unit);
+   if (sampler_unit_offset) {
+      indices[2] = LLVMBuildAdd(builder, indices[2], sampler_unit_offset, "");
+      LLVMValueRef cond =
+         LLVMBuildICmp(builder, LLVMIntULT, indices[2],
+                       lp_build_const_int32(gallivm, PIPE_MAX_SAMPLERS), "");
+      indices[2] = LLVMBuildSelect(builder, cond, indices[2],
+                                   lp_build_const_int32(gallivm, sampler_unit), "");
+   }
    /* context[0].samplers[unit].member */
    indices[3] = lp_build_const_int32(gallivm, member_index);
 
@@ -266,12 +285,14 @@ swr_sampler_member(const struct lp_sampler_dynamic_state *base,
       const struct lp_sampler_dynamic_state *base,                           \
       struct gallivm_state *gallivm,                                         \
       LLVMValueRef context_ptr,                                              \
-      unsigned sampler_unit)                                                 \
+      unsigned sampler_unit,                                                 \
+      LLVMValueRef sampler_unit_offset)                                      \
    {                                                                         \
       return swr_sampler_member(base,                                        \
                                 gallivm,                                     \
                                 context_ptr,                                 \
                                 sampler_unit,                                \
+                                sampler_unit_offset,                         \
                                 swr_jit_sampler_##_name,                     \
                                 #_name,                                      \
                                 _emit_load);                                 \
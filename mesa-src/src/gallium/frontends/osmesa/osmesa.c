@@ -23,13 +23,14 @@
 
 /*
  * Off-Screen rendering into client memory.
- * OpenGL gallium frontend for softpipe and llvmpipe.
+ * OpenGL gallium frontend for softpipe, llvmpipe and swr.
  *
  * Notes:
  *
  * If Gallium is built with LLVM support we use the llvmpipe driver.
- * Otherwise we use softpipe.  The GALLIUM_DRIVER environment variable
- * may be set to "softpipe" or "llvmpipe" to override.
+ * Otherwise we use softpipe.  The OSMESA_GALLIUM_DRIVER attribute of the
+ * first context, or the GALLIUM_DRIVER environment variable, may pick
+ * "softpipe", "llvmpipe" or "swr" instead.
  *
  * With softpipe we could render directly into the user's buffer by using a
  * display target resource.  However, softpipe doesn't support "upside-down"
@@ -38,9 +39,14 @@
  * With llvmpipe we could only render directly into the user's buffer when its
  * width and height is a multiple of the tile size (64 pixels).
  *
- * Because of these constraints we always render into ordinary resources then
- * copy the results to the user's buffer in the flush_front() function which
- * is called when the app calls glFlush/Finish.
+ * Because of these constraints we normally render into ordinary resources
+ * then copy the results to the user's buffer in the flush_front() function
+ * which is called when the app calls glFlush/Finish.  Contexts created with
+ * OSMESA_ZERO_COPY instead wrap the user's buffer as the color resource
+ * (via resource_from_user_memory) whenever its layout matches what the
+ * driver would use, in which case flush_front() only waits for rendering.
+ * Drivers with pipe_context::readback_to_buffer do the copy themselves,
+ * queued behind the rendering and spread over their rasterizer threads.
  *
  * In general, the OSMesa interface is pretty ugly and not a good match
  * for Gallium.  But we're interested in doing the best we can to preserve
@@ -49,8 +55,13 @@
  */
 
 
+#include <limits.h>
 #include <stdio.h>
 #include <c11/threads.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 #include "GL/osmesa.h"
 
 #include "glapi/glapi.h"  /* for OSMesaGetProcAddress below */
@@ -59,12 +70,22 @@
 #include "pipe/p_screen.h"
 #include "pipe/p_state.h"
 
+#include "util/anon_file.h"
+#include "util/futex.h"
+#include "util/hash_table.h"
+#include "util/list.h"
+#include "util/os_file.h"
+#include "util/simple_mtx.h"
 #include "util/u_atomic.h"
 #include "util/u_box.h"
 #include "util/u_debug.h"
 #include "util/format/u_format.h"
 #include "util/u_inlines.h"
 #include "util/u_memory.h"
+#include "util/u_resource.h"
+#include "util/u_surface.h"
+
+#include "hud/hud_context.h"
 
 #include "postprocess/filters.h"
 #include "postprocess/postprocess.h"
@@ -75,21 +96,120 @@
 
 
 extern struct pipe_screen *
-osmesa_create_screen(void);
+osmesa_create_screen(const char *driver);
+
+
+
+/** What an osmesa_buffer is looked up by, see BufferTable */
+struct osmesa_buffer_key
+{
+   enum pipe_format color_format;   /**< rendered in */
+   enum pipe_format user_format;    /**< of the user's buffer */
+   enum pipe_format ds_format;
+   enum pipe_format accum_format;
+   unsigned width, height;
+   unsigned color_buffers;   /**< see OSMESA_COLOR_BUFFERS */
+   boolean transient_ds;     /**< see OSMESA_TRANSIENT_DEPTH_STENCIL */
+};
 
 
+/**
+ * An image buffer from OSMesaCreateSharedBuffer(), on a file other
+ * processes map to read the frames.
+ */
+struct osmesa_shared
+{
+   OSMesaSharedHeader *header;  /**< start of the mapping */
+   void *image;                 /**< header->offset bytes into it */
+   size_t size;
+   int fd;
+   struct list_head link;       /**< in SharedBuffers */
+};
+
 
 struct osmesa_buffer
 {
    struct st_framebuffer_iface *stfb;
    struct st_visual visual;
+   struct osmesa_buffer_key key;
    unsigned width, height;
 
    struct pipe_resource *textures[ST_ATTACHMENT_COUNT];
 
    void *map;
+   void *user_map;  /**< user buffer wrapped by the front color resource */
+
+   /** Image buffers of color buffers 1 and up, see OSMesaMakeCurrentBuffers */
+   void *extra_map[OSMESA_MAX_COLOR_BUFFERS - 1];
+   void *extra_user_map[OSMESA_MAX_COLOR_BUFFERS - 1];
+
+   /** Image buffer of the depth/stencil texture, see OSMesaDepthBuffer() */
+   void *depth_map;
+   void *depth_user_map;
+
+   unsigned user_mapped;     /**< mask of the textures[] on user buffers */
+
+   /** The shared buffer map is, see OSMesaCreateSharedBuffer() */
+   struct osmesa_shared *shared;
+
+   /**
+    * The user's buffer the color buffer was last copied to in full, and how.
+    * The next flushes to it only copy the dirty region, when the driver
+    * tracks it.
+    */
+   void *synced_map;
+   int synced_stride;
+   GLboolean synced_y_up;
+
+   /** Copied by the last flush, see OSMesaGetDirtyRegion() */
+   struct pipe_box dirty;
+
+   /**
+    * OSMesaProgressCallback() of the user's buffer progress_map, set on
+    * the front color resources rendered in place to it.
+    */
+   OSMESAprogressproc progress_func;
+   void *progress_data;
+   void *progress_map;
+
+   unsigned pending_frames;  /**< frames in flight, see osmesa_frame */
+   unsigned bound;           /**< contexts with this as current_buffer */
+
+   /**
+    * Memory the textures are created on, see osmesa_create_backed_resource().
+    * It only grows, so a buffer can be resized in place: the next size
+    * gets new textures on the same, already faulted in, pages.
+    */
+   void *backing[ST_ATTACHMENT_COUNT];
+   uint64_t backing_size[ST_ATTACHMENT_COUNT];
+   unsigned backed;          /**< mask of the textures[] on backing[] */
+
+   /** Rendering of the last context to unbind it, see osmesa_unbind_buffer */
+   struct pipe_fence_handle *fence;
+
+   uint64_t memory;          /**< bytes of textures[], not the user's */
+
+   struct osmesa_buffer *next;  /**< next with the same key */
+   struct list_head lru;        /**< in BufferLRU */
+};
+
+
+/**
+ * A frame submitted with OSMesaSwapBuffersAsync() which hasn't been waited
+ * for yet.  The buffer it was rendered to isn't reused by
+ * OSMesaMakeCurrent() until then.
+ */
+struct osmesa_frame
+{
+   struct osmesa_buffer *buffer;
+   struct pipe_fence_handle *fence;
 
-   struct osmesa_buffer *next;  /**< next in linked list */
+   /** Resource to copy to the user's buffer, NULL if rendered in place */
+   struct pipe_resource *color;
+   void *map;
+   enum pipe_format format;
+   int stride;
+   GLboolean y_up;
 };
 
 
@@ -108,22 +228,56 @@ struct osmesa_context
    GLint user_row_length; /*< user-specified number of pixels per row */
    GLboolean y_up;        /*< TRUE  -> Y increases upward */
                           /*< FALSE -> Y increases downward */
+   GLboolean zero_copy;   /*< Render directly into the user's buffer */
+   unsigned color_buffers; /*< see OSMESA_COLOR_BUFFERS */
+   GLboolean transient_ds; /*< see OSMESA_TRANSIENT_DEPTH_STENCIL */
+   void *depth_buffer;    /*< from OSMesaDepthBuffer() */
 
    /** Which postprocessing filters are enabled. */
    unsigned pp_enabled[PP_FILTERS];
    struct pp_queue_t *pp;
+
+   /** Headless HUD, from GALLIUM_HUD or OSMesaRecordHUD() */
+   struct hud_context *hud;
+
+   /** To create stctx again, see OSMesaResetContext() */
+   struct st_context_attribs attribs;
+   GLboolean threaded;
+   GLboolean shared;      /*< Created with a sharelist */
 };
 
 
 /**
- * Linked list of all osmesa_buffers.
+ * Cache of all osmesa_buffers, hashed by formats and size, each entry being
+ * the list of the buffers with that key.
  * We can re-use an osmesa_buffer from one OSMesaMakeCurrent() call to
  * the next unless the color/depth/stencil/accum formats change.
  * We have to do this to be compatible with the original OSMesa implementation
  * because some apps call OSMesaMakeCurrent() several times during rendering
  * a frame.
+ *
+ * The buffers are also kept in least recently bound order, and once their
+ * textures take more than OSMESA_BUFFER_CACHE_MB the oldest buffers which
+ * no context has current and have no frames in flight are destroyed,
+ * see osmesa_trim_buffers().
+ */
+static struct hash_table *BufferTable = NULL;
+static struct list_head BufferLRU = { &BufferLRU, &BufferLRU };
+static uint64_t BufferMemory = 0;
+static simple_mtx_t BufferMutex = _SIMPLE_MTX_INITIALIZER_NP;
+
+/** All osmesa_shared, under BufferMutex too */
+static struct list_head SharedBuffers = { &SharedBuffers, &SharedBuffers };
+
+
+/**
+ * Gallium contexts of destroyed OSMesa contexts, which new ones are created
+ * on, see OSMESA_CONTEXT_POOL.
  */
-static struct osmesa_buffer *BufferList = NULL;
+#define OSMESA_MAX_CONTEXT_POOL 64
+static struct pipe_context *ContextPool[OSMESA_MAX_CONTEXT_POOL];
+static unsigned ContextPoolCount = 0;
+static simple_mtx_t ContextPoolMutex = _SIMPLE_MTX_INITIALIZER_NP;
 
 
 /**
@@ -152,12 +306,22 @@ get_st_api(void)
 
 static struct st_manager *stmgr = NULL;
 
+/** Driver the screen is created with, see osmesa_select_driver() */
+static const char *ScreenDriver = NULL;
+static simple_mtx_t ScreenDriverMutex = _SIMPLE_MTX_INITIALIZER_NP;
+
 static void
 create_st_manager(void)
 {
+   const char *driver;
+
+   simple_mtx_lock(&ScreenDriverMutex);
+   driver = ScreenDriver;
+   simple_mtx_unlock(&ScreenDriverMutex);
+
    stmgr = CALLOC_STRUCT(st_manager);
    if (stmgr) {
-      stmgr->screen = osmesa_create_screen();
+      stmgr->screen = osmesa_create_screen(driver);
       stmgr->get_param = osmesa_st_get_param;
       stmgr->get_egl_image = NULL;
    }
@@ -177,13 +341,74 @@ get_st_manager(void)
 }
 
 
+/**
+ * Ask for the screen to be created with the driver of an
+ * OSMESA_GALLIUM_DRIVER value, unless it already was or GALLIUM_DRIVER is
+ * set.  Return whether the screen is that driver's.
+ */
+static GLboolean
+osmesa_select_driver(int value)
+{
+   static const struct {
+      int value;
+      const char *driver;
+      const char *screen_name;  /**< prefix of pipe_screen::get_name() */
+   } drivers[] = {
+      { OSMESA_LLVMPIPE, "llvmpipe", "llvmpipe" },
+      { OSMESA_SOFTPIPE, "softpipe", "softpipe" },
+      { OSMESA_SWR, "swr", "SWR" },
+   };
+   struct st_manager *mgr;
+   const char *name;
+   unsigned i;
+
+   for (i = 0; i < ARRAY_SIZE(drivers); i++) {
+      if (drivers[i].value == value)
+         break;
+   }
+   if (i == ARRAY_SIZE(drivers))
+      return GL_FALSE;
+
+   if (debug_get_option("GALLIUM_DRIVER", NULL))
+      return GL_TRUE;
+
+   simple_mtx_lock(&ScreenDriverMutex);
+   if (!ScreenDriver)
+      ScreenDriver = drivers[i].driver;
+   simple_mtx_unlock(&ScreenDriverMutex);
+
+   mgr = get_st_manager();
+   if (!mgr || !mgr->screen)
+      return GL_FALSE;
+
+   name = mgr->screen->get_name(mgr->screen);
+   return strncmp(name, drivers[i].screen_name,
+                  strlen(drivers[i].screen_name)) == 0;
+}
+
+
+/**
+ * Wait for the GL calls queued for the context's API thread, see
+ * OSMESA_THREADED.  Only the current context can have queued calls, and
+ * the OSMesa functions touching the same state, or reading the results,
+ * must wait for them.
+ */
+static void
+osmesa_thread_finish(void)
+{
+   struct st_api *stapi = get_st_api();
+   struct st_context_iface *st = stapi->get_current(stapi);
+
+   if (st && st->thread_finish)
+      st->thread_finish(st);
+}
+
+
 /**
  * Given an OSMESA_x format and a GL_y type, return the best
  * matching PIPE_FORMAT_z.
- * Note that we can't exactly match all user format/type combinations
- * with gallium formats.  If we find this to be a problem, we can
- * implement more elaborate format/type conversion in the flush_front()
- * function.
+ * This is the layout of the user's buffer, rendering may be in another
+ * format, see osmesa_render_format().
  */
 static enum pipe_format
 osmesa_choose_format(GLenum format, GLenum type)
@@ -258,7 +483,8 @@ osmesa_choose_format(GLenum format, GLenum type)
       }
       break;
    case OSMESA_BGR:
-      /* No gallium format for this one */
+      if (type == GL_UNSIGNED_BYTE)
+         return PIPE_FORMAT_B8G8R8_UNORM;
       return PIPE_FORMAT_NONE;
    case OSMESA_RGB_565:
       if (type != GL_UNSIGNED_SHORT_5_6_5)
@@ -271,6 +497,85 @@ osmesa_choose_format(GLenum format, GLenum type)
 }
 
 
+/**
+ * Choose the format to render in for the user's format.  That's the user's
+ * one when the driver renders to it, unless it has 24, 48 or 96 bit pixels,
+ * which rasterizers are slow at.  Otherwise it's the 32, 64 or 128 bit
+ * format holding the same channels, with X for a missing alpha so that
+ * blending is unchanged.  The user's layout is then packed when the color
+ * buffer is copied to the user's buffer, see osmesa_queue_copy_to_user()
+ * and osmesa_copy_to_user().
+ */
+static enum pipe_format
+osmesa_render_format(struct pipe_screen *screen, enum pipe_format user_format)
+{
+   const struct util_format_description *desc =
+      util_format_description(user_format);
+   const int c = util_format_get_first_non_void_channel(user_format);
+   enum pipe_format formats[2];
+   unsigned i;
+
+   if (util_is_power_of_two_nonzero(desc->block.bits) &&
+       screen->is_format_supported(screen, user_format, PIPE_TEXTURE_RECT,
+                                   0, 0, PIPE_BIND_RENDER_TARGET))
+      return user_format;
+
+   if (c < 0)
+      return user_format;
+
+   if (desc->channel[c].type == UTIL_FORMAT_TYPE_FLOAT) {
+      formats[0] = PIPE_FORMAT_R32G32B32X32_FLOAT;
+      formats[1] = PIPE_FORMAT_R32G32B32A32_FLOAT;
+   }
+   else if (desc->channel[c].size > 8) {
+      formats[0] = PIPE_FORMAT_R16G16B16X16_UNORM;
+      formats[1] = PIPE_FORMAT_R16G16B16A16_UNORM;
+   }
+   else {
+      formats[0] = PIPE_FORMAT_B8G8R8X8_UNORM;
+      formats[1] = PIPE_FORMAT_B8G8R8A8_UNORM;
+   }
+
+   /* The X formats only for a user format without alpha */
+   for (i = util_format_has_alpha(user_format) ? 1 : 0; i < 2; i++) {
+      if (screen->is_format_supported(screen, formats[i], PIPE_TEXTURE_RECT,
+                                      0, 0, PIPE_BIND_RENDER_TARGET))
+         return formats[i];
+   }
+
+   return user_format;
+}
+
+
+/**
+ * Attachments of the color buffers of OSMesaMakeCurrentBuffers().
+ */
+static const enum st_attachment_type
+osmesa_color_statts[OSMESA_MAX_COLOR_BUFFERS] = {
+   ST_ATTACHMENT_FRONT_LEFT,
+   ST_ATTACHMENT_FRONT_RIGHT,
+   ST_ATTACHMENT_BACK_LEFT,
+   ST_ATTACHMENT_BACK_RIGHT,
+};
+
+
+/**
+ * Return the index into osmesa_buffer::extra_map of a color attachment
+ * other than the front left one, or -1.
+ */
+static int
+osmesa_extra_color_buffer(enum st_attachment_type statt)
+{
+   unsigned i;
+
+   for (i = 1; i < OSMESA_MAX_COLOR_BUFFERS; i++) {
+      if (osmesa_color_statts[i] == statt)
+         return i - 1;
+   }
+   return -1;
+}
+
+
 /**
  * Initialize an st_visual object.
  */
@@ -278,10 +583,18 @@ static void
 osmesa_init_st_visual(struct st_visual *vis,
                       enum pipe_format color_format,
                       enum pipe_format ds_format,
-                      enum pipe_format accum_format)
+                      enum pipe_format accum_format,
+                      unsigned color_buffers)
 {
    vis->buffer_mask = ST_ATTACHMENT_FRONT_LEFT_MASK;
 
+   /* Stereo, and double-buffered for more than two color buffers */
+   if (color_buffers > 1)
+      vis->buffer_mask |= ST_ATTACHMENT_FRONT_RIGHT_MASK;
+   if (color_buffers > 2)
+      vis->buffer_mask |= ST_ATTACHMENT_BACK_LEFT_MASK |
+                          ST_ATTACHMENT_BACK_RIGHT_MASK;
+
    if (ds_format != PIPE_FORMAT_NONE)
       vis->buffer_mask |= ST_ATTACHMENT_DEPTH_STENCIL_MASK;
    if (accum_format != PIPE_FORMAT_NONE)
@@ -306,749 +619,2385 @@ stfbi_to_osbuffer(struct st_framebuffer_iface *stfbi)
 
 
 /**
- * Called via glFlush/glFinish.  This is where we copy the contents
- * of the driver's color buffer into the user-specified buffer.
+ * Return the row stride of the user's color buffer, in bytes.
  */
-static bool
-osmesa_st_framebuffer_flush_front(struct st_context_iface *stctx,
-                                  struct st_framebuffer_iface *stfbi,
-                                  enum st_attachment_type statt)
+static int
+osmesa_user_stride(OSMesaContext osmesa,
+                   const struct osmesa_buffer *osbuffer)
 {
-   OSMesaContext osmesa = OSMesaGetCurrentContext();
-   struct osmesa_buffer *osbuffer = stfbi_to_osbuffer(stfbi);
-   struct pipe_context *pipe = stctx->pipe;
-   struct pipe_resource *res = osbuffer->textures[statt];
-   struct pipe_transfer *transfer = NULL;
-   struct pipe_box box;
-   void *map;
-   ubyte *src, *dst;
-   unsigned y, bytes, bpp;
-   int dst_stride;
+   unsigned bpp = util_format_get_blocksize(osbuffer->key.user_format);
 
-   if (osmesa->pp) {
-      struct pipe_resource *zsbuf = NULL;
-      unsigned i;
+   if (osbuffer->shared)
+      return osbuffer->shared->header->stride;
+   else if (osmesa->user_row_length)
+      return bpp * osmesa->user_row_length;
+   else
+      return bpp * osbuffer->width;
+}
 
-      /* Find the z/stencil buffer if there is one */
-      for (i = 0; i < ARRAY_SIZE(osbuffer->textures); i++) {
-         struct pipe_resource *res = osbuffer->textures[i];
-         if (res) {
-            const struct util_format_description *desc =
-               util_format_description(res->format);
 
-            if (util_format_has_depth(desc)) {
-               zsbuf = res;
-               break;
-            }
+/**
+ * Return the row stride of the user's depth buffer, in bytes.
+ */
+static int
+osmesa_user_depth_stride(OSMesaContext osmesa,
+                         const struct osmesa_buffer *osbuffer)
+{
+   unsigned bpp =
+      util_format_get_blocksize(osbuffer->visual.depth_stencil_format);
+
+   if (osmesa->user_row_length)
+      return bpp * osmesa->user_row_length;
+   else
+      return bpp * osbuffer->width;
+}
+
+
+/**
+ * Run the enabled postprocess filters on the color resource.
+ */
+static void
+osmesa_postprocess(OSMesaContext osmesa, struct osmesa_buffer *osbuffer,
+                   struct pipe_resource *res)
+{
+   struct pipe_resource *zsbuf = NULL;
+   unsigned i;
+
+   if (!osmesa->pp)
+      return;
+
+   /* Find the z/stencil buffer if there is one */
+   for (i = 0; i < ARRAY_SIZE(osbuffer->textures); i++) {
+      struct pipe_resource *res = osbuffer->textures[i];
+      if (res) {
+         const struct util_format_description *desc =
+            util_format_description(res->format);
+
+         if (util_format_has_depth(desc)) {
+            zsbuf = res;
+            break;
          }
       }
-
-      /* run the postprocess stage(s) */
-      pp_run(osmesa->pp, res, res, zsbuf);
    }
 
-   u_box_2d(0, 0, res->width0, res->height0, &box);
+   /* run the postprocess stage(s) */
+   pp_run(osmesa->pp, res, res, zsbuf);
+}
+
 
-   map = pipe->transfer_map(pipe, res, 0, PIPE_TRANSFER_READ, &box,
+/**
+ * Copy a box of the color buffer from the resource to the user's buffer,
+ * packed in dst_format.  A NULL box copies the whole of it.
+ */
+static void
+osmesa_copy_to_user(struct pipe_context *pipe, struct pipe_resource *res,
+                    const struct pipe_box *box, enum pipe_format dst_format,
+                    void *user_map, int dst_stride, GLboolean y_up)
+{
+   struct pipe_transfer *transfer = NULL;
+   struct pipe_box full;
+   void *map;
+   ubyte *src, *dst;
+   unsigned y, bytes, bpp;
+
+   if (!box) {
+      u_box_2d(0, 0, res->width0, res->height0, &full);
+      box = &full;
+   }
+   if (box->width <= 0 || box->height <= 0)
+      return;
+
+   map = pipe->transfer_map(pipe, res, 0, PIPE_TRANSFER_READ, box,
                             &transfer);
 
-   /*
-    * Copy the color buffer from the resource to the user's buffer.
-    */
-   bpp = util_format_get_blocksize(osbuffer->visual.color_format);
+   bpp = util_format_get_blocksize(dst_format);
    src = map;
-   dst = osbuffer->map;
-   if (osmesa->user_row_length)
-      dst_stride = bpp * osmesa->user_row_length;
-   else
-      dst_stride = bpp * osbuffer->width;
-   bytes = bpp * res->width0;
+   dst = (ubyte *) user_map + box->x * bpp;
+   bytes = bpp * box->width;
 
-   if (osmesa->y_up) {
+   if (y_up) {
       /* need to flip image upside down */
-      dst = dst + (res->height0 - 1) * dst_stride;
+      dst = dst + (res->height0 - 1 - box->y) * dst_stride;
       dst_stride = -dst_stride;
    }
+   else {
+      dst = dst + box->y * dst_stride;
+   }
 
-   for (y = 0; y < res->height0; y++) {
-      memcpy(dst, src, bytes);
+   for (y = 0; y < box->height; y++) {
+      if (dst_format == res->format)
+         memcpy(dst, src, bytes);
+      else
+         util_format_translate(dst_format, dst, 0, 0, 0,
+                               res->format, src, 0, 0, 0, box->width, 1);
       dst += dst_stride;
       src += transfer->stride;
    }
 
    pipe->transfer_unmap(pipe, transfer);
-
-   return true;
 }
 
 
 /**
- * Called by the st manager to validate the framebuffer (allocate
- * its resources).
+ * Queue the copy of the color buffer to the user's buffer behind the
+ * rendering, with pipe_context::readback_to_buffer, so that it is done
+ * tile by tile on the driver's rasterizer threads, packing dst_format as
+ * it goes.  Only possible while res is the bound color buffer, returns
+ * false if the copy wasn't queued.  A NULL box copies the whole of it.
  */
 static bool
-osmesa_st_framebuffer_validate(struct st_context_iface *stctx,
-                               struct st_framebuffer_iface *stfbi,
-                               const enum st_attachment_type *statts,
-                               unsigned count,
-                               struct pipe_resource **out)
+osmesa_queue_copy_to_user(struct pipe_context *pipe, struct pipe_resource *res,
+                          const struct pipe_box *box,
+                          enum pipe_format dst_format, void *user_map,
+                          int dst_stride, GLboolean y_up)
 {
-   struct pipe_screen *screen = get_st_manager()->screen;
-   enum st_attachment_type i;
-   struct osmesa_buffer *osbuffer = stfbi_to_osbuffer(stfbi);
-   struct pipe_resource templat;
+   struct pipe_screen *screen = pipe->screen;
+   struct pipe_resource templat, *buf;
+   struct pipe_surface surf_tmpl, *surf;
+   struct pipe_box full;
+   unsigned bpp = util_format_get_blocksize(dst_format);
+   unsigned offset;
+   bool ok;
+
+   if (!pipe->readback_to_buffer || !screen->resource_from_user_memory)
+      return false;
+
+   if (!box) {
+      u_box_2d(0, 0, res->width0, res->height0, &full);
+      box = &full;
+   }
+   if (box->width <= 0 || box->height <= 0)
+      return true;
 
    memset(&templat, 0, sizeof(templat));
-   templat.target = PIPE_TEXTURE_RECT;
-   templat.format = 0; /* setup below */
-   templat.last_level = 0;
-   templat.width0 = osbuffer->width;
-   templat.height0 = osbuffer->height;
+   templat.target = PIPE_BUFFER;
+   templat.format = PIPE_FORMAT_R8_UNORM;
+   templat.width0 = (res->height0 - 1) * dst_stride +
+                    bpp * res->width0;
+   templat.height0 = 1;
    templat.depth0 = 1;
    templat.array_size = 1;
-   templat.usage = PIPE_USAGE_DEFAULT;
-   templat.bind = 0; /* setup below */
-   templat.flags = 0;
+   templat.usage = PIPE_USAGE_STAGING;
 
-   for (i = 0; i < count; i++) {
-      enum pipe_format format = PIPE_FORMAT_NONE;
-      unsigned bind = 0;
-
-      /*
-       * At this time, we really only need to handle the front-left color
-       * attachment, since that's all we specified for the visual in
-       * osmesa_init_st_visual().
-       */
-      if (statts[i] == ST_ATTACHMENT_FRONT_LEFT) {
-         format = osbuffer->visual.color_format;
-         bind = PIPE_BIND_RENDER_TARGET;
-      }
-      else if (statts[i] == ST_ATTACHMENT_DEPTH_STENCIL) {
-         format = osbuffer->visual.depth_stencil_format;
-         bind = PIPE_BIND_DEPTH_STENCIL;
-      }
-      else if (statts[i] == ST_ATTACHMENT_ACCUM) {
-         format = osbuffer->visual.accum_format;
-         bind = PIPE_BIND_RENDER_TARGET;
-      }
-      else {
-         debug_warning("Unexpected attachment type in "
-                       "osmesa_st_framebuffer_validate()");
-      }
+   buf = screen->resource_from_user_memory(screen, &templat, user_map);
+   if (!buf)
+      return false;
 
-      templat.format = format;
-      templat.bind = bind;
-      pipe_resource_reference(&out[i], NULL);
-      out[i] = osbuffer->textures[statts[i]] =
-         screen->resource_create(screen, &templat);
+   u_surface_default_template(&surf_tmpl, res);
+   surf = pipe->create_surface(pipe, res, &surf_tmpl);
+   if (!surf) {
+      pipe_resource_reference(&buf, NULL);
+      return false;
    }
 
-   return true;
-}
+   if (y_up) {
+      /* need to flip image upside down */
+      offset = (res->height0 - 1 - box->y) * dst_stride + box->x * bpp;
+      dst_stride = -dst_stride;
+   }
+   else {
+      offset = box->y * dst_stride + box->x * bpp;
+   }
 
-static uint32_t osmesa_fb_ID = 0;
+   ok = pipe->readback_to_buffer(pipe, surf, box, buf, dst_format,
+                                 offset, dst_stride);
 
-static struct st_framebuffer_iface *
-osmesa_create_st_framebuffer(void)
-{
-   struct st_framebuffer_iface *stfbi = CALLOC_STRUCT(st_framebuffer_iface);
-   if (stfbi) {
-      stfbi->flush_front = osmesa_st_framebuffer_flush_front;
-      stfbi->validate = osmesa_st_framebuffer_validate;
-      p_atomic_set(&stfbi->stamp, 1);
-      stfbi->ID = p_atomic_inc_return(&osmesa_fb_ID);
-      stfbi->state_manager = get_st_manager();
-   }
-   return stfbi;
+   pipe_surface_reference(&surf, NULL);
+   pipe_resource_reference(&buf, NULL);
+   return ok;
 }
 
 
 /**
- * Create new buffer and add to linked list.
+ * Get the box of the color buffer to copy to the user's buffer: what was
+ * written since the last flush, when the driver tracks it and the user's
+ * buffer is the one last copied to, else all of it.  Rendering in place
+ * gets the written box too, for OSMesaGetDirtyRegion().
  */
-static struct osmesa_buffer *
-osmesa_create_buffer(enum pipe_format color_format,
-                     enum pipe_format ds_format,
-                     enum pipe_format accum_format)
+static void
+osmesa_dirty_box(OSMesaContext osmesa, struct osmesa_buffer *osbuffer,
+                 struct pipe_context *pipe, struct pipe_resource *res,
+                 struct pipe_box *box)
 {
-   struct osmesa_buffer *osbuffer = CALLOC_STRUCT(osmesa_buffer);
-   if (osbuffer) {
-      osbuffer->stfb = osmesa_create_st_framebuffer();
-
-      osbuffer->stfb->st_manager_private = osbuffer;
-      osbuffer->stfb->visual = &osbuffer->visual;
-
-      osmesa_init_st_visual(&osbuffer->visual, color_format,
-                            ds_format, accum_format);
-
-      /* insert into linked list */
-      osbuffer->next = BufferList;
-      BufferList = osbuffer;
-   }
-
-   return osbuffer;
+   const int stride = osmesa_user_stride(osmesa, osbuffer);
+   const bool in_place = osbuffer->user_map &&
+                         osbuffer->user_map == osbuffer->map;
+   const bool synced = osbuffer->synced_map == osbuffer->map &&
+                       osbuffer->synced_stride == stride &&
+                       osbuffer->synced_y_up == osmesa->y_up;
+
+   if (!pipe->get_dirty_region ||
+       !pipe->get_dirty_region(pipe, res, true, box) ||
+       (!in_place && !synced))
+      u_box_2d(0, 0, res->width0, res->height0, box);
+
+   osbuffer->synced_map = osbuffer->map;
+   osbuffer->synced_stride = stride;
+   osbuffer->synced_y_up = osmesa->y_up;
+   osbuffer->dirty = *box;
 }
 
 
 /**
- * Search linked list for a buffer with matching pixel formats and size.
+ * Return the shared buffer whose image is map, if any.
+ * Called with BufferMutex held.
  */
-static struct osmesa_buffer *
-osmesa_find_buffer(enum pipe_format color_format,
-                   enum pipe_format ds_format,
-                   enum pipe_format accum_format,
-                   GLsizei width, GLsizei height)
+static struct osmesa_shared *
+osmesa_find_shared(const void *map)
 {
-   struct osmesa_buffer *b;
+   struct osmesa_shared *shared;
 
-   /* Check if we already have a suitable buffer for the given formats */
-   for (b = BufferList; b; b = b->next) {
-      if (b->visual.color_format == color_format &&
-          b->visual.depth_stencil_format == ds_format &&
-          b->visual.accum_format == accum_format &&
-          b->width == width &&
-          b->height == height) {
-         return b;
-      }
+   LIST_FOR_EACH_ENTRY(shared, &SharedBuffers, link) {
+      if (shared->image == map)
+         return shared;
    }
    return NULL;
 }
 
 
+/**
+ * Tell the readers of a shared buffer that a frame, with box in it
+ * changed, has been written to its image.
+ */
 static void
-osmesa_destroy_buffer(struct osmesa_buffer *osbuffer)
+osmesa_publish_shared(struct osmesa_shared *shared,
+                      const struct pipe_box *box, GLboolean y_up)
 {
-   struct st_api *stapi = get_st_api();
+   OSMesaSharedHeader *header = shared->header;
+
+   header->y_up = y_up;
+   header->dirty[0] = box->x;
+   header->dirty[1] = y_up && box->height ?
+                      header->height - box->y - box->height : box->y;
+   header->dirty[2] = box->width;
+   header->dirty[3] = box->height;
+
+   /* Also orders the image and the above before the new sequence */
+   p_atomic_inc(&header->sequence);
+#ifdef UTIL_FUTEX_SUPPORTED
+   futex_wake(&header->sequence, INT_MAX);
+#endif
+}
 
-   /*
-    * Notify the state manager that the associated framebuffer interface
-    * is no longer valid.
-    */
-   stapi->destroy_drawable(stapi, osbuffer->stfb);
+
+/**
+ * Called via glFlush/glFinish.  This is where we copy the contents
+ * of the driver's color buffer into the user-specified buffer.
+ */
+static bool
+osmesa_st_framebuffer_flush_front(struct st_context_iface *stctx,
+                                  struct st_framebuffer_iface *stfbi,
+                                  enum st_attachment_type statt)
+{
+   OSMesaContext osmesa = OSMesaGetCurrentContext();
+   struct osmesa_buffer *osbuffer = stfbi_to_osbuffer(stfbi);
+   struct pipe_context *pipe = stctx->pipe;
+   struct pipe_resource *res = osbuffer->textures[statt];
+   struct pipe_resource *depth;
+   struct pipe_box box;
+   unsigned i;
+
+   osmesa_postprocess(osmesa, osbuffer, res);
+
+   /* The other color buffers, unless rendered in place */
+   for (i = 0; statt == ST_ATTACHMENT_FRONT_LEFT &&
+               i < ARRAY_SIZE(osbuffer->extra_map); i++) {
+      struct pipe_resource *extra =
+         osbuffer->textures[osmesa_color_statts[i + 1]];
+
+      if (extra && osbuffer->extra_map[i] &&
+          osbuffer->extra_user_map[i] != osbuffer->extra_map[i])
+         osmesa_copy_to_user(pipe, extra, NULL, osbuffer->key.user_format,
+                             osbuffer->extra_map[i],
+                             osmesa_user_stride(osmesa, osbuffer),
+                             osmesa->y_up);
+   }
+
+   /* And the depth buffer, likewise */
+   depth = osbuffer->textures[ST_ATTACHMENT_DEPTH_STENCIL];
+   if (statt == ST_ATTACHMENT_FRONT_LEFT && depth && osbuffer->depth_map &&
+       osbuffer->depth_user_map != osbuffer->depth_map)
+      osmesa_copy_to_user(pipe, depth, NULL, depth->format,
+                          osbuffer->depth_map,
+                          osmesa_user_depth_stride(osmesa, osbuffer),
+                          osmesa->y_up);
+
+   /* A front buffer flush is the end of a frame, as far as the HUD goes */
+   if (osmesa->hud && statt == ST_ATTACHMENT_FRONT_LEFT)
+      hud_record_only(osmesa->hud, pipe);
+
+   if (statt == ST_ATTACHMENT_FRONT_LEFT)
+      osmesa_dirty_box(osmesa, osbuffer, pipe, res, &box);
+
+   if (statt == ST_ATTACHMENT_FRONT_LEFT &&
+       ((osbuffer->user_map && osbuffer->user_map == osbuffer->map) ||
+        osmesa_queue_copy_to_user(pipe, res, &box, osbuffer->key.user_format,
+                                  osbuffer->map,
+                                  osmesa_user_stride(osmesa, osbuffer),
+                                  osmesa->y_up))) {
+      /* The driver rendered straight into the user's buffer, or is going
+       * to copy the rendering there, we only need to wait for it to be
+       * done.
+       */
+      struct pipe_screen *screen = pipe->screen;
+      struct pipe_fence_handle *fence = NULL;
+
+      pipe->flush(pipe, &fence, 0);
+      if (fence) {
+         screen->fence_finish(screen, NULL, fence, PIPE_TIMEOUT_INFINITE);
+         screen->fence_reference(screen, &fence, NULL);
+      }
+   }
+   else {
+      osmesa_copy_to_user(pipe, res,
+                          statt == ST_ATTACHMENT_FRONT_LEFT ? &box : NULL,
+                          osbuffer->key.user_format, osbuffer->map,
+                          osmesa_user_stride(osmesa, osbuffer), osmesa->y_up);
+   }
+
+   if (statt == ST_ATTACHMENT_FRONT_LEFT && osbuffer->shared)
+      osmesa_publish_shared(osbuffer->shared, &box, osmesa->y_up);
+
+   return true;
+}
+
+
+/**
+ * Recount the memory of the buffer's textures, once they changed.
+ */
+static void
+osmesa_buffer_update_memory(struct osmesa_buffer *osbuffer)
+{
+   uint64_t memory = 0;
+   unsigned i;
+
+   for (i = 0; i < ST_ATTACHMENT_COUNT; i++) {
+      struct pipe_resource *res = osbuffer->textures[i];
+
+      memory += osbuffer->backing_size[i];
+      if (res && !((osbuffer->backed | osbuffer->user_mapped) & (1 << i)))
+         memory += util_resource_size(res);
+   }
+
+   simple_mtx_lock(&BufferMutex);
+   BufferMemory += memory - osbuffer->memory;
+   osbuffer->memory = memory;
+   simple_mtx_unlock(&BufferMutex);
+}
+
+
+/**
+ * Wait for the rendering to the buffer by the contexts which unbound it.
+ * BufferMutex must be held.
+ */
+static void
+osmesa_buffer_wait_idle(struct osmesa_buffer *osbuffer)
+{
+   struct pipe_screen *screen = get_st_manager()->screen;
+
+   if (osbuffer->fence) {
+      screen->fence_finish(screen, NULL, osbuffer->fence,
+                           PIPE_TIMEOUT_INFINITE);
+      screen->fence_reference(screen, &osbuffer->fence, NULL);
+   }
+}
+
+
+/**
+ * Create a color/depth/accum resource on the buffer's backing memory for
+ * the attachment, growing it if needed.  Return NULL if the driver can't,
+ * in which case the caller falls back to an ordinary resource.
+ */
+static struct pipe_resource *
+osmesa_create_backed_resource(struct st_context_iface *stctx,
+                              struct osmesa_buffer *osbuffer,
+                              enum st_attachment_type statt,
+                              const struct pipe_resource *templat)
+{
+   struct pipe_screen *screen = stctx->pipe->screen;
+   struct pipe_resource padded = *templat;
+   struct pipe_resource *res;
+   unsigned stride, offset, rows;
+   uint64_t size;
+
+   if (!screen->resource_from_user_memory || !screen->resource_get_info)
+      return NULL;
+
+   /* Rows and row lengths rounded up as drivers lay them out, like
+    * llvmpipe's 4x4 pixel blocks.
+    */
+   rows = align(templat->height0, 4);
+   size = (uint64_t) align(align(templat->width0, 4) *
+                           util_format_get_blocksize(templat->format), 64) *
+          rows;
+
+   if (size > osbuffer->backing_size[statt]) {
+      struct pipe_fence_handle *fence = NULL;
+      void *backing;
+
+      /* Leave room for the sizes to come */
+      size = MAX2(size, osbuffer->backing_size[statt] * 3 / 2);
+      backing = align_malloc(size, 64);
+      if (!backing)
+         return NULL;
+
+      /* The old textures may still be rendered to */
+      if (osbuffer->backing[statt]) {
+         stctx->pipe->flush(stctx->pipe, &fence, 0);
+         if (fence) {
+            screen->fence_finish(screen, NULL, fence, PIPE_TIMEOUT_INFINITE);
+            screen->fence_reference(screen, &fence, NULL);
+         }
+         simple_mtx_lock(&BufferMutex);
+         osmesa_buffer_wait_idle(osbuffer);
+         simple_mtx_unlock(&BufferMutex);
+         align_free(osbuffer->backing[statt]);
+      }
+      osbuffer->backing[statt] = backing;
+      osbuffer->backing_size[statt] = size;
+   }
+
+   padded.flags |= PIPE_RESOURCE_FLAG_USER_MEMORY_PADDED;
+   res = screen->resource_from_user_memory(screen, &padded,
+                                           osbuffer->backing[statt]);
+   if (!res)
+      return NULL;
+
+   screen->resource_get_info(screen, res, &stride, &offset);
+   if (offset != 0 ||
+       (uint64_t) stride * rows > osbuffer->backing_size[statt]) {
+      pipe_resource_reference(&res, NULL);
+      return NULL;
+   }
+
+   osbuffer->backed |= 1 << statt;
+   return res;
+}
+
+
+/**
+ * Try to create a color or depth resource on top of the user's buffer,
+ * with rows stride bytes apart.
+ * Return NULL if the buffer can't be used as is by the driver, in which
+ * case the caller falls back to an ordinary resource.
+ */
+static struct pipe_resource *
+osmesa_create_user_resource(struct pipe_screen *screen,
+                            OSMesaContext osmesa, void *map, int stride,
+                            const struct pipe_resource *templat)
+{
+   struct pipe_resource *res;
+   unsigned res_stride, offset;
+
+   if (!screen->resource_from_user_memory || !screen->resource_get_info)
+      return NULL;
+
+   /* Gallium resources are top-to-bottom, we'd need a negative stride */
+   if (osmesa->y_up)
+      return NULL;
+
+   res = screen->resource_from_user_memory(screen, templat, map);
+   if (!res)
+      return NULL;
+
+   screen->resource_get_info(screen, res, &res_stride, &offset);
+   if (offset != 0 || (int) res_stride != stride) {
+      pipe_resource_reference(&res, NULL);
+      return NULL;
+   }
+
+   return res;
+}
+
+
+static void
+osmesa_progress(void *data, unsigned rows)
+{
+   struct osmesa_buffer *osbuffer = (struct osmesa_buffer *) data;
+
+   osbuffer->progress_func(osbuffer->progress_data, rows);
+}
+
+
+/**
+ * Called by the st manager to validate the framebuffer (allocate
+ * its resources).
+ */
+static bool
+osmesa_st_framebuffer_validate(struct st_context_iface *stctx,
+                               struct st_framebuffer_iface *stfbi,
+                               const enum st_attachment_type *statts,
+                               unsigned count,
+                               struct pipe_resource **out)
+{
+   struct pipe_screen *screen = get_st_manager()->screen;
+   OSMesaContext osmesa = (OSMesaContext) stctx->st_manager_private;
+   enum st_attachment_type i;
+   struct osmesa_buffer *osbuffer = stfbi_to_osbuffer(stfbi);
+   const int color_stride = osmesa_user_stride(osmesa, osbuffer);
+   const int depth_stride = osmesa_user_depth_stride(osmesa, osbuffer);
+   /* The user's color buffers can only be rendered to in their format.
+    * Shared buffers are always rendered in place, it's what they're for.
+    */
+   const GLboolean zero_copy = (osmesa->zero_copy || osbuffer->shared) &&
+      osbuffer->key.user_format == osbuffer->key.color_format;
+   struct pipe_resource templat;
+
+   memset(&templat, 0, sizeof(templat));
+   templat.target = PIPE_TEXTURE_RECT;
+   templat.format = 0; /* setup below */
+   templat.last_level = 0;
+   templat.width0 = osbuffer->width;
+   templat.height0 = osbuffer->height;
+   templat.depth0 = 1;
+   templat.array_size = 1;
+   templat.usage = PIPE_USAGE_DEFAULT;
+   templat.bind = 0; /* setup below */
+   templat.flags = 0;
+
+   for (i = 0; i < count; i++) {
+      enum pipe_format format = PIPE_FORMAT_NONE;
+      unsigned bind = 0;
+      int extra = osmesa_extra_color_buffer(statts[i]);
+
+      /*
+       * The other color attachments are only in the visual, see
+       * osmesa_init_st_visual(), with OSMESA_COLOR_BUFFERS.
+       */
+      if (statts[i] == ST_ATTACHMENT_FRONT_LEFT || extra >= 0) {
+         format = osbuffer->visual.color_format;
+         bind = PIPE_BIND_RENDER_TARGET;
+      }
+      else if (statts[i] == ST_ATTACHMENT_DEPTH_STENCIL) {
+         format = osbuffer->visual.depth_stencil_format;
+         bind = PIPE_BIND_DEPTH_STENCIL;
+      }
+      else if (statts[i] == ST_ATTACHMENT_ACCUM) {
+         format = osbuffer->visual.accum_format;
+         bind = PIPE_BIND_RENDER_TARGET;
+      }
+      else {
+         debug_warning("Unexpected attachment type in "
+                       "osmesa_st_framebuffer_validate()");
+      }
+
+      templat.format = format;
+      templat.bind = bind;
+      pipe_resource_reference(&out[i], NULL);
+      osbuffer->backed &= ~(1 << statts[i]);
+      osbuffer->user_mapped &= ~(1 << statts[i]);
+
+      if (statts[i] == ST_ATTACHMENT_FRONT_LEFT) {
+         /* A new texture, its contents aren't in the user's buffer */
+         osbuffer->user_map = NULL;
+         osbuffer->synced_map = NULL;
+         if (zero_copy) {
+            struct pipe_resource user = templat;
+
+            /* Whose rows are allocated in whole 4x4 blocks */
+            if (osbuffer->shared)
+               user.flags |= PIPE_RESOURCE_FLAG_USER_MEMORY_PADDED;
+            out[i] = osmesa_create_user_resource(screen, osmesa,
+                                                 osbuffer->map, color_stride,
+                                                 &user);
+            if (out[i]) {
+               struct pipe_context *pipe = stctx->pipe;
+
+               osbuffer->user_map = osbuffer->map;
+               osbuffer->user_mapped |= 1 << statts[i];
+               osbuffer->textures[statts[i]] = out[i];
+               if (osbuffer->progress_func &&
+                   osbuffer->progress_map == osbuffer->map &&
+                   pipe->set_progress_callback)
+                  pipe->set_progress_callback(pipe, out[i], osmesa_progress,
+                                              osbuffer);
+               continue;
+            }
+         }
+      }
+      else if (extra >= 0) {
+         void *map = osbuffer->extra_map[extra];
+
+         osbuffer->extra_user_map[extra] = NULL;
+         if (zero_copy && map) {
+            out[i] = osmesa_create_user_resource(screen, osmesa, map,
+                                                 color_stride, &templat);
+            if (out[i]) {
+               osbuffer->extra_user_map[extra] = map;
+               osbuffer->user_mapped |= 1 << statts[i];
+               osbuffer->textures[statts[i]] = out[i];
+               continue;
+            }
+         }
+      }
+      else if (statts[i] == ST_ATTACHMENT_DEPTH_STENCIL) {
+         osbuffer->depth_user_map = NULL;
+         if (osbuffer->depth_map) {
+            out[i] = osmesa_create_user_resource(screen, osmesa,
+                                                 osbuffer->depth_map,
+                                                 depth_stride, &templat);
+            if (out[i]) {
+               osbuffer->depth_user_map = osbuffer->depth_map;
+               osbuffer->user_mapped |= 1 << statts[i];
+               osbuffer->textures[statts[i]] = out[i];
+               continue;
+            }
+         }
+         else if (osbuffer->key.transient_ds) {
+            struct pipe_resource transient = templat;
+
+            /* Its contents needn't outlive a flush, so it may never be
+             * allocated.
+             */
+            transient.flags |= PIPE_RESOURCE_FLAG_TRANSIENT;
+            out[i] = screen->resource_create(screen, &transient);
+            osbuffer->textures[statts[i]] = out[i];
+            continue;
+         }
+      }
+
+      out[i] = osmesa_create_backed_resource(stctx, osbuffer, statts[i],
+                                             &templat);
+      if (!out[i])
+         out[i] = screen->resource_create(screen, &templat);
+      osbuffer->textures[statts[i]] = out[i];
+   }
+
+   osmesa_buffer_update_memory(osbuffer);
+
+   return true;
+}
+
+static uint32_t osmesa_fb_ID = 0;
+
+static struct st_framebuffer_iface *
+osmesa_create_st_framebuffer(void)
+{
+   struct st_framebuffer_iface *stfbi = CALLOC_STRUCT(st_framebuffer_iface);
+   if (stfbi) {
+      stfbi->flush_front = osmesa_st_framebuffer_flush_front;
+      stfbi->validate = osmesa_st_framebuffer_validate;
+      p_atomic_set(&stfbi->stamp, 1);
+      stfbi->ID = p_atomic_inc_return(&osmesa_fb_ID);
+      stfbi->state_manager = get_st_manager();
+   }
+   return stfbi;
+}
+
+
+static uint32_t
+osmesa_buffer_key_hash(const void *key)
+{
+   return _mesa_hash_data(key, sizeof(struct osmesa_buffer_key));
+}
+
+
+static bool
+osmesa_buffer_key_equal(const void *a, const void *b)
+{
+   return memcmp(a, b, sizeof(struct osmesa_buffer_key)) == 0;
+}
+
+
+/** Add the buffer to BufferTable under its key */
+static void
+osmesa_link_buffer(struct osmesa_buffer *osbuffer)
+{
+   struct hash_entry *entry;
+
+   /* The table's key is the one of the first buffer in the list */
+   entry = _mesa_hash_table_search(BufferTable, &osbuffer->key);
+   osbuffer->next = NULL;
+   if (entry) {
+      osbuffer->next = entry->data;
+      _mesa_hash_table_remove(BufferTable, entry);
+   }
+   _mesa_hash_table_insert(BufferTable, &osbuffer->key, osbuffer);
+}
+
+
+static void
+osmesa_unlink_buffer(struct osmesa_buffer *osbuffer)
+{
+   struct hash_entry *entry;
+
+   entry = _mesa_hash_table_search(BufferTable, &osbuffer->key);
+   if (entry->data == osbuffer) {
+      _mesa_hash_table_remove(BufferTable, entry);
+      if (osbuffer->next)
+         _mesa_hash_table_insert(BufferTable, &osbuffer->next->key,
+                                 osbuffer->next);
+   } else {
+      struct osmesa_buffer *b = entry->data;
+
+      while (b->next != osbuffer)
+         b = b->next;
+      b->next = osbuffer->next;
+   }
+}
+
+
+/**
+ * Create new buffer and add it to the cache.  BufferMutex must be held.
+ */
+static struct osmesa_buffer *
+osmesa_create_buffer(const struct osmesa_buffer_key *key)
+{
+   struct osmesa_buffer *osbuffer;
+
+   if (!BufferTable) {
+      BufferTable = _mesa_hash_table_create(NULL, osmesa_buffer_key_hash,
+                                            osmesa_buffer_key_equal);
+      if (!BufferTable)
+         return NULL;
+   }
+
+   osbuffer = CALLOC_STRUCT(osmesa_buffer);
+   if (osbuffer) {
+      osbuffer->stfb = osmesa_create_st_framebuffer();
+      if (!osbuffer->stfb) {
+         FREE(osbuffer);
+         return NULL;
+      }
+
+      osbuffer->stfb->st_manager_private = osbuffer;
+      osbuffer->stfb->visual = &osbuffer->visual;
+      osbuffer->key = *key;
+
+      osmesa_init_st_visual(&osbuffer->visual, key->color_format,
+                            key->ds_format, key->accum_format,
+                            key->color_buffers);
+
+      osmesa_link_buffer(osbuffer);
+      list_add(&osbuffer->lru, &BufferLRU);
+   }
+
+   return osbuffer;
+}
+
+
+/**
+ * Look up a buffer with matching pixel formats and size, the context's
+ * current one first.  BufferMutex must be held.
+ */
+static struct osmesa_buffer *
+osmesa_find_buffer(const struct osmesa_buffer_key *key,
+                   struct osmesa_buffer *current)
+{
+   struct hash_entry *entry;
+   struct osmesa_buffer *b;
+
+   if (!BufferTable)
+      return NULL;
+
+   if (current && !current->pending_frames &&
+       memcmp(&current->key, key, sizeof(*key)) == 0)
+      return current;
+
+   entry = _mesa_hash_table_search(BufferTable, key);
+   if (!entry)
+      return NULL;
+
+   /* Buffers with frames in flight keep their contents until waited for. */
+   for (b = entry->data; b; b = b->next) {
+      if (!b->pending_frames)
+         return b;
+   }
+   return NULL;
+}
+
+
+/**
+ * Destroy a buffer no context has current.  BufferMutex must be held.
+ *
+ * The textures are freed once the contexts which rendered to the buffer
+ * drop their framebuffer objects for it, which they do when they are made
+ * current next.
+ */
+static void
+osmesa_destroy_buffer(struct osmesa_buffer *osbuffer)
+{
+   struct st_api *stapi = get_st_api();
+   unsigned i;
+
+   assert(!osbuffer->bound && !osbuffer->pending_frames);
+
+   osmesa_unlink_buffer(osbuffer);
+   list_del(&osbuffer->lru);
+
+   /*
+    * Notify the state manager that the associated framebuffer interface
+    * is no longer valid.
+    */
+   stapi->destroy_drawable(stapi, osbuffer->stfb);
+
+   for (i = 0; i < ST_ATTACHMENT_COUNT; i++)
+      pipe_resource_reference(&osbuffer->textures[i], NULL);
+
+   /* Unlike the textures, the memory under them isn't refcounted */
+   osmesa_buffer_wait_idle(osbuffer);
+   for (i = 0; i < ST_ATTACHMENT_COUNT; i++)
+      align_free(osbuffer->backing[i]);
+   BufferMemory -= osbuffer->memory;
 
    FREE(osbuffer->stfb);
    FREE(osbuffer);
 }
 
 
+static bool
+osmesa_buffer_is_idle(const struct osmesa_buffer *osbuffer)
+{
+   return !osbuffer->bound && !osbuffer->pending_frames;
+}
+
+
+/**
+ * Resize a buffer with matching pixel formats in place, rather than
+ * allocating a new one: the context's current one if no other context has
+ * it current, else the most recently bound idle one.  BufferMutex must be
+ * held.
+ */
+static struct osmesa_buffer *
+osmesa_resize_buffer(const struct osmesa_buffer_key *key,
+                     struct osmesa_buffer *current)
+{
+   struct osmesa_buffer *b = NULL, *iter;
+
+   if (current && current->bound == 1 && !current->pending_frames &&
+       current->key.color_format == key->color_format &&
+       current->key.ds_format == key->ds_format &&
+       current->key.accum_format == key->accum_format &&
+       current->key.color_buffers == key->color_buffers &&
+       current->key.transient_ds == key->transient_ds) {
+      b = current;
+   } else {
+      LIST_FOR_EACH_ENTRY(iter, &BufferLRU, lru) {
+         if (osmesa_buffer_is_idle(iter) &&
+             iter->key.color_format == key->color_format &&
+             iter->key.ds_format == key->ds_format &&
+             iter->key.accum_format == key->accum_format &&
+             iter->key.color_buffers == key->color_buffers &&
+             iter->key.transient_ds == key->transient_ds) {
+            b = iter;
+            break;
+         }
+      }
+   }
+
+   if (!b)
+      return NULL;
+
+   osmesa_unlink_buffer(b);
+   b->key = *key;
+   osmesa_link_buffer(b);
+
+   /* New textures, on the same memory */
+   p_atomic_inc(&b->stfb->stamp);
+   return b;
+}
+
+
+/**
+ * Drop the context's binding of its current buffer, after which the buffer
+ * may be resized or destroyed: its fence tells when the context is done
+ * rendering to it.
+ */
+static void
+osmesa_unbind_buffer(OSMesaContext osmesa)
+{
+   struct pipe_screen *screen = get_st_manager()->screen;
+   struct osmesa_buffer *osbuffer = osmesa->current_buffer;
+   struct pipe_fence_handle *fence = NULL;
+
+   if (!osbuffer)
+      return;
+
+   osmesa->stctx->flush(osmesa->stctx, 0, &fence, NULL, NULL);
+
+   simple_mtx_lock(&BufferMutex);
+   screen->fence_reference(screen, &osbuffer->fence, NULL);
+   osbuffer->fence = fence;
+   osbuffer->bound--;
+   osmesa->current_buffer = NULL;
+   simple_mtx_unlock(&BufferMutex);
+}
+
+
+/**
+ * Destroy the least recently bound idle buffers until the textures fit in
+ * OSMESA_BUFFER_CACHE_MB.  BufferMutex must be held.
+ */
+static void
+osmesa_trim_buffers(void)
+{
+   static int64_t budget = -1;
+   struct osmesa_buffer *b, *prev;
+
+   if (budget < 0)
+      budget = (int64_t) debug_get_num_option("OSMESA_BUFFER_CACHE_MB",
+                                              256) << 20;
+
+   LIST_FOR_EACH_ENTRY_SAFE_REV(b, prev, &BufferLRU, lru) {
+      if (BufferMemory <= (uint64_t) budget)
+         break;
+      if (osmesa_buffer_is_idle(b))
+         osmesa_destroy_buffer(b);
+   }
+}
+
+
+
+/**********************************************************************/
+/*****                    Public Functions                        *****/
+/**********************************************************************/
+
+
+/**
+ * Create an Off-Screen Mesa rendering context.  The only attribute needed is
+ * an RGBA vs Color-Index mode flag.
+ *
+ * Input:  format - Must be GL_RGBA
+ *         sharelist - specifies another OSMesaContext with which to share
+ *                     display lists.  NULL indicates no sharing.
+ * Return:  an OSMesaContext or 0 if error
+ */
+static unsigned
+osmesa_context_pool_size(void)
+{
+   static int size = -1;
+
+   if (size < 0)
+      size = MIN2(debug_get_num_option("OSMESA_CONTEXT_POOL", 0),
+                  OSMESA_MAX_CONTEXT_POOL);
+   return size;
+}
+
+
+/**
+ * Create the osmesa->attribs context, on the given gallium context if not
+ * NULL, else a pooled or new one.  The gallium context is destroyed if
+ * this fails.
+ */
+static struct st_context_iface *
+osmesa_create_st_context(OSMesaContext osmesa,
+                         struct st_context_iface *st_shared,
+                         struct pipe_context *pipe)
+{
+   struct st_api *stapi = get_st_api();
+   struct st_context_attribs attribs = osmesa->attribs;
+   enum st_context_error st_error = 0;
+   struct st_context_iface *stctx;
+
+   if (!pipe) {
+      simple_mtx_lock(&ContextPoolMutex);
+      if (ContextPoolCount)
+         pipe = ContextPool[--ContextPoolCount];
+      simple_mtx_unlock(&ContextPoolMutex);
+   }
+
+   attribs.pipe = pipe;
+   stctx = stapi->create_context(stapi, get_st_manager(),
+                                 &attribs, &st_error, st_shared);
+   if (!stctx) {
+      if (pipe)
+         pipe->destroy(pipe);
+      return NULL;
+   }
+
+   stctx->st_manager_private = osmesa;
+
+   if (debug_get_bool_option("OSMESA_THREADED", osmesa->threaded) &&
+       stctx->start_thread)
+      stctx->start_thread(stctx);
+
+   return stctx;
+}
+
+
+GLAPI OSMesaContext GLAPIENTRY
+OSMesaCreateContext(GLenum format, OSMesaContext sharelist)
+{
+   return OSMesaCreateContextExt(format, 24, 8, 0, sharelist);
+}
+
+
+/**
+ * New in Mesa 3.5
+ *
+ * Create context and specify size of ancillary buffers.
+ */
+GLAPI OSMesaContext GLAPIENTRY
+OSMesaCreateContextExt(GLenum format, GLint depthBits, GLint stencilBits,
+                       GLint accumBits, OSMesaContext sharelist)
+{
+   int attribs[100], n = 0;
+
+   attribs[n++] = OSMESA_FORMAT;
+   attribs[n++] = format;
+   attribs[n++] = OSMESA_DEPTH_BITS;
+   attribs[n++] = depthBits;
+   attribs[n++] = OSMESA_STENCIL_BITS;
+   attribs[n++] = stencilBits;
+   attribs[n++] = OSMESA_ACCUM_BITS;
+   attribs[n++] = accumBits;
+   attribs[n++] = 0;
+
+   return OSMesaCreateContextAttribs(attribs, sharelist);
+}
+
+
+/**
+ * New in Mesa 11.2
+ *
+ * Create context with attribute list.
+ */
+GLAPI OSMesaContext GLAPIENTRY
+OSMesaCreateContextAttribs(const int *attribList, OSMesaContext sharelist)
+{
+   OSMesaContext osmesa;
+   struct st_context_iface *st_shared;
+   struct st_context_attribs *attribs;
+   GLenum format = GL_RGBA;
+   int depthBits = 0, stencilBits = 0, accumBits = 0;
+   int profile = OSMESA_COMPAT_PROFILE, version_major = 1, version_minor = 0;
+   int zero_copy = -1;
+   GLboolean threaded = GL_FALSE;
+   int color_buffers = 1;
+   GLboolean depth_float = GL_FALSE;
+   GLboolean transient_ds = GL_FALSE;
+   int driver = 0;
+   int i;
+
+   if (sharelist) {
+      st_shared = sharelist->stctx;
+   }
+   else {
+      st_shared = NULL;
+   }
+
+   for (i = 0; attribList[i]; i += 2) {
+      switch (attribList[i]) {
+      case OSMESA_FORMAT:
+         format = attribList[i+1];
+         switch (format) {
+         case OSMESA_COLOR_INDEX:
+         case OSMESA_RGBA:
+         case OSMESA_BGRA:
+         case OSMESA_ARGB:
+         case OSMESA_RGB:
+         case OSMESA_BGR:
+         case OSMESA_RGB_565:
+            /* legal */
+            break;
+         default:
+            return NULL;
+         }
+         break;
+      case OSMESA_DEPTH_BITS:
+         depthBits = attribList[i+1];
+         if (depthBits < 0)
+            return NULL;
+         break;
+      case OSMESA_STENCIL_BITS:
+         stencilBits = attribList[i+1];
+         if (stencilBits < 0)
+            return NULL;
+         break;
+      case OSMESA_ACCUM_BITS:
+         accumBits = attribList[i+1];
+         if (accumBits < 0)
+            return NULL;
+         break;
+      case OSMESA_PROFILE:
+         profile = attribList[i+1];
+         if (profile != OSMESA_CORE_PROFILE &&
+             profile != OSMESA_COMPAT_PROFILE)
+            return NULL;
+         break;
+      case OSMESA_CONTEXT_MAJOR_VERSION:
+         version_major = attribList[i+1];
+         if (version_major < 1)
+            return NULL;
+         break;
+      case OSMESA_CONTEXT_MINOR_VERSION:
+         version_minor = attribList[i+1];
+         if (version_minor < 0)
+            return NULL;
+         break;
+      case OSMESA_ZERO_COPY:
+         zero_copy = attribList[i+1] ? GL_TRUE : GL_FALSE;
+         break;
+      case OSMESA_THREADED:
+         threaded = attribList[i+1] ? GL_TRUE : GL_FALSE;
+         break;
+      case OSMESA_DEPTH_FLOAT:
+         depth_float = attribList[i+1] ? GL_TRUE : GL_FALSE;
+         break;
+      case OSMESA_COLOR_BUFFERS:
+         color_buffers = attribList[i+1];
+         if (color_buffers < 1 || color_buffers > OSMESA_MAX_COLOR_BUFFERS)
+            return NULL;
+         break;
+      case OSMESA_GALLIUM_DRIVER:
+         driver = attribList[i+1];
+         break;
+      case OSMESA_TRANSIENT_DEPTH_STENCIL:
+         transient_ds = attribList[i+1] ? GL_TRUE : GL_FALSE;
+         break;
+      case 0:
+         /* end of list */
+         break;
+      default:
+         fprintf(stderr, "Bad attribute in OSMesaCreateContextAttribs()\n");
+         return NULL;
+      }
+   }
+
+   /* Before anything creates the screen */
+   if (driver && !osmesa_select_driver(driver))
+      return NULL;
+
+   osmesa = (OSMesaContext) CALLOC_STRUCT(osmesa_context);
+   if (!osmesa)
+      return NULL;
+
+   /* Choose depth/stencil/accum buffer formats */
+   if (accumBits > 0) {
+      osmesa->accum_format = PIPE_FORMAT_R16G16B16A16_SNORM;
+   }
+   if (depth_float && depthBits > 0) {
+      osmesa->depth_stencil_format = stencilBits > 0 ?
+         PIPE_FORMAT_Z32_FLOAT_S8X24_UINT : PIPE_FORMAT_Z32_FLOAT;
+   }
+   else if (depthBits > 0 && stencilBits > 0) {
+      osmesa->depth_stencil_format = PIPE_FORMAT_Z24_UNORM_S8_UINT;
+   }
+   else if (stencilBits > 0) {
+      osmesa->depth_stencil_format = PIPE_FORMAT_S8_UINT;
+   }
+   else if (depthBits >= 24) {
+      osmesa->depth_stencil_format = PIPE_FORMAT_Z24X8_UNORM;
+   }
+   else if (depthBits >= 16) {
+      osmesa->depth_stencil_format = PIPE_FORMAT_Z16_UNORM;
+   }
+
+   /*
+    * Create the rendering context
+    */
+   attribs = &osmesa->attribs;
+   attribs->profile = (profile == OSMESA_CORE_PROFILE)
+      ? ST_PROFILE_OPENGL_CORE : ST_PROFILE_DEFAULT;
+   attribs->major = version_major;
+   attribs->minor = version_minor;
+   attribs->flags = 0;  /* ST_CONTEXT_FLAG_x */
+   attribs->options.force_glsl_extensions_warn = FALSE;
+   attribs->options.disable_blend_func_extended = FALSE;
+   attribs->options.disable_glsl_line_continuations = FALSE;
+   attribs->options.force_glsl_version = 0;
+
+   osmesa_init_st_visual(&attribs->visual,
+                         PIPE_FORMAT_NONE,
+                         osmesa->depth_stencil_format,
+                         osmesa->accum_format,
+                         color_buffers);
+
+   osmesa->threaded = threaded;
+   osmesa->shared = st_shared != NULL;
+
+   osmesa->stctx = osmesa_create_st_context(osmesa, st_shared, NULL);
+   if (!osmesa->stctx) {
+      FREE(osmesa);
+      return NULL;
+   }
+
+   osmesa->format = format;
+   osmesa->user_row_length = 0;
+   osmesa->y_up = GL_TRUE;
+   /* Several outputs are meant to be written in place */
+   osmesa->zero_copy = zero_copy < 0 ? color_buffers > 1 : zero_copy;
+   osmesa->color_buffers = color_buffers;
+   osmesa->transient_ds = transient_ds;
+
+   osmesa->hud = hud_create_headless(osmesa->stctx->pipe,
+                                     debug_get_option("GALLIUM_HUD", NULL));
+
+   return osmesa;
+}
+
+
+
+/**
+ * Destroy an Off-Screen Mesa rendering context.
+ *
+ * \param osmesa  the context to destroy
+ */
+GLAPI void GLAPIENTRY
+OSMesaDestroyContext(OSMesaContext osmesa)
+{
+   if (osmesa) {
+      osmesa_thread_finish();
+      if (osmesa->hud)
+         hud_destroy(osmesa->hud, NULL);
+      osmesa_unbind_buffer(osmesa);
+      pp_free(osmesa->pp);
+      if (osmesa->stctx && osmesa->stctx->release_pipe &&
+          osmesa_context_pool_size()) {
+         /* Keep the gallium context for the next context */
+         struct pipe_context *pipe =
+            osmesa->stctx->release_pipe(osmesa->stctx);
+
+         simple_mtx_lock(&ContextPoolMutex);
+         if (ContextPoolCount < osmesa_context_pool_size()) {
+            ContextPool[ContextPoolCount++] = pipe;
+            pipe = NULL;
+         }
+         simple_mtx_unlock(&ContextPoolMutex);
+
+         if (pipe)
+            pipe->destroy(pipe);
+      }
+      else {
+         // We shoudn't destroy the stctx, because that
+         // frees the memory for the osbuffer,
+         // and the osbuffer is still in the BufferLizt so may be reused.
+         // TODO: does this cause a space leak?
+         // osmesa->stctx->destroy(osmesa->stctx);
+      }
+      FREE(osmesa);
+   }
+}
+
+
+/**
+ * Bind an OSMesaContext to an image buffer.  The image buffer is just a
+ * block of memory which the client provides.  Its size must be at least
+ * as large as width*height*pixelSize.  Its address should be a multiple
+ * of 4 if using RGBA mode.
+ *
+ * By default, image data is stored in the order of glDrawPixels: row-major
+ * order with the lower-left image pixel stored in the first array position
+ * (ie. bottom-to-top).
+ *
+ * If the context's viewport hasn't been initialized yet, it will now be
+ * initialized to (0,0,width,height).
+ *
+ * Input:  osmesa - the rendering context
+ *         buffer - the image buffer memory
+ *         type - data type for pixel components
+ *                GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT_5_6_5, GL_UNSIGNED_SHORT
+ *                or GL_FLOAT.
+ *         width, height - size of image buffer in pixels, at least 1
+ * Return:  GL_TRUE if success, GL_FALSE if error because of invalid osmesa,
+ *          invalid type, invalid size, etc.
+ */
+static GLboolean
+osmesa_make_current(OSMesaContext osmesa, GLint count, void *const *buffers,
+                    GLenum type, GLsizei width, GLsizei height)
+{
+   struct st_api *stapi = get_st_api();
+   struct osmesa_buffer *osbuffer;
+   struct osmesa_buffer_key key;
+   struct osmesa_shared *shared;
+   enum pipe_format user_format;
+   void *buffer = buffers[0];
+   boolean invalidate, zero_copy;
+   unsigned i;
+
+   /* The calls queued so far are for the old binding. */
+   osmesa_thread_finish();
+
+   if (!osmesa && !buffer) {
+      OSMesaContext current = OSMesaGetCurrentContext();
+
+      stapi->make_current(stapi, NULL, NULL, NULL);
+
+      /* The buffer can be destroyed now */
+      if (current)
+         osmesa_unbind_buffer(current);
+      return GL_TRUE;
+   }
+
+   if (!osmesa || !buffer || width < 1 || height < 1) {
+      return GL_FALSE;
+   }
+
+   user_format = osmesa_choose_format(osmesa->format, type);
+   if (user_format == PIPE_FORMAT_NONE) {
+      fprintf(stderr, "OSMesaMakeCurrent(unsupported format/type)\n");
+      return GL_FALSE;
+   }
+
+   /* A shared buffer only holds the image it was created for */
+   simple_mtx_lock(&BufferMutex);
+   shared = osmesa_find_shared(buffer);
+   simple_mtx_unlock(&BufferMutex);
+   if (shared && (shared->header->format != osmesa->format ||
+                  shared->header->type != type ||
+                  shared->header->width != width ||
+                  shared->header->height != height))
+      return GL_FALSE;
+
+   memset(&key, 0, sizeof(key));
+   key.color_format = osmesa_render_format(get_st_manager()->screen,
+                                           user_format);
+   key.user_format = user_format;
+   key.ds_format = osmesa->depth_stencil_format;
+   key.accum_format = osmesa->accum_format;
+   key.width = width;
+   key.height = height;
+   key.color_buffers = osmesa->color_buffers;
+   key.transient_ds = osmesa->transient_ds;
+
+   /* Record where rendering to the old buffer ends, unless it's reused */
+   if (osmesa->current_buffer &&
+       memcmp(&osmesa->current_buffer->key, &key, sizeof(key)) != 0) {
+      struct osmesa_buffer *old = osmesa->current_buffer;
+
+      osmesa_unbind_buffer(osmesa);
+      /* Taken back below, so that it can be resized in place */
+      simple_mtx_lock(&BufferMutex);
+      old->bound++;
+      osmesa->current_buffer = old;
+      simple_mtx_unlock(&BufferMutex);
+   }
+
+   simple_mtx_lock(&BufferMutex);
+
+   /* See if we already have a buffer that uses these pixel formats, else
+    * one to resize
+    */
+   osbuffer = osmesa_find_buffer(&key, osmesa->current_buffer);
+   if (!osbuffer)
+      osbuffer = osmesa_resize_buffer(&key, osmesa->current_buffer);
+   if (!osbuffer) {
+      /* No existing buffer found, create new buffer */
+      osbuffer = osmesa_create_buffer(&key);
+      if (!osbuffer) {
+         simple_mtx_unlock(&BufferMutex);
+         return GL_FALSE;
+      }
+   }
+
+   list_del(&osbuffer->lru);
+   list_add(&osbuffer->lru, &BufferLRU);
+
+   if (osmesa->current_buffer != osbuffer) {
+      if (osmesa->current_buffer)
+         osmesa->current_buffer->bound--;
+      osbuffer->bound++;
+   }
+
+   osbuffer->shared = shared;
+
+   /* The old buffer may be the one to go */
+   osmesa_trim_buffers();
+
+   simple_mtx_unlock(&BufferMutex);
+
+   /* A color resource wrapping another user buffer (or an ordinary one
+    * while this context wants to render in place) must be recreated.
+    */
+   zero_copy = (osmesa->zero_copy || shared) &&
+               key.user_format == key.color_format;
+   invalidate = osbuffer->user_map ? osbuffer->user_map != buffer
+                                   : zero_copy;
+   for (i = 0; i < ARRAY_SIZE(osbuffer->extra_map); i++) {
+      void *map = i + 1 < (unsigned) count ? buffers[i + 1] : NULL;
+
+      if (osbuffer->extra_user_map[i] ? osbuffer->extra_user_map[i] != map
+                                      : zero_copy && map)
+         invalidate = TRUE;
+      osbuffer->extra_map[i] = map;
+   }
+   if (osbuffer->depth_user_map ?
+       osbuffer->depth_user_map != osmesa->depth_buffer :
+       osmesa->depth_buffer != NULL)
+      invalidate = TRUE;
+   osbuffer->depth_map = osmesa->depth_buffer;
+   if (invalidate)
+      p_atomic_inc(&osbuffer->stfb->stamp);
+
+   osbuffer->width = width;
+   osbuffer->height = height;
+   osbuffer->map = buffer;
+
+   osmesa->current_buffer = osbuffer;
+   osmesa->type = type;
+
+   stapi->make_current(stapi, osmesa->stctx, osbuffer->stfb, osbuffer->stfb);
+
+   if (!osmesa->ever_used) {
+      /* one-time init, just postprocessing for now */
+      boolean any_pp_enabled = FALSE;
+      unsigned i;
+
+      for (i = 0; i < ARRAY_SIZE(osmesa->pp_enabled); i++) {
+         if (osmesa->pp_enabled[i]) {
+            any_pp_enabled = TRUE;
+            break;
+         }
+      }
+
+      if (any_pp_enabled) {
+         osmesa->pp = pp_init(osmesa->stctx->pipe,
+                              osmesa->pp_enabled,
+                              osmesa->stctx->cso_context);
+
+         pp_init_fbos(osmesa->pp, width, height);
+      }
+
+      osmesa->ever_used = TRUE;
+   }
+
+   return GL_TRUE;
+}
+
+
+GLAPI GLboolean GLAPIENTRY
+OSMesaMakeCurrent(OSMesaContext osmesa, void *buffer, GLenum type,
+                  GLsizei width, GLsizei height)
+{
+   return osmesa_make_current(osmesa, 1, &buffer, type, width, height);
+}
+
+
+GLAPI GLboolean GLAPIENTRY
+OSMesaMakeCurrentBuffers(OSMesaContext osmesa, GLint count,
+                         void *const *buffers, GLenum type,
+                         GLsizei width, GLsizei height)
+{
+   if (!osmesa || !buffers || count < 1 ||
+       count > (GLint) osmesa->color_buffers)
+      return GL_FALSE;
+
+   return osmesa_make_current(osmesa, count, buffers, type, width, height);
+}
+
+
+
+GLAPI OSMesaContext GLAPIENTRY
+OSMesaGetCurrentContext(void)
+{
+   struct st_api *stapi = get_st_api();
+   struct st_context_iface *st = stapi->get_current(stapi);
+   return st ? (OSMesaContext) st->st_manager_private : NULL;
+}
+
+
+
+GLAPI void GLAPIENTRY
+OSMesaPixelStore(GLint pname, GLint value)
+{
+   OSMesaContext osmesa = OSMesaGetCurrentContext();
+
+   /* a pending glFlush may still copy to the buffer with the old layout */
+   osmesa_thread_finish();
+
+   switch (pname) {
+   case OSMESA_ROW_LENGTH:
+      osmesa->user_row_length = value;
+      break;
+   case OSMESA_Y_UP:
+      osmesa->y_up = value ? GL_TRUE : GL_FALSE;
+      break;
+   default:
+      fprintf(stderr, "Invalid pname in OSMesaPixelStore()\n");
+      return;
+   }
+
+   /* The buffer layout changed, check again whether we can render into it
+    * directly.
+    */
+   if (osmesa->zero_copy && osmesa->current_buffer)
+      p_atomic_inc(&osmesa->current_buffer->stfb->stamp);
+}
+
+
+GLAPI void GLAPIENTRY
+OSMesaGetIntegerv(GLint pname, GLint *value)
+{
+   OSMesaContext osmesa = OSMesaGetCurrentContext();
+   struct osmesa_buffer *osbuffer = osmesa ? osmesa->current_buffer : NULL;
+
+   switch (pname) {
+   case OSMESA_WIDTH:
+      *value = osbuffer ? osbuffer->width : 0;
+      return;
+   case OSMESA_HEIGHT:
+      *value = osbuffer ? osbuffer->height : 0;
+      return;
+   case OSMESA_FORMAT:
+      *value = osmesa->format;
+      return;
+   case OSMESA_TYPE:
+      /* current color buffer's data type */
+      *value = osmesa->type;
+      return;
+   case OSMESA_ROW_LENGTH:
+      *value = osmesa->user_row_length;
+      return;
+   case OSMESA_Y_UP:
+      *value = osmesa->y_up;
+      return;
+   case OSMESA_MAX_WIDTH:
+      /* fall-through */
+   case OSMESA_MAX_HEIGHT:
+      {
+         struct pipe_screen *screen = get_st_manager()->screen;
+         *value = screen->get_param(screen, PIPE_CAP_MAX_TEXTURE_2D_SIZE);
+      }
+      return;
+   default:
+      fprintf(stderr, "Invalid pname in OSMesaGetIntegerv()\n");
+      return;
+   }
+}
+
+/**
+ * Return information about the depth buffer associated with an OSMesa context.
+ * Input:  c - the OSMesa context
+ * Output:  width, height - size of buffer in pixels
+ *          bytesPerValue - bytes per depth value (2 or 4)
+ *          buffer - pointer to depth buffer values
+ * Return:  GL_TRUE or GL_FALSE to indicate success or failure.
+ */
+GLAPI GLboolean GLAPIENTRY
+OSMesaGetDepthBuffer(OSMesaContext c, GLint *width, GLint *height,
+                     GLint *bytesPerValue, void **buffer)
+{
+   struct osmesa_buffer *osbuffer = c->current_buffer;
+   struct pipe_context *pipe = c->stctx->pipe;
+   struct pipe_resource *res = osbuffer->textures[ST_ATTACHMENT_DEPTH_STENCIL];
+   struct pipe_transfer *transfer = NULL;
+   struct pipe_box box;
+
+   if (!res) {
+      return GL_FALSE;
+   }
+
+   osmesa_thread_finish();
+
+   /*
+    * Note: we can't really implement this function with gallium as
+    * we did for swrast.  We can't just map the resource and leave it
+    * mapped (and there's no OSMesaUnmapDepthBuffer() function) so
+    * we unmap the buffer here and return a 'stale' pointer.  This should
+    * actually be OK in most cases where the caller of this function
+    * immediately uses the pointer.
+    */
+
+   u_box_2d(0, 0, res->width0, res->height0, &box);
+
+   *buffer = pipe->transfer_map(pipe, res, 0, PIPE_TRANSFER_READ, &box,
+                                &transfer);
+   if (!*buffer) {
+      return GL_FALSE;
+   }
+
+   *width = res->width0;
+   *height = res->height0;
+   *bytesPerValue = util_format_get_blocksize(res->format);
+
+   pipe->transfer_unmap(pipe, transfer);
+
+   return GL_TRUE;
+}
+
+
+/**
+ * Return the color buffer associated with an OSMesa context.
+ * Input:  c - the OSMesa context
+ * Output:  width, height - size of buffer in pixels
+ *          format - the pixel format (OSMESA_FORMAT)
+ *          buffer - pointer to color buffer values
+ * Return:  GL_TRUE or GL_FALSE to indicate success or failure.
+ */
+GLAPI GLboolean GLAPIENTRY
+OSMesaGetColorBuffer(OSMesaContext osmesa, GLint *width,
+                      GLint *height, GLint *format, void **buffer)
+{
+   struct osmesa_buffer *osbuffer = osmesa->current_buffer;
+
+   osmesa_thread_finish();
+
+   if (osbuffer) {
+      *width = osbuffer->width;
+      *height = osbuffer->height;
+      *format = osmesa->format;
+      *buffer = osbuffer->map;
+      return GL_TRUE;
+   }
+   else {
+      *width = 0;
+      *height = 0;
+      *format = 0;
+      *buffer = 0;
+      return GL_FALSE;
+   }
+}
+
+
+struct name_function
+{
+   const char *Name;
+   OSMESAproc Function;
+};
+
+static struct name_function functions[] = {
+   { "OSMesaCreateContext", (OSMESAproc) OSMesaCreateContext },
+   { "OSMesaCreateContextExt", (OSMESAproc) OSMesaCreateContextExt },
+   { "OSMesaCreateContextAttribs", (OSMESAproc) OSMesaCreateContextAttribs },
+   { "OSMesaDestroyContext", (OSMESAproc) OSMesaDestroyContext },
+   { "OSMesaMakeCurrent", (OSMESAproc) OSMesaMakeCurrent },
+   { "OSMesaMakeCurrentBuffers", (OSMESAproc) OSMesaMakeCurrentBuffers },
+   { "OSMesaGetCurrentContext", (OSMESAproc) OSMesaGetCurrentContext },
+   { "OSMesaPixelStore", (OSMESAproc) OSMesaPixelStore },
+   { "OSMesaGetIntegerv", (OSMESAproc) OSMesaGetIntegerv },
+   { "OSMesaGetDepthBuffer", (OSMESAproc) OSMesaGetDepthBuffer },
+   { "OSMesaGetColorBuffer", (OSMESAproc) OSMesaGetColorBuffer },
+   { "OSMesaGetProcAddress", (OSMESAproc) OSMesaGetProcAddress },
+   { "OSMesaColorClamp", (OSMESAproc) OSMesaColorClamp },
+   { "OSMesaPostprocess", (OSMESAproc) OSMesaPostprocess },
+   { "OSMesaSwapBuffersAsync", (OSMESAproc) OSMesaSwapBuffersAsync },
+   { "OSMesaWaitFrame", (OSMESAproc) OSMesaWaitFrame },
+   { "OSMesaSaveShaderManifest", (OSMESAproc) OSMesaSaveShaderManifest },
+   { "OSMesaLoadShaderManifest", (OSMESAproc) OSMesaLoadShaderManifest },
+   { "OSMesaSaveShaderCache", (OSMESAproc) OSMesaSaveShaderCache },
+   { "OSMesaLoadShaderCache", (OSMESAproc) OSMesaLoadShaderCache },
+   { "OSMesaGetStats", (OSMESAproc) OSMesaGetStats },
+   { "OSMesaGetMemoryUsage", (OSMESAproc) OSMesaGetMemoryUsage },
+   { "OSMesaSetMemoryBudget", (OSMESAproc) OSMesaSetMemoryBudget },
+   { "OSMesaRecordHUD", (OSMESAproc) OSMesaRecordHUD },
+   { "OSMesaDestroyBuffer", (OSMESAproc) OSMesaDestroyBuffer },
+   { "OSMesaResetContext", (OSMESAproc) OSMesaResetContext },
+   { "OSMesaDepthBuffer", (OSMESAproc) OSMesaDepthBuffer },
+   { "OSMesaGetDirtyRegion", (OSMESAproc) OSMesaGetDirtyRegion },
+   { "OSMesaCreateSharedBuffer", (OSMESAproc) OSMesaCreateSharedBuffer },
+   { "OSMesaDestroySharedBuffer", (OSMESAproc) OSMesaDestroySharedBuffer },
+   { NULL, NULL }
+};
+
+
+GLAPI OSMESAproc GLAPIENTRY
+OSMesaGetProcAddress(const char *funcName)
+{
+   int i;
+   for (i = 0; functions[i].Name; i++) {
+      if (strcmp(functions[i].Name, funcName) == 0)
+         return functions[i].Function;
+   }
+   return _glapi_get_proc_address(funcName);
+}
+
+
+GLAPI void GLAPIENTRY
+OSMesaColorClamp(GLboolean enable)
+{
+   extern void GLAPIENTRY _mesa_ClampColor(GLenum target, GLenum clamp);
+
+   osmesa_thread_finish();
+   _mesa_ClampColor(GL_CLAMP_FRAGMENT_COLOR_ARB,
+                    enable ? GL_TRUE : GL_FIXED_ONLY_ARB);
+}
+
+
+GLAPI void GLAPIENTRY
+OSMesaPostprocess(OSMesaContext osmesa, const char *filter,
+                  unsigned enable_value)
+{
+   if (!osmesa->ever_used) {
+      /* We can only enable/disable postprocess filters before a context
+       * is made current for the first time.
+       */
+      unsigned i;
+
+      for (i = 0; i < PP_FILTERS; i++) {
+         if (strcmp(pp_filters[i].name, filter) == 0) {
+            osmesa->pp_enabled[i] = enable_value;
+            return;
+         }
+      }
+      debug_warning("OSMesaPostprocess(unknown filter)\n");
+   }
+   else {
+      debug_warning("Calling OSMesaPostprocess() after OSMesaMakeCurrent()\n");
+   }
+}
+
+
+/**
+ * Submit the rendering done into the current buffer without waiting for
+ * it and make next_buffer (with the same type and size) current.
+ * The returned frame must be passed to OSMesaWaitFrame() before the
+ * previous buffer's contents can be used.
+ */
+GLAPI OSMesaFrame GLAPIENTRY
+OSMesaSwapBuffersAsync(OSMesaContext osmesa, void *next_buffer)
+{
+   struct osmesa_buffer *osbuffer;
+   struct osmesa_frame *frame;
+   struct pipe_resource *res;
+
+   if (!osmesa || !next_buffer || !osmesa->current_buffer)
+      return NULL;
+
+   osbuffer = osmesa->current_buffer;
+   res = osbuffer->textures[ST_ATTACHMENT_FRONT_LEFT];
+   if (!res || osbuffer->key.color_buffers > 1)
+      return NULL;
+
+   frame = CALLOC_STRUCT(osmesa_frame);
+   if (!frame)
+      return NULL;
+
+   osmesa_thread_finish();
+   osmesa_postprocess(osmesa, osbuffer, res);
+
+   /* Copy to the user's buffer as part of the frame, while the rasterizer
+    * threads are at it, rather than in OSMesaWaitFrame().
+    */
+   if (osbuffer->user_map != osbuffer->map &&
+       osmesa_queue_copy_to_user(osmesa->stctx->pipe, res, NULL,
+                                 osbuffer->key.user_format, osbuffer->map,
+                                 osmesa_user_stride(osmesa, osbuffer),
+                                 osmesa->y_up))
+      res = NULL;
+
+   osmesa->stctx->flush(osmesa->stctx, ST_FLUSH_END_OF_FRAME, &frame->fence,
+                        NULL, NULL);
+
+   frame->buffer = osbuffer;
+   frame->map = osbuffer->map;
+   /* Copied in full, the next flush to it too */
+   osbuffer->synced_map = NULL;
+   frame->y_up = osmesa->y_up;
+   if (res && osbuffer->user_map != osbuffer->map) {
+      pipe_resource_reference(&frame->color, res);
+      frame->format = osbuffer->key.user_format;
+      frame->stride = osmesa_user_stride(osmesa, osbuffer);
+   }
+   simple_mtx_lock(&BufferMutex);
+   osbuffer->pending_frames++;
+   simple_mtx_unlock(&BufferMutex);
+
+   OSMesaMakeCurrent(osmesa, next_buffer, osmesa->type,
+                     osbuffer->width, osbuffer->height);
+
+   return frame;
+}
+
+
+/**
+ * Wait up to timeout nanoseconds for a frame returned by
+ * OSMesaSwapBuffersAsync() and make its contents available in the user's
+ * buffer.  Returns GL_FALSE on timeout, in which case the frame is still
+ * pending, and GL_TRUE once the frame is done and has been released.
+ */
+GLAPI GLboolean GLAPIENTRY
+OSMesaWaitFrame(OSMesaContext osmesa, OSMesaFrame frame, GLuint64 timeout)
+{
+   struct pipe_context *pipe;
+   struct pipe_screen *screen;
+   struct osmesa_shared *shared;
+
+   if (!osmesa || !frame)
+      return GL_FALSE;
+
+   pipe = osmesa->stctx->pipe;
+   screen = pipe->screen;
+
+   if (frame->fence &&
+       !screen->fence_finish(screen, NULL, frame->fence, timeout))
+      return GL_FALSE;
+
+   if (frame->color) {
+      osmesa_copy_to_user(pipe, frame->color, NULL, frame->format, frame->map,
+                          frame->stride, frame->y_up);
+      pipe_resource_reference(&frame->color, NULL);
+   }
+
+   screen->fence_reference(screen, &frame->fence, NULL);
+   simple_mtx_lock(&BufferMutex);
+   /* Swapped frames are copied in full */
+   shared = osmesa_find_shared(frame->map);
+   if (shared) {
+      struct pipe_box box;
+
+      u_box_2d(0, 0, shared->header->width, shared->header->height, &box);
+      osmesa_publish_shared(shared, &box, frame->y_up);
+   }
+   frame->buffer->pending_frames--;
+   simple_mtx_unlock(&BufferMutex);
+   FREE(frame);
 
-/**********************************************************************/
-/*****                    Public Functions                        *****/
-/**********************************************************************/
+   return GL_TRUE;
+}
 
 
-/**
- * Create an Off-Screen Mesa rendering context.  The only attribute needed is
- * an RGBA vs Color-Index mode flag.
- *
- * Input:  format - Must be GL_RGBA
- *         sharelist - specifies another OSMesaContext with which to share
- *                     display lists.  NULL indicates no sharing.
- * Return:  an OSMesaContext or 0 if error
- */
-GLAPI OSMesaContext GLAPIENTRY
-OSMesaCreateContext(GLenum format, OSMesaContext sharelist)
+GLAPI GLboolean GLAPIENTRY
+OSMesaSaveShaderManifest(const char *filename)
 {
-   return OSMesaCreateContextExt(format, 24, 8, 0, sharelist);
+   struct st_manager *mgr = get_st_manager();
+   struct pipe_screen *screen = mgr ? mgr->screen : NULL;
+
+   if (!filename || !screen || !screen->save_shader_manifest)
+      return GL_FALSE;
+
+   return screen->save_shader_manifest(screen, filename) ? GL_TRUE : GL_FALSE;
 }
 
 
-/**
- * New in Mesa 3.5
- *
- * Create context and specify size of ancillary buffers.
- */
-GLAPI OSMesaContext GLAPIENTRY
-OSMesaCreateContextExt(GLenum format, GLint depthBits, GLint stencilBits,
-                       GLint accumBits, OSMesaContext sharelist)
+GLAPI GLboolean GLAPIENTRY
+OSMesaLoadShaderManifest(const char *filename)
 {
-   int attribs[100], n = 0;
+   struct st_manager *mgr = get_st_manager();
+   struct pipe_screen *screen = mgr ? mgr->screen : NULL;
 
-   attribs[n++] = OSMESA_FORMAT;
-   attribs[n++] = format;
-   attribs[n++] = OSMESA_DEPTH_BITS;
-   attribs[n++] = depthBits;
-   attribs[n++] = OSMESA_STENCIL_BITS;
-   attribs[n++] = stencilBits;
-   attribs[n++] = OSMESA_ACCUM_BITS;
-   attribs[n++] = accumBits;
-   attribs[n++] = 0;
+   if (!filename || !screen || !screen->load_shader_manifest)
+      return GL_FALSE;
 
-   return OSMesaCreateContextAttribs(attribs, sharelist);
+   return screen->load_shader_manifest(screen, filename) ? GL_TRUE : GL_FALSE;
 }
 
 
-/**
- * New in Mesa 11.2
- *
- * Create context with attribute list.
- */
-GLAPI OSMesaContext GLAPIENTRY
-OSMesaCreateContextAttribs(const int *attribList, OSMesaContext sharelist)
+GLAPI GLboolean GLAPIENTRY
+OSMesaSaveShaderCache(const char *filename)
 {
-   OSMesaContext osmesa;
-   struct st_context_iface *st_shared;
-   enum st_context_error st_error = 0;
-   struct st_context_attribs attribs;
-   struct st_api *stapi = get_st_api();
-   GLenum format = GL_RGBA;
-   int depthBits = 0, stencilBits = 0, accumBits = 0;
-   int profile = OSMESA_COMPAT_PROFILE, version_major = 1, version_minor = 0;
-   int i;
+   struct st_manager *mgr = get_st_manager();
+   struct pipe_screen *screen = mgr ? mgr->screen : NULL;
+   size_t size;
+   void *data;
+   FILE *f;
+   bool ok;
+
+   if (!filename || !screen || !screen->get_shader_cache_data)
+      return GL_FALSE;
 
-   if (sharelist) {
-      st_shared = sharelist->stctx;
-   }
-   else {
-      st_shared = NULL;
-   }
+   /* Code may be compiled meanwhile, which only leaves it out */
+   size = screen->get_shader_cache_data(screen, NULL, 0);
+   if (!size)
+      return GL_FALSE;
 
-   for (i = 0; attribList[i]; i += 2) {
-      switch (attribList[i]) {
-      case OSMESA_FORMAT:
-         format = attribList[i+1];
-         switch (format) {
-         case OSMESA_COLOR_INDEX:
-         case OSMESA_RGBA:
-         case OSMESA_BGRA:
-         case OSMESA_ARGB:
-         case OSMESA_RGB:
-         case OSMESA_BGR:
-         case OSMESA_RGB_565:
-            /* legal */
-            break;
-         default:
-            return NULL;
-         }
-         break;
-      case OSMESA_DEPTH_BITS:
-         depthBits = attribList[i+1];
-         if (depthBits < 0)
-            return NULL;
-         break;
-      case OSMESA_STENCIL_BITS:
-         stencilBits = attribList[i+1];
-         if (stencilBits < 0)
-            return NULL;
-         break;
-      case OSMESA_ACCUM_BITS:
-         accumBits = attribList[i+1];
-         if (accumBits < 0)
-            return NULL;
-         break;
-      case OSMESA_PROFILE:
-         profile = attribList[i+1];
-         if (profile != OSMESA_CORE_PROFILE &&
-             profile != OSMESA_COMPAT_PROFILE)
-            return NULL;
-         break;
-      case OSMESA_CONTEXT_MAJOR_VERSION:
-         version_major = attribList[i+1];
-         if (version_major < 1)
-            return NULL;
-         break;
-      case OSMESA_CONTEXT_MINOR_VERSION:
-         version_minor = attribList[i+1];
-         if (version_minor < 0)
-            return NULL;
-         break;
-      case 0:
-         /* end of list */
-         break;
-      default:
-         fprintf(stderr, "Bad attribute in OSMesaCreateContextAttribs()\n");
-         return NULL;
-      }
-   }
+   data = malloc(size);
+   if (!data)
+      return GL_FALSE;
 
-   osmesa = (OSMesaContext) CALLOC_STRUCT(osmesa_context);
-   if (!osmesa)
-      return NULL;
+   size = screen->get_shader_cache_data(screen, data, size);
 
-   /* Choose depth/stencil/accum buffer formats */
-   if (accumBits > 0) {
-      osmesa->accum_format = PIPE_FORMAT_R16G16B16A16_SNORM;
-   }
-   if (depthBits > 0 && stencilBits > 0) {
-      osmesa->depth_stencil_format = PIPE_FORMAT_Z24_UNORM_S8_UINT;
-   }
-   else if (stencilBits > 0) {
-      osmesa->depth_stencil_format = PIPE_FORMAT_S8_UINT;
-   }
-   else if (depthBits >= 24) {
-      osmesa->depth_stencil_format = PIPE_FORMAT_Z24X8_UNORM;
-   }
-   else if (depthBits >= 16) {
-      osmesa->depth_stencil_format = PIPE_FORMAT_Z16_UNORM;
-   }
+   f = fopen(filename, "wb");
+   ok = f && size && fwrite(data, 1, size, f) == size;
+   if (f && fclose(f) != 0)
+      ok = false;
 
-   /*
-    * Create the rendering context
-    */
-   memset(&attribs, 0, sizeof(attribs));
-   attribs.profile = (profile == OSMESA_CORE_PROFILE)
-      ? ST_PROFILE_OPENGL_CORE : ST_PROFILE_DEFAULT;
-   attribs.major = version_major;
-   attribs.minor = version_minor;
-   attribs.flags = 0;  /* ST_CONTEXT_FLAG_x */
-   attribs.options.force_glsl_extensions_warn = FALSE;
-   attribs.options.disable_blend_func_extended = FALSE;
-   attribs.options.disable_glsl_line_continuations = FALSE;
-   attribs.options.force_glsl_version = 0;
-
-   osmesa_init_st_visual(&attribs.visual,
-                         PIPE_FORMAT_NONE,
-                         osmesa->depth_stencil_format,
-                         osmesa->accum_format);
+   free(data);
+   return ok ? GL_TRUE : GL_FALSE;
+}
 
-   osmesa->stctx = stapi->create_context(stapi, get_st_manager(),
-                                         &attribs, &st_error, st_shared);
-   if (!osmesa->stctx) {
-      FREE(osmesa);
-      return NULL;
-   }
 
-   osmesa->stctx->st_manager_private = osmesa;
+GLAPI GLboolean GLAPIENTRY
+OSMesaLoadShaderCache(const char *filename)
+{
+   struct st_manager *mgr = get_st_manager();
+   struct pipe_screen *screen = mgr ? mgr->screen : NULL;
+   size_t size;
+   char *data;
+   bool ok;
 
-   osmesa->format = format;
-   osmesa->user_row_length = 0;
-   osmesa->y_up = GL_TRUE;
+   if (!filename || !screen || !screen->add_shader_cache_data)
+      return GL_FALSE;
 
-   return osmesa;
-}
+   data = os_read_file(filename, &size);
+   if (!data)
+      return GL_FALSE;
+
+   ok = screen->add_shader_cache_data(screen, data, size);
 
+   free(data);
+   return ok ? GL_TRUE : GL_FALSE;
+}
 
 
 /**
- * Destroy an Off-Screen Mesa rendering context.
- *
- * \param osmesa  the context to destroy
+ * Read the current value of a driver query.  The query is never begun,
+ * so it reports the absolute value.
  */
-GLAPI void GLAPIENTRY
-OSMesaDestroyContext(OSMesaContext osmesa)
+static GLboolean
+osmesa_read_driver_query(struct pipe_context *pipe, unsigned query_type,
+                         GLuint64 *value)
 {
-   if (osmesa) {
-      pp_free(osmesa->pp);
-      // We shoudn't destroy the stctx, because that
-      // frees the memory for the osbuffer,
-      // and the osbuffer is still in the BufferLizt so may be reused.
-      // TODO: does this cause a space leak?
-      // osmesa->stctx->destroy(osmesa->stctx);
-      FREE(osmesa);
-   }
+   struct pipe_query *query;
+   union pipe_query_result result;
+   bool ok;
+
+   query = pipe->create_query(pipe, query_type, 0);
+   if (!query)
+      return GL_FALSE;
+
+   osmesa_thread_finish();
+   pipe->end_query(pipe, query);
+   ok = pipe->get_query_result(pipe, query, true, &result);
+   pipe->destroy_query(pipe, query);
+
+   if (!ok)
+      return GL_FALSE;
+
+   *value = result.u64;
+   return GL_TRUE;
 }
 
 
 /**
- * Bind an OSMesaContext to an image buffer.  The image buffer is just a
- * block of memory which the client provides.  Its size must be at least
- * as large as width*height*pixelSize.  Its address should be a multiple
- * of 4 if using RGBA mode.
- *
- * By default, image data is stored in the order of glDrawPixels: row-major
- * order with the lower-left image pixel stored in the first array position
- * (ie. bottom-to-top).
- *
- * If the context's viewport hasn't been initialized yet, it will now be
- * initialized to (0,0,width,height).
- *
- * Input:  osmesa - the rendering context
- *         buffer - the image buffer memory
- *         type - data type for pixel components
- *                GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT_5_6_5, GL_UNSIGNED_SHORT
- *                or GL_FLOAT.
- *         width, height - size of image buffer in pixels, at least 1
- * Return:  GL_TRUE if success, GL_FALSE if error because of invalid osmesa,
- *          invalid type, invalid size, etc.
+ * Read the driver query of the given name.
  */
-GLAPI GLboolean GLAPIENTRY
-OSMesaMakeCurrent(OSMesaContext osmesa, void *buffer, GLenum type,
-                  GLsizei width, GLsizei height)
+static GLboolean
+osmesa_read_named_driver_query(struct pipe_context *pipe, const char *name,
+                               GLuint64 *value)
 {
-   struct st_api *stapi = get_st_api();
-   struct osmesa_buffer *osbuffer;
-   enum pipe_format color_format;
+   struct pipe_screen *screen = pipe->screen;
+   struct pipe_driver_query_info info;
+   unsigned i;
 
-   if (!osmesa && !buffer) {
-      stapi->make_current(stapi, NULL, NULL, NULL);
-      return GL_TRUE;
-   }
-
-   if (!osmesa || !buffer || width < 1 || height < 1) {
+   if (!screen->get_driver_query_info)
       return GL_FALSE;
-   }
 
-   color_format = osmesa_choose_format(osmesa->format, type);
-   if (color_format == PIPE_FORMAT_NONE) {
-      fprintf(stderr, "OSMesaMakeCurrent(unsupported format/type)\n");
-      return GL_FALSE;
+   for (i = 0; screen->get_driver_query_info(screen, i, &info); i++) {
+      if (strcmp(info.name, name) == 0)
+         return osmesa_read_driver_query(pipe, info.query_type, value);
    }
+   return GL_FALSE;
+}
 
-   /* See if we already have a buffer that uses these pixel formats */
-   osbuffer = osmesa_find_buffer(color_format,
-                                 osmesa->depth_stencil_format,
-                                 osmesa->accum_format, width, height);
-   if (!osbuffer) {
-      /* Existing buffer found, create new buffer */
-      osbuffer = osmesa_create_buffer(color_format,
-                                      osmesa->depth_stencil_format,
-                                      osmesa->accum_format);
-   }
 
-   osbuffer->width = width;
-   osbuffer->height = height;
-   osbuffer->map = buffer;
+GLAPI GLboolean GLAPIENTRY
+OSMesaGetStats(OSMesaContext osmesa, GLuint index,
+               const char **name, GLuint64 *value)
+{
+   struct pipe_context *pipe;
+   struct pipe_screen *screen;
+   struct pipe_driver_query_info info;
 
-   /* XXX unused for now */
-   (void) osmesa_destroy_buffer;
+   if (!osmesa)
+      return GL_FALSE;
 
-   osmesa->current_buffer = osbuffer;
-   osmesa->type = type;
+   pipe = osmesa->stctx->pipe;
+   screen = pipe->screen;
+   if (!screen->get_driver_query_info ||
+       !screen->get_driver_query_info(screen, index, &info))
+      return GL_FALSE;
 
-   stapi->make_current(stapi, osmesa->stctx, osbuffer->stfb, osbuffer->stfb);
+   if (name)
+      *name = info.name;
+   if (!value)
+      return GL_TRUE;
 
-   if (!osmesa->ever_used) {
-      /* one-time init, just postprocessing for now */
-      boolean any_pp_enabled = FALSE;
-      unsigned i;
+   return osmesa_read_driver_query(pipe, info.query_type, value);
+}
 
-      for (i = 0; i < ARRAY_SIZE(osmesa->pp_enabled); i++) {
-         if (osmesa->pp_enabled[i]) {
-            any_pp_enabled = TRUE;
-            break;
-         }
-      }
 
-      if (any_pp_enabled) {
-         osmesa->pp = pp_init(osmesa->stctx->pipe,
-                              osmesa->pp_enabled,
-                              osmesa->stctx->cso_context);
+GLAPI GLboolean GLAPIENTRY
+OSMesaGetMemoryUsage(OSMesaContext osmesa, GLuint64 *context_bytes,
+                     GLuint64 *screen_bytes)
+{
+   struct pipe_context *pipe;
 
-         pp_init_fbos(osmesa->pp, width, height);
-      }
+   if (!osmesa)
+      return GL_FALSE;
+
+   pipe = osmesa->stctx->pipe;
+
+   if (context_bytes &&
+       !osmesa_read_named_driver_query(pipe, "context-memory", context_bytes))
+      return GL_FALSE;
 
-      osmesa->ever_used = TRUE;
-   }
+   if (screen_bytes &&
+       !osmesa_read_named_driver_query(pipe, "screen-memory", screen_bytes))
+      return GL_FALSE;
 
    return GL_TRUE;
 }
 
 
-
-GLAPI OSMesaContext GLAPIENTRY
-OSMesaGetCurrentContext(void)
+GLAPI GLboolean GLAPIENTRY
+OSMesaSetMemoryBudget(OSMesaContext osmesa, GLuint64 bytes)
 {
-   struct st_api *stapi = get_st_api();
-   struct st_context_iface *st = stapi->get_current(stapi);
-   return st ? (OSMesaContext) st->st_manager_private : NULL;
-}
+   struct pipe_context *pipe;
 
+   if (!osmesa || !osmesa->stctx->pipe->set_memory_budget)
+      return GL_FALSE;
 
+   pipe = osmesa->stctx->pipe;
 
-GLAPI void GLAPIENTRY
-OSMesaPixelStore(GLint pname, GLint value)
+   osmesa_thread_finish();
+   pipe->set_memory_budget(pipe, bytes);
+   return GL_TRUE;
+}
+
+
+GLAPI GLboolean GLAPIENTRY
+OSMesaRecordHUD(OSMesaContext osmesa, const char *config,
+                OSMESAhudproc callback, void *data)
 {
-   OSMesaContext osmesa = OSMesaGetCurrentContext();
+   if (!osmesa)
+      return GL_FALSE;
 
-   switch (pname) {
-   case OSMESA_ROW_LENGTH:
-      osmesa->user_row_length = value;
-      break;
-   case OSMESA_Y_UP:
-      osmesa->y_up = value ? GL_TRUE : GL_FALSE;
-      break;
-   default:
-      fprintf(stderr, "Invalid pname in OSMesaPixelStore()\n");
-      return;
+   osmesa_thread_finish();
+
+   if (osmesa->hud) {
+      hud_destroy(osmesa->hud, NULL);
+      osmesa->hud = NULL;
    }
+
+   if (!config)
+      return GL_TRUE;
+
+   osmesa->hud = hud_create_headless(osmesa->stctx->pipe, config);
+   if (!osmesa->hud)
+      return GL_FALSE;
+
+   hud_set_value_callback(osmesa->hud, (hud_value_callback) callback, data);
+   return GL_TRUE;
 }
 
 
 GLAPI void GLAPIENTRY
-OSMesaGetIntegerv(GLint pname, GLint *value)
+OSMesaDestroyBuffer(void *buffer)
 {
-   OSMesaContext osmesa = OSMesaGetCurrentContext();
-   struct osmesa_buffer *osbuffer = osmesa ? osmesa->current_buffer : NULL;
+   struct osmesa_buffer *b, *next;
 
-   switch (pname) {
-   case OSMESA_WIDTH:
-      *value = osbuffer ? osbuffer->width : 0;
-      return;
-   case OSMESA_HEIGHT:
-      *value = osbuffer ? osbuffer->height : 0;
-      return;
-   case OSMESA_FORMAT:
-      *value = osmesa->format;
-      return;
-   case OSMESA_TYPE:
-      /* current color buffer's data type */
-      *value = osmesa->type;
-      return;
-   case OSMESA_ROW_LENGTH:
-      *value = osmesa->user_row_length;
-      return;
-   case OSMESA_Y_UP:
-      *value = osmesa->y_up;
-      return;
-   case OSMESA_MAX_WIDTH:
-      /* fall-through */
-   case OSMESA_MAX_HEIGHT:
-      {
-         struct pipe_screen *screen = get_st_manager()->screen;
-         *value = screen->get_param(screen, PIPE_CAP_MAX_TEXTURE_2D_SIZE);
-      }
-      return;
-   default:
-      fprintf(stderr, "Invalid pname in OSMesaGetIntegerv()\n");
-      return;
+   /* Queued calls may still render to it */
+   osmesa_thread_finish();
+
+   simple_mtx_lock(&BufferMutex);
+   LIST_FOR_EACH_ENTRY_SAFE(b, next, &BufferLRU, lru) {
+      if ((!buffer || b->map == buffer) && osmesa_buffer_is_idle(b))
+         osmesa_destroy_buffer(b);
    }
+   simple_mtx_unlock(&BufferMutex);
 }
 
-/**
- * Return information about the depth buffer associated with an OSMesa context.
- * Input:  c - the OSMesa context
- * Output:  width, height - size of buffer in pixels
- *          bytesPerValue - bytes per depth value (2 or 4)
- *          buffer - pointer to depth buffer values
- * Return:  GL_TRUE or GL_FALSE to indicate success or failure.
- */
+
 GLAPI GLboolean GLAPIENTRY
-OSMesaGetDepthBuffer(OSMesaContext c, GLint *width, GLint *height,
-                     GLint *bytesPerValue, void **buffer)
+OSMesaResetContext(OSMesaContext osmesa)
 {
-   struct osmesa_buffer *osbuffer = c->current_buffer;
-   struct pipe_context *pipe = c->stctx->pipe;
-   struct pipe_resource *res = osbuffer->textures[ST_ATTACHMENT_DEPTH_STENCIL];
-   struct pipe_transfer *transfer = NULL;
-   struct pipe_box box;
-
-   if (!res) {
+   struct osmesa_buffer *osbuffer;
+   struct pipe_context *pipe;
+   GLboolean current;
+   void *maps[OSMESA_MAX_COLOR_BUFFERS] = { NULL };
+   GLsizei width = 0, height = 0;
+   unsigned i;
+
+   if (!osmesa || !osmesa->stctx || !osmesa->stctx->release_pipe ||
+       osmesa->shared)
       return GL_FALSE;
+
+   current = OSMesaGetCurrentContext() == osmesa;
+   if (current)
+      osmesa_thread_finish();
+
+   osbuffer = osmesa->current_buffer;
+   if (osbuffer) {
+      maps[0] = osbuffer->map;
+      for (i = 1; i < osmesa->color_buffers; i++)
+         maps[i] = osbuffer->extra_map[i - 1];
+      width = osbuffer->width;
+      height = osbuffer->height;
    }
+   osmesa_unbind_buffer(osmesa);
 
-   /*
-    * Note: we can't really implement this function with gallium as
-    * we did for swrast.  We can't just map the resource and leave it
-    * mapped (and there's no OSMesaUnmapDepthBuffer() function) so
-    * we unmap the buffer here and return a 'stale' pointer.  This should
-    * actually be OK in most cases where the caller of this function
-    * immediately uses the pointer.
-    */
+   /* Recreated with the new cso context by the next OSMesaMakeCurrent() */
+   pp_free(osmesa->pp);
+   osmesa->pp = NULL;
+   osmesa->ever_used = FALSE;
 
-   u_box_2d(0, 0, res->width0, res->height0, &box);
+   osmesa->user_row_length = 0;
+   osmesa->y_up = GL_TRUE;
 
-   *buffer = pipe->transfer_map(pipe, res, 0, PIPE_TRANSFER_READ, &box,
-                                &transfer);
-   if (!*buffer) {
+   pipe = osmesa->stctx->release_pipe(osmesa->stctx);
+   osmesa->stctx = osmesa_create_st_context(osmesa, NULL, pipe);
+   if (!osmesa->stctx)
       return GL_FALSE;
-   }
 
-   *width = res->width0;
-   *height = res->height0;
-   *bytesPerValue = util_format_get_blocksize(res->format);
+   if (current && maps[0])
+      return osmesa_make_current(osmesa, osmesa->color_buffers, maps,
+                                 osmesa->type, width, height);
+   return GL_TRUE;
+}
 
-   pipe->transfer_unmap(pipe, transfer);
 
+GLAPI GLboolean GLAPIENTRY
+OSMesaGetDirtyRegion(OSMesaContext osmesa, GLint *x, GLint *y,
+                     GLint *width, GLint *height)
+{
+   struct osmesa_buffer *osbuffer;
+
+   if (!osmesa || !osmesa->current_buffer)
+      return GL_FALSE;
+
+   osbuffer = osmesa->current_buffer;
+   *x = osbuffer->dirty.x;
+   *width = osbuffer->dirty.width;
+   *height = osbuffer->dirty.height;
+   /* In the rows of the user's buffer, which are flipped with Y up */
+   if (osmesa->y_up && osbuffer->dirty.height)
+      *y = osbuffer->height - osbuffer->dirty.y - osbuffer->dirty.height;
+   else
+      *y = osbuffer->dirty.y;
    return GL_TRUE;
 }
 
 
-/**
- * Return the color buffer associated with an OSMesa context.
- * Input:  c - the OSMesa context
- * Output:  width, height - size of buffer in pixels
- *          format - the pixel format (OSMESA_FORMAT)
- *          buffer - pointer to color buffer values
- * Return:  GL_TRUE or GL_FALSE to indicate success or failure.
- */
 GLAPI GLboolean GLAPIENTRY
-OSMesaGetColorBuffer(OSMesaContext osmesa, GLint *width,
-                      GLint *height, GLint *format, void **buffer)
+OSMesaDepthBuffer(OSMesaContext osmesa, void *buffer)
 {
-   struct osmesa_buffer *osbuffer = osmesa->current_buffer;
+   struct osmesa_buffer *osbuffer;
 
-   if (osbuffer) {
-      *width = osbuffer->width;
-      *height = osbuffer->height;
-      *format = osmesa->format;
-      *buffer = osbuffer->map;
-      return GL_TRUE;
-   }
-   else {
-      *width = 0;
-      *height = 0;
-      *format = 0;
-      *buffer = 0;
+   if (!osmesa || osmesa->depth_stencil_format == PIPE_FORMAT_NONE)
       return GL_FALSE;
+
+   osmesa->depth_buffer = buffer;
+
+   /* Rendering so far is to the old depth buffer */
+   osbuffer = osmesa->current_buffer;
+   if (osbuffer && OSMesaGetCurrentContext() == osmesa) {
+      osmesa_thread_finish();
+      osbuffer->depth_map = buffer;
+      if (osbuffer->depth_user_map != buffer)
+         p_atomic_inc(&osbuffer->stfb->stamp);
    }
+   return GL_TRUE;
 }
 
 
-struct name_function
+GLAPI void * GLAPIENTRY
+OSMesaCreateSharedBuffer(OSMesaContext osmesa, GLenum type,
+                         GLsizei width, GLsizei height, int *fd)
 {
-   const char *Name;
-   OSMESAproc Function;
-};
+#ifndef _WIN32
+   struct osmesa_shared *shared;
+   OSMesaSharedHeader *header;
+   enum pipe_format format;
+   uint64_t stride, offset, size;
+   void *mapping;
+   int file;
+
+   if (!osmesa || width < 1 || height < 1)
+      return NULL;
 
-static struct name_function functions[] = {
-   { "OSMesaCreateContext", (OSMESAproc) OSMesaCreateContext },
-   { "OSMesaCreateContextExt", (OSMESAproc) OSMesaCreateContextExt },
-   { "OSMesaCreateContextAttribs", (OSMESAproc) OSMesaCreateContextAttribs },
-   { "OSMesaDestroyContext", (OSMESAproc) OSMesaDestroyContext },
-   { "OSMesaMakeCurrent", (OSMESAproc) OSMesaMakeCurrent },
-   { "OSMesaGetCurrentContext", (OSMESAproc) OSMesaGetCurrentContext },
-   { "OSMesaPixelStore", (OSMESAproc) OSMesaPixelStore },
-   { "OSMesaGetIntegerv", (OSMESAproc) OSMesaGetIntegerv },
-   { "OSMesaGetDepthBuffer", (OSMESAproc) OSMesaGetDepthBuffer },
-   { "OSMesaGetColorBuffer", (OSMESAproc) OSMesaGetColorBuffer },
-   { "OSMesaGetProcAddress", (OSMESAproc) OSMesaGetProcAddress },
-   { "OSMesaColorClamp", (OSMESAproc) OSMesaColorClamp },
-   { "OSMesaPostprocess", (OSMESAproc) OSMesaPostprocess },
-   { NULL, NULL }
-};
+   format = osmesa_choose_format(osmesa->format, type);
+   if (format == PIPE_FORMAT_NONE)
+      return NULL;
 
+   /* Rows as the driver lays out resources on user memory, so that it
+    * renders in place, the image page aligned so that it can be mapped
+    * on its own.
+    */
+   stride = align(align(width, 4) * util_format_get_blocksize(format), 16);
+   offset = align(sizeof(OSMesaSharedHeader), 4096);
+   size = offset + stride * align(height, 4);
+   if (stride > UINT_MAX || size > SIZE_MAX)
+      return NULL;
 
-GLAPI OSMESAproc GLAPIENTRY
-OSMesaGetProcAddress(const char *funcName)
-{
-   int i;
-   for (i = 0; functions[i].Name; i++) {
-      if (strcmp(functions[i].Name, funcName) == 0)
-         return functions[i].Function;
+   shared = CALLOC_STRUCT(osmesa_shared);
+   if (!shared)
+      return NULL;
+
+   file = os_create_anonymous_file(size, "osmesa-shared");
+   if (file < 0) {
+      FREE(shared);
+      return NULL;
    }
-   return _glapi_get_proc_address(funcName);
+
+   mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+   if (mapping == MAP_FAILED) {
+      close(file);
+      FREE(shared);
+      return NULL;
+   }
+
+   /* The file starts zeroed, sequence and dirty with it */
+   header = mapping;
+   header->magic = OSMESA_SHARED_MAGIC;
+   header->offset = offset;
+   header->stride = stride;
+   header->width = width;
+   header->height = height;
+   header->format = osmesa->format;
+   header->type = type;
+   header->y_up = osmesa->y_up;
+
+   shared->header = header;
+   shared->image = (uint8_t *) mapping + offset;
+   shared->size = size;
+   shared->fd = file;
+
+   simple_mtx_lock(&BufferMutex);
+   list_add(&shared->link, &SharedBuffers);
+   simple_mtx_unlock(&BufferMutex);
+
+   if (fd)
+      *fd = file;
+   return shared->image;
+#else
+   return NULL;
+#endif
 }
 
 
 GLAPI void GLAPIENTRY
-OSMesaColorClamp(GLboolean enable)
+OSMesaDestroySharedBuffer(void *buffer)
 {
-   extern void GLAPIENTRY _mesa_ClampColor(GLenum target, GLenum clamp);
+#ifndef _WIN32
+   struct osmesa_shared *shared;
+   struct osmesa_buffer *b;
 
-   _mesa_ClampColor(GL_CLAMP_FRAGMENT_COLOR_ARB,
-                    enable ? GL_TRUE : GL_FIXED_ONLY_ARB);
+   if (!buffer)
+      return;
+
+   /* The cached buffers wrapping it */
+   OSMesaDestroyBuffer(buffer);
+
+   simple_mtx_lock(&BufferMutex);
+   shared = osmesa_find_shared(buffer);
+   if (shared) {
+      list_del(&shared->link);
+      LIST_FOR_EACH_ENTRY(b, &BufferLRU, lru) {
+         if (b->shared == shared)
+            b->shared = NULL;
+      }
+   }
+   simple_mtx_unlock(&BufferMutex);
+
+   if (!shared)
+      return;
+
+   munmap(shared->header, shared->size);
+   close(shared->fd);
+   FREE(shared);
+#endif
 }
 
 
-GLAPI void GLAPIENTRY
-OSMesaPostprocess(OSMesaContext osmesa, const char *filter,
-                  unsigned enable_value)
+GLAPI GLboolean GLAPIENTRY
+OSMesaRenderRegions(OSMesaContext osmesa, void *buffer, GLenum type,
+                    GLsizei width, GLsizei height,
+                    GLsizei regionWidth, GLsizei regionHeight,
+                    OSMESAdrawproc draw, OSMESAregionproc region_done,
+                    void *data)
 {
-   if (!osmesa->ever_used) {
-      /* We can only enable/disable postprocess filters before a context
-       * is made current for the first time.
-       */
-      unsigned i;
+   extern GLuint GLAPIENTRY _mesa_GenLists(GLsizei range);
+   extern void GLAPIENTRY _mesa_NewList(GLuint name, GLenum mode);
+   extern void GLAPIENTRY _mesa_EndList(void);
+   extern void GLAPIENTRY _mesa_CallList(GLuint list);
+   extern void GLAPIENTRY _mesa_DeleteLists(GLuint list, GLsizei range);
+   float scale[2], translate[2];
+   GLboolean record, first = GL_TRUE, ret = GL_TRUE;
+   GLuint list = 0;
+   GLint x, y;
+
+   if (!osmesa || !buffer || !draw || !region_done ||
+       width < 1 || height < 1 || regionWidth < 1 || regionHeight < 1 ||
+       !osmesa->stctx->set_window_transform)
+      return GL_FALSE;
 
-      for (i = 0; i < PP_FILTERS; i++) {
-         if (strcmp(pp_filters[i].name, filter) == 0) {
-            osmesa->pp_enabled[i] = enable_value;
-            return;
+   regionWidth = MIN2(regionWidth, width);
+   regionHeight = MIN2(regionHeight, height);
+
+   /* The regionWidth x regionHeight window draw renders to, stretched */
+   scale[0] = (float) width / regionWidth;
+   scale[1] = (float) height / regionHeight;
+
+   /* Display lists are only in the compatibility profile, and glthread
+    * would have to be synced around our calls of them.
+    */
+   record = osmesa->attribs.profile == ST_PROFILE_DEFAULT &&
+            !osmesa->threaded;
+
+   for (y = 0; y < height && ret; y += regionHeight) {
+      for (x = 0; x < width; x += regionWidth) {
+         const GLsizei w = MIN2(regionWidth, width - x);
+         const GLsizei h = MIN2(regionHeight, height - y);
+
+         if (!OSMesaMakeCurrent(osmesa, buffer, type, w, h)) {
+            ret = GL_FALSE;
+            break;
+         }
+
+         translate[0] = (float) -x;
+         translate[1] = (float) -y;
+         osmesa_thread_finish();
+         osmesa->stctx->set_window_transform(osmesa->stctx,
+                                             scale, translate);
+
+         if (first) {
+            list = record ? _mesa_GenLists(1) : 0;
+            if (list)
+               _mesa_NewList(list, GL_COMPILE_AND_EXECUTE);
+            draw(data);
+            if (list)
+               _mesa_EndList();
+            first = GL_FALSE;
+         }
+         else if (list) {
+            _mesa_CallList(list);
          }
+         else {
+            draw(data);
+         }
+
+         /* Copies the region to buffer and waits for it */
+         osmesa_thread_finish();
+         osmesa->stctx->flush(osmesa->stctx, ST_FLUSH_FRONT,
+                              NULL, NULL, NULL);
+
+         region_done(data, x, y, w, h);
       }
-      debug_warning("OSMesaPostprocess(unknown filter)\n");
-   }
-   else {
-      debug_warning("Calling OSMesaPostprocess() after OSMesaMakeCurrent()\n");
    }
+
+   osmesa_thread_finish();
+   if (list)
+      _mesa_DeleteLists(list, 1);
+   osmesa->stctx->set_window_transform(osmesa->stctx, NULL, NULL);
+
+   return ret;
+}
+
+
+GLAPI GLboolean GLAPIENTRY
+OSMesaProgressCallback(OSMesaContext osmesa, OSMESAprogressproc func,
+                       void *data)
+{
+   struct osmesa_buffer *osbuffer;
+   struct pipe_context *pipe;
+   struct pipe_resource *res;
+
+   if (!osmesa || !osmesa->current_buffer ||
+       !osmesa->stctx->pipe->set_progress_callback)
+      return GL_FALSE;
+
+   osbuffer = osmesa->current_buffer;
+   pipe = osmesa->stctx->pipe;
+
+   /* Only the rows of a buffer rendered in place are done once drawn */
+   if (func && (!(osmesa->zero_copy || osbuffer->shared) || osmesa->y_up ||
+                osbuffer->key.user_format != osbuffer->key.color_format))
+      return GL_FALSE;
+
+   osmesa_thread_finish();
+
+   /* Waits until the old callback isn't called anymore */
+   res = osbuffer->textures[ST_ATTACHMENT_FRONT_LEFT];
+   if (res && osbuffer->user_map == osbuffer->map)
+      pipe->set_progress_callback(pipe, res, NULL, NULL);
+
+   osbuffer->progress_func = func;
+   osbuffer->progress_data = data;
+   osbuffer->progress_map = func ? osbuffer->map : NULL;
+
+   /* Else set once the resource is created in place */
+   if (func && res && osbuffer->user_map == osbuffer->map)
+      pipe->set_progress_callback(pipe, res, osmesa_progress, osbuffer);
+
+   return GL_TRUE;
 }
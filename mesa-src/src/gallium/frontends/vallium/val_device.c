@@ -29,6 +29,7 @@
 #include "pipe/p_state.h"
 #include "pipe/p_context.h"
 #include "frontend/drisw_api.h"
+#include "cso_cache/cso_context.h"
 
 #include "compiler/glsl_types.h"
 #include "util/u_inlines.h"
@@ -733,7 +734,11 @@ static int queue_thread(void *data)
       }
       if (!task->cmd_buffer_count && task->fence)
          task->fence->signaled = true;
-      p_atomic_dec(&queue->count);
+      if (task->precompile) {
+         val_precompile_pipeline(queue, task->precompile);
+         util_queue_fence_signal(&task->precompile->precompile_fence);
+      } else
+         p_atomic_dec(&queue->count);
       mtx_lock(&queue->m);
       list_del(&task->list);
       free(task);
@@ -750,6 +755,8 @@ val_queue_init(struct val_device *device, struct val_queue *queue)
 
    queue->flags = 0;
    queue->ctx = device->pscreen->context_create(device->pscreen, NULL, PIPE_CONTEXT_ROBUST_BUFFER_ACCESS);
+   /* Vulkan has no user vertex buffers, and draws skip u_vbuf */
+   queue->cso = cso_create_context(queue->ctx, CSO_NO_USER_VERTEX_BUFFERS);
    list_inithead(&queue->workqueue);
    p_atomic_set(&queue->count, 0);
    mtx_init(&queue->m, mtx_plain);
@@ -770,6 +777,7 @@ val_queue_finish(struct val_queue *queue)
 
    cnd_destroy(&queue->new_work);
    mtx_destroy(&queue->m);
+   cso_destroy_context(queue->cso);
    queue->ctx->destroy(queue->ctx);
 }
 
@@ -1003,6 +1011,7 @@ VkResult val_QueueSubmit(
 
       task->cmd_buffer_count = pSubmits[i].commandBufferCount;
       task->fence = fence;
+      task->precompile = NULL;
       task->cmd_buffers = (struct val_cmd_buffer **)(task + 1);
       for (uint32_t j = 0; j < pSubmits[i].commandBufferCount; j++) {
          task->cmd_buffers[j] = val_cmd_buffer_from_handle(pSubmits[i].pCommandBuffers[j]);
@@ -1020,6 +1029,36 @@ VkResult val_QueueSubmit(
    return VK_SUCCESS;
 }
 
+/**
+ * Have the queue thread, which owns the context, compile the pipeline's
+ * fragment shader variants after the submits queued so far.  That isn't
+ * work the queue's waits wait for, pipeline->precompile_fence tells when
+ * it's done.
+ */
+void val_queue_precompile(struct val_queue *queue,
+                          struct val_pipeline *pipeline)
+{
+   struct val_queue_work *task;
+
+   if (!queue->ctx->precompile_fs)
+      return;
+
+   task = malloc(sizeof(*task));
+   if (!task)
+      return;
+
+   task->cmd_buffer_count = 0;
+   task->cmd_buffers = NULL;
+   task->fence = NULL;
+   task->precompile = pipeline;
+   util_queue_fence_reset(&pipeline->precompile_fence);
+
+   mtx_lock(&queue->m);
+   list_addtail(&task->list, &queue->workqueue);
+   cnd_signal(&queue->new_work);
+   mtx_unlock(&queue->m);
+}
+
 static VkResult queue_wait_idle(struct val_queue *queue, uint64_t timeout)
 {
    if (timeout == 0)
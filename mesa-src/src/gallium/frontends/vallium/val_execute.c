@@ -39,9 +39,11 @@
 #include "util/u_box.h"
 #include "util/u_inlines.h"
 #include "util/format/u_format_zs.h"
+#include "cso_cache/cso_context.h"
 
 struct rendering_state {
    struct pipe_context *pctx;
+   struct cso_context *cso;
 
    bool blend_dirty;
    bool rs_dirty;
@@ -65,11 +67,8 @@ struct rendering_state {
    struct pipe_framebuffer_state framebuffer;
 
    struct pipe_blend_state blend_state;
-   void *blend_handle;
    struct pipe_rasterizer_state rs_state;
-   void *rast_handle;
    struct pipe_depth_stencil_alpha_state dsa_state;
-   void *dsa_handle;
 
    struct pipe_blend_color blend_color;
    struct pipe_stencil_ref stencil_ref;
@@ -90,8 +89,7 @@ struct rendering_state {
    int num_vb;
    unsigned start_vb;
    struct pipe_vertex_buffer vb[PIPE_MAX_ATTRIBS];
-   int num_ve;
-   struct pipe_vertex_element ve[PIPE_MAX_ATTRIBS];
+   struct cso_velems_state velem;
 
    struct pipe_sampler_view *sv[PIPE_SHADER_TYPES][PIPE_MAX_SAMPLERS];
    int num_sampler_views[PIPE_SHADER_TYPES];
@@ -106,8 +104,6 @@ struct rendering_state {
    int num_shader_buffers[PIPE_SHADER_TYPES];
    bool iv_dirty[PIPE_SHADER_TYPES];
    bool sb_dirty[PIPE_SHADER_TYPES];
-   void *ss_cso[PIPE_SHADER_TYPES][PIPE_MAX_SAMPLERS];
-   void *velems_cso;
 
    uint8_t push_constants[128 * 4];
 
@@ -122,6 +118,23 @@ struct rendering_state {
    struct val_attachment_state *attachments;
 };
 
+/*
+ * The blend, rasterizer, depth/stencil/alpha, sampler and vertex element
+ * states go through the queue's cso_context.  It keeps the gallium objects
+ * across submits, so replaying the same command buffers finds them instead
+ * of creating new ones, and the driver sees the same objects bound.
+ */
+static void emit_samplers(struct rendering_state *state,
+                          enum pipe_shader_type sh)
+{
+   const struct pipe_sampler_state *ss[PIPE_MAX_SAMPLERS];
+
+   for (int i = 0; i < state->num_sampler_states[sh]; i++)
+      ss[i] = &state->ss[sh][i];
+
+   cso_set_samplers(state->cso, sh, state->num_sampler_states[sh], ss);
+}
+
 static void emit_compute_state(struct rendering_state *state)
 {
    if (state->iv_dirty[PIPE_SHADER_COMPUTE]) {
@@ -158,12 +171,7 @@ static void emit_compute_state(struct rendering_state *state)
    }
 
    if (state->ss_dirty[PIPE_SHADER_COMPUTE]) {
-      for (unsigned i = 0; i < state->num_sampler_states[PIPE_SHADER_COMPUTE]; i++) {
-         if (state->ss_cso[PIPE_SHADER_COMPUTE][i])
-            state->pctx->delete_sampler_state(state->pctx, state->ss_cso[PIPE_SHADER_COMPUTE][i]);
-         state->ss_cso[PIPE_SHADER_COMPUTE][i] = state->pctx->create_sampler_state(state->pctx, &state->ss[PIPE_SHADER_COMPUTE][i]);
-      }
-      state->pctx->bind_sampler_states(state->pctx, PIPE_SHADER_COMPUTE, 0, state->num_sampler_states[PIPE_SHADER_COMPUTE], state->ss_cso[PIPE_SHADER_COMPUTE]);
+      emit_samplers(state, PIPE_SHADER_COMPUTE);
       state->ss_dirty[PIPE_SHADER_COMPUTE] = false;
    }
 }
@@ -172,37 +180,17 @@ static void emit_state(struct rendering_state *state)
 {
    int sh;
    if (state->blend_dirty) {
-      if (state->blend_handle) {
-         state->pctx->bind_blend_state(state->pctx, NULL);
-         state->pctx->delete_blend_state(state->pctx, state->blend_handle);
-      }
-      state->blend_handle = state->pctx->create_blend_state(state->pctx,
-                                                            &state->blend_state);
-      state->pctx->bind_blend_state(state->pctx, state->blend_handle);
-
+      cso_set_blend(state->cso, &state->blend_state);
       state->blend_dirty = false;
    }
 
    if (state->rs_dirty) {
-      if (state->rast_handle) {
-         state->pctx->bind_rasterizer_state(state->pctx, NULL);
-         state->pctx->delete_rasterizer_state(state->pctx, state->rast_handle);
-      }
-      state->rast_handle = state->pctx->create_rasterizer_state(state->pctx,
-                                                                &state->rs_state);
-      state->pctx->bind_rasterizer_state(state->pctx, state->rast_handle);
+      cso_set_rasterizer(state->cso, &state->rs_state);
       state->rs_dirty = false;
    }
 
    if (state->dsa_dirty) {
-      if (state->dsa_handle) {
-         state->pctx->bind_depth_stencil_alpha_state(state->pctx, NULL);
-         state->pctx->delete_depth_stencil_alpha_state(state->pctx, state->dsa_handle);
-      }
-      state->dsa_handle = state->pctx->create_depth_stencil_alpha_state(state->pctx,
-                                                                        &state->dsa_state);
-      state->pctx->bind_depth_stencil_alpha_state(state->pctx, state->dsa_handle);
-
+      cso_set_depth_stencil_alpha(state->cso, &state->dsa_state);
       state->dsa_dirty = false;
    }
 
@@ -233,16 +221,8 @@ static void emit_state(struct rendering_state *state)
    }
 
    if (state->ve_dirty) {
-      void *ve = NULL;
-      if (state->velems_cso)
-         ve = state->velems_cso;
-
-      state->velems_cso = state->pctx->create_vertex_elements_state(state->pctx, state->num_ve,
-                                                                    state->ve);
-      state->pctx->bind_vertex_elements_state(state->pctx, state->velems_cso);
-
-      if (ve)
-         state->pctx->delete_vertex_elements_state(state->pctx, ve);
+      cso_set_vertex_elements(state->cso, &state->velem);
+      state->ve_dirty = false;
    }
 
    for (sh = 0; sh < PIPE_SHADER_TYPES; sh++) {
@@ -288,17 +268,11 @@ static void emit_state(struct rendering_state *state)
    }
 
    for (sh = 0; sh < PIPE_SHADER_TYPES; sh++) {
-      int i;
       if (!state->ss_dirty[sh])
          continue;
 
-      for (i = 0; i < state->num_sampler_states[sh]; i++) {
-         if (state->ss_cso[sh][i])
-            state->pctx->delete_sampler_state(state->pctx, state->ss_cso[sh][i]);
-         state->ss_cso[sh][i] = state->pctx->create_sampler_state(state->pctx, &state->ss[sh][i]);
-      }
-
-      state->pctx->bind_sampler_states(state->pctx, sh, 0, state->num_sampler_states[sh], state->ss_cso[sh]);
+      emit_samplers(state, sh);
+      state->ss_dirty[sh] = false;
    }
 
    if (state->vp_dirty) {
@@ -343,14 +317,10 @@ get_viewport_xform(const VkViewport *viewport,
    translate[2] = n;
 }
 
-static void handle_graphics_pipeline(struct val_cmd_buffer_entry *cmd,
-                                     struct rendering_state *state)
+static void get_dynamic_states(const struct val_pipeline *pipeline,
+                               bool dynamic_states[VK_DYNAMIC_STATE_STENCIL_REFERENCE+1])
 {
-   struct val_pipeline *pipeline = cmd->u.pipeline.pipeline;
-   bool dynamic_states[VK_DYNAMIC_STATE_STENCIL_REFERENCE+1];
-   unsigned fb_samples = 0;
-
-   memset(dynamic_states, 0, sizeof(dynamic_states));
+   memset(dynamic_states, 0, sizeof(bool) * (VK_DYNAMIC_STATE_STENCIL_REFERENCE+1));
    if (pipeline->graphics_create_info.pDynamicState)
    {
       const VkPipelineDynamicStateCreateInfo *dyn = pipeline->graphics_create_info.pDynamicState;
@@ -361,55 +331,16 @@ static void handle_graphics_pipeline(struct val_cmd_buffer_entry *cmd,
          dynamic_states[dyn->pDynamicStates[i]] = true;
       }
    }
+}
 
-   bool has_stage[PIPE_SHADER_TYPES] = { false };
-
-   state->pctx->bind_gs_state(state->pctx, NULL);
-   if (state->pctx->bind_tcs_state)
-      state->pctx->bind_tcs_state(state->pctx, NULL);
-   if (state->pctx->bind_tes_state)
-      state->pctx->bind_tes_state(state->pctx, NULL);
-   {
-      int i;
-      for (i = 0; i < pipeline->graphics_create_info.stageCount; i++) {
-         const VkPipelineShaderStageCreateInfo *sh = &pipeline->graphics_create_info.pStages[i];
-         switch (sh->stage) {
-         case VK_SHADER_STAGE_FRAGMENT_BIT:
-            state->pctx->bind_fs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_FRAGMENT]);
-            has_stage[PIPE_SHADER_FRAGMENT] = true;
-            break;
-         case VK_SHADER_STAGE_VERTEX_BIT:
-            state->pctx->bind_vs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_VERTEX]);
-            has_stage[PIPE_SHADER_VERTEX] = true;
-            break;
-         case VK_SHADER_STAGE_GEOMETRY_BIT:
-            state->pctx->bind_gs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_GEOMETRY]);
-            has_stage[PIPE_SHADER_GEOMETRY] = true;
-            break;
-         case VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT:
-            state->pctx->bind_tcs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_TESS_CTRL]);
-            has_stage[PIPE_SHADER_TESS_CTRL] = true;
-            break;
-         case VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT:
-            state->pctx->bind_tes_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_TESS_EVAL]);
-            has_stage[PIPE_SHADER_TESS_EVAL] = true;
-            break;
-         default:
-            assert(0);
-            break;
-         }
-      }
-   }
-
-   /* there should always be a dummy fs. */
-   if (!has_stage[PIPE_SHADER_FRAGMENT])
-      state->pctx->bind_fs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_FRAGMENT]);
-   if (state->pctx->bind_gs_state && !has_stage[PIPE_SHADER_GEOMETRY])
-      state->pctx->bind_gs_state(state->pctx, NULL);
-   if (state->pctx->bind_tcs_state && !has_stage[PIPE_SHADER_TESS_CTRL])
-      state->pctx->bind_tcs_state(state->pctx, NULL);
-   if (state->pctx->bind_tes_state && !has_stage[PIPE_SHADER_TESS_EVAL])
-      state->pctx->bind_tes_state(state->pctx, NULL);
+/* Rasterizer, multisample, depth/stencil and blend state, which fragment
+ * shader variants depend on.  Returns the framebuffer sample count.
+ */
+static unsigned handle_pipeline_fixed_state(const struct val_pipeline *pipeline,
+                                            const bool *dynamic_states,
+                                            struct rendering_state *state)
+{
+   unsigned fb_samples = 0;
 
    /* rasterization state */
    if (pipeline->graphics_create_info.pRasterizationState) {
@@ -550,6 +481,69 @@ static void handle_graphics_pipeline(struct val_cmd_buffer_entry *cmd,
       }
    }
 
+   return fb_samples;
+}
+
+static void handle_graphics_pipeline(struct val_cmd_buffer_entry *cmd,
+                                     struct rendering_state *state)
+{
+   struct val_pipeline *pipeline = cmd->u.pipeline.pipeline;
+   bool dynamic_states[VK_DYNAMIC_STATE_STENCIL_REFERENCE+1];
+   unsigned fb_samples;
+
+   get_dynamic_states(pipeline, dynamic_states);
+
+   bool has_stage[PIPE_SHADER_TYPES] = { false };
+
+   state->pctx->bind_gs_state(state->pctx, NULL);
+   if (state->pctx->bind_tcs_state)
+      state->pctx->bind_tcs_state(state->pctx, NULL);
+   if (state->pctx->bind_tes_state)
+      state->pctx->bind_tes_state(state->pctx, NULL);
+   {
+      int i;
+      for (i = 0; i < pipeline->graphics_create_info.stageCount; i++) {
+         const VkPipelineShaderStageCreateInfo *sh = &pipeline->graphics_create_info.pStages[i];
+         switch (sh->stage) {
+         case VK_SHADER_STAGE_FRAGMENT_BIT:
+            state->pctx->bind_fs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_FRAGMENT]);
+            has_stage[PIPE_SHADER_FRAGMENT] = true;
+            break;
+         case VK_SHADER_STAGE_VERTEX_BIT:
+            state->pctx->bind_vs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_VERTEX]);
+            has_stage[PIPE_SHADER_VERTEX] = true;
+            break;
+         case VK_SHADER_STAGE_GEOMETRY_BIT:
+            state->pctx->bind_gs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_GEOMETRY]);
+            has_stage[PIPE_SHADER_GEOMETRY] = true;
+            break;
+         case VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT:
+            state->pctx->bind_tcs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_TESS_CTRL]);
+            has_stage[PIPE_SHADER_TESS_CTRL] = true;
+            break;
+         case VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT:
+            state->pctx->bind_tes_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_TESS_EVAL]);
+            has_stage[PIPE_SHADER_TESS_EVAL] = true;
+            break;
+         default:
+            assert(0);
+            break;
+         }
+      }
+   }
+
+   /* there should always be a dummy fs. */
+   if (!has_stage[PIPE_SHADER_FRAGMENT])
+      state->pctx->bind_fs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_FRAGMENT]);
+   if (state->pctx->bind_gs_state && !has_stage[PIPE_SHADER_GEOMETRY])
+      state->pctx->bind_gs_state(state->pctx, NULL);
+   if (state->pctx->bind_tcs_state && !has_stage[PIPE_SHADER_TESS_CTRL])
+      state->pctx->bind_tcs_state(state->pctx, NULL);
+   if (state->pctx->bind_tes_state && !has_stage[PIPE_SHADER_TESS_EVAL])
+      state->pctx->bind_tes_state(state->pctx, NULL);
+
+   fb_samples = handle_pipeline_fixed_state(pipeline, dynamic_states, state);
+
    {
       const VkPipelineVertexInputStateCreateInfo *vi = pipeline->graphics_create_info.pVertexInputState;
       int i;
@@ -561,15 +555,15 @@ static void handle_graphics_pipeline(struct val_cmd_buffer_entry *cmd,
       int max_location = -1;
       for (i = 0; i < vi->vertexAttributeDescriptionCount; i++) {
          unsigned location = vi->pVertexAttributeDescriptions[i].location;
-         state->ve[location].src_offset = vi->pVertexAttributeDescriptions[i].offset;
-         state->ve[location].vertex_buffer_index = vi->pVertexAttributeDescriptions[i].binding;
-         state->ve[location].src_format = vk_format_to_pipe(vi->pVertexAttributeDescriptions[i].format);
-         state->ve[location].instance_divisor = vi->pVertexBindingDescriptions[vi->pVertexAttributeDescriptions[i].binding].inputRate;
+         state->velem.velems[location].src_offset = vi->pVertexAttributeDescriptions[i].offset;
+         state->velem.velems[location].vertex_buffer_index = vi->pVertexAttributeDescriptions[i].binding;
+         state->velem.velems[location].src_format = vk_format_to_pipe(vi->pVertexAttributeDescriptions[i].format);
+         state->velem.velems[location].instance_divisor = vi->pVertexBindingDescriptions[vi->pVertexAttributeDescriptions[i].binding].inputRate;
 
          if ((int)location > max_location)
             max_location = location;
       }
-      state->num_ve = max_location + 1;
+      state->velem.count = max_location + 1;
       state->vb_dirty = true;
       state->ve_dirty = true;
    }
@@ -1171,6 +1165,36 @@ static void render_subpass_clear(struct rendering_state *state)
 
 }
 
+/* Let the driver drop a depth/stencil attachment that isn't stored, rather
+ * than write it back, before the flush ending its last subpass.
+ */
+static void render_pass_discard_ds(struct rendering_state *state)
+{
+   struct val_subpass *subpass = &state->pass->subpasses[state->subpass];
+
+   if (!subpass->depth_stencil_attachment ||
+       subpass->depth_stencil_attachment->in_render_loop ||
+       !state->pctx->invalidate_resource)
+      return;
+
+   uint32_t ds = subpass->depth_stencil_attachment->attachment;
+   struct val_render_pass_attachment *att = &state->pass->attachments[ds];
+   struct val_image_view *imgv = state->vk_framebuffer->attachments[ds];
+   const struct util_format_description *desc =
+      util_format_description(imgv->pformat);
+
+   if (att->last_subpass_idx != state->subpass)
+      return;
+   if (util_format_has_depth(desc) &&
+       att->store_op != VK_ATTACHMENT_STORE_OP_DONT_CARE)
+      return;
+   if (util_format_has_stencil(desc) &&
+       att->stencil_store_op != VK_ATTACHMENT_STORE_OP_DONT_CARE)
+      return;
+
+   state->pctx->invalidate_resource(state->pctx, imgv->image->bo);
+}
+
 static void render_pass_resolve(struct rendering_state *state)
 {
    struct val_subpass *subpass = &state->pass->subpasses[state->subpass];
@@ -1262,6 +1286,7 @@ static void handle_begin_render_pass(struct val_cmd_buffer_entry *cmd,
 static void handle_end_render_pass(struct val_cmd_buffer_entry *cmd,
                                    struct rendering_state *state)
 {
+   render_pass_discard_ds(state);
    state->pctx->flush(state->pctx, NULL, 0);
 
    render_pass_resolve(state);
@@ -1274,6 +1299,7 @@ static void handle_end_render_pass(struct val_cmd_buffer_entry *cmd,
 static void handle_next_subpass(struct val_cmd_buffer_entry *cmd,
                                 struct rendering_state *state)
 {
+   render_pass_discard_ds(state);
    state->pctx->flush(state->pctx, NULL, 0);
    render_pass_resolve(state);
    state->subpass++;
@@ -2404,6 +2430,33 @@ static void val_execute_cmd_buffer(struct val_cmd_buffer *cmd_buffer,
    }
 }
 
+/* The state is the one of a submit which binds the pipeline first, as
+ * being the most likely.  Runs on the queue thread, see
+ * val_queue_precompile().
+ */
+void val_precompile_pipeline(struct val_queue *queue,
+                             struct val_pipeline *pipeline)
+{
+   struct rendering_state state;
+   bool dynamic_states[VK_DYNAMIC_STATE_STENCIL_REFERENCE+1];
+
+   memset(&state, 0, sizeof(state));
+   get_dynamic_states(pipeline, dynamic_states);
+   handle_pipeline_fixed_state(pipeline, dynamic_states, &state);
+
+   pipeline->precompile.fs = pipeline->shader_cso[PIPE_SHADER_FRAGMENT];
+   pipeline->precompile.blend = &state.blend_state;
+   pipeline->precompile.depth_stencil_alpha = &state.dsa_state;
+   pipeline->precompile.rasterizer = &state.rs_state;
+   pipeline->precompile.min_samples = MAX2(state.min_samples, 1);
+
+   queue->ctx->precompile_fs(queue->ctx, &pipeline->precompile);
+
+   pipeline->precompile.blend = NULL;
+   pipeline->precompile.depth_stencil_alpha = NULL;
+   pipeline->precompile.rasterizer = NULL;
+}
+
 VkResult val_execute_cmds(struct val_device *device,
                           struct val_queue *queue,
                           struct val_fence *fence,
@@ -2413,6 +2466,7 @@ VkResult val_execute_cmds(struct val_device *device,
    struct pipe_fence_handle *handle = NULL;
    memset(&state, 0, sizeof(state));
    state.pctx = queue->ctx;
+   state.cso = queue->cso;
    state.blend_dirty = true;
    state.dsa_dirty = true;
    state.rs_dirty = true;
@@ -2428,7 +2482,6 @@ VkResult val_execute_cmds(struct val_device *device,
    state.start_vb = -1;
    state.num_vb = 0;
    state.pctx->set_vertex_buffers(state.pctx, 0, PIPE_MAX_ATTRIBS, NULL);
-   state.pctx->bind_vertex_elements_state(state.pctx, NULL);
    state.pctx->bind_vs_state(state.pctx, NULL);
    state.pctx->bind_fs_state(state.pctx, NULL);
    state.pctx->bind_gs_state(state.pctx, NULL);
@@ -2438,31 +2491,15 @@ VkResult val_execute_cmds(struct val_device *device,
       state.pctx->bind_tes_state(state.pctx, NULL);
    if (state.pctx->bind_compute_state)
       state.pctx->bind_compute_state(state.pctx, NULL);
-   if (state.velems_cso)
-      state.pctx->delete_vertex_elements_state(state.pctx, state.velems_cso);
-
-   state.pctx->bind_rasterizer_state(state.pctx, NULL);
-   state.pctx->delete_rasterizer_state(state.pctx, state.rast_handle);
-   if (state.blend_handle) {
-      state.pctx->bind_blend_state(state.pctx, NULL);
-      state.pctx->delete_blend_state(state.pctx, state.blend_handle);
-   }
-
-   if (state.dsa_handle) {
-      state.pctx->bind_depth_stencil_alpha_state(state.pctx, NULL);
-      state.pctx->delete_depth_stencil_alpha_state(state.pctx, state.dsa_handle);
-   }
 
+   /* The blend, rasterizer, depth/stencil/alpha, sampler and vertex
+    * element states stay bound, they belong to the queue's cso_context.
+    */
    for (enum pipe_shader_type s = PIPE_SHADER_VERTEX; s < PIPE_SHADER_TYPES; s++) {
       for (unsigned i = 0; i < PIPE_MAX_SAMPLERS; i++) {
          if (state.sv[s][i])
             pipe_sampler_view_reference(&state.sv[s][i], NULL);
-         if (state.ss_cso[s][i]) {
-            state.pctx->delete_sampler_state(state.pctx, state.ss_cso[s][i]);
-            state.ss_cso[s][i] = NULL;
-         }
       }
-      state.pctx->bind_sampler_states(state.pctx, s, 0, PIPE_MAX_SAMPLERS, state.ss_cso[s]);
 
       state.pctx->set_shader_images(state.pctx, s, 0, device->physical_device->max_images, NULL);
    }
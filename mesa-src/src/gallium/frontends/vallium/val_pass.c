@@ -183,6 +183,8 @@ VkResult val_CreateRenderPass(
       att->samples = pCreateInfo->pAttachments[i].samples;
       att->load_op = pCreateInfo->pAttachments[i].loadOp;
       att->stencil_load_op = pCreateInfo->pAttachments[i].stencilLoadOp;
+      att->store_op = pCreateInfo->pAttachments[i].storeOp;
+      att->stencil_store_op = pCreateInfo->pAttachments[i].stencilStoreOp;
       att->final_layout = pCreateInfo->pAttachments[i].finalLayout;
       att->first_subpass_idx = UINT32_MAX;
    }
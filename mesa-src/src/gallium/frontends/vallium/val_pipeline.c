@@ -86,6 +86,11 @@ void val_DestroyPipeline(
    if (!_pipeline)
       return;
 
+   if (!pipeline->is_compute_pipeline) {
+      util_queue_fence_wait(&pipeline->precompile_fence);
+      util_queue_fence_destroy(&pipeline->precompile_fence);
+   }
+
    if (pipeline->shader_cso[PIPE_SHADER_VERTEX])
       device->queue.ctx->delete_vs_state(device->queue.ctx, pipeline->shader_cso[PIPE_SHADER_VERTEX]);
    if (pipeline->shader_cso[PIPE_SHADER_FRAGMENT])
@@ -733,6 +738,38 @@ val_pipeline_compile(struct val_pipeline *pipeline,
    return VK_SUCCESS;
 }
 
+/* The surfaces drawn to are the subpass attachments, see
+ * begin_render_subpass().
+ */
+static void
+get_precompile_formats(struct val_pipeline *pipeline,
+                       const VkGraphicsPipelineCreateInfo *pCreateInfo)
+{
+   VAL_FROM_HANDLE(val_render_pass, pass, pCreateInfo->renderPass);
+   const struct val_subpass *subpass = &pass->subpasses[pCreateInfo->subpass];
+   struct pipe_precompile_fs_state *precompile = &pipeline->precompile;
+
+   precompile->nr_cbufs = subpass->color_count;
+   for (unsigned i = 0; i < subpass->color_count; i++) {
+      uint32_t idx = subpass->color_attachments[i].attachment;
+
+      if (idx != VK_ATTACHMENT_UNUSED) {
+         precompile->cbuf_formats[i] = vk_format_to_pipe(pass->attachments[idx].format);
+         precompile->samples = pass->attachments[idx].samples;
+      } else
+         precompile->cbuf_formats[i] = PIPE_FORMAT_NONE;
+   }
+
+   precompile->zsbuf_format = PIPE_FORMAT_NONE;
+   if (subpass->depth_stencil_attachment &&
+       subpass->depth_stencil_attachment->attachment != VK_ATTACHMENT_UNUSED) {
+      uint32_t idx = subpass->depth_stencil_attachment->attachment;
+
+      precompile->zsbuf_format = vk_format_to_pipe(pass->attachments[idx].format);
+      precompile->samples = pass->attachments[idx].samples;
+   }
+}
+
 static VkResult
 val_graphics_pipeline_init(struct val_pipeline *pipeline,
                            struct val_device *device,
@@ -794,6 +831,10 @@ val_graphics_pipeline_init(struct val_pipeline *pipeline,
       shstate.ir.nir = pipeline->pipeline_nir[MESA_SHADER_FRAGMENT];
       pipeline->shader_cso[PIPE_SHADER_FRAGMENT] = device->queue.ctx->create_fs_state(device->queue.ctx, &shstate);
    }
+
+   util_queue_fence_init(&pipeline->precompile_fence);
+   get_precompile_formats(pipeline, pCreateInfo);
+   val_queue_precompile(&device->queue, pipeline);
    return VK_SUCCESS;
 }
 
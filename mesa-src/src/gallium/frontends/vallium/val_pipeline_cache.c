@@ -23,6 +23,31 @@
 
 #include "val_private.h"
 
+/*
+ * The pipelines don't keep anything in the cache objects: the driver's
+ * shader code and variant caches are the screen's, and what any cache
+ * object saves.  The data is the Vulkan header followed by the screen's
+ * get_shader_cache_data().
+ */
+#define VAL_CACHE_HEADER_SIZE 32
+
+static bool
+val_cache_header_matches(const void *data, size_t size)
+{
+   const uint32_t *hdr = data;
+   char uuid[VK_UUID_SIZE];
+
+   if (size < VAL_CACHE_HEADER_SIZE)
+      return false;
+
+   val_device_get_cache_uuid(uuid);
+   return hdr[0] == VAL_CACHE_HEADER_SIZE &&
+          hdr[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+          hdr[2] == VK_VENDOR_ID_MESA &&
+          hdr[3] == 0 &&
+          memcmp(&hdr[4], uuid, VK_UUID_SIZE) == 0;
+}
+
 VkResult val_CreatePipelineCache(
     VkDevice                                    _device,
     const VkPipelineCacheCreateInfo*            pCreateInfo,
@@ -51,6 +76,15 @@ VkResult val_CreatePipelineCache(
    cache->device = device;
    *pPipelineCache = val_pipeline_cache_to_handle(cache);
 
+   /* Data from another lavapipe or llvmpipe build is just ignored. */
+   if (device->pscreen->add_shader_cache_data &&
+       val_cache_header_matches(pCreateInfo->pInitialData,
+                                pCreateInfo->initialDataSize)) {
+      device->pscreen->add_shader_cache_data(device->pscreen,
+         (const char *)pCreateInfo->pInitialData + VAL_CACHE_HEADER_SIZE,
+         pCreateInfo->initialDataSize - VAL_CACHE_HEADER_SIZE);
+   }
+
    return VK_SUCCESS;
 }
 
@@ -75,21 +109,40 @@ VkResult val_GetPipelineCacheData(
         size_t*                                     pDataSize,
         void*                                       pData)
 {
+   VAL_FROM_HANDLE(val_device, device, _device);
+   struct pipe_screen *pscreen = device->pscreen;
    VkResult result = VK_SUCCESS;
+   size_t shader_size = 0;
+
+   if (pscreen->get_shader_cache_data)
+      shader_size = pscreen->get_shader_cache_data(pscreen, NULL, 0);
+
    if (pData) {
-      if (*pDataSize < 32) {
+      if (*pDataSize < VAL_CACHE_HEADER_SIZE) {
          *pDataSize = 0;
          result = VK_INCOMPLETE;
       } else {
          uint32_t *hdr = (uint32_t *)pData;
-         hdr[0] = 32;
-         hdr[1] = 1;
+         size_t written = 0;
+
+         hdr[0] = VAL_CACHE_HEADER_SIZE;
+         hdr[1] = VK_PIPELINE_CACHE_HEADER_VERSION_ONE;
          hdr[2] = VK_VENDOR_ID_MESA;
          hdr[3] = 0;
          val_device_get_cache_uuid(&hdr[4]);
+
+         if (shader_size) {
+            written = pscreen->get_shader_cache_data(pscreen,
+               (char *)pData + VAL_CACHE_HEADER_SIZE,
+               *pDataSize - VAL_CACHE_HEADER_SIZE);
+         }
+         /* The oldest code didn't fit */
+         if (written < shader_size)
+            result = VK_INCOMPLETE;
+         *pDataSize = VAL_CACHE_HEADER_SIZE + written;
       }
    } else
-      *pDataSize = 32;
+      *pDataSize = VAL_CACHE_HEADER_SIZE + shader_size;
    return result;
 }
 
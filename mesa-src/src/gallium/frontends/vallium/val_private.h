@@ -33,6 +33,7 @@
 
 #include "util/macros.h"
 #include "util/list.h"
+#include "util/u_queue.h"
 
 #include "compiler/shader_enums.h"
 #include "pipe/p_screen.h"
@@ -248,6 +249,7 @@ struct val_queue {
    VkDeviceQueueCreateFlags flags;
    struct val_device *                         device;
    struct pipe_context *ctx;
+   struct cso_context *cso;  /**< state objects kept across submits */
    bool shutdown;
    thrd_t exec_thread;
    mtx_t m;
@@ -261,8 +263,12 @@ struct val_queue_work {
    uint32_t cmd_buffer_count;
    struct val_cmd_buffer **cmd_buffers;
    struct val_fence *fence;
+   struct val_pipeline *precompile;  /**< see val_queue_precompile() */
 };
 
+void val_queue_precompile(struct val_queue *queue,
+                          struct val_pipeline *pipeline);
+
 struct val_pipeline_cache {
    struct vk_object_base                        base;
    struct val_device *                          device;
@@ -376,6 +382,8 @@ struct val_render_pass_attachment {
    uint32_t                                     samples;
    VkAttachmentLoadOp                           load_op;
    VkAttachmentLoadOp                           stencil_load_op;
+   VkAttachmentStoreOp                          store_op;
+   VkAttachmentStoreOp                          stencil_store_op;
    VkImageLayout                                initial_layout;
    VkImageLayout                                final_layout;
 
@@ -521,6 +529,13 @@ struct val_pipeline {
    void *shader_cso[PIPE_SHADER_TYPES];
    VkGraphicsPipelineCreateInfo graphics_create_info;
    VkComputePipelineCreateInfo compute_create_info;
+
+   /** The fs variants are compiled on the queue thread at creation.  The
+    * framebuffer formats are the subpass's, as the render pass may be
+    * gone by then.
+    */
+   struct pipe_precompile_fs_state precompile;
+   struct util_queue_fence precompile_fence;
 };
 
 struct val_event {
@@ -956,6 +971,8 @@ VkResult val_execute_cmds(struct val_device *device,
                           struct val_queue *queue,
                           struct val_fence *fence,
                           struct val_cmd_buffer *cmd_buffer);
+void val_precompile_pipeline(struct val_queue *queue,
+                             struct val_pipeline *pipeline);
 
 enum pipe_format vk_format_to_pipe(VkFormat format);
 
@@ -263,6 +263,13 @@ struct st_context_attribs
     * Configuration options.
     */
    struct st_config_options options;
+
+   /**
+    * Pipe context to create the context on, from release_pipe() of another
+    * context, or NULL for a new one.  The context owns it once created,
+    * the caller still does if creation fails.
+    */
+   struct pipe_context *pipe;
 };
 
 struct st_context_iface;
@@ -386,6 +393,15 @@ struct st_context_iface
     */
    void (*destroy)(struct st_context_iface *stctxi);
 
+   /**
+    * Destroy the context, but not its gallium context, which is returned.
+    * Creating a new context on it, see st_context_attribs::pipe, keeps the
+    * driver's allocations and caches, and is cheaper than a new one.
+    *
+    * This function is optional.
+    */
+   struct pipe_context *(*release_pipe)(struct st_context_iface *stctxi);
+
    /**
     * Flush all drawing from context to the pipe also flushes the pipe.
     */
@@ -428,6 +444,17 @@ struct st_context_iface
     * Called from the main thread.
     */
    void (*thread_finish)(struct st_context_iface *stctxi);
+
+   /**
+    * Map the window coordinates of the draws to the winsys framebuffer,
+    * x' = x * scale[0] + translate[0] and likewise for y, so that a window
+    * bigger than the framebuffer can be rendered piece by piece.  Applies
+    * to the viewports and scissors.  NULL scale restores the identity.
+    *
+    * This function is optional.
+    */
+   void (*set_window_transform)(struct st_context_iface *stctxi,
+                                const float *scale, const float *translate);
 };
 
 
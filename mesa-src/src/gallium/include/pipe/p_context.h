@@ -55,6 +55,7 @@ struct pipe_framebuffer_state;
 struct pipe_image_view;
 struct pipe_query;
 struct pipe_poly_stipple;
+struct pipe_precompile_fs_state;
 struct pipe_rasterizer_state;
 struct pipe_resolve_info;
 struct pipe_resource;
@@ -708,6 +709,70 @@ struct pipe_context {
                            unsigned stride,
                            unsigned layer_stride);
 
+   /**
+    * Copy a box of a color surface into a buffer, converted to dst_format,
+    * as glReadPixels into a pixel buffer object does.  Multisampled
+    * surfaces are resolved.  sRGB surfaces are read without decoding.
+    * Optional.
+    *
+    * The copy comes after the rendering already submitted, and mapping dst
+    * waits for it, but the call itself doesn't have to.
+    *
+    * \param dst_offset  byte offset in dst of pixel (box->x, box->y)
+    * \param dst_stride  bytes from a row to the next one, may be negative
+    * \return false if the driver can't do it, then nothing is copied
+    */
+   bool (*readback_to_buffer)(struct pipe_context *,
+                              struct pipe_surface *src,
+                              const struct pipe_box *box,
+                              struct pipe_resource *dst,
+                              enum pipe_format dst_format,
+                              unsigned dst_offset,
+                              int dst_stride);
+
+   /**
+    * Get the bounds of level 0 of a texture written since the last call
+    * with reset set, including the rendering submitted but not done yet.
+    * The box may be larger than what was written; its width and height
+    * are 0 if nothing was.  Optional.
+    *
+    * \return false if the driver doesn't track it for this resource
+    */
+   bool (*get_dirty_region)(struct pipe_context *,
+                            struct pipe_resource *resource,
+                            bool reset,
+                            struct pipe_box *box);
+
+   /**
+    * Have func called, from any of the driver's threads, as the rendering
+    * to level 0 of a texture completes from the top down: rows is how many
+    * of its rows at the top all the rendering flushed so far is written
+    * to.  It grows in steps of the driver's tiles, up to the height, for
+    * each flush.  A NULL func stops it, and once this returns the old one
+    * isn't called anymore.  Optional.
+    */
+   void (*set_progress_callback)(struct pipe_context *,
+                                 struct pipe_resource *resource,
+                                 void (*func)(void *data, unsigned rows),
+                                 void *data);
+
+   /**
+    * Compile the fragment shader variants draws with the given state will
+    * need, instead of at the first of them.  Nothing gets bound, and the
+    * compilation may still be going on when this returns.  Optional.
+    */
+   void (*precompile_fs)(struct pipe_context *,
+                         const struct pipe_precompile_fs_state *state);
+
+   /**
+    * Keep the memory the context holds on to, not counting resources,
+    * under a number of bytes: once over, the driver frees what it caches
+    * for later draws, such as compiled shaders and vertex storage.  It is
+    * checked at flushes and when shaders get compiled, so it may be
+    * exceeded in between.  0 removes the budget.  Optional.
+    */
+   void (*set_memory_budget)(struct pipe_context *, uint64_t bytes);
+
    /**
     * Flush any pending framebuffer writes and invalidate texture caches.
     */
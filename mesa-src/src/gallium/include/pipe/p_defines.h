@@ -513,7 +513,12 @@ enum pipe_flush_flags
 #define PIPE_RESOURCE_FLAG_SINGLE_THREAD_USE     (1 << 4)
 #define PIPE_RESOURCE_FLAG_ENCRYPTED             (1 << 5)
 #define PIPE_RESOURCE_FLAG_DONT_OVER_ALLOCATE    (1 << 6)
-#define PIPE_RESOURCE_FLAG_DRV_PRIV    (1 << 8) /* driver/winsys private */
+#define PIPE_RESOURCE_FLAG_USER_MEMORY_PADDED    (1 << 7) /* see resource_from_user_memory */
+/* The contents of a depth/stencil buffer needn't survive a
+ * pipe_context::flush, so its storage may never be allocated.
+ */
+#define PIPE_RESOURCE_FLAG_TRANSIENT             (1 << 8)
+#define PIPE_RESOURCE_FLAG_DRV_PRIV    (1 << 9) /* driver/winsys private */
 #define PIPE_RESOURCE_FLAG_FRONTEND_PRIV         (1 << 24) /* gallium frontend private */
 
 /**
@@ -966,6 +971,8 @@ enum pipe_cap
    PIPE_CAP_GLSL_ZERO_INIT,
    PIPE_CAP_BLEND_EQUATION_ADVANCED,
    PIPE_CAP_NIR_ATOMICS_AS_DEREF,
+   PIPE_CAP_SHAREABLE_STATE_OBJECTS,
+   PIPE_CAP_USER_VERTEX_BUFFERS_DIRECT,
 };
 
 /**
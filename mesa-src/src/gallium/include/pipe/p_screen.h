@@ -217,6 +217,10 @@ struct pipe_screen {
    /**
     * Create a resource from user memory. This maps the user memory into
     * the device address space.
+    *
+    * With PIPE_RESOURCE_FLAG_USER_MEMORY_PADDED the memory is known to
+    * extend past the last row to the driver's block alignment, so the
+    * driver needn't refuse sizes for which it writes whole blocks.
     */
    struct pipe_resource * (*resource_from_user_memory)(struct pipe_screen *,
                                                        const struct pipe_resource *t,
@@ -512,6 +516,46 @@ struct pipe_screen {
     */
    void (*finalize_nir)(struct pipe_screen *screen, void *nir, bool optimize);
 
+   /**
+    * Write the shader variants compiled so far, along with those of any
+    * loaded manifest, to a manifest file.
+    *
+    * \return false if the file couldn't be written.
+    */
+   bool (*save_shader_manifest)(struct pipe_screen *screen, const char *path);
+
+   /**
+    * Load a manifest written by save_shader_manifest(), possibly by an
+    * earlier process.  The variants it lists are compiled as soon as the
+    * shaders they belong to are created, instead of at their first draw.
+    *
+    * \return false if the file couldn't be read or is from another build.
+    */
+   bool (*load_shader_manifest)(struct pipe_screen *screen, const char *path);
+
+   /**
+    * Write the shader code the driver keeps compiled, along with the
+    * variants of its manifest, for an API level cache such as a Vulkan
+    * pipeline cache.  Only whole entries are written, the oldest code is
+    * left out when it doesn't all fit.
+    *
+    * \param data  where to write it, NULL to get the size of all of it
+    * \param size  bytes available at data
+    * \return the bytes written, or needed if data is NULL, 0 if none
+    */
+   size_t (*get_shader_cache_data)(struct pipe_screen *screen,
+                                   void *data, size_t size);
+
+   /**
+    * Add what get_shader_cache_data() wrote, possibly in another process,
+    * to the driver's caches, for shaders created later on.
+    *
+    * \return false if the data is from another build or CPU, or corrupt.
+    *         The entries up to the corruption are added all the same.
+    */
+   bool (*add_shader_cache_data)(struct pipe_screen *screen,
+                                 const void *data, size_t size);
+
    /*Separated memory/resource allocations interfaces for Vulkan */
 
    /**
@@ -970,6 +970,26 @@ struct pipe_memory_info
    unsigned nr_device_memory_evictions; /**< # of evictions (monotonic counter) */
 };
 
+/**
+ * The state draws will be made with, for pipe_context::precompile_fs.
+ * Sampler views, images and the like, which aren't known in advance,
+ * are taken as unbound.
+ */
+struct pipe_precompile_fs_state
+{
+   void *fs;   /**< from create_fs_state() */
+   const struct pipe_blend_state *blend;
+   const struct pipe_depth_stencil_alpha_state *depth_stencil_alpha;
+   const struct pipe_rasterizer_state *rasterizer;
+   unsigned min_samples;
+
+   /** The framebuffer, PIPE_FORMAT_NONE for unbound buffers */
+   unsigned nr_cbufs;
+   enum pipe_format cbuf_formats[PIPE_MAX_COLOR_BUFS];
+   enum pipe_format zsbuf_format;
+   unsigned samples;   /**< of all the buffers, 0 or 1 if single-sampled */
+};
+
 /**
  * Structure that contains information about external memory
  */
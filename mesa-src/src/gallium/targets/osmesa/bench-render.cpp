@@ -0,0 +1,334 @@
+/*
+ * Frame benchmark of typical OSMesa use: contexts are created, made
+ * current on a few user buffers in turn, and GL 3.3 core frames are drawn,
+ * finished and read back.  Every phase is timed separately, and the peak
+ * RSS is reported at the end, so that builds and LP_NUM_THREADS settings
+ * can be compared.
+ *
+ *    osmesa-bench [-s WxH] [-n frames] [-d draws] [-t triangles]
+ *                 [-c contexts] [-b buffers]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#define GL_GLEXT_PROTOTYPES
+#include "GL/osmesa.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+struct Phase {
+   const char *name;
+   std::vector<double> ms;
+
+   void add(bench_clock::time_point start)
+   {
+      ms.push_back(std::chrono::duration<double, std::milli>(
+                      bench_clock::now() - start).count());
+   }
+};
+
+struct Options {
+   int width = 1024, height = 768;
+   int frames = 100;
+   int draws = 16;
+   int triangles = 20000;
+   int contexts = 4;
+   int buffers = 3;
+};
+
+static const char vs_source[] =
+   "#version 330 core\n"
+   "layout(location = 0) in vec2 pos;\n"
+   "uniform vec2 offset;\n"
+   "out vec2 uv;\n"
+   "void main()\n"
+   "{\n"
+   "   uv = pos * 0.5 + 0.5;\n"
+   "   gl_Position = vec4(pos + offset, uv.x * 0.5, 1.0);\n"
+   "}\n";
+
+static const char fs_source[] =
+   "#version 330 core\n"
+   "in vec2 uv;\n"
+   "uniform vec4 tint;\n"
+   "out vec4 color;\n"
+   "void main()\n"
+   "{\n"
+   "   color = vec4(uv, 0.5, 1.0) * tint;\n"
+   "}\n";
+
+static GLuint
+compile_shader(GLenum type, const char *source)
+{
+   GLuint shader = glCreateShader(type);
+   GLint ok = GL_FALSE;
+
+   glShaderSource(shader, 1, &source, NULL);
+   glCompileShader(shader);
+   glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+   if (!ok) {
+      char log[1024] = "";
+      glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+      fprintf(stderr, "osmesa-bench: shader compile failed: %s\n", log);
+      exit(1);
+   }
+   return shader;
+}
+
+/** A grid of small triangles covering the viewport */
+static std::vector<float>
+make_triangles(int count)
+{
+   int cells = std::max(1, (count + 1) / 2);
+   int cols = std::max(1, (int)std::sqrt((double)cells));
+   int rows = (cells + cols - 1) / cols;
+   float dx = 2.0f / cols, dy = 2.0f / rows;
+   std::vector<float> verts;
+
+   for (int n = 0; n < count; n++) {
+      int cell = n / 2;
+      float x0 = -1.0f + (cell % cols) * dx, y0 = -1.0f + (cell / cols) * dy;
+
+      if (n & 1) {
+         const float tri[6] = { x0 + dx, y0, x0 + dx, y0 + dy, x0, y0 + dy };
+         verts.insert(verts.end(), tri, tri + 6);
+      } else {
+         const float tri[6] = { x0, y0, x0 + dx, y0, x0, y0 + dy };
+         verts.insert(verts.end(), tri, tri + 6);
+      }
+   }
+   return verts;
+}
+
+static long
+peak_rss_kb(void)
+{
+#if defined(__unix__) || defined(__APPLE__)
+   struct rusage usage;
+
+   if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+      return usage.ru_maxrss / 1024;
+#else
+      return usage.ru_maxrss;
+#endif
+   }
+#endif
+   return -1;
+}
+
+static void
+report(const Phase &phase)
+{
+   if (phase.ms.empty())
+      return;
+
+   std::vector<double> sorted = phase.ms;
+   std::sort(sorted.begin(), sorted.end());
+   double total = 0;
+   for (double ms : sorted)
+      total += ms;
+
+   printf("%-14s %7zu %10.3f %10.3f %10.3f %10.3f\n", phase.name,
+          sorted.size(), total / sorted.size(), sorted[sorted.size() / 2],
+          sorted[(sorted.size() * 99) / 100], sorted.back());
+}
+
+static bool
+parse_args(int argc, char **argv, Options &o)
+{
+   for (int i = 1; i < argc; i++) {
+      const char *arg = argv[i];
+      const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+      if (!value)
+         return false;
+      i++;
+      if (!strcmp(arg, "-s")) {
+         if (sscanf(value, "%dx%d", &o.width, &o.height) != 2)
+            return false;
+      } else if (!strcmp(arg, "-n")) {
+         o.frames = atoi(value);
+      } else if (!strcmp(arg, "-d")) {
+         o.draws = atoi(value);
+      } else if (!strcmp(arg, "-t")) {
+         o.triangles = atoi(value);
+      } else if (!strcmp(arg, "-c")) {
+         o.contexts = atoi(value);
+      } else if (!strcmp(arg, "-b")) {
+         o.buffers = atoi(value);
+      } else {
+         return false;
+      }
+   }
+   return o.width > 0 && o.height > 0 && o.frames > 0 && o.draws > 0 &&
+          o.triangles > 0 && o.contexts > 0 && o.buffers > 0;
+}
+
+int
+main(int argc, char **argv)
+{
+   Options o;
+   const int attribs[] = {
+      OSMESA_FORMAT, OSMESA_RGBA,
+      OSMESA_DEPTH_BITS, 24,
+      OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+      OSMESA_CONTEXT_MAJOR_VERSION, 3,
+      OSMESA_CONTEXT_MINOR_VERSION, 3,
+      0
+   };
+   Phase create{"create"}, make_current{"make_current"}, first{"first_frame"},
+         draw{"draw"}, finish{"finish"}, readback{"readpixels"},
+         frame{"frame"};
+
+   if (!parse_args(argc, argv, o)) {
+      fprintf(stderr, "usage: osmesa-bench [-s WxH] [-n frames] [-d draws] "
+              "[-t triangles] [-c contexts] [-b buffers]\n");
+      return 1;
+   }
+
+   /* Context creation; only the last context is used afterwards */
+   OSMesaContext ctx = NULL;
+   for (int i = 0; i < o.contexts; i++) {
+      if (ctx)
+         OSMesaDestroyContext(ctx);
+      auto start = bench_clock::now();
+      ctx = OSMesaCreateContextAttribs(attribs, NULL);
+      create.add(start);
+      if (!ctx) {
+         fprintf(stderr, "osmesa-bench: no GL 3.3 core context\n");
+         return 1;
+      }
+   }
+
+   size_t pixels = (size_t)o.width * o.height;
+   std::vector<std::vector<uint32_t>> buffers(o.buffers,
+                                              std::vector<uint32_t>(pixels));
+   std::vector<uint32_t> readback_buffer(pixels);
+
+   /* Buffer switching, before anything was drawn */
+   for (int i = 0; i < o.buffers * 4; i++) {
+      auto start = bench_clock::now();
+      if (!OSMesaMakeCurrent(ctx, buffers[i % o.buffers].data(),
+                             GL_UNSIGNED_BYTE, o.width, o.height)) {
+         fprintf(stderr, "osmesa-bench: OSMesaMakeCurrent failed\n");
+         return 1;
+      }
+      make_current.add(start);
+   }
+
+   GLuint program = glCreateProgram();
+   GLuint vs = compile_shader(GL_VERTEX_SHADER, vs_source);
+   GLuint fs = compile_shader(GL_FRAGMENT_SHADER, fs_source);
+   glAttachShader(program, vs);
+   glAttachShader(program, fs);
+   glLinkProgram(program);
+   glDeleteShader(vs);
+   glDeleteShader(fs);
+   glUseProgram(program);
+   GLint offset_loc = glGetUniformLocation(program, "offset");
+   GLint tint_loc = glGetUniformLocation(program, "tint");
+
+   std::vector<float> verts = make_triangles(o.triangles);
+   GLuint vao, vbo;
+   glGenVertexArrays(1, &vao);
+   glBindVertexArray(vao);
+   glGenBuffers(1, &vbo);
+   glBindBuffer(GL_ARRAY_BUFFER, vbo);
+   glBufferData(GL_ARRAY_BUFFER, verts.size() * sizeof(float), verts.data(),
+                GL_STATIC_DRAW);
+   glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+   glEnableVertexAttribArray(0);
+
+   glEnable(GL_DEPTH_TEST);
+   glEnable(GL_BLEND);
+   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+   glViewport(0, 0, o.width, o.height);
+
+   /* The first frame compiles the shader variants, so it's kept apart.
+    * Each frame renders into the next buffer, as a frame pool would.
+    */
+   for (int f = 0; f <= o.frames; f++) {
+      auto frame_start = bench_clock::now();
+
+      if (o.buffers > 1 || f == 0) {
+         auto start = bench_clock::now();
+         OSMesaMakeCurrent(ctx, buffers[f % o.buffers].data(),
+                           GL_UNSIGNED_BYTE, o.width, o.height);
+         if (f)
+            make_current.add(start);
+      }
+
+      auto start = bench_clock::now();
+      glClearColor(0.1f, 0.2f, 0.3f, 1.0f);
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      for (int d = 0; d < o.draws; d++) {
+         float t = (float)d / o.draws;
+         glUniform2f(offset_loc, 0.01f * d, -0.01f * d);
+         glUniform4f(tint_loc, 1.0f - t, t, 0.5f, 0.75f);
+         glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(verts.size() / 2));
+      }
+      if (f)
+         draw.add(start);
+
+      start = bench_clock::now();
+      glFinish();
+      if (f)
+         finish.add(start);
+
+      start = bench_clock::now();
+      glReadPixels(0, 0, o.width, o.height, GL_RGBA, GL_UNSIGNED_BYTE,
+                   readback_buffer.data());
+      if (f) {
+         readback.add(start);
+         frame.add(frame_start);
+      } else {
+         first.add(frame_start);
+      }
+   }
+
+   glDeleteBuffers(1, &vbo);
+   glDeleteVertexArrays(1, &vao);
+   glDeleteProgram(program);
+
+   const char *threads = getenv("LP_NUM_THREADS");
+   printf("# %dx%d, %d draws of %d triangles, %d buffers, LP_NUM_THREADS=%s\n",
+          o.width, o.height, o.draws, o.triangles, o.buffers,
+          threads ? threads : "default");
+   printf("%-14s %7s %10s %10s %10s %10s\n", "phase", "count", "avg ms",
+          "median ms", "p99 ms", "max ms");
+   for (const Phase *p : { &create, &make_current, &first, &draw, &finish,
+                           &readback, &frame })
+      report(*p);
+   if (!frame.ms.empty()) {
+      double total = 0;
+      for (double ms : frame.ms)
+         total += ms;
+      printf("fps            %10.2f\n", 1000.0 * frame.ms.size() / total);
+   }
+
+   /* Driver statistics, e.g. llvmpipe's with LP_PERF=counters */
+   const char *name;
+   GLuint64 value;
+   for (GLuint i = 0; OSMesaGetStats(ctx, i, &name, &value); i++) {
+      if (value)
+         printf("stat %-30s %20llu\n", name, (unsigned long long)value);
+   }
+
+   OSMesaDestroyContext(ctx);
+
+   printf("peak_rss_kb    %10ld\n", peak_rss_kb());
+   return 0;
+}
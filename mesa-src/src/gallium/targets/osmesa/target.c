@@ -28,11 +28,15 @@
 
 
 struct pipe_screen *
-osmesa_create_screen(void);
+osmesa_create_screen(const char *driver);
 
 
+/**
+ * Create the screen of the named driver, or if NULL of the one
+ * GALLIUM_DRIVER names, llvmpipe by default.
+ */
 struct pipe_screen *
-osmesa_create_screen(void)
+osmesa_create_screen(const char *driver)
 {
    struct sw_winsys *winsys;
    struct pipe_screen *screen;
@@ -44,8 +48,9 @@ osmesa_create_screen(void)
    if (!winsys)
       return NULL;
 
-   /* Create llvmpipe or softpipe screen */
-   screen = sw_screen_create(winsys);
+   /* Create llvmpipe, softpipe or swr screen */
+   screen = driver ? sw_screen_create_named(winsys, driver)
+                   : sw_screen_create(winsys);
    if (!screen) {
       winsys->destroy(winsys);
       return NULL;
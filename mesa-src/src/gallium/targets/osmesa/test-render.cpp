@@ -3,6 +3,7 @@
 #include <cstdlib>
 #include <array>
 #include <memory>
+#include <string>
 
 #include <gtest/gtest.h>
 
@@ -162,3 +163,111 @@ INSTANTIATE_TEST_CASE_P(
    ),
    name_params
 );
+
+TEST(OSMesaRenderTest, ZeroCopy)
+{
+   const int w = 16, h = 16;
+   alignas(16) uint32_t pixels[w * h] = { 0 };
+   const int attribs[] = {
+      OSMESA_FORMAT, OSMESA_RGBA,
+      OSMESA_ZERO_COPY, GL_TRUE,
+      0
+   };
+
+   std::unique_ptr<osmesa_context, decltype(&OSMesaDestroyContext)> ctx{
+      OSMesaCreateContextAttribs(attribs, NULL), &OSMesaDestroyContext};
+   ASSERT_TRUE(ctx);
+
+   auto ret = OSMesaMakeCurrent(ctx.get(), &pixels, GL_UNSIGNED_BYTE, w, h);
+   ASSERT_EQ(ret, GL_TRUE);
+   OSMesaPixelStore(OSMESA_Y_UP, 0);
+
+   uint32_t expected = 0xbf80ff40;
+   if (UTIL_ARCH_BIG_ENDIAN)
+      expected = util_bswap32(expected);
+
+   glClearColor(0.25, 1.0, 0.5, 0.75);
+   glClear(GL_COLOR_BUFFER_BIT);
+   glFinish();
+
+   for (unsigned i = 0; i < w * h; i++)
+      ASSERT_EQ(expected, pixels[i]);
+
+   /* Switching to another buffer of the same size must render there. */
+   alignas(16) uint32_t other[w * h] = { 0 };
+   ret = OSMesaMakeCurrent(ctx.get(), &other, GL_UNSIGNED_BYTE, w, h);
+   ASSERT_EQ(ret, GL_TRUE);
+
+   glClear(GL_COLOR_BUFFER_BIT);
+   glFinish();
+
+   for (unsigned i = 0; i < w * h; i++)
+      ASSERT_EQ(expected, other[i]);
+}
+
+TEST(OSMesaRenderTest, SwapBuffersAsync)
+{
+   const int w = 16, h = 16;
+   alignas(16) uint32_t pixels[2][w * h] = {{ 0 }};
+
+   std::unique_ptr<osmesa_context, decltype(&OSMesaDestroyContext)> ctx{
+      OSMesaCreateContext(OSMESA_RGBA, NULL), &OSMesaDestroyContext};
+   ASSERT_TRUE(ctx);
+
+   auto ret = OSMesaMakeCurrent(ctx.get(), pixels[0], GL_UNSIGNED_BYTE, w, h);
+   ASSERT_EQ(ret, GL_TRUE);
+
+   glClearColor(1.0, 0.0, 0.0, 1.0);
+   glClear(GL_COLOR_BUFFER_BIT);
+   OSMesaFrame first = OSMesaSwapBuffersAsync(ctx.get(), pixels[1]);
+   ASSERT_TRUE(first);
+
+   glClearColor(0.0, 0.0, 1.0, 1.0);
+   glClear(GL_COLOR_BUFFER_BIT);
+   OSMesaFrame second = OSMesaSwapBuffersAsync(ctx.get(), pixels[0]);
+   ASSERT_TRUE(second);
+
+   ASSERT_EQ(OSMesaWaitFrame(ctx.get(), first, ~0ull), GL_TRUE);
+   ASSERT_EQ(OSMesaWaitFrame(ctx.get(), second, ~0ull), GL_TRUE);
+
+   uint32_t red = 0xff0000ff, blue = 0xffff0000;
+   if (UTIL_ARCH_BIG_ENDIAN) {
+      red = util_bswap32(red);
+      blue = util_bswap32(blue);
+   }
+
+   for (unsigned i = 0; i < w * h; i++) {
+      ASSERT_EQ(red, pixels[0][i]);
+      ASSERT_EQ(blue, pixels[1][i]);
+   }
+}
+
+TEST(OSMesaRenderTest, ShaderManifest)
+{
+   const int w = 16, h = 16;
+   alignas(16) uint32_t pixels[w * h] = { 0 };
+   std::string path = testing::TempDir() + "osmesa-test-manifest";
+
+   std::unique_ptr<osmesa_context, decltype(&OSMesaDestroyContext)> ctx{
+      OSMesaCreateContext(OSMESA_RGBA, NULL), &OSMesaDestroyContext};
+   ASSERT_TRUE(ctx);
+
+   auto ret = OSMesaMakeCurrent(ctx.get(), &pixels, GL_UNSIGNED_BYTE, w, h);
+   ASSERT_EQ(ret, GL_TRUE);
+
+   glColor4f(1.0, 0.0, 0.0, 1.0);
+   glBegin(GL_TRIANGLES);
+   glVertex2f(-1.0, -1.0);
+   glVertex2f(3.0, -1.0);
+   glVertex2f(-1.0, 3.0);
+   glEnd();
+   glFinish();
+
+   /* Not all drivers support manifests. */
+   if (!OSMesaSaveShaderManifest(path.c_str()))
+      return;
+
+   EXPECT_EQ(OSMesaLoadShaderManifest(path.c_str()), GL_TRUE);
+   EXPECT_EQ(OSMesaLoadShaderManifest((path + "-missing").c_str()), GL_FALSE);
+   std::remove(path.c_str());
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright © 2026 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Vertices per second of translate's linear run, for the vertex formats
+ * draw fetches most, with translate_generic, translate_sse limited to SSE
+ * and translate_sse with AVX2.  The output of each is checked against
+ * translate_generic.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "translate/translate.h"
+#include "util/os_time.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_half.h"
+#include "util/u_memory.h"
+#include "util/format/u_format.h"
+
+#define NUM_VERTICES 10003
+
+static const struct {
+   const char *name;
+   enum pipe_format formats[3];
+} cases[] = {
+   { "float1",   { PIPE_FORMAT_R32_FLOAT } },
+   { "float2",   { PIPE_FORMAT_R32G32_FLOAT } },
+   { "float3",   { PIPE_FORMAT_R32G32B32_FLOAT } },
+   { "float4",   { PIPE_FORMAT_R32G32B32A32_FLOAT } },
+   { "unorm8x4", { PIPE_FORMAT_R8G8B8A8_UNORM } },
+   { "bgra8",    { PIPE_FORMAT_B8G8R8A8_UNORM } },
+   { "half2",    { PIPE_FORMAT_R16G16_FLOAT } },
+   { "half4",    { PIPE_FORMAT_R16G16B16A16_FLOAT } },
+   { "pos+color+uv", { PIPE_FORMAT_R32G32B32_FLOAT,
+                       PIPE_FORMAT_R8G8B8A8_UNORM,
+                       PIPE_FORMAT_R16G16_FLOAT } },
+};
+
+static void
+fill(uint8_t *data, enum pipe_format format)
+{
+   const struct util_format_description *desc =
+      util_format_description(format);
+   unsigned i;
+
+   for (i = 0; i < desc->nr_channels; i++) {
+      float f = (float) rand() / RAND_MAX * 2.0f - 1.0f;
+
+      if (desc->channel[0].size == 32)
+         memcpy(data + i * 4, &f, 4);
+      else if (desc->channel[0].size == 16) {
+         uint16_t h = util_float_to_half(f);
+         memcpy(data + i * 2, &h, 2);
+      }
+      else
+         data[i] = rand();
+   }
+}
+
+static double
+bench(struct translate *translate, const void *src, unsigned stride,
+      void *dst)
+{
+   int64_t start = os_time_get_nano(), end;
+   unsigned runs = 0;
+
+   do {
+      translate->set_buffer(translate, 0, src, stride, NUM_VERTICES);
+      translate->run(translate, 1, NUM_VERTICES - 1, 0, 0, dst);
+      runs++;
+      end = os_time_get_nano();
+   } while (end - start < 200000000);
+
+   return (double) runs * (NUM_VERTICES - 1) * 1e9 / (end - start);
+}
+
+int
+main(int argc, char **argv)
+{
+   unsigned i, j, k;
+   boolean has_avx2;
+   unsigned failed = 0;
+
+   util_cpu_detect();
+   has_avx2 = util_cpu_caps.has_avx2 && util_cpu_caps.has_f16c;
+
+   printf("%-14s %12s %12s %12s   (Mvertices/s)\n",
+          "format", "generic", "sse", has_avx2 ? "avx2" : "");
+
+   for (i = 0; i < ARRAY_SIZE(cases); i++) {
+      struct translate_key key;
+      struct translate *translate[3] = { NULL };
+      unsigned stride = 0, size;
+      uint8_t *src;
+      float *dst[3];
+      double rate[3] = { 0 };
+
+      memset(&key, 0, sizeof(key));
+      for (j = 0; j < ARRAY_SIZE(cases[i].formats) &&
+                  cases[i].formats[j]; j++) {
+         key.element[j].type = TRANSLATE_ELEMENT_NORMAL;
+         key.element[j].input_format = cases[i].formats[j];
+         key.element[j].input_offset = stride;
+         key.element[j].output_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+         key.element[j].output_offset = j * 16;
+         stride += util_format_get_blocksize(cases[i].formats[j]);
+      }
+      key.nr_elements = j;
+      key.output_stride = j * 16;
+
+      src = MALLOC(stride * NUM_VERTICES);
+      for (j = 0; j < NUM_VERTICES; j++) {
+         for (k = 0; k < key.nr_elements; k++)
+            fill(src + j * stride + key.element[k].input_offset,
+                 key.element[k].input_format);
+      }
+
+      translate[0] = translate_generic_create(&key);
+      util_cpu_caps.has_avx2 = 0;
+      translate[1] = translate_sse2_create(&key);
+      util_cpu_caps.has_avx2 = has_avx2;
+      if (has_avx2)
+         translate[2] = translate_sse2_create(&key);
+
+      size = key.output_stride * NUM_VERTICES;
+      for (j = 0; j < 3; j++) {
+         dst[j] = MALLOC(size);
+         memset(dst[j], 0xcd, size);
+         if (translate[j])
+            rate[j] = bench(translate[j], src, stride, dst[j]);
+      }
+
+      for (j = 1; j < 3; j++) {
+         if (!translate[j])
+            continue;
+         for (k = 0; k < size / sizeof(float); k++) {
+            if (fabsf(dst[j][k] - dst[0][k]) > 1e-6f * MAX2(1.0f, fabsf(dst[0][k]))) {
+               printf("FAIL: %s %s vertex %u: %f != %f\n", cases[i].name,
+                      j == 1 ? "sse" : "avx2",
+                      k * 4 / key.output_stride, dst[j][k], dst[0][k]);
+               failed++;
+               break;
+            }
+         }
+      }
+
+      printf("%-14s %12.1f %12.1f %12.1f\n", cases[i].name,
+             rate[0] / 1e6, rate[1] / 1e6, rate[2] / 1e6);
+
+      for (j = 0; j < 3; j++) {
+         if (translate[j])
+            translate[j]->release(translate[j]);
+         FREE(dst[j]);
+      }
+      FREE(src);
+   }
+
+   return failed ? 1 : 0;
+}
@@ -118,6 +118,28 @@ _mesa_clear_accum_buffer(struct gl_context *ctx)
 }
 
 
+/**
+ * Whether the color buffer only has 8-bit unorm RGB(A) channels.  Their
+ * float values are ubyte_to_float() of the bytes, and are packed back
+ * with float_to_ubyte(), so that the conversions of glAccum can be done
+ * with tables, on bytes unpacked and packed without floats.
+ */
+static GLboolean
+is_unorm8_color_format(mesa_format format)
+{
+   const GLenum base = _mesa_get_format_base_format(format);
+   const GLint alpha_bits = _mesa_get_format_bits(format, GL_ALPHA_BITS);
+
+   return (base == GL_RGBA || base == GL_RGB) &&
+          _mesa_get_format_datatype(format) == GL_UNSIGNED_NORMALIZED &&
+          !_mesa_is_format_srgb(format) &&
+          _mesa_get_format_bits(format, GL_RED_BITS) == 8 &&
+          _mesa_get_format_bits(format, GL_GREEN_BITS) == 8 &&
+          _mesa_get_format_bits(format, GL_BLUE_BITS) == 8 &&
+          (alpha_bits == 0 || alpha_bits == 8);
+}
+
+
 /**
  * if (bias)
  *    Accum += value
@@ -226,7 +248,44 @@ accum_or_load(struct gl_context *ctx, GLfloat value,
       return;
    }
 
-   if (accRb->Format == MESA_FORMAT_RGBA_SNORM16) {
+   if (accRb->Format == MESA_FORMAT_RGBA_SNORM16 &&
+       is_unorm8_color_format(colorRb->Format)) {
+      const GLfloat scale = value * 32767.0f;
+      GLshort table[256];
+      GLint i, j;
+      GLubyte *rgba;
+
+      for (i = 0; i < 256; i++)
+         table[i] = (GLshort) (ubyte_to_float(i) * scale);
+
+      rgba = malloc(width * 4);
+      if (rgba) {
+         for (j = 0; j < height; j++) {
+            GLshort *acc = (GLshort *) accMap;
+
+            _mesa_unpack_ubyte_rgba_row(colorRb->Format, width, colorMap,
+                                        (GLubyte (*)[4]) rgba);
+
+            if (load) {
+               for (i = 0; i < 4 * width; i++)
+                  acc[i] = table[rgba[i]];
+            }
+            else {
+               for (i = 0; i < 4 * width; i++)
+                  acc[i] += table[rgba[i]];
+            }
+
+            colorMap += colorRowStride;
+            accMap += accRowStride;
+         }
+
+         free(rgba);
+      }
+      else {
+         _mesa_error(ctx, GL_OUT_OF_MEMORY, "glAccum");
+      }
+   }
+   else if (accRb->Format == MESA_FORMAT_RGBA_SNORM16) {
       const GLfloat scale = value * 32767.0f;
       GLint i, j;
       GLfloat (*rgba)[4];
@@ -288,6 +347,7 @@ accum_return(struct gl_context *ctx, GLfloat value,
    GLubyte *accMap, *colorMap;
    GLint accRowStride, colorRowStride;
    GLuint buffer;
+   GLubyte *table = NULL;
 
    /* Map accum buffer */
    ctx->Driver.MapRenderbuffer(ctx, accRb, xpos, ypos, width, height,
@@ -319,7 +379,47 @@ accum_return(struct gl_context *ctx, GLfloat value,
          continue;
       }
 
-      if (accRb->Format == MESA_FORMAT_RGBA_SNORM16) {
+      /* A table of all the accum values only pays off for large areas */
+      if (!table && !masking &&
+          accRb->Format == MESA_FORMAT_RGBA_SNORM16 &&
+          is_unorm8_color_format(colorRb->Format) &&
+          width * height >= 16384) {
+         const GLfloat scale = value / 32767.0f;
+         GLuint i;
+
+         table = malloc(1 << 16);
+         if (table) {
+            for (i = 0; i < 1 << 16; i++)
+               table[i] = float_to_ubyte((GLshort) i * scale);
+         }
+      }
+
+      if (table && !masking && is_unorm8_color_format(colorRb->Format)) {
+         GLint i, j;
+         GLubyte *rgba = malloc(width * 4);
+
+         if (rgba) {
+            for (j = 0; j < height; j++) {
+               const GLushort *acc = (const GLushort *) accMap;
+
+               for (i = 0; i < 4 * width; i++)
+                  rgba[i] = table[acc[i]];
+
+               _mesa_pack_ubyte_rgba_row(colorRb->Format, width,
+                                         (const GLubyte (*)[4]) rgba,
+                                         colorMap);
+
+               accMap += accRowStride;
+               colorMap += colorRowStride;
+            }
+            accMap -= height * accRowStride;
+         }
+         else {
+            _mesa_error(ctx, GL_OUT_OF_MEMORY, "glAccum");
+         }
+         free(rgba);
+      }
+      else if (accRb->Format == MESA_FORMAT_RGBA_SNORM16) {
          const GLfloat scale = value / 32767.0f;
          GLint i, j;
          GLfloat (*rgba)[4], (*dest)[4];
@@ -382,6 +482,7 @@ accum_return(struct gl_context *ctx, GLfloat value,
       ctx->Driver.UnmapRenderbuffer(ctx, colorRb);
    }
 
+   free(table);
    ctx->Driver.UnmapRenderbuffer(ctx, accRb);
 }
 
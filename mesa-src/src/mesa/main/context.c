@@ -122,6 +122,7 @@
 #include "remap.h"
 #include "scissor.h"
 #include "shared.h"
+#include "shaderapi.h"
 #include "shaderobj.h"
 #include "shaderimage.h"
 #include "state.h"
@@ -130,6 +131,7 @@
 #include "util/strtod.h"
 #include "stencil.h"
 #include "shaderimage.h"
+#include "texcompress.h"
 #include "texcompress_s3tc.h"
 #include "texstate.h"
 #include "transformfeedback.h"
@@ -1326,6 +1328,9 @@ _mesa_free_context_data(struct gl_context *ctx, bool destroy_debug_output)
       _mesa_make_current(ctx, NULL, NULL);
    }
 
+   _mesa_destroy_shader_compiler_queue(ctx);
+   _mesa_destroy_texcompress_queue(ctx);
+
    /* unreference WinSysDraw/Read buffers */
    _mesa_reference_framebuffer(&ctx->WinSysDrawBuffer, NULL);
    _mesa_reference_framebuffer(&ctx->WinSysReadBuffer, NULL);
@@ -1326,6 +1326,13 @@ struct dd_function_table {
    void (*SetMaxShaderCompilerThreads)(struct gl_context *ctx, unsigned count);
    bool (*GetShaderProgramCompletionStatus)(struct gl_context *ctx,
                                             struct gl_shader_program *shprog);
+
+   /**
+    * Called on the context's own thread once a program linked on a compiler
+    * thread is first used, for the work which can't be done there.
+    */
+   void (*FinishBackgroundLink)(struct gl_context *ctx,
+                                struct gl_shader_program *shprog);
 };
 
 
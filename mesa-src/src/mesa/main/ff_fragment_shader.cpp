@@ -1145,6 +1145,9 @@ extern "C" {
 /**
  * Return a fragment program which implements the current
  * fixed-function texture, fog and color-sum operations.
+ *
+ * When the contexts of the share group can share programs, they also share
+ * the ones built for each state, so that each is only built once.
  */
 struct gl_shader_program *
 _mesa_get_fixed_func_fragment_program(struct gl_context *ctx)
@@ -1160,7 +1163,27 @@ _mesa_get_fixed_func_fragment_program(struct gl_context *ctx)
                                  &key, keySize);
 
    if (!shader_program) {
-      shader_program = create_new_program(ctx, &key);
+      struct gl_shared_state *shared = ctx->Shared;
+
+      if (ctx->Const.ShareFixedFuncPrograms &&
+          ctx->API == API_OPENGL_COMPAT) {
+         struct gl_shader_program *ref = NULL;
+
+         simple_mtx_lock(&shared->FixedFuncMutex);
+         shader_program = (struct gl_shader_program *)
+            _mesa_search_program_cache(shared->FixedFuncFragmentPrograms,
+                                       &key, keySize);
+         if (!shader_program) {
+            shader_program = create_new_program(ctx, &key);
+            _mesa_shader_cache_insert(ctx, shared->FixedFuncFragmentPrograms,
+                                      &key, keySize, shader_program);
+         }
+         /* The context's cache holds a reference of its own */
+         _mesa_reference_shader_program(ctx, &ref, shader_program);
+         simple_mtx_unlock(&shared->FixedFuncMutex);
+      } else {
+         shader_program = create_new_program(ctx, &key);
+      }
 
       _mesa_shader_cache_insert(ctx, ctx->FragmentProgram.Cache,
 				&key, keySize, shader_program);
@@ -1640,9 +1640,39 @@ create_new_program( const struct state_key *key,
 }
 
 
+/**
+ * Build the vertex program for the state key.
+ */
+static struct gl_program *
+build_fixed_func_vertex_program(struct gl_context *ctx,
+                                const struct state_key *key)
+{
+   struct gl_program *prog;
+
+   if (0)
+      printf("Build new TNL program\n");
+
+   prog = ctx->Driver.NewProgram(ctx, MESA_SHADER_VERTEX, 0, true);
+   if (!prog)
+      return NULL;
+
+   create_new_program( key, prog,
+                       ctx->Const.ShaderCompilerOptions[MESA_SHADER_VERTEX].OptimizeForAOS,
+                       ctx->Const.Program[MESA_SHADER_VERTEX].MaxTemps );
+
+   if (ctx->Driver.ProgramStringNotify)
+      ctx->Driver.ProgramStringNotify(ctx, GL_VERTEX_PROGRAM_ARB, prog);
+
+   return prog;
+}
+
+
 /**
  * Return a vertex program which implements the current fixed-function
  * transform/lighting/texgen operations.
+ *
+ * When the contexts of the share group can share programs, they also share
+ * the ones built for each state, so that each is only built once.
  */
 struct gl_program *
 _mesa_get_fixed_func_vertex_program(struct gl_context *ctx)
@@ -1663,21 +1693,33 @@ _mesa_get_fixed_func_vertex_program(struct gl_context *ctx)
                                      sizeof(key));
 
    if (!prog) {
-      /* OK, we'll have to build a new one */
-      if (0)
-         printf("Build new TNL program\n");
+      struct gl_shared_state *shared = ctx->Shared;
+      struct gl_program *ref = NULL;
+
+      if (ctx->Const.ShareFixedFuncPrograms &&
+          ctx->API == API_OPENGL_COMPAT) {
+         simple_mtx_lock(&shared->FixedFuncMutex);
+         prog = _mesa_search_program_cache(shared->FixedFuncVertexPrograms,
+                                           &key, sizeof(key));
+         if (!prog) {
+            prog = build_fixed_func_vertex_program(ctx, &key);
+            if (prog) {
+               _mesa_program_cache_insert(ctx,
+                                          shared->FixedFuncVertexPrograms,
+                                          &key, sizeof(key), prog);
+            }
+         }
+         /* The context's cache holds a reference of its own */
+         _mesa_reference_program(ctx, &ref, prog);
+         simple_mtx_unlock(&shared->FixedFuncMutex);
+      } else {
+         ref = build_fixed_func_vertex_program(ctx, &key);
+      }
 
-      prog = ctx->Driver.NewProgram(ctx, MESA_SHADER_VERTEX, 0, true);
-      if (!prog)
+      if (!ref)
          return NULL;
 
-      create_new_program( &key, prog,
-                          ctx->Const.ShaderCompilerOptions[MESA_SHADER_VERTEX].OptimizeForAOS,
-                          ctx->Const.Program[MESA_SHADER_VERTEX].MaxTemps );
-
-      if (ctx->Driver.ProgramStringNotify)
-         ctx->Driver.ProgramStringNotify(ctx, GL_VERTEX_PROGRAM_ARB, prog);
-
+      prog = ref;
       _mesa_program_cache_insert(ctx, ctx->VertexProgram.Cache, &key,
                                  sizeof(key), prog);
    }
@@ -29,6 +29,8 @@
 #include "glformats.h"
 #include "format_pack.h"
 #include "format_unpack.h"
+#include "sse_swizzle.h"
+#include "x86/common_x86_asm.h"
 
 const mesa_array_format RGBA32_FLOAT =
    MESA_ARRAY_FORMAT(MESA_ARRAY_FORMAT_BASE_FORMAT_RGBA_VARIANTS,
@@ -193,7 +195,7 @@ _mesa_compute_rgba2base2rgba_component_mapping(GLenum baseFormat, uint8_t *map)
 
 /**
  * Special case conversion function to swap r/b channels from the source
- * image to the dest image.
+ * image to the dest image, either way.
  */
 static void
 convert_ubyte_rgba_to_bgra(size_t width, size_t height,
@@ -202,6 +204,27 @@ convert_ubyte_rgba_to_bgra(size_t width, size_t height,
 {
    int row;
 
+#if defined(USE_SSE41)
+   if (cpu_has_sse4_1) {
+      static const uint8_t bgra[4] = { 2, 1, 0, 3 };
+
+      for (row = 0; row < height; row++) {
+         const GLuint *s = (const GLuint *) src;
+         GLuint *d = (GLuint *) dst;
+         int i = _mesa_swizzle_ubyte_sse41(dst, 4, src, 4, bgra, 0xff, width);
+
+         for (; i < width; i++) {
+            d[i] = ( (s[i] & 0xff00ff00) |
+                    ((s[i] &       0xff) << 16) |
+                    ((s[i] &   0xff0000) >> 16));
+         }
+         src += src_stride;
+         dst += dst_stride;
+      }
+      return;
+   }
+#endif
+
    if (sizeof(void *) == 8 &&
        src_stride % 8 == 0 &&
        dst_stride % 8 == 0 &&
@@ -347,6 +370,11 @@ _mesa_format_convert(void *void_dst, uint32_t dst_format, size_t dst_stride,
                dst += dst_stride;
             }
             return;
+         } else if (dst_array_format == RGBA8_UBYTE &&
+                    src_array_format == BGRA8_UBYTE) {
+            convert_ubyte_rgba_to_bgra(width, height, src, src_stride,
+                                       dst, dst_stride);
+            return;
          } else if (dst_array_format == RGBA8_UBYTE) {
             assert(!_mesa_is_format_integer_color(src_format));
             for (row = 0; row < height; ++row) {
@@ -1110,6 +1138,19 @@ convert_ubyte(void *void_dst, int num_dst_channels,
       }
       break;
    case MESA_ARRAY_FORMAT_TYPE_UBYTE:
+#if defined(USE_SSE41)
+      /* RGBA <-> BGRA, RGB <-> RGBA and the like */
+      if (cpu_has_sse4_1 && num_dst_channels >= 3 && num_src_channels >= 3) {
+         const int done =
+            _mesa_swizzle_ubyte_sse41(void_dst, num_dst_channels,
+                                      void_src, num_src_channels,
+                                      swizzle, one, count);
+
+         void_dst = (uint8_t *) void_dst + done * num_dst_channels;
+         void_src = (const uint8_t *) void_src + done * num_src_channels;
+         count -= done;
+      }
+#endif
       SWIZZLE_CONVERT(uint8_t, uint8_t, src);
       break;
    case MESA_ARRAY_FORMAT_TYPE_BYTE:
@@ -138,6 +138,12 @@ _mesa_MaxShaderCompilerThreadsKHR(GLuint count)
 
    ctx->Hint.MaxShaderCompilerThreads = count;
 
+   /* count == 0 makes glCompileShader and glLinkProgram synchronous again,
+    * the queue is left alone then.
+    */
+   if (count && util_queue_is_initialized(&ctx->ShaderCompilerQueue))
+      util_queue_adjust_num_threads(&ctx->ShaderCompilerQueue, count);
+
    if (ctx->Driver.SetMaxShaderCompilerThreads)
       ctx->Driver.SetMaxShaderCompilerThreads(ctx, count);
 }
@@ -2630,6 +2630,9 @@ struct gl_shader
 
    enum gl_compile_status CompileStatus;
 
+   /** Signalled once a glCompileShader on a compiler thread is done */
+   struct util_queue_fence CompileFence;
+
 #ifdef DEBUG
    unsigned SourceChecksum;       /**< for debug/logging purposes */
 #endif
@@ -2994,6 +2997,14 @@ struct gl_shader_program
    GLboolean BinaryRetrievableHint;
    GLboolean BinaryRetrievableHintPending;
 
+   /**
+    * glLinkProgram on a compiler thread: LinkFence is signalled once the
+    * link is done, and LinkPending stays set until the context has done the
+    * rest of the work, see _mesa_wait_shader_program().
+    */
+   struct util_queue_fence LinkFence;
+   bool LinkPending;
+
    /**
     * Indicates whether program can be bound for individual pipeline stages
     * using UseProgramStages after it is next linked.
@@ -3351,6 +3362,16 @@ struct gl_shared_state
    struct gl_program *DefaultFragmentProgram;
    /*@}*/
 
+   /**
+    * \name Fixed-function programs of the share group, by state, when
+    * gl_constants::ShareFixedFuncPrograms is set
+    */
+   /*@{*/
+   simple_mtx_t FixedFuncMutex;
+   struct gl_program_cache *FixedFuncVertexPrograms;
+   struct gl_program_cache *FixedFuncFragmentPrograms;
+   /*@}*/
+
    /* GL_ATI_fragment_shader */
    struct _mesa_HashTable *ATIShaders;
    struct ati_fragment_shader *DefaultFragmentShader;
@@ -4177,6 +4198,13 @@ struct gl_constants
    /** Does the driver make use of the NIR based GLSL linker */
    bool UseNIRGLSLLinker;
 
+   /**
+    * Whether the contexts of a share group can use the fixed-function
+    * programs built by each other, which needs programs that don't depend
+    * on the context they were built by.
+    */
+   bool ShareFixedFuncPrograms;
+
    /** Wether or not glBitmap uses red textures rather than alpha */
    bool BitmapUsesRed;
 
@@ -4959,6 +4987,18 @@ struct gl_context
 
    struct glthread_state GLThread;
 
+   /**
+    * Threads running glCompileShader and glLinkProgram for
+    * GL_KHR_parallel_shader_compile, see MESA_SHADER_COMPILER_THREADS.
+    */
+   struct util_queue ShaderCompilerQueue;
+
+   /**
+    * Threads encoding large images to S3TC and RGTC, see
+    * _mesa_compress_block_rows().
+    */
+   struct util_queue TexCompressQueue;
+
    struct gl_config Visual;
    struct gl_framebuffer *DrawBuffer;	/**< buffer for writing */
    struct gl_framebuffer *ReadBuffer;	/**< buffer for reading */
@@ -59,6 +59,10 @@ _mesa_delete_pipeline_object(struct gl_context *ctx,
 {
    unsigned i;
 
+   /* The compiler threads read ctx->_Shader->Flags. */
+   if (util_queue_is_initialized(&ctx->ShaderCompilerQueue))
+      util_queue_finish(&ctx->ShaderCompilerQueue);
+
    for (i = 0; i < MESA_SHADER_STAGES; i++) {
       _mesa_reference_program(ctx, &obj->CurrentProgram[i], NULL);
       _mesa_reference_shader_program(ctx, &obj->ReferencedPrograms[i], NULL);
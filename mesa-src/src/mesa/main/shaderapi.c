@@ -61,8 +61,10 @@
 #include "util/hash_table.h"
 #include "util/mesa-sha1.h"
 #include "util/crc32.h"
+#include "util/debug.h"
 #include "util/os_file.h"
 #include "util/simple_list.h"
+#include "util/simple_mtx.h"
 #include "util/u_string.h"
 
 /**
@@ -117,6 +119,71 @@ _mesa_get_shader_capture_path(void)
    return path;
 }
 
+/**
+ * Memoized version of env_var_as_unsigned("MESA_SHADER_COMPILER_THREADS").
+ */
+static unsigned
+get_shader_compiler_threads(void)
+{
+   static bool read_env_var = false;
+   static unsigned num_threads = 0;
+
+   if (!read_env_var) {
+      num_threads = env_var_as_unsigned("MESA_SHADER_COMPILER_THREADS", 0);
+      read_env_var = true;
+   }
+
+   return num_threads;
+}
+
+/**
+ * Return the queue glCompileShader and glLinkProgram run on, or NULL if they
+ * must run on this thread.  The queue is created on first use.
+ */
+static struct util_queue *
+get_shader_compiler_queue(struct gl_context *ctx)
+{
+   struct util_queue *queue = &ctx->ShaderCompilerQueue;
+   const unsigned num_threads = get_shader_compiler_threads();
+
+   if (!num_threads || !ctx->Hint.MaxShaderCompilerThreads)
+      return NULL;
+
+   if (!util_queue_is_initialized(queue)) {
+      if (!util_queue_init(queue, "glsl", 32, num_threads,
+                           UTIL_QUEUE_INIT_RESIZE_IF_FULL))
+         return NULL;
+
+      util_queue_adjust_num_threads(queue,
+                                    MIN2(ctx->Hint.MaxShaderCompilerThreads,
+                                         num_threads));
+   }
+
+   return queue;
+}
+
+/**
+ * Wait for the compiler threads of the context if a program may be linking
+ * the shader, before the shader is changed.
+ */
+static void
+wait_for_shader_users(struct gl_context *ctx, struct gl_shader *sh)
+{
+   if (sh->RefCount > 1 && util_queue_is_initialized(&ctx->ShaderCompilerQueue))
+      util_queue_finish(&ctx->ShaderCompilerQueue);
+}
+
+void
+_mesa_destroy_shader_compiler_queue(struct gl_context *ctx)
+{
+   if (util_queue_is_initialized(&ctx->ShaderCompilerQueue)) {
+      /* util_queue_destroy() drops the jobs which haven't started yet. */
+      util_queue_finish(&ctx->ShaderCompilerQueue);
+      util_queue_destroy(&ctx->ShaderCompilerQueue);
+      memset(&ctx->ShaderCompilerQueue, 0, sizeof(ctx->ShaderCompilerQueue));
+   }
+}
+
 /**
  * Initialize context's shader state.
  */
@@ -285,7 +352,8 @@ attach_shader_err(struct gl_context *ctx, GLuint program, GLuint shader,
    if (!shProg)
       return;
 
-   sh = _mesa_lookup_shader_err(ctx, shader, caller);
+   /* The shader may still be compiling, only its stage is looked at. */
+   sh = _mesa_lookup_shader_err_nowait(ctx, shader, caller);
    if (!sh) {
       return;
    }
@@ -326,7 +394,7 @@ attach_shader_no_error(struct gl_context *ctx, GLuint program, GLuint shader)
    struct gl_shader *sh;
 
    shProg = _mesa_lookup_shader_program(ctx, program);
-   sh = _mesa_lookup_shader(ctx, shader);
+   sh = _mesa_lookup_shader_nowait(ctx, shader);
 
    attach_shader(ctx, shProg, sh);
 }
@@ -419,7 +487,8 @@ delete_shader(struct gl_context *ctx, GLuint shader)
 {
    struct gl_shader *sh;
 
-   sh = _mesa_lookup_shader_err(ctx, shader, "glDeleteShader");
+   /* _mesa_delete_shader() waits for the compile once it's unreferenced. */
+   sh = _mesa_lookup_shader_err_nowait(ctx, shader, "glDeleteShader");
    if (!sh)
       return;
 
@@ -668,7 +737,8 @@ get_programiv(struct gl_context *ctx, GLuint program, GLenum pname,
               GLint *params)
 {
    struct gl_shader_program *shProg
-      = _mesa_lookup_shader_program_err(ctx, program, "glGetProgramiv(program)");
+      = _mesa_lookup_shader_program_err_nowait(ctx, program,
+                                               "glGetProgramiv(program)");
 
    /* Is transform feedback available in this context?
     */
@@ -695,6 +765,14 @@ get_programiv(struct gl_context *ctx, GLuint program, GLenum pname,
       return;
    }
 
+   if (pname == GL_COMPLETION_STATUS_ARB && shProg->LinkPending &&
+       !util_queue_fence_is_signalled(&shProg->LinkFence)) {
+      *params = GL_FALSE;
+      return;
+   }
+
+   _mesa_wait_shader_program(ctx, shProg);
+
    switch (pname) {
    case GL_DELETE_STATUS:
       *params = shProg->DeletePending;
@@ -1013,12 +1091,19 @@ static void
 get_shaderiv(struct gl_context *ctx, GLuint name, GLenum pname, GLint *params)
 {
    struct gl_shader *shader =
-      _mesa_lookup_shader_err(ctx, name, "glGetShaderiv");
+      _mesa_lookup_shader_err_nowait(ctx, name, "glGetShaderiv");
 
    if (!shader) {
       return;
    }
 
+   if (pname == GL_COMPLETION_STATUS_ARB) {
+      *params = util_queue_fence_is_signalled(&shader->CompileFence);
+      return;
+   }
+
+   util_queue_fence_wait(&shader->CompileFence);
+
    switch (pname) {
    case GL_SHADER_TYPE:
       *params = shader->Type;
@@ -1026,10 +1111,6 @@ get_shaderiv(struct gl_context *ctx, GLuint name, GLenum pname, GLint *params)
    case GL_DELETE_STATUS:
       *params = shader->DeletePending;
       break;
-   case GL_COMPLETION_STATUS_ARB:
-      /* _mesa_glsl_compile_shader is not offloaded to other threads. */
-      *params = GL_TRUE;
-      return;
    case GL_COMPILE_STATUS:
       *params = shader->CompileStatus ? GL_TRUE : GL_FALSE;
       break;
@@ -1171,26 +1252,12 @@ ensure_builtin_types(struct gl_context *ctx)
 }
 
 /**
- * Compile a shader.
+ * Compile a shader, once the builtin types are set up.  This may run on a
+ * compiler thread.
  */
-void
-_mesa_compile_shader(struct gl_context *ctx, struct gl_shader *sh)
+static void
+compile_shader(struct gl_context *ctx, struct gl_shader *sh)
 {
-   if (!sh)
-      return;
-
-   /* The GL_ARB_gl_spirv spec says:
-    *
-    *    "Add a new error for the CompileShader command:
-    *
-    *      An INVALID_OPERATION error is generated if the SPIR_V_BINARY_ARB
-    *      state of <shader> is TRUE."
-    */
-   if (sh->spirv_data) {
-      _mesa_error(ctx, GL_INVALID_OPERATION, "glCompileShader(SPIR-V)");
-      return;
-   }
-
    if (!sh->Source) {
       /* If the user called glCompileShader without first calling
        * glShaderSource, we should fail to compile, but not raise a GL_ERROR.
@@ -1203,8 +1270,6 @@ _mesa_compile_shader(struct gl_context *ctx, struct gl_shader *sh)
          _mesa_log("%s\n", sh->Source);
       }
 
-      ensure_builtin_types(ctx);
-
       /* this call will set the shader->CompileStatus field to indicate if
        * compilation was successful.
        */
@@ -1249,6 +1314,100 @@ _mesa_compile_shader(struct gl_context *ctx, struct gl_shader *sh)
    }
 }
 
+/**
+ * Check the GL errors of glCompileShader.
+ */
+static bool
+validate_compile_shader(struct gl_context *ctx, struct gl_shader *sh)
+{
+   if (!sh)
+      return false;
+
+   /* The GL_ARB_gl_spirv spec says:
+    *
+    *    "Add a new error for the CompileShader command:
+    *
+    *      An INVALID_OPERATION error is generated if the SPIR_V_BINARY_ARB
+    *      state of <shader> is TRUE."
+    */
+   if (sh->spirv_data) {
+      _mesa_error(ctx, GL_INVALID_OPERATION, "glCompileShader(SPIR-V)");
+      return false;
+   }
+
+   return true;
+}
+
+/**
+ * Compile a shader.
+ */
+void
+_mesa_compile_shader(struct gl_context *ctx, struct gl_shader *sh)
+{
+   if (!validate_compile_shader(ctx, sh))
+      return;
+
+   wait_for_shader_users(ctx, sh);
+
+   if (sh->Source)
+      ensure_builtin_types(ctx);
+
+   compile_shader(ctx, sh);
+}
+
+struct compile_shader_job
+{
+   struct gl_context *ctx;
+   struct gl_shader *sh;
+};
+
+static void
+compile_shader_job_execute(void *data, int thread_index)
+{
+   struct compile_shader_job *job = (struct compile_shader_job *) data;
+
+   compile_shader(job->ctx, job->sh);
+}
+
+static void
+compile_shader_job_cleanup(void *data, int thread_index)
+{
+   free(data);
+}
+
+/**
+ * Queue glCompileShader on a compiler thread, see
+ * MESA_SHADER_COMPILER_THREADS.  Returns false if the shader must be
+ * compiled here instead.
+ *
+ * Only shaders which aren't attached to a program are compiled in the
+ * background, so that no link reads the shader while it changes.  Anything
+ * else than attaching, deleting and asking for GL_COMPLETION_STATUS waits
+ * for the compile.
+ */
+static bool
+compile_shader_in_background(struct gl_context *ctx, struct gl_shader *sh)
+{
+   struct util_queue *queue = get_shader_compiler_queue(ctx);
+
+   if (!queue || !sh->Source || sh->RefCount > 1)
+      return false;
+
+   struct compile_shader_job *job = malloc(sizeof(*job));
+   if (!job)
+      return false;
+
+   job->ctx = ctx;
+   job->sh = sh;
+
+   ensure_builtin_types(ctx);
+
+   util_queue_add_job(queue, job, &sh->CompileFence,
+                      compile_shader_job_execute, compile_shader_job_cleanup,
+                      0);
+   return true;
+}
+
 
 struct update_programs_in_pipeline_params
 {
@@ -1273,12 +1432,101 @@ update_programs_in_pipeline(GLuint key, void *data, void *userData)
 }
 
 
+/**
+ * Serializes the links running on compiler threads with each other and with
+ * the links done on the context threads: programs may share shaders, and the
+ * linker changes the GLSL IR of the shaders.
+ */
+static simple_mtx_t link_mutex = _SIMPLE_MTX_INITIALIZER_NP;
+
+/**
+ * _mesa_glsl_link_shader(), once the shaders are compiled.  This may run on a
+ * compiler thread.
+ */
+static void
+link_program_shaders(struct gl_context *ctx,
+                     struct gl_shader_program *shProg)
+{
+   for (unsigned i = 0; i < shProg->NumShaders; i++)
+      util_queue_fence_wait(&shProg->Shaders[i]->CompileFence);
+
+   simple_mtx_lock(&link_mutex);
+   _mesa_glsl_link_shader(ctx, shProg);
+   simple_mtx_unlock(&link_mutex);
+}
+
+struct link_program_job
+{
+   struct gl_context *ctx;
+   struct gl_shader_program *shProg;
+};
+
+static void
+link_program_job_execute(void *data, int thread_index)
+{
+   struct link_program_job *job = (struct link_program_job *) data;
+   struct gl_context *ctx = job->ctx;
+   struct gl_shader_program *shProg = job->shProg;
+
+   link_program_shaders(ctx, shProg);
+
+   if (shProg->data->LinkStatus == LINKING_FAILURE &&
+       (ctx->_Shader->Flags & GLSL_REPORT_ERRORS)) {
+      _mesa_debug(ctx, "Error linking program %u:\n%s\n",
+                  shProg->Name, shProg->data->InfoLog);
+   }
+}
+
+static void
+link_program_job_cleanup(void *data, int thread_index)
+{
+   free(data);
+}
+
+/**
+ * Queue glLinkProgram on a compiler thread, see MESA_SHADER_COMPILER_THREADS.
+ * Returns false if the program must be linked here instead.
+ *
+ * Only programs which were never linked are linked in the background: they
+ * can't be in use, and the driver has no variants of them yet.  Everything
+ * which looks the program up waits for the link, see
+ * _mesa_wait_shader_program().
+ */
+static bool
+link_program_in_background(struct gl_context *ctx,
+                           struct gl_shader_program *shProg)
+{
+   struct util_queue *queue = get_shader_compiler_queue(ctx);
+
+   if (!queue || _mesa_get_shader_capture_path())
+      return false;
+
+   for (unsigned stage = 0; stage < MESA_SHADER_STAGES; stage++) {
+      if (shProg->_LinkedShaders[stage])
+         return false;
+   }
+
+   struct link_program_job *job = malloc(sizeof(*job));
+   if (!job)
+      return false;
+
+   job->ctx = ctx;
+   job->shProg = shProg;
+
+   shProg->BinaryRetrievableHint = shProg->BinaryRetrievableHintPending;
+   shProg->LinkPending = true;
+
+   util_queue_add_job(queue, job, &shProg->LinkFence,
+                      link_program_job_execute, link_program_job_cleanup, 0);
+   return true;
+}
+
 /**
  * Link a program's shaders.
  */
 static ALWAYS_INLINE void
 link_program(struct gl_context *ctx, struct gl_shader_program *shProg,
-             bool no_error)
+             bool no_error, bool allow_background)
 {
    if (!shProg)
       return;
@@ -1308,7 +1556,12 @@ link_program(struct gl_context *ctx, struct gl_shader_program *shProg,
    ensure_builtin_types(ctx);
 
    FLUSH_VERTICES(ctx, 0);
-   _mesa_glsl_link_shader(ctx, shProg);
+
+   if (allow_background && !programs_in_use &&
+       link_program_in_background(ctx, shProg))
+      return;
+
+   link_program_shaders(ctx, shProg);
 
    /* From section 7.3 (Program Objects) of the OpenGL 4.5 spec:
     *
@@ -1416,21 +1669,21 @@ link_program(struct gl_context *ctx, struct gl_shader_program *shProg,
 static void
 link_program_error(struct gl_context *ctx, struct gl_shader_program *shProg)
 {
-   link_program(ctx, shProg, false);
+   link_program(ctx, shProg, false, true);
 }
 
 
 static void
 link_program_no_error(struct gl_context *ctx, struct gl_shader_program *shProg)
 {
-   link_program(ctx, shProg, true);
+   link_program(ctx, shProg, true, true);
 }
 
 
 void
 _mesa_link_program(struct gl_context *ctx, struct gl_shader_program *shProg)
 {
-   link_program_error(ctx, shProg);
+   link_program(ctx, shProg, false, false);
 }
 
 
@@ -1611,8 +1864,15 @@ _mesa_CompileShader(GLuint shaderObj)
    GET_CURRENT_CONTEXT(ctx);
    if (MESA_VERBOSE & VERBOSE_API)
       _mesa_debug(ctx, "glCompileShader %u\n", shaderObj);
-   _mesa_compile_shader(ctx, _mesa_lookup_shader_err(ctx, shaderObj,
-                                                     "glCompileShader"));
+
+   struct gl_shader *sh =
+      _mesa_lookup_shader_err(ctx, shaderObj, "glCompileShader");
+
+   if (!validate_compile_shader(ctx, sh))
+      return;
+
+   if (!compile_shader_in_background(ctx, sh))
+      _mesa_compile_shader(ctx, sh);
 }
 
 
@@ -2116,6 +2376,7 @@ shader_source(struct gl_context *ctx, GLuint shaderObj, GLsizei count,
    }
 #endif /* ENABLE_SHADER_CACHE */
 
+   wait_for_shader_users(ctx, sh);
    set_shader_source(sh, source);
 
    free(offsets);
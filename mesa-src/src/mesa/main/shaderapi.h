@@ -70,6 +70,9 @@ _mesa_compile_shader(struct gl_context *ctx, struct gl_shader *sh);
 extern void
 _mesa_link_program(struct gl_context *ctx, struct gl_shader_program *sh_prog);
 
+extern void
+_mesa_destroy_shader_compiler_queue(struct gl_context *ctx);
+
 extern unsigned
 _mesa_count_active_attribs(struct gl_shader_program *shProg);
 
@@ -91,6 +91,7 @@ static void
 _mesa_init_shader(struct gl_shader *shader)
 {
    shader->RefCount = 1;
+   util_queue_fence_init(&shader->CompileFence);
    shader->info.Geom.VerticesOut = -1;
    shader->info.Geom.InputType = GL_TRIANGLES;
    shader->info.Geom.OutputType = GL_TRIANGLE_STRIP;
@@ -122,6 +123,9 @@ _mesa_new_shader(GLuint name, gl_shader_stage stage)
 void
 _mesa_delete_shader(struct gl_context *ctx, struct gl_shader *sh)
 {
+   util_queue_fence_wait(&sh->CompileFence);
+   util_queue_fence_destroy(&sh->CompileFence);
+
    _mesa_shader_spirv_data_reference(&sh->spirv_data, NULL);
    free((void *)sh->Source);
    free((void *)sh->FallbackSource);
@@ -144,10 +148,12 @@ _mesa_delete_linked_shader(struct gl_context *ctx,
 
 
 /**
- * Lookup a GLSL shader object.
+ * Lookup a GLSL shader object, without waiting for a glCompileShader
+ * running on a compiler thread.  Only for callers which don't look at the
+ * compiled shader.
  */
 struct gl_shader *
-_mesa_lookup_shader(struct gl_context *ctx, GLuint name)
+_mesa_lookup_shader_nowait(struct gl_context *ctx, GLuint name)
 {
    if (name) {
       struct gl_shader *sh = (struct gl_shader *)
@@ -166,10 +172,26 @@ _mesa_lookup_shader(struct gl_context *ctx, GLuint name)
 
 
 /**
- * As above, but record an error if shader is not found.
+ * Lookup a GLSL shader object.
  */
 struct gl_shader *
-_mesa_lookup_shader_err(struct gl_context *ctx, GLuint name, const char *caller)
+_mesa_lookup_shader(struct gl_context *ctx, GLuint name)
+{
+   struct gl_shader *sh = _mesa_lookup_shader_nowait(ctx, name);
+
+   if (sh)
+      util_queue_fence_wait(&sh->CompileFence);
+   return sh;
+}
+
+
+/**
+ * As _mesa_lookup_shader_nowait(), but record an error if shader is not
+ * found.
+ */
+struct gl_shader *
+_mesa_lookup_shader_err_nowait(struct gl_context *ctx, GLuint name,
+                               const char *caller)
 {
    if (!name) {
       _mesa_error(ctx, GL_INVALID_VALUE, "%s", caller);
@@ -191,6 +213,20 @@ _mesa_lookup_shader_err(struct gl_context *ctx, GLuint name, const char *caller)
 }
 
 
+/**
+ * As _mesa_lookup_shader(), but record an error if shader is not found.
+ */
+struct gl_shader *
+_mesa_lookup_shader_err(struct gl_context *ctx, GLuint name, const char *caller)
+{
+   struct gl_shader *sh = _mesa_lookup_shader_err_nowait(ctx, name, caller);
+
+   if (sh)
+      util_queue_fence_wait(&sh->CompileFence);
+   return sh;
+}
+
+
 
 /**********************************************************************/
 /*** Shader Program object functions                                ***/
@@ -285,6 +321,7 @@ init_shader_program(struct gl_shader_program *prog)
 {
    prog->Type = GL_SHADER_PROGRAM_MESA;
    prog->RefCount = 1;
+   util_queue_fence_init(&prog->LinkFence);
 
    prog->AttributeBindings = string_to_uint_map_ctor();
    prog->FragDataBindings = string_to_uint_map_ctor();
@@ -365,6 +402,8 @@ _mesa_free_shader_program_data(struct gl_context *ctx,
 
    assert(shProg->Type == GL_SHADER_PROGRAM_MESA);
 
+   util_queue_fence_wait(&shProg->LinkFence);
+
    _mesa_clear_shader_program_data(ctx, shProg);
 
    if (shProg->AttributeBindings) {
@@ -412,15 +451,37 @@ _mesa_delete_shader_program(struct gl_context *ctx,
                             struct gl_shader_program *shProg)
 {
    _mesa_free_shader_program_data(ctx, shProg);
+   util_queue_fence_destroy(&shProg->LinkFence);
    ralloc_free(shProg);
 }
 
 
 /**
- * Lookup a GLSL program object.
+ * Wait for a glLinkProgram running on a compiler thread, and finish it on
+ * this context.
+ */
+void
+_mesa_wait_shader_program(struct gl_context *ctx,
+                          struct gl_shader_program *shProg)
+{
+   if (likely(!shProg->LinkPending))
+      return;
+
+   util_queue_fence_wait(&shProg->LinkFence);
+
+   /* Another context sharing the program may be finishing it as well. */
+   if (p_atomic_cmpxchg(&shProg->LinkPending, true, false) &&
+       ctx->Driver.FinishBackgroundLink)
+      ctx->Driver.FinishBackgroundLink(ctx, shProg);
+}
+
+
+/**
+ * Lookup a GLSL program object, without waiting for a glLinkProgram running
+ * on a compiler thread.
  */
 struct gl_shader_program *
-_mesa_lookup_shader_program(struct gl_context *ctx, GLuint name)
+_mesa_lookup_shader_program_nowait(struct gl_context *ctx, GLuint name)
 {
    struct gl_shader_program *shProg;
    if (name) {
@@ -440,11 +501,27 @@ _mesa_lookup_shader_program(struct gl_context *ctx, GLuint name)
 
 
 /**
- * As above, but record an error if program is not found.
+ * Lookup a GLSL program object.
  */
 struct gl_shader_program *
-_mesa_lookup_shader_program_err(struct gl_context *ctx, GLuint name,
-                                const char *caller)
+_mesa_lookup_shader_program(struct gl_context *ctx, GLuint name)
+{
+   struct gl_shader_program *shProg =
+      _mesa_lookup_shader_program_nowait(ctx, name);
+
+   if (shProg)
+      _mesa_wait_shader_program(ctx, shProg);
+   return shProg;
+}
+
+
+/**
+ * As _mesa_lookup_shader_program_nowait(), but record an error if program is
+ * not found.
+ */
+struct gl_shader_program *
+_mesa_lookup_shader_program_err_nowait(struct gl_context *ctx, GLuint name,
+                                       const char *caller)
 {
    if (!name) {
       _mesa_error(ctx, GL_INVALID_VALUE, "%s", caller);
@@ -466,6 +543,23 @@ _mesa_lookup_shader_program_err(struct gl_context *ctx, GLuint name,
 }
 
 
+/**
+ * As _mesa_lookup_shader_program(), but record an error if program is not
+ * found.
+ */
+struct gl_shader_program *
+_mesa_lookup_shader_program_err(struct gl_context *ctx, GLuint name,
+                                const char *caller)
+{
+   struct gl_shader_program *shProg =
+      _mesa_lookup_shader_program_err_nowait(ctx, name, caller);
+
+   if (shProg)
+      _mesa_wait_shader_program(ctx, shProg);
+   return shProg;
+}
+
+
 void
 _mesa_init_shader_object_functions(struct dd_function_table *driver)
 {
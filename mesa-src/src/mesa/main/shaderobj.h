@@ -63,6 +63,13 @@ _mesa_lookup_shader(struct gl_context *ctx, GLuint name);
 extern struct gl_shader *
 _mesa_lookup_shader_err(struct gl_context *ctx, GLuint name, const char *caller);
 
+extern struct gl_shader *
+_mesa_lookup_shader_nowait(struct gl_context *ctx, GLuint name);
+
+extern struct gl_shader *
+_mesa_lookup_shader_err_nowait(struct gl_context *ctx, GLuint name,
+                               const char *caller);
+
 
 
 extern void
@@ -101,6 +108,17 @@ extern struct gl_shader_program *
 _mesa_lookup_shader_program_err(struct gl_context *ctx, GLuint name,
                                 const char *caller);
 
+extern struct gl_shader_program *
+_mesa_lookup_shader_program_nowait(struct gl_context *ctx, GLuint name);
+
+extern struct gl_shader_program *
+_mesa_lookup_shader_program_err_nowait(struct gl_context *ctx, GLuint name,
+                                       const char *caller);
+
+extern void
+_mesa_wait_shader_program(struct gl_context *ctx,
+                          struct gl_shader_program *shProg);
+
 extern struct gl_shader_program *
 _mesa_new_shader_program(GLuint name);
 
@@ -0,0 +1,89 @@
+/*
+ * Copyright © 2026 Mesa contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include "main/sse_swizzle.h"
+#include "main/formats.h"
+#include <smmintrin.h>
+#include <string.h>
+#include <assert.h>
+
+/**
+ * Swizzle 3 or 4 channel ubyte pixels to 3 or 4 channel ubyte pixels,
+ * four at a time with a byte shuffle, for _mesa_swizzle_and_convert().
+ * ZERO and ONE channels, and channels the source doesn't have, are
+ * filled in with 0 and \p one.  Only whole groups of four pixels whose
+ * 16 bytes of source can be read are done; the caller does the rest.
+ *
+ * \return  the number of pixels converted
+ */
+int
+_mesa_swizzle_ubyte_sse41(void *void_dst, int num_dst_channels,
+                          const void *void_src, int num_src_channels,
+                          const uint8_t swizzle[4], uint8_t one, int count)
+{
+   uint8_t *dst = void_dst;
+   const uint8_t *src = void_src;
+   uint8_t shuffle[16], fill[16];
+   __m128i shuffle4, fill4;
+   int p, c, i;
+
+   assert(num_dst_channels == 3 || num_dst_channels == 4);
+   assert(num_src_channels == 3 || num_src_channels == 4);
+
+   memset(shuffle, 0x80, sizeof(shuffle));
+   memset(fill, 0, sizeof(fill));
+   for (p = 0; p < 4; ++p) {
+      for (c = 0; c < num_dst_channels; ++c) {
+         const int pos = p * num_dst_channels + c;
+
+         if (swizzle[c] < num_src_channels)
+            shuffle[pos] = p * num_src_channels + swizzle[c];
+         else if (swizzle[c] == MESA_FORMAT_SWIZZLE_ONE)
+            fill[pos] = one;
+      }
+   }
+   shuffle4 = _mm_loadu_si128((const __m128i *)shuffle);
+   fill4 = _mm_loadu_si128((const __m128i *)fill);
+
+   for (i = 0; i * num_src_channels + 16 <= count * num_src_channels; i += 4) {
+      __m128i pixels = _mm_loadu_si128((const __m128i *)src);
+
+      pixels = _mm_or_si128(_mm_shuffle_epi8(pixels, shuffle4), fill4);
+
+      if (num_dst_channels == 4) {
+         _mm_storeu_si128((__m128i *)dst, pixels);
+      } else {
+         /* Exactly 12 bytes, so that in-place conversions keep working */
+         const uint32_t last = _mm_extract_epi32(pixels, 2);
+
+         _mm_storel_epi64((__m128i *)dst, pixels);
+         memcpy(dst + 8, &last, sizeof(last));
+      }
+
+      src += 4 * num_src_channels;
+      dst += 4 * num_dst_channels;
+   }
+
+   return i;
+}
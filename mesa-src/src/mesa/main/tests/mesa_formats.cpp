@@ -33,6 +33,11 @@
 
 #include "main/formats.h"
 #include "main/glformats.h"
+#include "main/format_utils.h"
+
+extern "C" {
+#include "main/cpuinfo.h"
+}
 
 /**
  * Debug/test: check that all uncompressed formats are handled in the
@@ -184,3 +189,62 @@ TEST(MesaFormatsTest, FormatMatchesFormatAndType)
                                                     GL_UNSIGNED_SHORT, false,
                                                     NULL));
 }
+
+/**
+ * Check the 3 and 4 channel ubyte conversions, which have SIMD paths,
+ * against a per pixel swizzle, at widths which leave a different number
+ * of pixels after the last full group of four.
+ */
+TEST(MesaFormatsTest, FormatConvertUbyteSwizzles)
+{
+   const uint8_t X = MESA_FORMAT_SWIZZLE_X, Y = MESA_FORMAT_SWIZZLE_Y;
+   const uint8_t Z = MESA_FORMAT_SWIZZLE_Z, W = MESA_FORMAT_SWIZZLE_W;
+   const uint8_t ONE = MESA_FORMAT_SWIZZLE_ONE;
+   const struct {
+      uint32_t src, dst;
+      int src_chans, dst_chans;
+      uint8_t swizzle[4];
+   } cases[] = {
+      { RGBA8_UBYTE, BGRA8_UBYTE, 4, 4, { Z, Y, X, W } },
+      { BGRA8_UBYTE, RGBA8_UBYTE, 4, 4, { Z, Y, X, W } },
+      { MESA_FORMAT_RGB_UNORM8, RGBA8_UBYTE, 3, 4, { X, Y, Z, ONE } },
+      { MESA_FORMAT_BGR_UNORM8, RGBA8_UBYTE, 3, 4, { Z, Y, X, ONE } },
+      { RGBA8_UBYTE, MESA_FORMAT_RGB_UNORM8, 4, 3, { X, Y, Z } },
+      { RGBA8_UBYTE, MESA_FORMAT_BGR_UNORM8, 4, 3, { Z, Y, X } },
+      { MESA_FORMAT_RGB_UNORM8, MESA_FORMAT_BGR_UNORM8, 3, 3, { Z, Y, X } },
+   };
+   uint8_t src[2][37 * 4], dst[2][37 * 4];
+
+   _mesa_get_cpu_features();
+
+   for (unsigned i = 0; i < sizeof(src); i++)
+      src[i / sizeof(src[0])][i % sizeof(src[0])] = i * 151 + 7;
+
+   for (unsigned c = 0; c < ARRAY_SIZE(cases); c++) {
+      for (int width = 1; width <= 37; width++) {
+         SCOPED_TRACE(testing::Message() << "case " << c << " width " << width);
+         const int src_stride = width * cases[c].src_chans;
+         const int dst_stride = width * cases[c].dst_chans;
+
+         memset(dst, 0, sizeof(dst));
+         _mesa_format_convert(dst, cases[c].dst, dst_stride,
+                              src, cases[c].src, src_stride,
+                              width, 2, NULL);
+
+         for (int y = 0; y < 2; y++) {
+            const uint8_t *s = (const uint8_t *) src + y * src_stride;
+            const uint8_t *d = (const uint8_t *) dst + y * dst_stride;
+
+            for (int x = 0; x < width; x++) {
+               for (int ch = 0; ch < cases[c].dst_chans; ch++) {
+                  const uint8_t sw = cases[c].swizzle[ch];
+                  const uint8_t expected =
+                     sw == ONE ? 0xff : s[x * cases[c].src_chans + sw];
+
+                  EXPECT_EQ(d[x * cases[c].dst_chans + ch], expected);
+               }
+            }
+         }
+      }
+   }
+}
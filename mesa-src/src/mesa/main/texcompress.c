@@ -42,6 +42,8 @@
 #include "texcompress_s3tc.h"
 #include "texcompress_etc.h"
 #include "texcompress_bptc.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_queue.h"
 
 
 /**
@@ -961,3 +963,92 @@ _mesa_decompress_image(mesa_format format, GLuint width, GLuint height,
       }
    }
 }
+
+
+/** The fewest block rows worth a thread of their own */
+#define COMPRESS_MIN_BLOCK_ROWS 16
+
+
+/** A band of block rows to encode, as a job of the TexCompressQueue */
+struct compress_job
+{
+   struct util_queue_fence fence;
+   compress_rows_func func;
+   void *data;
+   unsigned first_row, num_rows;
+};
+
+
+static void
+compress_job_execute(void *data, UNUSED int thread_index)
+{
+   const struct compress_job *job = data;
+
+   job->func(job->data, job->first_row, job->num_rows);
+}
+
+
+/**
+ * Encode the block_rows block rows of an image with func.  Large images are
+ * split in bands of block rows, which the threads of ctx->TexCompressQueue
+ * and this thread encode in parallel.  The queue is started on first use.
+ *
+ * \param func  must only write the blocks of the rows it is given
+ */
+void
+_mesa_compress_block_rows(struct gl_context *ctx, unsigned block_rows,
+                          compress_rows_func func, void *data)
+{
+   struct compress_job jobs[16];
+   unsigned num_jobs, rows_per_job, i;
+
+   util_cpu_detect();
+   num_jobs = MIN3(block_rows / COMPRESS_MIN_BLOCK_ROWS,
+                   util_cpu_caps.nr_cpus, ARRAY_SIZE(jobs));
+
+   if (num_jobs > 1 && !util_queue_is_initialized(&ctx->TexCompressQueue) &&
+       !util_queue_init(&ctx->TexCompressQueue, "texcompress",
+                        ARRAY_SIZE(jobs), util_cpu_caps.nr_cpus - 1,
+                        UTIL_QUEUE_INIT_RESIZE_IF_FULL))
+      num_jobs = 1;
+
+   if (num_jobs <= 1) {
+      func(data, 0, block_rows);
+      return;
+   }
+
+   rows_per_job = DIV_ROUND_UP(block_rows, num_jobs);
+
+   for (i = 0; i < num_jobs; i++) {
+      struct compress_job *job = &jobs[i];
+
+      job->func = func;
+      job->data = data;
+      job->first_row = MIN2(i * rows_per_job, block_rows);
+      job->num_rows = MIN2(rows_per_job, block_rows - job->first_row);
+   }
+
+   /* This thread takes the first band */
+   for (i = 1; i < num_jobs; i++) {
+      util_queue_fence_init(&jobs[i].fence);
+      util_queue_add_job(&ctx->TexCompressQueue, &jobs[i], &jobs[i].fence,
+                         compress_job_execute, NULL, 0);
+   }
+
+   compress_job_execute(&jobs[0], 0);
+
+   for (i = 1; i < num_jobs; i++) {
+      util_queue_fence_wait(&jobs[i].fence);
+      util_queue_fence_destroy(&jobs[i].fence);
+   }
+}
+
+
+void
+_mesa_destroy_texcompress_queue(struct gl_context *ctx)
+{
+   if (util_queue_is_initialized(&ctx->TexCompressQueue)) {
+      util_queue_destroy(&ctx->TexCompressQueue);
+      memset(&ctx->TexCompressQueue, 0, sizeof(ctx->TexCompressQueue));
+   }
+}
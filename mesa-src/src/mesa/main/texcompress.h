@@ -63,4 +63,16 @@ _mesa_decompress_image(mesa_format format, GLuint width, GLuint height,
                        const GLubyte *src, GLint srcRowStride,
                        GLfloat *dest);
 
+
+/** Encode num_rows block rows of an image, starting at first_row */
+typedef void (*compress_rows_func)(void *data, unsigned first_row,
+                                   unsigned num_rows);
+
+extern void
+_mesa_compress_block_rows(struct gl_context *ctx, unsigned block_rows,
+                          compress_rows_func func, void *data);
+
+extern void
+_mesa_destroy_texcompress_queue(struct gl_context *ctx);
+
 #endif /* TEXCOMPRESS_H */
@@ -74,18 +74,167 @@ static void extractsrc_s( GLbyte srcpixels[4][4], const GLfloat *srcaddr,
 }
 
 
-GLboolean
-_mesa_texstore_red_rgtc1(TEXSTORE_PARAMS)
+/** An image to encode to RGTC, band by band */
+struct rgtc_image
 {
+   const void *src;        /**< tightly packed 1 or 2 channel image */
    GLubyte *dst;
-   const GLubyte *tempImage = NULL;
+   GLint width, height;
+   GLint blockRowStride;
+};
+
+
+/**
+ * How far the encoders move per row of blocks.  Strides too small for the
+ * row are ignored.
+ */
+static GLint
+rgtc_block_row_stride(GLint width, GLint dstRowStride, GLint blockBytes)
+{
+   return dstRowStride >= width * blockBytes / 4 ?
+      dstRowStride : (width + 3) / 4 * blockBytes;
+}
+
+
+static void
+compress_red_rgtc1_rows(void *data, unsigned first_row, unsigned num_rows)
+{
+   const struct rgtc_image *img = data;
+   const GLubyte *tempImage = img->src;
+   const GLint srcWidth = img->width;
+   const GLint endRow = MIN2((first_row + num_rows) * 4, img->height);
    int i, j;
    int numxpixels, numypixels;
    const GLubyte *srcaddr;
    GLubyte srcpixels[4][4];
    GLubyte *blkaddr;
-   GLint dstRowDiff, redRowStride;
+
+   for (j = first_row * 4; j < endRow; j += 4) {
+      if (endRow > j + 3) numypixels = 4;
+      else numypixels = endRow - j;
+      srcaddr = tempImage + j * srcWidth;
+      blkaddr = img->dst + j / 4 * img->blockRowStride;
+      for (i = 0; i < srcWidth; i += 4) {
+	 if (srcWidth > i + 3) numxpixels = 4;
+	 else numxpixels = srcWidth - i;
+	 extractsrc_u(srcpixels, srcaddr, srcWidth, numxpixels, numypixels, 1);
+	 util_format_unsigned_encode_rgtc_ubyte(blkaddr, srcpixels, numxpixels, numypixels);
+	 srcaddr += numxpixels;
+	 blkaddr += 8;
+      }
+   }
+}
+
+static void
+compress_signed_red_rgtc1_rows(void *data, unsigned first_row,
+                               unsigned num_rows)
+{
+   const struct rgtc_image *img = data;
+   const GLfloat *tempImage = img->src;
+   const GLint srcWidth = img->width;
+   const GLint endRow = MIN2((first_row + num_rows) * 4, img->height);
+   int i, j;
+   int numxpixels, numypixels;
+   const GLfloat *srcaddr;
+   GLbyte srcpixels[4][4];
+   GLbyte *blkaddr;
+
+   for (j = first_row * 4; j < endRow; j += 4) {
+      if (endRow > j + 3) numypixels = 4;
+      else numypixels = endRow - j;
+      srcaddr = tempImage + j * srcWidth;
+      blkaddr = (GLbyte *) img->dst + j / 4 * img->blockRowStride;
+      for (i = 0; i < srcWidth; i += 4) {
+	 if (srcWidth > i + 3) numxpixels = 4;
+	 else numxpixels = srcWidth - i;
+	 extractsrc_s(srcpixels, srcaddr, srcWidth, numxpixels, numypixels, 1);
+	 util_format_signed_encode_rgtc_ubyte(blkaddr, srcpixels, numxpixels, numypixels);
+	 srcaddr += numxpixels;
+	 blkaddr += 8;
+      }
+   }
+}
+
+static void
+compress_rg_rgtc2_rows(void *data, unsigned first_row, unsigned num_rows)
+{
+   const struct rgtc_image *img = data;
+   const GLubyte *tempImage = img->src;
+   const GLint srcWidth = img->width;
+   const GLint endRow = MIN2((first_row + num_rows) * 4, img->height);
+   int i, j;
+   int numxpixels, numypixels;
+   const GLubyte *srcaddr;
+   GLubyte srcpixels[4][4];
+   GLubyte *blkaddr;
+
+   for (j = first_row * 4; j < endRow; j += 4) {
+      if (endRow > j + 3) numypixels = 4;
+      else numypixels = endRow - j;
+      srcaddr = tempImage + j * srcWidth * 2;
+      blkaddr = img->dst + j / 4 * img->blockRowStride;
+      for (i = 0; i < srcWidth; i += 4) {
+	 if (srcWidth > i + 3) numxpixels = 4;
+	 else numxpixels = srcWidth - i;
+	 extractsrc_u(srcpixels, srcaddr, srcWidth, numxpixels, numypixels, 2);
+	 util_format_unsigned_encode_rgtc_ubyte(blkaddr, srcpixels, numxpixels, numypixels);
+
+	 blkaddr += 8;
+	 extractsrc_u(srcpixels, (GLubyte *)srcaddr + 1, srcWidth, numxpixels, numypixels, 2);
+	 util_format_unsigned_encode_rgtc_ubyte(blkaddr, srcpixels, numxpixels, numypixels);
+
+	 blkaddr += 8;
+
+	 srcaddr += numxpixels * 2;
+      }
+   }
+}
+
+static void
+compress_signed_rg_rgtc2_rows(void *data, unsigned first_row,
+                              unsigned num_rows)
+{
+   const struct rgtc_image *img = data;
+   const GLfloat *tempImage = img->src;
+   const GLint srcWidth = img->width;
+   const GLint endRow = MIN2((first_row + num_rows) * 4, img->height);
+   int i, j;
+   int numxpixels, numypixels;
+   const GLfloat *srcaddr;
+   GLbyte srcpixels[4][4];
+   GLbyte *blkaddr;
+
+   for (j = first_row * 4; j < endRow; j += 4) {
+      if (endRow > j + 3) numypixels = 4;
+      else numypixels = endRow - j;
+      srcaddr = tempImage + j * srcWidth * 2;
+      blkaddr = (GLbyte *) img->dst + j / 4 * img->blockRowStride;
+      for (i = 0; i < srcWidth; i += 4) {
+	 if (srcWidth > i + 3) numxpixels = 4;
+	 else numxpixels = srcWidth - i;
+
+	 extractsrc_s(srcpixels, srcaddr, srcWidth, numxpixels, numypixels, 2);
+	 util_format_signed_encode_rgtc_ubyte(blkaddr, srcpixels, numxpixels, numypixels);
+	 blkaddr += 8;
+
+	 extractsrc_s(srcpixels, srcaddr + 1, srcWidth, numxpixels, numypixels, 2);
+	 util_format_signed_encode_rgtc_ubyte(blkaddr, srcpixels, numxpixels, numypixels);
+	 blkaddr += 8;
+
+	 srcaddr += numxpixels * 2;
+
+      }
+   }
+}
+
+
+GLboolean
+_mesa_texstore_red_rgtc1(TEXSTORE_PARAMS)
+{
+   const GLubyte *tempImage = NULL;
+   GLint redRowStride;
    GLubyte *tempImageSlices[1];
+   struct rgtc_image img;
 
    assert(dstFormat == MESA_FORMAT_R_RGTC1_UNORM ||
           dstFormat == MESA_FORMAT_L_LATC1_UNORM);
@@ -103,24 +252,13 @@ _mesa_texstore_red_rgtc1(TEXSTORE_PARAMS)
                   srcFormat, srcType, srcAddr,
                   srcPacking);
 
-   dst = dstSlices[0];
-
-   blkaddr = dst;
-   dstRowDiff = dstRowStride >= (srcWidth * 2) ? dstRowStride - (((srcWidth + 3) & ~3) * 2) : 0;
-   for (j = 0; j < srcHeight; j+=4) {
-      if (srcHeight > j + 3) numypixels = 4;
-      else numypixels = srcHeight - j;
-      srcaddr = tempImage + j * srcWidth;
-      for (i = 0; i < srcWidth; i += 4) {
-	 if (srcWidth > i + 3) numxpixels = 4;
-	 else numxpixels = srcWidth - i;
-	 extractsrc_u(srcpixels, srcaddr, srcWidth, numxpixels, numypixels, 1);
-	 util_format_unsigned_encode_rgtc_ubyte(blkaddr, srcpixels, numxpixels, numypixels);
-	 srcaddr += numxpixels;
-	 blkaddr += 8;
-      }
-      blkaddr += dstRowDiff;
-   }
+   img.src = tempImage;
+   img.dst = dstSlices[0];
+   img.width = srcWidth;
+   img.height = srcHeight;
+   img.blockRowStride = rgtc_block_row_stride(srcWidth, dstRowStride, 8);
+   _mesa_compress_block_rows(ctx, (srcHeight + 3) / 4,
+                             compress_red_rgtc1_rows, &img);
 
    free((void *) tempImage);
 
@@ -130,15 +268,10 @@ _mesa_texstore_red_rgtc1(TEXSTORE_PARAMS)
 GLboolean
 _mesa_texstore_signed_red_rgtc1(TEXSTORE_PARAMS)
 {
-   GLbyte *dst;
    const GLfloat *tempImage = NULL;
-   int i, j;
-   int numxpixels, numypixels;
-   const GLfloat *srcaddr;
-   GLbyte srcpixels[4][4];
-   GLbyte *blkaddr;
-   GLint dstRowDiff, redRowStride;
+   GLint redRowStride;
    GLfloat *tempImageSlices[1];
+   struct rgtc_image img;
 
    assert(dstFormat == MESA_FORMAT_R_RGTC1_SNORM ||
           dstFormat == MESA_FORMAT_L_LATC1_SNORM);
@@ -156,24 +289,13 @@ _mesa_texstore_signed_red_rgtc1(TEXSTORE_PARAMS)
                   srcFormat, srcType, srcAddr,
                   srcPacking);
 
-   dst = (GLbyte *) dstSlices[0];
-
-   blkaddr = dst;
-   dstRowDiff = dstRowStride >= (srcWidth * 2) ? dstRowStride - (((srcWidth + 3) & ~3) * 2) : 0;
-   for (j = 0; j < srcHeight; j+=4) {
-      if (srcHeight > j + 3) numypixels = 4;
-      else numypixels = srcHeight - j;
-      srcaddr = tempImage + j * srcWidth;
-      for (i = 0; i < srcWidth; i += 4) {
-	 if (srcWidth > i + 3) numxpixels = 4;
-	 else numxpixels = srcWidth - i;
-	 extractsrc_s(srcpixels, srcaddr, srcWidth, numxpixels, numypixels, 1);
-	 util_format_signed_encode_rgtc_ubyte(blkaddr, srcpixels, numxpixels, numypixels);
-	 srcaddr += numxpixels;
-	 blkaddr += 8;
-      }
-      blkaddr += dstRowDiff;
-   }
+   img.src = tempImage;
+   img.dst = dstSlices[0];
+   img.width = srcWidth;
+   img.height = srcHeight;
+   img.blockRowStride = rgtc_block_row_stride(srcWidth, dstRowStride, 8);
+   _mesa_compress_block_rows(ctx, (srcHeight + 3) / 4,
+                             compress_signed_red_rgtc1_rows, &img);
 
    free((void *) tempImage);
 
@@ -183,16 +305,11 @@ _mesa_texstore_signed_red_rgtc1(TEXSTORE_PARAMS)
 GLboolean
 _mesa_texstore_rg_rgtc2(TEXSTORE_PARAMS)
 {
-   GLubyte *dst;
    const GLubyte *tempImage = NULL;
-   int i, j;
-   int numxpixels, numypixels;
-   const GLubyte *srcaddr;
-   GLubyte srcpixels[4][4];
-   GLubyte *blkaddr;
-   GLint dstRowDiff, rgRowStride;
+   GLint rgRowStride;
    mesa_format tempFormat;
    GLubyte *tempImageSlices[1];
+   struct rgtc_image img;
 
    assert(dstFormat == MESA_FORMAT_RG_RGTC2_UNORM ||
           dstFormat == MESA_FORMAT_LA_LATC2_UNORM);
@@ -215,30 +332,13 @@ _mesa_texstore_rg_rgtc2(TEXSTORE_PARAMS)
                   srcFormat, srcType, srcAddr,
                   srcPacking);
 
-   dst = dstSlices[0];
-
-   blkaddr = dst;
-   dstRowDiff = dstRowStride >= (srcWidth * 4) ? dstRowStride - (((srcWidth + 3) & ~3) * 4) : 0;
-   for (j = 0; j < srcHeight; j+=4) {
-      if (srcHeight > j + 3) numypixels = 4;
-      else numypixels = srcHeight - j;
-      srcaddr = tempImage + j * srcWidth * 2;
-      for (i = 0; i < srcWidth; i += 4) {
-	 if (srcWidth > i + 3) numxpixels = 4;
-	 else numxpixels = srcWidth - i;
-	 extractsrc_u(srcpixels, srcaddr, srcWidth, numxpixels, numypixels, 2);
-	 util_format_unsigned_encode_rgtc_ubyte(blkaddr, srcpixels, numxpixels, numypixels);
-
-	 blkaddr += 8;
-	 extractsrc_u(srcpixels, (GLubyte *)srcaddr + 1, srcWidth, numxpixels, numypixels, 2);
-	 util_format_unsigned_encode_rgtc_ubyte(blkaddr, srcpixels, numxpixels, numypixels);
-
-	 blkaddr += 8;
-
-	 srcaddr += numxpixels * 2;
-      }
-      blkaddr += dstRowDiff;
-   }
+   img.src = tempImage;
+   img.dst = dstSlices[0];
+   img.width = srcWidth;
+   img.height = srcHeight;
+   img.blockRowStride = rgtc_block_row_stride(srcWidth, dstRowStride, 16);
+   _mesa_compress_block_rows(ctx, (srcHeight + 3) / 4,
+                             compress_rg_rgtc2_rows, &img);
 
    free((void *) tempImage);
 
@@ -248,16 +348,11 @@ _mesa_texstore_rg_rgtc2(TEXSTORE_PARAMS)
 GLboolean
 _mesa_texstore_signed_rg_rgtc2(TEXSTORE_PARAMS)
 {
-   GLbyte *dst;
    const GLfloat *tempImage = NULL;
-   int i, j;
-   int numxpixels, numypixels;
-   const GLfloat *srcaddr;
-   GLbyte srcpixels[4][4];
-   GLbyte *blkaddr;
-   GLint dstRowDiff, rgRowStride;
+   GLint rgRowStride;
    mesa_format tempFormat;
    GLfloat *tempImageSlices[1];
+   struct rgtc_image img;
 
    assert(dstFormat == MESA_FORMAT_RG_RGTC2_SNORM ||
           dstFormat == MESA_FORMAT_LA_LATC2_SNORM);
@@ -280,31 +375,13 @@ _mesa_texstore_signed_rg_rgtc2(TEXSTORE_PARAMS)
                   srcFormat, srcType, srcAddr,
                   srcPacking);
 
-   dst = (GLbyte *) dstSlices[0];
-
-   blkaddr = dst;
-   dstRowDiff = dstRowStride >= (srcWidth * 4) ? dstRowStride - (((srcWidth + 3) & ~3) * 4) : 0;
-   for (j = 0; j < srcHeight; j += 4) {
-      if (srcHeight > j + 3) numypixels = 4;
-      else numypixels = srcHeight - j;
-      srcaddr = tempImage + j * srcWidth * 2;
-      for (i = 0; i < srcWidth; i += 4) {
-	 if (srcWidth > i + 3) numxpixels = 4;
-	 else numxpixels = srcWidth - i;
-
-	 extractsrc_s(srcpixels, srcaddr, srcWidth, numxpixels, numypixels, 2);
-	 util_format_signed_encode_rgtc_ubyte(blkaddr, srcpixels, numxpixels, numypixels);
-	 blkaddr += 8;
-
-	 extractsrc_s(srcpixels, srcaddr + 1, srcWidth, numxpixels, numypixels, 2);
-	 util_format_signed_encode_rgtc_ubyte(blkaddr, srcpixels, numxpixels, numypixels);
-	 blkaddr += 8;
-
-	 srcaddr += numxpixels * 2;
-
-      }
-      blkaddr += dstRowDiff;
-   }
+   img.src = tempImage;
+   img.dst = dstSlices[0];
+   img.width = srcWidth;
+   img.height = srcHeight;
+   img.blockRowStride = rgtc_block_row_stride(srcWidth, dstRowStride, 16);
+   _mesa_compress_block_rows(ctx, (srcHeight + 3) / 4,
+                             compress_signed_rg_rgtc2_rows, &img);
 
    free((void *) tempImage);
 
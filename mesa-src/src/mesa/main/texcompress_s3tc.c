@@ -42,6 +42,62 @@
 #include "util/format_srgb.h"
 
 
+/** An image to encode with tx_compress_dxtn(), band by band */
+struct dxtn_image
+{
+   GLint srccomps;
+   GLint width, height;
+   const GLubyte *pixels;
+   GLenum destFormat;
+   GLubyte *dst;
+   GLint dstRowStride;
+   GLint blockRowStride;   /**< how far tx_compress_dxtn() moves per row */
+};
+
+
+static void
+compress_dxtn_rows(void *data, unsigned first_row, unsigned num_rows)
+{
+   const struct dxtn_image *img = data;
+   const GLint y = first_row * 4;
+
+   tx_compress_dxtn(img->srccomps, img->width,
+                    MIN2(num_rows * 4, img->height - y),
+                    img->pixels + y * img->width * img->srccomps,
+                    img->destFormat,
+                    img->dst + first_row * img->blockRowStride,
+                    img->dstRowStride);
+}
+
+
+/**
+ * tx_compress_dxtn(), with large images encoded on several threads.
+ */
+static void
+compress_dxtn(struct gl_context *ctx, GLint srccomps, GLint width,
+              GLint height, const GLubyte *pixels, GLenum destFormat,
+              GLubyte *dst, GLint dstRowStride)
+{
+   const GLint blockBytes =
+      destFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ||
+      destFormat == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ? 8 : 16;
+   struct dxtn_image img;
+
+   img.srccomps = srccomps;
+   img.width = width;
+   img.height = height;
+   img.pixels = pixels;
+   img.destFormat = destFormat;
+   img.dst = dst;
+   img.dstRowStride = dstRowStride;
+   /* tx_compress_dxtn() ignores strides too small for the row */
+   img.blockRowStride = dstRowStride >= width * blockBytes / 4 ?
+      dstRowStride : (width + 3) / 4 * blockBytes;
+
+   _mesa_compress_block_rows(ctx, (height + 3) / 4, compress_dxtn_rows, &img);
+}
+
+
 /**
  * Store user's image in rgb_dxt1 format.
  */
@@ -84,9 +140,9 @@ _mesa_texstore_rgb_dxt1(TEXSTORE_PARAMS)
 
    dst = dstSlices[0];
 
-   tx_compress_dxtn(3, srcWidth, srcHeight, pixels,
-                    GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
-                    dst, dstRowStride);
+   compress_dxtn(ctx, 3, srcWidth, srcHeight, pixels,
+                 GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+                 dst, dstRowStride);
 
    free((void *) tempImage);
 
@@ -140,9 +196,9 @@ _mesa_texstore_rgba_dxt1(TEXSTORE_PARAMS)
 
    dst = dstSlices[0];
 
-   tx_compress_dxtn(4, srcWidth, srcHeight, pixels,
-                    GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
-                    dst, dstRowStride);
+   compress_dxtn(ctx, 4, srcWidth, srcHeight, pixels,
+                 GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
+                 dst, dstRowStride);
 
    free((void*) tempImage);
 
@@ -195,9 +251,9 @@ _mesa_texstore_rgba_dxt3(TEXSTORE_PARAMS)
 
    dst = dstSlices[0];
 
-   tx_compress_dxtn(4, srcWidth, srcHeight, pixels,
-                    GL_COMPRESSED_RGBA_S3TC_DXT3_EXT,
-                    dst, dstRowStride);
+   compress_dxtn(ctx, 4, srcWidth, srcHeight, pixels,
+                 GL_COMPRESSED_RGBA_S3TC_DXT3_EXT,
+                 dst, dstRowStride);
 
    free((void *) tempImage);
 
@@ -250,9 +306,9 @@ _mesa_texstore_rgba_dxt5(TEXSTORE_PARAMS)
 
    dst = dstSlices[0];
 
-   tx_compress_dxtn(4, srcWidth, srcHeight, pixels,
-                    GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
-                    dst, dstRowStride);
+   compress_dxtn(ctx, 4, srcWidth, srcHeight, pixels,
+                 GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+                 dst, dstRowStride);
 
    free((void *) tempImage);
 
@@ -34,6 +34,7 @@
 #include "pipe/p_defines.h"
 #include "st_context.h"
 #include "st_atom.h"
+#include "st_debug.h"
 #include "st_program.h"
 #include "st_manager.h"
 #include "st_util.h"
@@ -49,16 +50,61 @@ static const update_func_t update_functions[] =
 #undef ST_STATE
 };
 
+/* The names of the update functions, for ST_DEBUG=atoms. */
+static const char *update_names[] =
+{
+#define ST_STATE(FLAG, st_update) #st_update,
+#include "st_atom_list.h"
+#undef ST_STATE
+};
+
 
 void st_init_atoms( struct st_context *st )
 {
    STATIC_ASSERT(ARRAY_SIZE(update_functions) <= 64);
+   STATIC_ASSERT(ARRAY_SIZE(update_functions) == ST_NUM_ATOMS);
 }
 
 
 void st_destroy_atoms( struct st_context *st )
 {
-   /* no-op */
+   unsigned i;
+
+   if (!(ST_DEBUG & DEBUG_ATOMS))
+      return;
+
+   debug_printf("st: atom updates (no-op updates didn't change driver "
+                "state):\n");
+   for (i = 0; i < ST_NUM_ATOMS; i++) {
+      unsigned updates = st->atom_stats.updates[i];
+      unsigned noops = st->atom_stats.noops[i];
+
+      if (!updates)
+         continue;
+
+      debug_printf("st:   %-36s %10u updates %10u no-op (%5.1f%%)\n",
+                   update_names[i], updates, noops,
+                   100.0 * noops / updates);
+   }
+}
+
+
+/**
+ * Run one state update for ST_DEBUG=atoms, and count it as a no-op if no
+ * state call got through to the driver.
+ */
+static void
+st_update_atom_counted(struct st_context *st, unsigned index)
+{
+   unsigned changes = cso_get_state_changes(st->cso_context) +
+                      st->pipe_state_changes;
+
+   update_functions[index](st);
+
+   st->atom_stats.updates[index]++;
+   if (changes == cso_get_state_changes(st->cso_context) +
+                  st->pipe_state_changes)
+      st->atom_stats.noops[index]++;
 }
 
 
@@ -254,14 +300,21 @@ void st_validate_state( struct st_context *st, enum st_pipeline pipeline )
    dirty_lo = dirty;
    dirty_hi = dirty >> 32;
 
-   /* Update states.
-    *
-    * Don't use u_bit_scan64, it may be slower on 32-bit.
-    */
-   while (dirty_lo)
-      update_functions[u_bit_scan(&dirty_lo)](st);
-   while (dirty_hi)
-      update_functions[32 + u_bit_scan(&dirty_hi)](st);
+   if (unlikely(ST_DEBUG & DEBUG_ATOMS)) {
+      while (dirty_lo)
+         st_update_atom_counted(st, u_bit_scan(&dirty_lo));
+      while (dirty_hi)
+         st_update_atom_counted(st, 32 + u_bit_scan(&dirty_hi));
+   } else {
+      /* Update states.
+       *
+       * Don't use u_bit_scan64, it may be slower on 32-bit.
+       */
+      while (dirty_lo)
+         update_functions[u_bit_scan(&dirty_lo)](st);
+      while (dirty_hi)
+         update_functions[32 + u_bit_scan(&dirty_hi)](st);
+   }
 
    /* Clear the render or compute state bits. */
    st->dirty &= ~pipeline_mask;
@@ -79,6 +79,7 @@ enum {
 #define ST_STATE(FLAG, st_update) FLAG##_INDEX,
 #include "st_atom_list.h"
 #undef ST_STATE
+   ST_NUM_ATOMS,
 };
 
 /* Define ST_NEW_xxx values as static const uint64_t values.
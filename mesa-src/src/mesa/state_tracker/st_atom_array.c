@@ -146,7 +146,8 @@ st_setup_arrays(struct st_context *st,
    GLbitfield userbuf_attribs = inputs_read & _mesa_draw_user_array_bits(ctx);
 
    *has_user_vertex_buffers = userbuf_attribs != 0;
-   st->draw_needs_minmax_index =
+   /* Drivers reading user buffers directly don't need the index bounds. */
+   st->draw_needs_minmax_index = !st->user_vertex_buffers_direct &&
       (userbuf_attribs & ~_mesa_draw_nonzero_divisor_bits(ctx)) != 0;
 
    if (vao->IsDynamic) {
@@ -341,8 +342,18 @@ st_update_array(struct st_context *st)
 
    /* _NEW_CURRENT_ATTRIB */
    /* Setup zero-stride attribs. */
-   int current_attrib_buffer =
-      st_setup_current(st, vp, vp_variant, &velements, vbuffer, &num_vbuffers);
+   int current_attrib_buffer = -1;
+   if (st->user_vertex_buffers_direct) {
+      /* The driver reads them in place at draw time, no need to upload. */
+      unsigned first_current = num_vbuffers;
+      st_setup_current_user(st, vp, vp_variant, &velements, vbuffer,
+                            &num_vbuffers);
+      uses_user_vertex_buffers |= num_vbuffers > first_current;
+   } else {
+      current_attrib_buffer =
+         st_setup_current(st, vp, vp_variant, &velements, vbuffer,
+                          &num_vbuffers);
+   }
 
    velements.count = vp->num_inputs + vp_variant->key.passthrough_edgeflags;
 
@@ -88,6 +88,7 @@ st_bind_atomics(struct st_context *st, struct gl_program *prog,
 
       st->pipe->set_shader_buffers(st->pipe, shader_type,
                                    buffer_base + atomic->Binding, 1, &sb, 0x1);
+      st->pipe_state_changes++;
       used_bindings = MAX2(atomic->Binding + 1, used_bindings);
    }
    st->last_used_atomic_bindings[shader_type] = used_bindings;
@@ -164,4 +165,5 @@ st_bind_hw_atomic_buffers(struct st_context *st)
       st_binding_to_sb(&st->ctx->AtomicBufferBindings[i], &buffers[i]);
 
    st->pipe->set_hw_atomic_buffers(st->pipe, 0, st->ctx->Const.MaxAtomicBufferBindings, buffers);
+   st->pipe_state_changes++;
 }
@@ -64,5 +64,6 @@ void st_update_clip( struct st_context *st )
    if (memcmp(&st->state.clip, &clip, sizeof(clip)) != 0) {
       st->state.clip = clip;
       st->pipe->set_clip_state(st->pipe, &clip);
+      st->pipe_state_changes++;
    }
 }
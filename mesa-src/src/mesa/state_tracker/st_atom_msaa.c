@@ -96,12 +96,14 @@ update_sample_locations(struct st_context *st)
           st->state.sample_locations_samples != samples ||
           memcmp(locations, st->state.sample_locations, size) != 0) {
          st->pipe->set_sample_locations( st->pipe, size, locations);
+         st->pipe_state_changes++;
          
          st->state.sample_locations_samples = samples;
          memcpy(st->state.sample_locations, locations, size);
       }
    } else if (st->state.enable_sample_locations) {
       st->pipe->set_sample_locations(st->pipe, 0, NULL);
+      st->pipe_state_changes++;
    }
 
    st->state.enable_sample_locations = fb->ProgrammableSampleLocations;
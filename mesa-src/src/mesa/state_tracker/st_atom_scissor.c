@@ -33,6 +33,7 @@
 
 #include "main/macros.h"
 #include "main/framebuffer.h"
+#include "util/u_math.h"
 #include "st_context.h"
 #include "pipe/p_context.h"
 #include "st_atom.h"
@@ -50,6 +51,8 @@ st_update_scissor( struct st_context *st )
    const struct gl_framebuffer *fb = ctx->DrawBuffer;
    const unsigned int fb_width = _mesa_geometric_width(fb);
    const unsigned int fb_height = _mesa_geometric_height(fb);
+   const bool xform = st->state.window_xform.enabled &&
+                      fb == ctx->WinSysDrawBuffer;
    GLint miny, maxy;
    unsigned i;
    bool changed = false;
@@ -64,14 +67,30 @@ st_update_scissor( struct st_context *st )
       scissor[i].maxy = fb_height;
 
       if (ctx->Scissor.EnableFlags & (1 << i)) {
+         GLint x = ctx->Scissor.ScissorArray[i].X;
+         GLint y = ctx->Scissor.ScissorArray[i].Y;
+         GLint xmax = x + ctx->Scissor.ScissorArray[i].Width;
+         GLint ymax = y + ctx->Scissor.ScissorArray[i].Height;
+
+         /* Rounded the same way on both sides of a piece's edge */
+         if (xform) {
+            const float *wscale = st->state.window_xform.scale;
+            const float *wtranslate = st->state.window_xform.translate;
+
+            x = util_iround(x * wscale[0] + wtranslate[0]);
+            y = util_iround(y * wscale[1] + wtranslate[1]);
+            xmax = util_iround(xmax * wscale[0] + wtranslate[0]);
+            ymax = util_iround(ymax * wscale[1] + wtranslate[1]);
+         }
+
          /* need to be careful here with xmax or ymax < 0 */
-         GLint xmax = MAX2(0, ctx->Scissor.ScissorArray[i].X + ctx->Scissor.ScissorArray[i].Width);
-         GLint ymax = MAX2(0, ctx->Scissor.ScissorArray[i].Y + ctx->Scissor.ScissorArray[i].Height);
+         xmax = MAX2(0, xmax);
+         ymax = MAX2(0, ymax);
 
-         if (ctx->Scissor.ScissorArray[i].X > (GLint)scissor[i].minx)
-            scissor[i].minx = ctx->Scissor.ScissorArray[i].X;
-         if (ctx->Scissor.ScissorArray[i].Y > (GLint)scissor[i].miny)
-            scissor[i].miny = ctx->Scissor.ScissorArray[i].Y;
+         if (x > (GLint)scissor[i].minx)
+            scissor[i].minx = x;
+         if (y > (GLint)scissor[i].miny)
+            scissor[i].miny = y;
 
          if (xmax < (GLint) scissor[i].maxx)
             scissor[i].maxx = xmax;
@@ -104,6 +123,7 @@ st_update_scissor( struct st_context *st )
       struct pipe_context *pipe = st->pipe;
 
       pipe->set_scissor_states(pipe, 0, st->state.num_viewports, scissor);
+      st->pipe_state_changes++;
    }
 }
 
@@ -143,7 +163,9 @@ st_update_window_rectangles(struct st_context *st)
       st->state.window_rects.include = include;
       changed = true;
    }
-   if (changed)
+   if (changed) {
       st->pipe->set_window_rectangles(
             st->pipe, include, num_rects, new_rects);
+      st->pipe_state_changes++;
+   }
 }
@@ -82,5 +82,6 @@ st_update_polygon_stipple( struct st_context *st )
       }
 
       st->pipe->set_polygon_stipple(st->pipe, &newStipple);
+      st->pipe_state_changes++;
    }
 }
@@ -78,6 +78,7 @@ st_bind_ssbos(struct st_context *st, struct gl_program *prog,
    st->pipe->set_shader_buffers(st->pipe, shader_type, 0,
                                 prog->info.num_ssbos, buffers,
                                 prog->sh.ShaderStorageBlocksWriteAccess);
+   st->pipe_state_changes++;
 
    /* Clear out any stale shader buffers (or lowered atomic counters). */
    int num_ssbos = prog->info.num_ssbos;
@@ -89,6 +90,7 @@ st_bind_ssbos(struct st_context *st, struct gl_program *prog,
             num_ssbos,
             st->last_num_ssbos[shader_type] - num_ssbos,
             NULL, 0);
+      st->pipe_state_changes++;
       st->last_num_ssbos[shader_type] = num_ssbos;
    }
 }
@@ -49,4 +49,5 @@ st_update_tess(struct st_context *st)
    pipe->set_tess_state(pipe,
                         ctx->TessCtrlProgram.patch_default_outer_level,
                         ctx->TessCtrlProgram.patch_default_inner_level);
+   st->pipe_state_changes++;
 }
@@ -50,6 +50,8 @@ void
 st_update_viewport( struct st_context *st )
 {
    struct gl_context *ctx = st->ctx;
+   const bool xform = st->state.window_xform.enabled &&
+                      ctx->DrawBuffer == ctx->WinSysDrawBuffer;
    unsigned i;
 
    /* _NEW_VIEWPORT 
@@ -60,6 +62,17 @@ st_update_viewport( struct st_context *st )
 
       _mesa_get_viewport_xform(ctx, i, scale, translate);
 
+      /* Into the piece of the window the framebuffer holds */
+      if (xform) {
+         const float *wscale = st->state.window_xform.scale;
+         const float *wtranslate = st->state.window_xform.translate;
+
+         scale[0] *= wscale[0];
+         scale[1] *= wscale[1];
+         translate[0] = translate[0] * wscale[0] + wtranslate[0];
+         translate[1] = translate[1] * wscale[1] + wtranslate[1];
+      }
+
       /* _NEW_BUFFERS */
       /* Drawing to a window where the coordinate system is upside down. */
       if (st->state.fb_orientation == Y_0_TOP) {
@@ -80,5 +93,6 @@ st_update_viewport( struct st_context *st )
 
       pipe->set_viewport_states(pipe, 1, st->state.num_viewports - 1,
                                 &st->state.viewport[1]);
+      st->pipe_state_changes++;
    }
 }
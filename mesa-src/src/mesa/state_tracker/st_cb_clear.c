@@ -242,10 +242,19 @@ clear_with_quad(struct gl_context *ctx, unsigned clear_buffers)
 
    _mesa_update_draw_buffer_bounds(ctx, ctx->DrawBuffer);
 
-   const GLfloat x0 = (GLfloat) ctx->DrawBuffer->_Xmin / fb_width * 2.0f - 1.0f;
-   const GLfloat x1 = (GLfloat) ctx->DrawBuffer->_Xmax / fb_width * 2.0f - 1.0f;
-   const GLfloat y0 = (GLfloat) ctx->DrawBuffer->_Ymin / fb_height * 2.0f - 1.0f;
-   const GLfloat y1 = (GLfloat) ctx->DrawBuffer->_Ymax / fb_height * 2.0f - 1.0f;
+   /* The bounds are in window coordinates, not the framebuffer's, under a
+    * window transform: cover it all and leave it to the scissor.
+    */
+   const bool xform = st->state.window_xform.enabled &&
+                      fb == ctx->WinSysDrawBuffer;
+   const GLfloat x0 = xform ? -1.0f :
+      (GLfloat) ctx->DrawBuffer->_Xmin / fb_width * 2.0f - 1.0f;
+   const GLfloat x1 = xform ? 1.0f :
+      (GLfloat) ctx->DrawBuffer->_Xmax / fb_width * 2.0f - 1.0f;
+   const GLfloat y0 = xform ? -1.0f :
+      (GLfloat) ctx->DrawBuffer->_Ymin / fb_height * 2.0f - 1.0f;
+   const GLfloat y1 = xform ? 1.0f :
+      (GLfloat) ctx->DrawBuffer->_Ymax / fb_height * 2.0f - 1.0f;
    unsigned num_layers = st->state.fb_num_layers;
 
    /*
@@ -372,6 +381,12 @@ static inline GLboolean
 is_scissor_enabled(struct gl_context *ctx, struct gl_renderbuffer *rb)
 {
    const struct gl_scissor_rect *scissor = &ctx->Scissor.ScissorArray[0];
+   const struct st_context *st = st_context(ctx);
+
+   /* The scissor box isn't in the framebuffer's coordinates */
+   if (st->state.window_xform.enabled &&
+       ctx->DrawBuffer == ctx->WinSysDrawBuffer)
+      return (ctx->Scissor.EnableFlags & 1) != 0;
 
    return (ctx->Scissor.EnableFlags & 1) &&
           (scissor->X > 0 ||
@@ -525,7 +540,12 @@ st_Clear(struct gl_context *ctx, GLbitfield mask)
       /* Now invert Y if needed.
        * Gallium drivers use the convention Y=0=top for surfaces.
        */
-      if (st->state.fb_orientation == Y_0_TOP) {
+      if (st->state.window_xform.enabled &&
+          ctx->DrawBuffer == ctx->WinSysDrawBuffer) {
+         /* Already transformed and inverted by st_update_scissor() */
+         scissor_state = st->state.scissor[0];
+      }
+      else if (st->state.fb_orientation == Y_0_TOP) {
          const struct gl_framebuffer *fb = ctx->DrawBuffer;
          /* use intermediate variables to avoid uint underflow */
          GLint miny, maxy;
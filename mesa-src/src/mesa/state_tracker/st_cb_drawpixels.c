@@ -43,6 +43,7 @@
 #include "main/pbo.h"
 #include "main/readpix.h"
 #include "main/state.h"
+#include "main/stencil.h"
 #include "main/texformat.h"
 #include "main/teximage.h"
 #include "main/texstore.h"
@@ -1396,6 +1397,101 @@ get_effective_raster_z(struct gl_context *ctx)
 /**
  * Called via ctx->Driver.DrawPixels()
  */
+/**
+ * For drivers whose resources can be mapped cheaply (those which don't
+ * prefer blit based transfers), copy a color image straight into the
+ * draw buffer, with a memcpy per row, when format and type match its
+ * layout and nothing would change the fragments on the way: no zoom,
+ * pixel transfer, texturing, fog, fragment program or per-fragment
+ * operations.  This skips the texture upload and the textured quad.
+ * The y flip of window system buffers is done by the map.
+ */
+static bool
+try_direct_drawpixels(struct gl_context *ctx, GLint x, GLint y,
+                      GLsizei width, GLsizei height,
+                      GLenum format, GLenum type,
+                      const struct gl_pixelstore_attrib *unpack,
+                      const void *pixels)
+{
+   struct st_context *st = st_context(ctx);
+   struct gl_framebuffer *fb = ctx->DrawBuffer;
+   struct gl_renderbuffer *rb = fb->_ColorDrawBuffers[0];
+   struct st_renderbuffer *strb = st_renderbuffer(rb);
+   struct gl_pixelstore_attrib clipped = *unpack;
+   mesa_format rb_format;
+   const GLubyte *src;
+   GLubyte *map;
+   GLint stride, src_stride, bytes_per_row, row;
+
+   if (st->prefer_blit_based_texture_transfer ||
+       fb->_NumColorDrawBuffers != 1 || !strb ||
+       strb->software || !strb->texture || strb->texture->nr_samples > 1)
+      return false;
+
+   if (ctx->_ImageTransferState ||
+       ctx->Pixel.ZoomX != 1.0f || ctx->Pixel.ZoomY != 1.0f ||
+       ctx->Texture._MaxEnabledTexImageUnit >= 0 ||
+       ctx->Fog.Enabled || _mesa_need_secondary_color(ctx) ||
+       ctx->_Shader->CurrentProgram[MESA_SHADER_FRAGMENT] ||
+       _mesa_arb_fragment_program_enabled(ctx) ||
+       _mesa_ati_fragment_shader_enabled(ctx) ||
+       ctx->Color.AlphaEnabled || ctx->Color.BlendEnabled ||
+       ctx->Color.ColorLogicOpEnabled ||
+       GET_COLORMASK(ctx->Color.ColorMask, 0) != 0xf ||
+       ctx->Depth.Test || _mesa_stencil_is_enabled(ctx) ||
+       ctx->Multisample.Enabled || ctx->RasterDiscard ||
+       ctx->Query.CurrentOcclusionObject || ctx->Query.CondRenderQuery ||
+       ctx->Scissor.WindowRectMode != GL_EXCLUSIVE_EXT ||
+       ctx->Scissor.NumWindowRects)
+      return false;
+
+   /* Unclamped colors would need the clamp, sRGB ones the encoding */
+   if (_mesa_get_format_datatype(rb->Format) != GL_UNSIGNED_NORMALIZED ||
+       (ctx->Color.sRGBEnabled && _mesa_is_format_srgb(rb->Format)))
+      return false;
+
+   rb_format = _mesa_get_srgb_format_linear(rb->Format);
+   if (!_mesa_format_matches_format_and_type(rb_format, format, type,
+                                             unpack->SwapBytes, NULL))
+      return false;
+
+   /* The draw buffer bounds include the scissor */
+   if (!_mesa_clip_drawpixels(ctx, &x, &y, &width, &height, &clipped))
+      return true;
+
+   pixels = _mesa_map_pbo_source(ctx, &clipped, pixels);
+   if (!pixels)
+      return true;
+
+   ctx->Driver.MapRenderbuffer(ctx, rb, x, y, width, height,
+                               GL_MAP_WRITE_BIT, &map, &stride, fb->FlipY);
+   if (!map) {
+      _mesa_unmap_pbo_source(ctx, &clipped);
+      return false;
+   }
+
+   src_stride = _mesa_image_row_stride(&clipped, width, format, type);
+   src = (const GLubyte *) _mesa_image_address2d(&clipped, pixels,
+                                                 width, height,
+                                                 format, type, 0, 0);
+   bytes_per_row = _mesa_get_format_bytes(rb_format) * width;
+
+   if (stride == bytes_per_row && src_stride == bytes_per_row) {
+      memcpy(map, src, bytes_per_row * height);
+   } else {
+      for (row = 0; row < height; row++) {
+         memcpy(map, src, bytes_per_row);
+         map += stride;
+         src += src_stride;
+      }
+   }
+
+   ctx->Driver.UnmapRenderbuffer(ctx, rb);
+   _mesa_unmap_pbo_source(ctx, &clipped);
+   return true;
+}
+
+
 static void
 st_DrawPixels(struct gl_context *ctx, GLint x, GLint y,
               GLsizei width, GLsizei height,
@@ -1422,6 +1518,10 @@ st_DrawPixels(struct gl_context *ctx, GLint x, GLint y,
 
    st_validate_state(st, ST_PIPELINE_META);
 
+   if (try_direct_drawpixels(ctx, x, y, width, height, format, type,
+                             unpack, pixels))
+      return;
+
    /* Limit the size of the glDrawPixels to the max texture size.
     * Strictly speaking, that's not correct but since we don't handle
     * larger images yet, this is better than crashing.
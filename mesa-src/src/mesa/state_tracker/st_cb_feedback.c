@@ -65,6 +65,10 @@ struct feedback_stage
    struct draw_stage stage;   /**< Base class */
    struct gl_context *ctx;            /**< Rendering context */
    GLboolean reset_stipple_counter;
+
+   /** Selection hits since the last flush, see select_flush() */
+   GLboolean hit;
+   GLfloat min_z, max_z;
 };
 
 
@@ -206,36 +210,60 @@ draw_glfeedback_stage(struct gl_context *ctx, struct draw_context *draw)
  * GL Selection functions
  **********************************************************************/
 
+/*
+ * The depth range of the hits is only kept in the stage, and given to
+ * the context on flush, which st_feedback_draw_vbo() does after each
+ * draw, before the name stack may change.
+ */
+static inline void
+select_hit(struct feedback_stage *fs, GLfloat min_z, GLfloat max_z)
+{
+   fs->hit = GL_TRUE;
+   fs->min_z = MIN2(fs->min_z, min_z);
+   fs->max_z = MAX2(fs->max_z, max_z);
+}
+
 static void
 select_tri( struct draw_stage *stage, struct prim_header *prim )
 {
-   struct feedback_stage *fs = feedback_stage(stage);
-   _mesa_update_hitflag( fs->ctx, prim->v[0]->data[0][2] );
-   _mesa_update_hitflag( fs->ctx, prim->v[1]->data[0][2] );
-   _mesa_update_hitflag( fs->ctx, prim->v[2]->data[0][2] );
+   const GLfloat z0 = prim->v[0]->data[0][2];
+   const GLfloat z1 = prim->v[1]->data[0][2];
+   const GLfloat z2 = prim->v[2]->data[0][2];
+
+   select_hit(feedback_stage(stage), MIN3(z0, z1, z2), MAX3(z0, z1, z2));
 }
 
 static void
 select_line( struct draw_stage *stage, struct prim_header *prim )
 {
-   struct feedback_stage *fs = feedback_stage(stage);
-   _mesa_update_hitflag( fs->ctx, prim->v[0]->data[0][2] );
-   _mesa_update_hitflag( fs->ctx, prim->v[1]->data[0][2] );
+   const GLfloat z0 = prim->v[0]->data[0][2];
+   const GLfloat z1 = prim->v[1]->data[0][2];
+
+   select_hit(feedback_stage(stage), MIN2(z0, z1), MAX2(z0, z1));
 }
 
 
 static void
 select_point( struct draw_stage *stage, struct prim_header *prim )
 {
-   struct feedback_stage *fs = feedback_stage(stage);
-   _mesa_update_hitflag( fs->ctx, prim->v[0]->data[0][2] );
+   const GLfloat z = prim->v[0]->data[0][2];
+
+   select_hit(feedback_stage(stage), z, z);
 }
 
 
 static void
 select_flush( struct draw_stage *stage, unsigned flags )
 {
-   /* no-op */
+   struct feedback_stage *fs = feedback_stage(stage);
+
+   if (fs->hit) {
+      _mesa_update_hitflag(fs->ctx, fs->min_z);
+      _mesa_update_hitflag(fs->ctx, fs->max_z);
+      fs->hit = GL_FALSE;
+      fs->min_z = FLT_MAX;
+      fs->max_z = -FLT_MAX;
+   }
 }
 
 
@@ -269,6 +297,8 @@ draw_glselect_stage(struct gl_context *ctx, struct draw_context *draw)
    fs->stage.reset_stipple_counter = select_reset_stipple_counter;
    fs->stage.destroy = select_destroy;
    fs->ctx = ctx;
+   fs->min_z = FLT_MAX;
+   fs->max_z = -FLT_MAX;
 
    return &fs->stage;
 }
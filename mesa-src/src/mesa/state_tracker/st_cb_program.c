@@ -185,6 +185,24 @@ st_get_shader_program_completion_status(struct gl_context *ctx,
    return true;
 }
 
+/**
+ * Finish a glLinkProgram done on a compiler thread, see
+ * _mesa_wait_shader_program().
+ */
+static void
+st_finish_background_link(struct gl_context *ctx,
+                          struct gl_shader_program *shprog)
+{
+   struct st_context *st = st_context(ctx);
+
+   for (unsigned i = 0; i < MESA_SHADER_STAGES; i++) {
+      struct gl_linked_shader *linked = shprog->_LinkedShaders[i];
+
+      if (linked && linked->Program)
+         st_precompile_deferred(st, linked->Program);
+   }
+}
+
 /**
  * Plug in the program and shader-related device driver functions.
  */
@@ -199,4 +217,5 @@ st_init_program_functions(struct dd_function_table *functions)
    functions->SetMaxShaderCompilerThreads = st_max_shader_compiler_threads;
    functions->GetShaderProgramCompletionStatus =
       st_get_shader_program_completion_status;
+   functions->FinishBackgroundLink = st_finish_background_link;
 }
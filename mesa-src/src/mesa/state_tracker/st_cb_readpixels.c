@@ -32,10 +32,17 @@
 #include "main/readpix.h"
 #include "main/enums.h"
 #include "main/framebuffer.h"
+#include "main/state.h"
+#include "util/u_endian.h"
 #include "util/u_inlines.h"
 #include "util/format/u_format.h"
 #include "cso_cache/cso_context.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "st_cb_bufferobjects.h"
 #include "st_cb_fbo.h"
 #include "st_atom.h"
 #include "st_context.h"
@@ -382,6 +389,264 @@ try_cached_readpixels(struct st_context *st, struct st_renderbuffer *strb,
    return dst;
 }
 
+/**
+ * Whether 8-bit RGBA/RGBX texels of rb_format read as format/type only
+ * need the R and B bytes swapped and/or the X byte set to one.
+ */
+static bool
+rgba8_readpixels_swizzle(mesa_format rb_format, GLenum format, GLenum type,
+                         GLboolean swap_bytes, bool *swap_rb,
+                         uint32_t *alpha)
+{
+   bool rb_is_bgr;
+
+   if (!UTIL_ARCH_LITTLE_ENDIAN || swap_bytes)
+      return false;
+   if (format != GL_RGBA && format != GL_BGRA)
+      return false;
+   if (type != GL_UNSIGNED_BYTE && type != GL_UNSIGNED_INT_8_8_8_8_REV)
+      return false;
+
+   switch (rb_format) {
+   case MESA_FORMAT_R8G8B8A8_UNORM:
+   case MESA_FORMAT_R8G8B8X8_UNORM:
+      rb_is_bgr = false;
+      break;
+   case MESA_FORMAT_B8G8R8A8_UNORM:
+   case MESA_FORMAT_B8G8R8X8_UNORM:
+      rb_is_bgr = true;
+      break;
+   default:
+      return false;
+   }
+
+   *swap_rb = rb_is_bgr != (format == GL_BGRA);
+   *alpha = (rb_format == MESA_FORMAT_R8G8B8X8_UNORM ||
+             rb_format == MESA_FORMAT_B8G8R8X8_UNORM) ? 0xff000000 : 0;
+   return true;
+}
+
+static void
+rgba8_swizzle_row(uint8_t *dst, const uint8_t *src, unsigned width,
+                  bool swap_rb, uint32_t alpha)
+{
+   unsigned i = 0;
+
+#if defined(__SSE2__)
+   const __m128i ag_mask = _mm_set1_epi32(0xff00ff00);
+   const __m128i byte_mask = _mm_set1_epi32(0xff);
+   const __m128i alpha4 = _mm_set1_epi32(alpha);
+
+   for (; i + 4 <= width; i += 4) {
+      __m128i p = _mm_loadu_si128((const __m128i *)(src + i * 4));
+
+      if (swap_rb) {
+         __m128i r = _mm_and_si128(_mm_srli_epi32(p, 16), byte_mask);
+         __m128i b = _mm_slli_epi32(_mm_and_si128(p, byte_mask), 16);
+         p = _mm_or_si128(_mm_and_si128(p, ag_mask), _mm_or_si128(r, b));
+      }
+      _mm_storeu_si128((__m128i *)(dst + i * 4), _mm_or_si128(p, alpha4));
+   }
+#endif
+
+   for (; i < width; i++) {
+      uint32_t p;
+
+      memcpy(&p, src + i * 4, 4);
+      if (swap_rb)
+         p = (p & 0xff00ff00) | ((p >> 16) & 0xff) | ((p & 0xff) << 16);
+      p |= alpha;
+      memcpy(dst + i * 4, &p, 4);
+   }
+}
+
+/**
+ * For drivers whose resources can be mapped cheaply (those which don't
+ * prefer blit based transfers), copy a color renderbuffer straight into
+ * the client memory or PBO, with a memcpy when format and type match its
+ * layout, or an R/B swap when they only differ by that.  The y flip of
+ * window system buffers is done by the map.
+ */
+static bool
+try_direct_readpixels(struct gl_context *ctx, struct st_renderbuffer *strb,
+                      GLint x, GLint y, GLsizei width, GLsizei height,
+                      GLenum format, GLenum type,
+                      const struct gl_pixelstore_attrib *pack,
+                      void *pixels)
+{
+   struct gl_renderbuffer *rb = &strb->Base;
+   mesa_format rb_format;
+   bool swap_rb = false;
+   uint32_t alpha = 0;
+   GLubyte *dst, *map;
+   GLint stride, dst_stride, bytes_per_row, row;
+
+   if (rb != ctx->ReadBuffer->_ColorReadBuffer ||
+       strb->software || !strb->texture || strb->texture->nr_samples > 1)
+      return false;
+
+   if (ctx->NewState)
+      _mesa_update_state(ctx);
+
+   if (rb->_BaseFormat != _mesa_get_format_base_format(rb->Format) ||
+       _mesa_readpixels_needs_slow_path(ctx, format, type, GL_FALSE))
+      return false;
+
+   rb_format = _mesa_get_srgb_format_linear(rb->Format);
+   if (!_mesa_format_matches_format_and_type(rb_format, format, type,
+                                             pack->SwapBytes, NULL) &&
+       !rgba8_readpixels_swizzle(rb_format, format, type, pack->SwapBytes,
+                                 &swap_rb, &alpha))
+      return false;
+
+   pixels = _mesa_map_pbo_dest(ctx, pack, pixels);
+   if (!pixels)
+      return true;
+
+   ctx->Driver.MapRenderbuffer(ctx, rb, x, y, width, height, GL_MAP_READ_BIT,
+                               &map, &stride, ctx->ReadBuffer->FlipY);
+   if (!map) {
+      _mesa_unmap_pbo_dest(ctx, pack);
+      return false;
+   }
+
+   dst_stride = _mesa_image_row_stride(pack, width, format, type);
+   dst = (GLubyte *) _mesa_image_address2d(pack, pixels, width, height,
+                                           format, type, 0, 0);
+   bytes_per_row = _mesa_get_format_bytes(rb_format) * width;
+
+   if (!swap_rb && !alpha &&
+       stride == bytes_per_row && dst_stride == bytes_per_row) {
+      memcpy(dst, map, bytes_per_row * height);
+   } else {
+      for (row = 0; row < height; row++) {
+         if (swap_rb || alpha)
+            rgba8_swizzle_row(dst, map, width, swap_rb, alpha);
+         else
+            memcpy(dst, map, bytes_per_row);
+         dst += dst_stride;
+         map += stride;
+      }
+   }
+
+   ctx->Driver.UnmapRenderbuffer(ctx, rb);
+   _mesa_unmap_pbo_dest(ctx, pack);
+   return true;
+}
+
+/**
+ * Read a color renderbuffer with pipe_context::readback_to_buffer, which
+ * lets the driver queue the copy behind the rendering, and resolves
+ * multisampled ones without a resolve blit first.  For a PBO only
+ * mapping it waits for the copy.  Client memory is wrapped in a user
+ * buffer, and waited for here, the copy is still spread over the driver's
+ * threads.
+ */
+static bool
+try_readback_to_buffer(struct st_context *st, struct st_renderbuffer *strb,
+                       GLint x, GLint y, GLsizei width, GLsizei height,
+                       GLenum format, GLenum type,
+                       const struct gl_pixelstore_attrib *pack,
+                       void *pixels)
+{
+   struct gl_context *ctx = st->ctx;
+   struct pipe_context *pipe = st->pipe;
+   struct pipe_screen *screen = pipe->screen;
+   struct gl_renderbuffer *rb = &strb->Base;
+   struct pipe_resource *buf = NULL;
+   enum pipe_format src_format, dst_format;
+   struct pipe_box box;
+   intptr_t offset;
+   GLint stride;
+   bool success;
+
+   if (!pipe->readback_to_buffer || pack->Invert ||
+       rb != ctx->ReadBuffer->_ColorReadBuffer ||
+       strb->software || !strb->surface)
+      return false;
+
+   if (!pack->BufferObj &&
+       (!screen->resource_from_user_memory ||
+        !screen->get_param(screen, PIPE_CAP_RESOURCE_FROM_USER_MEMORY)))
+      return false;
+
+   if (ctx->NewState)
+      _mesa_update_state(ctx);
+
+   if (rb->_BaseFormat != _mesa_get_format_base_format(rb->Format) ||
+       _mesa_readpixels_needs_slow_path(ctx, format, type, GL_TRUE) ||
+       needs_integer_signed_unsigned_conversion(ctx, format, type))
+      return false;
+
+   /* Luminance and intensity read back as red, leave those to the blit. */
+   src_format = util_format_linear(strb->surface->format);
+   if (util_format_luminance_to_red(src_format) != src_format ||
+       util_format_intensity_to_red(src_format) != src_format)
+      return false;
+
+   dst_format = st_choose_matching_format(st, 0, format, type,
+                                          pack->SwapBytes);
+   if (dst_format == PIPE_FORMAT_NONE)
+      return false;
+
+   offset = (intptr_t) _mesa_image_address2d(pack, pixels, width, height,
+                                             format, type, 0, 0);
+   stride = _mesa_image_row_stride(pack, width, format, type);
+
+   /* Window system buffers are upside down, copy their rows bottom up. */
+   if (ctx->ReadBuffer->FlipY) {
+      y = rb->Height - y - height;
+      offset += (intptr_t) (height - 1) * stride;
+      stride = -stride;
+   }
+
+   if (pack->BufferObj) {
+      struct st_buffer_object *stobj = st_buffer_object(pack->BufferObj);
+
+      if (!stobj->buffer || offset < 0 || offset > UINT_MAX)
+         return false;
+      pipe_resource_reference(&buf, stobj->buffer);
+   } else {
+      /* Wrap the rows which are written, from the lowest one. */
+      const intptr_t last = offset + (intptr_t) (height - 1) * stride;
+      const uintptr_t base = MIN2(offset, last);
+      struct pipe_resource templat;
+
+      memset(&templat, 0, sizeof(templat));
+      templat.target = PIPE_BUFFER;
+      templat.format = PIPE_FORMAT_R8_UNORM;
+      templat.width0 = MAX2(offset, last) - base +
+                       width * util_format_get_blocksize(dst_format);
+      templat.height0 = 1;
+      templat.depth0 = 1;
+      templat.array_size = 1;
+      templat.usage = PIPE_USAGE_STAGING;
+
+      buf = screen->resource_from_user_memory(screen, &templat,
+                                              (void *) base);
+      if (!buf)
+         return false;
+      offset -= base;
+   }
+
+   u_box_2d(x, y, width, height, &box);
+   success = pipe->readback_to_buffer(pipe, strb->surface, &box, buf,
+                                      dst_format, offset, stride);
+
+   if (success && !pack->BufferObj) {
+      struct pipe_fence_handle *fence = NULL;
+
+      pipe->flush(pipe, &fence, 0);
+      if (fence) {
+         screen->fence_finish(screen, NULL, fence, PIPE_TIMEOUT_INFINITE);
+         screen->fence_reference(screen, &fence, NULL);
+      }
+   }
+
+   pipe_resource_reference(&buf, NULL);
+   return success;
+}
+
 /**
  * This uses a blit to copy the read buffer to a texture format which matches
  * the format and type combo and then a fast read-back is done using memcpy.
@@ -420,7 +685,14 @@ st_ReadPixels(struct gl_context *ctx, GLint x, GLint y,
    st_validate_state(st, ST_PIPELINE_UPDATE_FRAMEBUFFER);
    st_flush_bitmap_cache(st);
 
+   if (try_readback_to_buffer(st, strb, x, y, width, height,
+                              format, type, pack, pixels))
+      return;
+
    if (!st->prefer_blit_based_texture_transfer) {
+      if (try_direct_readpixels(ctx, strb, x, y, width, height,
+                                format, type, pack, pixels))
+         return;
       goto fallback;
    }
 
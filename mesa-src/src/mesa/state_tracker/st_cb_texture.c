@@ -75,6 +75,8 @@
 #include "util/u_sampler.h"
 #include "util/u_math.h"
 #include "util/u_box.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_queue.h"
 #include "util/u_simple_shaders.h"
 #include "cso_cache/cso_context.h"
 #include "tgsi/tgsi_ureg.h"
@@ -363,6 +365,113 @@ st_MapTextureImage(struct gl_context *ctx,
 }
 
 
+/** The fewest block rows worth a thread of their own */
+#define DECOMPRESS_MIN_BLOCK_ROWS 32
+
+
+/**
+ * Rows of a compressed format fallback image to decompress, as a job of
+ * st_context::decompress_queue.
+ */
+struct st_decompress_job
+{
+   struct util_queue_fence fence;
+   mesa_format format;
+   bool bgra;
+   uint8_t *dst;
+   unsigned dst_stride;
+   const uint8_t *src;
+   unsigned src_stride;
+   unsigned width, height;
+};
+
+
+static void
+decompress_rows(void *data, UNUSED int thread_index)
+{
+   const struct st_decompress_job *job = data;
+
+   if (job->format == MESA_FORMAT_ETC1_RGB8) {
+      _mesa_etc1_unpack_rgba8888(job->dst, job->dst_stride,
+                                 job->src, job->src_stride,
+                                 job->width, job->height);
+   } else if (_mesa_is_format_etc2(job->format)) {
+      _mesa_unpack_etc2_format(job->dst, job->dst_stride,
+                               job->src, job->src_stride,
+                               job->width, job->height,
+                               job->format, job->bgra);
+   } else if (_mesa_is_format_astc_2d(job->format)) {
+      _mesa_unpack_astc_2d_ldr(job->dst, job->dst_stride,
+                               job->src, job->src_stride,
+                               job->width, job->height,
+                               job->format);
+   } else {
+      unreachable("unexpected format for a compressed format fallback");
+   }
+}
+
+
+/**
+ * Decompress an image of a compressed format fallback.  Large images are
+ * split in bands of block rows, which the threads of the decompress queue
+ * and this thread decompress in parallel.  The queue is started on first
+ * use.
+ */
+static void
+decompress_image(struct st_context *st, mesa_format format, bool bgra,
+                 uint8_t *dst, unsigned dst_stride,
+                 const uint8_t *src, unsigned src_stride,
+                 unsigned width, unsigned height)
+{
+   struct st_decompress_job jobs[16];
+   unsigned blk_w, blk_h, block_rows, num_jobs, rows_per_job, i;
+
+   _mesa_get_format_block_size(format, &blk_w, &blk_h);
+   block_rows = DIV_ROUND_UP(height, blk_h);
+
+   util_cpu_detect();
+   num_jobs = MIN3(block_rows / DECOMPRESS_MIN_BLOCK_ROWS,
+                   util_cpu_caps.nr_cpus, ARRAY_SIZE(jobs));
+
+   if (num_jobs > 1 && !util_queue_is_initialized(&st->decompress_queue) &&
+       !util_queue_init(&st->decompress_queue, "st_decompress",
+                        ARRAY_SIZE(jobs), util_cpu_caps.nr_cpus - 1,
+                        UTIL_QUEUE_INIT_RESIZE_IF_FULL))
+      num_jobs = 1;
+
+   num_jobs = MAX2(num_jobs, 1);
+   rows_per_job = DIV_ROUND_UP(block_rows, num_jobs);
+
+   for (i = 0; i < num_jobs; i++) {
+      struct st_decompress_job *job = &jobs[i];
+      const unsigned row = i * rows_per_job;
+
+      job->format = format;
+      job->bgra = bgra;
+      job->dst = dst + row * blk_h * dst_stride;
+      job->dst_stride = dst_stride;
+      job->src = src + row * src_stride;
+      job->src_stride = src_stride;
+      job->width = width;
+      job->height = MIN2((row + rows_per_job) * blk_h, height) - row * blk_h;
+   }
+
+   /* This thread takes the first band */
+   for (i = 1; i < num_jobs; i++) {
+      util_queue_fence_init(&jobs[i].fence);
+      util_queue_add_job(&st->decompress_queue, &jobs[i], &jobs[i].fence,
+                         decompress_rows, NULL, 0);
+   }
+
+   decompress_rows(&jobs[0], 0);
+
+   for (i = 1; i < num_jobs; i++) {
+      util_queue_fence_wait(&jobs[i].fence);
+      util_queue_fence_destroy(&jobs[i].fence);
+   }
+}
+
+
 /** called via ctx->Driver.UnmapTextureImage() */
 static void
 st_UnmapTextureImage(struct gl_context *ctx,
@@ -382,29 +491,11 @@ st_UnmapTextureImage(struct gl_context *ctx,
       assert(z == transfer->box.z);
 
       if (transfer->usage & PIPE_TRANSFER_WRITE) {
-         if (texImage->TexFormat == MESA_FORMAT_ETC1_RGB8) {
-            _mesa_etc1_unpack_rgba8888(itransfer->map, transfer->stride,
-                                       itransfer->temp_data,
-                                       itransfer->temp_stride,
-                                       transfer->box.width,
-                                       transfer->box.height);
-         } else if (_mesa_is_format_etc2(texImage->TexFormat)) {
-            bool bgra = stImage->pt->format == PIPE_FORMAT_B8G8R8A8_SRGB;
-            _mesa_unpack_etc2_format(itransfer->map, transfer->stride,
-                                     itransfer->temp_data,
-                                     itransfer->temp_stride,
-                                     transfer->box.width, transfer->box.height,
-                                     texImage->TexFormat,
-                                     bgra);
-         } else if (_mesa_is_format_astc_2d(texImage->TexFormat)) {
-            _mesa_unpack_astc_2d_ldr(itransfer->map, transfer->stride,
-                                     itransfer->temp_data,
-                                     itransfer->temp_stride,
-                                     transfer->box.width, transfer->box.height,
-                                     texImage->TexFormat);
-         } else {
-            unreachable("unexpected format for a compressed format fallback");
-         }
+         decompress_image(st, texImage->TexFormat,
+                          stImage->pt->format == PIPE_FORMAT_B8G8R8A8_SRGB,
+                          itransfer->map, transfer->stride,
+                          itransfer->temp_data, itransfer->temp_stride,
+                          transfer->box.width, transfer->box.height);
       }
 
       itransfer->temp_data = NULL;
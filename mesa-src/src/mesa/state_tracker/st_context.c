@@ -32,6 +32,7 @@
 #include "main/debug_output.h"
 #include "main/glthread.h"
 #include "main/samplerobj.h"
+#include "main/shaderapi.h"
 #include "main/shaderobj.h"
 #include "main/version.h"
 #include "main/vtxfmt.h"
@@ -464,6 +465,9 @@ st_destroy_context_priv(struct st_context *st, bool destroy_pipe)
 
    /* free glReadPixels cache data */
    st_invalidate_readpix_cache(st);
+
+   if (util_queue_is_initialized(&st->decompress_queue))
+      util_queue_destroy(&st->decompress_queue);
    util_throttle_deinit(st->pipe->screen, &st->throttle);
 
    cso_destroy_context(st->cso_context);
@@ -585,9 +589,14 @@ st_create_context_priv(struct gl_context *ctx, struct pipe_context *pipe,
 
    st->can_bind_const_buffer_as_vertex =
       screen->get_param(screen, PIPE_CAP_CAN_BIND_CONST_BUFFER_AS_VERTEX);
-
-   /* st/mesa always uploads zero-stride vertex attribs, and other user
-    * vertex buffers are only possible with a compatibility profile.
+   st->user_vertex_buffers_direct =
+      screen->get_param(screen, PIPE_CAP_USER_VERTEX_BUFFERS) &&
+      screen->get_param(screen, PIPE_CAP_USER_VERTEX_BUFFERS_DIRECT);
+
+   /* st/mesa uploads zero-stride vertex attribs unless the driver has
+    * PIPE_CAP_USER_VERTEX_BUFFERS_DIRECT, in which case it supports user
+    * vertex buffers anyway, and other user vertex buffers are only
+    * possible with a compatibility profile.
     * So tell the u_vbuf module that user VBOs are not possible with the Core
     * profile, so that u_vbuf is bypassed completely if there is nothing else
     * to do.
@@ -775,6 +784,9 @@ st_create_context_priv(struct gl_context *ctx, struct pipe_context *pipe,
                                PIPE_SHADER_CAP_PREFERRED_IR);
    ctx->Const.UseNIRGLSLLinker = preferred_ir == PIPE_SHADER_IR_NIR;
 
+   /* Variants don't depend on the context, so nor do fixed-function programs */
+   ctx->Const.ShareFixedFuncPrograms = st->has_shareable_shaders;
+
    if (ctx->Const.GLSLVersion < 400) {
       for (i = 0; i < MESA_SHADER_STAGES; i++)
          ctx->Const.ShaderCompilerOptions[i].EmitNoIndirectSampler = true;
@@ -1036,8 +1048,8 @@ destroy_framebuffer_attachment_sampler_cb(GLuint id, void *data, void *userData)
    }
 }
 
-void
-st_destroy_context(struct st_context *st)
+static void
+destroy_context(struct st_context *st, bool destroy_pipe)
 {
    struct gl_context *ctx = st->ctx;
    struct st_framebuffer *stfb, *next;
@@ -1062,6 +1074,7 @@ st_destroy_context(struct st_context *st)
 
    /* This must be called first so that glthread has a chance to finish */
    _mesa_glthread_destroy(ctx);
+   _mesa_destroy_shader_compiler_queue(ctx);
 
    _mesa_HashWalk(ctx->Shared->TexObjects, destroy_tex_sampler_cb, st);
 
@@ -1110,7 +1123,7 @@ st_destroy_context(struct st_context *st)
 
    /* This will free the st_context too, so 'st' must not be accessed
     * afterwards. */
-   st_destroy_context_priv(st, true);
+   st_destroy_context_priv(st, destroy_pipe);
    st = NULL;
 
    _mesa_destroy_debug_output(ctx);
@@ -1125,3 +1138,25 @@ st_destroy_context(struct st_context *st)
       _mesa_make_current(save_ctx, save_drawbuffer, save_readbuffer);
    }
 }
+
+
+void
+st_destroy_context(struct st_context *st)
+{
+   destroy_context(st, true);
+}
+
+
+/**
+ * Destroy the context but not its pipe context, which is returned so
+ * that a new context can be created on it, with its driver state and
+ * caches.  The pipe context is left with no shaders or samplers bound.
+ */
+struct pipe_context *
+st_destroy_context_keep_pipe(struct st_context *st)
+{
+   struct pipe_context *pipe = st->pipe;
+
+   destroy_context(st, false);
+   return pipe;
+}
@@ -36,6 +36,7 @@
 #include "util/u_helpers.h"
 #include "util/u_inlines.h"
 #include "util/list.h"
+#include "util/u_queue.h"
 #include "vbo/vbo.h"
 #include "util/list.h"
 #include "cso_cache/cso_context.h"
@@ -148,6 +149,7 @@ struct st_context
    boolean has_indep_blend_func;
    boolean needs_rgb_dst_alpha_override;
    boolean can_bind_const_buffer_as_vertex;
+   boolean user_vertex_buffers_direct;
    boolean lower_flatshade;
    boolean lower_alpha_test;
    boolean lower_point_size;
@@ -219,6 +221,13 @@ struct st_context
          struct pipe_scissor_state rects[PIPE_MAX_WINDOW_RECTANGLES];
       } window_rects;
 
+      /** See st_context_iface::set_window_transform() */
+      struct {
+         bool enabled;
+         float scale[2];
+         float translate[2];
+      } window_xform;
+
       GLuint poly_stipple[32];  /**< In OpenGL's bottom-to-top order */
 
       GLuint fb_orientation;
@@ -301,6 +310,11 @@ struct st_context
       unsigned hits;
    } readpix_cache;
 
+   /** Threads decompressing compressed format fallbacks on upload, started
+    * on first use
+    */
+   struct util_queue decompress_queue;
+
    /** for glClear */
    struct {
       struct pipe_rasterizer_state raster;
@@ -344,6 +358,18 @@ struct st_context
    unsigned last_used_atomic_bindings[PIPE_SHADER_TYPES];
    unsigned last_num_ssbos[PIPE_SHADER_TYPES];
 
+   /**
+    * State calls made by the atoms directly on the pipe rather than through
+    * cso_context, added to cso_get_state_changes() to tell no-op updates.
+    */
+   unsigned pipe_state_changes;
+
+   /** Per-atom update counts, for ST_DEBUG=atoms */
+   struct {
+      unsigned updates[ST_NUM_ATOMS];
+      unsigned noops[ST_NUM_ATOMS];   /**< updates which changed nothing */
+   } atom_stats;
+
    int32_t draw_stamp;
    int32_t read_stamp;
 
@@ -400,6 +426,9 @@ st_create_context(gl_api api, struct pipe_context *pipe,
 extern void
 st_destroy_context(struct st_context *st);
 
+extern struct pipe_context *
+st_destroy_context_keep_pipe(struct st_context *st);
+
 
 extern void
 st_invalidate_buffers(struct st_context *st);
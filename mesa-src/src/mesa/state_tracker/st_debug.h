@@ -48,6 +48,7 @@ struct st_context;
 #define DEBUG_PRECOMPILE   0x800
 #define DEBUG_GREMEDY   0x1000
 #define DEBUG_NOREADPIXCACHE 0x2000
+#define DEBUG_ATOMS     0x4000
 
 extern int ST_DEBUG;
 
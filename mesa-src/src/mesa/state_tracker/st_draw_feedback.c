@@ -443,6 +443,10 @@ st_feedback_draw_vbo(struct gl_context *ctx,
       draw_vbo(draw, &info);
    }
 
+   /* Selection hits are gathered in the stage, see select_flush() */
+   if (ctx->RenderMode == GL_SELECT)
+      draw_flush(draw);
+
    /* unmap images */
    for (unsigned i = 0; i < prog->info.num_images; i++) {
       if (img_transfer[i]) {
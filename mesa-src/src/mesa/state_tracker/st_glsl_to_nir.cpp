@@ -868,6 +868,7 @@ st_link_nir(struct gl_context *ctx,
       st_store_ir_in_disk_cache(st, prog, true);
 
       st_release_variants(st, stp);
+      stp->defer_precompile = shader_program->LinkPending;
       st_finalize_program(st, prog);
 
       /* The GLSL IR won't be needed anymore. */
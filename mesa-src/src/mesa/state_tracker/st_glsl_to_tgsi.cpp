@@ -7343,6 +7343,8 @@ st_link_tgsi(struct gl_context *ctx, struct gl_shader_program *prog)
             (linked_prog->sh.LinkedTransformFeedback &&
              linked_prog->sh.LinkedTransformFeedback->NumVarying);
 
+         st_program(linked_prog)->defer_precompile = prog->LinkPending;
+
          if (!ctx->Driver.ProgramStringNotify(ctx,
                                               _mesa_shader_stage_to_program(i),
                                               linked_prog)) {
@@ -815,6 +815,32 @@ st_context_destroy(struct st_context_iface *stctxi)
 }
 
 
+static struct pipe_context *
+st_context_release_pipe(struct st_context_iface *stctxi)
+{
+   struct st_context *st = (struct st_context *) stctxi;
+   return st_destroy_context_keep_pipe(st);
+}
+
+
+static void
+st_context_set_window_transform(struct st_context_iface *stctxi,
+                                const float *scale, const float *translate)
+{
+   struct st_context *st = (struct st_context *) stctxi;
+
+   st->state.window_xform.enabled = scale != NULL;
+   if (scale) {
+      st->state.window_xform.scale[0] = scale[0];
+      st->state.window_xform.scale[1] = scale[1];
+      st->state.window_xform.translate[0] = translate[0];
+      st->state.window_xform.translate[1] = translate[1];
+   }
+
+   st->dirty |= ST_NEW_VIEWPORT | ST_NEW_SCISSOR;
+}
+
+
 static void
 st_start_thread(struct st_context_iface *stctxi)
 {
@@ -925,7 +951,10 @@ st_api_create_context(struct st_api *stapi, struct st_manager *smapi,
    if (attribs->flags & ST_CONTEXT_FLAG_RESET_NOTIFICATION_ENABLED)
       ctx_flags |= PIPE_CONTEXT_LOSE_CONTEXT_ON_RESET;
 
-   pipe = smapi->screen->context_create(smapi->screen, NULL, ctx_flags);
+   if (attribs->pipe)
+      pipe = attribs->pipe;
+   else
+      pipe = smapi->screen->context_create(smapi->screen, NULL, ctx_flags);
    if (!pipe) {
       *error = ST_CONTEXT_ERROR_NO_MEMORY;
       return NULL;
@@ -942,7 +971,8 @@ st_api_create_context(struct st_api *stapi, struct st_manager *smapi,
                           &attribs->options, no_error);
    if (!st) {
       *error = ST_CONTEXT_ERROR_NO_MEMORY;
-      pipe->destroy(pipe);
+      if (!attribs->pipe)
+         pipe->destroy(pipe);
       return NULL;
    }
 
@@ -979,7 +1009,10 @@ st_api_create_context(struct st_api *stapi, struct st_manager *smapi,
        */
       if (st->ctx->Version < attribs->major * 10U + attribs->minor) {
          *error = ST_CONTEXT_ERROR_BAD_VERSION;
-         st_destroy_context(st);
+         if (attribs->pipe)
+            st_destroy_context_keep_pipe(st);
+         else
+            st_destroy_context(st);
          return NULL;
       }
    }
@@ -990,12 +1023,14 @@ st_api_create_context(struct st_api *stapi, struct st_manager *smapi,
       smapi->get_param(smapi, ST_MANAGER_BROKEN_INVALIDATE);
 
    st->iface.destroy = st_context_destroy;
+   st->iface.release_pipe = st_context_release_pipe;
    st->iface.flush = st_context_flush;
    st->iface.teximage = st_context_teximage;
    st->iface.copy = st_context_copy;
    st->iface.share = st_context_share;
    st->iface.start_thread = st_start_thread;
    st->iface.thread_finish = st_thread_finish;
+   st->iface.set_window_transform = st_context_set_window_transform;
    st->iface.st_context_private = (void *) smapi;
    st->iface.cso_context = st->cso_context;
    st->iface.pipe = st->pipe;
@@ -1948,6 +1948,9 @@ destroy_shader_program_variants_cb(GLuint key, void *data, void *userData)
          struct gl_shader_program *shProg = (struct gl_shader_program *) data;
          GLuint i;
 
+         /* It may still be linking on another context's compiler thread. */
+         util_queue_fence_wait(&shProg->LinkFence);
+
 	 for (i = 0; i < ARRAY_SIZE(shProg->_LinkedShaders); i++) {
 	    if (shProg->_LinkedShaders[i])
                destroy_program_variants(st, shProg->_LinkedShaders[i]->Program);
@@ -2088,6 +2091,27 @@ st_finalize_program(struct st_context *st, struct gl_program *prog)
    }
 
    /* Create Gallium shaders now instead of on demand. */
+   if (!st_program(prog)->defer_precompile &&
+       (ST_DEBUG & DEBUG_PRECOMPILE ||
+        st->shader_has_one_variant[prog->info.stage]))
+      st_precompile_shader_variant(st, prog);
+}
+
+
+/**
+ * Do the precompile st_finalize_program() skipped for a program linked on
+ * a compiler thread.
+ */
+void
+st_precompile_deferred(struct st_context *st, struct gl_program *prog)
+{
+   struct st_program *stp = st_program(prog);
+
+   if (!stp->defer_precompile)
+      return;
+
+   stp->defer_precompile = false;
+
    if (ST_DEBUG & DEBUG_PRECOMPILE ||
        st->shader_has_one_variant[prog->info.stage])
       st_precompile_shader_variant(st, prog);
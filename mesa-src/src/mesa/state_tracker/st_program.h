@@ -239,6 +239,12 @@ struct st_program
    struct gl_shader_program *shader_program;
 
    struct st_variant *variants;
+
+   /**
+    * Linked on a compiler thread: the variant precompile is left to
+    * st_precompile_deferred() on the context thread.
+    */
+   bool defer_precompile;
 };
 
 
@@ -350,6 +356,9 @@ st_serialize_nir(struct st_program *stp);
 extern void
 st_finalize_program(struct st_context *st, struct gl_program *prog);
 
+extern void
+st_precompile_deferred(struct st_context *st, struct gl_program *prog);
+
 #ifdef __cplusplus
 }
 #endif
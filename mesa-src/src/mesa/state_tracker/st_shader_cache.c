@@ -232,6 +232,7 @@ st_deserialise_ir_program(struct gl_context *ctx,
       }
    }
 
+   stp->defer_precompile = shProg->LinkPending;
    st_finalize_program(st, prog);
 }
 
@@ -167,6 +167,15 @@ struct vbo_save_context {
 
    GLuint opcode_vertex_list;
 
+   /**
+    * The last vertex list compiled, and where the display list ended just
+    * after it.  The next vertex list can be appended to it if nothing was
+    * compiled in between.
+    */
+   struct vbo_save_vertex_list *last_node;
+   union gl_dlist_node *last_node_block;
+   GLuint last_node_pos;
+
    struct vbo_save_copied_vtx copied;
 
    fi_type *current[VBO_ATTRIB_MAX]; /* points into ctx->ListState */
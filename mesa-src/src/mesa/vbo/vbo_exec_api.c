@@ -231,6 +231,79 @@ vbo_exec_copy_to_current(struct vbo_exec_context *exec)
 }
 
 
+/**
+ * Whether the vertices of the current glBegin/glEnd batch may be converted
+ * to the upgraded vertex format where they are, instead of being drawn
+ * before the upgrade.  Mixed attribute immediate mode code would be drawn
+ * in tiny pieces otherwise.  The converted vertices must still fit, with
+ * room for the next one.
+ */
+static bool
+vbo_exec_can_upgrade_in_place(const struct vbo_exec_context *exec,
+                              GLuint attr, GLuint newSize, GLenum newType)
+{
+   const GLuint oldSize = exec->vtx.attr[attr].size;
+   const GLuint new_vtx_size = exec->vtx.vertex_size + newSize - oldSize;
+   const GLenum oldType = exec->vtx.attr[attr].type;
+
+   if (!_mesa_inside_begin_end(exec->ctx) || !exec->vtx.vert_count ||
+       !exec->vtx.buffer_map)
+      return false;
+
+   /* Values are converted by COPY_CLEAN_4V_TYPE_AS_UNION, 32-bit only */
+   if ((oldSize && oldType != newType) ||
+       newType == GL_DOUBLE || newType == GL_UNSIGNED_INT64_ARB)
+      return false;
+
+   /* As vbo_compute_max_verts(), which keeps a vertex for line loops */
+   return exec->vtx.buffer_used +
+          (exec->vtx.vert_count + 2) * new_vtx_size * sizeof(GLfloat) <=
+          exec->ctx->Const.glBeginEndBufferSize;
+}
+
+
+/**
+ * Write a vertex in the old format to dest in the new one, after
+ * vbo_exec_wrap_upgrade_vertex() changed the layout.  The upgraded
+ * attribute gets the default values for the components it lacked, or
+ * the current value if it wasn't in the vertex before.
+ */
+static void
+vbo_exec_upgrade_vertex_data(struct vbo_exec_context *exec,
+                             fi_type *dest, const fi_type *data,
+                             fi_type *const old_attrptr[VBO_ATTRIB_MAX],
+                             GLuint attr, GLuint oldSize, GLuint newSize)
+{
+   struct vbo_context *vbo = vbo_context(exec->ctx);
+   GLbitfield64 enabled = exec->vtx.enabled;
+
+   while (enabled) {
+      const int j = u_bit_scan64(&enabled);
+      GLuint sz = exec->vtx.attr[j].size;
+      GLint old_offset = old_attrptr[j] - exec->vtx.vertex;
+      GLint new_offset = exec->vtx.attrptr[j] - exec->vtx.vertex;
+
+      assert(sz);
+
+      if (j == attr) {
+         if (oldSize) {
+            fi_type tmp[4];
+            COPY_CLEAN_4V_TYPE_AS_UNION(tmp, oldSize,
+                                        data + old_offset,
+                                        exec->vtx.attr[j].type);
+            COPY_SZ_4V(dest + new_offset, newSize, tmp);
+         } else {
+            fi_type *current = (fi_type *)vbo->current[j].Ptr;
+            COPY_SZ_4V(dest + new_offset, sz, current);
+         }
+      }
+      else {
+         COPY_SZ_4V(dest + new_offset, sz, data + old_offset);
+      }
+   }
+}
+
+
 /**
  * Flush existing data, set new attrib size, replay copied vertices.
  * This is called when we transition from a small vertex attribute size
@@ -244,20 +317,27 @@ vbo_exec_wrap_upgrade_vertex(struct vbo_exec_context *exec,
                              GLuint attr, GLuint newSize, GLenum newType)
 {
    struct gl_context *ctx = exec->ctx;
-   struct vbo_context *vbo = vbo_context(ctx);
    const GLint lastcount = exec->vtx.vert_count;
    fi_type *old_attrptr[VBO_ATTRIB_MAX];
    const GLuint old_vtx_size_no_pos = exec->vtx.vertex_size_no_pos;
    const GLuint old_vtx_size = exec->vtx.vertex_size; /* floats per vertex */
    const GLuint oldSize = exec->vtx.attr[attr].size;
+   const bool in_place =
+      vbo_exec_can_upgrade_in_place(exec, attr, newSize, newType);
    GLuint i;
 
    assert(attr < VBO_ATTRIB_MAX);
 
-   /* Run pipeline on current vertices, copy wrapped vertices
-    * to exec->vtx.copied.
-    */
-   vbo_exec_wrap_buffers(exec);
+   if (in_place) {
+      /* Keep the vertices, they are converted below */
+      memcpy(old_attrptr, exec->vtx.attrptr, sizeof(old_attrptr));
+   }
+   else {
+      /* Run pipeline on current vertices, copy wrapped vertices
+       * to exec->vtx.copied.
+       */
+      vbo_exec_wrap_buffers(exec);
+   }
 
    if (unlikely(exec->vtx.copied.nr)) {
       /* We're in the middle of a primitive, keep the old vertex
@@ -284,8 +364,10 @@ vbo_exec_wrap_upgrade_vertex(struct vbo_exec_context *exec,
    exec->vtx.vertex_size += newSize - oldSize;
    exec->vtx.vertex_size_no_pos = exec->vtx.vertex_size - exec->vtx.attr[0].size;
    exec->vtx.max_vert = vbo_compute_max_verts(exec);
-   exec->vtx.vert_count = 0;
-   exec->vtx.buffer_ptr = exec->vtx.buffer_map;
+   if (!in_place) {
+      exec->vtx.vert_count = 0;
+      exec->vtx.buffer_ptr = exec->vtx.buffer_map;
+   }
    exec->vtx.enabled |= BITFIELD64_BIT(attr);
 
    if (attr != 0) {
@@ -345,6 +427,31 @@ vbo_exec_wrap_upgrade_vertex(struct vbo_exec_context *exec,
    /* The position is always last. */
    exec->vtx.attrptr[0] = exec->vtx.vertex + exec->vtx.vertex_size_no_pos;
 
+   /* Convert the buffered vertices where they are.  The vertices grow,
+    * so going from the last one, each one only overwrites itself and
+    * vertices already converted.
+    */
+   if (in_place) {
+      fi_type tmp[VBO_ATTRIB_MAX * 4];
+
+      assert(exec->vtx.vertex_size > old_vtx_size);
+      assert(old_vtx_size <= ARRAY_SIZE(tmp));
+      assert(exec->vtx.max_vert > exec->vtx.vert_count);
+
+      for (i = exec->vtx.vert_count; i-- > 0; ) {
+         memcpy(tmp, exec->vtx.buffer_map + i * old_vtx_size,
+                old_vtx_size * sizeof(fi_type));
+         vbo_exec_upgrade_vertex_data(exec,
+                                      exec->vtx.buffer_map +
+                                      i * exec->vtx.vertex_size,
+                                      tmp, old_attrptr,
+                                      attr, oldSize, newSize);
+      }
+
+      exec->vtx.buffer_ptr = exec->vtx.buffer_map +
+                             exec->vtx.vert_count * exec->vtx.vertex_size;
+   }
+
    /* Replay stored vertices to translate them
     * to new format here.
     *
@@ -357,32 +464,8 @@ vbo_exec_wrap_upgrade_vertex(struct vbo_exec_context *exec,
       assert(exec->vtx.buffer_ptr == exec->vtx.buffer_map);
 
       for (i = 0 ; i < exec->vtx.copied.nr ; i++) {
-         GLbitfield64 enabled = exec->vtx.enabled;
-         while (enabled) {
-            const int j = u_bit_scan64(&enabled);
-            GLuint sz = exec->vtx.attr[j].size;
-            GLint old_offset = old_attrptr[j] - exec->vtx.vertex;
-            GLint new_offset = exec->vtx.attrptr[j] - exec->vtx.vertex;
-
-            assert(sz);
-
-            if (j == attr) {
-               if (oldSize) {
-                  fi_type tmp[4];
-                  COPY_CLEAN_4V_TYPE_AS_UNION(tmp, oldSize,
-                                              data + old_offset,
-                                              exec->vtx.attr[j].type);
-                  COPY_SZ_4V(dest + new_offset, newSize, tmp);
-               } else {
-                  fi_type *current = (fi_type *)vbo->current[j].Ptr;
-                  COPY_SZ_4V(dest + new_offset, sz, current);
-               }
-            }
-            else {
-               COPY_SZ_4V(dest + new_offset, sz, data + old_offset);
-            }
-         }
-
+         vbo_exec_upgrade_vertex_data(exec, dest, data, old_attrptr,
+                                      attr, oldSize, newSize);
          data += old_vtx_size;
          dest += exec->vtx.vertex_size;
       }
@@ -461,6 +461,69 @@ update_vao(struct gl_context *ctx,
 }
 
 
+/**
+ * Return the vertex list compiled just before, if the run of vertices being
+ * compiled can be appended to it: nothing was compiled in between, the
+ * vertices use the same buffer and layout and start a new primitive, and
+ * the primitives fit in the previous list's store.
+ */
+static struct vbo_save_vertex_list *
+get_mergeable_vertex_list(struct gl_context *ctx)
+{
+   struct vbo_save_context *save = &vbo_context(ctx)->save;
+   struct vbo_save_vertex_list *prev = save->last_node;
+
+   if (!prev ||
+       save->last_node_block != ctx->ListState.CurrentBlock ||
+       save->last_node_pos != ctx->ListState.CurrentPos)
+      return NULL;
+
+   for (gl_vertex_processing_mode vpm = VP_MODE_FF; vpm < VP_MODE_MAX; ++vpm) {
+      if (prev->VAO[vpm] != save->VAO[vpm])
+         return NULL;
+   }
+
+   if (!prev->prim_count || !save->prim_count ||
+       !save->prims[0].begin || save->copied.nr)
+      return NULL;
+
+   if (prev->prims + prev->prim_count + save->prim_count >
+       prev->prim_store->prims + VBO_SAVE_PRIM_SIZE)
+      return NULL;
+
+   return prev;
+}
+
+
+/**
+ * Append the primitives of the vertex list next, whose vertices come right
+ * after the ones of node, to node.  The primitives at the end of node's
+ * store are unused as node was the last list to take some.
+ */
+static void
+merge_vertex_lists(struct gl_context *ctx, struct vbo_save_vertex_list *node,
+                   const struct vbo_save_vertex_list *next)
+{
+   struct _mesa_prim *last = &node->prims[node->prim_count - 1];
+   GLuint skip = 0;
+
+   memmove(last + 1, next->prims, next->prim_count * sizeof(*last));
+
+   vbo_try_prim_conversion(last + 1);
+   if (vbo_merge_draws(ctx, true, last, last + 1)) {
+      memmove(last + 1, last + 2, (next->prim_count - 1) * sizeof(*last));
+      skip = 1;
+   }
+
+   node->prim_count += next->prim_count - skip;
+   node->vertex_count += next->vertex_count;
+
+   /* The last vertex is next's now */
+   free(node->current_data);
+   node->current_data = next->current_data;
+}
+
+
 /**
  * Insert the active immediate struct onto the display list currently
  * being built.
@@ -469,22 +532,8 @@ static void
 compile_vertex_list(struct gl_context *ctx)
 {
    struct vbo_save_context *save = &vbo_context(ctx)->save;
-   struct vbo_save_vertex_list *node;
-
-   /* Allocate space for this structure in the display list currently
-    * being compiled.
-    */
-   node = (struct vbo_save_vertex_list *)
-      _mesa_dlist_alloc_aligned(ctx, save->opcode_vertex_list, sizeof(*node));
+   struct vbo_save_vertex_list *node, *merge_node, next_node;
 
-   if (!node)
-      return;
-
-   /* Make sure the pointer is aligned to the size of a pointer */
-   assert((GLintptr) node % sizeof(void *) == 0);
-
-   /* Duplicate our template, increment refcounts to the storage structs:
-    */
    GLintptr old_offset = 0;
    if (save->VAO[0]) {
       old_offset = save->VAO[0]->BufferBinding[0].Offset
@@ -517,11 +566,6 @@ compile_vertex_list(struct gl_context *ctx)
       offsets[i] = offset;
       offset += save->attrsz[i] * sizeof(GLfloat);
    }
-   node->vertex_count = save->vert_count;
-   node->wrap_count = save->copied.nr;
-   node->prims = save->prims;
-   node->prim_count = save->prim_count;
-   node->prim_store = save->prim_store;
 
    /* Create a pair of VAOs for the possible VERTEX_PROCESSING_MODEs
     * Note that this may reuse the previous one of possible.
@@ -531,12 +575,52 @@ compile_vertex_list(struct gl_context *ctx)
       update_vao(ctx, vpm, &save->VAO[vpm],
                  save->vertex_store->bufferobj, buffer_offset, stride,
                  save->enabled, save->attrsz, save->attrtype, offsets);
-      /* Reference the vao in the dlist */
-      node->VAO[vpm] = NULL;
-      _mesa_reference_vao(ctx, &node->VAO[vpm], save->VAO[vpm]);
    }
 
-   node->prim_store->refcount++;
+   /* A run of vertices right after the previous one, with the same layout,
+    * is appended to the previous vertex list.  Replaying the display list
+    * then takes a single draw for both.  The run is compiled to a
+    * temporary list first.
+    */
+   merge_node = get_mergeable_vertex_list(ctx);
+   if (merge_node) {
+      node = &next_node;
+      memset(node, 0, sizeof(*node));
+   } else {
+      /* Allocate space for this structure in the display list currently
+       * being compiled.
+       */
+      node = (struct vbo_save_vertex_list *)
+         _mesa_dlist_alloc_aligned(ctx, save->opcode_vertex_list,
+                                   sizeof(*node));
+
+      if (!node)
+         return;
+
+      /* Make sure the pointer is aligned to the size of a pointer */
+      assert((GLintptr) node % sizeof(void *) == 0);
+   }
+
+   /* Duplicate our template, increment refcounts to the storage structs:
+    */
+   node->vertex_count = save->vert_count;
+   node->wrap_count = save->copied.nr;
+   node->prims = save->prims;
+   node->prim_count = save->prim_count;
+   node->prim_store = save->prim_store;
+
+   for (gl_vertex_processing_mode vpm = VP_MODE_FF; vpm < VP_MODE_MAX; ++vpm) {
+      if (merge_node) {
+         node->VAO[vpm] = save->VAO[vpm];
+      } else {
+         /* Reference the vao in the dlist */
+         node->VAO[vpm] = NULL;
+         _mesa_reference_vao(ctx, &node->VAO[vpm], save->VAO[vpm]);
+      }
+   }
+
+   if (!merge_node)
+      node->prim_store->refcount++;
 
    if (save->no_current_update) {
       node->current_data = NULL;
@@ -603,6 +687,15 @@ compile_vertex_list(struct gl_context *ctx)
       _glapi_set_dispatch(dispatch);
    }
 
+   if (merge_node) {
+      merge_vertex_lists(ctx, merge_node, node);
+      node = merge_node;
+   }
+
+   save->last_node = node;
+   save->last_node_block = ctx->ListState.CurrentBlock;
+   save->last_node_pos = ctx->ListState.CurrentPos;
+
    /* Decide whether the storage structs are full, or can be used for
     * the next vertex lists as well.
     */
@@ -1559,6 +1652,7 @@ vbo_save_NewList(struct gl_context *ctx, GLuint list, GLenum mode)
       save->vertex_store = alloc_vertex_store(ctx);
 
    save->buffer_ptr = vbo_save_map_vertex_store(ctx, save->vertex_store);
+   save->last_node = NULL;
 
    reset_vertex(ctx);
    reset_counters(ctx);
@@ -1598,6 +1692,7 @@ vbo_save_EndList(struct gl_context *ctx)
    }
 
    vbo_save_unmap_vertex_store(ctx, save->vertex_store);
+   save->last_node = NULL;
 
    assert(save->vertex_size == 0);
 }
@@ -38,6 +38,7 @@
 #include <errno.h>
 #include <dirent.h>
 #include <inttypes.h>
+#include <time.h>
 #include "zlib.h"
 
 #ifdef HAVE_ZSTD
@@ -53,6 +54,9 @@
 #include "util/ralloc.h"
 #include "util/compiler.h"
 
+#define XXH_INLINE_ALL
+#include "util/xxhash.h"
+
 #include "disk_cache.h"
 
 /* Number of bits to mask off from a cache key to get an index. */
@@ -81,6 +85,81 @@
 /* 3 is the recomended level, with 22 as the absolute maximum */
 #define ZSTD_COMPRESSION_LEVEL 3
 
+/* The archive file, see MESA_GLSL_CACHE_ARCHIVE, starts with a header and
+ * an index of CACHE_INDEX_MAX_KEYS entries, followed by the blobs which are
+ * appended to it.  When the blobs reach max_size the index is wiped and
+ * writing starts again after it, so the file never grows beyond that.
+ */
+#define CACHE_ARCHIVE_MAGIC 0x4143534d  /* "MSCA" */
+#define CACHE_ARCHIVE_VERSION 1
+
+/* Number of index entries probed from a key's slot. */
+#define CACHE_ARCHIVE_PROBES 32
+
+/* The blob is stored without compression. */
+#define CACHE_ARCHIVE_RAW (1 << 0)
+
+/* Algorithms for disk_cache_compute_key, see MESA_GLSL_CACHE_KEY_HASH.  Only
+ * a non-default one is recorded in the header, so that existing SHA-1 keyed
+ * caches stay valid.
+ */
+enum cache_key_hash {
+   CACHE_KEY_HASH_SHA1,
+   CACHE_KEY_HASH_XXH64,
+};
+
+/* The filter of keys present in the cache directory, see
+ * MESA_GLSL_CACHE_MISS_FILTER, is a bloom filter of 2^CACHE_FILTER_BITS bits
+ * probed with CACHE_FILTER_PROBES words of the key.  At 50000 entries it
+ * passes about 0.1% of the misses on to the filesystem.
+ */
+#define CACHE_FILTER_BITS 20
+#define CACHE_FILTER_PROBES 4
+
+/* The eviction index of the directory cache, the "lru_index" file, records
+ * the size and the time of last use of each entry, in buckets of
+ * CACHE_LRU_WAYS slots.  Eviction removes the least recently used of about
+ * CACHE_LRU_SAMPLES entries from random buckets, instead of stat'ing every
+ * file of a directory.  Files the index doesn't know about, from older caches or
+ * dropped from a full bucket, are adopted when read, and are otherwise left
+ * to the directory scan once sampling finds nothing.
+ */
+#define CACHE_LRU_BITS 18
+#define CACHE_LRU_WAYS 4
+#define CACHE_LRU_SAMPLES 8
+
+struct cache_lru_entry {
+   uint8_t key[CACHE_KEY_SIZE];
+   /* Size on disk in 512 byte blocks. */
+   uint32_t blocks;
+   /* In seconds, zero for an empty slot. */
+   uint64_t last_used;
+};
+
+struct cache_archive_header {
+   uint32_t magic;
+   uint32_t version;
+   /* Offset of the end of the last blob written. */
+   uint64_t end;
+};
+
+struct cache_archive_entry {
+   /* Written last, and cleared first, so that a reader which finds the key
+    * sees the rest of the entry.
+    */
+   uint8_t key[CACHE_KEY_SIZE];
+   uint32_t flags;
+   uint64_t offset;
+   uint32_t size;
+   uint32_t uncompressed_size;
+   uint32_t crc32;
+   uint32_t pad;
+};
+
+#define CACHE_ARCHIVE_DATA_START \
+   (sizeof(struct cache_archive_header) + \
+    CACHE_INDEX_MAX_KEYS * sizeof(struct cache_archive_entry))
+
 struct disk_cache {
    /* The path to the cache directory. */
    char *path;
@@ -105,9 +184,40 @@ struct disk_cache {
    /* Maximum size of all cached objects (in bytes). */
    uint64_t max_size;
 
+   /* The mmapped eviction index, NULL with the archive. */
+   struct cache_lru_entry *lru;
+   size_t lru_size;
+
+   /* The mmapped archive file, if MESA_GLSL_CACHE_ARCHIVE is set.  The
+    * mutex serializes this process's writers; other processes are kept
+    * out by a lock on the file.
+    */
+   int archive_fd;
+   uint8_t *archive_map;
+   size_t archive_map_size;
+   bool archive_compressed;
+   mtx_t archive_mutex;
+
+   /* Read-only archives from MESA_GLSL_CACHE_BUNDLES, searched before the
+    * writable cache and never written to or evicted.
+    */
+   struct cache_bundle {
+      uint8_t *map;
+      size_t size;
+   } *bundles;
+   unsigned num_bundles;
+
    /* Driver cache keys. */
    uint8_t *driver_keys_blob;
    size_t driver_keys_blob_size;
+   enum cache_key_hash key_hash;
+
+   /* Bloom filter of the keys in the cache directory.  It is only consulted
+    * once filter_ready is set by the job that scans the directory.
+    */
+   uint32_t *filter;
+   bool filter_ready;
+   struct util_queue_fence filter_fence;
 
    disk_cache_put_cb blob_put_cb;
    disk_cache_get_cb blob_get_cb;
@@ -189,6 +299,351 @@ concatenate_and_mkdir(void *ctx, const char *path, const char *name)
       return NULL;
 }
 
+static void
+cache_archive_lock(struct disk_cache *cache)
+{
+   mtx_lock(&cache->archive_mutex);
+#ifdef HAVE_FLOCK
+   flock(cache->archive_fd, LOCK_EX);
+#else
+   struct flock lock = {
+      .l_start = 0,
+      .l_len = 0, /* entire file */
+      .l_type = F_WRLCK,
+      .l_whence = SEEK_SET
+   };
+   fcntl(cache->archive_fd, F_SETLKW, &lock);
+#endif
+}
+
+static void
+cache_archive_unlock(struct disk_cache *cache)
+{
+#ifdef HAVE_FLOCK
+   flock(cache->archive_fd, LOCK_UN);
+#else
+   struct flock lock = {
+      .l_start = 0,
+      .l_len = 0, /* entire file */
+      .l_type = F_UNLCK,
+      .l_whence = SEEK_SET
+   };
+   fcntl(cache->archive_fd, F_SETLK, &lock);
+#endif
+   mtx_unlock(&cache->archive_mutex);
+}
+
+static struct cache_archive_entry *
+cache_archive_entries(struct disk_cache *cache)
+{
+   return (struct cache_archive_entry *)
+      (cache->archive_map + sizeof(struct cache_archive_header));
+}
+
+/* Forget every blob.  Called with the archive locked. */
+static void
+cache_archive_reset(struct disk_cache *cache)
+{
+   struct cache_archive_header *header =
+      (struct cache_archive_header *) cache->archive_map;
+
+   memset(cache_archive_entries(cache), 0,
+          CACHE_INDEX_MAX_KEYS * sizeof(struct cache_archive_entry));
+   header->end = CACHE_ARCHIVE_DATA_START;
+   header->version = CACHE_ARCHIVE_VERSION;
+   header->magic = CACHE_ARCHIVE_MAGIC;
+}
+
+/* Open and map <path>/archive.  The whole range the archive may ever use is
+ * mapped once, so that lookups need no syscalls; the file itself only grows
+ * as blobs are appended.  On any failure the cache directory is used.
+ */
+static void
+cache_archive_open(struct disk_cache *cache, void *local)
+{
+   struct stat sb;
+   char *path;
+   uint8_t *map;
+   size_t map_size;
+   int fd;
+
+   /* The mapping is as large as the cache. */
+   if (sizeof(void *) < 8)
+      return;
+
+   path = ralloc_asprintf(local, "%s/archive", cache->path);
+   if (path == NULL)
+      return;
+
+   fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+   if (fd == -1)
+      return;
+
+   map_size = CACHE_ARCHIVE_DATA_START + cache->max_size;
+   map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   if (map == MAP_FAILED) {
+      close(fd);
+      return;
+   }
+
+   if (mtx_init(&cache->archive_mutex, mtx_plain) != thrd_success) {
+      munmap(map, map_size);
+      close(fd);
+      return;
+   }
+
+   cache->archive_fd = fd;
+   cache->archive_map = map;
+   cache->archive_map_size = map_size;
+   cache->archive_compressed =
+      !env_var_as_boolean("MESA_GLSL_CACHE_ARCHIVE_UNCOMPRESSED", false);
+
+   /* Create the index if the file is new, or from another version. */
+   cache_archive_lock(cache);
+
+   struct cache_archive_header *header =
+      (struct cache_archive_header *) cache->archive_map;
+   bool ok = fstat(fd, &sb) == 0;
+   if (ok && sb.st_size < CACHE_ARCHIVE_DATA_START) {
+      ok = ftruncate(fd, CACHE_ARCHIVE_DATA_START) == 0;
+      if (ok)
+         cache_archive_reset(cache);
+   } else if (ok && (header->magic != CACHE_ARCHIVE_MAGIC ||
+                     header->version != CACHE_ARCHIVE_VERSION ||
+                     header->end > sb.st_size)) {
+      cache_archive_reset(cache);
+   }
+
+   cache_archive_unlock(cache);
+
+   if (!ok) {
+      mtx_destroy(&cache->archive_mutex);
+      munmap(map, map_size);
+      close(fd);
+      cache->archive_fd = -1;
+      cache->archive_map = NULL;
+   }
+}
+
+/* Map the archives listed in MESA_GLSL_CACHE_BUNDLES, separated by ':'.
+ * They need neither a cache directory nor write access, so are opened even
+ * when the writable cache could not be.  Files that are not archives of
+ * this version are skipped.
+ */
+static void
+cache_bundles_open(struct disk_cache *cache, void *local)
+{
+   const char *list = getenv("MESA_GLSL_CACHE_BUNDLES");
+   if (list == NULL || *list == '\0')
+      return;
+
+   char *paths = ralloc_strdup(local, list);
+   if (paths == NULL)
+      return;
+
+   unsigned max_bundles = 1;
+   for (const char *p = paths; *p; p++) {
+      if (*p == ':')
+         max_bundles++;
+   }
+
+   cache->bundles = ralloc_array(cache, struct cache_bundle, max_bundles);
+   if (cache->bundles == NULL)
+      return;
+
+   char *save;
+   for (char *path = strtok_r(paths, ":", &save); path;
+        path = strtok_r(NULL, ":", &save)) {
+      struct stat sb;
+      int fd = open(path, O_RDONLY | O_CLOEXEC);
+      if (fd == -1)
+         continue;
+
+      if (fstat(fd, &sb) == -1 || sb.st_size < CACHE_ARCHIVE_DATA_START) {
+         close(fd);
+         continue;
+      }
+
+      uint8_t *map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      close(fd);
+      if (map == MAP_FAILED)
+         continue;
+
+      struct cache_archive_header *header =
+         (struct cache_archive_header *) map;
+      if (header->magic != CACHE_ARCHIVE_MAGIC ||
+          header->version != CACHE_ARCHIVE_VERSION ||
+          header->end > sb.st_size) {
+         munmap(map, sb.st_size);
+         continue;
+      }
+
+      cache->bundles[cache->num_bundles].map = map;
+      cache->bundles[cache->num_bundles].size = sb.st_size;
+      cache->num_bundles++;
+   }
+}
+
+/* Opens the eviction index of the directory cache. Without it, eviction
+ * falls back to scanning the directories.
+ */
+static void
+cache_lru_open(struct disk_cache *cache, void *local)
+{
+   size_t size = (1 << CACHE_LRU_BITS) * sizeof(struct cache_lru_entry);
+   char *path = ralloc_asprintf(local, "%s/lru_index", cache->path);
+   struct stat sb;
+   int fd;
+
+   if (path == NULL)
+      return;
+
+   fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+   if (fd == -1)
+      return;
+
+   if (fstat(fd, &sb) == -1 ||
+       (sb.st_size != size && ftruncate(fd, size) == -1)) {
+      close(fd);
+      return;
+   }
+
+   /* Shared with other processes like the index, and with the same benign
+    * races: a torn entry names a file that doesn't exist.
+    */
+   void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED)
+      return;
+
+   cache->lru = map;
+   cache->lru_size = size;
+}
+
+static uint32_t
+cache_filter_bit(const cache_key key, unsigned probe)
+{
+   uint32_t word;
+
+   /* The key is a hash already. */
+   memcpy(&word, key + probe * sizeof(word), sizeof(word));
+   return word & ((1u << CACHE_FILTER_BITS) - 1);
+}
+
+static void
+cache_filter_add(struct disk_cache *cache, const cache_key key)
+{
+   for (unsigned i = 0; i < CACHE_FILTER_PROBES; i++) {
+      uint32_t bit = cache_filter_bit(key, i);
+      uint32_t *word = &cache->filter[bit / 32];
+      uint32_t mask = 1u << (bit % 32);
+      uint32_t old = p_atomic_read(word);
+
+      while (!(old & mask)) {
+         uint32_t prev = p_atomic_cmpxchg(word, old, old | mask);
+         if (prev == old)
+            break;
+         old = prev;
+      }
+   }
+}
+
+/* Returns false if the key is definitely not in the cache directory. */
+static bool
+cache_filter_test(struct disk_cache *cache, const cache_key key)
+{
+   for (unsigned i = 0; i < CACHE_FILTER_PROBES; i++) {
+      uint32_t bit = cache_filter_bit(key, i);
+      if (!(p_atomic_read(&cache->filter[bit / 32]) & (1u << (bit % 32))))
+         return false;
+   }
+   return true;
+}
+
+static int
+hex_digit_value(char c)
+{
+   if (c >= '0' && c <= '9')
+      return c - '0';
+   if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+   return -1;
+}
+
+/* Add the keys of the files in one of the two character sub-directories
+ * created by make_cache_file_directory to the filter.
+ */
+static void
+cache_filter_add_directory(struct disk_cache *cache, const char *dir_path,
+                           const char *prefix)
+{
+   DIR *dir = opendir(dir_path);
+   struct dirent *dir_ent;
+
+   if (dir == NULL)
+      return;
+
+   while ((dir_ent = readdir(dir)) != NULL) {
+      char hex[2 * CACHE_KEY_SIZE];
+      cache_key key;
+      unsigned i;
+
+      /* This also skips the ".tmp" files of entries being written. */
+      if (strlen(dir_ent->d_name) != sizeof(hex) - 2)
+         continue;
+
+      memcpy(hex, prefix, 2);
+      memcpy(hex + 2, dir_ent->d_name, sizeof(hex) - 2);
+
+      for (i = 0; i < CACHE_KEY_SIZE; i++) {
+         int hi = hex_digit_value(hex[2 * i]);
+         int lo = hex_digit_value(hex[2 * i + 1]);
+         if (hi < 0 || lo < 0)
+            break;
+         key[i] = hi << 4 | lo;
+      }
+
+      if (i == CACHE_KEY_SIZE)
+         cache_filter_add(cache, key);
+   }
+
+   closedir(dir);
+}
+
+/* Queue job that fills the filter from the cache directory.   Entries that
+ * other processes add later aren't seen, which only costs those an extra
+ * compile, the same tradeoff as for disk_cache_has_key.
+ */
+static void
+cache_filter_build(void *job, int thread_index)
+{
+   struct disk_cache *cache = job;
+   DIR *dir = opendir(cache->path);
+   struct dirent *dir_ent;
+
+   if (dir == NULL)
+      return;
+
+   while ((dir_ent = readdir(dir)) != NULL) {
+      const char *name = dir_ent->d_name;
+      char *dir_path;
+
+      if (strlen(name) != 2 || hex_digit_value(name[0]) < 0 ||
+          hex_digit_value(name[1]) < 0)
+         continue;
+
+      if (asprintf(&dir_path, "%s/%s", cache->path, name) == -1)
+         continue;
+
+      cache_filter_add_directory(cache, dir_path, name);
+      free(dir_path);
+   }
+
+   closedir(dir);
+
+   p_atomic_set(&cache->filter_ready, true);
+}
+
 #define DRV_KEY_CPY(_dst, _src, _src_size) \
 do {                                       \
    memcpy(_dst, _src, _src_size);          \
@@ -230,6 +685,10 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
    /* Assume failure. */
    cache->path_init_failed = true;
 
+   const char *key_hash_str = getenv("MESA_GLSL_CACHE_KEY_HASH");
+   if (key_hash_str && strcmp(key_hash_str, "xxh64") == 0)
+      cache->key_hash = CACHE_KEY_HASH_XXH64;
+
    /* Determine path for cache based on the first defined name as follows:
     *
     *   $MESA_GLSL_CACHE_DIR
@@ -375,6 +834,12 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
 
    cache->max_size = max_size;
 
+   cache->archive_fd = -1;
+   if (env_var_as_boolean("MESA_GLSL_CACHE_ARCHIVE", false))
+      cache_archive_open(cache, local);
+   if (!cache->archive_map)
+      cache_lru_open(cache, local);
+
    /* 4 threads were chosen below because just about all modern CPUs currently
     * available that run Mesa have *at least* 4 cores. For these CPUs allowing
     * more threads can result in the queue being processed faster, thus
@@ -390,6 +855,18 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
                    UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY |
                    UTIL_QUEUE_INIT_SET_FULL_THREAD_AFFINITY);
 
+   /* The archive index is in memory already. */
+   if (!cache->archive_map &&
+       env_var_as_boolean("MESA_GLSL_CACHE_MISS_FILTER", false)) {
+      cache->filter = rzalloc_array(cache, uint32_t,
+                                    (1 << CACHE_FILTER_BITS) / 32);
+      if (cache->filter) {
+         util_queue_fence_init(&cache->filter_fence);
+         util_queue_add_job(&cache->cache_queue, cache, &cache->filter_fence,
+                            cache_filter_build, NULL, 0);
+      }
+   }
+
    cache->path_init_failed = false;
 
  path_fail:
@@ -415,6 +892,11 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
    size_t driver_flags_size = sizeof(driver_flags);
    cache->driver_keys_blob_size += driver_flags_size;
 
+   uint8_t key_hash = cache->key_hash;
+   size_t key_hash_size =
+      cache->key_hash != CACHE_KEY_HASH_SHA1 ? sizeof(key_hash) : 0;
+   cache->driver_keys_blob_size += key_hash_size;
+
    cache->driver_keys_blob =
       ralloc_size(cache, cache->driver_keys_blob_size);
    if (!cache->driver_keys_blob)
@@ -426,6 +908,9 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
    DRV_KEY_CPY(drv_key_blob, gpu_name, gpu_name_size)
    DRV_KEY_CPY(drv_key_blob, &ptr_size, ptr_size_size)
    DRV_KEY_CPY(drv_key_blob, &driver_flags, driver_flags_size)
+   DRV_KEY_CPY(drv_key_blob, &key_hash, key_hash_size)
+
+   cache_bundles_open(cache, local);
 
    /* Seed our rand function */
    s_rand_xorshift128plus(cache->seed_xorshift128plus, true);
@@ -448,9 +933,21 @@ disk_cache_destroy(struct disk_cache *cache)
    if (cache && !cache->path_init_failed) {
       util_queue_finish(&cache->cache_queue);
       util_queue_destroy(&cache->cache_queue);
+      if (cache->filter)
+         util_queue_fence_destroy(&cache->filter_fence);
       munmap(cache->index_mmap, cache->index_mmap_size);
+      if (cache->lru)
+         munmap(cache->lru, cache->lru_size);
+      if (cache->archive_map) {
+         munmap(cache->archive_map, cache->archive_map_size);
+         close(cache->archive_fd);
+         mtx_destroy(&cache->archive_mutex);
+      }
    }
 
+   for (unsigned i = 0; cache && i < cache->num_bundles; i++)
+      munmap(cache->bundles[i].map, cache->bundles[i].size);
+
    ralloc_free(cache);
 }
 
@@ -501,6 +998,103 @@ make_cache_file_directory(struct disk_cache *cache, const cache_key key)
    free(dir);
 }
 
+static struct cache_lru_entry *
+cache_lru_bucket(struct disk_cache *cache, const cache_key key)
+{
+   uint32_t word;
+
+   /* The first word picks the slot in the index file already. */
+   memcpy(&word, key + sizeof(word), sizeof(word));
+   word &= (1 << CACHE_LRU_BITS) - 1;
+   return &cache->lru[word & ~(CACHE_LRU_WAYS - 1)];
+}
+
+/* Records that the entry of the key, taking "blocks" 512 byte blocks on
+ * disk, has just been written or read.
+ */
+static void
+cache_lru_touch(struct disk_cache *cache, const cache_key key,
+                uint64_t blocks)
+{
+   struct cache_lru_entry *bucket = cache_lru_bucket(cache, key);
+   struct cache_lru_entry *slot = NULL;
+
+   for (unsigned i = 0; i < CACHE_LRU_WAYS; i++) {
+      if (memcmp(bucket[i].key, key, CACHE_KEY_SIZE) == 0) {
+         slot = &bucket[i];
+         break;
+      }
+      if (!slot || bucket[i].last_used < slot->last_used)
+         slot = &bucket[i];
+   }
+
+   /* Replacing an entry only drops it from the index, not from the disk. */
+   if (memcmp(slot->key, key, CACHE_KEY_SIZE) != 0)
+      memcpy(slot->key, key, CACHE_KEY_SIZE);
+   slot->blocks = blocks;
+   slot->last_used = time(NULL);
+}
+
+static void
+cache_lru_forget(struct disk_cache *cache, const cache_key key)
+{
+   struct cache_lru_entry *bucket = cache_lru_bucket(cache, key);
+
+   for (unsigned i = 0; i < CACHE_LRU_WAYS; i++) {
+      if (memcmp(bucket[i].key, key, CACHE_KEY_SIZE) == 0)
+         memset(&bucket[i], 0, sizeof(bucket[i]));
+   }
+}
+
+/* Removes the least recently used of the indexed entries in a few random
+ * buckets. Returns the size of the deleted file, (or 0 if none of them had
+ * an entry or on any error).
+ */
+static size_t
+cache_lru_evict(struct disk_cache *cache)
+{
+   struct cache_lru_entry *oldest = NULL;
+   cache_key key;
+   struct stat sb;
+
+   /* Keep looking a bit longer in a sparse index. */
+   for (unsigned i = 0, found = 0;
+        found < CACHE_LRU_SAMPLES && i < CACHE_LRU_SAMPLES * 8; i++) {
+      uint64_t rand64 = rand_xorshift128plus(cache->seed_xorshift128plus);
+      struct cache_lru_entry *bucket =
+         &cache->lru[(rand64 & ((1 << CACHE_LRU_BITS) - 1)) &
+                     ~(CACHE_LRU_WAYS - 1)];
+
+      for (unsigned j = 0; j < CACHE_LRU_WAYS; j++) {
+         if (!bucket[j].last_used)
+            continue;
+         if (!oldest || bucket[j].last_used < oldest->last_used)
+            oldest = &bucket[j];
+         found++;
+      }
+   }
+
+   if (!oldest)
+      return 0;
+
+   memcpy(key, oldest->key, CACHE_KEY_SIZE);
+   memset(oldest, 0, sizeof(*oldest));
+
+   char *filename = get_cache_file(cache, key);
+   if (filename == NULL)
+      return 0;
+
+   /* The size comes from the file rather than the index, so that a torn
+    * entry can't throw off the accounting.
+    */
+   size_t size = 0;
+   if (stat(filename, &sb) == 0 && unlink(filename) == 0)
+      size = sb.st_blocks * 512;
+
+   free(filename);
+   return size;
+}
+
 /* Given a directory path and predicate function, find the entry with
  * the oldest access time in that directory for which the predicate
  * returns true.
@@ -644,6 +1238,15 @@ static void
 evict_lru_item(struct disk_cache *cache)
 {
    char *dir_path;
+   size_t size;
+
+   if (cache->lru) {
+      size = cache_lru_evict(cache);
+      if (size) {
+         p_atomic_add(cache->size, - (uint64_t)size);
+         return;
+      }
+   }
 
    /* With a reasonably-sized, full cache, (and with keys generated
     * from a cryptographic hash), we can choose two random hex digits
@@ -654,7 +1257,7 @@ evict_lru_item(struct disk_cache *cache)
    if (asprintf(&dir_path, "%s/%02" PRIx64 , cache->path, rand64 & 0xff) < 0)
       return;
 
-   size_t size = unlink_lru_file_from_directory(dir_path);
+   size = unlink_lru_file_from_directory(dir_path);
 
    free(dir_path);
 
@@ -684,11 +1287,51 @@ evict_lru_item(struct disk_cache *cache)
       p_atomic_add(cache->size, - (uint64_t)size);
 }
 
+/* Returns the index entry holding key, if any.  This takes no lock: a
+ * reader racing with a writer may see a stale entry, which the bounds and
+ * CRC checks in cache_archive_get() reject.
+ */
+static struct cache_archive_entry *
+cache_archive_find(uint8_t *map, const cache_key key)
+{
+   struct cache_archive_entry *entries = (struct cache_archive_entry *)
+      (map + sizeof(struct cache_archive_header));
+   const uint32_t *key_chunk = (const uint32_t *) key;
+   unsigned i = CPU_TO_LE32(*key_chunk) & CACHE_INDEX_KEY_MASK;
+
+   for (unsigned p = 0; p < CACHE_ARCHIVE_PROBES; p++) {
+      struct cache_archive_entry *entry =
+         &entries[(i + p) & CACHE_INDEX_KEY_MASK];
+      if (entry->size && memcmp(entry->key, key, CACHE_KEY_SIZE) == 0)
+         return entry;
+   }
+
+   return NULL;
+}
+
+static struct cache_archive_entry *
+cache_archive_lookup(struct disk_cache *cache, const cache_key key)
+{
+   return cache_archive_find(cache->archive_map, key);
+}
+
 void
 disk_cache_remove(struct disk_cache *cache, const cache_key key)
 {
    struct stat sb;
 
+   if (cache->archive_map) {
+      cache_archive_lock(cache);
+      struct cache_archive_entry *entry = cache_archive_lookup(cache, key);
+      if (entry)
+         memset(entry->key, 0, CACHE_KEY_SIZE);
+      cache_archive_unlock(cache);
+      return;
+   }
+
+   if (cache->lru)
+      cache_lru_forget(cache, key);
+
    char *filename = get_cache_file(cache, key);
    if (filename == NULL) {
       return;
@@ -834,6 +1477,42 @@ deflate_and_write_to_disk(const void *in_data, size_t in_data_size, int dest,
 # endif
 }
 
+/**
+ * Compresses cache entry into a malloc'ed buffer. Returns NULL on failure.
+ */
+static void *
+deflate_to_memory(const void *in_data, size_t in_data_size, size_t *out_size)
+{
+#ifdef HAVE_ZSTD
+   size_t bound = ZSTD_compressBound(in_data_size);
+   void *out = malloc(bound);
+   if (!out)
+      return NULL;
+
+   size_t ret = ZSTD_compress(out, bound, in_data, in_data_size,
+                              ZSTD_COMPRESSION_LEVEL);
+   if (ZSTD_isError(ret)) {
+      free(out);
+      return NULL;
+   }
+   *out_size = ret;
+   return out;
+#else
+   uLongf size = compressBound(in_data_size);
+   void *out = malloc(size);
+   if (!out)
+      return NULL;
+
+   if (compress2(out, &size, in_data, in_data_size,
+                 Z_BEST_COMPRESSION) != Z_OK) {
+      free(out);
+      return NULL;
+   }
+   *out_size = size;
+   return out;
+#endif
+}
+
 static struct disk_cache_put_job *
 create_put_job(struct disk_cache *cache, const cache_key key,
                const void *data, size_t size,
@@ -895,6 +1574,81 @@ struct cache_entry_file_data {
    uint32_t uncompressed_size;
 };
 
+/* Appends the blob to the archive and publishes it in the index.  The
+ * slot taken is the first free one probed, or else the one holding the
+ * oldest blob.
+ */
+static void
+cache_archive_put(struct disk_cache_put_job *dc_job)
+{
+   struct disk_cache *cache = dc_job->cache;
+   struct cache_archive_header *header =
+      (struct cache_archive_header *) cache->archive_map;
+   struct cache_archive_entry *entries = cache_archive_entries(cache);
+   struct cache_archive_entry *entry = NULL;
+
+   if (dc_job->size == 0 || dc_job->size > cache->max_size)
+      return;
+
+   /* Compress before taking the lock, so that the queue threads only
+    * serialize on the write itself.
+    */
+   const void *blob = dc_job->data;
+   void *compressed = NULL;
+   size_t size = dc_job->size;
+   if (cache->archive_compressed) {
+      compressed = deflate_to_memory(dc_job->data, dc_job->size, &size);
+      if (!compressed)
+         return;
+      blob = compressed;
+   }
+
+   cache_archive_lock(cache);
+
+   if (cache_archive_lookup(cache, dc_job->key))
+      goto done;
+
+   const uint32_t *key_chunk = (const uint32_t *) dc_job->key;
+   unsigned i = CPU_TO_LE32(*key_chunk) & CACHE_INDEX_KEY_MASK;
+   for (unsigned p = 0; p < CACHE_ARCHIVE_PROBES; p++) {
+      struct cache_archive_entry *probe =
+         &entries[(i + p) & CACHE_INDEX_KEY_MASK];
+      if (!probe->size) {
+         entry = probe;
+         break;
+      }
+      if (!entry || probe->offset < entry->offset)
+         entry = probe;
+   }
+
+   /* Unpublish the old blob before anything else is changed. */
+   memset(entry->key, 0, CACHE_KEY_SIZE);
+   entry->size = 0;
+   __sync_synchronize();
+
+   if (header->end + size > cache->archive_map_size)
+      cache_archive_reset(cache);
+
+   uint64_t offset = header->end;
+   if (size > cache->archive_map_size - offset ||
+       lseek(cache->archive_fd, offset, SEEK_SET) == -1 ||
+       write_all(cache->archive_fd, blob, size) == -1)
+      goto done;
+
+   entry->offset = offset;
+   entry->uncompressed_size = dc_job->size;
+   entry->crc32 = util_hash_crc32(dc_job->data, dc_job->size);
+   entry->flags = cache->archive_compressed ? 0 : CACHE_ARCHIVE_RAW;
+   entry->size = size;
+   header->end = offset + size;
+   __sync_synchronize();
+   memcpy(entry->key, dc_job->key, CACHE_KEY_SIZE);
+
+ done:
+   cache_archive_unlock(cache);
+   free(compressed);
+}
+
 static void
 cache_put(void *job, int thread_index)
 {
@@ -905,6 +1659,11 @@ cache_put(void *job, int thread_index)
    char *filename = NULL, *filename_tmp = NULL;
    struct disk_cache_put_job *dc_job = (struct disk_cache_put_job *) job;
 
+   if (dc_job->cache->archive_map) {
+      cache_archive_put(dc_job);
+      return;
+   }
+
    filename = get_cache_file(dc_job->cache, dc_job->key);
    if (filename == NULL)
       goto done;
@@ -1050,6 +1809,8 @@ cache_put(void *job, int thread_index)
    }
 
    p_atomic_add(dc_job->cache->size, sb.st_blocks * 512);
+   if (dc_job->cache->lru)
+      cache_lru_touch(dc_job->cache, dc_job->key, sb.st_blocks);
 
  done:
    if (fd_final != -1)
@@ -1076,6 +1837,9 @@ disk_cache_put(struct disk_cache *cache, const cache_key key,
    if (cache->path_init_failed)
       return;
 
+   if (cache->filter)
+      cache_filter_add(cache, key);
+
    struct disk_cache_put_job *dc_job =
       create_put_job(cache, key, data, size, cache_item_metadata);
 
@@ -1130,6 +1894,84 @@ inflate_cache_data(uint8_t *in_data, size_t in_data_size,
 #endif
 }
 
+/* A hit is a probe of the mapped index and a copy, or inflate, straight
+ * out of the mapping.
+ */
+static void *
+cache_archive_read(uint8_t *map, size_t map_size, uint64_t max_size,
+                   const cache_key key, size_t *size)
+{
+   struct cache_archive_header *header = (struct cache_archive_header *) map;
+   struct cache_archive_entry *found = cache_archive_find(map, key);
+   if (!found)
+      return NULL;
+
+   struct cache_archive_entry entry = *found;
+   uint64_t end = header->end;
+   if (end > map_size)
+      end = map_size;
+
+   if (entry.offset < CACHE_ARCHIVE_DATA_START ||
+       entry.size > end || entry.offset > end - entry.size)
+      return NULL;
+
+   if (entry.uncompressed_size == 0 ||
+       entry.uncompressed_size > max_size)
+      return NULL;
+
+   uint8_t *blob = map + entry.offset;
+   uint8_t *data = malloc(entry.uncompressed_size);
+   if (!data)
+      return NULL;
+
+   if (entry.flags & CACHE_ARCHIVE_RAW) {
+      if (entry.size != entry.uncompressed_size)
+         goto fail;
+      memcpy(data, blob, entry.size);
+   } else {
+      if (!inflate_cache_data(blob, entry.size, data,
+                              entry.uncompressed_size))
+         goto fail;
+   }
+
+   /* Check the data for corruption, or for a racing writer */
+   if (entry.crc32 != util_hash_crc32(data, entry.uncompressed_size))
+      goto fail;
+
+   if (size)
+      *size = entry.uncompressed_size;
+
+   return data;
+
+ fail:
+   free(data);
+   return NULL;
+}
+
+static void *
+cache_archive_get(struct disk_cache *cache, const cache_key key, size_t *size)
+{
+   return cache_archive_read(cache->archive_map, cache->archive_map_size,
+                             cache->max_size, key, size);
+}
+
+/* Bundles are searched in the order they were listed.  Their entries are
+ * bounded only by the 32-bit size field, the crc catches the rest.
+ */
+static void *
+cache_bundle_get(struct disk_cache *cache, const cache_key key, size_t *size)
+{
+   for (unsigned i = 0; i < cache->num_bundles; i++) {
+      void *data = cache_archive_read(cache->bundles[i].map,
+                                      cache->bundles[i].size, UINT32_MAX,
+                                      key, size);
+      if (data)
+         return data;
+   }
+
+   return NULL;
+}
+
 void *
 disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
 {
@@ -1165,6 +2007,19 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
       return blob;
    }
 
+   if (cache->num_bundles) {
+      void *data = cache_bundle_get(cache, key, size);
+      if (data)
+         return data;
+   }
+
+   if (cache->archive_map)
+      return cache_archive_get(cache, key, size);
+
+   if (cache->filter && p_atomic_read(&cache->filter_ready) &&
+       !cache_filter_test(cache, key))
+      return NULL;
+
    filename = get_cache_file(cache, key);
    if (filename == NULL)
       goto fail;
@@ -1253,6 +2108,9 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
    free(file_header);
    close(fd);
 
+   if (cache->lru)
+      cache_lru_touch(cache, key, sb.st_blocks);
+
    if (size)
       *size = cf_data.uncompressed_size;
 
@@ -1312,6 +2170,11 @@ disk_cache_has_key(struct disk_cache *cache, const cache_key key)
       return cache->blob_get_cb(key, CACHE_KEY_SIZE, &blob, sizeof(uint32_t));
    }
 
+   for (unsigned b = 0; b < cache->num_bundles; b++) {
+      if (cache_archive_find(cache->bundles[b].map, key))
+         return true;
+   }
+
    if (cache->path_init_failed)
       return false;
 
@@ -1326,6 +2189,28 @@ disk_cache_compute_key(struct disk_cache *cache, const void *data, size_t size,
 {
    struct mesa_sha1 ctx;
 
+   if (cache->key_hash == CACHE_KEY_HASH_XXH64) {
+      /* Three differently seeded 64-bit hashes fill the 160-bit key. Unlike
+       * SHA-1 this is no defence against deliberate collisions, which the
+       * cache doesn't rely on, but it is many times faster.
+       */
+      uint8_t hashes[3 * sizeof(XXH64_canonical_t)];
+
+      for (unsigned i = 0; i < 3; i++) {
+         XXH64_state_t state;
+
+         XXH64_reset(&state, i);
+         XXH64_update(&state, cache->driver_keys_blob,
+                      cache->driver_keys_blob_size);
+         XXH64_update(&state, data, size);
+         XXH64_canonicalFromHash((XXH64_canonical_t *)
+                                 &hashes[i * sizeof(XXH64_canonical_t)],
+                                 XXH64_digest(&state));
+      }
+      memcpy(key, hashes, CACHE_KEY_SIZE);
+      return;
+   }
+
    _mesa_sha1_init(&ctx);
    _mesa_sha1_update(&ctx, cache->driver_keys_blob,
                      cache->driver_keys_blob_size);
@@ -315,3 +315,217 @@ slab_create(struct slab_mempool *mempool,
    slab_create_parent(&mempool->parent, item_size, num_items);
    slab_create_child(&mempool->child, &mempool->parent);
 }
+
+/****************************************************************************
+ * Multi-threaded pool
+ */
+
+#define SLAB_MT_MAGAZINE_SIZE 32
+
+struct slab_mt_element {
+   /* The next element in the same magazine. */
+   struct slab_mt_element *next;
+
+#ifndef NDEBUG
+   intptr_t magic;
+#endif
+};
+
+/* Kept in the first element of a magazine while it's in the depot. */
+struct slab_mt_magazine {
+   struct slab_mt_element *next;
+   unsigned count;
+};
+
+struct slab_mt_page {
+   struct slab_mt_page *next;
+   /* Elements follow. */
+};
+
+static inline struct slab_mt_magazine *
+slab_mt_magazine(struct slab_mt_element *elt)
+{
+   return (struct slab_mt_magazine *)&elt[1];
+}
+
+#ifdef USE_ELF_TLS
+static __thread unsigned slab_mt_thread_id;
+static unsigned slab_mt_num_threads;
+#endif
+
+static struct slab_mt_cache *
+slab_mt_get_cache(struct slab_mt_pool *pool)
+{
+#ifdef USE_ELF_TLS
+   if (unlikely(!slab_mt_thread_id))
+      slab_mt_thread_id = p_atomic_inc_return(&slab_mt_num_threads);
+
+   return &pool->caches[slab_mt_thread_id % SLAB_MT_NUM_CACHES];
+#else
+   return &pool->caches[0];
+#endif
+}
+
+/**
+ * Create a pool for same-sized objects that can be allocated and freed in
+ * any thread.
+ *
+ * \param item_size     Size of one object.
+ * \param num_items     Number of objects to allocate at once.
+ */
+void
+slab_mt_create(struct slab_mt_pool *pool,
+               unsigned item_size,
+               unsigned num_items)
+{
+   memset(pool, 0, sizeof(*pool));
+   simple_mtx_init(&pool->mutex, mtx_plain);
+   for (unsigned i = 0; i < SLAB_MT_NUM_CACHES; i++)
+      simple_mtx_init(&pool->caches[i].mutex, mtx_plain);
+
+   pool->element_size =
+      ALIGN_POT(sizeof(struct slab_mt_element) +
+                MAX2(item_size, sizeof(struct slab_mt_magazine)),
+                sizeof(intptr_t));
+   pool->num_elements = MAX2(num_items, 1);
+}
+
+/**
+ * Destroy the pool. All objects must have been freed.
+ */
+void
+slab_mt_destroy(struct slab_mt_pool *pool)
+{
+   while (pool->pages) {
+      struct slab_mt_page *page = pool->pages;
+      pool->pages = page->next;
+      free(page);
+   }
+
+   for (unsigned i = 0; i < SLAB_MT_NUM_CACHES; i++)
+      simple_mtx_destroy(&pool->caches[i].mutex);
+   simple_mtx_destroy(&pool->mutex);
+}
+
+/* Load a magazine into the cache, from the depot if there is one there.
+ * Called with the cache mutex held.
+ */
+static bool
+slab_mt_refill(struct slab_mt_pool *pool, struct slab_mt_cache *cache)
+{
+   struct slab_mt_element *first;
+   struct slab_mt_page *page;
+
+   simple_mtx_lock(&pool->mutex);
+   first = pool->depot;
+   if (first) {
+      pool->depot = slab_mt_magazine(first)->next;
+      simple_mtx_unlock(&pool->mutex);
+
+      cache->loaded = first;
+      cache->num_loaded = slab_mt_magazine(first)->count;
+      return true;
+   }
+   simple_mtx_unlock(&pool->mutex);
+
+   page = malloc(sizeof(struct slab_mt_page) +
+                 pool->num_elements * pool->element_size);
+   if (!page)
+      return false;
+
+   first = NULL;
+   for (unsigned i = pool->num_elements; i--;) {
+      struct slab_mt_element *elt = (struct slab_mt_element *)
+         ((uint8_t *)&page[1] + pool->element_size * i);
+
+      elt->next = first;
+      SET_MAGIC(elt, SLAB_MAGIC_FREE);
+      first = elt;
+   }
+
+   simple_mtx_lock(&pool->mutex);
+   page->next = pool->pages;
+   pool->pages = page;
+   simple_mtx_unlock(&pool->mutex);
+
+   cache->loaded = first;
+   cache->num_loaded = pool->num_elements;
+   return true;
+}
+
+/**
+ * Allocate an object from the pool. Can be called from any thread.
+ */
+void *
+slab_mt_alloc(struct slab_mt_pool *pool)
+{
+   struct slab_mt_cache *cache = slab_mt_get_cache(pool);
+   struct slab_mt_element *elt;
+
+   simple_mtx_lock(&cache->mutex);
+
+   if (!cache->num_loaded) {
+      if (cache->num_previous) {
+         cache->loaded = cache->previous;
+         cache->num_loaded = cache->num_previous;
+         cache->previous = NULL;
+         cache->num_previous = 0;
+      } else if (!slab_mt_refill(pool, cache)) {
+         simple_mtx_unlock(&cache->mutex);
+         return NULL;
+      }
+   }
+
+   elt = cache->loaded;
+   cache->loaded = elt->next;
+   cache->num_loaded--;
+
+   simple_mtx_unlock(&cache->mutex);
+
+   CHECK_MAGIC(elt, SLAB_MAGIC_FREE);
+   SET_MAGIC(elt, SLAB_MAGIC_ALLOCATED);
+
+   return &elt[1];
+}
+
+/**
+ * Free an object allocated from the pool. Can be called from any thread,
+ * not just the one that allocated the object.
+ */
+void
+slab_mt_free(struct slab_mt_pool *pool, void *ptr)
+{
+   struct slab_mt_element *elt = ((struct slab_mt_element *)ptr - 1);
+   struct slab_mt_cache *cache = slab_mt_get_cache(pool);
+
+   CHECK_MAGIC(elt, SLAB_MAGIC_ALLOCATED);
+   SET_MAGIC(elt, SLAB_MAGIC_FREE);
+
+   simple_mtx_lock(&cache->mutex);
+
+   if (cache->num_loaded >= SLAB_MT_MAGAZINE_SIZE) {
+      /* If both magazines are full, the previous one goes to the depot where
+       * other threads can pick it up.
+       */
+      if (cache->num_previous) {
+         struct slab_mt_element *first = cache->previous;
+
+         slab_mt_magazine(first)->count = cache->num_previous;
+         simple_mtx_lock(&pool->mutex);
+         slab_mt_magazine(first)->next = pool->depot;
+         pool->depot = first;
+         simple_mtx_unlock(&pool->mutex);
+      }
+
+      cache->previous = cache->loaded;
+      cache->num_previous = cache->num_loaded;
+      cache->loaded = NULL;
+      cache->num_loaded = 0;
+   }
+
+   elt->next = cache->loaded;
+   cache->loaded = elt;
+   cache->num_loaded++;
+
+   simple_mtx_unlock(&cache->mutex);
+}
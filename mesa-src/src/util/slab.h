@@ -37,15 +37,24 @@
  *
  * For convenience and to ease the transition, there is also a set of wrapper
  * functions around a single parent-child pair.
+ *
+ * For objects that are routinely freed by a different thread than the one
+ * that allocated them, there is slab_mt_pool. It can be used from any thread
+ * without a child pool: every thread works on its own cache of free elements
+ * (a "magazine"), and full magazines are handed between threads in one go
+ * through a shared depot.
  */
 
 #ifndef SLAB_H
 #define SLAB_H
 
 #include "c11/threads.h"
+#include "util/simple_mtx.h"
 
 struct slab_element_header;
 struct slab_page_header;
+struct slab_mt_element;
+struct slab_mt_page;
 
 struct slab_parent_pool {
    mtx_t mutex;
@@ -91,4 +100,45 @@ void slab_destroy(struct slab_mempool *mempool);
 void *slab_alloc_st(struct slab_mempool *mempool);
 void slab_free_st(struct slab_mempool *mempool, void *ptr);
 
+#define SLAB_MT_NUM_CACHES 16
+
+/* Per-thread cache of free elements. Threads are spread over the caches,
+ * so the lock is practically uncontended.
+ */
+struct slab_mt_cache {
+   simple_mtx_t mutex;
+
+   /* The magazine that allocations and frees work on, and the previous one
+    * that is kept around so that alternating allocs and frees at the
+    * boundary don't go to the depot every time.
+    */
+   struct slab_mt_element *loaded;
+   struct slab_mt_element *previous;
+   unsigned num_loaded;
+   unsigned num_previous;
+
+   /* Keeps the caches of different threads off each other's cache lines. */
+   char pad[64];
+};
+
+struct slab_mt_pool {
+   struct slab_mt_cache caches[SLAB_MT_NUM_CACHES];
+
+   /* Protects everything below. */
+   simple_mtx_t mutex;
+   unsigned element_size;
+   unsigned num_elements;
+   struct slab_mt_page *pages;
+
+   /* Full magazines returned by the caches. */
+   struct slab_mt_element *depot;
+};
+
+void slab_mt_create(struct slab_mt_pool *pool,
+                    unsigned item_size,
+                    unsigned num_items);
+void slab_mt_destroy(struct slab_mt_pool *pool);
+void *slab_mt_alloc(struct slab_mt_pool *pool);
+void slab_mt_free(struct slab_mt_pool *pool, void *ptr);
+
 #endif
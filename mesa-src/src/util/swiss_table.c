@@ -0,0 +1,536 @@
+/*
+ * Copyright © 2026 Mesa contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * Implements an open-addressing hash table in the style of the "Swiss
+ * tables": the slots are split in groups of 16, and a control byte per slot
+ * holds either 7 bits of the hash of its key or an empty / deleted marker.
+ *
+ * The hash is scrambled once with a multiply: the group a key starts in
+ * comes from the top bits of the product, the 7 bits kept in the control
+ * byte from the bottom ones.  Further groups are probed triangularly.  Within a group the control bytes are
+ * compared against the key's 7 bits at once, and only the matching entries
+ * are looked at.  A probe sequence ends at the first group with an empty
+ * slot.
+ */
+
+#include <string.h>
+#include <assert.h>
+
+#include "swiss_table.h"
+#include "bitscan.h"
+#include "ralloc.h"
+#include "macros.h"
+
+#if defined(__SSE2__) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2)) || defined(_M_X64)
+#include <emmintrin.h>
+#define SWISS_TABLE_SSE2
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SWISS_TABLE_NEON
+#endif
+
+#define GROUP_SIZE 16
+
+#define CTRL_EMPTY   0x80
+#define CTRL_DELETED 0xfe
+
+#define MIN_SIZE GROUP_SIZE
+
+/* Callers' hashes often only vary in a few bits (_mesa_hash_pointer()), so
+ * mix them before splitting into the group and control byte parts.
+ */
+static inline uint32_t
+mix_hash(uint32_t hash)
+{
+   return hash * 0x9e3779b1u;
+}
+
+static inline uint8_t
+ctrl_h2(uint32_t mixed)
+{
+   return mixed & 0x7f;
+}
+
+static inline uint32_t
+first_group(uint32_t mixed, uint32_t groups)
+{
+   return ((uint64_t)mixed * groups) >> 32;
+}
+
+static inline bool
+ctrl_is_full(uint8_t ctrl)
+{
+   return (ctrl & 0x80) == 0;
+}
+
+/* 7/8 load factor */
+static inline uint32_t
+max_entries_for_size(uint32_t size)
+{
+   return size - size / 8;
+}
+
+/**
+ * Returns a mask with bit i set when control byte i of the group equals
+ * value.
+ */
+static inline unsigned
+group_match(const uint8_t *ctrl, uint8_t value)
+{
+#if defined(SWISS_TABLE_SSE2)
+   __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+   return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(value)));
+#elif defined(SWISS_TABLE_NEON)
+   static const uint8_t bits[GROUP_SIZE] = {
+      1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+   };
+   uint8x16_t cmp = vceqq_u8(vld1q_u8(ctrl), vdupq_n_u8(value));
+   uint8x16_t m = vandq_u8(cmp, vld1q_u8(bits));
+   return vaddv_u8(vget_low_u8(m)) | (vaddv_u8(vget_high_u8(m)) << 8);
+#else
+   unsigned mask = 0;
+   unsigned i;
+
+   for (i = 0; i < GROUP_SIZE; i++)
+      mask |= (unsigned)(ctrl[i] == value) << i;
+   return mask;
+#endif
+}
+
+/**
+ * Returns a mask of the empty or deleted slots of the group, the ones with
+ * the top bit set.
+ */
+static inline unsigned
+group_match_available(const uint8_t *ctrl)
+{
+#if defined(SWISS_TABLE_SSE2)
+   return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#elif defined(SWISS_TABLE_NEON)
+   static const uint8_t bits[GROUP_SIZE] = {
+      1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+   };
+   uint8x16_t cmp = vcltzq_s8(vreinterpretq_s8_u8(vld1q_u8(ctrl)));
+   uint8x16_t m = vandq_u8(cmp, vld1q_u8(bits));
+   return vaddv_u8(vget_low_u8(m)) | (vaddv_u8(vget_high_u8(m)) << 8);
+#else
+   unsigned mask = 0;
+   unsigned i;
+
+   for (i = 0; i < GROUP_SIZE; i++)
+      mask |= (unsigned)!ctrl_is_full(ctrl[i]) << i;
+   return mask;
+#endif
+}
+
+static inline uint32_t
+group_mask(const struct swiss_table *ht)
+{
+   return ht->size / GROUP_SIZE - 1;
+}
+
+static bool
+swiss_table_alloc(void *mem_ctx, uint32_t size,
+                  struct hash_entry **table, uint8_t **ctrl)
+{
+   *table = ralloc_array(mem_ctx, struct hash_entry, size);
+   if (*table == NULL)
+      return false;
+
+   /* The control bytes hang off the entries, freeing one frees both. */
+   *ctrl = ralloc_array(*table, uint8_t, size);
+   if (*ctrl == NULL) {
+      ralloc_free(*table);
+      return false;
+   }
+
+   memset(*ctrl, CTRL_EMPTY, size);
+   return true;
+}
+
+bool
+_mesa_swiss_table_init(struct swiss_table *ht,
+                       void *mem_ctx,
+                       uint32_t (*key_hash_function)(const void *key),
+                       bool (*key_equals_function)(const void *a,
+                                                   const void *b))
+{
+   ht->size = MIN_SIZE;
+   ht->max_entries = max_entries_for_size(ht->size);
+   ht->key_hash_function = key_hash_function;
+   ht->key_equals_function = key_equals_function;
+   ht->entries = 0;
+   ht->deleted_entries = 0;
+
+   return swiss_table_alloc(mem_ctx, ht->size, &ht->table, &ht->ctrl);
+}
+
+struct swiss_table *
+_mesa_swiss_table_create(void *mem_ctx,
+                         uint32_t (*key_hash_function)(const void *key),
+                         bool (*key_equals_function)(const void *a,
+                                                     const void *b))
+{
+   struct swiss_table *ht;
+
+   ht = ralloc(mem_ctx, struct swiss_table);
+   if (ht == NULL)
+      return NULL;
+
+   if (!_mesa_swiss_table_init(ht, ht, key_hash_function, key_equals_function)) {
+      ralloc_free(ht);
+      return NULL;
+   }
+
+   return ht;
+}
+
+struct swiss_table *
+_mesa_swiss_table_clone(struct swiss_table *src, void *dst_mem_ctx)
+{
+   struct swiss_table *ht;
+
+   ht = ralloc(dst_mem_ctx, struct swiss_table);
+   if (ht == NULL)
+      return NULL;
+
+   memcpy(ht, src, sizeof(struct swiss_table));
+
+   if (!swiss_table_alloc(ht, ht->size, &ht->table, &ht->ctrl)) {
+      ralloc_free(ht);
+      return NULL;
+   }
+
+   memcpy(ht->table, src->table, ht->size * sizeof(struct hash_entry));
+   memcpy(ht->ctrl, src->ctrl, ht->size);
+
+   return ht;
+}
+
+/**
+ * Frees the given table, calling delete_function on each entry present
+ * first if one is passed.
+ */
+void
+_mesa_swiss_table_destroy(struct swiss_table *ht,
+                          void (*delete_function)(struct hash_entry *entry))
+{
+   if (!ht)
+      return;
+
+   if (delete_function) {
+      swiss_table_foreach(ht, entry) {
+         delete_function(entry);
+      }
+   }
+   ralloc_free(ht);
+}
+
+/**
+ * Deletes all entries without changing the size of the table.
+ */
+void
+_mesa_swiss_table_clear(struct swiss_table *ht,
+                        void (*delete_function)(struct hash_entry *entry))
+{
+   if (delete_function) {
+      swiss_table_foreach(ht, entry) {
+         delete_function(entry);
+      }
+   }
+
+   memset(ht->ctrl, CTRL_EMPTY, ht->size);
+   ht->entries = 0;
+   ht->deleted_entries = 0;
+}
+
+static struct hash_entry *
+swiss_table_search(struct swiss_table *ht, uint32_t hash, const void *key)
+{
+   const uint32_t mask = group_mask(ht);
+   const uint32_t mixed = mix_hash(hash);
+   const uint8_t h2 = ctrl_h2(mixed);
+   uint32_t group = first_group(mixed, mask + 1);
+   uint32_t probe;
+
+   for (probe = 1; probe <= mask + 1; probe++) {
+      const uint32_t base = group * GROUP_SIZE;
+      unsigned match = group_match(ht->ctrl + base, h2);
+
+      while (match) {
+         struct hash_entry *entry = ht->table + base + u_bit_scan(&match);
+
+         if (entry->hash == hash && ht->key_equals_function(key, entry->key))
+            return entry;
+      }
+
+      if (group_match(ht->ctrl + base, CTRL_EMPTY))
+         return NULL;
+
+      group = (group + probe) & mask;
+   }
+
+   return NULL;
+}
+
+struct hash_entry *
+_mesa_swiss_table_search(struct swiss_table *ht, const void *key)
+{
+   assert(ht->key_hash_function);
+   return swiss_table_search(ht, ht->key_hash_function(key), key);
+}
+
+struct hash_entry *
+_mesa_swiss_table_search_pre_hashed(struct swiss_table *ht, uint32_t hash,
+                                    const void *key)
+{
+   assert(ht->key_hash_function == NULL || hash == ht->key_hash_function(key));
+   return swiss_table_search(ht, hash, key);
+}
+
+static bool
+swiss_table_rehash(struct swiss_table *ht, uint32_t new_size)
+{
+   struct hash_entry *table;
+   uint8_t *ctrl;
+   uint32_t mask = new_size / GROUP_SIZE - 1;
+   uint32_t i;
+
+   if (!swiss_table_alloc(ralloc_parent(ht->table), new_size, &table, &ctrl))
+      return false;
+
+   /* The entries are moved without comparing keys, they are known to be
+    * unique.
+    */
+   for (i = 0; i < ht->size; i++) {
+      uint32_t group, probe;
+
+      if (!ctrl_is_full(ht->ctrl[i]))
+         continue;
+
+      group = first_group(mix_hash(ht->table[i].hash), mask + 1);
+      for (probe = 1;; probe++) {
+         const uint32_t base = group * GROUP_SIZE;
+         unsigned empty = group_match(ctrl + base, CTRL_EMPTY);
+
+         if (empty) {
+            const uint32_t slot = base + ffs(empty) - 1;
+
+            ctrl[slot] = ht->ctrl[i];
+            table[slot] = ht->table[i];
+            break;
+         }
+
+         group = (group + probe) & mask;
+      }
+   }
+
+   ralloc_free(ht->table);
+
+   ht->table = table;
+   ht->ctrl = ctrl;
+   ht->size = new_size;
+   ht->max_entries = max_entries_for_size(new_size);
+   ht->deleted_entries = 0;
+
+   return true;
+}
+
+static struct hash_entry *
+swiss_table_insert(struct swiss_table *ht, uint32_t hash,
+                   const void *key, void *data)
+{
+   const uint32_t mixed = mix_hash(hash);
+   const uint8_t h2 = ctrl_h2(mixed);
+   uint32_t available = UINT32_MAX;
+   uint32_t mask, group, probe;
+
+   if (ht->entries >= ht->max_entries) {
+      if (ht->size <= UINT32_MAX / 2)
+         swiss_table_rehash(ht, ht->size * 2);
+   } else if (ht->entries + ht->deleted_entries >= ht->max_entries) {
+      swiss_table_rehash(ht, ht->size);
+   }
+
+   mask = group_mask(ht);
+   group = first_group(mixed, mask + 1);
+
+   for (probe = 1; probe <= mask + 1; probe++) {
+      const uint32_t base = group * GROUP_SIZE;
+      const uint8_t *ctrl = ht->ctrl + base;
+      unsigned match = group_match(ctrl, h2);
+
+      /* Replace the data of a matching key, as _mesa_hash_table_insert() */
+      while (match) {
+         struct hash_entry *entry = ht->table + base + u_bit_scan(&match);
+
+         if (entry->hash == hash && ht->key_equals_function(key, entry->key)) {
+            entry->key = key;
+            entry->data = data;
+            return entry;
+         }
+      }
+
+      /* Stash the first available slot we find */
+      if (available == UINT32_MAX) {
+         unsigned free_slots = group_match_available(ctrl);
+
+         if (free_slots)
+            available = base + ffs(free_slots) - 1;
+      }
+
+      if (group_match(ctrl, CTRL_EMPTY))
+         break;
+
+      group = (group + probe) & mask;
+   }
+
+   if (available != UINT32_MAX) {
+      struct hash_entry *entry = ht->table + available;
+
+      if (ht->ctrl[available] == CTRL_DELETED)
+         ht->deleted_entries--;
+      ht->ctrl[available] = h2;
+      entry->hash = hash;
+      entry->key = key;
+      entry->data = data;
+      ht->entries++;
+      return entry;
+   }
+
+   /* We could hit here if a required resize failed. */
+   return NULL;
+}
+
+/**
+ * Inserts the key into the table, replacing the data of an existing entry
+ * with an equal key.
+ *
+ * Insertion may rehash the table, so previously found entries are no longer
+ * valid after this function.
+ */
+struct hash_entry *
+_mesa_swiss_table_insert(struct swiss_table *ht, const void *key, void *data)
+{
+   assert(ht->key_hash_function);
+   return swiss_table_insert(ht, ht->key_hash_function(key), key, data);
+}
+
+struct hash_entry *
+_mesa_swiss_table_insert_pre_hashed(struct swiss_table *ht, uint32_t hash,
+                                    const void *key, void *data)
+{
+   assert(ht->key_hash_function == NULL || hash == ht->key_hash_function(key));
+   return swiss_table_insert(ht, hash, key, data);
+}
+
+/**
+ * Deletes the given entry.  This does not otherwise modify the table, so
+ * removing entries while iterating is safe.
+ */
+void
+_mesa_swiss_table_remove(struct swiss_table *ht,
+                         struct hash_entry *entry)
+{
+   uint32_t slot;
+
+   if (!entry)
+      return;
+
+   slot = entry - ht->table;
+   assert(slot < ht->size && ctrl_is_full(ht->ctrl[slot]));
+
+   /* Probes only go past groups without an empty slot.  If this group
+    * still has one, no probe sequence continues past it and the slot can
+    * be freed outright instead of leaving a tombstone.
+    */
+   if (group_match(ht->ctrl + (slot & ~(GROUP_SIZE - 1)), CTRL_EMPTY)) {
+      ht->ctrl[slot] = CTRL_EMPTY;
+   } else {
+      ht->ctrl[slot] = CTRL_DELETED;
+      ht->deleted_entries++;
+   }
+   ht->entries--;
+}
+
+void
+_mesa_swiss_table_remove_key(struct swiss_table *ht,
+                             const void *key)
+{
+   _mesa_swiss_table_remove(ht, _mesa_swiss_table_search(ht, key));
+}
+
+/**
+ * Iterator over the table, pass NULL for the first entry.  Iteration is
+ * O(table_size) not O(entries).
+ */
+struct hash_entry *
+_mesa_swiss_table_next_entry(struct swiss_table *ht,
+                             struct hash_entry *entry)
+{
+   uint32_t i = entry ? entry - ht->table + 1 : 0;
+
+   for (; i < ht->size; i++) {
+      if (ctrl_is_full(ht->ctrl[i]))
+         return ht->table + i;
+   }
+
+   return NULL;
+}
+
+/**
+ * Returns a random entry from the table, see
+ * _mesa_hash_table_random_entry().
+ */
+struct hash_entry *
+_mesa_swiss_table_random_entry(struct swiss_table *ht,
+                               bool (*predicate)(struct hash_entry *entry))
+{
+   uint32_t start = rand() % ht->size;
+   uint32_t n;
+
+   if (ht->entries == 0)
+      return NULL;
+
+   for (n = 0; n < ht->size; n++) {
+      uint32_t i = start + n < ht->size ? start + n : start + n - ht->size;
+      struct hash_entry *entry = ht->table + i;
+
+      if (ctrl_is_full(ht->ctrl[i]) && (!predicate || predicate(entry)))
+         return entry;
+   }
+
+   return NULL;
+}
+
+/**
+ * Helper to create a table with pointer keys.
+ */
+struct swiss_table *
+_mesa_pointer_swiss_table_create(void *mem_ctx)
+{
+   return _mesa_swiss_table_create(mem_ctx, _mesa_hash_pointer,
+                                   _mesa_key_pointer_equal);
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright © 2026 Mesa contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _SWISS_TABLE_H
+#define _SWISS_TABLE_H
+
+#include "hash_table.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Open-addressing hash table keeping a control byte per slot in a separate
+ * array, so that a probe checks 16 slots with one SIMD compare before
+ * touching any entry.
+ *
+ * The interface follows _mesa_hash_table_*, with the same struct hash_entry
+ * and the same rules for entries going stale on insertion.  No key values
+ * are reserved, so there is no deleted key to set.
+ */
+struct swiss_table {
+   struct hash_entry *table;
+   uint8_t *ctrl;
+   uint32_t (*key_hash_function)(const void *key);
+   bool (*key_equals_function)(const void *a, const void *b);
+   uint32_t size;
+   uint32_t max_entries;
+   uint32_t entries;
+   uint32_t deleted_entries;
+};
+
+struct swiss_table *
+_mesa_swiss_table_create(void *mem_ctx,
+                         uint32_t (*key_hash_function)(const void *key),
+                         bool (*key_equals_function)(const void *a,
+                                                     const void *b));
+
+bool
+_mesa_swiss_table_init(struct swiss_table *ht,
+                       void *mem_ctx,
+                       uint32_t (*key_hash_function)(const void *key),
+                       bool (*key_equals_function)(const void *a,
+                                                   const void *b));
+
+struct swiss_table *
+_mesa_swiss_table_clone(struct swiss_table *src, void *dst_mem_ctx);
+void _mesa_swiss_table_destroy(struct swiss_table *ht,
+                               void (*delete_function)(struct hash_entry *entry));
+void _mesa_swiss_table_clear(struct swiss_table *ht,
+                             void (*delete_function)(struct hash_entry *entry));
+
+static inline uint32_t _mesa_swiss_table_num_entries(struct swiss_table *ht)
+{
+   return ht->entries;
+}
+
+struct hash_entry *
+_mesa_swiss_table_insert(struct swiss_table *ht, const void *key, void *data);
+struct hash_entry *
+_mesa_swiss_table_insert_pre_hashed(struct swiss_table *ht, uint32_t hash,
+                                    const void *key, void *data);
+struct hash_entry *
+_mesa_swiss_table_search(struct swiss_table *ht, const void *key);
+struct hash_entry *
+_mesa_swiss_table_search_pre_hashed(struct swiss_table *ht, uint32_t hash,
+                                    const void *key);
+void _mesa_swiss_table_remove(struct swiss_table *ht,
+                              struct hash_entry *entry);
+void _mesa_swiss_table_remove_key(struct swiss_table *ht,
+                                  const void *key);
+
+struct hash_entry *_mesa_swiss_table_next_entry(struct swiss_table *ht,
+                                                struct hash_entry *entry);
+struct hash_entry *
+_mesa_swiss_table_random_entry(struct swiss_table *ht,
+                               bool (*predicate)(struct hash_entry *entry));
+
+struct swiss_table *
+_mesa_pointer_swiss_table_create(void *mem_ctx);
+
+/**
+ * As hash_table_foreach(), safe against removing the current entry but not
+ * against insertion.
+ */
+#define swiss_table_foreach(ht, entry)                                      \
+   for (struct hash_entry *entry = _mesa_swiss_table_next_entry(ht, NULL);  \
+        entry != NULL;                                                      \
+        entry = _mesa_swiss_table_next_entry(ht, entry))
+
+#ifdef __cplusplus
+} /* extern C */
+#endif
+
+#endif /* _SWISS_TABLE_H */
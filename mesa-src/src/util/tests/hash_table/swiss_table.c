@@ -0,0 +1,161 @@
+/*
+ * Copyright © 2026 Mesa contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#undef NDEBUG
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "swiss_table.h"
+
+#define SIZE 10000
+
+static uint32_t
+key_value(const void *key)
+{
+   return *(const uint32_t *)key;
+}
+
+/* Few distinct hashes, so that groups fill up and probing goes on */
+static uint32_t
+collide_hash(const void *key)
+{
+   return key_value(key) & 0xf;
+}
+
+static bool
+uint32_t_key_equals(const void *a, const void *b)
+{
+   return key_value(a) == key_value(b);
+}
+
+static void
+check_table(struct swiss_table *ht)
+{
+   uint32_t keys[SIZE];
+   struct hash_entry *entry;
+   uint32_t i, count;
+
+   for (i = 0; i < SIZE; i++) {
+      keys[i] = i;
+      _mesa_swiss_table_insert(ht, keys + i, (void *)(uintptr_t)i);
+   }
+   assert(_mesa_swiss_table_num_entries(ht) == SIZE);
+
+   for (i = 0; i < SIZE; i++) {
+      entry = _mesa_swiss_table_search(ht, keys + i);
+      assert(entry);
+      assert(key_value(entry->key) == i);
+      assert(entry->data == (void *)(uintptr_t)i);
+   }
+
+   /* Replacement keeps a single entry */
+   _mesa_swiss_table_insert(ht, keys + 1, NULL);
+   assert(_mesa_swiss_table_num_entries(ht) == SIZE);
+   assert(_mesa_swiss_table_search(ht, keys + 1)->data == NULL);
+
+   /* Remove the odd keys while iterating */
+   count = 0;
+   swiss_table_foreach(ht, entry) {
+      if (key_value(entry->key) & 1)
+         _mesa_swiss_table_remove(ht, entry);
+      count++;
+   }
+   assert(count == SIZE);
+   assert(_mesa_swiss_table_num_entries(ht) == SIZE / 2);
+
+   for (i = 0; i < SIZE; i++) {
+      entry = _mesa_swiss_table_search(ht, keys + i);
+      assert((entry != NULL) == !(i & 1));
+   }
+
+   /* Reinsert over the tombstones */
+   for (i = 1; i < SIZE; i += 2)
+      _mesa_swiss_table_insert(ht, keys + i, NULL);
+   assert(_mesa_swiss_table_num_entries(ht) == SIZE);
+
+   for (i = 0; i < SIZE; i++)
+      assert(_mesa_swiss_table_search(ht, keys + i));
+
+   _mesa_swiss_table_clear(ht, NULL);
+   assert(_mesa_swiss_table_num_entries(ht) == 0);
+   assert(_mesa_swiss_table_next_entry(ht, NULL) == NULL);
+   assert(_mesa_swiss_table_search(ht, keys) == NULL);
+}
+
+int
+main(int argc, char **argv)
+{
+   struct swiss_table *ht, *clone;
+   struct hash_entry *entry;
+   uint32_t keys[64];
+   uint32_t i;
+
+   (void) argc;
+   (void) argv;
+
+   ht = _mesa_swiss_table_create(NULL, key_value, uint32_t_key_equals);
+   check_table(ht);
+   _mesa_swiss_table_destroy(ht, NULL);
+
+   ht = _mesa_swiss_table_create(NULL, collide_hash, uint32_t_key_equals);
+   check_table(ht);
+   _mesa_swiss_table_destroy(ht, NULL);
+
+   /* Churn a small table, removing and inserting without growing it */
+   ht = _mesa_swiss_table_create(NULL, collide_hash, uint32_t_key_equals);
+   for (i = 0; i < ARRAY_SIZE(keys); i++)
+      keys[i] = i;
+   for (i = 0; i < 100 * ARRAY_SIZE(keys); i++) {
+      const uint32_t *key = keys + i % ARRAY_SIZE(keys);
+
+      if (i % ARRAY_SIZE(keys) < 8)
+         _mesa_swiss_table_insert(ht, key, NULL);
+      else
+         _mesa_swiss_table_remove_key(ht, key);
+      assert(_mesa_swiss_table_num_entries(ht) <= 8);
+   }
+   for (i = 0; i < 8; i++)
+      assert(_mesa_swiss_table_search(ht, keys + i));
+
+   clone = _mesa_swiss_table_clone(ht, NULL);
+   _mesa_swiss_table_destroy(ht, NULL);
+   assert(_mesa_swiss_table_num_entries(clone) == 8);
+   for (i = 0; i < 8; i++) {
+      entry = _mesa_swiss_table_search(clone, keys + i);
+      assert(entry && key_value(entry->key) == i);
+   }
+   _mesa_swiss_table_destroy(clone, NULL);
+
+   /* NULL is an ordinary key */
+   ht = _mesa_pointer_swiss_table_create(NULL);
+   _mesa_swiss_table_insert(ht, NULL, keys);
+   assert(_mesa_swiss_table_search(ht, NULL)->data == keys);
+   _mesa_swiss_table_remove_key(ht, NULL);
+   assert(_mesa_swiss_table_search(ht, NULL) == NULL);
+   _mesa_swiss_table_destroy(ht, NULL);
+
+   return 0;
+}
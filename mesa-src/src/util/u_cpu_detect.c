@@ -65,6 +65,9 @@
 #include <signal.h>
 #include <fcntl.h>
 #include <elf.h>
+#if defined(PIPE_ARCH_AARCH64)
+#include <sys/prctl.h>
+#endif
 #endif
 
 #ifdef PIPE_OS_UNIX
@@ -426,6 +429,36 @@ static void
 check_os_arm_support(void)
 {
     util_cpu_caps.has_neon = true;
+
+#if defined(PIPE_OS_LINUX)
+    Elf64_auxv_t aux;
+    int fd;
+
+    fd = open("/proc/self/auxv", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+       while (read(fd, &aux, sizeof(Elf64_auxv_t)) == sizeof(Elf64_auxv_t)) {
+          if (aux.a_type == AT_HWCAP) {
+             uint64_t hwcap = aux.a_un.a_val;
+
+             /* HWCAP_SVE */
+             util_cpu_caps.has_sve = (hwcap >> 22) & 1;
+             break;
+          }
+       }
+       close (fd);
+    }
+
+#if defined(PR_SVE_GET_VL)
+    if (util_cpu_caps.has_sve) {
+       /* The vector length is in bytes, and may be smaller than the
+        * hardware's if the kernel was told so.
+        */
+       int vl = prctl(PR_SVE_GET_VL);
+       if (vl > 0)
+          util_cpu_caps.sve_vector_bits = (vl & PR_SVE_VL_LEN_MASK) * 8;
+    }
+#endif
+#endif /* PIPE_OS_LINUX */
 }
 #endif /* PIPE_ARCH_ARM || PIPE_ARCH_AARCH64 */
 
@@ -632,6 +665,8 @@ util_cpu_detect_once(void)
       debug_printf("util_cpu_caps.has_altivec = %u\n", util_cpu_caps.has_altivec);
       debug_printf("util_cpu_caps.has_vsx = %u\n", util_cpu_caps.has_vsx);
       debug_printf("util_cpu_caps.has_neon = %u\n", util_cpu_caps.has_neon);
+      debug_printf("util_cpu_caps.has_sve = %u\n", util_cpu_caps.has_sve);
+      debug_printf("util_cpu_caps.sve_vector_bits = %u\n", util_cpu_caps.sve_vector_bits);
       debug_printf("util_cpu_caps.has_daz = %u\n", util_cpu_caps.has_daz);
       debug_printf("util_cpu_caps.has_avx512f = %u\n", util_cpu_caps.has_avx512f);
       debug_printf("util_cpu_caps.has_avx512dq = %u\n", util_cpu_caps.has_avx512dq);
@@ -51,6 +51,7 @@ struct util_cpu_caps {
    int x86_cpu_type;
    unsigned cacheline;
    unsigned cores_per_L3;
+   unsigned sve_vector_bits;
 
    unsigned has_intel:1;
    unsigned has_tsc:1;
@@ -74,6 +75,7 @@ struct util_cpu_caps {
    unsigned has_vsx:1;
    unsigned has_daz:1;
    unsigned has_neon:1;
+   unsigned has_sve:1;
 
    unsigned has_avx512f:1;
    unsigned has_avx512dq:1;
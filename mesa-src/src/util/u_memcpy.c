@@ -0,0 +1,85 @@
+/*
+ * Copyright © 2026 Mesa contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <stdint.h>
+
+#include "macros.h"
+#include "u_memcpy.h"
+
+#if defined(__SSE2__) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2)) || defined(_M_X64)
+#include <emmintrin.h>
+#define U_MEMCPY_SSE2
+#endif
+
+void
+util_streaming_store_memcpy(void *restrict dst, const void *restrict src,
+                            size_t len)
+{
+#ifdef U_MEMCPY_SSE2
+   char *restrict d = dst;
+   const char *restrict s = src;
+
+   /* memcpy() up to the first 16-byte boundary of <d>; MOVNTDQ only takes
+    * aligned destinations, the source is read with unaligned loads.
+    */
+   if ((uintptr_t)d & 15) {
+      size_t head = MIN2(16 - ((uintptr_t)d & 15), len);
+
+      memcpy(d, s, head);
+      d += head;
+      s += head;
+      len -= head;
+   }
+
+   while (len >= 64) {
+      __m128i *dst_cacheline = (__m128i *)d;
+      const __m128i *src_cacheline = (const __m128i *)s;
+
+      __m128i temp1 = _mm_loadu_si128(src_cacheline + 0);
+      __m128i temp2 = _mm_loadu_si128(src_cacheline + 1);
+      __m128i temp3 = _mm_loadu_si128(src_cacheline + 2);
+      __m128i temp4 = _mm_loadu_si128(src_cacheline + 3);
+
+      _mm_stream_si128(dst_cacheline + 0, temp1);
+      _mm_stream_si128(dst_cacheline + 1, temp2);
+      _mm_stream_si128(dst_cacheline + 2, temp3);
+      _mm_stream_si128(dst_cacheline + 3, temp4);
+
+      d += 64;
+      s += 64;
+      len -= 64;
+   }
+
+   /* memcpy() the tail. */
+   if (len)
+      memcpy(d, s, len);
+
+   /* Non-temporal stores are weakly ordered: make them visible before
+    * whatever tells another thread the data is there.
+    */
+   _mm_sfence();
+#else
+   memcpy(dst, src, len);
+#endif
+}
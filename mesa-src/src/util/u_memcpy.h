@@ -0,0 +1,71 @@
+/*
+ * Copyright © 2026 Mesa contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * Copies for uploads: data the CPU hands to the driver and will not read
+ * back soon, so it need not go through the cache on the way.
+ */
+
+#ifndef U_MEMCPY_H
+#define U_MEMCPY_H
+
+#include <stddef.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Copies of at least this many bytes mostly miss in the cache anyway, and
+ * leave it full of data the CPU is done with.
+ */
+#define UTIL_STREAMING_STORE_MIN_SIZE (2 * 1024 * 1024)
+
+/**
+ * Copies memory from src to dst with non-temporal stores where the CPU has
+ * them, followed by a store fence, so the copy neither reads nor keeps the
+ * destination's cache lines.
+ */
+void
+util_streaming_store_memcpy(void *restrict dst, const void *restrict src,
+                            size_t len);
+
+/**
+ * memcpy() for uploads, streaming the big ones.
+ */
+static inline void
+util_upload_memcpy(void *restrict dst, const void *restrict src, size_t len)
+{
+   if (len >= UTIL_STREAMING_STORE_MIN_SIZE)
+      util_streaming_store_memcpy(dst, src, len);
+   else
+      memcpy(dst, src, len);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* U_MEMCPY_H */
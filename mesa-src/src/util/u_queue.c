@@ -29,6 +29,7 @@
 #include "c11/threads.h"
 
 #include "util/os_time.h"
+#include "util/u_math.h"
 #include "util/u_string.h"
 #include "util/u_thread.h"
 #include "u_process.h"
@@ -234,6 +235,233 @@ util_queue_fence_destroy(struct util_queue_fence *fence)
 }
 #endif
 
+/****************************************************************************
+ * Lock-free ring for UTIL_QUEUE_INIT_LOCKLESS
+ *
+ * A bounded multi-producer multi-consumer ring (D. Vyukov's design): every
+ * cell carries a sequence number telling whose turn it is. A producer owns
+ * cell "pos" when its sequence equals pos, a consumer when it equals pos + 1.
+ * Claiming a cell is a single compare-and-swap on the shared position, after
+ * which the owner fills or drains the cell and hands it on by storing the
+ * next sequence number.
+ *
+ * Threads that find the ring empty (consumers) or full (producers) park on a
+ * futex word that the other side bumps after each operation. The waiter
+ * samples the word before trying, so a bump that races with going to sleep
+ * makes futex_wait return immediately and no wakeup is lost. The waker, not
+ * the sleeper, takes a parked thread off the waiter count, so that a thread
+ * which was woken but hasn't run yet doesn't cost every following operation
+ * another syscall. The count can be left too high by a futex_wait that
+ * returned early, which costs one spurious wake and nothing else.
+ */
+
+#if UTIL_FUTEX_SUPPORTED
+
+struct util_queue_cell {
+   uint32_t seq;
+   struct util_queue_job job;
+};
+
+struct util_queue_ring {
+   /* Written by producers. */
+   uint32_t enqueue_pos;
+   uint32_t queued_seq; /* futex, bumped after every enqueue */
+   uint32_t num_waiting_producers;
+   char pad0[64 - 3 * sizeof(uint32_t)];
+
+   /* Written by consumers. */
+   uint32_t dequeue_pos;
+   uint32_t space_seq; /* futex, bumped after every dequeue */
+   uint32_t num_waiting_consumers;
+   char pad1[64 - 3 * sizeof(uint32_t)];
+
+   uint32_t mask;
+   struct util_queue_cell *cells;
+};
+
+static struct util_queue_ring *
+util_queue_ring_create(unsigned max_jobs)
+{
+   struct util_queue_ring *ring = calloc(1, sizeof(*ring));
+   if (!ring)
+      return NULL;
+
+   unsigned size = util_next_power_of_two(MAX2(max_jobs, 2));
+
+   ring->cells = calloc(size, sizeof(*ring->cells));
+   if (!ring->cells) {
+      free(ring);
+      return NULL;
+   }
+
+   for (unsigned i = 0; i < size; i++)
+      ring->cells[i].seq = i;
+   ring->mask = size - 1;
+   return ring;
+}
+
+static void
+util_queue_ring_destroy(struct util_queue_ring *ring)
+{
+   free(ring->cells);
+   free(ring);
+}
+
+static bool
+util_queue_ring_push(struct util_queue_ring *ring,
+                     const struct util_queue_job *job)
+{
+   uint32_t pos = p_atomic_read(&ring->enqueue_pos);
+   struct util_queue_cell *cell;
+
+   while (1) {
+      cell = &ring->cells[pos & ring->mask];
+      int32_t diff = (int32_t)(p_atomic_read(&cell->seq) - pos);
+
+      if (diff == 0) {
+         uint32_t old = p_atomic_cmpxchg(&ring->enqueue_pos, pos, pos + 1);
+         if (old == pos)
+            break;
+         pos = old;
+      } else if (diff < 0) {
+         return false; /* full */
+      } else {
+         pos = p_atomic_read(&ring->enqueue_pos);
+      }
+   }
+
+   cell->job = *job;
+   p_atomic_set(&cell->seq, pos + 1);
+   return true;
+}
+
+static bool
+util_queue_ring_pop(struct util_queue_ring *ring, struct util_queue_job *job)
+{
+   uint32_t pos = p_atomic_read(&ring->dequeue_pos);
+   struct util_queue_cell *cell;
+
+   while (1) {
+      cell = &ring->cells[pos & ring->mask];
+      int32_t diff = (int32_t)(p_atomic_read(&cell->seq) - (pos + 1));
+
+      if (diff == 0) {
+         uint32_t old = p_atomic_cmpxchg(&ring->dequeue_pos, pos, pos + 1);
+         if (old == pos)
+            break;
+         pos = old;
+      } else if (diff < 0) {
+         return false; /* empty */
+      } else {
+         pos = p_atomic_read(&ring->dequeue_pos);
+      }
+   }
+
+   *job = cell->job;
+   p_atomic_set(&cell->seq, pos + ring->mask + 1);
+   return true;
+}
+
+/* Signal the fences of all jobs left in the ring, used once all threads have
+ * been terminated.
+ */
+static void
+util_queue_ring_drain(struct util_queue_ring *ring)
+{
+   struct util_queue_job job;
+
+   while (util_queue_ring_pop(ring, &job))
+      util_queue_fence_signal(job.fence);
+}
+
+/* Wake one of the threads parked on "*seq", if there are any. */
+static inline void
+util_queue_ring_wake_one(uint32_t *seq, uint32_t *num_waiting)
+{
+   uint32_t n = p_atomic_read(num_waiting);
+
+   while (n) {
+      uint32_t old = p_atomic_cmpxchg(num_waiting, n, n - 1);
+      if (old == n) {
+         futex_wake(seq, 1);
+         return;
+      }
+      n = old;
+   }
+}
+
+static void
+util_queue_ring_add_job(struct util_queue *queue,
+                        const struct util_queue_job *job)
+{
+   struct util_queue_ring *ring = queue->ring;
+
+   while (1) {
+      uint32_t seq = p_atomic_read(&ring->space_seq);
+
+      if (util_queue_ring_push(ring, job))
+         break;
+
+      /* Wait until there is a free slot. */
+      p_atomic_inc(&ring->num_waiting_producers);
+      futex_wait(&ring->space_seq, seq, NULL);
+   }
+
+   p_atomic_inc(&ring->queued_seq);
+   util_queue_ring_wake_one(&ring->queued_seq, &ring->num_waiting_consumers);
+
+   /* The threads may have been terminated while we were pushing, in which
+    * case nobody else is going to signal the fence.
+    */
+   if (unlikely(p_atomic_read(&queue->num_threads) == 0))
+      util_queue_ring_drain(ring);
+}
+
+static void
+util_queue_ring_thread_loop(struct util_queue *queue, int thread_index)
+{
+   struct util_queue_ring *ring = queue->ring;
+
+   while (1) {
+      struct util_queue_job job;
+      uint32_t seq = p_atomic_read(&ring->queued_seq);
+
+      /* only kill threads that are above "num_threads" */
+      if (thread_index >= p_atomic_read(&queue->num_threads))
+         break;
+
+      /* wait if the queue is empty */
+      if (!util_queue_ring_pop(ring, &job)) {
+         p_atomic_inc(&ring->num_waiting_consumers);
+         futex_wait(&ring->queued_seq, seq, NULL);
+         continue;
+      }
+
+      p_atomic_inc(&ring->space_seq);
+      util_queue_ring_wake_one(&ring->space_seq, &ring->num_waiting_producers);
+
+      job.execute(job.job, thread_index);
+      util_queue_fence_signal(job.fence);
+      if (job.cleanup)
+         job.cleanup(job.job, thread_index);
+   }
+
+   /* signal remaining jobs if all threads are being terminated */
+   if (p_atomic_read(&queue->num_threads) == 0)
+      util_queue_ring_drain(ring);
+}
+
+/* Wake up all parked threads so that they re-check num_threads. */
+static void
+util_queue_ring_wake_all(struct util_queue_ring *ring)
+{
+   p_atomic_inc(&ring->queued_seq);
+   p_atomic_set(&ring->num_waiting_consumers, 0);
+   futex_wake(&ring->queued_seq, INT_MAX);
+}
+
+#endif /* UTIL_FUTEX_SUPPORTED */
+
 /****************************************************************************
  * util_queue implementation
  */
@@ -278,6 +506,13 @@ util_queue_thread_func(void *input)
       u_thread_setname(name);
    }
 
+#if UTIL_FUTEX_SUPPORTED
+   if (queue->ring) {
+      util_queue_ring_thread_loop(queue, thread_index);
+      return 0;
+   }
+#endif
+
    while (1) {
       struct util_queue_job job;
 
@@ -315,8 +550,9 @@ util_queue_thread_func(void *input)
    /* signal remaining jobs if all threads are being terminated */
    mtx_lock(&queue->lock);
    if (queue->num_threads == 0) {
-      for (unsigned i = queue->read_idx; i != queue->write_idx;
-           i = (i + 1) % queue->max_jobs) {
+      /* read_idx == write_idx also when the ring is full */
+      for (unsigned n = 0, i = queue->read_idx; n < queue->num_queued;
+           n++, i = (i + 1) % queue->max_jobs) {
          if (queue->jobs[i].job) {
             util_queue_fence_signal(queue->jobs[i].fence);
             queue->jobs[i].job = NULL;
@@ -386,7 +622,7 @@ util_queue_adjust_num_threads(struct util_queue *queue, unsigned num_threads)
     * We need to update num_threads first, because threads terminate
     * when thread_index < num_threads.
     */
-   queue->num_threads = num_threads;
+   p_atomic_set(&queue->num_threads, num_threads);
    for (unsigned i = old_num_threads; i < num_threads; i++) {
       if (!util_queue_create_thread(queue, i))
          break;
@@ -448,6 +684,15 @@ util_queue_init(struct util_queue *queue,
    cnd_init(&queue->has_queued_cond);
    cnd_init(&queue->has_space_cond);
 
+#if UTIL_FUTEX_SUPPORTED
+   if (flags & UTIL_QUEUE_INIT_LOCKLESS &&
+       !(flags & UTIL_QUEUE_INIT_RESIZE_IF_FULL)) {
+      queue->ring = util_queue_ring_create(max_jobs);
+      if (!queue->ring)
+         goto fail;
+   }
+#endif
+
    queue->threads = (thrd_t*) calloc(num_threads, sizeof(thrd_t));
    if (!queue->threads)
       goto fail;
@@ -478,6 +723,10 @@ fail:
       mtx_destroy(&queue->lock);
       free(queue->jobs);
    }
+#if UTIL_FUTEX_SUPPORTED
+   if (queue->ring)
+      util_queue_ring_destroy(queue->ring);
+#endif
    /* also util_queue_is_initialized can be used to check for success */
    memset(queue, 0, sizeof(*queue));
    return false;
@@ -503,9 +752,13 @@ util_queue_kill_threads(struct util_queue *queue, unsigned keep_num_threads,
    /* Setting num_threads is what causes the threads to terminate.
     * Then cnd_broadcast wakes them up and they will exit their function.
     */
-   queue->num_threads = keep_num_threads;
+   p_atomic_set(&queue->num_threads, keep_num_threads);
    cnd_broadcast(&queue->has_queued_cond);
    mtx_unlock(&queue->lock);
+#if UTIL_FUTEX_SUPPORTED
+   if (queue->ring)
+      util_queue_ring_wake_all(queue->ring);
+#endif
 
    for (i = keep_num_threads; i < old_num_threads; i++)
       thrd_join(queue->threads[i], NULL);
@@ -526,6 +779,10 @@ util_queue_destroy(struct util_queue *queue)
    mtx_destroy(&queue->lock);
    free(queue->jobs);
    free(queue->threads);
+#if UTIL_FUTEX_SUPPORTED
+   if (queue->ring)
+      util_queue_ring_destroy(queue->ring);
+#endif
 }
 
 void
@@ -538,6 +795,25 @@ util_queue_add_job(struct util_queue *queue,
 {
    struct util_queue_job *ptr;
 
+#if UTIL_FUTEX_SUPPORTED
+   if (queue->ring) {
+      if (p_atomic_read(&queue->num_threads) == 0)
+         return;
+
+      util_queue_fence_reset(fence);
+
+      struct util_queue_job ring_job = {
+         .job = job,
+         .job_size = job_size,
+         .fence = fence,
+         .execute = execute,
+         .cleanup = cleanup,
+      };
+      util_queue_ring_add_job(queue, &ring_job);
+      return;
+   }
+#endif
+
    mtx_lock(&queue->lock);
    if (queue->num_threads == 0) {
       mtx_unlock(&queue->lock);
@@ -607,7 +883,8 @@ util_queue_add_job(struct util_queue *queue,
  * the queue. If the job has started execution, the function waits for it to
  * complete.
  *
- * In all cases, the fence is signalled when the function returns.
+ * In all cases, the fence is signalled when the function returns. Queues
+ * created with UTIL_QUEUE_INIT_LOCKLESS always wait for the job.
  *
  * The function can be used when destroying an object associated with the job
  * when you don't care about the job completion state.
@@ -620,6 +897,14 @@ util_queue_drop_job(struct util_queue *queue, struct util_queue_fence *fence)
    if (util_queue_fence_is_signalled(fence))
       return;
 
+   /* Cells of the lock-free ring can't be cleared behind the consumers'
+    * back, so just let the job run.
+    */
+   if (queue->ring) {
+      util_queue_fence_wait(fence);
+      return;
+   }
+
    mtx_lock(&queue->lock);
    for (unsigned i = queue->read_idx; i != queue->write_idx;
         i = (i + 1) % queue->max_jobs) {
@@ -49,6 +49,11 @@ extern "C" {
 #define UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY      (1 << 0)
 #define UTIL_QUEUE_INIT_RESIZE_IF_FULL            (1 << 1)
 #define UTIL_QUEUE_INIT_SET_FULL_THREAD_AFFINITY  (1 << 2)
+/* Use a lock-free ring and futex parking instead of the mutex and condition
+ * variables. Ignored without futex support or with RESIZE_IF_FULL. With it,
+ * util_queue_drop_job waits for the job instead of removing it.
+ */
+#define UTIL_QUEUE_INIT_LOCKLESS                  (1 << 3)
 
 #if UTIL_FUTEX_SUPPORTED
 #define UTIL_QUEUE_FENCE_FUTEX
@@ -216,6 +221,11 @@ struct util_queue {
    size_t total_jobs_size;  /* memory use of all jobs in the queue */
    struct util_queue_job *jobs;
 
+   /* non-NULL if UTIL_QUEUE_INIT_LOCKLESS is in effect, the fields above
+    * except threads, num_threads and finish_lock are then unused
+    */
+   struct util_queue_ring *ring;
+
    /* for cleanup at exit(), protected by exit_mutex */
    struct list_head head;
 };
@@ -0,0 +1,132 @@
+/*
+ * Copyright © 2026 Mesa contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/* Force assertions, even on release builds. */
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "u_queue.h"
+
+#define NUM_PRODUCERS 4
+#define JOBS_PER_PRODUCER 20000
+#define BATCH 64
+
+struct producer {
+   thrd_t thread;
+   struct util_queue *queue;
+   struct util_queue_fence fences[BATCH];
+};
+
+static uint32_t executed;
+static uint32_t cleaned_up;
+
+static void
+count_execute(void *job, int thread_index)
+{
+   p_atomic_inc(&executed);
+}
+
+static void
+count_cleanup(void *job, int thread_index)
+{
+   p_atomic_inc(&cleaned_up);
+}
+
+static int
+producer_func(void *data)
+{
+   struct producer *p = data;
+
+   for (unsigned i = 0; i < JOBS_PER_PRODUCER; i++) {
+      struct util_queue_fence *fence = &p->fences[i % BATCH];
+
+      util_queue_fence_wait(fence);
+      util_queue_add_job(p->queue, p, fence, count_execute, count_cleanup, 0);
+   }
+
+   for (unsigned i = 0; i < BATCH; i++)
+      util_queue_fence_wait(&p->fences[i]);
+   return 0;
+}
+
+static void
+test_queue(unsigned flags)
+{
+   struct util_queue queue;
+   struct producer producers[NUM_PRODUCERS];
+
+   executed = 0;
+   cleaned_up = 0;
+
+   /* A small ring so that producers regularly find it full. */
+   bool ok = util_queue_init(&queue, "test", 8, 3, flags);
+   assert(ok);
+
+   for (unsigned i = 0; i < NUM_PRODUCERS; i++) {
+      producers[i].queue = &queue;
+      for (unsigned j = 0; j < BATCH; j++)
+         util_queue_fence_init(&producers[i].fences[j]);
+      producers[i].thread = u_thread_create(producer_func, &producers[i]);
+   }
+
+   for (unsigned i = 0; i < NUM_PRODUCERS; i++)
+      thrd_join(producers[i].thread, NULL);
+
+   util_queue_finish(&queue);
+   assert(executed == NUM_PRODUCERS * JOBS_PER_PRODUCER);
+   assert(cleaned_up == NUM_PRODUCERS * JOBS_PER_PRODUCER);
+
+   /* Thread count changes must not lose jobs. */
+   util_queue_adjust_num_threads(&queue, 1);
+   util_queue_fence_wait(&producers[0].fences[0]);
+   util_queue_add_job(&queue, &queue, &producers[0].fences[0], count_execute,
+                      NULL, 0);
+   util_queue_drop_job(&queue, &producers[0].fences[0]);
+   assert(util_queue_fence_is_signalled(&producers[0].fences[0]));
+   util_queue_adjust_num_threads(&queue, 3);
+
+   /* Destroying the queue signals everything still queued. */
+   for (unsigned i = 0; i < 8; i++) {
+      util_queue_add_job(&queue, &queue, &producers[1].fences[i],
+                         count_execute, NULL, 0);
+   }
+   util_queue_destroy(&queue);
+   for (unsigned i = 0; i < 8; i++)
+      assert(util_queue_fence_is_signalled(&producers[1].fences[i]));
+
+   for (unsigned i = 0; i < NUM_PRODUCERS; i++) {
+      for (unsigned j = 0; j < BATCH; j++)
+         util_queue_fence_destroy(&producers[i].fences[j]);
+   }
+}
+
+int
+main(void)
+{
+   test_queue(0);
+   test_queue(UTIL_QUEUE_INIT_LOCKLESS);
+   return 0;
+}
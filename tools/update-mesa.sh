@@ -40,3 +40,153 @@ patch -i patches/3-mesa-issue-2035.diff -p1
 patch -i patches/4-mesa-issue-1020.diff -p1
 patch -i patches/5.diff -p1
 patch -i patches/6.diff -p1
+patch -i patches/7-osmesa-zero-copy.diff -p1
+patch -i patches/8-osmesa-async-frames.diff -p1
+patch -i patches/9-llvmpipe-multiple-scenes.diff -p1
+patch -i patches/10-llvmpipe-lockless-bins.diff -p1
+patch -i patches/11-llvmpipe-thread-affinity.diff -p1
+patch -i patches/12-llvmpipe-rast-per-context.diff -p1
+patch -i patches/13-llvmpipe-adaptive-tile-size.diff -p1
+patch -i patches/14-llvmpipe-fb-sized-bins.diff -p1
+patch -i patches/15-llvmpipe-scene-block-pool.diff -p1
+patch -i patches/16-llvmpipe-scene-streaming.diff -p1
+patch -i patches/17-llvmpipe-variant-hash.diff -p1
+patch -i patches/18-llvmpipe-async-jit.diff -p1
+patch -i patches/19-llvmpipe-generic-fs-variant.diff -p1
+patch -i patches/20-llvmpipe-shader-manifest.diff -p1
+patch -i patches/21-llvmpipe-parallel-variant-compile.diff -p1
+patch -i patches/22-gallivm-shared-code-arena.diff -p1
+patch -i patches/23-llvmpipe-tiered-fs-jit.diff -p1
+patch -i patches/24-llvmpipe-memory-code-cache.diff -p1
+patch -i patches/25-llvmpipe-shader-memory-budget.diff -p1
+patch -i patches/26-disk-cache-archive.diff -p1
+patch -i patches/27-llvmpipe-deferred-tile-clears.diff -p1
+patch -i patches/28-llvmpipe-threaded-binning.diff -p1
+patch -i patches/29-llvmpipe-simd-triangle-setup.diff -p1
+patch -i patches/30-gallivm-avx512.diff -p1
+patch -i patches/31-llvmpipe-tiled-textures.diff -p1
+patch -i patches/32-gallivm-block-cache-all-formats.diff -p1
+patch -i patches/33-gallivm-anisotropic-filtering.diff -p1
+patch -i patches/34-llvmpipe-decompress-textures.diff -p1
+patch -i patches/35-llvmpipe-hierarchical-z.diff -p1
+patch -i patches/36-llvmpipe-z-prepass.diff -p1
+patch -i patches/37-draw-threaded-vertex-shading.diff -p1
+patch -i patches/38-draw-vsplit-set-associative-cache.diff -p1
+patch -i patches/39-draw-instance-batching.diff -p1
+patch -i patches/40-draw-tri-batch.diff -p1
+patch -i patches/41-draw-early-cull.diff -p1
+patch -i patches/42-draw-direct-vertices.diff -p1
+patch -i patches/43-translate-sse-half-1010102.diff -p1
+patch -i patches/44-draw-tess-threads.diff -p1
+patch -i patches/45-draw-gs-output-sizing.diff -p1
+patch -i patches/46-draw-so-discard.diff -p1
+patch -i patches/47-osmesa-glthread.diff -p1
+patch -i patches/48-llvmpipe-threaded-context.diff -p1
+patch -i patches/49-st-direct-readpixels.diff -p1
+patch -i patches/50-sse41-ubyte-swizzle.diff -p1
+patch -i patches/51-readback-to-buffer.diff -p1
+patch -i patches/52-tile-parallel-readback.diff -p1
+patch -i patches/53-lp-texture-subdata.diff -p1
+patch -i patches/54-lp-generate-mipmap.diff -p1
+patch -i patches/55-draw-vertex-replay.diff -p1
+patch -i patches/56-cso-redundant-state-filtering.diff -p1
+patch -i patches/57-parallel-glsl-compile.diff -p1
+patch -i patches/58-lockfree-builtin-lookup.diff -p1
+patch -i patches/59-lp-glsl-optimize-conservatively.diff -p1
+patch -i patches/60-lp-variant-cache-key.diff -p1
+patch -i patches/61-glsl-type-thread-cache.diff -p1
+patch -i patches/62-nir-pass-stats.diff -p1
+patch -i patches/63-nir-linear-arena.diff -p1
+patch -i patches/64-nir-algebraic-skip-stats.diff -p1
+patch -i patches/65-lp-constbuf-cow.diff -p1
+patch -i patches/66-lp-fs-key-cache.diff -p1
+patch -i patches/67-lp-cs-tpool-chunked.diff -p1
+patch -i patches/68-lp-async-compute.diff -p1
+patch -i patches/69-lp-coro-frame-pool.diff -p1
+patch -i patches/70-lp-release-counters.diff -p1
+patch -i patches/71-lp-trace.diff -p1
+patch -i patches/72-lp-fs-profile.diff -p1
+patch -i patches/73-lp-bench.diff -p1
+patch -i patches/74-osmesa-bench.diff -p1
+patch -i patches/75-lp-test-sample.diff -p1
+patch -i patches/76-headless-hud.diff -p1
+patch -i patches/77-osmesa-buffer-cache.diff -p1
+patch -i patches/78-osmesa-resize-in-place.diff -p1
+patch -i patches/79-llvmpipe-huge-pages.diff -p1
+patch -i patches/80-osmesa-context-pool.diff -p1
+patch -i patches/81-osmesa-mrt.diff -p1
+patch -i patches/82-osmesa-user-depth.diff -p1
+patch -i patches/83-pp-cpu-filters.diff -p1
+patch -i patches/84-osmesa-render-format.diff -p1
+patch -i patches/85-dirty-region.diff -p1
+patch -i patches/86-osmesa-shared-buffer.diff -p1
+patch -i patches/87-llvmpipe-msaa-equal-blocks.diff -p1
+patch -i patches/88-lp-binned-resolve.diff -p1
+patch -i patches/89-lp-msaa-8x-16x.diff -p1
+patch -i patches/90-lp-rectangles.diff -p1
+patch -i patches/91-aa-lines-setup.diff -p1
+patch -i patches/92-lp-render-cond-predicate.diff -p1
+patch -i patches/93-lp-blend-packed-unorm.diff -p1
+patch -i patches/94-gallivm-srgb-neon.diff -p1
+patch -i patches/95-lp-lazy-inputs.diff -p1
+patch -i patches/96-avx2-tri-32-3.diff -p1
+patch -i patches/97-swiss-table.diff -p1
+patch -i patches/98-cso-shared-cache.diff -p1
+patch -i patches/99-util-queue-lockless.diff -p1
+patch -i patches/100-slab-mt-pool.diff -p1
+patch -i patches/101-disk-cache-fast-keys.diff -p1
+patch -i patches/102-disk-cache-lru-index.diff -p1
+patch -i patches/103-disk-cache-bundles.diff -p1
+patch -i patches/104-draw-restart-runs.diff -p1
+patch -i patches/105-translate-sse-avx2.diff -p1
+patch -i patches/106-streaming-store-memcpy.diff -p1
+patch -i patches/107-nir-soa-divergence.diff -p1
+patch -i patches/108-masked-gather-scatter.diff -p1
+patch -i patches/109-lp-subgroup-ops.diff -p1
+patch -i patches/110-nir-skip-inactive-bodies.diff -p1
+patch -i patches/111-lp-fs-8x8.diff -p1
+patch -i patches/112-lp-inline-uniforms.diff -p1
+patch -i patches/113-lp-const-texture-size.diff -p1
+patch -i patches/114-lp-blit-tiles.diff -p1
+patch -i patches/115-lp-spans.diff -p1
+patch -i patches/116-gallivm-mul-norm-exact.diff -p1
+patch -i patches/117-st-direct-drawpixels.diff -p1
+patch -i patches/118-st-select-hits.diff -p1
+patch -i patches/119-mesa-accum-tables.diff -p1
+patch -i patches/120-vbo-upgrade-in-place.diff -p1
+patch -i patches/121-st-parallel-decompress.diff -p1
+patch -i patches/122-texcompress-threads.diff -p1
+patch -i patches/123-ff-shared-programs.diff -p1
+patch -i patches/124-vbo-save-merge-lists.diff -p1
+patch -i patches/125-lp-deferred-fences.diff -p1
+patch -i patches/126-lp-time-elapsed-queries.diff -p1
+patch -i patches/127-osmesa-swr-backend.diff -p1
+patch -i patches/128-lp-pipeline-scenes.diff -p1
+patch -i patches/129-lp-scene-aligned-blocks.diff -p1
+patch -i patches/130-sp-set-assoc-tile-caches.diff -p1
+patch -i patches/131-sp-band-threads.diff -p1
+patch -i patches/132-tgsi-exec-predecoded.diff -p1
+patch -i patches/133-val-cso-cache.diff -p1
+patch -i patches/134-val-precompile-fs.diff -p1
+patch -i patches/135-val-pipeline-cache-code.diff -p1
+patch -i patches/136-render-pass-dont-care-zs-store.diff -p1
+patch -i patches/137-lp-tile-local-buffers.diff -p1
+patch -i patches/138-osmesa-transient-depth-stencil.diff -p1
+patch -i patches/139-lp-scene-resource-table.diff -p1
+patch -i patches/140-lp-texture-renames.diff -p1
+patch -i patches/141-lp-spin-wait.diff -p1
+patch -i patches/142-lp-rast-scene-threads.diff -p1
+patch -i patches/143-osmesa-render-regions.diff -p1
+patch -i patches/144-osmesa-progress-callback.diff -p1
+patch -i patches/145-lp-layer-bins.diff -p1
+patch -i patches/146-draw-multi-indirect.diff -p1
+patch -i patches/147-lp-memory-import.diff -p1
+patch -i patches/148-lp-sparse-resources.diff -p1
+patch -i patches/149-gallivm-shadow-pair-fetch.diff -p1
+patch -i patches/150-gallivm-shared-tex-funcs.diff -p1
+patch -i patches/151-gallivm-aos-sampling-more-cases.diff -p1
+patch -i patches/152-gallivm-aarch64-neon-sve.diff -p1
+patch -i patches/153-st-mesa-user-vertex-buffers-direct.diff -p1
+patch -i patches/154-llvmpipe-memory-accounting.diff -p1
+patch -i patches/155-llvmpipe-lazy-llvm-startup.diff -p1
+patch -i patches/156-llvmpipe-conservative-raster.diff -p1